@@ -135,6 +135,13 @@ static uint16_t pm1_enable, pm1_status;
  */
 static uint16_t pm1_control;
 
+/*
+ * General Purpose Event Registers
+ *
+ * GPE0 only, for the events the DM raises at runtime, e.g. CPU hotplug.
+ */
+static uint8_t gpe0_enable, gpe0_status;
+
 static void
 sci_update(struct vmctx *ctx)
 {
@@ -159,6 +166,8 @@ sci_update(struct vmctx *ctx)
 		need_sci = 1;
 	if ((pm1_enable & PM1_RTC_EN) && (pm1_status & PM1_RTC_STS))
 		need_sci = 1;
+	if (gpe0_enable & gpe0_status)
+		need_sci = 1;
 	if (need_sci)
 		sci_assert(ctx);
 	else
@@ -288,6 +297,43 @@ pm1_control_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 INOUT_PORT(pm1_control, VIRTUAL_PM1A_CNT_ADDR, IOPORT_F_INOUT, pm1_control_handler);
 SYSRES_IO(PM1A_EVT_ADDR, 8);
 
+static int
+gpe0_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
+	     uint32_t *eax, void *arg)
+{
+	uint8_t *reg = (port == GPE0_BLK_ADDR) ? &gpe0_status : &gpe0_enable;
+
+	if (bytes != 1)
+		return -1;
+
+	pthread_mutex_lock(&pm_lock);
+	if (in)
+		*eax = *reg;
+	else {
+		/* a status bit is cleared by writing 1 to it */
+		if (port == GPE0_BLK_ADDR)
+			gpe0_status &= ~*eax;
+		else
+			gpe0_enable = *eax;
+		sci_update(ctx);
+	}
+	pthread_mutex_unlock(&pm_lock);
+
+	return 0;
+}
+INOUT_PORT(gpe0_status, GPE0_BLK_ADDR, IOPORT_F_INOUT, gpe0_handler);
+INOUT_PORT(gpe0_enable, GPE0_BLK_ADDR + 1, IOPORT_F_INOUT, gpe0_handler);
+SYSRES_IO(GPE0_BLK_ADDR, GPE0_BLK_LEN);
+
+void
+inject_gpe_event(struct vmctx *ctx, int gpe)
+{
+	pthread_mutex_lock(&pm_lock);
+	gpe0_status |= (1 << gpe);
+	sci_update(ctx);
+	pthread_mutex_unlock(&pm_lock);
+}
+
 /*
  * ACPI SMI Command Register
  *
@@ -100,6 +100,17 @@ static void register_socket_message_handlers(struct vmctx *ctx)
 	register_command_handler(user_vm_destroy_handler, &arg, DESTROY);
 	register_command_handler(user_vm_blkrescan_handler, &arg, BLKRESCAN);
 	register_command_handler(user_vm_register_vm_event_client_handler, &arg, REGISTER_VM_EVENT_CLIENT);
+	register_command_handler(user_vm_ioreq_latency_handler, &arg, IOREQ_LATENCY);
+	register_command_handler(user_vm_iothread_stats_handler, &arg, IOTHREAD_STATS);
+	register_command_handler(user_vm_launch_timeline_handler, &arg, LAUNCH_TIMELINE);
+	register_command_handler(user_vm_blk_stats_handler, &arg, BLK_STATS);
+	register_command_handler(user_vm_snapshot_handler, &arg, SNAPSHOT);
+	register_command_handler(user_vm_vssram_stats_handler, &arg, VSSRAM_STATS);
+	register_command_handler(user_vm_vtcon_stats_handler, &arg, VTCON_STATS);
+	register_command_handler(user_vm_dev_stats_handler, &arg, DEV_STATS);
+	register_command_handler(user_vm_dev_tune_handler, &arg, DEV_TUNE);
+	register_command_handler(user_vm_cpu_hotplug_handler, &arg, CPU_HOTPLUG);
+	register_command_handler(user_vm_vm_events_handler, &arg, VM_EVENTS);
 }
 
 int init_cmd_monitor(struct vmctx *ctx)
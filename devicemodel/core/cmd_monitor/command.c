@@ -27,6 +27,17 @@
 	GEN_CMD_OBJ(DESTROY), \
 	GEN_CMD_OBJ(BLKRESCAN), \
 	GEN_CMD_OBJ(REGISTER_VM_EVENT_CLIENT), \
+	GEN_CMD_OBJ(IOREQ_LATENCY), \
+	GEN_CMD_OBJ(IOTHREAD_STATS), \
+	GEN_CMD_OBJ(LAUNCH_TIMELINE), \
+	GEN_CMD_OBJ(BLK_STATS), \
+	GEN_CMD_OBJ(SNAPSHOT), \
+	GEN_CMD_OBJ(VSSRAM_STATS), \
+	GEN_CMD_OBJ(VTCON_STATS), \
+	GEN_CMD_OBJ(DEV_STATS), \
+	GEN_CMD_OBJ(DEV_TUNE), \
+	GEN_CMD_OBJ(CPU_HOTPLUG), \
+	GEN_CMD_OBJ(VM_EVENTS), \
 
 struct command dm_command_list[CMDS_NUM] = {CMD_OBJS};
 
@@ -11,8 +11,19 @@
 #define DESTROY "destroy"
 #define BLKRESCAN "blkrescan"
 #define REGISTER_VM_EVENT_CLIENT "register_vm_event_client"
+#define IOREQ_LATENCY "ioreq_latency"
+#define IOTHREAD_STATS "iothread_stats"
+#define LAUNCH_TIMELINE "launch_timeline"
+#define BLK_STATS "blk_stats"
+#define SNAPSHOT "snapshot"
+#define VSSRAM_STATS "vssram_stats"
+#define VTCON_STATS "vtcon_stats"
+#define DEV_STATS "dev_stats"
+#define DEV_TUNE "dev_tune"
+#define CPU_HOTPLUG "cpu_hotplug"
+#define VM_EVENTS "vm_events"
 
-#define CMDS_NUM 3U
+#define CMDS_NUM 14U
 #define CMD_NAME_MAX 32U
 #define CMD_ARG_MAX 320U
 
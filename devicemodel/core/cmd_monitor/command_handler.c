@@ -20,6 +20,17 @@
 #include "vmmapi.h"
 #include "log.h"
 #include "monitor.h"
+#include "ioreq_trace.h"
+#include "iothread.h"
+#include "launch_timeline.h"
+#include "block_if.h"
+#include "snapshot.h"
+#include "vssram.h"
+#include "virtio_console.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "acpi.h"
+#include "vm_event.h"
 
 #define SUCCEEDED 0
 #define FAILED -1
@@ -88,6 +99,11 @@ static int set_vm_event_client(struct socket_client *client)
 	}
 }
 
+bool vm_monitor_has_vm_event_client(void)
+{
+	return vm_event_client != NULL;
+}
+
 int vm_monitor_send_vm_event(const char *msg)
 {
 	int ret = -1;
@@ -96,7 +112,7 @@ int vm_monitor_send_vm_event(const char *msg)
 
 	pthread_mutex_lock(per_client_mutex);
 	client = vm_event_client;
-	if (msg == NULL || client == NULL) {
+	if (msg == NULL || client == NULL || strlen(msg) >= CLIENT_BUF_LEN) {
 		pthread_mutex_unlock(per_client_mutex);
 		return -1;
 	}
@@ -194,3 +210,307 @@ int user_vm_blkrescan_handler(void *arg, void *command_para)
 	}
 	return ret;
 }
+
+/* The reply to IOREQ_LATENCY is the JSON report of the tracer itself. */
+int user_vm_ioreq_latency_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (ioreq_trace_control(cmd_para->option, client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate ioreq latency report.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send ioreq latency report by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_iothread_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (iothread_get_stats(client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate iothread statistics.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send iothread statistics by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_launch_timeline_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (launch_timeline_get(client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate launch timeline.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send launch timeline by socket.\n");
+	}
+	return ret;
+}
+
+/*
+ * The vm_events recorded from the sequence number in the option (0 if none)
+ * on, in one message.
+ */
+int user_vm_vm_events_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+	uint64_t since = 0;
+	char *end;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	if (cmd_para->option[0] != '\0') {
+		since = strtoull(cmd_para->option, &end, 10);
+		if (*end != '\0')
+			return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (vm_event_read(since, client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate vm_events.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send vm_events by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_blk_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (blockif_get_stats(client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate block statistics.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send block statistics by socket.\n");
+	}
+	return ret;
+}
+
+/* Once paused for the snapshot, the VM is powered off, written or not */
+int user_vm_snapshot_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+	bool cmd_completed = false;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	if (cmd_para->option[0] == '\0') {
+		pr_err("No file to write the snapshot to.\n");
+	} else if (vm_snapshot(hdl_arg->ctx_arg, cmd_para->option) == 0) {
+		cmd_completed = true;
+	} else {
+		pr_err("Failed to take a snapshot of the VM.\n");
+	}
+
+	ret = send_socket_ack(sock, cmd_para->fd, cmd_completed);
+	if (ret < 0) {
+		pr_err("Failed to send ACK by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_vssram_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (vssram_get_stats(hdl_arg->ctx_arg, client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate vSSRAM statistics.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send vSSRAM statistics by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_vtcon_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (virtio_console_get_stats(client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate virtio-console statistics.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send virtio-console statistics by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_dev_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	memset(client->buf, 0, CLIENT_BUF_LEN);
+	if (virtio_get_stats(client->buf, CLIENT_BUF_LEN) < 0) {
+		pr_err("Failed to generate device statistics.\n");
+		return send_socket_ack(sock, cmd_para->fd, false);
+	}
+
+	client->len = strlen(client->buf);
+	ret = write_socket_char(client);
+	if (ret < 0) {
+		pr_err("Failed to send device statistics by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_dev_tune_handler(void *arg, void *command_para)
+{
+	int ret = 0;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+	bool cmd_completed = false;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	ret = vm_monitor_dev_tune(cmd_para->option);
+	if (ret >= 0) {
+		cmd_completed = true;
+	} else {
+		pr_err("Failed to tune the device.\n");
+	}
+
+	ret = send_socket_ack(sock, cmd_para->fd, cmd_completed);
+	if (ret < 0) {
+		pr_err("Failed to send ACK by socket.\n");
+	}
+	return ret;
+}
+
+int user_vm_cpu_hotplug_handler(void *arg, void *command_para)
+{
+	int ret = 0;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	struct socket_client *client = NULL;
+	bool cmd_completed = false;
+
+	client = find_socket_client(sock, cmd_para->fd);
+	if (client == NULL)
+		return -1;
+
+	ret = cpu_hotplug_request(hdl_arg->ctx_arg, cmd_para->option);
+	if (ret >= 0) {
+		cmd_completed = true;
+	} else {
+		pr_err("Failed to hot-plug the CPU.\n");
+	}
+
+	ret = send_socket_ack(sock, cmd_para->fd, cmd_completed);
+	if (ret < 0) {
+		pr_err("Failed to send ACK by socket.\n");
+	}
+	return ret;
+}
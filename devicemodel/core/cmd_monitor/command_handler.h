@@ -10,5 +10,16 @@ extern struct socket_dev *sock_server;
 int user_vm_destroy_handler(void *arg, void *command_para);
 int user_vm_blkrescan_handler(void *arg, void *command_para);
 int user_vm_register_vm_event_client_handler(void *arg, void *command_para);
+int user_vm_ioreq_latency_handler(void *arg, void *command_para);
+int user_vm_iothread_stats_handler(void *arg, void *command_para);
+int user_vm_launch_timeline_handler(void *arg, void *command_para);
+int user_vm_blk_stats_handler(void *arg, void *command_para);
+int user_vm_snapshot_handler(void *arg, void *command_para);
+int user_vm_vssram_stats_handler(void *arg, void *command_para);
+int user_vm_vtcon_stats_handler(void *arg, void *command_para);
+int user_vm_dev_stats_handler(void *arg, void *command_para);
+int user_vm_dev_tune_handler(void *arg, void *command_para);
+int user_vm_cpu_hotplug_handler(void *arg, void *command_para);
+int user_vm_vm_events_handler(void *arg, void *command_para);
 
 #endif
@@ -28,6 +28,10 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/vfs.h>
 #include <sys/mount.h>
@@ -36,9 +40,15 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <log.h>
+#include <sys/syscall.h>
 #include <linux/memfd.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
 
 #include "vmmapi.h"
+#include "atomic.h"
+#include "dm.h"
+#include "dm_string.h"
 
 extern char *vmname;
 
@@ -56,6 +66,9 @@ extern char *vmname;
 #define SYS_PATH_LV2  "/sys/kernel/mm/hugepages/hugepages-1048576kB/"
 #define SYS_NR_HUGEPAGES  "nr_hugepages"
 #define SYS_FREE_HUGEPAGES  "free_hugepages"
+/* the huge page pool of one NUMA node, of the page size in kB */
+#define SYS_PATH_NODE "/sys/devices/system/node/node%d/hugepages/hugepages-%dkB/"
+#define HUGETLB_NODES_MAX	64
 
 /* File used for lock between different processes access to hugetlbfs.
  * We observed when access hugetlbfs from different process to allocate
@@ -69,6 +82,19 @@ extern char *vmname;
 #define	LOCK_OFFSET_START	0
 #define	LOCK_OFFSET_END		10
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23
+#endif
+
+/* the entries of /proc/self/pagemap, one per 4K page */
+#define PAGEMAP_PAGE_SHIFT	12
+#define PAGEMAP_PRESENT		(1UL << 63)
+#define PAGEMAP_PFN_MASK	((1UL << 55) - 1)
+
+/* work unit of the prefault threads, a multiple of any huge page size */
+#define PREFAULT_CHUNK_SIZE	(1024UL * 1024 * 1024)
+#define PREFAULT_THREADS_MAX	64
+
 /* hugetlb_info record private information for one specific hugetlbfs:
  * - mounted: is hugetlbfs mounted for below mount_path
  * - mount_path: hugetlbfs mount path
@@ -81,6 +107,7 @@ extern char *vmname;
  *.---if > 0: it's the gap for needed page; if < 0, more free than needed.
  * - nr_pages_path: sys path for total number of pages
  *.- free_pages_path: sys path for number of free pages
+ * - pooled: fd is a pre-zeroed file claimed from the memory pool, not a memfd
  */
 struct hugetlb_info {
 	int fd;
@@ -94,6 +121,7 @@ struct hugetlb_info {
 	int pages_delta;
 	char *nr_pages_path;
 	char *free_pages_path;
+	bool pooled;
 };
 
 static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
@@ -133,6 +161,7 @@ struct vm_mmap_mem_region {
 	vm_paddr_t fd_offset;
 	char *hva_base;
 	int fd;
+	int level;
 };
 
 static struct vm_mmap_mem_region mmap_mem_regions[16];
@@ -143,6 +172,25 @@ static size_t total_size;
 static int hugetlb_lv_max;
 static int lock_fd;
 
+/* the NUMA node of the pCPUs of the VM, -1 on a single node board */
+static int home_node = -1;
+
+/* --mem_prefault <num>: fault in the guest memory on num threads */
+static int prefault_threads;
+/* --mem_pool <dir>: hugetlbfs files of pre-zeroed pages kept by a daemon */
+static char *pool_dir;
+
+struct prefault_chunk {
+	char *addr;
+	size_t len;
+	size_t pg_size;
+};
+
+static struct prefault_chunk *prefault_chunks;
+static int prefault_nr_chunks;
+static int prefault_next;
+static int prefault_err;
+
 static int lock_acrn_hugetlb(void)
 {
 	int ret;
@@ -183,6 +231,7 @@ static void close_hugetlbfs(int level)
 		close(hugetlb_priv[level].fd);
 		hugetlb_priv[level].fd = -1;
 	}
+	hugetlb_priv[level].pooled = false;
 }
 
 static bool should_enable_hugetlb_level(int level)
@@ -211,6 +260,7 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 {
 	char *addr;
 	size_t pagesz = 0;
+	unsigned long nodemask;
 	int fd, i;
 
 	if (level >= HUGETLB_LV_MAX) {
@@ -237,9 +287,23 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 	mmap_mem_regions[mem_idx].fd = fd;
 	mmap_mem_regions[mem_idx].fd_offset = skip;
 	mmap_mem_regions[mem_idx].hva_base = addr;
+	mmap_mem_regions[mem_idx].level = level;
 	mem_idx++;
 	pr_info("mmap 0x%lx@%p\n", len, addr);
 
+	/* the pages are allocated at fault time, on the node of the policy */
+	if (home_node >= 0) {
+		nodemask = 1UL << home_node;
+		if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &nodemask,
+				HUGETLB_NODES_MAX, 0) < 0)
+			pr_warn("mbind to node %d failed: %s\n", home_node,
+				strerror(errno));
+	}
+
+	/* left to hugetlb_prefault() on the prefault threads */
+	if (prefault_threads > 0)
+		return 0;
+
 	/* pre-allocate hugepages by touch them */
 	pagesz = hugetlb_priv[level].pg_size;
 
@@ -381,6 +445,108 @@ static int read_sys_info(const char *sys_path)
 	return pages;
 }
 
+/* the NUMA node of a CPU of the Service VM, -1 if unknown */
+static int cpu_to_node(int cpu)
+{
+	char path[MAX_PATH_LEN];
+	struct dirent *ent;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((ent = readdir(dir)) != NULL) {
+		if (sscanf(ent->d_name, "node%d", &node) == 1)
+			break;
+		node = -1;
+	}
+	closedir(dir);
+
+	return node;
+}
+
+/*
+ * The home node of the VM is the NUMA node most of its pCPUs are on, its
+ * memory is taken from there. The Service VM numbers its CPUs as the pCPUs,
+ * an offlined CPU keeps its node link.
+ */
+static int hugetlb_home_node(void)
+{
+	uint64_t pcpus = vm_get_cpu_affinity_dm();
+	int count[HUGETLB_NODES_MAX] = { 0 };
+	int cpu, node, home = -1;
+
+	if (access("/sys/devices/system/node/node1", F_OK) != 0)
+		return -1;
+
+	for (cpu = 0; cpu < 64; cpu++) {
+		if ((pcpus & (1UL << cpu)) == 0)
+			continue;
+		node = cpu_to_node(cpu);
+		if (node < 0 || node >= HUGETLB_NODES_MAX)
+			continue;
+		count[node]++;
+		if (home < 0 || count[node] > count[home])
+			home = node;
+	}
+
+	return home;
+}
+
+/* check and reserve the free huge pages of the node, or of all if node < 0 */
+static void hugetlb_set_node_paths(int node)
+{
+	static char nr_paths[HUGETLB_LV_MAX][MAX_PATH_LEN];
+	static char free_paths[HUGETLB_LV_MAX][MAX_PATH_LEN];
+	static const char *sys_paths[HUGETLB_LV_MAX] = { SYS_PATH_LV1, SYS_PATH_LV2 };
+	/* leave room for the longer file name, so the paths below fit */
+	char dir[MAX_PATH_LEN - sizeof(SYS_FREE_HUGEPAGES) + 1];
+	int level;
+
+	for (level = HUGETLB_LV1; level < HUGETLB_LV_MAX; level++) {
+		if (node < 0)
+			snprintf(dir, sizeof(dir), "%s", sys_paths[level]);
+		else
+			snprintf(dir, sizeof(dir), SYS_PATH_NODE, node,
+				hugetlb_priv[level].pg_size / 1024);
+		snprintf(nr_paths[level], MAX_PATH_LEN, "%s" SYS_NR_HUGEPAGES, dir);
+		snprintf(free_paths[level], MAX_PATH_LEN, "%s" SYS_FREE_HUGEPAGES, dir);
+		hugetlb_priv[level].nr_pages_path = nr_paths[level];
+		hugetlb_priv[level].free_pages_path = free_paths[level];
+	}
+}
+
+/* the guest memory on the home node and on the other nodes */
+static void hugetlb_node_stat(size_t *local, size_t *remote)
+{
+	void *pages[512];
+	int status[512];
+	struct vm_mmap_mem_region *region;
+	size_t off, len, pg_size;
+	int i, j, n;
+
+	*local = *remote = 0;
+	for (i = 0; i < mem_idx; i++) {
+		region = &mmap_mem_regions[i];
+		len = region->gpa_end - region->gpa_start;
+		pg_size = hugetlb_priv[region->level].pg_size;
+		for (off = 0; off < len; ) {
+			for (n = 0; n < 512 && off < len; n++, off += pg_size)
+				pages[n] = region->hva_base + off;
+			if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) < 0)
+				return;
+			for (j = 0; j < n; j++) {
+				if (status[j] == home_node)
+					*local += pg_size;
+				else if (status[j] >= 0)
+					*remote += pg_size;
+			}
+		}
+	}
+}
+
 /* check if enough free huge pages for the User VM */
 static bool hugetlb_check_memgap(void)
 {
@@ -396,6 +562,9 @@ static bool hugetlb_check_memgap(void)
 		need_pages = (hugetlb_priv[lvl].lowmem + hugetlb_priv[lvl].fbmem +
 			hugetlb_priv[lvl].biosmem + hugetlb_priv[lvl].highmem) /
 			hugetlb_priv[lvl].pg_size;
+		/* the pages of a pool file are allocated already */
+		if (hugetlb_priv[lvl].pooled)
+			need_pages = 0;
 
 		hugetlb_priv[lvl].pages_delta = need_pages - free_pages;
 		/* if delta > 0, it's a gap for needed pages, to be handled */
@@ -539,6 +708,191 @@ static bool hugetlb_reserve_pages(void)
 	return true;
 }
 
+int hugetlb_parse_prefault(const char *opt)
+{
+	char *end;
+	int num;
+
+	if (dm_strtoi(opt, &end, 10, &num) != 0 || *end != '\0' ||
+			num < 0 || num > PREFAULT_THREADS_MAX)
+		return -1;
+
+	prefault_threads = num;
+	return 0;
+}
+
+int hugetlb_set_pool(const char *dir)
+{
+	free(pool_dir);
+	pool_dir = strdup(dir);
+	return (pool_dir != NULL) ? 0 : -1;
+}
+
+/*
+ * Claim a file of the memory pool for the level: a regular file on a
+ * hugetlbfs of the level's page size, at least as large as the level's part
+ * of the guest memory and not locked by another acrn-dm. The daemon keeping
+ * the pool faults in and zeroes the pages of its files beforehand, so the
+ * kernel has nothing left to clear when they are mapped. The file stays
+ * locked as long as its fd is open.
+ */
+static bool hugetlb_claim_pool(int level)
+{
+	struct hugetlb_info *htlb = &hugetlb_priv[level];
+	char path[MAX_PATH_LEN];
+	struct dirent *entry;
+	struct statfs fs;
+	struct stat st;
+	size_t need;
+	DIR *dir;
+	int fd = -1;
+
+	need = htlb->lowmem + htlb->fbmem + htlb->biosmem + htlb->highmem;
+	if (need == 0)
+		return false;
+
+	dir = opendir(pool_dir);
+	if (dir == NULL) {
+		pr_err("can't open memory pool %s: %s\n", pool_dir, strerror(errno));
+		return false;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (snprintf(path, MAX_PATH_LEN, "%s/%s", pool_dir,
+				entry->d_name) >= MAX_PATH_LEN)
+			continue;
+
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		if (fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC &&
+				fs.f_bsize == htlb->pg_size &&
+				fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+				st.st_size >= need &&
+				flock(fd, LOCK_EX | LOCK_NB) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	closedir(dir);
+
+	if (fd < 0) {
+		pr_info("level %d: no free file of 0x%lx in memory pool\n",
+			level, need);
+		return false;
+	}
+
+	pr_notice("level %d: use memory pool file %s\n", level, path);
+	close(htlb->fd);
+	htlb->fd = fd;
+	htlb->pooled = true;
+
+	return true;
+}
+
+static int prefault_range(struct prefault_chunk *chunk)
+{
+	char *addr;
+
+	if (madvise(chunk->addr, chunk->len, MADV_POPULATE_WRITE) == 0)
+		return 0;
+	if (errno != EINVAL)
+		return -errno;
+
+	/* kernel without MADV_POPULATE_WRITE, touch the pages instead */
+	for (addr = chunk->addr; addr < chunk->addr + chunk->len;
+			addr += chunk->pg_size)
+		*(volatile char *)addr = *addr;
+
+	return 0;
+}
+
+static void *prefault_thread(void *arg)
+{
+	int idx, err;
+
+	while ((idx = atomic_fetch_add(&prefault_next, 1)) < prefault_nr_chunks) {
+		err = prefault_range(&prefault_chunks[idx]);
+		if (err < 0)
+			atomic_store(&prefault_err, err);
+	}
+
+	return NULL;
+}
+
+/*
+ * Fault in all the mapped regions, PREFAULT_CHUNK_SIZE at a time, on
+ * prefault_threads threads. The kernel allocates and clears each huge page
+ * on the thread faulting it in, so the clearing scales with the threads.
+ */
+static int hugetlb_prefault(void)
+{
+	struct vm_mmap_mem_region *region;
+	pthread_t tids[PREFAULT_THREADS_MAX];
+	char name[MAXCOMLEN + 1];
+	size_t off, len;
+	int i, n = 0, nr_threads;
+
+	for (i = 0; i < mem_idx; i++) {
+		len = mmap_mem_regions[i].gpa_end - mmap_mem_regions[i].gpa_start;
+		n += (len + PREFAULT_CHUNK_SIZE - 1) / PREFAULT_CHUNK_SIZE;
+	}
+
+	prefault_chunks = calloc(n, sizeof(struct prefault_chunk));
+	if (prefault_chunks == NULL) {
+		pr_err("%s: calloc returns NULL\n", __func__);
+		return -ENOMEM;
+	}
+
+	n = 0;
+	for (i = 0; i < mem_idx; i++) {
+		region = &mmap_mem_regions[i];
+		len = region->gpa_end - region->gpa_start;
+		for (off = 0; off < len; off += PREFAULT_CHUNK_SIZE) {
+			prefault_chunks[n].addr = region->hva_base + off;
+			prefault_chunks[n].len = (len - off < PREFAULT_CHUNK_SIZE) ?
+				(len - off) : PREFAULT_CHUNK_SIZE;
+			prefault_chunks[n].pg_size = hugetlb_priv[region->level].pg_size;
+			n++;
+		}
+	}
+	prefault_nr_chunks = n;
+	prefault_next = 0;
+	prefault_err = 0;
+
+	/* the calling thread is one of them */
+	nr_threads = (prefault_threads < n) ? prefault_threads : n;
+	for (i = 0; i < nr_threads - 1; i++) {
+		if (pthread_create(&tids[i], NULL, prefault_thread, NULL) != 0) {
+			pr_warn("%s: %d prefault threads only\n", __func__, i + 1);
+			break;
+		}
+		snprintf(name, sizeof(name), "prefault_%d", i);
+		pthread_setname_np(tids[i], name);
+	}
+	nr_threads = i + 1;
+
+	prefault_thread(NULL);
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(tids[i], NULL);
+
+	free(prefault_chunks);
+	prefault_chunks = NULL;
+
+	pr_info("prefault %d chunks on %d threads\n", n, nr_threads);
+	return prefault_err;
+}
+
+static uint64_t hugetlb_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
 bool init_hugetlb(void)
 {
 	char path[MAX_PATH_LEN] = {0};
@@ -600,11 +954,96 @@ void uninit_hugetlb(void)
 		if (hugetlb_priv[level].fd > 0)
 			close(hugetlb_priv[level].fd);
 		hugetlb_priv[level].fd = -1;
+		hugetlb_priv[level].pooled = false;
 	}
 
 	close(lock_fd);
 }
 
+/* the host physical address of a mapped page, 0 if it can't be told */
+static uint64_t
+hva_to_hpa(int pagemap_fd, char *hva)
+{
+	uint64_t entry;
+
+	if (pread(pagemap_fd, &entry, sizeof(entry),
+			((uint64_t)hva >> PAGEMAP_PAGE_SHIFT) * sizeof(entry)) != sizeof(entry) ||
+			!(entry & PAGEMAP_PRESENT))
+		return 0;
+	return (entry & PAGEMAP_PFN_MASK) << PAGEMAP_PAGE_SHIFT;
+}
+
+static int
+hugetlb_map_run(struct vmctx *ctx, vm_paddr_t gpa, size_t len, uint64_t hpa,
+		int *nr_runs, size_t *large_size)
+{
+	vm_paddr_t start = ALIGN_UP(gpa, GB), end = ALIGN_DOWN(gpa + len, GB);
+
+	if (len == 0)
+		return 0;
+
+	(*nr_runs)++;
+	/* the GPAs and HPAs of a 1G EPT leaf are both 1G aligned */
+	if (hpa != 0 && ((gpa - hpa) & (GB - 1)) == 0 && end > start)
+		*large_size += end - start;
+
+	return vm_map_memseg_vma(ctx, len, gpa, (uint64_t)(ctx->baseaddr + gpa), PROT_ALL);
+}
+
+/*
+ * Map [gpa, gpa + len) of the guest RAM into the EPT, one region per run of
+ * huge pages contiguous in the host physical memory as well, so that the
+ * hypervisor maps each with the largest leaves its alignment allows: the 1G
+ * huge pages, and the 2M ones that happen to make up an aligned 1G, with 1G
+ * leaves. The HPAs are read from /proc/self/pagemap; without them, the range
+ * is mapped at once.
+ */
+static int
+hugetlb_map_ept(struct vmctx *ctx, vm_paddr_t gpa, size_t len, int pagemap_fd,
+		int *nr_runs, size_t *large_size)
+{
+	struct vm_mmap_mem_region *region;
+	vm_paddr_t cur = gpa, run_gpa = gpa;
+	uint64_t hpa, run_hpa = 0;
+	size_t pg_size;
+	int i;
+
+	while (pagemap_fd >= 0 && cur < gpa + len) {
+		region = NULL;
+		for (i = 0; i < mem_idx; i++) {
+			if (cur >= mmap_mem_regions[i].gpa_start &&
+					cur < mmap_mem_regions[i].gpa_end) {
+				region = &mmap_mem_regions[i];
+				break;
+			}
+		}
+		if (region == NULL)
+			break;
+
+		pg_size = hugetlb_priv[region->level].pg_size;
+		hpa = hva_to_hpa(pagemap_fd, ctx->baseaddr + cur);
+		if (hpa == 0)
+			break;
+
+		if (cur == run_gpa) {
+			run_hpa = hpa;
+		} else if (hpa != run_hpa + (cur - run_gpa)) {
+			if (hugetlb_map_run(ctx, run_gpa, cur - run_gpa, run_hpa,
+					nr_runs, large_size) < 0)
+				return -1;
+			run_gpa = cur;
+			run_hpa = hpa;
+		}
+		cur += pg_size;
+	}
+
+	/* the last run, or the rest if the HPAs are unknown */
+	if (cur < gpa + len)
+		run_hpa = 0;
+	return hugetlb_map_run(ctx, run_gpa, gpa + len - run_gpa, run_hpa,
+			nr_runs, large_size);
+}
+
 int hugetlb_setup_memory(struct vmctx *ctx)
 {
 	int level;
@@ -612,8 +1051,12 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	bool has_gap;
 	int fd;
 	unsigned int seal_flag = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
-	size_t mem_size_level;
+	size_t mem_size_level, large_size = 0;
+	size_t local_size, remote_size;
+	uint64_t start_us, prefault_us = 0;
+	int pagemap_fd = -1, nr_runs = 0;
 
+	start_us = hugetlb_now_us();
 	mem_idx = 0;
 	memset(&mmap_mem_regions, 0, sizeof(mmap_mem_regions));
 	if (ctx->lowmem == 0) {
@@ -692,13 +1135,34 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		}
 	}
 
+	if (pool_dir != NULL) {
+		for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+			if (hugetlb_priv[level].fd >= 0)
+				hugetlb_claim_pool(level);
+		}
+	}
+
+	home_node = hugetlb_home_node();
+	hugetlb_set_node_paths(home_node);
+	if (home_node >= 0)
+		pr_notice("memory from the home NUMA node %d\n", home_node);
+
 	lock_acrn_hugetlb();
 
 	/* it will check each level memory need */
 	has_gap = hugetlb_check_memgap();
 	if (has_gap) {
-		if (!hugetlb_reserve_pages())
-			goto err_lock;
+		if (!hugetlb_reserve_pages()) {
+			if (home_node < 0)
+				goto err_lock;
+
+			/* the pages on the other nodes are still better than none */
+			pr_warn("not enough huge pages on node %d, use all nodes\n",
+				home_node);
+			hugetlb_set_node_paths(-1);
+			if (hugetlb_check_memgap() && !hugetlb_reserve_pages())
+				goto err_lock;
+		}
 	}
 
 	/* align up total size with huge page size for vma alignment */
@@ -766,11 +1230,21 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		goto err_lock;
 	}
 
+	if (prefault_threads > 0) {
+		prefault_us = hugetlb_now_us();
+		if (hugetlb_prefault() < 0) {
+			pr_err("prefault failed");
+			goto err_lock;
+		}
+		prefault_us = hugetlb_now_us() - prefault_us;
+	}
+
 	/* resize the memfd to meet with the size requirement and add the
 	 * F_SEAL_SEAL flag
 	 */
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
-		if (hugetlb_priv[level].fd > 0) {
+		/* a pool file is kept as large as the daemon made it */
+		if (hugetlb_priv[level].fd > 0 && !hugetlb_priv[level].pooled) {
 			mem_size_level = hugetlb_priv[level].lowmem +
 					 hugetlb_priv[level].highmem +
 					 hugetlb_priv[level].biosmem +
@@ -803,9 +1277,11 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 			hugetlb_priv[level].highmem);
 	}
 
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
 	/* map ept for lowmem */
-	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
-		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
+	if (hugetlb_map_ept(ctx, 0, ctx->lowmem, pagemap_fd, &nr_runs,
+			&large_size) < 0)
 		goto err;
 
 	/* map ept for biosmem */
@@ -815,25 +1291,41 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		 * modified by the boot firmware itself (e.g. OVMF
 		 * NV data storage region).
 		 */
-		if (vm_map_memseg_vma(ctx, ctx->biosmem, 4 * GB - ctx->biosmem,
-			(uint64_t)(ctx->baseaddr + 4 * GB - ctx->biosmem),
-			PROT_ALL) < 0)
-		goto err;
+		if (hugetlb_map_ept(ctx, 4 * GB - ctx->biosmem, ctx->biosmem,
+				pagemap_fd, &nr_runs, &large_size) < 0)
+			goto err;
 	}
 
 	/* map ept for highmem */
 	if (ctx->highmem > 0) {
-		if (vm_map_memseg_vma(ctx, ctx->highmem, ctx->highmem_gpa_base,
-			(uint64_t)(ctx->baseaddr + ctx->highmem_gpa_base),
-			PROT_ALL) < 0)
+		if (hugetlb_map_ept(ctx, ctx->highmem_gpa_base, ctx->highmem,
+				pagemap_fd, &nr_runs, &large_size) < 0)
 			goto err;
 	}
 
+	if (pagemap_fd >= 0) {
+		close(pagemap_fd);
+		pagemap_fd = -1;
+	}
+	pr_notice("memory mapped in %d regions, 0x%lx in 1G EPT leaves\n",
+		nr_runs, large_size);
+	if (home_node >= 0) {
+		hugetlb_node_stat(&local_size, &remote_size);
+		pr_notice("memory on home node %d: 0x%lx, on other nodes: 0x%lx\n",
+			home_node, local_size, remote_size);
+	}
+
+	pr_notice("memory setup of 0x%lx takes %lu ms, prefault %lu ms on %d threads\n",
+		ctx->lowmem + ctx->highmem + ctx->biosmem + ctx->fbmem,
+		(hugetlb_now_us() - start_us) / 1000, prefault_us / 1000,
+		prefault_threads);
 	return 0;
 
 err_lock:
 	unlock_acrn_hugetlb();
 err:
+	if (pagemap_fd >= 0)
+		close(pagemap_fd);
 	if (ptr) {
 		munmap(ptr, total_size);
 		ptr = NULL;
@@ -847,7 +1339,27 @@ err:
 
 void hugetlb_unsetup_memory(struct vmctx *ctx)
 {
-	int level;
+	struct vm_mmap_mem_region *region;
+	int i, level;
+
+	/*
+	 * The lowmem and highmem are cleared by vm_unsetup_memory(), clear the
+	 * rest of a pool file as well before it goes back to the pool. The
+	 * memory of an RTVM isn't cleared, so its pages are dropped instead.
+	 */
+	for (i = 0; i < mem_idx; i++) {
+		region = &mmap_mem_regions[i];
+		if (!hugetlb_priv[region->level].pooled)
+			continue;
+		if (!is_rtvm && region->gpa_start >= ctx->lowmem &&
+				region->gpa_end <= 4 * GB)
+			bzero(region->hva_base, region->gpa_end - region->gpa_start);
+	}
+	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+		if (is_rtvm && hugetlb_priv[level].pooled &&
+				ftruncate(hugetlb_priv[level].fd, 0) == -1)
+			pr_err("Fail to drop the pages of level %d.\n", level);
+	}
 
 	if (total_size > 0) {
 		munmap(ptr, total_size);
@@ -888,6 +1400,216 @@ vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 	return ret;
 }
 
+/*
+ * The hugetlb region of the 2M level holding [gpa, gpa + len) of the lowmem
+ * or the highmem, NULL if the range is not there or not 2M aligned: a 1G
+ * page can't be given back in part, the biosmem and the fbmem are not RAM
+ * the guest frees.
+ */
+static struct vm_mmap_mem_region *
+find_releasable_region(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_mmap_mem_region *region;
+	int i;
+
+	if (len == 0 || ALIGN_CHECK(gpa | len, hugetlb_priv[HUGETLB_LV1].pg_size))
+		return NULL;
+	if (!(gpa + len <= ctx->lowmem || (gpa >= ctx->highmem_gpa_base &&
+			gpa + len <= ctx->highmem_gpa_base + ctx->highmem)))
+		return NULL;
+
+	for (i = 0; i < mem_idx; i++) {
+		region = &mmap_mem_regions[i];
+		if (gpa >= region->gpa_start && gpa + len <= region->gpa_end)
+			return region->level == HUGETLB_LV1 ? region : NULL;
+	}
+	return NULL;
+}
+
+/*
+ * Give the huge pages backing [gpa, gpa + len) back to the host. The range
+ * leaves the EPT first, so that the guest can't reach the pages while they
+ * are punched out of the hugetlb file; a guest access to it comes to the DM
+ * as an MMIO access then, see vm_populate_ram().
+ */
+int
+vm_release_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_mmap_mem_region *region;
+	uint64_t hva = (uint64_t)(ctx->baseaddr + gpa);
+
+	region = find_releasable_region(ctx, gpa, len);
+	if (region == NULL)
+		return -1;
+
+	if (vm_unmap_memseg_vma(ctx, len, gpa, hva, PROT_ALL) < 0)
+		return -1;
+
+	if (fallocate(region->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			region->fd_offset + (gpa - region->gpa_start), len) < 0) {
+		pr_err("%s: fallocate of 0x%lx failed: %s\n", __func__, gpa,
+			strerror(errno));
+		(void)vm_map_memseg_vma(ctx, len, gpa, hva, PROT_ALL);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Back a range given away by vm_release_ram() with huge pages again and map
+ * it into the EPT. It fails if the host has no free huge page left.
+ */
+int
+vm_populate_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct prefault_chunk chunk;
+	int err;
+
+	if (find_releasable_region(ctx, gpa, len) == NULL)
+		return -1;
+
+	chunk.addr = ctx->baseaddr + gpa;
+	chunk.len = len;
+	chunk.pg_size = hugetlb_priv[HUGETLB_LV1].pg_size;
+	err = prefault_range(&chunk);
+	if (err < 0) {
+		pr_err("%s: no huge page for 0x%lx: %s\n", __func__, gpa,
+			strerror(-err));
+		return -1;
+	}
+
+	return vm_map_memseg_vma(ctx, len, gpa, (uint64_t)chunk.addr, PROT_ALL);
+}
+
+/*
+ * The RAM the devices map into the guest, beside the hugetlb regions. The
+ * device model maps them on its main thread, at the device init.
+ */
+static struct vm_memfd_map ram_maps[16];
+static int ram_map_idx;
+static LIST_HEAD(, vm_mem_listener) mem_listeners =
+	LIST_HEAD_INITIALIZER(mem_listeners);
+
+/* the fbmem region is not guest RAM at its offset, it's in the VGA BAR */
+static bool
+is_fbmem_region(struct vmctx *ctx, struct vm_mmap_mem_region *region)
+{
+	vm_paddr_t fb_start = 4 * GB - ctx->biosmem - ctx->fbmem;
+
+	return ctx->fbmem > 0 && region->gpa_start >= fb_start &&
+		region->gpa_end <= 4 * GB - ctx->biosmem;
+}
+
+/*
+ * All the memfd mappings of the guest memory, one per hugetlb segment
+ * plus the ones of vm_add_ram_map(), -1 if there are more than max of them.
+ */
+int
+vm_get_memfd_maps(struct vmctx *ctx, struct vm_memfd_map *maps, int max)
+{
+	int i, n = 0;
+
+	for (i = 0; i < mem_idx; i++) {
+		if (is_fbmem_region(ctx, &mmap_mem_regions[i]))
+			continue;
+		if (n >= max)
+			return -1;
+		maps[n].gpa = mmap_mem_regions[i].gpa_start;
+		maps[n].size = mmap_mem_regions[i].gpa_end -
+			mmap_mem_regions[i].gpa_start;
+		maps[n].fd_offset = mmap_mem_regions[i].fd_offset;
+		maps[n].hva = mmap_mem_regions[i].hva_base;
+		maps[n].fd = mmap_mem_regions[i].fd;
+		n++;
+	}
+
+	for (i = 0; i < ram_map_idx; i++) {
+		if (n >= max)
+			return -1;
+		maps[n++] = ram_maps[i];
+	}
+
+	return n;
+}
+
+int
+vm_add_ram_map(struct vmctx *ctx, vm_paddr_t gpa, uint64_t size,
+	       void *hva, int fd, uint64_t fd_offset)
+{
+	struct vm_mmap_mem_region *region;
+	struct vm_mem_listener *l;
+	struct vm_memfd_map *map;
+	int i;
+
+	if (ram_map_idx >= ARRAY_SIZE(ram_maps)) {
+		pr_err("exceed supported ram maps.\n");
+		return -1;
+	}
+
+	if (fd < 0) {
+		for (i = 0; i < mem_idx; i++) {
+			region = &mmap_mem_regions[i];
+			if ((char *)hva >= region->hva_base &&
+			    (char *)hva + size <= region->hva_base +
+			    (region->gpa_end - region->gpa_start)) {
+				fd = region->fd;
+				fd_offset = region->fd_offset +
+					((char *)hva - region->hva_base);
+				break;
+			}
+		}
+		if (fd < 0) {
+			pr_err("%s: %p is not in the guest memory\n",
+				__func__, hva);
+			return -1;
+		}
+	}
+
+	map = &ram_maps[ram_map_idx++];
+	map->gpa = gpa;
+	map->size = size;
+	map->hva = hva;
+	map->fd = fd;
+	map->fd_offset = fd_offset;
+
+	LIST_FOREACH(l, &mem_listeners, list)
+		l->map_add(l, map);
+	return 0;
+}
+
+void
+vm_del_ram_map(struct vmctx *ctx, vm_paddr_t gpa)
+{
+	struct vm_mem_listener *l;
+	struct vm_memfd_map map;
+	int i;
+
+	for (i = 0; i < ram_map_idx; i++) {
+		if (ram_maps[i].gpa == gpa)
+			break;
+	}
+	if (i == ram_map_idx)
+		return;
+
+	map = ram_maps[i];
+	ram_maps[i] = ram_maps[--ram_map_idx];
+
+	LIST_FOREACH(l, &mem_listeners, list)
+		l->map_del(l, &map);
+}
+
+void
+vm_register_mem_listener(struct vm_mem_listener *l)
+{
+	LIST_INSERT_HEAD(&mem_listeners, l, list);
+}
+
+void
+vm_unregister_mem_listener(struct vm_mem_listener *l)
+{
+	LIST_REMOVE(l, list);
+}
+
 bool vm_allow_dmabuf(struct vmctx *ctx)
 {
 	uint32_t mem_flags;
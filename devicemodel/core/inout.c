@@ -118,6 +118,22 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct acrn_pio_request *pio_reques
 	return retval;
 }
 
+const char *
+inout_port_name(int port)
+{
+	if (port < 0 || port >= MAX_IOPORTS || inout_handlers[port].name == NULL)
+		return "";
+	return inout_handlers[port].name;
+}
+
+bool
+inout_port_concurrent(int port)
+{
+	if (port < 0 || port >= MAX_IOPORTS)
+		return false;
+	return (inout_handlers[port].flags & IOPORT_F_CONCURRENT) != 0;
+}
+
 void
 init_inout(void)
 {
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "vmmapi.h"
+#include "inout.h"
+#include "mem.h"
+#include "pm.h"
+#include "iothread.h"
+#include "ioreq_dispatch.h"
+#include "log.h"
+
+/*
+ * The HSM wakes the ioreq client as long as any request is pending, the
+ * ones already handed to a thread included. While some are, vm_loop()
+ * waits for their completion, up to this long, instead.
+ */
+#define IOREQ_DISPATCH_POLL_US	50
+
+struct ioreq_worker {
+	pthread_t tid;
+	pthread_cond_t cond;
+	uint64_t pending;	/* the vCPUs whose request is to be handled */
+	uint16_t idx;
+	char name[PTHREAD_NAME_MAX_LEN];
+};
+
+static struct iothreads_option dispatch_opt;
+static struct ioreq_worker *workers;
+static uint16_t nr_workers;
+static bool stopping;
+
+static struct vmctx *dispatch_ctx;
+static struct acrn_io_request *dispatch_buf;
+static int dispatch_ncpus;
+static ioreq_handler_t dispatch_handler;
+
+/* protects the worker queues and inflight */
+static pthread_mutex_t dispatch_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond;
+/* the vCPUs whose request is owned by a worker */
+static uint64_t inflight;
+
+/*
+ * Held shared by the emulation of the concurrent ranges, exclusive by any
+ * other, which may change the registrations or the state of any device.
+ */
+static pthread_rwlock_t emul_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * --ioreq_threads <num>[@<cpu>:<cpu>/<cpu>...]
+ * The requests of vCPU n are handled by thread (n % num), the optional CPU
+ * affinity of each thread uses the iothread syntax.
+ */
+int
+ioreq_dispatch_parse_options(char *opt)
+{
+	iothread_free_options(&dispatch_opt);
+	if (iothread_parse_options(opt, &dispatch_opt) != 0) {
+		pr_err("%s: invalid ioreq_threads option %s\n", __func__, opt);
+		return -1;
+	}
+	if (dispatch_opt.per_queue) {
+		pr_err("%s: ioreq_threads needs a number of threads\n", __func__);
+		iothread_free_options(&dispatch_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+bool
+ioreq_dispatch_enabled(void)
+{
+	return dispatch_opt.num > 0;
+}
+
+static bool
+ioreq_is_concurrent(struct acrn_io_request *io_req)
+{
+	switch (io_req->type) {
+	case ACRN_IOREQ_TYPE_PORTIO:
+		return inout_port_concurrent((int)io_req->reqs.pio_request.address);
+	case ACRN_IOREQ_TYPE_MMIO:
+		return mem_range_concurrent(io_req->reqs.mmio_request.address);
+	default:
+		return false;
+	}
+}
+
+static void
+ioreq_handle(int vcpu)
+{
+	struct acrn_io_request *io_req = &dispatch_buf[vcpu];
+
+	if (ioreq_is_concurrent(io_req)) {
+		pthread_rwlock_rdlock(&emul_lock);
+		/* the range may have been moved before the lock was taken */
+		if (!ioreq_is_concurrent(io_req)) {
+			pthread_rwlock_unlock(&emul_lock);
+			pthread_rwlock_wrlock(&emul_lock);
+		}
+	} else
+		pthread_rwlock_wrlock(&emul_lock);
+
+	(*dispatch_handler)(dispatch_ctx, io_req, vcpu);
+
+	pthread_rwlock_unlock(&emul_lock);
+}
+
+static void *
+ioreq_worker_thread(void *arg)
+{
+	struct ioreq_worker *w = arg;
+	int vcpu;
+
+	pthread_mutex_lock(&dispatch_mtx);
+	while (!stopping) {
+		if (w->pending == 0UL) {
+			pthread_cond_wait(&w->cond, &dispatch_mtx);
+			continue;
+		}
+
+		vcpu = ffsll(w->pending) - 1;
+		w->pending &= ~(1UL << vcpu);
+		pthread_mutex_unlock(&dispatch_mtx);
+
+		ioreq_handle(vcpu);
+
+		/*
+		 * Only released once the request is notified done, or the
+		 * slot could be dispatched again before it is.
+		 */
+		pthread_mutex_lock(&dispatch_mtx);
+		inflight &= ~(1UL << vcpu);
+		pthread_cond_broadcast(&done_cond);
+	}
+	pthread_mutex_unlock(&dispatch_mtx);
+
+	return NULL;
+}
+
+int
+ioreq_dispatch_init(struct vmctx *ctx, struct acrn_io_request *ioreq_buf,
+		int ncpus, ioreq_handler_t handler)
+{
+	pthread_condattr_t attr;
+	uint16_t i;
+	int ret;
+
+	dispatch_ctx = ctx;
+	dispatch_buf = ioreq_buf;
+	dispatch_ncpus = ncpus;
+	dispatch_handler = handler;
+	stopping = false;
+	inflight = 0UL;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&done_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* no use for more threads than vCPUs */
+	nr_workers = (uint16_t)((dispatch_opt.num < ncpus) ? dispatch_opt.num : ncpus);
+	workers = calloc(nr_workers, sizeof(struct ioreq_worker));
+	if (workers == NULL) {
+		pr_err("%s: calloc returns NULL\n", __func__);
+		nr_workers = 0;
+		return -1;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		workers[i].idx = i;
+		pthread_cond_init(&workers[i].cond, NULL);
+		snprintf(workers[i].name, PTHREAD_NAME_MAX_LEN, "ioreq_%u", i);
+
+		if (pthread_create(&workers[i].tid, NULL, ioreq_worker_thread, &workers[i]) != 0) {
+			pr_err("%s: failed to create %s\n", __func__, workers[i].name);
+			nr_workers = i;
+			ioreq_dispatch_deinit();
+			return -1;
+		}
+		pthread_setname_np(workers[i].tid, workers[i].name);
+
+		if (dispatch_opt.cpusets != NULL && CPU_COUNT(&dispatch_opt.cpusets[i]) != 0) {
+			ret = pthread_setaffinity_np(workers[i].tid, sizeof(cpuset_t),
+					&dispatch_opt.cpusets[i]);
+			if (ret != 0)
+				pr_err("pthread_setaffinity_np fails %d \n", ret);
+		}
+	}
+
+	pr_info("%s: %d ioreq threads for %d vCPUs\n", __func__, nr_workers, ncpus);
+	return 0;
+}
+
+void
+ioreq_dispatch_deinit(void)
+{
+	uint16_t i;
+
+	if (workers == NULL)
+		return;
+
+	ioreq_dispatch_quiesce();
+
+	pthread_mutex_lock(&dispatch_mtx);
+	stopping = true;
+	for (i = 0; i < nr_workers; i++)
+		pthread_cond_signal(&workers[i].cond);
+	pthread_mutex_unlock(&dispatch_mtx);
+
+	for (i = 0; i < nr_workers; i++) {
+		pthread_join(workers[i].tid, NULL);
+		pthread_cond_destroy(&workers[i].cond);
+	}
+
+	free(workers);
+	workers = NULL;
+	nr_workers = 0;
+	iothread_free_options(&dispatch_opt);
+}
+
+/*
+ * Hand the new pending requests to their threads, return the number of them.
+ * Nothing is dispatched once the VM is going to be reset or suspended, the
+ * request which asked for it stays pending until vm_loop() handles it.
+ */
+int
+ioreq_dispatch_scan(void)
+{
+	struct acrn_io_request *io_req;
+	struct ioreq_worker *w;
+	uint64_t bit, scan;
+	int vcpu, n = 0;
+
+	if (vm_get_suspend_mode() != VM_SUSPEND_NONE)
+		return 0;
+
+	pthread_mutex_lock(&dispatch_mtx);
+	scan = vm_ioreq_scan_mask(dispatch_buf, dispatch_ncpus) & ~inflight;
+	while (scan != 0UL) {
+		vcpu = ffsll(scan) - 1;
+		bit = 1UL << vcpu;
+		scan &= ~bit;
+		io_req = &dispatch_buf[vcpu];
+		if (atomic_load(&io_req->processed) != ACRN_IOREQ_STATE_PROCESSING ||
+		    io_req->kernel_handled)
+			continue;
+
+		vm_ioreq_taken(dispatch_buf, vcpu);
+		inflight |= bit;
+		w = &workers[vcpu % nr_workers];
+		w->pending |= bit;
+		pthread_cond_signal(&w->cond);
+		n++;
+	}
+	pthread_mutex_unlock(&dispatch_mtx);
+
+	return n;
+}
+
+bool
+ioreq_dispatch_busy(void)
+{
+	bool busy;
+
+	pthread_mutex_lock(&dispatch_mtx);
+	busy = (inflight != 0UL);
+	pthread_mutex_unlock(&dispatch_mtx);
+
+	return busy;
+}
+
+/* wait for a request to complete, or the poll interval to expire */
+void
+ioreq_dispatch_wait(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += IOREQ_DISPATCH_POLL_US * 1000;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&dispatch_mtx);
+	if (inflight != 0UL)
+		pthread_cond_timedwait(&done_cond, &dispatch_mtx, &ts);
+	pthread_mutex_unlock(&dispatch_mtx);
+}
+
+/* wait for all the dispatched requests to be handled */
+void
+ioreq_dispatch_quiesce(void)
+{
+	if (workers == NULL)
+		return;
+
+	pthread_mutex_lock(&dispatch_mtx);
+	while (inflight != 0UL)
+		pthread_cond_wait(&done_cond, &dispatch_mtx);
+	pthread_mutex_unlock(&dispatch_mtx);
+}
+
+/* for the emulation vm_loop() does itself, e.g. the posted writes */
+void
+ioreq_emulate_exclusive_begin(void)
+{
+	if (workers != NULL)
+		pthread_rwlock_wrlock(&emul_lock);
+}
+
+void
+ioreq_emulate_exclusive_end(void)
+{
+	if (workers != NULL)
+		pthread_rwlock_unlock(&emul_lock);
+}
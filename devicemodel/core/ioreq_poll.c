@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "vmmapi.h"
+#include "dm_string.h"
+#include "ioreq_poll.h"
+#include "log.h"
+
+/* the poll window starts from this long, and doubles up to poll_max_us */
+#define IOREQ_POLL_START_US	4
+
+static int poll_max_us;
+static int poll_us;
+static int poll_cpu = -1;
+
+static struct acrn_io_request *poll_buf;
+static int poll_ncpus;
+
+/*
+ * --ioreq_poll <max_us>[@<cpu>]
+ * vm_loop() polls for up to max_us, on the Service VM CPU cpu if given.
+ */
+int
+ioreq_poll_parse_options(char *opt)
+{
+	char *cpu;
+
+	cpu = strchr(opt, '@');
+	if (cpu != NULL)
+		*cpu++ = '\0';
+
+	if (dm_strtoi(opt, NULL, 10, &poll_max_us) || poll_max_us <= 0 ||
+	    (cpu != NULL && (dm_strtoi(cpu, NULL, 10, &poll_cpu) || poll_cpu < 0 ||
+			     poll_cpu >= CPU_SETSIZE))) {
+		pr_err("%s: invalid ioreq_poll option\n", __func__);
+		poll_max_us = 0;
+		poll_cpu = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+bool
+ioreq_poll_enabled(void)
+{
+	return poll_max_us > 0;
+}
+
+static uint64_t
+ioreq_poll_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Pin the calling thread, vm_loop(), if a CPU was given.
+ */
+int
+ioreq_poll_init(struct acrn_io_request *ioreq_buf, int ncpus)
+{
+	cpu_set_t cpuset;
+	int ret;
+
+	poll_buf = ioreq_buf;
+	poll_ncpus = ncpus;
+	poll_us = poll_max_us;
+
+	if (poll_cpu >= 0) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(poll_cpu, &cpuset);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (ret != 0) {
+			pr_err("%s: fails to pin to CPU %d, error %d\n", __func__, poll_cpu, ret);
+			return -1;
+		}
+	}
+
+	pr_info("%s: polling the I/O requests for up to %d us\n", __func__, poll_max_us);
+	return 0;
+}
+
+/* a request the HSM handed to the device model, not to the kernel */
+static bool
+ioreq_poll_pending(void)
+{
+	struct acrn_io_request *io_req;
+	uint64_t scan;
+	int vcpu;
+
+	/* the bits are left to the scan of vm_loop, which takes the requests */
+	scan = vm_ioreq_scan_mask(poll_buf, poll_ncpus);
+	while (scan != 0UL) {
+		vcpu = ffsll(scan) - 1;
+		scan &= ~(1UL << vcpu);
+		io_req = &poll_buf[vcpu];
+		if (atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING &&
+		    !io_req->kernel_handled)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Poll the I/O request page for up to poll_us, return true if a request
+ * came in the window.
+ */
+static bool
+ioreq_poll(void)
+{
+	uint64_t end = ioreq_poll_now_us() + poll_us;
+
+	do {
+		if (ioreq_poll_pending())
+			return true;
+		__builtin_ia32_pause();
+	} while (ioreq_poll_now_us() < end);
+
+	return false;
+}
+
+/*
+ * Grow the poll window when the request came soon after the thread gave up
+ * polling, shrink it when the thread slept longer than it could poll.
+ */
+static void
+ioreq_adjust_poll(uint64_t slept_us)
+{
+	if (slept_us <= (uint64_t)poll_max_us) {
+		if (poll_us == 0)
+			poll_us = IOREQ_POLL_START_US;
+		else
+			poll_us *= 2;
+		if (poll_us > poll_max_us)
+			poll_us = poll_max_us;
+	} else {
+		poll_us /= 2;
+		if (poll_us < IOREQ_POLL_START_US)
+			poll_us = 0;
+	}
+}
+
+/*
+ * vm_attach_ioreq_client(), polling first. The requests are still completed
+ * through the HSM, which keeps track of those it handed to the client.
+ */
+int
+ioreq_poll_attach(struct vmctx *ctx)
+{
+	uint64_t start;
+	int error;
+
+	if (poll_us > 0 && ioreq_poll())
+		return 0;
+
+	start = ioreq_poll_now_us();
+	error = vm_attach_ioreq_client(ctx);
+	ioreq_adjust_poll(ioreq_poll_now_us() - start);
+
+	return error;
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <x86intrin.h>
+#include <cjson/cJSON.h>
+
+#include "ioreq_trace.h"
+#include "inout.h"
+#include "mem.h"
+#include "log.h"
+
+#define IOREQ_TRACE_MAX_RANGES	64
+#define IOREQ_TRACE_NAME_LEN	32
+#define IOREQ_LAT_BUCKETS	128	/* two buckets per power of 2 of TSC cycles */
+/* a stage longer than this is a stale stamp, not a latency */
+#define IOREQ_LAT_MAX_SEC	10
+
+enum ioreq_stage {
+	STAGE_DISPATCH,		/* hypervisor insert to device model pickup */
+	STAGE_HANDLER,		/* device model handler */
+	STAGE_COMPLETE,		/* handler done to hypervisor completion */
+	STAGE_TOTAL,
+	STAGE_NUM
+};
+
+static const char *stage_names[STAGE_NUM] = {
+	"dispatch", "handler", "complete", "total"
+};
+
+struct ioreq_range_stat {
+	bool used;
+	uint32_t type;
+	uint64_t base;
+	char name[IOREQ_TRACE_NAME_LEN];
+	uint64_t count;
+	uint64_t sum[STAGE_NUM];
+	uint64_t max[STAGE_NUM];
+	uint32_t hist[STAGE_NUM][IOREQ_LAT_BUCKETS];
+};
+
+/* the last request of a vCPU, waiting for its completion stamp */
+struct ioreq_vcpu_trace {
+	struct ioreq_range_stat *range;
+	uint64_t tsc_insert;
+	uint64_t tsc_pickup;
+	uint64_t tsc_handled;
+};
+
+bool ioreq_trace_enabled;
+
+static struct ioreq_range_stat ranges[IOREQ_TRACE_MAX_RANGES];
+static struct ioreq_vcpu_trace last_req[ACRN_IO_REQUEST_MAX];
+static uint64_t dropped;
+static uint64_t start_tsc;
+static struct timespec start_ts;
+static pthread_mutex_t trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+lat_bucket(uint64_t v)
+{
+	int msb;
+
+	if (v < 2)
+		return (int)v;
+	msb = 63 - __builtin_clzll(v);
+	return msb * 2 + (int)((v >> (msb - 1)) & 1);
+}
+
+/* the smallest value of the next bucket */
+static uint64_t
+lat_bucket_end(int b)
+{
+	int msb;
+
+	b++;
+	if (b < 2)
+		return (uint64_t)b;
+	if (b >= IOREQ_LAT_BUCKETS)
+		return UINT64_MAX;
+	msb = b / 2;
+	return (1ULL << msb) | ((uint64_t)(b & 1) << (msb - 1));
+}
+
+static double
+tsc_per_us(void)
+{
+	struct timespec now;
+	uint64_t tsc = __rdtsc();
+	double us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start_ts.tv_sec) * 1e6 + (now.tv_nsec - start_ts.tv_nsec) / 1e3;
+
+	return (us > 0.0 && tsc > start_tsc) ? (tsc - start_tsc) / us : 0.0;
+}
+
+static struct ioreq_range_stat *
+find_range(struct acrn_io_request *io_req)
+{
+	char name[IOREQ_TRACE_NAME_LEN] = "";
+	uint64_t base;
+	int i, free_slot = -1;
+
+	switch (io_req->type) {
+	case ACRN_IOREQ_TYPE_PORTIO:
+		base = io_req->reqs.pio_request.address;
+		snprintf(name, sizeof(name), "%s", inout_port_name((int)base));
+		break;
+	case ACRN_IOREQ_TYPE_MMIO:
+		if (lookup_mem_range(io_req->reqs.mmio_request.address, &base, name, sizeof(name)) != 0) {
+			base = io_req->reqs.mmio_request.address & ~0xfffUL;
+			snprintf(name, sizeof(name), "unhandled");
+		}
+		break;
+	case ACRN_IOREQ_TYPE_WP:
+		/* all the protected pages in one */
+		base = 0;
+		snprintf(name, sizeof(name), "dirty-log");
+		break;
+	case ACRN_IOREQ_TYPE_PCICFG:
+		base = ((uint64_t)io_req->reqs.pci_request.bus << 8) |
+			((uint64_t)io_req->reqs.pci_request.dev << 3) |
+			(uint64_t)io_req->reqs.pci_request.func;
+		snprintf(name, sizeof(name), "pci-cfg");
+		break;
+	default:
+		return NULL;
+	}
+
+	for (i = 0; i < IOREQ_TRACE_MAX_RANGES; i++) {
+		if (!ranges[i].used) {
+			if (free_slot < 0)
+				free_slot = i;
+			continue;
+		}
+		if (ranges[i].type == io_req->type && ranges[i].base == base)
+			return &ranges[i];
+	}
+
+	if (free_slot < 0)
+		return NULL;
+
+	ranges[free_slot].used = true;
+	ranges[free_slot].type = io_req->type;
+	ranges[free_slot].base = base;
+	memcpy(ranges[free_slot].name, name, sizeof(name));
+	return &ranges[free_slot];
+}
+
+static void
+account_stage(struct ioreq_range_stat *range, int stage, uint64_t cycles)
+{
+	range->sum[stage] += cycles;
+	if (cycles > range->max[stage])
+		range->max[stage] = cycles;
+	range->hist[stage][lat_bucket(cycles)]++;
+}
+
+/* account the last request of the vCPU, complete at tsc_complete */
+static void
+account_request(struct ioreq_vcpu_trace *req, uint64_t tsc_complete, uint64_t max_cycles)
+{
+	struct ioreq_range_stat *range = req->range;
+
+	req->range = NULL;
+	if (tsc_complete <= req->tsc_handled || (tsc_complete - req->tsc_insert) > max_cycles)
+		return;
+
+	range->count++;
+	account_stage(range, STAGE_DISPATCH, req->tsc_pickup - req->tsc_insert);
+	account_stage(range, STAGE_HANDLER, req->tsc_handled - req->tsc_pickup);
+	account_stage(range, STAGE_COMPLETE, tsc_complete - req->tsc_handled);
+	account_stage(range, STAGE_TOTAL, tsc_complete - req->tsc_insert);
+}
+
+/*
+ * Called before the handler. The hypervisor stamps the completion of the
+ * previous request in the same slot, right before this one is inserted, so
+ * this is where the previous request is accounted.
+ */
+void
+ioreq_trace_pickup(struct acrn_io_request *io_req, int vcpu)
+{
+	struct ioreq_vcpu_trace *req = &last_req[vcpu];
+
+	if (req->range != NULL) {
+		pthread_mutex_lock(&trace_mtx);
+		if (req->range != NULL)
+			account_request(req, io_req->tsc_complete,
+				(uint64_t)(tsc_per_us() * 1e6 * IOREQ_LAT_MAX_SEC));
+		pthread_mutex_unlock(&trace_mtx);
+	}
+
+	io_req->tsc_pickup = __rdtsc();
+}
+
+void
+ioreq_trace_handled(struct acrn_io_request *io_req, int vcpu)
+{
+	struct ioreq_vcpu_trace *req = &last_req[vcpu];
+	struct ioreq_range_stat *range;
+
+	io_req->tsc_handled = __rdtsc();
+
+	/* a hypervisor without the stamps, or tracing just turned on */
+	if (io_req->tsc_insert == 0 || io_req->tsc_pickup == 0)
+		return;
+
+	pthread_mutex_lock(&trace_mtx);
+	range = find_range(io_req);
+	if (range != NULL) {
+		req->range = range;
+		req->tsc_insert = io_req->tsc_insert;
+		req->tsc_pickup = io_req->tsc_pickup;
+		req->tsc_handled = io_req->tsc_handled;
+	} else
+		dropped++;
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+static const char *
+type_name(uint32_t type)
+{
+	switch (type) {
+	case ACRN_IOREQ_TYPE_PORTIO:
+		return "pio";
+	case ACRN_IOREQ_TYPE_MMIO:
+		return "mmio";
+	case ACRN_IOREQ_TYPE_PCICFG:
+		return "pcicfg";
+	case ACRN_IOREQ_TYPE_WP:
+		return "wp";
+	default:
+		return "unknown";
+	}
+}
+
+/* upper bound of the bucket holding the p-th fraction of the samples, in us */
+static double
+hist_percentile(const uint32_t *hist, uint64_t count, double p, double cycles_per_us)
+{
+	uint64_t sum = 0, goal = (uint64_t)(count * p);
+	int b;
+
+	for (b = 0; b < IOREQ_LAT_BUCKETS; b++) {
+		sum += hist[b];
+		if (sum > goal)
+			break;
+	}
+
+	return (b < IOREQ_LAT_BUCKETS - 1) ? lat_bucket_end(b) / cycles_per_us : 0.0;
+}
+
+static cJSON *
+range_to_json(const struct ioreq_range_stat *range, bool with_hist, double cycles_per_us)
+{
+	cJSON *obj, *stages, *stage, *hist, *bucket;
+	char base[24];
+	int s, b;
+
+	obj = cJSON_CreateObject();
+	if (obj == NULL)
+		return NULL;
+
+	snprintf(base, sizeof(base), "0x%lx", range->base);
+	cJSON_AddStringToObject(obj, "name", range->name);
+	cJSON_AddStringToObject(obj, "type", type_name(range->type));
+	cJSON_AddStringToObject(obj, "base", base);
+	cJSON_AddNumberToObject(obj, "count", (double)range->count);
+
+	stages = cJSON_AddObjectToObject(obj, "stages");
+	for (s = 0; stages != NULL && s < STAGE_NUM; s++) {
+		stage = cJSON_AddObjectToObject(stages, stage_names[s]);
+		if (stage == NULL)
+			break;
+		cJSON_AddNumberToObject(stage, "avg_us", range->sum[s] / (double)range->count / cycles_per_us);
+		cJSON_AddNumberToObject(stage, "p50_us", hist_percentile(range->hist[s], range->count, 0.5, cycles_per_us));
+		cJSON_AddNumberToObject(stage, "p99_us", hist_percentile(range->hist[s], range->count, 0.99, cycles_per_us));
+		cJSON_AddNumberToObject(stage, "max_us", range->max[s] / cycles_per_us);
+		if (!with_hist)
+			continue;
+
+		/* [upper bound in us, count] of the buckets in use */
+		hist = cJSON_AddArrayToObject(stage, "hist");
+		for (b = 0; hist != NULL && b < IOREQ_LAT_BUCKETS; b++) {
+			if (range->hist[s][b] == 0)
+				continue;
+			bucket = cJSON_CreateArray();
+			if (bucket == NULL)
+				break;
+			cJSON_AddItemToArray(bucket, cJSON_CreateNumber(lat_bucket_end(b) / cycles_per_us));
+			cJSON_AddItemToArray(bucket, cJSON_CreateNumber(range->hist[s][b]));
+			cJSON_AddItemToArray(hist, bucket);
+		}
+	}
+
+	return obj;
+}
+
+static int
+cmp_total(const void *a, const void *b)
+{
+	const struct ioreq_range_stat *ra = *(const struct ioreq_range_stat **)a;
+	const struct ioreq_range_stat *rb = *(const struct ioreq_range_stat **)b;
+
+	return (ra->sum[STAGE_TOTAL] < rb->sum[STAGE_TOTAL]) - (ra->sum[STAGE_TOTAL] > rb->sum[STAGE_TOTAL]);
+}
+
+/*
+ * Render the ranges, the ones the guest spends most time on first, as many
+ * as fit in len. With a name, only its ranges and with their histograms.
+ */
+static int
+ioreq_trace_report(const char *name, char *buf, size_t len)
+{
+	struct ioreq_range_stat *sorted[IOREQ_TRACE_MAX_RANGES];
+	double cycles_per_us = tsc_per_us();
+	cJSON *root, *list, *item;
+	char *out = NULL;
+	int i, n = 0, ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+
+	cJSON_AddNumberToObject(root, "ack", 0);
+	cJSON_AddBoolToObject(root, "enabled", ioreq_trace_enabled);
+	cJSON_AddNumberToObject(root, "dropped", (double)dropped);
+	list = cJSON_AddArrayToObject(root, "ranges");
+
+	pthread_mutex_lock(&trace_mtx);
+	for (i = 0; i < IOREQ_TRACE_MAX_RANGES; i++) {
+		if (ranges[i].used && ranges[i].count != 0 &&
+		    (name == NULL || strcmp(name, ranges[i].name) == 0))
+			sorted[n++] = &ranges[i];
+	}
+	qsort(sorted, n, sizeof(sorted[0]), cmp_total);
+
+	for (i = 0; list != NULL && cycles_per_us > 0.0 && i < n; i++) {
+		item = range_to_json(sorted[i], name != NULL, cycles_per_us);
+		if (item != NULL)
+			cJSON_AddItemToArray(list, item);
+	}
+	pthread_mutex_unlock(&trace_mtx);
+
+	/* drop the least costly ranges until the reply fits */
+	while ((out = cJSON_PrintUnformatted(root)) != NULL && strlen(out) >= len &&
+	       list != NULL && cJSON_GetArraySize(list) > 0) {
+		free(out);
+		cJSON_DeleteItemFromArray(list, cJSON_GetArraySize(list) - 1);
+		if (cJSON_GetObjectItem(root, "truncated") == NULL)
+			cJSON_AddBoolToObject(root, "truncated", true);
+	}
+
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
+}
+
+static void
+ioreq_trace_reset(void)
+{
+	pthread_mutex_lock(&trace_mtx);
+	memset(ranges, 0, sizeof(ranges));
+	memset(last_req, 0, sizeof(last_req));
+	dropped = 0;
+	start_tsc = __rdtsc();
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+/*
+ * The "ioreq_latency" monitor command:
+ *   on / off / reset	start, stop or clear the tracing
+ *   (none)		latency summary of the ranges
+ *   <name>		summary and histograms of the ranges of device <name>
+ * The JSON reply is written to buf.
+ */
+int
+ioreq_trace_control(const char *option, char *buf, size_t len)
+{
+	if (strcmp(option, "on") == 0) {
+		ioreq_trace_reset();
+		ioreq_trace_enabled = true;
+	} else if (strcmp(option, "off") == 0) {
+		ioreq_trace_enabled = false;
+	} else if (strcmp(option, "reset") == 0) {
+		ioreq_trace_reset();
+	} else {
+		return ioreq_trace_report((option[0] != '\0') ? option : NULL, buf, len);
+	}
+
+	snprintf(buf, len, "{\"ack\":0}");
+	return 0;
+}
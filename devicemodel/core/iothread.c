@@ -11,37 +11,277 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/queue.h>
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <cjson/cJSON.h>
 
 #include "iothread.h"
+#include "atomic.h"
 #include "log.h"
 #include "mevent.h"
 #include "dm.h"
 
 
 #define MEVENT_MAX 64
+#define IOTHREAD_DEQUE_MASK	(IOTHREAD_DEQUE_LEN - 1U)
 
 static struct iothread_ctx ioctxes[IOTHREAD_NUM];
 static int ioctx_active_cnt;
 /* mutex to protect the free ioctx slot allocation */
 static pthread_mutex_t ioctxes_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static uint64_t
+iothread_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Poll the fds for up to poll_us, an event found this way saves the wakeup
+ * of the thread. Return what epoll_wait() does, 0 if the window expired.
+ */
+static int
+iothread_poll(struct iothread_ctx *ioctx_x, struct epoll_event *eventlist)
+{
+	uint64_t end = iothread_now_us() + ioctx_x->poll_us;
+	int n;
+
+	do {
+		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, 0);
+		if (n != 0)
+			return n;
+		__builtin_ia32_pause();
+	} while (ioctx_x->started && iothread_now_us() < end);
+
+	return 0;
+}
+
+/*
+ * Grow the poll window when the event came soon after the thread gave up
+ * polling, shrink it when the thread slept longer than it could poll.
+ */
+static void
+iothread_adjust_poll(struct iothread_ctx *ioctx_x, uint64_t slept_us)
+{
+	if (slept_us <= (uint64_t)ioctx_x->poll_max_us) {
+		if (ioctx_x->poll_us == 0)
+			ioctx_x->poll_us = IOTHREAD_POLL_START_US;
+		else
+			ioctx_x->poll_us *= 2;
+		if (ioctx_x->poll_us > ioctx_x->poll_max_us)
+			ioctx_x->poll_us = ioctx_x->poll_max_us;
+	} else {
+		ioctx_x->poll_us /= 2;
+		if (ioctx_x->poll_us < IOTHREAD_POLL_START_US)
+			ioctx_x->poll_us = 0;
+	}
+}
+
+static void
+iothread_wake(struct iothread_ctx *ioctx_x)
+{
+	if (eventfd_write(ioctx_x->wake_fd, 1) == -1)
+		pr_err("%s: eventfd_write fails \r\n", __func__);
+}
+
+static void
+iothread_wake_handler(void *arg)
+{
+	struct iothread_ctx *ioctx_x = arg;
+	eventfd_t val;
+
+	(void)eventfd_read(ioctx_x->wake_fd, &val);
+}
+
+static void
+iothread_push(struct iothread_ctx *ioctx_x, struct iothread_mevent *aevp)
+{
+	pthread_mutex_lock(&ioctx_x->dq_mtx);
+	ioctx_x->dq[ioctx_x->dq_tail & IOTHREAD_DEQUE_MASK] = aevp;
+	ioctx_x->dq_tail++;
+	pthread_mutex_unlock(&ioctx_x->dq_mtx);
+}
+
+/* the newest mevent of the own deque, the one most likely still in cache */
+static struct iothread_mevent *
+iothread_pop(struct iothread_ctx *ioctx_x)
+{
+	struct iothread_mevent *aevp = NULL;
+
+	pthread_mutex_lock(&ioctx_x->dq_mtx);
+	if (ioctx_x->dq_head != ioctx_x->dq_tail) {
+		ioctx_x->dq_tail--;
+		aevp = ioctx_x->dq[ioctx_x->dq_tail & IOTHREAD_DEQUE_MASK];
+	}
+	pthread_mutex_unlock(&ioctx_x->dq_mtx);
+
+	return aevp;
+}
+
+/* the oldest mevent of the deque of another thread */
+static struct iothread_mevent *
+iothread_steal(struct iothread_ctx *victim)
+{
+	struct iothread_mevent *aevp = NULL;
+
+	pthread_mutex_lock(&victim->dq_mtx);
+	if (victim->dq_head != victim->dq_tail) {
+		aevp = victim->dq[victim->dq_head & IOTHREAD_DEQUE_MASK];
+		victim->dq_head++;
+	}
+	pthread_mutex_unlock(&victim->dq_mtx);
+
+	return aevp;
+}
+
+static struct iothread_mevent *
+iothread_take(struct iothread_ctx *ioctx_x, bool steal)
+{
+	struct iothread_ctx *pool = ioctx_x->pool;
+	struct iothread_mevent *aevp;
+	int i, self = ioctx_x - pool;
+
+	aevp = iothread_pop(ioctx_x);
+	for (i = 1; steal && aevp == NULL && i < ioctx_x->pool_num; i++) {
+		aevp = iothread_steal(pool + (self + i) % ioctx_x->pool_num);
+		if (aevp != NULL)
+			ioctx_x->steals++;
+	}
+
+	return aevp;
+}
+
+/* let the idle threads of the pool steal what this one cannot run soon */
+static void
+iothread_wake_idle(struct iothread_ctx *ioctx_x)
+{
+	struct iothread_ctx *sibling;
+	unsigned int queued;
+	int i;
+
+	pthread_mutex_lock(&ioctx_x->dq_mtx);
+	queued = ioctx_x->dq_tail - ioctx_x->dq_head;
+	pthread_mutex_unlock(&ioctx_x->dq_mtx);
+
+	for (i = 0; queued > 1U && i < ioctx_x->pool_num; i++) {
+		sibling = ioctx_x->pool + i;
+		if (sibling != ioctx_x && atomic_load(&sibling->idle)) {
+			iothread_wake(sibling);
+			queued--;
+		}
+	}
+}
+
+/*
+ * Run a pooled mevent unless another one of its group is running, it is then
+ * handed to the thread running that one and false is returned. The fd is armed
+ * again afterwards, it is added with EPOLLONESHOT so that it is queued once at
+ * most.
+ */
+static bool
+iothread_run_pooled(struct iothread_ctx *ioctx_x, struct iothread_mevent *aevp)
+{
+	struct iothread_mevent *group = (aevp->group != NULL) ? aevp->group : aevp;
+	struct iothread_ctx *holder;
+	struct epoll_event ee;
+	int expected = 0;
+
+	if (!atomic_cmpxchg(&group->running, &expected, ioctx_x->idx + 1)) {
+		holder = &ioctxes[expected - 1];
+		iothread_push(holder, aevp);
+		iothread_wake(holder);
+		return false;
+	}
+
+	(*aevp->run)(aevp->arg);
+	atomic_store(&group->running, 0);
+
+	ee.events = EPOLLIN | EPOLLONESHOT;
+	ee.data.ptr = aevp;
+	/* ENOENT once the fd is deleted, the mevent is simply not run anymore */
+	(void)epoll_ctl(aevp->ioctx->epfd, EPOLL_CTL_MOD, aevp->fd, &ee);
+	return true;
+}
+
+static void
+iothread_run(struct iothread_ctx *ioctx_x, struct epoll_event *eventlist, int n)
+{
+	struct iothread_mevent *aevp;
+	bool steal = true;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		aevp = eventlist[i].data.ptr;
+		if (aevp && aevp->run) {
+			if (ioctx_x->pool != NULL && aevp != &ioctx_x->wake_mevt)
+				iothread_push(ioctx_x, aevp);
+			else
+				(*aevp->run)(aevp->arg);
+		}
+	}
+
+	if (ioctx_x->pool != NULL) {
+		iothread_wake_idle(ioctx_x);
+		/* stop stealing once a mevent is handed back, the next would likely be too */
+		while ((aevp = iothread_take(ioctx_x, steal)) != NULL) {
+			if (!iothread_run_pooled(ioctx_x, aevp))
+				steal = false;
+		}
+	}
+}
+
 static void *
 io_thread(void *arg)
 {
 	struct epoll_event eventlist[MEVENT_MAX];
-	struct iothread_mevent *aevp;
-	int i, n;
+	uint64_t start;
+	int n;
 	struct iothread_ctx *ioctx_x = (struct iothread_ctx *)arg;
+	struct iothread_ctx *pool = ioctx_x->pool;
 
 	set_thread_priority(PRIO_IOTHREAD, true);
 
 	while(ioctx_x->started) {
-		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, -1);
+		/* dropped between two passes only, for iothread_del() to wait for */
+		if (pool != NULL) {
+			pthread_rwlock_rdlock(&pool->pass_lock);
+			atomic_store(&ioctx_x->idle, 1);
+		}
+
+		/* the monitor may lower poll_max_us, see iothread_set_poll() */
+		if (ioctx_x->poll_us > ioctx_x->poll_max_us)
+			ioctx_x->poll_us = ioctx_x->poll_max_us;
+
+		n = 0;
+		if (ioctx_x->poll_us > 0) {
+			n = iothread_poll(ioctx_x, eventlist);
+			if (n > 0)
+				ioctx_x->poll_hits++;
+			else if (n == 0)
+				ioctx_x->poll_misses++;
+		}
+
+		if (n == 0) {
+			start = (ioctx_x->poll_max_us > 0) ? iothread_now_us() : 0;
+			n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, -1);
+			ioctx_x->sleeps++;
+			if (ioctx_x->poll_max_us > 0)
+				iothread_adjust_poll(ioctx_x, iothread_now_us() - start);
+		}
+
+		if (pool != NULL)
+			atomic_store(&ioctx_x->idle, 0);
+
 		if (n < 0) {
+			if (pool != NULL)
+				pthread_rwlock_unlock(&pool->pass_lock);
 			if (errno == EINTR) {
 				/* EINTR may happen when io_uring fd is monitored, it is harmless. */
 				continue;
@@ -50,12 +290,11 @@ io_thread(void *arg)
 				break;
 			}
 		}
-		for (i = 0; i < n; i++) {
-			aevp = eventlist[i].data.ptr;
-			if (aevp && aevp->run) {
-				(*aevp->run)(aevp->arg);
-			}
-		}
+		ioctx_x->events += n;
+		iothread_run(ioctx_x, eventlist, n);
+
+		if (pool != NULL)
+			pthread_rwlock_unlock(&pool->pass_lock);
 	}
 
 	return NULL;
@@ -73,13 +312,15 @@ iothread_start(struct iothread_ctx *ioctx_x)
 		return 0;
 	}
 
+	/* set first, the thread exits as soon as it finds it false */
+	ioctx_x->started = true;
 	if (pthread_create(&ioctx_x->tid, NULL, io_thread, ioctx_x) != 0) {
+		ioctx_x->started = false;
 		pthread_mutex_unlock(&ioctx_x->mtx);
 		pr_err("%s", "iothread create failed\r\n");
 		return -1;
 	}
 
-	ioctx_x->started = true;
 	pthread_setname_np(ioctx_x->tid, ioctx_x->name);
 
 	if (CPU_COUNT(&(ioctx_x->cpuset)) != 0) {
@@ -99,25 +340,42 @@ int
 iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt)
 {
 	struct epoll_event ee;
-	int ret;
+	int i, ret = 0;
 
 	if (ioctx_x == NULL) {
 		pr_err("%s: ioctx_x is NULL \n", __func__);
 		return -1;
 	}
 
+	aevt->ioctx = ioctx_x;
+	aevt->running = 0;
+
 	/* Create a epoll instance before the first fd is added.*/
 	ee.events = EPOLLIN;
+	if (ioctx_x->pool != NULL) {
+		if (atomic_add_fetch(&ioctx_x->pool->pool_mevents, 1) > IOTHREAD_DEQUE_LEN) {
+			atomic_sub_fetch(&ioctx_x->pool->pool_mevents, 1);
+			pr_err("%s: too many fds in the pool of %s\n", __func__, ioctx_x->name);
+			return -1;
+		}
+		ee.events |= EPOLLONESHOT;
+	}
 	ee.data.ptr = aevt;
 	ret = epoll_ctl(ioctx_x->epfd, EPOLL_CTL_ADD, fd, &ee);
 	if (ret < 0) {
 		pr_err("%s: failed to add fd, error is %d\n",
 			__func__, errno);
+		if (ioctx_x->pool != NULL)
+			atomic_sub_fetch(&ioctx_x->pool->pool_mevents, 1);
 		return ret;
 	}
 
-	/* Start the iothread after the first fd is added.*/
-	ret = iothread_start(ioctx_x);
+	/* Start the iothread after the first fd is added, all of them for a pool. */
+	if (ioctx_x->pool != NULL) {
+		for (i = 0; ret == 0 && i < ioctx_x->pool_num; i++)
+			ret = iothread_start(ioctx_x->pool + i);
+	} else
+		ret = iothread_start(ioctx_x);
 	if (ret < 0) {
 		pr_err("%s: failed to start iothread thread\n",
 			__func__);
@@ -125,6 +383,74 @@ iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt)
 	return ret;
 }
 
+/* drop the queued mevents of fd from the deques of the pool */
+static void
+iothread_pool_purge(struct iothread_ctx *pool, int fd)
+{
+	struct iothread_ctx *ioctx_x;
+	unsigned int i, j;
+	int k;
+
+	for (k = 0; k < pool->pool_num; k++) {
+		ioctx_x = pool + k;
+		pthread_mutex_lock(&ioctx_x->dq_mtx);
+		for (i = j = ioctx_x->dq_head; i != ioctx_x->dq_tail; i++) {
+			if (ioctx_x->dq[i & IOTHREAD_DEQUE_MASK]->fd != fd)
+				ioctx_x->dq[j++ & IOTHREAD_DEQUE_MASK] = ioctx_x->dq[i & IOTHREAD_DEQUE_MASK];
+		}
+		ioctx_x->dq_tail = j;
+		pthread_mutex_unlock(&ioctx_x->dq_mtx);
+	}
+}
+
+/*
+ * Any thread of the pool may run the mevent of fd, or have it queued. Wait
+ * for all of them to be between two passes, kicking those asleep, so that
+ * none does once fd is deleted.
+ */
+static int
+iothread_pool_del(struct iothread_ctx *ioctx_x, int fd)
+{
+	struct iothread_ctx *pool = ioctx_x->pool;
+	struct timespec ts;
+	bool in_pool = false;
+	int i, ret;
+
+	for (i = 0; i < pool->pool_num; i++) {
+		if (pool[i].started && pthread_equal(pool[i].tid, pthread_self()))
+			in_pool = true;
+	}
+
+	/* a thread of the pool cannot wait for itself */
+	if (!in_pool) {
+		do {
+			for (i = 0; i < pool->pool_num; i++) {
+				if (pool[i].started)
+					iothread_wake(pool + i);
+			}
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 1000000;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+		} while (pthread_rwlock_timedwrlock(&pool->pass_lock, &ts) == ETIMEDOUT);
+	}
+
+	ret = epoll_ctl(ioctx_x->epfd, EPOLL_CTL_DEL, fd, NULL);
+	if (ret < 0)
+		pr_err("%s: failed to delete fd from epoll fd, error is %d\n",
+			__func__, errno);
+	else
+		atomic_sub_fetch(&pool->pool_mevents, 1);
+	iothread_pool_purge(pool, fd);
+
+	if (!in_pool)
+		pthread_rwlock_unlock(&pool->pass_lock);
+
+	return ret;
+}
+
 int
 iothread_del(struct iothread_ctx *ioctx_x, int fd)
 {
@@ -135,6 +461,9 @@ iothread_del(struct iothread_ctx *ioctx_x, int fd)
 		return -1;
 	}
 
+	if (ioctx_x->pool != NULL)
+		return iothread_pool_del(ioctx_x, fd);
+
 	if (ioctx_x->epfd) {
 		ret = epoll_ctl(ioctx_x->epfd, EPOLL_CTL_DEL, fd, NULL);
 		if (ret < 0)
@@ -159,13 +488,29 @@ iothread_deinit(void)
 			pthread_mutex_lock(&ioctx_x->mtx);
 			ioctx_x->started = false;
 			pthread_mutex_unlock(&ioctx_x->mtx);
+			if (ioctx_x->pool != NULL)
+				iothread_wake(ioctx_x);
 			pthread_kill(ioctx_x->tid, SIGCONT);
 			pthread_join(ioctx_x->tid, &jval);
 		}
+	}
+
+	/* the threads of a pool use the fds and the deques of each other */
+	for (i = 0; i < ioctx_active_cnt; i++) {
+		ioctx_x = &ioctxes[i];
+
 		if (ioctx_x->epfd > 0) {
 			close(ioctx_x->epfd);
 			ioctx_x->epfd = -1;
 		}
+		if (ioctx_x->pool != NULL) {
+			close(ioctx_x->wake_fd);
+			ioctx_x->wake_fd = -1;
+			pthread_mutex_destroy(&ioctx_x->dq_mtx);
+			if (ioctx_x->pool == ioctx_x)
+				pthread_rwlock_destroy(&ioctx_x->pass_lock);
+			ioctx_x->pool = NULL;
+		}
 		pthread_mutex_destroy(&ioctx_x->mtx);
 		pr_info("%s stop \n", ioctx_x->name);
 	}
@@ -173,6 +518,82 @@ iothread_deinit(void)
 	pthread_mutex_unlock(&ioctxes_mutex);
 }
 
+static int
+iothread_pool_init(struct iothread_ctx *pool, int num)
+{
+	pthread_rwlockattr_t attr;
+	struct iothread_ctx *ioctx_x;
+	struct epoll_event ee;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		ioctx_x = pool + i;
+		ioctx_x->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (ioctx_x->wake_fd < 0) {
+			pr_err("%s: failed to create eventfd, error is %d\n", __func__, errno);
+			break;
+		}
+		ioctx_x->wake_mevt.run = iothread_wake_handler;
+		ioctx_x->wake_mevt.arg = ioctx_x;
+		ioctx_x->wake_mevt.fd = ioctx_x->wake_fd;
+		ioctx_x->wake_mevt.ioctx = ioctx_x;
+
+		ee.events = EPOLLIN;
+		ee.data.ptr = &ioctx_x->wake_mevt;
+		if (epoll_ctl(ioctx_x->epfd, EPOLL_CTL_ADD, ioctx_x->wake_fd, &ee) < 0) {
+			pr_err("%s: failed to add eventfd, error is %d\n", __func__, errno);
+			close(ioctx_x->wake_fd);
+			ioctx_x->wake_fd = -1;
+			break;
+		}
+	}
+
+	if (i < num) {
+		while (--i >= 0) {
+			close(pool[i].wake_fd);
+			pool[i].wake_fd = -1;
+		}
+		return -1;
+	}
+
+	/* the threads take it again right away, iothread_del() would starve */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&pool->pass_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	pool->pool_mevents = 0;
+
+	for (i = 0; i < num; i++) {
+		ioctx_x = pool + i;
+		ioctx_x->pool = pool;
+		ioctx_x->pool_num = num;
+		pthread_mutex_init(&ioctx_x->dq_mtx, NULL);
+		ioctx_x->dq_head = 0U;
+		ioctx_x->dq_tail = 0U;
+		ioctx_x->idle = 0;
+	}
+
+	return 0;
+}
+
+/* pin @cpuset to the (@n % count)th CPU of @cpus */
+static void
+iothread_spread_cpu(cpu_set_t *cpuset, const cpu_set_t *cpus, int n)
+{
+	int cpu, count = CPU_COUNT(cpus);
+
+	if (count == 0)
+		return;
+
+	n %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, cpus) && n-- == 0) {
+			CPU_SET(cpu, cpuset);
+			return;
+		}
+	}
+}
+
 /*
  * Create @ioctx_num iothread context instances
  * Return NULL if fails. Otherwise, return the base of those iothread context instances.
@@ -222,8 +643,21 @@ iothread_create(struct iothreads_option *iothr_opt)
 			ioctx_x->started = false;
 			ioctx_x->epfd = epoll_create1(0);
 
+			ioctx_x->poll_max_us = iothr_opt->poll_us;
+			ioctx_x->poll_us = iothr_opt->poll_us;
+			ioctx_x->poll_hits = 0;
+			ioctx_x->poll_misses = 0;
+			ioctx_x->sleeps = 0;
+			ioctx_x->events = 0;
+			ioctx_x->pool = NULL;
+			ioctx_x->pool_num = 0;
+			ioctx_x->wake_fd = -1;
+			ioctx_x->steals = 0;
+
 			CPU_ZERO(&(ioctx_x->cpuset));
-			if (iothr_opt->cpusets != NULL) {
+			if (iothr_opt->cpusets != NULL && iothr_opt->per_queue) {
+				iothread_spread_cpu(&(ioctx_x->cpuset), iothr_opt->cpusets, i - base);
+			} else if (iothr_opt->cpusets != NULL) {
 				memcpy(&(ioctx_x->cpuset), iothr_opt->cpusets + (i - base), sizeof(cpu_set_t));
 			}
 
@@ -239,6 +673,9 @@ iothread_create(struct iothreads_option *iothr_opt)
 				break;
 			}
 		}
+		/* a pool of one thread would only be slower */
+		if (ret == 0 && iothr_opt->pool && iothr_opt->num > 1)
+			ret = iothread_pool_init(&ioctxes[base], iothr_opt->num);
 		if (ret == 0) {
 			ioctx_base = &ioctxes[base];
 			ioctx_active_cnt = end;
@@ -259,7 +696,8 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 	char *tmp_num = NULL;
 	char *tmp_cpusets = NULL;
 	char *tmp_cpux = NULL;
-	int service_vm_cpuid, iothread_sub_idx, num;
+	int service_vm_cpuid, iothread_sub_idx, num, nr_sets, poll_us = 0;
+	bool pool = false, per_queue = false;
 	cpu_set_t *cpuset_list = NULL;
 
 	/*
@@ -285,6 +723,18 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 	 *   - 2nd iothread instance <-> Service VM CPU 0,1
 	 *   - 3rd iothread instance <-> No CPU affinity settings
 	 *
+	 * - create 2 iothread instances for virtio-blk, which busy poll for
+	 *   up to 50us before sleeping, pinned to Service VM CPU 2 and 3
+	 *   ... virtio-blk iothread=2:poll=50@2/3,...
+	 *
+	 * - create a pool of 4 iothread instances for virtio-blk, any of which
+	 *   may handle any virtqueue, one thread at a time for each
+	 *   ... virtio-blk iothread=4:pool,mq=8,...
+	 *
+	 * - create one iothread instance for each of the 4 virtqueues, pinned
+	 *   to Service VM CPU 2, 3, 2 and 3
+	 *   ... virtio-blk iothread=auto@2:3,mq=4,...
+	 *
 	 */
 	if (str != NULL) {
 		/*
@@ -295,19 +745,44 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 		tmp_num = strsep(&str, "@");
 
 		if (tmp_num != NULL) {
-			if (dm_strtoi(tmp_num, &tmp_num, 10, &num) || (num <= 0)) {
+			if (!strncmp(tmp_num, "auto", strlen("auto"))) {
+				/* the device sets the number, one for each of its queues */
+				per_queue = true;
+				num = 0;
+				tmp_num += strlen("auto");
+			} else if (dm_strtoi(tmp_num, &tmp_num, 10, &num) || (num <= 0)) {
 				pr_err("%s: invalid iothread number %s \n", __func__, tmp_num);
 				return -1;
 			}
 
-			cpuset_list = calloc(num, sizeof(cpu_set_t));
+			/* ":poll=<us>", the busy poll window, and ":pool" are optional */
+			while (*tmp_num != '\0') {
+				if (!strncmp(tmp_num, ":poll=", strlen(":poll="))) {
+					if (dm_strtoi(tmp_num + strlen(":poll="), &tmp_num, 10, &poll_us) ||
+						(poll_us < 0)) {
+						pr_err("%s: invalid iothread poll setting %s \n", __func__, tmp_num);
+						return -1;
+					}
+				} else if (!strncmp(tmp_num, ":pool", strlen(":pool")) &&
+					(tmp_num[strlen(":pool")] == '\0' || tmp_num[strlen(":pool")] == ':')) {
+					pool = true;
+					tmp_num += strlen(":pool");
+				} else {
+					pr_err("%s: invalid iothread setting %s \n", __func__, tmp_num);
+					return -1;
+				}
+			}
+
+			/* "auto" has a single set, of the CPUs to spread the threads on */
+			nr_sets = per_queue ? 1 : num;
+			cpuset_list = calloc(nr_sets, sizeof(cpu_set_t));
 			if (cpuset_list == NULL) {
 				pr_err("%s: calloc cpuset_list returns NULL \n", __func__);
 				return -1;
 			}
 
 			iothread_sub_idx = 0;
-			while ((str != NULL) && (*str !='\0') && (iothread_sub_idx < num)) {
+			while ((str != NULL) && (*str !='\0') && (iothread_sub_idx < nr_sets)) {
 				/* "/" is used to separate the CPU affinity setting for each iothread instance. */
 				tmp_cpusets = strsep(&str, "/");
 
@@ -342,6 +817,9 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 		}
 	}
 	iothr_opt->num = num;
+	iothr_opt->poll_us = poll_us;
+	iothr_opt->pool = pool;
+	iothr_opt->per_queue = per_queue;
 	iothr_opt->cpusets = cpuset_list;
 
 	return 0;
@@ -360,3 +838,116 @@ void iothread_free_options(struct iothreads_option *iothr_opt)
 
 	return;
 }
+
+/*
+ * Write the busy poll statistics of the iothreads to buf, as JSON. The
+ * counters are read while the threads update them, they are only a view.
+ */
+int
+iothread_get_stats(char *buf, size_t len)
+{
+	struct iothread_ctx *ioctx_x;
+	cJSON *root, *list, *obj;
+	char *out;
+	int i, ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	cJSON_AddNumberToObject(root, "ack", 0);
+	list = cJSON_AddArrayToObject(root, "iothreads");
+
+	pthread_mutex_lock(&ioctxes_mutex);
+	for (i = 0; list != NULL && i < ioctx_active_cnt; i++) {
+		ioctx_x = &ioctxes[i];
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+		cJSON_AddStringToObject(obj, "name", ioctx_x->name);
+		cJSON_AddNumberToObject(obj, "poll_max_us", ioctx_x->poll_max_us);
+		cJSON_AddNumberToObject(obj, "poll_us", ioctx_x->poll_us);
+		cJSON_AddNumberToObject(obj, "events", (double)ioctx_x->events);
+		cJSON_AddNumberToObject(obj, "poll_hits", (double)ioctx_x->poll_hits);
+		cJSON_AddNumberToObject(obj, "poll_misses", (double)ioctx_x->poll_misses);
+		cJSON_AddNumberToObject(obj, "sleeps", (double)ioctx_x->sleeps);
+		if (ioctx_x->pool != NULL)
+			cJSON_AddNumberToObject(obj, "steals", (double)ioctx_x->steals);
+		/* the wakeups polling saved, out of all those the thread had */
+		cJSON_AddNumberToObject(obj, "poll_hit_ratio", (ioctx_x->poll_hits + ioctx_x->sleeps) ?
+			(double)ioctx_x->poll_hits / (ioctx_x->poll_hits + ioctx_x->sleeps) : 0.0);
+		cJSON_AddItemToArray(list, obj);
+	}
+	pthread_mutex_unlock(&ioctxes_mutex);
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
+}
+
+/* the active iothread called name, with ioctxes_mutex held */
+static struct iothread_ctx *
+iothread_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ioctx_active_cnt; i++) {
+		if (strcmp(ioctxes[i].name, name) == 0)
+			return &ioctxes[i];
+	}
+	pr_err("%s: no iothread %s\n", __func__, name);
+	return NULL;
+}
+
+/*
+ * A new poll window for an iothread, from the monitor; 0 stops polling.
+ * The thread clamps its adaptive window to it before its next poll.
+ */
+int
+iothread_set_poll(const char *name, int poll_max_us)
+{
+	struct iothread_ctx *ioctx_x;
+
+	if (poll_max_us < 0)
+		return -1;
+
+	pthread_mutex_lock(&ioctxes_mutex);
+	ioctx_x = iothread_find(name);
+	if (ioctx_x != NULL)
+		ioctx_x->poll_max_us = poll_max_us;
+	pthread_mutex_unlock(&ioctxes_mutex);
+
+	return (ioctx_x != NULL) ? 0 : -1;
+}
+
+/* pin an iothread to new CPUs, from the monitor */
+int
+iothread_set_affinity(const char *name, const cpu_set_t *cpuset)
+{
+	struct iothread_ctx *ioctx_x;
+	int ret = -1;
+
+	pthread_mutex_lock(&ioctxes_mutex);
+	ioctx_x = iothread_find(name);
+	if (ioctx_x != NULL) {
+		pthread_mutex_lock(&ioctx_x->mtx);
+		ret = 0;
+		if (ioctx_x->started) {
+			ret = pthread_setaffinity_np(ioctx_x->tid, sizeof(cpuset_t), cpuset);
+			if (ret != 0)
+				pr_err("pthread_setaffinity_np fails %d \n", ret);
+		}
+		/* kept for a restart of the thread */
+		if (ret == 0)
+			memcpy(&(ioctx_x->cpuset), cpuset, sizeof(cpu_set_t));
+		pthread_mutex_unlock(&ioctx_x->mtx);
+	}
+	pthread_mutex_unlock(&ioctxes_mutex);
+
+	return (ret == 0) ? 0 : -1;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <cjson/cJSON.h>
+
+#include "vmmapi.h"
+#include "monitor.h"
+#include "launch_timeline.h"
+#include "log.h"
+
+#define LAUNCH_PHASES_MAX	32
+#define LAUNCH_VDEVS_MAX	128
+#define LAUNCH_NAME_LEN		32
+
+struct launch_phase {
+	char name[LAUNCH_NAME_LEN];
+	uint64_t start_us;	/* from the start of the launch */
+	uint64_t duration_us;
+};
+
+struct launch_vdev {
+	char name[LAUNCH_NAME_LEN];
+	int bus, slot, func;
+	int err;
+	uint64_t start_us;
+	uint64_t duration_us;
+};
+
+static pthread_mutex_t timeline_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t launch_start_us;
+static uint64_t launch_total_us;
+static bool launch_done;
+static struct launch_phase phases[LAUNCH_PHASES_MAX];
+static int nr_phases;
+static struct launch_vdev vdevs[LAUNCH_VDEVS_MAX];
+static int nr_vdevs;
+static int nr_dropped;
+static char *timeline_path;
+
+/* --launch_timeline <file>: also write the timeline to the file */
+int
+launch_timeline_parse_options(const char *path)
+{
+	free(timeline_path);
+	timeline_path = strdup(path);
+	return (timeline_path != NULL) ? 0 : -1;
+}
+
+uint64_t
+launch_timeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* start a new timeline, at each (re)launch of the VM */
+void
+launch_timeline_reset(void)
+{
+	pthread_mutex_lock(&timeline_mtx);
+	launch_start_us = launch_timeline_now();
+	launch_total_us = 0;
+	launch_done = false;
+	nr_phases = 0;
+	nr_vdevs = 0;
+	nr_dropped = 0;
+	pthread_mutex_unlock(&timeline_mtx);
+}
+
+/* record a phase which started at start_us and ends now */
+void
+launch_timeline_add_phase(const char *name, uint64_t start_us)
+{
+	struct launch_phase *phase;
+	uint64_t now = launch_timeline_now();
+
+	pthread_mutex_lock(&timeline_mtx);
+	if (launch_done || nr_phases >= LAUNCH_PHASES_MAX) {
+		if (!launch_done)
+			nr_dropped++;
+		pthread_mutex_unlock(&timeline_mtx);
+		return;
+	}
+	phase = &phases[nr_phases++];
+	snprintf(phase->name, LAUNCH_NAME_LEN, "%s", name);
+	phase->start_us = start_us - launch_start_us;
+	phase->duration_us = now - start_us;
+	pthread_mutex_unlock(&timeline_mtx);
+}
+
+/* record the init of a PCI device, which started at start_us and ends now */
+void
+launch_timeline_add_vdev(const char *name, int bus, int slot, int func,
+		uint64_t start_us, int err)
+{
+	struct launch_vdev *vdev;
+	uint64_t now = launch_timeline_now();
+
+	pthread_mutex_lock(&timeline_mtx);
+	if (launch_done || nr_vdevs >= LAUNCH_VDEVS_MAX) {
+		if (!launch_done)
+			nr_dropped++;
+		pthread_mutex_unlock(&timeline_mtx);
+		return;
+	}
+	vdev = &vdevs[nr_vdevs++];
+	snprintf(vdev->name, LAUNCH_NAME_LEN, "%s", name);
+	vdev->bus = bus;
+	vdev->slot = slot;
+	vdev->func = func;
+	vdev->err = err;
+	vdev->start_us = start_us - launch_start_us;
+	vdev->duration_us = now - start_us;
+	pthread_mutex_unlock(&timeline_mtx);
+}
+
+/* called with timeline_mtx held */
+static cJSON *
+launch_timeline_json(void)
+{
+	cJSON *root, *obj, *list, *item;
+	char bdf[16];
+	int i;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return NULL;
+	obj = cJSON_AddObjectToObject(root, "launch_timeline");
+	if (obj == NULL)
+		goto fail;
+
+	cJSON_AddBoolToObject(obj, "done", launch_done);
+	cJSON_AddNumberToObject(obj, "total_us", (double)launch_total_us);
+	cJSON_AddNumberToObject(obj, "dropped", nr_dropped);
+
+	list = cJSON_AddArrayToObject(obj, "phases");
+	for (i = 0; list != NULL && i < nr_phases; i++) {
+		item = cJSON_CreateObject();
+		if (item == NULL)
+			goto fail;
+		cJSON_AddStringToObject(item, "name", phases[i].name);
+		cJSON_AddNumberToObject(item, "start_us", (double)phases[i].start_us);
+		cJSON_AddNumberToObject(item, "duration_us", (double)phases[i].duration_us);
+		cJSON_AddItemToArray(list, item);
+	}
+
+	list = cJSON_AddArrayToObject(obj, "vdevs");
+	for (i = 0; list != NULL && i < nr_vdevs; i++) {
+		item = cJSON_CreateObject();
+		if (item == NULL)
+			goto fail;
+		snprintf(bdf, sizeof(bdf), "%02x:%02x.%x",
+			vdevs[i].bus, vdevs[i].slot, vdevs[i].func);
+		cJSON_AddStringToObject(item, "name", vdevs[i].name);
+		cJSON_AddStringToObject(item, "bdf", bdf);
+		cJSON_AddNumberToObject(item, "start_us", (double)vdevs[i].start_us);
+		cJSON_AddNumberToObject(item, "duration_us", (double)vdevs[i].duration_us);
+		cJSON_AddNumberToObject(item, "error", vdevs[i].err);
+		cJSON_AddItemToArray(list, item);
+	}
+
+	return root;
+
+fail:
+	cJSON_Delete(root);
+	return NULL;
+}
+
+/*
+ * The VM runs: close the timeline, send it to the vm_event client and write
+ * it to the file. Only the first vm_run() of a launch counts.
+ */
+void
+launch_timeline_done(void)
+{
+	cJSON *root;
+	char *msg = NULL, *out = NULL;
+	FILE *fp;
+
+	pthread_mutex_lock(&timeline_mtx);
+	if (launch_done) {
+		pthread_mutex_unlock(&timeline_mtx);
+		return;
+	}
+	launch_done = true;
+	launch_total_us = launch_timeline_now() - launch_start_us;
+	root = launch_timeline_json();
+	pthread_mutex_unlock(&timeline_mtx);
+
+	pr_notice("%s: VM runs %lu ms after launch\n", __func__,
+		launch_total_us / 1000);
+
+	if (root == NULL) {
+		pr_err("Failed to generate launch timeline message.\n");
+		return;
+	}
+
+	/* the client buffer is 4K, a message too large for it is dropped */
+	msg = cJSON_PrintUnformatted(root);
+	if (msg != NULL && vm_monitor_send_vm_event(msg) < 0)
+		pr_info("%s: launch timeline not sent to a vm_event client\n", __func__);
+
+	if (timeline_path != NULL) {
+		out = cJSON_Print(root);
+		fp = fopen(timeline_path, "w");
+		if (fp != NULL && out != NULL)
+			fprintf(fp, "%s\n", out);
+		else
+			pr_err("%s: can't write %s\n", __func__, timeline_path);
+		if (fp != NULL)
+			fclose(fp);
+	}
+
+	free(out);
+	free(msg);
+	cJSON_Delete(root);
+}
+
+/* the timeline so far, for the monitor */
+int
+launch_timeline_get(char *buf, size_t len)
+{
+	cJSON *root;
+	char *out;
+	int ret = -1;
+
+	pthread_mutex_lock(&timeline_mtx);
+	root = launch_timeline_json();
+	pthread_mutex_unlock(&timeline_mtx);
+	if (root == NULL)
+		return -1;
+
+	cJSON_AddNumberToObject(root, "ack", 0);
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
+}
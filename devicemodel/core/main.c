@@ -58,6 +58,7 @@
 #include "version.h"
 #include "sw_load.h"
 #include "monitor.h"
+#include "acrn_mngr.h"
 #include "ioc.h"
 #include "pm.h"
 #include "atomic.h"
@@ -72,6 +73,12 @@
 #include "vdisplay.h"
 #include "iothread.h"
 #include "vm_event.h"
+#include "sbuf.h"
+#include "ioreq_trace.h"
+#include "ioreq_poll.h"
+#include "ioreq_dispatch.h"
+#include "launch_timeline.h"
+#include "snapshot.h"
 
 #define	VM_MAXCPU		16	/* maximum virtual cpus */
 
@@ -103,6 +110,10 @@ bool is_winvm;
 bool skip_pci_mem64bar_workaround = false;
 bool gfx_ui = false;
 bool ovmf_loaded = false;
+bool warm_reset = false;
+bool hv_vhpet = false;
+bool hv_vpit = false;
+char *restore_file_name = NULL;
 
 static int guest_ncpus;
 static int virtio_msix = 1;
@@ -119,6 +130,8 @@ static void vm_loop(struct vmctx *ctx);
 
 static char io_request_page[4096] __aligned(4096);
 static char asyncio_page[4096] __aligned(4096);
+static char posted_io_page[4096] __aligned(4096);
+static char msi_ring_page[4096] __aligned(4096);
 
 static struct acrn_io_request *ioreq_buf =
 				(struct acrn_io_request *)&io_request_page;
@@ -132,6 +145,7 @@ struct dmstats {
 	uint64_t	cpu_switch_rotate;
 	uint64_t	cpu_switch_direct;
 	uint64_t	vmexit_mmio_emul;
+	uint64_t	vmexit_wp;
 } stats;
 
 struct mt_vmm_info {
@@ -150,13 +164,17 @@ usage(int code)
 		"       %*s [-k kernel_image_path]\n"
 		"       %*s [-l lpc] [-m mem] [-r ramdisk_image_path]\n"
 		"       %*s [-s pci] [--ovmf ovmf_file_path]\n"
-		"       %*s [--iasl iasl_compiler_path]\n"
+		"       %*s [--iasl iasl_compiler_path] [--acpi_cache dir]\n"
 		"       %*s [--enable_trusty] [--intr_monitor param_setting]\n"
 		"       %*s [--acpidev_pt HID] [--mmiodev_pt MMIO_Regions]\n"
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval]\n"
-		"       %*s [--cpu_affinity lapic_id] [--lapic_pt] [--rtvm] [--windows]\n"
+		"       %*s [--cpu_affinity lapic_id] [--cpu_hotplug lapic_id]\n"
+		"       %*s [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
-		"       %*s [--ssram] <vm>\n"
+		"       %*s [--ssram] [--ioreq_threads num[@cpus]] [--ioreq_poll us[@cpu]]\n"
+		"       %*s [--mem_prefault num] [--mem_pool dir]\n"
+		"       %*s [--launch_timeline file] [--warm_reset] [--restore file]\n"
+		"       %*s [--vhpet] [--vpit] <vm>\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
 		"       -h: help\n"
@@ -168,9 +186,12 @@ usage(int code)
 		"       -v: version\n"
 		"       --ovmf: ovmf file path\n"
 		"       --iasl: iasl compiler path\n"
+		"       --acpi_cache: directory of the ACPI tables compiled, reused by their source\n"
 		"       --ssram: Configure Software SRAM parameters\n"
 		"       --cpu_affinity: list of Service VM vCPUs assigned to this User VM, the vCPUs are"
 		"	     identified by their local APIC IDs.\n"
+		"       --cpu_hotplug: list of pCPUs the User VM may get vCPUs on while it runs, the pCPUs are"
+		"	     identified by their local APIC IDs.\n"
 		"       --enable_trusty: enable trusty for guest\n"
 		"       --debugexit: enable debug exit function\n"
 		"       --intr_monitor: enable interrupt storm monitor\n"
@@ -186,11 +207,24 @@ usage(int code)
 		"       --logger_setting: params like console,level=4;kmsg,level=3\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
 		"            for windows guest with secure boot\n"
-		"       --virtio_msi: force virtio to use single-vector MSI\n",
+		"       --virtio_msi: force virtio to use single-vector MSI\n"
+		"       --ioreq_threads: handle the I/O requests on num threads, sharded by vCPU\n"
+		"            its params: num[@cpu:cpu/cpu...], CPU affinity of each thread\n"
+		"       --ioreq_poll: poll the I/O request page for up to us before sleeping\n"
+		"            its params: us[@cpu], the Service VM CPU to pin the polling thread to\n"
+		"       --mem_prefault: fault in and clear the guest memory on num threads\n"
+		"       --mem_pool: directory of the hugetlbfs files of pre-zeroed pages\n"
+		"       --launch_timeline: also write the launch timeline to the file\n"
+		"       --warm_reset: reset the devices on a guest reboot instead of re-creating them\n"
+		"       --restore: start the VM from the snapshot file taken of it\n"
+		"       --vhpet: emulate the HPET in the hypervisor\n"
+		"       --vpit: emulate the PIT in the hypervisor\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "");
 
 	exit(code);
@@ -338,7 +372,9 @@ add_cpu(struct vmctx *ctx, int vcpu_num)
 		mt_vmm_info[i].mt_vcpu = i;
 	}
 
-	vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
+	/* the vCPUs restored from a snapshot have their state already */
+	if (restore_file_name == NULL)
+		vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
 
 	error = pthread_create(&mt_vmm_info[0].mt_thr, NULL,
 	    start_thread, &mt_vmm_info[0]);
@@ -442,6 +478,17 @@ vmexit_pci_emul(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
 	}
 }
 
+/* a write to a page protected for a dirty log */
+static void
+vmexit_wp(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
+{
+	stats.vmexit_wp++;
+	if (vm_dirty_log_write(ctx, &io_req->reqs.mmio_request) != 0)
+		pr_err("Unhandled write to the protected page at 0x%lx, size %ld\n",
+			io_req->reqs.mmio_request.address,
+			io_req->reqs.mmio_request.size);
+}
+
 #define	DEBUG_EPT_MISCONFIG
 
 #ifdef DEBUG_EPT_MISCONFIG
@@ -456,6 +503,7 @@ enum vm_exitcode {
 	VM_EXITCODE_INOUT = 0,
 	VM_EXITCODE_MMIO_EMUL,
 	VM_EXITCODE_PCI_CFG,
+	VM_EXITCODE_WP,
 	VM_EXITCODE_MAX
 };
 
@@ -463,12 +511,16 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 	[VM_EXITCODE_INOUT]  = vmexit_inout,
 	[VM_EXITCODE_MMIO_EMUL] = vmexit_mmio_emul,
 	[VM_EXITCODE_PCI_CFG] = vmexit_pci_emul,
+	[VM_EXITCODE_WP] = vmexit_wp,
 };
 
-static void
-handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
+/* emulate the request, return whether its completion may be notified now */
+static bool
+emulate_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 {
 	enum vm_exitcode exitcode;
+	struct timespec start;
+	bool timed = monitor_metrics_enabled;
 
 	exitcode = io_req->type;
 	if (exitcode >= VM_EXITCODE_MAX || handler[exitcode] == NULL) {
@@ -477,8 +529,19 @@ handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 		exit(1);
 	}
 
+	if (ioreq_trace_enabled)
+		ioreq_trace_pickup(io_req, vcpu);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
 	(*handler[exitcode])(ctx, io_req, &vcpu);
 
+	if (timed)
+		monitor_account_ioreq(io_req->type, &start);
+
+	if (ioreq_trace_enabled)
+		ioreq_trace_handled(io_req, vcpu);
+
 	/* We cannot notify the HSM/hypervisor on the request completion at this
 	 * point if the User VM is in suspend or system reset mode, as the VM is
 	 * still not paused and a notification can kick off the vcpu to run
@@ -488,9 +551,16 @@ handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 	 */
 	if ((VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) ||
 		(VM_SUSPEND_SUSPEND == vm_get_suspend_mode()))
-		return;
+		return false;
+
+	return true;
+}
 
-	vm_notify_request_done(ctx, vcpu);
+static void
+handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
+{
+	if (emulate_vmexit(ctx, io_req, vcpu))
+		vm_notify_request_done(ctx, vcpu);
 }
 
 static int
@@ -533,6 +603,7 @@ guest_pm_notify_deinit(struct vmctx *ctx)
 static int
 vm_init_vdevs(struct vmctx *ctx)
 {
+	uint64_t phase_us;
 	int ret;
 
 	init_mem();
@@ -576,7 +647,9 @@ vm_init_vdevs(struct vmctx *ctx)
 	if (ret < 0)
 		goto mmio_dev_fail;
 
+	phase_us = launch_timeline_now();
 	ret = init_pci(ctx);
+	launch_timeline_add_phase("init_pci", phase_us);
 	if (ret < 0)
 		goto pci_fail;
 
@@ -619,9 +692,10 @@ vm_deinit_vdevs(struct vmctx *ctx)
 	 */
 	acrn_writeback_ovmf_nvstorage(ctx);
 
+	/* the monitor samples the virtio queues for its metrics */
+	monitor_close();
 	deinit_pci(ctx);
 	deinit_mmio_devs(ctx);
-	monitor_close();
 
 	if (debugexit_enabled)
 		deinit_debugexit();
@@ -642,6 +716,8 @@ vm_deinit_vdevs(struct vmctx *ctx)
 static void
 vm_reset_vdevs(struct vmctx *ctx)
 {
+	bool warm;
+
 	/*
 	 * Write ovmf NV storage back to the original file from guest
 	 * memory before deinit operations.
@@ -649,9 +725,10 @@ vm_reset_vdevs(struct vmctx *ctx)
 	acrn_writeback_ovmf_nvstorage(ctx);
 
 	/*
-	 * The current virtual devices doesn't define virtual
-	 * device reset function. So we call vdev deinit/init
-	 * pairing to emulate the device reset operation.
+	 * With --warm_reset, the PCI devices that all define a vdev_reset
+	 * are reset in place, keeping their irqs, BARs and backends.
+	 * Otherwise, vdev deinit/init pairing emulates the device reset
+	 * operation.
 	 *
 	 * pci/ioapic deinit/init is needed because of dependency
 	 * of pci irq allocation/free.
@@ -659,6 +736,9 @@ vm_reset_vdevs(struct vmctx *ctx)
 	 * acpi build is necessary because irq for each vdev
 	 * could be assigned with different number after reset.
 	 */
+	warm = warm_reset && can_reset_pci();
+	pr_info("%s: %s reset of the devices\n", __func__, warm ? "warm" : "cold");
+
 	atkbdc_deinit(ctx);
 
 	if (debugexit_enabled)
@@ -671,13 +751,15 @@ vm_reset_vdevs(struct vmctx *ctx)
 	vpit_deinit(ctx);
 	vrtc_deinit(ctx);
 
-	deinit_pci(ctx);
-	pci_irq_deinit(ctx);
-	ioapic_deinit();
+	if (!warm) {
+		deinit_pci(ctx);
+		pci_irq_deinit(ctx);
+		ioapic_deinit();
 
-	iothread_deinit();
+		iothread_deinit();
 
-	pci_irq_init(ctx);
+		pci_irq_init(ctx);
+	}
 	atkbdc_init(ctx);
 	vrtc_init(ctx);
 	vpit_init(ctx);
@@ -689,8 +771,12 @@ vm_reset_vdevs(struct vmctx *ctx)
 	if (ssram)
 		init_vssram(ctx);
 
-	ioapic_init(ctx);
-	init_pci(ctx);
+	if (warm) {
+		reset_pci(ctx);
+	} else {
+		ioapic_init(ctx);
+		init_pci(ctx);
+	}
 
 	acpi_build(ctx, guest_ncpus);
 }
@@ -759,6 +845,7 @@ vm_suspend_resume(struct vmctx *ctx)
 
 	vm_clear_ioreq(ctx);
 	vm_stop_watchdog(ctx);
+	monitor_notify_state(DM_NOTIFY_SUSPENDED);
 	wait_for_resume(ctx);
 
 	pm_backto_wakeup(ctx);
@@ -792,11 +879,54 @@ vm_suspend_resume(struct vmctx *ctx)
 	/* set the BSP init state */
 	vm_set_vcpu_regs(ctx, &bsp_regs);
 	vm_run(ctx);
+	monitor_notify_state(DM_NOTIFY_RUNNING);
+}
+
+/*
+ * Emulate the writes the hypervisor posted without suspending the vCPU.
+ * It runs before the synchronous requests are handled, so a vCPU always
+ * observes its earlier posted writes as completed.
+ */
+static void
+vm_drain_posted_io(struct vmctx *ctx)
+{
+	struct shared_buf *sbuf = (struct shared_buf *)posted_io_page;
+	struct acrn_posted_io posted;
+	struct acrn_pio_request pio_req;
+	struct acrn_mmio_request mmio_req;
+	int vcpu, error;
+
+	while (!sbuf_is_empty(sbuf)) {
+		if (sbuf_get(sbuf, (uint8_t *)&posted) == 0)
+			break;
+
+		vcpu = posted.vcpu_id;
+		if (posted.type == ACRN_IOREQ_TYPE_PORTIO) {
+			bzero(&pio_req, sizeof(pio_req));
+			pio_req.direction = ACRN_IOREQ_DIR_WRITE;
+			pio_req.address = posted.addr;
+			pio_req.size = posted.size;
+			pio_req.value = (uint32_t)posted.value;
+			error = emulate_inout(ctx, &vcpu, &pio_req);
+		} else {
+			bzero(&mmio_req, sizeof(mmio_req));
+			mmio_req.direction = ACRN_IOREQ_DIR_WRITE;
+			mmio_req.address = posted.addr;
+			mmio_req.size = posted.size;
+			mmio_req.value = posted.value;
+			error = emulate_mem(ctx, &mmio_req);
+		}
+
+		if (error)
+			pr_err("Unhandled posted write 0x%lx, size %d\n",
+				posted.addr, posted.size);
+	}
 }
 
 static void
 vm_loop(struct vmctx *ctx)
 {
+	uint64_t phase_us;
 	int error;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
@@ -805,24 +935,73 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_dispatch_enabled() &&
+	    ioreq_dispatch_init(ctx, ioreq_buf, guest_ncpus, handle_vmexit) != 0) {
+		pr_err("%s, failed to start the ioreq threads.\n", __func__);
+		return;
+	}
+
+	if (ioreq_poll_enabled() && ioreq_poll_init(ioreq_buf, guest_ncpus) != 0) {
+		pr_err("%s, failed to set up the ioreq polling.\n", __func__);
+		return;
+	}
+
+	phase_us = launch_timeline_now();
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
 		return;
 	}
+	launch_timeline_add_phase("vm_run", phase_us);
+	launch_timeline_done();
+	monitor_notify_state(DM_NOTIFY_RUNNING);
 
 	while (1) {
 		int vcpu_id;
+		uint64_t done, scan;
 		struct acrn_io_request *io_req;
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
+		/* the client keeps waking up while a thread owns a request */
+		if (ioreq_dispatch_busy()) {
+			ioreq_dispatch_wait();
+		} else {
+			if (ioreq_poll_enabled())
+				error = ioreq_poll_attach(ctx);
+			else
+				error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
+		}
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			io_req = &ioreq_buf[vcpu_id];
-			if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
-				&& !io_req->kernel_handled)
-				handle_vmexit(ctx, io_req, vcpu_id);
+		/* the MSIs raised by the requests of a pass are injected together */
+		vm_msi_batch_begin(ctx);
+		if (ctx->posted_io) {
+			ioreq_emulate_exclusive_begin();
+			vm_drain_posted_io(ctx);
+			ioreq_emulate_exclusive_end();
+		}
+
+		if (ioreq_dispatch_enabled()) {
+			vm_msi_batch_end(ctx);
+			ioreq_dispatch_scan();
+		} else {
+			/* the requests handled in one pass are notified at once */
+			done = 0UL;
+			scan = vm_ioreq_scan_mask(ioreq_buf, guest_ncpus);
+			while (scan != 0UL) {
+				vcpu_id = ffsll(scan) - 1;
+				scan &= ~(1UL << vcpu_id);
+				io_req = &ioreq_buf[vcpu_id];
+				if ((atomic_load(&io_req->processed) != ACRN_IOREQ_STATE_PROCESSING)
+					|| io_req->kernel_handled)
+					continue;
+				vm_ioreq_taken(ioreq_buf, vcpu_id);
+				if (emulate_vmexit(ctx, io_req, vcpu_id))
+					done |= 1UL << vcpu_id;
+			}
+			/* before the vCPUs resume, as the requests done one by one did */
+			vm_msi_batch_end(ctx);
+			if (done != 0UL)
+				vm_notify_requests_done(ctx, done);
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -831,13 +1010,16 @@ vm_loop(struct vmctx *ctx)
 		}
 
 		if (VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) {
+			ioreq_dispatch_quiesce();
 			vm_system_reset(ctx);
 		}
 
 		if (VM_SUSPEND_SUSPEND == vm_get_suspend_mode()) {
+			ioreq_dispatch_quiesce();
 			vm_suspend_resume(ctx);
 		}
 	}
+	ioreq_dispatch_deinit();
 	pr_err("VM loop exit\n");
 }
 
@@ -864,6 +1046,7 @@ enum {
 	CMD_OPT_OVMF,
 	CMD_OPT_IASL,
 	CMD_OPT_CPU_AFFINITY,
+	CMD_OPT_CPU_HOTPLUG,
 	CMD_OPT_PART_INFO,
 	CMD_OPT_TRUSTY_ENABLE,
 	CMD_OPT_VIRTIO_POLL_ENABLE,
@@ -884,6 +1067,16 @@ enum {
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
 	CMD_OPT_FORCE_VIRTIO_MSI,
+	CMD_OPT_IOREQ_THREADS,
+	CMD_OPT_IOREQ_POLL,
+	CMD_OPT_MEM_PREFAULT,
+	CMD_OPT_MEM_POOL,
+	CMD_OPT_LAUNCH_TIMELINE,
+	CMD_OPT_WARM_RESET,
+	CMD_OPT_RESTORE,
+	CMD_OPT_ACPI_CACHE,
+	CMD_OPT_VHPET,
+	CMD_OPT_VPIT,
 };
 
 static struct option long_options[] = {
@@ -909,6 +1102,7 @@ static struct option long_options[] = {
 	{"ovmf",		required_argument,	0, CMD_OPT_OVMF},
 	{"iasl",		required_argument,	0, CMD_OPT_IASL},
 	{"cpu_affinity",	required_argument,	0, CMD_OPT_CPU_AFFINITY},
+	{"cpu_hotplug",		required_argument,	0, CMD_OPT_CPU_HOTPLUG},
 	{"part_info",		required_argument,	0, CMD_OPT_PART_INFO},
 	{"enable_trusty",	no_argument,		0,
 					CMD_OPT_TRUSTY_ENABLE},
@@ -927,6 +1121,16 @@ static struct option long_options[] = {
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
 	{"virtio_msi",		no_argument,		0, CMD_OPT_FORCE_VIRTIO_MSI},
+	{"ioreq_threads",	required_argument,	0, CMD_OPT_IOREQ_THREADS},
+	{"ioreq_poll",		required_argument,	0, CMD_OPT_IOREQ_POLL},
+	{"mem_prefault",	required_argument,	0, CMD_OPT_MEM_PREFAULT},
+	{"mem_pool",		required_argument,	0, CMD_OPT_MEM_POOL},
+	{"launch_timeline",	required_argument,	0, CMD_OPT_LAUNCH_TIMELINE},
+	{"warm_reset",		no_argument,		0, CMD_OPT_WARM_RESET},
+	{"restore",		required_argument,	0, CMD_OPT_RESTORE},
+	{"acpi_cache",		required_argument,	0, CMD_OPT_ACPI_CACHE},
+	{"vhpet",		no_argument,		0, CMD_OPT_VHPET},
+	{"vpit",		no_argument,		0, CMD_OPT_VPIT},
 	{0,			0,			0,  0  },
 };
 
@@ -949,6 +1153,18 @@ vm_init_asyncio(struct vmctx *ctx, uint64_t base)
 	return vm_setup_asyncio(ctx, base);
 }
 
+static int
+vm_init_posted_io(struct vmctx *ctx, uint64_t base)
+{
+	struct shared_buf *sbuf = (struct shared_buf *)base;
+
+	/* Overwrite stays disabled, the hypervisor falls back to a
+	 * synchronous request when the ring is full.
+	 */
+	sbuf_init(sbuf, 4096, sizeof(struct acrn_posted_io));
+	return vm_setup_posted_io(ctx, base);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -957,6 +1173,7 @@ main(int argc, char *argv[])
 	struct vmctx *ctx;
 	size_t memsize;
 	int option_idx = 0;
+	uint64_t phase_us;
 
 	progname = basename(argv[0]);
 	memsize = 256 * MB;
@@ -1050,10 +1267,50 @@ main(int argc, char *argv[])
 			if (acrn_parse_iasl(optarg) != 0)
 				errx(EX_USAGE, "invalid iasl param %s", optarg);
 			break;
+		case CMD_OPT_ACPI_CACHE:
+			if (acrn_parse_acpi_cache(optarg) != 0)
+				errx(EX_USAGE, "invalid acpi_cache param %s", optarg);
+			break;
 		case CMD_OPT_CPU_AFFINITY:
 			if (acrn_parse_cpu_affinity(optarg) != 0)
 				errx(EX_USAGE, "invalid pcpu param %s", optarg);
 			break;
+		case CMD_OPT_CPU_HOTPLUG:
+			if (acrn_parse_cpu_hotplug(optarg) != 0)
+				errx(EX_USAGE, "invalid cpu_hotplug param %s", optarg);
+			break;
+		case CMD_OPT_IOREQ_THREADS:
+			if (ioreq_dispatch_parse_options(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq_threads param %s", optarg);
+			break;
+		case CMD_OPT_IOREQ_POLL:
+			if (ioreq_poll_parse_options(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq_poll param %s", optarg);
+			break;
+		case CMD_OPT_MEM_PREFAULT:
+			if (hugetlb_parse_prefault(optarg) != 0)
+				errx(EX_USAGE, "invalid mem_prefault param %s", optarg);
+			break;
+		case CMD_OPT_MEM_POOL:
+			if (hugetlb_set_pool(optarg) != 0)
+				errx(EX_USAGE, "invalid mem_pool param %s", optarg);
+			break;
+		case CMD_OPT_LAUNCH_TIMELINE:
+			if (launch_timeline_parse_options(optarg) != 0)
+				errx(EX_USAGE, "invalid launch_timeline param %s", optarg);
+			break;
+		case CMD_OPT_WARM_RESET:
+			warm_reset = true;
+			break;
+		case CMD_OPT_RESTORE:
+			restore_file_name = optarg;
+			break;
+		case CMD_OPT_VHPET:
+			hv_vhpet = true;
+			break;
+		case CMD_OPT_VPIT:
+			hv_vpit = true;
+			break;
 		case CMD_OPT_PART_INFO: /* obsolete parameter */
 			outdate("--part_info");
 			break;
@@ -1145,12 +1402,13 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (get_iasl_compiler() != 0) {
+	/* with the cache, iasl is only needed for the tables not in it */
+	if (!acpi_cache_enabled() && get_iasl_compiler() != 0) {
 		pr_err("Cannot find Intel ACPI ASL compiler tool \"iasl\".\n");
 		exit(1);
 	}
 
-	if (check_iasl_version() != 0) {
+	if (!acpi_cache_enabled() && check_iasl_version() != 0) {
 		pr_err("Please install iasl tool with version >= %s from https://www.acpica.org/downloads, "
 			"and provide the path to iasl (by using --iasl) if it's not on the PATH \n",
 			IASL_MIN_VER);
@@ -1169,6 +1427,16 @@ main(int argc, char *argv[])
 		lapic_pt = false;
 		pr_warn("Only a Realtime VM can use local APIC pass through, '--lapic_pt' is invalid here.\n");
 	}
+	if (is_rtvm && vm_get_cpu_hotplug_dm() != 0UL)
+		errx(EX_USAGE, "The vCPUs of a Realtime VM can't be hot-plugged, '--cpu_hotplug' is invalid here.");
+	if (hv_vhpet && lapic_pt) {
+		hv_vhpet = false;
+		pr_warn("The hypervisor doesn't emulate the HPET of a VM with local APIC pass through, '--vhpet' is invalid here.\n");
+	}
+	if (hv_vpit && lapic_pt) {
+		hv_vpit = false;
+		pr_warn("The hypervisor doesn't emulate the PIT of a VM with local APIC pass through, '--vpit' is invalid here.\n");
+	}
 	vmname = argv[0];
 
 	if (strnlen(vmname, MAX_VM_NAME_LEN) >= MAX_VM_NAME_LEN) {
@@ -1189,8 +1457,12 @@ main(int argc, char *argv[])
 	}
 
 	for (;;) {
+		launch_timeline_reset();
+
 		pr_notice("vm_create: %s\n", vmname);
+		phase_us = launch_timeline_now();
 		ctx = vm_create(vmname, (unsigned long)ioreq_buf, &guest_ncpus);
+		launch_timeline_add_phase("vm_create", phase_us);
 		if (!ctx) {
 			pr_err("vm_create failed");
 			goto create_fail;
@@ -1214,8 +1486,22 @@ main(int argc, char *argv[])
 			pr_warn("ASYNIO capability is not supported by kernel or hyperviosr!\n");
 		}
 
+		pr_notice("vm setup posted io page\n");
+		error = vm_init_posted_io(ctx, (uint64_t)posted_io_page);
+		if (error) {
+			pr_warn("Posted IO is not supported by kernel or hypervisor!\n");
+		}
+
+		pr_notice("vm setup msi ring page\n");
+		error = vm_setup_msi_ring(ctx, (uint64_t)msi_ring_page);
+		if (error) {
+			pr_warn("MSI ring is not supported by kernel or hypervisor!\n");
+		}
+
 		pr_notice("vm_setup_memory: size=0x%lx\n", memsize);
+		phase_us = launch_timeline_now();
 		error = vm_setup_memory(ctx, memsize);
+		launch_timeline_add_phase("vm_setup_memory", phase_us);
 		if (error) {
 			pr_err("Unable to setup memory (%d)\n", errno);
 			goto fail;
@@ -1228,10 +1514,12 @@ main(int argc, char *argv[])
 		}
 
 		pr_notice("vm_init_vdevs\n");
+		phase_us = launch_timeline_now();
 		if (vm_init_vdevs(ctx) < 0) {
 			pr_err("Unable to init vdev (%d)\n", errno);
 			goto dev_fail;
 		}
+		launch_timeline_add_phase("vm_init_vdevs", phase_us);
 
 		pr_notice("vm setup vm event\n");
 		error = vm_event_init(ctx);
@@ -1243,23 +1531,37 @@ main(int argc, char *argv[])
 		 * build the guest tables, MP etc.
 		 */
 		if (mptgen) {
+			phase_us = launch_timeline_now();
 			error = mptable_build(ctx, guest_ncpus);
 			if (error) {
 				goto vm_fail;
 			}
+			launch_timeline_add_phase("mptable_build", phase_us);
 		}
 
+		phase_us = launch_timeline_now();
 		error = acpi_build(ctx, guest_ncpus);
 		if (error) {
 			pr_err("acpi_build failed, error=%d\n", error);
 			goto vm_fail;
 		}
+		launch_timeline_add_phase("acpi_build", phase_us);
 
-		pr_notice("acrn_sw_load\n");
-		error = acrn_sw_load(ctx);
-		if (error) {
-			pr_err("acrn_sw_load failed, error=%d\n", error);
-			goto vm_fail;
+		/* only the first launch is restored, a reboot loads the software */
+		if (restore_file_name != NULL) {
+			pr_notice("vm_restore_snapshot: %s\n", restore_file_name);
+			error = vm_restore_snapshot(ctx, restore_file_name);
+			if (error) {
+				pr_err("vm_restore_snapshot failed, error=%d\n", error);
+				goto vm_fail;
+			}
+		} else {
+			pr_notice("acrn_sw_load\n");
+			error = acrn_sw_load(ctx);
+			if (error) {
+				pr_err("acrn_sw_load failed, error=%d\n", error);
+				goto vm_fail;
+			}
 		}
 
 		/*
@@ -1300,6 +1602,7 @@ main(int argc, char *argv[])
 		vm_unsetup_memory(ctx);
 		vm_destroy(ctx);
 		_ctx = 0;
+		restore_file_name = NULL;
 
 		pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_NONE));
 		vm_set_suspend_mode(VM_SUSPEND_NONE);
@@ -30,19 +30,29 @@
  * Memory ranges are represented with an RB tree. On insertion, the range
  * is checked for overlaps. On lookup, the key has the same base and limit
  * so it can be searched within the range.
+ *
+ * The trees are only used by the writers. Every change of them publishes a
+ * sorted array of the ranges, which the ioreq threads search without a lock.
+ * A reader announces the snapshot it searches in its hazard slot, and a
+ * writer only frees the previous snapshot once no slot points to it.
  */
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include <pthread.h>
 
 #include "mem.h"
 #include "tree.h"
+#include "atomic.h"
 
 #define MEMNAMESZ (80)
 
+/* the threads which can search the snapshot without a lock */
+#define MMIO_READERS_MAX	64
+
 struct mmio_rb_range {
 	RB_ENTRY(mmio_rb_range)	mr_link;	/* RB tree links */
 	struct mem_range	mr_param;
@@ -53,14 +63,40 @@ struct mmio_rb_range {
 static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
 RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+struct mmio_snap_range {
+	uint64_t		base;
+	uint64_t		end;
+	struct mem_range	param;
+};
+
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_root;	/* root ranges, then fallback ones */
+	int			nr;
+	struct mmio_snap_range	ranges[];
+};
+
+static struct mmio_snapshot *mmio_snap;
+static uint64_t mmio_snap_gen;
+
+struct mmio_reader {
+	struct mmio_snapshot	*snap;
+} __aligned(64);
+
+static struct mmio_reader mmio_readers[MMIO_READERS_MAX];
+static int mmio_nr_readers;
+
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
+ * Per-thread cache. Since most accesses from a vCPU will be to
  * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
+ * result of a lookup, as long as the snapshot stays the same.
  */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+static __thread int mmio_reader_idx = -1;
+static __thread uint64_t mmio_hint_gen;
+static __thread int mmio_hint = -1;
 
-static pthread_rwlock_t mmio_rwlock;
+/* serializes the writers, and the readers without a hazard slot */
+static pthread_mutex_t mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
@@ -116,17 +152,148 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 {
 	struct mmio_rb_range *np;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	RB_FOREACH(np, mmio_rb_tree, rbt) {
 		pr_dbg(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
 		       np->mr_param.name);
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 }
 #endif
 
 RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+static int
+mmio_snap_fill(struct mmio_snapshot *snap, struct mmio_rb_tree *rbt)
+{
+	struct mmio_rb_range *np;
+	int n = 0;
+
+	RB_FOREACH(np, mmio_rb_tree, rbt) {
+		if (snap != NULL) {
+			snap->ranges[snap->nr].base = np->mr_base;
+			snap->ranges[snap->nr].end = np->mr_end;
+			snap->ranges[snap->nr].param = np->mr_param;
+			snap->nr++;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+/* publish the trees to the readers, called with mmio_mtx held */
+static int
+mmio_snap_publish(void)
+{
+	struct mmio_snapshot *snap, *old;
+	int i, n;
+
+	n = mmio_snap_fill(NULL, &mmio_rb_root) + mmio_snap_fill(NULL, &mmio_rb_fallback);
+	snap = malloc(sizeof(*snap) + n * sizeof(struct mmio_snap_range));
+	if (snap == NULL)
+		return -1;
+
+	snap->gen = ++mmio_snap_gen;
+	snap->nr = 0;
+	snap->nr_root = mmio_snap_fill(snap, &mmio_rb_root);
+	mmio_snap_fill(snap, &mmio_rb_fallback);
+
+	old = atomic_xchg(&mmio_snap, snap);
+	if (old == NULL)
+		return 0;
+
+	/* the readers only hold a snapshot for the time of a search */
+	for (i = 0; i < MMIO_READERS_MAX; i++) {
+		while (atomic_load(&mmio_readers[i].snap) == old)
+			sched_yield();
+	}
+	free(old);
+
+	return 0;
+}
+
+static int
+mmio_snap_search(struct mmio_snapshot *snap, int lo, int hi, uint64_t addr)
+{
+	int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (addr < snap->ranges[mid].base)
+			hi = mid;
+		else if (addr > snap->ranges[mid].end)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+static int
+mmio_snap_lookup(struct mmio_snapshot *snap, uint64_t addr)
+{
+	struct mmio_snap_range *r;
+	int idx;
+
+	if (mmio_hint_gen == snap->gen && mmio_hint >= 0) {
+		r = &snap->ranges[mmio_hint];
+		if (addr >= r->base && addr <= r->end)
+			return mmio_hint;
+	}
+
+	idx = mmio_snap_search(snap, 0, snap->nr_root, addr);
+	if (idx < 0)
+		idx = mmio_snap_search(snap, snap->nr_root, snap->nr, addr);
+
+	if (idx >= 0 && idx < snap->nr_root) {
+		/* Update the per-thread cache */
+		mmio_hint_gen = snap->gen;
+		mmio_hint = idx;
+	}
+
+	return idx;
+}
+
+/*
+ * Copy the range handling addr to range, return -1 if there is none.
+ */
+static int
+mmio_find(uint64_t addr, struct mmio_snap_range *range)
+{
+	struct mmio_reader *reader;
+	struct mmio_snapshot *snap;
+	int idx;
+
+	if (mmio_reader_idx < 0)
+		mmio_reader_idx = atomic_fetch_add(&mmio_nr_readers, 1);
+
+	if (mmio_reader_idx >= MMIO_READERS_MAX) {
+		pthread_mutex_lock(&mmio_mtx);
+		snap = mmio_snap;
+		idx = (snap != NULL) ? mmio_snap_lookup(snap, addr) : -1;
+		if (idx >= 0)
+			*range = snap->ranges[idx];
+		pthread_mutex_unlock(&mmio_mtx);
+		return idx;
+	}
+
+	reader = &mmio_readers[mmio_reader_idx];
+	do {
+		snap = atomic_load(&mmio_snap);
+		atomic_store(&reader->snap, snap);
+	} while (snap != atomic_load(&mmio_snap));
+
+	idx = (snap != NULL) ? mmio_snap_lookup(snap, addr) : -1;
+	if (idx >= 0)
+		*range = snap->ranges[idx];
+
+	atomic_store(&reader->snap, NULL);
+
+	return idx;
+}
+
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
 {
@@ -154,41 +321,54 @@ emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req)
 {
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
+	struct mmio_snap_range range;
 	int err;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
-
 	/*
-	 * First check the per-VM cache
+	 * The handler runs on a copy of the range, a concurrent unregister
+	 * can then free the snapshot, the handler may even be the one doing it.
 	 */
-	hint = mmio_hint;
-
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
+	if (mmio_find(paddr, &range) < 0)
 		return -ESRCH;
-	}
-
-	pthread_rwlock_unlock(&mmio_rwlock);
-
-	if (entry == NULL)
-		return -EINVAL;
 
 	if (mmio_req->direction == ACRN_IOREQ_DIR_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
-				size, &entry->mr_param);
+				size, &range.param);
 	else
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
-				size, &entry->mr_param);
+				size, &range.param);
 
 	return err;
 }
 
+/*
+ * Copy the name of the range handling paddr to name and return its base, for
+ * the tracers. Return -1 if it is not emulated.
+ */
+int
+lookup_mem_range(uint64_t paddr, uint64_t *base, char *name, size_t len)
+{
+	struct mmio_snap_range range;
+
+	if (mmio_find(paddr, &range) < 0)
+		return -1;
+
+	*base = range.base;
+	snprintf(name, len, "%s", range.param.name ? range.param.name : "");
+	return 0;
+}
+
+bool
+mem_range_concurrent(uint64_t paddr)
+{
+	struct mmio_snap_range range;
+
+	if (mmio_find(paddr, &range) < 0)
+		return false;
+
+	return (range.param.flags & MEM_F_CONCURRENT) != 0;
+}
+
 static int
 register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
@@ -203,10 +383,14 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_param = *memp;
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
+		pthread_mutex_lock(&mmio_mtx);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
+		if (err == 0 && mmio_snap_publish() != 0) {
+			RB_REMOVE(mmio_rb_tree, rbt, mrp);
+			err = -1;
+		}
+		pthread_mutex_unlock(&mmio_mtx);
 		if (err)
 			free(mrp);
 	}
@@ -233,7 +417,7 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 	struct mmio_rb_range *entry = NULL;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	err = mmio_rb_lookup(rbt, memp->base, &entry);
 	if (err == 0) {
 		mr = &entry->mr_param;
@@ -244,14 +428,15 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		} else {
 			RB_REMOVE(mmio_rb_tree, rbt, entry);
 
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
-
-			free(entry);
+			if (mmio_snap_publish() == 0) {
+				free(entry);
+			} else {
+				mmio_rb_add(rbt, entry);
+				err = -1;
+			}
 		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
@@ -273,5 +458,7 @@ init_mem(void)
 {
 	RB_INIT(&mmio_rb_root);
 	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+	pthread_mutex_lock(&mmio_mtx);
+	mmio_snap_publish();
+	pthread_mutex_unlock(&mmio_mtx);
 }
@@ -29,6 +29,11 @@
 /*
  * Micro event library for FreeBSD, designed for a single i/o thread
  * using EPOLL, and having events be persistent by default.
+ *
+ * The mevents may also be added to other dispatcher threads, each with its
+ * own epoll instance, so that the timers, say, are not delayed by bulk I/O.
+ * The main dispatcher is the thread calling mevent_dispatch(), the others are
+ * started on their first mevent and stopped when it returns.
  */
 #include <errno.h>
 #include <stdlib.h>
@@ -42,6 +47,7 @@
 
 #include "mevent.h"
 #include "vmmapi.h"
+#include "atomic.h"
 #include "log.h"
 
 #define	MEVENT_MAX	64
@@ -51,9 +57,26 @@
 #define	MEV_DISABLE	3
 #define	MEV_DEL_PENDING	4
 
-static int epoll_fd;
-static pthread_t mevent_tid;
-static int mevent_pipefd[2];
+struct mevent;
+
+struct mevent_disp {
+	const char		*name;
+	int			epfd;
+	pthread_t		tid;
+	int			pipefd[2];
+	int			running;	/* for the threads started here */
+	/* the mevents deleted from another thread, freed by this one */
+	LIST_HEAD(, mevent)	del_head;
+};
+
+static struct mevent_disp mevent_disps[MEVENT_DISP_NUM] = {
+	[MEVENT_DISP_MAIN]	= { .name = "mevent" },
+	[MEVENT_DISP_TIMER]	= { .name = "mevent_timer" },
+	[MEVENT_DISP_NET]	= { .name = "mevent_net" },
+};
+
+#define epoll_fd	(mevent_disps[MEVENT_DISP_MAIN].epfd)
+#define mevent_pipefd	(mevent_disps[MEVENT_DISP_MAIN].pipefd)
 static pthread_mutex_t mevent_lmutex;
 
 struct mevent {
@@ -68,12 +91,11 @@ struct mevent {
 	int			me_state;
 
 	int			closefd;
+	struct mevent_disp	*me_disp;
 	LIST_ENTRY(mevent)	me_list;
 };
 
 static LIST_HEAD(listhead, mevent) global_head;
-/* List holds the mevent node which is requested to be deleted */
-static LIST_HEAD(del_listhead, mevent) del_head;
 
 static void
 mevent_qlock(void)
@@ -88,9 +110,9 @@ mevent_qunlock(void)
 }
 
 static bool
-is_dispatch_thread(void)
+is_dispatch_thread(struct mevent_disp *disp)
 {
-	return (pthread_self() == mevent_tid);
+	return (disp->tid != 0) && pthread_equal(pthread_self(), disp->tid);
 }
 
 static void
@@ -108,9 +130,8 @@ mevent_pipe_read(int fd, enum ev_type type, void *param)
 	} while (status == MEVENT_MAX);
 }
 
-/* On error, -1 is returned, else return zero */
-int
-mevent_notify(void)
+static int
+mevent_notify_disp(struct mevent_disp *disp)
 {
 	char c = 0;
 
@@ -118,12 +139,19 @@ mevent_notify(void)
 	 * If calling from outside the i/o thread, write a byte on the
 	 * pipe to force the i/o thread to exit the blocking epoll call.
 	 */
-	if (mevent_pipefd[1] != 0 && !is_dispatch_thread())
-		if (write(mevent_pipefd[1], &c, 1) <= 0)
+	if (disp->pipefd[1] != 0 && !is_dispatch_thread(disp))
+		if (write(disp->pipefd[1], &c, 1) <= 0)
 			return -1;
 	return 0;
 }
 
+/* On error, -1 is returned, else return zero */
+int
+mevent_notify(void)
+{
+	return mevent_notify_disp(&mevent_disps[MEVENT_DISP_MAIN]);
+}
+
 static int
 mevent_kq_filter(struct mevent *mevp)
 {
@@ -150,11 +178,12 @@ static void
 mevent_destroy(void)
 {
 	struct mevent *mevp, *tmpp;
+	int i;
 
 	mevent_qlock();
 	list_foreach_safe(mevp, &global_head, me_list, tmpp) {
 		LIST_REMOVE(mevp, me_list);
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
+		epoll_ctl(mevp->me_disp->epfd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
 
                if ((mevp->me_type == EVF_READ ||
                     mevp->me_type == EVF_READ_ET ||
@@ -172,20 +201,22 @@ mevent_destroy(void)
 	/* the mevp in del_head was removed from epoll when add it
 	 * to del_head already.
 	 */
-	list_foreach_safe(mevp, &del_head, me_list, tmpp) {
-		LIST_REMOVE(mevp, me_list);
+	for (i = 0; i < MEVENT_DISP_NUM; i++) {
+		list_foreach_safe(mevp, &mevent_disps[i].del_head, me_list, tmpp) {
+			LIST_REMOVE(mevp, me_list);
 
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
+			if ((mevp->me_type == EVF_READ ||
+			     mevp->me_type == EVF_READ_ET ||
+			     mevp->me_type == EVF_WRITE ||
+			     mevp->me_type == EVF_WRITE_ET) &&
+			     mevp->me_fd != STDIN_FILENO)
+				close(mevp->me_fd);
 
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
+			if (mevp->teardown)
+				mevp->teardown(mevp->teardown_param);
 
-		free(mevp);
+			free(mevp);
+		}
 	}
 	mevent_qunlock();
 }
@@ -199,26 +230,95 @@ mevent_handle(struct epoll_event *kev, int numev)
 	for (i = 0; i < numev; i++) {
 		mevp = kev[i].data.ptr;
 
-		if (mevp->me_state)
+		if (atomic_load(&mevp->me_state))
 			(*mevp->run)(mevp->me_fd, mevp->me_type, mevp->run_param);
 	}
 }
 
+static void *mevent_disp_thread(void *arg);
+
+/* start the thread of a dispatcher other than the main one, mevent_lmutex held */
+static int
+mevent_disp_start(struct mevent_disp *disp, enum mevent_disp_id id)
+{
+	disp->epfd = epoll_create1(0);
+	if (disp->epfd < 0) {
+		pr_err("%s: epoll_create1 fails for %s\n", __func__, disp->name);
+		return -1;
+	}
+
+	if (pipe2(disp->pipefd, O_NONBLOCK) < 0) {
+		pr_err("%s: pipe2 fails for %s\n", __func__, disp->name);
+		goto close_epfd;
+	}
+
+	atomic_store(&disp->running, 1);
+	if (mevent_add_disp(disp->pipefd[0], EVF_READ, mevent_pipe_read, NULL,
+			NULL, NULL, id) == NULL) {
+		pr_err("%s: pipefd mevent_add failed for %s\n", __func__, disp->name);
+		goto close_pipe;
+	}
+
+	if (pthread_create(&disp->tid, NULL, mevent_disp_thread, disp) != 0) {
+		pr_err("%s: failed to create %s\n", __func__, disp->name);
+		/* the pipe mevent goes with the others in mevent_destroy() */
+		atomic_store(&disp->running, 0);
+		disp->tid = 0;
+		return -1;
+	}
+	pthread_setname_np(disp->tid, disp->name);
+
+	return 0;
+
+close_pipe:
+	atomic_store(&disp->running, 0);
+	close(disp->pipefd[0]);
+	close(disp->pipefd[1]);
+	disp->pipefd[0] = disp->pipefd[1] = 0;
+close_epfd:
+	close(disp->epfd);
+	disp->epfd = 0;
+	return -1;
+}
+
+/* stop the dispatcher threads started by mevent_disp_start() */
+static void
+mevent_disp_stop(void)
+{
+	struct mevent_disp *disp;
+	int i;
+
+	for (i = MEVENT_DISP_MAIN + 1; i < MEVENT_DISP_NUM; i++) {
+		disp = &mevent_disps[i];
+		if (disp->tid == 0)
+			continue;
+
+		atomic_store(&disp->running, 0);
+		mevent_notify_disp(disp);
+		pthread_join(disp->tid, NULL);
+		disp->tid = 0;
+	}
+}
+
 struct mevent *
-mevent_add(int tfd, enum ev_type type,
+mevent_add_disp(int tfd, enum ev_type type,
 	   void (*run)(int, enum ev_type, void *), void *run_param,
-	   void (*teardown)(void *), void *teardown_param)
+	   void (*teardown)(void *), void *teardown_param,
+	   enum mevent_disp_id id)
 {
 	int ret;
 	struct epoll_event ee;
 	struct mevent *lp, *mevp;
+	struct mevent_disp *disp;
 
-	if (tfd < 0 || run == NULL)
+	if (tfd < 0 || run == NULL || id >= MEVENT_DISP_NUM)
 		return NULL;
 
 	if (type == EVF_TIMER)
 		return NULL;
 
+	disp = &mevent_disps[id];
+
 	mevent_qlock();
 	/* Verify that the fd/type tuple is not present in the list */
 	LIST_FOREACH(lp, &global_head, me_list) {
@@ -227,6 +327,13 @@ mevent_add(int tfd, enum ev_type type,
 			return lp;
 		}
 	}
+
+	/* the pipe of a new dispatcher is added while it is marked running */
+	if (id != MEVENT_DISP_MAIN && !atomic_load(&disp->running) &&
+	    mevent_disp_start(disp, id) < 0) {
+		mevent_qunlock();
+		return NULL;
+	}
 	mevent_qunlock();
 
 	/*
@@ -239,6 +346,7 @@ mevent_add(int tfd, enum ev_type type,
 	mevp->me_fd = tfd;
 	mevp->me_type = type;
 	mevp->me_state = 1;
+	mevp->me_disp = disp;
 
 	mevp->run = run;
 	mevp->run_param = run_param;
@@ -247,7 +355,7 @@ mevent_add(int tfd, enum ev_type type,
 
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(disp->epfd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 
 	if (ret == 0) {
 		mevent_qlock();
@@ -261,29 +369,31 @@ mevent_add(int tfd, enum ev_type type,
 	}
 }
 
+struct mevent *
+mevent_add(int tfd, enum ev_type type,
+	   void (*run)(int, enum ev_type, void *), void *run_param,
+	   void (*teardown)(void *), void *teardown_param)
+{
+	return mevent_add_disp(tfd, type, run, run_param, teardown,
+			teardown_param, MEVENT_DISP_MAIN);
+}
+
+/*
+ * Neither takes mevent_lmutex, these may be called from the handlers, on any
+ * dispatcher, as often as each event.
+ */
 int
 mevent_enable(struct mevent *evp)
 {
 	int ret;
 	struct epoll_event ee;
-	struct mevent *lp, *mevp = NULL;
 
-	mevent_qlock();
-	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
-		if (lp == evp) {
-			mevp = lp;
-			break;
-		}
-	}
-	mevent_qunlock();
-
-	if (!mevp)
+	if (evp == NULL || !atomic_load(&evp->me_state))
 		return -1;
 
-	ee.events = mevent_kq_filter(mevp);
-	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ee.events = mevent_kq_filter(evp);
+	ee.data.ptr = evp;
+	ret = epoll_ctl(evp->me_disp->epfd, EPOLL_CTL_ADD, evp->me_fd, &ee);
 	if (ret < 0 && errno == EEXIST)
 		ret = 0;
 
@@ -295,7 +405,7 @@ mevent_disable(struct mevent *evp)
 {
 	int ret;
 
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	ret = epoll_ctl(evp->me_disp->epfd, EPOLL_CTL_DEL, evp->me_fd, NULL);
 	if (ret < 0 && errno == ENOENT)
 		ret = 0;
 
@@ -306,19 +416,19 @@ static void
 mevent_add_to_del_list(struct mevent *evp, int closefd)
 {
 	mevent_qlock();
-	LIST_INSERT_HEAD(&del_head, evp, me_list);
+	LIST_INSERT_HEAD(&evp->me_disp->del_head, evp, me_list);
 	mevent_qunlock();
 
-	mevent_notify();
+	mevent_notify_disp(evp->me_disp);
 }
 
 static void
-mevent_drain_del_list(void)
+mevent_drain_del_list(struct mevent_disp *disp)
 {
 	struct mevent *evp, *tmpp;
 
 	mevent_qlock();
-	list_foreach_safe(evp, &del_head, me_list, tmpp) {
+	list_foreach_safe(evp, &disp->del_head, me_list, tmpp) {
 		LIST_REMOVE(evp, me_list);
 		if (evp->closefd) {
 			close(evp->me_fd);
@@ -337,11 +447,12 @@ mevent_delete_event(struct mevent *evp, int closefd)
 	mevent_qlock();
 	LIST_REMOVE(evp, me_list);
 	mevent_qunlock();
-	evp->me_state = 0;
+	atomic_store(&evp->me_state, 0);
 	evp->closefd = closefd;
 
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
-	if (!is_dispatch_thread()) {
+	epoll_ctl(evp->me_disp->epfd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	/* the dispatcher may be running it, it frees it once it is done */
+	if (!is_dispatch_thread(evp->me_disp)) {
 		mevent_add_to_del_list(evp, closefd);
 	} else {
 		if (evp->closefd) {
@@ -370,7 +481,28 @@ mevent_delete_close(struct mevent *evp)
 static void
 mevent_set_name(void)
 {
-	pthread_setname_np(mevent_tid, "mevent");
+	pthread_setname_np(mevent_disps[MEVENT_DISP_MAIN].tid,
+			mevent_disps[MEVENT_DISP_MAIN].name);
+}
+
+static void *
+mevent_disp_thread(void *arg)
+{
+	struct mevent_disp *disp = arg;
+	struct epoll_event eventlist[MEVENT_MAX];
+	int ret;
+
+	disp->tid = pthread_self();
+	while (atomic_load(&disp->running)) {
+		ret = epoll_wait(disp->epfd, eventlist, MEVENT_MAX, -1);
+		if (ret == -1 && errno != EINTR)
+			pr_err("Error return from epoll_wait");
+
+		mevent_handle(eventlist, ret);
+		mevent_drain_del_list(disp);
+	}
+
+	return NULL;
 }
 
 int
@@ -394,10 +526,24 @@ mevent_init(void)
 void
 mevent_deinit(void)
 {
+	struct mevent_disp *disp;
+	int i;
+
+	/* on the error paths, the threads may have been started */
+	mevent_disp_stop();
 	mevent_destroy();
-	close(epoll_fd);
-	if (mevent_pipefd[1] != 0)
-		close(mevent_pipefd[1]);
+	for (i = 0; i < MEVENT_DISP_NUM; i++) {
+		disp = &mevent_disps[i];
+		if (i != MEVENT_DISP_MAIN && disp->epfd == 0)
+			continue;
+
+		close(disp->epfd);
+		if (disp->pipefd[1] != 0)
+			close(disp->pipefd[1]);
+		disp->epfd = 0;
+		disp->pipefd[0] = disp->pipefd[1] = 0;
+		disp->tid = 0;
+	}
 
 	pthread_mutex_destroy(&mevent_lmutex);
 }
@@ -410,7 +556,7 @@ mevent_dispatch(void)
 	struct mevent *pipev;
 	int ret;
 
-	mevent_tid = pthread_self();
+	mevent_disps[MEVENT_DISP_MAIN].tid = pthread_self();
 	mevent_set_name();
 
 	/*
@@ -448,7 +594,7 @@ mevent_dispatch(void)
 		 * Handle reported events
 		 */
 		mevent_handle(eventlist, ret);
-		mevent_drain_del_list();
+		mevent_drain_del_list(&mevent_disps[MEVENT_DISP_MAIN]);
 
 		suspend_mode = vm_get_suspend_mode();
 		if ((suspend_mode != VM_SUSPEND_NONE) &&
@@ -456,4 +602,7 @@ mevent_dispatch(void)
 		    (suspend_mode != VM_SUSPEND_SUSPEND))
 			break;
 	}
+
+	/* no handler runs while the devices are torn down, as before */
+	mevent_disp_stop();
 }
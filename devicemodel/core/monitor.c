@@ -23,6 +23,11 @@
 #include "acrn_mngr.h"
 #include "pm.h"
 #include "vmmapi.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "block_if.h"
+#include "iothread.h"
+#include "atomic.h"
 #include "log.h"
 
 #define INTR_STORM_MONITOR_PERIOD	10 /* 10 seconds */
@@ -271,6 +276,29 @@ int set_wakeup_timer(time_t t)
 	return ack.data.err;
 }
 
+/* tell acrnd, if it runs, that the User VM runs or stops */
+static void notify_acrnd(int state)
+{
+	int acrnd_fd;
+	struct mngr_msg req;
+
+	acrnd_fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (acrnd_fd < 0)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_NOTIFY;
+	req.timestamp = time(NULL);
+	req.data.dm_notify.state = state;
+	strncpy(req.data.dm_notify.name, vmname,
+			sizeof(req.data.dm_notify.name) - 1);
+
+	if (mngr_send_msg(acrnd_fd, &req, NULL, 0) < 0)
+		pr_err("%s: failed to notify acrnd\n", __func__);
+	mngr_close(acrnd_fd);
+}
+
 static LIST_HEAD(vm_ops_list, vm_ops) vm_ops_head;
 static pthread_mutex_t vm_ops_mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -308,6 +336,298 @@ static int monitor_fd = -1;
 /* handlers */
 #define ACK_TIMEOUT	1
 
+/*
+ * State and metrics pushed to the clients subscribed to the monitor socket,
+ * so that they don't have to poll each DM with DM_QUERY.
+ */
+static int vm_state;	/* enum dm_notify_state, 0 before the User VM runs */
+
+bool monitor_metrics_enabled;
+static struct {
+	uint64_t pio;
+	uint64_t mmio;
+	uint64_t pci_cfg;
+	uint64_t lat_total_ns;
+	uint64_t lat_max_ns;
+} ioreq_metrics;
+
+static pthread_t metrics_monitor_pid;
+static pthread_mutex_t metrics_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metrics_cond = PTHREAD_COND_INITIALIZER;
+static bool metrics_stop;
+
+static void publish_state(int state)
+{
+	struct mngr_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = MNGR_MSG_MAGIC;
+	msg.msgid = DM_STATE_EVENT;
+	msg.timestamp = time(NULL);
+	msg.data.dm_notify.state = state;
+	strncpy(msg.data.dm_notify.name, vmname,
+			sizeof(msg.data.dm_notify.name) - 1);
+
+	mngr_publish_msg(monitor_fd, &msg);
+}
+
+/* tell acrnd and the subscribers that the User VM changed state */
+void monitor_notify_state(int state)
+{
+	vm_state = state;
+	if (monitor_fd >= 0)
+		publish_state(state);
+	if (state != DM_NOTIFY_SUSPENDED)
+		notify_acrnd(state);
+}
+
+/* account an ioreq emulated from @start, while there are subscribers */
+void monitor_account_ioreq(uint32_t type, const struct timespec *start)
+{
+	struct timespec now;
+	uint64_t ns, max;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+
+	if (type == ACRN_IOREQ_TYPE_PORTIO)
+		atomic_add_fetch(&ioreq_metrics.pio, 1);
+	else if (type == ACRN_IOREQ_TYPE_PCICFG)
+		atomic_add_fetch(&ioreq_metrics.pci_cfg, 1);
+	else
+		atomic_add_fetch(&ioreq_metrics.mmio, 1);
+	atomic_add_fetch(&ioreq_metrics.lat_total_ns, ns);
+
+	max = atomic_load(&ioreq_metrics.lat_max_ns);
+	while (ns > max && !atomic_cmpxchg(&ioreq_metrics.lat_max_ns, &max, ns))
+		;
+}
+
+static void publish_metrics(void)
+{
+	struct mngr_msg msg;
+	struct dm_metrics *m = &msg.data.dm_metrics;
+	struct pci_vdev *dev;
+	uint16_t pending, inflight;
+	uint64_t max;
+	int slot, idx, qsize;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = MNGR_MSG_MAGIC;
+	msg.msgid = DM_METRICS_EVENT;
+	msg.timestamp = time(NULL);
+	strncpy(m->name, vmname, sizeof(m->name) - 1);
+
+	m->pio = atomic_load(&ioreq_metrics.pio);
+	m->mmio = atomic_load(&ioreq_metrics.mmio);
+	m->pci_cfg = atomic_load(&ioreq_metrics.pci_cfg);
+	m->lat_total_ns = atomic_load(&ioreq_metrics.lat_total_ns);
+	max = atomic_xchg(&ioreq_metrics.lat_max_ns, 0);
+	m->lat_max_ns = (max > UINT32_MAX) ? UINT32_MAX : max;
+
+	for (slot = 0; slot <= PCI_SLOTMAX && m->nr_vq < DM_METRICS_MAX_VQ; slot++) {
+		dev = pci_get_vdev_info(slot);
+		if (dev == NULL)
+			continue;
+
+		for (idx = 0; m->nr_vq < DM_METRICS_MAX_VQ; idx++) {
+			qsize = virtio_vq_depth(dev, idx, &pending, &inflight);
+			if (qsize < 0)
+				break;
+			if (qsize == 0)
+				continue;
+			m->vq[m->nr_vq].slot = slot;
+			m->vq[m->nr_vq].queue = idx;
+			m->vq[m->nr_vq].qsize = qsize;
+			m->vq[m->nr_vq].pending = pending;
+			m->vq[m->nr_vq].inflight = inflight;
+			m->nr_vq++;
+		}
+	}
+
+	mngr_publish_msg(monitor_fd, &msg);
+}
+
+/* <value> of a <key>=<value> option, NULL if opt is not one */
+static char *
+dev_tune_value(char *opt, const char *key)
+{
+	size_t n = strlen(key);
+
+	if (strncmp(opt, key, n) != 0 || opt[n] != '=')
+		return NULL;
+	return opt + n + 1;
+}
+
+/* cpus=<cpu>[:<cpu>...] */
+static int
+dev_tune_parse_cpus(char *str, cpu_set_t *cpuset)
+{
+	char *cpu;
+	int id;
+
+	CPU_ZERO(cpuset);
+	while ((cpu = strsep(&str, ":")) != NULL) {
+		if (dm_strtoi(cpu, &cpu, 10, &id) || *cpu != '\0' ||
+		    id < 0 || id >= CPU_SETSIZE)
+			return -1;
+		CPU_SET(id, cpuset);
+	}
+	return CPU_COUNT(cpuset) ? 0 : -1;
+}
+
+/*
+ * The dev_tune monitor command, one device per command:
+ *   slot=<n>,coalesce=<frames>:<usecs>[:adaptive]
+ *   slot=<n>,balloon=<MB>
+ *   drive=<ident>[,iops=<n>][,bw=<KB/s>]
+ *   iothread=<name>[,poll=<us>][,cpus=<cpu>[:<cpu>...]]
+ */
+int
+vm_monitor_dev_tune(char *opt)
+{
+	struct virtio_coalesce_opts co;
+	cpu_set_t cpuset;
+	char *target, *cp, *val, *end;
+	int slot, iops = -1, bw_kb = -1, poll_us = -1, balloon_mb = -1;
+	bool coalesce = false, cpus = false;
+
+	cp = opt;
+	target = strsep(&cp, ",");
+	if (target == NULL || cp == NULL)
+		goto err;
+
+	while ((opt = strsep(&cp, ",")) != NULL) {
+		if ((val = dev_tune_value(opt, "coalesce")) != NULL) {
+			memset(&co, 0, sizeof(co));
+			if (virtio_coalesce_parse_options(val, &co))
+				return -1;
+			coalesce = true;
+		} else if ((val = dev_tune_value(opt, "iops")) != NULL) {
+			if (dm_strtoi(val, &end, 10, &iops) || *end != '\0' || iops < 0)
+				goto err;
+		} else if ((val = dev_tune_value(opt, "bw")) != NULL) {
+			if (dm_strtoi(val, &end, 10, &bw_kb) || *end != '\0' || bw_kb < 0)
+				goto err;
+		} else if ((val = dev_tune_value(opt, "poll")) != NULL) {
+			if (dm_strtoi(val, &end, 10, &poll_us) || *end != '\0' || poll_us < 0)
+				goto err;
+		} else if ((val = dev_tune_value(opt, "cpus")) != NULL) {
+			if (dev_tune_parse_cpus(val, &cpuset))
+				goto err;
+			cpus = true;
+		} else if ((val = dev_tune_value(opt, "balloon")) != NULL) {
+			if (dm_strtoi(val, &end, 10, &balloon_mb) || *end != '\0' || balloon_mb < 0)
+				goto err;
+		} else
+			goto err;
+	}
+
+	if ((val = dev_tune_value(target, "slot")) != NULL) {
+		if (dm_strtoi(val, &end, 10, &slot) || *end != '\0' ||
+		    coalesce == (balloon_mb >= 0) ||
+		    iops >= 0 || bw_kb >= 0 || poll_us >= 0 || cpus)
+			goto err;
+		if (balloon_mb >= 0)
+			return virtio_balloon_set_target(slot, balloon_mb);
+		return virtio_set_coalesce(slot, &co);
+	} else if ((val = dev_tune_value(target, "drive")) != NULL) {
+		if (coalesce || poll_us >= 0 || cpus || balloon_mb >= 0)
+			goto err;
+		return blockif_set_throttle(val, iops, bw_kb);
+	} else if ((val = dev_tune_value(target, "iothread")) != NULL) {
+		if (coalesce || iops >= 0 || bw_kb >= 0 || balloon_mb >= 0)
+			goto err;
+		if (poll_us >= 0 && iothread_set_poll(val, poll_us))
+			return -1;
+		if (cpus && iothread_set_affinity(val, &cpuset))
+			return -1;
+		return 0;
+	}
+
+err:
+	pr_err("%s: invalid option\n", __func__);
+	return -1;
+}
+
+/*
+ * Wake up every second to follow the subscribers: the ioreqs are timed only
+ * while one asks for metrics, which are pushed at the shortest interval asked.
+ */
+static void *metrics_monitor_thread(void *arg)
+{
+	struct timespec ts;
+	unsigned interval, elapsed = 0;
+
+	pthread_mutex_lock(&metrics_mtx);
+	while (!metrics_stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&metrics_cond, &metrics_mtx, &ts);
+		if (metrics_stop)
+			break;
+
+		if (mngr_subscribers(monitor_fd, &interval) <= 0 || interval == 0) {
+			monitor_metrics_enabled = false;
+			elapsed = 0;
+			continue;
+		}
+		monitor_metrics_enabled = true;
+
+		/* the devices are set up once the User VM runs */
+		if (++elapsed < interval || vm_state == 0)
+			continue;
+		elapsed = 0;
+		publish_metrics();
+	}
+	monitor_metrics_enabled = false;
+	pthread_mutex_unlock(&metrics_mtx);
+
+	return NULL;
+}
+
+static void start_metrics_monitor(void)
+{
+	metrics_stop = false;
+	if (pthread_create(&metrics_monitor_pid, NULL, metrics_monitor_thread, NULL)) {
+		pr_err("%s: failed to create the metrics thread\n", __func__);
+		metrics_monitor_pid = 0;
+		return;
+	}
+	pthread_setname_np(metrics_monitor_pid, "dm_metrics");
+}
+
+static void stop_metrics_monitor(void)
+{
+	if (metrics_monitor_pid) {
+		pthread_mutex_lock(&metrics_mtx);
+		metrics_stop = true;
+		pthread_cond_signal(&metrics_cond);
+		pthread_mutex_unlock(&metrics_mtx);
+		pthread_join(metrics_monitor_pid, NULL);
+		metrics_monitor_pid = 0;
+	}
+}
+
+/* push the current state first, a subscriber then only sees the changes */
+static void handle_subscribe(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ev;
+
+	if (vm_state == 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.magic = MNGR_MSG_MAGIC;
+	ev.msgid = DM_STATE_EVENT;
+	ev.timestamp = time(NULL);
+	ev.data.dm_notify.state = vm_state;
+	strncpy(ev.data.dm_notify.name, vmname,
+			sizeof(ev.data.dm_notify.name) - 1);
+
+	mngr_send_msg(client_fd, &ev, NULL, ACK_TIMEOUT);
+}
+
 #define DEFINE_HANDLER(name, func)				\
 static void name(struct mngr_msg *msg, int client_fd, void *param)	\
 {									\
@@ -490,6 +810,7 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_RESUME, handle_resume, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, MNGR_SUBSCRIBE, handle_subscribe, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
@@ -499,6 +820,7 @@ int monitor_init(struct vmctx *ctx)
 	monitor_register_vm_ops(&pmc_ops, ctx, "PMC_VM_OPs");
 
 	start_intr_storm_monitor(ctx);
+	start_metrics_monitor();
 
 	return 0;
 
@@ -512,8 +834,15 @@ int monitor_init(struct vmctx *ctx)
 
 void monitor_close(void)
 {
-	if (monitor_fd >= 0)
+	stop_metrics_monitor();
+
+	if (monitor_fd >= 0) {
+		publish_state(DM_NOTIFY_STOPPED);
 		mngr_close(monitor_fd);
+		monitor_fd = -1;
+		notify_acrnd(DM_NOTIFY_STOPPED);
+	}
+	vm_state = 0;
 
 	stop_intr_storm_monitor();
 }
@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "macros.h"
+#include "launch_timeline.h"
+#include "snapshot.h"
+#include "log.h"
+
+#define SNAPSHOT_PAGE		4096UL
+#define SNAPSHOT_MEM_ALIGN	(2 * MB)
+#define SNAPSHOT_WRITE_MAX	(2 * MB)
+#define SNAPSHOT_LOAD_CHUNK	(2 * MB)
+#define SNAPSHOT_LOAD_THREADS	4
+#define SNAPSHOT_REGIONS	3
+
+/* the devices get this long to finish the requests they took */
+#define SNAPSHOT_DRAIN_TRIES	100
+#define SNAPSHOT_DRAIN_US	10000
+
+/* A range of the guest memory, at file_off of the file */
+struct snapshot_region {
+	uint64_t gpa;
+	size_t len;
+	off_t file_off;
+};
+
+struct snapshot_load {
+	int fd;
+	struct vmctx *ctx;
+	struct snapshot_region *regions;
+	off_t mem_offset;
+	size_t size;
+	atomic_size_t next;
+	atomic_int err;
+};
+
+int
+snapshot_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n < 0) ? -errno : -EIO;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int
+snapshot_read(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n < 0) ? -errno : -EIO;
+		buf = (char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_pwrite(int fd, const char *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n < 0) ? -errno : -EIO;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_pread(int fd, char *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n < 0) ? -errno : -EIO;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * The guest memory in the file: the low memory, the frame buffer and BIOS
+ * memory right below 4G, and the high memory. Their sizes are multiples of
+ * SNAPSHOT_LOAD_CHUNK, as the huge pages they are in.
+ */
+static void
+snapshot_regions(const struct snapshot_header *hdr, uint64_t highmem_gpa_base,
+		struct snapshot_region *regions)
+{
+	regions[0].gpa = 0;
+	regions[0].len = hdr->lowmem;
+	regions[1].gpa = 4 * GB - hdr->biosmem - hdr->fbmem;
+	regions[1].len = hdr->fbmem + hdr->biosmem;
+	regions[2].gpa = highmem_gpa_base;
+	regions[2].len = hdr->highmem;
+
+	regions[0].file_off = 0;
+	regions[1].file_off = regions[0].len;
+	regions[2].file_off = regions[1].file_off + regions[1].len;
+}
+
+static bool
+is_zero_page(const char *page)
+{
+	const uint64_t *p = (const uint64_t *)page;
+	size_t i;
+
+	for (i = 0; i < SNAPSHOT_PAGE / sizeof(*p); i++) {
+		if (p[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+/* The pages of zeros are left out, holes of the file */
+static int
+snapshot_save_region(int fd, const char *hva, size_t len, off_t file_off)
+{
+	size_t off = 0, run;
+	int err;
+
+	while (off < len) {
+		if (is_zero_page(hva + off)) {
+			off += SNAPSHOT_PAGE;
+			continue;
+		}
+
+		run = SNAPSHOT_PAGE;
+		while ((off + run < len) && (run < SNAPSHOT_WRITE_MAX) &&
+				!is_zero_page(hva + off + run))
+			run += SNAPSHOT_PAGE;
+
+		err = snapshot_pwrite(fd, hva + off, run, file_off + off);
+		if (err < 0)
+			return err;
+		off += run;
+	}
+
+	return 0;
+}
+
+/* The vCPUs and the devices, after the header */
+static int
+snapshot_save_state(struct vmctx *ctx, int fd, const struct snapshot_header *hdr)
+{
+	struct acrn_vcpu_state *state;
+	int i, err;
+
+	if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+		return -errno;
+
+	err = snapshot_write(fd, hdr, sizeof(*hdr));
+	if (err < 0)
+		return err;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+	for (i = 0; (i < hdr->nr_vcpus) && (err == 0); i++) {
+		memset(state, 0, sizeof(*state));
+		state->vcpu_id = i;
+		if (vm_save_vcpu_state(ctx, state) != 0)
+			err = -errno;
+		else
+			err = snapshot_write(fd, state, sizeof(*state));
+	}
+	free(state);
+
+	if (err == 0)
+		err = save_pci(ctx, fd);
+
+	return err;
+}
+
+/*
+ * Take a snapshot of the VM to path: the VM is paused and powered off
+ * once it's written, ACRN can't run a paused VM again.
+ */
+int
+vm_snapshot(struct vmctx *ctx, const char *path)
+{
+	struct snapshot_region regions[SNAPSHOT_REGIONS];
+	struct snapshot_header hdr;
+	off_t off;
+	int fd, i, tries, err;
+
+	if (!can_save_pci()) {
+		pr_err("%s: the devices of the VM can't be saved\n", __func__);
+		return -1;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		pr_err("%s: failed to open %s (%s)\n", __func__, path, strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.nr_vcpus = guest_cpu_num();
+	hdr.lowmem = ctx->lowmem;
+	hdr.fbmem = ctx->fbmem;
+	hdr.biosmem = ctx->biosmem;
+	hdr.highmem = ctx->highmem;
+
+	snapshot_regions(&hdr, ctx->highmem_gpa_base, regions);
+	vm_pause(ctx);
+
+	/* the backends still complete the requests the devices took */
+	for (tries = 0; ; tries++) {
+		err = snapshot_save_state(ctx, fd, &hdr);
+		if (err != -EBUSY || tries == SNAPSHOT_DRAIN_TRIES)
+			break;
+		usleep(SNAPSHOT_DRAIN_US);
+	}
+
+	if (err == 0) {
+		off = lseek(fd, 0, SEEK_CUR);
+		hdr.mem_offset = roundup2(off, SNAPSHOT_MEM_ALIGN);
+		for (i = 0; (i < SNAPSHOT_REGIONS) && (err == 0); i++) {
+			if (regions[i].len > 0)
+				err = snapshot_save_region(fd, ctx->baseaddr + regions[i].gpa,
+					regions[i].len, hdr.mem_offset + regions[i].file_off);
+		}
+	}
+
+	/* the header last, so that a snapshot cut short has none */
+	if (err == 0 && ftruncate(fd, hdr.mem_offset + regions[2].file_off + regions[2].len) != 0)
+		err = -errno;
+	if (err == 0) {
+		hdr.magic = SNAPSHOT_MAGIC;
+		hdr.version = SNAPSHOT_VERSION;
+		err = snapshot_pwrite(fd, (const char *)&hdr, sizeof(hdr), 0);
+	}
+	if (err == 0 && fsync(fd) != 0)
+		err = -errno;
+	close(fd);
+
+	if (err < 0) {
+		pr_err("%s: failed to write %s (%s)\n", __func__, path, strerror(-err));
+		unlink(path);
+	} else {
+		pr_notice("%s: VM snapshot written to %s\n", __func__, path);
+	}
+
+	vm_suspend(ctx, VM_SUSPEND_POWEROFF);
+	return (err < 0) ? -1 : 0;
+}
+
+/* Read the data extents of one chunk of the guest memory, skipping the holes */
+static int
+snapshot_load_chunk(struct snapshot_load *load, size_t chunk)
+{
+	struct snapshot_region *r;
+	off_t start, end, data, hole;
+	int i, err;
+
+	for (i = 0; i < SNAPSHOT_REGIONS; i++) {
+		r = &load->regions[i];
+		if (chunk >= r->file_off && chunk < r->file_off + r->len)
+			break;
+	}
+	if (i == SNAPSHOT_REGIONS)
+		return 0;
+
+	start = load->mem_offset + chunk;
+	end = start + ((r->file_off + r->len - chunk < SNAPSHOT_LOAD_CHUNK) ?
+			(r->file_off + r->len - chunk) : SNAPSHOT_LOAD_CHUNK);
+	while (start < end) {
+		data = lseek(load->fd, start, SEEK_DATA);
+		if (data < 0)
+			return (errno == ENXIO) ? 0 : -errno;
+		if (data >= end)
+			return 0;
+		hole = lseek(load->fd, data, SEEK_HOLE);
+		if (hole < 0)
+			return -errno;
+		if (hole > end)
+			hole = end;
+
+		err = snapshot_pread(load->fd, load->ctx->baseaddr + r->gpa +
+				(data - load->mem_offset - r->file_off), hole - data, data);
+		if (err < 0)
+			return err;
+		start = hole;
+	}
+
+	return 0;
+}
+
+static void *
+snapshot_load_thread(void *arg)
+{
+	struct snapshot_load *load = arg;
+	size_t chunk;
+	int err;
+
+	while ((chunk = atomic_fetch_add(&load->next, SNAPSHOT_LOAD_CHUNK)) < load->size) {
+		err = snapshot_load_chunk(load, chunk);
+		if (err < 0)
+			atomic_store(&load->err, err);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the guest memory, SNAPSHOT_LOAD_CHUNK at a time on up to
+ * SNAPSHOT_LOAD_THREADS threads. The holes are left as the memory was set
+ * up: zeros, or the same tables the same command line built.
+ */
+static int
+snapshot_load_memory(struct vmctx *ctx, int fd, const struct snapshot_header *hdr)
+{
+	struct snapshot_region regions[SNAPSHOT_REGIONS];
+	pthread_t tids[SNAPSHOT_LOAD_THREADS - 1];
+	struct snapshot_load load;
+	uint64_t start_us = launch_timeline_now();
+	int i, nr_threads;
+
+	snapshot_regions(hdr, ctx->highmem_gpa_base, regions);
+	load.fd = fd;
+	load.ctx = ctx;
+	load.regions = regions;
+	load.mem_offset = hdr->mem_offset;
+	load.size = regions[2].file_off + regions[2].len;
+	atomic_init(&load.next, 0);
+	atomic_init(&load.err, 0);
+
+	/* the calling thread is one of them */
+	for (i = 0; i < SNAPSHOT_LOAD_THREADS - 1; i++) {
+		if (pthread_create(&tids[i], NULL, snapshot_load_thread, &load) != 0)
+			break;
+		pthread_setname_np(tids[i], "snapshot_load");
+	}
+	nr_threads = i + 1;
+
+	snapshot_load_thread(&load);
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(tids[i], NULL);
+
+	if (atomic_load(&load.err) < 0)
+		return atomic_load(&load.err);
+
+	launch_timeline_add_phase("restore_memory", start_us);
+	pr_info("%s: guest memory read on %d threads in %lu us\n", __func__,
+		nr_threads, launch_timeline_now() - start_us);
+	return 0;
+}
+
+/*
+ * Restore the VM from the snapshot at path instead of loading its software,
+ * after its devices are initialized and before it runs.
+ */
+int
+vm_restore_snapshot(struct vmctx *ctx, const char *path)
+{
+	struct acrn_vcpu_state *states = NULL;
+	struct snapshot_header hdr;
+	uint64_t start_us;
+	int fd, i, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pr_err("%s: failed to open %s (%s)\n", __func__, path, strerror(errno));
+		return -1;
+	}
+
+	err = snapshot_read(fd, &hdr, sizeof(hdr));
+	if (err < 0)
+		goto out;
+	if (hdr.magic != SNAPSHOT_MAGIC || hdr.version != SNAPSHOT_VERSION) {
+		pr_err("%s: %s isn't a VM snapshot\n", __func__, path);
+		err = -EINVAL;
+		goto out;
+	}
+	if (hdr.nr_vcpus != guest_cpu_num() || hdr.lowmem != ctx->lowmem ||
+	    hdr.fbmem != ctx->fbmem || hdr.biosmem != ctx->biosmem ||
+	    hdr.highmem != ctx->highmem) {
+		pr_err("%s: %s is of a VM with other vCPUs or memory\n", __func__, path);
+		err = -EINVAL;
+		goto out;
+	}
+
+	states = calloc(hdr.nr_vcpus, sizeof(*states));
+	if (states == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; (i < hdr.nr_vcpus) && (err == 0); i++)
+		err = snapshot_read(fd, &states[i], sizeof(states[i]));
+	if (err < 0)
+		goto out;
+
+	err = snapshot_load_memory(ctx, fd, &hdr);
+	if (err < 0)
+		goto out;
+
+	/* the vIOAPIC comes with vCPU 0, before the devices raise their lines */
+	start_us = launch_timeline_now();
+	for (i = 0; (i < hdr.nr_vcpus) && (err == 0); i++) {
+		if (vm_restore_vcpu_state(ctx, &states[i]) != 0)
+			err = -errno;
+	}
+	if (err == 0)
+		err = restore_pci(ctx, fd);
+	if (err == 0)
+		launch_timeline_add_phase("restore_state", start_us);
+
+out:
+	free(states);
+	close(fd);
+	if (err < 0) {
+		pr_err("%s: failed to restore %s (%s)\n", __func__, path, strerror(-err));
+		return -1;
+	}
+	pr_notice("%s: VM restored from %s\n", __func__, path);
+	return 0;
+}
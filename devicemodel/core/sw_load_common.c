@@ -28,16 +28,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
 #include "dm.h"
 #include "pci_core.h"
 #include "vssram.h"
+#include "launch_timeline.h"
 
 int with_bootargs;
 static char bootargs[BOOT_ARG_LEN];
 
+/* the images are read into guest memory by chunks, on up to the threads */
+#define IMAGE_LOAD_CHUNK	(16 * MB)
+#define IMAGE_LOAD_THREADS	4
+
+struct image_load {
+	int fd;
+	char *dst;
+	size_t size;
+	atomic_size_t next;	/* the offset of the next chunk to read */
+	atomic_int err;
+};
+
 /*
  * Default e820 mem map:
  *
@@ -159,6 +178,102 @@ check_image(char *path, size_t size_limit, size_t *size)
 	return 0;
 }
 
+static int
+image_load_range(struct image_load *load, size_t off, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(load->fd, load->dst + off, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n < 0) ? -errno : -EIO;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void *
+image_load_thread(void *arg)
+{
+	struct image_load *load = arg;
+	size_t off;
+	int err;
+
+	while ((off = atomic_fetch_add(&load->next, IMAGE_LOAD_CHUNK)) < load->size) {
+		err = image_load_range(load, off, (load->size - off < IMAGE_LOAD_CHUNK) ?
+			(load->size - off) : IMAGE_LOAD_CHUNK);
+		if (err < 0)
+			atomic_store(&load->err, err);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the image at path, of size bytes when it was checked, into dst in
+ * the guest memory. It's read with pread() straight into the guest memory,
+ * IMAGE_LOAD_CHUNK at a time on up to IMAGE_LOAD_THREADS threads, and the
+ * time it takes is recorded as the phase name of the launch timeline.
+ */
+int
+acrn_load_image(const char *name, const char *path, void *dst, size_t size)
+{
+	pthread_t tids[IMAGE_LOAD_THREADS - 1];
+	uint64_t start_us = launch_timeline_now();
+	struct image_load load;
+	struct stat sb;
+	size_t nr_chunks;
+	int i, nr_threads;
+
+	load.fd = open(path, O_RDONLY);
+	if (load.fd < 0) {
+		pr_err("SW_LOAD ERR: could not open %s (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	if ((fstat(load.fd, &sb) != 0) || (sb.st_size != size)) {
+		pr_err("SW_LOAD ERR: %s changed\n", path);
+		close(load.fd);
+		return -1;
+	}
+	posix_fadvise(load.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	load.dst = dst;
+	load.size = size;
+	atomic_init(&load.next, 0);
+	atomic_init(&load.err, 0);
+
+	/* the calling thread is one of them */
+	nr_chunks = (size + IMAGE_LOAD_CHUNK - 1) / IMAGE_LOAD_CHUNK;
+	nr_threads = (nr_chunks < IMAGE_LOAD_THREADS) ? nr_chunks : IMAGE_LOAD_THREADS;
+	for (i = 0; i < nr_threads - 1; i++) {
+		if (pthread_create(&tids[i], NULL, image_load_thread, &load) != 0)
+			break;
+		pthread_setname_np(tids[i], "image_load");
+	}
+	nr_threads = i + 1;
+
+	image_load_thread(&load);
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(tids[i], NULL);
+	close(load.fd);
+
+	if (atomic_load(&load.err) < 0) {
+		pr_err("SW_LOAD ERR: could not read the whole %s (%s)\n", path,
+			strerror(-atomic_load(&load.err)));
+		return -1;
+	}
+
+	launch_timeline_add_phase(name, start_us);
+	pr_info("SW_LOAD: %s %s size %lu read on %d threads in %lu us\n", name, path,
+		size, nr_threads, launch_timeline_now() - start_us);
+	return 0;
+}
+
 /* Assumption:
  * the range [start, start + size] belongs to one entry of e820 table
  */
@@ -295,14 +410,25 @@ acrn_create_e820_table(struct vmctx *ctx, struct e820_entry *e820)
 int
 acrn_sw_load(struct vmctx *ctx)
 {
-	if (vsbl_file_name)
-		return acrn_sw_load_vsbl(ctx);
-	else if (ovmf_loaded)
-		return acrn_sw_load_ovmf(ctx);
-	else if (kernel_file_name)
-		return acrn_sw_load_bzimage(ctx);
-	else if (elf_file_name)
-		return acrn_sw_load_elf(ctx);
-	else
+	uint64_t start_us = launch_timeline_now();
+	const char *phase;
+	int ret;
+
+	if (vsbl_file_name) {
+		phase = "sw_load_vsbl";
+		ret = acrn_sw_load_vsbl(ctx);
+	} else if (ovmf_loaded) {
+		phase = "sw_load_ovmf";
+		ret = acrn_sw_load_ovmf(ctx);
+	} else if (kernel_file_name) {
+		phase = "sw_load_bzimage";
+		ret = acrn_sw_load_bzimage(ctx);
+	} else if (elf_file_name) {
+		phase = "sw_load_elf";
+		ret = acrn_sw_load_elf(ctx);
+	} else
 		return -1;
+
+	launch_timeline_add_phase(phase, start_us);
+	return ret;
 }
@@ -82,6 +82,8 @@ static size_t ovmf_code_size;
 static size_t ovmf_vars_size;
 static char *mmap_vars;
 static bool writeback_nv_storage;
+/* the read-only images read, copied again instead on a warm reset */
+static char *ovmf_cache[2];
 
 extern int init_cmos_vrpmb(struct vmctx *ctx);
 
@@ -169,6 +171,13 @@ acrn_prepare_ovmf(struct vmctx *ctx)
 	addr = ctx->baseaddr + OVMF_TOP(ctx) - ovmf_image_size();
 
 	for (i = 0; i < 2; i++) {
+		if ((flags == O_RDONLY) && (ovmf_cache[i] != NULL)) {
+			memcpy(addr, ovmf_cache[i], size);
+			pr_info("SW_LOAD: cached partition blob %s size 0x%lx copied to addr %p\n",
+				path, size, addr);
+			goto next;
+		}
+
 		fd = open(path, flags);
 
 		if (fd == -1) {
@@ -254,6 +263,13 @@ acrn_prepare_ovmf(struct vmctx *ctx)
 		pr_info("SW_LOAD: partition blob %s size 0x%lx copied to addr %p\n",
 			path, size, addr);
 
+		if (warm_reset && (flags == O_RDONLY)) {
+			ovmf_cache[i] = malloc(size);
+			if (ovmf_cache[i] != NULL)
+				memcpy(ovmf_cache[i], addr, size);
+		}
+
+next:
 		if (!ovmf_file_name) {
 			addr += size;
 			path = ovmf_code_file_name;
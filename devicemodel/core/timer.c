@@ -4,9 +4,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/timerfd.h>
 
 #include "vmmapi.h"
@@ -22,126 +24,447 @@
  * Please note timerfd and epoll are all Linux specific. If the code need to be
  * ported to other OS, we can modify the api with POSIX timers and sigevent
  * mechanism.
+ *
+ * Rather than one timerfd per timer, the timers of a clock are kept in a
+ * min-heap of their deadlines, expire + slack, and share one timerfd armed
+ * for the earliest of them. Whenever it fires, every timer already expired
+ * runs, those with some slack left included, so that the coarse timers are
+ * batched into the wakeups of the others. Arming a timer later than the first
+ * deadline takes no syscall at all.
  */
 
+#define TIMER_HEAP_MIN		16
+
+struct timer_service {
+	int32_t clockid;
+	int32_t fd;
+	struct mevent *mevp;
+	uint64_t armed_ns;		/* the deadline the timerfd is armed for, 0 if none */
+	struct acrn_timer **heap;
+	int32_t nr;
+	int32_t cap;
+	int32_t nr_slack;		/* the armed timers with some slack */
+};
+
+static struct timer_service timer_services[] = {
+	{ .clockid = CLOCK_MONOTONIC, .fd = -1 },
+	{ .clockid = CLOCK_REALTIME, .fd = -1 },
+};
+
+/* protects the timer services and the timers in them */
+static pthread_mutex_t timer_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t
+ts_to_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static inline void
+ns_to_ts(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / NS_PER_SEC;
+	ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+static uint64_t
+timer_now_ns(int32_t clockid)
+{
+	struct timespec ts;
+
+	clock_gettime(clockid, &ts);
+	return ts_to_ns(&ts);
+}
+
+static inline uint64_t
+timer_deadline(const struct acrn_timer *timer)
+{
+	return timer->expire_ns + timer->slack_ns;
+}
+
+static struct timer_service *
+timer_get_service(int32_t clockid)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(timer_services); i++) {
+		if (timer_services[i].clockid == clockid)
+			return &timer_services[i];
+	}
+	return NULL;
+}
+
+static void
+heap_set(struct timer_service *svc, int32_t idx, struct acrn_timer *timer)
+{
+	svc->heap[idx] = timer;
+	timer->heap_idx = idx;
+}
+
+static void
+heap_sift_up(struct timer_service *svc, int32_t idx)
+{
+	struct acrn_timer *timer = svc->heap[idx];
+	int32_t parent;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (timer_deadline(svc->heap[parent]) <= timer_deadline(timer))
+			break;
+		heap_set(svc, idx, svc->heap[parent]);
+		idx = parent;
+	}
+	heap_set(svc, idx, timer);
+}
+
+static void
+heap_sift_down(struct timer_service *svc, int32_t idx)
+{
+	struct acrn_timer *timer = svc->heap[idx];
+	int32_t child;
+
+	while ((child = 2 * idx + 1) < svc->nr) {
+		if ((child + 1 < svc->nr) &&
+		    (timer_deadline(svc->heap[child + 1]) < timer_deadline(svc->heap[child])))
+			child++;
+		if (timer_deadline(timer) <= timer_deadline(svc->heap[child]))
+			break;
+		heap_set(svc, idx, svc->heap[child]);
+		idx = child;
+	}
+	heap_set(svc, idx, timer);
+}
+
+static int
+heap_insert(struct timer_service *svc, struct acrn_timer *timer)
+{
+	struct acrn_timer **heap;
+	int32_t cap;
+
+	if (svc->nr == svc->cap) {
+		cap = (svc->cap != 0) ? svc->cap * 2 : TIMER_HEAP_MIN;
+		heap = realloc(svc->heap, cap * sizeof(struct acrn_timer *));
+		if (heap == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		svc->heap = heap;
+		svc->cap = cap;
+	}
+
+	heap_set(svc, svc->nr++, timer);
+	heap_sift_up(svc, timer->heap_idx);
+	if (timer->slack_ns != 0UL)
+		svc->nr_slack++;
+
+	return 0;
+}
+
+static void
+heap_remove(struct timer_service *svc, struct acrn_timer *timer)
+{
+	int32_t idx = timer->heap_idx;
+
+	/* the heap is emptied when the service is torn down */
+	if ((idx < 0) || (idx >= svc->nr) || (svc->heap[idx] != timer)) {
+		timer->heap_idx = -1;
+		return;
+	}
+
+	timer->heap_idx = -1;
+	if (timer->slack_ns != 0UL)
+		svc->nr_slack--;
+
+	svc->nr--;
+	if (idx == svc->nr)
+		return;
+	heap_set(svc, idx, svc->heap[svc->nr]);
+	heap_sift_down(svc, idx);
+	heap_sift_up(svc, idx);
+}
+
+/* the timer moved later, as it only does once it expired */
+static void
+heap_update(struct timer_service *svc, struct acrn_timer *timer)
+{
+	heap_sift_down(svc, timer->heap_idx);
+}
+
+/* arm the timerfd for the first deadline, unless it already is */
+static void
+timer_service_arm(struct timer_service *svc)
+{
+	struct itimerspec its = { 0 };
+	uint64_t deadline;
+
+	deadline = (svc->nr > 0) ? timer_deadline(svc->heap[0]) : 0UL;
+	if (deadline == svc->armed_ns)
+		return;
+
+	ns_to_ts(deadline, &its.it_value);
+	if (timerfd_settime(svc->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		pr_err("acrn_timer timerfd_settime error %d\n", errno);
+		return;
+	}
+	svc->armed_ns = deadline;
+}
+
+/* an expired timer, the top of the heap or, with slack, any in it */
+static struct acrn_timer *
+timer_service_next_due(struct timer_service *svc, uint64_t now)
+{
+	int32_t i;
+
+	if (svc->nr == 0)
+		return NULL;
+	if (svc->heap[0]->expire_ns <= now)
+		return svc->heap[0];
+	/* without slack, the first deadline is the first expiration */
+	if (svc->nr_slack == 0)
+		return NULL;
+
+	for (i = 1; i < svc->nr; i++) {
+		if (svc->heap[i]->expire_ns <= now)
+			return svc->heap[i];
+	}
+	return NULL;
+}
+
 static void
-timer_handler(int fd __attribute__((unused)),
+timer_service_handler(int fd __attribute__((unused)),
 		  enum ev_type t __attribute__((unused)),
 		  void *arg)
 {
-	struct acrn_timer *timer = arg;
-	uint64_t nexp;
+	struct timer_service *svc = arg;
+	struct acrn_timer *timer;
+	uint64_t nexp, now;
 	ssize_t size;
 	void (*cb)(void *, uint64_t);
+	void *param;
 
-	if (timer == NULL) {
+	/* Consume I/O event for default EPOLLLT type. */
+	size = read(svc->fd, &nexp, sizeof(nexp));
+	if ((size < 0) && (errno != EAGAIN)) {
+		pr_err("acrn_timer read timerfd error");
 		return;
 	}
 
-	/* Consume I/O event for default EPOLLLT type.
-	 * Here is a temporary solution, the processing could be moved to
-	 * mevent.c once EVF_TIMER is supported.
+	/*
+	 * One timer at a time, the lock is not held by the callbacks, which
+	 * may set or delete any timer, themselves included.
 	 */
-	size = read(timer->fd, &nexp, sizeof(nexp));
+	pthread_mutex_lock(&timer_mtx);
+	/* the timerfd is not armed anymore once it expired */
+	if (size > 0)
+		svc->armed_ns = 0UL;
+	for (;;) {
+		now = timer_now_ns(svc->clockid);
+		timer = timer_service_next_due(svc, now);
+		if (timer == NULL)
+			break;
 
-	if (size < 0) {
-		if (errno != EAGAIN) {
-			pr_err("acrn_timer read timerfd error");
+		if (timer->interval_ns != 0UL) {
+			nexp = 1UL + (now - timer->expire_ns) / timer->interval_ns;
+			timer->expire_ns += nexp * timer->interval_ns;
+			heap_update(svc, timer);
+		} else {
+			nexp = 1UL;
+			heap_remove(svc, timer);
 		}
-		return;
+
+		cb = timer->callback;
+		param = timer->callback_param;
+		pthread_mutex_unlock(&timer_mtx);
+
+		if (cb != NULL)
+			(*cb)(param, nexp);
+
+		pthread_mutex_lock(&timer_mtx);
 	}
+	timer_service_arm(svc);
+	pthread_mutex_unlock(&timer_mtx);
+}
 
-	/* check the validity of timer expiration. */
-	if ((size == 0) || (nexp == 0))
-		return;
+/* the timerfd is closed by mevent_destroy(), along with the dispatch loop */
+static void
+timer_service_teardown(void *arg)
+{
+	struct timer_service *svc = arg;
+	int32_t i;
 
-	if ((cb = timer->callback) != NULL) {
-		(*cb)(timer->callback_param, nexp);
+	pthread_mutex_lock(&timer_mtx);
+	for (i = 0; i < svc->nr; i++)
+		svc->heap[i]->heap_idx = -1;
+	svc->nr = 0;
+	svc->nr_slack = 0;
+	svc->armed_ns = 0UL;
+	svc->fd = -1;
+	svc->mevp = NULL;
+	pthread_mutex_unlock(&timer_mtx);
+}
+
+static int
+timer_service_start(struct timer_service *svc)
+{
+	svc->fd = timerfd_create(svc->clockid, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (svc->fd < 0) {
+		pr_err("acrn_timer create failed.\n");
+		return -1;
 	}
+
+	svc->mevp = mevent_add_disp(svc->fd, EVF_READ, timer_service_handler, svc,
+			timer_service_teardown, svc, MEVENT_DISP_TIMER);
+	if (svc->mevp == NULL) {
+		close(svc->fd);
+		svc->fd = -1;
+		pr_err("acrn_timer mevent add failed.\n");
+		return -1;
+	}
+	svc->armed_ns = 0UL;
+
+	return 0;
 }
 
 int32_t
 acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t),
 		void *param)
 {
+	struct timer_service *svc;
+	int32_t ret = 0;
+
 	if ((timer == NULL) || (cb == NULL)) {
 		return -1;
 	}
 
 	timer->fd = -1;
-	if ((timer->clockid == CLOCK_REALTIME) ||
-			(timer->clockid == CLOCK_MONOTONIC)) {
-		timer->fd = timerfd_create(timer->clockid,
-					TFD_NONBLOCK | TFD_CLOEXEC);
-	} else {
+	timer->heap_idx = -1;
+	svc = timer_get_service(timer->clockid);
+	if (svc == NULL) {
 		pr_err("acrn_timer clockid is not supported.\n");
-	}
-
-	if (timer->fd <= 0) {
-		pr_err("acrn_timer create failed.\n");
 		return -1;
 	}
 
-	timer->mevp = mevent_add(timer->fd, EVF_READ, timer_handler, timer, NULL, NULL);
-	if (timer->mevp == NULL) {
-		close(timer->fd);
-		pr_err("acrn_timer mevent add failed.\n");
-		return -1;
+	pthread_mutex_lock(&timer_mtx);
+	if (svc->fd < 0)
+		ret = timer_service_start(svc);
+	if (ret == 0) {
+		timer->fd = svc->fd;
+		timer->expire_ns = 0UL;
+		timer->interval_ns = 0UL;
+		timer->callback = cb;
+		timer->callback_param = param;
 	}
+	pthread_mutex_unlock(&timer_mtx);
 
-	timer->callback = cb;
-	timer->callback_param = param;
-
-	return 0;
+	return ret;
 }
 
 void
 acrn_timer_deinit(struct acrn_timer *timer)
 {
+	struct timer_service *svc;
+
 	if (timer == NULL) {
 		return;
 	}
 
-	if (timer->mevp != NULL) {
-		mevent_delete_close(timer->mevp);
-		timer->mevp = NULL;
+	pthread_mutex_lock(&timer_mtx);
+	svc = timer_get_service(timer->clockid);
+	if ((svc != NULL) && (timer->fd >= 0) && (timer->heap_idx >= 0)) {
+		heap_remove(svc, timer);
+		timer_service_arm(svc);
 	}
 
 	timer->fd = -1;
 	timer->callback = NULL;
 	timer->callback_param = NULL;
+	pthread_mutex_unlock(&timer_mtx);
 }
 
-int32_t
-acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
+static int32_t
+acrn_timer_set(struct acrn_timer *timer, const struct itimerspec *new_value,
+		bool abs)
 {
-	if (timer == NULL) {
+	struct timer_service *svc;
+	int32_t ret = 0;
+
+	if ((timer == NULL) || (new_value == NULL) ||
+	    (new_value->it_value.tv_nsec < 0) || (new_value->it_value.tv_nsec >= NS_PER_SEC) ||
+	    (new_value->it_interval.tv_nsec < 0) || (new_value->it_interval.tv_nsec >= NS_PER_SEC)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return timerfd_settime(timer->fd, 0, new_value, NULL);
+	pthread_mutex_lock(&timer_mtx);
+	svc = timer_get_service(timer->clockid);
+	if ((svc == NULL) || (timer->fd < 0) || (timer->fd != svc->fd)) {
+		pthread_mutex_unlock(&timer_mtx);
+		errno = EBADF;
+		return -1;
+	}
+
+	if (timer->heap_idx >= 0)
+		heap_remove(svc, timer);
+
+	/* a zero it_value disarms the timer, as with timerfd_settime() */
+	if ((new_value->it_value.tv_sec != 0) || (new_value->it_value.tv_nsec != 0)) {
+		timer->expire_ns = ts_to_ns(&new_value->it_value);
+		if (!abs)
+			timer->expire_ns += timer_now_ns(svc->clockid);
+		timer->interval_ns = ts_to_ns(&new_value->it_interval);
+		ret = heap_insert(svc, timer);
+	}
+	timer_service_arm(svc);
+	pthread_mutex_unlock(&timer_mtx);
+
+	return ret;
+}
+
+int32_t
+acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
+{
+	return acrn_timer_set(timer, new_value, false);
 }
 
 int32_t
 acrn_timer_settime_abs(struct acrn_timer *timer,
 		const struct itimerspec *new_value)
 {
-	if (timer == NULL) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	return timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, new_value, NULL);
+	return acrn_timer_set(timer, new_value, true);
 }
 
 int32_t
 acrn_timer_gettime(struct acrn_timer *timer, struct itimerspec *cur_value)
 {
-	if (timer == NULL) {
+	struct timer_service *svc;
+	uint64_t now, expire;
+
+	if ((timer == NULL) || (cur_value == NULL)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return timerfd_gettime(timer->fd, cur_value);
+	pthread_mutex_lock(&timer_mtx);
+	svc = timer_get_service(timer->clockid);
+	if ((svc == NULL) || (timer->fd < 0)) {
+		pthread_mutex_unlock(&timer_mtx);
+		errno = EBADF;
+		return -1;
+	}
+
+	ns_to_ts(0UL, &cur_value->it_value);
+	ns_to_ts(0UL, &cur_value->it_interval);
+	if (timer->heap_idx >= 0) {
+		now = timer_now_ns(svc->clockid);
+		expire = timer->expire_ns;
+		/* an expiration not handled yet, the next one is what is left */
+		if ((expire <= now) && (timer->interval_ns != 0UL))
+			expire += (1UL + (now - expire) / timer->interval_ns) * timer->interval_ns;
+		if (expire > now)
+			ns_to_ts(expire - now, &cur_value->it_value);
+		ns_to_ts(timer->interval_ns, &cur_value->it_interval);
+	}
+	pthread_mutex_unlock(&timer_mtx);
+
+	return 0;
 }
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -35,6 +36,11 @@
 
 #define BROKEN_TIME ((time_t)-1)
 
+/* the events emitted last, kept binary until a client reads them */
+#define VM_EVENT_RING_LEN	64U
+/* as many fit in the 4K buffer of a monitor client */
+#define VM_EVENT_READ_MAX	24U
+
 typedef void (*vm_event_handler)(struct vmctx *ctx, struct vm_event *event);
 typedef void (*vm_event_generate_jdata)(cJSON *event_obj, struct vm_event *event);
 
@@ -78,6 +84,16 @@ struct vm_event_proc {
 	vm_event_generate_jdata gen_jdata_handler; /* how to transtfer vm_event data to json txt */
 };
 
+struct vm_event_record {
+	uint64_t seq;
+	uint64_t time_us;	/* CLOCK_MONOTONIC */
+	struct vm_event event;
+};
+
+static struct vm_event_record ve_ring[VM_EVENT_RING_LEN];
+static uint64_t ve_next_seq;
+static pthread_mutex_t ve_ring_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static struct vm_event_proc ve_proc[VM_EVENT_COUNT] = {
 	[VM_EVENT_RTC_CHG] = {
 		.ve_handler = rtc_chg_event_handler,
@@ -155,6 +171,8 @@ static void vm_event_throttle_init(struct vmctx *ctx)
 		ctl->is_up = false;
 		pthread_mutex_init(&ctl->mtx, NULL);
 		ctl->timer.clockid = CLOCK_MONOTONIC;
+		/* a 1s window, it may as well expire with another timer */
+		ctl->timer.slack_ns = 10000000UL;
 		ret = acrn_timer_init(&ctl->timer, throttle_timer_cb, ctl);
 		if (ret < 0) {
 			pr_warn("failed to create timer for vm_event %d, throttle disabled\n", i);
@@ -214,17 +232,100 @@ static char *generate_vm_event_message(struct vm_event *event)
 	return event_msg;
 }
 
+static void record_vm_event(struct vm_event *event)
+{
+	struct vm_event_record *rec;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	pthread_mutex_lock(&ve_ring_mtx);
+	rec = &ve_ring[ve_next_seq % VM_EVENT_RING_LEN];
+	rec->seq = ve_next_seq++;
+	rec->time_us = (uint64_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+	rec->event = *event;
+	pthread_mutex_unlock(&ve_ring_mtx);
+}
+
 static void emit_vm_event(struct vmctx *ctx, struct vm_event *event)
 {
-	if (!event_throttle(event)) {
-		char *msg = generate_vm_event_message(event);
-		if (msg != NULL) {
-			vm_monitor_send_vm_event(msg);
-			free(msg);
-		}
+	char *msg;
+
+	if (event_throttle(event))
+		return;
+
+	record_vm_event(event);
+
+	/* the JSON message is only built for a registered vm_event client */
+	if (!vm_monitor_has_vm_event_client())
+		return;
+	msg = generate_vm_event_message(event);
+	if (msg != NULL) {
+		vm_monitor_send_vm_event(msg);
+		free(msg);
 	}
 }
 
+/*
+ * The recorded events from sequence number since on, at most
+ * VM_EVENT_READ_MAX of them, for the monitor: a client polling with the
+ * returned next_seq gets all the events in batches, "lost" counts the ones
+ * overwritten in the ring before it read them.
+ */
+int
+vm_event_read(uint64_t since, char *buf, size_t len)
+{
+	struct vm_event_record recs[VM_EVENT_READ_MAX];
+	struct vm_event_proc *proc;
+	cJSON *root, *obj, *list, *item;
+	uint64_t seq, next, lost = 0;
+	char *out;
+	int i, n = 0, ret = -1;
+
+	pthread_mutex_lock(&ve_ring_mtx);
+	next = ve_next_seq;
+	seq = since;
+	if (next > VM_EVENT_RING_LEN && seq < next - VM_EVENT_RING_LEN) {
+		lost = next - VM_EVENT_RING_LEN - seq;
+		seq = next - VM_EVENT_RING_LEN;
+	}
+	for (; seq < next && n < VM_EVENT_READ_MAX; seq++)
+		recs[n++] = ve_ring[seq % VM_EVENT_RING_LEN];
+	pthread_mutex_unlock(&ve_ring_mtx);
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	obj = cJSON_AddObjectToObject(root, "vm_events");
+	if (obj == NULL)
+		goto out;
+	cJSON_AddNumberToObject(obj, "next_seq", (double)seq);
+	cJSON_AddNumberToObject(obj, "lost", (double)lost);
+	list = cJSON_AddArrayToObject(obj, "events");
+	for (i = 0; list != NULL && i < n; i++) {
+		item = cJSON_CreateObject();
+		if (item == NULL)
+			goto out;
+		cJSON_AddNumberToObject(item, "seq", (double)recs[i].seq);
+		cJSON_AddNumberToObject(item, "time_us", (double)recs[i].time_us);
+		cJSON_AddNumberToObject(item, "vm_event", recs[i].event.type);
+		proc = get_vm_event_proc(&recs[i].event);
+		if (proc && proc->gen_jdata_handler)
+			(proc->gen_jdata_handler)(item, &recs[i].event);
+		cJSON_AddItemToArray(list, item);
+	}
+	cJSON_AddNumberToObject(root, "ack", 0);
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+out:
+	cJSON_Delete(root);
+	return ret;
+}
+
 static void general_event_handler(struct vmctx *ctx, struct vm_event *event)
 {
 	emit_vm_event(ctx, event);
@@ -249,6 +350,7 @@ static void gen_rtc_chg_jdata(cJSON *event_obj, struct vm_event *event)
 
 static struct acrn_timer rtc_chg_event_timer = {
 	.clockid = CLOCK_MONOTONIC,
+	.slack_ns = 10000000UL,
 };
 static pthread_mutex_t rtc_chg_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct timespec time_window_start;
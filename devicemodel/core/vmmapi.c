@@ -38,8 +38,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 
+#include "atomic.h"
 #include "vmmapi.h"
 #include "mevent.h"
 #include "errno.h"
@@ -81,22 +83,20 @@ const char *vm_state_to_str(enum vm_suspend_how idx)
 
 static int devfd = -1;
 static uint64_t cpu_affinity_bitmap = 0UL;
+static uint64_t cpu_hotplug_bitmap = 0UL;
 
-static void add_one_pcpu(int pcpu_id)
+static void add_one_pcpu(uint64_t *bitmap, int pcpu_id)
 {
-	if (cpu_affinity_bitmap & (1UL << pcpu_id)) {
+	if ((cpu_affinity_bitmap | cpu_hotplug_bitmap) & (1UL << pcpu_id)) {
 		pr_err("%s: pcpu_id %d has been allocated to this VM.\n", __func__, pcpu_id);
 		return;
 	}
 
-	cpu_affinity_bitmap |= (1UL << pcpu_id);
+	*bitmap |= (1UL << pcpu_id);
 }
 
-/*
- * example options:
- *   --cpu_affinity 1,2,3
- */
-int acrn_parse_cpu_affinity(char *opt)
+/* a list of LAPIC IDs delimited by ',' */
+static int parse_pcpus(char *opt, uint64_t *bitmap)
 {
 	char *str, *cp, *cp_opt;
 	int lapic_id;
@@ -114,7 +114,7 @@ int acrn_parse_cpu_affinity(char *opt)
 		/* no more entries delimited by ',' */
 		if (!str) {
 			if (!dm_strtoi(cp, NULL, 10, &lapic_id)) {
-				add_one_pcpu(lapic_to_pcpu(lapic_id));
+				add_one_pcpu(bitmap, lapic_to_pcpu(lapic_id));
 			}
 			break;
 		} else {
@@ -126,7 +126,7 @@ int acrn_parse_cpu_affinity(char *opt)
 				if (dm_strtoi(str, NULL, 10, &lapic_id)) {
 					goto err;
 				}
-				add_one_pcpu(lapic_to_pcpu(lapic_id));
+				add_one_pcpu(bitmap, lapic_to_pcpu(lapic_id));
 			}
 		}
 	}
@@ -139,11 +139,35 @@ err:
 	return -1;
 }
 
+/*
+ * example options:
+ *   --cpu_affinity 1,2,3
+ */
+int acrn_parse_cpu_affinity(char *opt)
+{
+	return parse_pcpus(opt, &cpu_affinity_bitmap);
+}
+
+/*
+ * The pCPUs the VM may get vCPUs on once it runs, they are announced to the
+ * guest as hot-pluggable processors. example options:
+ *   --cpu_hotplug 4,5
+ */
+int acrn_parse_cpu_hotplug(char *opt)
+{
+	return parse_pcpus(opt, &cpu_hotplug_bitmap);
+}
+
 uint64_t vm_get_cpu_affinity_dm(void)
 {
 	return cpu_affinity_bitmap;
 }
 
+uint64_t vm_get_cpu_hotplug_dm(void)
+{
+	return cpu_hotplug_bitmap;
+}
+
 struct vmctx *
 vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 {
@@ -192,6 +216,16 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		create_vm.vm_flag &= (~GUEST_FLAG_IO_COMPLETION_POLLING);
 	}
 
+	if (hv_vhpet)
+		create_vm.vm_flag |= GUEST_FLAG_VHPET;
+	else
+		create_vm.vm_flag &= (~GUEST_FLAG_VHPET);
+
+	if (hv_vpit)
+		create_vm.vm_flag |= GUEST_FLAG_VPIT;
+	else
+		create_vm.vm_flag &= (~GUEST_FLAG_VPIT);
+
 	/* command line arguments specified CPU affinity could overwrite HV's static configuration */
 	create_vm.cpu_affinity = cpu_affinity_bitmap;
 	strncpy((char *)create_vm.name, name, strnlen(name, MAX_VM_NAME_LEN));
@@ -281,6 +315,71 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	return error;
 }
 
+/*
+ * Notify the completion of the requests of all the vCPUs in vcpu_mask, in one
+ * ioctl if the HSM supports it, one per vCPU otherwise.
+ */
+int
+vm_notify_requests_done(struct vmctx *ctx, uint64_t vcpu_mask)
+{
+	static bool batch_unsupported;
+	struct acrn_ioreq_notify_batch notify;
+	int vcpu, error = 0;
+
+	/* a single request gains nothing from the batch */
+	if (!batch_unsupported && (vcpu_mask & (vcpu_mask - 1)) != 0UL) {
+		bzero(&notify, sizeof(notify));
+		notify.vmid = ctx->vmid;
+		notify.vcpu_mask = vcpu_mask;
+
+		error = ioctl(ctx->fd, ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH, &notify);
+		if (error == 0)
+			return 0;
+		if (errno != ENOTTY && errno != EINVAL) {
+			pr_err("ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH ioctl() returned an error: %s\n",
+				errormsg(errno));
+			return error;
+		}
+		pr_info("%s: batched notification is not supported, one per request\n", __func__);
+		batch_unsupported = true;
+	}
+
+	while (vcpu_mask != 0UL) {
+		vcpu = ffsll(vcpu_mask) - 1;
+		vcpu_mask &= ~(1UL << vcpu);
+		if (vm_notify_request_done(ctx, vcpu) != 0)
+			error = -1;
+	}
+
+	return error;
+}
+
+/*
+ * The slots of the I/O request page worth a look, the ones the hypervisor
+ * flagged in pending_mask if it keeps it, all the vCPUs otherwise.
+ */
+uint64_t
+vm_ioreq_scan_mask(struct acrn_io_request *req_buf, int ncpus)
+{
+	uint64_t all = (ncpus >= 64) ? ~0UL : ((1UL << ncpus) - 1UL);
+
+	if ((atomic_load(&req_buf[0].buf_features) & ACRN_IOREQ_BUF_PENDING_MASK) == 0U)
+		return all;
+
+	return atomic_load(&req_buf[0].pending_mask) & all;
+}
+
+/*
+ * The device model took the request of vcpu, its slot stays out of the scans
+ * until the hypervisor makes the next request of the vCPU pending.
+ */
+void
+vm_ioreq_taken(struct acrn_io_request *req_buf, int vcpu)
+{
+	if ((atomic_load(&req_buf[0].buf_features) & ACRN_IOREQ_BUF_PENDING_MASK) != 0U)
+		atomic_fetch_and(&req_buf[0].pending_mask, ~(1UL << vcpu));
+}
+
 void
 vm_destroy(struct vmctx *ctx)
 {
@@ -308,6 +407,328 @@ vm_setup_asyncio(struct vmctx *ctx, uint64_t base)
 	return error;
 }
 
+int
+vm_setup_posted_io(struct vmctx *ctx, uint64_t base)
+{
+	int error;
+
+	error = ioctl(ctx->fd, ACRN_IOCTL_SETUP_POSTED_IO, base);
+
+	if (error) {
+		pr_err("ACRN_IOCTL_SETUP_POSTED_IO ioctl() returned an error: %s\n", errormsg(errno));
+	} else {
+		ctx->posted_io = true;
+	}
+
+	return error;
+}
+
+/*
+ * The MSIs of the DM are published in the ring at base instead of being
+ * injected one ioctl each. The hypervisor takes them on the exits of the
+ * Service VM and from an idle pCPU polling the rings, the DM only notifies
+ * it with ACRN_IOCTL_NOTIFY_MSI_RING while no pCPU polls, i.e. while the
+ * doorbell of the ring is set.
+ */
+int
+vm_setup_msi_ring(struct vmctx *ctx, uint64_t base)
+{
+	struct acrn_msi_ring *ring = (struct acrn_msi_ring *)base;
+	int error;
+
+	bzero(ring, sizeof(*ring));
+	ring->magic = ACRN_MSI_RING_MAGIC;
+	ring->nr_entries = ACRN_MSI_RING_MAX;
+	ring->doorbell = 1;
+
+	error = ioctl(ctx->fd, ACRN_IOCTL_SETUP_MSI_RING, base);
+
+	if (error) {
+		pr_err("ACRN_IOCTL_SETUP_MSI_RING ioctl() returned an error: %s\n", errormsg(errno));
+		return error;
+	}
+
+	pthread_mutex_init(&ctx->msi_ring_mtx, NULL);
+	ctx->msi_ring = ring;
+	return 0;
+}
+
+/* publish an MSI in the ring of ctx, false if the ring is full */
+static bool
+vm_msi_ring_put(struct vmctx *ctx, uint64_t addr, uint64_t msg)
+{
+	struct acrn_msi_ring *ring = ctx->msi_ring;
+	struct acrn_msi_entry *msi;
+	uint32_t prod;
+	bool put = false;
+
+	pthread_mutex_lock(&ctx->msi_ring_mtx);
+	prod = ring->prod;
+	if (prod - __atomic_load_n(&ring->cons, __ATOMIC_ACQUIRE) < ring->nr_entries) {
+		msi = &ring->entries[prod & (ring->nr_entries - 1)];
+		msi->msi_addr = addr;
+		msi->msi_data = msg;
+		__atomic_store_n(&ring->prod, prod + 1, __ATOMIC_RELEASE);
+		put = true;
+	}
+	pthread_mutex_unlock(&ctx->msi_ring_mtx);
+
+	return put;
+}
+
+/* notify the hypervisor of the MSIs published, if no pCPU polls the ring */
+static void
+vm_msi_ring_kick(struct vmctx *ctx)
+{
+	/* pairs with the fence of the hypervisor between setting the doorbell and checking the ring */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctx->msi_ring->doorbell, __ATOMIC_RELAXED) == 0)
+		return;
+
+	if (ioctl(ctx->fd, ACRN_IOCTL_NOTIFY_MSI_RING) != 0)
+		pr_err("ACRN_IOCTL_NOTIFY_MSI_RING ioctl() returned an error: %s\n", errormsg(errno));
+}
+
+/*
+ * Guest writes to a posted range are queued by the hypervisor and the vCPU
+ * doesn't wait for them. Only register ranges whose write handlers never
+ * need to be observed synchronously by the guest, reads still go through
+ * the normal I/O request path. Fails without posted I/O set up, the writes
+ * then stay synchronous.
+ */
+int
+vm_assign_posted_io(struct vmctx *ctx, uint32_t type, uint64_t addr, uint64_t len)
+{
+	struct acrn_posted_io_range range;
+	int error;
+
+	if (!ctx->posted_io)
+		return -1;
+
+	bzero(&range, sizeof(range));
+	range.type = type;
+	range.addr = addr;
+	range.len = len;
+	error = ioctl(ctx->fd, ACRN_IOCTL_ASSIGN_POSTED_IO, &range);
+
+	if (error) {
+		pr_err("ACRN_IOCTL_ASSIGN_POSTED_IO ioctl() returned an error: %s\n", errormsg(errno));
+	}
+
+	return error;
+}
+
+int
+vm_deassign_posted_io(struct vmctx *ctx, uint32_t type, uint64_t addr, uint64_t len)
+{
+	struct acrn_posted_io_range range;
+	int error;
+
+	if (!ctx->posted_io)
+		return -1;
+
+	bzero(&range, sizeof(range));
+	range.type = type;
+	range.addr = addr;
+	range.len = len;
+	error = ioctl(ctx->fd, ACRN_IOCTL_DEASSIGN_POSTED_IO, &range);
+
+	if (error) {
+		pr_err("ACRN_IOCTL_DEASSIGN_POSTED_IO ioctl() returned an error: %s\n", errormsg(errno));
+	}
+
+	return error;
+}
+
+int
+vm_write_protect_page(struct vmctx *ctx, vm_paddr_t gpa, bool set)
+{
+	struct acrn_write_protect wp;
+	int error;
+
+	bzero(&wp, sizeof(wp));
+	wp.set = set ? 1 : 0;
+	wp.gpa = gpa;
+	error = ioctl(ctx->fd, ACRN_IOCTL_WRITE_PROTECT_PAGE, &wp);
+
+	if (error) {
+		pr_err("ACRN_IOCTL_WRITE_PROTECT_PAGE ioctl() returned an error: %s\n", errormsg(errno));
+	}
+
+	return error;
+}
+
+#define DIRTY_LOG_PAGE_SHIFT	12
+#define DIRTY_LOG_PAGE_SIZE	(1UL << DIRTY_LOG_PAGE_SHIFT)
+
+struct vm_dirty_log {
+	struct vmctx *ctx;
+	vm_paddr_t gpa;
+	char *hva;
+	size_t npages;
+	/* the pages written, whose protection is lifted */
+	uint64_t *bitmap;
+	LIST_ENTRY(vm_dirty_log) list;
+};
+
+/* the dirty logs and their bitmaps, the vCPUs write while they're synced */
+static LIST_HEAD(, vm_dirty_log) dirty_logs = LIST_HEAD_INITIALIZER(dirty_logs);
+static pthread_mutex_t dirty_log_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+dirty_log_test_and_set(struct vm_dirty_log *log, size_t page)
+{
+	uint64_t bit = 1UL << (page % 64);
+
+	if (log->bitmap[page / 64] & bit)
+		return true;
+	log->bitmap[page / 64] |= bit;
+	return false;
+}
+
+struct vm_dirty_log *
+vm_dirty_log_start(struct vmctx *ctx, vm_paddr_t gpa, void *hva, size_t len)
+{
+	struct vm_dirty_log *log;
+	size_t i;
+
+	if ((gpa & (DIRTY_LOG_PAGE_SIZE - 1)) || len == 0)
+		return NULL;
+
+	log = calloc(1, sizeof(*log));
+	if (log == NULL)
+		return NULL;
+	log->ctx = ctx;
+	log->gpa = gpa;
+	log->hva = hva;
+	log->npages = roundup2(len, DIRTY_LOG_PAGE_SIZE) >> DIRTY_LOG_PAGE_SHIFT;
+	log->bitmap = calloc(roundup2(log->npages, 64) / 64, sizeof(uint64_t));
+	if (log->bitmap == NULL) {
+		free(log);
+		return NULL;
+	}
+
+	for (i = 0; i < log->npages; i++) {
+		if (vm_write_protect_page(ctx,
+				gpa + (i << DIRTY_LOG_PAGE_SHIFT), true) != 0)
+			break;
+	}
+	if (i < log->npages) {
+		while (i-- > 0)
+			vm_write_protect_page(ctx,
+				gpa + (i << DIRTY_LOG_PAGE_SHIFT), false);
+		free(log->bitmap);
+		free(log);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&dirty_log_mtx);
+	LIST_INSERT_HEAD(&dirty_logs, log, list);
+	pthread_mutex_unlock(&dirty_log_mtx);
+	return log;
+}
+
+void
+vm_dirty_log_stop(struct vm_dirty_log *log)
+{
+	size_t i;
+
+	pthread_mutex_lock(&dirty_log_mtx);
+	LIST_REMOVE(log, list);
+	for (i = 0; i < log->npages; i++) {
+		if (!dirty_log_test_and_set(log, i))
+			vm_write_protect_page(log->ctx,
+				log->gpa + (i << DIRTY_LOG_PAGE_SHIFT), false);
+	}
+	pthread_mutex_unlock(&dirty_log_mtx);
+
+	free(log->bitmap);
+	free(log);
+}
+
+size_t
+vm_dirty_log_sync(struct vm_dirty_log *log, uint64_t *bitmap)
+{
+	size_t i, n, dirty = 0;
+	uint64_t word;
+
+	n = roundup2(log->npages, 64) / 64;
+	pthread_mutex_lock(&dirty_log_mtx);
+	for (i = 0; i < n; i++) {
+		word = log->bitmap[i];
+		bitmap[i] = word;
+		log->bitmap[i] = 0;
+		while (word) {
+			vm_write_protect_page(log->ctx, log->gpa +
+				((i * 64 + __builtin_ctzl(word)) << DIRTY_LOG_PAGE_SHIFT),
+				true);
+			word &= word - 1;
+			dirty++;
+		}
+	}
+	pthread_mutex_unlock(&dirty_log_mtx);
+
+	return dirty;
+}
+
+/* a write which trapped while its dirty log was still there */
+static int
+dirty_log_write_ram(struct vmctx *ctx, struct acrn_mmio_request *req)
+{
+	struct vm_memfd_map maps[32];
+	int i, n;
+
+	n = vm_get_memfd_maps(ctx, maps, ARRAY_SIZE(maps));
+	for (i = 0; i < n; i++) {
+		if (req->address >= maps[i].gpa &&
+		    req->address + req->size <= maps[i].gpa + maps[i].size) {
+			memcpy((char *)maps[i].hva + (req->address - maps[i].gpa),
+			       &req->value, req->size);
+			return 0;
+		}
+	}
+	return -ESRCH;
+}
+
+/* a write of the guest to a protected page, -ESRCH if it isn't RAM */
+int
+vm_dirty_log_write(struct vmctx *ctx, struct acrn_mmio_request *req)
+{
+	struct vm_dirty_log *log;
+	uint64_t offset, size;
+	size_t page, last;
+
+	if (req->direction != ACRN_IOREQ_DIR_WRITE || req->size == 0 ||
+	    req->size > sizeof(req->value))
+		return -EINVAL;
+
+	pthread_mutex_lock(&dirty_log_mtx);
+	LIST_FOREACH(log, &dirty_logs, list) {
+		if (log->ctx == ctx && req->address >= log->gpa &&
+		    req->address - log->gpa <
+		    (log->npages << DIRTY_LOG_PAGE_SHIFT))
+			break;
+	}
+	if (log == NULL) {
+		pthread_mutex_unlock(&dirty_log_mtx);
+		return dirty_log_write_ram(ctx, req);
+	}
+
+	offset = req->address - log->gpa;
+	size = MIN(req->size, (log->npages << DIRTY_LOG_PAGE_SHIFT) - offset);
+	memcpy(log->hva + offset, &req->value, size);
+
+	last = (offset + size - 1) >> DIRTY_LOG_PAGE_SHIFT;
+	for (page = offset >> DIRTY_LOG_PAGE_SHIFT; page <= last; page++) {
+		if (!dirty_log_test_and_set(log, page))
+			vm_write_protect_page(ctx,
+				log->gpa + (page << DIRTY_LOG_PAGE_SHIFT), false);
+	}
+	pthread_mutex_unlock(&dirty_log_mtx);
+
+	return 0;
+}
+
 int
 vm_parse_memsize(const char *optarg, size_t *ret_memsize)
 {
@@ -368,6 +789,25 @@ vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	return error;
 }
 
+int
+vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma, int prot)
+{
+	struct acrn_vm_memmap memmap;
+	int error;
+	bzero(&memmap, sizeof(struct acrn_vm_memmap));
+	memmap.type = ACRN_MEMMAP_RAM;
+	memmap.vma_base = vma;
+	memmap.len = len;
+	memmap.user_vm_pa = gpa;
+	memmap.attr = prot;
+	error = ioctl(ctx->fd, ACRN_IOCTL_UNSET_MEMSEG, &memmap);
+	if (error) {
+		pr_err("ACRN_IOCTL_UNSET_MEMSEG ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
 int
 vm_setup_memory(struct vmctx *ctx, size_t memsize)
 {
@@ -516,8 +956,8 @@ vm_suspend(struct vmctx *ctx, enum vm_suspend_how how)
 	return 0;
 }
 
-int
-vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
+static int
+vm_inject_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 {
 	struct acrn_msi_entry msi;
 	int error;
@@ -532,6 +972,123 @@ vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 	return error;
 }
 
+/*
+ * The MSIs a thread raises between vm_msi_batch_begin() and vm_msi_batch_end()
+ * are injected together when the pass ends or the batch is full, in one ioctl
+ * if the HSM supports it. Raised twice in a pass, an MSI is injected once: the
+ * guest couldn't have told the two apart. The MSIs published in the ring
+ * of the VM meanwhile get a single notification.
+ */
+struct msi_batch {
+	struct vmctx *ctx;
+	int depth;
+	bool kick;
+	uint32_t nr;
+	struct acrn_msi_entry msis[ACRN_MSI_BATCH_MAX];
+};
+
+static __thread struct msi_batch msi_batch;
+static bool msi_batch_unsupported;
+
+static int
+vm_msi_batch_flush(struct vmctx *ctx, struct msi_batch *b)
+{
+	struct acrn_msi_batch batch;
+	int32_t results[ACRN_MSI_BATCH_MAX];
+	uint32_t i, nr = b->nr;
+	int error = 0;
+
+	b->nr = 0;
+
+	/* a single MSI gains nothing from the batch */
+	if (!msi_batch_unsupported && nr > 1) {
+		bzero(&batch, sizeof(batch));
+		batch.nr = nr;
+		batch.msis = (uint64_t)b->msis;
+		batch.results = (uint64_t)results;
+
+		error = ioctl(ctx->fd, ACRN_IOCTL_INJECT_MSI_BATCH, &batch);
+		if (error == 0) {
+			for (i = 0; i < nr; i++) {
+				if (results[i] != 0) {
+					pr_err("%s: MSI addr 0x%lx data 0x%lx returned %d\n", __func__,
+						b->msis[i].msi_addr, b->msis[i].msi_data, results[i]);
+					error = -1;
+				}
+			}
+			return error;
+		}
+		if (errno != ENOTTY && errno != EINVAL) {
+			pr_err("ACRN_IOCTL_INJECT_MSI_BATCH ioctl() returned an error: %s\n",
+				errormsg(errno));
+			return error;
+		}
+		pr_info("%s: batched MSIs are not supported, one per MSI\n", __func__);
+		msi_batch_unsupported = true;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (vm_inject_msi(ctx, b->msis[i].msi_addr, b->msis[i].msi_data) != 0)
+			error = -1;
+	}
+
+	return error;
+}
+
+void
+vm_msi_batch_begin(struct vmctx *ctx)
+{
+	if (msi_batch.depth++ == 0)
+		msi_batch.ctx = ctx;
+}
+
+int
+vm_msi_batch_end(struct vmctx *ctx)
+{
+	if (--msi_batch.depth != 0)
+		return 0;
+
+	if (msi_batch.kick) {
+		msi_batch.kick = false;
+		vm_msi_ring_kick(ctx);
+	}
+	if (msi_batch.nr != 0)
+		return vm_msi_batch_flush(ctx, &msi_batch);
+
+	return 0;
+}
+
+int
+vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
+{
+	struct msi_batch *b = &msi_batch;
+	uint32_t i;
+
+	/* with the ring full, the MSI is injected by ioctl */
+	if (ctx->msi_ring != NULL && vm_msi_ring_put(ctx, addr, msg)) {
+		if (b->depth > 0 && b->ctx == ctx)
+			b->kick = true;
+		else
+			vm_msi_ring_kick(ctx);
+		return 0;
+	}
+
+	if (b->depth == 0 || b->ctx != ctx)
+		return vm_inject_msi(ctx, addr, msg);
+
+	for (i = 0; i < b->nr; i++) {
+		if (b->msis[i].msi_addr == addr && b->msis[i].msi_data == msg)
+			return 0;
+	}
+	if (b->nr == ACRN_MSI_BATCH_MAX)
+		(void)vm_msi_batch_flush(ctx, b);
+	b->msis[b->nr].msi_addr = addr;
+	b->msis[b->nr].msi_data = msg;
+	b->nr++;
+
+	return 0;
+}
+
 int
 vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation)
 {
@@ -653,6 +1210,16 @@ vm_remove_hv_vdev(struct vmctx *ctx, struct acrn_vdev *dev)
 	return error;
 }
 
+/*
+ * A hypervisor without the hypercall, or emulating the device itself,
+ * rejects the shadow, the config accesses then keep coming to the DM.
+ */
+int
+vm_set_vdev_cfg_shadow(struct vmctx *ctx, struct acrn_vdev_cfg_shadow *shadow)
+{
+	return ioctl(ctx->fd, ACRN_IOCTL_SET_VDEV_CFG_SHADOW, shadow);
+}
+
 int
 vm_set_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf, uint16_t phys_bdf,
 		       int virt_pin, int phys_pin, bool pic_pin)
@@ -705,6 +1272,41 @@ vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_vcpu_regs *vcpu_regs)
 	return error;
 }
 
+/* state->vcpu_id is the vCPU saved, the VM is paused */
+int
+vm_save_vcpu_state(struct vmctx *ctx, struct acrn_vcpu_state *state)
+{
+	int error;
+	error = ioctl(ctx->fd, ACRN_IOCTL_SAVE_VCPU_STATE, state);
+	if (error) {
+		pr_err("ACRN_IOCTL_SAVE_VCPU_STATE ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
+int
+vm_hotplug_vcpu(struct vmctx *ctx, struct acrn_vcpu_hotplug *hotplug)
+{
+	int error;
+	error = ioctl(ctx->fd, ACRN_IOCTL_HOTPLUG_VCPU, hotplug);
+	if (error) {
+		pr_err("ACRN_IOCTL_HOTPLUG_VCPU ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
+/* Before the VM is started */
+int
+vm_restore_vcpu_state(struct vmctx *ctx, struct acrn_vcpu_state *state)
+{
+	int error;
+	error = ioctl(ctx->fd, ACRN_IOCTL_RESTORE_VCPU_STATE, state);
+	if (error) {
+		pr_err("ACRN_IOCTL_RESTORE_VCPU_STATE ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
 int
 vm_get_cpu_state(struct vmctx *ctx, void *state_buf)
 {
@@ -716,6 +1318,22 @@ vm_get_cpu_state(struct vmctx *ctx, void *state_buf)
 	return error;
 }
 
+/* Samples the RDT counters of this VM in the L3 domain of pcpu_id */
+int
+vm_get_rdt_mon(struct vmctx *ctx, int pcpu_id, struct acrn_rdt_mon *mon)
+{
+	int error;
+
+	bzero(mon, sizeof(*mon));
+	mon->vm_id = (uint16_t)ctx->vmid;
+	mon->pcpu_id = (uint16_t)pcpu_id;
+	error = ioctl(ctx->fd, ACRN_IOCTL_GET_RDT_MON, mon);
+	if (error) {
+		pr_err("ACRN_IOCTL_GET_RDT_MON ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
 int
 vm_intr_monitor(struct vmctx *ctx, void *intr_buf)
 {
@@ -30,25 +30,32 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <liburing.h>
+#include <cjson/cJSON.h>
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_overlay.h"
+#include "block_readahead.h"
 #include "ahci.h"
 #include "dm_string.h"
 #include "log.h"
 #include "iothread.h"
+#include "vmmapi.h"
 
 /*
  * Notes:
@@ -67,6 +74,31 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
+/* the ranges of a batch of discards or write-zeroes */
+#define BLOCKIF_RANGES_MAX	MAX_DISCARD_SEGMENT
+
+/* the KB a merged read or write is at most, by default and at all */
+#define BLOCKIF_MERGE_DEFAULT	128
+#define BLOCKIF_MERGE_MAX	4096
+#define BLOCKIF_MERGE_IOV_MAX	IOV_MAX
+
+/*
+ * The bounce buffers of a queue are kept for reuse in size classes of
+ * 4KB to 128KB, by powers of 2, the larger ones are not.
+ */
+#define BLOCKIF_BOUNCE_MIN_SHIFT	12
+#define BLOCKIF_BOUNCE_CLASSES		6
+#define BLOCKIF_BOUNCE_CACHED		16	/* buffers kept of a class */
+#define BLOCKIF_BOUNCE_ALIGN		4096
+
+/* the KB of the read-ahead window and cache, by default and at most */
+#define BLOCKIF_RA_WINDOW_DEFAULT	256
+#define BLOCKIF_RA_CACHE_DEFAULT	4096
+#define BLOCKIF_RA_CACHE_MAX		(256 * 1024)
+
+/* the latency histogram of a queue: two buckets per power of 2 of ns */
+#define BLOCKIF_LAT_BUCKETS		128
+#define BLOCKIF_IDENT_LEN		32
 
 #define AIO_MODE_THREAD_POOL	0
 #define AIO_MODE_IO_URING	1
@@ -74,6 +106,14 @@
 /* the max number of entries for the io_uring submission/completion queue */
 #define MAX_IO_URING_ENTRIES	256
 
+/* ms the SQPOLL thread spins without submissions before it sleeps */
+#define IO_URING_SQ_THREAD_IDLE	100
+
+/* a fixed buffer is 1GB at most, the guest memory is cut into them */
+#define IO_URING_FIXED_BUF_MAX	(1UL << 30)
+#define IO_URING_FIXED_BUFS	1024
+#define IO_URING_MEM_MAPS	64
+
 /*
  * Debug printf
  */
@@ -85,7 +125,8 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DISCARD
+	BOP_DISCARD,
+	BOP_WRITE_ZEROES
 };
 
 enum blockstat {
@@ -103,6 +144,26 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+
+	/* the contiguous requests merged into this one, and their iovecs */
+	struct blockif_elem *merge_next;
+	struct iovec	    *merge_iov;
+	int		     merge_iovcnt;
+
+	uint64_t	     enq_ns;	/* when it was queued */
+};
+
+/* a range to discard or zero, at an offset of the file */
+struct blockif_range {
+	off_t			start;
+	off_t			len;
+	bool			unmap;	/* a write-zeroes may deallocate it */
+};
+
+struct blockif_bounce_pool {
+	pthread_mutex_t		mtx;
+	void			*bufs[BLOCKIF_BOUNCE_CLASSES][BLOCKIF_BOUNCE_CACHED];
+	int			nr_bufs[BLOCKIF_BOUNCE_CLASSES];
 };
 
 struct blockif_queue {
@@ -119,6 +180,52 @@ struct blockif_queue {
 	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
 
 	int			in_flight;
+
+	/*
+	 * Between blockif_plug() and blockif_unplug() the requests are only
+	 * queued, and plug_kicks counts the kicks held back for them.
+	 */
+	int			plugged;
+	int			plug_kicks;
+
+	/* merge statistics */
+	uint64_t		nr_reqs;	/* reads and writes */
+	uint64_t		nr_merged;	/* of them, merged into another */
+	uint64_t		nr_merges;	/* submissions of merged requests */
+
+	/* the buffers of the misaligned O_DIRECT reads and writes */
+	struct blockif_bounce_pool bounce;
+	uint64_t		nr_bounced;	/* reads and writes bounced */
+	uint64_t		nr_direct;	/* and the ones which weren't */
+
+	/*
+	 * The discards, or write-zeroes, in progress: one batch of them at a
+	 * time, led by ranges_be, which the reads and writes go past. Its
+	 * ranges are sorted and coalesced, ranges_err is its error, and under
+	 * io_uring ranges_pending the ranges not completed yet.
+	 */
+	struct blockif_elem	*ranges_be;
+	struct blockif_range	ranges[BLOCKIF_RANGES_MAX];
+	int			nr_ranges;
+	int			ranges_err;
+	int			ranges_pending;
+	uint64_t		nr_range_reqs;	/* discards and write-zeroes */
+	uint64_t		nr_range_ops;	/* the ranges done for them */
+
+	/* the requests queued or in progress, and their latency */
+	uint32_t		depth;
+	uint32_t		depth_max;
+	uint64_t		nr_done;
+	uint64_t		lat_sum_ns;
+	uint64_t		lat_max_ns;
+	uint32_t		lat_hist[BLOCKIF_LAT_BUCKETS];
+
+	/* io_uring: fires when the throttle lets the submissions go on */
+	int			throttle_fd;
+	bool			throttle_armed;
+	uint64_t		throttle_since;	/* the submissions are held */
+	struct iothread_mevent	throttle_mvt;
+
 	struct io_uring		ring;
 	struct iothread_mevent	iomvt;
 	struct iothread_ctx	*ioctx;
@@ -126,6 +233,25 @@ struct blockif_queue {
 	struct blockif_ctxt	*bc;
 };
 
+/*
+ * The token buckets of a drive, of I/Os and of bytes: an I/O starts when
+ * both have tokens, and takes its tokens then, which may leave them in
+ * debt until they're refilled at the rate, up to the burst.
+ */
+struct blockif_throttle {
+	pthread_mutex_t		mtx;
+	double			iops;
+	double			iops_burst;
+	double			iops_tokens;
+	double			bps;
+	double			bps_burst;
+	double			bps_tokens;
+	uint64_t		last_ns;
+
+	uint64_t		nr_throttled;	/* the I/Os which waited */
+	uint64_t		wait_ns;	/* and how long they did */
+};
+
 struct blockif_ops {
 	int aio_mode;
 
@@ -153,12 +279,26 @@ struct blockif_ctxt {
 	int			max_discard_sectors;
 	int			max_discard_seg;
 	int			discard_sector_alignment;
+	int			canzero;
+	int			max_zero_sectors;
+	int			max_zero_seg;
+	/* io_uring: fallocate() doesn't do the ranges of the drive */
+	bool			ranges_sync;
 	struct blockif_queue	*bqs;
 	int			bq_num;
 
 	int			aio_mode;
 	const struct blockif_ops *ops;
 
+	/* io_uring: the SQ thread polls the submissions on sq_cpu (-1: any) */
+	bool			sqpoll;
+	int			sq_cpu;
+	/* io_uring: the completions are polled, for O_DIRECT on NVMe */
+	bool			iopoll;
+	/* io_uring: the guest memory, registered as the fixed buffers */
+	struct iovec		*fixed_bufs;
+	int			nr_fixed_bufs;
+
 	/* write cache enable */
 	uint8_t			wce;
 
@@ -175,8 +315,28 @@ struct blockif_ctxt {
 	 * It indicates that consecutive requests are executed sequentially.
 	 */
 	uint8_t			bst_block;
+
+	/* bytes contiguous reads or writes are merged up to, 0: no merging */
+	size_t			merge_max;
+
+	/* the fd is the delta of this copy-on-write overlay of a base image */
+	struct blockif_overlay	*overlay;
+
+	/* the read-ahead of the sequential reads, NULL: none */
+	struct blockif_ra	*ra;
+
+	/* the I/O limits, off if neither rate is set */
+	bool			throttle_on;
+	struct blockif_throttle	throttle;
+
+	char			ident[BLOCKIF_IDENT_LEN];
+	LIST_ENTRY(blockif_ctxt) list;
 };
 
+/* the open drives, for their statistics */
+static LIST_HEAD(, blockif_ctxt) blockif_list = LIST_HEAD_INITIALIZER(blockif_list);
+static pthread_mutex_t blockif_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_once_t blockif_once = PTHREAD_ONCE_INIT;
 
 struct blockif_sig_elem {
@@ -191,6 +351,8 @@ struct discard_range {
 	uint32_t num_sectors;
 	uint32_t flags;
 };
+/* a write-zeroes range may be deallocated */
+#define BLOCKIF_RANGE_F_UNMAP	0x1
 
 static struct blockif_sig_elem *blockif_bse_head;
 
@@ -207,6 +369,153 @@ blockif_flush_cache(struct blockif_ctxt *bc)
 	return err;
 }
 
+static uint64_t
+blockif_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int
+blockif_lat_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < 2)
+		return (int)ns;
+	msb = 63 - __builtin_clzll(ns);
+	return msb * 2 + (int)((ns >> (msb - 1)) & 1);
+}
+
+/* the smallest latency of the next bucket */
+static uint64_t
+blockif_lat_bucket_end(int b)
+{
+	int msb;
+
+	b++;
+	if (b < 2)
+		return (uint64_t)b;
+	if (b >= BLOCKIF_LAT_BUCKETS)
+		return UINT64_MAX;
+	msb = b / 2;
+	return (1ULL << msb) | ((uint64_t)(b & 1) << (msb - 1));
+}
+
+static void
+blockif_throttle_refill(struct blockif_throttle *t, uint64_t now)
+{
+	double secs = (now - t->last_ns) / 1e9;
+
+	t->last_ns = now;
+	if (t->iops > 0)
+		t->iops_tokens = MIN(t->iops_burst, t->iops_tokens + secs * t->iops);
+	if (t->bps > 0)
+		t->bps_tokens = MIN(t->bps_burst, t->bps_tokens + secs * t->bps);
+}
+
+/* the ns until the buckets are out of debt; called locked */
+static uint64_t
+blockif_throttle_delay_locked(struct blockif_throttle *t)
+{
+	double secs = 0.0;
+
+	if (t->iops > 0 && t->iops_tokens < 0)
+		secs = -t->iops_tokens / t->iops;
+	if (t->bps > 0 && t->bps_tokens < 0)
+		secs = MAX(secs, -t->bps_tokens / t->bps);
+	return secs > 0.0 ? (uint64_t)(secs * 1e9) + 1 : 0;
+}
+
+static uint64_t
+blockif_throttle_delay(struct blockif_ctxt *bc)
+{
+	struct blockif_throttle *t = &bc->throttle;
+	uint64_t delay;
+
+	pthread_mutex_lock(&t->mtx);
+	blockif_throttle_refill(t, blockif_now_ns());
+	delay = blockif_throttle_delay_locked(t);
+	pthread_mutex_unlock(&t->mtx);
+	return delay;
+}
+
+static void
+blockif_throttle_charge(struct blockif_ctxt *bc, size_t bytes, uint64_t waited)
+{
+	struct blockif_throttle *t = &bc->throttle;
+
+	pthread_mutex_lock(&t->mtx);
+	t->iops_tokens -= 1;
+	t->bps_tokens -= bytes;
+	if (waited) {
+		t->nr_throttled++;
+		t->wait_ns += waited;
+	}
+	pthread_mutex_unlock(&t->mtx);
+}
+
+/* the thread pool: wait for the tokens of a request, and take them */
+static void
+blockif_throttle_wait(struct blockif_ctxt *bc, size_t bytes)
+{
+	struct blockif_throttle *t = &bc->throttle;
+	struct timespec ts;
+	uint64_t delay, waited = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&t->mtx);
+		blockif_throttle_refill(t, blockif_now_ns());
+		delay = blockif_throttle_delay_locked(t);
+		if (delay == 0) {
+			t->iops_tokens -= 1;
+			t->bps_tokens -= bytes;
+			if (waited) {
+				t->nr_throttled++;
+				t->wait_ns += waited;
+			}
+			pthread_mutex_unlock(&t->mtx);
+			return;
+		}
+		pthread_mutex_unlock(&t->mtx);
+
+		ts.tv_sec = delay / 1000000000UL;
+		ts.tv_nsec = delay % 1000000000UL;
+		nanosleep(&ts, NULL);
+		waited += delay;
+	}
+}
+
+static ssize_t
+blockif_preadv(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->overlay)
+		return blockif_overlay_preadv(bc->overlay, iov, iovcnt, offset);
+	return preadv(bc->fd, iov, iovcnt, offset);
+}
+
+static ssize_t
+blockif_pwritev(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->overlay)
+		return blockif_overlay_pwritev(bc->overlay, iov, iovcnt, offset);
+	return pwritev(bc->fd, iov, iovcnt, offset);
+}
+
+/* the chunks of the read-ahead, at offsets of the disk */
+static ssize_t
+blockif_ra_pread(void *arg, void *buf, size_t len, off_t offset)
+{
+	struct blockif_ctxt *bc = arg;
+	struct iovec iov = { buf, len };
+
+	return blockif_preadv(bc, &iov, 1, offset + bc->sub_file_start_lba);
+}
+
 static int
 blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 		enum blockop op)
@@ -223,6 +532,9 @@ blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 	TAILQ_REMOVE(&bq->freeq, be, link);
 	be->req = breq;
 	be->op = op;
+	be->enq_ns = blockif_now_ns();
+	if (++bq->depth > bq->depth_max)
+		bq->depth_max = bq->depth;
 
 	be->status = BST_PEND;
 	if (bq->bc->bst_block == 1) {
@@ -230,6 +542,7 @@ blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 		case BOP_READ:
 		case BOP_WRITE:
 		case BOP_DISCARD:
+		case BOP_WRITE_ZEROES:
 			off = breq->offset;
 			for (i = 0; i < breq->iovcnt; i++)
 				off += breq->iov[i].iov_len;
@@ -257,14 +570,24 @@ blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 	return (be->status == BST_PEND);
 }
 
+static bool
+blockif_is_range_op(enum blockop op)
+{
+	return (op == BOP_DISCARD || op == BOP_WRITE_ZEROES);
+}
+
 static int
 blockif_dequeue(struct blockif_queue *bq, pthread_t t, struct blockif_elem **bep)
 {
 	struct blockif_elem *be;
 
 	TAILQ_FOREACH(be, &bq->pendq, link) {
-		if (be->status == BST_PEND)
-			break;
+		if (be->status != BST_PEND)
+			continue;
+		/* a batch of ranges at a time, blockif_merge_ranges() */
+		if (bq->ranges_be != NULL && blockif_is_range_op(be->op))
+			continue;
+		break;
 	}
 	if (be == NULL)
 		return 0;
@@ -276,15 +599,327 @@ blockif_dequeue(struct blockif_queue *bq, pthread_t t, struct blockif_elem **bep
 	return 1;
 }
 
+static size_t
+blockif_req_len(struct blockif_req *br)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < br->iovcnt; i++)
+		len += br->iov[i].iov_len;
+	return len;
+}
+
+/* the bytes of the requests merged into be */
+static size_t
+blockif_merge_len(struct blockif_elem *be)
+{
+	size_t len = 0;
+
+	for (; be != NULL; be = be->merge_next)
+		len += blockif_req_len(be->req);
+	return len;
+}
+
+/* the bytes the throttle charges to be */
+static size_t
+blockif_throttle_len(struct blockif_elem *be)
+{
+	if (be->op != BOP_READ && be->op != BOP_WRITE)
+		return 0;
+	return blockif_merge_len(be);
+}
+
+static int
+blockif_range_validate(struct blockif_ctxt *bc, enum blockop op, off_t start,
+		off_t size)
+{
+	off_t start_sector = start / DEV_BSIZE;
+	off_t size_sector = size / DEV_BSIZE;
+
+	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
+		return -1;
+
+	if (op == BOP_WRITE_ZEROES)
+		return (size_sector > bc->max_zero_sectors) ? -1 : 0;
+
+	if ((size_sector > bc->max_discard_sectors) ||
+			(bc->discard_sector_alignment &&
+			start_sector % bc->discard_sector_alignment))
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse the ranges of the discard or write-zeroes be into ranges, max of
+ * them at most: the number of them, or -errno.
+ */
+static int
+blockif_parse_ranges(struct blockif_ctxt *bc, struct blockif_elem *be,
+		struct blockif_range *ranges, int max)
+{
+	struct blockif_req *br = be->req;
+	struct discard_range *range;
+	int i, n, max_seg;
+
+	if (be->op == BOP_DISCARD ? !bc->candiscard : !bc->canzero)
+		return -EOPNOTSUPP;
+
+	if (bc->rdonly)
+		return -EROFS;
+
+	if (br->iovcnt != 1) {
+		/* ahci parse discard range to br->offset and br->reside */
+		if (max < 1)
+			return -E2BIG;
+		ranges[0].start = br->offset + bc->sub_file_start_lba;
+		ranges[0].len = br->resid;
+		ranges[0].unmap = true;
+		return 1;
+	}
+
+	/* virtio-blk use iov to transfer the ranges */
+	n = br->iov[0].iov_len / sizeof(*range);
+	range = br->iov[0].iov_base;
+	max_seg = (be->op == BOP_DISCARD) ? bc->max_discard_seg : bc->max_zero_seg;
+	if (n > max_seg) {
+		WPRINTF(("segment > max_discard_seg\n"));
+		return -EINVAL;
+	}
+	if (n > max)
+		return -E2BIG;
+
+	for (i = 0; i < n; i++) {
+		ranges[i].start = range[i].sector * DEV_BSIZE +
+				bc->sub_file_start_lba;
+		ranges[i].len = range[i].num_sectors * DEV_BSIZE;
+		ranges[i].unmap = (be->op == BOP_DISCARD) ||
+				(range[i].flags & BLOCKIF_RANGE_F_UNMAP);
+		if (blockif_range_validate(bc, be->op, ranges[i].start,
+					   ranges[i].len)) {
+			WPRINTF(("range [%ld: %ld] is invalid\n",
+				 ranges[i].start, ranges[i].len));
+			return -EINVAL;
+		}
+	}
+	return n;
+}
+
+static int
+blockif_range_cmp(const void *a, const void *b)
+{
+	const struct blockif_range *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return (ra->start < rb->start) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Take the discards, or write-zeroes, pending in the queue into the batch
+ * which be leads, and coalesce their ranges: the ranges a guest trims one
+ * request after the other go as one. A request whose ranges are invalid,
+ * or don't fit, stays pending, to fail, or go, on its own.
+ */
+static void
+blockif_merge_ranges(struct blockif_queue *bq, struct blockif_elem *be)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_elem *tbe, *next, *tail = be;
+	struct blockif_range *r, *last;
+	int n;
+
+	bq->ranges_be = be;
+	bq->ranges_err = 0;
+	bq->nr_ranges = 0;
+	bq->nr_range_reqs++;
+	n = blockif_parse_ranges(bc, be, bq->ranges, BLOCKIF_RANGES_MAX);
+	if (n < 0) {
+		bq->ranges_err = -n;
+		return;
+	}
+	bq->nr_ranges = n;
+
+	for (tbe = TAILQ_FIRST(&bq->pendq); tbe != NULL; tbe = next) {
+		next = TAILQ_NEXT(tbe, link);
+		if (tbe->op != be->op || tbe->status != BST_PEND)
+			continue;
+		n = blockif_parse_ranges(bc, tbe, bq->ranges + bq->nr_ranges,
+					 BLOCKIF_RANGES_MAX - bq->nr_ranges);
+		if (n < 0)
+			continue;
+		bq->nr_ranges += n;
+		bq->nr_range_reqs++;
+
+		TAILQ_REMOVE(&bq->pendq, tbe, link);
+		tbe->status = BST_BUSY;
+		tbe->tid = be->tid;
+		TAILQ_INSERT_TAIL(&bq->busyq, tbe, link);
+		tail->merge_next = tbe;
+		tail = tbe;
+	}
+
+	if (bq->nr_ranges < 2)
+		return;
+
+	/* the overlapping or adjacent ranges, of the same unmap, as one */
+	qsort(bq->ranges, bq->nr_ranges, sizeof(struct blockif_range),
+	      blockif_range_cmp);
+	last = bq->ranges;
+	for (r = bq->ranges + 1; r < bq->ranges + bq->nr_ranges; r++) {
+		if (r->start <= last->start + last->len && r->unmap == last->unmap) {
+			last->len = MAX(last->len, r->start + r->len - last->start);
+			continue;
+		}
+		*++last = *r;
+	}
+	bq->nr_ranges = last - bq->ranges + 1;
+}
+
+/*
+ * Merge the pending reads or writes which follow be on the disk into it, up
+ * to merge_max bytes, to submit them as a single vectored request. A
+ * follower blocked by bst_block is blocked by the tail of the run, so it
+ * may go with it. The bounced requests keep their own buffer.
+ */
+static void
+blockif_merge(struct blockif_queue *bq, struct blockif_elem *be)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_elem *tbe, *tail = be;
+	struct blockif_req *br = be->req;
+	size_t len;
+	off_t end;
+	int iovcnt, n;
+
+	if (blockif_is_range_op(be->op)) {
+		blockif_merge_ranges(bq, be);
+		return;
+	}
+	if ((be->op != BOP_READ && be->op != BOP_WRITE))
+		return;
+	bq->nr_reqs++;
+	if (bc->merge_max == 0 || br->align_info.need_conversion)
+		return;
+
+	len = blockif_req_len(br);
+	end = br->offset + len;
+	iovcnt = br->iovcnt;
+
+	do {
+		TAILQ_FOREACH(tbe, &bq->pendq, link) {
+			if ((tbe->status == BST_PEND || tbe->status == BST_BLOCK) &&
+			    tbe->op == be->op && tbe->req->offset == end &&
+			    !tbe->req->align_info.need_conversion)
+				break;
+		}
+		if (tbe == NULL ||
+		    len + blockif_req_len(tbe->req) > bc->merge_max ||
+		    iovcnt + tbe->req->iovcnt > BLOCKIF_MERGE_IOV_MAX)
+			break;
+
+		TAILQ_REMOVE(&bq->pendq, tbe, link);
+		tbe->status = BST_BUSY;
+		tbe->tid = be->tid;
+		TAILQ_INSERT_TAIL(&bq->busyq, tbe, link);
+		tail->merge_next = tbe;
+		tail = tbe;
+
+		len += blockif_req_len(tbe->req);
+		end = tbe->req->offset + blockif_req_len(tbe->req);
+		iovcnt += tbe->req->iovcnt;
+		bq->nr_reqs++;
+		bq->nr_merged++;
+	} while (1);
+
+	if (be->merge_next == NULL)
+		return;
+
+	be->merge_iov = malloc(sizeof(struct iovec) * iovcnt);
+	if (be->merge_iov == NULL) {
+		/* submit them one by one again */
+		while ((tbe = be->merge_next) != NULL) {
+			be->merge_next = tbe->merge_next;
+			tbe->merge_next = NULL;
+			TAILQ_REMOVE(&bq->busyq, tbe, link);
+			tbe->status = BST_PEND;
+			TAILQ_INSERT_HEAD(&bq->pendq, tbe, link);
+			bq->nr_reqs--;
+			bq->nr_merged--;
+		}
+		return;
+	}
+
+	n = 0;
+	for (tbe = be; tbe != NULL; tbe = tbe->merge_next) {
+		memcpy(&be->merge_iov[n], tbe->req->iov,
+		       sizeof(struct iovec) * tbe->req->iovcnt);
+		n += tbe->req->iovcnt;
+	}
+	be->merge_iovcnt = n;
+	bq->nr_merges++;
+}
+
+/*
+ * Complete the requests of a merged submission which moved len bytes, or
+ * failed with err: each gets its share of the bytes, a short transfer
+ * fails the requests it didn't reach.
+ */
+static void
+blockif_merge_done(struct blockif_elem *be, ssize_t len, int err)
+{
+	struct blockif_elem *tbe, *next;
+	struct blockif_req *br;
+	size_t req_len;
+
+	for (tbe = be; tbe != NULL; tbe = next) {
+		next = tbe->merge_next;
+		br = tbe->req;
+		req_len = blockif_req_len(br);
+		tbe->status = BST_DONE;
+		if (err == 0 && (size_t)len < req_len) {
+			(*br->callback)(br, EIO);
+			continue;
+		}
+		if (err == 0) {
+			br->resid -= req_len;
+			len -= req_len;
+		}
+		(*br->callback)(br, err);
+	}
+}
+
 static void
 blockif_complete(struct blockif_queue *bq, struct blockif_elem *be)
 {
 	struct blockif_elem *tbe;
+	uint64_t lat;
+
+	while ((tbe = be->merge_next) != NULL) {
+		be->merge_next = tbe->merge_next;
+		tbe->merge_next = NULL;
+		blockif_complete(bq, tbe);
+	}
+	if (be->merge_iov) {
+		free(be->merge_iov);
+		be->merge_iov = NULL;
+		be->merge_iovcnt = 0;
+	}
 
 	if (be->status == BST_DONE || be->status == BST_BUSY)
 		TAILQ_REMOVE(&bq->busyq, be, link);
 	else
 		TAILQ_REMOVE(&bq->pendq, be, link);
+	if (bq->ranges_be == be)
+		bq->ranges_be = NULL;
+
+	lat = blockif_now_ns() - be->enq_ns;
+	bq->depth--;
+	bq->nr_done++;
+	bq->lat_sum_ns += lat;
+	if (lat > bq->lat_max_ns)
+		bq->lat_max_ns = lat;
+	bq->lat_hist[blockif_lat_bucket(lat)]++;
 
 	if (bq->bc->bst_block == 1) {
 		TAILQ_FOREACH(tbe, &bq->pendq, link) {
@@ -298,88 +933,97 @@ blockif_complete(struct blockif_queue *bq, struct blockif_elem *be)
 	TAILQ_INSERT_TAIL(&bq->freeq, be, link);
 }
 
+/* discard or zero a range, synchronously */
 static int
-discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
+blockif_range_sync(struct blockif_ctxt *bc, enum blockop op,
+		struct blockif_range *r)
 {
-	off_t start_sector = start / DEV_BSIZE;
-	off_t size_sector = size / DEV_BSIZE;
+	off_t arg[2] = { r->start, r->len };
+	int mode;
 
-	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
-		return -1;
+	if (bc->isblk) {
+		if (ioctl(bc->fd, (op == BOP_DISCARD) ? BLKDISCARD : BLKZEROOUT, arg))
+			return errno;
+		return 0;
+	}
 
-	if ((size_sector > bc->max_discard_sectors) ||
-			(bc->discard_sector_alignment &&
-			start_sector % bc->discard_sector_alignment))
-		return -1;
-	return 0;
+	/* FALLOC_FL_PUNCH_HOLE:
+	 *	Deallocates space in the byte range starting at offset and
+	 *	continuing for length bytes.  After a successful call,
+	 *	subsequent reads from this range will return zeroes.
+	 * FALLOC_FL_ZERO_RANGE:
+	 *	Zeroes the range, which stays allocated.
+	 * FALLOC_FL_KEEP_SIZE:
+	 *	Do not modify the apparent length of the file.
+	 */
+	mode = (op == BOP_DISCARD || r->unmap) ?
+		FALLOC_FL_PUNCH_HOLE : FALLOC_FL_ZERO_RANGE;
+	if (fallocate(bc->fd, mode | FALLOC_FL_KEEP_SIZE, r->start, r->len) == 0)
+		return 0;
+	/* a hole reads as zeroes too, for the file systems with no ZERO_RANGE */
+	if (errno == EOPNOTSUPP && mode == FALLOC_FL_ZERO_RANGE &&
+	    fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      r->start, r->len) == 0)
+		return 0;
+	return errno;
 }
 
+/* the discards or write-zeroes of the batch of the queue, synchronously */
 static int
-blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+blockif_process_ranges(struct blockif_queue *bq, enum blockop op)
 {
-	int err;
-	struct discard_range *range;
-	int n_range, i, segment;
-	off_t arg[MAX_DISCARD_SEGMENT][2];
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_range *r;
+	int i, err;
 
-	err = 0;
-	n_range = 0;
-	segment = 0;
-	if (!bc->candiscard)
-		return EOPNOTSUPP;
+	if (bq->ranges_err)
+		return bq->ranges_err;
 
-	if (bc->rdonly)
-		return EROFS;
-
-	if (br->iovcnt == 1) {
-		/* virtio-blk use iov to transfer discard range */
-		n_range = br->iov[0].iov_len/sizeof(*range);
-		range = br->iov[0].iov_base;
-		for (i = 0; i < n_range; i++) {
-			arg[i][0] = range[i].sector * DEV_BSIZE +
-					bc->sub_file_start_lba;
-			arg[i][1] = range[i].num_sectors * DEV_BSIZE;
-			segment++;
-			if (segment > bc->max_discard_seg) {
-				WPRINTF(("segment > max_discard_seg\n"));
-				return EINVAL;
-			}
-			if (discard_range_validate(bc, arg[i][0], arg[i][1])) {
-				WPRINTF(("range [%ld: %ld] is invalid\n", arg[i][0], arg[i][1]));
-				return EINVAL;
-			}
-		}
-	} else {
-		/* ahci parse discard range to br->offset and br->reside */
-		arg[0][0] = br->offset + bc->sub_file_start_lba;
-		arg[0][1] = br->resid;
-		segment = 1;
-	}
-	for (i = 0; i < segment; i++) {
-		if (bc->isblk) {
-			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
-		} else {
-			/* FALLOC_FL_PUNCH_HOLE:
-			 *	Deallocates space in the byte range starting at offset and
-			 *	continuing for length bytes.  After a successful call,
-			 *	subsequent reads from this range will return zeroes.
-			 * FALLOC_FL_KEEP_SIZE:
-			 *	Do not modify the apparent length of the file.
-			 */
-			err = fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
-				arg[i][0], arg[i][1]);
-			if (!err)
-				err = fdatasync(bc->fd);
-		}
+	for (i = 0; i < bq->nr_ranges; i++) {
+		r = &bq->ranges[i];
+		err = blockif_range_sync(bc, op, r);
 		if (err) {
-			WPRINTF(("Failed to discard offset=%ld nbytes=%ld err code: %d\n",
-				 arg[i][0], arg[i][1], err));
+			WPRINTF(("Failed to %s offset=%ld nbytes=%ld err code: %d\n",
+				 (op == BOP_DISCARD) ? "discard" : "zero",
+				 r->start, r->len, err));
 			return err;
 		}
 	}
-	br->resid = 0;
+	bq->nr_range_ops += bq->nr_ranges;
 
-	return 0;
+	return bc->isblk ? 0 : blockif_flush_cache(bc);
+}
+
+/* the batch of the queue changed the drive under the read-ahead */
+static void
+blockif_ranges_invalidate(struct blockif_queue *bq)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	int i;
+
+	if (bc->ra == NULL)
+		return;
+	for (i = 0; i < bq->nr_ranges; i++)
+		blockif_ra_invalidate(bc->ra,
+			bq->ranges[i].start - bc->sub_file_start_lba,
+			bq->ranges[i].len);
+}
+
+/* complete the requests of the batch led by be */
+static void
+blockif_ranges_done(struct blockif_elem *be, int err)
+{
+	struct blockif_elem *tbe, *next;
+	struct blockif_req *br;
+
+	for (tbe = be; tbe != NULL; tbe = next) {
+		next = tbe->merge_next;
+		br = tbe->req;
+		tbe->status = BST_DONE;
+		if (err == 0)
+			br->resid = 0;
+		(*br->callback)(br, err);
+	}
 }
 
 static void
@@ -572,46 +1216,104 @@ blockif_init_alignment_info(struct blockif_ctxt *bc, struct blockif_req *br)
 	return;
 }
 
+/*
+ * The class of a bounce buffer of size bytes, or -1 for the ones larger
+ * than the largest class.
+ */
+static int
+blockif_bounce_class(size_t size)
+{
+	int class = 0;
+
+	while ((1UL << (BLOCKIF_BOUNCE_MIN_SHIFT + class)) < size)
+		if (++class == BLOCKIF_BOUNCE_CLASSES)
+			return -1;
+	return class;
+}
+
 /*
  * Use a single bounce_iov to do the aligned READ/WRITE.
  *  - bounce_iov cnt = 1
- *  - bounce_iov.iov_base = return of posix_memalign (aligned to @alignment)
+ *  - bounce_iov.iov_base = a buffer of the queue's pool, or of posix_memalign
+ *    when it's larger than the largest class (aligned to @alignment)
  *  - bounce_iov.len = bounced_size
  *  - Accessing from the offset `aligned_dn_start`
  */
 static int
-blockif_init_bounce_iov(struct blockif_req *br)
+blockif_init_bounce_iov(struct blockif_queue *bq, struct blockif_req *br)
 {
-	int ret = 0;
-	void *bounce_buf = NULL;
+	struct blockif_bounce_pool *pool = &bq->bounce;
 	struct br_align_info *info = &br->align_info;
-
-	ret = posix_memalign(&bounce_buf, info->alignment, info->bounced_size);
-	if (ret != 0) {
-		bounce_buf = NULL;
-		pr_err("%s: posix_memalign fails, error %s \n", __func__, strerror(-ret));
-	} else {
-		info->bounce_iov.iov_base = bounce_buf;
-		info->bounce_iov.iov_len = info->bounced_size;
+	void *bounce_buf = NULL;
+	size_t size = info->bounced_size;
+	uint32_t alignment = info->alignment;
+	int class, ret = 0;
+
+	class = blockif_bounce_class(size);
+	if (class >= 0) {
+		pthread_mutex_lock(&pool->mtx);
+		if (pool->nr_bufs[class] > 0)
+			bounce_buf = pool->bufs[class][--pool->nr_bufs[class]];
+		pthread_mutex_unlock(&pool->mtx);
+
+		/* a new one of the class, which any sector size may reuse */
+		size = 1UL << (BLOCKIF_BOUNCE_MIN_SHIFT + class);
+		if (alignment < BLOCKIF_BOUNCE_ALIGN)
+			alignment = BLOCKIF_BOUNCE_ALIGN;
+	}
+
+	if (bounce_buf == NULL) {
+		ret = posix_memalign(&bounce_buf, alignment, size);
+		if (ret != 0) {
+			pr_err("%s: posix_memalign fails, error %s \n", __func__, strerror(ret));
+			return -ret;
+		}
 	}
 
-	return ret;
+	info->bounce_iov.iov_base = bounce_buf;
+	info->bounce_iov.iov_len = info->bounced_size;
+	return 0;
 }
 
 static void
-blockif_deinit_bounce_iov(struct blockif_req *br)
+blockif_deinit_bounce_iov(struct blockif_queue *bq, struct blockif_req *br)
 {
+	struct blockif_bounce_pool *pool = &bq->bounce;
 	struct br_align_info *info = &br->align_info;
+	int class;
 
 	if (info->bounce_iov.iov_base == NULL) {
-		pr_err("%s: info->bounce_iov.iov_base is NULL %s \n", __func__);
+		pr_err("%s: info->bounce_iov.iov_base is NULL\n", __func__);
 		return;
 	}
 
+	class = blockif_bounce_class(info->bounced_size);
+	if (class >= 0) {
+		pthread_mutex_lock(&pool->mtx);
+		if (pool->nr_bufs[class] < BLOCKIF_BOUNCE_CACHED) {
+			pool->bufs[class][pool->nr_bufs[class]++] =
+				info->bounce_iov.iov_base;
+			info->bounce_iov.iov_base = NULL;
+		}
+		pthread_mutex_unlock(&pool->mtx);
+	}
+
 	free(info->bounce_iov.iov_base);
 	info->bounce_iov.iov_base = NULL;
 }
 
+static void
+blockif_bounce_pool_deinit(struct blockif_queue *bq)
+{
+	struct blockif_bounce_pool *pool = &bq->bounce;
+	int class;
+
+	for (class = 0; class < BLOCKIF_BOUNCE_CLASSES; class++)
+		while (pool->nr_bufs[class] > 0)
+			free(pool->bufs[class][--pool->nr_bufs[class]]);
+	pthread_mutex_destroy(&pool->mtx);
+}
+
 /*
  * For READ access:
  *    1. Do the aligned READ (using `bounce_iov`) from the offset `aligned_dn_start`, with the length `bounced_size`.
@@ -650,26 +1352,16 @@ blockif_complete_bounced_read(struct blockif_req *br)
 /*
  * It is used to read out the head/tail area to construct the bounced data.
  *
- * Allocate an aligned buffer for @b_iov and do an aligned read from @offset (with length @alignment).
+ * Do an aligned read from @offset (with length @alignment) into @area, which is in the bounce_iov.
  * @offset shall be guaranteed to be aligned by caller (either aligned_dn_start or aligned_dn_end).
  */
 static int
-blockif_read_head_or_tail_area(int fd, struct iovec *b_iov, off_t offset, uint32_t alignment)
+blockif_read_head_or_tail_area(int fd, void *area, off_t offset, uint32_t alignment)
 {
 	int ret = 0;
 	int bytes_read;
-	void *area = NULL;
-
-	ret = posix_memalign(&area, alignment, alignment);
-	if (ret != 0) {
-		area = NULL;
-		pr_err("%s: posix_memalign fails, error %s \n", __func__, strerror(-ret));
-		return ret;
-	}
 
-	b_iov->iov_base = area;
-	b_iov->iov_len = alignment;
-	bytes_read = preadv(fd, b_iov, 1, offset);
+	bytes_read = pread(fd, area, alignment, offset);
 
 	if (bytes_read < 0) {
 		pr_err("%s: read fails \n", __func__);
@@ -692,6 +1384,8 @@ blockif_read_head_or_tail_area(int fd, struct iovec *b_iov, off_t offset, uint32
  *             --------------------|---------------
  *             aligned_dn_end      | alignment
  *
+ *             The head and tail areas are read in place, into the bounce_iov.
+ *
  *        (c). Construct the bounced data in bounce_iov
  *             from                | to               | length        | source
  *             --------------------|------------------|---------------|---------------------------------
@@ -706,7 +1400,6 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 	struct iovec *iov = br->iov;
 	struct br_align_info *info = &br->align_info;
 	uint32_t alignment = info->alignment;
-	struct iovec head_iov, tail_iov;
 	uint32_t head = info->head;
 	uint32_t tail = info->tail;
 	int i, done, ret;
@@ -718,9 +1411,6 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 		return -1;
 	}
 
-	memset(&head_iov, 0, sizeof(head_iov));
-	memset(&tail_iov, 0, sizeof(tail_iov));
-
 	/*
 	 * If head is not 0, get data of first alignment area, head_area data (by doing aligned read)
 	 *  from                | length
@@ -728,10 +1418,11 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 	 *  aligned_dn_start    | alignment
 	 */
 	if (head != 0) {
-		ret = blockif_read_head_or_tail_area(bc->fd, &head_iov, info->aligned_dn_start, alignment);
-		if (ret < 0) {
+		ret = blockif_read_head_or_tail_area(bc->fd, info->bounce_iov.iov_base,
+				info->aligned_dn_start, alignment);
+		if (ret != 0) {
 			pr_err("%s: fails to read out the head area \n", __func__);
-			goto end;
+			return -1;
 		}
 	}
 
@@ -740,49 +1431,33 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 	 *  from                | length
 	 *  --------------------|---------------
 	 *  aligned_dn_end      | alignment
+	 * unless it's the head area, already read.
 	 */
-	if (tail != 0) {
-		ret = blockif_read_head_or_tail_area(bc->fd, &tail_iov, info->aligned_dn_end, alignment);
-		if (ret < 0) {
+	if (tail != 0 && (head == 0 || info->aligned_dn_end != info->aligned_dn_start)) {
+		ret = blockif_read_head_or_tail_area(bc->fd,
+				info->bounce_iov.iov_base + info->bounced_size - alignment,
+				info->aligned_dn_end, alignment);
+		if (ret != 0) {
 			pr_err("%s: fails to read out the tail area \n", __func__);
-			goto end;
+			return -1;
 		}
 	}
 
-	done = 0;
 	/*
-	 * Construct the bounced data in bounce_iov
+	 * Construct the bounced data in bounce_iov: the head and tail areas
+	 * are in place, the data specified in org_iov[] goes between them
 	 *  from                | to               | length        | source
 	 *  --------------------|------------------|---------------|---------------------------------
 	 *  aligned_dn_start    | start            | head          | head_area data from block device
 	 *  start               | end              | org_size      | data specified in org_iov[]
 	 *  end                 | end + tail       | tail          | tail_area data from block device
 	 */
-	if (head_iov.iov_base != NULL) {
-		memcpy(info->bounce_iov.iov_base, head_iov.iov_base, head);
-		done += head;
-	}
-
-	/* data specified in org_iov[] */
+	done = head;
 	for (i = 0; i < br->iovcnt; i++) {
 		memcpy(info->bounce_iov.iov_base + done, iov[i].iov_base, iov[i].iov_len);
 		done += iov[i].iov_len;
 	}
 
-	if (tail_iov.iov_base != NULL) {
-		memcpy(info->bounce_iov.iov_base + done, tail_iov.iov_base + alignment - tail, tail);
-		done += tail;
-	}
-
-end:
-	if (head_iov.iov_base != NULL) {
-		free(head_iov.iov_base);
-	}
-
-	if (tail_iov.iov_base != NULL) {
-		free(tail_iov.iov_base);
-	}
-
 	return ret;
 };
 
@@ -792,9 +1467,9 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 	struct blockif_req *br;
 	struct blockif_ctxt *bc;
 	struct br_align_info *info;
-	ssize_t len, iovcnt;
-	struct iovec *iovecs;
-	off_t offset;
+	ssize_t len, iovcnt = 0;
+	struct iovec *iovecs = NULL;
+	off_t offset = 0;
 	int err;
 
 	br = be->req;
@@ -802,12 +1477,34 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 	info = &br->align_info;
 	err = 0;
 
+	/* a read the read-ahead has, which takes no bounce either */
+	if (be->op == BOP_READ && bc->ra &&
+	    blockif_ra_read(bc->ra, be->merge_iov ? be->merge_iov : br->iov,
+			    be->merge_iov ? be->merge_iovcnt : br->iovcnt,
+			    br->offset)) {
+		if (be->merge_iov) {
+			blockif_merge_done(be, blockif_merge_len(be), 0);
+			return;
+		}
+		if (info->need_conversion)
+			blockif_deinit_bounce_iov(bq, br);
+		br->resid -= blockif_req_len(br);
+		be->status = BST_DONE;
+		(*br->callback)(br, 0);
+		return;
+	}
+
 	if ((be->op == BOP_READ) || (be->op == BOP_WRITE)) {
 		if (info->need_conversion) {
 			/* bounce_iov has been initialized in blockif_request */
 			iovecs = &(info->bounce_iov);
 			iovcnt = 1;
 			offset = info->aligned_dn_start;
+		} else if (be->merge_iov) {
+			/* the iovecs of the requests merged by blockif_merge */
+			iovecs = be->merge_iov;
+			iovcnt = be->merge_iovcnt;
+			offset = br->offset + bc->sub_file_start_lba;
 		} else {
 			/* use the original iov if no conversion is required */
 			iovecs = br->iov;
@@ -816,12 +1513,33 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 		}
 	}
 
+	if (be->merge_iov) {
+		if (be->op == BOP_WRITE && bc->rdonly) {
+			blockif_merge_done(be, 0, EROFS);
+			return;
+		}
+		if (be->op == BOP_READ)
+			len = blockif_preadv(bc, iovecs, iovcnt, offset);
+		else {
+			len = blockif_pwritev(bc, iovecs, iovcnt, offset);
+			if (bc->ra)
+				blockif_ra_invalidate(bc->ra, br->offset,
+						      blockif_merge_len(be));
+		}
+		if (len < 0)
+			err = errno;
+		else if (be->op == BOP_WRITE)
+			err = blockif_flush_cache(bc);
+		blockif_merge_done(be, len, err);
+		return;
+	}
+
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, iovecs, iovcnt, offset);
+		len = blockif_preadv(bc, iovecs, iovcnt, offset);
 		if (info->need_conversion) {
 			blockif_complete_bounced_read(br);
-			blockif_deinit_bounce_iov(br);
+			blockif_deinit_bounce_iov(bq, br);
 		}
 
 		if (len < 0)
@@ -835,10 +1553,12 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, iovecs, iovcnt, offset);
+		len = blockif_pwritev(bc, iovecs, iovcnt, offset);
 		if (info->need_conversion) {
-			blockif_deinit_bounce_iov(br);
+			blockif_deinit_bounce_iov(bq, br);
 		}
+		if (bc->ra)
+			blockif_ra_invalidate(bc->ra, br->offset, blockif_req_len(br));
 
 		if (len < 0)
 			err = errno;
@@ -852,8 +1572,11 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 			err = errno;
 		break;
 	case BOP_DISCARD:
-		err = blockif_process_discard(bc, br);
-		break;
+	case BOP_WRITE_ZEROES:
+		err = blockif_process_ranges(bq, be->op);
+		blockif_ranges_invalidate(bq);
+		blockif_ranges_done(be, err);
+		return;
 	default:
 		err = EINVAL;
 		break;
@@ -878,7 +1601,10 @@ blockif_thr(void *arg)
 
 	for (;;) {
 		while (blockif_dequeue(bq, t, &be)) {
+			blockif_merge(bq, be);
 			pthread_mutex_unlock(&bq->mtx);
+			if (bq->bc->throttle_on)
+				blockif_throttle_wait(bq->bc, blockif_throttle_len(be));
 			blockif_proc(bq, be);
 			pthread_mutex_lock(&bq->mtx);
 			blockif_complete(bq, be);
@@ -1032,25 +1758,56 @@ static struct blockif_ops blockif_ops_thread_pool = {
 	.request	= thread_pool_request,
 };
 
-static bool
-is_io_uring_supported_op(enum blockop op)
+static bool
+is_io_uring_supported_op(struct blockif_ctxt *bc, enum blockop op)
+{
+	/* an IOPOLL ring has no fsync */
+	if (op == BOP_FLUSH)
+		return !bc->iopoll;
+	return ((op == BOP_READ) || (op == BOP_WRITE));
+}
+
+/*
+ * The fixed buffer a single iovec is in, -1 if there is none; a bounce
+ * buffer or a request of several iovecs uses the vectored ops.
+ */
+static int
+iou_find_fixed_buf(struct blockif_ctxt *bc, struct iovec *iov)
 {
-	return ((op == BOP_READ) || (op == BOP_WRITE) || (op == BOP_FLUSH));
+	struct iovec *buf;
+	int i;
+
+	for (i = 0; i < bc->nr_fixed_bufs; i++) {
+		buf = &bc->fixed_bufs[i];
+		if ((char *)iov->iov_base >= (char *)buf->iov_base &&
+		    (char *)iov->iov_base + iov->iov_len <=
+		    (char *)buf->iov_base + buf->iov_len)
+			return i;
+	}
+	return -1;
 }
 
+/*
+ * Prepare the SQE of the request: iou_submit() submits the ones of a pass
+ * at once. -1 if there's none available.
+ */
 static int
 iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 {
-	int ret;
 	struct io_uring *ring = &bq->ring;
-	struct io_uring_sqe *sqes = io_uring_get_sqe(ring);
+	struct io_uring_sqe *sqes;
 	struct blockif_req *br = be->req;
 	struct blockif_ctxt *bc = bq->bc;
 	struct br_align_info *info = &br->align_info;
 	struct iovec *iovecs;
 	size_t iovcnt;
 	off_t offset;
+	int buf_idx = -1;
 
+	/* the SQ may be full of the SQEs prepared by this pass, submit them */
+	sqes = io_uring_get_sqe(ring);
+	if (!sqes && io_uring_submit(ring) > 0)
+		sqes = io_uring_get_sqe(ring);
 	if (!sqes) {
 		pr_err("%s: io_uring_get_sqe fails. NO available submission queue entry. \n", __func__);
 		return -1;
@@ -1067,32 +1824,158 @@ iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 			iovecs = br->iov;
 			iovcnt = br->iovcnt;
 			offset = br->offset + bc->sub_file_start_lba;
+			if (be->merge_iov) {
+				iovecs = be->merge_iov;
+				iovcnt = be->merge_iovcnt;
+			} else if (iovcnt == 1)
+				buf_idx = iou_find_fixed_buf(bc, iovecs);
 		}
 	}
 
+	/* the fd is the registered file 0 of the ring */
 	switch (be->op) {
 	case BOP_READ:
-		io_uring_prep_readv(sqes, bc->fd, iovecs, iovcnt, offset);
+		if (buf_idx >= 0)
+			io_uring_prep_read_fixed(sqes, 0, iovecs->iov_base,
+				iovecs->iov_len, offset, buf_idx);
+		else
+			io_uring_prep_readv(sqes, 0, iovecs, iovcnt, offset);
 		break;
 	case BOP_WRITE:
-		io_uring_prep_writev(sqes, bc->fd, iovecs, iovcnt, offset);
+		if (buf_idx >= 0)
+			io_uring_prep_write_fixed(sqes, 0, iovecs->iov_base,
+				iovecs->iov_len, offset, buf_idx);
+		else
+			io_uring_prep_writev(sqes, 0, iovecs, iovcnt, offset);
 		break;
 	case BOP_FLUSH:
-		io_uring_prep_fsync(sqes, bc->fd, IORING_FSYNC_DATASYNC);
+		io_uring_prep_fsync(sqes, 0, IORING_FSYNC_DATASYNC);
 		break;
 	default:
 		/* is_io_uring_supported_op guarantees that this case will not occur */
 		break;
 	}
 
+	io_uring_sqe_set_flags(sqes, IOSQE_FIXED_FILE);
 	io_uring_sqe_set_data(sqes, be);
 	bq->in_flight++;
-	ret = io_uring_submit(ring);
-	if (ret < 0) {
-		pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-ret));
-	}
 
-	return ret;
+	return 0;
+}
+
+/* the fallocate() mode doing a range under io_uring */
+static int
+iou_range_mode(struct blockif_ctxt *bc, enum blockop op, struct blockif_range *r)
+{
+	/* on a block device, a hole is zeroed with the unmap of the device */
+	if (op == BOP_DISCARD || (r->unmap && !bc->isblk))
+		return FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	return FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE;
+}
+
+/*
+ * Prepare the ranges of the batch of the queue as fallocate SQEs, whose
+ * data is the range, completed by iou_range_done(): false if it has to be
+ * done synchronously instead.
+ */
+static bool
+iou_submit_ranges(struct blockif_queue *bq, struct blockif_elem *be)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct io_uring *ring = &bq->ring;
+	struct io_uring_sqe *sqe;
+	struct blockif_range *r;
+	int i;
+
+	/* an IOPOLL ring has no fallocate */
+	if (bc->iopoll || bc->ranges_sync || bq->ranges_err ||
+	    bq->nr_ranges == 0)
+		return false;
+	if (io_uring_sq_space_left(ring) < bq->nr_ranges)
+		io_uring_submit(ring);
+	if (io_uring_sq_space_left(ring) < bq->nr_ranges)
+		return false;
+
+	for (i = 0; i < bq->nr_ranges; i++) {
+		r = &bq->ranges[i];
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_fallocate(sqe, 0, iou_range_mode(bc, be->op, r),
+					r->start, r->len);
+		io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+		io_uring_sqe_set_data(sqe, r);
+		bq->in_flight++;
+	}
+	bq->ranges_pending = bq->nr_ranges;
+	return true;
+}
+
+static bool
+iou_is_range(struct blockif_queue *bq, void *data)
+{
+	return ((struct blockif_range *)data >= bq->ranges &&
+		(struct blockif_range *)data < bq->ranges + BLOCKIF_RANGES_MAX);
+}
+
+/* a range of the batch of the queue is done, and the batch with the last */
+static void
+iou_range_done(struct blockif_queue *bq, struct blockif_range *r, int res)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_elem *be = bq->ranges_be;
+	int err = (res < 0) ? -res : 0;
+
+	/* a kernel or a device fallocate() can't do it for: the ioctls, from now on */
+	if (err == EOPNOTSUPP || err == EINVAL) {
+		bc->ranges_sync = true;
+		err = blockif_range_sync(bc, be->op, r);
+	}
+	if (err) {
+		WPRINTF(("Failed to %s offset=%ld nbytes=%ld err code: %d\n",
+			 (be->op == BOP_DISCARD) ? "discard" : "zero",
+			 r->start, r->len, err));
+		if (bq->ranges_err == 0)
+			bq->ranges_err = err;
+	}
+	if (--bq->ranges_pending > 0)
+		return;
+
+	bq->nr_range_ops += bq->nr_ranges;
+	err = bq->ranges_err;
+	if (err == 0 && !bc->isblk)
+		err = blockif_flush_cache(bc);
+	blockif_ranges_done(be, err);
+	blockif_complete(bq, be);
+}
+
+/*
+ * Whether the throttle holds the submissions back; the timer of the queue
+ * then resumes them.
+ */
+static bool
+iou_throttled(struct blockif_queue *bq)
+{
+	struct itimerspec its;
+	uint64_t delay;
+
+	if (!bq->bc->throttle_on || TAILQ_EMPTY(&bq->pendq))
+		return false;
+
+	delay = blockif_throttle_delay(bq->bc);
+	if (delay == 0)
+		return false;
+
+	if (!bq->throttle_armed) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = delay / 1000000000UL;
+		its.it_value.tv_nsec = delay % 1000000000UL;
+		if (timerfd_settime(bq->throttle_fd, 0, &its, NULL) < 0) {
+			pr_err("%s: timerfd_settime fails, error %s \n", __func__, strerror(errno));
+			return false;
+		}
+		bq->throttle_armed = true;
+		bq->throttle_since = blockif_now_ns();
+	}
+	return true;
 }
 
 static void
@@ -1102,9 +1985,21 @@ iou_submit(struct blockif_queue *bq)
 	struct blockif_elem *be;
 	struct blockif_req *br;
 	struct blockif_ctxt *bc = bq->bc;
-
-	while (blockif_dequeue(bq, 0, &be)) {
-		if (is_io_uring_supported_op(be->op)) {
+	uint64_t waited;
+
+	while (!iou_throttled(bq) && blockif_dequeue(bq, 0, &be)) {
+		blockif_merge(bq, be);
+		if (bc->throttle_on) {
+			waited = 0;
+			if (bq->throttle_since) {
+				waited = blockif_now_ns() - bq->throttle_since;
+				bq->throttle_since = 0;
+			}
+			blockif_throttle_charge(bc, blockif_throttle_len(be), waited);
+		}
+		if (blockif_is_range_op(be->op) && iou_submit_ranges(bq, be))
+			continue;
+		if (is_io_uring_supported_op(bc, be->op)) {
 			err = iou_submit_sqe(bq, be);
 
 			/*
@@ -1116,8 +2011,12 @@ iou_submit(struct blockif_queue *bq)
 			}
 		} else {
 			br = be->req;
-			if (be->op == BOP_DISCARD) {
-				err = blockif_process_discard(bc, br);
+			if (blockif_is_range_op(be->op)) {
+				blockif_ranges_done(be, blockif_process_ranges(bq, be->op));
+				blockif_complete(bq, be);
+				continue;
+			} else if (be->op == BOP_FLUSH) {
+				err = fsync(bc->fd) ? errno : 0;
 			} else {
 				pr_err("%s: op %d is not supported \n", __func__, be->op);
 				err = EINVAL;
@@ -1127,6 +2026,13 @@ iou_submit(struct blockif_queue *bq)
 			blockif_complete(bq, be);
 		}
 	}
+
+	/* the SQEs of the pass, in one system call */
+	if (io_uring_sq_ready(&bq->ring) > 0) {
+		err = io_uring_submit(&bq->ring);
+		if (err < 0)
+			pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-err));
+	}
 	return;
 }
 
@@ -1138,6 +2044,7 @@ iou_process_completions(struct blockif_queue *bq)
 	struct blockif_req *br;
 	struct io_uring *ring = &bq->ring;
 	int err = 0;
+	int res;
 
 	while (io_uring_peek_cqe(ring, &cqes) == 0) {
 		if (!cqes) {
@@ -1146,6 +2053,7 @@ iou_process_completions(struct blockif_queue *bq)
 		}
 
 		be = io_uring_cqe_get_data(cqes);
+		res = cqes->res;
 		bq->in_flight--;
 		io_uring_cqe_seen(ring, cqes);
 		cqes = NULL;
@@ -1154,18 +2062,32 @@ iou_process_completions(struct blockif_queue *bq)
 			break;
 		}
 
+		if (iou_is_range(bq, be)) {
+			iou_range_done(bq, (struct blockif_range *)be, res);
+			continue;
+		}
+
 		br = be->req;
 		if (!br) {
 			pr_err("%s: br is NULL \n", __func__);
 			break;
 		}
 
+		if (be->merge_iov) {
+			err = (res < 0) ? -res : 0;
+			if (err == 0 && be->op == BOP_WRITE)
+				err = blockif_flush_cache(bq->bc);
+			blockif_merge_done(be, res, err);
+			blockif_complete(bq, be);
+			continue;
+		}
+
 		/* when a misaligned request is converted to an aligned one, need to do some post-work */
 		if (br->align_info.need_conversion) {
 			if (be->op == BOP_READ) {
 				blockif_complete_bounced_read(br);
 			}
-			blockif_deinit_bounce_iov(br);
+			blockif_deinit_bounce_iov(bq, br);
 		}
 
 		if (be->op == BOP_WRITE) {
@@ -1228,6 +2150,42 @@ iou_set_iothread(struct blockif_queue *bq)
 	return ret;
 }
 
+static void
+iou_throttle_cb(void *arg)
+{
+	struct blockif_queue *bq = (struct blockif_queue *)arg;
+	uint64_t expirations;
+
+	if (read(bq->throttle_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		pr_err("%s: read fails, error %s \n", __func__, strerror(errno));
+	bq->throttle_armed = false;
+	iou_submit_and_reap(bq);
+}
+
+static int
+iou_set_throttle_timer(struct blockif_queue *bq)
+{
+	int ret;
+
+	bq->throttle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (bq->throttle_fd < 0) {
+		pr_err("%s: timerfd_create fails, error %s \n", __func__, strerror(errno));
+		return -1;
+	}
+
+	bq->throttle_mvt.arg = bq;
+	bq->throttle_mvt.run = iou_throttle_cb;
+	bq->throttle_mvt.fd = bq->throttle_fd;
+	ret = iothread_add(bq->ioctx, bq->throttle_fd, &bq->throttle_mvt);
+	if (ret < 0) {
+		pr_err("%s: iothread_add fails, error %d \n", __func__, ret);
+		close(bq->throttle_fd);
+		bq->throttle_fd = -1;
+	}
+	return ret;
+}
+
 static int
 iou_del_iothread(struct blockif_queue *bq)
 {
@@ -1246,33 +2204,108 @@ iou_init(struct blockif_queue *bq, char *tag __attribute__((unused)))
 {
 	int ret = 0;
 	struct io_uring *ring = &bq->ring;
+	struct blockif_ctxt *bc = bq->bc;
+	struct io_uring_params params;
 
 	/*
 	 * - When Service VM owns more dedicated cores, IORING_SETUP_SQPOLL and IORING_SETUP_IOPOLL, along with NVMe
 	 *   polling mechanism could benefit the performance.
 	 * - When Service VM owns limited cores, the benefit of polling is also limited.
 	 * As in most of the use cases, Service VM does not own much dedicated cores, IORING_SETUP_SQPOLL and
-	 * IORING_SETUP_IOPOLL are not enabled by default.
+	 * IORING_SETUP_IOPOLL are only enabled by the sqpoll and iopoll options.
+	 * The queues of a drive share the SQ thread of its first queue.
 	 */
-	ret = io_uring_queue_init(MAX_IO_URING_ENTRIES, ring, 0);
+	memset(&params, 0, sizeof(params));
+	if (bc->sqpoll) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = IO_URING_SQ_THREAD_IDLE;
+		if (bc->sq_cpu >= 0) {
+			params.flags |= IORING_SETUP_SQ_AFF;
+			params.sq_thread_cpu = bc->sq_cpu;
+		}
+		if (bq != bc->bqs) {
+			params.flags |= IORING_SETUP_ATTACH_WQ;
+			params.wq_fd = bc->bqs[0].ring.ring_fd;
+		}
+	}
+	if (bc->iopoll)
+		params.flags |= IORING_SETUP_IOPOLL;
+
+	ret = io_uring_queue_init_params(MAX_IO_URING_ENTRIES, ring, &params);
 	if (ret < 0) {
 		pr_err("%s: io_uring_queue_init fails, error %d \n", __func__, ret);
-	} else {
-		ret = iou_set_iothread(bq);
-		if (ret < 0) {
-			pr_err("%s: iou_set_iothread fails \n", __func__);
-		}
+		return ret;
+	}
+
+	ret = io_uring_register_files(ring, &bc->fd, 1);
+	if (ret < 0) {
+		pr_err("%s: io_uring_register_files fails, error %d \n", __func__, ret);
+		io_uring_queue_exit(ring);
+		return ret;
+	}
+
+	if (bc->nr_fixed_bufs > 0 &&
+	    io_uring_register_buffers(ring, bc->fixed_bufs, bc->nr_fixed_bufs) < 0) {
+		pr_err("%s: io_uring_register_buffers fails, no fixed buffers \n", __func__);
+		bc->nr_fixed_bufs = 0;
 	}
 
+	ret = iou_set_iothread(bq);
+	if (ret < 0) {
+		pr_err("%s: iou_set_iothread fails \n", __func__);
+		return ret;
+	}
+
+	if (bc->throttle_on)
+		ret = iou_set_throttle_timer(bq);
+
 	return ret;
 }
 
+/*
+ * The guest memory as fixed buffers, one per GB at most of each memory map.
+ * The queues of the drive register the same ones.
+ */
+static int
+iou_setup_fixed_bufs(struct blockif_ctxt *bc, struct vmctx *ctx)
+{
+	struct vm_memfd_map maps[IO_URING_MEM_MAPS];
+	uint64_t off, len;
+	int i, n;
+
+	n = vm_get_memfd_maps(ctx, maps, IO_URING_MEM_MAPS);
+	if (n <= 0)
+		return -1;
+
+	bc->fixed_bufs = calloc(IO_URING_FIXED_BUFS, sizeof(struct iovec));
+	if (!bc->fixed_bufs)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		for (off = 0; off < maps[i].size; off += len) {
+			if (bc->nr_fixed_bufs == IO_URING_FIXED_BUFS)
+				return 0;
+			len = MIN(maps[i].size - off, IO_URING_FIXED_BUF_MAX);
+			bc->fixed_bufs[bc->nr_fixed_bufs].iov_base =
+				(char *)maps[i].hva + off;
+			bc->fixed_bufs[bc->nr_fixed_bufs].iov_len = len;
+			bc->nr_fixed_bufs++;
+		}
+	}
+
+	return 0;
+}
+
 static void
 iou_deinit(struct blockif_queue *bq)
 {
 	struct io_uring *ring = &bq->ring;
 
 	iou_del_iothread(bq);
+	if (bq->throttle_fd >= 0) {
+		iothread_del(bq->ioctx, bq->throttle_fd);
+		close(bq->throttle_fd);
+	}
 	io_uring_queue_exit(ring);
 }
 
@@ -1292,7 +2325,8 @@ static struct blockif_ops blockif_ops_iou = {
 };
 
 struct blockif_ctxt *
-blockif_open(const char *optstr, const char *ident, int queue_num, struct iothreads_info *iothrds_info)
+blockif_open(struct vmctx *ctx, const char *optstr, const char *ident, int queue_num,
+	     struct iothreads_info *iothrds_info)
 {
 	char tag[MAXCOMLEN + 1];
 	char *nopt, *xopts, *cp;
@@ -1301,7 +2335,7 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
 	int fd, i, j, sectsz;
-	int writeback, ro, candiscard, ssopt, pssopt;
+	int writeback, ro, candiscard, canzero, ssopt, pssopt;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -1311,6 +2345,12 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	off_t probe_arg[] = {0, 0};
 	int aio_mode;
 	int bypass_host_cache, open_flag, bst_block;
+	int sqpoll, sq_cpu, iopoll, fixedbufs;
+	int merge_kb;
+	char *base_path;
+	struct blockif_overlay *overlay;
+	int ra_window_kb, ra_cache_kb;
+	int iops, iops_burst, bw_kb, bw_burst_kb;
 
 	pthread_once(&blockif_once, blockif_init);
 
@@ -1329,6 +2369,27 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	/* default mode is thread pool */
 	aio_mode = AIO_MODE_THREAD_POOL;
 
+	/* io_uring polls neither the submissions nor the completions by default */
+	sqpoll = 0;
+	sq_cpu = -1;
+	iopoll = 0;
+	fixedbufs = 0;
+
+	/* the requests are submitted as they come by default */
+	merge_kb = 0;
+
+	/* the file is a raw image, not the delta of an overlay, by default */
+	base_path = NULL;
+	overlay = NULL;
+
+	/* no read-ahead but the one of the page cache by default */
+	ra_window_kb = 0;
+	ra_cache_kb = BLOCKIF_RA_CACHE_DEFAULT;
+
+	/* no I/O limits by default, the bursts are a second of the rates */
+	iops = iops_burst = 0;
+	bw_kb = bw_burst_kb = 0;
+
 	/* writethru is on by default */
 	writeback = 0;
 
@@ -1413,12 +2474,99 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 					goto err;
 				}
 			}
-		} else {
+		} else if (!strncmp(cp, "sqpoll", strlen("sqpoll"))) {
+			/* sqpoll or sqpoll=<cpu> */
+			strsep(&cp, "=");
+			if (cp != NULL && (dm_strtoi(cp, &cp, 10, &sq_cpu) ||
+					*cp != '\0' || sq_cpu < 0))
+				goto err;
+			sqpoll = 1;
+		} else if (!strcmp(cp, "iopoll"))
+			iopoll = 1;
+		else if (!strcmp(cp, "fixedbufs"))
+			fixedbufs = 1;
+		else if (!strncmp(cp, "merge", strlen("merge"))) {
+			/* merge or merge=<KB> */
+			merge_kb = BLOCKIF_MERGE_DEFAULT;
+			strsep(&cp, "=");
+			if (cp != NULL && (dm_strtoi(cp, &cp, 10, &merge_kb) ||
+					*cp != '\0' || merge_kb <= 0 ||
+					merge_kb > BLOCKIF_MERGE_MAX)) {
+				pr_err("merge has to be 1~%d KB\n", BLOCKIF_MERGE_MAX);
+				goto err;
+			}
+		} else if (!strncmp(cp, "base=", strlen("base="))) {
+			/* base=<base image>: the file is its delta */
+			base_path = cp + strlen("base=");
+		} else if (!strncmp(cp, "iops=", strlen("iops="))) {
+			/* iops=<IOPS>[:<burst>] */
+			cp += strlen("iops=");
+			if (dm_strtoi(cp, &cp, 10, &iops) || iops <= 0 ||
+			    (*cp == ':' && (dm_strtoi(cp + 1, &cp, 10, &iops_burst) ||
+					    iops_burst <= 0)) || *cp != '\0') {
+				pr_err("Invalid iops option\n");
+				goto err;
+			}
+		} else if (!strncmp(cp, "bw=", strlen("bw="))) {
+			/* bw=<KB/s>[:<burst KB>] */
+			cp += strlen("bw=");
+			if (dm_strtoi(cp, &cp, 10, &bw_kb) || bw_kb <= 0 ||
+			    (*cp == ':' && (dm_strtoi(cp + 1, &cp, 10, &bw_burst_kb) ||
+					    bw_burst_kb <= 0)) || *cp != '\0') {
+				pr_err("Invalid bw option\n");
+				goto err;
+			}
+		} else if (!strncmp(cp, "ra", strlen("ra")) &&
+				(cp[2] == '\0' || cp[2] == '=')) {
+			/* ra or ra=<window KB>[:<cache KB>] */
+			ra_window_kb = BLOCKIF_RA_WINDOW_DEFAULT;
+			strsep(&cp, "=");
+			if (cp != NULL && (dm_strtoi(cp, &cp, 10, &ra_window_kb) ||
+					(*cp == ':' &&
+					 dm_strtoi(cp + 1, &cp, 10, &ra_cache_kb)) ||
+					*cp != '\0')) {
+				pr_err("Invalid ra option\n");
+				goto err;
+			}
+			if (ra_window_kb <= 0 || ra_cache_kb > BLOCKIF_RA_CACHE_MAX ||
+			    ra_cache_kb < 2 * ra_window_kb) {
+				pr_err("ra: the cache has to be twice the window at "
+				       "least, and %d KB at most\n", BLOCKIF_RA_CACHE_MAX);
+				goto err;
+			}
+		}
+		else {
 			pr_err("Invalid device option \"%s\"\n", cp);
 			goto err;
 		}
 	}
 
+	/*
+	 * The polled completions are only reaped by the SQ thread, the
+	 * iothreads get no event for them, and only O_DIRECT I/O is polled.
+	 */
+	if ((sqpoll || iopoll || fixedbufs) && aio_mode != AIO_MODE_IO_URING) {
+		pr_err("sqpoll, iopoll and fixedbufs are options of aio=io_uring\n");
+		goto err;
+	}
+	if (iopoll && (!sqpoll || !bypass_host_cache)) {
+		pr_err("iopoll needs sqpoll and nocache\n");
+		goto err;
+	}
+
+	/* the clusters of an overlay are mapped by the threads of the pool */
+	/* the read-ahead serves the reads of the threads of the pool */
+	if (ra_window_kb && aio_mode != AIO_MODE_THREAD_POOL) {
+		pr_err("ra needs aio=threads\n");
+		goto err;
+	}
+
+	if (base_path && (aio_mode != AIO_MODE_THREAD_POOL ||
+			bypass_host_cache || sub_file_assign || candiscard)) {
+		pr_err("base needs aio=threads, and no nocache, range or discard\n");
+		goto err;
+	}
+
 	/*
 	 * To support "writeback" and "writethru" mode switch during runtime,
 	 * O_SYNC is not used directly, as O_SYNC flag cannot dynamic change
@@ -1453,8 +2601,17 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	size = sbuf.st_size;
 	sectsz = DEV_BSIZE;
 	psectsz = psectoff = 0;
+	/* even with no discard of the device, BLKZEROOUT writes the zeroes */
+	canzero = candiscard;
 
-	if (S_ISBLK(sbuf.st_mode)) {
+	if (base_path) {
+		/* the disk is the base, with the clusters of the delta */
+		overlay = blockif_overlay_open(fd, base_path, ro);
+		if (overlay == NULL)
+			goto err;
+		size = blockif_overlay_size(overlay);
+		psectsz = sbuf.st_blksize;
+	} else if (S_ISBLK(sbuf.st_mode)) {
 		/* get size */
 		err_code = ioctl(fd, BLKGETSIZE, &sz);
 		if (err_code) {
@@ -1566,9 +2723,17 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 				max_discard_sectors : (size / DEV_BSIZE);
 		bc->max_discard_seg =
 			(max_discard_seg != -1) ? max_discard_seg : 1;
+		bc->max_discard_seg = MIN(bc->max_discard_seg, BLOCKIF_RANGES_MAX);
 		bc->discard_sector_alignment =
 			(discard_sector_alignment != -1) ? discard_sector_alignment : 0;
 	}
+	/* the write-zeroes come with the discards, on a writable drive */
+	bc->canzero = canzero && !ro;
+	if (bc->canzero) {
+		bc->max_zero_sectors = MIN(size / DEV_BSIZE, INT_MAX);
+		bc->max_zero_seg = (max_discard_seg != -1) ?
+			MIN(max_discard_seg, BLOCKIF_RANGES_MAX) : 1;
+	}
 	bc->rdonly = ro;
 	bc->size = size;
 	bc->sectsz = sectsz;
@@ -1577,10 +2742,39 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	bc->wce = writeback;
 	bc->bypass_host_cache = bypass_host_cache;
 	bc->aio_mode = aio_mode;
+	bc->merge_max = (size_t)merge_kb * 1024;
+	bc->overlay = overlay;
+
+	pthread_mutex_init(&bc->throttle.mtx, NULL);
+	if (iops || bw_kb) {
+		bc->throttle_on = true;
+		bc->throttle.iops = iops;
+		bc->throttle.iops_burst = iops_burst ? iops_burst : MAX(iops, 1);
+		bc->throttle.iops_tokens = bc->throttle.iops_burst;
+		bc->throttle.bps = bw_kb * 1024.0;
+		bc->throttle.bps_burst = (bw_burst_kb ? bw_burst_kb : bw_kb) * 1024.0;
+		bc->throttle.bps_tokens = bc->throttle.bps_burst;
+		bc->throttle.last_ns = blockif_now_ns();
+	}
+	snprintf(bc->ident, sizeof(bc->ident), "%s", ident);
+
+	if (ra_window_kb) {
+		if (snprintf(tag, sizeof(tag), "blk-ra-%s", ident) >= sizeof(tag))
+			pr_err("blk read-ahead thread tag too long");
+		bc->ra = blockif_ra_init(tag, size, (size_t)ra_window_kb * 1024,
+				(size_t)ra_cache_kb * 1024, blockif_ra_pread, bc);
+		if (bc->ra == NULL)
+			goto err;
+	}
 
 	if (bc->aio_mode == AIO_MODE_IO_URING) {
 		bc->ops = &blockif_ops_iou;
 		bc->bst_block = 0;
+		bc->sqpoll = sqpoll;
+		bc->sq_cpu = sq_cpu;
+		bc->iopoll = iopoll;
+		if (fixedbufs && iou_setup_fixed_bufs(bc, ctx) < 0)
+			WPRINTF(("no fixed buffers, the guest memory maps are unknown\n"));
 	} else {
 		bc->ops = &blockif_ops_thread_pool;
 		bc->bst_block = bst_block;
@@ -1606,6 +2800,8 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 
 		pthread_mutex_init(&bq->mtx, NULL);
 		pthread_cond_init(&bq->cond, NULL);
+		pthread_mutex_init(&bq->bounce.mtx, NULL);
+		bq->throttle_fd = -1;
 		TAILQ_INIT(&bq->freeq);
 		TAILQ_INIT(&bq->pendq);
 		TAILQ_INIT(&bq->busyq);
@@ -1632,16 +2828,25 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 		nopt = NULL;
 	}
 
+	pthread_mutex_lock(&blockif_list_mtx);
+	LIST_INSERT_HEAD(&blockif_list, bc, list);
+	pthread_mutex_unlock(&blockif_list_mtx);
+
 	return bc;
 err:
 	/* handle failure case: free strdup memory*/
 	if (nopt)
 		free(nopt);
+	if (overlay)
+		blockif_overlay_close(overlay);
 	if (fd >= 0)
 		close(fd);
 	if (bc) {
+		if (bc->ra)
+			blockif_ra_deinit(bc->ra);
 		if (bc->bqs)
 			free(bc->bqs);
+		free(bc->fixed_bufs);
 		free(bc);
 	}
 	return NULL;
@@ -1665,7 +2870,7 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	blockif_init_alignment_info(bc, breq);
 	/* For misaligned READ/WRITE, need a bounce_iov to convert the misaligned request to an aligned one. */
 	if (((op == BOP_READ) || (op == BOP_WRITE)) && (breq->align_info.need_conversion)) {
-		err = blockif_init_bounce_iov(breq);
+		err = blockif_init_bounce_iov(bq, breq);
 		if (err < 0) {
 			return err;
 		}
@@ -1673,6 +2878,7 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		if (op == BOP_WRITE) {
 			err = blockif_init_bounced_write(bc, breq);
 			if (err < 0) {
+				blockif_deinit_bounce_iov(bq, breq);
 				return err;
 			}
 		}
@@ -1686,10 +2892,17 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
+		if ((op == BOP_READ) || (op == BOP_WRITE)) {
+			if (breq->align_info.need_conversion)
+				bq->nr_bounced++;
+			else
+				bq->nr_direct++;
+		}
 		if (blockif_enqueue(bq, breq, op)) {
-			if (bc->ops->request) {
+			if (bq->plugged)
+				bq->plug_kicks++;
+			else if (bc->ops->request)
 				bc->ops->request(bq);
-			}
 		}
 	} else {
 		/*
@@ -1699,6 +2912,9 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * exceeded.
 		 */
 		err = E2BIG;
+		if (((op == BOP_READ) || (op == BOP_WRITE)) &&
+		    breq->align_info.need_conversion)
+			blockif_deinit_bounce_iov(bq, breq);
 	}
 	if (bc->ops->mutex_unlock) {
 		bc->ops->mutex_unlock(&bq->mtx);
@@ -1730,6 +2946,62 @@ blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DISCARD);
 }
 
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	return blockif_request(bc, breq, BOP_WRITE_ZEROES);
+}
+
+/*
+ * Hold back the submission of the requests of the queue: they're queued
+ * until blockif_unplug(), which submits them in one batch, with a single
+ * io_uring_submit() or waking the workers of the pool at once. A worker
+ * still busy may take them before.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+
+	if (qidx >= bc->bq_num)
+		return;
+	bq = bc->bqs + qidx;
+
+	if (bc->ops->mutex_lock)
+		bc->ops->mutex_lock(&bq->mtx);
+	bq->plugged++;
+	if (bc->ops->mutex_unlock)
+		bc->ops->mutex_unlock(&bq->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+	int i, kicks;
+
+	if (qidx >= bc->bq_num)
+		return;
+	bq = bc->bqs + qidx;
+
+	if (bc->ops->mutex_lock)
+		bc->ops->mutex_lock(&bq->mtx);
+	if (bq->plugged > 0 && --bq->plugged == 0 && bq->plug_kicks > 0) {
+		kicks = bq->plug_kicks;
+		bq->plug_kicks = 0;
+
+		/* a worker of the pool per request, a submission of the ring */
+		if (bc->ops->aio_mode == AIO_MODE_IO_URING)
+			kicks = 1;
+		else if (kicks > BLOCKIF_NUMTHR)
+			kicks = BLOCKIF_NUMTHR;
+		for (i = 0; i < kicks && bc->ops->request; i++)
+			bc->ops->request(bq);
+	}
+	if (bc->ops->mutex_unlock)
+		bc->ops->mutex_unlock(&bq->mtx);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -1815,10 +3087,17 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 int
 blockif_close(struct blockif_ctxt *bc)
 {
+	uint64_t nr_reqs = 0, nr_merged = 0, nr_merges = 0;
+	uint64_t nr_bounced = 0, nr_direct = 0;
+	uint64_t nr_range_reqs = 0, nr_range_ops = 0;
 	int j;
 
 	sub_file_unlock(bc);
 
+	pthread_mutex_lock(&blockif_list_mtx);
+	LIST_REMOVE(bc, list);
+	pthread_mutex_unlock(&blockif_list_mtx);
+
 	/*
 	 * Stop the block i/o thread
 	 */
@@ -1833,20 +3112,199 @@ blockif_close(struct blockif_ctxt *bc)
 		if (bc->ops->deinit) {
 			bc->ops->deinit(bq);
 		}
+
+		nr_reqs += bq->nr_reqs;
+		nr_merged += bq->nr_merged;
+		nr_merges += bq->nr_merges;
+		nr_bounced += bq->nr_bounced;
+		nr_direct += bq->nr_direct;
+		nr_range_reqs += bq->nr_range_reqs;
+		nr_range_ops += bq->nr_range_ops;
+		blockif_bounce_pool_deinit(bq);
 	}
 	/* XXX Cancel queued i/o's ??? */
 
+	/* many bounced ones: the guest partitions aren't sector aligned */
+	if (nr_bounced)
+		pr_info("blockif: %lu reads and writes misaligned to the %d "
+			"bytes sectors were bounced, %lu were not\n",
+			nr_bounced, bc->sectsz, nr_direct);
+
+	if (bc->merge_max)
+		pr_info("blockif: %lu reads and writes, %lu of them merged "
+			"into %lu submissions\n", nr_reqs,
+			nr_merged + nr_merges, nr_merges);
+
+	if (nr_range_reqs)
+		pr_info("blockif: %lu discards and write-zeroes, %lu ranges "
+			"done for them\n", nr_range_reqs, nr_range_ops);
+
 	/*
 	 * Release resources
 	 */
+	if (bc->ra)
+		blockif_ra_deinit(bc->ra);
+	if (bc->overlay)
+		blockif_overlay_close(bc->overlay);
 	close(bc->fd);
 	if (bc->bqs)
 		free(bc->bqs);
+	free(bc->fixed_bufs);
+	pthread_mutex_destroy(&bc->throttle.mtx);
 	free(bc);
 
 	return 0;
 }
 
+/*
+ * The latency of the p part of the requests of a histogram, in us: the end
+ * of its bucket, bounded by the longest.
+ */
+static double
+blockif_lat_percentile(const uint64_t *hist, uint64_t count, uint64_t max,
+		double p)
+{
+	uint64_t sum = 0, rank = (uint64_t)(count * p);
+	int b;
+
+	for (b = 0; b < BLOCKIF_LAT_BUCKETS; b++) {
+		sum += hist[b];
+		if (sum > rank)
+			return MIN(blockif_lat_bucket_end(b), max) / 1000.0;
+	}
+	return 0.0;
+}
+
+/*
+ * The JSON report of the drives: their limits, queue depths and the
+ * latency of their requests, from queued to completed.
+ */
+int
+blockif_get_stats(char *buf, size_t len)
+{
+	uint64_t hist[BLOCKIF_LAT_BUCKETS];
+	uint64_t nr_done, lat_sum, lat_max;
+	uint32_t depth, depth_max;
+	struct blockif_ctxt *bc;
+	cJSON *root, *list, *obj;
+	char *out;
+	int i, j, ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	cJSON_AddNumberToObject(root, "ack", 0);
+	list = cJSON_AddArrayToObject(root, "drives");
+
+	pthread_mutex_lock(&blockif_list_mtx);
+	LIST_FOREACH(bc, &blockif_list, list) {
+		if (list == NULL)
+			break;
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+
+		/* the queues' counters are read unlocked, as a snapshot */
+		memset(hist, 0, sizeof(hist));
+		nr_done = lat_sum = lat_max = 0;
+		depth = depth_max = 0;
+		for (i = 0; i < bc->bq_num; i++) {
+			struct blockif_queue *bq = bc->bqs + i;
+
+			for (j = 0; j < BLOCKIF_LAT_BUCKETS; j++)
+				hist[j] += bq->lat_hist[j];
+			nr_done += bq->nr_done;
+			lat_sum += bq->lat_sum_ns;
+			lat_max = MAX(lat_max, bq->lat_max_ns);
+			depth += bq->depth;
+			depth_max += bq->depth_max;
+		}
+
+		cJSON_AddStringToObject(obj, "name", bc->ident);
+		cJSON_AddNumberToObject(obj, "queues", bc->bq_num);
+		cJSON_AddNumberToObject(obj, "depth", depth);
+		cJSON_AddNumberToObject(obj, "depth_max", depth_max);
+		cJSON_AddNumberToObject(obj, "requests", (double)nr_done);
+		cJSON_AddNumberToObject(obj, "avg_us", nr_done ? lat_sum / 1000.0 / nr_done : 0.0);
+		cJSON_AddNumberToObject(obj, "p50_us",
+			blockif_lat_percentile(hist, nr_done, lat_max, 0.5));
+		cJSON_AddNumberToObject(obj, "p99_us",
+			blockif_lat_percentile(hist, nr_done, lat_max, 0.99));
+		cJSON_AddNumberToObject(obj, "p999_us",
+			blockif_lat_percentile(hist, nr_done, lat_max, 0.999));
+		cJSON_AddNumberToObject(obj, "max_us", lat_max / 1000.0);
+		if (bc->throttle_on) {
+			pthread_mutex_lock(&bc->throttle.mtx);
+			cJSON_AddNumberToObject(obj, "iops_limit", bc->throttle.iops);
+			cJSON_AddNumberToObject(obj, "bw_limit_kb", bc->throttle.bps / 1024);
+			cJSON_AddNumberToObject(obj, "throttled", (double)bc->throttle.nr_throttled);
+			cJSON_AddNumberToObject(obj, "throttled_us", bc->throttle.wait_ns / 1000.0);
+			pthread_mutex_unlock(&bc->throttle.mtx);
+		}
+		cJSON_AddItemToArray(list, obj);
+	}
+	pthread_mutex_unlock(&blockif_list_mtx);
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
+}
+
+/*
+ * New limits for a drive started with a throttle, from the monitor: a
+ * negative one is kept, 0 lifts it. The bursts are back to one second of
+ * the rate, and the buckets no fuller than that.
+ */
+int
+blockif_set_throttle(const char *ident, int iops, int bw_kb)
+{
+	struct blockif_throttle *t;
+	struct blockif_ctxt *bc;
+	int ret = -1;
+
+	pthread_mutex_lock(&blockif_list_mtx);
+	LIST_FOREACH(bc, &blockif_list, list) {
+		if (strcmp(bc->ident, ident) != 0)
+			continue;
+		if (!bc->throttle_on) {
+			/* the queues have no throttle timer to wait on */
+			pr_err("%s: %s: not started with iops= or bw=\n",
+			    __func__, ident);
+			break;
+		}
+
+		t = &bc->throttle;
+		pthread_mutex_lock(&t->mtx);
+		blockif_throttle_refill(t, blockif_now_ns());
+		if (iops >= 0) {
+			t->iops = iops;
+			t->iops_burst = MAX(iops, 1);
+			t->iops_tokens = MIN(t->iops_tokens, t->iops_burst);
+		}
+		if (bw_kb >= 0) {
+			t->bps = bw_kb * 1024.0;
+			t->bps_burst = bw_kb * 1024.0;
+			t->bps_tokens = MIN(t->bps_tokens, t->bps_burst);
+		}
+		pr_info("%s: %s: iops %.0f, bw %.0f KB/s\n", __func__, ident,
+		    t->iops, t->bps / 1024);
+		pthread_mutex_unlock(&t->mtx);
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&blockif_list_mtx);
+
+	if (bc == NULL)
+		pr_err("%s: no drive %s\n", __func__, ident);
+	return ret;
+}
+
 /*
  * Return virtual C/H/S values for a given block. Use the algorithm
  * outlined in the VHD specification to calculate values.
@@ -1952,6 +3410,37 @@ blockif_discard_sector_alignment(struct blockif_ctxt *bc)
 	return bc->discard_sector_alignment;
 }
 
+int
+blockif_canzero(struct blockif_ctxt *bc)
+{
+	return bc->canzero;
+}
+
+int
+blockif_max_zero_sectors(struct blockif_ctxt *bc)
+{
+	return bc->max_zero_sectors;
+}
+
+int
+blockif_max_zero_seg(struct blockif_ctxt *bc)
+{
+	return bc->max_zero_seg;
+}
+
+/*
+ * The mevent reaping the io_uring completions of queue qidx on its iothread,
+ * NULL if the queue has none. Submission and completion of a queue assume one
+ * thread, a pooled virtqueue has to be grouped with it.
+ */
+struct iothread_mevent *
+blockif_get_iomvt(struct blockif_ctxt *bc, int qidx)
+{
+	if (bc->aio_mode != AIO_MODE_IO_URING || qidx >= bc->bq_num || bc->bqs[qidx].ioctx == NULL)
+		return NULL;
+	return &bc->bqs[qidx].iomvt;
+}
+
 uint8_t
 blockif_get_wce(struct blockif_ctxt *bc)
 {
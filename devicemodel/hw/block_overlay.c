@@ -0,0 +1,557 @@
+/* Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * The delta file of an overlay is made of clusters:
+ *
+ *  cluster 0		the header
+ *  cluster 1 ...	the L1 table: the delta offsets of the L2 tables
+ *  then		the L2 tables and the data clusters, as they're allocated
+ *
+ * An L2 table is a cluster of the delta offsets of the data clusters, 0 for
+ * the ones which weren't written, read from the base. All the fields are
+ * little endian. The clusters are allocated at the end of the file by the
+ * first write to them: the data cluster is written before the L2 entry
+ * pointing to it, and a new L2 table before the L1 entry, so a crash
+ * leaks an allocation at worst.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_overlay.h"
+#include "log.h"
+
+#define OVERLAY_MAGIC		0x574f4341	/* "ACOW" */
+#define OVERLAY_VERSION		1
+#define OVERLAY_CLUSTER_BITS	16		/* of a new delta: 64KB */
+#define OVERLAY_CLUSTER_BITS_MIN	12
+#define OVERLAY_CLUSTER_BITS_MAX	21
+
+struct overlay_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	cluster_bits;
+	uint32_t	l1_entries;
+	uint64_t	size;		/* of the disk, the one of the base */
+	uint64_t	l1_offset;
+} __attribute__((packed));
+
+struct blockif_overlay {
+	int		fd;		/* the delta */
+	int		base_fd;
+	off_t		size;
+
+	uint32_t	cluster_bits;
+	size_t		cluster_size;
+	uint32_t	l2_bits;	/* of the entries of an L2 table */
+	uint32_t	l1_entries;
+	off_t		l1_offset;
+	uint64_t	*l1;
+	uint64_t	**l2;		/* the L2 tables read so far */
+
+	/* the allocations, the L2 tables read, and the copy on write */
+	pthread_mutex_t	mtx;
+	off_t		end;		/* where the next cluster goes */
+	void		*cow_buf;
+};
+
+static int
+overlay_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			return -1;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int
+overlay_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/* the len bytes at skip of iov, in slice; the number of iovecs is returned */
+static int
+overlay_iov_slice(const struct iovec *iov, int iovcnt, size_t skip, size_t len,
+		struct iovec *slice)
+{
+	int i, n = 0;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		slice[n].iov_base = (char *)iov[i].iov_base + skip;
+		slice[n].iov_len = iov[i].iov_len - skip;
+		if (slice[n].iov_len > len)
+			slice[n].iov_len = len;
+		len -= slice[n].iov_len;
+		skip = 0;
+		n++;
+	}
+	return n;
+}
+
+static void
+overlay_iov_copy(const struct iovec *iov, int iovcnt, size_t skip, size_t len,
+		void *buf)
+{
+	struct iovec slice[IOV_MAX];
+	int i, n;
+
+	n = overlay_iov_slice(iov, iovcnt, skip, len, slice);
+	for (i = 0; i < n; i++) {
+		memcpy(buf, slice[i].iov_base, slice[i].iov_len);
+		buf = (char *)buf + slice[i].iov_len;
+	}
+}
+
+/* the L2 table of l1_idx in *l2, NULL if it has none; called locked */
+static int
+overlay_get_l2(struct blockif_overlay *ov, uint32_t l1_idx, uint64_t **l2)
+{
+	uint64_t *table;
+	size_t i;
+
+	if (ov->l2[l1_idx] != NULL || ov->l1[l1_idx] == 0) {
+		*l2 = ov->l2[l1_idx];
+		return 0;
+	}
+
+	table = malloc(ov->cluster_size);
+	if (table == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (overlay_pread(ov->fd, table, ov->cluster_size, ov->l1[l1_idx]) < 0) {
+		pr_err("overlay: failed to read an L2 table: %s\n", strerror(errno));
+		free(table);
+		return -1;
+	}
+	for (i = 0; i < ov->cluster_size / sizeof(uint64_t); i++)
+		table[i] = le64toh(table[i]);
+
+	ov->l2[l1_idx] = table;
+	*l2 = table;
+	return 0;
+}
+
+/* the delta offset of a cluster, 0 if it's the base's; called locked */
+static int
+overlay_lookup(struct blockif_overlay *ov, uint64_t cluster, uint64_t *offset)
+{
+	uint64_t *l2;
+
+	if (overlay_get_l2(ov, cluster >> ov->l2_bits, &l2) < 0)
+		return -1;
+	*offset = l2 ? l2[cluster & ((1UL << ov->l2_bits) - 1)] : 0;
+	return 0;
+}
+
+/*
+ * Map the len bytes at pos of the disk: the length of the run of them in
+ * the same file, contiguous in it, is returned, and its delta offset in
+ * *offset, 0 if it's in the base.
+ */
+static ssize_t
+overlay_map(struct blockif_overlay *ov, off_t pos, size_t len, uint64_t *offset)
+{
+	uint64_t cluster = pos >> ov->cluster_bits;
+	uint64_t first, next;
+	size_t run;
+
+	pthread_mutex_lock(&ov->mtx);
+	if (overlay_lookup(ov, cluster, &first) < 0)
+		goto fail;
+
+	run = ov->cluster_size - (pos & (ov->cluster_size - 1));
+	while (run < len) {
+		if (overlay_lookup(ov, ++cluster, &next) < 0)
+			goto fail;
+		if ((first == 0) != (next == 0) ||
+		    (first != 0 && next != first +
+		     ((cluster - (pos >> ov->cluster_bits)) << ov->cluster_bits)))
+			break;
+		run += ov->cluster_size;
+	}
+	pthread_mutex_unlock(&ov->mtx);
+
+	*offset = first ? first + (pos & (ov->cluster_size - 1)) : 0;
+	return run < len ? run : len;
+
+fail:
+	pthread_mutex_unlock(&ov->mtx);
+	return -1;
+}
+
+/*
+ * Allocate the cluster of pos, filling it with the len bytes of iov at skip,
+ * and the rest from the base. Called locked.
+ */
+static int
+overlay_cow(struct blockif_overlay *ov, off_t pos, size_t len,
+		const struct iovec *iov, int iovcnt, size_t skip)
+{
+	uint64_t cluster = pos >> ov->cluster_bits;
+	uint32_t l1_idx = cluster >> ov->l2_bits;
+	uint32_t l2_idx = cluster & ((1UL << ov->l2_bits) - 1);
+	off_t start = cluster << ov->cluster_bits;
+	size_t base_len;
+	uint64_t *l2, entry;
+
+	if (overlay_get_l2(ov, l1_idx, &l2) < 0)
+		return -1;
+
+	if (l2 == NULL) {
+		/* a new L2 table, of no data cluster */
+		l2 = calloc(1, ov->cluster_size);
+		if (l2 == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		entry = htole64(ov->end);
+		if (ftruncate(ov->fd, ov->end + ov->cluster_size) < 0 ||
+		    overlay_pwrite(ov->fd, &entry, sizeof(entry),
+				   ov->l1_offset + l1_idx * sizeof(entry)) < 0) {
+			pr_err("overlay: failed to add an L2 table: %s\n",
+			       strerror(errno));
+			free(l2);
+			return -1;
+		}
+		ov->l1[l1_idx] = ov->end;
+		ov->l2[l1_idx] = l2;
+		ov->end += ov->cluster_size;
+	}
+
+	if (len < ov->cluster_size) {
+		base_len = ov->cluster_size;
+		if (start + base_len > ov->size)
+			base_len = ov->size - start;
+		if (overlay_pread(ov->base_fd, ov->cow_buf, base_len, start) < 0)
+			return -1;
+		memset((char *)ov->cow_buf + base_len, 0,
+		       ov->cluster_size - base_len);
+	}
+	overlay_iov_copy(iov, iovcnt, skip, len,
+			 (char *)ov->cow_buf + (pos - start));
+
+	entry = htole64(ov->end);
+	if (overlay_pwrite(ov->fd, ov->cow_buf, ov->cluster_size, ov->end) < 0 ||
+	    overlay_pwrite(ov->fd, &entry, sizeof(entry),
+			   ov->l1[l1_idx] + l2_idx * sizeof(entry)) < 0) {
+		pr_err("overlay: failed to add a cluster: %s\n", strerror(errno));
+		return -1;
+	}
+	l2[l2_idx] = ov->end;
+	ov->end += ov->cluster_size;
+	return 0;
+}
+
+static ssize_t
+overlay_check(struct blockif_overlay *ov, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (iovcnt > IOV_MAX || offset < 0 || offset + len > ov->size) {
+		errno = EINVAL;
+		return -1;
+	}
+	return len;
+}
+
+ssize_t
+blockif_overlay_preadv(struct blockif_overlay *ov, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	struct iovec slice[IOV_MAX];
+	ssize_t len, run, n;
+	size_t done = 0;
+	uint64_t off;
+	int cnt;
+
+	len = overlay_check(ov, iov, iovcnt, offset);
+	if (len < 0)
+		return -1;
+
+	while (done < len) {
+		run = overlay_map(ov, offset + done, len - done, &off);
+		if (run < 0)
+			return -1;
+
+		cnt = overlay_iov_slice(iov, iovcnt, done, run, slice);
+		if (off)
+			n = preadv(ov->fd, slice, cnt, off);
+		else
+			n = preadv(ov->base_fd, slice, cnt, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+ssize_t
+blockif_overlay_pwritev(struct blockif_overlay *ov, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	struct iovec slice[IOV_MAX];
+	ssize_t len, run, n;
+	size_t done = 0;
+	uint64_t off;
+	off_t pos;
+	int cnt;
+
+	len = overlay_check(ov, iov, iovcnt, offset);
+	if (len < 0)
+		return -1;
+
+	while (done < len) {
+		pos = offset + done;
+		run = overlay_map(ov, pos, len - done, &off);
+		if (run < 0)
+			return -1;
+
+		if (off) {
+			cnt = overlay_iov_slice(iov, iovcnt, done, run, slice);
+			n = pwritev(ov->fd, slice, cnt, off);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				if (n == 0)
+					errno = EIO;
+				return -1;
+			}
+			done += n;
+			continue;
+		}
+
+		/* one cluster at a time, unless another write allocated it */
+		if (run > ov->cluster_size - (pos & (ov->cluster_size - 1)))
+			run = ov->cluster_size - (pos & (ov->cluster_size - 1));
+		pthread_mutex_lock(&ov->mtx);
+		if (overlay_lookup(ov, pos >> ov->cluster_bits, &off) == 0 &&
+		    off != 0) {
+			pthread_mutex_unlock(&ov->mtx);
+			continue;
+		}
+		if (overlay_cow(ov, pos, run, iov, iovcnt, done) < 0) {
+			pthread_mutex_unlock(&ov->mtx);
+			return -1;
+		}
+		pthread_mutex_unlock(&ov->mtx);
+		done += run;
+	}
+	return done;
+}
+
+static int
+overlay_format(struct blockif_overlay *ov)
+{
+	struct overlay_header hdr;
+	off_t l2_span;
+
+	ov->cluster_bits = OVERLAY_CLUSTER_BITS;
+	ov->cluster_size = 1UL << ov->cluster_bits;
+	ov->l2_bits = ov->cluster_bits - 3;
+	l2_span = 1L << (ov->cluster_bits + ov->l2_bits);
+	ov->l1_entries = (ov->size + l2_span - 1) / l2_span;
+	ov->l1_offset = ov->cluster_size;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = htole32(OVERLAY_MAGIC);
+	hdr.version = htole32(OVERLAY_VERSION);
+	hdr.cluster_bits = htole32(ov->cluster_bits);
+	hdr.l1_entries = htole32(ov->l1_entries);
+	hdr.size = htole64(ov->size);
+	hdr.l1_offset = htole64(ov->l1_offset);
+
+	/* the L1 table is a hole, of no L2 table */
+	if (ftruncate(ov->fd, ov->l1_offset + ov->l1_entries * sizeof(uint64_t)) < 0 ||
+	    overlay_pwrite(ov->fd, &hdr, sizeof(hdr), 0) < 0 ||
+	    fsync(ov->fd) < 0) {
+		pr_err("overlay: failed to format the delta: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int
+overlay_load(struct blockif_overlay *ov)
+{
+	struct overlay_header hdr;
+
+	if (overlay_pread(ov->fd, &hdr, sizeof(hdr), 0) < 0) {
+		pr_err("overlay: failed to read the header: %s\n", strerror(errno));
+		return -1;
+	}
+	if (le32toh(hdr.magic) != OVERLAY_MAGIC ||
+	    le32toh(hdr.version) != OVERLAY_VERSION) {
+		pr_err("overlay: the delta isn't an overlay\n");
+		return -1;
+	}
+	if (le64toh(hdr.size) != ov->size) {
+		pr_err("overlay: the delta is of a %lu bytes base, not of this "
+		       "one of %ld\n", le64toh(hdr.size), ov->size);
+		return -1;
+	}
+
+	ov->cluster_bits = le32toh(hdr.cluster_bits);
+	ov->l1_entries = le32toh(hdr.l1_entries);
+	ov->l1_offset = le64toh(hdr.l1_offset);
+	if (ov->cluster_bits < OVERLAY_CLUSTER_BITS_MIN ||
+	    ov->cluster_bits > OVERLAY_CLUSTER_BITS_MAX ||
+	    ((off_t)ov->l1_entries << (2 * ov->cluster_bits - 3)) < ov->size) {
+		pr_err("overlay: bad header\n");
+		return -1;
+	}
+	ov->cluster_size = 1UL << ov->cluster_bits;
+	ov->l2_bits = ov->cluster_bits - 3;
+	return 0;
+}
+
+struct blockif_overlay *
+blockif_overlay_open(int fd, const char *base_path, int ro)
+{
+	struct blockif_overlay *ov;
+	struct stat sbuf;
+	uint64_t size;
+	uint32_t i;
+
+	ov = calloc(1, sizeof(struct blockif_overlay));
+	if (ov == NULL)
+		return NULL;
+	ov->fd = fd;
+	ov->base_fd = -1;
+	pthread_mutex_init(&ov->mtx, NULL);
+
+	/* read only, shared by the overlays of the VMs */
+	ov->base_fd = open(base_path, O_RDONLY);
+	if (ov->base_fd < 0 || fstat(ov->base_fd, &sbuf) < 0) {
+		pr_err("overlay: could not open the base %s\n", base_path);
+		goto fail;
+	}
+	if (S_ISBLK(sbuf.st_mode)) {
+		if (ioctl(ov->base_fd, BLKGETSIZE64, &size) < 0) {
+			pr_err("overlay: could not get the size of %s\n", base_path);
+			goto fail;
+		}
+		ov->size = size;
+	} else
+		ov->size = sbuf.st_size;
+	if (ov->size < DEV_BSIZE || (ov->size & (DEV_BSIZE - 1))) {
+		pr_err("overlay: the size of %s should be a multiple of %d\n",
+		       base_path, DEV_BSIZE);
+		goto fail;
+	}
+
+	if (fstat(fd, &sbuf) < 0)
+		goto fail;
+	if (sbuf.st_size == 0) {
+		if (ro) {
+			pr_err("overlay: the delta is empty and read only\n");
+			goto fail;
+		}
+		if (overlay_format(ov) < 0)
+			goto fail;
+		if (fstat(fd, &sbuf) < 0)
+			goto fail;
+	} else if (overlay_load(ov) < 0)
+		goto fail;
+
+	ov->l1 = calloc(ov->l1_entries, sizeof(uint64_t));
+	ov->l2 = calloc(ov->l1_entries, sizeof(uint64_t *));
+	ov->cow_buf = malloc(ov->cluster_size);
+	if (ov->l1 == NULL || ov->l2 == NULL || ov->cow_buf == NULL)
+		goto fail;
+	if (overlay_pread(fd, ov->l1, ov->l1_entries * sizeof(uint64_t),
+			  ov->l1_offset) < 0) {
+		pr_err("overlay: failed to read the L1 table: %s\n", strerror(errno));
+		goto fail;
+	}
+	for (i = 0; i < ov->l1_entries; i++)
+		ov->l1[i] = le64toh(ov->l1[i]);
+
+	ov->end = (sbuf.st_size + ov->cluster_size - 1) & ~(ov->cluster_size - 1);
+	return ov;
+
+fail:
+	blockif_overlay_close(ov);
+	return NULL;
+}
+
+void
+blockif_overlay_close(struct blockif_overlay *ov)
+{
+	uint32_t i;
+
+	if (ov->l2) {
+		for (i = 0; i < ov->l1_entries; i++)
+			free(ov->l2[i]);
+		free(ov->l2);
+	}
+	free(ov->l1);
+	free(ov->cow_buf);
+	if (ov->base_fd >= 0)
+		close(ov->base_fd);
+	pthread_mutex_destroy(&ov->mtx);
+	free(ov);
+}
+
+off_t
+blockif_overlay_size(struct blockif_overlay *ov)
+{
+	return ov->size;
+}
@@ -0,0 +1,377 @@
+/* Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * The cache is direct mapped: chunk n of the drive goes to slot n % slots,
+ * so that the chunks of a window are in different slots. A read continuing
+ * one of the last streams of reads extends it, and from the second read of
+ * a stream on, the chunks of the window after the read are loaded by the
+ * thread of the drive. A write invalidates its chunks once it's done: a
+ * load which began before is then dropped, a load after reads the data of
+ * the write.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_readahead.h"
+#include "log.h"
+
+#define BLOCKIF_RA_STREAMS	4
+#define BLOCKIF_RA_TRIGGER	2	/* sequential reads, to read ahead */
+#define BLOCKIF_RA_ALIGN	4096
+
+enum ra_state {
+	RA_EMPTY,
+	RA_LOADING,
+	RA_VALID
+};
+
+struct ra_slot {
+	enum ra_state	state;
+	uint64_t	chunk;
+	uint64_t	gen;		/* bumped as the slot changes */
+	size_t		len;		/* of the chunk, the last is shorter */
+	bool		queued;
+	bool		used;		/* served a read */
+	void		*buf;
+};
+
+struct ra_stream {
+	off_t		next;		/* where the next read of it starts */
+	int		seq;		/* its sequential reads */
+	uint64_t	last;		/* the tick of the last one */
+};
+
+struct blockif_ra {
+	off_t		size;
+	size_t		window;
+	int		nr_slots;
+	struct ra_slot	*slots;
+	struct ra_stream streams[BLOCKIF_RA_STREAMS];
+	uint64_t	tick;
+
+	/* the slots to load, a ring of nr_slots */
+	int		*queue;
+	int		head;
+	int		count;
+
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	pthread_t	tid;
+	bool		closing;
+
+	blockif_ra_read_fn read;
+	void		*arg;
+
+	uint64_t	nr_reads;
+	uint64_t	nr_hits;
+	uint64_t	nr_loaded;
+	uint64_t	nr_unused;
+};
+
+static void
+ra_evict(struct blockif_ra *ra, struct ra_slot *slot)
+{
+	if (slot->state == RA_VALID && !slot->used)
+		ra->nr_unused++;
+	slot->state = RA_EMPTY;
+	slot->gen++;
+}
+
+/* have the chunk loaded, unless its slot has it already */
+static void
+ra_schedule(struct blockif_ra *ra, uint64_t chunk)
+{
+	int idx = chunk % ra->nr_slots;
+	struct ra_slot *slot = &ra->slots[idx];
+
+	if (slot->state != RA_EMPTY && slot->chunk == chunk)
+		return;
+
+	ra_evict(ra, slot);
+	slot->state = RA_LOADING;
+	slot->chunk = chunk;
+	if (!slot->queued) {
+		slot->queued = true;
+		ra->queue[(ra->head + ra->count) % ra->nr_slots] = idx;
+		ra->count++;
+	}
+}
+
+/* the slot holding all of the len bytes at offset of the chunk, or NULL */
+static struct ra_slot *
+ra_lookup(struct blockif_ra *ra, uint64_t chunk, size_t offset, size_t len)
+{
+	struct ra_slot *slot = &ra->slots[chunk % ra->nr_slots];
+
+	if (slot->state != RA_VALID || slot->chunk != chunk ||
+	    offset + len > slot->len)
+		return NULL;
+	return slot;
+}
+
+/* copy the len bytes at offset of the drive to iov, if they're all cached */
+static bool
+ra_copy(struct blockif_ra *ra, const struct iovec *iov, int iovcnt,
+		off_t offset, size_t len)
+{
+	struct ra_slot *slot;
+	uint64_t chunk;
+	size_t pos, n, done, skip;
+	int i;
+
+	for (pos = 0; pos < len; pos += n) {
+		chunk = (offset + pos) / BLOCKIF_RA_CHUNK;
+		skip = (offset + pos) % BLOCKIF_RA_CHUNK;
+		n = BLOCKIF_RA_CHUNK - skip;
+		if (n > len - pos)
+			n = len - pos;
+		if (ra_lookup(ra, chunk, skip, n) == NULL)
+			return false;
+	}
+
+	i = 0;
+	skip = 0;
+	for (pos = 0; pos < len; pos += n) {
+		chunk = (offset + pos) / BLOCKIF_RA_CHUNK;
+		slot = &ra->slots[chunk % ra->nr_slots];
+		slot->used = true;
+
+		/* the rest of the iovec, bounded by the chunk */
+		n = iov[i].iov_len - skip;
+		done = (offset + pos) % BLOCKIF_RA_CHUNK;
+		if (n > BLOCKIF_RA_CHUNK - done)
+			n = BLOCKIF_RA_CHUNK - done;
+		memcpy((char *)iov[i].iov_base + skip, (char *)slot->buf + done, n);
+		skip += n;
+		if (skip == iov[i].iov_len) {
+			i++;
+			skip = 0;
+		}
+	}
+	return true;
+}
+
+/* the stream the read continues, or the least recent one, given to it */
+static struct ra_stream *
+ra_stream(struct blockif_ra *ra, off_t offset, size_t len)
+{
+	struct ra_stream *stream, *oldest = &ra->streams[0];
+	int i;
+
+	ra->tick++;
+	for (i = 0; i < BLOCKIF_RA_STREAMS; i++) {
+		stream = &ra->streams[i];
+		if (stream->seq > 0 && stream->next == offset) {
+			stream->seq++;
+			goto out;
+		}
+		if (stream->last < oldest->last)
+			oldest = stream;
+	}
+	stream = oldest;
+	stream->seq = 1;
+out:
+	stream->next = offset + len;
+	stream->last = ra->tick;
+	return stream;
+}
+
+bool
+blockif_ra_read(struct blockif_ra *ra, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	struct ra_stream *stream;
+	uint64_t chunk, last;
+	size_t len = 0;
+	off_t end;
+	bool hit;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len == 0)
+		return false;
+
+	pthread_mutex_lock(&ra->mtx);
+	ra->nr_reads++;
+	hit = ra_copy(ra, iov, iovcnt, offset, len);
+	if (hit)
+		ra->nr_hits++;
+
+	stream = ra_stream(ra, offset, len);
+	if (stream->seq >= BLOCKIF_RA_TRIGGER && stream->next < ra->size) {
+		end = stream->next + ra->window;
+		if (end > ra->size)
+			end = ra->size;
+		last = (end - 1) / BLOCKIF_RA_CHUNK;
+		for (chunk = stream->next / BLOCKIF_RA_CHUNK; chunk <= last; chunk++)
+			ra_schedule(ra, chunk);
+		if (ra->count)
+			pthread_cond_signal(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mtx);
+
+	return hit;
+}
+
+void
+blockif_ra_invalidate(struct blockif_ra *ra, off_t offset, size_t len)
+{
+	struct ra_slot *slot;
+	uint64_t chunk, last;
+	int i;
+
+	if (len == 0)
+		return;
+
+	pthread_mutex_lock(&ra->mtx);
+	chunk = offset / BLOCKIF_RA_CHUNK;
+	last = (offset + len - 1) / BLOCKIF_RA_CHUNK;
+	if (last - chunk >= ra->nr_slots) {
+		for (i = 0; i < ra->nr_slots; i++)
+			ra_evict(ra, &ra->slots[i]);
+	} else {
+		for (; chunk <= last; chunk++) {
+			slot = &ra->slots[chunk % ra->nr_slots];
+			if (slot->chunk == chunk)
+				ra_evict(ra, slot);
+		}
+	}
+	pthread_mutex_unlock(&ra->mtx);
+}
+
+static void *
+ra_thread(void *arg)
+{
+	struct blockif_ra *ra = arg;
+	struct ra_slot *slot;
+	uint64_t gen;
+	off_t offset;
+	size_t len;
+	ssize_t n;
+
+	pthread_mutex_lock(&ra->mtx);
+	for (;;) {
+		while (ra->count == 0 && !ra->closing)
+			pthread_cond_wait(&ra->cond, &ra->mtx);
+		if (ra->closing)
+			break;
+
+		slot = &ra->slots[ra->queue[ra->head]];
+		ra->head = (ra->head + 1) % ra->nr_slots;
+		ra->count--;
+		slot->queued = false;
+		if (slot->state != RA_LOADING)
+			continue;
+
+		gen = slot->gen;
+		offset = slot->chunk * BLOCKIF_RA_CHUNK;
+		len = BLOCKIF_RA_CHUNK;
+		if (offset + len > ra->size)
+			len = ra->size - offset;
+		pthread_mutex_unlock(&ra->mtx);
+
+		/* the slot is only read once it's valid, so unlocked */
+		n = ra->read(ra->arg, slot->buf, len, offset);
+
+		pthread_mutex_lock(&ra->mtx);
+		if (slot->gen != gen || slot->state != RA_LOADING)
+			continue;
+		if (n == (ssize_t)len) {
+			slot->state = RA_VALID;
+			slot->len = len;
+			slot->used = false;
+			ra->nr_loaded++;
+		} else
+			slot->state = RA_EMPTY;
+	}
+	pthread_mutex_unlock(&ra->mtx);
+	return NULL;
+}
+
+struct blockif_ra *
+blockif_ra_init(const char *name, off_t size, size_t window, size_t cache_size,
+		blockif_ra_read_fn read, void *arg)
+{
+	struct blockif_ra *ra;
+	int i;
+
+	ra = calloc(1, sizeof(struct blockif_ra));
+	if (ra == NULL)
+		return NULL;
+
+	ra->size = size;
+	ra->window = window;
+	ra->read = read;
+	ra->arg = arg;
+	ra->nr_slots = cache_size / BLOCKIF_RA_CHUNK;
+	ra->slots = calloc(ra->nr_slots, sizeof(struct ra_slot));
+	ra->queue = calloc(ra->nr_slots, sizeof(int));
+	if (ra->slots == NULL || ra->queue == NULL)
+		goto fail;
+	for (i = 0; i < ra->nr_slots; i++) {
+		/* aligned for the O_DIRECT reads */
+		if (posix_memalign(&ra->slots[i].buf, BLOCKIF_RA_ALIGN,
+				   BLOCKIF_RA_CHUNK) != 0) {
+			ra->slots[i].buf = NULL;
+			goto fail;
+		}
+	}
+
+	pthread_mutex_init(&ra->mtx, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	if (pthread_create(&ra->tid, NULL, ra_thread, ra) != 0) {
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->mtx);
+		goto fail;
+	}
+	pthread_setname_np(ra->tid, name);
+	return ra;
+
+fail:
+	pr_err("blockif: failed to set up the read-ahead\n");
+	if (ra->slots) {
+		for (i = 0; i < ra->nr_slots; i++)
+			free(ra->slots[i].buf);
+		free(ra->slots);
+	}
+	free(ra->queue);
+	free(ra);
+	return NULL;
+}
+
+void
+blockif_ra_deinit(struct blockif_ra *ra)
+{
+	int i;
+
+	pthread_mutex_lock(&ra->mtx);
+	ra->closing = true;
+	pthread_cond_signal(&ra->cond);
+	pthread_mutex_unlock(&ra->mtx);
+	pthread_join(ra->tid, NULL);
+
+	for (i = 0; i < ra->nr_slots; i++) {
+		if (ra->slots[i].state == RA_VALID && !ra->slots[i].used)
+			ra->nr_unused++;
+	}
+	pr_info("blockif: read-ahead served %lu of %lu reads, %lu chunks read "
+		"ahead, %lu of them unused\n", ra->nr_hits, ra->nr_reads,
+		ra->nr_loaded, ra->nr_unused);
+
+	for (i = 0; i < ra->nr_slots; i++)
+		free(ra->slots[i].buf);
+	free(ra->slots);
+	free(ra->queue);
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->mtx);
+	free(ra);
+}
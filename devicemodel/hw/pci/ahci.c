@@ -43,6 +43,7 @@
 #include "ahci.h"
 #include "block_if.h"
 #include "ata.h"
+#include "timer.h"
 
 #define	DEF_PORTS	6	/* Intel ICH8 AHCI supports 6 ports */
 #define	MAX_PORTS	32	/* AHCI supports 32 ports */
@@ -102,6 +103,12 @@ enum sata_fis_type {
 #endif
 #define WPRINTF(format, arg...) pr_err(format, ##arg)
 
+/*
+ * The NCQ completions of a port are told in one SDB FIS while others of it
+ * are still in flight, after the last of them or this long after the first.
+ */
+#define	AHCI_SDB_COALESCE_NS	50000
+
 struct ahci_ioreq {
 	struct blockif_req io_req;
 	struct ahci_port *io_pr;
@@ -151,6 +158,12 @@ struct ahci_port {
 	uint32_t sntf;
 	uint32_t fbs;
 
+	/* the NCQ commands completed, which no SDB FIS told yet */
+	uint32_t sdb_done;
+	bool sdb_coalesce;	/* the timer is set up */
+	bool sdb_armed;
+	struct acrn_timer sdb_timer;
+
 	/*
 	 * i/o request info
 	 */
@@ -351,30 +364,76 @@ ahci_write_fis_piosetup(struct ahci_port *p)
 	ahci_write_fis(p, FIS_TYPE_PIOSETUP, fis);
 }
 
+/* the SDB FIS of the NCQ commands completed since the last one */
+static void
+ahci_flush_fis_sdb(struct ahci_port *p)
+{
+	uint8_t fis[8];
+
+	if (p->sdb_done == 0)
+		return;
+
+	memset(fis, 0, sizeof(fis));
+	fis[0] = FIS_TYPE_SETDEVBITS;
+	fis[1] = (1 << 6);
+	fis[2] = p->tfd & 0x77;
+	*(uint32_t *)(fis + 4) = p->sdb_done;
+	p->sdb_done = 0;
+	ahci_write_fis(p, FIS_TYPE_SETDEVBITS, fis);
+}
+
+static void
+ahci_sdb_timer(void *arg, uint64_t nexp)
+{
+	struct ahci_port *p = arg;
+
+	pthread_mutex_lock(&p->ahci_dev->mtx);
+	p->sdb_armed = false;
+	ahci_flush_fis_sdb(p);
+	pthread_mutex_unlock(&p->ahci_dev->mtx);
+}
+
 static void
 ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 {
+	struct itimerspec ts;
 	uint8_t fis[8];
 	uint8_t error;
 
 	error = (tfd >> 8) & 0xff;
 	tfd &= 0x77;
+	p->tfd &= ~0x77;
+	p->tfd |= tfd;
+	if (!(tfd & ATA_S_ERROR)) {
+		p->sact &= ~(1 << slot);
+		p->sdb_done |= (1 << slot);
+
+		/* others in flight: the last of them, or the timer, tells it */
+		if ((p->sact & p->pending) == 0 ||
+		    !p->sdb_coalesce) {
+			ahci_flush_fis_sdb(p);
+		} else if (!p->sdb_armed) {
+			memset(&ts, 0, sizeof(ts));
+			ts.it_value.tv_nsec = AHCI_SDB_COALESCE_NS;
+			if (acrn_timer_settime(&p->sdb_timer, &ts) == 0)
+				p->sdb_armed = true;
+			else
+				ahci_flush_fis_sdb(p);
+		}
+		return;
+	}
+
+	/* the completions before the error are told first */
+	ahci_flush_fis_sdb(p);
 	memset(fis, 0, sizeof(fis));
 	fis[0] = FIS_TYPE_SETDEVBITS;
 	fis[1] = (1 << 6);
 	fis[2] = tfd;
 	fis[3] = error;
-	if (fis[2] & ATA_S_ERROR) {
-		p->err_cfis[0] = slot;
-		p->err_cfis[2] = tfd;
-		p->err_cfis[3] = error;
-		memcpy(&p->err_cfis[4], cfis + 4, 16);
-	} else {
-		*(uint32_t *)(fis + 4) = (1 << slot);
-		p->sact &= ~(1 << slot);
-	}
-	p->tfd &= ~0x77;
-	p->tfd |= tfd;
+	p->err_cfis[0] = slot;
+	p->err_cfis[2] = tfd;
+	p->err_cfis[3] = error;
+	memcpy(&p->err_cfis[4], cfis + 4, 16);
 	ahci_write_fis(p, FIS_TYPE_SETDEVBITS, fis);
 }
 
@@ -457,6 +516,7 @@ ahci_check_stopped(struct ahci_port *p)
 			p->cmd &= ~(AHCI_P_CMD_CR | AHCI_P_CMD_CCS_MASK);
 			p->ci = 0;
 			p->sact = 0;
+			p->sdb_done = 0;
 			p->waitforclear = 0;
 		}
 	}
@@ -513,6 +573,7 @@ ahci_port_reset(struct ahci_port *pr)
 {
 	pr->serr = 0;
 	pr->sact = 0;
+	pr->sdb_done = 0;
 	pr->xfermode = ATA_UDMA6;
 	pr->mult_sectors = 128;
 
@@ -1919,6 +1980,8 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 	     (cfis[13] & 0x1f) == ATA_SFPDMA_DSM))
 		dsm = 1;
 
+	/* the commands it lets be issued go in one batch */
+	blockif_plug(p->bctx, 0);
 	pthread_mutex_lock(&ahci_dev->mtx);
 
 	/*
@@ -1960,6 +2023,7 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 	ahci_handle_port(p);
 out:
 	pthread_mutex_unlock(&ahci_dev->mtx);
+	blockif_unplug(p->bctx, 0);
 	DPRINTF("%s exit\n", __func__);
 }
 
@@ -2206,6 +2270,7 @@ pci_ahci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		int baridx, uint64_t offset, int size, uint64_t value)
 {
 	struct pci_ahci_vdev *ahci_dev = dev->arg;
+	struct blockif_ctxt *bctx = NULL;
 
 	if (baridx != 5) {
 		WPRINTF("%s: baridx=%d not support \n", __func__, baridx);
@@ -2218,6 +2283,15 @@ pci_ahci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		return;
 	}
 
+	/*
+	 * The commands a write of a port issues are submitted in one batch,
+	 * once the lock is dropped, which the completions take.
+	 */
+	if (offset >= AHCI_OFFSET &&
+	    offset < AHCI_OFFSET + ahci_dev->ports * AHCI_STEP)
+		bctx = ahci_dev->port[(offset - AHCI_OFFSET) / AHCI_STEP].bctx;
+	if (bctx)
+		blockif_plug(bctx, 0);
 	pthread_mutex_lock(&ahci_dev->mtx);
 
 	if (offset < AHCI_OFFSET)
@@ -2229,6 +2303,8 @@ pci_ahci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 			offset);
 
 	pthread_mutex_unlock(&ahci_dev->mtx);
+	if (bctx)
+		blockif_unplug(bctx, 0);
 }
 
 static uint64_t
@@ -2405,7 +2481,7 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 		 */
 		snprintf(bident, sizeof(bident), "%02x:%02x:%02x", dev->slot,
 		    dev->func, p);
-		bctxt = blockif_open(opts, bident, 1, NULL);
+		bctxt = blockif_open(ctx, opts, bident, 1, NULL);
 		if (bctxt == NULL) {
 			ahci_dev->ports = p;
 			ret = 1;
@@ -2415,6 +2491,12 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 		ahci_dev->port[p].ahci_dev = ahci_dev;
 		ahci_dev->port[p].port = p;
 		ahci_dev->port[p].atapi = atapi;
+		if (!atapi) {
+			ahci_dev->port[p].sdb_timer.clockid = CLOCK_MONOTONIC;
+			ahci_dev->port[p].sdb_coalesce = (acrn_timer_init(
+				&ahci_dev->port[p].sdb_timer, ahci_sdb_timer,
+				&ahci_dev->port[p]) == 0);
+		}
 
 		/*
 		 * Create an identifier for the backing file.
@@ -2485,6 +2567,8 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 open_fail:
 	if (ret) {
 		for (p = 0; p < ahci_dev->ports; p++) {
+			if (ahci_dev->port[p].sdb_coalesce)
+				acrn_timer_deinit(&ahci_dev->port[p].sdb_timer);
 			if (ahci_dev->port[p].bctx != NULL)
 				blockif_close(ahci_dev->port[p].bctx);
 		}
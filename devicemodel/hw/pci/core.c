@@ -48,6 +48,8 @@
 #include "sw_load.h"
 #include "log.h"
 #include "vdisplay.h"
+#include "launch_timeline.h"
+#include "snapshot.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -507,6 +509,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    port >= pdi->bar[i].addr &&
 		    port + bytes <= pdi->bar[i].addr + pdi->bar[i].size) {
 			offset = port - pdi->bar[i].addr;
+			pthread_mutex_lock(&pdi->io_lock);
 			if (in) {
 				*eax = (*ops->vdev_barread)(ctx, vcpu, pdi, i,
 				                            offset, bytes);
@@ -514,6 +517,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
+			pthread_mutex_unlock(&pdi->io_lock);
 			return 0;
 		}
 	}
@@ -536,6 +540,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	offset = addr - pdi->bar[bidx].addr;
 
+	pthread_mutex_lock(&pdi->io_lock);
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
 			(*ops->vdev_barwrite)(ctx, vcpu, pdi, bidx, offset,
@@ -564,6 +569,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 			*val = bar_value(size, *val);
 		}
 	}
+	pthread_mutex_unlock(&pdi->io_lock);
 
 	return 0;
 }
@@ -605,6 +611,26 @@ pci_emul_alloc_bar(struct pci_vdev *pdi, int idx, enum pcibar_type type,
 	return pci_emul_alloc_pbar(pdi, idx, 0, type, size);
 }
 
+/*
+ * Assign (or deassign) the posted range of the I/O BAR register 'idx' of an
+ * emulated pci device along with its registration.
+ */
+static void
+modify_bar_posted(struct pci_vdev *dev, int idx, int registration)
+{
+	struct pcibar *bar = &dev->bar[idx];
+
+	if (registration) {
+		if ((bar->posted_len != 0) && !bar->posted)
+			bar->posted = (vm_assign_posted_io(dev->vmctx, ACRN_IOREQ_TYPE_PORTIO,
+					bar->addr + bar->posted_off, bar->posted_len) == 0);
+	} else if (bar->posted) {
+		vm_deassign_posted_io(dev->vmctx, ACRN_IOREQ_TYPE_PORTIO,
+				bar->addr + bar->posted_off, bar->posted_len);
+		bar->posted = false;
+	}
+}
+
 /*
  * Register (or unregister) the MMIO or I/O region associated with the BAR
  * register 'idx' of an emulated pci device.
@@ -628,12 +654,16 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		iop.port = dev->bar[idx].addr;
 		iop.size = dev->bar[idx].size;
 		if (registration) {
-			iop.flags = IOPORT_F_INOUT;
+			iop.flags = IOPORT_F_INOUT | IOPORT_F_CONCURRENT;
 			iop.handler = pci_emul_io_handler;
 			iop.arg = dev;
 			error = register_inout(&iop);
-		} else
+			if (error == 0)
+				modify_bar_posted(dev, idx, 1);
+		} else {
+			modify_bar_posted(dev, idx, 0);
 			error = unregister_inout(&iop);
+		}
 		break;
 	case PCIBAR_MEM32:
 	case PCIBAR_MEM64:
@@ -642,7 +672,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		mr.base = dev->bar[idx].addr;
 		mr.size = dev->bar[idx].size;
 		if (registration) {
-			mr.flags = MEM_F_RW;
+			mr.flags = MEM_F_RW | MEM_F_CONCURRENT;
 			mr.handler = pci_emul_mem_handler;
 			mr.arg1 = dev;
 			mr.arg2 = idx;
@@ -692,6 +722,25 @@ memen(struct pci_vdev *dev)
 	return (cmd & PCIM_CMD_MEMEN) != 0;
 }
 
+/*
+ * Let the hypervisor post the guest writes to [off, off + len) of the I/O
+ * BAR 'idx', while the BAR is decoded. Only for registers whose writes the
+ * guest never needs to see completed before its next access to the device,
+ * a len of 0 makes the writes synchronous again.
+ */
+void
+pci_emul_set_bar_posted(struct pci_vdev *dev, int idx, uint64_t off, uint64_t len)
+{
+	if (dev->bar[idx].type != PCIBAR_IO)
+		return;
+
+	modify_bar_posted(dev, idx, 0);
+	dev->bar[idx].posted_off = off;
+	dev->bar[idx].posted_len = len;
+	if (porten(dev))
+		modify_bar_posted(dev, idx, 1);
+}
+
 /*
  * Update the MMIO or I/O address that is decoded by the BAR register.
  *
@@ -924,6 +973,7 @@ pci_emul_free_bar(struct pci_vdev *pdi, int idx)
 		if (enabled)
 			unregister_bar(pdi, idx);
 		pdi->bar[idx].type = PCIBAR_NONE;
+		pdi->bar[idx].posted_len = 0;
 	}
 }
 
@@ -1027,11 +1077,51 @@ pci_emul_finddev(char *name)
 	return NULL;
 }
 
+/*
+ * The config dwords of an emulated device which never change once it is
+ * initialized. The hypervisor answers the guest reads of these itself, so
+ * the enumeration and the drivers probing the IDs don't exit to the DM.
+ */
+static const int pci_cfg_shadow_regs[] = {
+	PCIR_DEVVENDOR,		/* vendor, device */
+	PCIR_REVID,		/* revision, class */
+	PCIR_SUBVEND_0,		/* subsystem vendor, subsystem */
+	PCIR_CAP_PTR,		/* capability pointer */
+};
+
+static void
+pci_emul_set_cfg_shadow(struct vmctx *ctx, struct pci_vdev *dev, bool clear)
+{
+	struct acrn_vdev_cfg_shadow shadow;
+	size_t i;
+
+	/* don't bypass the devices that emulate their own config reads */
+	if (dev->dev_ops->vdev_cfgread != NULL ||
+	    (pci_get_cfgdata8(dev, PCIR_HDRTYPE) & PCIM_HDRTYPE) != PCIM_HDRTYPE_NORMAL)
+		return;
+
+	memset(&shadow, 0, sizeof(shadow));
+	shadow.bdf = PCI_BDF(dev->bus, dev->slot, dev->func);
+	if (clear) {
+		shadow.flags = ACRN_PCI_CFG_SHADOW_CLEAR;
+	} else {
+		shadow.dm_dwords = ~0UL;
+		for (i = 0; i < ARRAY_SIZE(pci_cfg_shadow_regs); i++) {
+			shadow.cfg[pci_cfg_shadow_regs[i] / 4] = pci_get_cfgdata32(dev, pci_cfg_shadow_regs[i]);
+			shadow.dm_dwords &= ~(1UL << (pci_cfg_shadow_regs[i] / 4));
+		}
+	}
+
+	if (vm_set_vdev_cfg_shadow(ctx, &shadow) != 0)
+		pr_dbg("%s: no config shadow for %s\n", __func__, dev->name);
+}
+
 static int
 pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	      int func, struct funcinfo *fi)
 {
 	struct pci_vdev *pdi;
+	uint64_t start_us;
 	int err;
 
 	pdi = calloc(1, sizeof(struct pci_vdev));
@@ -1045,6 +1135,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->slot = slot;
 	pdi->func = func;
 	pthread_mutex_init(&pdi->lintr.lock, NULL);
+	pthread_mutex_init(&pdi->io_lock, NULL);
 	pdi->lintr.pin = 0;
 	pdi->lintr.state = IDLE;
 	pdi->lintr.pirq_pin = 0;
@@ -1063,10 +1154,13 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		fi->fi_param = strdup(fi->fi_param_saved);
 	else
 		fi->fi_param = NULL;
+	start_us = launch_timeline_now();
 	err = (*ops->vdev_init)(ctx, pdi, fi->fi_param);
-	if (err == 0)
+	launch_timeline_add_vdev(ops->class_name, bus, slot, func, start_us, err);
+	if (err == 0) {
 		fi->fi_devi = pdi;
-	else
+		pci_emul_set_cfg_shadow(ctx, pdi, false);
+	} else
 		free(pdi);
 
 	return err;
@@ -1082,6 +1176,7 @@ pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		free(fi->fi_param);
 
 	if (fi->fi_devi) {
+		pci_emul_set_cfg_shadow(ctx, fi->fi_devi, true);
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
 		pci_emul_free_msixcap(fi->fi_devi);
@@ -1633,6 +1728,26 @@ init_pci(struct vmctx *ctx)
 	}
 	lpc_pirq_routed();
 
+	/* the state a warm reset brings the devices back to */
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				memcpy(fi->fi_devi->reset_cfgdata, fi->fi_devi->cfgdata,
+					sizeof(fi->fi_devi->cfgdata));
+				for (i = 0; i <= PCI_BARMAX + 1; i++)
+					fi->fi_devi->reset_bar_addr[i] = fi->fi_devi->bar[i].addr;
+			}
+		}
+	}
+
 	/*
 	 * The guest physical memory map looks like the following:
 	 * [0,              lowmem)         guest system memory
@@ -1773,6 +1888,364 @@ deinit_pci(struct vmctx *ctx)
 	}
 }
 
+/* Is the BAR idx of dev decoded with its command register as it is? */
+static bool
+bar_decoded(struct pci_vdev *dev, int idx)
+{
+	switch (dev->bar[idx].type) {
+	case PCIBAR_IO:
+		return porten(dev);
+	case PCIBAR_MEM32:
+	case PCIBAR_MEM64:
+		return memen(dev);
+	default:
+		return false;
+	}
+}
+
+static void
+pci_emul_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	int i;
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		if (bar_decoded(dev, i))
+			unregister_bar(dev, i);
+	}
+
+	memcpy(dev->cfgdata, dev->reset_cfgdata, sizeof(dev->cfgdata));
+	for (i = 0; i <= PCI_BARMAX + 1; i++)
+		dev->bar[i].addr = dev->reset_bar_addr[i];
+
+	dev->msi.enabled = 0;
+	dev->msi.addr = 0;
+	dev->msi.msg_data = 0;
+	dev->msix.enabled = 0;
+	dev->msix.function_mask = 0;
+	for (i = 0; i < dev->msix.table_count; i++) {
+		dev->msix.table[i].addr = 0;
+		dev->msix.table[i].msg_data = 0;
+		dev->msix.table[i].vector_control = PCIM_MSIX_VCTRL_MASK;
+	}
+
+	(*dev->dev_ops->vdev_reset)(ctx, dev);
+
+	if (dev->lintr.pin > 0)
+		pci_lintr_deassert(dev);
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		if (bar_decoded(dev, i))
+			register_bar(dev, i);
+	}
+}
+
+/*
+ * Is a pass-through device assigned to the guest? Its DMA goes through the
+ * EPT of the guest, the guest RAM can't leave the EPT then.
+ */
+bool
+pci_has_passthrough(void)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	int bus, slot, func;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				if (is_pt_pci(si->si_funcs[func].fi_devi))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Can reset_pci() reset all the devices? The pass-through devices and
+ * those that only know init and deinit can't.
+ */
+bool
+can_reset_pci(void)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	int bus, slot, func;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				if (fi->fi_devi->dev_ops->vdev_reset == NULL) {
+					pr_info("%s: no warm reset for %s\n", __func__, fi->fi_name);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Warm reset of the devices, instead of deinit_pci() and init_pci():
+ * the config space, the BARs and the interrupts of each device are brought
+ * back to their state after init_pci(), the rest of its guest-visible state
+ * by its vdev_reset. The resources allocated and the backends (tap, block
+ * files, vhost, I/O threads) are kept.
+ *
+ * @pre can_reset_pci()
+ */
+void
+reset_pci(struct vmctx *ctx)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	int bus, slot, func;
+
+	pci_irq_reset(ctx);
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				pr_notice("pci reset %s\n", fi->fi_name);
+				pci_emul_reset(ctx, fi->fi_devi);
+			}
+		}
+	}
+}
+
+/* The state the core saves of each device, before that of the device */
+struct pci_snapshot_dev {
+	uint8_t bus, slot, func;
+	uint8_t lintr_asserted;
+	char name[PI_NAMESZ];
+	uint8_t cfgdata[PCI_REGMAX + 1];
+	uint64_t bar_addr[PCI_BARMAX + 2];
+	uint64_t msi_addr;
+	uint64_t msi_msg_data;
+	int32_t msi_enabled;
+	int32_t msix_enabled;
+	int32_t msix_function_mask;
+	int32_t msix_table_count;
+	/* the MSI-X table follows */
+};
+
+/*
+ * Can save_pci() save all the devices? The pass-through devices and those
+ * without a vdev_save and a vdev_restore can't.
+ */
+bool
+can_save_pci(void)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	int bus, slot, func;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				if (fi->fi_devi->dev_ops->vdev_save == NULL ||
+				    fi->fi_devi->dev_ops->vdev_restore == NULL) {
+					pr_info("%s: no snapshot of %s\n", __func__, fi->fi_name);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static int
+pci_emul_save(struct vmctx *ctx, struct pci_vdev *dev, int fd)
+{
+	struct pci_snapshot_dev sd;
+	int i, err;
+
+	memset(&sd, 0, sizeof(sd));
+	sd.bus = dev->bus;
+	sd.slot = dev->slot;
+	sd.func = dev->func;
+	strncpy(sd.name, dev->dev_ops->class_name, sizeof(sd.name) - 1);
+	sd.lintr_asserted = (dev->lintr.state == ASSERTED);
+	memcpy(sd.cfgdata, dev->cfgdata, sizeof(sd.cfgdata));
+	for (i = 0; i <= PCI_BARMAX + 1; i++)
+		sd.bar_addr[i] = dev->bar[i].addr;
+	sd.msi_enabled = dev->msi.enabled;
+	sd.msi_addr = dev->msi.addr;
+	sd.msi_msg_data = dev->msi.msg_data;
+	sd.msix_enabled = dev->msix.enabled;
+	sd.msix_function_mask = dev->msix.function_mask;
+	sd.msix_table_count = dev->msix.table_count;
+
+	err = snapshot_write(fd, &sd, sizeof(sd));
+	if (err == 0 && dev->msix.table_count > 0)
+		err = snapshot_write(fd, dev->msix.table,
+				dev->msix.table_count * sizeof(struct msix_table_entry));
+	if (err == 0)
+		err = (*dev->dev_ops->vdev_save)(ctx, dev, fd);
+
+	return err;
+}
+
+/*
+ * Save the state of the devices to fd, the VM being paused.
+ *
+ * @pre can_save_pci()
+ *
+ * @return 0 on success, -EBUSY if a device has requests in flight still,
+ * another -errno on other errors.
+ */
+int
+save_pci(struct vmctx *ctx, int fd)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	int bus, slot, func, err;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				err = pci_emul_save(ctx, fi->fi_devi, fd);
+				if (err < 0) {
+					if (err != -EBUSY)
+						pr_err("%s: failed to save %s\n", __func__, fi->fi_name);
+					return err;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+pci_emul_restore(struct vmctx *ctx, struct pci_vdev *dev, int fd)
+{
+	struct pci_snapshot_dev sd;
+	int i, err;
+
+	err = snapshot_read(fd, &sd, sizeof(sd));
+	if (err < 0)
+		return err;
+	sd.name[sizeof(sd.name) - 1] = '\0';
+	if (sd.bus != dev->bus || sd.slot != dev->slot || sd.func != dev->func ||
+	    strcmp(sd.name, dev->dev_ops->class_name) != 0 ||
+	    sd.msix_table_count != dev->msix.table_count) {
+		pr_err("%s: %02x:%02x.%x %s of the snapshot isn't the %s of the VM\n",
+			__func__, sd.bus, sd.slot, sd.func, sd.name, dev->dev_ops->class_name);
+		return -EINVAL;
+	}
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		if (bar_decoded(dev, i))
+			unregister_bar(dev, i);
+	}
+
+	memcpy(dev->cfgdata, sd.cfgdata, sizeof(dev->cfgdata));
+	for (i = 0; i <= PCI_BARMAX + 1; i++)
+		dev->bar[i].addr = sd.bar_addr[i];
+	dev->msi.enabled = sd.msi_enabled;
+	dev->msi.addr = sd.msi_addr;
+	dev->msi.msg_data = sd.msi_msg_data;
+	dev->msix.enabled = sd.msix_enabled;
+	dev->msix.function_mask = sd.msix_function_mask;
+	if (dev->msix.table_count > 0)
+		err = snapshot_read(fd, dev->msix.table,
+				dev->msix.table_count * sizeof(struct msix_table_entry));
+	if (err == 0)
+		err = (*dev->dev_ops->vdev_restore)(ctx, dev, fd);
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		if (bar_decoded(dev, i))
+			register_bar(dev, i);
+	}
+
+	if (err == 0 && sd.lintr_asserted && dev->lintr.pin > 0)
+		pci_lintr_assert(dev);
+
+	return err;
+}
+
+/*
+ * Restore the state of the devices saved by save_pci() from fd, after
+ * init_pci() and before the VM runs. The devices are those of the VM the
+ * snapshot was taken of, in the same slots.
+ */
+int
+restore_pci(struct vmctx *ctx, int fd)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	int bus, slot, func, err;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				pr_notice("pci restore %s\n", fi->fi_name);
+				err = pci_emul_restore(ctx, fi->fi_devi, fd);
+				if (err < 0) {
+					pr_err("%s: failed to restore %s\n", __func__, fi->fi_name);
+					return err;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
 static void
 pci_apic_prt_entry(int bus, int slot, int pin, int pirq_pin, int ioapic_irq,
 		   void *arg)
@@ -53,14 +53,39 @@ pci_amd_hostbridge_init(struct vmctx *ctx, struct pci_vdev *pi, char *opts)
 	return 0;
 }
 
+static void
+pci_hostbridge_reset(struct vmctx *ctx, struct pci_vdev *pi)
+{
+	/* the config space restored by the core is all its state */
+}
+
+static int
+pci_hostbridge_save(struct vmctx *ctx, struct pci_vdev *pi, int fd)
+{
+	/* as for the reset, the core saves all its state */
+	return 0;
+}
+
+static int
+pci_hostbridge_restore(struct vmctx *ctx, struct pci_vdev *pi, int fd)
+{
+	return 0;
+}
+
 struct pci_vdev_ops pci_ops_amd_hostbridge = {
 	.class_name	= "amd_hostbridge",
 	.vdev_init	= pci_amd_hostbridge_init,
+	.vdev_reset	= pci_hostbridge_reset,
+	.vdev_save	= pci_hostbridge_save,
+	.vdev_restore	= pci_hostbridge_restore,
 };
 DEFINE_PCI_DEVTYPE(pci_ops_amd_hostbridge);
 
 struct pci_vdev_ops pci_ops_hostbridge = {
 	.class_name	= "hostbridge",
 	.vdev_init	= pci_hostbridge_init,
+	.vdev_reset	= pci_hostbridge_reset,
+	.vdev_save	= pci_hostbridge_save,
+	.vdev_restore	= pci_hostbridge_restore,
 };
 DEFINE_PCI_DEVTYPE(pci_ops_hostbridge);
@@ -55,6 +55,7 @@
 
 static struct pirq {
 	uint8_t	reg;
+	uint8_t	reset_reg;	/* the routing set by pirq_alloc_pin() */
 	int	use_count;
 	int	active_count;
 	pthread_mutex_t lock;
@@ -127,6 +128,7 @@ pci_irq_init(struct vmctx *ctx)
 
 	for (i = 0; i < nitems(pirqs); i++) {
 		pirqs[i].reg = PIRQ_DIS;
+		pirqs[i].reset_reg = PIRQ_DIS;
 		pirqs[i].use_count = 0;
 		pirqs[i].active_count = 0;
 		pthread_mutex_init(&pirqs[i].lock, NULL);
@@ -144,6 +146,16 @@ void pci_irq_deinit(struct vmctx *ctx)
 	pirq_cold = 1;
 }
 
+/* Route the PIRQ pins as after the init of the devices, on a warm reset */
+void
+pci_irq_reset(struct vmctx *ctx)
+{
+	int pin;
+
+	for (pin = 1; pin <= nitems(pirqs); pin++)
+		pirq_write(ctx, pin, pirqs[pin - 1].reset_reg);
+}
+
 void
 pci_irq_assert(struct pci_vdev *dev)
 {
@@ -191,6 +203,7 @@ pirq_alloc_pin(struct pci_vdev *dev)
 
 		irq_counts[best_irq]++;
 		pirqs[best_pin].reg = best_irq;
+		pirqs[best_pin].reset_reg = best_irq;
 	}
 
 	return (best_pin + 1);
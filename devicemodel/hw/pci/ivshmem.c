@@ -76,6 +76,7 @@ struct pci_ivshmem_vdev {
 	int		fd;
 	void		*addr;
 	uint32_t	size;
+	uint64_t	bar_addr;
 	bool		is_hv_land;
 };
 
@@ -135,6 +136,11 @@ create_ivshmem_from_dm(struct vmctx *ctx, struct pci_vdev *vdev,
 	ivshmem_vdev->fd = fd;
 	ivshmem_vdev->addr = addr;
 	ivshmem_vdev->size = size;
+	ivshmem_vdev->bar_addr = bar_addr;
+
+	/* for the vhost backends to reach the shared memory */
+	if (vm_add_ram_map(ctx, bar_addr, size, addr, fd, 0) < 0)
+		pr_warn("shared memory not mapped to the vhost backends\n");
 	return 0;
 err:
 	if (addr)
@@ -346,10 +352,12 @@ err:
 }
 
 static void
-destroy_ivshmem_from_dm(struct pci_ivshmem_vdev *vdev)
+destroy_ivshmem_from_dm(struct vmctx *ctx, struct pci_ivshmem_vdev *vdev)
 {
-	if (vdev->addr && vdev->size)
+	if (vdev->addr && vdev->size) {
+		vm_del_ram_map(ctx, vdev->bar_addr);
 		munmap(vdev->addr, vdev->size);
+	}
 	if (vdev->fd > 0)
 		close(vdev->fd);
 }
@@ -379,7 +387,7 @@ pci_ivshmem_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (vdev->is_hv_land)
 		destroy_ivshmem_from_hv(ctx, dev);
 	else
-		destroy_ivshmem_from_dm(vdev);
+		destroy_ivshmem_from_dm(ctx, vdev);
 
 	if (vdev->name) {
 		/*
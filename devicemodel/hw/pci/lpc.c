@@ -45,6 +45,7 @@
 #include "lpc.h"
 #include "pit.h"
 #include "uart_core.h"
+#include "ns16550.h"
 
 #define	IO_ICU1		0x20
 #define	IO_ICU2		0xA0
@@ -66,6 +67,7 @@ static struct lpc_uart_vdev {
 	int	iobase;
 	int	irq;
 	int	enabled;	/* enabled/configured by user */
+	bool	posted;		/* THR writes are posted */
 } lpc_uart_vdev[LPC_UART_NUM];
 #define LPC_S5_UART_NAME "COM5"
 
@@ -204,6 +206,11 @@ lpc_deinit(struct vmctx *ctx)
 		iop.flags = IOPORT_F_INOUT;
 		unregister_inout(&iop);
 
+		if (lpc_uart->posted) {
+			vm_deassign_posted_io(ctx, ACRN_IOREQ_TYPE_PORTIO, lpc_uart->iobase + REG_DATA, 1);
+			lpc_uart->posted = false;
+		}
+
 		uart_release_backend(lpc_uart->uart, lpc_uart->opts);
 		uart_legacy_dealloc(unit);
 		lpc_uart->uart = NULL;
@@ -254,6 +261,10 @@ lpc_init(struct vmctx *ctx)
 		error = register_inout(&iop);
 		if (error)
 			goto init_failed;
+
+		/* the guest doesn't wait for the transmit of each character */
+		lpc_uart->posted = (vm_assign_posted_io(ctx, ACRN_IOREQ_TYPE_PORTIO,
+					lpc_uart->iobase + REG_DATA, 1) == 0);
 	}
 
 	return 0;
@@ -384,6 +395,41 @@ pci_lpc_uart_dsdt(void)
 }
 LPC_DSDT(pci_lpc_uart_dsdt);
 
+static void
+pci_lpc_reset(struct vmctx *ctx, struct pci_vdev *pi)
+{
+	int unit;
+
+	for (unit = 0; unit < LPC_UART_NUM; unit++) {
+		if (lpc_uart_vdev[unit].uart != NULL)
+			uart_reset_vdev(lpc_uart_vdev[unit].uart);
+	}
+}
+
+static int
+pci_lpc_save(struct vmctx *ctx, struct pci_vdev *pi, int fd)
+{
+	int unit, err = 0;
+
+	for (unit = 0; (unit < LPC_UART_NUM) && (err == 0); unit++) {
+		if (lpc_uart_vdev[unit].uart != NULL)
+			err = uart_save_vdev(lpc_uart_vdev[unit].uart, fd);
+	}
+	return err;
+}
+
+static int
+pci_lpc_restore(struct vmctx *ctx, struct pci_vdev *pi, int fd)
+{
+	int unit, err = 0;
+
+	for (unit = 0; (unit < LPC_UART_NUM) && (err == 0); unit++) {
+		if (lpc_uart_vdev[unit].uart != NULL)
+			err = uart_restore_vdev(lpc_uart_vdev[unit].uart, fd);
+	}
+	return err;
+}
+
 static int
 pci_lpc_cfgwrite(struct vmctx *ctx, int vcpu, struct pci_vdev *pi,
 		 int coff, int bytes, uint32_t val)
@@ -537,7 +583,10 @@ struct pci_vdev_ops pci_ops_lpc = {
 	.vdev_write_dsdt	= pci_lpc_write_dsdt,
 	.vdev_cfgwrite		= pci_lpc_cfgwrite,
 	.vdev_barwrite		= pci_lpc_write,
-	.vdev_barread		= pci_lpc_read
+	.vdev_barread		= pci_lpc_read,
+	.vdev_reset		= pci_lpc_reset,
+	.vdev_save		= pci_lpc_save,
+	.vdev_restore		= pci_lpc_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_lpc);
 
@@ -681,7 +681,7 @@ passthru_gpu_dsm_opregion(struct vmctx *ctx, struct passthru_dev *ptdev,
 	vm_unmap_ptdev_mmio(ctx, 0, 2, 0, gpu_opregion_gpa, GPU_OPREGION_SIZE, gpu_opregion_hpa);
 	vm_map_ptdev_mmio(ctx, 0, 2, 0, gpu_opregion_gpa, GPU_OPREGION_SIZE, gpu_opregion_hpa);
 
-	pcidev->type = ACRN_PTDEV_QUIRK_ASSIGN;
+	pcidev->type |= ACRN_PTDEV_QUIRK_ASSIGN;
 }
 
 static int
@@ -700,6 +700,39 @@ parse_vmsix_on_msi_bar_id(char *s, int *id, int base)
 	return ret;
 }
 
+/*
+ * Allocate the first unused BAR of ptdev for the vMSI-X table and PBA that
+ * the hypervisor relocates there: the table at offset 0, the PBA at the next
+ * page after it. The size is computed the same way by the hypervisor.
+ */
+static int
+passthru_alloc_msix_reloc_bar(struct passthru_dev *ptdev)
+{
+	int i, count;
+	uint32_t size;
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		if (ptdev->bar[i].type == PCIBAR_MEMHI64)
+			continue;
+		if (ptdev->bar[i].size == 0)
+			break;
+	}
+
+	if (i > PCI_BARMAX) {
+		pr_err("%s: no unused BAR to relocate the MSI-X table\n", __func__);
+		return -ENODEV;
+	}
+
+	count = (read_config(ptdev->phys_dev, ptdev->msix.capoff + PCIR_MSIX_CTRL, 2) &
+			PCIM_MSIXCTRL_TABLE_SIZE) + 1;
+	size = roundup2(count * MSIX_TABLE_ENTRY_SIZE, PAGE_SIZE) + PAGE_SIZE;
+	/* round up to a power of 2 */
+	if ((size & (size - 1)) != 0)
+		size = 1U << fls(size);
+
+	return pci_emul_alloc_pbar(ptdev->dev, i, 0, PCIBAR_MEM32, size);
+}
+
 /*
  * Passthrough device initialization function:
  * - initialize virtual config space
@@ -724,6 +757,7 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	bool d3hot_reset = false;
 	bool enable_ptm = false;
 	bool enable_irq = false;
+	bool msix_reloc = false;
 	int vrp_sec_bus = 0;
 	int vmsix_on_msi_bar_id = -1;
 	struct acrn_pcidev pcidev = {};
@@ -763,6 +797,8 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				pr_err("faild to parse msix emulation bar id");
 				return -EINVAL;
 			}
+		} else if (!strncmp(opt, "msix_reloc", 10)) {
+			msix_reloc = true;
 		} else if (!strncmp(opt, "enable_ptm", 10)) {
 			pr_notice("<PTM>: opt=enable_ptm.\n");
 			enable_ptm = true;
@@ -871,6 +907,12 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		if (error < 0)
 			goto done;
 		error = ACRN_PTDEV_IRQ_MSI;
+	} else if (msix_reloc && (ptdev->msix.capoff != 0)) {
+		if (passthru_alloc_msix_reloc_bar(ptdev) != 0) {
+			error = -ENODEV;
+			goto done;
+		}
+		pcidev.type |= ACRN_PTDEV_MSIX_RELOC;
 	}
 
 	ptdev->need_rombar = need_rombar;
@@ -900,7 +942,7 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		 * pci 0x30 reg will be emulated in DM.
 		 * So this will provide one hint for hypervisor.
 		 */
-		pcidev.type = ACRN_PTDEV_QUIRK_ASSIGN;
+		pcidev.type |= ACRN_PTDEV_QUIRK_ASSIGN;
 	}
 	pcidev.virt_bdf = PCI_BDF(dev->bus, dev->slot, dev->func);
 	pcidev.phys_bdf = ptdev->phys_bdf;
@@ -12,6 +12,7 @@
 #include <sys/eventfd.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -68,11 +69,56 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 	}
 }
 
+/* max_mem_regions of the vhost module defaults to 64 */
+#define VHOST_KERNEL_MEM_REGIONS_MAX	64
+
+/*
+ * One region per mapping of the guest memory, so that the RAM the devices
+ * map into the guest is reachable as well. The kernel swaps the whole table,
+ * it is how the changes are applied too.
+ */
 static int
-vhost_kernel_set_mem_table(struct vhost_dev *vdev,
-			   struct vhost_memory *mem)
+vhost_kernel_set_mem_table(struct vhost_dev *vdev)
 {
-	return vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	struct vm_memfd_map maps[VHOST_KERNEL_MEM_REGIONS_MAX];
+	struct vhost_memory *mem;
+	int i, n, rc;
+
+	n = vm_get_memfd_maps(vdev->base->dev->vmctx, maps,
+			      VHOST_KERNEL_MEM_REGIONS_MAX);
+	if (n <= 0) {
+		WPRINTF("failed to get the guest memory maps\n");
+		return -1;
+	}
+
+	mem = calloc(1, sizeof(struct vhost_memory) +
+		sizeof(struct vhost_memory_region) * n);
+	if (!mem) {
+		WPRINTF("out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		mem->regions[i].guest_phys_addr = maps[i].gpa;
+		mem->regions[i].memory_size = maps[i].size;
+		mem->regions[i].userspace_addr = (uintptr_t)maps[i].hva;
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			i,
+			mem->regions[i].guest_phys_addr,
+			mem->regions[i].userspace_addr,
+			mem->regions[i].memory_size);
+	}
+
+	mem->nregions = n;
+	mem->padding = 0;
+	rc = vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	free(mem);
+	if (rc < 0) {
+		WPRINTF("set_mem_table failed\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 static int
@@ -154,6 +200,53 @@ vhost_kernel_reset_device(struct vhost_dev *vdev)
 	return vhost_kernel_ioctl(vdev, VHOST_RESET_OWNER, NULL);
 }
 
+const struct vhost_ops vhost_kernel_ops = {
+	.set_mem_table			= vhost_kernel_set_mem_table,
+	.set_vring_addr			= vhost_kernel_set_vring_addr,
+	.set_vring_num			= vhost_kernel_set_vring_num,
+	.set_vring_base			= vhost_kernel_set_vring_base,
+	.get_vring_base			= vhost_kernel_get_vring_base,
+	.set_vring_kick			= vhost_kernel_set_vring_kick,
+	.set_vring_call			= vhost_kernel_set_vring_call,
+	.set_vring_busyloop_timeout	= vhost_kernel_set_vring_busyloop_timeout,
+	.set_features			= vhost_kernel_set_features,
+	.get_features			= vhost_kernel_get_features,
+	.set_owner			= vhost_kernel_set_owner,
+	.reset_device			= vhost_kernel_reset_device,
+};
+
+static void
+vhost_mem_map_add(struct vm_mem_listener *l, const struct vm_memfd_map *map)
+{
+	struct vhost_dev *vdev;
+	int rc;
+
+	vdev = container_of(l, struct vhost_dev, mem_listener);
+
+	if (vdev->ops->add_mem_map)
+		rc = vdev->ops->add_mem_map(vdev, map);
+	else
+		rc = vdev->ops->set_mem_table(vdev);
+	if (rc < 0)
+		WPRINTF("failed to add the map at 0x%lx\n", map->gpa);
+}
+
+static void
+vhost_mem_map_del(struct vm_mem_listener *l, const struct vm_memfd_map *map)
+{
+	struct vhost_dev *vdev;
+	int rc;
+
+	vdev = container_of(l, struct vhost_dev, mem_listener);
+
+	if (vdev->ops->del_mem_map)
+		rc = vdev->ops->del_mem_map(vdev, map);
+	else
+		rc = vdev->ops->set_mem_table(vdev);
+	if (rc < 0)
+		WPRINTF("failed to remove the map at 0x%lx\n", map->gpa);
+}
+
 static int
 vhost_eventfd_test_and_clear(int fd)
 {
@@ -196,7 +289,7 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 		irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
 	}
 
-	virtio_register_ioeventfd(base, idx, is_register, vq->kick_fd);
+	virtio_register_ioeventfd(base, vdev->vq_idx + idx, is_register, vq->kick_fd);
 	/* register irqfd for notify */
 	mte = &vdev->base->dev->msix.table[vqi->msix_idx];
 	msi.msi_addr = mte->addr;
@@ -324,7 +417,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_NUM */
 	ring.index = idx;
 	ring.num = vqi->qsize;
-	rc = vhost_kernel_set_vring_num(vdev, &ring);
+	rc = vdev->ops->set_vring_num(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_num failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -332,7 +425,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 
 	/* VHOST_SET_VRING_BASE */
 	ring.num = vqi->last_avail;
-	rc = vhost_kernel_set_vring_base(vdev, &ring);
+	rc = vdev->ops->set_vring_base(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_base failed: idx = %d, last_avail = %d\n",
 			idx, vqi->last_avail);
@@ -346,7 +439,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	addr.used_user_addr = (uintptr_t)vqi->used;
 	addr.log_guest_addr = (uintptr_t)NULL;
 	addr.flags = 0;
-	rc = vhost_kernel_set_vring_addr(vdev, &addr);
+	rc = vdev->ops->set_vring_addr(vdev, &addr);
 	if (rc < 0) {
 		WPRINTF("set_vring_addr failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -355,7 +448,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_CALL */
 	file.index = idx;
 	file.fd = vq->call_fd;
-	rc = vhost_kernel_set_vring_call(vdev, &file);
+	rc = vdev->ops->set_vring_call(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_call failed\n");
 		goto fail_vring;
@@ -364,18 +457,32 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_KICK */
 	file.index = idx;
 	file.fd = vq->kick_fd;
-	rc = vhost_kernel_set_vring_kick(vdev, &file);
+	rc = vdev->ops->set_vring_kick(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_kick failed: idx = %d", idx);
 		goto fail_vring_kick;
 	}
 
+	/* the rings of some backends start disabled */
+	if (vdev->ops->set_vring_enable) {
+		rc = vdev->ops->set_vring_enable(vdev, idx, true);
+		if (rc < 0) {
+			WPRINTF("set_vring_enable failed: idx = %d\n", idx);
+			goto fail_vring_enable;
+		}
+	}
+
 	return 0;
 
+fail_vring_enable:
+	file.index = idx;
+	file.fd = -1;
+	vdev->ops->set_vring_kick(vdev, &file);
+
 fail_vring_kick:
 	file.index = idx;
 	file.fd = -1;
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 fail_vring:
 	vhost_vq_register_eventfd(vdev, idx, false);
 fail:
@@ -405,18 +512,21 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	}
 	vqi = &vdev->base->queues[q_idx];
 
+	if (vdev->ops->set_vring_enable)
+		vdev->ops->set_vring_enable(vdev, idx, false);
+
 	file.index = idx;
 	file.fd = -1;
 
 	/* VHOST_SET_VRING_KICK */
-	vhost_kernel_set_vring_kick(vdev, &file);
+	vdev->ops->set_vring_kick(vdev, &file);
 
 	/* VHOST_SET_VRING_CALL */
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 
 	/* VHOST_GET_VRING_BASE */
 	ring.index = idx;
-	rc = vhost_kernel_get_vring_base(vdev, &ring);
+	rc = vdev->ops->get_vring_base(vdev, &ring);
 	if (rc < 0)
 		WPRINTF("get_vring_base failed: idx = %d", idx);
 	else
@@ -433,66 +543,6 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	return rc;
 }
 
-static int
-vhost_set_mem_table(struct vhost_dev *vdev)
-{
-	struct vmctx *ctx;
-	struct vhost_memory *mem;
-	uint32_t nregions = 0;
-	int rc;
-
-	ctx = vdev->base->dev->vmctx;
-	if (ctx->lowmem > 0)
-		nregions++;
-	if (ctx->highmem > 0)
-		nregions++;
-
-	mem = calloc(1, sizeof(struct vhost_memory) +
-		sizeof(struct vhost_memory_region) * nregions);
-	if (!mem) {
-		WPRINTF("out of memory\n");
-		return -1;
-	}
-
-	nregions = 0;
-	if (ctx->lowmem > 0) {
-		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
-		mem->regions[nregions].memory_size = ctx->lowmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)ctx->baseaddr;
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	if (ctx->highmem > 0) {
-		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
-		mem->regions[nregions].memory_size = ctx->highmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	mem->nregions = nregions;
-	mem->padding = 0;
-	rc = vhost_kernel_set_mem_table(vdev, mem);
-	free(mem);
-	if (rc < 0) {
-		WPRINTF("set_mem_table failed\n");
-		return -1;
-	}
-
-	return 0;
-}
-
 /**
  * @brief vhost_dev initialization.
  *
@@ -501,7 +551,8 @@ vhost_set_mem_table(struct vhost_dev *vdev)
  *
  * @param vdev Pointer to struct vhost_dev.
  * @param base Pointer to struct virtio_base.
- * @param fd fd of the vhost chardev.
+ * @param fd fd of the vhost chardev, or the vhost-user socket when
+ *           vdev->backend_type is VHOST_BACKEND_USER.
  * @param vq_idx The first virtqueue which would be used by this vhost dev.
  * @param vhost_features Subset of vhost features which would be enabled.
  * @param vhost_ext_features Specific vhost internal features to be enabled.
@@ -538,8 +589,17 @@ vhost_dev_init(struct vhost_dev *vdev,
 	}
 
 	vhost_kernel_init(vdev, base, fd, vq_idx, busyloop_timeout);
+	if (vdev->backend_type == VHOST_BACKEND_USER)
+		vdev->ops = &vhost_user_ops;
+	else
+		vdev->ops = &vhost_kernel_ops;
+
+	if (vdev->ops->init && vdev->ops->init(vdev) < 0) {
+		WPRINTF("vhost backend init failed\n");
+		goto fail;
+	}
 
-	rc = vhost_kernel_get_features(vdev, &features);
+	rc = vdev->ops->get_features(vdev, &features);
 	if (rc < 0) {
 		WPRINTF("vhost_get_features failed\n");
 		goto fail;
@@ -634,7 +694,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	rc = vhost_kernel_set_owner(vdev);
+	rc = vdev->ops->set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
@@ -643,15 +703,15 @@ vhost_dev_start(struct vhost_dev *vdev)
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
-	rc = vhost_kernel_set_features(vdev, features);
+	rc = vdev->ops->set_features(vdev, features);
 	if (rc < 0) {
 		WPRINTF("set_features failed\n");
 		goto fail;
 	}
 	DPRINTF("set_features: 0x%lx\n", features);
 
-	/* set memory table */
-	rc = vhost_set_mem_table(vdev);
+	/* set memory table, and keep it up to date until the stop */
+	rc = vdev->ops->set_mem_table(vdev);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
 		goto fail;
@@ -662,7 +722,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		state.num = vdev->busyloop_timeout;
 		for (i = 0; i < vdev->nvqs; i++) {
 			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
+			rc = vdev->ops->set_vring_busyloop_timeout(vdev,
 				&state);
 			if (rc < 0) {
 				WPRINTF("set_busyloop_timeout failed\n");
@@ -678,6 +738,10 @@ vhost_dev_start(struct vhost_dev *vdev)
 			goto fail_vq;
 	}
 
+	vdev->mem_listener.map_add = vhost_mem_map_add;
+	vdev->mem_listener.map_del = vhost_mem_map_del;
+	vm_register_mem_listener(&vdev->mem_listener);
+
 	vdev->started = true;
 	return 0;
 
@@ -702,6 +766,9 @@ vhost_dev_stop(struct vhost_dev *vdev)
 {
 	int i, rc = 0;
 
+	if (vdev->started)
+		vm_unregister_mem_listener(&vdev->mem_listener);
+
 	for (i = 0; i < vdev->nvqs; i++)
 		vhost_vq_stop(vdev, i);
 
@@ -709,7 +776,7 @@ vhost_dev_stop(struct vhost_dev *vdev)
 	 * 1) resources of the vhost dev are freed
 	 * 2) vhost virtqueues are reset
 	 */
-	rc = vhost_kernel_reset_device(vdev);
+	rc = vdev->ops->reset_device(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_reset_device failed\n");
 		rc = -1;
@@ -0,0 +1,617 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * vhost-user transport of vhost_dev: the requests are messages on a UNIX
+ * socket, the guest memory, kick and call eventfds are passed as fds.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/vhost.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "vhost.h"
+
+static int vhost_user_debug;
+#define LOG_TAG "vhost-user: "
+#define DPRINTF(fmt, args...) \
+       do { if (vhost_user_debug) pr_dbg(LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) pr_err(LOG_TAG fmt, ##args)
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_VERSION_MASK		0x3
+#define VHOST_USER_FLAG_REPLY		(1 << 2)
+#define VHOST_USER_FLAG_NEED_REPLY	(1 << 3)
+
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+
+#define VHOST_USER_PROTOCOL_F_MQ	0
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK	3
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+#define VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS	15
+
+/* the protocol features this side knows */
+#define VHOST_USER_PROTOCOL_FEATURES \
+	((1UL << VHOST_USER_PROTOCOL_F_MQ) | \
+	(1UL << VHOST_USER_PROTOCOL_F_REPLY_ACK) | \
+	(1UL << VHOST_USER_PROTOCOL_F_CONFIG) | \
+	(1UL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS))
+
+#define VHOST_USER_MEM_REGIONS_MAX	8
+#define VHOST_USER_CONFIG_SIZE_MAX	256
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD		(1 << 8)
+
+enum vhost_user_request {
+	VHOST_USER_GET_FEATURES = 1,
+	VHOST_USER_SET_FEATURES = 2,
+	VHOST_USER_SET_OWNER = 3,
+	VHOST_USER_RESET_OWNER = 4,
+	VHOST_USER_SET_MEM_TABLE = 5,
+	VHOST_USER_SET_VRING_NUM = 8,
+	VHOST_USER_SET_VRING_ADDR = 9,
+	VHOST_USER_SET_VRING_BASE = 10,
+	VHOST_USER_GET_VRING_BASE = 11,
+	VHOST_USER_SET_VRING_KICK = 12,
+	VHOST_USER_SET_VRING_CALL = 13,
+	VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+	VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+	VHOST_USER_SET_VRING_ENABLE = 18,
+	VHOST_USER_GET_CONFIG = 24,
+	VHOST_USER_ADD_MEM_REG = 37,
+	VHOST_USER_REM_MEM_REG = 38,
+};
+
+struct vhost_user_mem_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_mem_region regions[VHOST_USER_MEM_REGIONS_MAX];
+};
+
+struct vhost_user_mem_reg {
+	uint64_t padding;
+	struct vhost_user_mem_region region;
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_CONFIG_SIZE_MAX];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* of the payload */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_mem_reg mem_reg;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * VHOST_USER_MEM_REGIONS_MAX)];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	msg->flags |= VHOST_USER_VERSION;
+	do {
+		rc = sendmsg(vdev->fd, &mh, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != iov.iov_len) {
+		WPRINTF("failed to send request %d: %d\n", msg->request, errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	ssize_t rc;
+
+	do {
+		rc = recv(vdev->fd, msg, VHOST_USER_HDR_SIZE, MSG_WAITALL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != VHOST_USER_HDR_SIZE) {
+		WPRINTF("failed to receive the reply of %d: %d\n",
+			request, errno);
+		return -1;
+	}
+
+	if (msg->request != request ||
+	    (msg->flags & VHOST_USER_VERSION_MASK) != VHOST_USER_VERSION ||
+	    (msg->flags & VHOST_USER_FLAG_REPLY) == 0 ||
+	    msg->size > sizeof(msg->payload)) {
+		WPRINTF("bad reply of %d: request %d, flags 0x%x, size %d\n",
+			request, msg->request, msg->flags, msg->size);
+		return -1;
+	}
+
+	if (msg->size > 0) {
+		do {
+			rc = recv(vdev->fd, &msg->payload, msg->size,
+				  MSG_WAITALL);
+		} while (rc < 0 && errno == EINTR);
+		if (rc != msg->size) {
+			WPRINTF("failed to receive the payload of %d: %d\n",
+				request, errno);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Send a request which gets no reply. With REPLY_ACK, wait for the ack so
+ * that the backend has applied it before the next one.
+ */
+static int
+vhost_user_request(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		   int *fds, int nfds)
+{
+	uint32_t request = msg->request;
+	bool ack;
+
+	ack = (vdev->protocol_features &
+		(1UL << VHOST_USER_PROTOCOL_F_REPLY_ACK)) != 0;
+	if (ack)
+		msg->flags |= VHOST_USER_FLAG_NEED_REPLY;
+
+	if (vhost_user_send(vdev, msg, fds, nfds) < 0)
+		return -1;
+
+	if (!ack)
+		return 0;
+
+	if (vhost_user_recv(vdev, msg, request) < 0 ||
+	    msg->size != sizeof(msg->payload.u64))
+		return -1;
+	if (msg->payload.u64 != 0) {
+		WPRINTF("request %d failed: %lu\n", request, msg->payload.u64);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *val)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = request;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, request) < 0)
+		return -1;
+	if (msg.size != sizeof(msg.payload.u64)) {
+		WPRINTF("bad payload size %d of %d\n", msg.size, request);
+		return -1;
+	}
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = val;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+/* the vring indexes of the messages are the ones of the whole device */
+static int
+vhost_user_set_vring_state(struct vhost_dev *vdev, uint32_t request,
+			   struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = request;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state.index = ring->index + vdev->vq_idx;
+	msg.payload.state.num = ring->num;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_file(struct vhost_dev *vdev, uint32_t request,
+			  struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg;
+	int fd = file->fd;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = (file->index + vdev->vq_idx) &
+		VHOST_USER_VRING_IDX_MASK;
+	if (fd < 0)
+		msg.payload.u64 |= VHOST_USER_VRING_NOFD;
+	return vhost_user_request(vdev, &msg, &fd, fd < 0 ? 0 : 1);
+}
+
+static int
+vhost_user_init(struct vhost_dev *vdev)
+{
+	uint64_t features, protocol_features;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, &features) < 0)
+		return -1;
+
+	vdev->user_protocol = (features &
+		(1UL << VHOST_USER_F_PROTOCOL_FEATURES)) != 0;
+	vdev->protocol_features = 0;
+	if (!vdev->user_protocol)
+		return 0;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+			       &protocol_features) < 0)
+		return -1;
+
+	protocol_features &= VHOST_USER_PROTOCOL_FEATURES;
+	if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+			       protocol_features) < 0)
+		return -1;
+
+	vdev->protocol_features = protocol_features;
+	DPRINTF("protocol features 0x%lx\n", protocol_features);
+	return 0;
+}
+
+/*
+ * The backend maps the guest memory from the memfds of hugetlb.c and of the
+ * devices, the vring addresses are given as the user addresses of the device
+ * model.
+ */
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vm_memfd_map maps[VHOST_USER_MEM_REGIONS_MAX];
+	int fds[VHOST_USER_MEM_REGIONS_MAX];
+	struct vhost_user_msg msg;
+	struct vhost_user_mem_region region;
+	int i, n;
+
+	n = vm_get_memfd_maps(vdev->base->dev->vmctx, maps,
+			      VHOST_USER_MEM_REGIONS_MAX);
+	if (n <= 0) {
+		WPRINTF("no more than %d guest memory maps are supported\n",
+			VHOST_USER_MEM_REGIONS_MAX);
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_SET_MEM_TABLE;
+	msg.size = sizeof(msg.payload.memory);
+	msg.payload.memory.nregions = n;
+	for (i = 0; i < n; i++) {
+		region.guest_phys_addr = maps[i].gpa;
+		region.memory_size = maps[i].size;
+		region.userspace_addr = (uintptr_t)maps[i].hva;
+		region.mmap_offset = maps[i].fd_offset;
+		memcpy(&msg.payload.memory.regions[i], &region, sizeof(region));
+		fds[i] = maps[i].fd;
+		DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx]\n", i,
+			region.guest_phys_addr, region.userspace_addr,
+			region.memory_size);
+	}
+
+	return vhost_user_request(vdev, &msg, fds, n);
+}
+
+/* a single region is added or removed with CONFIGURE_MEM_SLOTS */
+static int
+vhost_user_mem_reg(struct vhost_dev *vdev, uint32_t request,
+		   const struct vm_memfd_map *map)
+{
+	struct vhost_user_msg msg;
+	struct vhost_user_mem_reg reg;
+	int fd = map->fd;
+
+	if ((vdev->protocol_features &
+	     (1UL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) == 0)
+		return vhost_user_set_mem_table(vdev);
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = request;
+	msg.size = sizeof(msg.payload.mem_reg);
+	reg.padding = 0;
+	reg.region.guest_phys_addr = map->gpa;
+	reg.region.memory_size = map->size;
+	reg.region.userspace_addr = (uintptr_t)map->hva;
+	reg.region.mmap_offset = map->fd_offset;
+	memcpy(&msg.payload.mem_reg, &reg, sizeof(reg));
+	DPRINTF("%s [0x%lx -> %p, 0x%lx]\n",
+		request == VHOST_USER_ADD_MEM_REG ? "add" : "remove",
+		map->gpa, map->hva, map->size);
+
+	/* the backend maps the region from the fd it gets with ADD_MEM_REG */
+	if (request == VHOST_USER_ADD_MEM_REG)
+		return vhost_user_request(vdev, &msg, &fd, 1);
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_add_mem_map(struct vhost_dev *vdev, const struct vm_memfd_map *map)
+{
+	return vhost_user_mem_reg(vdev, VHOST_USER_ADD_MEM_REG, map);
+}
+
+static int
+vhost_user_del_mem_map(struct vhost_dev *vdev, const struct vm_memfd_map *map)
+{
+	return vhost_user_mem_reg(vdev, VHOST_USER_REM_MEM_REG, map);
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = VHOST_USER_SET_VRING_ADDR;
+	msg.size = sizeof(msg.payload.addr);
+	msg.payload.addr = *addr;
+	msg.payload.addr.index += vdev->vq_idx;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_NUM, ring);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_BASE, ring);
+}
+
+/* this also stops the ring */
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = VHOST_USER_GET_VRING_BASE;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state.index = ring->index + vdev->vq_idx;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_VRING_BASE) < 0)
+		return -1;
+	if (msg.size != sizeof(msg.payload.state)) {
+		WPRINTF("bad payload size %d of get_vring_base\n", msg.size);
+		return -1;
+	}
+
+	ring->num = msg.payload.state.num;
+	return 0;
+}
+
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	/*
+	 * No kick fd asks the backend to poll the ring, the ring is stopped
+	 * by get_vring_base instead.
+	 */
+	if (file->fd < 0)
+		return 0;
+	return vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_KICK, file);
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_CALL, file);
+}
+
+static int
+vhost_user_set_vring_busyloop_timeout(struct vhost_dev *vdev,
+				      struct vhost_vring_state *s)
+{
+	/* the poll-mode backends busy loop on their own */
+	return 0;
+}
+
+/* the rings start disabled only with VHOST_USER_F_PROTOCOL_FEATURES */
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev, int idx, bool enable)
+{
+	struct vhost_vring_state ring;
+
+	if (!vdev->user_protocol)
+		return 0;
+
+	ring.index = idx;
+	ring.num = enable ? 1 : 0;
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_ENABLE,
+					  &ring);
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	if (vdev->user_protocol)
+		features |= 1UL << VHOST_USER_F_PROTOCOL_FEATURES;
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, features) < 0)
+		return -1;
+
+	/* not a virtio feature, see vhost_user_set_features() */
+	*features &= ~(1UL << VHOST_USER_F_PROTOCOL_FEATURES);
+	return 0;
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = VHOST_USER_SET_OWNER;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	memset(&msg, 0, VHOST_USER_HDR_SIZE);
+	msg.request = VHOST_USER_RESET_OWNER;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+const struct vhost_ops vhost_user_ops = {
+	.init				= vhost_user_init,
+	.set_mem_table			= vhost_user_set_mem_table,
+	.add_mem_map			= vhost_user_add_mem_map,
+	.del_mem_map			= vhost_user_del_mem_map,
+	.set_vring_addr			= vhost_user_set_vring_addr,
+	.set_vring_num			= vhost_user_set_vring_num,
+	.set_vring_base			= vhost_user_set_vring_base,
+	.get_vring_base			= vhost_user_get_vring_base,
+	.set_vring_kick			= vhost_user_set_vring_kick,
+	.set_vring_call			= vhost_user_set_vring_call,
+	.set_vring_busyloop_timeout	= vhost_user_set_vring_busyloop_timeout,
+	.set_vring_enable		= vhost_user_set_vring_enable,
+	.set_features			= vhost_user_set_features,
+	.get_features			= vhost_user_get_features,
+	.set_owner			= vhost_user_set_owner,
+	.reset_device			= vhost_user_reset_device,
+};
+
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("socket path %s too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("failed to create socket: %d\n", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF("failed to connect to %s: %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg;
+	uint32_t hdr = offsetof(struct vhost_user_config, region);
+
+	if ((vdev->protocol_features &
+	     (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) == 0) {
+		WPRINTF("the backend has no config space\n");
+		return -1;
+	}
+	if (size > VHOST_USER_CONFIG_SIZE_MAX)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_GET_CONFIG;
+	msg.size = hdr + size;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) < 0)
+		return -1;
+	if (msg.size != hdr + size || msg.payload.config.size != size) {
+		WPRINTF("bad config reply size %d\n", msg.size);
+		return -1;
+	}
+
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * vhost-user-blk device: the queues are served by a vhost-user backend in
+ * the Service VM, SPDK for instance, the config space is the backend's.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/vhost.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vhost.h"
+#include "dm_string.h"
+
+#define VHOST_USER_BLK_RINGSZ	256
+#define VHOST_USER_BLK_MAXQ	16
+
+#define VIRTIO_BLK_F_SIZE_MAX		(1 << 1)
+#define VIRTIO_BLK_F_SEG_MAX		(1 << 2)
+#define VIRTIO_BLK_F_GEOMETRY		(1 << 4)
+#define VIRTIO_BLK_F_RO			(1 << 5)
+#define VIRTIO_BLK_F_BLK_SIZE		(1 << 6)
+#define VIRTIO_BLK_F_FLUSH		(1 << 9)
+#define VIRTIO_BLK_F_TOPOLOGY		(1 << 10)
+#define VIRTIO_BLK_F_MQ			(1 << 12)
+#define VIRTIO_BLK_F_DISCARD		(1 << 13)
+#define VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
+
+/* the features the backend may offer to the guest */
+#define VHOST_USER_BLK_FEATURES \
+	(VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | \
+	VIRTIO_BLK_F_GEOMETRY | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_BLK_SIZE | \
+	VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_TOPOLOGY | VIRTIO_BLK_F_MQ | \
+	VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES | \
+	(1UL << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1UL << VIRTIO_RING_F_EVENT_IDX) | (1UL << VIRTIO_F_VERSION_1))
+
+struct vhost_user_blk_config {
+	uint64_t capacity;
+	uint32_t size_max;
+	uint32_t seg_max;
+	struct {
+		uint16_t cylinders;
+		uint8_t heads;
+		uint8_t sectors;
+	} geometry;
+	uint32_t blk_size;
+	struct {
+		uint8_t physical_block_exp;
+		uint8_t alignment_offset;
+		uint16_t min_io_size;
+		uint32_t opt_io_size;
+	} topology;
+	uint8_t writeback;
+	uint8_t unused0;
+	uint16_t num_queues;
+	uint32_t max_discard_sectors;
+	uint32_t max_discard_seg;
+	uint32_t discard_sector_alignment;
+	uint32_t max_write_zeroes_sectors;
+	uint32_t max_write_zeroes_seg;
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
+} __attribute__((packed));
+
+struct vhost_user_blk {
+	struct virtio_base base;
+	struct virtio_ops ops;
+	pthread_mutex_t mtx;
+	struct virtio_vq_info vqs[VHOST_USER_BLK_MAXQ];
+	struct vhost_dev vdev;
+	struct vhost_vq vhost_vqs[VHOST_USER_BLK_MAXQ];
+	struct vhost_user_blk_config cfg;
+	bool vhost_started;
+};
+
+static int
+vhost_user_blk_start(struct vhost_user_blk *blk)
+{
+	if (blk->vhost_started)
+		return 0;
+
+	if (vhost_dev_start(&blk->vdev) < 0) {
+		pr_err("vhost-user-blk: vhost_dev_start failed\n");
+		return -1;
+	}
+
+	blk->vhost_started = true;
+	return 0;
+}
+
+static int
+vhost_user_blk_stop(struct vhost_user_blk *blk)
+{
+	if (!blk->vhost_started)
+		return 0;
+
+	if (vhost_dev_stop(&blk->vdev) < 0) {
+		pr_err("vhost-user-blk: vhost_dev_stop failed\n");
+		return -1;
+	}
+
+	blk->vhost_started = false;
+	return 0;
+}
+
+static void
+vhost_user_blk_set_status(void *vdev, uint64_t status)
+{
+	struct vhost_user_blk *blk = vdev;
+
+	if (status & VIRTIO_CONFIG_S_DRIVER_OK)
+		vhost_user_blk_start(blk);
+	else
+		vhost_user_blk_stop(blk);
+}
+
+static int
+vhost_user_blk_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct vhost_user_blk *blk = vdev;
+	void *ptr;
+
+	ptr = (uint8_t *)&blk->cfg + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+vhost_user_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	/* CONFIG_WCE is not offered, the config space is read only */
+	pr_dbg("vhost-user-blk: write to readonly reg %d\n", offset);
+	return 0;
+}
+
+static void
+vhost_user_blk_reset(void *vdev)
+{
+	struct vhost_user_blk *blk = vdev;
+
+	pr_dbg("vhost-user-blk: device reset requested.\n");
+	vhost_user_blk_stop(blk);
+	virtio_reset_dev(&blk->base);
+}
+
+static void
+vhost_user_blk_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	/* the kicks go to the backend through the ioeventfds */
+}
+
+static struct virtio_ops vhost_user_blk_ops = {
+	"vhost-user-blk",		/* our name */
+	1,				/* mq=<n> sets it */
+	sizeof(struct vhost_user_blk_config), /* config reg size */
+	vhost_user_blk_reset,		/* reset */
+	NULL,				/* device-wide qnotify -- not used */
+	vhost_user_blk_cfgread,		/* read PCI config */
+	vhost_user_blk_cfgwrite,	/* write PCI config */
+	NULL,				/* apply negotiated features */
+	vhost_user_blk_set_status,	/* called on guest set status */
+};
+
+/*
+ * vhost-user-blk,<socket path>[,mq=<n>]
+ */
+static int
+vhost_user_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct vhost_user_blk *blk;
+	pthread_mutexattr_t attr;
+	char *devopts, *tmp, *path, *opt;
+	int num_vqs = 1;
+	int fd, i, rc;
+
+	if (opts == NULL) {
+		pr_err("vhost-user-blk: socket path required\n");
+		return -1;
+	}
+
+	devopts = tmp = strdup(opts);
+	if (!devopts) {
+		pr_err("vhost-user-blk: strdup failed\n");
+		return -1;
+	}
+
+	path = strsep(&tmp, ",");
+	while ((opt = strsep(&tmp, ",")) != NULL) {
+		if (!strncmp(opt, "mq=", 3)) {
+			if (dm_strtoi(opt + 3, &opt, 10, &num_vqs) ||
+			    *opt != '\0' || num_vqs <= 0) {
+				pr_err("vhost-user-blk: incorrect num queues\n");
+				free(devopts);
+				return -1;
+			}
+			if (num_vqs > VHOST_USER_BLK_MAXQ)
+				num_vqs = VHOST_USER_BLK_MAXQ;
+			/* the max vq number allowed by FE is guest cpu num */
+			if (num_vqs > guest_cpu_num())
+				num_vqs = guest_cpu_num();
+		}
+	}
+
+	blk = calloc(1, sizeof(struct vhost_user_blk));
+	if (!blk) {
+		pr_err("vhost-user-blk: calloc failed\n");
+		free(devopts);
+		return -1;
+	}
+
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		pr_err("vhost-user-blk: mutexattr init failed with erro %d\n", rc);
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		pr_err("vhost-user-blk: mutexattr_settype failed with error %d\n", rc);
+	rc = pthread_mutex_init(&blk->mtx, &attr);
+	if (rc)
+		pr_err("vhost-user-blk: pthread_mutex_init failed with error %d\n", rc);
+
+	blk->ops = vhost_user_blk_ops;
+	blk->ops.nvq = num_vqs;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs, BACKEND_VHOST);
+	blk->base.mtx = &blk->mtx;
+	blk->base.device_caps = VHOST_USER_BLK_FEATURES;
+	if (num_vqs == 1)
+		blk->base.device_caps &= ~VIRTIO_BLK_F_MQ;
+
+	for (i = 0; i < num_vqs; i++) {
+		blk->vqs[i].qsize = VHOST_USER_BLK_RINGSZ;
+		blk->vqs[i].notify = vhost_user_blk_notify;
+	}
+
+	fd = vhost_user_connect(path);
+	free(devopts);
+	if (fd < 0)
+		goto fail;
+
+	/* pre-init before calling vhost_dev_init */
+	blk->vdev.nvqs = num_vqs;
+	blk->vdev.vqs = blk->vhost_vqs;
+	blk->vdev.backend_type = VHOST_BACKEND_USER;
+	if (vhost_dev_init(&blk->vdev, &blk->base, fd, 0,
+			   blk->base.device_caps, 0, 0) < 0) {
+		pr_err("vhost-user-blk: vhost_dev_init failed\n");
+		goto fail;
+	}
+
+	if (num_vqs > 1 && (blk->base.device_caps & VIRTIO_BLK_F_MQ) == 0) {
+		pr_err("vhost-user-blk: the backend has a single queue\n");
+		goto fail_vhost;
+	}
+
+	if (vhost_user_get_config(&blk->vdev, &blk->cfg, sizeof(blk->cfg)) < 0) {
+		pr_err("vhost-user-blk: failed to get the config space\n");
+		goto fail_vhost;
+	}
+	blk->cfg.num_queues = num_vqs;
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BLOCK);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_STORAGE);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_STORAGE_SCSI);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BLOCK);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	virtio_set_modern_bar(&blk->base, false);
+
+	if (virtio_interrupt_init(&blk->base, virtio_uses_msix()))
+		goto fail_vhost;
+
+	return 0;
+
+fail_vhost:
+	vhost_dev_deinit(&blk->vdev);
+fail:
+	free(blk);
+	return -1;
+}
+
+static void
+vhost_user_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct vhost_user_blk *blk;
+
+	if (dev->arg) {
+		blk = (struct vhost_user_blk *) dev->arg;
+
+		vhost_user_blk_stop(blk);
+		vhost_dev_deinit(&blk->vdev);
+		pr_dbg("%s: done\n", __func__);
+		free(blk);
+	} else
+		pr_err("%s: NULL.\n", __func__);
+}
+
+struct pci_vdev_ops pci_ops_vhost_user_blk = {
+	.class_name	= "vhost-user-blk",
+	.vdev_init	= vhost_user_blk_init,
+	.vdev_deinit	= vhost_user_blk_deinit,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_vhost_user_blk);
@@ -234,11 +234,13 @@ static int
 virtio_vhost_vsock_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_vsock *vsock;
-	int rc;
+	int rc, i;
 	uint64_t cid = 0;
+	uint32_t qsize = VHOST_VSOCK_QUEUE_SIZE;
 	pthread_mutexattr_t attr;
 	char *devopts = NULL;
 	char *tmp = NULL;
+	char *opt = NULL;
 
 	if (opts == NULL) {
 		pr_err(("vsock: must have a valid guest_cid.\n"));
@@ -249,9 +251,22 @@ virtio_vhost_vsock_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pr_err(("vsock: The vsock parameter is NULL.\n"));
 		return -1;
 	}
-	if (!strncmp(tmp, "cid=", 4)) {
-		strsep(&tmp, "=");
-		dm_strtoul(tmp, NULL, 10, &cid);
+	while ((opt = strsep(&tmp, ",")) != NULL) {
+		if (!strncmp(opt, "cid=", 4)) {
+			dm_strtoul(opt + 4, NULL, 10, &cid);
+		} else if (!strncmp(opt, "qsize=", 6)) {
+			/* deeper rings keep more RX buffers posted to vhost */
+			if (dm_strtoui(opt + 6, &opt, 10, &qsize) ||
+			    *opt != '\0' || qsize < VHOST_VSOCK_QUEUE_SIZE ||
+			    qsize > VHOST_VSOCK_QUEUE_SIZE_MAX ||
+			    (qsize & (qsize - 1)) != 0) {
+				pr_err("vsock: qsize has to be a power of 2 "
+					"in %d~%d.\n", VHOST_VSOCK_QUEUE_SIZE,
+					VHOST_VSOCK_QUEUE_SIZE_MAX);
+				free(devopts);
+				return -1;
+			}
+		}
 	}
 	free(devopts);
 
@@ -282,12 +297,12 @@ virtio_vhost_vsock_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	vsock->base.mtx = &vsock->mtx;
 	vsock->base.device_caps = (1UL << VIRTIO_F_VERSION_1) | VHOST_VSOCK_FEATURES;
 
-	vsock->queues[VHOST_VSOCK_RXQ].qsize = VHOST_VSOCK_QUEUE_SIZE;
-	vsock->queues[VHOST_VSOCK_RXQ].notify = vhost_vsock_handle_output;
-	vsock->queues[VHOST_VSOCK_TXQ].qsize = VHOST_VSOCK_QUEUE_SIZE;
-	vsock->queues[VHOST_VSOCK_TXQ].notify = vhost_vsock_handle_output;
-	vsock->queues[VHOST_VSOCK_CTLQ].qsize = VHOST_VSOCK_QUEUE_SIZE;
-	vsock->queues[VHOST_VSOCK_CTLQ].notify = vhost_vsock_handle_output;
+	/* the event queue carries a few transport resets only */
+	for (i = 0; i < VHOST_VSOCK_MAXQ; i++) {
+		vsock->queues[i].qsize = (i == VHOST_VSOCK_CTLQ) ?
+			VHOST_VSOCK_QUEUE_SIZE : qsize;
+		vsock->queues[i].notify = vhost_vsock_handle_output;
+	}
 
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_VSOCK);
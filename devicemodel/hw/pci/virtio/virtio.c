@@ -42,7 +42,10 @@
 #include "hsm_ioctl_defs.h"
 #include "iothread.h"
 #include "vmmapi.h"
+#include "dm_string.h"
+#include "snapshot.h"
 #include <errno.h>
+#include <cjson/cJSON.h>
 
 /*
  * Functions for dealing with generalized "virtual devices" as
@@ -59,6 +62,23 @@
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
 
+/* a notification of the driver, and whether it found the ring full */
+static inline void
+vq_count_kick(struct virtio_vq_info *vq)
+{
+	__atomic_fetch_add(&vq->stats.kicks, 1, __ATOMIC_RELAXED);
+	if (!vq->packed && vq_ring_ready(vq) &&
+	    (uint16_t)(vq->avail->idx - vq->last_avail) >= vq->qsize)
+		__atomic_fetch_add(&vq->stats.ring_full, 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+vq_count_chain(struct virtio_vq_info *vq, int n)
+{
+	__atomic_fetch_add(&vq->stats.chains, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&vq->stats.descs, n, __ATOMIC_RELAXED);
+}
+
 static
 void iothread_handler(void *arg)
 {
@@ -74,14 +94,43 @@ void iothread_handler(void *arg)
 		return;
 	}
 
+	vq_count_kick(vq);
 	if (viothrd->iothread_run) {
+		if (viothrd->base_lock)
+			VIRTIO_BASE_LOCK(base);
 		pthread_mutex_lock(&vq->mtx);
 		/* only vq specific data can be accessed in qnotify callback */
 		(*viothrd->iothread_run)(base, vq);
 		pthread_mutex_unlock(&vq->mtx);
+		if (viothrd->base_lock)
+			VIRTIO_BASE_UNLOCK(base);
 	}
 }
 
+/*
+ * The queues a device did not bind to an iothread of its own share one
+ * created for the device, their kicks are taken with the device lock held
+ * as the vCPUs take them. The kicks of a queue stay synchronous if the
+ * iothread can't be created.
+ */
+static struct iothread_ctx *
+virtio_default_ioctx(struct virtio_base *base)
+{
+	struct iothreads_option iot_opt;
+
+	if (base->ioctx == NULL) {
+		memset(&iot_opt, 0, sizeof(iot_opt));
+		snprintf(iot_opt.tag, sizeof(iot_opt.tag), "vio%d", base->dev->slot);
+		iot_opt.num = 1;
+		base->ioctx = iothread_create(&iot_opt);
+		if (base->ioctx == NULL)
+			pr_warn("%s: no iothread, queue kicks stay synchronous\n",
+				base->vops->name);
+	}
+
+	return base->ioctx;
+}
+
 void
 virtio_set_iothread(struct virtio_base *base,
 			  bool is_register)
@@ -96,8 +145,14 @@ virtio_set_iothread(struct virtio_base *base,
 
 		if ((vq->viothrd.ioevent_started && is_register) ||
 			(!vq->viothrd.ioevent_started && !is_register))
-				return;
+				continue;
 		if (is_register) {
+			if (vq->viothrd.ioctx == NULL) {
+				vq->viothrd.ioctx = virtio_default_ioctx(base);
+				if (vq->viothrd.ioctx == NULL)
+					continue;
+				vq->viothrd.base_lock = true;
+			}
 			vq->viothrd.kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
 			if (vops->qnotify)
@@ -163,11 +218,13 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 
 	base->polling_in_progress = 1;
 
+	/* the interrupts of the queues polled are injected together */
+	vm_msi_batch_begin(base->dev->vmctx);
 	for (i = 0; i < base->vops->nvq; i++) {
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(base, vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -177,6 +234,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 			pr_err("%s: qnotify queue %d: missing vq/vops notify\r\n",
 				name, i);
 	}
+	vm_msi_batch_end(base->dev->vmctx);
 
 	if (base->mtx)
 		pthread_mutex_unlock(base->mtx);
@@ -184,6 +242,267 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
 }
 
+/*
+ * Interrupt moderation, per virtqueue. The used chains vq_endchains()
+ * would interrupt for are counted as pending instead, the interrupt is
+ * raised once there are max_frames of them, or by the timer, max_usecs
+ * after the first one.
+ */
+#define VIRTIO_COALESCE_USECS_MAX	100000
+
+struct virtio_coalesce {
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	struct virtio_coalesce_opts opts;
+	pthread_mutex_t mtx;
+	uint32_t pending;	/* used chains not interrupted for yet */
+	bool armed;		/* the timer runs for them */
+	uint64_t last_intr_ns;
+	struct acrn_timer timer;
+};
+
+static uint64_t
+virtio_coalesce_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* coalesce=<frames>:<usecs>[:adaptive] */
+int
+virtio_coalesce_parse_options(char *opt, struct virtio_coalesce_opts *co)
+{
+	char *cp, *end, *frames, *usecs, *mode;
+	int val;
+
+	memset(co, 0, sizeof(*co));
+	cp = opt;
+	frames = strsep(&cp, ":");
+	usecs = strsep(&cp, ":");
+	mode = strsep(&cp, ":");
+
+	if (frames == NULL || usecs == NULL || cp != NULL)
+		goto err;
+	if (dm_strtoi(frames, &end, 10, &val) || *end != '\0' || val < 0)
+		goto err;
+	co->max_frames = val;
+	if (dm_strtoi(usecs, &end, 10, &val) || *end != '\0' || val <= 0 ||
+	    val > VIRTIO_COALESCE_USECS_MAX)
+		goto err;
+	co->max_usecs = val;
+	if (mode != NULL) {
+		if (strcmp(mode, "adaptive") != 0)
+			goto err;
+		co->adaptive = true;
+	}
+	return 0;
+
+err:
+	pr_err("%s: invalid coalesce option, "
+	    "expected <frames>:<usecs 1-%d>[:adaptive]\n",
+	    __func__, VIRTIO_COALESCE_USECS_MAX);
+	return -1;
+}
+
+static void
+virtio_coalesce_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_coalesce *co = arg;
+	bool intr;
+
+	pthread_mutex_lock(&co->mtx);
+	intr = co->armed && co->pending != 0;
+	co->armed = false;
+	co->pending = 0;
+	if (intr)
+		co->last_intr_ns = virtio_coalesce_now();
+	pthread_mutex_unlock(&co->mtx);
+
+	if (intr && vq_ring_ready(co->vq))
+		vq_interrupt(co->base, co->vq);
+}
+
+/* the interrupt for n more used chains is due, raise it or hold it back */
+static void
+vq_coalesce_interrupt(struct virtio_base *base, struct virtio_vq_info *vq,
+		uint32_t n)
+{
+	struct virtio_coalesce *co = vq->coalesce;
+	uint64_t now;
+	bool idle, intr = false;
+
+	if (co == NULL) {
+		vq_interrupt(base, vq);
+		return;
+	}
+
+	now = virtio_coalesce_now();
+	pthread_mutex_lock(&co->mtx);
+	idle = (co->pending == 0) &&
+		(now - co->last_intr_ns >= co->opts.max_usecs * 1000UL);
+	co->pending += (n != 0) ? n : 1;
+	if ((co->opts.adaptive && idle) ||
+	    (co->opts.max_frames != 0 && co->pending >= co->opts.max_frames)) {
+		/* the timer, if armed, finds nothing pending */
+		co->pending = 0;
+		co->armed = false;
+		co->last_intr_ns = now;
+		intr = true;
+	} else if (!co->armed) {
+		co->armed = true;
+		virtio_start_timer(&co->timer, 0, co->opts.max_usecs * 1000L);
+	}
+	pthread_mutex_unlock(&co->mtx);
+
+	if (intr)
+		vq_interrupt(base, vq);
+}
+
+void
+vq_coalesce_flush(struct virtio_vq_info *vq)
+{
+	struct virtio_coalesce *co = vq->coalesce;
+	bool intr;
+
+	if (co == NULL)
+		return;
+
+	pthread_mutex_lock(&co->mtx);
+	intr = co->pending != 0;
+	/* the timer, if armed, finds nothing pending */
+	co->pending = 0;
+	co->armed = false;
+	if (intr)
+		co->last_intr_ns = virtio_coalesce_now();
+	pthread_mutex_unlock(&co->mtx);
+
+	if (intr && vq_ring_ready(vq))
+		vq_interrupt(co->base, vq);
+}
+
+/* at the reset of the device, forget the interrupts held back */
+static void
+vq_coalesce_reset(struct virtio_vq_info *vq)
+{
+	struct virtio_coalesce *co = vq->coalesce;
+
+	if (co == NULL)
+		return;
+
+	pthread_mutex_lock(&co->mtx);
+	co->pending = 0;
+	co->armed = false;
+	pthread_mutex_unlock(&co->mtx);
+}
+
+int
+virtio_coalesce_init(struct virtio_base *base,
+		const struct virtio_coalesce_opts *co)
+{
+	struct virtio_coalesce **vcos, *vco;
+	struct virtio_vq_info *vq;
+	int i;
+
+	if (base->backend_type != BACKEND_VBSU) {
+		pr_err("%s: %s: no interrupt moderation for a kernel backend\n",
+		    __func__, base->vops->name);
+		return -1;
+	}
+
+	/* all set up before any is published: the queues may be running */
+	vcos = calloc(base->vops->nvq, sizeof(*vcos));
+	if (vcos == NULL) {
+		pr_err("%s: calloc returns NULL\n", __func__);
+		return -1;
+	}
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		vco = calloc(1, sizeof(*vco));
+		if (vco == NULL) {
+			pr_err("%s: calloc returns NULL\n", __func__);
+			goto fail;
+		}
+		vco->base = base;
+		vco->vq = vq;
+		vco->opts = *co;
+		pthread_mutex_init(&vco->mtx, NULL);
+		/* may expire along with the other timers, up to 1/8 later */
+		vco->timer.clockid = CLOCK_MONOTONIC;
+		vco->timer.slack_ns = co->max_usecs * 1000UL / 8;
+		if (acrn_timer_init(&vco->timer, virtio_coalesce_timer, vco) != 0) {
+			pr_err("%s: failed to init the timer\n", __func__);
+			pthread_mutex_destroy(&vco->mtx);
+			free(vco);
+			goto fail;
+		}
+		vcos[i] = vco;
+	}
+	for (i = 0; i < base->vops->nvq; i++)
+		__atomic_store_n(&base->queues[i].coalesce, vcos[i],
+				__ATOMIC_RELEASE);
+	free(vcos);
+
+	pr_info("%s: %s: coalesce %u frames, %u us%s\n", __func__,
+	    base->vops->name, co->max_frames, co->max_usecs,
+	    co->adaptive ? ", adaptive" : "");
+	return 0;
+
+fail:
+	while (--i >= 0) {
+		acrn_timer_deinit(&vcos[i]->timer);
+		pthread_mutex_destroy(&vcos[i]->mtx);
+		free(vcos[i]);
+	}
+	free(vcos);
+	return -1;
+}
+
+/*
+ * A new moderation for a running device, from the monitor. The timer keeps
+ * the slack of the first one, it can't change while the timer is armed.
+ */
+int
+virtio_coalesce_update(struct virtio_base *base,
+		const struct virtio_coalesce_opts *co)
+{
+	struct virtio_coalesce *vco;
+	int i;
+
+	if (base->queues[0].coalesce == NULL)
+		return virtio_coalesce_init(base, co);
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vco = base->queues[i].coalesce;
+		pthread_mutex_lock(&vco->mtx);
+		vco->opts = *co;
+		pthread_mutex_unlock(&vco->mtx);
+	}
+
+	pr_info("%s: %s: coalesce %u frames, %u us%s\n", __func__,
+	    base->vops->name, co->max_frames, co->max_usecs,
+	    co->adaptive ? ", adaptive" : "");
+	return 0;
+}
+
+void
+virtio_coalesce_deinit(struct virtio_base *base)
+{
+	struct virtio_vq_info *vq;
+	int i;
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		if (vq->coalesce == NULL)
+			continue;
+		acrn_timer_deinit(&vq->coalesce->timer);
+		pthread_mutex_destroy(&vq->coalesce->mtx);
+		free(vq->coalesce);
+		vq->coalesce = NULL;
+	}
+}
+
 /**
  * @brief Link a virtio_base to its constants, the virtio device,
  * and the PCI emulation.
@@ -225,6 +544,8 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	base->dev = dev;
 	dev->arg = base;
 	base->backend_type = backend_type;
+	/* the kicks of a userspace device are taken by iothreads, unless it opts out */
+	base->iothread = (backend_type == BACKEND_VBSU) && !vops->sync_notify;
 
 	base->queues = queues;
 	for (i = 0; i < vops->nvq; i++) {
@@ -278,6 +599,10 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->packed = false;
+		free(vq->chain_len);
+		vq->chain_len = NULL;
+		vq_coalesce_reset(vq);
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -309,6 +634,9 @@ virtio_set_io_bar(struct virtio_base *base, int barnum)
 	size = VIRTIO_PCI_CONFIG_OFF(1) + base->vops->cfgsize;
 	pci_emul_alloc_bar(base->dev, barnum, PCIBAR_IO, size);
 	base->legacy_pio_bar_idx = barnum;
+
+	/* the guest doesn't wait for the queue notifications */
+	pci_emul_set_bar_posted(base->dev, barnum, VIRTIO_PCI_QUEUE_NOTIFY, 2);
 }
 
 /**
@@ -407,6 +735,7 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->packed = false;
 
 	/* Mark queue as allocated after initialization is complete. */
 	mb();
@@ -419,6 +748,77 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * The packed ring needs nothing from the devices beyond the vq_* interfaces,
+ * so it is offered by every modern device emulated in the device model. The
+ * kernel backends only know the split ring.
+ */
+static uint64_t
+virtio_device_caps(struct virtio_base *base)
+{
+	uint64_t caps = base->device_caps;
+
+	if (base->backend_type == BACKEND_VBSU &&
+	    (caps & (1UL << VIRTIO_F_VERSION_1)))
+		caps |= 1UL << VIRTIO_F_RING_PACKED;
+
+	return caps;
+}
+
+/*
+ * For a packed ring, the desc, avail and used addresses the guest gave are
+ * those of the descriptor ring, the driver and the device event suppression
+ * structures.
+ */
+static int
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint64_t phys;
+	char *vb;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			vq->qsize * sizeof(struct virtio_packed_desc));
+	if (!vb)
+		return -1;
+	vq->pdesc = (struct virtio_packed_desc *)vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct virtio_packed_event));
+	if (!vb)
+		return -1;
+	vq->driver_event = (struct virtio_packed_event *)vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct virtio_packed_event));
+	if (!vb)
+		return -1;
+	vq->device_event = (struct virtio_packed_event *)vb;
+
+	free(vq->chain_len);
+	vq->chain_len = calloc(vq->qsize, sizeof(uint16_t));
+	if (vq->chain_len == NULL)
+		return -1;
+
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used = NULL;
+	vq->packed = true;
+
+	/* Both wrap counters start at 1. */
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_idx = 0;
+	vq->used_wrap = true;
+	vq->save_used = 0;
+	vq->save_used_wrap = true;
+	vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+
+	return 0;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -437,6 +837,13 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		if (virtio_vq_enable_packed(base, vq) != 0)
+			goto error;
+		goto done;
+	}
+	vq->packed = false;
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -466,6 +873,7 @@ virtio_vq_enable(struct virtio_base *base)
 	vq->last_avail = 0;
 	vq->save_used = 0;
 
+done:
 	/* Mark queue as enabled. */
 	vq->enabled = true;
 
@@ -485,24 +893,245 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
-	   struct iovec *iov, int n_iov, uint16_t *flags) {
+_vq_record_buf(int i, uint64_t addr, uint32_t len, uint16_t dflags,
+	   struct vmctx *ctx, struct iovec *iov, int n_iov, uint16_t *flags) {
 
 	void *host_addr;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	host_addr = paddr_guest2host(ctx, addr, len);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
-		flags[i] = vd->flags;
+		flags[i] = dflags;
 	return 0;
 }
+
+static inline int
+_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
+	   struct iovec *iov, int n_iov, uint16_t *flags) {
+
+	return _vq_record_buf(i, vd->addr, vd->len, vd->flags,
+			ctx, iov, n_iov, flags);
+}
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/* the flags a used descriptor of the packed ring gets */
+#define VQ_PACKED_USED_FLAGS(wrap) \
+	((wrap) ? ((1 << VRING_PACKED_DESC_F_AVAIL) | \
+		   (1 << VRING_PACKED_DESC_F_USED)) : 0)
+#define VQ_PACKED_DESC_FLAGS_MASK \
+	(VRING_DESC_F_NEXT | VRING_DESC_F_WRITE | VRING_DESC_F_INDIRECT)
+
+/*
+ * vq_getchain() for a packed ring: the chain is made of the consecutive
+ * descriptors from last_avail on, up to the first one without NEXT, and the
+ * buffer id the guest put in that last one is returned in *pidx. The flags
+ * returned keep only the bits common with the split ring descriptors.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct virtio_packed_desc *vd, *vindir;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	struct vmctx *ctx = base->dev->vmctx;
+	u_int n, n_indir, j;
+	uint16_t dflags, id;
+	int i = 0;
+
+	if (!vq_packed_desc_avail(vq))
+		return 0;
+	/* the descriptors are read only after the head's flags */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	for (n = 1; ; n++) {
+		if (n > vq->qsize) {
+			pr_err("%s: chain longer than the ring, "
+			    "driver confused?\r\n", name);
+			return -1;
+		}
+		vd = &vq->pdesc[vq->last_avail];
+		dflags = vd->flags;
+		id = vd->id;
+		if (++vq->last_avail == vq->qsize) {
+			vq->last_avail = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record_buf(i, vd->addr, vd->len,
+					dflags & VQ_PACKED_DESC_FLAGS_MASK,
+					ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				return -1;
+			}
+			i++;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0 ||
+		    (dflags & VRING_DESC_F_NEXT)) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n", name);
+			return -1;
+		} else {
+			n_indir = vd->len / 16;
+			if ((vd->len & 0xf) || n_indir == 0) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vd->len);
+				return -1;
+			}
+			vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+			if (!vindir) {
+				pr_err("%s cannot get host memory\r\n", name);
+				return -1;
+			}
+			/* a packed indirect table is used in order, in full */
+			for (j = 0; j < n_indir; j++) {
+				if (vindir[j].flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n", name);
+					return -1;
+				}
+				if (_vq_record_buf(i, vindir[j].addr, vindir[j].len,
+						vindir[j].flags & VQ_PACKED_DESC_FLAGS_MASK,
+						ctx, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n", name);
+					return -1;
+				}
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+		}
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+		if (i > VQ_MAX_DESCRIPTORS)
+			goto loopy;
+	}
+
+	if (id >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range, driver confused?\r\n",
+		    name, id);
+		return -1;
+	}
+	vq->chain_len[id] = n;
+	*pidx = id;
+	return i;
+
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+	return -1;
+}
+
+/*
+ * vq_getchain() past the check of the available index: there is a chain at
+ * last_avail, take it.
+ */
+static int
+vq_getchain_split(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	int i;
+	u_int n_indir, next;
+
+	volatile struct vring_desc *vdir, *vindir, *vp;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	struct vmctx *ctx;
+
+	/*
+	 * Now count/parse "involved" descriptors starting from
+	 * the head of the chain.
+	 *
+	 * To prevent loops, we could be more complicated and
+	 * check whether we're re-visiting a previously visited
+	 * index, but we just abort if the count gets excessive.
+	 */
+	ctx = base->dev->vmctx;
+	*pidx = next = vq->avail->ring[vq->last_avail & (vq->qsize - 1)];
+	vq->last_avail++;
+	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
+		if (next >= vq->qsize) {
+			pr_err("%s: descriptor index %u out of range, "
+			    "driver confused?\r\n",
+			    name, next);
+			return -1;
+		}
+		vdir = &vq->desc[next];
+		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				return -1;
+			}
+			i++;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		} else {
+			n_indir = vdir->len / 16;
+			if ((vdir->len & 0xf) || n_indir == 0) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vdir->len);
+				return -1;
+			}
+			vindir = paddr_guest2host(ctx,
+			    vdir->addr, vdir->len);
+
+			if (!vindir) {
+				pr_err("%s cannot get host memory\r\n", name);
+				return -1;
+			}
+			/*
+			 * Indirects start at the 0th, then follow
+			 * their own embedded "next"s until those run
+			 * out.  Each one's indirect flag must be off
+			 * (we don't really have to check, could just
+			 * ignore errors...).
+			 */
+			next = 0;
+			for (;;) {
+				vp = &vindir[next];
+				if (vp->flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n",
+					    name);
+					return -1;
+				}
+				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n", name);
+					return -1;
+				}
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+				if ((vp->flags & VRING_DESC_F_NEXT) == 0)
+					break;
+				next = vp->next;
+				if (next >= n_indir) {
+					pr_err("%s: invalid next %u > %u, "
+					    "driver confused?\r\n",
+					    name, (u_int)next, n_indir);
+					return -1;
+				}
+			}
+		}
+		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
+			return i;
+	}
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+	return -1;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -546,17 +1175,15 @@ int
 vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	    struct iovec *iov, int n_iov, uint16_t *flags)
 {
-	int i;
-	u_int ndesc, n_indir;
-	u_int idx, next;
-
-	volatile struct vring_desc *vdir, *vindir, *vp;
-	struct vmctx *ctx;
-	struct virtio_base *base;
-	const char *name;
-
-	base = vq->base;
-	name = base->vops->name;
+	u_int ndesc, idx;
+	int n;
+
+	if (vq->packed) {
+		n = vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+		if (n > 0)
+			vq_count_chain(vq, n);
+		return n;
+	}
 
 	/*
 	 * Note: it's the responsibility of the guest not to
@@ -578,96 +1205,67 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	if (ndesc > vq->qsize) {
 		/* XXX need better way to diagnose issues */
 		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
-		    name, (u_int)ndesc);
+		    vq->base->vops->name, (u_int)ndesc);
 		return -1;
 	}
 
-	/*
-	 * Now count/parse "involved" descriptors starting from
-	 * the head of the chain.
-	 *
-	 * To prevent loops, we could be more complicated and
-	 * check whether we're re-visiting a previously visited
-	 * index, but we just abort if the count gets excessive.
-	 */
-	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
-	vq->last_avail++;
-	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
-		if (next >= vq->qsize) {
-			pr_err("%s: descriptor index %u out of range, "
-			    "driver confused?\r\n",
-			    name, next);
-			return -1;
-		}
-		vdir = &vq->desc[next];
-		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
-				pr_err("%s: mapping to host failed\r\n", name);
-				return -1;
-			}
-			i++;
-		} else if ((base->device_caps &
-		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
-			pr_err("%s: descriptor has forbidden INDIRECT flag, "
-			    "driver confused?\r\n",
-			    name);
-			return -1;
-		} else {
-			n_indir = vdir->len / 16;
-			if ((vdir->len & 0xf) || n_indir == 0) {
-				pr_err("%s: invalid indir len 0x%x, "
-				    "driver confused?\r\n",
-				    name, (u_int)vdir->len);
-				return -1;
-			}
-			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+	n = vq_getchain_split(vq, pidx, iov, n_iov, flags);
+	if (n > 0)
+		vq_count_chain(vq, n);
+	return n;
+}
 
-			if (!vindir) {
-				pr_err("%s cannot get host memory\r\n", name);
-				return -1;
-			}
-			/*
-			 * Indirects start at the 0th, then follow
-			 * their own embedded "next"s until those run
-			 * out.  Each one's indirect flag must be off
-			 * (we don't really have to check, could just
-			 * ignore errors...).
-			 */
-			next = 0;
-			for (;;) {
-				vp = &vindir[next];
-				if (vp->flags & VRING_DESC_F_INDIRECT) {
-					pr_err("%s: indirect desc has INDIR flag,"
-					    " driver confused?\r\n",
-					    name);
-					return -1;
-				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
-					pr_err("%s: mapping to host failed\r\n", name);
-					return -1;
-				}
-				if (++i > VQ_MAX_DESCRIPTORS)
-					goto loopy;
-				if ((vp->flags & VRING_DESC_F_NEXT) == 0)
-					break;
-				next = vp->next;
-				if (next >= n_indir) {
-					pr_err("%s: invalid next %u > %u, "
-					    "driver confused?\r\n",
-					    name, (u_int)next, n_indir);
-					return -1;
-				}
-			}
+/*
+ * vq_getchain() for up to nchains chains. The available index of a split
+ * ring is read, and checked, once for the batch; a packed ring has no such
+ * index, each chain is found available by its own head.
+ */
+int
+vq_getchains_bulk(struct virtio_vq_info *vq, struct vq_chain *chains,
+	    int nchains, int n_iov)
+{
+	struct vq_chain *chain;
+	u_int ndesc;
+	int i, n;
+
+	if (nchains <= 0)
+		return 0;
+
+	if (!vq->packed) {
+		ndesc = (uint16_t)((u_int)vq->avail->idx - vq->last_avail);
+		if (ndesc == 0)
+			return 0;
+		if (ndesc > vq->qsize) {
+			pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+			    vq->base->vops->name, (u_int)ndesc);
+			chains[0].idx = vq->qsize;
+			chains[0].n = -1;
+			return 1;
 		}
-		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
-			return i;
+		/* the chains are read only after the index */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ((u_int)nchains > ndesc)
+			nchains = ndesc;
 	}
-loopy:
-	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
-	    name, i);
-	return -1;
+
+	for (i = 0; i < nchains; i++) {
+		chain = &chains[i];
+		chain->idx = vq->qsize;
+		if (vq->packed)
+			n = vq_getchain_packed(vq, &chain->idx, chain->iov,
+					n_iov, chain->flags);
+		else
+			n = vq_getchain_split(vq, &chain->idx, chain->iov,
+					n_iov, chain->flags);
+		if (n == 0)
+			break;
+		chain->n = n;
+		if (n < 0)
+			return i + 1;
+		vq_count_chain(vq, n);
+	}
+
+	return i;
 }
 
 /*
@@ -679,9 +1277,51 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
+	uint16_t last, id, n;
+
+	if (vq->packed) {
+		/*
+		 * The last descriptor of the chain, right before last_avail,
+		 * still holds its buffer id: the used descriptors written
+		 * since can't have reached a chain not released yet.
+		 */
+		last = (vq->last_avail ? vq->last_avail : vq->qsize) - 1;
+		id = vq->pdesc[last].id;
+		if (id >= vq->qsize)
+			return;
+		n = vq->chain_len[id];
+		if (vq->last_avail < n) {
+			vq->last_avail += vq->qsize - n;
+			vq->avail_wrap = !vq->avail_wrap;
+		} else
+			vq->last_avail -= n;
+		return;
+	}
 	vq->last_avail--;
 }
 
+/*
+ * vq_relchain() for a packed ring: write the used descriptor at used_idx,
+ * its flags last, and skip the descriptors the chain took in the ring.
+ */
+static void
+vq_relchain_packed(struct virtio_vq_info *vq, uint16_t id, uint32_t iolen)
+{
+	volatile struct virtio_packed_desc *vd;
+
+	vd = &vq->pdesc[vq->used_idx];
+	vd->id = id;
+	vd->len = iolen;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vd->flags = VQ_PACKED_USED_FLAGS(vq->used_wrap);
+
+	vq->used_idx += vq->chain_len[id];
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+}
+
 /*
  * Return specified request chain to the guest, setting its I/O length
  * to the provided value.
@@ -706,6 +1346,11 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->packed) {
+		vq_relchain_packed(vq, idx, iolen);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -716,6 +1361,60 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vuh->idx = uidx;
 }
 
+/*
+ * vq_relchain() for a batch of chains: a single barrier before the guest
+ * can see any of them, that is, before the used index of a split ring is
+ * moved or the flags of the first used descriptor of a packed ring are
+ * written.
+ */
+void
+vq_relchains_bulk(struct virtio_vq_info *vq, struct vq_chain *chains,
+	    int nchains)
+{
+	volatile struct virtio_packed_desc *vd, *first = NULL;
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+	uint16_t uidx, mask, first_flags = 0;
+	int i;
+
+	if (nchains <= 0)
+		return;
+
+	if (vq->packed) {
+		for (i = 0; i < nchains; i++) {
+			vd = &vq->pdesc[vq->used_idx];
+			vd->id = chains[i].idx;
+			vd->len = chains[i].len;
+			if (i == 0) {
+				first = vd;
+				first_flags = VQ_PACKED_USED_FLAGS(vq->used_wrap);
+			} else
+				vd->flags = VQ_PACKED_USED_FLAGS(vq->used_wrap);
+
+			vq->used_idx += vq->chain_len[chains[i].idx];
+			if (vq->used_idx >= vq->qsize) {
+				vq->used_idx -= vq->qsize;
+				vq->used_wrap = !vq->used_wrap;
+			}
+		}
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		first->flags = first_flags;
+		return;
+	}
+
+	mask = vq->qsize - 1;
+	vuh = vq->used;
+
+	uidx = vuh->idx;
+	for (i = 0; i < nchains; i++) {
+		vue = &vuh->ring[uidx++ & mask];
+		vue->id = chains[i].idx;
+		vue->len = chains[i].len;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vuh->idx = uidx;
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -731,6 +1430,48 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
  * processing -- it's possible that descriptors became available after
  * that point.  (It's also typically a constant 1/True as well.)
  */
+/*
+ * vq_endchains() for a packed ring, the driver event suppression structure
+ * either enables or disables the interrupts, or, with EVENT_IDX, asks for
+ * one once the used descriptor at <off_wrap> is written.
+ */
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base = vq->base;
+	uint16_t new_idx, old_idx, event_idx, off_wrap, delta;
+	bool old_wrap;
+	int intr;
+
+	/* the used descriptors are written before the event is read */
+	atomic_thread_fence();
+
+	old_idx = vq->save_used;
+	old_wrap = vq->save_used_wrap;
+	new_idx = vq->save_used = vq->used_idx;
+	vq->save_used_wrap = vq->used_wrap;
+	delta = (old_wrap == vq->used_wrap) ? (new_idx - old_idx) :
+		(new_idx + vq->qsize - old_idx);
+
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		intr = 1;
+	else if (delta == 0)
+		intr = 0;
+	else if (vq->driver_event->flags == VRING_PACKED_EVENT_FLAG_DESC) {
+		off_wrap = vq->driver_event->off_wrap;
+		event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		/* compare in the index space of the current wrap */
+		if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+			event_idx -= vq->qsize;
+		intr = (uint16_t)(new_idx - event_idx - 1) < delta;
+	} else
+		intr = vq->driver_event->flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	if (intr)
+		vq_coalesce_interrupt(base, vq, delta);
+}
+
 void
 vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 {
@@ -738,6 +1479,12 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	uint16_t event_idx, new_idx, old_idx;
 	int intr;
 
+	if (vq && vq->packed) {
+		if (vq_ring_ready(vq))
+			vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
+
 	if (!vq || !vq->used)
 		return;
 
@@ -772,7 +1519,7 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 		    !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
 	}
 	if (intr)
-		vq_interrupt(base, vq);
+		vq_coalesce_interrupt(base, vq, (uint16_t)(new_idx - old_idx));
 }
 
 /**
@@ -794,7 +1541,18 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
-	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vq->packed)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	else
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+}
+
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->packed)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
@@ -1085,6 +1843,7 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
+		vq_count_kick(vq);
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
 		else if (vops->qnotify)
@@ -1395,9 +2154,9 @@ virtio_common_cfg_read(struct pci_vdev *dev, uint64_t offset, int size)
 		break;
 	case VIRTIO_PCI_COMMON_DF:
 		if (base->device_feature_select == 0)
-			value = base->device_caps & 0xffffffff;
+			value = virtio_device_caps(base) & 0xffffffff;
 		else if (base->device_feature_select == 1)
-			value = (base->device_caps >> 32) & 0xffffffff;
+			value = (virtio_device_caps(base) >> 32) & 0xffffffff;
 		else /* present 0, see 4.1.4.3.1 */
 			value = 0;
 		break;
@@ -1521,11 +2280,11 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 		if (base->driver_feature_select < 2) {
 			value &= 0xffffffff;
 			if (base->driver_feature_select == 0) {
-				features = base->device_caps & value;
+				features = virtio_device_caps(base) & value;
 				base->negotiated_caps &= ~0xffffffffULL;
 			} else {
 				features = (value << 32)
-					& base->device_caps;
+					& virtio_device_caps(base);
 				base->negotiated_caps &= 0xffffffffULL;
 			}
 			base->negotiated_caps |= features;
@@ -1722,6 +2481,7 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
+	vq_count_kick(vq);
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1876,6 +2636,7 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		pthread_mutex_lock(base->mtx);
 
 	vq = &base->queues[idx];
+	vq_count_kick(vq);
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1983,6 +2744,395 @@ virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		base->vops->name, baridx);
 }
 
+/**
+ * @brief Warm reset of a virtio device.
+ *
+ * Reset the device as a guest driver writing 0 to its status does, its
+ * backend is kept.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ */
+void
+virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+
+	base->status = 0;
+	if (vops->set_status)
+		(*vops->set_status)(DEV_STRUCT(base), 0);
+	if (vops->reset)
+		(*vops->reset)(DEV_STRUCT(base));
+	else
+		virtio_reset_dev(base);
+
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
+/* The state of a virtio device in a snapshot, its queues follow */
+struct virtio_snapshot {
+	uint64_t negotiated_caps;
+	uint32_t device_feature_select;
+	uint32_t driver_feature_select;
+	int32_t curq;
+	int32_t nvq;
+	uint16_t msix_cfg_idx;
+	uint8_t status;
+	uint8_t isr;
+	uint8_t config_generation;
+	uint8_t reserved[7];
+};
+
+struct virtio_vq_snapshot {
+	uint16_t qsize;
+	uint16_t flags;
+	uint16_t last_avail;
+	uint16_t save_used;
+	uint16_t msix_idx;
+	uint16_t used_idx;
+	uint16_t device_event_flags;
+	uint8_t enabled;
+	uint8_t packed;
+	uint8_t avail_wrap;
+	uint8_t used_wrap;
+	uint8_t save_used_wrap;
+	uint8_t reserved;
+	uint32_t pfn;
+	uint32_t gpa_desc[2];
+	uint32_t gpa_avail[2];
+	uint32_t gpa_used[2];
+};
+
+/* Has every chain taken from vq been given back? */
+static bool
+vq_drained(struct virtio_vq_info *vq)
+{
+	if (!vq_ring_ready(vq))
+		return true;
+	if (vq->packed)
+		return vq->last_avail == vq->used_idx && vq->avail_wrap == vq->used_wrap;
+	return vq->last_avail == vq->used->idx;
+}
+
+/**
+ * @brief Save the state of a virtio device to a snapshot.
+ *
+ * The state of the queues is saved once the requests the device took are
+ * done, the rings themselves are in the guest memory. The kernel backends
+ * keep the state of their rings, they can't be saved.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param fd The snapshot file.
+ *
+ * @return 0 on success, -EBUSY if requests are in flight, another -errno on
+ * other errors.
+ */
+int
+virtio_pci_save(struct vmctx *ctx, struct pci_vdev *dev, int fd)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_snapshot vs;
+	struct virtio_vq_snapshot vqs;
+	struct virtio_vq_info *vq;
+	int i, err = 0;
+
+	if (base->backend_type != BACKEND_VBSU) {
+		pr_err("%s: %s has a kernel backend\n", __func__, base->vops->name);
+		return -ENOTSUP;
+	}
+
+	VIRTIO_BASE_LOCK(base);
+	for (i = 0; i < base->vops->nvq; i++) {
+		if (!vq_drained(&base->queues[i])) {
+			VIRTIO_BASE_UNLOCK(base);
+			return -EBUSY;
+		}
+	}
+
+	memset(&vs, 0, sizeof(vs));
+	vs.negotiated_caps = base->negotiated_caps;
+	vs.device_feature_select = base->device_feature_select;
+	vs.driver_feature_select = base->driver_feature_select;
+	vs.curq = base->curq;
+	vs.nvq = base->vops->nvq;
+	vs.msix_cfg_idx = base->msix_cfg_idx;
+	vs.status = base->status;
+	vs.isr = base->isr;
+	vs.config_generation = base->config_generation;
+	err = snapshot_write(fd, &vs, sizeof(vs));
+
+	for (i = 0; (i < base->vops->nvq) && (err == 0); i++) {
+		vq = &base->queues[i];
+		memset(&vqs, 0, sizeof(vqs));
+		vqs.qsize = vq->qsize;
+		vqs.flags = vq->flags;
+		vqs.last_avail = vq->last_avail;
+		vqs.save_used = vq->save_used;
+		vqs.msix_idx = vq->msix_idx;
+		vqs.used_idx = vq->used_idx;
+		if (vq_ring_ready(vq) && vq->packed)
+			vqs.device_event_flags = vq->device_event->flags;
+		vqs.enabled = vq->enabled;
+		vqs.packed = vq->packed;
+		vqs.avail_wrap = vq->avail_wrap;
+		vqs.used_wrap = vq->used_wrap;
+		vqs.save_used_wrap = vq->save_used_wrap;
+		vqs.pfn = vq->pfn;
+		memcpy(vqs.gpa_desc, vq->gpa_desc, sizeof(vqs.gpa_desc));
+		memcpy(vqs.gpa_avail, vq->gpa_avail, sizeof(vqs.gpa_avail));
+		memcpy(vqs.gpa_used, vq->gpa_used, sizeof(vqs.gpa_used));
+		err = snapshot_write(fd, &vqs, sizeof(vqs));
+	}
+	VIRTIO_BASE_UNLOCK(base);
+
+	return err;
+}
+
+/**
+ * @brief Restore the state of a virtio device from a snapshot.
+ *
+ * The guest memory is restored already: the queues are mapped again as the
+ * guest driver set them up, and the device is told the features and the
+ * status the guest driver set.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param fd The snapshot file.
+ *
+ * @return 0 on success, -errno on errors.
+ */
+int
+virtio_pci_restore(struct vmctx *ctx, struct pci_vdev *dev, int fd)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+	struct virtio_snapshot vs;
+	struct virtio_vq_snapshot vqs;
+	struct virtio_vq_info *vq;
+	int i, err;
+
+	err = snapshot_read(fd, &vs, sizeof(vs));
+	if (err < 0)
+		return err;
+	if (vs.nvq != vops->nvq) {
+		pr_err("%s: %s has %d queues, not %d\n", __func__, vops->name, vops->nvq, vs.nvq);
+		return -EINVAL;
+	}
+
+	VIRTIO_BASE_LOCK(base);
+	base->negotiated_caps = vs.negotiated_caps;
+	base->device_feature_select = vs.device_feature_select;
+	base->driver_feature_select = vs.driver_feature_select;
+	base->msix_cfg_idx = vs.msix_cfg_idx;
+	base->status = vs.status;
+	base->isr = vs.isr;
+	base->config_generation = vs.config_generation;
+
+	for (i = 0; (i < vops->nvq) && (err == 0); i++) {
+		err = snapshot_read(fd, &vqs, sizeof(vqs));
+		if (err < 0)
+			break;
+
+		if ((vqs.qsize == 0) || ((vqs.qsize & (vqs.qsize - 1)) != 0)) {
+			err = -EINVAL;
+			break;
+		}
+
+		vq = &base->queues[i];
+		vq->qsize = vqs.qsize;
+		vq->msix_idx = vqs.msix_idx;
+		vq->enabled = vqs.enabled;
+		memcpy(vq->gpa_desc, vqs.gpa_desc, sizeof(vq->gpa_desc));
+		memcpy(vq->gpa_avail, vqs.gpa_avail, sizeof(vq->gpa_avail));
+		memcpy(vq->gpa_used, vqs.gpa_used, sizeof(vq->gpa_used));
+		if ((vqs.flags & VQ_ALLOC) == 0)
+			continue;
+
+		base->curq = i;
+		if (vqs.pfn != 0)
+			virtio_vq_init(base, vqs.pfn);
+		else
+			virtio_vq_enable(base);
+		if (!vq_ring_ready(vq)) {
+			err = -EINVAL;
+			break;
+		}
+
+		vq->last_avail = vqs.last_avail;
+		vq->save_used = vqs.save_used;
+		vq->used_idx = vqs.used_idx;
+		vq->avail_wrap = vqs.avail_wrap;
+		vq->used_wrap = vqs.used_wrap;
+		vq->save_used_wrap = vqs.save_used_wrap;
+		if (vq->packed)
+			vq->device_event->flags = vqs.device_event_flags;
+	}
+	base->curq = vs.curq;
+
+	if (err == 0) {
+		if (vops->apply_features)
+			(*vops->apply_features)(DEV_STRUCT(base), base->negotiated_caps);
+		if (vops->set_status)
+			(*vops->set_status)(DEV_STRUCT(base), base->status);
+		if (base->iothread && (base->status & VIRTIO_CONFIG_S_DRIVER_OK))
+			virtio_set_iothread(base, true);
+	}
+	VIRTIO_BASE_UNLOCK(base);
+
+	return err;
+}
+
+/**
+ * @brief Get how many descriptors of a queue of a virtio device wait.
+ *
+ * Only the queues the device model serves itself are reported, the indexes
+ * are read without the device lock, as a sample for the monitor.
+ *
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param idx Index of the queue.
+ * @param pending Where to store the chains made available, not taken yet.
+ * @param inflight Where to store the chains taken, not used yet.
+ *
+ * @return size of the queue, 0 if it is not set up, -1 if there is no such
+ * queue served by the device model.
+ */
+int
+virtio_vq_depth(struct pci_vdev *dev, int idx, uint16_t *pending,
+		uint16_t *inflight)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+
+	if (dev->dev_ops == NULL || dev->arg == NULL ||
+	    strncmp(dev->dev_ops->class_name, "virtio-", strlen("virtio-")))
+		return -1;
+
+	base = dev->arg;
+	if (base->backend_type != BACKEND_VBSU || base->queues == NULL ||
+	    idx >= base->vops->nvq)
+		return -1;
+
+	vq = &base->queues[idx];
+	*pending = 0;
+	*inflight = 0;
+	if (!vq_ring_ready(vq))
+		return 0;
+
+	if (vq->packed) {
+		/* the chains of a packed ring can't be counted from indexes */
+		*pending = vq_packed_desc_avail(vq) ? 1 : 0;
+	} else {
+		*pending = (uint16_t)(vq->avail->idx - vq->last_avail);
+		*inflight = (uint16_t)(vq->last_avail - vq->used->idx);
+	}
+
+	return vq->qsize;
+}
+
+/* the virtio_base of a device the DM emulates in user space, or NULL */
+static struct virtio_base *
+virtio_vbsu_base(struct pci_vdev *dev)
+{
+	struct virtio_base *base;
+
+	if (dev == NULL || dev->dev_ops == NULL || dev->arg == NULL ||
+	    strncmp(dev->dev_ops->class_name, "virtio-", strlen("virtio-")))
+		return NULL;
+
+	base = dev->arg;
+	if (base->backend_type != BACKEND_VBSU || base->queues == NULL)
+		return NULL;
+	return base;
+}
+
+int
+virtio_get_stats(char *buf, size_t len)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	struct virtio_coalesce *co;
+	cJSON *root, *list, *obj, *queues, *qobj;
+	uint64_t chains, descs;
+	char *out;
+	int slot, i, ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	cJSON_AddNumberToObject(root, "ack", 0);
+	list = cJSON_AddArrayToObject(root, "devices");
+
+	for (slot = 0; list != NULL && slot <= PCI_SLOTMAX; slot++) {
+		base = virtio_vbsu_base(pci_get_vdev_info(slot));
+		if (base == NULL)
+			continue;
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+		cJSON_AddNumberToObject(obj, "slot", slot);
+		cJSON_AddStringToObject(obj, "name", base->vops->name);
+		co = base->queues[0].coalesce;
+		if (co != NULL) {
+			cJSON_AddNumberToObject(obj, "coalesce_frames", co->opts.max_frames);
+			cJSON_AddNumberToObject(obj, "coalesce_usecs", co->opts.max_usecs);
+			cJSON_AddBoolToObject(obj, "coalesce_adaptive", co->opts.adaptive);
+		}
+		queues = cJSON_AddArrayToObject(obj, "queues");
+
+		/* the counters are read unlocked, as a snapshot */
+		for (i = 0; queues != NULL && i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			qobj = cJSON_CreateObject();
+			if (qobj == NULL)
+				break;
+			chains = __atomic_load_n(&vq->stats.chains, __ATOMIC_RELAXED);
+			descs = __atomic_load_n(&vq->stats.descs, __ATOMIC_RELAXED);
+			cJSON_AddNumberToObject(qobj, "queue", i);
+			cJSON_AddNumberToObject(qobj, "qsize", vq->qsize);
+			cJSON_AddNumberToObject(qobj, "kicks",
+				(double)__atomic_load_n(&vq->stats.kicks, __ATOMIC_RELAXED));
+			cJSON_AddNumberToObject(qobj, "interrupts",
+				(double)__atomic_load_n(&vq->stats.intrs, __ATOMIC_RELAXED));
+			cJSON_AddNumberToObject(qobj, "chains", (double)chains);
+			cJSON_AddNumberToObject(qobj, "avg_chain_len",
+				chains ? (double)descs / chains : 0.0);
+			cJSON_AddNumberToObject(qobj, "ring_full",
+				(double)__atomic_load_n(&vq->stats.ring_full, __ATOMIC_RELAXED));
+			cJSON_AddItemToArray(queues, qobj);
+		}
+		cJSON_AddItemToArray(list, obj);
+	}
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
+}
+
+int
+virtio_set_coalesce(int slot, const struct virtio_coalesce_opts *co)
+{
+	struct virtio_base *base;
+
+	base = virtio_vbsu_base(pci_get_vdev_info(slot));
+	if (base == NULL) {
+		pr_err("%s: no virtio device of the DM at slot %d\n", __func__, slot);
+		return -1;
+	}
+	return virtio_coalesce_update(base, co);
+}
+
 /**
  * @brief Get the virtio poll parameters
  *
@@ -2046,6 +3196,9 @@ int virtio_register_ioeventfd(struct virtio_base *base, int idx, bool is_registe
 			return -1;
 		}
 	} else {
+		/* the notifications go to the ioeventfd, not posted to the DM */
+		if (is_register)
+			pci_emul_set_bar_posted(base->dev, base->legacy_pio_bar_idx, 0, 0);
 		bar = &base->dev->bar[base->legacy_pio_bar_idx];
 		ioeventfd.data = idx;
 		ioeventfd.addr = bar->addr + VIRTIO_PCI_QUEUE_NOTIFY;
@@ -8,6 +8,11 @@
 /*
  * virtio audio
  * audio mediator device model
+ *
+ * Only the setup of the device is here: the virtqueues, and so the PCM
+ * data, the periods and their interrupts, are handled by the VBS-K backend
+ * in the Service VM kernel (/dev/vbs_k_audio), which signals the guest
+ * through the MSI-X vectors given to it below.
  */
 
 #include <err.h>
@@ -244,6 +249,9 @@ virtio_audio_k_set_status(void *base, uint64_t status)
 					2);
 
 		for (i = 0; i < nvq; i++) {
+			/* not the vector of the previous queue */
+			msix_addr = 0;
+			msix_data = 0;
 			if (virt_audio->vq[i].msix_idx
 				!= VIRTIO_MSI_NO_VECTOR) {
 				j = virt_audio->vq[i].msix_idx;
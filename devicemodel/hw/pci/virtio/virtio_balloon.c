@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio balloon, giving the memory a post-launched VM doesn't use back to
+ * the huge page pool of the Service VM.
+ *
+ * The guest RAM is tracked in 2M blocks, the huge pages of the lowmem and the
+ * highmem. A block is released, taken out of the EPT and punched out of its
+ * hugetlb file, once the guest inflated all of its 4K pages or reported it
+ * free on the reporting queue (VIRTIO_BALLOON_F_REPORTING, the "reporting"
+ * option). The blocks of the 1G huge pages are never released.
+ *
+ * A released block is populated again when the guest deflates a page of it
+ * or, for a reported block the guest allocated again, on its first access:
+ * the access misses the EPT and comes to the fallback MMIO handler of the
+ * guest RAM.
+ *
+ * The blocks are not released while a pass-through device is assigned, its
+ * DMA goes through the EPT, nor for an RTVM.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vmmapi.h"
+#include "mem.h"
+
+#define VIRTIO_BALLOON_RINGSZ		128
+#define VIRTIO_BALLOON_MAXSEGS		32
+
+/* the queues, the reporting one is used only with VIRTIO_BALLOON_F_REPORTING */
+#define VIRTIO_BALLOON_INFLATEQ		0
+#define VIRTIO_BALLOON_DEFLATEQ		1
+#define VIRTIO_BALLOON_REPORTQ		2
+#define VIRTIO_BALLOON_MAXQ		3
+
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	2	/* deflate on guest OOM */
+#define VIRTIO_BALLOON_F_REPORTING	5	/* free page reporting queue */
+
+#define VIRTIO_BALLOON_S_HOSTCAPS	(1UL << VIRTIO_BALLOON_F_DEFLATE_ON_OOM)
+
+/* the balloon talks in 4K pages, whatever the page size of the guest */
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+#define BALLOON_BLOCK_SHIFT		21
+#define BALLOON_BLOCK_SIZE		(1UL << BALLOON_BLOCK_SHIFT)
+#define BALLOON_BLOCK_PAGES		(1U << (BALLOON_BLOCK_SHIFT - VIRTIO_BALLOON_PFN_SHIFT))
+
+struct virtio_balloon_config {
+	uint32_t num_pages;	/* target, set by the device */
+	uint32_t actual;	/* pages in the balloon, set by the driver */
+} __attribute__((packed));
+
+struct balloon_block {
+	uint16_t inflated;	/* 4K pages of the block in the balloon */
+	bool released;		/* out of the EPT, its huge page freed */
+};
+
+/* adjacent blocks to release, one ioctl and one EPT flush for all */
+struct balloon_batch {
+	uint64_t start;
+	uint64_t nr;
+	bool allowed;
+};
+
+struct virtio_balloon {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_BALLOON_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_balloon_config cfg;
+	struct vmctx *ctx;
+
+	pthread_mutex_t blk_mtx;	/* the blocks, for the queues and the fallback */
+	struct balloon_block *blocks;
+	uint64_t nr_blocks;
+	uint64_t nr_released;
+	struct mem_range ram_lo;
+	struct mem_range ram_hi;
+};
+
+static int virtio_balloon_debug;
+#define DPRINTF(params) do { if (virtio_balloon_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+static void virtio_balloon_reset(void *);
+static void virtio_balloon_notify(void *, struct virtio_vq_info *);
+static int virtio_balloon_cfgread(void *, int, int, uint32_t *);
+static int virtio_balloon_cfgwrite(void *, int, int, uint32_t);
+
+static struct virtio_ops virtio_balloon_ops = {
+	"virtio_balloon",		/* our name */
+	VIRTIO_BALLOON_MAXQ,		/* we support 3 virtqueues */
+	sizeof(struct virtio_balloon_config), /* config reg size */
+	virtio_balloon_reset,		/* reset */
+	virtio_balloon_notify,		/* device-wide qnotify */
+	virtio_balloon_cfgread,		/* read virtio config */
+	virtio_balloon_cfgwrite,	/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
+/* @pre bl->blk_mtx is held */
+static void
+virtio_balloon_flush(struct virtio_balloon *bl, struct balloon_batch *batch)
+{
+	uint64_t i;
+
+	if (batch->nr == 0)
+		return;
+
+	if (batch->allowed && vm_release_ram(bl->ctx,
+			batch->start << BALLOON_BLOCK_SHIFT,
+			batch->nr << BALLOON_BLOCK_SHIFT) == 0) {
+		for (i = batch->start; i < batch->start + batch->nr; i++)
+			bl->blocks[i].released = true;
+		bl->nr_released += batch->nr;
+		DPRINTF(("%s: released 0x%lx blocks at 0x%lx\n", __func__,
+			 batch->nr, batch->start << BALLOON_BLOCK_SHIFT));
+	}
+	batch->nr = 0;
+}
+
+/* @pre bl->blk_mtx is held */
+static void
+virtio_balloon_release(struct virtio_balloon *bl, struct balloon_batch *batch,
+		       uint64_t block)
+{
+	if (bl->blocks[block].released)
+		return;
+
+	if (batch->nr > 0 && block != batch->start + batch->nr)
+		virtio_balloon_flush(bl, batch);
+	if (batch->nr == 0)
+		batch->start = block;
+	batch->nr++;
+}
+
+/* @pre bl->blk_mtx is held */
+static int
+virtio_balloon_populate(struct virtio_balloon *bl, uint64_t block)
+{
+	if (!bl->blocks[block].released)
+		return 0;
+
+	if (vm_populate_ram(bl->ctx, block << BALLOON_BLOCK_SHIFT,
+			BALLOON_BLOCK_SIZE) < 0)
+		return -1;
+	bl->blocks[block].released = false;
+	bl->nr_released--;
+	return 0;
+}
+
+static void
+virtio_balloon_do_pfns(struct virtio_balloon *bl, struct virtio_vq_info *vq,
+		       bool inflate)
+{
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	struct balloon_batch batch = { .nr = 0, .allowed = !pci_has_passthrough() };
+	struct balloon_block *blk;
+	uint32_t *pfns;
+	uint64_t block;
+	uint16_t idx;
+	size_t j;
+	int i, n;
+
+	pthread_mutex_lock(&bl->blk_mtx);
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n <= 0) {
+			WPRINTF(("%s: invalid descriptors\n", __func__));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			pfns = iov[i].iov_base;
+			for (j = 0; j < iov[i].iov_len / sizeof(uint32_t); j++) {
+				block = (uint64_t)pfns[j] >>
+					(BALLOON_BLOCK_SHIFT - VIRTIO_BALLOON_PFN_SHIFT);
+				if (block >= bl->nr_blocks)
+					continue;
+				blk = &bl->blocks[block];
+				if (inflate) {
+					if (blk->inflated < BALLOON_BLOCK_PAGES &&
+					    ++blk->inflated == BALLOON_BLOCK_PAGES)
+						virtio_balloon_release(bl, &batch, block);
+				} else {
+					if (blk->inflated > 0)
+						blk->inflated--;
+					/* the guest uses the page right after */
+					if (virtio_balloon_populate(bl, block) < 0)
+						WPRINTF(("%s: can't populate 0x%lx\n",
+							 __func__, block << BALLOON_BLOCK_SHIFT));
+				}
+			}
+		}
+		vq_relchain(vq, idx, 0);
+	}
+	virtio_balloon_flush(bl, &batch);
+	pthread_mutex_unlock(&bl->blk_mtx);
+
+	vq_endchains(vq, 1);
+}
+
+/* a reported range is free in the guest, its whole blocks are released */
+static void
+virtio_balloon_do_report(struct virtio_balloon *bl, struct virtio_vq_info *vq)
+{
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	struct balloon_batch batch = { .nr = 0, .allowed = !pci_has_passthrough() };
+	uint64_t gpa, start, end, block;
+	uint16_t idx;
+	int i, n;
+
+	pthread_mutex_lock(&bl->blk_mtx);
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n <= 0) {
+			WPRINTF(("%s: invalid descriptors\n", __func__));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			gpa = (uint64_t)((char *)iov[i].iov_base - bl->ctx->baseaddr);
+			start = (gpa + BALLOON_BLOCK_SIZE - 1) >> BALLOON_BLOCK_SHIFT;
+			end = MIN((gpa + iov[i].iov_len) >> BALLOON_BLOCK_SHIFT,
+				  bl->nr_blocks);
+			for (block = start; block < end; block++)
+				virtio_balloon_release(bl, &batch, block);
+		}
+		vq_relchain(vq, idx, 0);
+	}
+	virtio_balloon_flush(bl, &batch);
+	pthread_mutex_unlock(&bl->blk_mtx);
+
+	vq_endchains(vq, 1);
+}
+
+static void
+virtio_balloon_notify(void *base, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *bl = base;
+
+	switch (vq - bl->queues) {
+	case VIRTIO_BALLOON_INFLATEQ:
+		virtio_balloon_do_pfns(bl, vq, true);
+		break;
+	case VIRTIO_BALLOON_DEFLATEQ:
+		virtio_balloon_do_pfns(bl, vq, false);
+		break;
+	case VIRTIO_BALLOON_REPORTQ:
+		virtio_balloon_do_report(bl, vq);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * A guest access to a released block, out of the EPT: the block is
+ * populated and mapped again, this access is done on the DM mapping.
+ */
+static int
+virtio_balloon_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
+			   int size, uint64_t *val, void *arg1, long arg2)
+{
+	struct virtio_balloon *bl = arg1;
+	void *hva;
+	int ret;
+
+	pthread_mutex_lock(&bl->blk_mtx);
+	ret = virtio_balloon_populate(bl, addr >> BALLOON_BLOCK_SHIFT);
+	pthread_mutex_unlock(&bl->blk_mtx);
+	if (ret < 0)
+		return -1;
+
+	hva = vm_map_gpa(ctx, addr, size);
+	if (hva == NULL)
+		return -1;
+
+	if (dir == MEM_F_READ) {
+		*val = 0;
+		memcpy(val, hva, size);
+	} else
+		memcpy(hva, val, size);
+
+	return 0;
+}
+
+static int
+virtio_balloon_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_balloon *bl = vdev;
+
+	memcpy(retval, (uint8_t *)&bl->cfg + offset, size);
+	return 0;
+}
+
+static int
+virtio_balloon_cfgwrite(void *vdev, int offset, int size, uint32_t val)
+{
+	struct virtio_balloon *bl = vdev;
+
+	/* num_pages is the device's */
+	if (offset != offsetof(struct virtio_balloon_config, actual) ||
+	    size != sizeof(bl->cfg.actual)) {
+		DPRINTF(("%s: write to read-only reg %d\n", __func__, offset));
+		return -1;
+	}
+	bl->cfg.actual = val;
+	return 0;
+}
+
+static void
+virtio_balloon_reset(void *base)
+{
+	struct virtio_balloon *bl = base;
+	uint64_t block;
+
+	DPRINTF(("virtio_balloon: device reset requested !\n"));
+	virtio_reset_dev(&bl->base);
+
+	/* the guest starts over with all its memory */
+	pthread_mutex_lock(&bl->blk_mtx);
+	for (block = 0; block < bl->nr_blocks; block++) {
+		bl->blocks[block].inflated = 0;
+		if (virtio_balloon_populate(bl, block) < 0)
+			WPRINTF(("%s: can't populate 0x%lx\n", __func__,
+				 block << BALLOON_BLOCK_SHIFT));
+	}
+	pthread_mutex_unlock(&bl->blk_mtx);
+	bl->cfg.actual = 0;
+}
+
+int
+virtio_balloon_set_target(int slot, int size_mb)
+{
+	struct pci_vdev *dev;
+	struct virtio_balloon *bl;
+	uint64_t pages;
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strcmp(dev->dev_ops->class_name, "virtio-balloon")) {
+		pr_err("%s: no virtio balloon at slot %d\n", __func__, slot);
+		return -1;
+	}
+	bl = dev->arg;
+
+	pages = (uint64_t)size_mb << (20 - VIRTIO_BALLOON_PFN_SHIFT);
+	if (pages > ((bl->ctx->lowmem + bl->ctx->highmem) >> VIRTIO_BALLOON_PFN_SHIFT)) {
+		pr_err("%s: %d MB is more than the guest memory\n", __func__, size_mb);
+		return -1;
+	}
+
+	bl->cfg.num_pages = pages;
+	virtio_config_changed(&bl->base);
+	return 0;
+}
+
+static int
+virtio_balloon_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bl;
+	pthread_mutexattr_t attr;
+	bool reporting = false;
+	char *opt;
+	int i, rc;
+
+	if (is_rtvm || lapic_pt) {
+		WPRINTF(("virtio_balloon: not supported for an RTVM\n"));
+		return -1;
+	}
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strcmp(opt, "reporting"))
+			reporting = true;
+		else {
+			WPRINTF(("virtio_balloon: invalid option %s\n", opt));
+			return -1;
+		}
+	}
+
+	bl = calloc(1, sizeof(struct virtio_balloon));
+	if (!bl) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		return -1;
+	}
+	bl->ctx = ctx;
+
+	bl->nr_blocks = (ctx->highmem > 0 ? ctx->highmem_gpa_base + ctx->highmem :
+			 ctx->lowmem) >> BALLOON_BLOCK_SHIFT;
+	bl->blocks = calloc(bl->nr_blocks, sizeof(struct balloon_block));
+	if (!bl->blocks) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		goto fail;
+	}
+
+	/* init mutex attribute properly */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	if (virtio_uses_msix()) {
+		rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_DEFAULT);
+		if (rc)
+			DPRINTF(("virtio_msix: mutexattr_settype failed with "
+				"error %d!\n", rc));
+	} else {
+		rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		if (rc)
+			DPRINTF(("virtio_intx: mutexattr_settype failed with "
+				"error %d!\n", rc));
+	}
+	rc = pthread_mutex_init(&bl->mtx, &attr);
+	if (rc)
+		DPRINTF(("mutex init failed with error %d!\n", rc));
+	pthread_mutex_init(&bl->blk_mtx, NULL);
+
+	virtio_linkup(&bl->base, &virtio_balloon_ops, bl, dev, bl->queues,
+		      BACKEND_VBSU);
+	bl->base.mtx = &bl->mtx;
+	bl->base.device_caps = VIRTIO_BALLOON_S_HOSTCAPS;
+	if (reporting)
+		bl->base.device_caps |= (1UL << VIRTIO_BALLOON_F_REPORTING);
+	for (i = 0; i < VIRTIO_BALLOON_MAXQ; i++)
+		bl->queues[i].qsize = VIRTIO_BALLOON_RINGSZ;
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+
+	if (virtio_interrupt_init(&bl->base, virtio_uses_msix()))
+		goto fail;
+	virtio_set_io_bar(&bl->base, 0);
+
+	/* the guest accesses to the released blocks */
+	bl->ram_lo.name = "balloon-lowmem";
+	bl->ram_lo.flags = MEM_F_RW | MEM_F_CONCURRENT;
+	bl->ram_lo.handler = virtio_balloon_mem_handler;
+	bl->ram_lo.arg1 = bl;
+	bl->ram_lo.base = 0;
+	bl->ram_lo.size = ctx->lowmem;
+	if (register_mem_fallback(&bl->ram_lo) != 0)
+		goto fail;
+	if (ctx->highmem > 0) {
+		bl->ram_hi = bl->ram_lo;
+		bl->ram_hi.name = "balloon-highmem";
+		bl->ram_hi.base = ctx->highmem_gpa_base;
+		bl->ram_hi.size = ctx->highmem;
+		if (register_mem_fallback(&bl->ram_hi) != 0) {
+			unregister_mem_fallback(&bl->ram_lo);
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	free(bl->blocks);
+	free(bl);
+	return -1;
+}
+
+static void
+virtio_balloon_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bl;
+
+	bl = dev->arg;
+	if (bl == NULL) {
+		DPRINTF(("%s: balloon is NULL\n", __func__));
+		return;
+	}
+
+	virtio_balloon_reset(bl);
+	unregister_mem_fallback(&bl->ram_lo);
+	if (ctx->highmem > 0)
+		unregister_mem_fallback(&bl->ram_hi);
+
+	DPRINTF(("%s: free struct virtio_balloon!\n", __func__));
+	free(bl->blocks);
+	free(bl);
+}
+
+struct pci_vdev_ops pci_ops_virtio_balloon = {
+	.class_name	= "virtio-balloon",
+	.vdev_init	= virtio_balloon_init,
+	.vdev_deinit	= virtio_balloon_deinit,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_balloon);
@@ -45,6 +45,7 @@
 
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
+#define VIRTIO_BLK_CHAIN_BATCH	8	/* chains fetched at once */
 
 #define VIRTIO_BLK_S_OK	0
 #define VIRTIO_BLK_S_IOERR	1
@@ -63,6 +64,7 @@
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 #define	VIRTIO_BLK_F_MQ		(1 << 12)	/* support more than one vq */
 #define	VIRTIO_BLK_F_DISCARD	(1 << 13)
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
 
 /*
  * Basic device capabilities
@@ -109,6 +111,13 @@ struct virtio_blk_config {
 	uint32_t max_discard_seg;
 	/* Discard commands must be aligned to this number of sectors. */
 	uint32_t discard_sector_alignment;
+	/* The maximum write zeroes sectors (in 512-byte sectors) for one segment */
+	uint32_t max_write_zeroes_sectors;
+	/* The maximum number of write zeroes segments */
+	uint32_t max_write_zeroes_seg;
+	/* Whether the write zeroes may deallocate the sectors */
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -121,6 +130,7 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
 #define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
@@ -223,7 +233,8 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq,
+		struct vq_chain *chain)
 {
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
@@ -231,12 +242,11 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	int err;
 	ssize_t iolen;
 	int writeop, type;
-	struct iovec iov[BLOCKIF_IOV_MAX + 2];
-	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct iovec *iov = chain->iov;
+	uint16_t idx = chain->idx, *flags = chain->flags;
 
 	qidx = vq - blk->vqs;
-	idx = vq->qsize;
-	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
+	n = chain->n;
 
 	/*
 	 * The first descriptor will be the read-only fixed header,
@@ -284,7 +294,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
 	writeop = ((type == VBH_OP_WRITE) ||
-			(type == VBH_OP_DISCARD));
+			(type == VBH_OP_DISCARD) ||
+			(type == VBH_OP_WRITE_ZEROES));
 
 	if (blk->dummy_bctxt) {
 		WPRINTF(("Block context invalid: Operation cannot be permitted!\n"));
@@ -316,7 +327,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	io->req.resid = iolen;
 
 	DPRINTF(("virtio_blk: %s op, %zd bytes, %d segs, offset %ld\n\r",
-		 writeop ? "write/discard" : "read/ident", iolen, i - 1,
+		 writeop ? "write/discard/zeroes" : "read/ident", iolen, i - 1,
 		 io->req.offset));
 
 	switch (type) {
@@ -348,6 +359,9 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	case VBH_OP_DISCARD:
 		err = blockif_discard(blk->bc, &io->req);
 		break;
+	case VBH_OP_WRITE_ZEROES:
+		err = blockif_write_zeroes(blk->bc, &io->req);
+		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
 		err = blockif_flush(blk->bc, &io->req);
@@ -372,6 +386,10 @@ static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
+	struct iovec iov[VIRTIO_BLK_CHAIN_BATCH][BLOCKIF_IOV_MAX + 2];
+	uint16_t flags[VIRTIO_BLK_CHAIN_BATCH][BLOCKIF_IOV_MAX + 2];
+	struct vq_chain chains[VIRTIO_BLK_CHAIN_BATCH];
+	int i, n;
 
 	if (!vq_has_descs(vq))
 		return;
@@ -386,11 +404,19 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 	 * So, after enable NOTIFY, need to check the queue again to dry the
 	 * requests in virtqueue.
 	 * */
+	for (i = 0; i < VIRTIO_BLK_CHAIN_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = flags[i];
+	}
+
 	do {
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&blk->base, vq);
 		mb();
 		do {
-			virtio_blk_proc(blk, vq);
+			n = vq_getchains_bulk(vq, chains,
+					VIRTIO_BLK_CHAIN_BATCH, BLOCKIF_IOV_MAX + 2);
+			for (i = 0; i < n; i++)
+				virtio_blk_proc(blk, vq, &chains[i]);
 		} while (vq_has_descs(vq));
 
 		vq_clear_used_ring_flags(&blk->base, vq);
@@ -410,6 +436,9 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blockif_candiscard(blk->bc))
 		caps |= VIRTIO_BLK_F_DISCARD;
 
+	if (blockif_canzero(blk->bc))
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
+
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
 
@@ -450,6 +479,12 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc);
 		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc);
 	}
+	if (blockif_canzero(blk->bc)) {
+		blk->cfg.max_write_zeroes_sectors = blockif_max_zero_sectors(blk->bc);
+		blk->cfg.max_write_zeroes_seg = blockif_max_zero_seg(blk->bc);
+		/* the ranges flagged unmap are punched, they read as zeroes */
+		blk->cfg.write_zeroes_may_unmap = 1;
+	}
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
@@ -484,6 +519,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_mutexattr_t attr;
 	int rc;
 	struct iothreads_option iot_opt;
+	struct virtio_coalesce_opts co_opt;
+	bool use_coalesce = false;
 
 	memset(&iot_opt, 0, sizeof(iot_opt));
 
@@ -518,9 +555,9 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 	if (strstr(opts, "nodisk") == NULL) {
 		/*
-		 * both ",iothread" and ",mq=int" are consumed by virtio-blk
-		 * and must be specified before any other opts which will
-		 * be used by blockif_open.
+		 * ",iothread", ",mq=int" and ",coalesce=..." are consumed by
+		 * virtio-blk and must be specified before any other opts which
+		 * will be used by blockif_open.
 		 */
 		char *p = opts_start;
 		while (opts_tmp != NULL) {
@@ -551,6 +588,14 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 						num_vqs = guest_cpu_num();
 				}
 				p = opts_tmp;
+			} else if (!strncmp(opt, "coalesce=", strlen("coalesce="))) {
+				strsep(&opt, "=");
+				if (virtio_coalesce_parse_options(opt, &co_opt) < 0) {
+					free(opts_start);
+					return -1;
+				}
+				use_coalesce = true;
+				p = opts_tmp;
 			} else {
 				/* The opts_start is truncated by strsep, opts_tmp is also
 				 * changed by strsetp, so use opts which points to the
@@ -566,8 +611,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			 * Creating more iothread instances than the number of virtqueues is not necessary.
 			 * - One or more vqs can be handled in one iothread.
 			 * - The mapping between virtqueues and iothreads is based on round robin.
+			 * - "auto" creates one for each vq: each vq has its iothread and
+			 *   its io_uring ring, the queues share no thread.
 			 */
-			if (iot_opt.num > num_vqs) {
+			if (iot_opt.per_queue || iot_opt.num > num_vqs) {
 				iot_opt.num = num_vqs;
 			}
 
@@ -585,7 +632,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		iothrds_info.ioctx_base = ioctx_base;
 		iothrds_info.num = iot_opt.num;
 
-		bctxt = blockif_open(p, bident, num_vqs, &iothrds_info);
+		bctxt = blockif_open(ctx, p, bident, num_vqs, &iothrds_info);
 		if (bctxt == NULL) {
 			pr_err("Could not open backing file");
 			free(opts_start);
@@ -657,7 +704,6 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	/* init virtio struct and virtqueues */
 	virtio_linkup(&blk->base, &(blk->ops), blk, dev, blk->vqs, BACKEND_VBSU);
-	blk->base.iothread = use_iothread;
 	blk->base.mtx = &blk->mtx;
 
 	for (j = 0; j < num_vqs; j++) {
@@ -665,9 +711,21 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		blk->vqs[j].notify = virtio_blk_notify;
 		if (use_iothread) {
 			blk->vqs[j].viothrd.ioctx = ioctx_base + j % (iot_opt.num);
+			/* never run at the same time as the io_uring completions of the queue */
+			if (bctxt != NULL)
+				blk->vqs[j].viothrd.iomvt.group = blockif_get_iomvt(bctxt, j);
 		}
 	}
 
+	if (use_coalesce && virtio_coalesce_init(&blk->base, &co_opt) < 0) {
+		if (!blk->dummy_bctxt)
+			blockif_close(blk->bc);
+		free(blk->ios);
+		free(blk->vqs);
+		free(blk);
+		return -1;
+	}
+
 	/*
 	 * Create an identifier for the backing file. Use parts of the
 	 * md5 sum of the filename
@@ -748,6 +806,7 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			blockif_close(bctxt);
 		}
 		virtio_reset_dev(&blk->base);
+		virtio_coalesce_deinit(&blk->base);
 		if (blk->ios)
 			free(blk->ios);
 		if (blk->vqs)
@@ -813,7 +872,7 @@ virtio_blk_cfgread(void *vdev, int offset, int size, uint32_t *retval)
 int
 virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 {
-	int error = -1;
+	int i, error = -1;
 	char bident[16];
 	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk = (struct virtio_blk *) dev->arg;
@@ -851,7 +910,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 
 	pr_err("name=%s, Path=%s, ident=%s\n", dev->name, newpath, bident);
 	/* update the bctxt for the virtio-blk device */
-	bctxt = blockif_open(newpath, bident, blk->num_vqs, &blk->iothrds_info);
+	bctxt = blockif_open(ctx, newpath, bident, blk->num_vqs, &blk->iothrds_info);
 	if (bctxt == NULL) {
 		pr_err("Error opening backing file\n");
 		goto end;
@@ -859,6 +918,10 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 
 	blk->bc = bctxt;
 	blk->dummy_bctxt = false;
+	if (blk->base.iothread) {
+		for (i = 0; i < blk->num_vqs; i++)
+			blk->vqs[i].viothrd.iomvt.group = blockif_get_iomvt(bctxt, i);
+	}
 
 	/* Update virtio-blk device configuration on valid file*/
 	virtio_blk_update_config_space(blk);
@@ -927,6 +990,9 @@ struct pci_vdev_ops pci_ops_virtio_blk = {
 	.vdev_init	= virtio_blk_init,
 	.vdev_deinit	= virtio_blk_deinit,
 	.vdev_barwrite	= virtio_pci_write,
-	.vdev_barread	= virtio_pci_read
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_restore	= virtio_pci_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_virtio_blk);
@@ -29,6 +29,7 @@
  */
 
 #include <sys/uio.h>
+#include <sys/queue.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -42,15 +43,20 @@
 #include <pthread.h>
 #include <termios.h>
 #include <limits.h>
+#include <poll.h>
+#include <cjson/cJSON.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "virtio_console.h"
 #include "mevent.h"
 
 #define	VIRTIO_CONSOLE_RINGSZ	64
 #define	VIRTIO_CONSOLE_MAXPORTS	16
 #define	VIRTIO_CONSOLE_MAXQ	(VIRTIO_CONSOLE_MAXPORTS * 2 + 2)
+#define	VIRTIO_CONSOLE_TX_BATCH	16	/* chains fetched and released at once */
+#define	VIRTIO_CONSOLE_TX_WAIT_MS	100	/* async writer, back end full */
 
 #define	VIRTIO_CONSOLE_DEVICE_READY	0
 #define	VIRTIO_CONSOLE_DEVICE_ADD	1
@@ -117,6 +123,26 @@ struct virtio_console_backend {
 	int				pts_fd;	/* only valid for PTY */
 	const char 			*portpath;
 	const char 			*socket_type;
+
+	/*
+	 * async: the chains of the port are written by tx_tid, which holds
+	 * them until the back end takes them rather than dropping the data.
+	 */
+	bool				async;
+	volatile int			closing;
+	int				tx_in_progress;
+	pthread_t			tx_tid;
+	pthread_mutex_t			tx_mtx;
+	pthread_cond_t			tx_cond;
+
+	/* set by the writer, read unlocked by virtio_console_get_stats() */
+	uint64_t			tx_bytes;
+	uint64_t			tx_chains;
+	uint64_t			tx_writes;	/* writev() calls */
+	uint64_t			tx_waits;	/* back end full */
+	uint64_t			drop_bytes;
+
+	LIST_ENTRY(virtio_console_backend) list;
 };
 
 struct virtio_console {
@@ -131,6 +157,8 @@ struct virtio_console {
 	struct virtio_console_port	ports[VIRTIO_CONSOLE_MAXPORTS];
 	struct virtio_console_config	*config;
 	int				ref_count;
+	bool				async;		/* for the backends parsed next */
+	volatile int			resetting;	/* set and checked outside lock */
 };
 
 struct virtio_console_config {
@@ -161,6 +189,10 @@ static void virtio_console_control_send(struct virtio_console *,
 static void virtio_console_announce_port(struct virtio_console_port *);
 static void virtio_console_open_port(struct virtio_console_port *, bool);
 static void virtio_console_teardown_backend(void *);
+static void virtio_console_backend_write(struct virtio_console_port *, void *,
+	struct iovec *, int);
+static void virtio_console_ping_writer(struct virtio_console *,
+	struct virtio_console_backend *, struct virtio_vq_info *);
 
 static struct virtio_ops virtio_console_ops = {
 	"vtcon",			/* our name */
@@ -185,15 +217,47 @@ static const char *virtio_console_be_table[VIRTIO_CONSOLE_BE_MAX] = {
 static struct termios virtio_console_saved_tio;
 static int virtio_console_saved_flags;
 
+static LIST_HEAD(, virtio_console_backend) virtio_console_be_list =
+	LIST_HEAD_INITIALIZER(virtio_console_be_list);
+static pthread_mutex_t virtio_console_be_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * If the asynchronous writer of the backend is active then stall until it
+ * is done.
+ */
+static void
+virtio_console_txwait(struct virtio_console_backend *be)
+{
+	pthread_mutex_lock(&be->tx_mtx);
+	while (be->tx_in_progress) {
+		pthread_mutex_unlock(&be->tx_mtx);
+		usleep(10000);
+		pthread_mutex_lock(&be->tx_mtx);
+	}
+	pthread_mutex_unlock(&be->tx_mtx);
+}
+
 static void
 virtio_console_reset(void *vdev)
 {
 	struct virtio_console *console;
+	struct virtio_console_backend *be;
+	int i;
 
 	console = vdev;
 
 	DPRINTF(("vtcon: device reset requested!\n"));
+
+	/* the writers give up the chains they hold before the rings go */
+	console->resetting = 1;
+	for (i = 0; i < console->nports; i++) {
+		be = console->ports[i].arg;
+		if (console->ports[i].enabled && be != NULL && be->async)
+			virtio_console_txwait(be);
+	}
+
 	virtio_reset_dev(&console->base);
+	console->resetting = 0;
 }
 
 static void
@@ -384,25 +448,42 @@ virtio_console_notify_tx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
-	struct iovec iov[1];
-	uint16_t idx;
-	uint16_t flags[8];
+	struct iovec iov[VIRTIO_CONSOLE_TX_BATCH][1];
+	uint16_t flags[VIRTIO_CONSOLE_TX_BATCH][1];
+	struct vq_chain chains[VIRTIO_CONSOLE_TX_BATCH];
+	int i, n;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
 
+	if (port != NULL && port->cb == virtio_console_backend_write &&
+	    port->arg != NULL &&
+	    ((struct virtio_console_backend *)port->arg)->async) {
+		virtio_console_ping_writer(console, port->arg, vq);
+		return;
+	}
+
+	for (i = 0; i < VIRTIO_CONSOLE_TX_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = flags[i];
+		chains[i].len = 0;
+	}
+
 	while (vq_has_descs(vq)) {
-		if (vq_getchain(vq, &idx, iov, 1, flags) < 1) {
-			pr_err("%s: fail to getchain!\n", __func__);
-			break;
+		n = vq_getchains_bulk(vq, chains, VIRTIO_CONSOLE_TX_BATCH, 1);
+		for (i = 0; i < n && chains[i].n >= 1; i++) {
+			if ((port != NULL) && (port->cb != NULL))
+				port->cb(port, port->arg, chains[i].iov, 1);
 		}
-		if ((port != NULL) && (port->cb != NULL))
-			port->cb(port, port->arg, iov, 1);
 
 		/*
-		 * Release this chain and handle more
+		 * Release these chains and handle more
 		 */
-		vq_relchain(vq, idx, 0);
+		vq_relchains_bulk(vq, chains, i);
+		if (i < n) {
+			pr_err("%s: fail to getchain!\n", __func__);
+			break;
+		}
 	}
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
@@ -419,7 +500,7 @@ virtio_console_notify_rx(void *vdev, struct virtio_vq_info *vq)
 	if (!port->rx_ready) {
 		port->rx_ready = 1;
 		if (vq_has_descs(vq)) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+			vq_set_used_ring_flags(&console->base, vq);
 		}
 	}
 }
@@ -528,20 +609,62 @@ clear:
 	}
 }
 
+/*
+ * The back end failed a write for another reason than being full: reset it
+ * as the read side does, a server socket waits for its next client.
+ */
+static void
+virtio_console_backend_write_fail(struct virtio_console_backend *be)
+{
+	if (errno == EBADF) {
+		if (be->be_type == VIRTIO_CONSOLE_BE_SOCKET && (be->socket_type == NULL
+			|| !strcmp(be->socket_type,"server"))) {
+			virtio_console_socket_clear(be);
+			return;
+		}
+	}
+	virtio_console_reset_backend(be);
+	WPRINTF(("vtcon: be write failed! errno = %d\n", errno));
+}
+
+static size_t
+virtio_console_iov_len(const struct iovec *iov, int niov)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
 static void
 virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 			     struct iovec *iov, int niov)
 {
 	struct virtio_console_backend *be;
+	size_t len;
 	int ret;
 
 	be = arg;
+	len = virtio_console_iov_len(iov, niov);
+	be->tx_chains++;
 
-	if (be->fd == -1)
+	if (be->fd == -1) {
+		be->drop_bytes += len;
 		return;
+	}
 
 	ret = writev(be->fd, iov, niov);
+	be->tx_writes++;
+	if (ret > 0) {
+		/* what a short write left is lost */
+		be->tx_bytes += ret;
+		be->drop_bytes += len - ret;
+	}
 	if (ret <= 0) {
+		be->drop_bytes += len;
+
 		/* Case 1:backend cannot receive more data. For example when pts is
 		 * not connected to any client, its tty buffer will become full.
 		 * In this case we just drop data from guest hvc console.
@@ -560,16 +683,237 @@ virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 		if (ret == -1 && (errno == EAGAIN || errno == ENOTCONN))
 			return;
 
-		if (ret == -1 && errno == EBADF) {
-			if (be->be_type == VIRTIO_CONSOLE_BE_SOCKET && (be->socket_type == NULL
-				|| !strcmp(be->socket_type,"server"))) {
-				virtio_console_socket_clear(be);
-				return;
+		virtio_console_backend_write_fail(be);
+	}
+}
+
+/*
+ * Write the chains with as few writev() as the back end allows, straight
+ * from the guest buffers. When it is full, wait for it to drain instead of
+ * dropping the data: the chains are held, and so is the guest once its ring
+ * is used up. Only a missing peer, an error, a reset or the close drop.
+ */
+static void
+virtio_console_write_chains(struct virtio_console *console,
+			    struct virtio_console_backend *be,
+			    struct iovec *iov, int niov)
+{
+	struct pollfd pfd;
+	ssize_t len;
+	int fd;
+
+	while (niov > 0) {
+		fd = be->fd;
+		if (fd == -1 || be->closing || console->resetting)
+			break;
+
+		len = writev(fd, iov, niov);
+		be->tx_writes++;
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				be->tx_waits++;
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				poll(&pfd, 1, VIRTIO_CONSOLE_TX_WAIT_MS);
+				continue;
 			}
+			/* no client yet, see virtio_console_backend_write() */
+			if (errno != ENOTCONN)
+				virtio_console_backend_write_fail(be);
+			break;
+		}
+
+		be->tx_bytes += len;
+		while (niov > 0 && (size_t)len >= iov->iov_len) {
+			len -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
 		}
-		virtio_console_reset_backend(be);
-		WPRINTF(("vtcon: be write failed! errno = %d\n", errno));
 	}
+
+	be->drop_bytes += virtio_console_iov_len(iov, niov);
+}
+
+static void
+virtio_console_ping_writer(struct virtio_console *console,
+			   struct virtio_console_backend *be,
+			   struct virtio_vq_info *vq)
+{
+	/*
+	 * Any ring entries to process?
+	 */
+	if (!vq_has_descs(vq))
+		return;
+
+	/* Signal the writer for processing */
+	pthread_mutex_lock(&be->tx_mtx);
+	vq_set_used_ring_flags(&console->base, vq);
+	if (be->tx_in_progress == 0)
+		pthread_cond_signal(&be->tx_cond);
+	pthread_mutex_unlock(&be->tx_mtx);
+}
+
+/*
+ * Asynchronous writer of a port: the guest kicks are off while it drains
+ * the ring, TX_BATCH chains per writev().
+ */
+static void *
+virtio_console_tx_thread(void *param)
+{
+	struct virtio_console_backend *be = param;
+	struct virtio_console *console = be->port->console;
+	struct virtio_vq_info *vq = virtio_console_port_to_vq(be->port, false);
+	struct iovec iov[VIRTIO_CONSOLE_TX_BATCH][1];
+	uint16_t flags[VIRTIO_CONSOLE_TX_BATCH][1];
+	struct vq_chain chains[VIRTIO_CONSOLE_TX_BATCH];
+	struct iovec wiov[VIRTIO_CONSOLE_TX_BATCH];
+	int i, n;
+
+	for (i = 0; i < VIRTIO_CONSOLE_TX_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = flags[i];
+		chains[i].len = 0;
+	}
+
+	pthread_mutex_lock(&be->tx_mtx);
+	for (;;) {
+		/* note - tx mutex is locked here */
+		be->tx_in_progress = 0;
+
+		/*
+		 * Checking the avail ring here serves two purposes:
+		 *  - avoid vring processing due to spurious wakeups
+		 *  - catch missing notifications before acquiring tx_mtx
+		 */
+		while (be->closing || console->resetting || !vq_has_descs(vq)) {
+			if (be->closing) {
+				pthread_mutex_unlock(&be->tx_mtx);
+				return NULL;
+			}
+			if (!console->resetting && vq_ring_ready(vq)) {
+				vq_clear_used_ring_flags(&console->base, vq);
+				/* memory barrier */
+				mb();
+				if (vq_has_descs(vq))
+					break;
+			}
+			pthread_cond_wait(&be->tx_cond, &be->tx_mtx);
+		}
+
+		vq_set_used_ring_flags(&console->base, vq);
+		be->tx_in_progress = 1;
+		pthread_mutex_unlock(&be->tx_mtx);
+
+		while (!be->closing && !console->resetting && vq_has_descs(vq)) {
+			n = vq_getchains_bulk(vq, chains, VIRTIO_CONSOLE_TX_BATCH, 1);
+			for (i = 0; i < n && chains[i].n >= 1; i++)
+				wiov[i] = chains[i].iov[0];
+			be->tx_chains += i;
+
+			virtio_console_write_chains(console, be, wiov, i);
+			vq_relchains_bulk(vq, chains, i);
+			if (i < n) {
+				pr_err("%s: fail to getchain!\n", __func__);
+				break;
+			}
+		}
+
+		/*
+		 * Generate an interrupt if needed.
+		 */
+		vq_endchains(vq, 1);
+
+		pthread_mutex_lock(&be->tx_mtx);
+	}
+}
+
+static int
+virtio_console_tx_start(struct virtio_console_backend *be)
+{
+	struct pci_vdev *dev = be->port->console->base.dev;
+	char tname[MAXCOMLEN + 1];
+
+	pthread_mutex_init(&be->tx_mtx, NULL);
+	pthread_cond_init(&be->tx_cond, NULL);
+	if (pthread_create(&be->tx_tid, NULL, virtio_console_tx_thread, be) != 0)
+		return -1;
+
+	snprintf(tname, sizeof(tname), "vtcon-%d:%d tx%d", dev->slot,
+		 dev->func, be->port->id);
+	pthread_setname_np(be->tx_tid, tname);
+	return 0;
+}
+
+/*
+ * Send signal to the writer and wait till it exits, the chains it holds
+ * are dropped.
+ */
+static void
+virtio_console_tx_stop(struct virtio_console_backend *be)
+{
+	void *jval;
+
+	pthread_mutex_lock(&be->tx_mtx);
+	be->closing = 1;
+	pthread_cond_broadcast(&be->tx_cond);
+	pthread_mutex_unlock(&be->tx_mtx);
+
+	pthread_join(be->tx_tid, &jval);
+}
+
+int
+virtio_console_get_stats(char *buf, size_t len)
+{
+	struct virtio_console_backend *be;
+	cJSON *root, *list, *obj;
+	char *out;
+	int ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	cJSON_AddNumberToObject(root, "ack", 0);
+	list = cJSON_AddArrayToObject(root, "ports");
+
+	pthread_mutex_lock(&virtio_console_be_list_mtx);
+	LIST_FOREACH(be, &virtio_console_be_list, list) {
+		if (list == NULL)
+			break;
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+
+		/* the counters are read unlocked, as a snapshot */
+		cJSON_AddStringToObject(obj, "name", be->port->name);
+		cJSON_AddStringToObject(obj, "backend",
+			virtio_console_be_table[be->be_type]);
+		cJSON_AddBoolToObject(obj, "async", be->async);
+		cJSON_AddBoolToObject(obj, "connected", be->fd != -1);
+		cJSON_AddNumberToObject(obj, "tx_bytes", (double)be->tx_bytes);
+		cJSON_AddNumberToObject(obj, "tx_chains", (double)be->tx_chains);
+		cJSON_AddNumberToObject(obj, "tx_writes", (double)be->tx_writes);
+		cJSON_AddNumberToObject(obj, "tx_waits", (double)be->tx_waits);
+		cJSON_AddNumberToObject(obj, "drop_bytes", (double)be->drop_bytes);
+		cJSON_AddItemToArray(list, obj);
+	}
+	pthread_mutex_unlock(&virtio_console_be_list_mtx);
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
 }
 
 static void
@@ -913,6 +1257,12 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 		goto out;
 	}
 
+	if (console->async && virtio_console_tx_start(be) == 0)
+		be->async = true;
+	else if (console->async)
+		WPRINTF(("vtcon: no writer thread for %s, writes are synchronous\n",
+			portname));
+
 	if (virtio_console_backend_can_read(be_type)) {
 		if (be->be_type == VIRTIO_CONSOLE_BE_SOCKET && (be->socket_type == NULL
 			|| !strcmp(be->socket_type,"server"))) {
@@ -943,9 +1293,15 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 	virtio_console_open_port(be->port, true);
 	be->open = true;
 
+	pthread_mutex_lock(&virtio_console_be_list_mtx);
+	LIST_INSERT_HEAD(&virtio_console_be_list, be, list);
+	pthread_mutex_unlock(&virtio_console_be_list_mtx);
+
 out:
 	if (error != 0) {
 		if (be) {
+			if (be->async)
+				virtio_console_tx_stop(be);
 			if (be->port) {
 				be->port->enabled = false;
 				be->port->arg = NULL;
@@ -966,12 +1322,27 @@ parse_fail:
 static int
 virtio_console_add_backends(struct virtio_console *console, char *opts)
 {
+	struct virtio_coalesce_opts co_opt;
 	char *opt;
 
-	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
+	/* virtio-console,[coalesce=<frames>:<usecs>[:adaptive],][async,]
+	 * [@]stdio|tty|pty|file:portname[=portpath]
 	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type]]
+	 *
+	 * async applies to the ports given after it.
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(opt, "coalesce=", 9)) {
+			if (console->queues[0].coalesce != NULL ||
+			    virtio_coalesce_parse_options(opt + 9, &co_opt) ||
+			    virtio_coalesce_init(&console->base, &co_opt))
+				return -1;
+			continue;
+		}
+		if (!strcmp(opt, "async")) {
+			console->async = true;
+			continue;
+		}
 		if (virtio_console_add_backend(console, opt))
 			return -1;
 	}
@@ -984,6 +1355,14 @@ virtio_console_close_backend(struct virtio_console_backend *be)
 	if (!be)
 		return;
 
+	pthread_mutex_lock(&virtio_console_be_list_mtx);
+	LIST_REMOVE(be, list);
+	pthread_mutex_unlock(&virtio_console_be_list_mtx);
+
+	/* the writer stops before the fds it writes to are closed */
+	if (be->async)
+		virtio_console_tx_stop(be);
+
 	switch (be->be_type) {
 	case VIRTIO_CONSOLE_BE_PTY:
 		if (be->pts_fd > 0) {
@@ -1193,6 +1572,7 @@ virtio_console_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	console = (struct virtio_console *)dev->arg;
 	if (console) {
+		virtio_coalesce_deinit(&console->base);
 		rc = virtio_console_close_all(console);
 		/*
 		 * if all the ports are without mevent attached,
@@ -1209,6 +1589,9 @@ struct pci_vdev_ops pci_ops_virtio_console = {
 	.vdev_init	= virtio_console_init,
 	.vdev_deinit	= virtio_console_deinit,
 	.vdev_barwrite	= virtio_pci_write,
-	.vdev_barread	= virtio_pci_read
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_restore	= virtio_pci_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_virtio_console);
@@ -6,6 +6,7 @@
  */
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -23,6 +24,9 @@
 #include "pci_core.h"
 #include "mevent.h"
 #include "virtio.h"
+#include "vmmapi.h"
+#include "timer.h"
+#include "atomic.h"
 #include "gpio_dm.h"
 
 /*
@@ -97,7 +101,7 @@ static int gpio_debug;
 #define DPRINTF(params) do { if (gpio_debug) pr_dbg params; } while (0)
 #define WPRINTF(params) (pr_err params)
 
-#define BIT(x) (1 << (x))
+#define BIT(x) (1UL << (x))
 
 /* Virtio GPIO supports maximum number of virtual gpio */
 #define VIRTIO_GPIO_MAX_VLINES	64
@@ -110,6 +114,7 @@ static int gpio_debug;
 
 /* Virtio GPIO capabilities */
 #define VIRTIO_GPIO_F_CHIP	1
+#define VIRTIO_GPIO_F_SHM	2
 #define VIRTIO_GPIO_S_HOSTCAPS	VIRTIO_GPIO_F_CHIP
 
 #define IRQ_TYPE_NONE		0
@@ -127,6 +132,37 @@ static bool virtio_gpio_is_active;
 #define GPIO_PIO_SIZE	(VIRTIO_GPIO_MAX_VLINES * 4)
 static uint64_t gpio_pio_start;
 
+/*
+ * Line-state page, mapped by BAR 2 with the shm option. The device model
+ * keeps value, dir and irq current under seq, odd while it updates them:
+ * the values of the output lines and of the IRQ lines detecting both
+ * edges as they change, those of the other input lines as of the last
+ * request or doorbell. The guest reads them without exits, and stages
+ * the values of output lines in set_mask and set_value that one write of
+ * the doorbell, the register after the PIO space, applies at once.
+ */
+#define VIRTIO_GPIO_SHM_BAR	2
+#define VIRTIO_GPIO_SHM_SIZE	4096
+#define VIRTIO_GPIO_SHM_DB_SIZE	4
+#define VIRTIO_GPIO_SHM_DB_SET	(1 << 0)	/* apply set_mask/set_value */
+#define VIRTIO_GPIO_SHM_DB_SYNC	(1 << 1)	/* read the input lines */
+
+struct virtio_gpio_shm {
+	uint32_t	seq;		/* odd while updating */
+	uint32_t	nline;		/* number of lines */
+	uint64_t	value;		/* bit n is the value of line n */
+	uint64_t	dir;		/* bit n is set for an input line n */
+	uint64_t	irq;		/* bit n is set for line n in IRQ mode */
+	uint64_t	set_mask;	/* lines to set, written by the guest */
+	uint64_t	set_value;	/* values to set, written by the guest */
+};
+
+/* the most gpioevent_data one read of an IRQ line returns */
+#define GPIO_IRQ_READ_BATCH	16
+
+/* upper bound of the irq_coalesce window */
+#define GPIO_IRQ_COALESCE_USECS_MAX	100000
+
 /* Uses the same packed config format as generic pinconf. */
 #define PIN_CONF_UNPACKED(p) ((unsigned long) p & 0xffUL)
 enum pin_config_param {
@@ -241,6 +277,10 @@ struct gpio_irq_desc {
 	uint64_t		mode;		/* interrupt trigger mode */
 	void			*data;		/* virtio gpio instance */
 	uint64_t		intr_stat;	/* interrupts count */
+	uint64_t		intr_ns;	/* when it became pending */
+	uint64_t		lat_total_ns;	/* pending to ack, all interrupts */
+	uint64_t		lat_max_ns;	/* pending to ack, the longest */
+	uint64_t		lat_count;	/* interrupts acked */
 };
 
 struct gpio_irq_chip {
@@ -249,6 +289,9 @@ struct gpio_irq_chip {
 	uint64_t		intr_pending;	/* pending interrupts */
 	uint64_t		intr_service;	/* service interrupts */
 	uint64_t		intr_stat;	/* all interrupts count */
+	uint32_t		coalesce_us;	/* window to gather pending interrupts */
+	bool			coalesce_armed;	/* the window is open */
+	struct acrn_timer	coalesce_timer;
 };
 
 struct virtio_gpio {
@@ -261,6 +304,10 @@ struct virtio_gpio {
 	uint32_t		nvline;
 	struct virtio_gpio_config	config;
 	struct gpio_irq_chip		irq_chip;
+	bool				shm_enabled;	/* shm option */
+	volatile struct virtio_gpio_shm	*shm;		/* line-state page */
+	pthread_mutex_t			shm_mtx;
+	uint64_t			shm_input;	/* input values last read */
 };
 
 static void print_gpio_info(struct virtio_gpio *gpio);
@@ -271,6 +318,7 @@ static void record_intr_statistics(struct gpio_irq_chip *chip, uint64_t mask);
 static void gpio_pio_write(struct virtio_gpio *gpio, int n, uint64_t reg);
 static uint32_t gpio_pio_read(struct virtio_gpio *gpio, int n);
 static void native_gpio_close_line(struct gpio_line *line);
+static void gpio_shm_update(struct virtio_gpio *gpio, bool sync);
 
 static void
 virtio_gpio_abort(struct virtio_vq_info *vq, uint16_t idx)
@@ -529,8 +577,13 @@ gpio_request_handler(struct virtio_gpio *gpio, struct virtio_gpio_request *req,
 		break;
 	case GPIO_REQ_GET_VALUE:
 		rc = gpio_get_value(gpio, req->offset);
-		if (rc >= 0)
+		if (rc >= 0) {
 			rsp->data = rc;
+			if (rc)
+				gpio->shm_input |= BIT(req->offset);
+			else
+				gpio->shm_input &= ~BIT(req->offset);
+		}
 		break;
 	case GPIO_REQ_OUTPUT_DIRECTION:
 		rc = gpio_set_direction_output(gpio, req->offset,
@@ -555,6 +608,89 @@ gpio_request_handler(struct virtio_gpio *gpio, struct virtio_gpio_request *req,
 
 	rsp->err = rc < 0 ? -1 : 0;
 	print_virtio_gpio_info(req, rsp, false);
+	gpio_shm_update(gpio, false);
+}
+
+/* Rebuild the line-state page, reading the input lines if sync is set */
+static void
+gpio_shm_update(struct virtio_gpio *gpio, bool sync)
+{
+	volatile struct virtio_gpio_shm *shm;
+	struct gpio_line *line;
+	uint64_t value, dir, irq;
+	int i, rc;
+
+	shm = gpio->shm;
+	if (!shm)
+		return;
+
+	value = dir = irq = 0;
+	pthread_mutex_lock(&gpio->shm_mtx);
+	for (i = 0; i < gpio->nvline; i++) {
+		line = gpio->vlines[i];
+		if (line->irq->fd > 0) {
+			irq |= BIT(i);
+			dir |= BIT(i);
+			if (line->irq->level)
+				value |= BIT(i);
+		} else if (line->dir == 0) {
+			if (line->value)
+				value |= BIT(i);
+		} else {
+			dir |= BIT(i);
+			if (sync && !line->busy && line->fd > 0) {
+				rc = gpio_get_value(gpio, i);
+				if (rc > 0)
+					gpio->shm_input |= BIT(i);
+				else if (rc == 0)
+					gpio->shm_input &= ~BIT(i);
+			}
+			value |= gpio->shm_input & BIT(i);
+		}
+	}
+
+	shm->seq++;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->value = value;
+	shm->dir = dir;
+	shm->irq = irq;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->seq++;
+	pthread_mutex_unlock(&gpio->shm_mtx);
+}
+
+static void
+gpio_shm_doorbell(struct virtio_gpio *gpio, uint32_t db)
+{
+	struct gpio_line *line;
+	uint64_t mask, value;
+	int i, v;
+
+	if (!gpio->shm) {
+		WPRINTF(("%s", "virtio gpio, doorbell without shm\n"));
+		return;
+	}
+
+	if (db & VIRTIO_GPIO_SHM_DB_SET) {
+		mask = atomic_xchg(&gpio->shm->set_mask, 0);
+		value = gpio->shm->set_value;
+		for (i = 0; i < gpio->nvline; i++) {
+			if (!(mask & BIT(i)))
+				continue;
+
+			line = gpio->vlines[i];
+			if (line->dir != 0 || line->irq->fd > 0) {
+				WPRINTF(("doorbell discards gpio %d, not output\n",
+						i));
+				continue;
+			}
+
+			v = (value & BIT(i)) ? 1 : 0;
+			if (v != line->value)
+				gpio_set_value(gpio, i, v);
+		}
+	}
+	gpio_shm_update(gpio, db & VIRTIO_GPIO_SHM_DB_SYNC);
 }
 
 static void virtio_gpio_reset(void *vdev)
@@ -565,6 +701,8 @@ static void virtio_gpio_reset(void *vdev)
 
 	DPRINTF(("%s", "virtio_gpio: device reset requested!\n"));
 	virtio_reset_dev(&gpio->base);
+	if (gpio->shm)
+		gpio->shm->set_mask = 0;
 }
 
 static int
@@ -574,6 +712,10 @@ virtio_gpio_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 
 	cfg_size = sizeof(struct virtio_gpio_config);
 	offset -= cfg_size;
+	if (offset == GPIO_PIO_SIZE && size == VIRTIO_GPIO_SHM_DB_SIZE) {
+		gpio_shm_doorbell((struct virtio_gpio *)vdev, value);
+		return 0;
+	}
 	if (offset < 0 || offset >= GPIO_PIO_SIZE) {
 		WPRINTF(("virtio_gpio: write to invalid reg %d\n", offset));
 		return -1;
@@ -592,7 +734,11 @@ virtio_gpio_cfgread(void *vdev, int offset, int size, uint32_t *retval)
 	uint32_t reg;
 
 	cfg_size = sizeof(struct virtio_gpio_config);
-	if (offset < 0 || offset >= cfg_size + GPIO_PIO_SIZE) {
+	if (offset >= cfg_size + GPIO_PIO_SIZE &&
+			offset < cfg_size + GPIO_PIO_SIZE + VIRTIO_GPIO_SHM_DB_SIZE) {
+		/* the doorbell reads as 0 */
+		memset(retval, 0, size);
+	} else if (offset < 0 || offset >= cfg_size + GPIO_PIO_SIZE) {
 		WPRINTF(("virtio_gpio: read from invalid reg %d\n", offset));
 		return -1;
 	} else if (offset < cfg_size) {
@@ -686,7 +832,9 @@ virtio_gpio_notify(void *vdev, struct virtio_vq_info *vq)
 
 	idx = vq->qsize;
 	gpio = (struct virtio_gpio *)vdev;
-	if (vq_has_descs(vq)) {
+
+	/* all the requests the guest queued before the kick, in one exit */
+	while (vq_has_descs(vq)) {
 		n = vq_getchain(vq, &idx, iov, 2, NULL);
 		if (n < 1 || n >= 3) {
 			WPRINTF(("virtio gpio, invalid chain number %d\n", n));
@@ -938,6 +1086,73 @@ gpio_irq_deliver_intr(struct virtio_gpio *gpio, uint64_t mask)
 		WPRINTF(("virtio gpio failed to send an IRQ, mask %lu", mask));
 }
 
+static uint64_t
+gpio_irq_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Called with intr_mtx held */
+static void
+gpio_irq_send_intr(struct virtio_gpio *gpio)
+{
+	struct gpio_irq_chip *chip;
+
+	chip = &gpio->irq_chip;
+	chip->intr_service = chip->intr_pending;
+	chip->intr_pending = 0;
+
+	/* deliver interrupt */
+	gpio_irq_deliver_intr(gpio, chip->intr_service);
+}
+
+/* Called with intr_mtx held */
+static void
+gpio_irq_flush_intr(struct virtio_gpio *gpio)
+{
+	struct gpio_irq_chip *chip;
+	struct itimerspec ts;
+
+	chip = &gpio->irq_chip;
+
+	/*
+	 * if all interrupts in service are acknowledged, then send pending
+	 * interrupts, after the coalesce window if there is one so that
+	 * the pins raised meanwhile join the same notification.
+	 */
+	if (chip->intr_service || !chip->intr_pending || chip->coalesce_armed)
+		return;
+
+	if (chip->coalesce_us) {
+		memset(&ts, 0, sizeof(ts));
+		ts.it_value.tv_nsec = chip->coalesce_us * 1000UL;
+		if (acrn_timer_settime(&chip->coalesce_timer, &ts) == 0) {
+			chip->coalesce_armed = true;
+			return;
+		}
+		WPRINTF(("%s", "virtio gpio, failed to arm coalesce timer\n"));
+	}
+	gpio_irq_send_intr(gpio);
+}
+
+static void
+gpio_irq_coalesce_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_gpio *gpio;
+	struct gpio_irq_chip *chip;
+
+	gpio = arg;
+	chip = &gpio->irq_chip;
+	pthread_mutex_lock(&chip->intr_mtx);
+	chip->coalesce_armed = false;
+	if (!chip->intr_service && chip->intr_pending)
+		gpio_irq_send_intr(gpio);
+	pthread_mutex_unlock(&chip->intr_mtx);
+}
+
 static void
 gpio_irq_generate_intr(struct virtio_gpio *gpio, int pin)
 {
@@ -954,19 +1169,11 @@ gpio_irq_generate_intr(struct virtio_gpio *gpio, int pin)
 	pthread_mutex_lock(&chip->intr_mtx);
 
 	/* set it to pending mask */
+	if (!(chip->intr_pending & BIT(pin)))
+		desc->intr_ns = gpio_irq_now();
 	chip->intr_pending |= BIT(pin);
 
-	/*
-	 * if all interrupts in service are acknowledged, then send pending
-	 * interrupts.
-	 */
-	if (!chip->intr_service) {
-		chip->intr_service = chip->intr_pending;
-		chip->intr_pending = 0;
-
-		/* deliver interrupt */
-		gpio_irq_deliver_intr(gpio, chip->intr_service);
-	}
+	gpio_irq_flush_intr(gpio);
 	pthread_mutex_unlock(&chip->intr_mtx);
 }
 
@@ -975,45 +1182,55 @@ gpio_irq_set_pin_state(int fd __attribute__((unused)),
 		enum ev_type t __attribute__((unused)),
 		void *arg)
 {
-	struct gpioevent_data data;
+	struct gpioevent_data data[GPIO_IRQ_READ_BATCH];
 	struct virtio_gpio *gpio;
 	struct gpio_irq_desc *desc;
-	int err;
+	bool intr;
+	int err, i;
 
 	desc = (struct gpio_irq_desc *) arg;
 	gpio = (struct virtio_gpio *) desc->data;
 
-	/* get pin state */
-	memset(&data, 0, sizeof(data));
-	err = read(desc->fd, &data, sizeof(data));
-	if (err != sizeof(data)) {
+	/*
+	 * get pin state, all the edges queued in one read, they raise
+	 * one interrupt.
+	 */
+	memset(data, 0, sizeof(data));
+	err = read(desc->fd, data, sizeof(data));
+	if (err < (int)sizeof(data[0]) || err % sizeof(data[0])) {
 		WPRINTF(("virtio gpio, gpio mevent read error %s, len %d\n",
 				strerror(errno), err));
 		return;
 	}
 
-	if (data.id == GPIOEVENT_EVENT_RISING_EDGE) {
-
-		/* pin level is high */
-		desc->level = 1;
-
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_RISING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_HIGH)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else if (data.id == GPIOEVENT_EVENT_FALLING_EDGE) {
-
-		/* pin level is low */
-		desc->level = 0;
+	intr = false;
+	for (i = 0; i < err / sizeof(data[0]); i++) {
+		if (data[i].id == GPIOEVENT_EVENT_RISING_EDGE) {
+
+			/* pin level is high */
+			desc->level = 1;
+
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_RISING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_HIGH))
+				intr = true;
+		} else if (data[i].id == GPIOEVENT_EVENT_FALLING_EDGE) {
+
+			/* pin level is low */
+			desc->level = 0;
+
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_LOW))
+				intr = true;
+		} else
+			WPRINTF(("virtio gpio, undefined GPIO event id %d\n",
+					data[i].id));
+	}
 
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_LOW)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else
-		WPRINTF(("virtio gpio, undefined GPIO event id %d\n", data.id));
+	gpio_shm_update(gpio, false);
+	if (intr)
+		gpio_irq_generate_intr(gpio, desc->pin);
 }
 
 static void
@@ -1052,8 +1269,10 @@ gpio_irq_teardown(void *param)
 	}
 
 	/* if deinit is not set, switch the pin to GPIO mode */
-	if (!desc->deinit)
+	if (!desc->deinit) {
 		native_gpio_open_line(desc->gpio, 0, 0);
+		gpio_shm_update(desc->data, false);
+	}
 }
 
 static void
@@ -1122,6 +1341,7 @@ gpio_irq_enable(struct virtio_gpio *gpio, unsigned int pin,
 		goto error;
 	}
 
+	gpio_shm_update(gpio, false);
 	return;
 error:
 	gpio_irq_disable(chip, pin);
@@ -1147,10 +1367,36 @@ gpio_irq_has_pending_intr(struct gpio_irq_desc *desc)
 }
 
 static void
-gpio_irq_clear_intr(struct gpio_irq_chip *chip, int pin)
+gpio_irq_clear_intr(struct virtio_gpio *gpio, int pin)
 {
+	struct gpio_irq_chip *chip;
+	struct gpio_irq_desc *desc;
+	uint64_t lat;
+
+	chip = &gpio->irq_chip;
+	desc = &chip->descs[pin];
 	pthread_mutex_lock(&chip->intr_mtx);
+	if (chip->intr_service & BIT(pin)) {
+		lat = gpio_irq_now() - desc->intr_ns;
+		desc->lat_total_ns += lat;
+		if (lat > desc->lat_max_ns)
+			desc->lat_max_ns = lat;
+		desc->lat_count++;
+	}
 	chip->intr_service &= ~BIT(pin);
+
+	/*
+	 * For level trigger, we need to check the level value
+	 * for next interrupt.
+	 */
+	if (!desc->mask && gpio_irq_has_pending_intr(desc)) {
+		if (!(chip->intr_pending & BIT(pin)))
+			desc->intr_ns = gpio_irq_now();
+		chip->intr_pending |= BIT(pin);
+	}
+
+	/* the pins raised while the others were in service */
+	gpio_irq_flush_intr(gpio);
 	pthread_mutex_unlock(&chip->intr_mtx);
 }
 
@@ -1196,13 +1442,7 @@ virtio_gpio_irq_proc(struct virtio_gpio *gpio, struct iovec *iov, uint16_t flag)
 		print_intr_statistics(chip);
 		break;
 	case IRQ_ACTION_ACK:
-		/*
-		 * For level trigger, we need to check the level value
-		 * for next interrupt.
-		 */
-		gpio_irq_clear_intr(chip, req->pin);
-		if (gpio_irq_has_pending_intr(desc))
-			gpio_irq_generate_intr(gpio, req->pin);
+		gpio_irq_clear_intr(gpio, req->pin);
 		break;
 	case IRQ_ACTION_MASK:
 		desc->mask = true;
@@ -1234,7 +1474,10 @@ virtio_irq_notify(void *vdev, struct virtio_vq_info *vq)
 
 	idx = vq->qsize;
 	gpio = (struct virtio_gpio *)vdev;
-	if (vq_has_descs(vq)) {
+	if (!vq_has_descs(vq))
+		return;
+
+	while (vq_has_descs(vq)) {
 		n = vq_getchain(vq, &idx, iov, 1, &flag);
 		if (n != 1) {
 			WPRINTF(("virtio gpio, invalid irq chain %d\n", n));
@@ -1247,10 +1490,10 @@ virtio_irq_notify(void *vdev, struct virtio_vq_info *vq)
 		 * Release this chain and handle more
 		 */
 		vq_relchain(vq, idx, 1);
-
-		/* Generate interrupt if appropriate. */
-		vq_endchains(vq, 1);
 	}
+
+	/* Generate interrupt if appropriate, once for all the actions. */
+	vq_endchains(vq, 1);
 }
 
 static void
@@ -1261,6 +1504,8 @@ gpio_irq_deinit(struct virtio_gpio *gpio)
 	int i;
 
 	chip = &gpio->irq_chip;
+	if (chip->coalesce_us)
+		acrn_timer_deinit(&chip->coalesce_timer);
 	pthread_mutex_destroy(&chip->intr_mtx);
 	for (i = 0; i < gpio->nvline; i++) {
 		desc = &chip->descs[i];
@@ -1288,6 +1533,15 @@ gpio_irq_init(struct virtio_gpio *gpio)
 		WPRINTF(("IRQ pthread_mutex_init failed with error %d!\n", rc));
 		return -1;
 	}
+	if (chip->coalesce_us) {
+		chip->coalesce_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&chip->coalesce_timer,
+				gpio_irq_coalesce_timer, gpio) != 0) {
+			WPRINTF(("%s", "IRQ coalesce timer init failed\n"));
+			pthread_mutex_destroy(&chip->intr_mtx);
+			return -1;
+		}
+	}
 	for (i = 0; i < gpio->nvline; i++) {
 		desc = &chip->descs[i];
 		line = gpio->vlines[i];
@@ -1301,11 +1555,90 @@ gpio_irq_init(struct virtio_gpio *gpio)
 	return 0;
 }
 
+static int
+gpio_shm_init(struct vmctx *ctx, struct virtio_gpio *gpio,
+		struct pci_vdev *dev)
+{
+	void *addr;
+	int rc;
+
+	rc = pthread_mutex_init(&gpio->shm_mtx, NULL);
+	if (rc) {
+		WPRINTF(("shm pthread_mutex_init failed with error %d!\n", rc));
+		return -1;
+	}
+
+	addr = mmap(NULL, VIRTIO_GPIO_SHM_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		WPRINTF(("virtio gpio, failed to allocate shm, error %s\n",
+				strerror(errno)));
+		goto fail;
+	}
+
+	if (pci_emul_alloc_bar(dev, VIRTIO_GPIO_SHM_BAR, PCIBAR_MEM32,
+				VIRTIO_GPIO_SHM_SIZE) != 0 ||
+			vm_map_memseg_vma(ctx, VIRTIO_GPIO_SHM_SIZE,
+				dev->bar[VIRTIO_GPIO_SHM_BAR].addr,
+				(uint64_t)addr, PROT_READ | PROT_WRITE) != 0) {
+		WPRINTF(("%s", "virtio gpio, failed to map shm to bar2\n"));
+		munmap(addr, VIRTIO_GPIO_SHM_SIZE);
+		goto fail;
+	}
+
+	gpio->shm = addr;
+	gpio->shm->nline = gpio->nvline;
+	gpio_shm_update(gpio, true);
+	return 0;
+
+fail:
+	pthread_mutex_destroy(&gpio->shm_mtx);
+	return -1;
+}
+
+static void
+gpio_shm_deinit(struct virtio_gpio *gpio)
+{
+	if (gpio->shm) {
+		munmap((void *)gpio->shm, VIRTIO_GPIO_SHM_SIZE);
+		gpio->shm = NULL;
+		pthread_mutex_destroy(&gpio->shm_mtx);
+	}
+}
+
+static int
+virtio_gpio_parse_opts(struct virtio_gpio *gpio, char *opts)
+{
+	char *tmp;
+	int val;
+
+	/* the options after the gpio resources */
+	while ((tmp = strsep(&opts, ",")) != NULL) {
+		if (!strcmp(tmp, "shm")) {
+			gpio->shm_enabled = true;
+		} else if (!strncmp(tmp, "irq_coalesce=", 13)) {
+			if (dm_strtoi(tmp + 13, NULL, 10, &val) || val <= 0 ||
+					val > GPIO_IRQ_COALESCE_USECS_MAX) {
+				WPRINTF(("virtio gpio, invalid %s, expected "
+					"usecs 1-%d\n", tmp,
+					GPIO_IRQ_COALESCE_USECS_MAX));
+				return -1;
+			}
+			gpio->irq_chip.coalesce_us = val;
+		} else {
+			WPRINTF(("virtio gpio, unknown option %s\n", tmp));
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int
 virtio_gpio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_gpio *gpio;
 	pthread_mutexattr_t attr;
+	char *b, *o, *res;
 	int rc, i;
 
 	/* Just support one bdf */
@@ -1325,10 +1658,23 @@ virtio_gpio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto init_fail;
 	}
 
-	rc = native_gpio_init(gpio, opts);
+	/*
+	 * -s <slot>,virtio-gpio,<gpio resources>[,shm][,irq_coalesce=<usecs>]
+	 */
+	b = o = strdup(opts);
+	if (!b) {
+		rc = -ENOMEM;
+		goto gpio_fail;
+	}
+	res = strsep(&o, ",");
+	rc = virtio_gpio_parse_opts(gpio, o);
+	if (rc == 0)
+		rc = native_gpio_init(gpio, res);
+	free(b);
 	if (rc) {
 		WPRINTF(("%s", "virtio gpio: failed to initialize gpio\n"));
-		goto gpio_fail;
+		rc = -EINVAL;
+		goto irq_fail;
 	}
 
 	rc = gpio_irq_init(gpio);
@@ -1365,6 +1711,8 @@ virtio_gpio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	gpio->config.ngpio = gpio->nvline;
 
 	gpio->base.device_caps = VIRTIO_GPIO_S_HOSTCAPS;
+	if (gpio->shm_enabled)
+		gpio->base.device_caps |= VIRTIO_GPIO_F_SHM;
 	gpio->base.mtx = &gpio->mtx;
 	gpio->queues[0].qsize = 64;
 	gpio->queues[0].notify = virtio_gpio_notify;
@@ -1386,8 +1734,10 @@ virtio_gpio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto fail;
 	}
 
-	/* Allocate PIO space for GPIO */
+	/* Allocate PIO space for GPIO, and the doorbell of the shm */
 	virtio_gpio_ops.cfgsize = sizeof(struct virtio_gpio_config) + GPIO_PIO_SIZE;
+	if (gpio->shm_enabled)
+		virtio_gpio_ops.cfgsize += VIRTIO_GPIO_SHM_DB_SIZE;
 
 	/* use BAR 0 to map config regs in IO space */
 	virtio_set_io_bar(&gpio->base, 0);
@@ -1395,6 +1745,12 @@ virtio_gpio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	gpio_pio_start = dev->bar[0].addr + VIRTIO_PCI_CONFIG_OFF(1) +
 		sizeof(struct virtio_gpio_config);
 
+	/* use BAR 2 to map the line-state page */
+	if (gpio->shm_enabled && gpio_shm_init(ctx, gpio, dev)) {
+		rc = -1;
+		goto fail;
+	}
+
 	virtio_gpio_is_active = true;
 
 	/* dump gpio information */
@@ -1431,6 +1787,7 @@ virtio_gpio_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (gpio) {
 		pthread_mutex_destroy(&gpio->mtx);
 		gpio_irq_deinit(gpio);
+		gpio_shm_deinit(gpio);
 		for (i = 0; i < gpio->nchip; i++)
 			native_gpio_close_chip(&gpio->chips[i]);
 		virtio_gpio_reset(gpio);
@@ -1646,6 +2003,12 @@ print_intr_statistics(struct gpio_irq_chip *chip)
 		DPRINTF(("Chip %s GPIO %d generated interrupts %lu\n",
 				desc->gpio->chip->dev_name, desc->gpio->offset,
 				desc->intr_stat));
+		if (desc->lat_count == 0)
+			continue;
+		DPRINTF(("Chip %s GPIO %d pending to ack avg %lu us, max %lu us\n",
+				desc->gpio->chip->dev_name, desc->gpio->offset,
+				desc->lat_total_ns / desc->lat_count / 1000,
+				desc->lat_max_ns / 1000));
 	}
 }
 
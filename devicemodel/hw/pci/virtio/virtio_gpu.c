@@ -214,10 +214,12 @@ struct virtio_gpu_resource_2d {
 	uint32_t width;
 	uint32_t height;
 	uint32_t format;
+	uint32_t drm_fourcc;
 	pixman_image_t *image;
 	struct iovec *iov;
 	uint32_t iovcnt;
 	bool blob;
+	/* of the blob, or of the backing of a 2D resource for zero-copy */
 	struct dma_buf_info *dma_info;
 	LIST_ENTRY(virtio_gpu_resource_2d) link;
 };
@@ -374,6 +376,13 @@ struct virtio_gpu {
 	struct vga vga;
 	pthread_mutex_t	vga_thread_mtx;
 	int32_t vga_thread_status;
+	/* the framebuffer is tracked by a dirty log, not uploaded whole */
+	bool vga_dirty_log;
+	struct vm_dirty_log *vga_log;
+	uint64_t *vga_dirty;
+	/* the rows of the framebuffer to upload, under vga_thread_mtx */
+	int vga_damage_top;
+	int vga_damage_bottom;
 	uint8_t edid[VIRTIO_GPU_EDID_SIZE];
 	bool is_blob_supported;
 	int scanout_num;
@@ -396,6 +405,8 @@ static int virtio_gpu_cfgwrite(void *, int, int, uint32_t);
 static void virtio_gpu_neg_features(void *, uint64_t);
 static void virtio_gpu_set_status(void *, uint64_t);
 static void * virtio_gpu_vga_render(void *param);
+static struct dma_buf_info *virtio_gpu_create_udmabuf(struct virtio_gpu *gpu,
+		struct virtio_gpu_mem_entry *entries, int nr_entries);
 
 static struct virtio_ops virtio_gpu_ops = {
 	"virtio-gpu",			/* our name */
@@ -460,7 +471,7 @@ virtio_gpu_reset(void *vdev)
 				pixman_image_unref(r2d->image);
 				r2d->image = NULL;
 			}
-			if (r2d->blob) {
+			if (r2d->dma_info) {
 				virtio_gpu_dmabuf_unref(r2d->dma_info);
 				r2d->dma_info = NULL;
 				r2d->blob = false;
@@ -649,6 +660,44 @@ virtio_gpu_get_pixman_format(uint32_t format)
 	}
 }
 
+static uint32_t
+virtio_gpu_get_drm_format(uint32_t format)
+{
+	switch (format) {
+	case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+		return DRM_FORMAT_XRGB8888;
+	case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+		return DRM_FORMAT_ARGB8888;
+	case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+		return DRM_FORMAT_ABGR8888;
+	case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+		return DRM_FORMAT_XBGR8888;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Whether the resource is displayed from the dmabuf of its memory: a blob,
+ * or a 2D resource with one, unless a scanout was set to it before, when
+ * it had no dmabuf yet, and shows its image.
+ */
+static bool
+virtio_gpu_zero_copy(struct virtio_gpu *gpu, struct virtio_gpu_resource_2d *r2d)
+{
+	int i;
+
+	if (r2d->dma_info == NULL)
+		return false;
+	if (r2d->blob)
+		return true;
+	for (i = 0; i < gpu->scanout_num; i++) {
+		if (gpu->gpu_scanouts[i].cur_img == r2d->image)
+			return false;
+	}
+	return true;
+}
+
 static void
 virtio_gpu_update_scanout(struct virtio_gpu *gpu, int scanout_id, int resource_id,
 			  struct virtio_gpu_rect *scan_rect)
@@ -670,7 +719,7 @@ virtio_gpu_update_scanout(struct virtio_gpu *gpu, int scanout_id, int resource_i
 	r2d = virtio_gpu_find_resource_2d(gpu, resource_id);
 	if (r2d) {
 		gpu_scanout->is_active = true;
-		if (r2d->blob) {
+		if (r2d->dma_info) {
 			virtio_gpu_dmabuf_ref(r2d->dma_info);
 			gpu_scanout->dma_buf = r2d->dma_info;
 		} else {
@@ -712,6 +761,7 @@ virtio_gpu_cmd_resource_create_2d(struct virtio_gpu_command *cmd)
 	r2d->width = req.width;
 	r2d->height = req.height;
 	r2d->format = virtio_gpu_get_pixman_format(req.format);
+	r2d->drm_fourcc = virtio_gpu_get_drm_format(req.format);
 	r2d->image = pixman_image_create_bits(
 			r2d->format, r2d->width, r2d->height, NULL, 0);
 	if (!r2d->image) {
@@ -749,7 +799,7 @@ virtio_gpu_cmd_resource_unref(struct virtio_gpu_command *cmd)
 			pixman_image_unref(r2d->image);
 			r2d->image = NULL;
 		}
-		if (r2d->blob) {
+		if (r2d->dma_info) {
 			virtio_gpu_dmabuf_unref(r2d->dma_info);
 			r2d->dma_info = NULL;
 			r2d->blob = false;
@@ -781,6 +831,7 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 	int i;
 	uint8_t *pbuf;
 	struct iovec *iov;
+	uint64_t len, size;
 
 	memcpy(&req, cmd->iov[0].iov_base, sizeof(req));
 	memset(&resp, 0, sizeof(resp));
@@ -821,13 +872,30 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 			memcpy(pbuf, cmd->iov[i].iov_base, cmd->iov[i].iov_len);
 			pbuf += cmd->iov[i].iov_len;
 		}
+		len = 0;
 		for (i = 0; i < req.nr_entries; i++) {
 			r2d->iov[i].iov_base = paddr_guest2host(
 					cmd->gpu->base.dev->vmctx,
 					entries[i].addr,
 					entries[i].length);
 			r2d->iov[i].iov_len = entries[i].length;
+			len += entries[i].length;
 		}
+
+		/*
+		 * The backing has the layout of the image, so the display can
+		 * import it as a dmabuf, as a blob, rather than have the
+		 * transfers copy it to the image and then to the texture. Not
+		 * for the cursors, which are images to the display.
+		 */
+		virtio_gpu_dmabuf_unref(r2d->dma_info);
+		r2d->dma_info = NULL;
+		size = (uint64_t)pixman_image_get_stride(r2d->image) * r2d->height;
+		if (virtio_gpu_blob_supported(cmd->gpu) &&
+		    vdpy_dmabuf_supported(cmd->gpu->vdpy_handle) &&
+		    r2d->drm_fourcc && size > CURSOR_BLOB_SIZE && len >= size)
+			r2d->dma_info = virtio_gpu_create_udmabuf(cmd->gpu,
+					entries, req.nr_entries);
 		free(entries);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
@@ -855,6 +923,11 @@ virtio_gpu_cmd_resource_detach_backing(struct virtio_gpu_command *cmd)
 		free(r2d->iov);
 		r2d->iov = NULL;
 	}
+	/* the scanouts keep a reference of theirs */
+	if (r2d && !r2d->blob && r2d->dma_info) {
+		virtio_gpu_dmabuf_unref(r2d->dma_info);
+		r2d->dma_info = NULL;
+	}
 
 	cmd->iolen = sizeof(resp);
 	resp.type = VIRTIO_GPU_RESP_OK_NODATA;
@@ -904,6 +977,21 @@ virtio_gpu_cmd_set_scanout(struct virtio_gpu_command *cmd)
 		pr_err("%s: Scanout bound out of underlying resource.\n",
 				__func__);
 		resp.type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+	} else if (r2d->dma_info && !r2d->blob) {
+		virtio_gpu_update_scanout(gpu, req.scanout_id, req.resource_id, &req.r);
+		memset(&surf, 0, sizeof(surf));
+		bytes_pp = PIXMAN_FORMAT_BPP(r2d->format) / 8;
+		surf.x = req.r.x;
+		surf.y = req.r.y;
+		surf.width = req.r.width;
+		surf.height = req.r.height;
+		surf.stride = pixman_image_get_stride(r2d->image);
+		surf.surf_type = SURFACE_DMABUF;
+		surf.dma_info.dmabuf_fd = r2d->dma_info->dmabuf_fd;
+		surf.dma_info.dmabuf_offset = bytes_pp * surf.x + surf.y * surf.stride;
+		surf.dma_info.surf_fourcc = r2d->drm_fourcc;
+		vdpy_surface_set(gpu->vdpy_handle, req.scanout_id, &surf);
+		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
 		virtio_gpu_update_scanout(gpu, req.scanout_id, req.resource_id, &req.r);
 		bytes_pp = PIXMAN_FORMAT_BPP(r2d->format) / 8;
@@ -930,18 +1018,60 @@ virtio_gpu_cmd_set_scanout(struct virtio_gpu_command *cmd)
 	}
 }
 
+/* copy the rect of the backing of the resource, from offset, to its image */
 static void
-virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
+virtio_gpu_copy_backing(struct virtio_gpu_resource_2d *r2d,
+			struct virtio_gpu_rect *r, uint64_t offset)
 {
-	struct virtio_gpu_transfer_to_host_2d req;
-	struct virtio_gpu_resource_2d *r2d;
-	struct virtio_gpu_ctrl_hdr resp;
 	uint32_t src_offset, dst_offset, stride, bpp, h;
 	pixman_format_code_t format;
 	void *img_data, *dst, *src;
 	int i, done, bytes, total;
 	int width, height;
 
+	pixman_image_ref(r2d->image);
+	stride = pixman_image_get_stride(r2d->image);
+	format = pixman_image_get_format(r2d->image);
+	bpp = PIXMAN_FORMAT_BPP(format) / 8;
+	img_data = pixman_image_get_data(r2d->image);
+	width = (r->width < r2d->width) ? r->width : r2d->width;
+	height = (r->height < r2d->height) ? r->height : r2d->height;
+	for (h = 0; h < height; h++) {
+		src_offset = offset + stride * h;
+		dst_offset = (r->y + h) * stride + (r->x * bpp);
+		dst = img_data + dst_offset;
+		done = 0;
+		total = width * bpp;
+		for (i = 0; i < r2d->iovcnt; i++) {
+			if ((r2d->iov[i].iov_base == 0) || (r2d->iov[i].iov_len == 0)) {
+				continue;
+			}
+
+			if (src_offset < r2d->iov[i].iov_len) {
+				src = r2d->iov[i].iov_base + src_offset;
+				bytes = ((total - done) < (r2d->iov[i].iov_len - src_offset)) ?
+					 (total - done) : (r2d->iov[i].iov_len - src_offset);
+				memcpy((dst + done), src, bytes);
+				src_offset = 0;
+				done += bytes;
+				if (done >= total) {
+					break;
+				}
+			} else {
+				src_offset -= r2d->iov[i].iov_len;
+			}
+		}
+	}
+	pixman_image_unref(r2d->image);
+}
+
+static void
+virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
+{
+	struct virtio_gpu_transfer_to_host_2d req;
+	struct virtio_gpu_resource_2d *r2d;
+	struct virtio_gpu_ctrl_hdr resp;
+
 	memcpy(&req, cmd->iov[0].iov_base, sizeof(req));
 	memset(&resp, 0, sizeof(resp));
 	virtio_gpu_update_resp_fence(&cmd->hdr, &resp);
@@ -955,7 +1085,8 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 		return;
 	}
 
-	if (r2d->blob) {
+	/* the display reads the memory of the guest itself */
+	if (virtio_gpu_zero_copy(cmd->gpu, r2d)) {
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 		memcpy(cmd->iov[1].iov_base, &resp, sizeof(resp));
 		return;
@@ -970,40 +1101,7 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 		pr_err("%s: transfer bounds outside resource.\n", __func__);
 		resp.type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
 	} else {
-		pixman_image_ref(r2d->image);
-		stride = pixman_image_get_stride(r2d->image);
-		format = pixman_image_get_format(r2d->image);
-		bpp = PIXMAN_FORMAT_BPP(format) / 8;
-		img_data = pixman_image_get_data(r2d->image);
-		width = (req.r.width < r2d->width) ? req.r.width : r2d->width;
-		height = (req.r.height < r2d->height) ? req.r.height : r2d->height;
-		for (h = 0; h < height; h++) {
-			src_offset = req.offset + stride * h;
-			dst_offset = (req.r.y + h) * stride + (req.r.x * bpp);
-			dst = img_data + dst_offset;
-			done = 0;
-			total = width * bpp;
-			for (i = 0; i < r2d->iovcnt; i++) {
-				if ((r2d->iov[i].iov_base == 0) || (r2d->iov[i].iov_len == 0)) {
-					continue;
-				}
-
-				if (src_offset < r2d->iov[i].iov_len) {
-					src = r2d->iov[i].iov_base + src_offset;
-					bytes = ((total - done) < (r2d->iov[i].iov_len - src_offset)) ?
-						 (total - done) : (r2d->iov[i].iov_len - src_offset);
-					memcpy((dst + done), src, bytes);
-					src_offset = 0;
-					done += bytes;
-					if (done >= total) {
-						break;
-					}
-				} else {
-					src_offset -= r2d->iov[i].iov_len;
-				}
-			}
-		}
-		pixman_image_unref(r2d->image);
+		virtio_gpu_copy_backing(r2d, &req.r, req.offset);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	}
 
@@ -1058,6 +1156,7 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 	struct virtio_gpu_ctrl_hdr resp;
 	struct virtio_gpu_resource_2d *r2d;
 	struct surface surf;
+	struct vdpy_rect damage;
 	struct virtio_gpu *gpu;
 	int i;
 	struct virtio_gpu_scanout *gpu_scanout;
@@ -1076,7 +1175,7 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 		memcpy(cmd->iov[1].iov_base, &resp, sizeof(resp));
 		return;
 	}
-	if (r2d->blob) {
+	if (virtio_gpu_zero_copy(gpu, r2d)) {
 		virtio_gpu_dmabuf_ref(r2d->dma_info);
 		for (i = 0; i < gpu->scanout_num; i++) {
 			if (!virtio_gpu_scanout_needs_flush(gpu, i, req.resource_id, &req.r))
@@ -1107,7 +1206,15 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 		surf.surf_format = r2d->format;
 		surf.surf_type = SURFACE_PIXMAN;
 		surf.pixel += bytes_pp * surf.x + surf.y * surf.stride;
-		vdpy_surface_update(gpu->vdpy_handle, i, &surf);
+
+		/* only the part of the scanout flushed is uploaded */
+		damage.x = MAX(req.r.x, surf.x) - surf.x;
+		damage.y = MAX(req.r.y, surf.y) - surf.y;
+		damage.width = MIN(req.r.x + req.r.width, surf.x + surf.width) -
+			surf.x - damage.x;
+		damage.height = MIN(req.r.y + req.r.height, surf.y + surf.height) -
+			surf.y - damage.y;
+		vdpy_surface_update_rect(gpu->vdpy_handle, i, &surf, &damage);
 	}
 	pixman_image_unref(r2d->image);
 
@@ -1376,24 +1483,11 @@ virtio_gpu_cmd_set_scanout_blob(struct virtio_gpu_command *cmd)
 	surf.dma_info.dmabuf_fd = r2d->dma_info->dmabuf_fd;
 	surf.surf_type = SURFACE_DMABUF;
 	bytes_pp = 4;
-	switch (req.format) {
-	case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
-		drm_fourcc = DRM_FORMAT_XRGB8888;
-		break;
-	case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
-		drm_fourcc = DRM_FORMAT_ARGB8888;
-		break;
-	case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
-		drm_fourcc = DRM_FORMAT_ABGR8888;
-		break;
-	case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
-		drm_fourcc = DRM_FORMAT_XBGR8888;
-		break;
-	default:
+	drm_fourcc = virtio_gpu_get_drm_format(req.format);
+	if (drm_fourcc == 0) {
 		pr_err("%s : unuspported surface format %d.\n",
 			__func__, req.format);
 		drm_fourcc = DRM_FORMAT_ARGB8888;
-		break;
 	}
 	surf.dma_info.dmabuf_offset = req.offsets[0] + bytes_pp * surf.x + surf.y * surf.stride;
 	surf.dma_info.surf_fourcc = drm_fourcc;
@@ -1502,6 +1596,7 @@ virtio_gpu_cmd_update_cursor(struct virtio_gpu_command *cmd)
 {
 	struct virtio_gpu_update_cursor req;
 	struct virtio_gpu_resource_2d *r2d;
+	struct virtio_gpu_rect rect;
 	struct cursor cur;
 	struct virtio_gpu *gpu;
 
@@ -1520,6 +1615,14 @@ virtio_gpu_cmd_update_cursor(struct virtio_gpu_command *cmd)
 		cur.hot_y = req.hot_y;
 		cur.width = r2d->width;
 		cur.height = r2d->height;
+		/* the transfers left the image as it was */
+		if (virtio_gpu_zero_copy(gpu, r2d) && !r2d->blob) {
+			rect.x = 0;
+			rect.y = 0;
+			rect.width = r2d->width;
+			rect.height = r2d->height;
+			virtio_gpu_copy_backing(r2d, &rect, 0);
+		}
 		pixman_image_ref(r2d->image);
 		cur.data = pixman_image_get_data(r2d->image);
 		vdpy_cursor_define(gpu->vdpy_handle, req.pos.scanout_id, &cur);
@@ -1596,9 +1699,17 @@ static void
 virtio_gpu_vga_bh(void *param)
 {
 	struct virtio_gpu *gpu;
+	struct vdpy_rect damage;
 
 	gpu = (struct virtio_gpu*)param;
 
+	pthread_mutex_lock(&gpu->vga_thread_mtx);
+	damage.y = gpu->vga_damage_top;
+	damage.height = gpu->vga_damage_bottom - gpu->vga_damage_top;
+	gpu->vga_damage_top = 0;
+	gpu->vga_damage_bottom = 0;
+	pthread_mutex_unlock(&gpu->vga_thread_mtx);
+
 	if ((gpu->vga.surf.width != gpu->vga.gc->gc_image->width) ||
 		(gpu->vga.surf.height != gpu->vga.gc->gc_image->height)) {
 		gpu->vga.surf.width = gpu->vga.gc->gc_image->width;
@@ -1608,9 +1719,96 @@ virtio_gpu_vga_bh(void *param)
 		gpu->vga.surf.surf_format = PIXMAN_a8r8g8b8;
 		gpu->vga.surf.surf_type = SURFACE_PIXMAN;
 		vdpy_surface_set(gpu->vdpy_handle, 0, &gpu->vga.surf);
+		vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf);
+		return;
 	}
 
-	vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf);
+	if (damage.height <= 0)
+		return;
+	damage.x = 0;
+	damage.width = gpu->vga.surf.width;
+	vdpy_surface_update_rect(gpu->vdpy_handle, 0, &gpu->vga.surf, &damage);
+}
+
+static void
+virtio_gpu_vga_log_stop(struct virtio_gpu *gpu)
+{
+	if (gpu->vga_log == NULL)
+		return;
+
+	vm_dirty_log_stop(gpu->vga_log);
+	gpu->vga_log = NULL;
+	free(gpu->vga_dirty);
+	gpu->vga_dirty = NULL;
+}
+
+/* the log of the framebuffer of the mode, none if it can't be had */
+static void
+virtio_gpu_vga_log_start(struct virtio_gpu *gpu)
+{
+	struct pci_vdev *dev = gpu->base.dev;
+	size_t len, npages;
+
+	virtio_gpu_vga_log_stop(gpu);
+	len = (size_t)gpu->vga.vberegs.xres * gpu->vga.vberegs.yres * 4;
+	if (len == 0 || len > VIRTIO_GPU_VGA_FB_SIZE)
+		return;
+
+	npages = roundup2(len, 4096) / 4096;
+	gpu->vga_dirty = calloc(roundup2(npages, 64) / 64, sizeof(uint64_t));
+	if (gpu->vga_dirty == NULL)
+		return;
+	gpu->vga_log = vm_dirty_log_start(dev->vmctx, dev->bar[0].addr,
+			dev->vmctx->fb_base, len);
+	if (gpu->vga_log == NULL) {
+		pr_err("%s: no dirty log of the framebuffer, it's uploaded whole.\n",
+			__func__);
+		free(gpu->vga_dirty);
+		gpu->vga_dirty = NULL;
+		gpu->vga_dirty_log = false;
+	}
+}
+
+/*
+ * The rows of the framebuffer written since the last time: all of them
+ * without a dirty log, else those of the pages the log has.
+ */
+static void
+virtio_gpu_vga_damage(struct virtio_gpu *gpu)
+{
+	size_t i, n, first, last;
+	int stride, height, top, bottom;
+
+	stride = gpu->vga.vberegs.xres * 4;
+	height = gpu->vga.vberegs.yres;
+	if (gpu->vga_log == NULL) {
+		top = 0;
+		bottom = height;
+	} else {
+		if (vm_dirty_log_sync(gpu->vga_log, gpu->vga_dirty) == 0)
+			return;
+
+		n = roundup2(roundup2((size_t)stride * height, 4096) / 4096, 64) / 64;
+		first = last = 0;
+		for (i = 0; i < n; i++) {
+			if (gpu->vga_dirty[i] == 0)
+				continue;
+			if (last == 0)
+				first = i * 64 + __builtin_ctzl(gpu->vga_dirty[i]);
+			last = i * 64 + 64 - __builtin_clzl(gpu->vga_dirty[i]);
+		}
+		top = first * 4096 / stride;
+		bottom = MIN((int)((last * 4096 + stride - 1) / stride), height);
+	}
+
+	pthread_mutex_lock(&gpu->vga_thread_mtx);
+	if (gpu->vga_damage_bottom > gpu->vga_damage_top) {
+		top = MIN(top, gpu->vga_damage_top);
+		bottom = MAX(bottom, gpu->vga_damage_bottom);
+	}
+	gpu->vga_damage_top = top;
+	gpu->vga_damage_bottom = bottom;
+	pthread_mutex_unlock(&gpu->vga_thread_mtx);
 }
 
 static void *
@@ -1631,10 +1829,20 @@ virtio_gpu_vga_render(void *param)
 		if(gpu->vga.gc->gc_image->width != gpu->vga.vberegs.xres ||
 		   gpu->vga.gc->gc_image->height != gpu->vga.vberegs.yres) {
 			gc_resize(gpu->vga.gc, gpu->vga.vberegs.xres, gpu->vga.vberegs.yres);
-		}
-		vdpy_submit_bh(gpu->vdpy_handle, &gpu->vga_bh);
+			if (gpu->vga_dirty_log)
+				virtio_gpu_vga_log_start(gpu);
+		} else if (gpu->vga_dirty_log && gpu->vga_log == NULL)
+			virtio_gpu_vga_log_start(gpu);
+
+		/* an idle screen costs nothing with a dirty log */
+		virtio_gpu_vga_damage(gpu);
+		if (gpu->vga_log == NULL || gpu->vga_damage_bottom > 0 ||
+		    gpu->vga.surf.width != gpu->vga.gc->gc_image->width ||
+		    gpu->vga.surf.height != gpu->vga.gc->gc_image->height)
+			vdpy_submit_bh(gpu->vdpy_handle, &gpu->vga_bh);
 		usleep(33000);
 	}
+	virtio_gpu_vga_log_stop(gpu);
 
 	pthread_mutex_lock(&gpu->vga_thread_mtx);
 	atomic_store(&gpu->vga_thread_status, VGA_THREAD_EOL);
@@ -1745,6 +1953,14 @@ virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			gpu->base.device_caps |= (1UL << VIRTIO_GPU_F_RESOURCE_BLOB);
 	}
 
+	/*
+	 * The writes of the guest to the framebuffer trap once per page and
+	 * frame then, so only the instructions the hypervisor can emulate
+	 * may write it: not for the guests drawing it with SSE or AVX.
+	 */
+	if (opts && strcasestr(opts, "vga_dirty_log"))
+		gpu->vga_dirty_log = true;
+
 	/* set queue size */
 	gpu->vq[VIRTIO_GPU_CONTROLQ].qsize = VIRTIO_GPU_RINGSZ;
 	gpu->vq[VIRTIO_GPU_CONTROLQ].notify = virtio_gpu_notify_controlq;
@@ -1784,6 +2000,9 @@ virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (vm_map_memseg_vma(ctx, VIRTIO_GPU_VGA_FB_SIZE, dev->bar[0].addr,
 				(uint64_t)ctx->fb_base, prot) != 0) {
 		pr_err("%s: fail to map VGA framebuffer to bar0.\n", __func__);
+	} else if (vm_add_ram_map(ctx, dev->bar[0].addr,
+			VIRTIO_GPU_VGA_FB_SIZE, ctx->fb_base, -1, 0) != 0) {
+		pr_err("%s: fail to add VGA framebuffer to ram maps.\n", __func__);
 	}
 
 	/** BAR2: VGA & Virtio Modern regs **/
@@ -1791,7 +2010,7 @@ virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	vdpy_get_edid(gpu->vdpy_handle, 0, gpu->edid, VIRTIO_GPU_EDID_SIZE);
 	/* VGA ioports regs [0x400~0x41f] */
 	gpu->vga.gc = gc_init(info.width, info.height, ctx->fb_base);
-	gpu->vga.dev = vga_init(gpu->vga.gc, 0);
+	gpu->vga.dev = vga_init(ctx, gpu->vga.gc, 0);
 	if (gpu->vga.dev == NULL) {
 		pr_err("%s: fail to init vga.\n", __func__);
 		return -1;
@@ -1876,6 +2095,7 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return;
 
 	gpu->vga.enable = false;
+	vm_del_ram_map(ctx, dev->bar[0].addr);
 
 	pthread_mutex_lock(&gpu->vga_thread_mtx);
 	if (atomic_load(&gpu->vga_thread_status) != VGA_THREAD_EOL) {
@@ -1918,7 +2138,7 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				pixman_image_unref(r2d->image);
 				r2d->image = NULL;
 			}
-			if (r2d->blob) {
+			if (r2d->dma_info) {
 				virtio_gpu_dmabuf_unref(r2d->dma_info);
 				r2d->dma_info = NULL;
 				r2d->blob = false;
@@ -69,6 +69,7 @@ static int virtio_i2c_debug=0;
 #define MAX_NODE_NAME_LEN	20
 #define MAX_I2C_VDEV		128
 #define MAX_NATIVE_I2C_ADAPTER	16
+#define VIRTIO_I2C_RINGSZ	64
 #define I2C_MSG_OK	0
 #define I2C_MSG_ERR	1
 #define I2C_NO_DEV	2
@@ -112,10 +113,39 @@ struct virtio_i2c_in_hdr {
 	uint8_t status;
 };
 
+/*
+ * A request of the guest, indexed by the head descriptor of its chain.
+ */
+struct virtio_i2c_req {
+	struct i2c_msg			msg;
+	struct virtio_i2c_in_hdr	*in_hdr;
+	struct native_i2c_adapter	*adapter;	/* NULL: no such client */
+};
+
+/*
+ * A group of requests: the ones with VIRTIO_I2C_FLAGS_FAIL_NEXT and the
+ * first one without, one i2c_transfer() of the guest driver. The group is
+ * run by the worker of its first adapter and completed at once.
+ */
+struct virtio_i2c_job {
+	uint16_t			idx[VIRTIO_I2C_RINGSZ];
+	int				n;
+	TAILQ_ENTRY(virtio_i2c_job)	link;
+};
+
 struct native_i2c_adapter {
 	int 		fd;
 	int 		bus;
 	bool 		i2cdev_enable[MAX_I2C_VDEV];
+
+	/* the worker runs the jobs of the adapter, in order */
+	struct virtio_i2c		*vi2c;
+	bool				started;
+	int				closing;
+	pthread_t			tid;
+	pthread_mutex_t			mtx;
+	pthread_cond_t			cond;
+	TAILQ_HEAD(, virtio_i2c_job)	jobs;
 };
 
 /*
@@ -135,6 +165,13 @@ struct virtio_i2c {
 	pthread_cond_t req_cond;
 	int in_process;
 	int closing;
+
+	struct virtio_i2c_req reqs[VIRTIO_I2C_RINGSZ];
+	struct virtio_i2c_job jobs[VIRTIO_I2C_RINGSZ];
+	/* the completions of the workers, the free jobs */
+	pthread_mutex_t cmpl_mtx;
+	TAILQ_HEAD(, virtio_i2c_job) free_jobs;
+	int nr_jobs;		/* jobs handed to the workers */
 };
 
 static void virtio_i2c_reset(void *);
@@ -406,42 +443,136 @@ native_adapter_find(struct virtio_i2c *vi2c, uint16_t addr)
 	return NULL;
 }
 
-static uint8_t
-native_adapter_proc(struct virtio_i2c *vi2c, struct i2c_msg *msg)
+/*
+ * Run the messages with I2C_RDWR, one call for each run of consecutive
+ * messages on the same adapter, so that they keep their repeated starts.
+ * Once a message fails, the next ones of the group fail without being
+ * run, see VIRTIO_I2C_FLAGS_FAIL_NEXT.
+ */
+static void
+native_adapter_run(struct virtio_i2c *vi2c, struct virtio_i2c_job *job)
 {
-	int ret;
-	uint16_t addr;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
 	struct i2c_rdwr_ioctl_data work_queue;
 	struct native_i2c_adapter *adapter;
-	uint8_t status;
+	struct virtio_i2c_req *req;
+	bool fail = false;
+	int i, j, n;
+
+	for (i = 0; i < job->n; i = j) {
+		req = &vi2c->reqs[job->idx[i]];
+		adapter = req->adapter;
+		if (fail || adapter == NULL) {
+			if (!fail)
+				DPRINTF("%s: could not find device for addr %x\n",
+					__func__, req->msg.addr);
+			req->in_hdr->status = I2C_MSG_ERR;
+			fail = true;
+			j = i + 1;
+			continue;
+		}
+
+		n = 0;
+		for (j = i; j < job->n && n < I2C_RDWR_IOCTL_MAX_MSGS; j++) {
+			req = &vi2c->reqs[job->idx[j]];
+			if (req->adapter != adapter)
+				break;
+			msgs[n++] = req->msg;
+			DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
+					req->msg.flags,
+					req->msg.addr,
+					req->msg.len);
+		}
+
+		work_queue.nmsgs = n;
+		work_queue.msgs = msgs;
+		if (ioctl(adapter->fd, I2C_RDWR, &work_queue) < 0)
+			fail = true;
+
+		for (n = i; n < j; n++)
+			vi2c->reqs[job->idx[n]].in_hdr->status =
+				fail ? I2C_MSG_ERR : I2C_MSG_OK;
+	}
+}
+
+/*
+ * Complete the requests of the job, the workers complete concurrently.
+ */
+static void
+virtio_i2c_job_done(struct virtio_i2c *vi2c, struct virtio_i2c_job *job,
+		    bool submitted)
+{
+	struct virtio_vq_info *vq = &vi2c->vq;
+	int i;
+
+	pthread_mutex_lock(&vi2c->cmpl_mtx);
+	for (i = 0; i < job->n; i++)
+		vq_relchain(vq, job->idx[i], 1);
+	vq_endchains(vq, 0);
+
+	job->n = 0;
+	TAILQ_INSERT_TAIL(&vi2c->free_jobs, job, link);
+	if (submitted)
+		vi2c->nr_jobs--;
+	pthread_mutex_unlock(&vi2c->cmpl_mtx);
+}
+
+static void *
+native_adapter_thread(void *arg)
+{
+	struct native_i2c_adapter *adapter = arg;
+	struct virtio_i2c_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&adapter->mtx);
+		while (TAILQ_EMPTY(&adapter->jobs) && !adapter->closing)
+			pthread_cond_wait(&adapter->cond, &adapter->mtx);
+
+		job = TAILQ_FIRST(&adapter->jobs);
+		if (job == NULL) {
+			pthread_mutex_unlock(&adapter->mtx);
+			return NULL;
+		}
+		TAILQ_REMOVE(&adapter->jobs, job, link);
+		pthread_mutex_unlock(&adapter->mtx);
 
-	addr = msg->addr;
-	adapter = native_adapter_find(vi2c, addr);
-	if (!adapter) {
-		DPRINTF("%s: could not find device for addr %x\n", __func__, msg->addr);
-		return I2C_MSG_ERR;
+		native_adapter_run(adapter->vi2c, job);
+		virtio_i2c_job_done(adapter->vi2c, job, true);
 	}
+}
+
+static int
+native_adapter_start(struct virtio_i2c *vi2c, struct native_i2c_adapter *adapter)
+{
+	char tname[MAXCOMLEN + 1];
+
+	adapter->vi2c = vi2c;
+	adapter->closing = 0;
+	TAILQ_INIT(&adapter->jobs);
+	pthread_mutex_init(&adapter->mtx, NULL);
+	pthread_cond_init(&adapter->cond, NULL);
+	if (pthread_create(&adapter->tid, NULL, native_adapter_thread, adapter)) {
+		WPRINTF("failed to create the worker of i2c-%d\n", adapter->bus);
+		return -1;
+	}
+	snprintf(tname, sizeof(tname), "virtio-i2c-%d", adapter->bus);
+	pthread_setname_np(adapter->tid, tname);
+	adapter->started = true;
+	return 0;
+}
+
+/* the jobs queued are run before the worker exits */
+static void
+native_adapter_stop(struct native_i2c_adapter *adapter)
+{
+	void *jval;
 
-	work_queue.nmsgs = 1;
-	work_queue.msgs = msg;
-
-	ret = ioctl(adapter->fd, I2C_RDWR, &work_queue);
-	if (ret < 0)
-		status = I2C_MSG_ERR;
-	else
-		status = I2C_MSG_OK;
-	if (msg->len)
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x buf=%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len,
-				msg->buf[0]);
-	else
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len);
-	return status;
+	pthread_mutex_lock(&adapter->mtx);
+	adapter->closing = 1;
+	pthread_cond_broadcast(&adapter->cond);
+	pthread_mutex_unlock(&adapter->mtx);
+	pthread_join(adapter->tid, &jval);
+	adapter->started = false;
 }
 
 static struct native_i2c_adapter *
@@ -512,6 +643,8 @@ native_adapter_remove(struct virtio_i2c *vi2c)
 	for (i = 0; i < MAX_NATIVE_I2C_ADAPTER; i++) {
 		native_adapter = vi2c->native_adapter[i];
 		if (native_adapter) {
+			if (native_adapter->started)
+				native_adapter_stop(native_adapter);
 			if (native_adapter->fd > 0)
 				close(native_adapter->fd);
 			free(native_adapter);
@@ -532,18 +665,56 @@ virtio_i2c_req_stop(struct virtio_i2c *vi2c)
 	pthread_join(vi2c->req_tid, &jval);
 }
 
+/*
+ * Hand the job to the worker of its first adapter, the jobs of different
+ * adapters run concurrently. A job without any known client fails here.
+ */
+static void
+virtio_i2c_job_submit(struct virtio_i2c *vi2c, struct virtio_i2c_job *job)
+{
+	struct native_i2c_adapter *adapter = vi2c->reqs[job->idx[0]].adapter;
+
+	if (adapter == NULL) {
+		native_adapter_run(vi2c, job);
+		virtio_i2c_job_done(vi2c, job, false);
+		return;
+	}
+
+	pthread_mutex_lock(&vi2c->cmpl_mtx);
+	vi2c->nr_jobs++;
+	pthread_mutex_unlock(&vi2c->cmpl_mtx);
+
+	pthread_mutex_lock(&adapter->mtx);
+	TAILQ_INSERT_TAIL(&adapter->jobs, job, link);
+	pthread_cond_signal(&adapter->cond);
+	pthread_mutex_unlock(&adapter->mtx);
+}
+
+static struct virtio_i2c_job *
+virtio_i2c_job_get(struct virtio_i2c *vi2c)
+{
+	struct virtio_i2c_job *job;
+
+	/* a job holds one chain at least, there are as many jobs as chains */
+	pthread_mutex_lock(&vi2c->cmpl_mtx);
+	job = TAILQ_FIRST(&vi2c->free_jobs);
+	TAILQ_REMOVE(&vi2c->free_jobs, job, link);
+	pthread_mutex_unlock(&vi2c->cmpl_mtx);
+
+	return job;
+}
+
 static void *
 virtio_i2c_proc_thread(void *arg)
 {
 	struct virtio_i2c *vi2c = arg;
 	struct virtio_vq_info *vq = &vi2c->vq;
+	struct virtio_i2c_job *job = NULL;
+	struct virtio_i2c_req *req;
 	struct iovec iov[3];
 	uint16_t idx, flags[3];
-	struct i2c_msg msg;
 	int n;
-	bool fail_next = false;
 	struct virtio_i2c_out_hdr *out_hdr;
-	struct virtio_i2c_in_hdr *in_hdr;
 
 	for (;;) {
 		pthread_mutex_lock(&vi2c->req_mtx);
@@ -560,10 +731,11 @@ virtio_i2c_proc_thread(void *arg)
 		pthread_mutex_unlock(&vi2c->req_mtx);
 		do {
 			n = vq_getchain(vq, &idx, iov, 3, flags);
-			if (n < 2 || n > 3) {
+			if (n < 2 || n > 3 || idx >= VIRTIO_I2C_RINGSZ) {
 				WPRINTF("virtio_i2c_proc: failed to get iov from virtqueue\n");
 				continue;
 			}
+			req = &vi2c->reqs[idx];
 			out_hdr = iov[0].iov_base;
 			/* From v1.2-cs01 virtio spec, 7-bit address is defined as:
 			 * -----------------------------------------------------------
@@ -572,21 +744,26 @@ virtio_i2c_proc_thread(void *arg)
 			 * 7-bit address|0 |0 |0 |0 |0 |0 |0|0|A6|A5|A4|A3|A2|A1|A0|0|
 			 * -------------+--+--+--+--+--+--+-+-+--+--+--+--+--+--+--+-+
 			 */
-			msg.addr = out_hdr->addr >> 1;
+			req->msg.addr = out_hdr->addr >> 1;
 			if (out_hdr->flags & VIRTIO_I2C_FLAGS_M_RD)
-				msg.flags = I2C_M_RD;
+				req->msg.flags = I2C_M_RD;
 			else
-				msg.flags = I2C_NO_FLAGS;
+				req->msg.flags = I2C_NO_FLAGS;
 			if (n == 3) {
-				msg.buf = iov[1].iov_base;
-				msg.len = iov[1].iov_len;
-				in_hdr = iov[2].iov_base;
+				req->msg.buf = iov[1].iov_base;
+				req->msg.len = iov[1].iov_len;
+				req->in_hdr = iov[2].iov_base;
 			} else {
 				// this is a zero-length request
-				msg.buf = NULL;
-				msg.len = 0;
-				in_hdr = iov[1].iov_base;
+				req->msg.buf = NULL;
+				req->msg.len = 0;
+				req->in_hdr = iov[1].iov_base;
 			}
+			req->adapter = native_adapter_find(vi2c, req->msg.addr);
+
+			if (job == NULL)
+				job = virtio_i2c_job_get(vi2c);
+			job->idx[job->n++] = idx;
 
 			/*
 			 * From v1.2-cs01 virtio spec:
@@ -595,19 +772,17 @@ virtio_i2c_proc_thread(void *arg)
 			 * If this bit is set and a device fails to process the current request, it needs to
 			 * fail the next request instead of attempting to execute it.
 			 */
-			if (!fail_next) {
-				in_hdr->status = native_adapter_proc(vi2c, &msg);
-				if ((out_hdr->flags & VIRTIO_I2C_FLAGS_FAIL_NEXT) && (in_hdr->status == I2C_MSG_ERR))
-					fail_next = true;
-			} else {
-				in_hdr->status = I2C_MSG_ERR;
+			if (!(out_hdr->flags & VIRTIO_I2C_FLAGS_FAIL_NEXT)) {
+				virtio_i2c_job_submit(vi2c, job);
+				job = NULL;
 			}
-			vq_relchain(vq, idx, 1);
-
-			if (!(out_hdr->flags & VIRTIO_I2C_FLAGS_FAIL_NEXT))
-				fail_next = false;
 		} while (vq_has_descs(vq));
-		vq_endchains(vq, 0);
+
+		/* the driver queues a group whole before the kick, just in case */
+		if (job != NULL) {
+			virtio_i2c_job_submit(vi2c, job);
+			job = NULL;
+		}
 	}
 }
 
@@ -763,6 +938,16 @@ virtio_i2c_reset(void *vdev)
 	struct virtio_i2c *vi2c = vdev;
 
 	DPRINTF("device reset requested !\n");
+
+	/* the jobs in flight complete before the ring goes */
+	pthread_mutex_lock(&vi2c->cmpl_mtx);
+	while (vi2c->in_process || vi2c->nr_jobs) {
+		pthread_mutex_unlock(&vi2c->cmpl_mtx);
+		usleep(1000);
+		pthread_mutex_lock(&vi2c->cmpl_mtx);
+	}
+	pthread_mutex_unlock(&vi2c->cmpl_mtx);
+
 	virtio_reset_dev(&vi2c->base);
 }
 
@@ -786,7 +971,7 @@ virtio_i2c_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	u_char digest[16];
 	struct virtio_i2c *vi2c;
 	pthread_mutexattr_t attr;
-	int rc = -1;
+	int i, rc = -1;
 
 	vi2c = calloc(1, sizeof(struct virtio_i2c));
 	if (!vi2c) {
@@ -826,7 +1011,7 @@ virtio_i2c_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	virtio_linkup(&vi2c->base, &virtio_i2c_ops, vi2c, dev, &vi2c->vq, BACKEND_VBSU);
 	vi2c->base.mtx = &vi2c->mtx;
 	vi2c->base.device_caps = VIRTIO_I2C_HOSTCAPS;
-	vi2c->vq.qsize = 64;
+	vi2c->vq.qsize = VIRTIO_I2C_RINGSZ;
 	vi2c->native_adapter_num = 0;
 
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
@@ -865,6 +1050,19 @@ virtio_i2c_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto fail;
 	}
 	rc = virtio_set_modern_bar(&vi2c->base, false);
+
+	pthread_mutex_init(&vi2c->cmpl_mtx, NULL);
+	TAILQ_INIT(&vi2c->free_jobs);
+	for (i = 0; i < VIRTIO_I2C_RINGSZ; i++)
+		TAILQ_INSERT_TAIL(&vi2c->free_jobs, &vi2c->jobs[i], link);
+	for (i = 0; i < MAX_NATIVE_I2C_ADAPTER; i++) {
+		if (vi2c->native_adapter[i] &&
+		    native_adapter_start(vi2c, vi2c->native_adapter[i])) {
+			rc = -1;
+			goto fail;
+		}
+	}
+
 	vi2c->in_process = 0;
 	vi2c->closing = 0;
 	pthread_mutex_init(&vi2c->req_mtx, NULL);
@@ -43,6 +43,11 @@ static int virtio_input_debug;
  */
 #define VIRTIO_INPUT_PACKET_SIZE	10
 
+/*
+ * Host events read at once from the evdev
+ */
+#define VIRTIO_INPUT_READ_BATCH		64
+
 /*
  * Host capabilities
  */
@@ -122,6 +127,9 @@ struct virtio_input {
 	struct virtio_input_event_elem		*event_queue;
 	uint32_t				event_qsize;
 	uint32_t				event_qindex;
+	bool					packet_urgent;
+	bool					intr_pending;	/* packets sent, interrupt not yet */
+	bool					intr_urgent;	/* not held back by coalesce */
 };
 
 static void virtio_input_reset(void *);
@@ -153,6 +161,9 @@ virtio_input_reset(void *vdev)
 
 	DPRINTF(("vtinput: device reset requested!\n"));
 	vi->ready = false;
+	vi->packet_urgent = false;
+	vi->intr_pending = false;
+	vi->intr_urgent = false;
 	virtio_reset_dev(&vi->base);
 }
 
@@ -311,9 +322,19 @@ virtio_input_send_event(struct virtio_input *vi,
 	vi->event_queue[vi->event_qindex].event = *event;
 	vi->event_qindex++;
 
+	/* only the pointer motion of a packet may wait for the coalesce window */
+	if (event->type != EV_SYN && event->type != EV_REL &&
+	    event->type != EV_ABS && event->type != EV_MSC)
+		vi->packet_urgent = true;
+
 	if (event->type != EV_SYN || event->code != SYN_REPORT)
 		return;
 
+	/* the interrupt is raised once the events read at once are all sent */
+	vi->intr_pending = true;
+	vi->intr_urgent |= vi->packet_urgent;
+	vi->packet_urgent = false;
+
 	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
 	for (i = 0; i < vi->event_qindex; i++) {
 		if (!vq_has_descs(vq)) {
@@ -351,7 +372,23 @@ virtio_input_send_event(struct virtio_input *vi,
 
 out:
 	vi->event_qindex = 0;
+}
+
+/* raise one interrupt for the packets sent since the last one */
+static void
+virtio_input_end_events(struct virtio_input *vi)
+{
+	struct virtio_vq_info *vq;
+
+	if (!vi->intr_pending)
+		return;
+
+	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
 	vq_endchains(vq, 1);
+	if (vi->intr_urgent)
+		vq_coalesce_flush(vq);
+	vi->intr_pending = false;
+	vi->intr_urgent = false;
 }
 
 static void
@@ -361,12 +398,13 @@ virtio_input_read_event(int fd __attribute__((unused)),
 {
 	struct virtio_input *vi = arg;
 	struct virtio_input_event event;
-	struct input_event host_event;
-	int len;
+	struct input_event host_events[VIRTIO_INPUT_READ_BATCH];
+	int i, len;
 
 	while (1) {
-		len = read(vi->fd, &host_event, sizeof(host_event));
-		if (len != sizeof(host_event)) {
+		/* evdev reads whole events only */
+		len = read(vi->fd, host_events, sizeof(host_events));
+		if (len < (int)sizeof(host_events[0])) {
 			if (len == -1 && errno != EAGAIN)
 				WPRINTF(("vtinput: host read failed! "
 					"len = %d, errno = %d\n",
@@ -374,11 +412,18 @@ virtio_input_read_event(int fd __attribute__((unused)),
 			break;
 		}
 
-		event.type = host_event.type;
-		event.code = host_event.code;
-		event.value = host_event.value;
-		virtio_input_send_event(vi, &event);
+		for (i = 0; i < len / (int)sizeof(host_events[0]); i++) {
+			event.type = host_events[i].type;
+			event.code = host_events[i].code;
+			event.value = host_events[i].value;
+			virtio_input_send_event(vi, &event);
+		}
+
+		if (len < (int)sizeof(host_events))
+			break;
 	}
+
+	virtio_input_end_events(vi);
 }
 
 static int
@@ -576,6 +621,7 @@ virtio_input_teardown(void *param)
 
 	vi = (struct virtio_input *)param;
 	if (vi) {
+		virtio_coalesce_deinit(&vi->base);
 		pthread_mutex_destroy(&vi->mtx);
 		if (vi->event_queue)
 			free(vi->event_queue);
@@ -596,13 +642,15 @@ static int
 virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_input *vi;
+	struct virtio_coalesce_opts co_opt;
 	pthread_mutexattr_t attr;
+	bool coalesce = false;
 	char *opt;
 	int flags, ver;
 	int rc;
 
 	/* get evdev path from opts
-	 * -s n,virtio-input,/dev/input/eventX[,serial]
+	 * -s n,virtio-input,/dev/input/eventX[,serial][,coalesce=<frames>:<usecs>[:adaptive]]
 	 */
 	if (!opts) {
 		WPRINTF(("%s: evdev path is NULL\n", __func__));
@@ -627,11 +675,17 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto opt_fail;
 	}
 
-	if (opts) {
-		vi->serial = strdup(opts);
-		if (!vi->serial) {
-			WPRINTF(("%s: strdup serial failed\n", __func__));
-			goto serial_fail;
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(opt, "coalesce=", 9)) {
+			if (virtio_coalesce_parse_options(opt + 9, &co_opt))
+				goto open_fail;
+			coalesce = true;
+		} else if (!vi->serial) {
+			vi->serial = strdup(opt);
+			if (!vi->serial) {
+				WPRINTF(("%s: strdup serial failed\n", __func__));
+				goto serial_fail;
+			}
 		}
 	}
 
@@ -696,6 +750,10 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	vi->queues[VIRTIO_INPUT_STATUS_QUEUE].notify =
 		virtio_input_notify_status_vq;
 
+	/* the packets of pointer motion only wait for the window */
+	if (coalesce && virtio_coalesce_init(&vi->base, &co_opt))
+		goto fail;
+
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_INPUT);
 	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
@@ -758,6 +816,9 @@ struct pci_vdev_ops pci_ops_virtio_input = {
 	.vdev_init	= virtio_input_init,
 	.vdev_deinit	= virtio_input_deinit,
 	.vdev_barwrite	= virtio_pci_write,
-	.vdev_barread	= virtio_pci_read
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_restore	= virtio_pci_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_virtio_input);
@@ -44,6 +44,7 @@
 #include <linux/if_tun.h>
 #include <sys/socket.h>
 #include <linux/vhost.h>
+#include <liburing.h>
 
 #include "dm.h"
 #include "pci_core.h"
@@ -51,9 +52,15 @@
 #include "virtio.h"
 #include "vhost.h"
 #include "dm_string.h"
+#include "iothread.h"
+#include "atomic.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_TX_BATCH	8	/* chains fetched and released at once */
+#define VIRTIO_NET_RX_MAXLEN	(65550 + 12)	/* a GSO frame and its header */
+#define VIRTIO_NET_RX_MAXBUFS	64	/* merged rx bufs of one frame */
+#define VIRTIO_NET_RX_BATCH	64	/* rx chains released at once */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -77,11 +84,21 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple queue pairs */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
 
+/* offered when the tap passes the virtio_net_hdr through */
+#define VIRTIO_NET_S_OFFLOADCAPS \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_HOST_ECN | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | \
+	VIRTIO_NET_F_GUEST_ECN)
+#define VIRTIO_NET_S_UFOCAPS \
+	(VIRTIO_NET_F_HOST_UFO | VIRTIO_NET_F_GUEST_UFO)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
 	(1 << VIRTIO_RING_F_EVENT_IDX) | VIRTIO_NET_F_MRG_RXBUF | \
@@ -96,16 +113,35 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions: the RX and TX queues of pair n are the queues 2n and
+ * 2n + 1, the control queue, only with several pairs, follows the last pair.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_PAIRS	16
+#define VIRTIO_NET_MAXQ		(VIRTIO_NET_MAX_PAIRS * 2 + 1)
+
+/* us, longer polls only burn the Service VM cores */
+#define VIRTIO_NET_BUSYLOOP_MAX	100000
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK		0
+#define VIRTIO_NET_ERR		1
+
+#define VIRTIO_NET_CTRL_MQ			4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
 
 /*
  * Fixed network header size
@@ -132,50 +168,81 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* the RX/TX queues of one pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+/*
+ * A pair of RX/TX queues, with its own tap queue and threads
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;
+
+	int		tapfd;		/* one queue of a multi-queue tap */
+	struct mevent	*mevp;
+	struct iothread_ctx *ioctx;	/* RX in an iothread instead */
+	struct iothread_mevent iomvt;
+
+	int		rx_ready;
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+	struct io_uring	tx_ring;	/* the writes of a TX batch */
+	bool		tx_uring;
+	int		tx_queued;	/* writes in tx_ring not completed */
+
+	bool		attached;	/* the tap queue gets packets */
+
+	struct vhost_net *vhost_net;
+	uint32_t	busyloop_timeout; /* us the vhost worker polls for */
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
-
-	int		rx_ready;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_PAIRS];
+	int		nr_pairs;	/* the pairs of the device */
+	int		cur_pairs;	/* the pairs the driver uses */
 
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_gso;		/* a frame may take several merged rx bufs */
+
+	bool		tap_vnet_hdr;	/* the tap reads and writes the header */
+	bool		tap_ufo;	/* the tap can do UFO */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
+	void (*virtio_net_tx_flush)(struct virtio_net_qpair *qp);
 
-	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	struct iothread_ctx *ioctx_base;
+	int		nr_ioctx;
+	int		refs;	/* the tap mevents not torn down yet, + 1 */
 };
-
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
+static void virtio_net_tap_tx_flush(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -183,15 +250,17 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
+static void virtio_net_put(struct virtio_net *net);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
-	int tapfd, int vq_idx);
+	int tapfd, int vq_idx, enum vhost_backend_type backend_type,
+	uint32_t busyloop_timeout);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 1 pair, see virtio_net_init() */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -264,40 +333,112 @@ ether_aton(const char *a, struct ether_addr *e)
 	return e;
 }
 
+static inline struct virtio_net_qpair *
+virtio_net_vq_to_qpair(struct virtio_net *net, struct virtio_vq_info *vq)
+{
+	return &net->qpairs[(vq - net->queues) / 2];
+}
+
 /*
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Only the tap queues of the pairs in use get packets, the kernel would
+ * hash the flows onto the others as well.
+ */
+static void
+virtio_net_set_pairs(struct virtio_net *net, int pairs)
+{
+	struct virtio_net_qpair *qp;
+	struct ifreq ifr;
+	bool attach;
+	int i;
+
+	for (i = 0; i < net->nr_pairs && net->nr_pairs > 1; i++) {
+		qp = &net->qpairs[i];
+		attach = (i < pairs);
+		if (qp->tapfd < 0 || qp->attached == attach)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = attach ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(qp->tapfd, TUNSETQUEUE, (void *)&ifr) < 0)
+			WPRINTF(("vtnet: failed to %s tap queue %d: %d\n",
+				attach ? "attach" : "detach", i, errno));
+		else
+			qp->attached = attach;
+	}
+	net->cur_pairs = pairs;
+}
+
+/*
+ * The header size and the offloads of a vnet hdr tap follow the negotiated
+ * features, the guest ones tell what the tap may hand over.
+ */
+static void
+virtio_net_tap_set_vnet(struct virtio_net *net, uint64_t features)
+{
+	unsigned int offloads = 0;
+	int hdrlen = net->rx_vhdrlen;
+	int i, fd;
+
+	if (features & VIRTIO_NET_F_GUEST_CSUM) {
+		offloads |= TUN_F_CSUM;
+		if (features & VIRTIO_NET_F_GUEST_TSO4)
+			offloads |= TUN_F_TSO4;
+		if (features & VIRTIO_NET_F_GUEST_TSO6)
+			offloads |= TUN_F_TSO6;
+		if (features & VIRTIO_NET_F_GUEST_ECN)
+			offloads |= TUN_F_TSO_ECN;
+		if (features & VIRTIO_NET_F_GUEST_UFO)
+			offloads |= TUN_F_UFO;
+	}
+
+	for (i = 0; i < net->nr_pairs; i++) {
+		fd = net->qpairs[i].tapfd;
+		if (fd < 0)
+			continue;
+		if (ioctl(fd, TUNSETVNETHDRSZ, &hdrlen) < 0)
+			WPRINTF(("vtnet: failed to set the tap header size: %d\n",
+				errno));
+		if (ioctl(fd, TUNSETOFFLOAD, offloads) < 0)
+			WPRINTF(("vtnet: failed to set the tap offloads 0x%x: %d\n",
+				offloads, errno));
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -307,16 +448,24 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->nr_pairs; i++) {
+		virtio_net_txwait(&net->qpairs[i]);
+		virtio_net_rxwait(&net->qpairs[i]);
+		net->qpairs[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
+	net->rx_gso = 0;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	if (net->tap_vnet_hdr)
+		virtio_net_tap_set_vnet(net, 0);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
+	/* the driver uses the first pair only until it asks for more */
+	virtio_net_set_pairs(net, 1);
+
 	net->resetting = 0;
 	net->closing = 0;
 }
@@ -325,42 +474,100 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
+}
+
+/*
+ * Submit the writes queued by virtio_net_tap_tx() and wait for them, a
+ * failed write drops the frame as writev() does.
+ */
+static void
+virtio_net_tap_tx_flush(struct virtio_net_qpair *qp)
+{
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	if (qp->tx_queued == 0)
+		return;
+
+	do {
+		ret = io_uring_submit(&qp->tx_ring);
+	} while (ret == -EINTR || ret == -EAGAIN);
+	if (ret < 0) {
+		WPRINTF(("vtnet: tx io_uring_submit failed: %d\n", ret));
+		qp->tx_queued = 0;
+		qp->tx_uring = false;
+		return;
+	}
+
+	while (qp->tx_queued > 0) {
+		ret = io_uring_wait_cqe(&qp->tx_ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0) {
+			WPRINTF(("vtnet: tx io_uring_wait_cqe failed: %d\n", ret));
+			qp->tx_queued = 0;
+			qp->tx_uring = false;
+			return;
+		}
+		io_uring_cqe_seen(&qp->tx_ring, cqe);
+		qp->tx_queued--;
+	}
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
+	struct io_uring_sqe *sqe;
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
 	 * If the length is < 60, pad out to that and add the
 	 * extra zero'd segment to the iov. It is guaranteed that
 	 * there is always an extra iov available by the caller.
+	 * len doesn't count the header a vnet hdr tap is given.
 	 */
 	if (len < 60) {
 		iov[iovcnt].iov_base = pad;
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+
+	/*
+	 * The frames of a batch are written with one syscall, the iov stays
+	 * valid until virtio_net_tap_tx_flush().
+	 */
+	if (qp->tx_uring) {
+		sqe = io_uring_get_sqe(&qp->tx_ring);
+		if (sqe == NULL) {
+			virtio_net_tap_tx_flush(qp);
+			sqe = io_uring_get_sqe(&qp->tx_ring);
+		}
+		if (sqe != NULL) {
+			io_uring_prep_writev(sqe, qp->tapfd, iov, iovcnt, 0);
+			qp->tx_queued++;
+			return;
+		}
+	}
+
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -401,19 +608,23 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 }
 
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
 {
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	uint16_t idx[VIRTIO_NET_RX_MAXBUFS];
+	uint32_t blen[VIRTIO_NET_RX_MAXBUFS];
+	struct vq_chain rel[VIRTIO_NET_RX_BATCH];
 	struct virtio_vq_info *vq;
 	void *vrx;
-	int len, n;
-	uint16_t idx;
+	int len, n, niov, nbufs, nrel, i, j;
+	uint32_t total, ulen;
 	ssize_t ret;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -422,11 +633,11 @@ virtio_net_tap_rx(struct virtio_net *net)
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!qp->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -435,137 +646,222 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[qp->idx * 2 + VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	nrel = 0;
 	do {
 		/*
-		 * Get descriptor chain.
+		 * Get descriptor chain, or, when a GSO frame may not fit in
+		 * one merged rx buf, as many as the largest frame needs.
 		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
-			return;
-		}
+		nbufs = 0;
+		niov = 0;
+		total = 0;
+		do {
+			n = vq_getchain(vq, &idx[nbufs], &iov[niov],
+					VIRTIO_NET_MAXSEGS - niov, NULL);
+			if (n < 1 || n > VIRTIO_NET_MAXSEGS - niov) {
+				WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
+				if (nbufs == 0)
+					goto out;
+				break;
+			}
+			for (blen[nbufs] = 0, i = niov; i < niov + n; i++)
+				blen[nbufs] += iov[i].iov_len;
+			total += blen[nbufs];
+			niov += n;
+			nbufs++;
+		} while (net->rx_gso && total < VIRTIO_NET_RX_MAXLEN &&
+			 nbufs < VIRTIO_NET_RX_MAXBUFS &&
+			 niov < VIRTIO_NET_MAXSEGS && vq_has_descs(vq));
+
 		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
+		 * Get a pointer to the rx header. The tap writes it with
+		 * the frame, else use the data immediately following it
+		 * for the packet buffer.
 		 */
 		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
-			return;
+		if (iov[0].iov_len < net->rx_vhdrlen) {
+			WPRINTF(("vtnet: rx header not in the first segment\n"));
+			goto out;
+		}
+		n = niov;
+		if (net->tap_vnet_hdr)
+			riov = iov;
+		else {
+			riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+			if (riov == NULL)
+				goto out;
+		}
 
-		len = readv(net->tapfd, riov, n);
+		len = readv(qp->tapfd, riov, n);
 
-		if (len < 0 && errno == EWOULDBLOCK) {
+		if (len < 0) {
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
-			vq_retchain(vq);
+			if (errno != EWOULDBLOCK)
+				WPRINTF(("vtnet: tap read failed: %d\n", errno));
+			for (i = 0; i < nbufs; i++)
+				vq_retchain(vq);
+			vq_relchains_bulk(vq, rel, nrel);
 			vq_endchains(vq, 0);
 			return;
 		}
 
 		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
+		 * With a tap which doesn't pass it through, the only valid
+		 * field in the rx packet header is the number of buffers if
+		 * merged rx bufs were negotiated.
 		 */
-		memset(vrx, 0, net->rx_vhdrlen);
+		if (!net->tap_vnet_hdr) {
+			memset(vrx, 0, net->rx_vhdrlen);
+			len += net->rx_vhdrlen;
+		}
+
+		/* the frame takes the first bufs, give the others back */
+		for (i = 0, ulen = len; i < nbufs - 1 && ulen > blen[i]; i++)
+			ulen -= blen[i];
+		for (j = nbufs - 1; j > i; j--)
+			vq_retchain(vq);
 
 		if (net->rx_merge) {
 			struct virtio_net_rxhdr *vrxh;
 
 			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
+			vrxh->vrh_bufs = i + 1;
 		}
 
 		/*
-		 * Release this chain and handle more chains.
+		 * Release the chains, the guest sees them by batches, and
+		 * handle more chains.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
+		if (nrel + i + 1 > VIRTIO_NET_RX_BATCH) {
+			vq_relchains_bulk(vq, rel, nrel);
+			nrel = 0;
+		}
+		for (j = 0, ulen = len; j <= i; j++, nrel++) {
+			rel[nrel].idx = idx[j];
+			rel[nrel].len = MIN(ulen, blen[j]);
+			ulen -= rel[nrel].len;
+		}
 	} while (vq_has_descs(vq));
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	vq_relchains_bulk(vq, rel, nrel);
 	vq_endchains(vq, 1);
+	return;
+
+out:
+	vq_relchains_bulk(vq, rel, nrel);
+	vq_endchains(vq, 0);
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
+
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+}
+
+/* the RX of a pair bound to an iothread */
+static void
+virtio_net_rx_iothread(void *arg)
+{
+	struct virtio_net_qpair *qp = arg;
 
+	virtio_net_rx_callback(qp->tapfd, EVF_READ, qp);
 }
 
 static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = virtio_net_vq_to_qpair(net, vq);
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		if (vq->used != NULL) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
+		if (vq_ring_ready(vq)) {
+			vq_set_used_ring_flags(&net->base, vq);
 		}
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
+	struct iovec iov[VIRTIO_NET_TX_BATCH][VIRTIO_NET_MAXSEGS + 1];
+	struct vq_chain chains[VIRTIO_NET_TX_BATCH], *chain;
+	int i, j, n, nchains;
 	int plen, tlen;
-	uint16_t idx;
+
+	for (i = 0; i < VIRTIO_NET_TX_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = NULL;
+	}
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
+	 * Obtain the chains of descriptors.  The first one of each
+	 * is really the header descriptor, so we need to sum
 	 * up two lengths: packet length and transfer length.
 	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
-		return;
-	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
-	}
+	nchains = vq_getchains_bulk(vq, chains, VIRTIO_NET_TX_BATCH,
+			VIRTIO_NET_MAXSEGS);
+	for (i = 0; i < nchains; i++) {
+		chain = &chains[i];
+		n = chain->n;
+		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
+			break;
+		}
+		plen = 0;
+		tlen = chain->iov[0].iov_len;
+		for (j = 1; j < n; j++) {
+			plen += chain->iov[j].iov_len;
+			tlen += chain->iov[j].iov_len;
+		}
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
+		/* the header goes along to a tap which takes it */
+		if (qp->net->tap_vnet_hdr)
+			qp->net->virtio_net_tx(qp, chain->iov, n, plen);
+		else
+			qp->net->virtio_net_tx(qp, &chain->iov[1], n - 1, plen);
+		chain->len = tlen;
+	}
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	/* the frames are out, release the chains and set their tlen */
+	if (qp->net->virtio_net_tx_flush)
+		qp->net->virtio_net_tx_flush(qp);
+	vq_relchains_bulk(vq, chains, i);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = virtio_net_vq_to_qpair(net, vq);
 
 	/*
 	 * Any ring entries to process?
@@ -574,11 +870,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	vq_set_used_ring_flags(&net->base, vq);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -587,27 +883,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[qp->idx * 2 + VIRTIO_NET_TXQ];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -621,18 +918,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(&net->base, vq);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -640,7 +937,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -648,17 +945,67 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
 }
 
-#ifdef notyet
+/*
+ * The control queue, only VIRTIO_NET_CTRL_MQ is supported: the command and
+ * its data are in the descriptors the driver wrote, the ack is the last
+ * byte of the chain.
+ */
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct virtio_net_ctrl_hdr *hdr;
+	struct iovec iov[4];
+	uint16_t idx, flags[4], pairs;
+	uint8_t cmd[16], *ack;
+	size_t len, sz;
+	int i, n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, 4, flags);
+		if (n < 1) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n", n));
+			break;
+		}
+		if ((flags[n - 1] & VRING_DESC_F_WRITE) == 0 ||
+		    iov[n - 1].iov_len < 1) {
+			WPRINTF(("vtnet: control command without ack\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+		ack = iov[n - 1].iov_base;
+
+		for (i = 0, len = 0; i < n - 1 && len < sizeof(cmd); i++) {
+			if (flags[i] & VRING_DESC_F_WRITE)
+				break;
+			sz = MIN(iov[i].iov_len, sizeof(cmd) - len);
+			memcpy(cmd + len, iov[i].iov_base, sz);
+			len += sz;
+		}
+
+		*ack = VIRTIO_NET_ERR;
+		hdr = (struct virtio_net_ctrl_hdr *)cmd;
+		if (len >= sizeof(*hdr) + sizeof(pairs) &&
+		    (net->features & VIRTIO_NET_F_MQ) &&
+		    hdr->class == VIRTIO_NET_CTRL_MQ &&
+		    hdr->cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+			memcpy(&pairs, cmd + sizeof(*hdr), sizeof(pairs));
+			if (pairs >= 1 && pairs <= net->nr_pairs) {
+				DPRINTF(("vtnet: %d queue pairs in use\n", pairs));
+				virtio_net_set_pairs(net, pairs);
+				*ack = VIRTIO_NET_OK;
+			}
+		} else
+			DPRINTF(("vtnet: unsupported control command\n"));
+
+		vq_relchain(vq, idx, 1);
+	}
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -738,10 +1085,11 @@ virtio_net_is_macvtap(char *devname, int *ifindex)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool multi_queue, bool *vnet_hdr)
 {
 	char tbuf[IFNAMSIZ];
 	int tunfd, rc, macvtap_index;
+	unsigned int features;
 	struct ifreq ifr;
 
 	/*Check if tun/tap or macvtap interface is used */
@@ -764,6 +1112,17 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	/* each open of the same name adds one queue to the tap */
+	if (multi_queue)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	/* the virtio_net_hdr is passed through, if the tap can */
+	if (*vnet_hdr) {
+		if (ioctl(tunfd, TUNGETFEATURES, &features) < 0 ||
+		    (features & IFF_VNET_HDR) == 0)
+			*vnet_hdr = false;
+		else
+			ifr.ifr_flags |= IFF_VNET_HDR;
+	}
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -785,9 +1144,11 @@ virtio_net_tap_open(char *devname)
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
+	struct virtio_net_qpair *qp;
 	char tbuf[IFNAMSIZ];
 	int vhost_fd = -1;
-	int rc;
+	int rc, i, opt;
+	bool vnet_hdr;
 
 	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
@@ -795,51 +1156,159 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
+	net->virtio_net_tx_flush = virtio_net_tap_tx_flush;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
+	/*
+	 * One tap queue per pair, set non-blocking. The link is down if any
+	 * of them can't be opened. vhost-net adds the header itself.
+	 */
+	vnet_hdr = !net->use_vhost;
+	for (i = 0; i < net->nr_pairs; i++) {
+		qp = &net->qpairs[i];
+		qp->tapfd = virtio_net_tap_open(tbuf, net->nr_pairs > 1,
+				&vnet_hdr);
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s failed\n", tbuf));
+			break;
+		}
+		qp->attached = true;
+
+		opt = 1;
+		if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			close(qp->tapfd);
+			qp->tapfd = -1;
+			break;
+		}
+	}
+	if (i < net->nr_pairs) {
+		while (--i >= 0) {
+			close(net->qpairs[i].tapfd);
+			net->qpairs[i].tapfd = -1;
+		}
 		return;
 	}
 	DPRINTF(("open of tap device %s success!\n", tbuf));
 
 	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
+	 * With the header, the tap takes and gives partial checksums and
+	 * GSO frames. Only newer kernels have UFO.
 	 */
-	int opt = 1;
-
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+	if (vnet_hdr) {
+		net->tap_vnet_hdr = true;
+		net->tap_ufo = (ioctl(net->qpairs[0].tapfd, TUNSETOFFLOAD,
+				TUN_F_CSUM | TUN_F_UFO) == 0);
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+		if (net->tap_ufo)
+			net->base.device_caps |= VIRTIO_NET_S_UFOCAPS;
+		virtio_net_tap_set_vnet(net, 0);
 	}
 
-	if (net->use_vhost) {
-		vhost_fd = open("/dev/vhost-net", O_RDWR);
-		if (vhost_fd < 0)
-			WPRINTF(("open of vhost-net failed\n"));
-		else {
-			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
-			if (!net->vhost_net) {
-				WPRINTF(("vhost_net_init failed, fallback "
-					"to userspace virtio\n"));
-				close(vhost_fd);
-				vhost_fd = -1;
+	for (i = 0; i < net->nr_pairs; i++) {
+		qp = &net->qpairs[i];
+
+		vhost_fd = -1;
+		if (net->use_vhost) {
+			vhost_fd = open("/dev/vhost-net", O_RDWR);
+			if (vhost_fd < 0)
+				WPRINTF(("open of vhost-net failed\n"));
+			else {
+				qp->vhost_net = vhost_net_init(&net->base,
+					vhost_fd, qp->tapfd, i * 2,
+					VHOST_BACKEND_KERNEL,
+					qp->busyloop_timeout);
+				if (!qp->vhost_net) {
+					WPRINTF(("vhost_net_init failed, fallback "
+						"to userspace virtio\n"));
+					close(vhost_fd);
+					vhost_fd = -1;
+				}
 			}
 		}
-	}
+		if (vhost_fd >= 0)
+			continue;
+
+		/* without io_uring, the frames of a batch are written one by one */
+		rc = io_uring_queue_init(VIRTIO_NET_TX_BATCH, &qp->tx_ring, 0);
+		if (rc < 0)
+			WPRINTF(("vtnet: tx io_uring_queue_init failed: %d\n", rc));
+		else
+			qp->tx_uring = true;
+
+		/*
+		 * Register for read notifications, with the iothread of the
+		 * pair or the event loop
+		 */
+		if (qp->ioctx) {
+			qp->iomvt.run = virtio_net_rx_iothread;
+			qp->iomvt.arg = qp;
+			qp->iomvt.fd = qp->tapfd;
+			if (iothread_add(qp->ioctx, qp->tapfd, &qp->iomvt) < 0) {
+				WPRINTF(("Could not add tap queue %d to iothread\n", i));
+				close(qp->tapfd);
+				qp->tapfd = -1;
+				qp->ioctx = NULL;
+			}
+			continue;
+		}
 
-	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+		qp->mevp = mevent_add_disp(qp->tapfd, EVF_READ,
+				       virtio_net_rx_callback, qp,
+				       virtio_net_teardown, qp, MEVENT_DISP_NET);
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+			close(qp->tapfd);
+			qp->tapfd = -1;
+		} else
+			net->refs++;
+	}
+}
+
+/*
+ * busyloop=<usecs>[:<usecs>...], the time the vhost worker of each pair
+ * polls its queues for before it sleeps until a kick
+ */
+static int
+virtio_net_parse_busyloop(char *str, uint32_t *busyloop, int *num)
+{
+	char *tok, *end;
+	uint32_t usecs;
+
+	*num = 0;
+	while ((tok = strsep(&str, ":")) != NULL) {
+		if (*num >= VIRTIO_NET_MAX_PAIRS ||
+		    dm_strtoui(tok, &end, 10, &usecs) || *end != '\0' ||
+		    usecs > VIRTIO_NET_BUSYLOOP_MAX) {
+			WPRINTF(("virtio_net: incorrect busyloop %s\n", tok));
+			return -1;
 		}
+		busyloop[(*num)++] = usecs;
+	}
+
+	return 0;
+}
+
+/*
+ * A vhost-user backend serves the queues of one pair, with no tap in the
+ * device model.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, char *path)
+{
+	struct virtio_net_qpair *qp = &net->qpairs[0];
+	int fd;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("connect to vhost-user backend %s failed\n", path));
+		return;
+	}
+
+	qp->vhost_net = vhost_net_init(&net->base, fd, -1, 0,
+			VHOST_BACKEND_USER, 0);
+	if (!qp->vhost_net) {
+		WPRINTF(("vhost_net_init of %s failed\n", path));
+		close(fd);
 	}
 }
 
@@ -851,6 +1320,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char nstr[80];
 	char tname[MAXCOMLEN + 1];
 	struct virtio_net *net = NULL;
+	struct virtio_net_qpair *qp;
 	char *devopts = NULL;
 	char *name = NULL;
 	char *type = NULL;
@@ -860,7 +1330,15 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	int rc, i;
+	struct virtio_coalesce_opts co_opt;
+	bool use_coalesce = false;
+	struct iothreads_option iot_opt;
+	bool use_iothread = false;
+	uint32_t busyloop[VIRTIO_NET_MAX_PAIRS];
+	int nr_busyloop = 0;
+
+	memset(&iot_opt, 0, sizeof(iot_opt));
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -886,7 +1364,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * Read the MAC address if specified
 	 */
 	mac_provided = 0;
-	net->vhost_net = NULL;
+	net->nr_pairs = 1;
 	if (opts != NULL) {
 		int err;
 
@@ -897,7 +1375,10 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			return -1;
 		}
 
-		(void) strsep(&vtopts, ",");
+		/* the backend, a vhost-user one is vhost too */
+		opt = strsep(&vtopts, ",");
+		if (!strncmp(opt, "vhost-user=", 11))
+			net->use_vhost = true;
 
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
@@ -911,29 +1392,127 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					return err;
 				}
 				mac_provided = 1;
+			} else if (!strncmp(opt, "coalesce=", 9)) {
+				if (virtio_coalesce_parse_options(opt + 9,
+						&co_opt) != 0) {
+					free(devopts);
+					free(net);
+					return -1;
+				}
+				use_coalesce = true;
+			} else if (!strncmp(opt, "mq=", 3)) {
+				if (dm_strtoi(opt + 3, &tmp, 10, &net->nr_pairs) ||
+				    *tmp != '\0' || net->nr_pairs <= 0) {
+					WPRINTF(("virtio_net: incorrect queue pairs %s\n",
+						opt + 3));
+					free(devopts);
+					free(net);
+					return -1;
+				}
+				/* the driver uses one pair per vCPU at most */
+				if (net->nr_pairs > VIRTIO_NET_MAX_PAIRS)
+					net->nr_pairs = VIRTIO_NET_MAX_PAIRS;
+				if (net->nr_pairs > guest_cpu_num())
+					net->nr_pairs = guest_cpu_num();
+			} else if (!strncmp(opt, "busyloop=", 9)) {
+				if (virtio_net_parse_busyloop(opt + 9, busyloop,
+						&nr_busyloop) != 0) {
+					free(devopts);
+					free(net);
+					return -1;
+				}
+			} else if (!strncmp(opt, "iothread", 8)) {
+				strsep(&opt, "=");
+				iothread_free_options(&iot_opt);
+				if (iothread_parse_options(opt, &iot_opt) < 0) {
+					free(devopts);
+					free(net);
+					return -1;
+				}
+				use_iothread = true;
 			}
 		}
+		tmp = NULL;
+
+		/* one connection serves one vhost_dev */
+		if (!strncmp(devopts, "vhost-user=", 11) && net->nr_pairs > 1) {
+			WPRINTF(("virtio_net: vhost-user has a single queue pair\n"));
+			net->nr_pairs = 1;
+		}
+
+		/* the last timeout is the one of the pairs left */
+		for (i = 0; i < net->nr_pairs && nr_busyloop > 0; i++)
+			net->qpairs[i].busyloop_timeout =
+				busyloop[MIN(i, nr_busyloop - 1)];
+		if (nr_busyloop > 0 && !net->use_vhost)
+			WPRINTF(("virtio_net: busyloop is for the vhost backend\n"));
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	/*
+	 * The RX of the pairs are spread over the iothreads round robin,
+	 * more iothreads than pairs are useless.
+	 */
+	if (use_iothread) {
+		if (iot_opt.per_queue || iot_opt.num > net->nr_pairs)
+			iot_opt.num = net->nr_pairs;
+		if (snprintf(iot_opt.tag, sizeof(iot_opt.tag), "net%d:%d",
+			     dev->slot, dev->func) >= sizeof(iot_opt.tag))
+			WPRINTF(("virtio_net: ioctx_tag too long\n"));
+
+		net->ioctx_base = iothread_create(&iot_opt);
+		net->nr_ioctx = iot_opt.num;
+		iothread_free_options(&iot_opt);
+		if (net->ioctx_base == NULL) {
+			WPRINTF(("virtio_net: failed to create iothreads\n"));
+			free(devopts);
+			free(net);
+			return -1;
+		}
+	}
+
+	/* one RX/TX pair per queue pair, and the control queue for several */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = net->nr_pairs * 2 + (net->nr_pairs > 1 ? 1 : 0);
+	net->refs = 1;
+
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	if (net->nr_pairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+	net->config.max_virtqueue_pairs = net->nr_pairs;
+
+	for (i = 0; i < net->nr_pairs; i++) {
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+		if (use_iothread)
+			qp->ioctx = net->ioctx_base + i % net->nr_ioctx;
+
+		net->queues[i * 2 + VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[i * 2 + VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
+		net->queues[i * 2 + VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[i * 2 + VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
+	}
+	if (net->nr_pairs > 1) {
+		net->queues[net->nr_pairs * 2].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[net->nr_pairs * 2].notify = virtio_net_ping_ctlq;
+	}
 
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	if (use_coalesce && virtio_coalesce_init(&net->base, &co_opt) != 0) {
+		free(devopts);
+		free(net);
+		return -1;
+	}
+
+	net->rx_merge = 1;
+	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
-
 	if (!devopts) {
 		WPRINTF(("virtio_net: invalid optional argument\n"));
 		free(net);
@@ -944,7 +1523,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		vtopts = tmp = strdup(opts);
 	}
 
-	if ((tmp != NULL) && (strncmp(tmp, "tap", 3) == 0)) {
+	if ((tmp != NULL) && (strncmp(tmp, "tap", 3) == 0 ||
+			      strncmp(tmp, "vhost-user", 10) == 0)) {
 		type = strsep(&tmp, "=");
 		name = strsep(&tmp, ",");
 	}
@@ -958,6 +1538,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 		if (strcmp(type, "tap") == 0) {
 			virtio_net_tap_setup(net, name);
+		} else if (strcmp(type, "vhost-user") == 0) {
+			virtio_net_vhost_user_setup(net, name);
 		}
 	}
 
@@ -1008,7 +1590,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0 ||
+			      net->qpairs[0].vhost_net != NULL);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -1023,24 +1606,31 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	net->resetting = 0;
 	net->closing = 0;
 
-	net->rx_merge = 1;
-	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	/* the driver starts with the first pair */
+	virtio_net_set_pairs(net, 1);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphore & spawn TX processing thread,
+	 * one for each pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->nr_pairs; i++) {
+		qp = &net->qpairs[i];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->nr_pairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -1092,75 +1682,119 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	/* GSO frames may be larger than a merged rx buf */
+	net->rx_gso = net->rx_merge && (net->features &
+		(VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 |
+		 VIRTIO_NET_F_GUEST_UFO));
+
+	if (net->tap_vnet_hdr)
+		virtio_net_tap_set_vnet(net, net->features);
 }
 
 static void
 virtio_net_set_status(void *vdev, uint64_t status)
 {
 	struct virtio_net *net = vdev;
-	int rc;
-
-	if (!net->vhost_net)
-		return;
-
-	if (!net->vhost_net->vhost_started &&
-		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+	struct virtio_net_qpair *qp;
+	int rc, i;
 
-		rc = vhost_net_start(net->vhost_net);
-		if (rc < 0) {
-			WPRINTF(("vhost_net_start failed\n"));
-			return;
+	for (i = 0; i < net->nr_pairs; i++) {
+		qp = &net->qpairs[i];
+		if (!qp->vhost_net)
+			continue;
+
+		if (!qp->vhost_net->vhost_started &&
+			(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+			/* the driver may not set up the pairs it doesn't use */
+			if (!vq_ring_ready(&net->queues[i * 2 + VIRTIO_NET_RXQ]) ||
+			    !vq_ring_ready(&net->queues[i * 2 + VIRTIO_NET_TXQ]))
+				continue;
+
+			if (qp->mevp)
+				mevent_disable(qp->mevp);
+
+			rc = vhost_net_start(qp->vhost_net);
+			if (rc < 0) {
+				WPRINTF(("vhost_net_start failed\n"));
+				return;
+			}
+		} else if (qp->vhost_net->vhost_started &&
+			((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
+			rc = vhost_net_stop(qp->vhost_net);
+			if (rc < 0)
+				WPRINTF(("vhost_net_stop failed\n"));
 		}
-	} else if (net->vhost_net->vhost_started &&
-		((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
-		rc = vhost_net_stop(net->vhost_net);
-		if (rc < 0)
-			WPRINTF(("vhost_net_stop failed\n"));
+	}
+}
+
+/* the device is freed once the last tap mevent is torn down */
+static void
+virtio_net_put(struct virtio_net *net)
+{
+	if (atomic_sub_fetch(&net->refs, 1) == 0) {
+		virtio_reset_dev(&net->base);
+		free(net);
 	}
 }
 
 static void
 virtio_net_teardown(void *param)
 {
-	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	qp = (struct virtio_net_qpair *)param;
+	if (!qp)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
+	if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	} else
-		pr_err("net->tapfd is -1!\n");
+		pr_err("qp->tapfd is -1!\n");
 
-	virtio_reset_dev(&net->base);
-	free(net);
+	virtio_net_put(qp->net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
+	int i;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
-
-		if (net->vhost_net) {
-			vhost_net_stop(net->vhost_net);
-			vhost_net_deinit(net->vhost_net);
-			free(net->vhost_net);
-			net->vhost_net = NULL;
+		for (i = 0; i < net->nr_pairs; i++) {
+			virtio_net_tx_stop(&net->qpairs[i]);
+			if (net->qpairs[i].tx_uring) {
+				io_uring_queue_exit(&net->qpairs[i].tx_ring);
+				net->qpairs[i].tx_uring = false;
+			}
 		}
+		virtio_coalesce_deinit(&net->base);
+
+		for (i = 0; i < net->nr_pairs; i++) {
+			qp = &net->qpairs[i];
+			if (qp->vhost_net) {
+				vhost_net_stop(qp->vhost_net);
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
+			}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+			if (qp->ioctx && qp->tapfd >= 0)
+				iothread_del(qp->ioctx, qp->tapfd);
+
+			if (qp->mevp != NULL)
+				mevent_delete(qp->mevp);
+			else if (qp->tapfd >= 0) {
+				close(qp->tapfd);
+				qp->tapfd = -1;
+			}
+		}
+		virtio_net_put(net);
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
@@ -1168,12 +1802,12 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 }
 
 static struct vhost_net *
-vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
+vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx,
+	       enum vhost_backend_type backend_type, uint32_t busyloop_timeout)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
 	uint64_t vhost_ext_features =  1 << VHOST_NET_F_VIRTIO_NET_HDR;
-	uint32_t busyloop_timeout = 0;
 	int rc;
 
 	vhost_net = calloc(1, sizeof(struct vhost_net));
@@ -1185,8 +1819,13 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 	/* pre-init before calling vhost_dev_init */
 	vhost_net->vdev.nvqs = ARRAY_SIZE(vhost_net->vqs);
 	vhost_net->vdev.vqs = vhost_net->vqs;
+	vhost_net->vdev.backend_type = backend_type;
 	vhost_net->tapfd = tapfd;
 
+	/* a vhost-user backend has no tap to add the header for */
+	if (backend_type == VHOST_BACKEND_USER)
+		vhost_ext_features = 0;
+
 	rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
 		vhost_features, vhost_ext_features, busyloop_timeout);
 	if (rc < 0) {
@@ -1269,6 +1908,9 @@ struct pci_vdev_ops pci_ops_virtio_net = {
 	.vdev_init	= virtio_net_init,
 	.vdev_deinit	= virtio_net_deinit,
 	.vdev_barwrite	= virtio_pci_write,
-	.vdev_barread	= virtio_pci_read
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_restore	= virtio_pci_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_virtio_net);
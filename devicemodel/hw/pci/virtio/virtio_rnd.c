@@ -36,14 +36,20 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/random.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "virtio_kernel.h"
 #include "vmmapi.h"			/* for vmctx */
+#include "dm_string.h"
 
 #define VIRTIO_RND_RINGSZ	64
+#define VIRTIO_RND_BATCH	16	/* chains fetched and released at once */
+#define VIRTIO_RND_POOLSZ	4096	/* bytes of entropy kept ahead */
+#define VIRTIO_RND_FILLSZ	512	/* bytes per getrandom() */
 
 /*
  * Per-device struct
@@ -54,11 +60,25 @@ struct virtio_rnd {
 	struct virtio_vq_info vq;
 	pthread_mutex_t mtx;
 	uint64_t cfg;
-	int fd;
 	int in_progress;
+	volatile int closing;
 	pthread_t rx_tid;
 	pthread_mutex_t	rx_mtx;
 	pthread_cond_t rx_cond;
+	/*
+	 * Entropy pool, a ring filled by pool_tid from getrandom() so that
+	 * the requests are served from memory. rate limits the filling, in
+	 * bytes per second (0 for none): the guest gets at most the pool at
+	 * once, and rate bytes per second after.
+	 */
+	uint8_t pool[VIRTIO_RND_POOLSZ];
+	uint32_t pool_head;		/* next byte to serve */
+	uint32_t pool_len;		/* bytes in the pool */
+	unsigned long rate;
+	pthread_t pool_tid;
+	pthread_mutex_t pool_mtx;
+	pthread_cond_t pool_fill_cond;	/* the pool is not full */
+	pthread_cond_t pool_data_cond;	/* the pool is not empty */
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS status;
@@ -297,14 +317,101 @@ virtio_rnd_reset(void *base)
 	}
 }
 
+static void *
+virtio_rnd_fill_pool(void *param)
+{
+	struct virtio_rnd *rnd = param;
+	uint8_t buf[VIRTIO_RND_FILLSZ];
+	struct timespec ts;
+	uint32_t want, tail, n;
+	uint64_t ns;
+	ssize_t len;
+
+	for (;;) {
+		pthread_mutex_lock(&rnd->pool_mtx);
+		while (!rnd->closing && rnd->pool_len == VIRTIO_RND_POOLSZ)
+			pthread_cond_wait(&rnd->pool_fill_cond, &rnd->pool_mtx);
+		if (rnd->closing) {
+			pthread_mutex_unlock(&rnd->pool_mtx);
+			return NULL;
+		}
+		want = MIN(VIRTIO_RND_POOLSZ - rnd->pool_len, VIRTIO_RND_FILLSZ);
+		pthread_mutex_unlock(&rnd->pool_mtx);
+
+		/* a tenth of a second of rate at most, the sleep stays short */
+		if (rnd->rate != 0)
+			want = MIN(want, MAX(rnd->rate / 10, 1UL));
+
+		len = getrandom(buf, want, 0);
+		if (len <= 0) {
+			if (len < 0 && errno != EINTR) {
+				WPRINTF(("virtio_rnd: getrandom failed, errno %d\n",
+					 errno));
+				usleep(10000);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&rnd->pool_mtx);
+		tail = (rnd->pool_head + rnd->pool_len) % VIRTIO_RND_POOLSZ;
+		n = MIN((uint32_t)len, VIRTIO_RND_POOLSZ - tail);
+		memcpy(rnd->pool + tail, buf, n);
+		memcpy(rnd->pool, buf + n, len - n);
+		rnd->pool_len += len;
+		pthread_cond_broadcast(&rnd->pool_data_cond);
+		pthread_mutex_unlock(&rnd->pool_mtx);
+
+		if (rnd->rate != 0) {
+			ns = (uint64_t)len * 1000000000UL / rnd->rate;
+			ts.tv_sec = ns / 1000000000UL;
+			ts.tv_nsec = ns % 1000000000UL;
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+/*
+ * Copy up to len bytes of the pool into buf, waiting for the filler only
+ * if the pool is empty. Return the bytes copied, 0 when closing.
+ */
+static uint32_t
+virtio_rnd_take(struct virtio_rnd *rnd, uint8_t *buf, uint32_t len)
+{
+	uint32_t n, first;
+
+	pthread_mutex_lock(&rnd->pool_mtx);
+	while (!rnd->closing && rnd->pool_len == 0)
+		pthread_cond_wait(&rnd->pool_data_cond, &rnd->pool_mtx);
+
+	n = MIN(len, rnd->pool_len);
+	first = MIN(n, VIRTIO_RND_POOLSZ - rnd->pool_head);
+	memcpy(buf, rnd->pool + rnd->pool_head, first);
+	memcpy(buf + first, rnd->pool, n - first);
+	/* the bytes served are wiped, none is handed out twice */
+	memset(rnd->pool + rnd->pool_head, 0, first);
+	memset(rnd->pool, 0, n - first);
+	rnd->pool_head = (rnd->pool_head + n) % VIRTIO_RND_POOLSZ;
+	rnd->pool_len -= n;
+	if (n != 0)
+		pthread_cond_signal(&rnd->pool_fill_cond);
+	pthread_mutex_unlock(&rnd->pool_mtx);
+
+	return n;
+}
+
 static void *
 virtio_rnd_get_entropy(void *param)
 {
 	struct virtio_rnd *rnd = param;
 	struct virtio_vq_info *vq = &rnd->vq;
-	struct iovec iov;
-	uint16_t idx;
-	ssize_t len;
+	struct iovec iov[VIRTIO_RND_BATCH][1];
+	struct vq_chain chains[VIRTIO_RND_BATCH];
+	int i, n;
+
+	for (i = 0; i < VIRTIO_RND_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = NULL;
+	}
 
 	for (;;) {
 		pthread_mutex_lock(&rnd->rx_mtx);
@@ -315,31 +422,31 @@ virtio_rnd_get_entropy(void *param)
 		 *  - avoid vring processing due to spurious wakeups
 		 *  - catch missing notifications before acquiring rx_mtx
 		 */
-		while (!vq_has_descs(vq))
+		while (!rnd->closing && !vq_has_descs(vq))
 			pthread_cond_wait(&rnd->rx_cond, &rnd->rx_mtx);
 
+		if (rnd->closing) {
+			pthread_mutex_unlock(&rnd->rx_mtx);
+			return NULL;
+		}
+
 		rnd->in_progress = 1;
 		pthread_mutex_unlock(&rnd->rx_mtx);
 
+		/* the chains of a notification are served and released at once */
 		do {
-			if (vq_getchain(vq, &idx, &iov, 1, NULL) < 1) {
+			n = vq_getchains_bulk(vq, chains, VIRTIO_RND_BATCH, 1);
+			for (i = 0; i < n && chains[i].n >= 1; i++)
+				chains[i].len = virtio_rnd_take(rnd,
+					chains[i].iov[0].iov_base,
+					chains[i].iov[0].iov_len);
+
+			vq_relchains_bulk(vq, chains, i);
+			if (i < n) {
 				pr_err("%s: fail to getchain!\n", __func__);
 				break;
 			}
-			len = read(rnd->fd, iov.iov_base, iov.iov_len);
-			if (len <= 0) {
-				vq_retchain(vq);
-				vq_endchains(vq, 0);
-
-				/* no data available */
-				if (len == -1 && errno == EAGAIN)
-					return NULL;
-				break;
-			}
-
-			/* release this chain and handle more */
-			vq_relchain(vq, idx, len);
-		} while (vq_has_descs(vq));
+		} while (!rnd->closing && vq_has_descs(vq));
 
 		/* at least one avail ring element has been processed */
 		vq_endchains(vq, 1);
@@ -366,15 +473,24 @@ static int
 virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_rnd *rnd = NULL;
-	int fd;
 	pthread_mutexattr_t attr;
 	int rc;
 	char *opt;
 	char *vbs_k_opt = NULL;
 	enum VBS_K_STATUS kstat = VIRTIO_DEV_INITIAL;
+	unsigned long rate = 0;
 	char tname[MAXCOMLEN + 1];
 
 	while ((opt = strsep(&opts, ",")) != NULL) {
+		/* rate=<bytes per second> */
+		if (!strncmp(opt, "rate=", 5)) {
+			if (dm_strtoul(opt + 5, NULL, 10, &rate)) {
+				WPRINTF(("virtio_rnd: invalid rate %s\n", opt + 5));
+				return -1;
+			}
+			continue;
+		}
+
 		/* vbs_k_opt should be kernel=on */
 		vbs_k_opt = strsep(&opt, "=");
 		DPRINTF(("vbs_k_opt is %s\n", vbs_k_opt));
@@ -385,15 +501,6 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	/*
-	 * Should always be able to open /dev/random.
-	 */
-	fd = open("/dev/random", O_RDONLY);
-	if (fd < 0) {
-		WPRINTF(("virtio_rnd: open failed: /dev/random \n"));
-		return -1;
-	}
-
 	rnd = calloc(1, sizeof(struct virtio_rnd));
 	if (!rnd) {
 		WPRINTF(("virtio_rnd: calloc returns NULL\n"));
@@ -401,6 +508,7 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 
 	rnd->vbs_k.status = kstat;
+	rnd->rate = rate;
 
 	/* init mutex attribute properly */
 	rc = pthread_mutexattr_init(&attr);
@@ -444,9 +552,6 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	rnd->vq.qsize = VIRTIO_RND_RINGSZ;
 
-	/* keep /dev/random opened while emulating */
-	rnd->fd = fd;
-
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_RANDOM);
 	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
@@ -460,6 +565,15 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	virtio_set_io_bar(&rnd->base, 0);
 
+	pthread_mutex_init(&rnd->pool_mtx, NULL);
+	pthread_cond_init(&rnd->pool_fill_cond, NULL);
+	pthread_cond_init(&rnd->pool_data_cond, NULL);
+	pthread_create(&rnd->pool_tid, NULL, virtio_rnd_fill_pool,
+		       (void *)rnd);
+	snprintf(tname, sizeof(tname), "vtrnd-%d:%d pool", dev->slot,
+		 dev->func);
+	pthread_setname_np(rnd->pool_tid, tname);
+
 	rnd->in_progress = 0;
 	pthread_mutex_init(&rnd->rx_mtx, NULL);
 	pthread_cond_init(&rnd->rx_cond, NULL);
@@ -472,7 +586,6 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	return 0;
 
 fail:
-	close(fd);
 	if (rnd) {
 		if (rnd->vbs_k.status == VIRTIO_DEV_INIT_SUCCESS) {
 			/* VBS-K is in use */
@@ -495,8 +608,17 @@ virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return;
 	}
 
-	pthread_cancel(rnd->rx_tid);
+	/* the server may wait for the pool, both threads are woken up */
+	pthread_mutex_lock(&rnd->rx_mtx);
+	rnd->closing = 1;
+	pthread_cond_broadcast(&rnd->rx_cond);
+	pthread_mutex_unlock(&rnd->rx_mtx);
+	pthread_mutex_lock(&rnd->pool_mtx);
+	pthread_cond_broadcast(&rnd->pool_fill_cond);
+	pthread_cond_broadcast(&rnd->pool_data_cond);
+	pthread_mutex_unlock(&rnd->pool_mtx);
 	pthread_join(rnd->rx_tid, &jval);
+	pthread_join(rnd->pool_tid, &jval);
 
 	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
 		DPRINTF(("%s: deinit virtio_rnd_k!\n", __func__));
@@ -509,10 +631,6 @@ virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	if (rnd->fd >= 0) {
-		close(rnd->fd);
-		rnd->fd = -1;
-	}
 	virtio_rnd_reset(rnd);
 	DPRINTF(("%s: free struct virtio_rnd!\n", __func__));
 	free(rnd);
@@ -524,6 +642,9 @@ struct pci_vdev_ops pci_ops_virtio_rnd = {
 	.vdev_init	= virtio_rnd_init,
 	.vdev_deinit	= virtio_rnd_deinit,
 	.vdev_barwrite	= virtio_pci_write,
-	.vdev_barread	= virtio_pci_read
+	.vdev_barread	= virtio_pci_read,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_restore	= virtio_pci_restore
 };
 DEFINE_PCI_DEVTYPE(pci_ops_virtio_rnd);
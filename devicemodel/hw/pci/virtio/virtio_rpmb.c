@@ -59,6 +59,10 @@
 #define BLOCK_BARA_SIGNATURE		"BARA"
 #define SIGNATURE_LENGTH			(sizeof(BLOCK_BARA_SIGNATURE) - 1)
 #define ATTKB_PRESENT_FLAG_BIT		0x1
+/* blocks per authenticated write: 512 bytes, what any RPMB takes at once */
+#define RPMB_WRITE_BLOCKS		2U
+/* the write counter is not known, it is read from the RPMB first */
+#define RPMB_COUNTER_UNKNOWN		0xFFFFFFFFU
 
 static const char PHYSICAL_RPMB_STR[] = "physical_rpmb";
 static int virtio_rpmb_debug = 1;
@@ -244,8 +248,14 @@ rpmb_get_counter(__u8 mode, __u8 *key, __u32 *counter, __u16 *result)
 	return rc;
 }
 
+/*
+ * Write count blocks in one authenticated write. The write counter is
+ * *counter, if known: it is then the counter after the write, a sequence
+ * of writes reads it once.
+ */
 static int
-rpmb_write_block(__u8 mode, __u8 *key, __u16 addr, void *buf, __u32 count)
+rpmb_write_block(__u8 mode, __u8 *key, __u16 addr, void *buf, __u32 count,
+		 __u32 *counter)
 {
 	int rc;
 	int fd;
@@ -265,11 +275,16 @@ rpmb_write_block(__u8 mode, __u8 *key, __u16 addr, void *buf, __u32 count)
 		return -ENOBUFS;
 	}
 
-	rc = rpmb_get_counter(mode, key, &write_counter, &result);
-	if (rc) {
-		DPRINTF(("%s: virtio_rpmb_get_counter failed\n", __func__));
-		return rc;
+	if (*counter == RPMB_COUNTER_UNKNOWN) {
+		rc = rpmb_get_counter(mode, key, counter, &result);
+		if (rc) {
+			DPRINTF(("%s: virtio_rpmb_get_counter failed\n", __func__));
+			*counter = RPMB_COUNTER_UNKNOWN;
+			return rc;
+		}
 	}
+	write_counter = *counter;
+	*counter = RPMB_COUNTER_UNKNOWN;
 
 	frame_write.addr = swap16(addr);
 	frame_write.req_resp = swap16(RPMB_REQ_RESULT_READ);
@@ -325,6 +340,9 @@ rpmb_write_block(__u8 mode, __u8 *key, __u16 addr, void *buf, __u32 count)
 								&frame_read, 1, key, NULL, &addr);
 	}
 
+	if (rc == 0)
+		*counter = write_counter + 1;
+
 	return rc;
 }
 
@@ -482,6 +500,7 @@ rpmb_keybox_retrieve(__u8 mode, __u8 *key)
 	uint8_t *attkb = NULL;
 	uint16_t kb_size;
 	uint32_t kb_buf_size = 0;
+	__u32 counter = RPMB_COUNTER_UNKNOWN;
 
 	block_table = malloc(sizeof(rpmb_block_t));
 	if (!block_table) {
@@ -528,15 +547,17 @@ rpmb_keybox_retrieve(__u8 mode, __u8 *key)
 
 		rpmb_bara_init(block_table, kb_size);
 		block_num = (kb_size - 1) / RPMB_BLOCK_SIZE + 1;
-		for (i = 0; i < block_num; i++) {
-			ret = rpmb_write_block(mode, key, block_table->attkb_addr + i, attkb + i * RPMB_BLOCK_SIZE, 1);
+		for (i = 0; i < block_num; i += RPMB_WRITE_BLOCKS) {
+			ret = rpmb_write_block(mode, key, block_table->attkb_addr + i,
+					attkb + i * RPMB_BLOCK_SIZE,
+					MIN(RPMB_WRITE_BLOCKS, block_num - i), &counter);
 			if (ret) {
 				DPRINTF(("rpmb write key box fail!\n"));
 				goto out;
 			}
 		}
 
-		ret = rpmb_write_block(mode, key, BLOCK_BARA_BASE_ADDRESS, block_table, 1);
+		ret = rpmb_write_block(mode, key, BLOCK_BARA_BASE_ADDRESS, block_table, 1, &counter);
 		if (ret) {
 			DPRINTF(("rpmb write block table fail!\n"));
 			goto out;
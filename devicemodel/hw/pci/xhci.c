@@ -410,6 +410,15 @@ struct pci_xhci_vdev {
 	struct pci_xhci_opregs  opregs;
 	struct pci_xhci_rtsregs rtsregs;
 
+	/*
+	 * Interrupter moderation, imod_timer counts IMODC down after each
+	 * interrupt. The events inserted meanwhile or while the event handler
+	 * is busy only set IP, they all go with the next interrupt.
+	 */
+	pthread_mutex_t	intr_mtx;
+	struct acrn_timer imod_timer;
+	bool		imod_running;
+
 	struct pci_xhci_portregs *portregs;
 	struct pci_xhci_dev_emu  **devices; /* XHCI[port] = device */
 	struct pci_xhci_dev_emu  **slots;   /* slots assigned from 1 */
@@ -1212,10 +1221,21 @@ pci_xhci_reset(struct pci_xhci_vdev *xdev)
 {
 	int i;
 
+	struct itimerspec its;
+	struct pci_xhci_dev_emu *dev;
+
 	xdev->rtsregs.er_enq_idx = 0;
 	xdev->rtsregs.er_enq_seg = 0;
 	xdev->rtsregs.event_pcs = 1;
-	struct pci_xhci_dev_emu *dev;
+
+	pthread_mutex_lock(&xdev->intr_mtx);
+	memset(&its, 0, sizeof(its));
+	acrn_timer_settime(&xdev->imod_timer, &its);
+	xdev->imod_running = false;
+	xdev->rtsregs.intrreg.iman = 0;
+	xdev->rtsregs.intrreg.imod = XHCI_IMOD_DEFAULT;
+	xdev->rtsregs.intrreg.erdp = 0;
+	pthread_mutex_unlock(&xdev->intr_mtx);
 
 	for (i = 1; i <= XHCI_MAX_DEVS; i++)
 	{
@@ -1565,24 +1585,67 @@ pci_xhci_trb_next(struct pci_xhci_vdev *xdev,
 	return next;
 }
 
+/*
+ * Signal the pending interrupt once the moderation counter is 0 and the
+ * event handler isn't busy (xHCI spec 4.17.2), then load the counter with
+ * IMODI. Called with intr_mtx held.
+ */
 static void
-pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+pci_xhci_fire_interrupt(struct pci_xhci_vdev *xdev)
 {
+	struct pci_xhci_rtsregs *rts;
+	struct itimerspec its;
+	uint32_t ival;
 
-	xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
-	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
-	xdev->opregs.usbsts |= XHCI_STS_EINT;
+	rts = &xdev->rtsregs;
+	if (!(rts->intrreg.iman & XHCI_IMAN_INTR_PEND) || xdev->imod_running ||
+	    (rts->intrreg.erdp & XHCI_ERDP_LO_BUSY))
+		return;
 
 	/* only trigger interrupt if permitted */
-	if ((xdev->opregs.usbcmd & XHCI_CMD_INTE) &&
-	    (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_ENA)) {
-		if (pci_msi_enabled(xdev->dev))
-			pci_generate_msi(xdev->dev, 0);
-		else
-			pci_lintr_assert(xdev->dev);
+	if (!(xdev->opregs.usbcmd & XHCI_CMD_INTE) ||
+	    !(rts->intrreg.iman & XHCI_IMAN_INTR_ENA))
+		return;
+
+	rts->intrreg.erdp |= XHCI_ERDP_LO_BUSY;
+	if (pci_msi_enabled(xdev->dev)) {
+		/* IP is cleared as the MSI is sent */
+		rts->intrreg.iman &= ~XHCI_IMAN_INTR_PEND;
+		pci_generate_msi(xdev->dev, 0);
+	} else
+		pci_lintr_assert(xdev->dev);
+
+	ival = XHCI_IMOD_IVAL_GET(rts->intrreg.imod);
+	if (ival) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = ival * 250;
+		if (acrn_timer_settime(&xdev->imod_timer, &its) == 0)
+			xdev->imod_running = true;
 	}
 }
 
+static void
+pci_xhci_imod_handler(void *arg, uint64_t nexp)
+{
+	struct pci_xhci_vdev *xdev;
+
+	xdev = arg;
+	pthread_mutex_lock(&xdev->intr_mtx);
+	xdev->imod_running = false;
+	pci_xhci_fire_interrupt(xdev);
+	pthread_mutex_unlock(&xdev->intr_mtx);
+}
+
+static void
+pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+{
+	pthread_mutex_lock(&xdev->intr_mtx);
+	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
+	xdev->opregs.usbsts |= XHCI_STS_EINT;
+	pci_xhci_fire_interrupt(xdev);
+	pthread_mutex_unlock(&xdev->intr_mtx);
+}
+
 static void
 pci_xhci_deassert_interrupt(struct pci_xhci_vdev *xdev)
 {
@@ -1679,12 +1742,9 @@ pci_xhci_free_usb_xfer(struct pci_xhci_dev_emu *dev, struct usb_xfer *xfer)
 		return;
 
 	for (i = 0; i < xfer->max_blk_cnt; i++) {
-		if(xfer->reqs[i]) {
-			if (dev && dev->dev_ue->ue_free_req)
-				dev->dev_ue->ue_free_req(xfer->reqs[i]->trn);
-			free(xfer->reqs[i]->buffer);
-			free(xfer->reqs[i]);
-		}
+		/* the request in flight is released by its device emulation */
+		if (xfer->reqs[i] && dev && dev->dev_ue->ue_free_req)
+			dev->dev_ue->ue_free_req(xfer->reqs[i]);
 		if (xfer->data)
 			free(xfer->data[i].hcb);
 	}
@@ -2976,8 +3036,9 @@ pci_xhci_xfer_complete(struct pci_xhci_vdev *xdev, struct usb_xfer *xfer,
 			edtla = 0;
 		}
 
+		/* the caller asserts one interrupt for all of the events */
 		*do_intr = 1;
-		if (pci_xhci_insert_event(xdev, &evtrb, 1) != 0) {
+		if (pci_xhci_insert_event(xdev, &evtrb, 0) != 0) {
 			UPRINTF(LFTL, "Failed to inject xfer complete event!\r\n");
 			return err;
 		}
@@ -3489,6 +3550,7 @@ pci_xhci_rtsregs_write(struct pci_xhci_vdev *xdev,
 
 	switch (offset) {
 	case 0x00:
+		pthread_mutex_lock(&xdev->intr_mtx);
 		if (value & XHCI_IMAN_INTR_PEND)
 			rts->intrreg.iman &= ~XHCI_IMAN_INTR_PEND;
 		rts->intrreg.iman = (value & XHCI_IMAN_INTR_ENA) |
@@ -3496,11 +3558,16 @@ pci_xhci_rtsregs_write(struct pci_xhci_vdev *xdev,
 
 		if (!(value & XHCI_IMAN_INTR_ENA))
 			pci_xhci_deassert_interrupt(xdev);
-
+		else
+			pci_xhci_fire_interrupt(xdev);
+		pthread_mutex_unlock(&xdev->intr_mtx);
 		break;
 
 	case 0x04:
-		rts->intrreg.imod = value;
+		/* IMODC is emulated by imod_timer, only IMODI is kept */
+		pthread_mutex_lock(&xdev->intr_mtx);
+		rts->intrreg.imod = XHCI_IMOD_IVAL_GET(value);
+		pthread_mutex_unlock(&xdev->intr_mtx);
 		break;
 
 	case 0x08:
@@ -3532,16 +3599,23 @@ pci_xhci_rtsregs_write(struct pci_xhci_vdev *xdev,
 
 	case 0x18:
 		/* ERDP low bits */
+		pthread_mutex_lock(&xdev->intr_mtx);
 		rts->intrreg.erdp =
 			MASK_64_HI(xdev->rtsregs.intrreg.erdp) |
 			(rts->intrreg.erdp & XHCI_ERDP_LO_BUSY) |
 			(value & ~0xF);
+		rts->er_deq_seg = XHCI_ERDP_LO_SINDEX(value);
 		if (value & XHCI_ERDP_LO_BUSY) {
 			rts->intrreg.erdp &= ~XHCI_ERDP_LO_BUSY;
-			rts->intrreg.iman &= ~XHCI_IMAN_INTR_PEND;
+			/*
+			 * With MSI, IP left is set by the events inserted
+			 * since the interrupt, the guest may have missed them.
+			 */
+			if (!pci_msi_enabled(xdev->dev))
+				rts->intrreg.iman &= ~XHCI_IMAN_INTR_PEND;
+			pci_xhci_fire_interrupt(xdev);
 		}
-
-		rts->er_deq_seg = XHCI_ERDP_LO_SINDEX(value);
+		pthread_mutex_unlock(&xdev->intr_mtx);
 		break;
 
 	case 0x1C:
@@ -3602,6 +3676,11 @@ pci_xhci_hostop_write(struct pci_xhci_vdev *xdev,
 	case XHCI_USBCMD:
 		xdev->opregs.usbcmd =
 			pci_xhci_usbcmd_write(xdev, value & 0x3F0F);
+
+		/* send what was held back while interrupts were disabled */
+		pthread_mutex_lock(&xdev->intr_mtx);
+		pci_xhci_fire_interrupt(xdev);
+		pthread_mutex_unlock(&xdev->intr_mtx);
 		break;
 
 	case XHCI_USBSTS:
@@ -3855,6 +3934,23 @@ pci_xhci_dbregs_read(struct pci_xhci_vdev *xdev, uint64_t offset)
 	return 0;
 }
 
+/* IMODC, in 250ns, as much as is left of imod_timer */
+static uint32_t
+pci_xhci_imod_count(struct pci_xhci_vdev *xdev)
+{
+	struct itimerspec its;
+	uint64_t left = 0;
+
+	pthread_mutex_lock(&xdev->intr_mtx);
+	if (xdev->imod_running &&
+	    acrn_timer_gettime(&xdev->imod_timer, &its) == 0)
+		left = (its.it_value.tv_sec * NS_PER_SEC +
+			its.it_value.tv_nsec) / 250;
+	pthread_mutex_unlock(&xdev->intr_mtx);
+
+	return XHCI_IMOD_ICNT_SET(left);
+}
+
 static uint64_t
 pci_xhci_rtsregs_read(struct pci_xhci_vdev *xdev, uint64_t offset)
 {
@@ -3887,6 +3983,8 @@ pci_xhci_rtsregs_read(struct pci_xhci_vdev *xdev, uint64_t offset)
 		p = &xdev->rtsregs.intrreg.iman;
 		p += item / sizeof(uint32_t);
 		value = *p;
+		if (item == 4)
+			value |= pci_xhci_imod_count(xdev);
 	}
 
 	UPRINTF(LDBG, "rtsregs read offset 0x%lx -> 0x%x\r\n",
@@ -4629,6 +4727,13 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pthread_mutex_init(&xdev->mtx, NULL);
 
+	pthread_mutex_init(&xdev->intr_mtx, NULL);
+	xdev->rtsregs.intrreg.imod = XHCI_IMOD_DEFAULT;
+	xdev->imod_timer.clockid = CLOCK_MONOTONIC;
+	error = acrn_timer_init(&xdev->imod_timer, pci_xhci_imod_handler, xdev);
+	if (error)
+		goto done;
+
 	/* create vbdp_thread */
 	xdev->vbdp_polling = true;
 	sem_init(&xdev->vbdp_sem, 0, 0);
@@ -4709,6 +4814,8 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_cond_destroy(&xdev->async_cond);
 	pthread_mutex_destroy(&xdev->async_tmx);
 
+	acrn_timer_deinit(&xdev->imod_timer);
+	pthread_mutex_destroy(&xdev->intr_mtx);
 	pthread_mutex_destroy(&xdev->mtx);
 	free(xdev);
 	xhci_in_use = 0;
@@ -34,6 +34,10 @@
  * the tables and the compiling them to AML with the Intel iasl compiler.
  * The AML files are then read into guest memory.
  *
+ * With --acpi_cache, the AML files compiled are kept in a directory, named
+ * by the SHA-256 of their ASL source: a table whose source was compiled
+ * before is read from there, and iasl is only run for the others.
+ *
  *  The tables are placed in the guest's ROM area just below 1MB physical,
  * above the MPTable.
  *
@@ -63,6 +67,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <openssl/evp.h>
 
 #include "dm.h"
 #include "acpi.h"
@@ -105,6 +110,11 @@
 
 static char asl_compiler[MAXPATHLEN] = {0};
 
+/* the directory of the AML compiled, empty if not caching */
+static char acpi_cache_dir[MAXPATHLEN];
+/* with the cache, iasl is only looked for on the first miss */
+static bool iasl_checked;
+
 uint64_t audio_nhlt_len = 0;
 
 static int basl_keep_temps;
@@ -281,7 +291,7 @@ int pcpuid_from_vcpuid(uint64_t guest_pcpu_bitmask, int vcpu_id)
 static int
 basl_fwrite_madt(FILE *fp, struct vmctx *ctx)
 {
-	int i;
+	int i, ncpu;
 	uint64_t guest_pcpu_bitmask;
 
 	guest_pcpu_bitmask = vm_get_cpu_affinity_dm();
@@ -313,9 +323,14 @@ basl_fwrite_madt(FILE *fp, struct vmctx *ctx)
 	EFPRINTF(fp, "\t\t\tPC-AT Compatibility : 1\n");
 	EFPRINTF(fp, "\n");
 
-	/* Add a Processor Local APIC entry for each CPU */
-	for (i = 0; i < basl_ncpu; i++) {
-		int pcpu_id = pcpuid_from_vcpuid(guest_pcpu_bitmask, i);
+	/*
+	 * Add a Processor Local APIC entry for each CPU, the hot-pluggable ones
+	 * after them, disabled while they have no vCPU.
+	 */
+	ncpu = cpu_hotplug_enabled() ? cpu_hotplug_nr_cpus() : basl_ncpu;
+	for (i = 0; i < ncpu; i++) {
+		int pcpu_id = cpu_hotplug_enabled() ? cpu_hotplug_pcpu(i) : pcpuid_from_vcpuid(guest_pcpu_bitmask, i);
+		bool enabled = cpu_hotplug_enabled() ? cpu_hotplug_present(i) : true;
 		int lapic_id;
 
 		if (pcpu_id < 0) {
@@ -344,8 +359,8 @@ basl_fwrite_madt(FILE *fp, struct vmctx *ctx)
 
 		EFPRINTF(fp, "[0001]\t\tLocal Apic ID : %02x\n", lapic_id);
 
-		EFPRINTF(fp, "[0004]\t\tFlags (decoded below) : 00000001\n");
-		EFPRINTF(fp, "\t\t\tProcessor Enabled : 1\n");
+		EFPRINTF(fp, "[0004]\t\tFlags (decoded below) : %08x\n", enabled ? 1 : 0);
+		EFPRINTF(fp, "\t\t\tProcessor Enabled : %d\n", enabled ? 1 : 0);
 		EFPRINTF(fp, "\t\t\tRuntime Online Capable : 0\n");
 		EFPRINTF(fp, "\n");
 	}
@@ -441,13 +456,15 @@ basl_fwrite_fadt(FILE *fp, struct vmctx *ctx)
 	EFPRINTF(fp, "[0004]\t\tPM2 Control Block Address : 00000000\n");
 	EFPRINTF(fp, "[0004]\t\tPM Timer Block Address : %08X\n",
 	    IO_PMTMR);
-	EFPRINTF(fp, "[0004]\t\tGPE0 Block Address : 00000000\n");
+	EFPRINTF(fp, "[0004]\t\tGPE0 Block Address : %08X\n",
+	    cpu_hotplug_enabled() ? GPE0_BLK_ADDR : 0);
 	EFPRINTF(fp, "[0004]\t\tGPE1 Block Address : 00000000\n");
 	EFPRINTF(fp, "[0001]\t\tPM1 Event Block Length : 04\n");
 	EFPRINTF(fp, "[0001]\t\tPM1 Control Block Length : 02\n");
 	EFPRINTF(fp, "[0001]\t\tPM2 Control Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tPM Timer Block Length : 00\n");
-	EFPRINTF(fp, "[0001]\t\tGPE0 Block Length : 00\n");
+	EFPRINTF(fp, "[0001]\t\tGPE0 Block Length : %02X\n",
+	    cpu_hotplug_enabled() ? GPE0_BLK_LEN : 0);
 	EFPRINTF(fp, "[0001]\t\tGPE1 Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tGPE1 Base Offset : 00\n");
 	EFPRINTF(fp, "[0001]\t\t_CST Support : 00\n");
@@ -575,10 +592,12 @@ basl_fwrite_fadt(FILE *fp, struct vmctx *ctx)
 
 	EFPRINTF(fp, "[0012]\t\tGPE0 Block : [Generic Address Structure]\n");
 	EFPRINTF(fp, "[0001]\t\tSpace ID : 01 [SystemIO]\n");
-	EFPRINTF(fp, "[0001]\t\tBit Width : 00\n");
+	EFPRINTF(fp, "[0001]\t\tBit Width : %02X\n",
+	    cpu_hotplug_enabled() ? GPE0_BLK_LEN * 8 : 0);
 	EFPRINTF(fp, "[0001]\t\tBit Offset : 00\n");
 	EFPRINTF(fp, "[0001]\t\tEncoded Access Width : 01 [Byte Access:8]\n");
-	EFPRINTF(fp, "[0008]\t\tAddress : 0000000000000000\n");
+	EFPRINTF(fp, "[0008]\t\tAddress : 00000000%08X\n",
+	    cpu_hotplug_enabled() ? GPE0_BLK_ADDR : 0);
 	EFPRINTF(fp, "\n");
 
 	EFPRINTF(fp, "[0012]\t\tGPE1 Block : [Generic Address Structure]\n");
@@ -885,6 +904,7 @@ basl_fwrite_dsdt(FILE *fp, struct vmctx *ctx)
 
 	osc_write_ospm_dsdt(ctx, basl_ncpu);
 	pm_write_dsdt(ctx, basl_ncpu);
+	cpu_hotplug_write_dsdt(basl_ncpu);
 
 	dsdt_line("}");
 
@@ -973,6 +993,122 @@ basl_load(struct vmctx *ctx, int fd, uint64_t off)
 	return 0;
 }
 
+/* Read the whole file of fd, of *size bytes */
+static void *
+basl_read_all(int fd, size_t *size)
+{
+	struct stat sb;
+	void *buf;
+
+	if ((fstat(fd, &sb) < 0) || (sb.st_size <= 0))
+		return NULL;
+
+	buf = malloc(sb.st_size);
+	if ((buf != NULL) && (pread(fd, buf, sb.st_size, 0) != sb.st_size)) {
+		free(buf);
+		buf = NULL;
+	}
+	*size = sb.st_size;
+
+	return buf;
+}
+
+/*
+ * Get the path in the cache of the AML of the ASL source in, and load it
+ * at offset if it is there.
+ *
+ * Returns true if the AML was loaded from the cache. path is left empty if
+ * the source couldn't be hashed.
+ */
+static bool
+basl_cache_lookup(struct vmctx *ctx, struct basl_fio *in, uint64_t offset,
+		char *path, size_t len)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	char hex[EVP_MAX_MD_SIZE * 2 + 1];
+	unsigned int md_len, i;
+	size_t size;
+	void *src;
+	bool hit = false;
+	int fd, n;
+
+	path[0] = '\0';
+	if (fflush(in->fp) != 0)
+		return false;
+
+	src = basl_read_all(in->fd, &size);
+	if (src == NULL)
+		return false;
+	n = EVP_Digest(src, size, md, &md_len, EVP_sha256(), NULL);
+	free(src);
+	if (n != 1)
+		return false;
+
+	for (i = 0; i < md_len; i++)
+		snprintf(&hex[i * 2], 3, "%02x", md[i]);
+	if (snprintf(path, len, "%s/%s%s", acpi_cache_dir, hex, ASL_SUFFIX) >= len) {
+		path[0] = '\0';
+		return false;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		hit = (basl_load(ctx, fd, offset) == 0);
+		close(fd);
+	}
+
+	return hit;
+}
+
+/* Keep the AML compiled in out at path, renamed in place once written */
+static void
+basl_cache_store(struct basl_fio *out, const char *path)
+{
+	char tmp[MAXPATHLEN];
+	size_t size;
+	void *aml;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return;
+
+	aml = basl_read_all(out->fd, &size);
+	if (aml == NULL)
+		return;
+
+	fd = mkstemp(tmp);
+	if (fd >= 0) {
+		if ((write(fd, aml, size) != size) || (rename(tmp, path) != 0)) {
+			pr_warn("%s: failed to cache %s\n", __func__, path);
+			unlink(tmp);
+		}
+		close(fd);
+	}
+	free(aml);
+}
+
+/* Look for iasl on the first table not in the cache */
+static int
+basl_check_iasl(void)
+{
+	if (iasl_checked)
+		return 0;
+
+	if (get_iasl_compiler() != 0) {
+		pr_err("Cannot find Intel ACPI ASL compiler tool \"iasl\".\n");
+		return -1;
+	}
+
+	if (check_iasl_version() != 0) {
+		pr_err("iasl version >= %s is needed to compile the ACPI tables\n",
+			IASL_MIN_VER);
+		return -1;
+	}
+
+	iasl_checked = true;
+	return 0;
+}
+
 static int
 basl_compile(struct vmctx *ctx,
 		int (*fwrite_section)(FILE *, struct vmctx *),
@@ -980,12 +1116,22 @@ basl_compile(struct vmctx *ctx,
 {
 	struct basl_fio io[2];
 	static char iaslbuf[4*MAXPATHLEN + 10];
+	char cache_path[MAXPATHLEN] = "";
 	int err;
 
 	err = basl_start(&io[0], &io[1]);
 	if (!err) {
 		err = (*fwrite_section)(io[0].fp, ctx);
 
+		if (!err && (acpi_cache_dir[0] != '\0')) {
+			if (basl_cache_lookup(ctx, &io[0], offset, cache_path,
+					sizeof(cache_path))) {
+				basl_end(&io[0], &io[1]);
+				return 0;
+			}
+			err = basl_check_iasl();
+		}
+
 		if (!err) {
 			/*
 			 * iasl sends the results of the compilation to
@@ -1013,6 +1159,8 @@ basl_compile(struct vmctx *ctx,
 				 * memory at the specified location
 				 */
 				err = basl_load(ctx, io[1].fd, offset);
+				if (!err && (cache_path[0] != '\0'))
+					basl_cache_store(&io[1], cache_path);
 			} else
 				err = -1;
 		}
@@ -1203,6 +1351,33 @@ check_iasl_version(void)
 	return ret;
 }
 
+int
+acrn_parse_acpi_cache(char *arg)
+{
+	struct stat sb;
+	size_t len = strnlen(arg, MAXPATHLEN);
+
+	if (len >= MAXPATHLEN)
+		return -1;
+
+	if ((mkdir(arg, 0700) != 0) && (errno != EEXIST)) {
+		pr_err("%s: cannot create %s (%s)\n", __func__, arg, strerror(errno));
+		return -1;
+	}
+	if ((stat(arg, &sb) != 0) || !S_ISDIR(sb.st_mode))
+		return -1;
+
+	strncpy(acpi_cache_dir, arg, len + 1);
+	pr_info("ACPI tables compiled are cached in %s\n", acpi_cache_dir);
+	return 0;
+}
+
+bool
+acpi_cache_enabled(void)
+{
+	return acpi_cache_dir[0] != '\0';
+}
+
 int
 get_iasl_compiler(void)
 {
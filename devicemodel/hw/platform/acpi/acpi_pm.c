@@ -373,6 +373,7 @@ void pm_write_dsdt(struct vmctx *ctx, int ncpu)
 		dsdt_line("    {");
 		dsdt_line("        Name (_HID, \"ACPI0007\")");
 		dsdt_line("        Name (_UID, 0x%02X)", i);
+		cpu_hotplug_write_dsdt_methods(i);
 		dsdt_line("    }");
 	}
 	dsdt_line("  }");
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * ACPI CPU hotplug of a running User VM.
+ *
+ * The processors of the VM are the pCPUs of --cpu_affinity, present from the
+ * start, then the pCPUs of --cpu_hotplug, absent from the start. Each one is
+ * the PRnn device whose _UID is its index in that order.
+ *
+ * A vCPU is added on an absent pCPU by the hypervisor first, then the guest
+ * is notified through GPE _E02 and brings it up with INIT-SIPI. A removal
+ * only notifies the guest: it offlines the processor and ejects it with _EJ0,
+ * the vCPU is removed from the hypervisor then.
+ *
+ * Registers at CPU_HOTPLUG_ADDR:
+ *   0: index of the processor the status register is of
+ *   1: status, read: bit 0 present, bit 1 insert pending, bit 2 remove pending
+ *      write 1 to: bit 1 or 2 to acknowledge the event, bit 3 to eject
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "vmmapi.h"
+#include "acpi.h"
+#include "inout.h"
+#include "lpc.h"
+#include "dm_string.h"
+#include "log.h"
+
+#define	CPUHP_PRESENT		(1U << 0)
+#define	CPUHP_INSERT		(1U << 1)
+#define	CPUHP_REMOVE		(1U << 2)
+#define	CPUHP_EJECT		(1U << 3)
+
+static pthread_mutex_t cpuhp_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cpuhp_pcpu[ACRN_PLATFORM_LAPIC_IDS_MAX];
+static uint8_t cpuhp_status[ACRN_PLATFORM_LAPIC_IDS_MAX];
+static int cpuhp_nr_cpus = -1;
+static uint8_t cpuhp_sel;
+
+/* the present pCPUs first, in the order their vCPUs are created in */
+static void
+cpuhp_init_cpus(void)
+{
+	uint64_t affinity = vm_get_cpu_affinity_dm();
+	uint64_t hotplug = vm_get_cpu_hotplug_dm() & ~affinity;
+	int pcpu_id;
+
+	if (cpuhp_nr_cpus >= 0)
+		return;
+
+	cpuhp_nr_cpus = 0;
+	for (pcpu_id = 0; pcpu_id < ACRN_PLATFORM_LAPIC_IDS_MAX; pcpu_id++) {
+		if (affinity & (1UL << pcpu_id)) {
+			cpuhp_pcpu[cpuhp_nr_cpus] = pcpu_id;
+			cpuhp_status[cpuhp_nr_cpus++] = CPUHP_PRESENT;
+		}
+	}
+	for (pcpu_id = 0; pcpu_id < ACRN_PLATFORM_LAPIC_IDS_MAX; pcpu_id++) {
+		if (hotplug & (1UL << pcpu_id)) {
+			cpuhp_pcpu[cpuhp_nr_cpus] = pcpu_id;
+			cpuhp_status[cpuhp_nr_cpus++] = 0;
+		}
+	}
+}
+
+bool
+cpu_hotplug_enabled(void)
+{
+	return (vm_get_cpu_hotplug_dm() != 0UL);
+}
+
+int
+cpu_hotplug_nr_cpus(void)
+{
+	cpuhp_init_cpus();
+	return cpuhp_nr_cpus;
+}
+
+int
+cpu_hotplug_pcpu(int idx)
+{
+	cpuhp_init_cpus();
+	return cpuhp_pcpu[idx];
+}
+
+bool
+cpu_hotplug_present(int idx)
+{
+	bool present;
+
+	pthread_mutex_lock(&cpuhp_lock);
+	cpuhp_init_cpus();
+	present = (cpuhp_status[idx] & CPUHP_PRESENT) != 0;
+	pthread_mutex_unlock(&cpuhp_lock);
+
+	return present;
+}
+
+/* in Device (PRnn) */
+void
+cpu_hotplug_write_dsdt_methods(int idx)
+{
+	if (!cpu_hotplug_enabled())
+		return;
+
+	dsdt_line("        Method (_STA, 0, NotSerialized)");
+	dsdt_line("        {");
+	dsdt_line("            Return (CSTA (0x%02X))", idx);
+	dsdt_line("        }");
+	dsdt_line("        Name (_MAT, Buffer (0x08)");
+	dsdt_line("        {");
+	dsdt_line("            0x00, 0x08, 0x%02X, 0x%02X, 0x01, 0x00, 0x00, 0x00",
+		idx, lapicid_from_pcpuid(cpu_hotplug_pcpu(idx)));
+	dsdt_line("        })");
+	dsdt_line("        Method (_EJ0, 1, NotSerialized)");
+	dsdt_line("        {");
+	dsdt_line("            CEJ (0x%02X)", idx);
+	dsdt_line("        }");
+}
+
+/* the processors absent from the start, the hotplug registers and the GPE handler */
+void
+cpu_hotplug_write_dsdt(int ncpu)
+{
+	int i;
+
+	if (!cpu_hotplug_enabled())
+		return;
+
+	dsdt_line("");
+	dsdt_line("  Scope (_SB)");
+	dsdt_line("  {");
+	for (i = ncpu; i < cpu_hotplug_nr_cpus(); i++) {
+		dsdt_line("    Device (PR%02d)", i);
+		dsdt_line("    {");
+		dsdt_line("        Name (_HID, \"ACPI0007\")");
+		dsdt_line("        Name (_UID, 0x%02X)", i);
+		cpu_hotplug_write_dsdt_methods(i);
+		dsdt_line("    }");
+	}
+	dsdt_line("");
+	dsdt_line("    OperationRegion (CPHP, SystemIO, 0x%04X, 0x%02X)",
+		CPU_HOTPLUG_ADDR, CPU_HOTPLUG_LEN);
+	dsdt_line("    Field (CPHP, ByteAcc, NoLock, WriteAsZeros)");
+	dsdt_line("    {");
+	dsdt_line("        CSEL, 8,");
+	dsdt_line("        CPEN, 1,");
+	dsdt_line("        CINS, 1,");
+	dsdt_line("        CRMV, 1,");
+	dsdt_line("        CEJ0, 1");
+	dsdt_line("    }");
+	dsdt_line("    Mutex (CPLK, 0x00)");
+	dsdt_line("");
+	dsdt_line("    Method (CSTA, 1, Serialized)");
+	dsdt_line("    {");
+	dsdt_line("        Local0 = Zero");
+	dsdt_line("        Acquire (CPLK, 0xFFFF)");
+	dsdt_line("        CSEL = Arg0");
+	dsdt_line("        If (CPEN)");
+	dsdt_line("        {");
+	dsdt_line("            Local0 = 0x0F");
+	dsdt_line("        }");
+	dsdt_line("        Release (CPLK)");
+	dsdt_line("        Return (Local0)");
+	dsdt_line("    }");
+	dsdt_line("");
+	dsdt_line("    Method (CEJ, 1, Serialized)");
+	dsdt_line("    {");
+	dsdt_line("        Acquire (CPLK, 0xFFFF)");
+	dsdt_line("        CSEL = Arg0");
+	dsdt_line("        CEJ0 = One");
+	dsdt_line("        Release (CPLK)");
+	dsdt_line("    }");
+	dsdt_line("");
+	dsdt_line("    /* the pending event of a processor, acknowledged: 1 insert, 3 eject */");
+	dsdt_line("    Method (CEVT, 1, Serialized)");
+	dsdt_line("    {");
+	dsdt_line("        Local0 = Zero");
+	dsdt_line("        Acquire (CPLK, 0xFFFF)");
+	dsdt_line("        CSEL = Arg0");
+	dsdt_line("        If (CINS)");
+	dsdt_line("        {");
+	dsdt_line("            CINS = One");
+	dsdt_line("            Local0 = One");
+	dsdt_line("        }");
+	dsdt_line("        ElseIf (CRMV)");
+	dsdt_line("        {");
+	dsdt_line("            CRMV = One");
+	dsdt_line("            Local0 = 0x03");
+	dsdt_line("        }");
+	dsdt_line("        Release (CPLK)");
+	dsdt_line("        Return (Local0)");
+	dsdt_line("    }");
+	dsdt_line("");
+	dsdt_line("    Method (CSCN, 0, Serialized)");
+	dsdt_line("    {");
+	/* the BSP is never hot-plugged */
+	for (i = 1; i < cpu_hotplug_nr_cpus(); i++) {
+		dsdt_line("        Local0 = CEVT (0x%02X)", i);
+		dsdt_line("        If (Local0)");
+		dsdt_line("        {");
+		dsdt_line("            Notify (PR%02d, Local0)", i);
+		dsdt_line("        }");
+	}
+	dsdt_line("    }");
+	dsdt_line("  }");
+	dsdt_line("");
+	dsdt_line("  Scope (_GPE)");
+	dsdt_line("  {");
+	dsdt_line("    Method (_E%02X, 0, NotSerialized)", GPE_CPU_HOTPLUG);
+	dsdt_line("    {");
+	dsdt_line("        \\_SB.CSCN ()");
+	dsdt_line("    }");
+	dsdt_line("  }");
+}
+
+static int
+cpuhp_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
+	      uint32_t *eax, void *arg)
+{
+	struct acrn_vcpu_hotplug hotplug;
+	int idx;
+
+	if (bytes != 1)
+		return -1;
+
+	pthread_mutex_lock(&cpuhp_lock);
+	cpuhp_init_cpus();
+	idx = cpuhp_sel;
+	if (port == CPU_HOTPLUG_ADDR) {
+		if (in)
+			*eax = cpuhp_sel;
+		else
+			cpuhp_sel = *eax;
+	} else if (idx >= cpuhp_nr_cpus) {
+		if (in)
+			*eax = 0;
+	} else if (in) {
+		*eax = cpuhp_status[idx];
+	} else {
+		cpuhp_status[idx] &= ~(*eax & (CPUHP_INSERT | CPUHP_REMOVE));
+		/* the guest offlined the processor, its vCPU goes */
+		if ((*eax & CPUHP_EJECT) && (cpuhp_status[idx] & CPUHP_PRESENT) && (idx != 0)) {
+			memset(&hotplug, 0, sizeof(hotplug));
+			hotplug.op = ACRN_VCPU_HOTPLUG_REMOVE;
+			hotplug.pcpu_id = cpuhp_pcpu[idx];
+			if (vm_hotplug_vcpu(ctx, &hotplug) == 0) {
+				cpuhp_status[idx] &= ~CPUHP_PRESENT;
+				pr_notice("%s: processor %d on pCPU %d ejected\n", __func__, idx, cpuhp_pcpu[idx]);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cpuhp_lock);
+
+	return 0;
+}
+INOUT_PORT(cpu_hotplug_sel, CPU_HOTPLUG_ADDR, IOPORT_F_INOUT, cpuhp_handler);
+INOUT_PORT(cpu_hotplug_sts, CPU_HOTPLUG_ADDR + 1, IOPORT_F_INOUT, cpuhp_handler);
+SYSRES_IO(CPU_HOTPLUG_ADDR, CPU_HOTPLUG_LEN);
+
+/*
+ * The cpu_hotplug monitor command:
+ *   add=<lapic_id>: add a vCPU on the pCPU, which the Service VM gave up
+ *   remove=<lapic_id>: ask the guest to eject the processor on the pCPU
+ */
+int
+cpu_hotplug_request(struct vmctx *ctx, char *opt)
+{
+	struct acrn_vcpu_hotplug hotplug;
+	bool add;
+	int lapic_id, pcpu_id, idx, ret = -1;
+
+	if (!cpu_hotplug_enabled()) {
+		pr_err("%s: no --cpu_hotplug pCPU for the VM\n", __func__);
+		return -1;
+	}
+
+	if (strncmp(opt, "add=", 4) == 0) {
+		add = true;
+		opt += 4;
+	} else if (strncmp(opt, "remove=", 7) == 0) {
+		add = false;
+		opt += 7;
+	} else {
+		pr_err("%s: invalid option %s\n", __func__, opt);
+		return -1;
+	}
+	if (dm_strtoi(opt, NULL, 10, &lapic_id) != 0) {
+		pr_err("%s: invalid lapic_id %s\n", __func__, opt);
+		return -1;
+	}
+	pcpu_id = lapic_to_pcpu(lapic_id);
+
+	pthread_mutex_lock(&cpuhp_lock);
+	cpuhp_init_cpus();
+	for (idx = 0; idx < cpuhp_nr_cpus; idx++) {
+		if (cpuhp_pcpu[idx] == pcpu_id)
+			break;
+	}
+
+	if ((idx == 0) || (idx >= cpuhp_nr_cpus)) {
+		pr_err("%s: lapic_id %d is not a hot-pluggable processor of the VM\n", __func__, lapic_id);
+	} else if (add) {
+		if (cpuhp_status[idx] & CPUHP_PRESENT) {
+			pr_err("%s: processor %d is present already\n", __func__, idx);
+		} else {
+			memset(&hotplug, 0, sizeof(hotplug));
+			hotplug.op = ACRN_VCPU_HOTPLUG_ADD;
+			hotplug.pcpu_id = pcpu_id;
+			ret = vm_hotplug_vcpu(ctx, &hotplug);
+			if (ret == 0) {
+				cpuhp_status[idx] = CPUHP_PRESENT | CPUHP_INSERT;
+				pr_notice("%s: processor %d added, vCPU %u on pCPU %d\n", __func__,
+					idx, hotplug.vcpu_id, pcpu_id);
+			}
+		}
+	} else {
+		if (!(cpuhp_status[idx] & CPUHP_PRESENT)) {
+			pr_err("%s: processor %d is not present\n", __func__, idx);
+		} else {
+			cpuhp_status[idx] |= CPUHP_REMOVE;
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&cpuhp_lock);
+
+	if (ret == 0)
+		inject_gpe_event(ctx, GPE_CPU_HOTPLUG);
+
+	return ret;
+}
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "dm.h"
 #include "vmmapi.h"
 #include "mem.h"
 #include "timer.h"
@@ -974,6 +975,10 @@ vhpet_init(struct vmctx *ctx)
 	memset(vhpet, 0, sizeof(*vhpet));
 	vhpet->vm = ctx;
 
+	/* With --vhpet, the hypervisor handles the accesses to the same device */
+	if (hv_vhpet)
+		goto done;
+
 	pincount = VIOAPIC_RTE_NUM;
 
 	if (pincount >= 32)
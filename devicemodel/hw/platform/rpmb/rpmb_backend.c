@@ -236,19 +236,21 @@ static int rpmb_check_frame(const char *cmd_str, int *err,
 
 static int rpmb_phy_ioctl(uint32_t ioc_cmd, void* seq_data)
 {
+	static int fd = -1;
 	int rc = -1;
-	int fd;
 
 	if (seq_data == NULL) {
 		DPRINTF(("%s: seq_data is NULL\n", __func__));
 		return rc;
 	}
 
-	/* open rpmb device.*/
-	fd = open(RPMB_PHY_PATH_NAME, O_RDWR | O_NONBLOCK);
+	/* open rpmb device, once: it stays open for the next sequences */
 	if (fd < 0) {
-		DPRINTF(("%s: failed to open %s.\n", __func__, RPMB_PHY_PATH_NAME));
-		return fd;
+		fd = open(RPMB_PHY_PATH_NAME, O_RDWR | O_NONBLOCK);
+		if (fd < 0) {
+			DPRINTF(("%s: failed to open %s.\n", __func__, RPMB_PHY_PATH_NAME));
+			return fd;
+		}
 	}
 
 	/* send ioctl cmd.*/
@@ -256,9 +258,6 @@ static int rpmb_phy_ioctl(uint32_t ioc_cmd, void* seq_data)
 	if (rc)
 		DPRINTF(("%s: seq ioctl cmd failed(%d).\n", __func__, rc));
 
-	/* close rpmb device.*/
-	close(fd);
-
 	return rc;
 }
 
@@ -28,11 +28,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <openssl/hmac.h>
 #include <openssl/opensslv.h>
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
 #include <openssl/evp.h>
+#include <openssl/params.h>
+#include <openssl/core_names.h>
 #endif
 
 #include "rpmb.h"
@@ -41,6 +44,19 @@
 
 static FILE *rpmb_fd = NULL;
 
+/*
+ * The key and the write counter, read once when the file is opened and
+ * kept up to date by the writes: the file is only opened by this process,
+ * and stays open. A sequence reads or writes the data only.
+ */
+static struct {
+	bool		key_programmed;
+	bool		key_valid;
+	bool		counter_valid;
+	uint8_t		key[32];
+	uint32_t	counter;
+} sim_state;
+
 /*
  * 0~6 is magic
  * 7~38 is rpmb key
@@ -108,6 +124,9 @@ err:
 	return hmac_ret ? 0 : -1;
 }
 #elif OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* fetched once, the lookup in the providers costs more than a frame's MAC */
+static EVP_MAC *rpmb_hmac = NULL;
+
 int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
 			size_t frame_cnt, uint8_t *mac)
 {
@@ -115,16 +134,26 @@ int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
 	int hmac_ret;
 	size_t md_len;
 	EVP_MAC_CTX *hmac_ctx;
-	EVP_MAC *hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+	OSSL_PARAM params[2];
 
-	hmac_ctx = EVP_MAC_CTX_new(hmac);
+	if (rpmb_hmac == NULL) {
+		rpmb_hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+		if (rpmb_hmac == NULL) {
+			DPRINTF(("fetch hmac failed\n"));
+			return -1;
+		}
+	}
+
+	hmac_ctx = EVP_MAC_CTX_new(rpmb_hmac);
 	if (hmac_ctx == NULL) {
 		DPRINTF(("get hmac_ctx failed\n"));
-		EVP_MAC_free(hmac);
 		return -1;
 	}
 
-	hmac_ret = EVP_MAC_init(hmac_ctx, key, 32, NULL);
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+			(char *)"SHA256", 0);
+	params[1] = OSSL_PARAM_construct_end();
+	hmac_ret = EVP_MAC_init(hmac_ctx, key, 32, params);
 	if (!hmac_ret) {
 		DPRINTF(("HMAC_Init_ex failed\n"));
 		goto err;
@@ -151,7 +180,6 @@ int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
 
 err:
 	EVP_MAC_CTX_free(hmac_ctx);
-	EVP_MAC_free(hmac);
 
 	return hmac_ret ? 0 : -1;
 }
@@ -202,12 +230,6 @@ err:
 }
 #endif
 
-static void rpmb_sim_close(void)
-{
-	fclose(rpmb_fd);
-	rpmb_fd = NULL;
-}
-
 static int file_write(FILE *fp, const void *buf, size_t size, off_t offset)
 {
 	size_t rc = 0;
@@ -253,9 +275,27 @@ static int file_read(FILE *fp, void *buf, size_t size, off_t offset)
 	}
 }
 
+static void rpmb_sim_load_state(void)
+{
+	uint8_t magic[KEY_MAGIC_LENGTH] = {0};
+	uint32_t counter;
+
+	sim_state.key_programmed =
+		file_read(rpmb_fd, magic, KEY_MAGIC_LENGTH, KEY_MAGIC_ADDR) >= 0 &&
+		!memcmp(KEY_MAGIC, magic, KEY_MAGIC_LENGTH);
+	sim_state.key_valid = file_read(rpmb_fd, sim_state.key, KEY_LENGTH, KEY_ADDR) >= 0;
+	sim_state.counter_valid =
+		file_read(rpmb_fd, &counter, sizeof(counter), WRITER_COUNTER_ADDR) >= 0;
+	sim_state.counter = counter;
+}
+
 static int rpmb_sim_open(const char *rpmb_devname)
 {
 	uint8_t data = 0;
+
+	if (rpmb_fd != NULL)
+		return 0;
+
 	rpmb_fd = fopen(rpmb_devname, "rb+");
 
 	if (rpmb_fd == NULL) {
@@ -275,21 +315,19 @@ static int rpmb_sim_open(const char *rpmb_devname)
 		return -1;
 	}
 
+	rpmb_sim_load_state();
 	return 0;
 }
 
 static int get_counter(uint32_t *counter)
 {
-	int rc = 0;
-
-	rc = file_read(rpmb_fd, counter, sizeof(*counter), WRITER_COUNTER_ADDR);
-	if (rc < 0)
+	if (!sim_state.counter_valid)
 	{
 		DPRINTF(("%s failed.\n", __func__));
 		return -1;
 	}
 
-	swap32(*counter);
+	*counter = sim_state.counter;
 
 	return 0;
 }
@@ -304,41 +342,31 @@ static int set_counter(const uint32_t *counter)
 	if (rc < 0)
 	{
 		DPRINTF(("%s failed.\n", __func__));
+		sim_state.counter_valid = false;
 		return -1;
 	}
 
+	sim_state.counter = *counter;
+	sim_state.counter_valid = true;
+
 	return 0;
 }
 
 static int is_key_programmed(void)
 {
-	int rc = 0;
-	uint8_t magic[KEY_MAGIC_LENGTH] = {0};
-
-	rc = file_read(rpmb_fd, magic, KEY_MAGIC_LENGTH, KEY_MAGIC_ADDR);
-	if (rc < 0)
-	{
-		DPRINTF(("%s read magic failed.\n", __func__));
-		return 0;
-	}
-
-	if (memcmp(KEY_MAGIC, magic, KEY_MAGIC_LENGTH))
-		return 0;
-
-	return 1;
+	return sim_state.key_programmed ? 1 : 0;
 }
 
 static int get_key(uint8_t *key)
 {
-	int rc = 0;
-
-	rc = file_read(rpmb_fd, key, 32, KEY_ADDR);
-	if (rc < 0)
+	if (!sim_state.key_valid)
 	{
 		DPRINTF(("%s failed.\n", __func__));
 		return -1;
 	}
 
+	memcpy(key, sim_state.key, KEY_LENGTH);
+
 	return 0;
 }
 
@@ -346,12 +374,15 @@ static int program_key(const uint8_t *key)
 {
 	int rc = 0;
 
+	sim_state.key_valid = false;
 	rc = file_write(rpmb_fd, key, 32, KEY_ADDR);
 	if (rc < 0)
 	{
 		DPRINTF(("%s failed at set key.\n", __func__));
 		return -1;
 	}
+	memcpy(sim_state.key, key, KEY_LENGTH);
+	sim_state.key_valid = true;
 
 	rc = file_write(rpmb_fd, KEY_MAGIC, KEY_MAGIC_LENGTH, KEY_MAGIC_ADDR);
 	if (rc < 0)
@@ -359,6 +390,7 @@ static int program_key(const uint8_t *key)
 		DPRINTF(("%s failed at set magic.\n", __func__));
 		return -1;
 	}
+	sim_state.key_programmed = true;
 
 	return 0;
 }
@@ -616,11 +648,7 @@ int is_use_sim_rpmb(void)
 		return 0;
 	}
 
-	ret = is_key_programmed();
-
-	rpmb_sim_close();
-
-	return ret;
+	return is_key_programmed();
 }
 
 int rpmb_sim_key_init(uint8_t *key)
@@ -653,8 +681,6 @@ int rpmb_sim_key_init(uint8_t *key)
 	}
 
 out:
-	rpmb_sim_close();
-
 	return ret;
 }
 
@@ -734,6 +760,7 @@ int rpmb_sim_send(const void *r)
 		}
 	}
 
+	/* opened by the first sequence, and kept open */
 	ret = rpmb_sim_open(RPMB_SIM_PATH_NAME);
 	if (ret) {
 		DPRINTF(("%s: rpmb_sim_open failed\n", __func__));
@@ -744,7 +771,6 @@ int rpmb_sim_send(const void *r)
 	ret = rpmb_sim_operations(frame_rel_write, rel_write_size,
 							 frame_write, write_size,
 							 frame_read, read_size);
-	rpmb_sim_close();
 
 	if (ret) {
 		DPRINTF(("%s: rpmb_sim_operations failed\n", __func__));
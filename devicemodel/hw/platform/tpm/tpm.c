@@ -17,6 +17,7 @@
 #include "log.h"
 #include "mmio_dev.h"
 #include "dm.h"
+#include "launch_timeline.h"
 
 static int tpm_debug;
 #define LOG_TAG "tpm: "
@@ -256,11 +257,15 @@ int acrn_parse_vtpm2(char *arg)
 
 void init_vtpm2(struct vmctx *ctx)
 {
+	uint64_t start_us;
+
 	if (!sock_path) {
 		WPRINTF("Invalid socket path!\n");
 		return;
 	}
 
+	/* connecting to SWTPM and its startup are part of the launch time */
+	start_us = launch_timeline_now();
 	if (init_tpm_emulator(sock_path) < 0) {
 		WPRINTF("Failed init tpm emulator!\n");
 		return;
@@ -274,6 +279,7 @@ void init_vtpm2(struct vmctx *ctx)
 	if (init_tpm_crb(ctx) < 0) {
 		WPRINTF("Failed init tpm emulator!\n");
 	}
+	launch_timeline_add_phase("init_vtpm2", start_us);
 }
 
 void deinit_vtpm2(struct vmctx *ctx)
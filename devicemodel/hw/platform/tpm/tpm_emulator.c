@@ -21,10 +21,12 @@
 
 #include "vmmapi.h"
 #include "tpm_internal.h"
+#include "launch_timeline.h"
 #include "log.h"
 
 /* According to definition in TPM2 spec */
 #define TPM_ORD_ContinueSelfTest	0x53
+#define TPM2_CC_PCR_Extend		0x182
 #define TPM_TAG_RSP_COMMAND		0xc4
 #define TPM_FAIL		9
 #define PTM_INIT_FLAG_DELETE_VOLATILE	(1 << 0)
@@ -128,6 +130,9 @@ typedef struct  {
  * cur_locty_number: to store the last set locality
  * established_flag & established_flag_cached: used in
  *    swtpm_get_tpm_established_flag, to store tpm establish flag.
+ * nr_cmds & cmd_us: the TPM2 commands of the User VM and the time spent
+ *    in SWTPM for them, PCR extends also counted apart as measured boot
+ *    issues most of its commands as such.
  */
 typedef struct swtpm_context {
 	int ctrl_chan_fd;
@@ -135,6 +140,11 @@ typedef struct swtpm_context {
 	uint8_t cur_locty_number; /* last set locality */
 	unsigned int established_flag:1;
 	unsigned int established_flag_cached:1;
+	uint64_t nr_cmds;
+	uint64_t cmd_us;
+	uint64_t max_cmd_us;
+	uint64_t nr_pcr_extends;
+	uint64_t pcr_extend_us;
 } swtpm_context;
 
 /* Align with definition in SWTPM */
@@ -713,6 +723,12 @@ static void swtpm_write_fatal_error_response(uint8_t *out, uint32_t out_len)
 
 static void swtpm_cleanup(void)
 {
+	if (tpm_context.nr_cmds) {
+		pr_notice("swtpm: %lu commands in %lu us (max %lu us), %lu PCR extends in %lu us\n",
+			tpm_context.nr_cmds, tpm_context.cmd_us, tpm_context.max_cmd_us,
+			tpm_context.nr_pcr_extends, tpm_context.pcr_extend_us);
+	}
+
 	swtpm_shutdown();
 	close(tpm_context.cmd_chan_fd);
 	close(tpm_context.ctrl_chan_fd);
@@ -723,13 +739,32 @@ int swtpm_startup(size_t buffersize)
 	return swtpm_startup_tpm(buffersize, false);
 }
 
+static void swtpm_account_cmd(const uint8_t *in, uint32_t in_len, uint64_t start_us)
+{
+	uint64_t us = launch_timeline_now() - start_us;
+
+	tpm_context.nr_cmds++;
+	tpm_context.cmd_us += us;
+	if (us > tpm_context.max_cmd_us)
+		tpm_context.max_cmd_us = us;
+
+	if ((in_len >= sizeof(tpm_input_header)) &&
+		(tpm_cmd_get_ordinal(in) == TPM2_CC_PCR_Extend)) {
+		tpm_context.nr_pcr_extends++;
+		tpm_context.pcr_extend_us += us;
+	}
+}
+
 int swtpm_handle_request(TPMCommBuffer *cmd)
 {
+	uint64_t start_us;
+
 	if (!cmd) {
 		pr_err("%s error, invalid input.\n", __func__);
 		return -1;
 	}
 
+	start_us = launch_timeline_now();
 	if (swtpm_set_locality(cmd->locty) < 0 ||
 		swtpm_cmdcmd(tpm_context.cmd_chan_fd, cmd->in, cmd->in_len,
 				cmd->out, cmd->out_len,
@@ -737,6 +772,7 @@ int swtpm_handle_request(TPMCommBuffer *cmd)
 		swtpm_write_fatal_error_response(cmd->out, cmd->out_len);
 		return -1;
 	}
+	swtpm_account_cmd(cmd->in, cmd->in_len, start_us);
 
 	return 0;
 }
@@ -7,7 +7,9 @@
 
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "usb.h"
@@ -163,6 +165,202 @@ libusb_speed_to_usb_speed(int libusb_speed)
 	return speed;
 }
 
+static void
+usb_dev_free_req(struct usb_dev_req *r)
+{
+	if (r->trn)
+		libusb_free_transfer(r->trn);
+	free(r->buffer);
+	free(r);
+}
+
+static struct usb_dev_req *
+usb_dev_new_req(struct usb_dev_req_pool *pool, bool pooled)
+{
+	struct usb_dev_req *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	/* one size for all, it only costs the packet descriptors */
+	r->trn = libusb_alloc_transfer(USB_DEV_ISO_PKTS);
+	if (!r->trn) {
+		free(r);
+		return NULL;
+	}
+
+	r->pool = pool;
+	r->pooled = pooled;
+	return r;
+}
+
+static void
+usb_dev_free_pool(struct usb_dev_req_pool *pool)
+{
+	struct usb_dev_req *r;
+
+	while ((r = LIST_FIRST(&pool->free_reqs)) != NULL) {
+		LIST_REMOVE(r, link);
+		usb_dev_free_req(r);
+	}
+	pthread_mutex_destroy(&pool->mtx);
+	free(pool);
+}
+
+static struct usb_dev_req_pool *
+usb_dev_alloc_pool(void)
+{
+	struct usb_dev_req_pool *pool;
+	struct usb_dev_req *r;
+	int i;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->mtx, NULL);
+	LIST_INIT(&pool->free_reqs);
+	LIST_INIT(&pool->busy_reqs);
+	for (i = 0; i < USB_DEV_REQ_POOL_SIZE; i++) {
+		r = usb_dev_new_req(pool, true);
+		if (!r) {
+			usb_dev_free_pool(pool);
+			return NULL;
+		}
+		LIST_INSERT_HEAD(&pool->free_reqs, r, link);
+	}
+	return pool;
+}
+
+/*
+ * Called when the device is gone, the transfers still in flight are cancelled
+ * and the pool is freed with the last of them.
+ */
+static void
+usb_dev_kill_pool(struct usb_dev *udev, struct usb_dev_ep *ep, int epnum)
+{
+	struct usb_dev_req_pool *pool;
+	struct usb_dev_req *r;
+	bool busy;
+
+	pool = ep->pool;
+	if (!pool)
+		return;
+
+	ep->pool = NULL;
+	if (pool->underruns)
+		UPRINTF(LINF, "%d-%s: ep%d %s: %lu isoc underruns\r\n",
+				udev->info.path.bus,
+				usb_dev_path(&udev->info.path), epnum,
+				ep->pid == TOKEN_IN ? "IN" : "OUT",
+				pool->underruns);
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->dead = true;
+	LIST_FOREACH(r, &pool->busy_reqs, link)
+		libusb_cancel_transfer(r->trn);
+	busy = pool->nr_busy > 0;
+	pthread_mutex_unlock(&pool->mtx);
+
+	if (!busy)
+		usb_dev_free_pool(pool);
+}
+
+static struct usb_dev_req *
+usb_dev_get_req(struct usb_dev *udev, struct usb_dev_ep *ep,
+		struct usb_xfer *xfer, int in, int size)
+{
+	struct usb_dev_req_pool *pool;
+	struct usb_dev_req *r;
+	static int seq = 1;
+	uint8_t *buf;
+	int i;
+
+	pool = ep->pool;
+	pthread_mutex_lock(&pool->mtx);
+	r = LIST_FIRST(&pool->free_reqs);
+	if (r)
+		LIST_REMOVE(r, link);
+	pthread_mutex_unlock(&pool->mtx);
+
+	if (!r) {
+		r = usb_dev_new_req(pool, false);
+		if (!r)
+			return NULL;
+	}
+
+	if (r->buf_cap < size) {
+		buf = realloc(r->buffer, size);
+		if (!buf) {
+			pthread_mutex_lock(&pool->mtx);
+			if (r->pooled)
+				LIST_INSERT_HEAD(&pool->free_reqs, r, link);
+			pthread_mutex_unlock(&pool->mtx);
+			if (!r->pooled)
+				usb_dev_free_req(r);
+			return NULL;
+		}
+		r->buffer = buf;
+		r->buf_cap = size;
+	}
+
+	r->udev = udev;
+	r->in = in;
+	r->xfer = xfer;
+	r->seq = seq++;
+	for (i = 0; i < USB_DEV_ISO_PKTS; i++)
+		r->trn->iso_packet_desc[i].length = 0;
+
+	pthread_mutex_lock(&pool->mtx);
+	LIST_INSERT_HEAD(&pool->busy_reqs, r, link);
+	pool->nr_busy++;
+	if (pool->drained && ep->type == USB_ENDPOINT_ISOC) {
+		pool->underruns++;
+		UPRINTF(LDBG, "ep%d underrun %lu\r\n", xfer->epid,
+				pool->underruns);
+	}
+	pool->drained = false;
+	pthread_mutex_unlock(&pool->mtx);
+	return r;
+}
+
+/*
+ * Put back a busy request. completed is false for the requests never
+ * submitted or cancelled, which say nothing of the timing of the endpoint.
+ */
+static void
+usb_dev_put_req(struct usb_dev_req *r, bool completed)
+{
+	struct usb_dev_req_pool *pool;
+	bool free_req, free_pool;
+
+	pool = r->pool;
+	pthread_mutex_lock(&pool->mtx);
+	LIST_REMOVE(r, link);
+	pool->nr_busy--;
+	if (completed && pool->nr_busy == 0)
+		pool->drained = true;
+
+	r->xfer = NULL;
+	free_req = !r->pooled || pool->dead;
+	if (!free_req) {
+		if (r->buf_cap > USB_DEV_REQ_BUF_MAX) {
+			free(r->buffer);
+			r->buffer = NULL;
+			r->buf_cap = 0;
+		}
+		LIST_INSERT_HEAD(&pool->free_reqs, r, link);
+	}
+	free_pool = pool->dead && pool->nr_busy == 0;
+	pthread_mutex_unlock(&pool->mtx);
+
+	if (free_req)
+		usb_dev_free_req(r);
+	if (free_pool)
+		usb_dev_free_pool(pool);
+}
+
 static void
 usb_dev_comp_cb(struct libusb_transfer *trn)
 {
@@ -181,12 +379,19 @@ usb_dev_comp_cb(struct libusb_transfer *trn)
 	r = trn->user_data;
 	if (!r) {
 		UPRINTF(LFTL, "error: user context data not found on USB transfer\r\n");
-		goto free_transfer;
+		libusb_free_transfer(trn);
+		return;
 	}
-	info = &r->udev->info;
 
-	/* async transfer */
-	xfer = r->xfer;
+	/* async transfer, detached if its endpoint or device is gone */
+	pthread_mutex_lock(&r->pool->mtx);
+	xfer = r->pool->dead ? NULL : r->xfer;
+	pthread_mutex_unlock(&r->pool->mtx);
+	if (!xfer) {
+		usb_dev_put_req(r, false);
+		return;
+	}
+	info = &r->udev->info;
 
 	maxp = usb_dev_get_ep_maxp(r->udev, r->in, xfer->epid / 2);
 	if (trn->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
@@ -275,7 +480,7 @@ usb_dev_comp_cb(struct libusb_transfer *trn)
 
 			if (block->type == USB_DATA_PART ||
 					block->type == USB_DATA_FULL) {
-				if (r->in == TOKEN_IN) {
+				if (r->in == TOKEN_IN && !r->direct) {
 					memcpy(block->buf, buf + buf_idx, d);
 					buf_idx += d;
 				}
@@ -314,56 +519,11 @@ out:
 		g_ctx.intr_cb(xfer->dev, NULL);
 
 cancel_out:
-	/* unlock and release memory */
+	/* unlock and give the request back to the pool */
 	g_ctx.unlock_ep_cb(xfer->dev, &xfer->epid);
 
-	if (r && r->buffer)
-		free(r->buffer);
-
 	xfer->reqs[r->blk_head] = NULL;
-	free(r);
-free_transfer:
-	libusb_free_transfer(trn);
-}
-
-static struct usb_dev_req *
-usb_dev_alloc_req(struct usb_dev *udev, struct usb_xfer *xfer, int in,
-		size_t size, size_t count)
-{
-	struct usb_dev_req *req;
-	static int seq = 1;
-
-	if (!udev || !xfer || count < 0)
-		return NULL;
-
-	req = calloc(1, sizeof(*req));
-	if (!req)
-		return NULL;
-
-	req->udev = udev;
-	req->in = in;
-	req->xfer = xfer;
-	req->seq = seq++;
-	req->trn = libusb_alloc_transfer(count);
-	if (!req->trn)
-		goto errout;
-
-	if (size)
-		req->buffer = malloc(size);
-
-	if (!req->buffer)
-		goto errout;
-
-	return req;
-
-errout:
-	if (req && req->buffer)
-		free(req->buffer);
-	if (req && req->trn)
-		libusb_free_transfer(req->trn);
-	if (req)
-		free(req);
-	return NULL;
+	usb_dev_put_req(r, trn->status != LIBUSB_TRANSFER_CANCELLED);
 }
 
 static int
@@ -746,86 +906,67 @@ usb_dev_reset(void *pdata)
 	return rc;
 }
 
-int
-usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+/* the data block of [head, tail) if it is the only one */
+static struct usb_block *
+usb_dev_single_block(struct usb_xfer *xfer, int head, int tail)
+{
+	struct usb_block *b, *data = NULL;
+	int idx;
+
+	for (idx = head; index_valid(head, tail, xfer->max_blk_cnt, idx);
+			idx = index_inc(idx, xfer->max_blk_cnt)) {
+		b = &xfer->data[idx];
+		if (b->type == USB_DATA_NONE)
+			continue;
+		if (data || b->type != USB_DATA_FULL)
+			return NULL;
+		data = b;
+	}
+	return data;
+}
+
+/* submit the blocks [head, tail) of xfer as one libusb transfer */
+static int
+usb_dev_submit_req(struct usb_dev *udev, struct usb_dev_ep *ep,
+		struct usb_xfer *xfer, int dir, int epctx, int head, int tail,
+		int size, int framecnt)
 {
-	struct usb_dev *udev;
 	struct usb_dev_req *r;
 	struct usb_native_devinfo *info;
-	int rc = 0, epid;
-	uint8_t type;
-	int i, idx, buf_idx, head, tail, size;
-	struct usb_block *b;
+	struct usb_block *b, *direct = NULL;
+	uint8_t *buf;
+	int rc, epid;
+	int i, idx, buf_idx;
 	static const char * const type_str[] = {"CTRL", "ISO", "BULK", "INT"};
 	static const char * const dir_str[] = {"OUT", "IN"};
-	int framelen = 0, framecnt = 0;
-	uint16_t maxp;
 
-	udev = pdata;
 	info = &udev->info;
-	xfer->status = USB_ERR_NORMAL_COMPLETION;
-	size = usb_dev_prepare_xfer(xfer, &head, &tail);
-	if (size <= 0)
-		goto done;
-
-	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
-	if (type > USB_ENDPOINT_INT) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
 	epid = dir ? (0x80 | epctx) : epctx;
-	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
-	maxp = usb_dev_get_ep_maxp(udev, dir, epctx);
-	if (type == USB_ENDPOINT_ISOC) {
-		/* need to double check it, there might be some non-spec
-		 * compatible usb devices in the market.
-		 */
-		framelen = USB_EP_MAXP_SZ(maxp) * (1 + USB_EP_MAXP_MT(maxp));
-		UPRINTF(LDBG, "iso maxp %u framelen %d\r\n", maxp, framelen);
-
-		for (idx = head;
-			index_valid(head, tail, xfer->max_blk_cnt, idx);
-			idx = index_inc(idx, xfer->max_blk_cnt)) {
 
-			if (xfer->data[idx].blen > framelen)
-				UPRINTF(LFTL, "err framelen %d\r\n", framelen);
-
-			if (xfer->data[idx].type == USB_DATA_NONE ||
-					xfer->data[idx].type == USB_DATA_PART)
-				continue;
-			else if (xfer->data[idx].type == USB_DATA_FULL)
-				framecnt++;
-			else
-				UPRINTF(LFTL, "%s:%d error\r\n", __func__, __LINE__);
-		}
-		UPRINTF(LDBG, "iso maxp %u framelen %d, framecnt %d\r\n", maxp,
-				framelen, framecnt);
-	}
+	/*
+	 * A bulk TD of one TRB, the most of those of mass storage, goes from
+	 * or to the guest buffer itself with no copy.
+	 */
+	if (ep->type == USB_ENDPOINT_BULK)
+		direct = usb_dev_single_block(xfer, head, tail);
 
-	r = usb_dev_alloc_req(udev, xfer, dir, size, type ==
-			USB_ENDPOINT_ISOC ? framecnt : 0);
-	if (!r) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
+	r = usb_dev_get_req(udev, ep, xfer, dir, direct ? 0 : size);
+	if (!r)
+		return USB_ERR_IOERROR;
 
+	r->direct = direct != NULL;
+	buf = direct ? direct->buf : r->buffer;
 	r->buf_size = size;
 	r->blk_head = head;
 	r->blk_tail = tail;
-	xfer->reqs[head] = r;
 	UPRINTF(LDBG, "%s: %d-%s: explen %d ep%d-xfr [%d-%d %d] rq-%d "
 			"[%d-%d %d] dir %s type %s\r\n", __func__,
 			info->path.bus, usb_dev_path(&info->path), size, epctx,
 			xfer->head, xfer->tail, xfer->ndata, r->seq,
 			r->blk_head, r->blk_tail, r->buf_size, dir_str[dir],
-			type_str[type]);
+			type_str[ep->type]);
 
-	if (!dir) {
+	if (!dir && !direct) {
 		for (idx = head, buf_idx = 0;
 				index_valid(head, tail, xfer->max_blk_cnt, idx);
 				idx = index_inc(idx, xfer->max_blk_cnt)) {
@@ -838,7 +979,7 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 		}
 	}
 
-	if (type == USB_ENDPOINT_ISOC) {
+	if (ep->type == USB_ENDPOINT_ISOC) {
 		for (i = 0, idx = head;
 				index_valid(head, tail, xfer->max_blk_cnt, idx);
 				idx = index_inc(idx, xfer->max_blk_cnt)) {
@@ -862,33 +1003,112 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 		}
 	}
 
-	if (type == USB_ENDPOINT_BULK) {
+	if (ep->type == USB_ENDPOINT_BULK)
 		libusb_fill_bulk_transfer(r->trn, udev->handle, epid,
-				r->buffer, size, usb_dev_comp_cb, r, 0);
-
-	} else if (type == USB_ENDPOINT_INT) {
+				buf, size, usb_dev_comp_cb, r, 0);
+	else if (ep->type == USB_ENDPOINT_INT)
 		libusb_fill_interrupt_transfer(r->trn, udev->handle, epid,
 				r->buffer, size, usb_dev_comp_cb, r, 0);
-
-	} else if (type == USB_ENDPOINT_ISOC) {
+	else
 		libusb_fill_iso_transfer(r->trn, udev->handle, epid,
 				r->buffer, size, framecnt,
 				usb_dev_comp_cb, r, 0);
 
-	} else {
+	xfer->reqs[head] = r;
+	rc = libusb_submit_transfer(r->trn);
+	if (rc) {
+		UPRINTF(LDBG, "libusb_submit_transfer fail: %d\n", rc);
+		xfer->reqs[head] = NULL;
+		usb_dev_put_req(r, false);
+		return USB_ERR_IOERROR;
+	}
+	return USB_ERR_NORMAL_COMPLETION;
+}
+
+int
+usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+{
+	struct usb_dev *udev;
+	struct usb_dev_ep *ep;
+	uint8_t type;
+	int idx, first, head, tail, size;
+	struct usb_block *b;
+	int framelen = 0, framecnt = 0;
+	uint16_t maxp;
+
+	udev = pdata;
+	xfer->status = USB_ERR_NORMAL_COMPLETION;
+	size = usb_dev_prepare_xfer(xfer, &head, &tail);
+	if (size <= 0)
+		goto done;
+
+	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
+	if (type == USB_ENDPOINT_CONTROL || type > USB_ENDPOINT_INT) {
 		UPRINTF(LFTL, "%s: wrong endpoint type %d\r\n", __func__, type);
-		if (r->buffer)
-			free(r->buffer);
-		if (r->trn)
-			libusb_free_transfer(r->trn);
-		free(r);
-		xfer->status = USB_ERR_INVAL;
+		xfer->status = USB_ERR_IOERROR;
+		goto done;
 	}
 
-	rc = libusb_submit_transfer(r->trn);
-	if (rc) {
+	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
 		xfer->status = USB_ERR_IOERROR;
-		UPRINTF(LDBG, "libusb_submit_transfer fail: %d\n", rc);
+		goto done;
+	}
+
+	ep = usb_dev_get_ep(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
+	if (!ep->pool) {
+		ep->pool = usb_dev_alloc_pool();
+		if (!ep->pool) {
+			xfer->status = USB_ERR_IOERROR;
+			goto done;
+		}
+	}
+
+	if (type != USB_ENDPOINT_ISOC) {
+		xfer->status = usb_dev_submit_req(udev, ep, xfer, dir, epctx,
+				head, tail, size, 0);
+		goto done;
+	}
+
+	/* need to double check it, there might be some non-spec
+	 * compatible usb devices in the market.
+	 */
+	maxp = usb_dev_get_ep_maxp(udev, dir, epctx);
+	framelen = USB_EP_MAXP_SZ(maxp) * (1 + USB_EP_MAXP_MT(maxp));
+	UPRINTF(LDBG, "iso maxp %u framelen %d\r\n", maxp, framelen);
+
+	/*
+	 * Split the frames into transfers of up to USB_DEV_ISO_PKTS packets,
+	 * all submitted at once. The device keeps its frames scheduled with
+	 * the next transfers while the previous ones complete to the guest.
+	 */
+	first = head;
+	size = 0;
+	for (idx = head; index_valid(head, tail, xfer->max_blk_cnt, idx); ) {
+		b = &xfer->data[idx];
+		if (b->blen > framelen)
+			UPRINTF(LFTL, "err framelen %d\r\n", framelen);
+
+		if (b->type == USB_DATA_PART || b->type == USB_DATA_FULL)
+			size += b->blen;
+		if (b->type == USB_DATA_FULL)
+			framecnt++;
+
+		idx = index_inc(idx, xfer->max_blk_cnt);
+		if (framecnt < USB_DEV_ISO_PKTS &&
+				index_valid(head, tail, xfer->max_blk_cnt, idx))
+			continue;
+
+		UPRINTF(LDBG, "iso maxp %u framelen %d, framecnt %d\r\n",
+				maxp, framelen, framecnt);
+		if (size > 0) {
+			xfer->status = usb_dev_submit_req(udev, ep, xfer, dir,
+					epctx, first, idx, size, framecnt);
+			if (xfer->status != USB_ERR_NORMAL_COMPLETION)
+				break;
+		}
+		first = idx;
+		size = 0;
+		framecnt = 0;
 	}
 done:
 	return xfer->status;
@@ -1121,10 +1341,17 @@ errout:
 void
 usb_dev_free_request(void *pdata)
 {
-	struct libusb_transfer *trn;
+	struct usb_dev_req *r;
 
-	trn = pdata;
-	libusb_free_transfer(trn);
+	/*
+	 * The transfer is in flight, detach it from its xfer about to be
+	 * freed. usb_dev_comp_cb gives it back to the pool once cancelled.
+	 */
+	r = pdata;
+	pthread_mutex_lock(&r->pool->mtx);
+	r->xfer = NULL;
+	pthread_mutex_unlock(&r->pool->mtx);
+	libusb_cancel_transfer(r->trn);
 }
 
 void
@@ -1139,11 +1366,16 @@ usb_dev_cancel_request(void *pdata)
 void
 usb_dev_deinit(void *pdata)
 {
-	int rc = 0;
+	int rc = 0, ep;
 	struct usb_dev *udev;
 
 	udev = pdata;
 	if (udev) {
+		for (ep = 0; ep < USB_NUM_ENDPOINT; ep++) {
+			usb_dev_kill_pool(udev, &udev->epi[ep], ep + 1);
+			usb_dev_kill_pool(udev, &udev->epo[ep], ep + 1);
+		}
+
 		if (udev->handle) {
 			rc = usb_dev_native_toggle_if_drivers(udev, 1);
 			if (rc)
@@ -1280,6 +1512,7 @@ usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 	libusb_hotplug_callback_handle native_disconn_handle;
 	int native_pid, native_vid, native_cls, rc;
 	int num_devs;
+	struct sched_param sp;
 
 	usb_set_log_level(log_level);
 
@@ -1344,6 +1577,16 @@ usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 	}
 	pthread_setname_np(g_ctx.thread, "usb_dev_sys");
 
+	/*
+	 * All the transfer completions are reported from this thread, an
+	 * isochronous stream misses its frames whenever it is kept waiting.
+	 */
+	sp.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	rc = pthread_setschedparam(g_ctx.thread, SCHED_FIFO, &sp);
+	if (rc)
+		UPRINTF(LWRN, "fail to set RT priority of poll thread, rc %d\r\n",
+				rc);
+
 	return 0;
 
 errout:
@@ -19,6 +19,8 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <cjson/cJSON.h>
 
 #include "pci_core.h"
 #include "vmmapi.h"
@@ -83,6 +85,21 @@ static int	tcc_buffer_fd = INVALID_FD;
 static struct	vssram_buf *vssram_buffers;
 static struct   vssram_buf_param *vssram_buf_params;
 
+/*
+ * The last RDT sample of each L3 cache the vSSRAM buffers are in, for the
+ * memory bandwidth between two vssram_get_stats() calls, at the index of
+ * the first buffer in this L3 cache.
+ */
+struct vssram_l3_mon {
+	uint64_t mbm_total;
+	uint64_t tsc;
+};
+
+static struct vssram_l3_mon vssram_l3_mons[MAX_VSSRAM_BUFFER_NUM];
+
+/* serializes vssram_get_stats() of the command monitor against the setup and teardown of the buffers */
+static pthread_mutex_t vssram_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 #define vcpuid2pcpuid(vcpuid) pcpuid_from_vcpuid(guest_pcpumask, vcpuid)
 
 static inline uint64_t vcpuid2lapicid(int vcpuid)
@@ -1305,7 +1322,9 @@ int init_vssram(struct vmctx *ctx)
 		goto exit;
 	}
 
+	pthread_mutex_lock(&vssram_mtx);
 	vrtct_table = create_vrtct();
+	pthread_mutex_unlock(&vssram_mtx);
 	if (vrtct_table == NULL) {
 		pr_err("%s, create vRTCT failed.", __func__);
 		goto exit;
@@ -1338,6 +1357,7 @@ exit:
  */
 void deinit_vssram(struct vmctx *ctx)
 {
+	pthread_mutex_lock(&vssram_mtx);
 	vssram_close_buffers();
 	if (vssram_buffers) {
 		free(vssram_buffers);
@@ -1348,6 +1368,165 @@ void deinit_vssram(struct vmctx *ctx)
 		free(vrtct_table);
 		vrtct_table = NULL;
 	}
+	memset(vssram_l3_mons, 0, sizeof(vssram_l3_mons));
+	pthread_mutex_unlock(&vssram_mtx);
+}
+
+/**
+ * @brief  Get the L3 cache ID of a vSSRAM buffer.
+ *
+ * @param vbuf Pointer to a vSSRAM buffer descripition.
+ *
+ * @return L3 cache ID.
+ */
+static int vssram_l3_cache_id(struct vssram_buf *vbuf)
+{
+	return (vbuf->level == L3_CACHE) ? vbuf->cache_id : get_l3_cache_id_from_l2_buffer(vbuf);
+}
+
+/**
+ * @brief  Add the RDT monitoring of this VM in an L3 cache to the statistics.
+ *
+ * @param ctx       Pointer to context of user VM.
+ * @param cache_id  L3 cache ID.
+ * @param mon_state Pointer to the last sample of this L3 cache.
+ * @param obj       JSON object of this L3 cache.
+ *
+ * @return void
+ *
+ * @note  The lines of a vSSRAM buffer are locked in the L3 cache on behalf of
+ *        the VM, the accesses of the VM to them hit without filling lines.
+ *        The L3 occupancy of the VM is thus what its working set takes
+ *        beyond its vSSRAM buffers, and its memory bandwidth is made of its
+ *        L3 misses. Both close to 0 while the RT workload runs mean the
+ *        buffers hold it.
+ */
+static void vssram_add_l3_mon(struct vmctx *ctx, int cache_id,
+		struct vssram_l3_mon *mon_state, cJSON *obj)
+{
+	struct acrn_rdt_mon mon;
+	uint64_t bytes, ticks;
+	int i, pcpuid = -1;
+
+	/* any pCPU of the VM in this L3 cache */
+	for (i = 0; i < guest_vcpu_num; i++) {
+		if (vcpuid2cacheid(i, L3_CACHE) == cache_id) {
+			pcpuid = vcpuid2pcpuid(i);
+			break;
+		}
+	}
+
+	if ((pcpuid < 0) || (vm_get_rdt_mon(ctx, pcpuid, &mon) < 0)) {
+		cJSON_AddBoolToObject(obj, "monitored", false);
+		return;
+	}
+	cJSON_AddBoolToObject(obj, "monitored", true);
+
+	if ((mon.flags & ACRN_RDT_MON_OCCUPANCY) != 0)
+		cJSON_AddNumberToObject(obj, "occupancy_kb", (double)((mon.llc_occupancy * mon.upscale) >> 10));
+
+	if ((mon.flags & ACRN_RDT_MON_TOTAL_BW) != 0) {
+		/* the first sample only starts the measure */
+		if ((mon_state->tsc != 0) && (mon.tsc > mon_state->tsc) && (mon.tsc_khz != 0)) {
+			bytes = ((mon.mbm_total - mon_state->mbm_total) & ((1UL << mon.width) - 1UL)) * mon.upscale;
+			ticks = mon.tsc - mon_state->tsc;
+			cJSON_AddNumberToObject(obj, "mem_bw_mbps", (double)bytes * mon.tsc_khz / ticks / 1000.0);
+			cJSON_AddNumberToObject(obj, "interval_ms", (double)ticks / mon.tsc_khz);
+		}
+		mon_state->mbm_total = mon.mbm_total;
+		mon_state->tsc = mon.tsc;
+	}
+}
+
+/**
+ * @brief  Get the statistics of the vSSRAM buffers in JSON: the buffers, and
+ *         for each L3 cache they are in, the bytes locked for the VM, its L3
+ *         occupancy and its memory bandwidth since the last call.
+ *
+ * @param ctx  Pointer to context of user VM.
+ * @param buf  Buffer to write the statistics to.
+ * @param len  Size of the buffer.
+ *
+ * @return 0 on success and -1 on fail.
+ */
+int vssram_get_stats(struct vmctx *ctx, char *buf, size_t len)
+{
+	int i, j, cache_id;
+	uint64_t locked;
+	struct vssram_buf *vbuf;
+	cJSON *root, *list, *l3_list, *obj;
+	char *out;
+	int ret = -1;
+
+	root = cJSON_CreateObject();
+	if (root == NULL)
+		return -1;
+	cJSON_AddNumberToObject(root, "ack", 0);
+	list = cJSON_AddArrayToObject(root, "buffers");
+	l3_list = cJSON_AddArrayToObject(root, "l3");
+
+	pthread_mutex_lock(&vssram_mtx);
+	for (i = 0; (vrtct_table != NULL) && (list != NULL) && (i < MAX_VSSRAM_BUFFER_NUM); i++) {
+		vbuf = &vssram_buffers[i];
+		if (vbuf->cache_id == INVALID_CACHE_ID)
+			break;
+		if (vbuf->size == 0)
+			continue;
+
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+		cJSON_AddNumberToObject(obj, "level", vbuf->level);
+		cJSON_AddNumberToObject(obj, "cache_id", vbuf->cache_id);
+		cJSON_AddNumberToObject(obj, "size_kb", vbuf->size >> 10);
+		cJSON_AddNumberToObject(obj, "gpa", (double)vbuf->gpa_base);
+		cJSON_AddNumberToObject(obj, "waymask", vbuf->waymask);
+		cJSON_AddItemToArray(list, obj);
+	}
+
+	/* one entry per L3 cache, the RDT counters are per L3 cache */
+	for (i = 0; (vrtct_table != NULL) && (l3_list != NULL) && (i < MAX_VSSRAM_BUFFER_NUM); i++) {
+		vbuf = &vssram_buffers[i];
+		if (vbuf->cache_id == INVALID_CACHE_ID)
+			break;
+
+		cache_id = vssram_l3_cache_id(vbuf);
+		for (j = 0; j < i; j++) {
+			if (vssram_l3_cache_id(&vssram_buffers[j]) == cache_id)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		/* the L2 buffers take lines of an inclusive L3 as well */
+		locked = 0;
+		for (j = 0; j < MAX_VSSRAM_BUFFER_NUM; j++) {
+			if (vssram_buffers[j].cache_id == INVALID_CACHE_ID)
+				break;
+			if ((vssram_buffers[j].level == L3_CACHE) && (vssram_buffers[j].cache_id == cache_id))
+				locked += vssram_buffers[j].size +
+					(is_l3_inclusive_of_l2 ? vssram_buffers[j].l3_inclusive_of_l2_size : 0);
+		}
+
+		obj = cJSON_CreateObject();
+		if (obj == NULL)
+			break;
+		cJSON_AddNumberToObject(obj, "cache_id", cache_id);
+		cJSON_AddNumberToObject(obj, "locked_kb", (double)(locked >> 10));
+		vssram_add_l3_mon(ctx, cache_id, &vssram_l3_mons[i], obj);
+		cJSON_AddItemToArray(l3_list, obj);
+	}
+	pthread_mutex_unlock(&vssram_mtx);
+
+	out = cJSON_PrintUnformatted(root);
+	if (out != NULL && strlen(out) < len) {
+		memcpy(buf, out, strlen(out) + 1);
+		ret = 0;
+	}
+	free(out);
+	cJSON_Delete(root);
+
+	return ret;
 }
 
 /**
@@ -48,6 +48,8 @@
 #include "dm.h"
 #include "dm_string.h"
 #include "log.h"
+#include "snapshot.h"
+#include "timer.h"
 
 #define	COM1_BASE	0x3F8
 #define COM1_IRQ	4
@@ -77,6 +79,15 @@
 #define	DEFAULT_FIFOSZ	(256)
 #define	SOCK_FIFOSZ	(32 * 1024)
 
+/* the most read from the backend by one syscall */
+#define	RXBUF_SIZE	(256)
+/*
+ * THR writes are held back and sent with one syscall once TXBUF_SIZE of
+ * them accumulate or TX_DELAY_NS after the first.
+ */
+#define	TXBUF_SIZE	(256)
+#define	TX_DELAY_NS	(1000000)
+
 static int uart_debug;
 #define DPRINTF(params) do { if (uart_debug) pr_dbg params; } while (0)
 #define WPRINTF(params) (pr_err params)
@@ -152,6 +163,10 @@ struct uart_vdev {
 	struct fifo rxfifo;
 	struct uart_backend be;
 
+	uint8_t	txbuf[TXBUF_SIZE];
+	int	txnum;
+	struct acrn_timer tx_timer;	/* flushes txbuf */
+
 	bool	thre_int_pending;	/* THRE interrupt pending */
 
 	void	*arg;
@@ -162,8 +177,8 @@ struct uart_vdev {
 
 static void uart_drain(int fd, enum ev_type ev, void *arg);
 static void uart_deinit(struct uart_vdev *uart);
-static int uart_backend_read(struct uart_backend *be);
-static int uart_backend_write(struct uart_backend *be, unsigned char wb);
+static int uart_backend_read(struct uart_backend *be, uint8_t *buf, size_t len);
+static int uart_backend_write(struct uart_backend *be, const uint8_t *buf, int len);
 static int uart_reset_backend(struct uart_backend *be);
 static int uart_enable_backend(struct uart_backend *be, bool enable);
 
@@ -247,6 +262,44 @@ rxfifo_numchars(struct uart_vdev *uart)
 	return fifo->num;
 }
 
+static void
+txbuf_flush(struct uart_vdev *uart)
+{
+	if (uart->txnum > 0) {
+		uart_backend_write(&uart->be, uart->txbuf, uart->txnum);
+		uart->txnum = 0;
+	}
+}
+
+static void
+txbuf_putchar(struct uart_vdev *uart, uint8_t ch)
+{
+	struct itimerspec ts;
+
+	/* nothing to hold back for a backend that drops it */
+	if (!uart->be.opened)
+		return;
+
+	uart->txbuf[uart->txnum++] = ch;
+	if (uart->txnum == TXBUF_SIZE) {
+		txbuf_flush(uart);
+	} else if (uart->txnum == 1) {
+		memset(&ts, 0, sizeof(ts));
+		ts.it_value.tv_nsec = TX_DELAY_NS;
+		acrn_timer_settime(&uart->tx_timer, &ts);
+	}
+}
+
+static void
+uart_tx_timer(void *arg, uint64_t nexp)
+{
+	struct uart_vdev *uart = arg;
+
+	pthread_mutex_lock(&uart->mtx);
+	txbuf_flush(uart);
+	pthread_mutex_unlock(&uart->mtx);
+}
+
 static void
 uart_mevent_teardown(void *param)
 {
@@ -261,6 +314,10 @@ uart_mevent_teardown(void *param)
 	if (!be->opened)
 		return;
 
+	pthread_mutex_lock(&uart->mtx);
+	txbuf_flush(uart);
+	pthread_mutex_unlock(&uart->mtx);
+
 	switch (be->be_type) {
 	case UART_BE_STDIO:
 		uart_reset_stdio();
@@ -378,11 +435,99 @@ uart_reset(struct uart_vdev *uart)
 	uart_toggle_intr(uart);
 }
 
+/*
+ * Bring the registers of uart back to their values after uart_init(), its
+ * backend is kept.
+ */
+void
+uart_reset_vdev(struct uart_vdev *uart)
+{
+	pthread_mutex_lock(&uart->mtx);
+	uart->data = 0;
+	uart->lcr = 0;
+	uart->mcr = 0;
+	uart->lsr = 0;
+	uart->fcr = 0;
+	uart->scr = 0;
+	uart_reset(uart);
+	pthread_mutex_unlock(&uart->mtx);
+}
+
+/* The registers of a UART in a snapshot, the characters received are dropped */
+struct uart_snapshot {
+	uint8_t data;
+	uint8_t ier;
+	uint8_t lcr;
+	uint8_t mcr;
+	uint8_t lsr;
+	uint8_t msr;
+	uint8_t fcr;
+	uint8_t scr;
+	uint8_t dll;
+	uint8_t dlh;
+	uint8_t thre_int_pending;
+	uint8_t reserved[5];
+};
+
+int
+uart_save_vdev(struct uart_vdev *uart, int fd)
+{
+	struct uart_snapshot us;
+
+	memset(&us, 0, sizeof(us));
+	pthread_mutex_lock(&uart->mtx);
+	us.data = uart->data;
+	us.ier = uart->ier;
+	us.lcr = uart->lcr;
+	us.mcr = uart->mcr;
+	us.lsr = uart->lsr;
+	us.msr = uart->msr;
+	us.fcr = uart->fcr;
+	us.scr = uart->scr;
+	us.dll = uart->dll;
+	us.dlh = uart->dlh;
+	us.thre_int_pending = uart->thre_int_pending;
+	pthread_mutex_unlock(&uart->mtx);
+
+	return snapshot_write(fd, &us, sizeof(us));
+}
+
+int
+uart_restore_vdev(struct uart_vdev *uart, int fd)
+{
+	struct uart_snapshot us;
+	int err;
+
+	err = snapshot_read(fd, &us, sizeof(us));
+	if (err < 0)
+		return err;
+
+	pthread_mutex_lock(&uart->mtx);
+	uart->data = us.data;
+	uart->ier = us.ier;
+	uart->lcr = us.lcr;
+	uart->mcr = us.mcr;
+	uart->lsr = us.lsr & ~LSR_RXRDY;
+	uart->msr = us.msr;
+	uart->fcr = us.fcr;
+	uart->scr = us.scr;
+	uart->dll = us.dll;
+	uart->dlh = us.dlh;
+	uart->thre_int_pending = us.thre_int_pending;
+	rxfifo_reset(uart, (uart->fcr & FCR_ENABLE) ? uart->rxfifo_size : 1);
+	uart_toggle_intr(uart);
+	pthread_mutex_unlock(&uart->mtx);
+
+	return 0;
+}
+
 static void
 uart_drain(int fd, enum ev_type ev, void *arg)
 {
 	struct uart_vdev *uart;
-	int ch;
+	uint8_t buf[RXBUF_SIZE];
+	size_t len;
+	int i, n;
 
 	uart = arg;
 
@@ -394,11 +539,18 @@ uart_drain(int fd, enum ev_type ev, void *arg)
 	pthread_mutex_lock(&uart->mtx);
 
 	if ((uart->mcr & MCR_LOOPBACK) != 0) {
-		(void) uart_backend_read(&uart->be);
+		(void) uart_backend_read(&uart->be, buf, sizeof(buf));
 	} else {
-		/* only read tty when rxfifo available to make sure no data lost */
-		while (rxfifo_available(uart) && (ch = uart_backend_read(&uart->be)) != -1)
-			rxfifo_putchar(uart, ch);
+		/* only read as much as rxfifo has room for to make sure no data lost */
+		while (rxfifo_available(uart)) {
+			len = MIN(sizeof(buf), (size_t)(uart->rxfifo.size - uart->rxfifo.num));
+			n = uart_backend_read(&uart->be, buf, len);
+			for (i = 0; i < n; i++)
+				rxfifo_putchar(uart, buf[i]);
+			/* the backend is drained */
+			if (n < (int)len)
+				break;
+		}
 
 		uart_toggle_intr(uart);
 	}
@@ -438,7 +590,7 @@ uart_write(struct uart_vdev *uart, int offset, uint8_t value)
 			if (rxfifo_putchar(uart, value) != 0)
 				uart->lsr |= LSR_OE;
 		} else {
-			uart_backend_write(&uart->be, value);
+			txbuf_putchar(uart, value);
 		} /* else drop on floor */
 
 		/* We view the transmission is completed immediately */
@@ -664,6 +816,9 @@ uart_init(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 
 		pthread_mutex_init(&uart->mtx, NULL);
 
+		uart->tx_timer.clockid = CLOCK_MONOTONIC;
+		acrn_timer_init(&uart->tx_timer, uart_tx_timer, uart);
+
 		uart_reset(uart);
 	}
 
@@ -673,8 +828,10 @@ uart_init(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 static void
 uart_deinit(struct uart_vdev *uart)
 {
-	if (uart)
+	if (uart) {
+		acrn_timer_deinit(&uart->tx_timer);
 		free(uart);
+	}
 }
 
 static void
@@ -709,35 +866,41 @@ uart_sock_accept(int fd __attribute__((unused)),
 	DPRINTF(("uart: %s\r\n", __func__));
 }
 
+/*
+ * Read up to len bytes from the backend in one syscall, return the number
+ * read or -1 if there is nothing to read.
+ */
 static int
-uart_backend_read(struct uart_backend *be)
+uart_backend_read(struct uart_backend *be, uint8_t *buf, size_t len)
 {
-	unsigned char rb;
 	int rc = -1;
+	int i;
 
 	if (!be || !be->opened)
 		return -1;
 
 	switch (be->be_type) {
 	case UART_BE_STDIO:
-		rc = read(be->fd, &rb, 1);
-		if (rb == 0x01) {  // Ctrl-a
-			DPRINTF(("%s: Got Ctrl-a\n", __func__));
-			stdio_ctrl_a_pressed = true;
-		} else if (stdio_ctrl_a_pressed) {
-			if (rb == 'x') {
-				DPRINTF(("%s: Got Ctrl-a x\n", __func__));
-				kill(getpid(), SIGINT);
+		rc = read(be->fd, buf, len);
+		for (i = 0; i < rc; i++) {
+			if (buf[i] == 0x01) {  // Ctrl-a
+				DPRINTF(("%s: Got Ctrl-a\n", __func__));
+				stdio_ctrl_a_pressed = true;
+			} else if (stdio_ctrl_a_pressed) {
+				if (buf[i] == 'x') {
+					DPRINTF(("%s: Got Ctrl-a x\n", __func__));
+					kill(getpid(), SIGINT);
+				}
+				stdio_ctrl_a_pressed = false;
 			}
-			stdio_ctrl_a_pressed = false;
 		}
 		break;
 	case UART_BE_TTY:
 		/* fd is used to read */
-		rc = read(be->fd, &rb, 1);
+		rc = read(be->fd, buf, len);
 		break;
 	case UART_BE_SOCK:
-		rc = recv(be->fd2, &rb, 1, 0);
+		rc = recv(be->fd2, buf, len, 0);
 		if (rc <= 0 && errno != EAGAIN) {
 			if (be->evp2) {
 				mevent_delete(be->evp2);
@@ -759,34 +922,44 @@ uart_backend_read(struct uart_backend *be)
 	if (rc <= 0)
 		return -1;
 
-	return rb;
+	return rc;
 }
 
+/*
+ * Write len bytes to the backend, return the number written; what the
+ * backend can't take right away is dropped.
+ */
 static int
-uart_backend_write(struct uart_backend *be, unsigned char wb)
+uart_backend_write(struct uart_backend *be, const uint8_t *buf, int len)
 {
-	int rc = -1;
+	int rc, written = 0;
 
 	if (!be || !be->opened)
 		return -1;
 
-	switch (be->be_type) {
-	case UART_BE_STDIO:
-	case UART_BE_TTY:
-		/* fd2 is used to write */
-		rc = write(be->fd2, &wb, 1);
-		break;
-	case UART_BE_SOCK:
-		rc = send(be->fd2, &wb, 1, 0);
-		if (rc != 1)
-			WPRINTF(("%s: send error, rc = %d, errno = %d\r\n",
-				__func__, rc, errno));
-		break;
-	default:
-		WPRINTF(("not supported backend %d!\n", be->be_type));
+	while (written < len) {
+		switch (be->be_type) {
+		case UART_BE_STDIO:
+		case UART_BE_TTY:
+			/* fd2 is used to write */
+			rc = write(be->fd2, buf + written, len - written);
+			break;
+		case UART_BE_SOCK:
+			rc = send(be->fd2, buf + written, len - written, 0);
+			if (rc <= 0)
+				WPRINTF(("%s: send error, rc = %d, errno = %d\r\n",
+					__func__, rc, errno));
+			break;
+		default:
+			WPRINTF(("not supported backend %d!\n", be->be_type));
+			return -1;
+		}
+		if (rc <= 0)
+			break;
+		written += rc;
 	}
 
-	return rc;
+	return written;
 }
 
 static int
@@ -33,6 +33,15 @@
 #define VDPY_MIN_HEIGHT 480
 #define transto_10bits(color) (uint16_t)(color * 1024 + 0.5)
 #define VSCREEN_MAX_NUM 2
+/* a vscreen is presented at most this often, and at least this often */
+#define VDPY_MIN_FRAME_NS	10000000UL
+#define VDPY_IDLE_REDRAW_NS	1000000000UL
+/* the pixel buffers of a vscreen, the damage goes through them in turn */
+#define VDPY_PBO_NUM		3
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER	0x88EC
+#endif
 
 static unsigned char default_raw_argb[VDPY_DEFAULT_WIDTH * VDPY_DEFAULT_HEIGHT * 4];
 
@@ -50,6 +59,18 @@ struct egl_display_ops {
 	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
 	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+	/* the pixel buffers, of GLES 3 and EXT_buffer_storage */
+	PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT;
+	PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRange;
+	PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+	PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+	PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
+};
+
+struct vdpy_pbo {
+	GLuint buf;
+	void *map;		/* persistent and coherent */
+	EGLSyncKHR fence;	/* after the upload from it */
 };
 
 struct vscreen {
@@ -76,6 +97,22 @@ struct vscreen {
 	EGLImage egl_img;
 	/* Record the update_time that is activated from guest_vm */
 	struct timespec last_time;
+	/* the texture or the cursor changed since the last presentation */
+	bool dirty;
+	/* the texture did, with the damage of the guest */
+	bool damaged;
+	/* the ring of pixel buffers of the texture, when pbo_size isn't 0 */
+	struct vdpy_pbo pbos[VDPY_PBO_NUM];
+	int pbo_next;
+	size_t pbo_size;
+	/* logged at exit */
+	uint64_t nr_frames;
+	uint64_t frame_ns;
+	uint64_t frame_ns_max;
+	uint64_t nr_dropped;
+	uint64_t nr_uploads;
+	uint64_t upload_ns;
+	uint64_t nr_pbo_waits;
 };
 
 static struct display {
@@ -93,6 +130,7 @@ static struct display {
 	TAILQ_HEAD(display_list, vdpy_display_bh) request_list;
 	/* add the below two fields for calling eglAPI directly */
 	bool egl_dmabuf_supported;
+	bool pbo_supported;
 	SDL_GLContext eglContext;
 	EGLDisplay eglDisplay;
 	struct egl_display_ops gl_ops;
@@ -579,6 +617,8 @@ sdl_gl_display_init(void)
 {
 	struct egl_display_ops *gl_ops = &vdpy.gl_ops;
 	struct vscreen *vscr;
+	SDL_RendererInfo info;
+	const char *version, *gl_exts, *egl_exts;
 	int i;
 
 	/* obtain the eglDisplay/eglContext */
@@ -609,9 +649,165 @@ sdl_gl_display_init(void)
 	} else
 		vdpy.egl_dmabuf_supported = true;
 
+	/*
+	 * The pixman surfaces are uploaded through pixel buffers, which the
+	 * GPU copies to the texture while the display thread goes on. Only
+	 * for the GLES2 renderer of SDL: it keeps the pixels of the textures
+	 * as they are, in GL_RGBA, and swizzles when drawing.
+	 */
+	gl_ops->glBufferStorageEXT = (PFNGLBUFFERSTORAGEEXTPROC)
+				eglGetProcAddress("glBufferStorageEXT");
+	gl_ops->glMapBufferRange = (PFNGLMAPBUFFERRANGEEXTPROC)
+				eglGetProcAddress("glMapBufferRange");
+	gl_ops->eglCreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)
+				eglGetProcAddress("eglCreateSyncKHR");
+	gl_ops->eglDestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)
+				eglGetProcAddress("eglDestroySyncKHR");
+	gl_ops->eglClientWaitSyncKHR = (PFNEGLCLIENTWAITSYNCKHRPROC)
+				eglGetProcAddress("eglClientWaitSyncKHR");
+
+	version = (const char *)glGetString(GL_VERSION);
+	gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+	egl_exts = NULL;
+	if (vdpy.eglDisplay != EGL_NO_DISPLAY)
+		egl_exts = eglQueryString(vdpy.eglDisplay, EGL_EXTENSIONS);
+	vdpy.pbo_supported = (vdpy.vscrs_num > 0) &&
+		(SDL_GetRendererInfo(vdpy.vscrs[0].renderer, &info) == 0) &&
+		(strcmp(info.name, "opengles2") == 0) &&
+		version && (strncmp(version, "OpenGL ES 3", 11) == 0) &&
+		gl_exts && strstr(gl_exts, "GL_EXT_buffer_storage") &&
+		egl_exts && strstr(egl_exts, "EGL_KHR_fence_sync") &&
+		gl_ops->glBufferStorageEXT && gl_ops->glMapBufferRange &&
+		gl_ops->eglCreateSyncKHR && gl_ops->eglDestroySyncKHR &&
+		gl_ops->eglClientWaitSyncKHR;
+	if (!vdpy.pbo_supported)
+		pr_info("Pixel buffers are not supported.\n");
+
 	return;
 }
 
+static void
+vdpy_pbo_release(struct vscreen *vscr)
+{
+	struct vdpy_pbo *pbo;
+	int i;
+
+	for (i = 0; i < VDPY_PBO_NUM; i++) {
+		pbo = &vscr->pbos[i];
+		if (pbo->fence != EGL_NO_SYNC_KHR)
+			vdpy.gl_ops.eglDestroySyncKHR(vdpy.eglDisplay, pbo->fence);
+		/* which unmaps it */
+		if (pbo->buf)
+			glDeleteBuffers(1, &pbo->buf);
+		pbo->buf = 0;
+		pbo->map = NULL;
+		pbo->fence = EGL_NO_SYNC_KHR;
+	}
+	vscr->pbo_size = 0;
+}
+
+/* the ring of pixel buffers of the texture, whose context is current */
+static int
+vdpy_pbo_setup(struct vscreen *vscr)
+{
+	struct egl_display_ops *gl_ops = &vdpy.gl_ops;
+	struct vdpy_pbo *pbo;
+	GLbitfield flags;
+	size_t size;
+	int i;
+
+	flags = GL_MAP_WRITE_BIT_EXT | GL_MAP_PERSISTENT_BIT_EXT |
+		GL_MAP_COHERENT_BIT_EXT;
+	size = (size_t)vscr->guest_width * vscr->guest_height * 4;
+	for (i = 0; i < VDPY_PBO_NUM; i++) {
+		pbo = &vscr->pbos[i];
+		pbo->fence = EGL_NO_SYNC_KHR;
+		glGenBuffers(1, &pbo->buf);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buf);
+		gl_ops->glBufferStorageEXT(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+		pbo->map = gl_ops->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+				size, flags);
+		if (pbo->map == NULL)
+			break;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (i < VDPY_PBO_NUM) {
+		vdpy_pbo_release(vscr);
+		return -1;
+	}
+	vscr->pbo_size = size;
+	vscr->pbo_next = 0;
+	return 0;
+}
+
+/*
+ * Upload the rect of the texture from the pixels, with the stride, through
+ * the next pixel buffer of the ring: copying to it is all the display
+ * thread does. Its previous upload is waited for, the GPU being behind by
+ * VDPY_PBO_NUM of them then. False if the rect has to go the SDL way.
+ */
+static bool
+vdpy_pbo_upload(struct vscreen *vscr, const SDL_Rect *rect,
+		const uint8_t *pixel, int stride)
+{
+	struct egl_display_ops *gl_ops = &vdpy.gl_ops;
+	struct vdpy_pbo *pbo;
+	uint8_t *dst;
+	int y;
+
+	if (!vdpy.pbo_supported)
+		return false;
+
+	SDL_GL_BindTexture(vscr->surf_tex, NULL, NULL);
+	if (vscr->pbo_size == 0 && vdpy_pbo_setup(vscr) != 0) {
+		SDL_GL_UnbindTexture(vscr->surf_tex);
+		pr_err("Failed to map the pixel buffers, uploading without.\n");
+		vdpy.pbo_supported = false;
+		return false;
+	}
+
+	pbo = &vscr->pbos[vscr->pbo_next];
+	vscr->pbo_next = (vscr->pbo_next + 1) % VDPY_PBO_NUM;
+	if (pbo->fence != EGL_NO_SYNC_KHR) {
+		if (gl_ops->eglClientWaitSyncKHR(vdpy.eglDisplay, pbo->fence,
+				EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0) ==
+				EGL_TIMEOUT_EXPIRED_KHR) {
+			vscr->nr_pbo_waits++;
+			gl_ops->eglClientWaitSyncKHR(vdpy.eglDisplay, pbo->fence,
+				EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+		}
+		gl_ops->eglDestroySyncKHR(vdpy.eglDisplay, pbo->fence);
+		pbo->fence = EGL_NO_SYNC_KHR;
+	}
+
+	dst = pbo->map;
+	for (y = 0; y < rect->h; y++)
+		memcpy(dst + y * rect->w * 4, pixel + y * stride, rect->w * 4);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buf);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	/* or the uploads of SDL would read from it */
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	pbo->fence = gl_ops->eglCreateSyncKHR(vdpy.eglDisplay,
+			EGL_SYNC_FENCE_KHR, NULL);
+	SDL_GL_UnbindTexture(vscr->surf_tex);
+	return true;
+}
+
+static void
+vdpy_destroy_surf_tex(struct vscreen *vscr)
+{
+	if (vscr->pbo_size) {
+		SDL_GL_BindTexture(vscr->surf_tex, NULL, NULL);
+		vdpy_pbo_release(vscr);
+		SDL_GL_UnbindTexture(vscr->surf_tex);
+	}
+	SDL_DestroyTexture(vscr->surf_tex);
+	vscr->surf_tex = NULL;
+}
+
 static void sdl_gl_prepare_draw(struct vscreen *vscr)
 {
 	SDL_Rect bogus_rect;
@@ -696,7 +892,7 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 	}
 
 	if (vscr->surf_tex) {
-		SDL_DestroyTexture(vscr->surf_tex);
+		vdpy_destroy_surf_tex(vscr);
 	}
 	if (surf && (surf->surf_type == SURFACE_DMABUF)) {
 		access = SDL_TEXTUREACCESS_STATIC;
@@ -798,6 +994,7 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 	}
 	/* Replace the cur_img with the created_img */
 	vscr->img = src_img;
+	vscr->dirty = (surf != NULL);
 }
 
 void
@@ -816,11 +1013,79 @@ vdpy_cursor_position_transformation(struct display *vdpy, int scanout_id, SDL_Re
 	rect->h = (vscr->cur.height * vscr->height) / vscr->guest_height;
 }
 
+static uint64_t
+vdpy_elapsed_ns(const struct timespec *since)
+{
+	struct timespec cur_time;
+
+	clock_gettime(CLOCK_MONOTONIC, &cur_time);
+	return (cur_time.tv_sec - since->tv_sec) * 1000000000 +
+		cur_time.tv_nsec - since->tv_nsec;
+}
+
+static uint64_t
+vdpy_since_last_present(struct vscreen *vscr)
+{
+	return vdpy_elapsed_ns(&vscr->last_time);
+}
+
+/* render the texture and the cursor of the vscreen to its window */
+static void
+vdpy_present(struct vscreen *vscr, int scanout_id)
+{
+	SDL_Rect cursor_rect;
+	struct timespec start;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sdl_gl_prepare_draw(vscr);
+	SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
+
+	/* This should be handled after rendering the surface_texture.
+	 * Otherwise it will be hidden
+	 */
+	if (vscr->cur_tex) {
+		vdpy_cursor_position_transformation(&vdpy, scanout_id, &cursor_rect);
+		SDL_RenderCopy(vscr->renderer, vscr->cur_tex,
+				NULL, &cursor_rect);
+	}
+
+	SDL_RenderPresent(vscr->renderer);
+
+	/* update the rendering time */
+	clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
+	vscr->dirty = false;
+	vscr->damaged = false;
+
+	ns = vdpy_elapsed_ns(&start);
+	vscr->nr_frames++;
+	vscr->frame_ns += ns;
+	if (ns > vscr->frame_ns_max)
+		vscr->frame_ns_max = ns;
+}
+
 void
 vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
 {
-	SDL_Rect cursor_rect;
+	vdpy_surface_update_rect(handle, scanout_id, surf, NULL);
+}
+
+/*
+ * The damage of the surface, NULL for all of it, is uploaded to the texture
+ * of the vscreen. The vscreen is presented now unless it was less than
+ * VDPY_MIN_FRAME_NS ago, the UI refresh presents it then, so that the
+ * damage of a burst of flushes goes in one frame. A damage coming before the
+ * previous one was presented drops a frame of the guest.
+ */
+void
+vdpy_surface_update_rect(int handle, int scanout_id, struct surface *surf,
+		const struct vdpy_rect *damage)
+{
 	struct vscreen *vscr;
+	struct timespec start;
+	SDL_Rect rect;
+	const uint8_t *pixel;
+	int bytes_pp;
 
 	if (handle != vdpy.s.n_connect) {
 		return;
@@ -842,27 +1107,39 @@ vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
 	}
 
 	vscr = vdpy.vscrs + scanout_id;
-	if (surf->surf_type == SURFACE_PIXMAN)
-		SDL_UpdateTexture(vscr->surf_tex, NULL,
-			  surf->pixel,
-			  surf->stride);
-
-	sdl_gl_prepare_draw(vscr);
-	SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
+	if (surf->surf_type == SURFACE_PIXMAN) {
+		/* clipped to the surface, and to the texture */
+		rect.x = 0;
+		rect.y = 0;
+		rect.w = MIN((int)surf->width, vscr->guest_width);
+		rect.h = MIN((int)surf->height, vscr->guest_height);
+		if (damage) {
+			rect.x = MAX(damage->x, 0);
+			rect.y = MAX(damage->y, 0);
+			rect.w = MIN(damage->x + damage->width, rect.w) - rect.x;
+			rect.h = MIN(damage->y + damage->height, rect.h) - rect.y;
+		}
+		if (rect.w <= 0 || rect.h <= 0)
+			return;
 
-	/* This should be handled after rendering the surface_texture.
-	 * Otherwise it will be hidden
-	 */
-	if (vscr->cur_tex) {
-		vdpy_cursor_position_transformation(&vdpy, scanout_id, &cursor_rect);
-		SDL_RenderCopy(vscr->renderer, vscr->cur_tex,
-				NULL, &cursor_rect);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		bytes_pp = PIXMAN_FORMAT_BPP(surf->surf_format) / 8;
+		pixel = (uint8_t *)surf->pixel + rect.y * surf->stride +
+			rect.x * bytes_pp;
+		if (bytes_pp != 4 ||
+		    !vdpy_pbo_upload(vscr, &rect, pixel, surf->stride))
+			SDL_UpdateTexture(vscr->surf_tex, &rect, pixel,
+					  surf->stride);
+		vscr->nr_uploads++;
+		vscr->upload_ns += vdpy_elapsed_ns(&start);
 	}
 
-	SDL_RenderPresent(vscr->renderer);
-
-	/* update the rendering time */
-	clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
+	if (vscr->damaged)
+		vscr->nr_dropped++;
+	vscr->damaged = true;
+	vscr->dirty = true;
+	if (vdpy_since_last_present(vscr) >= VDPY_MIN_FRAME_NS)
+		vdpy_present(vscr, scanout_id);
 }
 
 void
@@ -905,6 +1182,10 @@ vdpy_cursor_define(int handle, int scanout_id, struct cursor *cur)
 	SDL_SetTextureBlendMode(vscr->cur_tex, SDL_BLENDMODE_BLEND);
 	vscr->cur = *cur;
 	SDL_UpdateTexture(vscr->cur_tex, NULL, cur->data, cur->width * 4);
+	vscr->dirty = true;
+	if (vscr->surf_tex &&
+	    vdpy_since_last_present(vscr) >= VDPY_MIN_FRAME_NS)
+		vdpy_present(vscr, scanout_id);
 }
 
 void
@@ -921,20 +1202,28 @@ vdpy_cursor_move(int handle, int scanout_id, uint32_t x, uint32_t y)
 	}
 
 	vscr = vdpy.vscrs + scanout_id;
-	/* Only move the position of the cursor. The cursor_texture
-	 * will be handled in surface_update
+	/* Only move the position of the cursor. The texture of the surface is
+	 * drawn as it is, with no upload: the cursor moves with no wait for a
+	 * damage of the guest, unless the last frame is too recent.
 	 */
 	vscr->cur.x = x;
 	vscr->cur.y = y;
+	vscr->dirty = true;
+	if (vdpy.tid == pthread_self() && vscr->surf_tex &&
+	    vdpy_since_last_present(vscr) >= VDPY_MIN_FRAME_NS)
+		vdpy_present(vscr, scanout_id);
 }
 
+/*
+ * Present the vscreens whose texture or cursor changed and weren't yet. The
+ * others are only presented again every VDPY_IDLE_REDRAW_NS, as nothing
+ * else repaints their windows once they've been covered.
+ */
 static void
 vdpy_sdl_ui_refresh(void *data)
 {
 	struct display *ui_vdpy;
-	struct timespec cur_time;
 	uint64_t elapsed_time;
-	SDL_Rect cursor_rect;
 	struct vscreen *vscr;
 	int i;
 
@@ -947,28 +1236,16 @@ vdpy_sdl_ui_refresh(void *data)
 		if (vscr->surf_tex == NULL)
 			continue;
 
-		clock_gettime(CLOCK_MONOTONIC, &cur_time);
-
-		elapsed_time = (cur_time.tv_sec - vscr->last_time.tv_sec) * 1000000000 +
-				cur_time.tv_nsec - vscr->last_time.tv_nsec;
+		elapsed_time = vdpy_since_last_present(vscr);
 
 		/* the time interval is less than 10ms. Skip it */
-		if (elapsed_time < 10000000)
-			return;
-
-		sdl_gl_prepare_draw(vscr);
-		SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
+		if (elapsed_time < VDPY_MIN_FRAME_NS)
+			continue;
 
-		/* This should be handled after rendering the surface_texture.
-		 * Otherwise it will be hidden
-		 */
-		if (vscr->cur_tex) {
-			vdpy_cursor_position_transformation(ui_vdpy, i, &cursor_rect);
-			SDL_RenderCopy(vscr->renderer, vscr->cur_tex,
-					NULL, &cursor_rect);
-		}
+		if (!vscr->dirty && elapsed_time < VDPY_IDLE_REDRAW_NS)
+			continue;
 
-		SDL_RenderPresent(vscr->renderer);
+		vdpy_present(vscr, i);
 	}
 }
 
@@ -1105,6 +1382,8 @@ vdpy_sdl_display_thread(void *data)
 	vdpy.ui_timer_bh.task_cb = vdpy_sdl_ui_refresh;
 	vdpy.ui_timer_bh.data = &vdpy;
 	vdpy.ui_timer.clockid = CLOCK_MONOTONIC;
+	/* a frame late by 1ms goes unnoticed */
+	vdpy.ui_timer.slack_ns = 1000000UL;
 	acrn_timer_init(&vdpy.ui_timer, vdpy_sdl_ui_timer, &vdpy);
 	ui_timer_spec.it_interval.tv_sec = 0;
 	ui_timer_spec.it_interval.tv_nsec = 33000000;
@@ -1154,15 +1433,21 @@ vdpy_sdl_display_thread(void *data)
 
 	for (i = 0; i < vdpy.vscrs_num; i++) {
 		vscr = vdpy.vscrs + i;
+		pr_info("vdisplay %d: %lu frames of %lu us, at most %lu us, "
+			"%lu dropped, %lu uploads of %lu us, %lu waited for a "
+			"pixel buffer\n", i, vscr->nr_frames,
+			vscr->nr_frames ? vscr->frame_ns / vscr->nr_frames / 1000 : 0,
+			vscr->frame_ns_max / 1000, vscr->nr_dropped,
+			vscr->nr_uploads,
+			vscr->nr_uploads ? vscr->upload_ns / vscr->nr_uploads / 1000 : 0,
+			vscr->nr_pbo_waits);
 		if (vscr->img) {
 			pixman_image_unref(vscr->img);
 			vscr->img = NULL;
 		}
 		/* Continue to thread cleanup */
-		if (vscr->surf_tex) {
-			SDL_DestroyTexture(vscr->surf_tex);
-			vscr->surf_tex = NULL;
-		}
+		if (vscr->surf_tex)
+			vdpy_destroy_surf_tex(vscr);
 		if (vscr->cur_tex) {
 			SDL_DestroyTexture(vscr->cur_tex);
 			vscr->cur_tex = NULL;
@@ -1197,6 +1482,16 @@ sdl_fail:
 	return NULL;
 }
 
+/* whether the surfaces can be dmabufs, once the display is set up */
+bool
+vdpy_dmabuf_supported(int handle)
+{
+	if (handle != vdpy.s.n_connect)
+		return false;
+
+	return vdpy.egl_dmabuf_supported;
+}
+
 bool vdpy_submit_bh(int handle, struct vdpy_display_bh *bh_task)
 {
 	bool bh_ok = false;
@@ -15,6 +15,7 @@
 #include <string.h>
 
 #include "console.h"
+#include "vmmapi.h"
 #include "inout.h"
 #include "mem.h"
 #include "vga.h"
@@ -27,6 +28,9 @@
 struct vga_vdev {
 	struct mem_range	mr;
 
+	struct vmctx		*ctx;
+	bool			posted;		/* the port writes are posted */
+
 	struct gfx_ctx		*gc;
 	int			gc_width;
 	int			gc_height;
@@ -1284,7 +1288,7 @@ vga_port_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 }
 
 void *
-vga_init(struct gfx_ctx *gc, int io_only)
+vga_init(struct vmctx *ctx, struct gfx_ctx *gc, int io_only)
 {
 	struct inout_port iop;
 	struct vga_vdev *vd;
@@ -1312,6 +1316,11 @@ vga_init(struct gfx_ctx *gc, int io_only)
 		}
 	}
 
+	/* the guest only waits for the port reads, which see the writes before them done */
+	vd->ctx = ctx;
+	vd->posted = (vm_assign_posted_io(ctx, ACRN_IOREQ_TYPE_PORTIO, VGA_IOPORT_START,
+				VGA_IOPORT_END - VGA_IOPORT_START + 1) == 0);
+
 	vd->gc_image = gc->gc_image;
 
 	/* only handle io ports; vga graphics is disabled */
@@ -1506,6 +1515,12 @@ void vga_deinit(struct vga *vga)
 		}
 	}
 
+	if (vd->posted) {
+		vm_deassign_posted_io(vd->ctx, ACRN_IOREQ_TYPE_PORTIO, VGA_IOPORT_START,
+				VGA_IOPORT_END - VGA_IOPORT_START + 1);
+		vd->posted = false;
+	}
+
 	rc = unregister_mem_fallback(&vd->mr);
 	if (rc == -1) {
 		pr_err("%s: fail to unregister mem fallback.\n", __func__);
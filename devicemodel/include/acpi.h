@@ -29,6 +29,7 @@
 #ifndef _ACPI_H_
 #define _ACPI_H_
 
+#include <stdbool.h>
 #include "hsm_ioctl_defs.h"
 
 #define	SCI_INT			9
@@ -41,6 +42,15 @@
 
 #define	IO_PMTMR		0x0	/* PM Timer is disabled in ACPI */
 
+/* GPE0 block: one status byte then one enable byte */
+#define	GPE0_BLK_ADDR		0x408
+#define	GPE0_BLK_LEN		2
+/* the general purpose events, each is raised by its bit in GPE0 and handled by _Exx */
+#define	GPE_CPU_HOTPLUG		2
+
+#define	CPU_HOTPLUG_ADDR	0x40C
+#define	CPU_HOTPLUG_LEN		2
+
 #define ACPI_MADT_TYPE_LOCAL_APIC   0U
 #define ACPI_MADT_TYPE_IOAPIC       1U
 #define ACPI_MADT_ENABLED           1U
@@ -115,6 +125,7 @@ void	sci_init(struct vmctx *ctx);
 void	pm_write_dsdt(struct vmctx *ctx, int ncpu);
 void	pm_backto_wakeup(struct vmctx *ctx);
 void	inject_power_button_event(struct vmctx *ctx);
+void	inject_gpe_event(struct vmctx *ctx, int gpe);
 void	power_button_init(struct vmctx *ctx);
 void	power_button_deinit(struct vmctx *ctx);
 
@@ -126,7 +137,17 @@ int parse_madt(void);
 int acrn_parse_iasl(char *arg);
 int get_iasl_compiler(void);
 int check_iasl_version(void);
+int acrn_parse_acpi_cache(char *arg);
+bool acpi_cache_enabled(void);
 
 void osc_write_ospm_dsdt(struct vmctx *ctx, int ncpu);
 
+bool	cpu_hotplug_enabled(void);
+int	cpu_hotplug_nr_cpus(void);
+int	cpu_hotplug_pcpu(int idx);
+bool	cpu_hotplug_present(int idx);
+void	cpu_hotplug_write_dsdt_methods(int idx);
+void	cpu_hotplug_write_dsdt(int ncpu);
+int	cpu_hotplug_request(struct vmctx *ctx, char *opt);
+
 #endif /* _ACPI_H_ */
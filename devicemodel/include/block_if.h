@@ -99,8 +99,9 @@ struct blockif_req {
 };
 
 struct blockif_ctxt;
-struct blockif_ctxt *blockif_open(const char *optstr, const char *ident, int queue_num,
-	struct iothreads_info *iothrds_info);
+struct vmctx;
+struct blockif_ctxt *blockif_open(struct vmctx *ctx, const char *optstr, const char *ident,
+	int queue_num, struct iothreads_info *iothrds_info);
 off_t	blockif_size(struct blockif_ctxt *bc);
 void	blockif_chs(struct blockif_ctxt *bc, uint16_t *c, uint8_t *h,
 		    uint8_t *s);
@@ -113,7 +114,10 @@ int	blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_write(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_flush(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq);
+int	blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq);
+void	blockif_plug(struct blockif_ctxt *bc, int qidx);
+void	blockif_unplug(struct blockif_ctxt *bc, int qidx);
 int	blockif_close(struct blockif_ctxt *bc);
 uint8_t	blockif_get_wce(struct blockif_ctxt *bc);
 void	blockif_set_wce(struct blockif_ctxt *bc, uint8_t wce);
@@ -121,5 +125,11 @@ int	blockif_flush_all(struct blockif_ctxt *bc);
 int	blockif_max_discard_sectors(struct blockif_ctxt *bc);
 int	blockif_max_discard_seg(struct blockif_ctxt *bc);
 int	blockif_discard_sector_alignment(struct blockif_ctxt *bc);
+int	blockif_canzero(struct blockif_ctxt *bc);
+int	blockif_max_zero_sectors(struct blockif_ctxt *bc);
+int	blockif_max_zero_seg(struct blockif_ctxt *bc);
+struct iothread_mevent *blockif_get_iomvt(struct blockif_ctxt *bc, int qidx);
+int	blockif_get_stats(char *buf, size_t len);
+int	blockif_set_throttle(const char *ident, int iops, int bw_kb);
 
 #endif /* _BLOCK_IF_H_ */
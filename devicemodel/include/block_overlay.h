@@ -0,0 +1,36 @@
+/* Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay of block_if: a sparse delta file holds the clusters
+ * written by the VM, the others are read from a base image shared read-only
+ * by the VMs, so that they share its pages in the Service VM's page cache.
+ */
+
+#ifndef _BLOCK_OVERLAY_H_
+#define _BLOCK_OVERLAY_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blockif_overlay;
+
+/*
+ * The overlay of the delta in fd, which is formatted when it's empty, on
+ * the image of base_path. The fd stays the caller's.
+ */
+struct blockif_overlay *blockif_overlay_open(int fd, const char *base_path,
+		int ro);
+void	blockif_overlay_close(struct blockif_overlay *ov);
+off_t	blockif_overlay_size(struct blockif_overlay *ov);
+
+/* as preadv and pwritev, at offsets of the virtual disk */
+ssize_t	blockif_overlay_preadv(struct blockif_overlay *ov,
+		const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t	blockif_overlay_pwritev(struct blockif_overlay *ov,
+		const struct iovec *iov, int iovcnt, off_t offset);
+
+#endif /* _BLOCK_OVERLAY_H_ */
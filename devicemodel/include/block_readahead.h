@@ -0,0 +1,48 @@
+/* Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Read-ahead of block_if: the sequential read streams of a drive are
+ * detected, and the chunks ahead of them read by a thread into a small
+ * cache which serves the reads it holds, for the images opened O_DIRECT
+ * which have no read-ahead of the page cache.
+ */
+
+#ifndef _BLOCK_READAHEAD_H_
+#define _BLOCK_READAHEAD_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define BLOCKIF_RA_CHUNK	(64 * 1024)
+
+struct blockif_ra;
+
+/* reads a chunk of the drive, as pread */
+typedef ssize_t (*blockif_ra_read_fn)(void *arg, void *buf, size_t len,
+		off_t offset);
+
+/*
+ * The read-ahead of a drive of size bytes, window bytes ahead of its
+ * streams, in a cache of cache_size bytes.
+ */
+struct blockif_ra *blockif_ra_init(const char *name, off_t size,
+		size_t window, size_t cache_size, blockif_ra_read_fn read,
+		void *arg);
+void	blockif_ra_deinit(struct blockif_ra *ra);
+
+/*
+ * A read of the guest: true if the cache had all of it, copied to iov.
+ * The read feeds the stream detection either way.
+ */
+bool	blockif_ra_read(struct blockif_ra *ra, const struct iovec *iov,
+		int iovcnt, off_t offset);
+
+/* the drive changed, after a write or a discard */
+void	blockif_ra_invalidate(struct blockif_ra *ra, off_t offset, size_t len);
+
+#endif /* _BLOCK_READAHEAD_H_ */
@@ -54,6 +54,10 @@ extern bool ssram;
 extern bool vtpm2;
 extern bool is_winvm;
 extern bool ovmf_loaded;
+extern bool warm_reset;
+extern bool hv_vhpet;
+extern bool hv_vpit;
+extern char *restore_file_name;
 
 enum acrn_thread_prio {
 	PRIO_VCPU = PRIO_MIN,
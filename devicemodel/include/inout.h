@@ -29,6 +29,7 @@
 #ifndef _INOUT_H_
 #define	_INOUT_H_
 
+#include <stdbool.h>
 #include "types.h"
 #include "acrn_common.h"
 struct vmctx;
@@ -50,6 +51,7 @@ struct inout_port {
 #define	IOPORT_F_IN		0x1
 #define	IOPORT_F_OUT		0x2
 #define	IOPORT_F_INOUT		(IOPORT_F_IN | IOPORT_F_OUT)
+#define	IOPORT_F_CONCURRENT	0x4	/* handler can run on several ioreq threads */
 
 /*
  * The following flags are used internally and must not be used by
@@ -73,5 +75,7 @@ void	init_inout(void);
 int	emulate_inout(struct vmctx *ctx, int *pvcpu, struct acrn_pio_request *req);
 int	register_inout(struct inout_port *iop);
 int	unregister_inout(struct inout_port *iop);
+const char *inout_port_name(int port);
+bool	inout_port_concurrent(int port);
 
 #endif	/* _INOUT_H_ */
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IOREQ_DISPATCH_H
+#define IOREQ_DISPATCH_H
+
+#include <stdbool.h>
+#include <acrn_common.h>
+
+struct vmctx;
+
+typedef void (*ioreq_handler_t)(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu);
+
+/*
+ * Concurrent I/O request dispatch: vm_loop() still waits on the ioreq client
+ * of the VM, but hands the pending requests to a pool of threads, sharded by
+ * vCPU, instead of handling them itself. The emulation of the ranges flagged
+ * IOPORT_F_CONCURRENT or MEM_F_CONCURRENT runs in parallel, every other
+ * request runs alone, as it did on the single vm_loop thread.
+ */
+int ioreq_dispatch_parse_options(char *opt);
+bool ioreq_dispatch_enabled(void);
+int ioreq_dispatch_init(struct vmctx *ctx, struct acrn_io_request *ioreq_buf,
+		int ncpus, ioreq_handler_t handler);
+void ioreq_dispatch_deinit(void);
+int ioreq_dispatch_scan(void);
+bool ioreq_dispatch_busy(void);
+void ioreq_dispatch_wait(void);
+void ioreq_dispatch_quiesce(void);
+void ioreq_emulate_exclusive_begin(void);
+void ioreq_emulate_exclusive_end(void);
+
+#endif /* IOREQ_DISPATCH_H */
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IOREQ_POLL_H
+#define IOREQ_POLL_H
+
+#include <stdbool.h>
+#include <acrn_common.h>
+
+struct vmctx;
+
+/*
+ * I/O request polling: vm_loop() spins on the I/O request page for a while
+ * before it sleeps in the ioreq client of the VM, a request found this way
+ * saves the HSM wakeup of the thread. The window adapts as the iothread one
+ * does, the thread may be pinned to a CPU of its own.
+ */
+int ioreq_poll_parse_options(char *opt);
+bool ioreq_poll_enabled(void);
+int ioreq_poll_init(struct acrn_io_request *ioreq_buf, int ncpus);
+int ioreq_poll_attach(struct vmctx *ctx);
+
+#endif /* IOREQ_POLL_H */
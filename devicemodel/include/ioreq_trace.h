@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IOREQ_TRACE_H
+#define IOREQ_TRACE_H
+
+#include <stdbool.h>
+#include <acrn_common.h>
+
+/*
+ * I/O request latency tracer: the hypervisor stamps the TSC into the request
+ * when it is made pending and when it completes, the device model when it
+ * picks it up and when the handler is done. The stages are aggregated per
+ * device address range and queried with the "ioreq_latency" monitor command.
+ */
+extern bool ioreq_trace_enabled;
+
+void ioreq_trace_pickup(struct acrn_io_request *io_req, int vcpu);
+void ioreq_trace_handled(struct acrn_io_request *io_req, int vcpu);
+int ioreq_trace_control(const char *option, char *buf, size_t len);
+
+#endif /* IOREQ_TRACE_H */
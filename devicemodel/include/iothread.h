@@ -17,12 +17,28 @@
  */
 #define PTHREAD_NAME_MAX_LEN		16
 
+struct iothread_ctx;
+
 struct iothread_mevent {
 	void (*run)(void *);
 	void *arg;
 	int fd;
+
+	/*
+	 * In a pool, the mevents of one group are never run at the same time,
+	 * group is the mevent holding the run flag, NULL for the mevent itself.
+	 */
+	struct iothread_mevent *group;
+	int running;			/* 1 + idx of the ctx running the group */
+	struct iothread_ctx *ioctx;	/* the ctx whose epoll has the fd */
 };
 
+/* the poll window starts from this long, and doubles up to poll_max_us */
+#define IOTHREAD_POLL_START_US		4
+
+/* the mevents one pool can have, each is queued once at most */
+#define IOTHREAD_DEQUE_LEN		128
+
 struct iothread_ctx {
 	pthread_t tid;
 	int epfd;
@@ -31,11 +47,49 @@ struct iothread_ctx {
 	int idx;
 	cpu_set_t cpuset;
 	char name[PTHREAD_NAME_MAX_LEN];
+
+	/*
+	 * Busy polling: poll the fds for up to poll_us before sleeping in
+	 * epoll_wait(). poll_us adapts to how long the thread sleeps, within
+	 * poll_max_us, 0 if polling is off.
+	 */
+	int poll_max_us;
+	int poll_us;
+	uint64_t poll_hits;	/* events found while polling */
+	uint64_t poll_misses;	/* poll windows which expired */
+	uint64_t sleeps;	/* blocking epoll_wait() */
+	uint64_t events;
+
+	/*
+	 * Pool mode: the mevents of the threads of a pool can be run by any of
+	 * them. Each thread queues what its own fds report, runs the newest
+	 * first and steals the oldest from the others once it has nothing left.
+	 */
+	struct iothread_ctx *pool;	/* the first ctx of the pool, NULL if not pooled */
+	int pool_num;
+	int wake_fd;
+	struct iothread_mevent wake_mevt;
+	pthread_mutex_t dq_mtx;
+	struct iothread_mevent *dq[IOTHREAD_DEQUE_LEN];
+	unsigned int dq_head;
+	unsigned int dq_tail;
+	int idle;
+	uint64_t steals;
+	/* the pool wide fields, in the first ctx only */
+	pthread_rwlock_t pass_lock;	/* held shared by each thread while it runs */
+	int pool_mevents;
 };
 
 struct iothreads_option {
 	char tag[PTHREAD_NAME_MAX_LEN];
 	int num;
+	int poll_us;
+	bool pool;
+	/*
+	 * "auto": num is 0 until the device sets it to its number of queues,
+	 * the threads take the CPUs of the single set in cpusets round robin.
+	 */
+	bool per_queue;
 	cpu_set_t *cpusets;
 };
 
@@ -50,5 +104,8 @@ void iothread_deinit(void);
 struct iothread_ctx *iothread_create(struct iothreads_option *iothr_opt);
 int iothread_parse_options(char *str, struct iothreads_option *iothr_opt);
 void iothread_free_options(struct iothreads_option *iothr_opt);
+int iothread_get_stats(char *buf, size_t len);
+int iothread_set_poll(const char *name, int poll_max_us);
+int iothread_set_affinity(const char *name, const cpu_set_t *cpuset);
 
 #endif
@@ -36,6 +36,7 @@ void	pci_irq_assert(struct pci_vdev *pi);
 void	pci_irq_deassert(struct pci_vdev *pi);
 void	pci_irq_init(struct vmctx *ctx);
 void	pci_irq_deinit(struct vmctx *ctx);
+void	pci_irq_reset(struct vmctx *ctx);
 void	pci_irq_reserve(int irq);
 void	pci_irq_use(int irq);
 int	pirq_alloc_pin(struct pci_vdev *pi);
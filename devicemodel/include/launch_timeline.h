@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef LAUNCH_TIMELINE_H
+#define LAUNCH_TIMELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Launch timeline: the monotonic time each launch phase of the User VM and
+ * the init of each PCI device takes, from vm_create() to the first vm_run().
+ * It is sent once as JSON to the vm_event client of the command monitor
+ * when the VM first runs, written to --launch_timeline <file> if given, and
+ * returned by the "launch_timeline" monitor command.
+ */
+int launch_timeline_parse_options(const char *path);
+void launch_timeline_reset(void);
+uint64_t launch_timeline_now(void);
+void launch_timeline_add_phase(const char *name, uint64_t start_us);
+void launch_timeline_add_vdev(const char *name, int bus, int slot, int func,
+		uint64_t start_us, int err);
+void launch_timeline_done(void);
+int launch_timeline_get(char *buf, size_t len);
+
+#endif /* LAUNCH_TIMELINE_H */
@@ -28,6 +28,7 @@
 
 #ifndef _MEM_H_
 #define	_MEM_H_
+#include <stdbool.h>
 #include "types.h"
 #include "hsm_ioctl_defs.h"
 
@@ -49,12 +50,15 @@ struct mem_range {
 #define	MEM_F_WRITE		0x2
 #define	MEM_F_RW		(MEM_F_READ | MEM_F_WRITE)
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
+#define	MEM_F_CONCURRENT	0x8	/* handler can run on several ioreq threads */
 
 int	emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req);
 int	register_mem(struct mem_range *memp);
 int	register_mem_fallback(struct mem_range *memp);
 int	unregister_mem(struct mem_range *memp);
 int	unregister_mem_fallback(struct mem_range *memp);
+int	lookup_mem_range(uint64_t paddr, uint64_t *base, char *name, size_t len);
+bool	mem_range_concurrent(uint64_t paddr);
 void	init_mem(void);
 
 #endif	/* _MEM_H_ */
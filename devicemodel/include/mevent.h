@@ -38,11 +38,26 @@ enum ev_type {
 	EVF_SIGNAL		/* Not supported yet */
 };
 
+/*
+ * The dispatcher threads: an mevent is run by the one it is added to, MAIN
+ * being the thread of mevent_dispatch().
+ */
+enum mevent_disp_id {
+	MEVENT_DISP_MAIN,
+	MEVENT_DISP_TIMER,	/* the acrn_timers */
+	MEVENT_DISP_NET,	/* the bulk network RX */
+	MEVENT_DISP_NUM
+};
+
 struct mevent;
 
 struct mevent *mevent_add(int fd, enum ev_type type,
 			  void (*run)(int, enum ev_type, void *), void *param,
 			  void (*teardown)(void *), void *teardown_param);
+struct mevent *mevent_add_disp(int fd, enum ev_type type,
+			  void (*run)(int, enum ev_type, void *), void *param,
+			  void (*teardown)(void *), void *teardown_param,
+			  enum mevent_disp_id id);
 int	mevent_enable(struct mevent *evp);
 int	mevent_disable(struct mevent *evp);
 int	mevent_delete(struct mevent *evp);
@@ -15,6 +15,10 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
 int monitor_init(struct vmctx *ctx);
 void monitor_close(void);
 
@@ -34,9 +38,16 @@ int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
 /* helper functions for vm_ops callback developer */
 unsigned get_wakeup_reason(void);
 int set_wakeup_timer(time_t t);
+void monitor_notify_state(int state);
 int acrn_parse_intr_monitor(const char *opt);
 int vm_monitor_blkrescan(void *arg, char *devargs);
+int vm_monitor_dev_tune(char *opt);
 
 int vm_monitor_send_vm_event(const char *msg);
+bool vm_monitor_has_vm_event_client(void);
+
+/* whether a subscriber of the monitor asks for metrics, to time the ioreqs */
+extern bool monitor_metrics_enabled;
+void monitor_account_ioreq(uint32_t type, const struct timespec *start);
 
 #endif
@@ -90,6 +90,20 @@ struct pci_vdev_ops {
 	uint64_t  (*vdev_barread)(struct vmctx *ctx, int vcpu,
 				struct pci_vdev *pi, int baridx,
 				uint64_t offset, int size);
+
+	/*
+	 * warm reset of the state the core doesn't restore itself, the
+	 * backend of the device is kept
+	 */
+	void	(*vdev_reset)(struct vmctx *ctx, struct pci_vdev *pi);
+
+	/*
+	 * snapshot of the guest-visible state the core doesn't save itself,
+	 * written to and read back from fd with snapshot_write() and
+	 * snapshot_read(): 0 on success, -EBUSY to be retried later
+	 */
+	int	(*vdev_save)(struct vmctx *ctx, struct pci_vdev *pi, int fd);
+	int	(*vdev_restore)(struct vmctx *ctx, struct pci_vdev *pi, int fd);
 };
 
 /*
@@ -113,6 +127,10 @@ struct pcibar {
 	uint64_t		size;
 	uint64_t		addr;
 	bool			sizing;
+	/* writes to [addr + posted_off, + posted_len) of an io bar may be posted */
+	uint64_t		posted_off;
+	uint64_t		posted_len;
+	bool			posted;		/* the posted range is assigned */
 };
 
 #define PI_NAMESZ	40
@@ -178,9 +196,16 @@ struct pci_vdev {
 
 	void	*arg;		/* devemu-private data */
 
+	/* serializes the BAR accesses of the ioreq threads */
+	pthread_mutex_t	io_lock;
+
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	/* 0..5 is used for PCI MMIO/IO bar. 6 is used for PCI ROMbar */
 	struct pcibar bar[PCI_BARMAX + 2];
+
+	/* the config space and BAR addresses set by init_pci(), for reset_pci() */
+	uint8_t	reset_cfgdata[PCI_REGMAX + 1];
+	uint64_t reset_bar_addr[PCI_BARMAX + 2];
 };
 
 struct gsi_dev {
@@ -309,6 +334,12 @@ typedef void (*pci_lintr_cb)(int b, int s, int pin, int pirq_pin,
 
 int	init_pci(struct vmctx *ctx);
 void	deinit_pci(struct vmctx *ctx);
+bool	pci_has_passthrough(void);
+bool	can_reset_pci(void);
+void	reset_pci(struct vmctx *ctx);
+bool	can_save_pci(void);
+int	save_pci(struct vmctx *ctx, int fd);
+int	restore_pci(struct vmctx *ctx, int fd);
 void	msicap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
 			int bytes, uint32_t val);
 void	msixcap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
@@ -336,6 +367,8 @@ int	pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx,
 			    uint64_t hostbase, enum pcibar_type type,
 			    uint64_t size);
 void	pci_emul_free_bar(struct pci_vdev *pdi, int idx);
+void	pci_emul_set_bar_posted(struct pci_vdev *dev, int idx, uint64_t off,
+				uint64_t len);
 void	pci_emul_free_bars(struct pci_vdev *pdi);
 int	pci_emul_add_capability(struct pci_vdev *dev, u_char *capdata,
 				int caplen);
@@ -81,6 +81,12 @@
 	_IO(ACRN_IOCTL_TYPE, 0x15)
 #define ACRN_IOCTL_SET_VCPU_REGS	\
 	_IOW(ACRN_IOCTL_TYPE, 0x16, struct acrn_vcpu_regs)
+#define ACRN_IOCTL_SAVE_VCPU_STATE	\
+	_IOWR(ACRN_IOCTL_TYPE, 0x17, struct acrn_vcpu_state)
+#define ACRN_IOCTL_RESTORE_VCPU_STATE	\
+	_IOW(ACRN_IOCTL_TYPE, 0x18, struct acrn_vcpu_state)
+#define ACRN_IOCTL_HOTPLUG_VCPU		\
+	_IOWR(ACRN_IOCTL_TYPE, 0x19, struct acrn_vcpu_hotplug)
 
 /* IRQ and Interrupts */
 #define ACRN_IOCTL_INJECT_MSI		\
@@ -89,6 +95,12 @@
 	_IOW(ACRN_IOCTL_TYPE, 0x24, unsigned long)
 #define ACRN_IOCTL_SET_IRQLINE		\
 	_IOW(ACRN_IOCTL_TYPE, 0x25, __u64)
+#define ACRN_IOCTL_INJECT_MSI_BATCH	\
+	_IOW(ACRN_IOCTL_TYPE, 0x26, struct acrn_msi_batch)
+#define ACRN_IOCTL_SETUP_MSI_RING	\
+	_IOW(ACRN_IOCTL_TYPE, 0x27, __u64)
+#define ACRN_IOCTL_NOTIFY_MSI_RING	\
+	_IO(ACRN_IOCTL_TYPE, 0x28)
 
 /* DM ioreq management */
 #define ACRN_IOCTL_NOTIFY_REQUEST_FINISH \
@@ -101,12 +113,16 @@
 	_IO(ACRN_IOCTL_TYPE, 0x34)
 #define ACRN_IOCTL_CLEAR_VM_IOREQ	\
 	_IO(ACRN_IOCTL_TYPE, 0x35)
+#define ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH \
+	_IOW(ACRN_IOCTL_TYPE, 0x36, struct acrn_ioreq_notify_batch)
 
 /* Guest memory management */
 #define ACRN_IOCTL_SET_MEMSEG		\
 	_IOW(ACRN_IOCTL_TYPE, 0x41, struct acrn_vm_memmap)
 #define ACRN_IOCTL_UNSET_MEMSEG		\
 	_IOW(ACRN_IOCTL_TYPE, 0x42, struct acrn_vm_memmap)
+#define ACRN_IOCTL_WRITE_PROTECT_PAGE	\
+	_IOW(ACRN_IOCTL_TYPE, 0x43, struct acrn_write_protect)
 
 /* PCI assignment*/
 #define ACRN_IOCTL_SET_PTDEV_INTR	\
@@ -125,6 +141,8 @@
 	_IOW(ACRN_IOCTL_TYPE, 0x59, struct acrn_vdev)
 #define ACRN_IOCTL_DESTROY_VDEV	\
 	_IOW(ACRN_IOCTL_TYPE, 0x5A, struct acrn_vdev)
+#define ACRN_IOCTL_SET_VDEV_CFG_SHADOW	\
+	_IOW(ACRN_IOCTL_TYPE, 0x5B, struct acrn_vdev_cfg_shadow)
 
 /* Power management */
 #define ACRN_IOCTL_PM_GET_CPU_STATE	\
@@ -140,12 +158,30 @@
 #define ACRN_IOCTL_SETUP_ASYNCIO	\
 	_IOW(ACRN_IOCTL_TYPE, 0x90, __u64)
 
+/* Posted IO */
+#define ACRN_IOCTL_SETUP_POSTED_IO	\
+	_IOW(ACRN_IOCTL_TYPE, 0x91, __u64)
+#define ACRN_IOCTL_ASSIGN_POSTED_IO	\
+	_IOW(ACRN_IOCTL_TYPE, 0x92, struct acrn_posted_io_range)
+#define ACRN_IOCTL_DEASSIGN_POSTED_IO	\
+	_IOW(ACRN_IOCTL_TYPE, 0x93, struct acrn_posted_io_range)
+
 /* VM EVENT */
 #define ACRN_IOCTL_SETUP_VM_EVENT_RING	\
 	_IOW(ACRN_IOCTL_TYPE, 0xa0, __u64)
 #define ACRN_IOCTL_SETUP_VM_EVENT_FD	\
 	_IOW(ACRN_IOCTL_TYPE, 0xa1, int)
 
+/* Hypervisor trace */
+#define ACRN_IOCTL_SET_TRACE_FILTER	\
+	_IOW(ACRN_IOCTL_TYPE, 0xb0, struct acrn_trace_filter)
+#define ACRN_IOCTL_SETUP_SBUF_EVENT_FD	\
+	_IOW(ACRN_IOCTL_TYPE, 0xb1, int)
+
+/* RDT monitoring, HC_GET_RDT_MON */
+#define ACRN_IOCTL_GET_RDT_MON		\
+	_IOWR(ACRN_IOCTL_TYPE, 0xc0, struct acrn_rdt_mon)
+
 #define	ACRN_MEM_ACCESS_RIGHT_MASK	0x00000007U
 #define	ACRN_MEM_ACCESS_READ		0x00000001U
 #define	ACRN_MEM_ACCESS_WRITE		0x00000002U
@@ -228,6 +264,53 @@ struct acrn_ioreq_notify {
 	__u32	vcpu;
 };
 
+/**
+ * @brief Info to notify the completion of several ioreqs at once
+ *
+ * The HSM completes the ioreq of each vCPU in vcpu_mask, then notifies the
+ * hypervisor of all of them in one HC_NOTIFY_REQUEST_FINISH_BATCH.
+ */
+struct acrn_ioreq_notify_batch {
+	/** VM id to identify ioreq client */
+	__u16	vmid;
+	__u16	reserved[3];
+	/** bitmap of the ioreq submitters */
+	__u64	vcpu_mask;
+};
+
+/**
+ * @brief Info to inject several MSIs at once
+ *
+ * The HSM issues one HC_INJECT_MSI per MSI of the array, all of them in one
+ * HC_MULTICALL, and writes the result of each into results.
+ */
+struct acrn_msi_batch {
+	/** number of MSIs, at most ACRN_MSI_BATCH_MAX */
+	__u32	nr;
+	__u32	reserved;
+	/** user address of the struct acrn_msi_entry array */
+	__u64	msis;
+	/** user address of the __s32 array of the results, 0 if not wanted */
+	__u64	results;
+};
+
+#define ACRN_MSI_BATCH_MAX	64U
+
+/**
+ * @brief Info to set or clear the write protection of a guest page
+ *
+ * The HSM passes it on as the wp_data of HC_VM_WRITE_PROTECT_PAGE. A guest
+ * write to a protected page comes to the DM as an ACRN_IOREQ_TYPE_WP ioreq,
+ * with the address, size and value of the write, which the DM does.
+ */
+struct acrn_write_protect {
+	/** non-zero to protect the page, 0 to clear the protection */
+	__u8	set;
+	__u8	reserved[7];
+	/** guest physical address of the page, page aligned */
+	__u64	gpa;
+};
+
 #define ACRN_PLATFORM_LAPIC_IDS_MAX	64
 struct acrn_ioeventfd {
 #define ACRN_IOEVENTFD_FLAG_PIO		0x01
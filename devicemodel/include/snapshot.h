@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2023 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct vmctx;
+
+/*
+ * Snapshot of a User VM, taken by the "snapshot" monitor command and
+ * restored with --restore <file> instead of loading the guest software.
+ *
+ * The file is the header, the state of each vCPU, the state of each PCI
+ * device, and the guest memory from mem_offset: the low memory, the frame
+ * buffer and BIOS memory below 4G, then the high memory. The pages of
+ * zeros are holes of the file.
+ *
+ * It can only be restored by the same acrn-dm command line as the VM it
+ * was taken of.
+ */
+#define SNAPSHOT_MAGIC		0x50414e534e524341UL	/* "ACRNSNAP" */
+#define SNAPSHOT_VERSION	1U
+
+struct snapshot_header {
+	uint64_t magic;
+	uint32_t version;
+	uint16_t nr_vcpus;
+	uint16_t reserved;
+	uint64_t lowmem;
+	uint64_t fbmem;
+	uint64_t biosmem;
+	uint64_t highmem;
+	uint64_t mem_offset;
+};
+
+int vm_snapshot(struct vmctx *ctx, const char *path);
+int vm_restore_snapshot(struct vmctx *ctx, const char *path);
+
+/* for the vdev_save and vdev_restore of the devices, 0 or -errno */
+int snapshot_write(int fd, const void *buf, size_t len);
+int snapshot_read(int fd, void *buf, size_t len);
+
+#endif /* SNAPSHOT_H */
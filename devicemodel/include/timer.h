@@ -9,12 +9,22 @@
 #include <time.h>  // for struct itimerspec
 #include <sys/param.h>
 
+/*
+ * All the timers of a clock share one timerfd, the earliest deadline of a
+ * min-heap arms it. slack_ns, 0 unless set before acrn_timer_init(), is how
+ * late the timer may fire so that it expires along with others.
+ */
 struct acrn_timer {
 	int32_t fd;
 	int32_t clockid;
-	struct mevent *mevp;
+	uint64_t slack_ns;
 	void (*callback)(void *, uint64_t);
 	void *callback_param;
+
+	/* private to timer.c */
+	uint64_t expire_ns;
+	uint64_t interval_ns;
+	int32_t heap_idx;	/* -1 when disarmed */
 };
 
 int32_t
@@ -40,6 +40,9 @@ int     uart_legacy_reinit_res(int which, int baseaddr, int irq);
 void	uart_legacy_dealloc(int which);
 uint8_t	uart_read(struct uart_vdev *uart, int offset);
 void	uart_write(struct uart_vdev *uart, int offset, uint8_t value);
+void	uart_reset_vdev(struct uart_vdev *uart);
+int	uart_save_vdev(struct uart_vdev *uart, int fd);
+int	uart_restore_vdev(struct uart_vdev *uart, int fd);
 struct	uart_vdev*
 	uart_set_backend(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 		void *arg, const char *opts);
@@ -7,6 +7,9 @@
 
 #ifndef _USB_DEVICE_H
 #define _USB_DEVICE_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/queue.h>
 #include <libusb-1.0/libusb.h>
 #include "usb_core.h"
 
@@ -24,6 +27,16 @@
 #define USB_EP_MAXP_SZ(m) ((m) & 0x7ff)
 #define USB_EP_MAXP_MT(m) (((m) >> 11) & 0x3)
 
+/* requests allocated for an endpoint on its first transfer, reused after */
+#define USB_DEV_REQ_POOL_SIZE	16
+/* the buffers larger than this are not kept by the pool */
+#define USB_DEV_REQ_BUF_MAX	(256 * 1024)
+/*
+ * isochronous packets per libusb transfer, the frames queued by the guest are
+ * split into several transfers in flight together
+ */
+#define USB_DEV_ISO_PKTS	8
+
 enum {
 	USB_INFO_VERSION,
 	USB_INFO_SPEED,
@@ -33,10 +46,13 @@ enum {
 	USB_INFO_PID
 };
 
+struct usb_dev_req_pool;
+
 struct usb_dev_ep {
 	uint8_t pid;
 	uint8_t type;
 	uint16_t maxp;
+	struct usb_dev_req_pool *pool;
 };
 
 struct usb_dev {
@@ -77,9 +93,38 @@ struct usb_dev_req {
 	int     blk_head;
 	int     blk_tail;
 
+	int     buf_cap;
+	bool    direct;	/* the transfer uses the guest buffer, not buffer */
+
 	struct usb_xfer *xfer;
 	struct libusb_transfer *trn;
 	struct usb_block *setup_blk;
+
+	struct usb_dev_req_pool *pool;
+	bool   pooled;	/* false if allocated with the pool exhausted */
+	LIST_ENTRY(usb_dev_req) link;
+};
+
+/*
+ * The requests of an endpoint, with their libusb transfers and buffers. A
+ * request is busy from its submission to its completion callback, then back
+ * in the free list for the next transfer of the endpoint.
+ */
+struct usb_dev_req_pool {
+	pthread_mutex_t mtx;
+	LIST_HEAD(, usb_dev_req) free_reqs;
+	LIST_HEAD(, usb_dev_req) busy_reqs;
+	int nr_busy;
+
+	/*
+	 * An isochronous endpoint whose last transfer in flight completed
+	 * before the next one was submitted missed the frames in between.
+	 */
+	bool drained;
+	uint64_t underruns;
+
+	/* the device is gone, freed once its last busy request completes */
+	bool dead;
 };
 
 /* callback type used by code from HCD layer */
@@ -71,6 +71,14 @@ struct surface {
 	} dma_info;
 };
 
+/* a rectangle of a surface, in its pixels */
+struct vdpy_rect {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
 struct cursor {
 	enum surface_type surf_type;
 	/* use pixman_format as the intermediate-format */
@@ -90,7 +98,10 @@ int vdpy_init(int *num_vscreens);
 void vdpy_get_display_info(int handle, int scanout_id, struct display_info *info);
 void vdpy_surface_set(int handle, int scanout_id, struct surface *surf);
 void vdpy_surface_update(int handle, int scanout_id, struct surface *surf);
+void vdpy_surface_update_rect(int handle, int scanout_id, struct surface *surf,
+		const struct vdpy_rect *damage);
 bool vdpy_submit_bh(int handle, struct vdpy_display_bh *bh);
+bool vdpy_dmabuf_supported(int handle);
 void vdpy_get_edid(int handle, int scanout_id, uint8_t *edid, size_t size);
 void vdpy_cursor_define(int handle, int scanout_id, struct cursor *cur);
 void vdpy_cursor_move(int handle, int scanout_id, uint32_t x, uint32_t y);
@@ -184,7 +184,7 @@ struct vga {
 	} __attribute__((packed)) vberegs;
 };
 
-void *vga_init(struct gfx_ctx *gc, int io_only);
+void *vga_init(struct vmctx *ctx, struct gfx_ctx *gc, int io_only);
 void vga_render(struct gfx_ctx *gc, void *arg);
 int vga_port_in_handler(struct vmctx *ctx, int in, int port, int bytes,
 		     uint8_t *val, void *arg);
@@ -15,6 +15,7 @@
 #define __VHOST_H__
 
 #include "virtio.h"
+#include "vmmapi.h"
 
 /**
  * @brief vhost APIs
@@ -30,12 +31,73 @@ struct vhost_vq {
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
 };
 
+struct vhost_dev;
+struct vhost_memory;
+struct vhost_vring_addr;
+struct vhost_vring_state;
+struct vhost_vring_file;
+
+/**
+ * @brief The transports a vhost_dev talks to its backend with.
+ */
+enum vhost_backend_type {
+	VHOST_BACKEND_KERNEL = 0,	/**< ioctls on a vhost chardev */
+	VHOST_BACKEND_USER,		/**< vhost-user messages on a UNIX socket */
+};
+
+/**
+ * @brief The vhost requests of a transport.
+ *
+ * The vring indexes are the ones within the vhost_dev.
+ */
+struct vhost_ops {
+	int (*init)(struct vhost_dev *vdev);
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	/* optional, set_mem_table is called again without them */
+	int (*add_mem_map)(struct vhost_dev *vdev,
+			   const struct vm_memfd_map *map);
+	int (*del_mem_map)(struct vhost_dev *vdev,
+			   const struct vm_memfd_map *map);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+	int (*set_vring_enable)(struct vhost_dev *vdev, int idx, bool enable);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+};
+
+extern const struct vhost_ops vhost_kernel_ops;
+extern const struct vhost_ops vhost_user_ops;
+
 struct vhost_dev {
 	/**
 	 * backpointer to virtio_base
 	 */
 	struct virtio_base *base;
 
+	/**
+	 * transport to the backend, set before vhost_dev_init
+	 */
+	enum vhost_backend_type backend_type;
+
+	/**
+	 * requests of the transport
+	 */
+	const struct vhost_ops *ops;
+
 	/**
 	 * pointer to vhost_vq array
 	 */
@@ -47,10 +109,20 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or the vhost-user socket
 	 */
 	int fd;
 
+	/**
+	 * vhost-user protocol features negotiated with the backend
+	 */
+	uint64_t protocol_features;
+
+	/**
+	 * whether the vhost-user backend offers VHOST_USER_F_PROTOCOL_FEATURES
+	 */
+	bool user_protocol;
+
 	/**
 	 * first vq's index in virtio_vq_info
 	 */
@@ -72,6 +144,11 @@ struct vhost_dev {
 	 */
 	uint32_t busyloop_timeout;
 
+	/**
+	 * told of the guest RAM mapped while vhost is started
+	 */
+	struct vm_mem_listener mem_listener;
+
 	/**
 	 * whether vhost is started
 	 */
@@ -86,7 +163,8 @@ struct vhost_dev {
  *
  * @param vdev Pointer to struct vhost_dev.
  * @param base Pointer to struct virtio_base.
- * @param fd fd of the vhost chardev.
+ * @param fd fd of the vhost chardev, or the vhost-user socket when
+ *           vdev->backend_type is VHOST_BACKEND_USER.
  * @param vq_idx The first virtqueue which would be used by this vhost dev.
  * @param vhost_features Subset of vhost features which would be enabled.
  * @param vhost_ext_features Specific vhost internal features to be enabled.
@@ -143,4 +221,26 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  * @return 0 on success and -1 on failure.
  */
 int vhost_kernel_ioctl(struct vhost_dev *vdev, unsigned long int request, void *arg);
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * @param path Path of the UNIX socket the backend listens on.
+ *
+ * @return the socket fd to give to vhost_dev_init, -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
+/**
+ * @brief read the device config space of a vhost-user backend.
+ *
+ * The backend has to support VHOST_USER_PROTOCOL_F_CONFIG.
+ *
+ * @param vdev Pointer to struct vhost_dev, initialized.
+ * @param config Buffer of the config space.
+ * @param size Size of the config space.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size);
 #endif /* __VHOST_H__ */
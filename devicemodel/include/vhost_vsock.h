@@ -21,6 +21,7 @@
 #define VHOST_VSOCK_MAXQ 3
 
 #define VHOST_VSOCK_QUEUE_SIZE 128
+#define VHOST_VSOCK_QUEUE_SIZE_MAX 1024
 #define VHOST_F_LOG_ALL 26
 
 #define VHOST_VSOCK_FEATURES \
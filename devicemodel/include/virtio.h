@@ -124,6 +124,17 @@
  * notify, when descriptors are added to the corresponding ring.
  * (These are provided only for interrupt optimization and need
  * not be implemented.)
+ *
+ * With VIRTIO_F_RING_PACKED negotiated, the three areas are instead a
+ * single ring of <N> 16-byte descriptors, each with a 64-bit <addr>, a
+ * 32-bit <len>, a 16-bit buffer <id> and 16-bit <flags>, followed by the
+ * driver and the device event suppression structures, a 16-bit
+ * <off_wrap> and 16-bit <flags> each. The guest makes a descriptor
+ * available, and the device marks it used, by writing its AVAIL and USED
+ * flags relative to a wrap counter each side flips when its index wraps
+ * around. A chain occupies consecutive descriptors, and a used descriptor
+ * returns it as a whole, with the <id> the guest put in its last one.
+ * The vq_* interfaces below hide which layout a queue uses.
  */
 
 #include <linux/virtio_ring.h>
@@ -219,6 +230,7 @@ enum {
 #define	VIRTIO_VENDOR		0x1AF4
 #define	VIRTIO_DEV_NET		0x1000
 #define	VIRTIO_DEV_BLOCK	0x1001
+#define	VIRTIO_DEV_BALLOON	0x1002
 #define	VIRTIO_DEV_CONSOLE	0x1003
 #define	VIRTIO_DEV_RANDOM	0x1005
 #define	VIRTIO_DEV_GPU		0x1050
@@ -346,7 +358,8 @@ struct virtio_vq_info;
 struct virtio_base {
 	struct virtio_ops *vops;	/**< virtio operations */
 	int	flags;			/**< VIRTIO_* flags from above */
-	bool	iothread;
+	bool	iothread;		/**< queue kicks taken by iothreads */
+	struct iothread_ctx *ioctx;	/**< iothread of the queues the device did not bind */
 	pthread_mutex_t *mtx;		/**< POSIX mutex, if any */
 	struct pci_vdev *dev;		/**< PCI device instance */
 	uint64_t negotiated_caps;	/**< negotiated capabilities */
@@ -399,10 +412,37 @@ struct virtio_ops {
 				/**< to apply negotiated features */
 	void    (*set_status)(void *, uint64_t);
 				/**< called to set device status */
+	bool	sync_notify;	/**< kicks handled on the vCPU, not by an iothread */
 };
 
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+
+#ifndef VIRTIO_F_RING_PACKED
+#define VIRTIO_F_RING_PACKED		34
+#endif
+
+#ifndef VRING_PACKED_DESC_F_AVAIL
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+#endif
+
+/* the layouts of the packed ring, see the comment at the top */
+struct virtio_packed_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t id;
+	uint16_t flags;
+};
+
+struct virtio_packed_event {
+	uint16_t off_wrap;
+	uint16_t flags;
+};
 /**
  * @brief Virtqueue data structure
  *
@@ -430,6 +470,19 @@ struct virtio_iothread {
 	struct iothread_ctx *ioctx;
 	struct iothread_mevent iomvt;
 	void (*iothread_run)(void *, struct virtio_vq_info *);
+	bool	base_lock;	/* iothread_run expects the device lock, as on the vCPU */
+};
+
+/*
+ * Counters of a virtqueue, kept since the device was created, for the
+ * dev_stats monitor command. Updated without the queue lock, relaxed.
+ */
+struct virtio_vq_stats {
+	uint64_t kicks;		/**< notifications from the driver */
+	uint64_t intrs;		/**< interrupts raised to the driver */
+	uint64_t chains;	/**< chains fetched */
+	uint64_t descs;		/**< descriptors of those chains */
+	uint64_t ring_full;	/**< kicks finding every entry available */
 };
 
 struct virtio_vq_info {
@@ -457,10 +510,42 @@ struct virtio_vq_info {
 	volatile struct vring_used *used;
 				/**< the "used" ring */
 
+	bool packed;		/**< VIRTIO_F_RING_PACKED layout */
+	bool avail_wrap;	/**< wrap counter of last_avail */
+	bool used_wrap;		/**< wrap counter of used_idx */
+	bool save_used_wrap;	/**< wrap counter of save_used */
+	uint16_t used_idx;	/**< next used descriptor */
+	uint16_t *chain_len;	/**< descriptors of each buffer id */
+	volatile struct virtio_packed_desc *pdesc;
+				/**< the packed descriptor ring */
+	volatile struct virtio_packed_event *driver_event;
+				/**< driver event suppression */
+	volatile struct virtio_packed_event *device_event;
+				/**< device event suppression */
+
 	uint32_t gpa_desc[2];	/**< gpa of descriptors */
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	struct virtio_coalesce *coalesce;
+				/**< interrupt moderation, NULL if none */
+	struct virtio_vq_stats stats;
+				/**< counters, see struct virtio_vq_stats */
+};
+
+/**
+ * @brief A request chain fetched by vq_getchains_bulk().
+ *
+ * The caller sets iov and flags to its own arrays before the fetch, the
+ * device sets len before the chain is released by vq_relchains_bulk().
+ */
+struct vq_chain {
+	struct iovec *iov;	/**< n_iov entries, set by the caller */
+	uint16_t *flags;	/**< n_iov entries or NULL, set by the caller */
+	uint16_t idx;		/**< the chain to release, as vq_getchain() */
+	int n;			/**< what vq_getchain() returns for it */
+	uint32_t len;		/**< bytes written, for the release */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -491,10 +576,23 @@ vq_ring_ready(struct virtio_vq_info *vq)
  *
  * @return false on not available and true on available.
  */
+/* whether the descriptor at last_avail is available in a packed ring */
+static inline bool
+vq_packed_desc_avail(struct virtio_vq_info *vq)
+{
+	uint16_t flags = vq->pdesc[vq->last_avail].flags;
+
+	return (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == vq->avail_wrap) &&
+		(!!(flags & (1 << VRING_PACKED_DESC_F_USED)) != vq->avail_wrap);
+}
+
 static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
 	bool ret = false;
+
+	if (vq->packed)
+		return vq_ring_ready(vq) && vq_packed_desc_avail(vq);
 	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
 		if ((uint16_t)((u_int)vq->avail->idx - vq->last_avail) > vq->qsize)
 			pr_err ("%s: no valid descriptor\n", vq->base->vops->name);
@@ -516,6 +614,7 @@ vq_has_descs(struct virtio_vq_info *vq)
 static inline void
 vq_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq)
 {
+	__atomic_fetch_add(&vq->stats.intrs, 1, __ATOMIC_RELAXED);
 	if (pci_msix_enabled(vb->dev))
 		pci_generate_msix(vb->dev, vq->msix_idx);
 	else {
@@ -676,6 +775,143 @@ void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
  */
 void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
 
+/**
+ * @brief Interrupt moderation of the virtqueues of a device.
+ *
+ * The interrupt vq_endchains() decides on is held back until max_frames
+ * used chains are pending, or max_usecs after the first of them. With
+ * adaptive, an interrupt is not held back as long as the previous one is
+ * older than max_usecs, i.e. while the rate is low.
+ */
+struct virtio_coalesce_opts {
+	uint32_t max_frames;	/**< 0: no limit but max_usecs */
+	uint32_t max_usecs;
+	bool adaptive;
+};
+
+/**
+ * @brief Parse the value of a coalesce=<frames>:<usecs>[:adaptive] option.
+ *
+ * @param opt Pointer to the option value.
+ * @param co Pointer to the moderation to fill.
+ *
+ * @return 0 on success and -1 on an invalid value.
+ */
+int virtio_coalesce_parse_options(char *opt, struct virtio_coalesce_opts *co);
+
+/**
+ * @brief Moderate the interrupts of all the virtqueues of a device.
+ *
+ * To be called once the virtqueues are linked up, for a BACKEND_VBSU
+ * device only.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param co Pointer to the moderation.
+ *
+ * @return 0 on success and -1 on error.
+ */
+int virtio_coalesce_init(struct virtio_base *base,
+		const struct virtio_coalesce_opts *co);
+
+/**
+ * @brief Raise now the interrupt the moderation of a virtqueue holds back.
+ *
+ * For the used chains the guest should not wait for, e.g. a key press
+ * after some pointer motion. Nothing is done without a moderation or an
+ * interrupt held back.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_coalesce_flush(struct virtio_vq_info *vq);
+
+/**
+ * @brief Change the interrupt moderation of a running device.
+ *
+ * The moderation is started if the device had none.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param co Pointer to the new moderation.
+ *
+ * @return 0 on success and -1 on error.
+ */
+int virtio_coalesce_update(struct virtio_base *base,
+		const struct virtio_coalesce_opts *co);
+
+/**
+ * @brief Change the interrupt moderation of the virtio device at a slot.
+ *
+ * For the dev_tune monitor command.
+ *
+ * @param slot PCI slot of the device, on bus 0.
+ * @param co Pointer to the new moderation.
+ *
+ * @return 0 on success and -1 if there is no such device or on error.
+ */
+int virtio_set_coalesce(int slot, const struct virtio_coalesce_opts *co);
+
+/**
+ * @brief Change the target size of the virtio balloon at a slot.
+ *
+ * For the dev_tune monitor command.
+ *
+ * @param slot PCI slot of the balloon, on bus 0.
+ * @param size_mb Memory the guest is asked to give back, in MB.
+ *
+ * @return 0 on success and -1 if there is no balloon at the slot or the
+ * size is larger than the guest memory.
+ */
+int virtio_balloon_set_target(int slot, int size_mb);
+
+/**
+ * @brief Dump the counters of the virtqueues of the virtio devices.
+ *
+ * The JSON reply to the dev_stats monitor command, one entry per device
+ * the DM emulates in user space, with the counters of each of its queues.
+ *
+ * @param buf Buffer for the reply.
+ * @param len Size of the buffer.
+ *
+ * @return 0 on success and -1 on error or if the reply doesn't fit.
+ */
+int virtio_get_stats(char *buf, size_t len);
+
+/**
+ * @brief Stop the interrupt moderation of a device.
+ *
+ * @param base Pointer to struct virtio_base.
+ */
+void virtio_coalesce_deinit(struct virtio_base *base);
+
+/**
+ * @brief Fetch up to nchains request chains at once.
+ *
+ * For a split ring, the available index is read once for all of them.
+ * The fetch stops after a chain vq_getchain() would fail on: its n is -1
+ * and its idx is qsize when the chain could not be identified.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Pointer to the chains, their iov and flags set by caller.
+ * @param nchains Size of chains[] array.
+ * @param n_iov Size of the iov[] array of each chain.
+ *
+ * @return number of chains[] entries filled.
+ */
+int vq_getchains_bulk(struct virtio_vq_info *vq, struct vq_chain *chains,
+		int nchains, int n_iov);
+
+/**
+ * @brief Return the request chains to the guest, each one with its len.
+ *
+ * The used entries are published together, a single vq_endchains() is
+ * still to be done.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Pointer to the chains fetched by vq_getchains_bulk().
+ * @param nchains Number of chains to release.
+ */
+void vq_relchains_bulk(struct virtio_vq_info *vq, struct vq_chain *chains,
+		int nchains);
+
 /**
  * @brief Helper function for clearing used ring flags.
  *
@@ -688,6 +924,17 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Driver should always use this helper function to suppress the guest
+ * notifications of the queue, whatever its ring layout.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
@@ -723,6 +970,54 @@ uint64_t virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 void virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		      int baridx, uint64_t offset, int size, uint64_t value);
 
+/**
+ * @brief Warm reset of a virtio device.
+ *
+ * Reset the device as a guest driver writing 0 to its status does, its
+ * backend is kept.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ */
+void virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev);
+
+/**
+ * @brief Save the state of a virtio device to a snapshot.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param fd The snapshot file.
+ *
+ * @return 0 on success, -EBUSY if requests are in flight, another -errno on
+ * other errors.
+ */
+int virtio_pci_save(struct vmctx *ctx, struct pci_vdev *dev, int fd);
+
+/**
+ * @brief Restore the state of a virtio device from a snapshot.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param fd The snapshot file.
+ *
+ * @return 0 on success, -errno on errors.
+ */
+int virtio_pci_restore(struct vmctx *ctx, struct pci_vdev *dev, int fd);
+
+/**
+ * @brief Get how many descriptors of a queue of a virtio device wait.
+ *
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param idx Index of the queue.
+ * @param pending Where to store the chains made available, not taken yet.
+ * @param inflight Where to store the chains taken, not used yet.
+ *
+ * @return size of the queue, 0 if it is not set up, -1 if there is no such
+ * queue served by the device model.
+ */
+int virtio_vq_depth(struct pci_vdev *dev, int idx, uint16_t *pending,
+		    uint16_t *inflight);
+
 /**
  * @brief Set modern BAR (usually 4) to map PCI config registers.
  *
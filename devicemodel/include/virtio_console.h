@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @file virtio_console.h
+ */
+
+#ifndef __VIRTIO_CONSOLE_H__
+#define __VIRTIO_CONSOLE_H__
+
+#include <stddef.h>
+
+/**
+ * @brief Write the counters of the virtio-console ports as JSON.
+ *
+ * @param buf Buffer of the JSON string.
+ * @param len Size of buf.
+ *
+ * @return 0 on success, -1 if buf is too small.
+ */
+int virtio_console_get_stats(char *buf, size_t len);
+
+#endif /* __VIRTIO_CONSOLE_H__ */
@@ -13,6 +13,7 @@
 int vm_event_init(struct vmctx *ctx);
 int vm_event_deinit(void);
 int dm_send_vm_event(struct vm_event *event);
+int vm_event_read(uint64_t since, char *buf, size_t len);
 uint32_t get_dm_vm_event_overrun_count(void);
 
 #endif /* VM_EVENT_H */
@@ -30,6 +30,8 @@
 #define	_VMMAPI_H_
 
 #include <sys/param.h>
+#include <sys/queue.h>
+#include <pthread.h>
 #include "types.h"
 #include "macros.h"
 #include "pm.h"
@@ -73,6 +75,13 @@ struct vmctx {
 	bool gvt_enabled;
 
 	void (*update_gvt_bar)(struct vmctx *ctx);
+
+	/* the MSIs are published here instead of injected by ioctl, if set */
+	struct acrn_msi_ring *msi_ring;
+	pthread_mutex_t msi_ring_mtx;
+
+	/* the hypervisor posts the writes to the ranges of vm_assign_posted_io(), if set */
+	bool posted_io;
 };
 
 #define	PROT_RW		(PROT_READ | PROT_WRITE)
@@ -94,6 +103,36 @@ struct vm_mem_region {
 };
 bool	vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 			     struct vm_mem_region *ret_region);
+
+/* a range of the guest memory mapped from a memfd, for the vhost backends */
+struct vm_memfd_map {
+	vm_paddr_t gpa;
+	uint64_t size;
+	uint64_t fd_offset;
+	void *hva;
+	int fd;
+};
+int	vm_get_memfd_maps(struct vmctx *ctx, struct vm_memfd_map *maps,
+			  int max);
+
+/*
+ * The memory a device maps into the guest as RAM (ivshmem, the VGA
+ * framebuffer) is added to the maps, the listeners are told of the changes.
+ * An fd of -1 looks the hva up in the guest memory.
+ */
+int	vm_add_ram_map(struct vmctx *ctx, vm_paddr_t gpa, uint64_t size,
+		       void *hva, int fd, uint64_t fd_offset);
+void	vm_del_ram_map(struct vmctx *ctx, vm_paddr_t gpa);
+
+struct vm_mem_listener {
+	void (*map_add)(struct vm_mem_listener *l,
+			const struct vm_memfd_map *map);
+	void (*map_del)(struct vm_mem_listener *l,
+			const struct vm_memfd_map *map);
+	LIST_ENTRY(vm_mem_listener) list;
+};
+void	vm_register_mem_listener(struct vm_mem_listener *l);
+void	vm_unregister_mem_listener(struct vm_mem_listener *l);
 bool    vm_allow_dmabuf(struct vmctx *ctx);
 /*
  * Create a device memory segment identified by 'segid'.
@@ -107,7 +146,33 @@ int	vm_create_ioreq_client(struct vmctx *ctx);
 int	vm_destroy_ioreq_client(struct vmctx *ctx);
 int	vm_attach_ioreq_client(struct vmctx *ctx);
 int	vm_notify_request_done(struct vmctx *ctx, int vcpu);
+int	vm_notify_requests_done(struct vmctx *ctx, uint64_t vcpu_mask);
+uint64_t	vm_ioreq_scan_mask(struct acrn_io_request *req_buf, int ncpus);
+void	vm_ioreq_taken(struct acrn_io_request *req_buf, int vcpu);
 int	vm_setup_asyncio(struct vmctx *ctx, uint64_t base);
+int	vm_setup_posted_io(struct vmctx *ctx, uint64_t base);
+int	vm_setup_msi_ring(struct vmctx *ctx, uint64_t base);
+int	vm_assign_posted_io(struct vmctx *ctx, uint32_t type, uint64_t addr, uint64_t len);
+int	vm_deassign_posted_io(struct vmctx *ctx, uint32_t type, uint64_t addr, uint64_t len);
+int	vm_write_protect_page(struct vmctx *ctx, vm_paddr_t gpa, bool set);
+
+/*
+ * The pages of [gpa, gpa + len) written by the guest, mapped at hva in the
+ * DM: they're write protected, and the first write to one after each sync
+ * comes to the DM as a WP ioreq, which vm_dirty_log_write() does before
+ * lifting the protection of the page.
+ */
+struct vm_dirty_log;
+struct vm_dirty_log *vm_dirty_log_start(struct vmctx *ctx, vm_paddr_t gpa,
+					void *hva, size_t len);
+void	vm_dirty_log_stop(struct vm_dirty_log *log);
+/*
+ * The pages written since the last sync, as a bit per page in bitmap, and
+ * protected again, so that the caller reads them after the sync. Returns
+ * the count of them.
+ */
+size_t	vm_dirty_log_sync(struct vm_dirty_log *log, uint64_t *bitmap);
+int	vm_dirty_log_write(struct vmctx *ctx, struct acrn_mmio_request *req);
 void	vm_clear_ioreq(struct vmctx *ctx);
 const char *vm_state_to_str(enum vm_suspend_how idx);
 void	vm_set_suspend_mode(enum vm_suspend_how how);
@@ -119,12 +184,18 @@ void	vm_destroy(struct vmctx *ctx);
 int	vm_parse_memsize(const char *optarg, size_t *memsize);
 int	vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	uint64_t vma, int prot);
+int	vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma, int prot);
 int	vm_setup_memory(struct vmctx *ctx, size_t len);
 void	vm_unsetup_memory(struct vmctx *ctx);
 bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
+int	hugetlb_parse_prefault(const char *opt);
+int	hugetlb_set_pool(const char *dir);
+int	vm_release_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	vm_populate_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
@@ -132,6 +203,8 @@ size_t	vm_get_highmem_size(struct vmctx *ctx);
 int	vm_run(struct vmctx *ctx);
 int	vm_suspend(struct vmctx *ctx, enum vm_suspend_how how);
 int	vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg);
+void	vm_msi_batch_begin(struct vmctx *ctx);
+int	vm_msi_batch_end(struct vmctx *ctx);
 int	vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation);
 int	vm_assign_pcidev(struct vmctx *ctx, struct acrn_pcidev *pcidev);
 int	vm_deassign_pcidev(struct vmctx *ctx, struct acrn_pcidev *pcidev);
@@ -146,13 +219,20 @@ int	vm_set_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf,
 int	vm_reset_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf,
 	uint16_t phys_bdf, int virt_pin, bool pic_pin);
 int	vm_add_hv_vdev(struct vmctx *ctx, struct acrn_vdev *dev);
+int	vm_set_vdev_cfg_shadow(struct vmctx *ctx, struct acrn_vdev_cfg_shadow *shadow);
 int	vm_remove_hv_vdev(struct vmctx *ctx, struct acrn_vdev *dev);
 
 int	acrn_parse_cpu_affinity(char *arg);
+int	acrn_parse_cpu_hotplug(char *arg);
 uint64_t vm_get_cpu_affinity_dm(void);
+uint64_t vm_get_cpu_hotplug_dm(void);
 int	vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_vcpu_regs *cpu_regs);
 
 int	vm_get_cpu_state(struct vmctx *ctx, void *state_buf);
+int	vm_get_rdt_mon(struct vmctx *ctx, int pcpu_id, struct acrn_rdt_mon *mon);
+int	vm_save_vcpu_state(struct vmctx *ctx, struct acrn_vcpu_state *state);
+int	vm_restore_vcpu_state(struct vmctx *ctx, struct acrn_vcpu_state *state);
+int	vm_hotplug_vcpu(struct vmctx *ctx, struct acrn_vcpu_hotplug *hotplug);
 int	vm_intr_monitor(struct vmctx *ctx, void *intr_buf);
 void	vm_stop_watchdog(struct vmctx *ctx);
 void	vm_reset_watchdog(struct vmctx *ctx);
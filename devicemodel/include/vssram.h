@@ -54,5 +54,6 @@ void clean_vssram_configs(void);
 int init_vssram(struct vmctx *ctx);
 void deinit_vssram(struct vmctx *ctx);
 int parse_vssram_buf_params(const char *opt);
+int vssram_get_stats(struct vmctx *ctx, char *buf, size_t len);
 
 #endif  /* RTCT_H */
@@ -0,0 +1,652 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * blockif-bench: block_if driven by synthetic workloads, without a guest,
+ * to measure its back-ends alone. The drives are given as to the -s
+ * options of the block devices, e.g.
+ *
+ *	blockif-bench -q 32 -b 4k /dev/nvme0n1,aio=threads /dev/nvme0n1,aio=io_uring
+ *
+ * runs the same workload on each of them in turn and reports their IOPS,
+ * bandwidth and latency percentiles.
+ *
+ * The requests are submitted from the callbacks of the ones they replace,
+ * and at first by an iothread, which is also the one running the io_uring
+ * completions: block_if expects the requests of an io_uring queue to come
+ * from the thread which reaps them, as its devices do.
+ */
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "block_if.h"
+#include "dm_string.h"
+#include "iothread.h"
+#include "log.h"
+#include "timer.h"
+#include "vmmapi.h"
+
+#define BENCH_DEPTH_MAX		64
+#define BENCH_BUF_ALIGN		4096
+#define BENCH_MISALIGN		512	/* of the buffers, with -u */
+
+/* the latency buckets: 16 per power of 2 of the nanoseconds */
+#define BENCH_LAT_SUB_SHIFT	4
+#define BENCH_LAT_SUB		(1 << BENCH_LAT_SUB_SHIFT)
+#define BENCH_LAT_BUCKETS	(64 * BENCH_LAT_SUB)
+
+enum bench_kind {
+	BENCH_READ,
+	BENCH_WRITE,
+	BENCH_FLUSH,
+	BENCH_KINDS
+};
+
+static const char *bench_kind_names[BENCH_KINDS] = { "read", "write", "flush" };
+
+struct bench_stats {
+	uint64_t	nr;
+	uint64_t	bytes;
+	uint64_t	lat_sum_ns;
+	uint64_t	lat_max_ns;
+	uint64_t	hist[BENCH_LAT_BUCKETS];
+};
+
+struct bench_opts {
+	bool		seq;
+	int		read_pct;
+	size_t		bs;
+	int		iovs;
+	bool		misaligned;
+	int		depth;
+	int		secs;
+	int		flush_every;	/* writes, 0 for no flush */
+	off_t		span;		/* 0 for the whole drive */
+};
+
+struct bench;
+
+struct bench_io {
+	struct blockif_req	req;
+	struct bench		*b;
+	enum bench_kind		kind;
+	uint64_t		start_ns;
+	void			*buf;
+	struct bench_io		*next;	/* in the ready list */
+};
+
+struct bench {
+	const struct bench_opts	*o;
+	struct blockif_ctxt	*bc;
+	off_t			span;
+	int			depth;
+
+	pthread_mutex_t		mtx;
+	pthread_cond_t		cond;
+	struct bench_io		*ios;
+	struct bench_io		*ready;		/* to be submitted */
+	int			active;		/* the ios not retired */
+	bool			done;
+	uint64_t		start_ns;
+	uint64_t		end_ns;		/* no submission after it */
+	uint64_t		last_ns;	/* the last completion */
+	off_t			next;		/* of the sequential workload */
+	int			writes;		/* since the last flush */
+	uint64_t		rand;
+	uint64_t		errors;
+	struct bench_stats	stats[BENCH_KINDS];
+
+	int			kick_fd;
+	struct iothread_mevent	kick_mevt;
+};
+
+static bool bench_verbose;
+
+/* the submissions nested in a callback are left to the outermost one */
+static __thread int bench_nesting;
+
+/* the rest of the device model, which block_if and the iothreads use */
+void
+output_log(uint8_t level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (level > LOG_WARNING && !bench_verbose)
+		return;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void
+set_thread_priority(int priority, bool reset_on_fork)
+{
+}
+
+/* no guest memory, no fixed buffers */
+int
+vm_get_memfd_maps(struct vmctx *ctx, struct vm_memfd_map *maps, int max)
+{
+	return 0;
+}
+
+static uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* xorshift64*, the offsets of the random workload */
+static uint64_t
+bench_rand(struct bench *b)
+{
+	b->rand ^= b->rand >> 12;
+	b->rand ^= b->rand << 25;
+	b->rand ^= b->rand >> 27;
+	return b->rand * 0x2545f4914f6cdd1dULL;
+}
+
+static int
+bench_lat_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < BENCH_LAT_SUB)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - BENCH_LAT_SUB_SHIFT + 1) * BENCH_LAT_SUB +
+		((ns >> (msb - BENCH_LAT_SUB_SHIFT)) & (BENCH_LAT_SUB - 1));
+}
+
+/* the middle of the latencies of the bucket */
+static uint64_t
+bench_lat_value(int idx)
+{
+	uint64_t base, step;
+
+	if (idx < BENCH_LAT_SUB)
+		return idx;
+	base = 1ULL << (idx / BENCH_LAT_SUB + BENCH_LAT_SUB_SHIFT - 1);
+	step = base >> BENCH_LAT_SUB_SHIFT;
+	return base + (idx % BENCH_LAT_SUB) * step + step / 2;
+}
+
+static double
+bench_percentile_us(const struct bench_stats *st, double p)
+{
+	uint64_t want, seen = 0, ns;
+	int i;
+
+	want = (uint64_t)(st->nr * p / 100.0);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+		seen += st->hist[i];
+		if (seen >= want)
+			break;
+	}
+	ns = bench_lat_value(i);
+	if (ns > st->lat_max_ns)
+		ns = st->lat_max_ns;
+	return ns / 1000.0;
+}
+
+/* the next request of the workload, under the lock */
+static off_t
+bench_pick(struct bench *b, enum bench_kind *kind)
+{
+	const struct bench_opts *o = b->o;
+	off_t offset;
+
+	if (o->flush_every && b->writes >= o->flush_every) {
+		b->writes = 0;
+		*kind = BENCH_FLUSH;
+		return 0;
+	}
+	*kind = ((int)(bench_rand(b) % 100) < o->read_pct) ? BENCH_READ : BENCH_WRITE;
+	if (*kind == BENCH_WRITE)
+		b->writes++;
+
+	if (o->seq) {
+		if (b->next + (off_t)o->bs > b->span)
+			b->next = 0;
+		offset = b->next;
+		b->next += o->bs;
+	} else
+		offset = (bench_rand(b) % (b->span / o->bs)) * o->bs;
+	return offset;
+}
+
+static void bench_done(struct blockif_req *br, int err);
+
+/* an io leaves the workload, the last one ends it */
+static void
+bench_retire(struct bench *b)
+{
+	if (--b->active == 0) {
+		b->done = true;
+		pthread_cond_broadcast(&b->cond);
+	}
+}
+
+static void
+bench_submit(struct bench_io *io)
+{
+	struct bench *b = io->b;
+	const struct bench_opts *o = b->o;
+	struct blockif_req *br = &io->req;
+	size_t piece;
+	int i, err;
+
+	pthread_mutex_lock(&b->mtx);
+	br->offset = bench_pick(b, &io->kind);
+	pthread_mutex_unlock(&b->mtx);
+
+	br->iovcnt = (io->kind == BENCH_FLUSH) ? 0 : o->iovs;
+	br->resid = (io->kind == BENCH_FLUSH) ? 0 : o->bs;
+	piece = o->bs / o->iovs;
+	for (i = 0; i < br->iovcnt; i++) {
+		br->iov[i].iov_base = (char *)io->buf + i * piece;
+		br->iov[i].iov_len = (i == br->iovcnt - 1) ?
+			o->bs - i * piece : piece;
+	}
+	br->callback = bench_done;
+	br->param = io;
+	br->qidx = 0;
+
+	io->start_ns = bench_now_ns();
+	switch (io->kind) {
+	case BENCH_READ:
+		err = blockif_read(b->bc, br);
+		break;
+	case BENCH_WRITE:
+		err = blockif_write(b->bc, br);
+		break;
+	default:
+		err = blockif_flush(b->bc, br);
+		break;
+	}
+	if (err) {
+		pthread_mutex_lock(&b->mtx);
+		b->errors++;
+		bench_retire(b);
+		pthread_mutex_unlock(&b->mtx);
+	}
+}
+
+/* submit the ready ios, unless a callback further up the stack does */
+static void
+bench_drain(struct bench *b)
+{
+	struct bench_io *io;
+
+	if (bench_nesting)
+		return;
+	bench_nesting++;
+	for (;;) {
+		pthread_mutex_lock(&b->mtx);
+		io = b->ready;
+		if (io)
+			b->ready = io->next;
+		pthread_mutex_unlock(&b->mtx);
+		if (io == NULL)
+			break;
+		bench_submit(io);
+	}
+	bench_nesting--;
+}
+
+static void
+bench_done(struct blockif_req *br, int err)
+{
+	struct bench_io *io = br->param;
+	struct bench *b = io->b;
+	struct bench_stats *st = &b->stats[io->kind];
+	uint64_t now = bench_now_ns(), lat = now - io->start_ns;
+
+	pthread_mutex_lock(&b->mtx);
+	if (err) {
+		b->errors++;
+	} else {
+		st->nr++;
+		if (io->kind != BENCH_FLUSH)
+			st->bytes += b->o->bs;
+		st->lat_sum_ns += lat;
+		if (lat > st->lat_max_ns)
+			st->lat_max_ns = lat;
+		st->hist[bench_lat_bucket(lat)]++;
+	}
+	b->last_ns = now;
+	if (now < b->end_ns) {
+		io->next = b->ready;
+		b->ready = io;
+	} else
+		bench_retire(b);
+	pthread_mutex_unlock(&b->mtx);
+
+	bench_drain(b);
+}
+
+/* on the iothread: the first request of each io */
+static void
+bench_kick(void *arg)
+{
+	struct bench *b = arg;
+	eventfd_t val;
+	int i;
+
+	if (eventfd_read(b->kick_fd, &val) < 0)
+		return;
+
+	pthread_mutex_lock(&b->mtx);
+	for (i = 0; i < b->depth; i++) {
+		b->ios[i].next = b->ready;
+		b->ready = &b->ios[i];
+	}
+	pthread_mutex_unlock(&b->mtx);
+	bench_drain(b);
+}
+
+static void
+bench_report(struct bench *b, const char *drive)
+{
+	const struct bench_opts *o = b->o;
+	const struct bench_stats *st;
+	double secs;
+	int k;
+
+	secs = (b->last_ns - b->start_ns) / 1e9;
+	if (secs <= 0)
+		secs = 1e-9;
+
+	printf("%s: %s %d%% reads, %zu bytes in %d iovecs%s, depth %d, %.2f s\n",
+		drive, o->seq ? "sequential" : "random", o->read_pct, o->bs,
+		o->iovs, o->misaligned ? " misaligned" : "", b->depth, secs);
+	for (k = 0; k < BENCH_KINDS; k++) {
+		st = &b->stats[k];
+		if (st->nr == 0)
+			continue;
+		printf("  %-5s iops %.0f, %.1f MiB/s, latency (us) avg %.1f, "
+			"p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+			bench_kind_names[k], st->nr / secs,
+			st->bytes / secs / (1024 * 1024),
+			st->lat_sum_ns / 1000.0 / st->nr,
+			bench_percentile_us(st, 50), bench_percentile_us(st, 90),
+			bench_percentile_us(st, 99), bench_percentile_us(st, 99.9),
+			st->lat_max_ns / 1000.0);
+	}
+	if (b->errors)
+		printf("  %lu errors\n", b->errors);
+}
+
+static int
+bench_run(const struct bench_opts *o, struct iothreads_info *iothrds,
+	  const char *drive)
+{
+	struct bench *b;
+	size_t buf_len;
+	int i, ret = -1;
+
+	b = calloc(1, sizeof(struct bench));
+	if (b == NULL)
+		return -1;
+	b->o = o;
+	b->rand = 0x9e3779b97f4a7c15ULL;
+	b->kick_fd = -1;
+	pthread_mutex_init(&b->mtx, NULL);
+	pthread_cond_init(&b->cond, NULL);
+
+	b->bc = blockif_open(NULL, drive, "bench", 1, iothrds);
+	if (b->bc == NULL) {
+		fprintf(stderr, "%s: failed to open\n", drive);
+		goto out;
+	}
+	if (o->bs % blockif_sectsz(b->bc) != 0) {
+		fprintf(stderr, "%s: the block size isn't a multiple of the "
+			"%d bytes sectors\n", drive, blockif_sectsz(b->bc));
+		goto out;
+	}
+	if (o->read_pct < 100 && blockif_is_ro(b->bc)) {
+		fprintf(stderr, "%s: the drive is read-only\n", drive);
+		goto out;
+	}
+	b->span = blockif_size(b->bc);
+	if (o->span && o->span < b->span)
+		b->span = o->span;
+	if (b->span < (off_t)o->bs) {
+		fprintf(stderr, "%s: smaller than a block\n", drive);
+		goto out;
+	}
+	b->depth = MIN(o->depth, blockif_queuesz(b->bc));
+
+	b->ios = calloc(b->depth, sizeof(struct bench_io));
+	if (b->ios == NULL)
+		goto out;
+	buf_len = o->bs + (o->misaligned ? BENCH_MISALIGN : 0);
+	for (i = 0; i < b->depth; i++) {
+		b->ios[i].b = b;
+		if (posix_memalign(&b->ios[i].buf, BENCH_BUF_ALIGN, buf_len) != 0) {
+			b->ios[i].buf = NULL;
+			goto out;
+		}
+		memset(b->ios[i].buf, 0x5a, buf_len);
+		if (o->misaligned)
+			b->ios[i].buf = (char *)b->ios[i].buf + BENCH_MISALIGN;
+	}
+
+	b->kick_fd = eventfd(0, EFD_NONBLOCK);
+	if (b->kick_fd < 0)
+		goto out;
+	b->kick_mevt.run = bench_kick;
+	b->kick_mevt.arg = b;
+	b->kick_mevt.fd = b->kick_fd;
+	if (iothread_add(iothrds->ioctx_base, b->kick_fd, &b->kick_mevt) < 0)
+		goto out;
+
+	b->active = b->depth;
+	b->start_ns = bench_now_ns();
+	b->last_ns = b->start_ns;
+	b->end_ns = b->start_ns + o->secs * NS_PER_SEC;
+	eventfd_write(b->kick_fd, 1);
+
+	pthread_mutex_lock(&b->mtx);
+	while (!b->done)
+		pthread_cond_wait(&b->cond, &b->mtx);
+	pthread_mutex_unlock(&b->mtx);
+
+	iothread_del(iothrds->ioctx_base, b->kick_fd);
+	bench_report(b, drive);
+	ret = 0;
+
+out:
+	if (b->bc)
+		blockif_close(b->bc);
+	if (b->kick_fd >= 0)
+		close(b->kick_fd);
+	if (b->ios) {
+		for (i = 0; i < b->depth; i++) {
+			if (b->ios[i].buf && o->misaligned)
+				b->ios[i].buf = (char *)b->ios[i].buf - BENCH_MISALIGN;
+			free(b->ios[i].buf);
+		}
+		free(b->ios);
+	}
+	pthread_cond_destroy(&b->cond);
+	pthread_mutex_destroy(&b->mtx);
+	free(b);
+	return ret;
+}
+
+static int
+bench_parse_int(const char *s, int min, int max, int *val)
+{
+	char *end;
+
+	if (dm_strtoi(s, &end, 10, val) || *end != '\0' ||
+	    *val < min || *val > max)
+		return -1;
+	return 0;
+}
+
+/* a size, with an optional k, m or g suffix */
+static int
+bench_parse_size(const char *s, uint64_t *size)
+{
+	char *end;
+	long val;
+
+	if (dm_strtol(s, &end, 0, &val) || val <= 0)
+		return -1;
+	switch (*end) {
+	case 'k': case 'K':
+		val <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		val <<= 20;
+		end++;
+		break;
+	case 'g': case 'G':
+		val <<= 30;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return -1;
+	*size = val;
+	return 0;
+}
+
+static void
+bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <drive>[,<blockif options>]...\n"
+		"  -b <size>    block size of the requests (4k)\n"
+		"  -v <n>       iovecs of a request (1)\n"
+		"  -u           misalign the buffers by %d bytes\n"
+		"  -q <depth>   requests in flight, up to %d (32)\n"
+		"  -S           sequential instead of random offsets\n"
+		"  -r <pct>     percentage of reads, the others write (100)\n"
+		"  -f <n>       a flush every n writes (never)\n"
+		"  -s <size>    only the first size bytes of the drive\n"
+		"  -t <secs>    duration of each run (10)\n"
+		"  -i <opts>    iothread of the io_uring completions, as the\n"
+		"               iothread option of virtio-blk (1)\n"
+		"  -V           show the messages of block_if\n"
+		"The drives are given as to virtio-blk, e.g. img,aio=io_uring,nocache.\n"
+		"Writes overwrite what the drives hold.\n",
+		prog, BENCH_MISALIGN, BENCH_DEPTH_MAX);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_opts o = {
+		.read_pct = 100,
+		.bs = 4096,
+		.iovs = 1,
+		.depth = 32,
+		.secs = 10,
+	};
+	struct iothreads_option iot_opt;
+	struct iothreads_info iothrds;
+	char *iot_str = NULL;
+	uint64_t val;
+	int c, i, ret = 0;
+
+	while ((c = getopt(argc, argv, "b:v:uq:Sr:f:s:t:i:Vh")) != -1) {
+		switch (c) {
+		case 'b':
+			if (bench_parse_size(optarg, &val) || val > SIZE_MAX)
+				goto usage;
+			o.bs = val;
+			break;
+		case 'v':
+			if (bench_parse_int(optarg, 1, BLOCKIF_IOV_MAX, &o.iovs))
+				goto usage;
+			break;
+		case 'u':
+			o.misaligned = true;
+			break;
+		case 'q':
+			if (bench_parse_int(optarg, 1, BENCH_DEPTH_MAX, &o.depth))
+				goto usage;
+			break;
+		case 'S':
+			o.seq = true;
+			break;
+		case 'r':
+			if (bench_parse_int(optarg, 0, 100, &o.read_pct))
+				goto usage;
+			break;
+		case 'f':
+			if (bench_parse_int(optarg, 0, INT_MAX, &o.flush_every))
+				goto usage;
+			break;
+		case 's':
+			if (bench_parse_size(optarg, &val))
+				goto usage;
+			o.span = val;
+			break;
+		case 't':
+			if (bench_parse_int(optarg, 1, INT_MAX, &o.secs))
+				goto usage;
+			break;
+		case 'i':
+			iot_str = optarg;
+			break;
+		case 'V':
+			bench_verbose = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc || o.bs % o.iovs != 0)
+		goto usage;
+
+	memset(&iot_opt, 0, sizeof(iot_opt));
+	if (iot_str && iothread_parse_options(iot_str, &iot_opt) < 0)
+		goto usage;
+	if (iot_opt.num <= 0)
+		iot_opt.num = 1;
+	snprintf(iot_opt.tag, sizeof(iot_opt.tag), "bench");
+	iothrds.ioctx_base = iothread_create(&iot_opt);
+	iothrds.num = iot_opt.num;
+	iothread_free_options(&iot_opt);
+	if (iothrds.ioctx_base == NULL) {
+		fprintf(stderr, "failed to create the iothreads\n");
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (bench_run(&o, &iothrds, argv[i]) < 0)
+			ret = 1;
+	}
+	iothread_deinit();
+	return ret;
+
+usage:
+	bench_usage(argv[0]);
+	return 1;
+}
@@ -25,6 +25,7 @@
 #include <asm/vmx.h>
 #include <asm/msr.h>
 #include <asm/host_pm.h>
+#include <asm/idle.h>
 #include <ptdev.h>
 #include <logmsg.h>
 #include <asm/rdt.h>
@@ -36,6 +37,7 @@
 #include <reloc.h>
 #include <asm/tsc.h>
 #include <ticks.h>
+#include <boot_time.h>
 #include <delay.h>
 #include <thermal.h>
 
@@ -56,6 +58,8 @@ static void set_current_pcpu_id(uint16_t pcpu_id);
 static void print_hv_banner(void);
 static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id);
 static uint64_t start_tick __attribute__((__section__(".bss_noinit")));
+/* the page colors of the last level cache, the pages of a color share its sets */
+static uint32_t llc_colors = 1U;
 
 /**
  * @pre phys_cpu_num <= MAX_PCPU_NUM
@@ -100,6 +104,14 @@ uint16_t get_pcpu_nums(void)
 	return phys_cpu_num;
 }
 
+/*
+ * @post return >= 1 && return <= MAX_LLC_COLORS
+ */
+uint32_t get_llc_colors(void)
+{
+	return llc_colors;
+}
+
 bool is_pcpu_active(uint16_t pcpu_id)
 {
 	return bitmap_test(pcpu_id, &pcpu_active_bitmap);
@@ -158,6 +170,8 @@ void init_pcpu_pre(bool is_bsp)
 
 		load_pcpu_state_data();
 
+		init_idle_states();
+
 		init_frequency_policy();
 
 		init_e820();
@@ -167,6 +181,7 @@ void init_pcpu_pre(bool is_bsp)
 
 		/* Initialize the hypervisor paging */
 		init_paging();
+		boot_time_mark(ACRN_BOOT_PAGING);
 
 		/*
 		 * Need update uart_base_address here for vaddr2paddr mapping may changed
@@ -187,6 +202,7 @@ void init_pcpu_pre(bool is_bsp)
 		if (!init_percpu_lapic_id()) {
 			panic("failed to init_percpu_lapic_id!");
 		}
+		boot_time_mark(ACRN_BOOT_ACPI);
 
 		ret = init_ioapic_id_info();
 		if (ret != 0) {
@@ -196,6 +212,7 @@ void init_pcpu_pre(bool is_bsp)
 #ifdef CONFIG_VCAT_ENABLED
 		init_intercepted_cat_msr_list();
 #endif
+		init_emulated_msr_index();
 
 		/* NOTE: this must call after MMCONFIG is parsed in acpi_fixup() and before APs are INIT.
 		 * We only support platform with MMIO based CFG space access.
@@ -223,6 +240,43 @@ void init_pcpu_pre(bool is_bsp)
 	pcpu_set_current_state(pcpu_id, PCPU_STATE_INITIALIZING);
 }
 
+/*
+ * CPUID.04H enumerates the caches of this pCPU by ascending level, the
+ * APIC IDs of the pCPUs sharing a cache only differ in the low bits that
+ * cover the maximum number of logical processors sharing it.
+ */
+static void init_pcpu_cache_topology(uint16_t pcpu_id)
+{
+	uint32_t eax, ebx, ecx, unused, subleaf, nr_sharing, shift;
+	uint32_t lapic_id = per_cpu(lapic_id, pcpu_id);
+	uint64_t way_size = 0UL;
+
+	per_cpu(l2_id, pcpu_id) = lapic_id;
+	per_cpu(llc_id, pcpu_id) = lapic_id;
+	for (subleaf = 0U; subleaf < 8U; subleaf++) {
+		cpuid_subleaf(CPUID_CACHE, subleaf, &eax, &ebx, &ecx, &unused);
+		/* EAX[4:0] is 0 when there are no more caches */
+		if ((eax & 0x1fU) == 0U) {
+			break;
+		}
+
+		/* EAX[25:14] is the maximum number of logical processors sharing the cache, minus 1 */
+		nr_sharing = (eax >> 14U) & 0xfffU;
+		shift = (nr_sharing == 0U) ? 0U : ((uint32_t)fls32(nr_sharing) + 1U);
+		if (((eax >> 5U) & 0x7U) == 2U) {
+			per_cpu(l2_id, pcpu_id) = lapic_id >> shift;
+		}
+		per_cpu(llc_id, pcpu_id) = lapic_id >> shift;
+
+		/* the bytes of a way: line size (EBX[11:0]), partitions (EBX[21:12]) and sets (ECX), all minus 1 */
+		way_size = (uint64_t)((ebx & 0xfffU) + 1U) * (((ebx >> 12U) & 0x3ffU) + 1U) * ((uint64_t)ecx + 1UL);
+	}
+
+	if (pcpu_id == BSP_CPU_ID) {
+		llc_colors = (uint32_t)clamp(way_size >> PAGE_SHIFT, 1UL, (uint64_t)MAX_LLC_COLORS);
+	}
+}
+
 void init_pcpu_post(uint16_t pcpu_id)
 {
 #ifdef STACK_PROTECTOR
@@ -248,6 +302,7 @@ void init_pcpu_post(uint16_t pcpu_id)
 
 		/* Calibrate TSC Frequency */
 		calibrate_tsc();
+		boot_time_mark(ACRN_BOOT_TSC_CALIBRATED);
 
 		pr_acrnlog("HV: %s-%s-%s %s%s%s%s %s@%s build by %s, start time %luus",
 				HV_BRANCH_VERSION, HV_COMMIT_TIME, HV_COMMIT_DIRTY, HV_BUILD_TYPE,
@@ -276,11 +331,13 @@ void init_pcpu_post(uint16_t pcpu_id)
 		if (init_iommu() != 0) {
 			panic("failed to initialize iommu!");
 		}
+		boot_time_mark(ACRN_BOOT_IOMMU);
 
 #ifdef CONFIG_IVSHMEM_ENABLED
 		init_ivshmem_shared_memory();
 #endif
 		init_pci_pdev_list(); /* init_iommu must come before this */
+		boot_time_mark(ACRN_BOOT_PCI);
 		ptdev_init();
 
 		if (init_sgx() != 0) {
@@ -291,6 +348,7 @@ void init_pcpu_post(uint16_t pcpu_id)
 		 * Reserve memory from platform E820 for EPT 4K pages for all VMs
 		 */
 		reserve_buffer_for_ept_pages();
+		boot_time_mark(ACRN_BOOT_EPT_POOL);
 
 		init_vept();
 
@@ -300,6 +358,7 @@ void init_pcpu_post(uint16_t pcpu_id)
 		if (!start_pcpus(AP_MASK)) {
 			panic("Failed to start all secondary cores!");
 		}
+		boot_time_mark(ACRN_BOOT_APS_UP);
 
 		ASSERT(get_pcpu_id() == BSP_CPU_ID, "");
 	} else {
@@ -321,6 +380,7 @@ void init_pcpu_post(uint16_t pcpu_id)
 
 	apply_frequency_policy();
 
+	init_pcpu_cache_topology(pcpu_id);
 	init_sched(pcpu_id);
 
 #ifdef CONFIG_RDT_ENABLED
@@ -336,6 +396,10 @@ void init_pcpu_post(uint16_t pcpu_id)
 	bitmap_clear_lock(pcpu_id, &pcpu_sync);
 	/* Waiting for each pCPU has done its initialization before to continue */
 	wait_sync_change(&pcpu_sync, 0UL);
+
+	if (pcpu_id == BSP_CPU_ID) {
+		boot_time_mark(ACRN_BOOT_PCPUS_READY);
+	}
 }
 
 static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
@@ -353,26 +417,25 @@ static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
 	return pcpu_id;
 }
 
+/*
+ * Each AP finds its own stack in the trampoline by its x2APIC ID, so that
+ * they are all sent the startup IPIs before waiting for any of them.
+ */
 static void start_pcpu(uint16_t pcpu_id)
 {
-	uint32_t timeout;
-
-	/* Update the stack for pcpu */
-	stac();
-	write_trampoline_stack_sym(pcpu_id);
-	clac();
-
-	/* Using the MFENCE to make sure trampoline code
-	 * has been updated (clflush) into memory beforing start APs.
-	 */
-	cpu_memory_barrier();
 	send_startup_ipi(pcpu_id, startup_paddr);
+}
 
-	/* Wait until the pcpu with pcpu_id is running and set the active bitmap or
+static void wait_pcpus_up(uint64_t mask)
+{
+	uint32_t timeout;
+	uint16_t i;
+
+	/* Wait until the pcpus in mask are running and set the active bitmap or
 	 * configured time-out has expired
 	 */
 	timeout = CPU_UP_TIMEOUT * 1000U;
-	while (!is_pcpu_active(pcpu_id) && (timeout != 0U)) {
+	while (((pcpu_active_bitmap & mask) != mask) && (timeout != 0U)) {
 		/* Delay 10us */
 		udelay(10U);
 
@@ -380,10 +443,12 @@ static void start_pcpu(uint16_t pcpu_id)
 		timeout -= 10U;
 	}
 
-	/* Check to see if expected CPU is actually up */
-	if (!is_pcpu_active(pcpu_id)) {
-		pr_fatal("Secondary CPU%hu failed to come up", pcpu_id);
-		pcpu_set_current_state(pcpu_id, PCPU_STATE_DEAD);
+	/* Check to see if expected CPUs are actually up */
+	for (i = 0U; i < phys_cpu_num; i++) {
+		if (bitmap_test(i, &mask) && !is_pcpu_active(i)) {
+			pr_fatal("Secondary CPU%hu failed to come up", i);
+			pcpu_set_current_state(i, PCPU_STATE_DEAD);
+		}
 	}
 }
 
@@ -402,6 +467,16 @@ bool start_pcpus(uint64_t mask)
 	uint16_t pcpu_id = get_pcpu_id();
 	uint64_t expected_start_mask = mask;
 
+	/* Update the stacks of the pcpus */
+	stac();
+	write_trampoline_stack_syms();
+	clac();
+
+	/* Using the MFENCE to make sure trampoline code
+	 * has been updated (clflush) into memory beforing start APs.
+	 */
+	cpu_memory_barrier();
+
 	i = ffs64(expected_start_mask);
 	while (i != INVALID_BIT_INDEX) {
 		bitmap_clear_nolock(i, &expected_start_mask);
@@ -414,6 +489,9 @@ bool start_pcpus(uint64_t mask)
 		i = ffs64(expected_start_mask);
 	}
 
+	bitmap_clear_nolock(pcpu_id, &mask);
+	wait_pcpus_up(mask);
+
 	return ((pcpu_active_bitmap & mask) == mask);
 }
 
@@ -471,7 +549,7 @@ void cpu_do_idle(void)
 	uint16_t pcpu_id = get_pcpu_id();
 
 	if (per_cpu(mode_to_idle, pcpu_id) == IDLE_MODE_HLT) {
-		asm_safe_hlt();
+		enter_idle_state(pcpu_id);
 	} else {
 		struct acrn_vcpu *vcpu = get_ever_run_vcpu(pcpu_id);
 
@@ -533,12 +611,6 @@ static void print_hv_banner(void)
 	printf(boot_msg);
 }
 
-static
-inline void asm_monitor(volatile const uint64_t *addr, uint64_t ecx, uint64_t edx)
-{
-	asm volatile("monitor\n" : : "a" (addr), "c" (ecx), "d" (edx));
-}
-
 static
 inline void asm_mwait(uint64_t eax, uint64_t ecx)
 {
@@ -570,6 +642,9 @@ static void init_pcpu_xsave(void)
 	uint64_t xcr0, xss;
 	uint32_t eax, ecx, unused, xsave_area_size;
 
+	/* the registers hold no state of any vCPU yet, or not any more after S3 */
+	get_cpu_var(whose_xsave) = NULL;
+
 	if (pcpu_has_cap(X86_FEATURE_XSAVE)) {
 		CPU_CR_READ(cr4, &val64);
 		val64 |= CR4_OSXSAVE;
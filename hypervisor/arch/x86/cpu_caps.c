@@ -34,6 +34,13 @@
 static struct cpu_capability {
 	uint8_t apicv_features;
 	uint8_t ept_features;
+	bool pml_supported;
+	bool ptimer_supported;
+	/* the VMX preemption timer counts down once every 2^ptimer_shift TSC cycles */
+	uint8_t ptimer_shift;
+	bool tsc_scaling_supported;
+	/* VM exits on INS/OUTS report their address size and segment */
+	bool ins_outs_info;
 
 	uint64_t vmx_ept_vpid;
 	uint32_t core_caps;	/* value of MSR_IA32_CORE_CAPABLITIES */
@@ -236,6 +243,7 @@ static void detect_ept_cap(void)
 		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_EPT)) {
 			cpu_caps.ept_features = 1U;
 		}
+		cpu_caps.pml_supported = is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_PML);
 	}
 }
 
@@ -273,6 +281,21 @@ static void detect_apicv_cap(void)
 	vlapic_set_apicv_ops();
 }
 
+static void detect_vmx_timer_cap(void)
+{
+	uint64_t msr_val = msr_read(MSR_IA32_VMX_PINBASED_CTLS);
+
+	cpu_caps.ptimer_supported = is_ctrl_setting_allowed(msr_val, VMX_PINBASED_CTLS_ENABLE_PTMR);
+	cpu_caps.ptimer_shift = (uint8_t)(msr_read(MSR_IA32_VMX_MISC) & MSR_IA32_MISC_PREEMPT_TIMER_RATE);
+	cpu_caps.tsc_scaling_supported = is_ctrl_setting_allowed(msr_read(MSR_IA32_VMX_PROCBASED_CTLS2),
+			VMX_PROCBASED_CTLS2_TSC_SCALING);
+}
+
+static void detect_vmx_exit_info_cap(void)
+{
+	cpu_caps.ins_outs_info = ((msr_read(MSR_IA32_VMX_BASIC) & MSR_IA32_VMX_BASIC_INS_OUTS_INFO) != 0UL);
+}
+
 static void detect_vmx_mmu_cap(void)
 {
 	/* Read the MSR register of EPT and VPID Capability -  SDM A.10 */
@@ -312,6 +335,8 @@ static void detect_pcpu_cap(void)
 	detect_apicv_cap();
 	detect_ept_cap();
 	detect_vmx_mmu_cap();
+	detect_vmx_timer_cap();
+	detect_vmx_exit_info_cap();
 	detect_xsave_cap();
 	detect_core_caps();
 }
@@ -410,6 +435,31 @@ bool pcpu_has_vmx_ept_vpid_cap(uint64_t bit_mask)
 	return ((cpu_caps.vmx_ept_vpid & bit_mask) != 0U);
 }
 
+bool is_pml_supported(void)
+{
+	return (cpu_caps.pml_supported && pcpu_has_vmx_ept_vpid_cap(VMX_EPT_AD));
+}
+
+bool is_vmx_preemption_timer_supported(void)
+{
+	return cpu_caps.ptimer_supported;
+}
+
+bool is_vmx_tsc_scaling_supported(void)
+{
+	return cpu_caps.tsc_scaling_supported;
+}
+
+bool is_vmx_ins_outs_info_supported(void)
+{
+	return cpu_caps.ins_outs_info;
+}
+
+uint32_t vmx_preemption_timer_shift(void)
+{
+	return (uint32_t)cpu_caps.ptimer_shift;
+}
+
 void init_pcpu_model_name(void)
 {
 	cpuid_subleaf(CPUID_EXTEND_FUNCTION_2, 0x0U,
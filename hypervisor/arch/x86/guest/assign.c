@@ -15,6 +15,7 @@
 #include <asm/pgtable.h>
 #include <asm/irq.h>
 #include <asm/guest/optee.h>
+#include <trace.h>
 
 /*
  * Check if the IRQ is single-destination and return the destination vCPU if so.
@@ -51,6 +52,12 @@ static struct acrn_vcpu *is_single_destination(struct acrn_vm *vm, const struct
 	return vcpu;
 }
 
+/* the vLAPIC delivers the MSI to the lowest priority vCPU of its destination */
+static inline bool is_msi_lowprio(const struct msi_info *info)
+{
+	return ((info->data.bits.delivery_mode == MSI_DATA_DELMODE_LOPRI) || (info->addr.bits.rh == MSI_ADDR_RH));
+}
+
 static uint32_t calculate_logical_dest_mask(uint64_t pdmask)
 {
 	uint32_t dest_cluster_id = 0U, cluster_id, logical_id_mask = 0U;
@@ -131,6 +138,12 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm,
 		delmode = MSI_DATA_DELMODE_LOPRI;
 	}
 
+	/* a steered lowest priority MSI only goes to the pCPU of the vCPU taking it */
+	if (is_msi_lowprio(&entry->vmsi) && (entry->steer_pcpu_id != INVALID_CPU_ID)
+			&& ((pdmask & (1UL << entry->steer_pcpu_id)) != 0UL)) {
+		pdmask = 1UL << entry->steer_pcpu_id;
+	}
+
 	dest_mask = calculate_logical_dest_mask(pdmask);
 
 	/* Using phys_irq as index in the corresponding IOMMU */
@@ -524,29 +537,70 @@ static void ptirq_handle_intx(struct acrn_vm *vm,
 	}
 }
 
-void ptirq_softirq(uint16_t pcpu_id)
+/* remote injections to the same pCPU in a row before the MSI is steered to it */
+#define PTIRQ_STEER_STREAK	8U
+
+/*
+ * Count the MSIs taken on another pCPU than the one running their destination
+ * vCPU, each of them costs a notification IPI. A lowest priority MSI that keeps
+ * going to the vCPU of the same remote pCPU is steered there: its IRTE
+ * destination is narrowed to that pCPU, until the guest programs the MSI again.
+ *
+ * @pre entry->intr_type == PTDEV_INTR_MSI
+ */
+static void ptirq_account_msi_dest(struct ptirq_remapping_info *entry, uint16_t pcpu_id)
 {
-	while (1) {
-		struct ptirq_remapping_info *entry = ptirq_dequeue_softirq(pcpu_id);
-		struct msi_info *vmsi;
+	const struct msi_info *vmsi = &entry->vmsi;
+	struct acrn_vm *vm = entry->vm;
+	uint64_t vdmask, pdmask, rflags;
+	uint16_t dest_pcpu_id;
+	bool lowprio = is_msi_lowprio(vmsi);
+
+	vdmask = vlapic_calc_dest_noshort(vm, false, (uint32_t)(vmsi->addr.bits.dest_field),
+		(vmsi->addr.bits.dest_mode == MSI_ADDR_DESTMODE_PHYS), lowprio);
+	pdmask = vcpumask2pcpumask(vm, vdmask);
 
-		if (entry == NULL) {
-			break;
+	if ((pdmask & ~(1UL << pcpu_id)) == 0UL) {
+		entry->remote_streak = 0U;
+	} else {
+		entry->remote_count++;
+		dest_pcpu_id = ffs64(pdmask);
+
+		/* only the remapped MSIs of a single vCPU, the ones in compatibility format are in the device */
+		if (lowprio && (pdmask == (1UL << dest_pcpu_id)) && !is_lapic_pt_configured(vm)
+				&& (entry->pmsi.addr.ir_bits.intr_format != 0U)) {
+			if (dest_pcpu_id != entry->remote_pcpu_id) {
+				entry->remote_pcpu_id = dest_pcpu_id;
+				entry->remote_streak = 0U;
+			}
+			entry->remote_streak++;
+
+			if ((entry->remote_streak >= PTIRQ_STEER_STREAK) && (dest_pcpu_id != entry->steer_pcpu_id)) {
+				spinlock_irqsave_obtain(&entry->remap_lock, &rflags);
+				entry->steer_pcpu_id = dest_pcpu_id;
+				ptirq_build_physical_msi(vm, entry, irq_to_vector(entry->allocated_pirq), 0UL,
+					entry->irte_idx);
+				spinlock_irqrestore_release(&entry->remap_lock, rflags);
+				entry->remote_streak = 0U;
+				dev_dbg(DBG_LEVEL_PTIRQ, "dev-assign: irq=0x%x MSI steered to pCPU%hu",
+					entry->allocated_pirq, dest_pcpu_id);
+			}
 		}
+	}
+}
 
-		vmsi = &entry->vmsi;
-
-		/* skip any inactive entry */
-		if (!is_entry_active(entry)) {
-			/* service next item */
-			continue;
-		}
+static void ptirq_inject_entry(struct ptirq_remapping_info *entry, uint16_t pcpu_id)
+{
+	struct msi_info *vmsi = &entry->vmsi;
 
+	/* skip any inactive entry */
+	if (is_entry_active(entry)) {
 		/* handle real request */
 		if (entry->intr_type == PTDEV_INTR_INTX) {
 			ptirq_handle_intx(entry->vm, entry);
 		} else {
 			if (vmsi != NULL) {
+				ptirq_account_msi_dest(entry, pcpu_id);
 				/* TODO: vmsi destmode check required */
 				(void)vlapic_inject_msi(entry->vm, vmsi->addr.full, vmsi->data.full);
 				dev_dbg(DBG_LEVEL_PTIRQ, "dev-assign: irq=0x%x MSI VR: 0x%x-0x%x",
@@ -561,6 +615,24 @@ void ptirq_softirq(uint16_t pcpu_id)
 	}
 }
 
+#define PTIRQ_SOFTIRQ_BATCH	32U
+
+void ptirq_softirq(uint16_t pcpu_id)
+{
+	struct ptirq_remapping_info *batch[PTIRQ_SOFTIRQ_BATCH];
+	uint32_t nr, i;
+
+	/* inject every queued entry in this pass, interrupts are disabled once per batch */
+	nr = ptirq_dequeue_softirq_batch(pcpu_id, batch, PTIRQ_SOFTIRQ_BATCH);
+	while (nr != 0U) {
+		TRACE_2L(TRACE_PTIRQ_BATCH, (uint64_t)pcpu_id, (uint64_t)nr);
+		for (i = 0U; i < nr; i++) {
+			ptirq_inject_entry(batch[i], pcpu_id);
+		}
+		nr = ptirq_dequeue_softirq_batch(pcpu_id, batch, PTIRQ_SOFTIRQ_BATCH);
+	}
+}
+
 void ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_ctlr)
 {
 	uint32_t phys_irq;
@@ -612,18 +684,32 @@ int32_t ptirq_prepare_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t
 	struct ptirq_remapping_info *entry;
 	int32_t ret = -ENODEV;
 	union pci_bdf vbdf;
+	DEFINE_MSI_SID(phys_sid, phys_bdf, entry_nr);
+
+	atomic_inc64(&vm->ptirq_msi_remaps);
 
 	/*
-	 * adds the mapping entries at runtime, if the
-	 * entry already be held by others, return error.
+	 * A guest reprogramming its vectors remaps entries it holds already, found
+	 * without ptdev_lock. Otherwise it adds the mapping entries at runtime, if
+	 * the entry already be held by others, return error.
 	 */
-	spinlock_obtain(&ptdev_lock);
-	entry = add_msix_remapping(vm, virt_bdf, phys_bdf, entry_nr);
-	spinlock_release(&ptdev_lock);
+	entry = find_ptirq_entry(PTDEV_INTR_MSI, &phys_sid, NULL);
+	if (entry == NULL) {
+		spinlock_obtain(&ptdev_lock);
+		entry = add_msix_remapping(vm, virt_bdf, phys_bdf, entry_nr);
+		spinlock_release(&ptdev_lock);
+	}
 
 	if (entry != NULL) {
+		uint64_t rflags;
+
 		ret = 0;
+		spinlock_irqsave_obtain(&entry->remap_lock, &rflags);
 		entry->vmsi = *info;
+		/* the new destination of the guest drops the steering */
+		entry->remote_pcpu_id = INVALID_CPU_ID;
+		entry->remote_streak = 0U;
+		entry->steer_pcpu_id = INVALID_CPU_ID;
 
 		/* build physical config MSI, update to info->pmsi_xxx */
 		if (is_lapic_pt_configured(vm)) {
@@ -672,6 +758,7 @@ int32_t ptirq_prepare_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t
 				vbdf.bits.b, vbdf.bits.d, vbdf.bits.f, entry_nr, entry->vmsi.data.bits.vector,
 				irq_to_vector(entry->allocated_pirq), entry->vm->vm_id);
 		}
+		spinlock_irqrestore_release(&entry->remap_lock, rflags);
 	}
 
 	return ret;
@@ -730,6 +817,8 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 
 	/* no remap for vuart intx */
 	if (!is_vuart_intx(vm, virt_sid.intx_id.gsi)) {
+		atomic_inc64(&vm->ptirq_intx_remaps);
+
 		/* query if we have virt to phys mapping */
 		spinlock_obtain(&ptdev_lock);
 		entry = find_ptirq_entry(PTDEV_INTR_INTX, &virt_sid, vm);
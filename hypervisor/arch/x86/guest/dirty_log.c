@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <asm/lib/bits.h>
+#include <asm/lib/atomic.h>
+#include <asm/cpu.h>
+#include <asm/cpu_caps.h>
+#include <asm/notify.h>
+#include <asm/pgtable.h>
+#include <asm/vmx.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/virq.h>
+#include <asm/guest/ept.h>
+#include <asm/guest/guest_memory.h>
+#include <asm/guest/dirty_log.h>
+#include <logmsg.h>
+
+#define EPT_DIRTY_POS		9U
+/* the bitmap words copied out at a time by dirty_log_get() */
+#define DIRTY_LOG_COPY_WORDS	16U
+
+void init_dirty_log(struct acrn_vm *vm)
+{
+	struct dirty_log *log = &vm->arch_vm.dirty_log;
+
+	spinlock_init(&log->lock);
+	log->enabled = false;
+	log->gpa = 0UL;
+	log->size = 0UL;
+	log->bitmap = NULL;
+}
+
+static void dirty_log_nop(__unused void *data)
+{
+}
+
+/*
+ * Make each vCPU of vm in non-root mode exit. It then only enters again after
+ * handling its pending requests, so those made before are in effect for any
+ * guest instruction run after the return, without waiting for the vCPUs.
+ */
+void dirty_log_sync(struct acrn_vm *vm, uint16_t request)
+{
+	struct acrn_vcpu *vcpu;
+	uint64_t mask = 0UL;
+	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, request);
+		bitmap_set_nolock(pcpuid_from_vcpu(vcpu), &mask);
+	}
+
+	if (vm->state == VM_RUNNING) {
+		smp_call_function(mask, dirty_log_nop, NULL);
+	}
+}
+
+void dirty_log_apply(struct acrn_vcpu *vcpu)
+{
+	bool enable = vcpu->vm->arch_vm.dirty_log.enabled;
+	/* the working set estimation needs the EPT accessed flags as well */
+	bool ad = enable || vcpu->vm->arch_vm.wss.enabled;
+	uint32_t ctrls2;
+	uint64_t eptp;
+
+	if (enable != vcpu->arch.pml_enabled) {
+		ctrls2 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS2);
+		if (enable) {
+			exec_vmwrite64(VMX_PML_ADDR_FULL, hva2hpa(vcpu->arch.pml_buf));
+			exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(VMX_PML_ENTRY_NUM - 1U));
+			ctrls2 |= VMX_PROCBASED_CTLS2_PML;
+		} else {
+			dirty_log_drain(vcpu);
+			ctrls2 &= ~VMX_PROCBASED_CTLS2_PML;
+		}
+		exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, ctrls2);
+		vcpu->arch.pml_enabled = enable;
+	}
+
+	eptp = exec_vmread64(VMX_EPT_POINTER_FULL);
+	if (ad != ((eptp & VMX_EPTP_AD_ENABLE_BIT) != 0UL)) {
+		exec_vmwrite64(VMX_EPT_POINTER_FULL, eptp ^ VMX_EPTP_AD_ENABLE_BIT);
+	}
+}
+
+void dirty_log_drain(struct acrn_vcpu *vcpu)
+{
+	struct dirty_log *log = &vcpu->vm->arch_vm.dirty_log;
+	uint16_t index = exec_vmread16(VMX_GUEST_PML_INDEX);
+	uint64_t gpa, page;
+	uint16_t i;
+
+	if (index != (uint16_t)(VMX_PML_ENTRY_NUM - 1U)) {
+		/* the index wraps to 0xFFFFU once the last entry is written */
+		i = (index < VMX_PML_ENTRY_NUM) ? (index + 1U) : 0U;
+
+		spinlock_obtain(&log->lock);
+		if (log->enabled) {
+			stac();
+			for (; i < VMX_PML_ENTRY_NUM; i++) {
+				gpa = vcpu->arch.pml_buf[i];
+				page = (gpa - log->gpa) >> PAGE_SHIFT;
+				/* the pages out of the range are logged at most once, their flag is never cleared */
+				if ((gpa >= log->gpa) && (page < (log->size >> PAGE_SHIFT))) {
+					bitmap_set_lock((uint16_t)(page & 0x3FUL), &log->bitmap[page >> 6U]);
+				}
+			}
+			clac();
+		}
+		spinlock_release(&log->lock);
+
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(VMX_PML_ENTRY_NUM - 1U));
+	}
+}
+
+int32_t pml_full_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+{
+	/* run_vcpu() drained the buffer on the exit, the write is retried on entry */
+	return 0;
+}
+
+int32_t dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t *bitmap)
+{
+	struct dirty_log *log = &vm->arch_vm.dirty_log;
+	int32_t ret = -EINVAL;
+
+	if (!is_pml_supported()) {
+		ret = -ENODEV;
+	} else if (is_lapic_pt_configured(vm) || is_nvmx_configured(vm) ||
+			(vm->sworld_control.flag.supported != 0UL)) {
+		/* their vCPUs run with other EPTPs or can't be kicked */
+		pr_err("%s: vm%hu doesn't support dirty logging", __func__, vm->vm_id);
+	} else if ((size == 0UL) || (!mem_aligned_check(gpa, PAGE_SIZE)) ||
+			(!mem_aligned_check(size, PAGE_SIZE)) || ((gpa + size) < gpa) || (bitmap == NULL)) {
+		pr_err("%s: invalid range 0x%lx, size 0x%lx", __func__, gpa, size);
+	} else {
+		spinlock_obtain(&vm->ept_lock);
+		if (!log->enabled) {
+			/* a large page would only be logged on its first write */
+			pgtable_split_map((uint64_t *)vm->arch_vm.nworld_eptp, gpa, size, &vm->arch_vm.ept_pgtable);
+
+			stac();
+			(void)memset((void *)bitmap, 0U, (((size >> PAGE_SHIFT) + 63UL) >> 6U) << 3U);
+			clac();
+
+			spinlock_obtain(&log->lock);
+			log->gpa = gpa;
+			log->size = size;
+			log->bitmap = bitmap;
+			log->enabled = true;
+			spinlock_release(&log->lock);
+			ret = 0;
+		}
+		spinlock_release(&vm->ept_lock);
+
+		if (ret == 0) {
+			/* the TLB entries of the split large pages go with the flush */
+			dirty_log_sync(vm, ACRN_REQUEST_EPT_FLUSH);
+			dirty_log_sync(vm, ACRN_REQUEST_DIRTY_LOG);
+		} else {
+			pr_err("%s: vm%hu is already logging", __func__, vm->vm_id);
+		}
+	}
+
+	return ret;
+}
+
+void dirty_log_stop(struct acrn_vm *vm)
+{
+	struct dirty_log *log = &vm->arch_vm.dirty_log;
+	uint64_t gpa = 0UL, size = 0UL;
+	bool stopped = false;
+
+	spinlock_obtain(&vm->ept_lock);
+	if (log->enabled) {
+		spinlock_obtain(&log->lock);
+		gpa = log->gpa;
+		size = log->size;
+		log->enabled = false;
+		log->bitmap = NULL;
+		spinlock_release(&log->lock);
+		stopped = true;
+	}
+	spinlock_release(&vm->ept_lock);
+
+	if (stopped) {
+		dirty_log_sync(vm, ACRN_REQUEST_DIRTY_LOG);
+		/* with no vCPU setting them any more, clear the flags for the range to coalesce */
+		ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa, size, 0UL, EPT_ACCESSED | EPT_DIRTY);
+	}
+}
+
+/* clear the EPT dirty flags of the pages in bits, the word of the log at gpa */
+static void clear_dirty_flags(struct acrn_vm *vm, uint64_t gpa, uint64_t bits)
+{
+	const uint64_t *pte;
+	uint64_t pg_size, word = bits;
+	uint16_t bit;
+
+	while (word != 0UL) {
+		bit = ffs64(word);
+		bitmap_clear_nolock(bit, &word);
+		pte = pgtable_lookup_entry((uint64_t *)vm->arch_vm.nworld_eptp, gpa + ((uint64_t)bit << PAGE_SHIFT),
+				&pg_size, &vm->arch_vm.ept_pgtable);
+		if ((pte != NULL) && (pg_size == PTE_SIZE)) {
+			bitmap_clear_lock(EPT_DIRTY_POS, (uint64_t *)pte);
+		}
+	}
+}
+
+/* put the bits of a word back into the log, after a failed copy */
+static void restore_dirty_bits(uint64_t *word, uint64_t bits)
+{
+	uint64_t left = bits;
+	uint16_t bit;
+
+	stac();
+	while (left != 0UL) {
+		bit = ffs64(left);
+		bitmap_clear_nolock(bit, &left);
+		bitmap_set_lock(bit, word);
+	}
+	clac();
+}
+
+int32_t dirty_log_get(struct acrn_vm *vm, uint64_t gpa, uint64_t size,
+		struct acrn_vm *service_vm, uint64_t bitmap_gpa, uint64_t *nr_dirty)
+{
+	struct dirty_log *log = &vm->arch_vm.dirty_log;
+	uint64_t buf[DIRTY_LOG_COPY_WORDS];
+	uint64_t first, nr_pages, nr_words, i, k, n, bits, dirty = 0UL;
+	uint64_t *word;
+	uint16_t bit;
+	int32_t ret = -EINVAL;
+
+	/* the vCPUs in non-root mode drain their PML buffers on the exit */
+	dirty_log_sync(vm, ACRN_REQUEST_DIRTY_LOG);
+
+	spinlock_obtain(&vm->ept_lock);
+	if (log->enabled && (gpa >= log->gpa) && (size != 0UL) && mem_aligned_check(size, PAGE_SIZE) &&
+			((gpa + size) > gpa) && ((gpa + size) <= (log->gpa + log->size)) &&
+			mem_aligned_check(gpa - log->gpa, PAGE_SIZE * 64UL)) {
+		first = (gpa - log->gpa) >> PAGE_SHIFT;
+		nr_pages = size >> PAGE_SHIFT;
+		nr_words = (nr_pages + 63UL) >> 6U;
+		/* checked first, the bits got can't be put anywhere else */
+		if (ept_is_valid_mr(service_vm, bitmap_gpa, nr_words << 3U)) {
+			ret = 0;
+		}
+
+		for (i = 0UL; (i < nr_words) && (ret == 0); i++) {
+			word = &log->bitmap[(first >> 6U) + i];
+			n = i % DIRTY_LOG_COPY_WORDS;
+
+			stac();
+			if (((i + 1UL) < nr_words) || ((nr_pages & 0x3FUL) == 0UL)) {
+				bits = atomic_readandclear64(word);
+			} else {
+				/* the rest of the last word is out of the range */
+				bits = 0UL;
+				for (bit = 0U; bit < (uint16_t)(nr_pages & 0x3FUL); bit++) {
+					if (bitmap_test_and_clear_lock(bit, word)) {
+						bitmap_set_nolock(bit, &bits);
+					}
+				}
+			}
+			clac();
+
+			clear_dirty_flags(vm, gpa + ((i << 6U) << PAGE_SHIFT), bits);
+			dirty += bitmap_weight(bits);
+			buf[n] = bits;
+
+			if (((n + 1UL) == DIRTY_LOG_COPY_WORDS) || ((i + 1UL) == nr_words)) {
+				if (copy_to_gpa(service_vm, buf, bitmap_gpa + ((i - n) << 3U),
+						(uint32_t)((n + 1UL) << 3U)) != 0) {
+					word = &log->bitmap[(first >> 6U) + (i - n)];
+					for (k = 0UL; k <= n; k++) {
+						restore_dirty_bits(word + k, buf[k]);
+					}
+					ret = -EFAULT;
+				}
+			}
+		}
+	}
+	spinlock_release(&vm->ept_lock);
+
+	/* a TLB entry caching a cleared flag would let the page be written unlogged */
+	if (dirty != 0UL) {
+		dirty_log_sync(vm, ACRN_REQUEST_EPT_FLUSH);
+	}
+
+	if (ret == 0) {
+		*nr_dirty = dirty;
+	} else {
+		pr_err("%s: vm%hu failed to get the log of 0x%lx, size 0x%lx", __func__, vm->vm_id, gpa, size);
+	}
+
+	return ret;
+}
@@ -75,6 +75,7 @@ static struct page ept_dummy_pages[CONFIG_MAX_VM_NUM];
 
 /* ept: extended page pool*/
 static struct page_pool ept_page_pool[CONFIG_MAX_VM_NUM];
+static struct page_cache ept_page_caches[CONFIG_MAX_VM_NUM][MAX_PCPU_NUM];
 
 static void reserve_ept_bitmap(void)
 {
@@ -176,10 +177,7 @@ void init_ept_pgtable(struct pgtable *table, uint16_t vm_id)
 	ept_page_pool[vm_id].bitmap_size = get_ept_page_num() / 64;
 	ept_page_pool[vm_id].bitmap = ept_page_bitmap[vm_id];
 	ept_page_pool[vm_id].dummy_page = &ept_dummy_pages[vm_id];
-
-	spinlock_init(&ept_page_pool[vm_id].lock);
-	memset((void *)ept_page_pool[vm_id].bitmap, 0, ept_page_pool[vm_id].bitmap_size * sizeof(uint64_t));
-	ept_page_pool[vm_id].last_hint_id = 0UL;
+	reset_page_pool(&ept_page_pool[vm_id], ept_page_caches[vm_id]);
 
 	table->pool = &ept_page_pool[vm_id];
 	table->default_access_right = EPT_RWX;
@@ -304,18 +302,94 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-static inline void ept_flush_guest(struct acrn_vm *vm)
+/*
+ * Free the retired EPT table pages the last flush request covers, no vCPU can walk them any more.
+ *
+ * @pre vm->ept_lock is held
+ */
+static void ept_free_retired(struct acrn_vm *vm)
+{
+	struct pgtable_retired *retired = &vm->arch_vm.ept_retired;
+	uint32_t i, nr = vm->arch_vm.ept_retired_flushing;
+
+	for (i = 0U; i < nr; i++) {
+		free_page(vm->arch_vm.ept_pgtable.pool, (void *)retired->pages[i]);
+	}
+	for (i = nr; i < retired->nr; i++) {
+		retired->pages[i - nr] = retired->pages[i];
+	}
+	retired->nr -= nr;
+	vm->arch_vm.ept_retired_flushing = 0U;
+}
+
+static inline void ept_request_flush(struct acrn_vm *vm)
 {
 	uint16_t i;
 	struct acrn_vcpu *vcpu;
+
+	/* the table pages retired so far wait for this flush on all the vCPUs */
+	spinlock_obtain(&vm->ept_lock);
+	vm->arch_vm.ept_retired_flushing = vm->arch_vm.ept_retired.nr;
+	vm->arch_vm.ept_flush_vcpus = vm_active_cpus(vm);
+	if (vm->arch_vm.ept_flush_vcpus == 0UL) {
+		ept_free_retired(vm);
+	}
+	spinlock_release(&vm->ept_lock);
+
 	/* Here doesn't do the real flush, just makes the request which will be handled before vcpu vmenter */
 	foreach_vcpu(i, vm, vcpu) {
 		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
 	}
 }
 
-void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+void ept_flush_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+
+	/* under ept_lock, so that the vCPU flushes after any table page it clears the bit for was retired */
+	spinlock_obtain(&vm->ept_lock);
+	invept(vm->arch_vm.nworld_eptp);
+	if (vm->sworld_control.flag.active != 0UL) {
+		invept(vm->arch_vm.sworld_eptp);
+	}
+
+	bitmap_clear_nolock(vcpu->vcpu_id, &vm->arch_vm.ept_flush_vcpus);
+	/* the vCPUs gone offline meanwhile won't run on these tables again without a flush */
+	if ((vm->arch_vm.ept_retired_flushing != 0U)
+			&& ((vm->arch_vm.ept_flush_vcpus & vm_active_cpus(vm)) == 0UL)) {
+		ept_free_retired(vm);
+	}
+	spinlock_release(&vm->ept_lock);
+}
+
+/* with a batch, the flush request is left to ept_batch_flush() */
+static inline void ept_flush_guest(struct acrn_vm *vm, struct ept_batch *batch)
+{
+	invalidate_gva_cache(vm);
+
+	if (batch != NULL) {
+		batch->flush_pending = true;
+	} else {
+		ept_request_flush(vm);
+	}
+}
+
+void ept_batch_init(struct ept_batch *batch, struct acrn_vm *vm)
+{
+	batch->vm = vm;
+	batch->flush_pending = false;
+}
+
+void ept_batch_flush(struct ept_batch *batch)
+{
+	if (batch->flush_pending) {
+		ept_request_flush(batch->vm);
+		batch->flush_pending = false;
+	}
+}
+
+void ept_add_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig, struct ept_batch *batch)
 {
 	uint64_t prot = prot_orig;
 
@@ -325,15 +399,29 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 	spinlock_obtain(&vm->ept_lock);
 
 	pgtable_add_map(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_pgtable);
+	if (vm->arch_vm.dirty_log.enabled) {
+		/* the dirty log needs 4K pages, the new ones may be in its range */
+		pgtable_split_map(pml4_page, gpa, size, &vm->arch_vm.ept_pgtable);
+	} else {
+		/* filling a hole of a split large page may make it whole again */
+		(void)pgtable_coalesce_map(pml4_page, gpa, size, &vm->arch_vm.ept_pgtable,
+				&vm->arch_vm.ept_retired);
+	}
 
 	spinlock_release(&vm->ept_lock);
 
-	ept_flush_guest(vm);
+	ept_flush_guest(vm, batch);
 }
 
-void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
+	ept_add_mr_batch(vm, pml4_page, hpa, gpa, size, prot_orig, NULL);
+}
+
+void ept_modify_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
-		uint64_t prot_set, uint64_t prot_clr)
+		uint64_t prot_set, uint64_t prot_clr, struct ept_batch *batch)
 {
 	uint64_t local_prot = prot_set;
 
@@ -342,15 +430,31 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 	spinlock_obtain(&vm->ept_lock);
 
 	pgtable_modify_or_del_map(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_pgtable), MR_MODIFY);
+	/* restoring the properties of a sub-range may make the split large page uniform again,
+	 * unless the dirty log is on, whose pages must stay 4K.
+	 */
+	if (!vm->arch_vm.dirty_log.enabled) {
+		(void)pgtable_coalesce_map(pml4_page, gpa, size, &vm->arch_vm.ept_pgtable,
+				&vm->arch_vm.ept_retired);
+	}
 
 	spinlock_release(&vm->ept_lock);
 
-	ept_flush_guest(vm);
+	ept_flush_guest(vm, batch);
+}
+
+void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+		uint64_t gpa, uint64_t size,
+		uint64_t prot_set, uint64_t prot_clr)
+{
+	ept_modify_mr_batch(vm, pml4_page, gpa, size, prot_set, prot_clr, NULL);
 }
+
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+void ept_del_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size,
+		struct ept_batch *batch)
 {
 	dev_dbg(DBG_LEVEL_EPT, "%s,vm[%d] gpa 0x%lx size 0x%lx\n", __func__, vm->vm_id, gpa, size);
 
@@ -360,7 +464,12 @@ void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t
 
 	spinlock_release(&vm->ept_lock);
 
-	ept_flush_guest(vm);
+	ept_flush_guest(vm, batch);
+}
+
+void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	ept_del_mr_batch(vm, pml4_page, gpa, size, NULL);
 }
 
 /**
@@ -423,6 +532,55 @@ void *get_eptp(struct acrn_vm *vm)
 	return eptp;
 }
 
+/**
+ * @pre vm != NULL && nr_leaves != NULL.
+ */
+void get_ept_leaf_stat(struct acrn_vm *vm, uint64_t nr_leaves[EPT_LEAF_SIZES])
+{
+	const struct pgtable *table = &vm->arch_vm.ept_pgtable;
+	uint64_t *pml4e, *pdpte, *pde, *pte;
+	uint64_t i, j, k, m;
+
+	nr_leaves[EPT_LEAF_4K] = 0UL;
+	nr_leaves[EPT_LEAF_2M] = 0UL;
+	nr_leaves[EPT_LEAF_1G] = 0UL;
+
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		pml4e = pml4e_offset((uint64_t *)vm->arch_vm.nworld_eptp, i << PML4E_SHIFT);
+		if (!pgentry_present(table, (*pml4e))) {
+			continue;
+		}
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			/* per PDPTE, not to hold off the EPT violations of the VM for the whole walk */
+			spinlock_obtain(&vm->ept_lock);
+			pdpte = pdpte_offset(pml4e, j << PDPTE_SHIFT);
+			if (!pgentry_present(table, (*pdpte))) {
+				/* nothing mapped */
+			} else if (pdpte_large(*pdpte) != 0UL) {
+				nr_leaves[EPT_LEAF_1G]++;
+			} else {
+				for (k = 0UL; k < PTRS_PER_PDE; k++) {
+					pde = pde_offset(pdpte, k << PDE_SHIFT);
+					if (!pgentry_present(table, (*pde))) {
+						continue;
+					}
+					if (pde_large(*pde) != 0UL) {
+						nr_leaves[EPT_LEAF_2M]++;
+						continue;
+					}
+					for (m = 0UL; m < PTRS_PER_PTE; m++) {
+						pte = pte_offset(pde, m << PTE_SHIFT);
+						if (pgentry_present(table, (*pte))) {
+							nr_leaves[EPT_LEAF_4K]++;
+						}
+					}
+				}
+			}
+			spinlock_release(&vm->ept_lock);
+		}
+	}
+}
+
 /**
  * @pre vm != NULL && cb != NULL.
  */
@@ -13,6 +13,7 @@
 #include <asm/guest/vmcs.h>
 #include <asm/mmu.h>
 #include <asm/guest/ept.h>
+#include <asm/lib/atomic.h>
 #include <logmsg.h>
 
 struct page_walk_info {
@@ -29,6 +30,14 @@ struct page_walk_info {
 
 	bool is_smap_on;
 	bool is_smep_on;
+	bool ac;		/* RFLAGS.AC, checked by SMAP */
+};
+
+/* The paging structure entries a 4-level walk read */
+struct page_walk_record {
+	uint64_t *entry[GVA_WALK_LEVELS];
+	uint64_t value[GVA_WALK_LEVELS];
+	uint32_t levels;
 };
 
 enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu)
@@ -53,7 +62,7 @@ enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu)
 /* TODO: Add code to check for Revserved bits, SMAP and PKE when do translation
  * during page walk */
 static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info,
-	uint64_t gva, uint64_t *gpa, uint32_t *err_code)
+	uint64_t gva, uint64_t *gpa, uint32_t *err_code, struct page_walk_record *rec)
 {
 	uint32_t i;
 	uint64_t index;
@@ -92,6 +101,11 @@ static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_wa
 				} else {
 					uint64_t *base64 = (uint64_t *)base;
 					entry = *(base64 + index);
+					if ((rec != NULL) && (rec->levels < GVA_WALK_LEVELS)) {
+						rec->entry[rec->levels] = base64 + index;
+						rec->value[rec->levels] = entry;
+						rec->levels++;
+					}
 				}
 
 				/* check if the entry present */
@@ -140,7 +154,7 @@ static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_wa
 		 */
 		/* if smap is enabled and supervisor-mode access */
 		if ((fault == 0) && pw_info->is_smap_on && (!pw_info->is_user_mode_access) &&
-			is_user_mode_addr && ((vcpu_get_rflags(vcpu) & RFLAGS_AC) == 0UL)) {
+			is_user_mode_addr && !pw_info->ac) {
 			fault = 1;
 		}
 
@@ -187,13 +201,83 @@ static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *
 		if ((entry & PAGE_PRESENT) != 0U) {
 			pw_info->level = 2U;
 			pw_info->top_entry = entry;
-			ret = local_gva2gpa_common(vcpu, pw_info, gva, gpa, err_code);
+			ret = local_gva2gpa_common(vcpu, pw_info, gva, gpa, err_code, NULL);
 		}
 	}
 
 	return ret;
 }
 
+/* The inputs of a 4-level walk which decide whether it faults */
+static uint32_t gva_walk_key(const struct page_walk_info *pw_info)
+{
+	return (pw_info->is_write_access ? (1U << 0U) : 0U) | (pw_info->is_inst_fetch ? (1U << 1U) : 0U) |
+		(pw_info->is_user_mode_access ? (1U << 2U) : 0U) | (pw_info->wp ? (1U << 3U) : 0U) |
+		(pw_info->nxe ? (1U << 4U) : 0U) | (pw_info->is_smap_on ? (1U << 5U) : 0U) |
+		(pw_info->is_smep_on ? (1U << 6U) : 0U) | (pw_info->ac ? (1U << 7U) : 0U);
+}
+
+static inline struct gva_cache_entry *gva_cache_slot(struct acrn_vcpu *vcpu, uint64_t cr3, uint64_t gva)
+{
+	uint64_t h = ((gva >> 12U) ^ (cr3 >> 12U)) * 0x9E3779B97F4A7C15UL;
+
+	return &vcpu->gva_cache.entries[h >> (64U - 4U)];
+}
+
+/*
+ * A cached translation holds as long as the paging structure entries of its
+ * walk keep their values: they are read again, without the GPA lookups.
+ */
+static bool gva_cache_lookup(struct acrn_vcpu *vcpu, uint64_t cr3, uint64_t gva, uint32_t key, uint64_t *gpa)
+{
+	const struct gva_cache_entry *e = gva_cache_slot(vcpu, cr3, gva);
+	bool hit = e->valid && (e->gen == vcpu->vm->gva_cache_gen) && (e->cr3 == cr3) &&
+		(e->gva_page == (gva & PAGE_MASK)) && (e->walk_key == key);
+	uint32_t i;
+
+	if (hit) {
+		stac();
+		for (i = 0U; i < e->levels; i++) {
+			if (*e->entry[i] != e->value[i]) {
+				hit = false;
+				break;
+			}
+		}
+		clac();
+	}
+
+	if (hit) {
+		*gpa = e->gpa_page | (gva & ~PAGE_MASK);
+		vcpu->gva_cache.hits++;
+	} else {
+		vcpu->gva_cache.misses++;
+	}
+
+	return hit;
+}
+
+static void gva_cache_insert(struct acrn_vcpu *vcpu, uint64_t cr3, uint64_t gva, uint64_t gpa,
+	uint32_t key, uint32_t gen, const struct page_walk_record *rec)
+{
+	struct gva_cache_entry *e = gva_cache_slot(vcpu, cr3, gva);
+
+	e->cr3 = cr3;
+	e->gva_page = gva & PAGE_MASK;
+	e->gpa_page = gpa & PAGE_MASK;
+	(void)memcpy_s(e->entry, sizeof(e->entry), rec->entry, sizeof(rec->entry));
+	(void)memcpy_s(e->value, sizeof(e->value), rec->value, sizeof(rec->value));
+	e->levels = rec->levels;
+	e->walk_key = key;
+	e->gen = gen;
+	e->valid = true;
+}
+
+/* Called whenever the EPT of the VM changes, the cached host pointers may be stale */
+void invalidate_gva_cache(struct acrn_vm *vm)
+{
+	atomic_inc32(&vm->gva_cache_gen);
+}
+
 /* Refer to SDM Vol.3A 6-39 section 6.15 for the format of paging fault error
  * code.
  *
@@ -217,6 +301,8 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 {
 	enum vm_paging_mode pm = get_vcpu_paging_mode(vcpu);
 	struct page_walk_info pw_info;
+	struct page_walk_record rec;
+	uint32_t key, gen;
 	int32_t ret = 0;
 
 	if ((gpa == NULL) || (err_code == NULL)) {
@@ -224,7 +310,7 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	} else {
 		*gpa = 0UL;
 
-		pw_info.top_entry = exec_vmread(VMX_GUEST_CR3);
+		pw_info.top_entry = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CR3);
 		pw_info.level = (uint32_t)pm;
 		pw_info.is_write_access = ((*err_code & PAGE_FAULT_WR_FLAG) != 0U);
 		pw_info.is_inst_fetch = ((*err_code & PAGE_FAULT_ID_FLAG) != 0U);
@@ -242,12 +328,23 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 		pw_info.wp = ((vcpu_get_cr0(vcpu) & CR0_WP) != 0UL);
 		pw_info.is_smap_on = ((vcpu_get_cr4(vcpu) & CR4_SMAP) != 0UL);
 		pw_info.is_smep_on = ((vcpu_get_cr4(vcpu) & CR4_SMEP) != 0UL);
+		pw_info.ac = pw_info.is_smap_on && ((vcpu_get_rflags(vcpu) & RFLAGS_AC) != 0UL);
 
 		*err_code &=  ~PAGE_FAULT_P_FLAG;
 
 		if (pm == PAGING_MODE_4_LEVEL) {
 			pw_info.width = 9U;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+			key = gva_walk_key(&pw_info);
+			if (!gva_cache_lookup(vcpu, pw_info.top_entry, gva, key, gpa)) {
+				/* read before the walk, an EPT change during it discards the entry */
+				gen = vcpu->vm->gva_cache_gen;
+				cpu_compiler_barrier();
+				rec.levels = 0U;
+				ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code, &rec);
+				if (ret == 0) {
+					gva_cache_insert(vcpu, pw_info.top_entry, gva, *gpa, key, gen, &rec);
+				}
+			}
 		} else if (pm == PAGING_MODE_3_LEVEL) {
 			pw_info.width = 9U;
 			ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
@@ -255,7 +352,7 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 			pw_info.width = 10U;
 			pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
 			pw_info.nxe = false;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code, NULL);
 		} else {
 			*gpa = gva;
 		}
@@ -12,12 +12,21 @@
 #include <logmsg.h>
 #include <asm/vmx.h>
 #include <asm/guest/hyperv.h>
+#include <asm/guest/vlapic.h>
+#include <asm/guest/virq.h>
+#include <asm/per_cpu.h>
+#include <asm/mmu.h>
 #include <asm/tsc.h>
+#include <schedule.h>
 
 #define DBG_LEVEL_HYPERV		6U
 
 /* Partition Reference Counter (HV_X64_MSR_TIME_REF_COUNT) */
 #define CPUID3A_TIME_REF_COUNT_MSR	(1U << 1U)
+/* Synthetic interrupt controller MSRs (HV_X64_MSR_SCONTROL to HV_X64_MSR_SINT15) */
+#define CPUID3A_SYNIC_MSRS		(1U << 2U)
+/* Synthetic timer MSRs (HV_X64_MSR_STIMER0_CONFIG to HV_X64_MSR_STIMER3_COUNT) */
+#define CPUID3A_SYNTIMER_MSRS		(1U << 3U)
 /* Hypercall MSRs (HV_X64_MSR_GUEST_OS_ID and HV_X64_MSR_HYPERCALL) */
 #define CPUID3A_HYPERCALL_MSR		(1U << 5U)
 /* Access virtual processor index MSR (HV_X64_MSR_VP_INDEX) */
@@ -28,6 +37,54 @@
 #define CPUID3A_ACCESS_FREQUENCY_MSRS	(1U << 11U)
 /* Frequency MSRs available */
 #define CPUID3D_FREQ_MSRS_AVAILABLE	(1U << 8U)
+/* Synthetic timers may inject their vector directly */
+#define CPUID3D_STIMER_DIRECT_MODE	(1U << 19U)
+
+/* Use HvCallFlushVirtualAddressSpace/List for remote TLB flushes */
+#define CPUID4A_REMOTE_TLB_FLUSH	(1U << 2U)
+/* Don't use the auto EOI of the SINTs, it isn't emulated */
+#define CPUID4A_DEPRECATING_AEOI	(1U << 9U)
+/* Use HvCallSendSyntheticClusterIpi */
+#define CPUID4A_CLUSTER_IPI		(1U << 10U)
+/* Never notify the hypervisor of long spinlock waits */
+#define CPUID4B_NO_SPINLOCK_NOTIFY	0xFFFFFFFFU
+
+#define HV_SYNIC_VERSION		1UL
+#define HV_SYNIC_CONTROL_ENABLE		(1UL << 0U)
+#define HV_SYNIC_PAGE_ENABLE		(1UL << 0U)
+#define HV_SYNIC_SINT_VECTOR_MASK	0xFFUL
+#define HV_SYNIC_SINT_MASKED		(1UL << 16U)
+#define HV_SYNIC_SINT_AUTO_EOI		(1UL << 17U)
+#define HV_SYNIC_SINT_POLLING		(1UL << 18U)
+#define HV_SYNIC_SINT_VALID_MASK	(HV_SYNIC_SINT_VECTOR_MASK | HV_SYNIC_SINT_MASKED | \
+					HV_SYNIC_SINT_AUTO_EOI | HV_SYNIC_SINT_POLLING)
+#define HV_SYNIC_FIRST_VALID_VECTOR	16U
+
+/* the valid bits of a synthetic timer config */
+#define HV_STIMER_CONFIG_VALID_MASK	0xF1FFFUL
+
+#define HV_MESSAGE_SIZE			256U
+#define HVMSG_NONE			0U
+#define HVMSG_TIMER_EXPIRED		0x80000010U
+#define HV_MESSAGE_FLAG_PENDING		(1U << 0U)
+
+/* Hypercall input value */
+#define HV_HYPERCALL_CODE_MASK		0xFFFFUL
+#define HV_HYPERCALL_FAST		(1UL << 16U)
+#define HV_HYPERCALL_REP_COUNT_SHIFT	32U
+#define HV_HYPERCALL_REP_MASK		0xFFFUL
+
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE	0x0002U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST	0x0003U
+#define HVCALL_SEND_IPI				0x000BU
+
+#define HV_FLUSH_ALL_PROCESSORS		(1UL << 0U)
+
+/* Hypercall status */
+#define HV_STATUS_SUCCESS		0UL
+#define HV_STATUS_INVALID_HYPERCALL_CODE	2UL
+#define HV_STATUS_INVALID_HYPERCALL_INPUT	3UL
+#define HV_STATUS_INVALID_PARAMETER	5UL
 
 struct HV_REFERENCE_TSC_PAGE {
 	uint32_t tsc_sequence;
@@ -37,6 +94,35 @@ struct HV_REFERENCE_TSC_PAGE {
 	uint64_t reserved2[509];
 };
 
+struct hv_message_header {
+	uint32_t message_type;
+	uint8_t payload_size;
+	uint8_t message_flags;
+	uint8_t reserved[2];
+	uint64_t sender;
+};
+
+struct hv_timer_message {
+	struct hv_message_header header;
+	uint32_t timer_index;
+	uint32_t reserved;
+	uint64_t expiration_time;
+	uint64_t delivery_time;
+};
+
+struct hv_flush_input {
+	uint64_t address_space;
+	uint64_t flags;
+	uint64_t processor_mask;
+};
+
+struct hv_send_ipi_input {
+	uint32_t vector;
+	uint8_t target_vtl;
+	uint8_t reserved[3];
+	uint64_t cpu_mask;
+};
+
 static inline uint64_t
 u64_shl64_div_u64(uint64_t a, uint64_t divisor)
 {
@@ -113,20 +199,13 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	/*
 	 * All enlightened versions of Windows operating systems invoke guest hypercalls on
 	 * the basis of the recommendations presented by the hypervisor in CPUID.40000004:EAX.
-	 * A conforming hypervisor must return HV_STATUS_INVALID_HYPERCALL_CODE for any
-	 * unimplemented hypercalls.
-	 * ACRN does not wish to handle any hypercalls at moment, the following hypercall 
-	 * code page is implemented for this purpose.
-	 * inst32[] for 32 bits:
-	 * 	mov eax, 0x02 ; HV_STATUS_INVALID_HYPERCALL_CODE
-	 * 	mov edx, 0
-	 * 	ret
-	 * inst64[] for 64 bits:
-	 * 	mov rax, 0x02 ; HV_STATUS_INVALID_HYPERCALL_CODE
+	 * The hypercall code page traps to hyperv_hypercall(), which returns
+	 * HV_STATUS_INVALID_HYPERCALL_CODE for the unimplemented hypercalls.
+	 * inst[] for both 32 and 64 bits:
+	 * 	vmcall
 	 * 	ret
 	 */
-	const uint8_t inst32[11] = {0xb8U, 0x02U, 0x0U, 0x0U, 0x0U, 0xbaU, 0x0U, 0x0U, 0x0U, 0x0U, 0xc3U};
-	const uint8_t inst64[8] = {0x48U, 0xc7U, 0xc0U, 0x02U, 0x0U, 0x0U, 0x0U, 0xc3U};
+	const uint8_t inst[4] = {0x0fU, 0x01U, 0xc1U, 0xc3U};
 
 	hypercall.val64 = val;
 
@@ -136,14 +215,266 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 		if (page_hva != NULL) {
 			stac();
 			(void)memset(page_hva, 0U, PAGE_SIZE);
-			if (get_vcpu_mode(vcpu) == CPU_MODE_64BIT) {
-				(void)memcpy_s(page_hva, 8U, inst64, 8U);
+			(void)memcpy_s(page_hva, 4U, inst, 4U);
+			clac();
+		}
+	}
+}
+
+/* TSC cycles of a duration in 100ns units */
+static inline uint64_t
+hyperv_ref_to_ticks(uint64_t ref)
+{
+	uint64_t tsc_khz = get_tsc_khz();
+
+	return (min(ref, ~0UL / tsc_khz) * tsc_khz) / 10000UL;
+}
+
+/*
+ * Post the expiration message of stimer to the SIMP slot of its SINT, and
+ * send the SINT vector. The slot is still taken by a previous message if it
+ * returns false: the guest writes HV_X64_MSR_EOM once it frees the slot.
+ */
+static bool
+hyperv_synic_post_timer_msg(struct hyperv_stimer *stimer)
+{
+	struct acrn_vcpu *vcpu = stimer->vcpu;
+	struct acrn_hyperv_vcpu *hv = &vcpu->hyperv;
+	uint64_t sint = hv->sint[stimer->config.sintx];
+	struct hv_timer_message *msg;
+	bool posted = true;
+
+	/* lost if the SynIC or the SINT are disabled */
+	if (((hv->scontrol & HV_SYNIC_CONTROL_ENABLE) != 0UL) && (hv->simp_page != NULL) &&
+			((sint & HV_SYNIC_SINT_MASKED) == 0UL)) {
+		msg = (struct hv_timer_message *)((uint8_t *)hv->simp_page +
+				(stimer->config.sintx * HV_MESSAGE_SIZE));
+
+		stac();
+		if (msg->header.message_type != HVMSG_NONE) {
+			msg->header.message_flags |= HV_MESSAGE_FLAG_PENDING;
+			posted = false;
+		} else {
+			msg->header.payload_size = (uint8_t)(sizeof(*msg) - sizeof(msg->header));
+			msg->header.message_flags = 0U;
+			msg->header.sender = 0UL;
+			msg->timer_index = stimer->index;
+			msg->reserved = 0U;
+			msg->expiration_time = stimer->exp_time;
+			msg->delivery_time = stimer->exp_time;
+			cpu_write_memory_barrier();
+			msg->header.message_type = HVMSG_TIMER_EXPIRED;
+		}
+		clac();
+
+		if (posted) {
+			vlapic_set_intr(vcpu, (uint32_t)(sint & HV_SYNIC_SINT_VECTOR_MASK), LAPIC_TRIG_EDGE);
+		}
+	}
+
+	return posted;
+}
+
+/* Deliver the expiration of stimer, false if it has to wait for a free SIMP slot */
+static bool
+hyperv_stimer_deliver(struct hyperv_stimer *stimer)
+{
+	bool delivered = true;
+
+	if (stimer->config.direct_mode != 0UL) {
+		if (stimer->config.apic_vector >= HV_SYNIC_FIRST_VALID_VECTOR) {
+			vlapic_set_intr(stimer->vcpu, (uint32_t)stimer->config.apic_vector, LAPIC_TRIG_EDGE);
+		}
+	} else {
+		delivered = hyperv_synic_post_timer_msg(stimer);
+	}
+
+	if (delivered) {
+		stimer->msg_pending = false;
+		/* a one-shot timer disables itself */
+		if (stimer->config.periodic == 0UL) {
+			stimer->config.enabled = 0UL;
+		}
+	} else {
+		stimer->msg_pending = true;
+	}
+
+	return delivered;
+}
+
+static void
+hyperv_stimer_expired(void *data)
+{
+	struct hyperv_stimer *stimer = (struct hyperv_stimer *)data;
+
+	if (stimer->config.periodic != 0UL) {
+		stimer->exp_time += stimer->count;
+	}
+
+	/* the expirations of a periodic timer coalesce while its message is pending */
+	if (!stimer->msg_pending) {
+		(void)hyperv_stimer_deliver(stimer);
+	}
+}
+
+/*
+ * (Re)arm stimer from its config and count, in the context of its vCPU.
+ * The count of a one-shot timer is an absolute reference time, the one of
+ * a periodic timer is its period, both in 100ns units.
+ */
+static void
+hyperv_stimer_start(struct hyperv_stimer *stimer)
+{
+	uint64_t now = hyperv_get_ReferenceTime(stimer->vcpu->vm);
+	uint64_t timeout, period = 0UL;
+
+	del_timer(&stimer->timer);
+	stimer->msg_pending = false;
+
+	if ((stimer->config.enabled != 0UL) && (stimer->count != 0UL)) {
+		if (stimer->config.periodic != 0UL) {
+			stimer->exp_time = now;
+			period = hyperv_ref_to_ticks(stimer->count);
+			timeout = cpu_ticks() + period;
+		} else {
+			stimer->exp_time = stimer->count;
+			timeout = cpu_ticks() + ((stimer->count > now) ? hyperv_ref_to_ticks(stimer->count - now) : 0UL);
+		}
+		update_timer(&stimer->timer, timeout, period);
+		(void)add_timer(&stimer->timer);
+	}
+}
+
+static int32_t
+hyperv_synic_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->hyperv;
+	void *hva = NULL;
+	uint32_t i;
+	int32_t ret = 0;
+
+	switch (msr) {
+	case HV_X64_MSR_SCONTROL:
+		hv->scontrol = wval & HV_SYNIC_CONTROL_ENABLE;
+		break;
+	case HV_X64_MSR_SIEFP:
+	case HV_X64_MSR_SIMP:
+		if ((wval & HV_SYNIC_PAGE_ENABLE) != 0UL) {
+			hva = gpa2hva(vcpu->vm, wval & PAGE_MASK);
+			if (hva != NULL) {
+				stac();
+				(void)memset(hva, 0U, PAGE_SIZE);
+				clac();
 			} else {
-				(void)memcpy_s(page_hva, 11U, inst32, 11U);
+				ret = -1;
 			}
-			clac();
 		}
+		if (ret == 0) {
+			if (msr == HV_X64_MSR_SIMP) {
+				hv->simp = wval;
+				hv->simp_page = hva;
+			} else {
+				hv->siefp = wval;
+			}
+		}
+		break;
+	case HV_X64_MSR_EOM:
+		/* a SIMP slot was freed, retry the pending messages */
+		for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+			if (hv->stimer[i].msg_pending) {
+				(void)hyperv_stimer_deliver(&hv->stimer[i]);
+			}
+		}
+		break;
+	case HV_X64_MSR_SVERSION:
+		/* read only */
+		ret = -1;
+		break;
+	default:
+		/* HV_X64_MSR_SINT0 ~ HV_X64_MSR_SINT15 */
+		if (((wval & ~HV_SYNIC_SINT_VALID_MASK) != 0UL) || (((wval & HV_SYNIC_SINT_MASKED) == 0UL) &&
+				((wval & HV_SYNIC_SINT_VECTOR_MASK) < HV_SYNIC_FIRST_VALID_VECTOR))) {
+			ret = -1;
+		} else {
+			hv->sint[msr - HV_X64_MSR_SINT0] = wval;
+		}
+		break;
+	}
+
+	return ret;
+}
+
+static uint64_t
+hyperv_synic_rdmsr(const struct acrn_vcpu *vcpu, uint32_t msr)
+{
+	const struct acrn_hyperv_vcpu *hv = &vcpu->hyperv;
+	uint64_t val;
+
+	switch (msr) {
+	case HV_X64_MSR_SCONTROL:
+		val = hv->scontrol;
+		break;
+	case HV_X64_MSR_SVERSION:
+		val = HV_SYNIC_VERSION;
+		break;
+	case HV_X64_MSR_SIEFP:
+		val = hv->siefp;
+		break;
+	case HV_X64_MSR_SIMP:
+		val = hv->simp;
+		break;
+	case HV_X64_MSR_EOM:
+		val = 0UL;
+		break;
+	default:
+		/* HV_X64_MSR_SINT0 ~ HV_X64_MSR_SINT15 */
+		val = hv->sint[msr - HV_X64_MSR_SINT0];
+		break;
 	}
+
+	return val;
+}
+
+static int32_t
+hyperv_stimer_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	struct hyperv_stimer *stimer = &vcpu->hyperv.stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+	int32_t ret = 0;
+
+	if (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) {
+		if ((wval & ~HV_STIMER_CONFIG_VALID_MASK) != 0UL) {
+			ret = -1;
+		} else {
+			stimer->config.val64 = wval;
+			/* a message can't go to SINT0 */
+			if ((stimer->config.direct_mode == 0UL) && (stimer->config.sintx == 0UL)) {
+				stimer->config.enabled = 0UL;
+			}
+		}
+	} else {
+		stimer->count = wval;
+		if (wval == 0UL) {
+			stimer->config.enabled = 0UL;
+		} else if (stimer->config.auto_enable != 0UL) {
+			stimer->config.enabled = 1UL;
+		} else {
+			/* the count of an enabled timer rearms it */
+		}
+	}
+
+	if (ret == 0) {
+		hyperv_stimer_start(stimer);
+	}
+
+	return ret;
+}
+
+static uint64_t
+hyperv_stimer_rdmsr(const struct acrn_vcpu *vcpu, uint32_t msr)
+{
+	const struct hyperv_stimer *stimer = &vcpu->hyperv.stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+
+	return (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) ? stimer->config.val64 : stimer->count;
 }
 
 int32_t
@@ -174,11 +505,19 @@ hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
 	case HV_X64_MSR_TSC_FREQUENCY:
 	case HV_X64_MSR_APIC_FREQUENCY:
 		/* read only */
-		/* fallthrough */
-	default:
 		pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
 		ret = -1;
 		break;
+	default:
+		if (is_hyperv_synic_msr(msr)) {
+			ret = hyperv_synic_wrmsr(vcpu, msr, wval);
+		} else if (is_hyperv_stimer_msr(msr)) {
+			ret = hyperv_stimer_wrmsr(vcpu, msr, wval);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
+			ret = -1;
+		}
+		break;
 	}
 
 	dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: MSR=0x%x wval=0x%lx vcpuid=%d vmid=%d",
@@ -216,8 +555,14 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 		*rval = get_tsc_khz() * 1000UL;
 		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
-		ret = -1;
+		if (is_hyperv_synic_msr(msr)) {
+			*rval = hyperv_synic_rdmsr(vcpu, msr);
+		} else if (is_hyperv_stimer_msr(msr)) {
+			*rval = hyperv_stimer_rdmsr(vcpu, msr);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
+			ret = -1;
+		}
 		break;
 	}
 
@@ -278,14 +623,16 @@ hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 	case 0x40000003U: /* HV supported feature */
 		entry->eax = CPUID3A_HYPERCALL_MSR | CPUID3A_VP_INDEX_MSR |
 			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR |
-			CPUID3A_ACCESS_FREQUENCY_MSRS;
+			CPUID3A_ACCESS_FREQUENCY_MSRS | CPUID3A_SYNIC_MSRS |
+			CPUID3A_SYNTIMER_MSRS;
 		entry->ebx = 0U;
 		entry->ecx = 0U;
-		entry->edx = CPUID3D_FREQ_MSRS_AVAILABLE;
+		entry->edx = CPUID3D_FREQ_MSRS_AVAILABLE | CPUID3D_STIMER_DIRECT_MODE;
 		break;
 	case 0x40000004U: /* HV Recommended hypercall usage */
-		entry->eax = 0U;
-		entry->ebx = 0U;
+		entry->eax = CPUID4A_REMOTE_TLB_FLUSH | CPUID4A_DEPRECATING_AEOI |
+			CPUID4A_CLUSTER_IPI;
+		entry->ebx = CPUID4B_NO_SPINLOCK_NOTIFY;
 		entry->ecx = 0U;
 		entry->edx = 0U;
 		break;
@@ -320,3 +667,232 @@ hyperv_page_destory(struct acrn_vm *vm)
 	/* Reset the TSC page */
 	vm->arch_vm.hyperv.ref_tsc_page.enabled = 0UL;
 }
+
+void
+hyperv_init_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->hyperv.stimer[i];
+		stimer->vcpu = vcpu;
+		stimer->index = i;
+		initialize_timer(&stimer->timer, hyperv_stimer_expired, stimer, 0UL, 0UL);
+	}
+	hyperv_reset_vcpu(vcpu);
+}
+
+void
+hyperv_reset_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->hyperv;
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	hv->scontrol = 0UL;
+	hv->siefp = 0UL;
+	hv->simp = 0UL;
+	hv->simp_page = NULL;
+	for (i = 0U; i < HV_SYNIC_SINT_COUNT; i++) {
+		hv->sint[i] = HV_SYNIC_SINT_MASKED;
+	}
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &hv->stimer[i];
+		del_timer(&stimer->timer);
+		update_timer(&stimer->timer, 0UL, 0UL);
+		stimer->config.val64 = 0UL;
+		stimer->count = 0UL;
+		stimer->exp_time = 0UL;
+		stimer->msg_pending = false;
+		stimer->restart = false;
+	}
+}
+
+void
+hyperv_stimer_migrate_out(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->hyperv.stimer[i];
+		if (timer_is_started(&stimer->timer)) {
+			del_timer(&stimer->timer);
+			stimer->restart = true;
+		}
+	}
+}
+
+void
+hyperv_stimer_migrate_in(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->hyperv.stimer[i];
+		if (stimer->restart) {
+			(void)add_timer(&stimer->timer);
+			stimer->restart = false;
+		}
+	}
+}
+
+/*
+ * Flush the TLB of the vCPUs of vcpu_mask before any of them runs a guest
+ * instruction after the return. The vCPUs running on other pCPUs are waited
+ * for until they handle the flush request on their next VM entry. While
+ * waiting, this vCPU handles its own flush request: a vCPU flushing the TLB
+ * of this one at the same time waits for it too.
+ */
+static void
+hyperv_flush_vcpus(struct acrn_vcpu *vcpu, uint64_t vcpu_mask)
+{
+	struct acrn_vcpu *target;
+	uint16_t i;
+
+	foreach_vcpu(i, vcpu->vm, target) {
+		if ((vcpu_mask & (1UL << i)) != 0UL) {
+			vcpu_make_request(target, ACRN_REQUEST_VPID_FLUSH);
+		}
+	}
+
+	foreach_vcpu(i, vcpu->vm, target) {
+		if (((vcpu_mask & (1UL << i)) != 0UL) && (target != vcpu)) {
+			while (bitmap_test(ACRN_REQUEST_VPID_FLUSH, &target->arch.pending_req) &&
+					(sched_get_current(pcpuid_from_vcpu(target)) == &target->thread_obj)) {
+				if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH, &vcpu->arch.pending_req)) {
+					flush_vpid_single(vcpu->arch.vpid);
+				}
+				asm_pause();
+			}
+		}
+	}
+}
+
+static uint64_t
+hyperv_hcall_flush(struct acrn_vcpu *vcpu, uint16_t code, bool fast, uint64_t in_gpa, uint32_t rep_cnt)
+{
+	struct hv_flush_input input;
+	uint64_t mask, status = HV_STATUS_SUCCESS;
+
+	if (fast) {
+		/* the processor mask would be in XMM0, this input isn't advertised */
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if ((code == HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE) && (rep_cnt != 0U)) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if (copy_from_gpa(vcpu->vm, &input, in_gpa, sizeof(input)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else {
+		/* whole VPIDs are flushed for both the space and the list of GVAs, with all its reps */
+		mask = ((input.flags & HV_FLUSH_ALL_PROCESSORS) != 0UL) ? ~0UL : input.processor_mask;
+		hyperv_flush_vcpus(vcpu, mask);
+	}
+
+	return status;
+}
+
+static uint64_t
+hyperv_hcall_send_ipi(struct acrn_vcpu *vcpu, bool fast, uint64_t in_gpa, uint64_t out_gpa)
+{
+	struct hv_send_ipi_input input;
+	uint64_t dmask = 0UL, status = HV_STATUS_SUCCESS;
+	struct acrn_vcpu *target;
+	uint16_t i;
+
+	if (fast) {
+		input.vector = (uint32_t)in_gpa;
+		input.target_vtl = (uint8_t)(in_gpa >> 32U);
+		input.cpu_mask = out_gpa;
+	} else if (copy_from_gpa(vcpu->vm, &input, in_gpa, sizeof(input)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else {
+		/* got from the input page */
+	}
+
+	if (status == HV_STATUS_SUCCESS) {
+		if ((input.vector < HV_SYNIC_FIRST_VALID_VECTOR) || (input.vector > 0xFFU) ||
+				(input.target_vtl != 0U)) {
+			status = HV_STATUS_INVALID_PARAMETER;
+		} else {
+			/* the VP index of a vCPU is its vcpu_id */
+			foreach_vcpu(i, vcpu->vm, target) {
+				if ((input.cpu_mask & (1UL << i)) != 0UL) {
+					bitmap_set_nolock(i, &dmask);
+				}
+			}
+			vlapic_send_fixed_ipi_mask(vcpu, dmask, input.vector);
+		}
+	}
+
+	return status;
+}
+
+/*
+ * A vmcall of a guest which enabled the Hyper-V hypercall page is a Hyper-V
+ * hypercall, the ACRN hypercalls aren't available to it.
+ */
+bool
+is_hyperv_hypercall(const struct acrn_vcpu *vcpu)
+{
+	const struct acrn_hyperv *hyperv = &vcpu->vm->arch_vm.hyperv;
+
+	return (!is_service_vm(vcpu->vm) && (hyperv->guest_os_id.val64 != 0UL) &&
+			(hyperv->hypercall_page.enabled != 0UL));
+}
+
+void
+hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	uint64_t input, in_gpa, out_gpa, status;
+	uint32_t rep_cnt;
+	uint16_t code;
+	bool fast, is_64bit = (get_vcpu_mode(vcpu) == CPU_MODE_64BIT);
+
+	if (is_64bit) {
+		input = vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+		in_gpa = vcpu_get_gpreg(vcpu, CPU_REG_RDX);
+		out_gpa = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	} else {
+		input = ((vcpu_get_gpreg(vcpu, CPU_REG_RDX) & 0xFFFFFFFFUL) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RAX) & 0xFFFFFFFFUL);
+		in_gpa = ((vcpu_get_gpreg(vcpu, CPU_REG_RBX) & 0xFFFFFFFFUL) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RCX) & 0xFFFFFFFFUL);
+		out_gpa = ((vcpu_get_gpreg(vcpu, CPU_REG_RDI) & 0xFFFFFFFFUL) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RSI) & 0xFFFFFFFFUL);
+	}
+
+	code = (uint16_t)(input & HV_HYPERCALL_CODE_MASK);
+	fast = ((input & HV_HYPERCALL_FAST) != 0UL);
+	rep_cnt = (uint32_t)((input >> HV_HYPERCALL_REP_COUNT_SHIFT) & HV_HYPERCALL_REP_MASK);
+
+	switch (code) {
+	case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE:
+	case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST:
+		status = hyperv_hcall_flush(vcpu, code, fast, in_gpa, rep_cnt);
+		break;
+	case HVCALL_SEND_IPI:
+		status = hyperv_hcall_send_ipi(vcpu, fast, in_gpa, out_gpa);
+		break;
+	default:
+		status = HV_STATUS_INVALID_HYPERCALL_CODE;
+		break;
+	}
+
+	/* all the reps of a successful rep hypercall are completed */
+	if ((status == HV_STATUS_SUCCESS) && (code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST)) {
+		status |= (uint64_t)rep_cnt << HV_HYPERCALL_REP_COUNT_SHIFT;
+	}
+
+	if (is_64bit) {
+		vcpu_set_gpreg(vcpu, CPU_REG_RAX, status);
+	} else {
+		vcpu_set_gpreg(vcpu, CPU_REG_RDX, status >> 32U);
+		vcpu_set_gpreg(vcpu, CPU_REG_RAX, status & 0xFFFFFFFFUL);
+	}
+
+	dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: code=0x%x status=0x%lx vcpuid=%d vmid=%d",
+		__func__, code, status, vcpu->vcpu_id, vcpu->vm->vm_id);
+}
@@ -1211,6 +1211,75 @@ static int32_t emulate_stos(struct acrn_vcpu *vcpu, const struct instr_emul_vie
 	return 0;
 }
 
+/* Whether the operand of opsize bytes at addr stays in the page of base */
+static inline bool in_same_page(uint64_t base, uint64_t addr, uint8_t opsize)
+{
+	return ((addr & PAGE_MASK) == (base & PAGE_MASK)) &&
+		((((addr + opsize) - 1UL) & PAGE_MASK) == (base & PAGE_MASK));
+}
+
+/**
+ * @brief Prepare the next iteration of a REP MOVS/STOS on MMIO in the same VM exit
+ *
+ * @param vcpu The vCPU, with the registers updated by the previous iteration
+ * @param gpa The address of the MMIO operand of the previous iteration, set to
+ *	      the one of the next iteration
+ *
+ * @return true if the count register is not zero, the MMIO operand stays in
+ *	   its page and the memory operand of a MOVS is mapped. Otherwise the
+ *	   guest resumes the instruction, and takes a new VM exit or fault.
+ */
+bool vie_rep_next(struct acrn_vcpu *vcpu, uint64_t *gpa)
+{
+	struct instr_emul_vie *vie = &vcpu->inst_ctxt.vie;
+	uint64_t next, gva, mem_gpa, rcx;
+	uint32_t err_code;
+	struct seg_desc desc;
+	enum cpu_reg_name seg;
+	uint8_t opsize;
+	bool is_mmio_write, ret = false;
+
+	if ((vie->decoded != 0U) && ((vie->repz_present | vie->repnz_present) != 0U) &&
+			((vie->op.op_type == VIE_OP_TYPE_MOVS) || (vie->op.op_type == VIE_OP_TYPE_STOS))) {
+		opsize = ((vie->op.op_flags & VIE_OP_F_BYTE_OP) != 0U) ? 1U : vie->opsize;
+		rcx = vm_get_register(vcpu, CPU_REG_RCX);
+		if ((vm_get_register(vcpu, CPU_REG_RFLAGS) & PSL_D) != 0U) {
+			next = *gpa - opsize;
+		} else {
+			next = *gpa + opsize;
+		}
+
+		ret = ((rcx & size2mask[vie->addrsize]) != 0UL) && in_same_page(*gpa, next, opsize);
+
+		if (ret && (vie->op.op_type == VIE_OP_TYPE_MOVS)) {
+			is_mmio_write = (vcpu->req.reqs.mmio_request.direction == ACRN_IOREQ_DIR_WRITE);
+			if (is_mmio_write) {
+				/* the source at DS:RSI, translated again by emulate_movs() */
+				seg = (vie->seg_override != 0U) ? (vie->segment_register) : CPU_REG_DS;
+				get_gva_si_nocheck(vcpu, vie->addrsize, seg, &gva);
+				err_code = 0U;
+			} else {
+				/* the destination at ES:RDI, as checked by get_gva_di_check() when decoded */
+				vm_get_seg_desc(CPU_REG_ES, &desc);
+				vie_calculate_gla(get_vcpu_mode(vcpu), CPU_REG_ES, &desc,
+					vm_get_register(vcpu, CPU_REG_RDI), vie->addrsize, &gva);
+				err_code = PAGE_FAULT_WR_FLAG;
+			}
+
+			ret = in_same_page(gva, gva, opsize) && (gva2gpa(vcpu, gva, &mem_gpa, &err_code) == 0);
+			if (ret && !is_mmio_write) {
+				vie->dst_gpa = mem_gpa;
+			}
+		}
+
+		if (ret) {
+			*gpa = next;
+		}
+	}
+
+	return ret;
+}
+
 static int32_t emulate_test(struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie)
 {
 	int32_t error;
@@ -1675,12 +1744,23 @@ static __attribute__((noinline)) int32_t emulate_xchg_for_splitlock(struct acrn_
 	return ret;
 }
 
-static int32_t vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu)
+static uint64_t vie_rip_gla(struct acrn_vcpu *vcpu, enum vm_cpu_mode cpu_mode)
 {
-	uint32_t inst_len = vcpu->arch.inst_len;
-	enum vm_cpu_mode cpu_mode;
 	struct seg_desc desc;
 	uint64_t guest_rip_gva;
+
+	vm_get_seg_desc(CPU_REG_CS, &desc);
+
+	/* VMX_GUEST_RIP is a natural-width field */
+	vie_calculate_gla(cpu_mode, CPU_REG_CS, &desc, vcpu_get_rip(vcpu),
+			8U, &guest_rip_gva);
+
+	return guest_rip_gva;
+}
+
+static int32_t vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu, uint64_t guest_rip_gva)
+{
+	uint32_t inst_len = vcpu->arch.inst_len;
 	uint32_t err_code;
 	uint64_t fault_addr;
 	int32_t ret;
@@ -1696,13 +1776,6 @@ static int32_t vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu)
 		vie->index_register = CPU_REG_LAST;
 		vie->segment_register = CPU_REG_LAST;
 
-		cpu_mode = get_vcpu_mode(vcpu);
-		vm_get_seg_desc(CPU_REG_CS, &desc);
-
-		/* VMX_GUEST_RIP is a natural-width field */
-		vie_calculate_gla(cpu_mode, CPU_REG_CS, &desc, vcpu_get_rip(vcpu),
-				8U, &guest_rip_gva);
-
 		err_code = PAGE_FAULT_ID_FLAG;
 		ret = copy_from_gva(vcpu, vie->inst, guest_rip_gva, inst_len, &err_code, &fault_addr);
 		if (ret < 0) {
@@ -1718,6 +1791,56 @@ static int32_t vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu)
 	return ret;
 }
 
+static inline struct instr_emul_cache_entry *vie_cache_slot(struct acrn_vcpu *vcpu, uint64_t rip_gla)
+{
+	uint64_t h = rip_gla * 0x9E3779B97F4A7C15UL;
+
+	return &vcpu->inst_cache.entries[h >> (64U - 4U)];
+}
+
+/*
+ * @pre vie holds the instruction bytes fetched at rip_gla by vie_init()
+ */
+static bool vie_cache_lookup(struct acrn_vcpu *vcpu, uint64_t rip_gla,
+	enum vm_cpu_mode cpu_mode, uint32_t csar, struct instr_emul_vie *vie)
+{
+	const struct instr_emul_cache_entry *entry = vie_cache_slot(vcpu, rip_gla);
+	bool hit = false;
+	uint8_t i;
+
+	if (entry->valid && (entry->rip_gla == rip_gla) && (entry->vie.num_valid == vie->num_valid) &&
+		(entry->cpu_mode == (uint8_t)cpu_mode) && (entry->csar == csar)) {
+		hit = true;
+		for (i = 0U; i < vie->num_valid; i++) {
+			if (entry->vie.inst[i] != vie->inst[i]) {
+				hit = false;
+				break;
+			}
+		}
+	}
+
+	if (hit) {
+		*vie = entry->vie;
+		vcpu->inst_cache.hits++;
+	} else {
+		vcpu->inst_cache.misses++;
+	}
+
+	return hit;
+}
+
+static void vie_cache_insert(struct acrn_vcpu *vcpu, uint64_t rip_gla,
+	enum vm_cpu_mode cpu_mode, uint32_t csar, const struct instr_emul_vie *vie)
+{
+	struct instr_emul_cache_entry *entry = vie_cache_slot(vcpu, rip_gla);
+
+	entry->rip_gla = rip_gla;
+	entry->csar = csar;
+	entry->cpu_mode = (uint8_t)cpu_mode;
+	entry->vie = *vie;
+	entry->valid = true;
+}
+
 static int32_t vie_peek(const struct instr_emul_vie *vie, uint8_t *x)
 {
 	int32_t ret;
@@ -2349,18 +2472,21 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu, bool full_decode)
 	uint32_t csar;
 	int32_t retval;
 	enum vm_cpu_mode cpu_mode;
+	uint64_t rip_gla;
 
 	emul_ctxt = &vcpu->inst_ctxt;
-	retval = vie_init(&emul_ctxt->vie, vcpu);
+	csar = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CS_ATTR);
+	cpu_mode = get_vcpu_mode(vcpu);
+	rip_gla = vie_rip_gla(vcpu, cpu_mode);
+
+	retval = vie_init(&emul_ctxt->vie, vcpu, rip_gla);
 
 	if (retval < 0) {
 		if (retval != -EFAULT) {
 			pr_err("init vie failed @ 0x%016lx:", vcpu_get_rip(vcpu));
 		}
-	} else {
-		csar = exec_vmread32(VMX_GUEST_CS_ATTR);
-		cpu_mode = get_vcpu_mode(vcpu);
-
+	} else if (!vie_cache_lookup(vcpu, rip_gla, cpu_mode, csar, &emul_ctxt->vie)) {
+		/* A cache hit of the fetched bytes skips the decoder */
 		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie);
 
 		if (retval != 0) {
@@ -2370,32 +2496,38 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu, bool full_decode)
 				retval = -EFAULT;
 			}
 		} else {
-			/*
-			 * We do operand check in instruction decode phase and
-			 * inject exception accordingly. In late instruction
-			 * emulation, it will always success.
-			 *
-			 * We only need to do dst check for movs. For other instructions,
-			 * they always has one register and one mmio which trigger EPT
-			 * by access mmio. With VMX enabled, the related check is done
-			 * by VMX itself before hit EPT violation.
-			 *
-			 */
-			if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_CHECK_GVA_DI) != 0U) {
-				retval = instr_check_di(vcpu);
-			} else {
-				retval = instr_check_gva(vcpu, cpu_mode);
-			}
+			vie_cache_insert(vcpu, rip_gla, cpu_mode, csar, &emul_ctxt->vie);
+		}
+	} else {
+		/* decoded from the cache */
+	}
 
-			if (retval >= 0) {
-				/* return the Memory Operand byte size */
-				if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_BYTE_OP) != 0U) {
-					retval = 1;
-				} else if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_WORD_OP) != 0U) {
-					retval = 2;
-				} else {
-					retval = (int32_t)emul_ctxt->vie.opsize;
-				}
+	if (retval == 0) {
+		/*
+		 * We do operand check in instruction decode phase and
+		 * inject exception accordingly. In late instruction
+		 * emulation, it will always success.
+		 *
+		 * We only need to do dst check for movs. For other instructions,
+		 * they always has one register and one mmio which trigger EPT
+		 * by access mmio. With VMX enabled, the related check is done
+		 * by VMX itself before hit EPT violation.
+		 *
+		 */
+		if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_CHECK_GVA_DI) != 0U) {
+			retval = instr_check_di(vcpu);
+		} else {
+			retval = instr_check_gva(vcpu, cpu_mode);
+		}
+
+		if (retval >= 0) {
+			/* return the Memory Operand byte size */
+			if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_BYTE_OP) != 0U) {
+				retval = 1;
+			} else if ((emul_ctxt->vie.op.op_flags & VIE_OP_F_WORD_OP) != 0U) {
+				retval = 2;
+			} else {
+				retval = (int32_t)emul_ctxt->vie.opsize;
 			}
 		}
 	}
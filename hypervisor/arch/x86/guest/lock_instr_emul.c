@@ -12,8 +12,138 @@
 #include <asm/cpu_caps.h>
 #include <logmsg.h>
 #include <errno.h>
+#include <ticks.h>
+#include <schedule.h>
 #include <asm/guest/lock_instr_emul.h>
 
+void init_lock_instr_stat(struct acrn_vm *vm)
+{
+	struct lock_instr_stat *stat = &vm->lock_instr_stat;
+
+	spinlock_init(&stat->lock);
+	(void)memset((void *)stat->rips, 0U, sizeof(stat->rips));
+	stat->interval = (TICKS_PER_MS * 1000UL) / LOCK_INSTR_RATE;
+	stat->tolerance = stat->interval * (LOCK_INSTR_BURST - 1U);
+	stat->tat = 0UL;
+	stat->emulated = 0UL;
+	stat->bus_locks = 0UL;
+	stat->throttled = 0UL;
+	stat->throttled_ticks = 0UL;
+}
+
+/*
+ * Take a token for a locked instruction of vcpu at rip, counting it in the
+ * table of the RIPs. Returns the ticks the vCPU has to wait for it, the token
+ * is reserved anyway.
+ */
+static uint64_t lock_instr_take_token(struct acrn_vcpu *vcpu, uint64_t rip, bool bus_lock)
+{
+	struct lock_instr_stat *stat = &vcpu->vm->lock_instr_stat;
+	struct lock_instr_rip *entry = &stat->rips[0];
+	uint64_t rflags, now = cpu_ticks(), delay = 0UL;
+	uint16_t i;
+
+	spinlock_irqsave_obtain(&stat->lock, &rflags);
+	if (stat->interval != 0UL) {
+		if (stat->tat < now) {
+			stat->tat = now;
+		}
+		if ((stat->tat - now) > stat->tolerance) {
+			delay = stat->tat - now - stat->tolerance;
+		}
+		stat->tat += stat->interval;
+	}
+
+	for (i = 0U; i < LOCK_INSTR_NR_RIPS; i++) {
+		if ((stat->rips[i].count != 0UL) && (stat->rips[i].rip == rip)) {
+			entry = &stat->rips[i];
+			break;
+		}
+		if (stat->rips[i].count < entry->count) {
+			entry = &stat->rips[i];
+		}
+	}
+	if ((entry->count == 0UL) || (entry->rip != rip)) {
+		entry->rip = rip;
+		entry->count = 0UL;
+	}
+	entry->count++;
+
+	if (bus_lock) {
+		stat->bus_locks++;
+	}
+	if (delay != 0UL) {
+		stat->throttled++;
+		stat->throttled_ticks += delay;
+	}
+	spinlock_irqrestore_release(&stat->lock, rflags);
+
+	return delay;
+}
+
+static void lock_instr_count_emulation(struct acrn_vm *vm)
+{
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vm->lock_instr_stat.lock, &rflags);
+	vm->lock_instr_stat.emulated++;
+	spinlock_irqrestore_release(&vm->lock_instr_stat.lock, rflags);
+}
+
+/*
+ * Whether the locked instruction vcpu faulted on has to wait for its token.
+ * It is then retried once the vCPU was held back long enough, with the token
+ * taken already.
+ */
+static bool lock_instr_throttled(struct acrn_vcpu *vcpu)
+{
+	uint64_t delay;
+	bool ret = false;
+
+	if (vcpu->arch.lock_instr_token) {
+		vcpu->arch.lock_instr_token = false;
+	} else {
+		delay = lock_instr_take_token(vcpu, vcpu_get_rip(vcpu), false);
+		if (delay != 0UL) {
+			vcpu->arch.lock_instr_deadline = cpu_ticks() + delay;
+			vcpu->arch.lock_instr_token = true;
+			ret = true;
+		}
+	}
+
+	return ret;
+}
+
+void lock_instr_bus_lock(struct acrn_vcpu *vcpu)
+{
+	uint64_t delay = lock_instr_take_token(vcpu, vcpu_get_rip(vcpu), true);
+
+	if (delay != 0UL) {
+		vcpu->arch.lock_instr_deadline = cpu_ticks() + delay;
+	}
+}
+
+void lock_instr_throttle(struct acrn_vcpu *vcpu)
+{
+	if (vcpu->arch.lock_instr_deadline != 0UL) {
+		while (cpu_ticks() < vcpu->arch.lock_instr_deadline) {
+			yield_current();
+			schedule();
+			asm_pause();
+		}
+		vcpu->arch.lock_instr_deadline = 0UL;
+	}
+}
+
+int32_t bus_lock_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	/* trap-like, the guest RIP is after the instruction which locked the bus */
+	vcpu_retain_rip(vcpu);
+	lock_instr_bus_lock(vcpu);
+
+	return 0;
+}
+
 static bool is_guest_ac_enabled(struct acrn_vcpu *vcpu)
 {
 	bool ret = false;
@@ -102,13 +232,19 @@ int32_t emulate_lock_instr(struct acrn_vcpu *vcpu, uint32_t exception_vector, bo
 				 * If #AC/#GP is caused by instruction with LOCK prefix or xchg, then emulate it,
 				 * otherwise, inject it back.
 				 */
-				if (inst[0] == 0xf0U) {  /* This is LOCK prefix */
+				if ((inst[0] == 0xf0U) && lock_instr_throttled(vcpu)) {
+					/* Retry it once the vCPU was held back, without the #AC/#GP */
+					vcpu_retain_rip(vcpu);
+					*queue_exception = false;
+				} else if (inst[0] == 0xf0U) {  /* This is LOCK prefix */
 					/*
 					 * Kick other vcpus of the guest to stop execution
 					 * until the split-lock/uc-lock emulation being completed.
 					 */
 					vcpu_kick_lock_instr_emulation(vcpu);
 
+					lock_instr_count_emulation(vcpu->vm);
+
 					/*
 					 * Skip the LOCK prefix and re-execute the instruction.
 					 */
@@ -129,7 +265,10 @@ int32_t emulate_lock_instr(struct acrn_vcpu *vcpu, uint32_t exception_vector, bo
 						 * If this is the xchg, then emulate it, otherwise,
 						 * inject it back.
 						 */
-						if (is_current_opcode_xchg(vcpu)) {
+						if (is_current_opcode_xchg(vcpu) && lock_instr_throttled(vcpu)) {
+							vcpu_retain_rip(vcpu);
+							*queue_exception = false;
+						} else if (is_current_opcode_xchg(vcpu)) {
 							/*
 							 * Kick other vcpus of the guest to stop execution
 							 * until the split-lock/uc-lock emulation being completed.
@@ -141,6 +280,7 @@ int32_t emulate_lock_instr(struct acrn_vcpu *vcpu, uint32_t exception_vector, bo
 							 * is only called by split-lock/uc-lock emulation.
 							 */
 							vcpu->arch.emulating_lock = true;
+							lock_instr_count_emulation(vcpu->vm);
 							status = emulate_instruction(vcpu);
 							vcpu->arch.emulating_lock = false;
 							if (status < 0) {
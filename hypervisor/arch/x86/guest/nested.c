@@ -172,8 +172,9 @@ void init_vmx_msrs(struct acrn_vcpu *vcpu)
 		/*
 		 * Hide 5 level EPT capability
 		 * Hide accessed and dirty flags for EPT
+		 * Hide 1G pages, 2M pages are shadowed by vept.c
 		 */
-		msr_value &= ~(VMX_EPT_PAGE_WALK_5 | VMX_EPT_AD | VMX_EPT_2MB_PAGE | VMX_EPT_1GB_PAGE);
+		msr_value &= ~(VMX_EPT_PAGE_WALK_5 | VMX_EPT_AD | VMX_EPT_1GB_PAGE);
 		vcpu_set_guest_msr(vcpu, MSR_IA32_VMX_EPT_VPID_CAP, msr_value);
 
 		/* For now passthru the value from physical MSR to L1 guest */
@@ -717,7 +718,7 @@ static void reset_vvmcs(struct acrn_vcpu *vcpu)
 	for (idx = 0U; idx < MAX_ACTIVE_VVMCS_NUM; idx++) {
 		vvmcs = &vcpu->arch.nested.vvmcs[idx];
 		vvmcs->host_state_dirty = false;
-		vvmcs->control_fields_dirty = false;
+		vvmcs->control_fields_dirty = 0U;
 		vvmcs->vmcs12_gpa = INVALID_GPA;
 		vvmcs->ref_cnt = 0;
 
@@ -917,6 +918,54 @@ int32_t vmread_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+/*
+ * The non-shadowed fields merged into VMCS02 by merge_and_sync_control_fields(),
+ * one bit each in acrn_vvmcs.control_fields_dirty
+ */
+#define VMCS12_MSR_BITMAP_DIRTY		(1U << 0U)
+#define VMCS12_EPT_POINTER_DIRTY	(1U << 1U)
+#define VMCS12_VPID_DIRTY		(1U << 2U)
+#define VMCS12_ENTRY_CONTROLS_DIRTY	(1U << 3U)
+#define VMCS12_EXIT_CONTROLS_DIRTY	(1U << 4U)
+#define VMCS12_ALL_CONTROLS_DIRTY	0x1FU
+
+/*
+ * @brief Record that L1 changed a non-shadowed field of the current VMCS12
+ *
+ * @pre vvmcs != NULL
+ */
+static void mark_vmcs12_field_dirty(struct acrn_vvmcs *vvmcs, uint32_t vmcs_field, uint64_t vmcs_value)
+{
+	switch (vmcs_field) {
+	case VMX_MSR_BITMAP_FULL:
+		vvmcs->control_fields_dirty |= VMCS12_MSR_BITMAP_DIRTY;
+		break;
+	case VMX_EPT_POINTER_FULL:
+		vvmcs->control_fields_dirty |= VMCS12_EPT_POINTER_DIRTY;
+		put_vept_desc(vvmcs->vmcs12.ept_pointer);
+		(void)get_vept_desc(vmcs_value);
+		break;
+	case VMX_VPID:
+		vvmcs->control_fields_dirty |= VMCS12_VPID_DIRTY;
+		break;
+	case VMX_ENTRY_CONTROLS:
+		vvmcs->control_fields_dirty |= VMCS12_ENTRY_CONTROLS_DIRTY;
+		break;
+	case VMX_EXIT_CONTROLS:
+		vvmcs->control_fields_dirty |= VMCS12_EXIT_CONTROLS_DIRTY;
+		break;
+	case VMX_HOST_RSP:
+	case VMX_HOST_RIP:
+		/* loaded on each L2 VM exit by set_vmcs01_guest_state() */
+		break;
+	default:
+		if (VMX_VMCS_FIELD_TYPE(vmcs_field) == VMX_VMCS_FIELD_TYPE_HOST) {
+			vvmcs->host_state_dirty = true;
+		}
+		break;
+	}
+}
+
 /*
  * @brief emulate VMWRITE instruction from L1
  * @pre vcpu != NULL
@@ -947,23 +996,9 @@ int32_t vmwrite_vmexit_handler(struct acrn_vcpu *vcpu)
 					(void)copy_from_gpa(vcpu->vm, &vmcs_value, gpa, 8U);
 				}
 
-				if (VMX_VMCS_FIELD_TYPE(vmcs_field) == VMX_VMCS_FIELD_TYPE_HOST) {
-					cur_vvmcs->host_state_dirty = true;
-				}
-
-				if ((vmcs_field == VMX_MSR_BITMAP_FULL)
-					|| (vmcs_field == VMX_EPT_POINTER_FULL)
-					|| (vmcs_field == VMX_VPID)
-					|| (vmcs_field == VMX_ENTRY_CONTROLS)
-					|| (vmcs_field == VMX_EXIT_CONTROLS)) {
-					cur_vvmcs->control_fields_dirty = true;
-
-					if (vmcs_field == VMX_EPT_POINTER_FULL) {
-						if (cur_vvmcs->vmcs12.ept_pointer != vmcs_value) {
-							put_vept_desc(cur_vvmcs->vmcs12.ept_pointer);
-							get_vept_desc(vmcs_value);
-						}
-					}
+				/* L1 rewrites unchanged fields, only what changes has to be merged again */
+				if (vmcs12_read_field(&cur_vvmcs->vmcs12, vmcs_field) != vmcs_value) {
+					mark_vmcs12_field_dirty(cur_vvmcs, vmcs_field, vmcs_value);
 				}
 
 				pr_dbg("vmcs_field: %x vmcs_value: %llx", vmcs_field, vmcs_value);
@@ -997,33 +1032,47 @@ static void sync_vmcs02_to_vmcs12(struct acrn_vmcs12 *vmcs12)
  * @pre vcpu != NULL
  * @pre VMCS02 (as an ordinary VMCS) is current
  */
-static void merge_and_sync_control_fields(struct acrn_vcpu *vcpu, struct acrn_vmcs12 *vmcs12)
+static void merge_and_sync_control_fields(struct acrn_vcpu *vcpu, struct acrn_vmcs12 *vmcs12, uint32_t dirty)
 {
 	uint64_t value64;
 
-	/* Sync VMCS fields that are not shadowing. Don't need to sync these fields back to VMCS12. */
+	/*
+	 * Sync the VMCS fields in dirty, that are not shadowing.
+	 * Don't need to sync these fields back to VMCS12.
+	 */
 
-	exec_vmwrite(VMX_MSR_BITMAP_FULL, gpa2hpa(vcpu->vm, vmcs12->msr_bitmap));
-	exec_vmwrite(VMX_EPT_POINTER_FULL, get_shadow_eptp(vmcs12->ept_pointer));
+	if ((dirty & VMCS12_MSR_BITMAP_DIRTY) != 0U) {
+		exec_vmwrite(VMX_MSR_BITMAP_FULL, gpa2hpa(vcpu->vm, vmcs12->msr_bitmap));
+	}
 
-	/* For VM-execution, entry and exit controls */
-	value64 = vmcs12->vm_entry_controls;
-	if ((value64 & VMX_ENTRY_CTLS_LOAD_EFER) != VMX_ENTRY_CTLS_LOAD_EFER) {
-		/*
-		 * L1 hypervisor wishes to use its IA32_EFER for L2 guest so we turn on the
-		 * VMX_ENTRY_CTLS_LOAD_EFER on VMCS02.
-		 */
-		value64 |= VMX_ENTRY_CTLS_LOAD_EFER;
-		exec_vmwrite(VMX_GUEST_IA32_EFER_FULL, vcpu_get_efer(vcpu));
+	if ((dirty & VMCS12_EPT_POINTER_DIRTY) != 0U) {
+		exec_vmwrite(VMX_EPT_POINTER_FULL, get_shadow_eptp(vmcs12->ept_pointer));
 	}
 
-	exec_vmwrite(VMX_ENTRY_CONTROLS, value64);
+	/* For VM-execution, entry and exit controls */
+	if ((dirty & VMCS12_ENTRY_CONTROLS_DIRTY) != 0U) {
+		value64 = vmcs12->vm_entry_controls;
+		if ((value64 & VMX_ENTRY_CTLS_LOAD_EFER) != VMX_ENTRY_CTLS_LOAD_EFER) {
+			/*
+			 * L1 hypervisor wishes to use its IA32_EFER for L2 guest so we turn on the
+			 * VMX_ENTRY_CTLS_LOAD_EFER on VMCS02.
+			 */
+			value64 |= VMX_ENTRY_CTLS_LOAD_EFER;
+			exec_vmwrite(VMX_GUEST_IA32_EFER_FULL, vcpu_get_efer(vcpu));
+		}
 
-	/* Host is alway runing in 64-bit mode */
-	value64 = vmcs12->vm_exit_controls | VMX_EXIT_CTLS_HOST_ADDR64;
-	exec_vmwrite(VMX_EXIT_CONTROLS, value64);
+		exec_vmwrite(VMX_ENTRY_CONTROLS, value64);
+	}
+
+	if ((dirty & VMCS12_EXIT_CONTROLS_DIRTY) != 0U) {
+		/* Host is alway runing in 64-bit mode */
+		value64 = vmcs12->vm_exit_controls | VMX_EXIT_CTLS_HOST_ADDR64;
+		exec_vmwrite(VMX_EXIT_CONTROLS, value64);
+	}
 
-	exec_vmwrite(VMX_VPID, vmcs12->vpid);
+	if ((dirty & VMCS12_VPID_DIRTY) != 0U) {
+		exec_vmwrite(VMX_VPID, vmcs12->vpid);
+	}
 }
 
 /**
@@ -1042,7 +1091,7 @@ static void sync_vmcs12_to_vmcs02(struct acrn_vcpu *vcpu, struct acrn_vmcs12 *vm
 		exec_vmwrite(vmcs_shadowing_fields[idx], val64);
 	}
 
-	merge_and_sync_control_fields(vcpu, vmcs12);
+	merge_and_sync_control_fields(vcpu, vmcs12, VMCS12_ALL_CONTROLS_DIRTY);
 }
 
 /*
@@ -1143,7 +1192,7 @@ static void clear_vvmcs(struct acrn_vcpu *vcpu, struct acrn_vvmcs *vvmcs)
 
 	/* Cleanup per VVMCS dirty flags */
 	vvmcs->host_state_dirty = false;
-	vvmcs->control_fields_dirty = false;
+	vvmcs->control_fields_dirty = 0U;
 }
 
 /*
@@ -1212,6 +1261,9 @@ int32_t vmptrld_vmexit_handler(struct acrn_vcpu *vcpu)
 			/* VMCS02 is referenced by VMCS01 Link Pointer */
 			enable_vmcs_shadowing(vvmcs);
 
+			/* VMCS01 doesn't hold the host state of this VMCS12, load it on the next L2 VM exit */
+			vvmcs->host_state_dirty = true;
+
 			vvmcs->vmcs12_gpa = vmcs12_gpa;
 			nested->current_vvmcs = vvmcs;
 			nested_vmx_result(VMsucceed, 0);
@@ -1433,6 +1485,9 @@ int32_t nested_vmexit_handler(struct acrn_vcpu *vcpu)
 	if (is_l1_vmexit) {
 		sanitize_l2_vpid(&cur_vvmcs->vmcs12);
 
+		/* the VMCS cache holds fields of VMCS02 */
+		vcpu_vmcs_cache_flush(vcpu);
+
 		/*
 		 * Clear VMCS02 because: ISDM: Before modifying the shadow-VMCS indicator,
 		 * software should execute VMCLEAR for the VMCS to ensure that it is not active.
@@ -1485,6 +1540,9 @@ static void nested_vmentry(struct acrn_vcpu *vcpu, bool is_launch)
 		 * Refer to ISDM Vol3 VMX Instructions reference.
 		 */
 
+		/* the VMCS cache holds fields of VMCS01 */
+		vcpu_vmcs_cache_flush(vcpu);
+
 		/*
 		 * Convert the shadow VMCS to an ordinary VMCS.
 		 * ISDM: Software should not modify the shadow-VMCS indicator in
@@ -1496,9 +1554,9 @@ static void nested_vmentry(struct acrn_vcpu *vcpu, bool is_launch)
 		/* as an ordinary VMCS, VMCS02 is active and currernt when L2 guest is running */
 		load_va_vmcs(cur_vvmcs->vmcs02);
 
-		if (cur_vvmcs->control_fields_dirty) {
-			cur_vvmcs->control_fields_dirty = false;
-			merge_and_sync_control_fields(vcpu, vmcs12);
+		if (cur_vvmcs->control_fields_dirty != 0U) {
+			merge_and_sync_control_fields(vcpu, vmcs12, cur_vvmcs->control_fields_dirty);
+			cur_vvmcs->control_fields_dirty = 0U;
 		}
 
 		/* vCPU is in guest mode from this point */
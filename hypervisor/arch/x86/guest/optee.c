@@ -13,6 +13,8 @@
 #include <asm/guest/vlapic.h>
 #include <asm/guest/virq.h>
 #include <asm/lapic.h>
+#include <asm/tsc.h>
+#include <trace.h>
 #include <reloc.h>
 #include <hypercall.h>
 #include <logmsg.h>
@@ -61,6 +63,7 @@ static int32_t tee_switch_to_ree(struct acrn_vcpu *vcpu)
 	struct acrn_vcpu *ree_vcpu;
 	uint32_t pending_intr;
 	int32_t ret = -EINVAL;
+	uint64_t now = cpu_ticks();
 
 	rdi = vcpu_get_gpreg(vcpu, CPU_REG_RDI);
 	rsi = vcpu_get_gpreg(vcpu, CPU_REG_RSI);
@@ -71,6 +74,11 @@ static int32_t tee_switch_to_ree(struct acrn_vcpu *vcpu)
 	ree_vcpu = vcpu_from_pid(ree_vm, get_pcpu_id());
 
 	if (ree_vcpu != NULL) {
+		/* a FIQ return resumes the REE without completing its call */
+		if (rdi != OPTEE_RETURN_FIQ_DONE) {
+			tee_call_done(ree_vcpu, now);
+		}
+
 		/*
 		 * We should avoid copy any values to REE registers,
 		 * If this is a FIQ return.
@@ -137,6 +145,9 @@ static int32_t ree_switch_to_tee(struct acrn_vcpu *vcpu)
 		vcpu_set_gpreg(tee_vcpu, CPU_REG_RBX, rbx);
 		vcpu_set_gpreg(tee_vcpu, CPU_REG_RCX, rcx);
 
+		tee_call_start(vcpu, cpu_ticks());
+		tee_vcpu->tee_stat.switch_armed = cpu_ticks();
+		tee_vcpu->tee_stat.switch_reason = TEE_SWITCH_CALL;
 		wake_thread(&tee_vcpu->thread_obj);
 
 		ret = 0;
@@ -182,6 +193,57 @@ int32_t hcall_switch_ee(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_
 	return ret;
 }
 
+/*
+ * Switch to the TEE right away for a secure interrupt taken while the REE runs on this pCPU:
+ * the TEE vCPU is prioritized over the REE one instead of waiting for the REE to yield.
+ * A TEE vCPU already woken up by a REE call takes the interrupt when it runs, with RDI left
+ * to the call.
+ */
+static void tee_switch_for_fiq(struct acrn_vcpu *tee_vcpu)
+{
+	if (tee_vcpu->thread_obj.status == THREAD_STS_BLOCKED) {
+		/*
+		 * Copy 0xB20000FF to RDI to indicate the switch is from secure interrupt
+		 * This is the contract with OPTEE.
+		 */
+		vcpu_set_gpreg(tee_vcpu, CPU_REG_RDI, OPTEE_FIQ_ENTRY);
+
+		tee_vcpu->tee_stat.switch_armed = cpu_ticks();
+		tee_vcpu->tee_stat.switch_reason = TEE_SWITCH_FIQ;
+		wake_thread(&tee_vcpu->thread_obj);
+	}
+	(void)prioritize_thread(&tee_vcpu->thread_obj);
+}
+
+/*
+ * A secure interrupt VT-d posted to the PIR of a TEE vCPU which isn't running: the TEE vCPU sleeps
+ * with notifications enabled while its REE vCPU runs, so the notification arrives here rather than
+ * being delivered by the CPU. The interrupt is in the PIR already, only the switch is left to do.
+ */
+void handle_x86_tee_posted_int(struct acrn_vcpu *tee_vcpu, uint16_t pcpu_id)
+{
+	struct acrn_vcpu *curr_vcpu = get_running_vcpu(pcpu_id);
+
+	if ((curr_vcpu != NULL) && is_ree_vm(curr_vcpu->vm) && (get_companion_vm(curr_vcpu->vm) == tee_vcpu->vm)) {
+		tee_vcpu->tee_stat.fiq_posted++;
+		tee_switch_for_fiq(tee_vcpu);
+	}
+}
+
+/*
+ * Trace how long the TEE vCPU waited to run since it was woken up to enter the TEE,
+ * on its switch in.
+ */
+void tee_vcpu_switch_in(struct acrn_vcpu *tee_vcpu)
+{
+	struct vcpu_tee_stat *stat = &tee_vcpu->tee_stat;
+
+	if (stat->switch_armed != 0UL) {
+		TRACE_2L(TRACE_TEE_SWITCH, stat->switch_reason, cpu_ticks() - stat->switch_armed);
+		stat->switch_armed = 0UL;
+	}
+}
+
 void handle_x86_tee_int(struct ptirq_remapping_info *entry, uint16_t pcpu_id)
 {
 	struct acrn_vcpu *tee_vcpu;
@@ -206,13 +268,7 @@ void handle_x86_tee_int(struct ptirq_remapping_info *entry, uint16_t pcpu_id)
 		 * and copy 0xB20000FF to RDI to notify OPTEE about this.
 		 */
 		tee_vcpu = vcpu_from_pid(entry->vm, pcpu_id);
-		/*
-		 * Copy 0xB20000FF to RDI to indicate the switch is from secure interrupt
-		 * This is the contract with OPTEE.
-		 */
-		vcpu_set_gpreg(tee_vcpu, CPU_REG_RDI, OPTEE_FIQ_ENTRY);
-
-		wake_thread(&tee_vcpu->thread_obj);
+		tee_switch_for_fiq(tee_vcpu);
 	} else {
 		/* Nothing need to do for this moment */
 	}
@@ -18,6 +18,7 @@
 #include <logmsg.h>
 #include <asm/seed.h>
 #include <asm/tsc.h>
+#include <trace.h>
 
 #define TRUSTY_VERSION   1U
 #define TRUSTY_VERSION_2 2U
@@ -160,9 +161,42 @@ static void save_world_ctx(struct acrn_vcpu *vcpu, struct ext_context *ext_ctx)
 	}
 }
 
-static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext_ctx)
+static inline bool segment_changed(const struct segment_sel *prev, const struct segment_sel *next)
 {
-	uint32_t i;
+	return (prev->selector != next->selector) || (prev->base != next->base) ||
+		(prev->limit != next->limit) || (prev->attr != next->attr);
+}
+
+/*
+ * Write a field of the next world only when it differs from the one of the world just saved:
+ * the worlds share the VMCS and the MSRs, so whatever both worlds agree on (TSC offset, PAT,
+ * TSC_AUX, most segments in 64-bit mode) is left in place and counted as skipped.
+ */
+#define load_field(prev, next, member, write, field, skipped)		\
+{									\
+	if ((prev)->member != (next)->member) {				\
+		write(field, (next)->member);				\
+	} else {							\
+		(skipped)++;						\
+	}								\
+}
+
+#define load_segment_field(prev, next, seg, SEG_NAME, skipped)		\
+{									\
+	if (segment_changed(&(prev)->seg, &(next)->seg)) {		\
+		load_segment((next)->seg, SEG_NAME);			\
+	} else {							\
+		(skipped)++;						\
+	}								\
+}
+
+static uint32_t load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *prev_ctx,
+		struct ext_context *ext_ctx)
+{
+	uint32_t i, skipped = 0U;
+
+	/* CR3 and CS of the other world are written to the VMCS below */
+	vcpu_vmcs_cache_flush(vcpu);
 
 	/* mark to update on-demand run_context for efer/rflags/rsp/rip/cr0/cr4 */
 	bitmap_set_nolock(CPU_REG_EFER, &vcpu->reg_updated);
@@ -173,36 +207,36 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	bitmap_set_nolock(CPU_REG_CR4, &vcpu->reg_updated);
 
 	/* VMCS Execution field */
-	exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
+	load_field(prev_ctx, ext_ctx, tsc_offset, exec_vmwrite64, VMX_TSC_OFFSET_FULL, skipped);
 
 	/* VMCS GUEST field */
-	exec_vmwrite(VMX_GUEST_CR3, ext_ctx->cr3);
-	exec_vmwrite(VMX_GUEST_DR7, ext_ctx->dr7);
-	exec_vmwrite64(VMX_GUEST_IA32_DEBUGCTL_FULL, ext_ctx->ia32_debugctl);
-	exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL, ext_ctx->ia32_pat);
-	exec_vmwrite32(VMX_GUEST_IA32_SYSENTER_CS, ext_ctx->ia32_sysenter_cs);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_ESP, ext_ctx->ia32_sysenter_esp);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_EIP, ext_ctx->ia32_sysenter_eip);
-	load_segment(ext_ctx->cs, VMX_GUEST_CS);
-	load_segment(ext_ctx->ss, VMX_GUEST_SS);
-	load_segment(ext_ctx->ds, VMX_GUEST_DS);
-	load_segment(ext_ctx->es, VMX_GUEST_ES);
-	load_segment(ext_ctx->fs, VMX_GUEST_FS);
-	load_segment(ext_ctx->gs, VMX_GUEST_GS);
-	load_segment(ext_ctx->tr, VMX_GUEST_TR);
-	load_segment(ext_ctx->ldtr, VMX_GUEST_LDTR);
+	load_field(prev_ctx, ext_ctx, cr3, exec_vmwrite, VMX_GUEST_CR3, skipped);
+	load_field(prev_ctx, ext_ctx, dr7, exec_vmwrite, VMX_GUEST_DR7, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_debugctl, exec_vmwrite64, VMX_GUEST_IA32_DEBUGCTL_FULL, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_pat, exec_vmwrite64, VMX_GUEST_IA32_PAT_FULL, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_sysenter_cs, exec_vmwrite32, VMX_GUEST_IA32_SYSENTER_CS, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_sysenter_esp, exec_vmwrite, VMX_GUEST_IA32_SYSENTER_ESP, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_sysenter_eip, exec_vmwrite, VMX_GUEST_IA32_SYSENTER_EIP, skipped);
+	load_segment_field(prev_ctx, ext_ctx, cs, VMX_GUEST_CS, skipped);
+	load_segment_field(prev_ctx, ext_ctx, ss, VMX_GUEST_SS, skipped);
+	load_segment_field(prev_ctx, ext_ctx, ds, VMX_GUEST_DS, skipped);
+	load_segment_field(prev_ctx, ext_ctx, es, VMX_GUEST_ES, skipped);
+	load_segment_field(prev_ctx, ext_ctx, fs, VMX_GUEST_FS, skipped);
+	load_segment_field(prev_ctx, ext_ctx, gs, VMX_GUEST_GS, skipped);
+	load_segment_field(prev_ctx, ext_ctx, tr, VMX_GUEST_TR, skipped);
+	load_segment_field(prev_ctx, ext_ctx, ldtr, VMX_GUEST_LDTR, skipped);
 	/* Only base and limit for IDTR and GDTR */
-	exec_vmwrite(VMX_GUEST_IDTR_BASE, ext_ctx->idtr.base);
-	exec_vmwrite(VMX_GUEST_GDTR_BASE, ext_ctx->gdtr.base);
-	exec_vmwrite32(VMX_GUEST_IDTR_LIMIT, ext_ctx->idtr.limit);
-	exec_vmwrite32(VMX_GUEST_GDTR_LIMIT, ext_ctx->gdtr.limit);
-
-	/* MSRs which not in the VMCS */
-	msr_write(MSR_IA32_STAR, ext_ctx->ia32_star);
-	msr_write(MSR_IA32_LSTAR, ext_ctx->ia32_lstar);
-	msr_write(MSR_IA32_FMASK, ext_ctx->ia32_fmask);
-	msr_write(MSR_IA32_KERNEL_GS_BASE, ext_ctx->ia32_kernel_gs_base);
-	msr_write(MSR_IA32_TSC_AUX, ext_ctx->tsc_aux);
+	load_field(prev_ctx, ext_ctx, idtr.base, exec_vmwrite, VMX_GUEST_IDTR_BASE, skipped);
+	load_field(prev_ctx, ext_ctx, gdtr.base, exec_vmwrite, VMX_GUEST_GDTR_BASE, skipped);
+	load_field(prev_ctx, ext_ctx, idtr.limit, exec_vmwrite32, VMX_GUEST_IDTR_LIMIT, skipped);
+	load_field(prev_ctx, ext_ctx, gdtr.limit, exec_vmwrite32, VMX_GUEST_GDTR_LIMIT, skipped);
+
+	/* MSRs which not in the VMCS, a WRMSR costs far more than the compare */
+	load_field(prev_ctx, ext_ctx, ia32_star, msr_write, MSR_IA32_STAR, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_lstar, msr_write, MSR_IA32_LSTAR, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_fmask, msr_write, MSR_IA32_FMASK, skipped);
+	load_field(prev_ctx, ext_ctx, ia32_kernel_gs_base, msr_write, MSR_IA32_KERNEL_GS_BASE, skipped);
+	load_field(prev_ctx, ext_ctx, tsc_aux, msr_write, MSR_IA32_TSC_AUX, skipped);
 
 	/* XSAVE area */
 	rstore_xsave_area(vcpu, ext_ctx);
@@ -211,6 +245,8 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	for (i = 0U; i < NUM_WORLD_MSRS; i++) {
 		vcpu->arch.guest_msrs[i] = vcpu->arch.contexts[!vcpu->arch.cur_context].world_msrs[i];
 	}
+
+	return skipped;
 }
 
 static void copy_smc_param(const struct run_context *prev_ctx,
@@ -226,11 +262,15 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 {
 	struct acrn_vcpu_arch *arch = &vcpu->arch;
 
+	struct vcpu_tee_stat *stat = &vcpu->tee_stat;
+	uint64_t start = cpu_ticks();
+
 	/* save previous world context */
 	save_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx);
 
-	/* load next world context */
-	load_world_ctx(vcpu, &arch->contexts[next_world].ext_ctx);
+	/* load next world context, only the fields which differ from the previous one */
+	stat->fields_skipped += load_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx,
+			&arch->contexts[next_world].ext_ctx);
 
 	/* Copy SMC parameters: RDI, RSI, RDX, RBX */
 	copy_smc_param(&arch->contexts[!next_world].run_ctx,
@@ -253,6 +293,15 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 
 	/* Update world index */
 	arch->cur_context = next_world;
+
+	stat->switches++;
+	stat->switch_ticks += cpu_ticks() - start;
+	TRACE_2L(TRACE_TEE_SWITCH, TEE_SWITCH_TRUSTY, cpu_ticks() - start);
+	if (next_world == SECURE_WORLD) {
+		tee_call_start(vcpu, start);
+	} else {
+		tee_call_done(vcpu, start);
+	}
 }
 
 /* Put key_info and trusty_startup_param in the first Page of Trusty
@@ -400,7 +400,7 @@ int32_t write_vclosid(struct acrn_vcpu *vcpu, uint64_t val)
 
 		/*
 		 * Validity check on val:
-		 * Bits 9:0: RMID (always 0 for now)
+		 * Bits 9:0: RMID (always 0, the RMID of the VM is kept by the hypervisor)
 		 * Bits 31:10: reserved and must be written with zeros
 		 * Bits 63:32: vclosid (must be within permitted range)
 		 */
@@ -418,7 +418,8 @@ int32_t write_vclosid(struct acrn_vcpu *vcpu, uint64_t val)
 			 * Here we only need to update the vcpu->arch.msr_area.guest[].value field for IA32_PQR_ASSOC,
 			 * all other vcpu->arch.msr_area fields remains unchanged at runtime.
 			 */
-			vcpu->arch.msr_area.guest[vcpu->arch.msr_area.index_of_pqr_assoc].value = clos2pqr_msr(pclosid);
+			vcpu->arch.msr_area.guest[vcpu->arch.msr_area.index_of_pqr_assoc].value =
+				vm_clos2pqr_msr(vcpu->vm->vm_id, pclosid);
 
 			ret = 0;
 		}
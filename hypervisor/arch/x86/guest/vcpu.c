@@ -9,6 +9,7 @@
 #include <asm/guest/vcpu.h>
 #include <asm/guest/virq.h>
 #include <asm/lib/bits.h>
+#include <asm/lib/atomic.h>
 #include <asm/vmx.h>
 #include <logmsg.h>
 #include <asm/cpufeatures.h>
@@ -17,11 +18,15 @@
 #include <asm/init.h>
 #include <asm/guest/vm.h>
 #include <asm/guest/vmcs.h>
+#include <asm/guest/guest_memory.h>
 #include <asm/mmu.h>
 #include <lib/sprintf.h>
 #include <asm/lapic.h>
 #include <asm/irq.h>
 #include <console.h>
+#include <asm/guest/optee.h>
+#include <asm/host_pm.h>
+#include <asm/tsc.h>
 
 /* stack_frame is linked with the sequence of stack operation in arch_switch_to() */
 struct stack_frame {
@@ -53,6 +58,49 @@ void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val)
 	ctx->cpu_regs.longs[reg] = val;
 }
 
+static const uint32_t vmcs_cache_encodings[VMCS_CACHE_FIELD_NUM] = {
+	[VMCS_CACHE_GUEST_CS_ATTR] = VMX_GUEST_CS_ATTR,
+	[VMCS_CACHE_GUEST_CR3] = VMX_GUEST_CR3,
+	[VMCS_CACHE_GUEST_INTR_STATE] = VMX_GUEST_INTERRUPTIBILITY_INFO,
+	[VMCS_CACHE_GUEST_PHYS_ADDR] = VMX_GUEST_PHYSICAL_ADDR_FULL,
+	[VMCS_CACHE_GUEST_LINEAR_ADDR] = VMX_GUEST_LINEAR_ADDR,
+	[VMCS_CACHE_EXIT_INT_INFO] = VMX_EXIT_INT_INFO,
+};
+
+uint64_t vcpu_vmcs_read(struct acrn_vcpu *vcpu, enum vmcs_cache_field field)
+{
+	struct vmcs_cache *cache = &vcpu->vmcs_cache;
+
+	if (!bitmap_test_and_set_nolock((uint16_t)field, &cache->valid)) {
+		cache->value[field] = exec_vmread64(vmcs_cache_encodings[field]);
+	}
+
+	return cache->value[field];
+}
+
+void vcpu_vmcs_write(struct acrn_vcpu *vcpu, enum vmcs_cache_field field, uint64_t val)
+{
+	struct vmcs_cache *cache = &vcpu->vmcs_cache;
+
+	cache->value[field] = val;
+	bitmap_set_nolock((uint16_t)field, &cache->valid);
+	bitmap_set_nolock((uint16_t)field, &cache->dirty);
+}
+
+void vcpu_vmcs_cache_flush(struct acrn_vcpu *vcpu)
+{
+	struct vmcs_cache *cache = &vcpu->vmcs_cache;
+	uint16_t field;
+
+	while (cache->dirty != 0UL) {
+		field = ffs64(cache->dirty);
+		bitmap_clear_nolock(field, &cache->dirty);
+		exec_vmwrite64(vmcs_cache_encodings[field], cache->value[field]);
+	}
+	cache->valid = 0UL;
+}
+
+
 uint64_t vcpu_get_rip(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx =
@@ -249,6 +297,9 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vcpu->arch.lapic_pt_enabled = false;
 	vcpu->arch.irq_window_enabled = false;
 	vcpu->arch.emulating_lock = false;
+	vcpu->arch.lock_instr_token = false;
+	vcpu->arch.lock_instr_deadline = 0UL;
+	vcpu->restore.pending = false;
 	(void)memset((void *)vcpu->arch.vmcs, 0U, PAGE_SIZE);
 
 	for (i = 0; i < NR_WORLD; i++) {
@@ -267,6 +318,12 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 
 	init_iwkey(vcpu);
 	vcpu->arch.iwkey_copy_status = 0UL;
+	vcpu->pv_state = NULL;
+	vcpu->steal_time.msr = 0UL;
+	vcpu->steal_time.page = NULL;
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_reset_vcpu(vcpu);
+#endif
 }
 
 struct acrn_vcpu *get_running_vcpu(uint16_t pcpu_id)
@@ -286,7 +343,7 @@ struct acrn_vcpu *get_ever_run_vcpu(uint16_t pcpu_id)
 	return per_cpu(ever_run_vcpu, pcpu_id);
 }
 
-static void set_vcpu_mode(struct acrn_vcpu *vcpu, uint32_t cs_attr, uint64_t ia32_efer,
+void set_vcpu_mode(struct acrn_vcpu *vcpu, uint32_t cs_attr, uint64_t ia32_efer,
 		uint64_t cr0)
 {
 	if ((ia32_efer & MSR_IA32_EFER_LMA_BIT) != 0UL) {
@@ -307,6 +364,12 @@ static void init_xsave(struct acrn_vcpu *vcpu)
 {
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
 	struct xsave_area *area = &ectx->xs_area;
+	int32_t i;
+
+	/* a pCPU may still hold the state of a vCPU destroyed here before, see rstore_xsave_area() */
+	for (i = 0; i < NR_WORLD; i++) {
+		vcpu->arch.contexts[i].ext_ctx.xs_pcpu = INVALID_CPU_ID;
+	}
 
 	/* if the HW has this cap, we need to prepare the buffer for potential save/restore.
 	 *  Guest may or may not enable XSAVE -- it doesn't matter.
@@ -474,6 +537,8 @@ void reset_vcpu_regs(struct acrn_vcpu *vcpu, enum reset_mode mode)
 
 		/* IA32_TSC_AUX: 0 following Power-up/Reset, unchanged following INIT */
 		ectx->tsc_aux = 0UL;
+		/* IA32_HWP_REQUEST: back to the perf_policy of the VM */
+		vcpu->arch.hwp_request = 0UL;
 	}
 }
 
@@ -502,6 +567,32 @@ void set_vcpu_startup_entry(struct acrn_vcpu *vcpu, uint64_t entry)
 	vcpu_set_rip(vcpu, 0UL);
 }
 
+/*
+ * A vCPU offlined while its VM runs leaves its slot, and its vCPU ID, to the
+ * next vCPU created in the VM: the one which last ran on pcpu_id first, then
+ * the lowest one. A new slot is taken only when there is no such one.
+ */
+static uint16_t get_free_vcpu_id(const struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	const struct acrn_vcpu *vcpu;
+	uint16_t i, vcpu_id = vm->hw.created_vcpus;
+
+	for (i = 0U; i < vm->hw.created_vcpus; i++) {
+		vcpu = &vm->hw.vcpu_array[i];
+		if ((vcpu->state == VCPU_OFFLINE) && (vcpu->vm == vm)) {
+			if (vcpu->thread_obj.pcpu_id == pcpu_id) {
+				vcpu_id = i;
+				break;
+			}
+			if (vcpu_id == vm->hw.created_vcpus) {
+				vcpu_id = i;
+			}
+		}
+	}
+
+	return vcpu_id;
+}
+
 /*
  * @pre vm != NULL && rtn_vcpu_handle != NULL
  */
@@ -513,11 +604,7 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 
 	pr_info("Creating VCPU working on PCPU%hu", pcpu_id);
 
-	/*
-	 * vcpu->vcpu_id = vm->hw.created_vcpus;
-	 * vm->hw.created_vcpus++;
-	 */
-	vcpu_id = vm->hw.created_vcpus;
+	vcpu_id = get_free_vcpu_id(vm, pcpu_id);
 	if (vcpu_id < MAX_VCPUS_PER_VM) {
 		/* Allocate memory for VCPU */
 		vcpu = &(vm->hw.vcpu_array[vcpu_id]);
@@ -545,20 +632,14 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 			per_cpu(mode_to_kick_pcpu, pcpu_id) = DEL_MODE_IPI;
 			per_cpu(mode_to_idle, pcpu_id) = IDLE_MODE_HLT;
 		}
+		/* an RT vCPU can't wait for the pCPU to come out of a deep C-state */
+		set_idle_latency_limit(pcpu_id, is_rt_vm(vm) ? 0U : IDLE_LATENCY_ANY);
 		pr_info("pcpu=%d, kick-mode=%d, use_init_flag=%d", pcpu_id,
 			per_cpu(mode_to_kick_pcpu, pcpu_id), is_using_init_ipi());
 
 		/* Initialize the parent VM reference */
 		vcpu->vm = vm;
 
-		/* Initialize the virtual ID for this VCPU */
-		/* FIXME:
-		 * We have assumption that we always destroys vcpus in one
-		 * shot (like when vm is destroyed). If we need to support
-		 * specific vcpu destroy on fly, this vcpu_id assignment
-		 * needs revise.
-		 */
-
 		pr_info("Create VM%d-VCPU%d, Role: %s",
 				vcpu->vm->vm_id, vcpu->vcpu_id,
 				is_vcpu_bsp(vcpu) ? "PRIMARY" : "SECONDARY");
@@ -572,6 +653,8 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		 */
 		vcpu->arch.vpid = ALLOCATED_MIN_L1_VPID + (vm->vm_id * MAX_VCPUS_PER_VM) + vcpu->vcpu_id;
 
+		vcpu->halt_poll.max_window = us_to_ticks(get_vm_config(vm->vm_id)->halt_poll_us);
+
 		/*
 		 * There are two locally independent writing operations, namely the
 		 * assignment of vcpu->vm and vcpu_array[]. Compilers may optimize
@@ -608,13 +691,16 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		 */
 		vcpu->arch.pid.control.bits.nv = POSTED_INTR_VECTOR + vm->vm_id;
 
-		/* ACRN does not support vCPU migration, one vCPU always runs on
-		 * the same pCPU, so PI's ndst is never changed after startup.
+		/* PI's ndst only changes when the vCPU is migrated to another pCPU,
+		 * see vcpu_migrate_out().
 		 */
 		vcpu->arch.pid.control.bits.ndst = per_cpu(lapic_id, pcpu_id);
 
 		/* Create per vcpu vlapic */
 		vlapic_create(vcpu, pcpu_id);
+#ifdef CONFIG_HYPERV_ENABLED
+		hyperv_init_vcpu(vcpu);
+#endif
 
 		if (!vm_hide_mtrr(vm)) {
 			init_vmtrr(vcpu);
@@ -627,7 +713,9 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		init_xsave(vcpu);
 		vcpu_reset_internal(vcpu, POWER_ON_RESET);
 		(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
-		vm->hw.created_vcpus++;
+		if (vcpu_id == vm->hw.created_vcpus) {
+			vm->hw.created_vcpus++;
+		}
 		ret = 0;
 	} else {
 		pr_err("%s, vcpu id is invalid!\n", __func__);
@@ -702,6 +790,8 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 	if (vcpu->reg_updated != 0UL) {
 		write_cached_registers(vcpu);
 	}
+	/* the handling of the next VM exit starts with an empty cache */
+	vcpu_vmcs_cache_flush(vcpu);
 
 	if (is_vcpu_in_l2_guest(vcpu)) {
 		int32_t launch_type;
@@ -717,6 +807,8 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 
 		status = exec_vmentry(ctx, launch_type, ibrs_type);
 	} else {
+		vlapic_arm_ptimer(vcpu);
+
 		/* If this VCPU is not already launched, launch it */
 		if (!vcpu->launched) {
 			pr_info("VM %d Starting VCPU %hu",
@@ -768,11 +860,12 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 				exec_vmwrite(VMX_GUEST_RIP, vcpu_get_rip(vcpu) + vcpu->arch.inst_len);
 			}
 
-			/* Resume the VM */
-			status = exec_vmentry(ctx, VM_RESUME, ibrs_type);
+			/* Resume the VM, a VMCS cleared by a pCPU migration is launched again */
+			status = exec_vmentry(ctx, vcpu->migration.relaunch ? VM_LAUNCH : VM_RESUME, ibrs_type);
+			vcpu->migration.relaunch = false;
 		}
 
-		cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
+		cs_attr = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CS_ATTR);
 		ia32_efer = vcpu_get_efer(vcpu);
 		cr0 = vcpu_get_cr0(vcpu);
 		set_vcpu_mode(vcpu, cs_attr, ia32_efer, cr0);
@@ -795,23 +888,63 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		}
 
 		ASSERT(status == 0, "vm fail");
+	} else if (vcpu->arch.pml_enabled) {
+		/* a vCPU out of non-root mode has nothing left in its PML buffer */
+		dirty_log_drain(vcpu);
 	}
 
 	return status;
 }
 
+/* run on the pCPU the VMCS of the vCPU (data) may be active on */
+static void clear_vcpu_vmcs(void *data)
+{
+	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)data;
+	uint16_t pcpu_id = get_pcpu_id();
+
+	clear_va_vmcs(vcpu->arch.vmcs);
+	if (per_cpu(vmcs_run, pcpu_id) == (void *)vcpu->arch.vmcs) {
+		per_cpu(vmcs_run, pcpu_id) = NULL;
+	}
+}
+
 /*
  *  @pre vcpu != NULL
  *  @pre vcpu->state == VCPU_ZOMBIE
  */
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+
+	/*
+	 * The slot may be reused by a vCPU of another pCPU: the VMCS is
+	 * cleared on the pCPU it is active on, as a migration does. A pCPU
+	 * which went offline lost it already.
+	 */
+	if (pcpu_id == get_pcpu_id()) {
+		clear_vcpu_vmcs(vcpu);
+	} else if (is_pcpu_active(pcpu_id)) {
+		smp_call_function(1UL << pcpu_id, clear_vcpu_vmcs, vcpu);
+	} else {
+		/* nothing to clear */
+	}
+
 	vlapic_free(vcpu);
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_reset_vcpu(vcpu);
+#endif
 	per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 
 	/* This operation must be atomic to avoid contention with posted interrupt handler */
 	per_cpu(vcpu_array, pcpuid_from_vcpu(vcpu))[vcpu->vm->vm_id] = NULL;
 
+	/* gives back what the scheduler reserved for the vCPU */
+	deinit_thread_data(&vcpu->thread_obj);
+
+	if (is_rt_vm(vcpu->vm)) {
+		set_idle_latency_limit(pcpuid_from_vcpu(vcpu), IDLE_LATENCY_ANY);
+	}
+
 	vcpu_set_state(vcpu, VCPU_OFFLINE);
 }
 
@@ -895,8 +1028,10 @@ void save_xsave_area(__unused struct acrn_vcpu *vcpu, struct ext_context *ectx)
 	}
 }
 
-void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *ectx)
+void rstore_xsave_area(const struct acrn_vcpu *vcpu, struct ext_context *ectx)
 {
+	uint16_t pcpu_id = get_pcpu_id();
+
 	if (pcpu_has_cap(X86_FEATURE_XSAVES)) {
 		/*
 		 * Restore XSAVE area if any of the following conditions is met:
@@ -908,19 +1043,77 @@ void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *e
 		 * that "vcpu->arch.xsave_enabled" is consistent with pcpu_has_cap(X86_FEATURE_XSAVES).
 		 *
 		 * Therefore, the check against "vcpu->launched" and "vcpu->arch.xsave_enabled" can be eliminated here.
+		 *
+		 * The hypervisor doesn't use the extended states itself, and save_xsave_area() leaves
+		 * them in the registers. They still hold ectx if it was the last context restored on
+		 * this pCPU and wasn't restored on another one since: the XRSTORS is skipped then, and
+		 * ping-ponging vCPUs only pay for the XSAVES of their own modified components.
 		 */
-		write_xcr(0, ectx->xcr0 | XSAVE_SSE);
-		msr_write(MSR_IA32_XSS, vcpu_get_guest_msr(vcpu, MSR_IA32_XSS));
-		xrstors(&ectx->xs_area, UINT64_MAX);
-		write_xcr(0, ectx->xcr0);
+		if ((get_cpu_var(whose_xsave) == ectx) && (ectx->xs_pcpu == pcpu_id)) {
+			write_xcr(0, ectx->xcr0);
+		} else {
+			write_xcr(0, ectx->xcr0 | XSAVE_SSE);
+			msr_write(MSR_IA32_XSS, vcpu_get_guest_msr(vcpu, MSR_IA32_XSS));
+			xrstors(&ectx->xs_area, UINT64_MAX);
+			write_xcr(0, ectx->xcr0);
+			get_cpu_var(whose_xsave) = ectx;
+			ectx->xs_pcpu = pcpu_id;
+		}
 	}
 }
 
-/* TODO:
+/*
  * Now we have switch_out and switch_in callbacks for each thread_object, and schedule
- * will call them every thread switch. We can implement lazy context swtich , which
- * only do context swtich when really need.
+ * will call them every thread switch. The XSAVE state is restored lazily, see
+ * rstore_xsave_area().
  */
+/* publish the steal time of vcpu to its guest, under an odd version */
+static void update_steal_time(struct acrn_vcpu *vcpu, bool preempted)
+{
+	struct vcpu_steal_time *st = &vcpu->steal_time;
+	struct acrn_steal_time *page = st->page;
+
+	if (page != NULL) {
+		stac();
+		page->version = st->version + 1U;
+		cpu_write_memory_barrier();
+		page->preempted = preempted ? 1U : 0U;
+		page->run = st->run;
+		page->steal = st->steal;
+		cpu_write_memory_barrier();
+		st->version += 2U;
+		page->version = st->version;
+		clac();
+	}
+}
+
+int32_t vcpu_set_steal_time_msr(struct acrn_vcpu *vcpu, uint64_t val)
+{
+	struct acrn_steal_time *page = NULL;
+	uint64_t gpa = val & ~(sizeof(struct acrn_steal_time) - 1UL);
+	int32_t ret = 0;
+
+	if ((val & (sizeof(struct acrn_steal_time) - 1UL) & ~ACRN_STEAL_TIME_ENABLE) != 0UL) {
+		ret = -EACCES;
+	} else if ((val & ACRN_STEAL_TIME_ENABLE) != 0UL) {
+		/* an aligned page doesn't cross a 4K page */
+		page = (struct acrn_steal_time *)gpa2hva(vcpu->vm, gpa);
+		if (page == NULL) {
+			ret = -EACCES;
+		}
+	} else {
+		/* disabled */
+	}
+
+	if (ret == 0) {
+		vcpu->steal_time.msr = val;
+		vcpu->steal_time.page = page;
+		update_steal_time(vcpu, false);
+	}
+
+	return ret;
+}
+
 static void context_switch_out(struct thread_object *prev)
 {
 	struct acrn_vcpu *vcpu = container_of(prev, struct acrn_vcpu, thread_obj);
@@ -935,6 +1128,145 @@ static void context_switch_out(struct thread_object *prev)
 	ectx->tsc_aux = msr_read(MSR_IA32_TSC_AUX);
 
 	save_xsave_area(vcpu, ectx);
+
+	/*
+	 * A preempted vCPU stays runnable and syncs its PIR on the next switch in,
+	 * so VT-d posted interrupts don't need to notify (and wake) it meanwhile.
+	 * A blocking vCPU keeps notifications enabled to be woken up.
+	 */
+	if (!prev->be_blocking && is_pi_capable(vcpu->vm)) {
+		bitmap_set_lock(POSTED_INTR_SN, &(vcpu->arch.pid.control.value));
+	}
+
+	/* the scheduler hasn't accounted the switch to the thread yet, run_tsc is the switch in */
+	vcpu->steal_time.run += cpu_ticks() - prev->run_tsc;
+	update_steal_time(vcpu, !prev->be_blocking);
+
+	vlapic_ptimer_switch_out(vcpu);
+
+	/* the guest skips the TLB shootdown IPIs to this vCPU from now on, see context_switch_in() */
+	if (vcpu->pv_state != NULL) {
+		stac();
+		(void)atomic_swap32(&vcpu->pv_state->preempted, ACRN_PV_VCPU_PREEMPTED);
+		clac();
+	}
+}
+
+/*
+ * Set up the pCPU specific state of a vCPU migrated to this pCPU, on its
+ * first switch in here.
+ */
+static void vcpu_migrate_in(struct acrn_vcpu *vcpu)
+{
+	if (vcpu->launched) {
+		load_vmcs(vcpu);
+		/* host state holds the GDT/TSS bases and the pseudo pCPU ID of this pCPU */
+		init_host_state();
+		if (get_ibrs_type() == IBRS_RAW) {
+			msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+		}
+	}
+
+	if (vcpu->migration.restart_vtimer) {
+		(void)add_timer(&vcpu_vlapic(vcpu)->vtimer.timer);
+		vcpu->migration.restart_vtimer = false;
+	}
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_stimer_migrate_in(vcpu);
+#endif
+
+	/* this pCPU may hold stale translations tagged with the VPID and EPTP of this vCPU */
+	vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+	vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	vcpu->migration.rebind = false;
+}
+
+/*
+ * IA32_HWP_REQUEST the pCPU of the vCPU runs it with: the one written by the guest if it
+ * controls HWP, or the one of the perf_policy of its VM.
+ */
+uint64_t vcpu_hwp_request(const struct acrn_vcpu *vcpu)
+{
+	uint64_t req = vcpu->arch.hwp_request;
+
+	if (req == 0UL) {
+		req = get_vm_hwp_request(pcpuid_from_vcpu(vcpu), get_vm_config(vcpu->vm->vm_id)->perf_policy);
+	}
+
+	return req;
+}
+
+#define TSC_MULTIPLIER_SHIFT	48U
+
+/*
+ * VMX TSC multiplier keeping the TSC rate of a restored VM, 0 at the host rate:
+ * (guest rate << 48) / host rate.
+ */
+uint64_t vcpu_tsc_multiplier(const struct acrn_vcpu *vcpu)
+{
+	uint64_t guest_khz = vcpu->vm->arch_vm.tsc_khz, mult = 0UL, rem;
+
+	if (guest_khz != 0UL) {
+		asm volatile ("divq %2" : "=a"(mult), "=d"(rem)
+			: "rm"((uint64_t)get_tsc_khz()), "0"(guest_khz << TSC_MULTIPLIER_SHIFT),
+			"1"(guest_khz >> (64U - TSC_MULTIPLIER_SHIFT)));
+	}
+
+	return mult;
+}
+
+/*
+ * The guest TSC of a host TSC, as RDTSC computes it in the guest: scaled by the
+ * VMX TSC multiplier, if any, then offset.
+ *
+ * @pre the VMCS of vcpu is the current one
+ */
+uint64_t vcpu_guest_tsc(const struct acrn_vcpu *vcpu, uint64_t host_tsc)
+{
+	uint64_t tsc = host_tsc, hi, lo;
+
+	if (vcpu->arch.tsc_multiplier != 0UL) {
+		asm volatile ("mulq %3" : "=d"(hi), "=a"(lo) : "a"(host_tsc), "rm"(vcpu->arch.tsc_multiplier));
+		tsc = (hi << (64U - TSC_MULTIPLIER_SHIFT)) | (lo >> TSC_MULTIPLIER_SHIFT);
+	}
+
+	return tsc + exec_vmread64(VMX_TSC_OFFSET_FULL);
+}
+
+/*
+ * The host TSC of a guest TSC, e.g. of a guest TSC deadline. A scaled guest TSC
+ * before the host TSC 0 is 0, one past the range of the host TSC saturates.
+ *
+ * @pre the VMCS of vcpu is the current one
+ */
+uint64_t vcpu_host_tsc(const struct acrn_vcpu *vcpu, uint64_t guest_tsc)
+{
+	uint64_t tsc = guest_tsc - exec_vmread64(VMX_TSC_OFFSET_FULL);
+	uint64_t mult = vcpu->arch.tsc_multiplier, rem;
+
+	if (mult != 0UL) {
+		if ((int64_t)tsc < 0L) {
+			tsc = 0UL;
+		} else if ((tsc >> (64U - TSC_MULTIPLIER_SHIFT)) >= mult) {
+			tsc = ~0UL;
+		} else {
+			asm volatile ("divq %2" : "=a"(tsc), "=d"(rem)
+				: "rm"(mult), "0"(tsc << TSC_MULTIPLIER_SHIFT), "1"(tsc >> (64U - TSC_MULTIPLIER_SHIFT)));
+		}
+	}
+
+	return tsc;
+}
+
+/*
+ * The guest TSC is the host TSC: the physical TSC_DEADLINE can be passed through to a
+ * vCPU with its LAPIC passed through.
+ *
+ * @pre the VMCS of vcpu is the current one
+ */
+bool vcpu_tsc_is_host_tsc(const struct acrn_vcpu *vcpu)
+{
+	return (vcpu->arch.tsc_multiplier == 0UL) && (exec_vmread64(VMX_TSC_OFFSET_FULL) == 0UL);
 }
 
 static void context_switch_in(struct thread_object *next)
@@ -942,8 +1274,17 @@ static void context_switch_in(struct thread_object *next)
 	struct acrn_vcpu *vcpu = container_of(next, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
 	uint64_t vmsr_val;
+	uint32_t pv_flags;
 
+	if (vcpu->migration.rebind) {
+		vcpu_migrate_in(vcpu);
+	}
 	load_vmcs(vcpu);
+	vlapic_ptimer_switch_in(vcpu);
+	if (is_tee_vm(vcpu->vm) != 0) {
+		tee_vcpu_switch_in(vcpu);
+	}
+	load_hwp_request(vcpu_hwp_request(vcpu));
 
 	msr_write(MSR_IA32_STAR, ectx->ia32_star);
 	msr_write(MSR_IA32_CSTAR, ectx->ia32_cstar);
@@ -962,8 +1303,212 @@ static void context_switch_in(struct thread_object *next)
 	load_iwkey(vcpu);
 
 	rstore_xsave_area(vcpu, ectx);
+
+	if (is_pi_capable(vcpu->vm)) {
+		struct pi_desc *pid = get_pi_desc(vcpu);
+
+		bitmap_clear_lock(POSTED_INTR_SN, &(pid->control.value));
+		/* interrupts posted while notifications were suppressed left ON clear */
+		if ((pid->pir[0] | pid->pir[1] | pid->pir[2] | pid->pir[3]) != 0UL) {
+			bitmap_set_lock(POSTED_INTR_ON, &(pid->control.value));
+			vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+		}
+	}
+
+	/* waited since preempted or woken up, run_tsc was just set by the scheduler */
+	vcpu->steal_time.steal += next->run_tsc - next->runnable_tsc;
+	update_steal_time(vcpu, false);
+
+	if (vcpu->pv_state != NULL) {
+		stac();
+		pv_flags = atomic_readandclear32(&vcpu->pv_state->preempted);
+		clac();
+		/* a flush was asked for while switched out, instead of an IPI */
+		if ((pv_flags & ACRN_PV_VCPU_FLUSH_TLB) != 0U) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+		}
+	}
+}
+
+int32_t vcpu_set_pv_state(struct acrn_vcpu *vcpu, uint64_t gpa)
+{
+	struct acrn_pv_vcpu_state *state = NULL;
+	int32_t ret = 0;
+
+	if (gpa != 0UL) {
+		/* an aligned state doesn't cross a page */
+		if (mem_aligned_check(gpa, sizeof(struct acrn_pv_vcpu_state))) {
+			state = (struct acrn_pv_vcpu_state *)gpa2hva(vcpu->vm, gpa);
+		}
+
+		if (state != NULL) {
+			stac();
+			state->preempted = 0U;
+			clac();
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	if (ret == 0) {
+		vcpu->pv_state = state;
+	}
+
+	return ret;
+}
+
+/*
+ * Release the pCPU specific state of a vCPU leaving this pCPU, obj->pcpu_id
+ * is already the destination pCPU. Called with the scheduler locks of both
+ * pCPUs held.
+ */
+static void vcpu_migrate_out(struct thread_object *obj)
+{
+	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	struct hv_timer *vtimer = &vcpu_vlapic(vcpu)->vtimer.timer;
+	struct pi_desc *pid = get_pi_desc(vcpu);
+	uint16_t pcpu_id = get_pcpu_id(), dst_pcpu_id = obj->pcpu_id;
+	uint16_t vm_id = vcpu->vm->vm_id;
+	uint64_t old_ctrl, new_ctrl;
+
+	/* a VMCS has to be cleared on the pCPU it is active on before another pCPU loads it */
+	clear_va_vmcs(vcpu->arch.vmcs);
+	if (per_cpu(vmcs_run, pcpu_id) == (void *)vcpu->arch.vmcs) {
+		per_cpu(vmcs_run, pcpu_id) = NULL;
+	}
+	vcpu->migration.relaunch = vcpu->launched;
+
+	if (per_cpu(whose_iwkey, pcpu_id) == vcpu) {
+		per_cpu(whose_iwkey, pcpu_id) = NULL;
+	}
+	if (per_cpu(ever_run_vcpu, pcpu_id) == vcpu) {
+		per_cpu(ever_run_vcpu, pcpu_id) = NULL;
+	}
+
+	/* the vLAPIC timer is in the timer heap of this pCPU */
+	if (timer_is_started(vtimer)) {
+		del_timer(vtimer);
+		vcpu->migration.restart_vtimer = true;
+	}
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_stimer_migrate_out(vcpu);
+#endif
+
+	/* VT-d may set ON concurrently, only NDST is replaced */
+	do {
+		old_ctrl = pid->control.value;
+		new_ctrl = (old_ctrl & 0xffffffffUL) | ((uint64_t)per_cpu(lapic_id, dst_pcpu_id) << 32U);
+	} while (atomic_cmpxchg64(&pid->control.value, old_ctrl, new_ctrl) != old_ctrl);
+
+	per_cpu(vcpu_array, pcpu_id)[vm_id] = NULL;
+	per_cpu(vcpu_array, dst_pcpu_id)[vm_id] = vcpu;
+	if (per_cpu(ever_run_vcpu, dst_pcpu_id) == NULL) {
+		per_cpu(ever_run_vcpu, dst_pcpu_id) = vcpu;
+	}
+
+	vcpu->migration.rebind = true;
+	vcpu->migration.count++;
 }
 
+/* pCPUs that any vCPU created so far may migrate to, the others skip balancing */
+static volatile uint64_t vcpu_migrate_pcpus = 0UL;
+
+/*
+ * A migratable vCPU may run on the pCPUs of the configured cpu_affinity
+ * of its VM that share the last level cache with the pCPU it is created on.
+ * A vCPU with a CPU reservation stays on the pCPU it was admitted on.
+ */
+static uint64_t get_vcpu_migrate_mask(const struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	uint64_t mask = 0UL, affinity;
+	uint16_t i;
+
+	if (is_vcpu_migration_configured(vm) && (get_vm_config(vm->vm_id)->sched_params.edf_budget_us == 0U)) {
+		affinity = get_vm_config(vm->vm_id)->cpu_affinity;
+		i = ffs64(affinity);
+		while (i < MAX_PCPU_NUM) {
+			bitmap_clear_nolock(i, &affinity);
+			if (per_cpu(llc_id, i) == per_cpu(llc_id, pcpu_id)) {
+				bitmap_set_nolock(i, &mask);
+				bitmap_set_lock(i, &vcpu_migrate_pcpus);
+			}
+			i = ffs64(affinity);
+		}
+	}
+
+	return mask;
+}
+
+/* number of vCPUs running or waiting to run on pcpu_id */
+static uint32_t get_pcpu_vcpu_load(uint16_t pcpu_id, bool *has_rt_vcpu)
+{
+	struct acrn_vcpu *vcpu;
+	uint32_t load = 0U;
+	uint16_t i;
+
+	*has_rt_vcpu = false;
+	for (i = 0U; i < CONFIG_MAX_VM_NUM; i++) {
+		vcpu = per_cpu(vcpu_array, pcpu_id)[i];
+		if (vcpu != NULL) {
+			if (vcpu->thread_obj.status != THREAD_STS_BLOCKED) {
+				load++;
+			}
+			if (is_rt_vm(vcpu->vm)) {
+				*has_rt_vcpu = true;
+			}
+		}
+	}
+
+	return load;
+}
+
+void balance_vcpus(uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu, *candidate = NULL;
+	struct acrn_vm *vm;
+	uint32_t load, max_load = 1U;
+	uint16_t vm_id, i, src_pcpu_id;
+	bool has_rt_vcpu = false, share_l2, candidate_share_l2 = false;
+	bool can_pull = bitmap_test(pcpu_id, &vcpu_migrate_pcpus);
+
+	if (can_pull) {
+		/* vCPUs of other VMs are never moved next to an RT vCPU */
+		(void)get_pcpu_vcpu_load(pcpu_id, &has_rt_vcpu);
+		can_pull = !has_rt_vcpu;
+	}
+
+	if (can_pull) {
+		for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+			vm = get_vm_from_vmid(vm_id);
+			/* vCPUs of one VM don't share a pCPU */
+			if ((vm->state != VM_RUNNING) || (per_cpu(vcpu_array, pcpu_id)[vm_id] != NULL)) {
+				continue;
+			}
+
+			foreach_vcpu(i, vm, vcpu) {
+				if ((vcpu->thread_obj.status != THREAD_STS_RUNNABLE)
+						|| !bitmap_test(pcpu_id, &vcpu->thread_obj.migrate_mask)) {
+					continue;
+				}
+
+				/* prefer the busiest pCPU, then one sharing L2 with this pCPU */
+				src_pcpu_id = pcpuid_from_vcpu(vcpu);
+				load = get_pcpu_vcpu_load(src_pcpu_id, &has_rt_vcpu);
+				share_l2 = (per_cpu(l2_id, src_pcpu_id) == per_cpu(l2_id, pcpu_id));
+				if ((load > max_load) || ((load == max_load) && (candidate != NULL)
+						&& share_l2 && !candidate_share_l2)) {
+					candidate = vcpu;
+					candidate_share_l2 = share_l2;
+					max_load = load;
+				}
+			}
+		}
+	}
+
+	if (candidate != NULL) {
+		(void)request_thread_migration(&candidate->thread_obj, pcpu_id);
+	}
+}
 
 /**
  * @pre vcpu != NULL
@@ -996,6 +1541,9 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		vcpu->thread_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->thread_obj.switch_out = context_switch_out;
 		vcpu->thread_obj.switch_in = context_switch_in;
+		vcpu->thread_obj.migrate_mask = get_vcpu_migrate_mask(vm, pcpu_id);
+		vcpu->thread_obj.migrate_out = vcpu_migrate_out;
+		join_sched_gang(&vm->sched_gang, &vcpu->thread_obj);
 		init_thread_data(&vcpu->thread_obj, &get_vm_config(vm->vm_id)->sched_params);
 		for (i = 0; i < VCPU_EVENT_NUM; i++) {
 			init_event(&vcpu->events[i]);
@@ -1060,6 +1608,10 @@ void vcpu_handle_pi_notification(uint32_t vcpu_index)
 			 */
 			vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
 			signal_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+
+			if (is_tee_vm(vcpu->vm) != 0) {
+				handle_x86_tee_posted_int(vcpu, get_pcpu_id());
+			}
 		}
 	}
 }
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <asm/cpu.h>
+#include <asm/cpu_caps.h>
+#include <asm/notify.h>
+#include <asm/per_cpu.h>
+#include <asm/tsc.h>
+#include <asm/vmx.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/virq.h>
+#include <asm/guest/vlapic.h>
+#include <asm/guest/virtual_cr.h>
+#include <asm/guest/guest_memory.h>
+#include <asm/guest/vcpu_state.h>
+#include <vioapic.h>
+#include <io_req.h>
+#include <logmsg.h>
+
+#define STATE_OFFSET(m)		(offsetof(struct acrn_vcpu_state, m))
+
+struct vcpu_state_capture {
+	struct acrn_vcpu *vcpu;
+	struct acrn_cpu_state *cpu;
+};
+
+static bool is_vcpu_state_supported(const struct acrn_vm *vm)
+{
+	/* their vCPUs run with state out of the VMCS or on pCPUs that can't be called */
+	return is_postlaunched_vm(vm) && !is_lapic_pt_configured(vm) && !is_nvmx_configured(vm) &&
+		(vm->sworld_control.flag.supported == 0UL);
+}
+
+static void save_segment_state(struct acrn_segment_state *state, const struct segment_sel *seg)
+{
+	state->selector = seg->selector;
+	state->base = seg->base;
+	state->limit = seg->limit;
+	state->attr = seg->attr;
+}
+
+static void restore_segment_state(struct segment_sel *seg, const struct acrn_segment_state *state)
+{
+	seg->selector = state->selector;
+	seg->base = state->base;
+	seg->limit = state->limit;
+	seg->attr = state->attr;
+}
+
+/*
+ * Read the state of a paused vCPU on its pCPU. Its VMCS is active there, but
+ * isn't the current one if the pCPU ran another vCPU since.
+ */
+static void capture_vcpu_state(void *data)
+{
+	struct vcpu_state_capture *cap = (struct vcpu_state_capture *)data;
+	struct acrn_vcpu *vcpu = cap->vcpu;
+	struct acrn_cpu_state *cpu = cap->cpu;
+	struct run_context *ctx = &(vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx);
+	struct segment_sel seg;
+	void *vmcs = get_cpu_var(vmcs_run);
+
+	if (vmcs != (void *)vcpu->arch.vmcs) {
+		load_va_vmcs(vcpu->arch.vmcs);
+	}
+
+	(void)memcpy_s((void *)&cpu->gprs, sizeof(cpu->gprs), (void *)&ctx->cpu_regs, sizeof(struct acrn_gp_regs));
+	/* the registers written since the last exit are still in the run context */
+	cpu->gprs.rsp = vcpu_get_rsp(vcpu);
+	/*
+	 * The instruction of the last exit is skipped at the next entry, unless
+	 * its I/O request is still out: it's run again after the restore then.
+	 */
+	cpu->rip = vcpu_get_rip(vcpu);
+	if (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_FREE) {
+		cpu->rip += vcpu->arch.inst_len;
+	}
+	cpu->rflags = vcpu_get_rflags(vcpu);
+	cpu->cr0 = vcpu_get_cr0(vcpu);
+	cpu->cr2 = vcpu_get_cr2(vcpu);
+	cpu->cr4 = vcpu_get_cr4(vcpu);
+	cpu->ia32_efer = vcpu_get_efer(vcpu);
+	cpu->cr3 = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CR3);
+	cpu->interruptibility = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_INTR_STATE);
+
+	cpu->dr7 = exec_vmread(VMX_GUEST_DR7);
+	cpu->ia32_pat = exec_vmread64(VMX_GUEST_IA32_PAT_FULL);
+	cpu->ia32_debugctl = exec_vmread64(VMX_GUEST_IA32_DEBUGCTL_FULL);
+	cpu->ia32_sysenter_cs = exec_vmread32(VMX_GUEST_IA32_SYSENTER_CS);
+	cpu->ia32_sysenter_esp = exec_vmread(VMX_GUEST_IA32_SYSENTER_ESP);
+	cpu->ia32_sysenter_eip = exec_vmread(VMX_GUEST_IA32_SYSENTER_EIP);
+	cpu->tsc = vcpu_guest_tsc(vcpu, vcpu->vm->arch_vm.state_tsc);
+	cpu->tsc_khz = vm_tsc_khz(vcpu->vm);
+
+	save_segment(seg, VMX_GUEST_CS);
+	seg.attr = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CS_ATTR);
+	save_segment_state(&cpu->cs, &seg);
+	save_segment(seg, VMX_GUEST_SS);
+	save_segment_state(&cpu->ss, &seg);
+	save_segment(seg, VMX_GUEST_DS);
+	save_segment_state(&cpu->ds, &seg);
+	save_segment(seg, VMX_GUEST_ES);
+	save_segment_state(&cpu->es, &seg);
+	save_segment(seg, VMX_GUEST_FS);
+	save_segment_state(&cpu->fs, &seg);
+	save_segment(seg, VMX_GUEST_GS);
+	save_segment_state(&cpu->gs, &seg);
+	save_segment(seg, VMX_GUEST_TR);
+	save_segment_state(&cpu->tr, &seg);
+	save_segment(seg, VMX_GUEST_LDTR);
+	save_segment_state(&cpu->ldtr, &seg);
+	cpu->gdt.base = exec_vmread(VMX_GUEST_GDTR_BASE);
+	cpu->gdt.limit = (uint16_t)exec_vmread32(VMX_GUEST_GDTR_LIMIT);
+	cpu->idt.base = exec_vmread(VMX_GUEST_IDTR_BASE);
+	cpu->idt.limit = (uint16_t)exec_vmread32(VMX_GUEST_IDTR_LIMIT);
+
+	if ((vmcs != NULL) && (vmcs != (void *)vcpu->arch.vmcs)) {
+		load_va_vmcs((uint8_t *)vmcs);
+	}
+}
+
+int32_t save_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *service_vm, uint64_t gpa)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	struct pi_desc *pid = get_pi_desc(vcpu);
+	struct vcpu_state_capture cap;
+	struct acrn_cpu_state cpu;
+	union ioapic_rte rte;
+	uint64_t flags = 0UL, rtes[VIOAPIC_RTE_NUM];
+	uint32_t i, irr;
+	int32_t ret = -ENODEV;
+
+	if (is_vcpu_state_supported(vm)) {
+		(void)memset((void *)&cpu, 0U, sizeof(cpu));
+		/* a vCPU not launched waits for INIT/SIPI, at its reset state */
+		if (vcpu->launched) {
+			cap.vcpu = vcpu;
+			cap.cpu = &cpu;
+			smp_call_function(1UL << pcpuid_from_vcpu(vcpu), capture_vcpu_state, &cap);
+
+			/* saved when the vCPU was switched out */
+			cpu.xcr0 = ectx->xcr0;
+			cpu.ia32_star = ectx->ia32_star;
+			cpu.ia32_cstar = ectx->ia32_cstar;
+			cpu.ia32_lstar = ectx->ia32_lstar;
+			cpu.ia32_fmask = ectx->ia32_fmask;
+			cpu.ia32_kernel_gs_base = ectx->ia32_kernel_gs_base;
+			cpu.tsc_aux = ectx->tsc_aux;
+			cpu.ia32_xss = vcpu_get_guest_msr(vcpu, MSR_IA32_XSS);
+			cpu.apicbase = vlapic_get_apicbase(vlapic);
+			cpu.tsc_deadline = vlapic_get_tsc_deadline_msr(vlapic);
+			flags = ACRN_VCPU_STATE_LAUNCHED;
+		}
+
+		ret = copy_to_gpa(service_vm, &flags, gpa + STATE_OFFSET(flags), (uint32_t)sizeof(flags));
+		if (ret == 0) {
+			ret = copy_to_gpa(service_vm, &cpu, gpa + STATE_OFFSET(cpu), (uint32_t)sizeof(cpu));
+		}
+		if (ret == 0) {
+			ret = copy_to_gpa(service_vm, &vlapic->apic_page, gpa + STATE_OFFSET(lapic),
+					(uint32_t)sizeof(struct lapic_regs));
+		}
+		/* the interrupts posted since the last entry are in the IRR of the state */
+		for (i = 0U; (i < 8U) && (ret == 0); i++) {
+			irr = vlapic->apic_page.irr[i].v | (uint32_t)(pid->pir[i >> 1U] >> ((i & 1U) << 5U));
+			if (irr != vlapic->apic_page.irr[i].v) {
+				ret = copy_to_gpa(service_vm, &irr, gpa + STATE_OFFSET(lapic) +
+						offsetof(struct lapic_regs, irr[i]), (uint32_t)sizeof(irr));
+			}
+		}
+		if (ret == 0) {
+			ret = copy_to_gpa(service_vm, &ectx->xs_area, gpa + STATE_OFFSET(xsave),
+					(uint32_t)sizeof(struct xsave_area));
+		}
+
+		if ((ret == 0) && (vcpu->vcpu_id == BSP_CPU_ID)) {
+			for (i = 0U; i < VIOAPIC_RTE_NUM; i++) {
+				vioapic_get_rte(vm, i, &rte);
+				rtes[i] = rte.full;
+			}
+			ret = copy_to_gpa(service_vm, rtes, gpa + STATE_OFFSET(ioapic_rte), (uint32_t)sizeof(rtes));
+		}
+	}
+
+	return ret;
+}
+
+/* XSETBV and XRSTORS of the restored state can't fault in the hypervisor */
+static bool is_valid_xstate(const struct acrn_cpu_state *cpu, const union xsave_header *hdr)
+{
+	const struct cpuinfo_x86 *cpu_info = get_pcpu_info();
+	uint64_t xcr0_cap = ((uint64_t)cpu_info->cpuid_leaves[FEAT_D_0_EDX] << 32U) |
+		cpu_info->cpuid_leaves[FEAT_D_0_EAX];
+	uint64_t xss_cap = ((uint64_t)cpu_info->cpuid_leaves[FEAT_D_1_EDX] << 32U) |
+		cpu_info->cpuid_leaves[FEAT_D_1_ECX];
+	uint64_t components = cpu->xcr0 | XCR0_SSE | cpu->ia32_xss;
+	bool valid = true;
+	uint32_t i;
+
+	if (((cpu->xcr0 & XSAVE_FPU) == 0UL) || ((cpu->xcr0 & ~xcr0_cap) != 0UL) ||
+			((cpu->xcr0 & (XCR0_SSE | XCR0_AVX)) == XCR0_AVX) ||
+			((cpu->ia32_xss & ~(MSR_IA32_XSS_PT | MSR_IA32_XSS_HDC)) != 0UL) ||
+			((cpu->ia32_xss & ~xss_cap) != 0UL)) {
+		valid = false;
+	} else if (((hdr->hdr.xcomp_bv & XSAVE_COMPACTED_FORMAT) == 0UL) ||
+			((hdr->hdr.xcomp_bv & ~(XSAVE_COMPACTED_FORMAT | components)) != 0UL) ||
+			((hdr->hdr.xstate_bv & ~hdr->hdr.xcomp_bv) != 0UL)) {
+		valid = false;
+	} else {
+		for (i = 2U; i < (XSAVE_HEADER_AREA_SIZE / sizeof(uint64_t)); i++) {
+			if (hdr->value[i] != 0UL) {
+				valid = false;
+			}
+		}
+	}
+
+	return valid;
+}
+
+/*
+ * A VM saved on a platform of another TSC rate keeps it, scaled by the processor, so that
+ * its guest TSC reads don't exit. The states of an older device model have no rate.
+ */
+static void restore_tsc_rate(struct acrn_vcpu *vcpu, uint32_t tsc_khz)
+{
+	struct acrn_vm *vm = vcpu->vm;
+#ifdef CONFIG_HYPERV_ENABLED
+	/* the Hyper-V reference time and TSC page are at the host TSC rate */
+	bool scaling = false;
+#else
+	bool scaling = is_vmx_tsc_scaling_supported();
+#endif
+
+	if ((tsc_khz == 0U) || (tsc_khz == get_tsc_khz())) {
+		vm->arch_vm.tsc_khz = 0U;
+	} else if (scaling) {
+		vm->arch_vm.tsc_khz = tsc_khz;
+	} else {
+		pr_warn("%s: vcpu%hu of vm%hu saved at %u kHz runs at the TSC rate, %u kHz",
+			__func__, vcpu->vcpu_id, vm->vm_id, tsc_khz, get_tsc_khz());
+		vm->arch_vm.tsc_khz = 0U;
+	}
+}
+
+int32_t restore_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *service_vm, uint64_t gpa)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct run_context *ctx = &(vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx);
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	struct lapic_regs *lapic = &(vlapic->apic_page);
+	struct acrn_cpu_state cpu;
+	union xsave_header hdr;
+	union ioapic_rte rte;
+	uint64_t flags, rtes[VIOAPIC_RTE_NUM];
+	uint32_t i, id;
+	int32_t ret = -ENODEV;
+
+	if (is_vcpu_state_supported(vm)) {
+		ret = copy_from_gpa(service_vm, &flags, gpa + STATE_OFFSET(flags), (uint32_t)sizeof(flags));
+		if (ret == 0) {
+			ret = copy_from_gpa(service_vm, &cpu, gpa + STATE_OFFSET(cpu), (uint32_t)sizeof(cpu));
+		}
+		if (ret == 0) {
+			ret = copy_from_gpa(service_vm, &hdr, gpa + STATE_OFFSET(xsave) + XSAVE_LEGACY_AREA_SIZE,
+					(uint32_t)sizeof(hdr));
+		}
+		if ((ret == 0) && (vcpu->vcpu_id == BSP_CPU_ID)) {
+			ret = copy_from_gpa(service_vm, rtes, gpa + STATE_OFFSET(ioapic_rte), (uint32_t)sizeof(rtes));
+		}
+
+		if ((ret == 0) && ((flags & ACRN_VCPU_STATE_LAUNCHED) != 0UL)) {
+			if (!is_valid_cr0_cr4(cpu.cr0, cpu.cr4) ||
+					(vcpu->arch.xsave_enabled && !is_valid_xstate(&cpu, &hdr))) {
+				pr_err("%s: invalid state of vcpu%hu", __func__, vcpu->vcpu_id);
+				ret = -EINVAL;
+			} else if (vcpu->arch.xsave_enabled) {
+				ret = copy_from_gpa(service_vm, &ectx->xs_area, gpa + STATE_OFFSET(xsave),
+						(uint32_t)sizeof(struct xsave_area));
+			}
+
+			if (ret == 0) {
+				/* the LAPIC ID is the one of the vCPU, not of the state */
+				id = lapic->id.v;
+				ret = copy_from_gpa(service_vm, lapic, gpa + STATE_OFFSET(lapic),
+						(uint32_t)sizeof(struct lapic_regs));
+				lapic->id.v = id;
+			}
+		}
+
+		if ((ret == 0) && ((flags & ACRN_VCPU_STATE_LAUNCHED) != 0UL)) {
+			(void)memcpy_s((void *)&ctx->cpu_regs, sizeof(struct acrn_gp_regs),
+					(void *)&cpu.gprs, sizeof(cpu.gprs));
+			vcpu_set_rip(vcpu, cpu.rip);
+			vcpu_set_rsp(vcpu, cpu.gprs.rsp);
+			vcpu_set_rflags(vcpu, cpu.rflags);
+			vcpu_set_efer(vcpu, cpu.ia32_efer);
+			/* written by init_vmcs(), as for set_vcpu_regs() */
+			ctx->cr0 = cpu.cr0;
+			ctx->cr2 = cpu.cr2;
+			ctx->cr4 = cpu.cr4;
+			ectx->cr3 = cpu.cr3;
+
+			restore_segment_state(&ectx->cs, &cpu.cs);
+			restore_segment_state(&ectx->ss, &cpu.ss);
+			restore_segment_state(&ectx->ds, &cpu.ds);
+			restore_segment_state(&ectx->es, &cpu.es);
+			restore_segment_state(&ectx->fs, &cpu.fs);
+			restore_segment_state(&ectx->gs, &cpu.gs);
+			restore_segment_state(&ectx->tr, &cpu.tr);
+			restore_segment_state(&ectx->ldtr, &cpu.ldtr);
+			ectx->gdtr.base = cpu.gdt.base;
+			ectx->gdtr.limit = cpu.gdt.limit;
+			ectx->idtr.base = cpu.idt.base;
+			ectx->idtr.limit = cpu.idt.limit;
+
+			ectx->dr7 = cpu.dr7;
+			ectx->ia32_pat = cpu.ia32_pat;
+			ectx->ia32_debugctl = cpu.ia32_debugctl;
+			ectx->ia32_sysenter_cs = cpu.ia32_sysenter_cs;
+			ectx->ia32_sysenter_esp = cpu.ia32_sysenter_esp;
+			ectx->ia32_sysenter_eip = cpu.ia32_sysenter_eip;
+			ectx->ia32_star = cpu.ia32_star;
+			ectx->ia32_cstar = cpu.ia32_cstar;
+			ectx->ia32_lstar = cpu.ia32_lstar;
+			ectx->ia32_fmask = cpu.ia32_fmask;
+			ectx->ia32_kernel_gs_base = cpu.ia32_kernel_gs_base;
+			ectx->tsc_aux = cpu.tsc_aux;
+			if (vcpu->arch.xsave_enabled) {
+				ectx->xcr0 = cpu.xcr0;
+				vcpu_set_guest_msr(vcpu, MSR_IA32_XSS, cpu.ia32_xss);
+			}
+			vcpu_set_guest_msr(vcpu, MSR_IA32_PAT, cpu.ia32_pat);
+			set_vcpu_mode(vcpu, cpu.cs.attr, cpu.ia32_efer, cpu.cr0);
+
+			/* the level-triggered vectors of the TMR exit on EOI */
+			for (i = 0U; i < 8U; i++) {
+				vcpu->arch.eoi_exit_bitmap[i >> 1U] &= ~(0xFFFFFFFFUL << ((i & 1U) << 5U));
+				vcpu->arch.eoi_exit_bitmap[i >> 1U] |= (uint64_t)lapic->tmr[i].v << ((i & 1U) << 5U);
+			}
+			vcpu_make_request(vcpu, ACRN_REQUEST_EOI_EXIT_BITMAP_UPDATE);
+
+			vcpu->restore.interruptibility = cpu.interruptibility;
+			vcpu->restore.tsc = cpu.tsc;
+			restore_tsc_rate(vcpu, cpu.tsc_khz);
+			vcpu->restore.apicbase = cpu.apicbase;
+			vcpu->restore.tsc_deadline = cpu.tsc_deadline;
+			vcpu->restore.pending = true;
+		}
+
+		if ((ret == 0) && (vcpu->vcpu_id == BSP_CPU_ID)) {
+			for (i = 0U; i < VIOAPIC_RTE_NUM; i++) {
+				rte.full = rtes[i];
+				vioapic_set_rte(vm, i, rte);
+			}
+		}
+	}
+
+	return ret;
+}
+
+void load_vcpu_state(struct acrn_vcpu *vcpu)
+{
+	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+
+	/* init_guest_vmx() took the rest from the contexts, set to their reset values */
+	exec_vmwrite(VMX_GUEST_DR7, ectx->dr7);
+	exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL, ectx->ia32_pat);
+	exec_vmwrite64(VMX_GUEST_IA32_DEBUGCTL_FULL, ectx->ia32_debugctl);
+	exec_vmwrite32(VMX_GUEST_IA32_SYSENTER_CS, ectx->ia32_sysenter_cs);
+	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_ESP, ectx->ia32_sysenter_esp);
+	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_EIP, ectx->ia32_sysenter_eip);
+	exec_vmwrite32(VMX_GUEST_INTERRUPTIBILITY_INFO, vcpu->restore.interruptibility);
+
+	/*
+	 * The guest TSCs go on from the values they had when the VM was paused, at their
+	 * rate: the offset is taken from the scaled host TSC of the pause, without offset.
+	 */
+	exec_vmwrite64(VMX_TSC_OFFSET_FULL, 0UL);
+	exec_vmwrite64(VMX_TSC_OFFSET_FULL, vcpu->restore.tsc - vcpu_guest_tsc(vcpu, vcpu->vm->arch_vm.state_tsc));
+
+	vlapic_load_state(vcpu_vlapic(vcpu), vcpu->restore.apicbase, vcpu->restore.tsc_deadline);
+	vcpu->restore.pending = false;
+}
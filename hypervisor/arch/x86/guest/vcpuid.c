@@ -23,20 +23,13 @@ static struct percpu_cpuids {
 	uint32_t leaves[MAX_VM_VCPUID_ENTRIES];
 } pcpu_cpuids;
 
-static inline const struct vcpuid_entry *local_find_vcpuid_entry(const struct acrn_vcpu *vcpu,
+static const struct vcpuid_entry *scan_vcpuid_entry(const struct acrn_vm *vm, uint32_t start,
 					uint32_t leaf, uint32_t subleaf)
 {
-	uint32_t i = 0U, nr, half;
+	uint32_t i;
 	const struct vcpuid_entry *found_entry = NULL;
-	struct acrn_vm *vm = vcpu->vm;
 
-	nr = vm->vcpuid_entry_nr;
-	half = nr >> 1U;
-	if (vm->vcpuid_entries[half].leaf < leaf) {
-		i = half;
-	}
-
-	for (; i < nr; i++) {
+	for (i = start; i < vm->vcpuid_entry_nr; i++) {
 		const struct vcpuid_entry *tmp = (const struct vcpuid_entry *)(&vm->vcpuid_entries[i]);
 
 		if (tmp->leaf < leaf) {
@@ -56,6 +49,35 @@ static inline const struct vcpuid_entry *local_find_vcpuid_entry(const struct ac
 	return found_entry;
 }
 
+static inline bool get_vcpuid_index_slot(uint32_t leaf, uint32_t *range, uint32_t *offset)
+{
+	*range = leaf >> 30U;
+	*offset = leaf & 0x3fffffffU;
+
+	return ((*range < VCPUID_LEAF_RANGE_NUM) && (*offset < VCPUID_LEAF_INDEX_NUM));
+}
+
+static inline const struct vcpuid_entry *local_find_vcpuid_entry(const struct acrn_vcpu *vcpu,
+					uint32_t leaf, uint32_t subleaf)
+{
+	uint32_t range, offset;
+	const struct vcpuid_entry *found_entry = NULL;
+	const struct acrn_vm *vm = vcpu->vm;
+
+	if (get_vcpuid_index_slot(leaf, &range, &offset)) {
+		uint8_t idx = vm->vcpuid_index[range][offset];
+
+		/* entries of one leaf are contiguous, only its subleaves are scanned */
+		if (idx != VCPUID_INDEX_INVALID) {
+			found_entry = scan_vcpuid_entry(vm, (uint32_t)idx, leaf, subleaf);
+		}
+	} else {
+		found_entry = scan_vcpuid_entry(vm, 0U, leaf, subleaf);
+	}
+
+	return found_entry;
+}
+
 static inline const struct vcpuid_entry *find_vcpuid_entry(const struct acrn_vcpu *vcpu,
 					uint32_t leaf_arg, uint32_t subleaf)
 {
@@ -546,8 +568,12 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 	if (result == 0) {
 		init_vcpuid_entry(0x40000001U, 0U, 0U, &entry);
 		/* EAX: Guest capability flags (e.g. whether it is a privilege VM) */
+		entry.eax |= GUEST_CAPS_STEAL_TIME;
 		if (is_service_vm(vm)) {
 			entry.eax |= GUEST_CAPS_PRIVILEGE_VM;
+		} else if (is_pv_ipi_configured(vm)) {
+			/* the ACRN interfaces are kept in place of the Hyper-V ones */
+			entry.eax |= GUEST_CAPS_PV_IPI | GUEST_CAPS_PV_TLB_FLUSH;
 		}
 #ifdef CONFIG_HYPERV_ENABLED
 		else {
@@ -594,6 +620,19 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 	return result;
 }
 
+static void build_vcpuid_index(struct acrn_vm *vm)
+{
+	uint32_t i, range, offset;
+
+	(void)memset(vm->vcpuid_index, (uint8_t)VCPUID_INDEX_INVALID, sizeof(vm->vcpuid_index));
+	for (i = 0U; i < vm->vcpuid_entry_nr; i++) {
+		if (get_vcpuid_index_slot(vm->vcpuid_entries[i].leaf, &range, &offset) &&
+				(vm->vcpuid_index[range][offset] == VCPUID_INDEX_INVALID)) {
+			vm->vcpuid_index[range][offset] = (uint8_t)i;
+		}
+	}
+}
+
 static inline bool is_percpu_related(uint32_t leaf)
 {
 	uint32_t i;
@@ -662,8 +701,12 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 			case CPUID_CACHE:
 				result = set_vcpuid_cache(vm);
 				break;
-			/* MONITOR/MWAIT */
+			/* MONITOR/MWAIT, the C-states and sub-states guests select with MWAIT hints */
 			case 0x05U:
+				if (is_mwait_pt_configured(vm)) {
+					init_vcpuid_entry(i, 0U, 0U, &entry);
+					result = set_vcpuid_entry(vm, &entry);
+				}
 				break;
 			/* 0x06U */
 			case CPUID_THERMAL_POWER:
@@ -720,6 +763,10 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 		if (result == 0) {
 			result = set_vcpuid_extended_function(vm);
 		}
+
+		if (result == 0) {
+			build_vcpuid_index(vm);
+		}
 	}
 
 	return result;
@@ -761,9 +808,11 @@ static void guest_cpuid_01h(struct acrn_vcpu *vcpu, uint32_t *eax, uint32_t *ebx
 	}
 
 	/*
-	 * Hide MONITOR/MWAIT.
+	 * Hide MONITOR/MWAIT, unless they run natively.
 	 */
-	*ecx &= ~CPUID_ECX_MONITOR;
+	if (!is_mwait_pt_configured(vcpu->vm)) {
+		*ecx &= ~CPUID_ECX_MONITOR;
+	}
 
 	*ecx &= ~CPUID_ECX_OSXSAVE;
 	if ((*ecx & CPUID_ECX_XSAVE) != 0U) {
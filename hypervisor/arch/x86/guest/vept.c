@@ -40,6 +40,7 @@ static uint64_t calc_sept_page_num(void)
 }
 
 static struct page_pool sept_page_pool;
+static struct page_cache sept_page_caches[MAX_PCPU_NUM];
 static struct page *sept_pages;
 static uint64_t *sept_page_bitmap;
 
@@ -69,39 +70,151 @@ static bool is_leaf_ept_entry(uint64_t ept_entry, enum _page_table_level pt_leve
 	return (((ept_entry & PAGE_PSE) != 0U) || (pt_level == IA32E_PT));
 }
 
+/*
+ * @brief Release the PD page a shadow PDPTE refers to, and the PT pages below
+ */
+static void free_sept_pd(uint64_t shadow_pdpte)
+{
+	const uint64_t *shadow_pd;
+	uint64_t k;
+
+	if (is_present_ept_entry(shadow_pdpte) && !is_leaf_ept_entry(shadow_pdpte, IA32E_PDPT)) {
+		shadow_pd = hpa2hva(shadow_pdpte & EPT_ENTRY_PFN_MASK);
+		for (k = 0UL; k < PTRS_PER_PDE; k++) {
+			if (is_present_ept_entry(shadow_pd[k]) && !is_leaf_ept_entry(shadow_pd[k], IA32E_PD)) {
+				free_page(&sept_page_pool, (struct page *)(shadow_pd[k] & EPT_ENTRY_PFN_MASK));
+			}
+		}
+		free_page(&sept_page_pool, (struct page *)(shadow_pdpte & EPT_ENTRY_PFN_MASK));
+	}
+}
+
+/*
+ * @brief Release the pages of the shadow EPT paging structures a shadow EPT entry refers to
+ */
+static void free_sept_entry(uint64_t shadow_ept_entry, enum _page_table_level pt_level)
+{
+	const uint64_t *shadow_pdpt;
+	uint64_t j;
+
+	if (is_present_ept_entry(shadow_ept_entry) && !is_leaf_ept_entry(shadow_ept_entry, pt_level)) {
+		switch (pt_level) {
+		case IA32E_PML4:
+			shadow_pdpt = hpa2hva(shadow_ept_entry & EPT_ENTRY_PFN_MASK);
+			for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+				free_sept_pd(shadow_pdpt[j]);
+			}
+			free_page(&sept_page_pool, (struct page *)(shadow_ept_entry & EPT_ENTRY_PFN_MASK));
+			break;
+		case IA32E_PDPT:
+			free_sept_pd(shadow_ept_entry);
+			break;
+		case IA32E_PD:
+			free_page(&sept_page_pool, (struct page *)(shadow_ept_entry & EPT_ENTRY_PFN_MASK));
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 /*
  * @brief Release all pages except the PML4E page of a shadow EPT
  */
 static void free_sept_table(uint64_t *shadow_eptp)
 {
-	uint64_t *shadow_pml4e, *shadow_pdpte, *shadow_pde;
-	uint64_t i, j, k;
+	uint64_t i;
 
 	if (shadow_eptp) {
 		for (i = 0UL; i < PTRS_PER_PML4E; i++) {
-			shadow_pml4e = pml4e_offset(shadow_eptp, i << PML4E_SHIFT);
-			if (!is_present_ept_entry(*shadow_pml4e)) {
-				continue;
+			free_sept_entry(shadow_eptp[i], IA32E_PML4);
+			shadow_eptp[i] = 0UL;
+		}
+	}
+}
+
+/*
+ * @brief Check if a shadow EPT entry still shadows the guest EPT entry of the same index
+ *
+ * The attributes have to be the same, and a leaf entry has to map the HPA of
+ * the guest EPT entry address. A non-leaf entry may refer to another guest EPT
+ * page than the one it was created from, the entries below are checked on
+ * their own against the current one.
+ */
+static bool is_sept_entry_valid(struct acrn_vm *vm, uint64_t shadow_ept_entry,
+		const uint64_t *p_guest_ept_page, uint16_t offset, enum _page_table_level pt_level)
+{
+	const uint64_t attr_mask = ~(EPT_ENTRY_PFN_MASK | EPT_ACCESSED | EPT_DIRTY);
+	uint64_t guest_ept_entry;
+	bool valid = false;
+
+	if (p_guest_ept_page != NULL) {
+		guest_ept_entry = p_guest_ept_page[offset];
+		/* a 2M guest page shadowed by 4K pages is dropped, not checked page by page */
+		if (is_present_ept_entry(guest_ept_entry) &&
+				(is_leaf_ept_entry(guest_ept_entry, pt_level) == is_leaf_ept_entry(shadow_ept_entry, pt_level)) &&
+				((guest_ept_entry & attr_mask) == (shadow_ept_entry & attr_mask))) {
+			if (is_leaf_ept_entry(guest_ept_entry, pt_level)) {
+				valid = (gpa2hpa(vm, guest_ept_entry & EPT_ENTRY_PFN_MASK) ==
+					(shadow_ept_entry & EPT_ENTRY_PFN_MASK));
+			} else {
+				valid = true;
 			}
-			for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
-				shadow_pdpte = pdpte_offset(shadow_pml4e, j << PDPTE_SHIFT);
-				if (!is_present_ept_entry(*shadow_pdpte) ||
-				    is_leaf_ept_entry(*shadow_pdpte, IA32E_PDPT)) {
-					continue;
-				}
-				for (k = 0UL; k < PTRS_PER_PDE; k++) {
-					shadow_pde = pde_offset(shadow_pdpte, k << PDE_SHIFT);
-					if (!is_present_ept_entry(*shadow_pde) ||
-					    is_leaf_ept_entry(*shadow_pde, IA32E_PD)) {
-						continue;
-					}
-					free_page(&sept_page_pool, (struct page *)((*shadow_pde) & EPT_ENTRY_PFN_MASK));
-				}
-				free_page(&sept_page_pool, (struct page *)((*shadow_pdpte) & EPT_ENTRY_PFN_MASK));
+		}
+	}
+
+	return valid;
+}
+
+/*
+ * @brief Drop the shadow EPT entries which don't shadow the guest EPT any more
+ *
+ * On INVEPT, the shadow EPT entries built for the translations the L1 VM did
+ * not change are kept, so that the L2 VM doesn't fault on them again.
+ *
+ * @pre the caller holds vept_desc_bucket_lock and called stac()
+ */
+static void sync_sept_table(struct acrn_vm *vm, const struct vept_desc *desc)
+{
+	uint64_t *p_shadow_ept_page[IA32E_PT + 1];
+	const uint64_t *p_guest_ept_page[IA32E_PT + 1];
+	uint16_t offset[IA32E_PT + 1];
+	enum _page_table_level pt_level = IA32E_PML4;
+	uint64_t shadow_ept_entry;
+
+	p_shadow_ept_page[IA32E_PML4] = (uint64_t *)(desc->shadow_eptp & PAGE_MASK);
+	p_guest_ept_page[IA32E_PML4] = gpa2hva(vm, desc->guest_eptp & PAGE_MASK);
+	offset[IA32E_PML4] = 0U;
+
+	/* walk the present shadow EPT entries, each table along with the guest EPT one of the same GPA range */
+	while (true) {
+		if (offset[pt_level] == PTRS_PER_PTE) {
+			if (pt_level == IA32E_PML4) {
+				break;
 			}
-			free_page(&sept_page_pool, (struct page *)((*shadow_pml4e) & EPT_ENTRY_PFN_MASK));
-			*shadow_pml4e = 0UL;
+			pt_level -= 1;
+			offset[pt_level]++;
+			continue;
 		}
+
+		shadow_ept_entry = p_shadow_ept_page[pt_level][offset[pt_level]];
+		if (is_present_ept_entry(shadow_ept_entry)) {
+			if (!is_sept_entry_valid(vm, shadow_ept_entry, p_guest_ept_page[pt_level],
+					offset[pt_level], pt_level)) {
+				free_sept_entry(shadow_ept_entry, pt_level);
+				p_shadow_ept_page[pt_level][offset[pt_level]] = 0UL;
+			} else if (!is_leaf_ept_entry(shadow_ept_entry, pt_level)) {
+				p_shadow_ept_page[pt_level + 1] = hpa2hva(shadow_ept_entry & EPT_ENTRY_PFN_MASK);
+				p_guest_ept_page[pt_level + 1] = gpa2hva(vm,
+					p_guest_ept_page[pt_level][offset[pt_level]] & EPT_ENTRY_PFN_MASK);
+				pt_level += 1;
+				offset[pt_level] = 0U;
+				continue;
+			} else {
+				/* a valid leaf entry, kept */
+			}
+		}
+		offset[pt_level]++;
 	}
 }
 
@@ -217,33 +330,50 @@ void put_vept_desc(uint64_t guest_eptp)
 	}
 }
 
-static uint64_t get_leaf_entry(uint64_t gpa, uint64_t *eptp, enum _page_table_level *level)
+/* The guest EPT leaf entries shadowed at once by an EPT violation on a 4K page, a power of 2 */
+#define SEPT_FAULT_AROUND_NUM	16U
+
+/**
+ * @brief Shadow a guest EPT leaf entry of a 4K page
+ * @return 0 if the page isn't mapped by the EPT of vm
+ */
+static uint64_t generate_shadow_4k_ept_entry(struct acrn_vm *vm, uint64_t guest_ept_entry)
 {
-	enum _page_table_level pt_level = IA32E_PML4;
-	uint16_t offset;
-	uint64_t ept_entry = 0UL;
-	uint64_t *p_ept_entry = eptp;
+	uint64_t hpa = gpa2hpa(vm, guest_ept_entry & EPT_ENTRY_PFN_MASK);
+	uint64_t shadow_ept_entry = 0UL;
 
-	while (pt_level <= IA32E_PT) {
-		offset = PAGING_ENTRY_OFFSET(gpa, pt_level);
-		ept_entry = p_ept_entry[offset];
+	if (hpa != INVALID_HPA) {
+		/*
+		 * TODO:
+		 * Now, take guest EPT entry attributes directly. We need take care
+		 * of memory type, permission bits, reserved bits when we merge EPT
+		 * entry and guest EPT entry.
+		 */
+		shadow_ept_entry = (guest_ept_entry & ~EPT_ENTRY_PFN_MASK) | hpa;
+	}
 
-		if (is_present_ept_entry(ept_entry)) {
-			if (is_leaf_ept_entry(ept_entry, pt_level)) {
-				*level = pt_level;
-				break;
-			}
-		} else {
-			ept_entry = 0UL;
-			pr_err("%s, GPA[%llx] is invalid!", __func__, gpa);
-			break;
-		}
+	return shadow_ept_entry;
+}
 
-		p_ept_entry = (uint64_t *)(ept_entry & EPT_ENTRY_PFN_MASK);
-		pt_level += 1;
+/**
+ * @brief The guest EPT leaf entry of the 4K page of index offset in a guest EPT page
+ *
+ * With p_guest_ept_page NULL, the 4K page is the one of index offset in the 2M
+ * page of guest_2m_ept_entry.
+ */
+static uint64_t get_guest_4k_ept_entry(const uint64_t *p_guest_ept_page, uint64_t guest_2m_ept_entry,
+		uint16_t offset)
+{
+	uint64_t guest_ept_entry;
+
+	if (p_guest_ept_page != NULL) {
+		guest_ept_entry = p_guest_ept_page[offset];
+	} else {
+		guest_ept_entry = (guest_2m_ept_entry & ~(EPT_ENTRY_PFN_MASK | PAGE_PSE)) |
+			((guest_2m_ept_entry & EPT_ENTRY_PFN_MASK) + ((uint64_t)offset << PTE_SHIFT));
 	}
 
-	return ept_entry;
+	return guest_ept_entry;
 }
 
 /**
@@ -254,37 +384,32 @@ static uint64_t generate_shadow_ept_entry(struct acrn_vcpu *vcpu, uint64_t guest
 				    enum _page_table_level guest_ept_level)
 {
 	uint64_t shadow_ept_entry = 0UL;
-	uint64_t ept_entry;
-	enum _page_table_level ept_level;
+	uint64_t hpa;
+	uint32_t pg_size = 0U;
 
 	/*
 	 * Create a shadow EPT entry
-	 * We only support 4K page for guest EPT. So it's simple to create a shadow EPT entry
-	 * for it. The rules are:
-	 *   > Find the host EPT leaf entry of address in ept_entry[M-1:12], named as ept_entry
-	 *   > Minimize the attribute bits (according to ept_entry and guest_ept_entry) and
-	 *     set in shadow EPT entry shadow_ept_entry.
-	 *   > Set the HPA of guest_ept_entry[M-1:12] to shadow_ept_entry.
+	 * We support 4K and 2M pages for guest EPT. The rules are:
+	 *   > A 4K leaf entry maps the HPA of guest_ept_entry[M-1:12], with the
+	 *     attributes of guest_ept_entry.
+	 *   > A 2M leaf entry is shadowed by a 2M leaf entry if the same 2M page is
+	 *     mapped by a 2M or 1G page of the host EPT, so that it is contiguous
+	 *     in HPA. Otherwise it is shadowed by a page of 4K leaf entries, filled
+	 *     as the L2 VM faults on them.
+	 *   > A non-leaf entry refers to a new shadow EPT page.
 	 */
 	if (is_leaf_ept_entry(guest_ept_entry, guest_ept_level)) {
-		ASSERT(guest_ept_level == IA32E_PT, "Only support 4K page for guest EPT!");
-		ept_entry = get_leaf_entry((guest_ept_entry & EPT_ENTRY_PFN_MASK), get_eptp(vcpu->vm), &ept_level);
-		if (ept_entry != 0UL) {
-			/*
-			 * TODO:
-			 * Now, take guest EPT entry attributes directly. We need take care
-			 * of memory type, permission bits, reserved bits when we merge EPT
-			 * entry and guest EPT entry.
-			 *
-			 * Just keep the code skeleton here for extend.
-			 */
-			shadow_ept_entry = guest_ept_entry & ~EPT_ENTRY_PFN_MASK;
-
-			/*
-			 * Set the address.
-			 * gpa2hpa() should be successful as ept_entry already be found.
-			 */
-			shadow_ept_entry |= gpa2hpa(vcpu->vm, (guest_ept_entry & EPT_ENTRY_PFN_MASK));
+		ASSERT(guest_ept_level >= IA32E_PD, "Only support 4K and 2M pages for guest EPT!");
+		if (guest_ept_level == IA32E_PT) {
+			shadow_ept_entry = generate_shadow_4k_ept_entry(vcpu->vm, guest_ept_entry);
+		} else {
+			hpa = local_gpa2hpa(vcpu->vm, guest_ept_entry & EPT_ENTRY_PFN_MASK, &pg_size);
+			if ((hpa != INVALID_HPA) && (pg_size >= PDE_SIZE)) {
+				shadow_ept_entry = (guest_ept_entry & ~EPT_ENTRY_PFN_MASK) | hpa;
+			} else {
+				shadow_ept_entry = guest_ept_entry & EPT_RWX;
+				shadow_ept_entry |= hva2hpa((void *)alloc_page(&sept_page_pool)) & EPT_ENTRY_PFN_MASK;
+			}
 		}
 	} else {
 		/* Use a HPA of a new page in shadow EPT entry */
@@ -329,7 +454,8 @@ static bool is_ept_entry_misconfig(uint64_t ept_entry, enum _page_table_level pt
 		break;
 	case IA32E_PDPT:
 		if (ept_entry & PAGE_PSE) {
-			reserved_bits = IA32E_PDPTE_LEAF_RESERVED_BITS(max_phy_addr_bits);
+			/* 1G pages aren't reported to L1 VM, bit 7 is reserved */
+			is_misconfig = true;
 		} else {
 			reserved_bits = IA32E_PDPTE_RESERVED_BITS(max_phy_addr_bits);
 		}
@@ -383,6 +509,34 @@ static bool is_access_violation(uint64_t ept_entry)
 	return access_violation;
 }
 
+/**
+ * @brief Shadow the guest EPT leaf entries around the one of index offset
+ *
+ * After an EPT violation on a 4K page, the not yet shadowed 4K pages of the
+ * same SEPT_FAULT_AROUND_NUM aligned entries are shadowed as well, so that the
+ * L2 VM doesn't take an EPT violation on each of them. Only the entries the L2
+ * VM could access without a misconfiguration, to pages mapped by the EPT of
+ * the L1 VM, are shadowed.
+ *
+ * @param p_guest_ept_page The guest EPT page of the entries, NULL if the shadow
+ *	  EPT page shadows the 2M page of guest_2m_ept_entry
+ */
+static void prefault_sept_entries(struct acrn_vm *vm, uint64_t *p_shadow_ept_page,
+		const uint64_t *p_guest_ept_page, uint64_t guest_2m_ept_entry, uint16_t offset)
+{
+	uint64_t guest_ept_entry;
+	uint16_t idx, start = offset & ~(uint16_t)(SEPT_FAULT_AROUND_NUM - 1U);
+
+	for (idx = start; idx < (start + SEPT_FAULT_AROUND_NUM); idx++) {
+		if ((idx != offset) && !is_present_ept_entry(p_shadow_ept_page[idx])) {
+			guest_ept_entry = get_guest_4k_ept_entry(p_guest_ept_page, guest_2m_ept_entry, idx);
+			if (is_present_ept_entry(guest_ept_entry) && !is_ept_entry_misconfig(guest_ept_entry, IA32E_PT)) {
+				p_shadow_ept_page[idx] = generate_shadow_4k_ept_entry(vm, guest_ept_entry);
+			}
+		}
+	}
+}
+
 /**
  * @brief L2 VM EPT violation handler
  * @pre vcpu != NULL
@@ -432,8 +586,12 @@ bool handle_l2_ept_violation(struct acrn_vcpu *vcpu)
 			break;
 		}
 
-		/* Shadow EPT entry is non-exist, create it */
-		if (!is_present_ept_entry(shadow_ept_entry)) {
+		/*
+		 * Shadow EPT entry is non-exist, create it. A leaf one shadowing the
+		 * 2M page the guest EPT entry referred to is replaced as well.
+		 */
+		if (!is_present_ept_entry(shadow_ept_entry) || (!is_leaf_ept_entry(guest_ept_entry, pt_level) &&
+				is_leaf_ept_entry(shadow_ept_entry, pt_level))) {
 			/* Create a shadow EPT entry */
 			shadow_ept_entry = generate_shadow_ept_entry(vcpu, guest_ept_entry, pt_level);
 			p_shadow_ept_page[offset] = shadow_ept_entry;
@@ -467,9 +625,27 @@ bool handle_l2_ept_violation(struct acrn_vcpu *vcpu)
 
 		/* Shadow EPT entry exists */
 		if (is_leaf_ept_entry(guest_ept_entry, pt_level)) {
-			/* Shadow EPT is set up, let L2 VM re-execute the instruction. */
-			if ((exec_vmread32(VMX_IDT_VEC_INFO_FIELD) & VMX_INT_INFO_VALID) == 0U) {
-				is_l1_vmexit = false;
+			if (!is_leaf_ept_entry(shadow_ept_entry, pt_level)) {
+				/* A 2M guest page shadowed by 4K pages, shadow the faulting one */
+				p_shadow_ept_page = hpa2hva(shadow_ept_entry & EPT_ENTRY_PFN_MASK);
+				p_guest_ept_page = NULL;
+				offset = PAGING_ENTRY_OFFSET(l2_ept_violation_gpa, IA32E_PT);
+				shadow_ept_entry = generate_shadow_4k_ept_entry(vcpu->vm,
+					get_guest_4k_ept_entry(NULL, guest_ept_entry, offset));
+				p_shadow_ept_page[offset] = shadow_ept_entry;
+				pt_level = IA32E_PT;
+			}
+
+			if (shadow_ept_entry != 0UL) {
+				if (pt_level == IA32E_PT) {
+					prefault_sept_entries(vcpu->vm, p_shadow_ept_page, p_guest_ept_page,
+						guest_ept_entry, offset);
+				}
+
+				/* Shadow EPT is set up, let L2 VM re-execute the instruction. */
+				if ((exec_vmread32(VMX_IDT_VEC_INFO_FIELD) & VMX_INT_INFO_VALID) == 0U) {
+					is_l1_vmexit = false;
+				}
 			}
 			break;
 		} else {
@@ -509,9 +685,12 @@ int32_t invept_vmexit_handler(struct acrn_vcpu *vcpu)
 				if (desc->shadow_eptp != 0UL) {
 					/*
 					 * Since ACRN does not know which paging entries are changed,
-					 * Remove all the shadow EPT entries that ACRN created for L2 VM
+					 * check all the shadow EPT entries that ACRN created for L2 VM
+					 * against the guest EPT, and remove those that are changed
 					 */
-					free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
+					stac();
+					sync_sept_table(vcpu->vm, desc);
+					clac();
 					invept((void *)(desc->shadow_eptp & PAGE_MASK));
 				}
 				spinlock_release(&vept_desc_bucket_lock);
@@ -525,13 +704,15 @@ int32_t invept_vmexit_handler(struct acrn_vcpu *vcpu)
 			 * Invalidate all shadow EPTPs of L1 VM
 			 * TODO: Invalidating all L2 vCPU associated EPTPs is enough. How?
 			 */
+			stac();
 			for (i = 0L; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
 				if (vept_desc_bucket[i].guest_eptp != 0UL) {
 					desc = &vept_desc_bucket[i];
-					free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
+					sync_sept_table(vcpu->vm, desc);
 					invept((void *)(desc->shadow_eptp & PAGE_MASK));
 				}
 			}
+			clac();
 			spinlock_release(&vept_desc_bucket_lock);
 			nested_vmx_result(VMsucceed, 0);
 		} else {
@@ -549,9 +730,7 @@ void init_vept(void)
 	sept_page_pool.bitmap_size = calc_sept_page_num() / 64U;
 	sept_page_pool.bitmap = sept_page_bitmap;
         sept_page_pool.dummy_page = NULL;
-	spinlock_init(&sept_page_pool.lock);
-	memset((void *)sept_page_pool.bitmap, 0, sept_page_pool.bitmap_size * sizeof(uint64_t));
-	sept_page_pool.last_hint_id = 0UL;
+	reset_page_pool(&sept_page_pool, sept_page_caches);
 
 	spinlock_init(&vept_desc_bucket_lock);
 }
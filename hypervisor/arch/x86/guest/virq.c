@@ -14,6 +14,7 @@
 #include <asm/guest/vcpu.h>
 #include <asm/guest/vmcs.h>
 #include <asm/guest/vm.h>
+#include <asm/guest/ept.h>
 #include <asm/guest/lock_instr_emul.h>
 #include <trace.h>
 #include <logmsg.h>
@@ -108,7 +109,7 @@ static bool is_guest_irq_enabled(struct acrn_vcpu *vcpu)
 	if ((guest_rflags & HV_ARCH_VCPU_RFLAGS_IF) != 0UL) {
 		/* Interrupts are allowed */
 		/* Check for temporarily disabled interrupts */
-		guest_state = exec_vmread32(VMX_GUEST_INTERRUPTIBILITY_INFO);
+		guest_state = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_INTR_STATE);
 
 		if ((guest_state & (HV_ARCH_VCPU_BLOCKED_BY_STI |
 				    HV_ARCH_VCPU_BLOCKED_BY_MOVSS)) == 0UL) {
@@ -118,11 +119,11 @@ static bool is_guest_irq_enabled(struct acrn_vcpu *vcpu)
 	return status;
 }
 
-static inline bool is_nmi_injectable(void)
+static inline bool is_nmi_injectable(struct acrn_vcpu *vcpu)
 {
 	uint64_t guest_state;
 
-	guest_state = exec_vmread32(VMX_GUEST_INTERRUPTIBILITY_INFO);
+	guest_state = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_INTR_STATE);
 
 	return ((guest_state & (HV_ARCH_VCPU_BLOCKED_BY_STI |
 		HV_ARCH_VCPU_BLOCKED_BY_MOVSS | HV_ARCH_VCPU_BLOCKED_BY_NMI)) == 0UL);
@@ -331,7 +332,7 @@ int32_t external_interrupt_vmexit_handler(struct acrn_vcpu *vcpu)
 	struct intr_excp_ctx ctx;
 	int32_t ret;
 
-	intr_info = exec_vmread32(VMX_EXIT_INT_INFO);
+	intr_info = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_EXIT_INT_INFO);
 	if (((intr_info & VMX_INT_INFO_VALID) == 0U) ||
 		(((intr_info & VMX_INT_TYPE_MASK) >> 8U)
 		!= VMX_INT_TYPE_EXT_INT)) {
@@ -364,6 +365,9 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 	struct acrn_vcpu_arch *arch = &vcpu->arch;
 	uint64_t *pending_req_bits = &arch->pending_req;
 
+	/* a TSC deadline passed in root mode is injected with this entry */
+	vlapic_expire_ptimer(vcpu);
+
 	if (*pending_req_bits != 0UL) {
 		/* make sure ACRN_REQUEST_INIT_VMCS handler as the first one */
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_INIT_VMCS, pending_req_bits)) {
@@ -382,11 +386,12 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 				wait_event(&vcpu->events[VCPU_EVENT_SPLIT_LOCK]);
 			}
 
+			if (bitmap_test_and_clear_lock(ACRN_REQUEST_DIRTY_LOG, pending_req_bits)) {
+				dirty_log_apply(vcpu);
+			}
+
 			if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, pending_req_bits)) {
-				invept(vcpu->vm->arch_vm.nworld_eptp);
-				if (vcpu->vm->sworld_control.flag.active != 0UL) {
-					invept(vcpu->vm->arch_vm.sworld_eptp);
-				}
+				ept_flush_vcpu(vcpu);
 			}
 
 			if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,	pending_req_bits)) {
@@ -416,7 +421,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 
 			if ((*pending_req_bits != 0UL) &&
 				bitmap_test_and_clear_lock(ACRN_REQUEST_NMI, pending_req_bits)) {
-				if (is_nmi_injectable()) {
+				if (is_nmi_injectable(vcpu)) {
 					/* Inject NMI vector = 2 */
 					exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD,
 							VMX_INT_INFO_VALID | (VMX_INT_TYPE_NMI << 8U) | IDT_NMI);
@@ -514,7 +519,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 	pr_dbg(" Handling guest exception");
 
 	/* Obtain VM-Exit information field pg 2912 */
-	intinfo = exec_vmread32(VMX_EXIT_INT_INFO);
+	intinfo = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_EXIT_INT_INFO);
 	if ((intinfo & VMX_INT_INFO_VALID) != 0U) {
 		exception_vector = intinfo & 0xFFU;
 		/* Check if exception caused by the guest is a HW exception.
@@ -525,7 +530,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 			int_err_code = exec_vmread32(VMX_EXIT_INT_ERROR_CODE);
 
 			/* get current privilege level and fault address */
-			cpl = exec_vmread32(VMX_GUEST_CS_ATTR);
+			cpl = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CS_ATTR);
 			cpl = (cpl >> 5U) & 3U;
 
 			if (cpl < 3U) {
@@ -17,6 +17,8 @@
 #include <asm/vtd.h>
 #include <asm/guest/vmexit.h>
 #include <asm/pgtable.h>
+#include <asm/cpuid.h>
+#include <asm/guest/vcpuid.h>
 #include <asm/cpufeatures.h>
 #include <trace.h>
 #include <logmsg.h>
@@ -57,6 +59,13 @@ static uint64_t cr4_passthru_mask = CR4_PASSTHRU_BITS;	/* bound to flexible bits
 #define CR4_TRAP_AND_PASSTHRU_BITS	(CR4_PSE | CR4_PAE | CR4_SMEP | CR4_SMAP | CR4_PKE | CR4_PKS | CR4_KL)
 static uint64_t	cr4_trap_and_passthru_mask = CR4_TRAP_AND_PASSTHRU_BITS; /* bound to flexible bits */
 
+/*
+ * CR4_TRAP_AND_PASSTHRU_BITS with no emulation side effect other than the TLB
+ * flush of the write. They are passed through to the vCPUs whose CPUID reports
+ * the feature, so that the flush is done by the guest write itself.
+ */
+#define CR4_PASSTHRU_IF_EXPOSED_BITS	(CR4_SMEP | CR4_SMAP | CR4_PKE | CR4_PKS)
+
 #ifdef CONFIG_NVMX_ENABLED
 #define CR4_TRAP_AND_EMULATE_BITS	(CR4_VMXE | CR4_MCE) /* software emulated bits even if host is fixed */
 #else
@@ -303,6 +312,10 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t value)
 						/* Restore IA32_PAT to enable cache again */
 						exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL,
 							vcpu_get_guest_msr(vcpu, MSR_IA32_PAT));
+						/* with the MTRRs written while the cache was disabled */
+						if (!vm_hide_mtrr(vcpu->vm)) {
+							apply_vmtrr(vcpu);
+						}
 					}
 				}
 			}
@@ -505,16 +518,43 @@ void init_cr0_cr4_flexible_bits(void)
 		cr4_reserved_bits_mask, cr4_rsv_bits_guest_value, initial_guest_cr4);
 }
 
-void init_cr0_cr4_host_guest_mask(void)
+/* CR4_PASSTHRU_IF_EXPOSED_BITS of the features reported by the CPUID of the vCPU */
+static uint64_t cr4_exposed_bits(struct acrn_vcpu *vcpu)
+{
+	uint32_t eax = CPUID_EXTEND_FEATURE, ebx, ecx = 0U, edx;
+	uint64_t bits = 0UL;
+
+	guest_cpuid(vcpu, &eax, &ebx, &ecx, &edx);
+	if ((ebx & CPUID_EBX_SMEP) != 0U) {
+		bits |= CR4_SMEP;
+	}
+	if ((ebx & CPUID_EBX_SMAP) != 0U) {
+		bits |= CR4_SMAP;
+	}
+	if ((ecx & CPUID_ECX_PKE) != 0U) {
+		bits |= CR4_PKE;
+	}
+	if ((ecx & CPUID_ECX_PKS) != 0U) {
+		bits |= CR4_PKS;
+	}
+
+	return bits & CR4_PASSTHRU_IF_EXPOSED_BITS;
+}
+
+void init_cr0_cr4_host_guest_mask(struct acrn_vcpu *vcpu)
 {
+	uint64_t cr4_mask = cr4_passthru_mask | (cr4_trap_and_passthru_mask & cr4_exposed_bits(vcpu));
+
+	vcpu->arch.cr4_passthru_mask = cr4_mask;
+
 	/*
 	 * "1" means the bit is trapped by host, and "0" means passthru to guest..
 	 */
 	exec_vmwrite(VMX_CR0_GUEST_HOST_MASK, ~cr0_passthru_mask); /* all bits except passthrubits are trapped */
 	pr_dbg("CR0 guest-host mask value: 0x%016lx", ~cr0_passthru_mask);
 
-	exec_vmwrite(VMX_CR4_GUEST_HOST_MASK, ~cr4_passthru_mask); /* all bits except passthru bits are trapped */
-	pr_dbg("CR4 guest-host mask value: 0x%016lx", ~cr4_passthru_mask);
+	exec_vmwrite(VMX_CR4_GUEST_HOST_MASK, ~cr4_mask); /* all bits except passthru bits are trapped */
+	pr_dbg("CR4 guest-host mask value: 0x%016lx", ~cr4_mask);
 }
 
 uint64_t vcpu_get_cr0(struct acrn_vcpu *vcpu)
@@ -550,8 +590,8 @@ uint64_t vcpu_get_cr4(struct acrn_vcpu *vcpu)
 	struct run_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
 	if (bitmap_test_and_set_nolock(CPU_REG_CR4, &vcpu->reg_cached) == 0) {
-		ctx->cr4 = (exec_vmread(VMX_CR4_READ_SHADOW) & ~cr4_passthru_mask) |
-			(exec_vmread(VMX_GUEST_CR4) & cr4_passthru_mask);
+		ctx->cr4 = (exec_vmread(VMX_CR4_READ_SHADOW) & ~vcpu->arch.cr4_passthru_mask) |
+			(exec_vmread(VMX_GUEST_CR4) & vcpu->arch.cr4_passthru_mask);
 	}
 	return ctx->cr4;
 }
@@ -562,9 +602,26 @@ void vcpu_set_cr4(struct acrn_vcpu *vcpu, uint64_t val)
 	vmx_write_cr4(vcpu, val);
 }
 
+/* Count a CR0/CR4 write exit on each bit it changes */
+static void cr_stat_inc(uint32_t *bits, uint32_t *unchanged, uint64_t changed)
+{
+	uint64_t rest = changed & 0xffffffffUL;
+	uint16_t bit;
+
+	if (rest == 0UL) {
+		(*unchanged)++;
+	}
+	while (rest != 0UL) {
+		bit = ffs64(rest);
+		bits[bit]++;
+		rest &= ~(1UL << bit);
+	}
+}
+
 int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	uint64_t reg;
+	struct vcpu_cr_stat *stat = &vcpu->cr_stat;
+	uint64_t reg, cr0;
 	uint32_t idx;
 	uint64_t exit_qual;
 	int32_t ret = 0;
@@ -578,13 +635,29 @@ int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 	switch ((vm_exit_cr_access_type(exit_qual) << 4U) | vm_exit_cr_access_cr_num(exit_qual)) {
 	case 0x00UL:
 		/* mov to cr0 */
+		cr_stat_inc(stat->cr0_bits, &stat->cr0_unchanged, vcpu_get_cr0(vcpu) ^ reg);
 		vcpu_set_cr0(vcpu, reg);
 		break;
 
 	case 0x04UL:
 		/* mov to cr4 */
+		cr_stat_inc(stat->cr4_bits, &stat->cr4_unchanged, vcpu_get_cr4(vcpu) ^ reg);
 		vcpu_set_cr4(vcpu, reg);
 		break;
+
+	case 0x20UL:
+		/* clts, only trapped when CR0.TS is not flexible */
+		stat->clts++;
+		vcpu_set_cr0(vcpu, vcpu_get_cr0(vcpu) & ~CR0_TS);
+		break;
+
+	case 0x30UL:
+		/* lmsw loads CR0[3:0] from its source, and cannot clear CR0.PE */
+		stat->lmsw++;
+		cr0 = vcpu_get_cr0(vcpu);
+		vcpu_set_cr0(vcpu, (cr0 & ~(CR0_MP | CR0_EM | CR0_TS)) |
+			(vm_exit_cr_access_lmsw_src_date(exit_qual) & (CR0_PE | CR0_MP | CR0_EM | CR0_TS)));
+		break;
 	default:
 		ASSERT(false, "Unhandled CR access");
 		ret = -EINVAL;
@@ -35,6 +35,7 @@
 #include <asm/per_cpu.h>
 #include <asm/pgtable.h>
 #include <asm/lapic.h>
+#include <asm/cpu_caps.h>
 #include <asm/guest/vmcs.h>
 #include <asm/guest/vlapic.h>
 #include <asm/guest/virq.h>
@@ -107,6 +108,9 @@ static void vlapic_set_error(struct acrn_vlapic *vlapic, uint32_t mask);
 
 static void vlapic_timer_expired(void *data);
 
+/* the VMX preemption timer value is 32-bit */
+#define VMX_PTIMER_MAX_VALUE	0xFFFFFFFFUL
+
 static inline bool vlapic_enabled(const struct acrn_vlapic *vlapic)
 {
 	const struct lapic_regs *lapic = &(vlapic->apic_page);
@@ -255,6 +259,12 @@ static void vlapic_init_timer(struct acrn_vlapic *vlapic)
 	(void)memset(vtimer, 0U, sizeof(struct vlapic_timer));
 
 	initialize_timer(&vtimer->timer, vlapic_timer_expired, vlapic2vcpu(vlapic), 0UL, 0UL);
+	vtimer->vmx_ptimer = is_vmx_preempt_timer_configured(vlapic2vcpu(vlapic)->vm);
+}
+
+static inline bool vlapic_ptimer_active(const struct acrn_vlapic *vlapic)
+{
+	return vlapic->vtimer.vmx_ptimer && vlapic_lvtt_tsc_deadline(vlapic);
 }
 
 /**
@@ -404,7 +414,7 @@ void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg)
 		 * we disarm the physical timer.
 		 */
 		if (val != 0UL) {
-			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
+			val = vcpu_host_tsc(vcpu, val);
 			if (val == 0UL) {
 				val += 1UL;
 			}
@@ -420,13 +430,16 @@ void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg)
 
 		if (val != 0UL) {
 			/* transfer guest tsc to host tsc */
-			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
+			val = vcpu_host_tsc(vcpu, val);
 			update_timer(timer, val, 0UL);
-			/* vlapic_init_timer has been called,
-			 * and timer->fire_tsc is not 0,here
-			 * add_timer should not return error
-			 */
-			(void)add_timer(timer);
+			/* the VMX preemption timer is programmed on VM entry, see vlapic_arm_ptimer() */
+			if (!vlapic->vtimer.vmx_ptimer) {
+				/* vlapic_init_timer has been called,
+				 * and timer->fire_tsc is not 0,here
+				 * add_timer should not return error
+				 */
+				(void)add_timer(timer);
+			}
 		} else {
 			update_timer(timer, 0UL, 0UL);
 		}
@@ -533,6 +546,7 @@ static void vlapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool
 		dev_dbg(DBG_LEVEL_VLAPIC, "vlapic is software disabled, ignoring interrupt %u", vector);
 	} else {
 		vlapic->ops->accept_intr(vlapic, vector, level);
+		atomic_inc64(&vlapic2vcpu(vlapic)->intr_accepted);
 		signal_event(&vlapic2vcpu(vlapic)->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
 	}
 }
@@ -1190,7 +1204,7 @@ static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 				} else if (mode == APIC_DELMODE_SMI) {
 					pr_info("vlapic: SMI IPI do not support\n");
 				} else {
-					pr_err("Unhandled icrlo write with mode %u\n", mode);
+					pr_err_ratelimited("Unhandled icrlo write with mode %u\n", mode);
 				}
 			}
 		}
@@ -1628,6 +1642,33 @@ void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
 	vlapic_write_dcr(vlapic);
 }
 
+/*
+ * Bring a vLAPIC whose registers were set from a saved vCPU state in line with
+ * them, on the pCPU of its vCPU with the VMCS loaded. A one-shot or periodic
+ * timer restarts from its initial count.
+ */
+void vlapic_load_state(struct acrn_vlapic *vlapic, uint64_t apicbase, uint64_t tsc_deadline)
+{
+	uint32_t rvi;
+
+	(void)vlapic_set_apicbase(vlapic, apicbase);
+	vlapic_write_svr(vlapic);
+	vlapic_write_dcr(vlapic);
+	vlapic->isrv = vlapic_find_isrv(vlapic);
+	vlapic_update_ppr(vlapic);
+
+	if (vlapic_lvtt_tsc_deadline(vlapic)) {
+		vlapic_set_tsc_deadline_msr(vlapic, tsc_deadline);
+	} else {
+		vlapic_write_icrtmr(vlapic);
+	}
+
+	if (is_apicv_advanced_feature_supported()) {
+		rvi = vlapic_find_highest_irr(vlapic);
+		exec_vmwrite16(VMX_GUEST_INTR_STATUS, (uint16_t)((vlapic->isrv << 8U) | rvi));
+	}
+}
+
 uint64_t vlapic_get_apicbase(const struct acrn_vlapic *vlapic)
 {
 	return vlapic->msr_apicbase;
@@ -1882,6 +1923,61 @@ static int32_t inject_msi_for_non_lapic_pt(struct acrn_vm *vm, uint64_t addr, ui
 	return ret;
 }
 
+/**
+ * @brief The single vCPU a MSI is delivered to, for it to be posted there directly.
+ *
+ * Only a fixed MSI to a physical APIC ID, with no redirection hint, has a
+ * destination that can't change without the MSI changing: the APIC IDs of
+ * the vCPUs are read-only.
+ *
+ * @param[in] vm     Pointer to VM data structure
+ * @param[in] addr   MSI address.
+ * @param[in] msg    MSI data.
+ * @param[out] vector The vector of the MSI, if a vCPU is returned.
+ *
+ * @return The destination vCPU, NULL for any other MSI or if the local APIC
+ *	   of \p vm is passed through.
+ *
+ * @pre vm != NULL
+ */
+struct acrn_vcpu *vlapic_msi_dest_vcpu(struct acrn_vm *vm, uint64_t addr, uint64_t msg, uint32_t *vector)
+{
+	struct acrn_vcpu *vcpu = NULL;
+	union msi_addr_reg address;
+	union msi_data_reg data;
+	uint64_t dmask;
+
+	address.full = addr;
+	data.full = (uint32_t) msg;
+
+	if (!is_lapic_pt_configured(vm) && (address.bits.addr_base == MSI_ADDR_BASE) &&
+			(address.bits.dest_mode == MSI_ADDR_DESTMODE_PHYS) && (address.bits.rh != MSI_ADDR_RH) &&
+			((uint32_t)(data.bits.delivery_mode) == IOAPIC_RTE_DELMODE_FIXED)) {
+		dmask = vlapic_calc_dest_noshort(vm, false, address.bits.dest_field, true, false);
+		if (bitmap_weight(dmask) == 1U) {
+			vcpu = vcpu_from_vid(vm, ffs64(dmask));
+			*vector = (uint32_t)(data.bits.vector);
+		}
+	}
+
+	return vcpu;
+}
+
+/**
+ * @brief Post an edge interrupt to a vCPU got from vlapic_msi_dest_vcpu().
+ *
+ * The interrupt is dropped if the vLAPIC of \p vcpu is disabled, as
+ * vlapic_inject_msi() would.
+ *
+ * @pre vcpu != NULL
+ */
+void vlapic_post_msi(struct acrn_vcpu *vcpu, uint32_t vector)
+{
+	if (vlapic_enabled(vcpu_vlapic(vcpu))) {
+		vlapic_set_intr(vcpu, vector, LAPIC_TRIG_EDGE);
+	}
+}
+
 /**
  *@pre Pointer vm shall point to Service VM
  */
@@ -1985,12 +2081,76 @@ static void vlapic_timer_expired(void *data)
 	vlapic = vcpu_vlapic(vcpu);
 	lapic = &(vlapic->apic_page);
 
+	/* the deadline backed by the VMX preemption timer is disarmed once fired */
+	if (vlapic_ptimer_active(vlapic)) {
+		update_timer(&vlapic->vtimer.timer, 0UL, 0UL);
+	}
+
 	/* inject vcpu timer interrupt if not masked */
 	if (!vlapic_lvtt_masked(vlapic)) {
 		vlapic_set_intr(vcpu, lapic->lvt[APIC_LVT_TIMER].v & APIC_LVTT_VECTOR, LAPIC_TRIG_EDGE);
 	}
 }
 
+void vlapic_expire_ptimer(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	const struct hv_timer *timer = &vlapic->vtimer.timer;
+
+	if (vlapic_ptimer_active(vlapic) && (timer->timeout != 0UL) && (cpu_ticks() >= timer->timeout)) {
+		vlapic_timer_expired(vcpu);
+	}
+}
+
+void vlapic_arm_ptimer(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	uint64_t timeout = vlapic->vtimer.timer.timeout;
+	uint64_t now, value = VMX_PTIMER_MAX_VALUE;
+	uint32_t shift;
+
+	if (vlapic->vtimer.vmx_ptimer) {
+		/* the timer only counts down in non-root mode, it is programmed again on each entry */
+		if (vlapic_lvtt_tsc_deadline(vlapic) && (timeout != 0UL)) {
+			now = cpu_ticks();
+			if (timeout > now) {
+				/* rounded up, an early exit would only be followed by another one */
+				shift = vmx_preemption_timer_shift();
+				value = min(((timeout - now) + (1UL << shift) - 1UL) >> shift, VMX_PTIMER_MAX_VALUE);
+			} else {
+				/* passed since vlapic_expire_ptimer(), exit right after the entry */
+				value = 0UL;
+			}
+		}
+		exec_vmwrite32(VMX_GUEST_TIMER, (uint32_t)value);
+	}
+}
+
+void vlapic_ptimer_switch_out(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+
+	/* the VMX preemption timer doesn't count while the vCPU is preempted or blocked */
+	if (vlapic_ptimer_active(vlapic) && (vlapic->vtimer.timer.timeout != 0UL)) {
+		(void)add_timer(&vlapic->vtimer.timer);
+	}
+}
+
+void vlapic_ptimer_switch_in(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+
+	if (vlapic_ptimer_active(vlapic)) {
+		del_timer(&vlapic->vtimer.timer);
+	}
+}
+
+int32_t vmx_preemption_timer_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+{
+	/* vlapic_expire_ptimer() fires the deadline before the next entry */
+	return 0;
+}
+
 /*
  * @pre vm != NULL
  */
@@ -2142,6 +2302,156 @@ int32_t vlapic_x2apic_read(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
 	return error;
 }
 
+/*
+ * Post vec to the PIRs of all the vCPUs of dmask first, then notify the
+ * pCPUs running those whose outstanding notification bit got set, with a
+ * single multicast IPI. The vCPUs which aren't the current thread of their
+ * pCPU aren't notified: they sync their PIR on their next VM entry, and are
+ * woken up by the event if halted.
+ *
+ * @pre APICv advanced features are supported
+ * @pre vec >= 16U
+ */
+static void apicv_post_ipi_mask(struct acrn_vcpu *vcpu, uint64_t dmask, uint32_t vec)
+{
+	struct vcpu_ipi_stat *stat = &vcpu->ipi_stat;
+	struct acrn_vcpu *target_vcpu;
+	struct acrn_vlapic *target;
+	uint64_t mask = dmask, pcpu_mask = 0UL;
+	uint16_t vcpu_id, pcpu_id;
+
+	vcpu_id = ffs64(mask);
+	while (vcpu_id != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(vcpu_id, &mask);
+		target_vcpu = vcpu_from_vid(vcpu->vm, vcpu_id);
+		target = vcpu_vlapic(target_vcpu);
+
+		if ((target->apic_page.svr.v & APIC_SVR_ENABLE) != 0U) {
+			stat->targets++;
+			atomic_inc64(&target_vcpu->intr_accepted);
+			vlapic_set_tmr(target, vec, LAPIC_TRIG_EDGE);
+			if (apicv_set_intr_ready(target, vec)) {
+				bitmap_set_lock(ACRN_REQUEST_EVENT, &target_vcpu->arch.pending_req);
+
+				/* the request set above is seen by a vCPU switched in after the check */
+				pcpu_id = pcpuid_from_vcpu(target_vcpu);
+				if (sched_get_current(pcpu_id) != &target_vcpu->thread_obj) {
+					stat->not_running++;
+				} else if (pcpu_id != get_pcpu_id()) {
+					bitmap_set_nolock(pcpu_id, &pcpu_mask);
+					stat->notified++;
+				} else {
+					/* the sender itself, synced on its VM entry */
+				}
+			}
+			signal_event(&target_vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+		}
+		vcpu_id = ffs64(mask);
+	}
+
+	if (pcpu_mask != 0UL) {
+		/* the notification vector is the same for all the vCPUs of a VM */
+		send_dest_ipi_mask_logical(pcpu_mask, (uint32_t)vcpu->arch.pid.control.bits.nv);
+	}
+}
+
+/*
+ * x2APIC ICR write. A fixed IPI is posted to all its destinations at once
+ * by apicv_post_ipi_mask() when the interrupts are posted, any other goes
+ * through vlapic_write_icrlo().
+ */
+static int32_t vlapic_x2apic_write_icr(struct acrn_vlapic *vlapic, uint64_t val)
+{
+	struct acrn_vcpu *vcpu = vlapic2vcpu(vlapic);
+	struct lapic_regs *lapic = &(vlapic->apic_page);
+	uint64_t start = cpu_ticks();
+	uint32_t icr_low = (uint32_t)val;
+	uint32_t dest = (uint32_t)(val >> 32U);
+	uint32_t vec = icr_low & APIC_VECTOR_MASK;
+	uint32_t shorthand = icr_low & APIC_DEST_MASK;
+	uint64_t dmask;
+
+	if (is_apicv_advanced_feature_supported() && ((icr_low & APIC_DELMODE_MASK) == APIC_DELMODE_FIXED) &&
+			(vec >= 16U)) {
+		lapic->icr_hi.v = dest;
+		lapic->icr_lo.v = icr_low & ~APIC_DELSTAT_PEND;
+
+		dmask = vlapic_calc_dest(vcpu, shorthand, (dest == 0xffffffffU), dest,
+				((icr_low & APIC_DESTMODE_LOG) == 0UL), false);
+		apicv_post_ipi_mask(vcpu, dmask, vec);
+
+		vcpu->ipi_stat.count++;
+		vcpu->ipi_stat.cycles += cpu_ticks() - start;
+	} else {
+		lapic->icr_hi.v = dest;
+		lapic->icr_lo.v = icr_low;
+		vlapic_write_icrlo(vlapic);
+	}
+
+	return 0;
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre vec >= 16U
+ */
+void vlapic_send_fixed_ipi_mask(struct acrn_vcpu *vcpu, uint64_t dmask, uint32_t vec)
+{
+	struct acrn_vcpu *target_vcpu;
+	uint16_t vcpu_id;
+
+	if (is_apicv_advanced_feature_supported()) {
+		apicv_post_ipi_mask(vcpu, dmask, vec);
+	} else {
+		foreach_vcpu(vcpu_id, vcpu->vm, target_vcpu) {
+			if ((dmask & (1UL << vcpu_id)) != 0UL) {
+				vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
+				vcpu->ipi_stat.targets++;
+			}
+		}
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t vlapic_pv_send_ipi(struct acrn_vcpu *vcpu, uint64_t bitmap, uint32_t min_apic_id, uint32_t icr_low)
+{
+	struct acrn_vcpu *target_vcpu;
+	uint64_t start = cpu_ticks();
+	uint64_t dmask = 0UL;
+	uint32_t vec = icr_low & APIC_VECTOR_MASK;
+	uint32_t mode = icr_low & APIC_DELMODE_MASK;
+	uint32_t apic_id;
+	uint16_t vcpu_id;
+	int32_t ret = 0;
+
+	foreach_vcpu(vcpu_id, vcpu->vm, target_vcpu) {
+		apic_id = vlapic_get_apicid(vcpu_vlapic(target_vcpu));
+		if ((apic_id >= min_apic_id) && ((apic_id - min_apic_id) < 64U) &&
+				((bitmap & (1UL << (apic_id - min_apic_id))) != 0UL)) {
+			bitmap_set_nolock(vcpu_id, &dmask);
+			ret++;
+		}
+	}
+
+	if ((mode == APIC_DELMODE_FIXED) && (vec >= 16U)) {
+		vlapic_send_fixed_ipi_mask(vcpu, dmask, vec);
+		vcpu->ipi_stat.count++;
+		vcpu->ipi_stat.cycles += cpu_ticks() - start;
+	} else if (mode == APIC_DELMODE_NMI) {
+		foreach_vcpu(vcpu_id, vcpu->vm, target_vcpu) {
+			if ((dmask & (1UL << vcpu_id)) != 0UL) {
+				vcpu_inject_nmi(target_vcpu);
+			}
+		}
+	} else {
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
 int32_t vlapic_x2apic_write(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val)
 {
 	struct acrn_vlapic *vlapic;
@@ -2167,6 +2477,8 @@ int32_t vlapic_x2apic_write(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val)
 				pr_err("%s: unexpected MSR[0x%x] write with lapic_pt", __func__, msr);
 				break;
 			}
+		} else if (msr == MSR_IA32_EXT_APIC_ICR) {
+			error = vlapic_x2apic_write_icr(vlapic, val);
 		} else {
 			offset = x2apic_msr_to_regoff(msr);
 			if (vlapic->ops->x2apic_write_msr_may_valid(offset)) {
@@ -2442,7 +2754,7 @@ int32_t apic_access_vmexit_handler(struct acrn_vcpu *vcpu)
 		}
 		TRACE_2L(TRACE_VMEXIT_APICV_ACCESS, qual, (uint64_t)vlapic);
 	} else {
-		pr_err("%s, unhandled access type: %lu\n", __func__, access_type);
+		pr_err_ratelimited("%s, unhandled access type: %lu\n", __func__, access_type);
 		err = -EINVAL;
 	}
 
@@ -2547,7 +2859,7 @@ int32_t apic_write_vmexit_handler(struct acrn_vcpu *vcpu)
 		/* falls through */
 	default:
 		err = -EACCES;
-		pr_err("Unhandled APIC-Write, offset:0x%x", offset);
+		pr_err_ratelimited("Unhandled APIC-Write, offset:0x%x", offset);
 		break;
 	}
 
@@ -9,7 +9,9 @@
 #include <sprintf.h>
 #include <asm/per_cpu.h>
 #include <asm/lapic.h>
+#include <asm/tsc.h>
 #include <asm/guest/vm.h>
+#include <asm/cpufeatures.h>
 #include <asm/guest/vm_reset.h>
 #include <asm/guest/virq.h>
 #include <asm/lib/bits.h>
@@ -44,6 +46,8 @@
 #endif
 #include <asm/boot/ld_sym.h>
 #include <asm/guest/optee.h>
+#include <boot_time.h>
+#include <msi_ring.h>
 
 /* Local variables */
 
@@ -181,6 +185,59 @@ bool is_stateful_vm(const struct acrn_vm *vm)
 	return ((vm_config->guest_flags & GUEST_FLAG_STATELESS) == 0U);
 }
 
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ *
+ * vCPUs of RT VMs, and of VMs with LAPIC or PMU passthrough or vCAT, always
+ * stay on the pCPU they were created on.
+ */
+bool is_vcpu_migration_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	return ((vm_config->load_order == POST_LAUNCHED_VM)
+		&& ((vm_config->guest_flags & GUEST_FLAG_VCPU_MIGRATION) != 0U)
+		&& ((vm_config->guest_flags & (GUEST_FLAG_RT | GUEST_FLAG_LAPIC_PASSTHROUGH
+			| GUEST_FLAG_PMU_PASSTHROUGH | GUEST_FLAG_VCAT_ENABLED)) == 0U));
+}
+
+bool is_pv_ipi_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	/* the IPIs of a guest with the physical LAPIC don't go through the hypervisor */
+	return (((vm_config->guest_flags & GUEST_FLAG_PV_IPI) != 0U)
+		&& ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) == 0U));
+}
+
+bool is_vmx_preempt_timer_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	/* the physical LAPIC timer of a guest with LAPIC passthrough is already its own */
+	return (((vm_config->guest_flags & GUEST_FLAG_VMX_PREEMPT_TIMER) != 0U)
+		&& ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) == 0U)
+		&& is_vmx_preemption_timer_supported());
+}
+
+bool is_vhpet_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	/* the HPET of the other VMs is the physical one or none, its interrupts go through the vIOAPIC */
+	return (((vm_config->guest_flags & GUEST_FLAG_VHPET) != 0U) && is_postlaunched_vm(vm)
+		&& ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) == 0U));
+}
+
+bool is_vpit_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	/* the interrupts of channel 0 go through the vPIC and the vIOAPIC */
+	return (((vm_config->guest_flags & GUEST_FLAG_VPIT) != 0U) && is_postlaunched_vm(vm)
+		&& ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) == 0U));
+}
+
 /**
  * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
  */
@@ -211,6 +268,27 @@ bool is_static_configured_vm(const struct acrn_vm *vm)
 	return ((vm_config->guest_flags & GUEST_FLAG_STATIC_VM) != 0U);
 }
 
+/*
+ * MONITOR/MWAIT don't exit and the guest idles in the C-states it picks, so the pCPU can't be given
+ * to another thread meanwhile: the scenario only sets the flag for VMs owning their pCPUs.
+ */
+bool is_mwait_pt_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	return (((vm_config->guest_flags & GUEST_FLAG_MWAIT_PASSTHROUGH) != 0U)
+		&& pcpu_has_cap(X86_FEATURE_MONITOR));
+}
+
+/*
+ * The rate of the guest TSCs, reported by CPUID and in the saved vCPU states: the host rate, or
+ * the one a restored VM was saved at, kept by VMX TSC scaling.
+ */
+uint32_t vm_tsc_khz(const struct acrn_vm *vm)
+{
+	return (vm->arch_vm.tsc_khz != 0U) ? vm->arch_vm.tsc_khz : get_tsc_khz();
+}
+
 /**
  * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
  */
@@ -319,6 +397,50 @@ static inline uint16_t get_configured_bsp_pcpu_id(const struct acrn_vm_config *v
 	return ffs64(vm_config->cpu_affinity);
 }
 
+/*
+ * The LLC colors of vm_config the memory of its VM is taken from, 0 for all.
+ * The pages of a color are the ones whose address bits above PAGE_SHIFT pick
+ * the same LLC sets, the colors repeat every get_llc_colors() pages.
+ */
+static uint64_t get_vm_cache_colors(const struct acrn_vm_config *vm_config)
+{
+	uint32_t nr_colors = get_llc_colors();
+	uint64_t all = (nr_colors >= 64U) ? ~0UL : ((1UL << nr_colors) - 1UL);
+	uint64_t colors = vm_config->cache_colors & all;
+
+	if ((vm_config->cache_colors != 0UL) && (colors == 0UL)) {
+		pr_err("%s: cache colors 0x%lx out of the %u LLC colors, ignored", vm_config->name,
+			vm_config->cache_colors, nr_colors);
+	}
+
+	return (colors == all) ? 0UL : colors;
+}
+
+/*
+ * Skip the pages of region not of colors, then return the bytes of the run of
+ * pages of colors starting it.
+ *
+ * @pre colors != 0UL
+ */
+static uint64_t next_colored_run(struct vm_hpa_regions *region, uint64_t colors)
+{
+	uint32_t nr_colors = get_llc_colors();
+	uint64_t size = 0UL;
+
+	while ((region->size_hpa >= PAGE_SIZE) &&
+			((colors & (1UL << ((region->start_hpa >> PAGE_SHIFT) % nr_colors))) == 0UL)) {
+		region->start_hpa += PAGE_SIZE;
+		region->size_hpa -= PAGE_SIZE;
+	}
+
+	while (((size + PAGE_SIZE) <= region->size_hpa) &&
+			((colors & (1UL << (((region->start_hpa + size) >> PAGE_SHIFT) % nr_colors))) != 0UL)) {
+		size += PAGE_SIZE;
+	}
+
+	return size;
+}
+
 /**
  * @pre vm != NULL && vm_config != NULL
  */
@@ -332,6 +454,7 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 	uint32_t i;
 	struct vm_hpa_regions tmp_vm_hpa;
 	const struct e820_entry *entry;
+	uint64_t colors = get_vm_cache_colors(vm_config);
 
 	hpa_index = 0U;
 	tmp_vm_hpa = vm_config->memory.host_regions[0];
@@ -361,10 +484,15 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 
 		while ((hpa_index < vm_config->memory.region_num) && (remaining_entry_size > 0)) {
 
+			if (colors != 0UL) {
+				/* only the pages of the colors are mapped, each run to consecutive GPAs */
+				base_size = min(remaining_entry_size, next_colored_run(&tmp_vm_hpa, colors));
+			} else {
+				base_size = min(remaining_entry_size, tmp_vm_hpa.size_hpa);
+			}
 			base_hpa = tmp_vm_hpa.start_hpa;
-			base_size = min(remaining_entry_size, tmp_vm_hpa.size_hpa);
 
-			if (tmp_vm_hpa.size_hpa > remaining_entry_size) {
+			if (tmp_vm_hpa.size_hpa > base_size) {
 				/* from low to high */
 				tmp_vm_hpa.start_hpa  += base_size;
 				tmp_vm_hpa.size_hpa -= base_size;
@@ -375,7 +503,10 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 				}
 			}
 
-			if (entry->type != E820_TYPE_RESERVED) {
+			if (base_size == 0UL) {
+				/* no page of the colors left in the region */
+				continue;
+			} else if (entry->type != E820_TYPE_RESERVED) {
 				ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base_hpa, base_gpa,
 						base_size, EPT_RWX | EPT_WB);
 			} else {
@@ -386,6 +517,11 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 			remaining_entry_size -= base_size;
 			base_gpa += base_size;
 		}
+
+		if (remaining_entry_size != 0UL) {
+			pr_err("%s: 0x%lx of the e820 entry at 0x%lx is not backed by its host regions",
+				vm_config->name, remaining_entry_size, entry->baseaddr);
+		}
 	}
 
 	for (i = 0U; i < MAX_MMIO_DEV_NUM; i++) {
@@ -472,6 +608,160 @@ static void deny_hv_owned_devices(struct acrn_vm *service_vm)
 	}
 }
 
+/*
+ * The ranges the Service VM doesn't get, left out of its EPT when it is built
+ * instead of unmapped after, which would split the large pages mapping them.
+ */
+#define MAX_SERVICE_VM_EPT_HOLES	64U
+
+struct service_vm_ept_hole {
+	uint64_t base;
+	uint64_t end;
+};
+
+static struct service_vm_ept_hole service_vm_ept_holes[MAX_SERVICE_VM_EPT_HOLES];
+static uint32_t nr_service_vm_ept_holes;
+/* some holes didn't fit in the array, they are unmapped after the EPT is built */
+static bool service_vm_ept_holes_full;
+
+typedef void (*service_vm_hole_fn)(struct acrn_vm *vm, uint64_t base, uint64_t size);
+
+static void plan_service_vm_hole(__unused struct acrn_vm *vm, uint64_t base, uint64_t size)
+{
+	if (size != 0UL) {
+		if (nr_service_vm_ept_holes < MAX_SERVICE_VM_EPT_HOLES) {
+			service_vm_ept_holes[nr_service_vm_ept_holes].base = base;
+			service_vm_ept_holes[nr_service_vm_ept_holes].end = base + size;
+			nr_service_vm_ept_holes++;
+		} else {
+			service_vm_ept_holes_full = true;
+		}
+	}
+}
+
+static void del_service_vm_hole(struct acrn_vm *vm, uint64_t base, uint64_t size)
+{
+	ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base, size);
+}
+
+static void foreach_service_vm_hole(struct acrn_vm *vm, service_vm_hole_fn fn)
+{
+	uint16_t vm_id;
+	uint32_t i;
+	struct acrn_vm_config *vm_config;
+	struct epc_section* epc_secs;
+	struct pci_mmcfg_region *pci_mmcfg;
+	uint64_t trampoline_memory_size = round_page_up((uint64_t)(&ld_trampoline_end - &ld_trampoline_start));
+
+	/* Unmap all platform EPC resource from Service VM.
+	 * This part has already been marked as reserved by BIOS in E820
+	 * will cause EPT violation if Service VM accesses EPC resource.
+	 */
+	epc_secs = get_phys_epc();
+	for (i = 0U; (i < MAX_EPC_SECTIONS) && (epc_secs[i].size != 0UL); i++) {
+		fn(vm, epc_secs[i].base, epc_secs[i].size);
+	}
+
+	/* unmap hypervisor itself for safety
+	 * will cause EPT violation if Service VM accesses hv memory
+	 */
+	fn(vm, hva2hpa((void *)(get_hv_image_base())), get_hv_ram_size());
+
+	/* unmap prelaunch VM memory */
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_config = get_vm_config(vm_id);
+		if (vm_config->load_order == PRE_LAUNCHED_VM) {
+			for (i = 0; i < vm_config->memory.region_num; i++){
+				fn(vm, vm_config->memory.host_regions[i].start_hpa, vm_config->memory.host_regions[i].size_hpa);
+			}
+		}
+	}
+
+	/* unmap AP trampoline code for security
+	 * This buffer is guaranteed to be page aligned.
+	 */
+	fn(vm, get_trampoline_start16_paddr(), trampoline_memory_size);
+
+	/* unmap PCIe MMCONFIG region since it's owned by hypervisor */
+	pci_mmcfg = get_mmcfg_region();
+	fn(vm, pci_mmcfg->address, get_pci_mmcfg_size(pci_mmcfg));
+
+#if (PRE_RTVM_SW_SRAM_MAX_SIZE > 0U)
+	/* Software SRAM regions assigned to the Pre-launched RTVM, see prepare_service_vm_memmap() */
+	if (is_software_sram_enabled()) {
+		fn(vm, service_vm_hpa2gpa(get_software_sram_base()), PRE_RTVM_SW_SRAM_MAX_SIZE);
+	}
+#endif
+
+	/* unmap Intel IOMMU register pages for below reason:
+	 * Service VM can detect IOMMU capability in its ACPI table hence it may access
+	 * IOMMU hardware resources, which is not expected, as IOMMU hardware is owned by hypervisor.
+	 */
+	for (i = 0U; i < plat_dmar_info.drhd_count; i++) {
+		fn(vm, plat_dmar_info.drhd_units[i].reg_base_addr, PAGE_SIZE);
+	}
+}
+
+/*
+ * Whether gpa is mapped WB for the Service VM, the RAM and the ACPI tables
+ * (DRAM the firmware also gives the OS as WB), or UC. next is set to the next
+ * address where this may change, an e820 entry starting or ending.
+ */
+static bool is_service_vm_wb(const struct acrn_vm *vm, uint64_t gpa, uint64_t *next)
+{
+	const struct e820_entry *entry;
+	uint64_t end;
+	bool wb = false;
+	uint32_t i;
+
+	*next = ~0UL;
+	for (i = 0U; i < vm->e820_entry_num; i++) {
+		entry = &vm->e820_entries[i];
+		end = entry->baseaddr + entry->length;
+		if (entry->baseaddr > gpa) {
+			*next = min(*next, entry->baseaddr);
+		} else if (end > gpa) {
+			*next = min(*next, end);
+			if ((entry->type == E820_TYPE_RAM) || (entry->type == E820_TYPE_ACPI_RECLAIM) ||
+					(entry->type == E820_TYPE_ACPI_NVS)) {
+				wb = true;
+			}
+		} else {
+			/* ends before gpa */
+		}
+	}
+
+	return wb;
+}
+
+/* Map [base, end) but the holes planned, with large pages wherever the holes leave them aligned */
+static void add_service_vm_mr(struct acrn_vm *vm, uint64_t base, uint64_t end, uint64_t prot)
+{
+	const struct service_vm_ept_hole *hole;
+	uint64_t cur = base, hole_base, hole_end;
+	uint32_t i;
+
+	while (cur < end) {
+		/* the first hole left from cur */
+		hole_base = end;
+		hole_end = end;
+		for (i = 0U; i < nr_service_vm_ept_holes; i++) {
+			hole = &service_vm_ept_holes[i];
+			if ((hole->end > cur) && (hole->base < end) && (max(hole->base, cur) <= hole_base)) {
+				if ((max(hole->base, cur) < hole_base) || (hole->end > hole_end)) {
+					hole_end = hole->end;
+				}
+				hole_base = max(hole->base, cur);
+			}
+		}
+
+		if (hole_base > cur) {
+			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, cur, cur, hole_base - cur, prot);
+		}
+		cur = min(hole_end, end);
+	}
+}
+
 /**
  * @param[inout] vm pointer to a vm descriptor
  *
@@ -484,17 +774,13 @@ static void prepare_service_vm_memmap(struct acrn_vm *vm)
 {
 	uint16_t vm_id;
 	uint32_t i;
-	uint64_t hv_hpa;
 	uint64_t service_vm_high64_max_ram = MEM_4G;
+	uint64_t gpa, next, end;
+	bool wb;
 	struct acrn_vm_config *vm_config;
-	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
-	struct epc_section* epc_secs;
-
 	const struct e820_entry *entry;
 	uint32_t entries_count = vm->e820_entry_num;
 	const struct e820_entry *p_e820 = vm->e820_entries;
-	struct pci_mmcfg_region *pci_mmcfg;
-	uint64_t trampoline_memory_size = round_page_up((uint64_t)(&ld_trampoline_end - &ld_trampoline_start));
 
 	pr_dbg("Service VM e820 layout:\n");
 	for (i = 0U; i < entries_count; i++) {
@@ -504,38 +790,34 @@ static void prepare_service_vm_memmap(struct acrn_vm *vm)
 		service_vm_high64_max_ram = max((entry->baseaddr + entry->length), service_vm_high64_max_ram);
 	}
 
-	/* create real ept map for [0, service_vm_high64_max_ram) with UC */
-	ept_add_mr(vm, pml4_page, 0UL, 0UL, service_vm_high64_max_ram, EPT_RWX | EPT_UNCACHED);
+	nr_service_vm_ept_holes = 0U;
+	service_vm_ept_holes_full = false;
+	foreach_service_vm_hole(vm, plan_service_vm_hole);
 
-	/* update ram entries to WB attr */
-	for (i = 0U; i < entries_count; i++) {
-		entry = p_e820 + i;
-		if (entry->type == E820_TYPE_RAM) {
-			ept_modify_mr(vm, pml4_page, entry->baseaddr, entry->length, EPT_WB, EPT_MT_MASK);
+	/*
+	 * Map [0, service_vm_high64_max_ram) in one pass, by runs of the same memory
+	 * type, so that a 1G or 2M page is only split where the type or a hole
+	 * changes inside it. Finer pages are split later by the hypercalls needing them.
+	 */
+	gpa = 0UL;
+	while (gpa < service_vm_high64_max_ram) {
+		wb = is_service_vm_wb(vm, gpa, &end);
+		while ((end < service_vm_high64_max_ram) && (is_service_vm_wb(vm, end, &next) == wb)) {
+			end = next;
 		}
+		end = min(end, service_vm_high64_max_ram);
+
+		add_service_vm_mr(vm, gpa, end, EPT_RWX | (wb ? EPT_WB : EPT_UNCACHED));
+		gpa = end;
 	}
 
-	/* Unmap all platform EPC resource from Service VM.
-	 * This part has already been marked as reserved by BIOS in E820
-	 * will cause EPT violation if Service VM accesses EPC resource.
-	 */
-	epc_secs = get_phys_epc();
-	for (i = 0U; (i < MAX_EPC_SECTIONS) && (epc_secs[i].size != 0UL); i++) {
-		ept_del_mr(vm, pml4_page, epc_secs[i].base, epc_secs[i].size);
+	if (service_vm_ept_holes_full) {
+		foreach_service_vm_hole(vm, del_service_vm_hole);
 	}
 
-	/* unmap hypervisor itself for safety
-	 * will cause EPT violation if Service VM accesses hv memory
-	 */
-	hv_hpa = hva2hpa((void *)(get_hv_image_base()));
-	ept_del_mr(vm, pml4_page, hv_hpa, get_hv_ram_size());
-	/* unmap prelaunch VM memory */
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
 		vm_config = get_vm_config(vm_id);
 		if (vm_config->load_order == PRE_LAUNCHED_VM) {
-			for (i = 0; i < vm_config->memory.region_num; i++){
-				ept_del_mr(vm, pml4_page, vm_config->memory.host_regions[i].start_hpa, vm_config->memory.host_regions[i].size_hpa);
-			}
 			/* Remove MMIO/IO bars of pre-launched VM's ptdev */
 			deny_pdevs(vm, vm_config->pci_devs, vm_config->pci_dev_num);
 		}
@@ -545,15 +827,6 @@ static void prepare_service_vm_memmap(struct acrn_vm *vm)
 		}
 	}
 
-	/* unmap AP trampoline code for security
-	 * This buffer is guaranteed to be page aligned.
-	 */
-	ept_del_mr(vm, pml4_page, get_trampoline_start16_paddr(), trampoline_memory_size);
-
-	/* unmap PCIe MMCONFIG region since it's owned by hypervisor */
-	pci_mmcfg = get_mmcfg_region();
-	ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, pci_mmcfg->address, get_pci_mmcfg_size(pci_mmcfg));
-
 	if (is_software_sram_enabled()) {
 		/*
 		 * Native Software SRAM resources shall be assigned to either Pre-launched RTVM
@@ -567,6 +840,7 @@ static void prepare_service_vm_memmap(struct acrn_vm *vm)
 		 *       Pre-launched RTVM uses, presumed to be starting from Software SRAM base.
 		 *       For other cases, PRE_RTVM_SW_SRAM_MAX_SIZE should be defined as 0,
 		 *       and no region will be removed from Service VM EPT.
+		 *       They are left out by foreach_service_vm_hole().
 		 *
 		 * 2) Native Software SRAM resources are assigned to Service VM:
 		 *     - Software SRAM regions are added to EPT of Service VM by default
@@ -575,22 +849,11 @@ static void prepare_service_vm_memmap(struct acrn_vm *vm)
 		 *       when virtualizing them for Post-launched RTVM.
 		 *     - So memory type of Software SRAM regions in EPT shall be updated to EPT_WB.
 		 */
-#if (PRE_RTVM_SW_SRAM_MAX_SIZE > 0U)
-		ept_del_mr(vm, pml4_page, service_vm_hpa2gpa(get_software_sram_base()), PRE_RTVM_SW_SRAM_MAX_SIZE);
-#else
-		ept_modify_mr(vm, pml4_page, service_vm_hpa2gpa(get_software_sram_base()),
+#if (PRE_RTVM_SW_SRAM_MAX_SIZE == 0U)
+		ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, service_vm_hpa2gpa(get_software_sram_base()),
 			get_software_sram_size(), EPT_WB, EPT_MT_MASK);
 #endif
 	}
-
-	/* unmap Intel IOMMU register pages for below reason:
-	 * Service VM can detect IOMMU capability in its ACPI table hence it may access
-	 * IOMMU hardware resources, which is not expected, as IOMMU hardware is owned by hypervisor.
-	 */
-	for (i = 0U; i < plat_dmar_info.drhd_count; i++) {
-		ept_del_mr(vm, pml4_page, plat_dmar_info.drhd_units[i].reg_base_addr, PAGE_SIZE);
-	}
-
 }
 
 /* Add EPT mapping of EPC reource for the VM */
@@ -689,13 +952,20 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 	int32_t status = 0;
 	uint16_t pcpu_id;
 
+	vm_boot_time_mark(vm_id, ACRN_VM_BOOT_CREATE);
+
 	/* Allocate memory for virtual machine */
 	vm = &vm_array[vm_id];
 	vm->vm_id = vm_id;
 	vm->hw.created_vcpus = 0U;
+	init_sched_gang(&vm->sched_gang, &vm_config->sched_params);
 
 	init_ept_pgtable(&vm->arch_vm.ept_pgtable, vm->vm_id);
+	vm->arch_vm.ept_retired.nr = 0U;
+	vm->arch_vm.ept_retired_flushing = 0U;
+	vm->arch_vm.ept_flush_vcpus = 0UL;
 	vm->arch_vm.nworld_eptp = pgtable_create_root(&vm->arch_vm.ept_pgtable);
+	vm->arch_vm.tsc_khz = 0U;
 
 	(void)memcpy_s(&vm->name[0], MAX_VM_NAME_LEN, &vm_config->name[0], MAX_VM_NAME_LEN);
 
@@ -748,14 +1018,25 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 
 	if (status == 0) {
 		prepare_epc_vm_memmap(vm);
+		vm_boot_time_mark(vm_id, ACRN_VM_BOOT_MEMMAP);
+
 		spinlock_init(&vm->vlapic_mode_lock);
 		spinlock_init(&vm->ept_lock);
+		init_dirty_log(vm);
+		init_wss(vm);
 		spinlock_init(&vm->emul_mmio_lock);
+		spinlock_init(&vm->posted_io_lock);
+		spinlock_init(&vm->msi_ring_lock);
 		spinlock_init(&vm->arch_vm.iwkey_backup_lock);
 
 		vm->arch_vm.vlapic_mode = VM_VLAPIC_XAPIC;
-		vm->intr_inject_delay_delta = 0UL;
+		spinlock_init(&vm->ptirq_rate_limit.lock);
+		ptirq_set_rate_limit(vm, 0UL, 0U);
+		vm->ptirq_msi_remaps = 0UL;
+		vm->ptirq_intx_remaps = 0UL;
+		init_lock_instr_stat(vm);
 		vm->nr_emul_mmio_regions = 0U;
+		vm->nr_emul_mmio_index = 0U;
 		vm->vcpuid_entry_nr = 0U;
 
 		/* Set up IO bit-mask such that VM exit occurs on
@@ -806,14 +1087,28 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 			*/
 			vioapic_init(vm);
 
+			/* the timers of the vHPET and the vPIT are on the pCPU of the BSP */
+			if (is_vhpet_configured(vm)) {
+				vhpet_init(vm, ffs64(pcpu_bitmap));
+			}
+			if (is_vpit_configured(vm)) {
+				vpit_init(vm, ffs64(pcpu_bitmap));
+			}
+
 			/* Populate return VM handle */
 			*rtn_vm = vm;
 			vm->sw.io_shared_page = NULL;
 			vm->sw.asyncio_sbuf = NULL;
+			vm->sw.posted_io_sbuf = NULL;
+			vm->sw.msi_ring = NULL;
+			(void)memset(vm->posted_io_range, 0U, sizeof(vm->posted_io_range));
 			if ((vm_config->load_order == POST_LAUNCHED_VM)
 				&& ((vm_config->guest_flags & GUEST_FLAG_IO_COMPLETION_POLLING) != 0U)) {
 				/* enable IO completion polling mode per its guest flags in vm_config. */
 				vm->sw.is_polling_ioreq = true;
+			} else if ((vm_config->load_order == POST_LAUNCHED_VM)
+				&& ((vm_config->guest_flags & GUEST_FLAG_IO_COMPLETION_HYBRID) != 0U)) {
+				vm->sw.is_hybrid_ioreq = true;
 			}
 			status = set_vcpuid_entries(vm);
 			if (status == 0) {
@@ -838,6 +1133,10 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 				break;
 			}
 		}
+
+		if (status == 0) {
+			vm_boot_time_mark(vm_id, ACRN_VM_BOOT_VCPUS);
+		}
 	}
 
 	if (status == 0) {
@@ -943,8 +1242,16 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 
 	deinit_vpci(vm);
 
+	vhpet_deinit(vm);
+	vpit_deinit(vm);
+
 	deinit_emul_io(vm);
 
+	dirty_log_stop(vm);
+	wss_stop(vm);
+
+	deinit_msi_ring(vm);
+
 	/* Free EPT allocated resources assigned to VM */
 	destroy_ept(vm);
 
@@ -984,13 +1291,25 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 void start_vm(struct acrn_vm *vm)
 {
 	struct acrn_vcpu *bsp = NULL;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
 
 	vm->state = VM_RUNNING;
+	vm_boot_time_mark(vm->vm_id, ACRN_VM_BOOT_START);
+	vm->arch_vm.state_tsc = rdtsc();
 
 	/* Only start BSP (vid = 0) and let BSP start other APs */
 	bsp = vcpu_from_vid(vm, BSP_CPU_ID);
 	vcpu_make_request(bsp, ACRN_REQUEST_INIT_VMCS);
 	launch_vcpu(bsp);
+
+	/* but the APs restored by HC_RESTORE_VCPU_STATE run already */
+	foreach_vcpu(i, vm, vcpu) {
+		if ((vcpu != bsp) && vcpu->restore.pending) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_INIT_VMCS);
+			launch_vcpu(vcpu);
+		}
+	}
 }
 
 /**
@@ -1009,6 +1328,9 @@ int32_t reset_vm(struct acrn_vm *vm, enum reset_mode mode)
 		ret = offline_lapic_pt_enabled_pcpus(vm, mask);
 	}
 
+	dirty_log_stop(vm);
+	wss_stop(vm);
+
 	foreach_vcpu(i, vm, vcpu) {
 		reset_vcpu(vcpu, COLD_RESET);
 	}
@@ -1023,7 +1345,10 @@ int32_t reset_vm(struct acrn_vm *vm, enum reset_mode mode)
 	}
 
 	reset_vm_ioreqs(vm);
+	invalidate_gva_cache(vm);
 	reset_vioapics(vm);
+	vhpet_reset(vm);
+	vpit_reset(vm);
 	destroy_secure_world(vm, false);
 	vm->sworld_control.flag.active = 0UL;
 	vm->arch_vm.iwkey_backup_status = 0UL;
@@ -1053,6 +1378,8 @@ void pause_vm(struct acrn_vm *vm)
 	if (((is_severity_pass(vm->vm_id)) && (vm->state == VM_RUNNING)) ||
 			(vm->state == VM_READY_TO_POWEROFF) ||
 			(vm->state == VM_CREATED)) {
+		/* the reference of the guest TSCs saved by HC_SAVE_VCPU_STATE */
+		vm->arch_vm.state_tsc = rdtsc();
 		foreach_vcpu(i, vm, vcpu) {
 			zombie_vcpu(vcpu, VCPU_ZOMBIE);
 		}
@@ -1104,6 +1431,8 @@ int32_t prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 #endif
 	if (get_vmid_by_name(vm_config->name) != vm_id) {
 		pr_err("Invalid VM name: %s", vm_config->name);
+	} else if (sched_admit(vm_config->cpu_affinity, &vm_config->sched_params) != 0) {
+		pr_err("VM%u: the CPU reservation of its vCPUs doesn't fit", vm_id);
 	} else {
 		/* Service VM and pre-launched VMs launch on all pCPUs defined in vm_config->cpu_affinity */
 		err = create_vm(vm_id, vm_config->cpu_affinity, vm_config, &vm);
@@ -1112,13 +1441,121 @@ int32_t prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 				build_vrsdp(vm);
 			}
 
+			vm_boot_time_mark(vm_id, ACRN_VM_BOOT_LOADING);
 			err = prepare_os_image(vm);
+			if (err == 0) {
+				vm_boot_time_mark(vm_id, ACRN_VM_BOOT_LOADED);
+			}
 		}
 	}
 
 	return err;
 }
 
+/*
+ * Only the VMs whose vCPUs are plain scheduler threads can grow and shrink at
+ * runtime: an RT or LAPIC passthrough vCPU owns its pCPU, co-scheduled vCPUs
+ * form a gang of fixed size, vCAT maps the CLOS of the VM to its vCPU count and
+ * a migratable vCPU picks its pCPU itself.
+ */
+static bool is_vcpu_hotplug_allowed(const struct acrn_vm *vm)
+{
+	return !is_rt_vm(vm) && !is_lapic_pt_configured(vm) && !is_vcat_configured(vm)
+		&& !is_vcpu_migration_configured(vm) && (vm->sched_gang.mode == COSCHED_NONE);
+}
+
+static bool can_pcpu_take_vcpu(__unused uint16_t pcpu_id)
+{
+	bool ret = true;
+#ifdef CONFIG_SCHED_NOOP
+	uint16_t vm_id;
+
+	/* the noop scheduler only runs the first thread woken on a pCPU */
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		if (per_cpu(vcpu_array, pcpu_id)[vm_id] != NULL) {
+			ret = false;
+			break;
+		}
+	}
+#endif
+
+	return ret;
+}
+
+/**
+ * @brief Add a vCPU running on pcpu_id to a created VM.
+ *
+ * The vCPU waits in INIT state for the INIT-SIPI sequence of the guest, as
+ * the APs created with the VM do.
+ *
+ * @pre vm != NULL && rtn_vcpu != NULL
+ * @pre the caller holds the VM lock
+ */
+int32_t vm_add_vcpu(struct acrn_vm *vm, uint16_t pcpu_id, struct acrn_vcpu **rtn_vcpu)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+	int32_t ret = 0;
+
+	if ((pcpu_id >= get_pcpu_nums()) || ((vm_config->cpu_affinity & (1UL << pcpu_id)) == 0UL)
+			|| ((vm->hw.cpu_affinity & (1UL << pcpu_id)) != 0UL)) {
+		ret = -EINVAL;
+	} else if (!is_vcpu_hotplug_allowed(vm)) {
+		ret = -EPERM;
+	} else if (!can_pcpu_take_vcpu(pcpu_id) || (sched_admit(1UL << pcpu_id, &vm_config->sched_params) != 0)) {
+		ret = -EBUSY;
+	}
+
+	if (ret == 0) {
+		ret = prepare_vcpu(vm, pcpu_id);
+		if (ret == 0) {
+			bitmap_set_lock(pcpu_id, &vm->hw.cpu_affinity);
+			*rtn_vcpu = vcpu_from_pid(vm, pcpu_id);
+			pr_info("VM%u: VCPU%u added on PCPU%u", vm->vm_id, (*rtn_vcpu)->vcpu_id, pcpu_id);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Remove the vCPU running on pcpu_id from a VM, giving the pCPU back.
+ *
+ * The guest must have offlined the vCPU before, leaving it in wait-for-SIPI
+ * after an INIT, the BSP is never removed.
+ *
+ * @pre vm != NULL
+ * @pre the caller holds the VM lock
+ *
+ * @retval -EBUSY the guest still runs the vCPU
+ */
+int32_t vm_remove_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu = NULL;
+	int32_t ret = -EINVAL;
+
+	if (pcpu_id < get_pcpu_nums()) {
+		vcpu = vcpu_from_pid(vm, pcpu_id);
+	}
+
+	if ((vcpu != NULL) && !is_vcpu_bsp(vcpu)) {
+		if (!is_vcpu_hotplug_allowed(vm)) {
+			ret = -EPERM;
+		} else if (vcpu->state != VCPU_INIT) {
+			pr_err("VM%u: VCPU%u not offlined by the guest", vm->vm_id, vcpu->vcpu_id);
+			ret = -EBUSY;
+		} else {
+			zombie_vcpu(vcpu, VCPU_ZOMBIE);
+			offline_vcpu(vcpu);
+			bitmap_clear_lock(pcpu_id, &vm->hw.cpu_affinity);
+			update_vm_vlapic_state(vm);
+			pr_info("VM%u: VCPU%u removed from PCPU%u", vm->vm_id, vcpu->vcpu_id, pcpu_id);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @pre vm_config != NULL
  * @Application constraint: The validity of vm_config->cpu_affinity should be guaranteed before run-time.
@@ -1127,6 +1564,7 @@ void launch_vms(uint16_t pcpu_id)
 {
 	uint16_t vm_id;
 	struct acrn_vm_config *vm_config;
+	int32_t err;
 
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
 		vm_config = get_vm_config(vm_id);
@@ -1151,7 +1589,10 @@ void launch_vms(uint16_t pcpu_id)
 				 * so skip "start_vm" here for REE, and start it in TEE hypercall
 				 * HC_TEE_VCPU_BOOT_DONE.
 				 */
-				if (prepare_vm(vm_id, vm_config) == 0) {
+				err = prepare_vm(vm_id, vm_config);
+				/* the other pCPUs of the VM stop helping the load in any case */
+				finish_load_vm(vm_id);
+				if (err == 0) {
 					if ((vm_config->guest_flags & GUEST_FLAG_REE) != 0U) {
 						/* Nothing need to do here, REE will start in TEE hypercall */
 					} else {
@@ -1159,6 +1600,11 @@ void launch_vms(uint16_t pcpu_id)
 						pr_acrnlog("Start VM id: %x name: %s", vm_id, vm_config->name);
 					}
 				}
+			} else if ((vm_config->cpu_affinity & (1UL << pcpu_id)) != 0UL) {
+				/* the other pCPUs of the VM copy its big images with its BSP */
+				help_load_vm(vm_id);
+			} else {
+				/* not a pCPU of the VM */
 			}
 		}
 	}
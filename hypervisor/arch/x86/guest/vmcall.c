@@ -30,12 +30,17 @@ struct hc_dispatch {
 	uint64_t permission_flags;
 };
 
+/* the entries of an HC_MULTICALL copied in and out at a time */
+#define MULTICALL_COPY_ENTRIES	16UL
+
 /* VM Dispatch table for Exit condition handling */
 static const struct hc_dispatch hc_dispatch_table[] = {
 	[HC_IDX(HC_GET_API_VERSION)] = {
 		.handler = hcall_get_api_version},
 	[HC_IDX(HC_SERVICE_VM_OFFLINE_CPU)] = {
 		.handler = hcall_service_vm_offline_cpu},
+	[HC_IDX(HC_SERVICE_VM_ONLINE_CPU)] = {
+		.handler = hcall_service_vm_online_cpu},
 	[HC_IDX(HC_SET_CALLBACK_VECTOR)] = {
 		.handler = hcall_set_callback_vector},
 	[HC_IDX(HC_CREATE_VM)] = {
@@ -50,26 +55,46 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_pause_vm},
 	[HC_IDX(HC_SET_VCPU_REGS)] = {
 		.handler = hcall_set_vcpu_regs},
+	[HC_IDX(HC_SAVE_VCPU_STATE)] = {
+		.handler = hcall_save_vcpu_state},
+	[HC_IDX(HC_RESTORE_VCPU_STATE)] = {
+		.handler = hcall_restore_vcpu_state},
+	[HC_IDX(HC_HOTPLUG_VCPU)] = {
+		.handler = hcall_hotplug_vcpu},
 	[HC_IDX(HC_CREATE_VCPU)] = {
 		.handler = hcall_create_vcpu},
 	[HC_IDX(HC_SET_IRQLINE)] = {
 		.handler = hcall_set_irqline},
 	[HC_IDX(HC_INJECT_MSI)] = {
 		.handler = hcall_inject_msi},
+	[HC_IDX(HC_NOTIFY_MSI_RING)] = {
+		.handler = hcall_notify_msi_ring},
 	[HC_IDX(HC_SET_IOREQ_BUFFER)] = {
 		.handler = hcall_set_ioreq_buffer},
 	[HC_IDX(HC_ASYNCIO_ASSIGN)] = {
 		.handler = hcall_asyncio_assign},
 	[HC_IDX(HC_ASYNCIO_DEASSIGN)] = {
 		.handler = hcall_asyncio_deassign},
+	[HC_IDX(HC_POSTED_IO_ASSIGN)] = {
+		.handler = hcall_posted_io_assign},
+	[HC_IDX(HC_POSTED_IO_DEASSIGN)] = {
+		.handler = hcall_posted_io_deassign},
 	[HC_IDX(HC_NOTIFY_REQUEST_FINISH)] = {
 		.handler = hcall_notify_ioreq_finish},
+	[HC_IDX(HC_NOTIFY_REQUEST_FINISH_BATCH)] = {
+		.handler = hcall_notify_ioreq_finish_batch},
 	[HC_IDX(HC_VM_SET_MEMORY_REGIONS)] = {
 		.handler = hcall_set_vm_memory_regions},
 	[HC_IDX(HC_VM_WRITE_PROTECT_PAGE)] = {
 		.handler = hcall_write_protect_page},
+	[HC_IDX(HC_VM_DIRTY_LOG)] = {
+		.handler = hcall_vm_dirty_log},
+	[HC_IDX(HC_VM_WSS)] = {
+		.handler = hcall_vm_wss},
 	[HC_IDX(HC_VM_GPA2HPA)] = {
 		.handler = hcall_gpa_to_hpa},
+	[HC_IDX(HC_VM_GPA2HPA_EXTENTS)] = {
+		.handler = hcall_gpa_to_hpa_extents},
 	[HC_IDX(HC_ASSIGN_PCIDEV)] = {
 		.handler = hcall_assign_pcidev},
 	[HC_IDX(HC_DEASSIGN_PCIDEV)] = {
@@ -82,6 +107,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_add_vdev},
 	[HC_IDX(HC_REMOVE_VDEV)] = {
 		.handler = hcall_remove_vdev},
+	[HC_IDX(HC_SET_VDEV_CFG_SHADOW)] = {
+		.handler = hcall_set_vdev_cfg_shadow},
 	[HC_IDX(HC_SET_PTDEV_INTR_INFO)] = {
 		.handler = hcall_set_ptdev_intr_info},
 	[HC_IDX(HC_RESET_PTDEV_INTR_INFO)] = {
@@ -98,6 +125,20 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_profiling_ops},
 	[HC_IDX(HC_GET_HW_INFO)] = {
 		.handler = hcall_get_hw_info},
+	[HC_IDX(HC_GET_VMEXIT_STAT)] = {
+		.handler = hcall_get_vmexit_stat},
+	[HC_IDX(HC_GET_SCHED_STAT)] = {
+		.handler = hcall_get_sched_stat},
+	[HC_IDX(HC_SET_TRACE_FILTER)] = {
+		.handler = hcall_set_trace_filter},
+	[HC_IDX(HC_GET_STEAL_TIME)] = {
+		.handler = hcall_get_steal_time},
+	[HC_IDX(HC_GET_BOOT_TIME)] = {
+		.handler = hcall_get_boot_time},
+	[HC_IDX(HC_GET_RDT_MON)] = {
+		.handler = hcall_get_rdt_mon},
+	[HC_IDX(HC_SET_RDT_CLOS)] = {
+		.handler = hcall_set_rdt_clos},
 	[HC_IDX(HC_INITIALIZE_TRUSTY)] = {
 		.handler = hcall_initialize_trusty,
 		.permission_flags = GUEST_FLAG_SECURE_WORLD_ENABLED},
@@ -113,6 +154,12 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 	[HC_IDX(HC_SWITCH_EE)] = {
 		.handler = hcall_switch_ee,
 		.permission_flags = (GUEST_FLAG_TEE | GUEST_FLAG_REE)},
+	[HC_IDX(HC_PV_SEND_IPI)] = {
+		.handler = hcall_pv_send_ipi,
+		.permission_flags = GUEST_FLAG_PV_IPI},
+	[HC_IDX(HC_PV_SET_VCPU_STATE)] = {
+		.handler = hcall_pv_set_vcpu_state,
+		.permission_flags = GUEST_FLAG_PV_IPI},
 };
 
 uint16_t allocate_dynamical_vmid(struct acrn_vm_creation *cv)
@@ -138,7 +185,7 @@ static bool is_guest_hypercall(struct acrn_vm *vm)
 	bool ret = true;
 
 	if ((guest_flags & (GUEST_FLAG_SECURE_WORLD_ENABLED |
-		GUEST_FLAG_TEE | GUEST_FLAG_REE)) == 0UL) {
+		GUEST_FLAG_TEE | GUEST_FLAG_REE | GUEST_FLAG_PV_IPI)) == 0UL) {
 		ret = false;
 	}
 
@@ -184,10 +231,14 @@ struct acrn_vm *parse_target_vm(struct acrn_vm *service_vm, uint64_t hcall_id, u
 		break;
 	case HC_GET_API_VERSION:
 	case HC_SERVICE_VM_OFFLINE_CPU:
+	case HC_SERVICE_VM_ONLINE_CPU:
 	case HC_SET_CALLBACK_VECTOR:
 	case HC_SETUP_HV_NPK_LOG:
 	case HC_PROFILING_OPS:
 	case HC_GET_HW_INFO:
+	case HC_GET_BOOT_TIME:
+	case HC_GET_RDT_MON:
+	case HC_SET_RDT_CLOS:
 		target_vm = service_vm;
 		break;
 	default:
@@ -206,21 +257,17 @@ struct acrn_vm *parse_target_vm(struct acrn_vm *service_vm, uint64_t hcall_id, u
 	return target_vm;
 }
 
-static int32_t dispatch_hypercall(struct acrn_vcpu *vcpu)
+static int32_t dispatch_hcall(struct acrn_vcpu *vcpu, uint64_t hcall_id, uint64_t param1, uint64_t param2)
 {
 	int32_t ret = -ENOTTY;
 	struct acrn_vm *vm = vcpu->vm;
-	uint64_t guest_flags = get_vm_config(vm->vm_id)->guest_flags;  /* hypercall ID from guest */
-	uint64_t hcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);  /* hypercall ID from guest */
+	uint64_t guest_flags = get_vm_config(vm->vm_id)->guest_flags;
 
 	if (HC_IDX(hcall_id) < ARRAY_SIZE(hc_dispatch_table)) {
 		const struct hc_dispatch *dispatch = &(hc_dispatch_table[HC_IDX(hcall_id)]);
 		uint64_t permission_flags = dispatch->permission_flags;
 
 		if (dispatch->handler != NULL) {
-			uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);  /* hypercall param1 from guest */
-			uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);  /* hypercall param2 from guest */
-
 			if ((permission_flags == 0UL) && is_service_vm(vm) && !is_ree_vm(vm)) {
 				/* A permission_flags of 0 indicates that this hypercall is for Service VM to manage
 				 * post-launched VMs.
@@ -250,6 +297,95 @@ static int32_t dispatch_hypercall(struct acrn_vcpu *vcpu)
 	return ret;
 }
 
+/*
+ * HC_MULTICALL: do the param2 hypercalls of the acrn_multicall_entry array at
+ * GPA param1 of the Service VM in a single VM exit, writing the return value
+ * of each into its result. Only the hypercalls of the Service VM managing the
+ * other VMs can be batched, the others act on the state of the calling vCPU
+ * and a nested HC_MULTICALL would make the batch unbounded.
+ *
+ * The entries are done in order, the failure of one doesn't stop the others.
+ */
+static int32_t dispatch_multicall(struct acrn_vcpu *vcpu, uint64_t param1, uint64_t param2)
+{
+	struct acrn_multicall_entry entries[MULTICALL_COPY_ENTRIES];
+	struct acrn_vm *vm = vcpu->vm;
+	uint64_t gpa, i, k, n;
+	int32_t ret = -ENOTTY;
+
+	if (is_service_vm(vm) && !is_ree_vm(vm)) {
+		ret = -EINVAL;
+		if ((param2 != 0UL) && (param2 <= ACRN_MULTICALL_MAX_ENTRIES)) {
+			ret = 0;
+		}
+
+		for (i = 0UL; (i < param2) && (ret == 0); i += n) {
+			n = min(param2 - i, MULTICALL_COPY_ENTRIES);
+			gpa = param1 + (i * sizeof(struct acrn_multicall_entry));
+			if (copy_from_gpa(vm, entries, gpa, (uint32_t)(n * sizeof(struct acrn_multicall_entry))) != 0) {
+				ret = -EFAULT;
+				break;
+			}
+
+			for (k = 0UL; k < n; k++) {
+				if ((HC_IDX(entries[k].hcall_id) < ARRAY_SIZE(hc_dispatch_table)) &&
+						(hc_dispatch_table[HC_IDX(entries[k].hcall_id)].permission_flags == 0UL)) {
+					entries[k].result = (int64_t)dispatch_hcall(vcpu, entries[k].hcall_id,
+							entries[k].param1, entries[k].param2);
+				} else {
+					entries[k].result = (int64_t)-EINVAL;
+				}
+			}
+
+			if (copy_to_gpa(vm, entries, gpa, (uint32_t)(n * sizeof(struct acrn_multicall_entry))) != 0) {
+				ret = -EFAULT;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static int32_t dispatch_hypercall(struct acrn_vcpu *vcpu)
+{
+	uint64_t hcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);  /* hypercall ID from guest */
+	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);  /* hypercall param1 from guest */
+	uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);  /* hypercall param2 from guest */
+	int32_t ret;
+
+	if (hcall_id == HC_MULTICALL) {
+		ret = dispatch_multicall(vcpu, param1, param2);
+	} else {
+		ret = dispatch_hcall(vcpu, hcall_id, param1, param2);
+	}
+
+	return ret;
+}
+
+/*
+ * A vmcall of a guest using the Hyper-V hypercall page is a Hyper-V
+ * hypercall, only allowed from ring 0. Returns whether it was one.
+ */
+static bool handle_hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	bool handled = false;
+
+#ifdef CONFIG_HYPERV_ENABLED
+	if (is_hyperv_hypercall(vcpu)) {
+		if (!is_hypercall_from_ring0()) {
+			vcpu_inject_ud(vcpu);
+		} else {
+			hyperv_hypercall(vcpu);
+		}
+		handled = true;
+	}
+#else
+	(void)vcpu;
+#endif
+
+	return handled;
+}
+
 /*
  * Pass return value to Service VM by register rax.
  * This function should always return 0 since we shouldn't
@@ -273,7 +409,9 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 	 *    guest flags. Attempts to invoke an unpermitted hypercall will make a vCPU see -EINVAL as the return
 	 *    value. No exception is triggered in this case.
 	 */
-	if (!is_service_vm(vm) && !is_guest_hypercall(vm)) {
+	if (handle_hyperv_hypercall(vcpu)) {
+		ret = 0;
+	} else if (!is_service_vm(vm) && !is_guest_hypercall(vm)) {
 		vcpu_inject_ud(vcpu);
 	} else if (!is_hypercall_from_ring0()) {
 		vcpu_inject_gp(vcpu, 0U);
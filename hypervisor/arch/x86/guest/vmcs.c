@@ -17,8 +17,13 @@
 #include <asm/cpu_caps.h>
 #include <asm/cpufeatures.h>
 #include <asm/guest/vmexit.h>
+#include <asm/guest/vcpu_state.h>
 #include <logmsg.h>
 
+/* PAUSE-loop exiting defaults, used unless the VM config overrides them */
+#define PLE_GAP_DEFAULT		128U
+#define PLE_WINDOW_DEFAULT	4096U
+
 /* rip, rsp, ia32_efer and rflags are written to VMCS in start_vcpu */
 static void init_guest_vmx(struct acrn_vcpu *vcpu, uint64_t cr0, uint64_t cr3,
 	uint64_t cr4)
@@ -53,8 +58,12 @@ static void init_guest_vmx(struct acrn_vcpu *vcpu, uint64_t cr0, uint64_t cr3,
 	load_segment(ectx->ldtr, VMX_GUEST_LDTR);
 
 	/* init guest ia32_misc_enable value for guest read */
-	vcpu_set_guest_msr(vcpu, MSR_IA32_MISC_ENABLE,
-		(msr_read(MSR_IA32_MISC_ENABLE) & (~MSR_IA32_MISC_ENABLE_MONITOR_ENA)));
+	if (is_mwait_pt_configured(vcpu->vm)) {
+		vcpu_set_guest_msr(vcpu, MSR_IA32_MISC_ENABLE, msr_read(MSR_IA32_MISC_ENABLE));
+	} else {
+		vcpu_set_guest_msr(vcpu, MSR_IA32_MISC_ENABLE,
+			(msr_read(MSR_IA32_MISC_ENABLE) & (~MSR_IA32_MISC_ENABLE_MONITOR_ENA)));
+	}
 
 	vcpu_set_guest_msr(vcpu, MSR_IA32_PERF_CTL, msr_read(MSR_IA32_PERF_CTL));
 
@@ -264,6 +273,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	uint32_t value32;
 	uint64_t value64;
 	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vm_config *vm_config;
 
 	/* Log messages to show initializing VMX execution controls */
 	pr_dbg("Initialize execution control ");
@@ -278,13 +288,17 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 		value32 |= VMX_PINBASED_CTLS_POST_IRQ;
 	}
 
+	/* programmed on each VM entry, see vlapic_arm_ptimer() */
+	if (is_vmx_preempt_timer_configured(vm)) {
+		value32 |= VMX_PINBASED_CTLS_ENABLE_PTMR;
+	}
+
 	exec_vmwrite32(VMX_PIN_VM_EXEC_CONTROLS, value32);
 	pr_dbg("VMX_PIN_VM_EXEC_CONTROLS: 0x%x ", value32);
 
 	/* Set up primary processor based VM execution controls - pg 2900
 	 * 24.6.2. Set up for:
 	 * Enable TSC offsetting
-	 * Enable TSC exiting
 	 * guest access to IO bit-mapped ports causes VM exit
 	 * guest access to MSR causes VM exit
 	 * Activate secondary controls
@@ -307,6 +321,12 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 */
 	value32 &= ~VMX_PROCBASED_CTLS_INVLPG;
 
+	/*
+	 * RDTSC and RDTSCP never exit: the guest TSC writes and IA32_TSC_ADJUST
+	 * only move the TSC offset, and the TSC of a restored VM is scaled.
+	 */
+	value32 &= ~VMX_PROCBASED_CTLS_RDTSC;
+
 	/*
 	 * Enable VM_EXIT for rdpmc execution except core partition VM, like RTVM
 	 */
@@ -315,9 +335,14 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	}
 
 	/*
-	 * Enable MONITOR/MWAIT cause a VM-EXIT.
+	 * Enable MONITOR/MWAIT cause a VM-EXIT, except for a VM owning its pCPUs
+	 * which idles in them natively.
 	 */
-	value32 |= VMX_PROCBASED_CTLS_MWAIT | VMX_PROCBASED_CTLS_MONITOR;
+	if (is_mwait_pt_configured(vcpu->vm)) {
+		value32 &= ~(VMX_PROCBASED_CTLS_MWAIT | VMX_PROCBASED_CTLS_MONITOR);
+	} else {
+		value32 |= VMX_PROCBASED_CTLS_MWAIT | VMX_PROCBASED_CTLS_MONITOR;
+	}
 
 	vcpu->arch.proc_vm_exec_ctrls = value32;
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
@@ -330,7 +355,8 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	value32 = check_vmx_ctrl(MSR_IA32_VMX_PROCBASED_CTLS2,
 			VMX_PROCBASED_CTLS2_VAPIC | VMX_PROCBASED_CTLS2_EPT |VMX_PROCBASED_CTLS2_VPID |
 			VMX_PROCBASED_CTLS2_RDTSCP | VMX_PROCBASED_CTLS2_UNRESTRICT | VMX_PROCBASED_CTLS2_XSVE_XRSTR |
-			VMX_PROCBASED_CTLS2_PAUSE_LOOP | VMX_PROCBASED_CTLS2_UWAIT_PAUSE);
+			VMX_PROCBASED_CTLS2_PAUSE_LOOP | VMX_PROCBASED_CTLS2_UWAIT_PAUSE |
+			VMX_PROCBASED_CTLS2_BUS_LOCK);
 
 	/* SDM Vol3, 25.3,  setting "enable INVPCID" VM-execution to 1 with "INVLPG exiting" disabled,
 	 * passes-through INVPCID instruction to guest if the instruction is supported.
@@ -368,6 +394,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 
 	value32 |= VMX_PROCBASED_CTLS2_WBINVD;
 
+	/* a VM restored from a platform of another TSC rate keeps its TSC rate */
+	vcpu->arch.tsc_multiplier = vcpu_tsc_multiplier(vcpu);
+	if (vcpu->arch.tsc_multiplier != 0UL) {
+		value32 |= VMX_PROCBASED_CTLS2_TSC_SCALING;
+		exec_vmwrite64(VMX_TSC_MULTIPLIER_FULL, vcpu->arch.tsc_multiplier);
+	} else {
+		value32 &= ~VMX_PROCBASED_CTLS2_TSC_SCALING;
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS2: 0x%x ", value32);
 
@@ -410,6 +445,10 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016lx ", value64);
 
+	/* PML and EPT A/D flags as the dirty log of the VM wants them, e.g. for an AP started later */
+	vcpu->arch.pml_enabled = false;
+	dirty_log_apply(vcpu);
+
 	/* Set up guest exception mask bitmap setting a bit * causes a VM exit
 	 * on corresponding guest * exception - pg 2902 24.6.3
 	 * enable VM exit on MC always
@@ -468,7 +507,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	/* Natural-width */
 	pr_dbg("Natural-width*********");
 
-	init_cr0_cr4_host_guest_mask();
+	init_cr0_cr4_host_guest_mask(vcpu);
 
 	/* The CR3 target registers work in concert with VMX_CR3_TARGET_COUNT
 	 * field. Using these registers guest CR3 access can be managed. i.e.,
@@ -481,8 +520,9 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite(VMX_CR3_TARGET_3, 0UL);
 
 	/* Setup PAUSE-loop exiting - 24.6.13 */
-	exec_vmwrite(VMX_PLE_GAP, 128U);
-	exec_vmwrite(VMX_PLE_WINDOW, 4096U);
+	vm_config = get_vm_config(vm->vm_id);
+	exec_vmwrite(VMX_PLE_GAP, (vm_config->ple_gap != 0U) ? vm_config->ple_gap : PLE_GAP_DEFAULT);
+	exec_vmwrite(VMX_PLE_WINDOW, (vm_config->ple_window != 0U) ? vm_config->ple_window : PLE_WINDOW_DEFAULT);
 }
 
 static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
@@ -574,6 +614,10 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	load_va_vmcs(vcpu->arch.vmcs);
 	*vmcs_ptr = (void *)vcpu->arch.vmcs;
 
+	/* nothing cached or pending in the VMCS cache applies to the new VMCS */
+	vcpu->vmcs_cache.valid = 0UL;
+	vcpu->vmcs_cache.dirty = 0UL;
+
 	/* Initialize the Virtual Machine Control Structure (VMCS) */
 	init_host_state();
 	/* init exec_ctrl needs to run before init_guest_state */
@@ -581,6 +625,10 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	init_guest_state(vcpu);
 	init_entry_ctrl(vcpu);
 	init_exit_ctrl(vcpu);
+
+	if (vcpu->restore.pending) {
+		load_vcpu_state(vcpu);
+	}
 }
 
 /**
@@ -21,14 +21,21 @@
 #include <asm/cpuid.h>
 #include <asm/guest/vcpuid.h>
 #include <trace.h>
+#include <ticks.h>
 #include <asm/rtcm.h>
 #include <debug/console.h>
+#include <msi_ring.h>
 
 /*
  * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
- * there are 65 Basic Exit Reasons.
+ * there are 75 Basic Exit Reasons.
  */
-#define NR_VMX_EXIT_REASONS	70U
+#define NR_VMX_EXIT_REASONS	75U
+
+/* the per-vCPU exit statistics are indexed by the basic exit reason */
+#if ACRN_VMEXIT_REASON_MAX != NR_VMX_EXIT_REASONS
+#error "ACRN_VMEXIT_REASON_MAX must match NR_VMX_EXIT_REASONS"
+#endif
 
 static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -182,7 +189,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDTSCP] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_VMX_PREEMPTION_TIMER_EXPIRED] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = vmx_preemption_timer_vmexit_handler},
 	[VMX_EXIT_REASON_WBINVD] = {
 		.handler = wbinvd_vmexit_handler},
 	[VMX_EXIT_REASON_XSETBV] = {
@@ -201,19 +208,36 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDSEED] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_PAGE_MODIFICATION_LOG_FULL] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pml_full_vmexit_handler},
 	[VMX_EXIT_REASON_XSAVES] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_XRSTORS] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_LOADIWKEY] = {
-		.handler = loadiwkey_vmexit_handler}
+		.handler = loadiwkey_vmexit_handler},
+	[VMX_EXIT_REASON_BUS_LOCK] = {
+		.handler = bus_lock_vmexit_handler}
 };
 
+static void account_vmexit(struct acrn_vcpu *vcpu, uint16_t basic_exit_reason, uint64_t cycles)
+{
+	struct acrn_vmexit_stat *stat = &vcpu->exit_stat[basic_exit_reason];
+	uint16_t bucket = 0U;
+
+	if (cycles >= (1UL << ACRN_VMEXIT_HIST_SHIFT)) {
+		bucket = min(fls64(cycles) - (ACRN_VMEXIT_HIST_SHIFT - 1U), ACRN_VMEXIT_HIST_BUCKETS - 1U);
+	}
+
+	stat->count++;
+	stat->cycles += cycles;
+	stat->hist[bucket]++;
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
 	uint16_t basic_exit_reason;
+	uint64_t start;
 	int32_t ret;
 
 	if (get_pcpu_id() != pcpuid_from_vcpu(vcpu)) {
@@ -251,6 +275,12 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 		/* Log details for exit */
 		pr_dbg("Exit Reason: 0x%016lx ", vcpu->arch.exit_reason);
 
+		/* the bus lock exits, with the same flag, are accounted by their handler */
+		if (((vcpu->arch.exit_reason & VMX_EXIT_REASON_BUS_LOCK_DETECTED) != 0U) &&
+				(basic_exit_reason != VMX_EXIT_REASON_BUS_LOCK)) {
+			lock_instr_bus_lock(vcpu);
+		}
+
 		/* Ensure exit reason is within dispatch table */
 		if (basic_exit_reason >= ARRAY_SIZE(dispatch_table)) {
 			pr_err("Invalid Exit Reason: 0x%016lx ", vcpu->arch.exit_reason);
@@ -266,6 +296,7 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			}
 
 			/* exit dispatch handling */
+			start = cpu_ticks();
 			if (basic_exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
 				/* Handling external_interrupt should disable intr */
 				if (!is_lapic_pt_enabled(vcpu)) {
@@ -280,9 +311,15 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			} else {
 				ret = dispatch->handler(vcpu);
 			}
+			account_vmexit(vcpu, basic_exit_reason, cpu_ticks() - start);
 		}
 	}
 
+	/* the MSIs the DM published meanwhile are injected on the way back to the Service VM */
+	if (is_service_vm(vcpu->vm)) {
+		(void)drain_msi_rings();
+	}
+
 	console_vmexit_callback(vcpu);
 
 	return ret;
@@ -338,16 +375,117 @@ static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
-static int32_t pause_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+/*
+ * A PAUSE-loop exit usually means the vCPU spins on a lock held by a sibling
+ * vCPU that got preempted on its own pCPU. Prioritize the first preempted
+ * sibling after the last boosted one, so boosts rotate among candidates.
+ */
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu)
 {
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu *target;
+	uint16_t nr_vcpus = vm->hw.created_vcpus;
+	uint16_t i, vcpu_id;
+	bool boosted = false;
+
+	for (i = 1U; i <= nr_vcpus; i++) {
+		vcpu_id = (vm->last_boosted_vcpu + i) % nr_vcpus;
+		target = vcpu_from_vid(vm, vcpu_id);
+		if ((target != vcpu) && (target->state == VCPU_RUNNING) &&
+				(target->thread_obj.status == THREAD_STS_RUNNABLE)) {
+			if (prioritize_thread(&target->thread_obj)) {
+				vm->last_boosted_vcpu = vcpu_id;
+				boosted = true;
+				break;
+			}
+		}
+	}
+
+	if (boosted) {
+		vcpu->directed_yield_hits++;
+	} else {
+		vcpu->directed_yield_misses++;
+	}
+
 	yield_current();
 	return 0;
 }
 
+/* first non-zero poll window after a short sleep */
+#define HALT_POLL_GROW_START_US	10U
+
+static inline bool has_wakeup_pending(struct acrn_vcpu *vcpu)
+{
+	return (vcpu->arch.pending_req != 0UL) || vlapic_has_pending_intr(vcpu);
+}
+
+/*
+ * Spin for the current poll window waiting for a wakeup source.
+ * Polling stops early if another thread needs this pCPU.
+ */
+static bool halt_poll(struct acrn_vcpu *vcpu)
+{
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+	uint64_t start = cpu_ticks();
+	bool woken = false;
+
+	while ((cpu_ticks() - start) < vcpu->halt_poll.window) {
+		if (has_wakeup_pending(vcpu)) {
+			woken = true;
+			break;
+		}
+		if (need_reschedule(pcpu_id)) {
+			break;
+		}
+		asm_pause();
+	}
+
+	return woken;
+}
+
+/*
+ * Grow the poll window when the vCPU slept for less than the max window,
+ * so that a poll would have caught the wakeup, shrink it otherwise.
+ */
+static void halt_poll_adjust(struct vcpu_halt_poll *hp, uint64_t slept)
+{
+	uint64_t grow_start = us_to_ticks(HALT_POLL_GROW_START_US);
+
+	if (slept < hp->max_window) {
+		if (hp->window < grow_start) {
+			hp->window = grow_start;
+		} else {
+			hp->window <<= 1U;
+		}
+		if (hp->window > hp->max_window) {
+			hp->window = hp->max_window;
+		}
+	} else {
+		hp->window >>= 1U;
+	}
+}
+
 static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	if ((vcpu->arch.pending_req == 0UL) && (!vlapic_has_pending_intr(vcpu))) {
-		wait_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+	struct vcpu_halt_poll *hp = &vcpu->halt_poll;
+	uint64_t start;
+
+	if (!has_wakeup_pending(vcpu)) {
+		if ((hp->window != 0UL) && !is_lapic_pt_enabled(vcpu)) {
+			if (halt_poll(vcpu)) {
+				hp->success++;
+			} else {
+				hp->fail++;
+			}
+		}
+
+		if (!has_wakeup_pending(vcpu)) {
+			start = cpu_ticks();
+			wait_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+			if ((hp->max_window != 0UL) && !is_lapic_pt_enabled(vcpu)) {
+				halt_poll_adjust(hp, cpu_ticks() - start);
+			}
+		}
 	}
 	return 0;
 }
@@ -398,7 +536,7 @@ static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu)
 	if (vcpu->arch.xsave_enabled && ((vcpu_get_cr4(vcpu) & CR4_OSXSAVE) != 0UL)) {
 		idx = vcpu->arch.cur_context;
 		/* get current privilege level */
-		cpl = exec_vmread32(VMX_GUEST_CS_ATTR);
+		cpl = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_CS_ATTR);
 		cpl = (cpl >> 5U) & 3U;
 
 		if ((idx < NR_WORLD) && (cpl == 0U)) {
@@ -10,6 +10,7 @@
 #include <asm/msr.h>
 #include <asm/cpuid.h>
 #include <asm/guest/vcpu.h>
+#include <asm/host_pm.h>
 #include <asm/guest/virq.h>
 #include <asm/guest/vm.h>
 #include <asm/vmx.h>
@@ -303,24 +304,89 @@ static const uint32_t unsupported_msrs[] = {
 	IA32_HW_FEEDBACK_THREAD_CONFIG,
 };
 
-/* emulated_guest_msrs[] shares same indexes with array vcpu->arch->guest_msrs[] */
-uint32_t vmsr_get_guest_msr_index(uint32_t msr)
+/*
+ * The index plus 1 in emulated_guest_msrs[] of the MSRs of the low (0 - 0x1fff) and high
+ * (0xc0000000 - 0xc0001fff) ranges of the MSR bitmap, 0 for the MSRs which are not emulated.
+ * Built once by init_emulated_msr_index(), after the CAT MSRs are filled in.
+ */
+#define MSR_RANGE_SIZE	0x2000U
+static uint16_t emulated_msr_index[2][MSR_RANGE_SIZE];
+
+static inline uint16_t *emulated_msr_index_entry(uint32_t msr)
 {
-	uint32_t index;
+	uint16_t *entry = NULL;
 
-	for (index = 0U; index < NUM_EMULATED_MSRS; index++) {
-		if (emulated_guest_msrs[index] == msr) {
-			break;
+	if (msr < MSR_RANGE_SIZE) {
+		entry = &emulated_msr_index[0][msr];
+	} else if ((msr >= 0xc0000000U) && (msr < (0xc0000000U + MSR_RANGE_SIZE))) {
+		entry = &emulated_msr_index[1][msr - 0xc0000000U];
+	} else {
+		/* not in the MSR bitmap, never emulated */
+	}
+
+	return entry;
+}
+
+void init_emulated_msr_index(void)
+{
+	uint16_t *entry;
+	uint32_t i;
+
+	for (i = 0U; i < NUM_EMULATED_MSRS; i++) {
+		entry = emulated_msr_index_entry(emulated_guest_msrs[i]);
+		ASSERT(entry != NULL, "emulated MSR out of the MSR bitmap ranges");
+		if ((entry != NULL) && (*entry == 0U)) {
+			*entry = (uint16_t)(i + 1U);
 		}
 	}
+}
 
-	if (index == NUM_EMULATED_MSRS) {
+/* emulated_guest_msrs[] shares same indexes with array vcpu->arch->guest_msrs[] */
+uint32_t vmsr_get_guest_msr_index(uint32_t msr)
+{
+	const uint16_t *entry = emulated_msr_index_entry(msr);
+	uint32_t index = NUM_EMULATED_MSRS;
+
+	if ((entry != NULL) && (*entry != 0U)) {
+		index = (uint32_t)*entry - 1U;
+	} else {
 		pr_err("%s, MSR %x is not defined in array emulated_guest_msrs[]", __func__, msr);
 	}
 
 	return index;
 }
 
+/*
+ * Count the RDMSR/WRMSR exits of an MSR in the open-addressed table of the vCPU,
+ * only called on the pCPU running the vCPU. A slot with no exits is free.
+ */
+static void msr_exit_stat_inc(struct acrn_vcpu *vcpu, uint32_t msr, bool is_write)
+{
+	struct vcpu_msr_stat *stat = &vcpu->msr_stat;
+	struct msr_exit_count *slot;
+	uint32_t hash = (msr * 0x9e3779b1U) >> (32U - MSR_EXIT_STAT_ORDER);
+	uint32_t i;
+
+	for (i = 0U; i < MSR_EXIT_STAT_SLOTS; i++) {
+		slot = &stat->slot[(hash + i) & (MSR_EXIT_STAT_SLOTS - 1U)];
+		if ((slot->reads == 0U) && (slot->writes == 0U)) {
+			slot->msr = msr;
+		}
+		if (slot->msr == msr) {
+			if (is_write) {
+				slot->writes++;
+			} else {
+				slot->reads++;
+			}
+			break;
+		}
+	}
+
+	if (i == MSR_EXIT_STAT_SLOTS) {
+		stat->dropped++;
+	}
+}
+
 static void enable_msr_interception(uint8_t *bitmap, uint32_t msr_arg, uint32_t mode)
 {
 	uint32_t read_offset = 0U;
@@ -393,12 +459,15 @@ static void prepare_auto_msr_area(struct acrn_vcpu *vcpu)
 
 		vcpu_clos = cfg->pclosids[vcpu->vcpu_id%cfg->num_pclosids];
 
-		/* RDT: only load/restore MSR_IA32_PQR_ASSOC when hv and guest have different settings
+		/* RDT: only load/restore MSR_IA32_PQR_ASSOC when hv and guest have different settings,
+		 * the CLOS or the RMID of a monitored VM
 		 * vCAT: always load/restore MSR_IA32_PQR_ASSOC
 		 */
-		if (is_vcat_configured(vcpu->vm) || (vcpu_clos != hv_clos)) {
+		if (is_vcat_configured(vcpu->vm) ||
+				(vm_clos2pqr_msr(vcpu->vm->vm_id, vcpu_clos) != clos2pqr_msr(hv_clos))) {
 			vcpu->arch.msr_area.guest[vcpu->arch.msr_area.count].msr_index = MSR_IA32_PQR_ASSOC;
-			vcpu->arch.msr_area.guest[vcpu->arch.msr_area.count].value = clos2pqr_msr(vcpu_clos);
+			vcpu->arch.msr_area.guest[vcpu->arch.msr_area.count].value =
+				vm_clos2pqr_msr(vcpu->vm->vm_id, vcpu_clos);
 			vcpu->arch.msr_area.host[vcpu->arch.msr_area.count].msr_index = MSR_IA32_PQR_ASSOC;
 			vcpu->arch.msr_area.host[vcpu->arch.msr_area.count].value = clos2pqr_msr(hv_clos);
 			vcpu->arch.msr_area.index_of_pqr_assoc = vcpu->arch.msr_area.count;
@@ -648,6 +717,7 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the msr value */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	msr_exit_stat_inc(vcpu, msr, false);
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
@@ -664,6 +734,11 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		break;
 	}
 #endif
+	case MSR_ACRN_STEAL_TIME:
+	{
+		v = vcpu->steal_time.msr;
+		break;
+	}
 	case MSR_IA32_TSC_DEADLINE:
 	{
 		v = vlapic_get_tsc_deadline_msr(vcpu_vlapic(vcpu));
@@ -723,9 +798,17 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		v = vcpu_get_guest_msr(vcpu, MSR_IA32_PERF_CTL);
 		break;
 	}
+	case MSR_IA32_HWP_REQUEST:
+	{
+		if (is_vhwp_configured(vcpu->vm)) {
+			v = vcpu_hwp_request(vcpu);
+		} else {
+			err = -EACCES;
+		}
+		break;
+	}
 	case MSR_IA32_PM_ENABLE:
 	case MSR_IA32_HWP_CAPABILITIES:
-	case MSR_IA32_HWP_REQUEST:
 	case MSR_IA32_HWP_STATUS:
 	case MSR_IA32_MPERF:
 	case MSR_IA32_APERF:
@@ -868,8 +951,12 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 			 * to just one switch to improvement  performance?
 			 */
 			err = read_vmx_msr(vcpu, msr, &v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_synic_msr(msr) || is_hyperv_stimer_msr(msr)) {
+			err = hyperv_rdmsr(vcpu, msr, &v);
+#endif
 		} else {
-			pr_warn("%s(): vm%d vcpu%d reading MSR %lx not supported",
+			pr_warn_ratelimited("%s(): vm%d vcpu%d reading MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
 			err = -EACCES;
 			v = 0UL;
@@ -890,8 +977,8 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 }
 
 /*
- * If VMX_TSC_OFFSET_FULL is 0, no need to trap the write of IA32_TSC_DEADLINE because there is
- * no offset between vTSC and pTSC, in this case, only write to vTSC_ADJUST is trapped.
+ * If VMX_TSC_OFFSET_FULL is 0 and the guest TSC isn't scaled, no need to trap the write of
+ * IA32_TSC_DEADLINE because vTSC is pTSC, in this case, only write to vTSC_ADJUST is trapped.
  */
 static void set_tsc_msr_interception(struct acrn_vcpu *vcpu, bool interception)
 {
@@ -937,21 +1024,19 @@ static void set_tsc_msr_interception(struct acrn_vcpu *vcpu, bool interception)
  */
 static void set_guest_tsc(struct acrn_vcpu *vcpu, uint64_t guest_tsc)
 {
-	uint64_t tsc_delta, tsc_offset_delta, tsc_adjust;
+	uint64_t tsc_offset_delta, tsc_adjust;
 
-	tsc_delta = guest_tsc - rdtsc();
-
-	/* the delta between new and existing TSC_OFFSET */
-	tsc_offset_delta = tsc_delta - exec_vmread64(VMX_TSC_OFFSET_FULL);
+	/* the delta between new and existing TSC_OFFSET, from the guest TSC, scaled or not */
+	tsc_offset_delta = guest_tsc - vcpu_guest_tsc(vcpu, rdtsc());
 
 	/* apply this delta to TSC_ADJUST */
 	tsc_adjust = vcpu_get_guest_msr(vcpu, MSR_IA32_TSC_ADJUST);
 	vcpu_set_guest_msr(vcpu, MSR_IA32_TSC_ADJUST, tsc_adjust + tsc_offset_delta);
 
 	/* write to VMCS because rdtsc and rdtscp are not intercepted */
-	exec_vmwrite64(VMX_TSC_OFFSET_FULL, tsc_delta);
+	exec_vmwrite64(VMX_TSC_OFFSET_FULL, exec_vmread64(VMX_TSC_OFFSET_FULL) + tsc_offset_delta);
 
-	set_tsc_msr_interception(vcpu, tsc_delta != 0UL);
+	set_tsc_msr_interception(vcpu, !vcpu_tsc_is_host_tsc(vcpu));
 }
 
 /*
@@ -1000,7 +1085,7 @@ static void set_guest_tsc_adjust(struct acrn_vcpu *vcpu, uint64_t tsc_adjust)
 	/* IA32_TSC_ADJUST is supposed to carry the value it's written to */
 	vcpu_set_guest_msr(vcpu, MSR_IA32_TSC_ADJUST, tsc_adjust);
 
-	set_tsc_msr_interception(vcpu, (tsc_offset + tsc_adjust_delta) != 0UL);
+	set_tsc_msr_interception(vcpu, !vcpu_tsc_is_host_tsc(vcpu));
 }
 
 /**
@@ -1018,10 +1103,10 @@ static void set_guest_ia32_misc_enalbe(struct acrn_vcpu *vcpu, uint64_t v)
 		vcpu_set_efer(vcpu, vcpu_get_efer(vcpu) & ~MSR_IA32_EFER_NXE_BIT);
 	}
 
-	/* MONITOR/MWAIT is hide.
-	 * MISC_ENABLE_MONITOR_ENA should not be set.
+	/* MONITOR/MWAIT is hide unless they run natively.
+	 * MISC_ENABLE_MONITOR_ENA should not be set otherwise.
 	 */
-	if ((v & MSR_IA32_MISC_ENABLE_MONITOR_ENA) != 0UL) {
+	if (((v & MSR_IA32_MISC_ENABLE_MONITOR_ENA) != 0UL) && !is_mwait_pt_configured(vcpu->vm)) {
 		vcpu_inject_gp(vcpu, 0U);
 		update_vmsr = false;
 	}
@@ -1042,6 +1127,7 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the MSR ID */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	msr_exit_stat_inc(vcpu, msr, true);
 
 	/* Get the MSR contents */
 	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
@@ -1062,6 +1148,11 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		break;
 	}
 #endif
+	case MSR_ACRN_STEAL_TIME:
+	{
+		err = vcpu_set_steal_time_msr(vcpu, v);
+		break;
+	}
 	case MSR_IA32_TSC_DEADLINE:
 	{
 		vlapic_set_tsc_deadline_msr(vcpu_vlapic(vcpu), v);
@@ -1188,7 +1279,9 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_vhwp_configured(vcpu->vm) &&
 			((v & (MSR_IA32_HWP_REQUEST_RSV_BITS | MSR_IA32_HWP_REQUEST_PKG_CTL)) == 0)) {
-			msr_write(msr, v);
+			/* kept by the vCPU, so that a pCPU it shares gets it back on each switch in */
+			vcpu->arch.hwp_request = sanitize_hwp_request(pcpuid_from_vcpu(vcpu), v);
+			load_hwp_request(vcpu->arch.hwp_request);
 		} else {
 			err = -EACCES;
 		}
@@ -1345,8 +1438,12 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_x2apic_write(vcpu, msr, v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_synic_msr(msr) || is_hyperv_stimer_msr(msr)) {
+			err = hyperv_wrmsr(vcpu, msr, v);
+#endif
 		} else {
-			pr_warn("%s(): vm%d vcpu%d writing MSR %lx not supported",
+			pr_warn_ratelimited("%s(): vm%d vcpu%d writing MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
 			err = -EACCES;
 		}
@@ -1413,5 +1510,5 @@ void update_msr_bitmap_x2apic_passthru(struct acrn_vcpu *vcpu)
 	if (!is_vtm_configured(vcpu->vm)) {
 		enable_msr_interception(msr_bitmap, MSR_IA32_EXT_APIC_LVT_THERMAL, INTERCEPT_READ_WRITE);
 	}
-	set_tsc_msr_interception(vcpu, exec_vmread64(VMX_TSC_OFFSET_FULL) != 0UL);
+	set_tsc_msr_interception(vcpu, !vcpu_tsc_is_host_tsc(vcpu));
 }
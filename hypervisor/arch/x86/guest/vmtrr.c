@@ -4,6 +4,7 @@
  */
 
 #include <types.h>
+#include <rtl.h>
 #include <asm/guest/vmtrr.h>
 #include <asm/msr.h>
 #include <asm/pgtable.h>
@@ -107,6 +108,14 @@ void init_vmtrr(struct acrn_vcpu *vcpu)
 	vmtrr->def_type.bits.enable = 1U;
 	vmtrr->def_type.bits.fixed_enable = 1U;
 	vmtrr->def_type.bits.type = MTRR_MEM_TYPE_UC;
+	vmtrr->ept_stale = false;
+
+	/* the BSP is created first, nothing is known of the EPT memory types yet */
+	if (vcpu->vcpu_id == BSP_CPU_ID) {
+		spinlock_init(&vcpu->vm->arch_vm.mtrr_ept.lock);
+		(void)memset(vcpu->vm->arch_vm.mtrr_ept.type, MTRR_EPT_TYPE_UNKNOWN,
+				sizeof(vcpu->vm->arch_vm.mtrr_ept.type));
+	}
 
 	if (is_service_vm(vcpu->vm)) {
 		cap.value = msr_read(MSR_IA32_MTRR_CAP);
@@ -137,7 +146,7 @@ void init_vmtrr(struct acrn_vcpu *vcpu)
 }
 
 static void update_ept(struct acrn_vm *vm, uint64_t start,
-	uint64_t size, uint8_t type)
+	uint64_t size, uint8_t type, struct ept_batch *batch)
 {
 	uint64_t attr;
 
@@ -160,45 +169,83 @@ static void update_ept(struct acrn_vm *vm, uint64_t start,
 		break;
 	}
 
-	ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK);
+	ept_modify_mr_batch(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK, batch);
 }
 
-static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
+/* the memory type in effect for each fixed-range sub-range */
+static void get_fixed_mem_types(const struct acrn_vmtrr *vmtrr, uint8_t types[FIXED_SUB_RANGE_NUM])
 {
-	uint8_t type;
-	uint64_t start, size;
 	uint32_t i, j;
-	struct acrn_vm *vm = vmtrr2vcpu(vmtrr)->vm;
 
 	/*
 	 * Intel SDM, Vol 3, 11.11.2.1 Section "IA32_MTRR_DEF_TYPE MSR":
 	 * - when def_type.E is clear, UC memory type is applied
 	 * - when def_type.FE is clear, MTRRdefType.type is applied
 	 */
-	if (!is_mtrr_enabled(vmtrr) || !is_fixed_range_mtrr_enabled(vmtrr)) {
-		update_ept(vm, 0U, MAX_FIXED_RANGE_ADDR, get_default_memory_type(vmtrr));
-	} else {
-		/* Deal with fixed-range MTRRs only */
-		for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
-			type = vmtrr->fixed_range[i].type[0];
-			start = get_subrange_start_of_fixed_mtrr(i, 0U);
-			size = get_subrange_size_of_fixed_mtrr(i);
-
-			for (j = 1U; j < MTRR_SUB_RANGE_NUM; j++) {
-				/* If it's same type, combine the subrange together */
-				if (type == vmtrr->fixed_range[i].type[j]) {
-					size += get_subrange_size_of_fixed_mtrr(i);
-				} else {
-					update_ept(vm, start, size, type);
-					type = vmtrr->fixed_range[i].type[j];
-					start = get_subrange_start_of_fixed_mtrr(i, j);
-					size = get_subrange_size_of_fixed_mtrr(i);
-				}
+	for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
+		for (j = 0U; j < MTRR_SUB_RANGE_NUM; j++) {
+			if (!is_mtrr_enabled(vmtrr) || !is_fixed_range_mtrr_enabled(vmtrr)) {
+				types[(i * MTRR_SUB_RANGE_NUM) + j] = get_default_memory_type(vmtrr);
+			} else {
+				types[(i * MTRR_SUB_RANGE_NUM) + j] = vmtrr->fixed_range[i].type[j];
 			}
+		}
+	}
+}
+
+static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
+{
+	uint8_t types[FIXED_SUB_RANGE_NUM];
+	uint8_t type = 0U;
+	uint64_t start = 0UL, end = 0UL, sub_start, sub_size;
+	uint32_t i, j, k;
+	struct acrn_vm *vm = vmtrr2vcpu(vmtrr)->vm;
+	struct vm_mtrr_ept *mtrr_ept = &vm->arch_vm.mtrr_ept;
+	struct ept_batch batch;
 
-			update_ept(vm, start, size, type);
+	get_fixed_mem_types(vmtrr, types);
+
+	/*
+	 * The fixed-range sub-ranges are contiguous from 0 to 1MB, the changed
+	 * ones of the same type are combined across the MTRRs and the EPT is
+	 * flushed once at the end.
+	 */
+	spinlock_obtain(&mtrr_ept->lock);
+	ept_batch_init(&batch, vm);
+	for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
+		sub_size = get_subrange_size_of_fixed_mtrr(i);
+		for (j = 0U; j < MTRR_SUB_RANGE_NUM; j++) {
+			k = (i * MTRR_SUB_RANGE_NUM) + j;
+			sub_start = get_subrange_start_of_fixed_mtrr(i, j);
+			if ((end != start) && ((types[k] != type) || (mtrr_ept->type[k] == types[k]))) {
+				update_ept(vm, start, end - start, type, &batch);
+				start = end;
+			}
+			if (mtrr_ept->type[k] != types[k]) {
+				if (end == start) {
+					start = sub_start;
+					type = types[k];
+				}
+				end = sub_start + sub_size;
+				mtrr_ept->type[k] = types[k];
+			}
 		}
 	}
+	if (end != start) {
+		update_ept(vm, start, end - start, type, &batch);
+	}
+	ept_batch_flush(&batch);
+	spinlock_release(&mtrr_ept->lock);
+}
+
+void apply_vmtrr(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vmtrr *vmtrr = &vcpu->arch.vmtrr;
+
+	if (vmtrr->ept_stale) {
+		vmtrr->ept_stale = false;
+		update_ept_mem_type(vmtrr);
+	}
 }
 
 /* virtual MTRR MSR write API */
@@ -210,40 +257,47 @@ void write_vmtrr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t value)
 	if (msr == MSR_IA32_MTRR_DEF_TYPE) {
 		if (vmtrr->def_type.value != value) {
 			vmtrr->def_type.value = value;
-
-			/*
-			 * Guests follow this guide line to update MTRRs:
-			 * Intel SDM, Volume 3, 11.11.8 Section "MTRR
-			 * Considerations in MP Systems"
-			 * 1. Broadcast to all processors
-			 * 2. Disable Interrupts
-			 * 3. Wait for all procs to do so
-			 * 4. Enter no-fill cache mode (CR0.CD=1, CR0.NW=0)
-			 * 5. Flush caches
-			 * 6. Clear CR4.PGE bit
-			 * 7. Flush all TLBs
-			 * 8. Disable all range registers by MTRRdefType.E
-			 * 9. Update the MTRRs
-			 * 10. Enable all range registers by MTRRdeftype.E
-			 * 11. Flush all TLBs and caches again
-			 * 12. Enter normal cache mode to re-enable caching
-			 * 13. Set CR4.PGE
-			 * 14. Wait for all processors to reach this point
-			 * 15. Enable interrupts.
-			 *
-			 * we don't have to update EPT in step 9
-			 * but in step 8 and 10 only
-			 */
-			update_ept_mem_type(vmtrr);
+			vmtrr->ept_stale = true;
 		}
 	} else {
 		index = get_index_of_fixed_mtrr(msr);
 		if (index != FIXED_MTRR_INVALID_INDEX) {
-			vmtrr->fixed_range[index].value = value;
+			if (vmtrr->fixed_range[index].value != value) {
+				vmtrr->fixed_range[index].value = value;
+				vmtrr->ept_stale = true;
+			}
 		} else {
 			pr_err("Write to unexpected MSR: 0x%x", msr);
 		}
 	}
+
+	/*
+	 * Guests follow this guide line to update MTRRs:
+	 * Intel SDM, Volume 3, 11.11.8 Section "MTRR
+	 * Considerations in MP Systems"
+	 * 1. Broadcast to all processors
+	 * 2. Disable Interrupts
+	 * 3. Wait for all procs to do so
+	 * 4. Enter no-fill cache mode (CR0.CD=1, CR0.NW=0)
+	 * 5. Flush caches
+	 * 6. Clear CR4.PGE bit
+	 * 7. Flush all TLBs
+	 * 8. Disable all range registers by MTRRdefType.E
+	 * 9. Update the MTRRs
+	 * 10. Enable all range registers by MTRRdeftype.E
+	 * 11. Flush all TLBs and caches again
+	 * 12. Enter normal cache mode to re-enable caching
+	 * 13. Set CR4.PGE
+	 * 14. Wait for all processors to reach this point
+	 * 15. Enable interrupts.
+	 *
+	 * While CR0.CD is set, the guest PAT makes all of its memory UC
+	 * anyway, so the EPT is only updated once in step 12, from all
+	 * the MTRRs written in steps 8 to 10.
+	 */
+	if ((vcpu_get_cr0(vcpu) & CR0_CD) == 0UL) {
+		apply_vmtrr(vcpu);
+	}
 }
 
 /* virtual MTRR MSR read API */
@@ -15,9 +15,17 @@
 #include <asm/vmx.h>
 #include <asm/guest/ept.h>
 #include <asm/pgtable.h>
+#include <asm/mmu.h>
+#include <asm/cpu_caps.h>
+#include <asm/guest/guest_memory.h>
+#include <asm/guest/virq.h>
+#include <schedule.h>
 #include <trace.h>
 #include <logmsg.h>
 
+/* iterations of a REP string I/O delivered to the device model per VM exit, unless configured */
+#define REP_IO_BATCH_DEFAULT	16U
+
 void arch_fire_hsm_interrupt(void)
 {
 	/*
@@ -48,7 +56,7 @@ emulate_pio_complete(struct acrn_vcpu *vcpu, const struct io_request *io_req)
 	const struct acrn_pio_request *pio_req = &io_req->reqs.pio_request;
 	uint64_t mask = 0xFFFFFFFFUL >> (32UL - (8UL * pio_req->size));
 
-	if (pio_req->direction == ACRN_IOREQ_DIR_READ) {
+	if ((pio_req->direction == ACRN_IOREQ_DIR_READ) && !io_req->string_io) {
 		uint64_t value = (uint64_t)pio_req->value;
 		uint64_t rax = vcpu_get_gpreg(vcpu, CPU_REG_RAX);
 
@@ -58,6 +66,155 @@ emulate_pio_complete(struct acrn_vcpu *vcpu, const struct io_request *io_req)
 }
 
 
+static uint32_t rep_io_dm_batch(const struct acrn_vm *vm)
+{
+	uint32_t batch = get_vm_config(vm->vm_id)->rep_io_batch;
+
+	return (batch != 0U) ? batch : REP_IO_BATCH_DEFAULT;
+}
+
+/* A batch of REP iterations stops for a request to the vCPU or a reschedule of its pCPU */
+static inline bool rep_io_yield(struct acrn_vcpu *vcpu)
+{
+	return (vcpu->state != VCPU_RUNNING) || (vcpu->arch.pending_req != 0UL) ||
+		need_reschedule(pcpuid_from_vcpu(vcpu));
+}
+
+/* A 32-bit address size zero-extends the register, a 16-bit one keeps its upper bits */
+static void set_gpreg_addr_size(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val, uint64_t mask)
+{
+	uint64_t old = vcpu_get_gpreg(vcpu, reg);
+
+	vcpu_set_gpreg(vcpu, reg, (mask == 0xffffUL) ? ((old & ~mask) | (val & mask)) : (val & mask));
+}
+
+/*
+ * Emulate an INS or OUTS from the linear address of its memory operand given
+ * by the VM exit. The iterations of a REP prefix go on in the same VM exit up
+ * to the page boundary of the memory operand, and to rep_io_batch iterations
+ * delivered to the device model. The guest resumes the instruction for the
+ * remaining ones.
+ */
+static int32_t emulate_pio_string(struct acrn_vcpu *vcpu, uint64_t exit_qual)
+{
+	struct io_request *io_req = &vcpu->req;
+	struct acrn_pio_request *pio_req = &io_req->reqs.pio_request;
+	/* bits 9:7 of the VM-exit instruction information: 16, 32 or 64-bit address size */
+	uint32_t addr_size = (exec_vmread32(VMX_INSTR_INFO) >> 7U) & 0x7U;
+	uint64_t mask = (addr_size == 0U) ? 0xffffUL : ((addr_size == 1U) ? 0xffffffffUL : ~0UL);
+	bool is_rep = (vm_exit_io_instruction_is_rep_prefixed(exit_qual) != 0UL);
+	bool is_outs = (pio_req->direction == ACRN_IOREQ_DIR_WRITE);
+	uint32_t idx_reg = is_outs ? CPU_REG_RSI : CPU_REG_RDI;
+	uint64_t first = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_LINEAR_ADDR);
+	uint64_t gva = first, idx = vcpu_get_gpreg(vcpu, idx_reg);
+	uint64_t rcx = vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	uint64_t count = is_rep ? (rcx & mask) : 1UL;
+	uint64_t size = pio_req->size, done = 0UL, gpa, fault_addr;
+	uint32_t err_code, val, dm_iters = 0U, dm_batch = rep_io_dm_batch(vcpu->vm);
+	bool backward = ((vcpu_get_rflags(vcpu) & RFLAGS_D) != 0UL);
+	int32_t status = 0;
+
+	io_req->string_io = true;
+	while (done < count) {
+		if ((done != 0UL) && ((dm_iters >= dm_batch) || rep_io_yield(vcpu) ||
+				((gva & PAGE_MASK) != (first & PAGE_MASK)) ||
+				(((gva + size - 1UL) & PAGE_MASK) != (first & PAGE_MASK)))) {
+			break;
+		}
+
+		val = 0U;
+		if (is_outs) {
+			err_code = 0U;
+			status = copy_from_gva(vcpu, &val, gva, (uint32_t)size, &err_code, &fault_addr);
+		} else {
+			/* both ends of the destination are checked before the port is read */
+			err_code = PAGE_FAULT_WR_FLAG;
+			fault_addr = gva;
+			status = gva2gpa(vcpu, gva, &gpa, &err_code);
+			if (status == 0) {
+				fault_addr = gva + size - 1UL;
+				status = gva2gpa(vcpu, fault_addr, &gpa, &err_code);
+			}
+		}
+		if (status != 0) {
+			if (status == -EFAULT) {
+				/* resumed iterations fault on their own VM exit */
+				if (done == 0UL) {
+					vcpu_inject_pf(vcpu, fault_addr, err_code);
+				}
+				status = 0;
+			}
+			break;
+		}
+
+		pio_req->value = val;
+		status = emulate_io(vcpu, io_req);
+		if (status != 0) {
+			break;
+		}
+		if (!is_outs) {
+			val = pio_req->value;
+			(void)copy_to_gva(vcpu, &val, gva, (uint32_t)size, &err_code, &fault_addr);
+		}
+
+		if (io_req->dm_emulated) {
+			dm_iters++;
+		}
+		done++;
+		gva = backward ? (gva - size) : (gva + size);
+		idx = backward ? (idx - size) : (idx + size);
+	}
+	io_req->string_io = false;
+
+	if (done != 0UL) {
+		set_gpreg_addr_size(vcpu, idx_reg, idx, mask);
+	}
+	if (is_rep) {
+		set_gpreg_addr_size(vcpu, CPU_REG_RCX, rcx - done, mask);
+	}
+	if (done < count) {
+		vcpu_retain_rip(vcpu);
+	}
+
+	return status;
+}
+
+/*
+ * Emulate the following iterations of a REP MOVS/STOS on MMIO in the same VM
+ * exit, up to the page boundary of the MMIO operand and to rep_io_batch
+ * iterations delivered to the device model.
+ */
+static int32_t emulate_mmio_rep(struct acrn_vcpu *vcpu, uint32_t inst_len)
+{
+	struct io_request *io_req = &vcpu->req;
+	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
+	uint32_t dm_iters = io_req->dm_emulated ? 1U : 0U;
+	uint32_t dm_batch = rep_io_dm_batch(vcpu->vm);
+	uint64_t gpa = mmio_req->address;
+	int32_t status = 0;
+
+	while ((dm_iters < dm_batch) && !rep_io_yield(vcpu) && vie_rep_next(vcpu, &gpa)) {
+		/* RIP was retained for this iteration, the last one moves past the instruction */
+		vcpu->arch.inst_len = inst_len;
+		mmio_req->address = gpa;
+		if (mmio_req->direction == ACRN_IOREQ_DIR_WRITE) {
+			mmio_req->value = 0UL;
+			status = emulate_instruction(vcpu);
+		}
+		if (status == 0) {
+			status = emulate_io(vcpu, io_req);
+		}
+		if (status != 0) {
+			break;
+		}
+		if (io_req->dm_emulated) {
+			dm_iters++;
+		}
+	}
+
+	return status;
+}
+
 /**
  * @brief The handler of VM exits on I/O instructions
  *
@@ -75,6 +232,7 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 	exit_qual = vcpu->arch.exit_qualification;
 
 	io_req->io_type = ACRN_IOREQ_TYPE_PORTIO;
+	io_req->string_io = false;
 	pio_req->size = vm_exit_io_instruction_size(exit_qual) + 1UL;
 	pio_req->address = vm_exit_io_instruction_port_number(exit_qual);
 	if (vm_exit_io_instruction_access_direction(exit_qual) == 0UL) {
@@ -91,7 +249,11 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 		(uint32_t)pio_req->size,
 		(uint32_t)cur_context_idx);
 
-	status = emulate_io(vcpu, io_req);
+	if ((vm_exit_io_instruction_is_string(exit_qual) != 0UL) && is_vmx_ins_outs_info_supported()) {
+		status = emulate_pio_string(vcpu, exit_qual);
+	} else {
+		status = emulate_io(vcpu, io_req);
+	}
 
 	return status;
 }
@@ -99,6 +261,7 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	int32_t status = -EINVAL, ret;
+	uint32_t inst_len = vcpu->arch.inst_len;
 	uint64_t exit_qual;
 	uint64_t gpa;
 	struct io_request *io_req = &vcpu->req;
@@ -107,7 +270,7 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 	/* Handle page fault from guest */
 	exit_qual = vcpu->arch.exit_qualification;
 	/* Get the guest physical address */
-	gpa = exec_vmread64(VMX_GUEST_PHYSICAL_ADDR_FULL);
+	gpa = vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_PHYS_ADDR);
 
 	TRACE_2L(TRACE_VMEXIT_EPT_VIOLATION, exit_qual, gpa);
 
@@ -150,36 +313,45 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 		 */
 		mmio_req->address = gpa;
 
-		ret = decode_instruction(vcpu, true);
-		if (ret > 0) {
-			mmio_req->size = (uint64_t)ret;
-			/*
-			 * For MMIO write, ask DM to run MMIO emulation after
-			 * instruction emulation. For MMIO read, ask DM to run MMIO
-			 * emulation at first.
-			 */
+		if ((io_req->io_type == ACRN_IOREQ_TYPE_MMIO) && (mmio_req->direction == ACRN_IOREQ_DIR_WRITE) &&
+				(emulate_mmio_doorbell(vcpu, gpa) == 0)) {
+			/* a doorbell is rung by its address alone, the instruction is skipped undecoded */
+			status = 0;
+		} else {
+			ret = decode_instruction(vcpu, true);
+			if (ret > 0) {
+				mmio_req->size = (uint64_t)ret;
+				/*
+				 * For MMIO write, ask DM to run MMIO emulation after
+				 * instruction emulation. For MMIO read, ask DM to run MMIO
+				 * emulation at first.
+				 */
 
-			/* Determine value being written. */
-			if (mmio_req->direction == ACRN_IOREQ_DIR_WRITE) {
-				status = emulate_instruction(vcpu);
-				if (status != 0) {
-					ret = -EFAULT;
+				/* Determine value being written. */
+				if (mmio_req->direction == ACRN_IOREQ_DIR_WRITE) {
+					status = emulate_instruction(vcpu);
+					if (status != 0) {
+						ret = -EFAULT;
+					}
 				}
-			}
 
-			if (ret > 0) {
-				status = emulate_io(vcpu, io_req);
+				if (ret > 0) {
+					status = emulate_io(vcpu, io_req);
+					if (status == 0) {
+						status = emulate_mmio_rep(vcpu, inst_len);
+					}
+				}
+			} else {
+				if (ret == -EFAULT) {
+					pr_info("page fault happen during decode_instruction");
+					status = 0;
+				}
 			}
-		} else {
-			if (ret == -EFAULT) {
-				pr_info("page fault happen during decode_instruction");
-				status = 0;
+			if (ret <= 0) {
+				pr_acrnlog("Guest Linear Address: 0x%016lx", vcpu_vmcs_read(vcpu, VMCS_CACHE_GUEST_LINEAR_ADDR));
+				pr_acrnlog("Guest Physical Address address: 0x%016lx", gpa);
 			}
 		}
-		if (ret <= 0) {
-			pr_acrnlog("Guest Linear Address: 0x%016lx", exec_vmread(VMX_GUEST_LINEAR_ADDR));
-			pr_acrnlog("Guest Physical Address address: 0x%016lx", gpa);
-		}
 	}
 
 	return status;
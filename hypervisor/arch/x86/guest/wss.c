@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <rtl.h>
+#include <asm/lib/atomic.h>
+#include <asm/cpu.h>
+#include <asm/cpu_caps.h>
+#include <asm/per_cpu.h>
+#include <asm/pgtable.h>
+#include <asm/vmx.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/ept.h>
+#include <asm/guest/virq.h>
+#include <asm/guest/dirty_log.h>
+#include <asm/guest/wss.h>
+#include <schedule.h>
+#include <ticks.h>
+#include <logmsg.h>
+
+/* the age of a leaf in the bits 52-55 of the entry, ignored by the processor */
+#define EPT_WSS_AGE_SHIFT	52U
+#define EPT_WSS_AGE_MASK	((uint64_t)(ACRN_WSS_AGES - 1U) << EPT_WSS_AGE_SHIFT)
+
+/*
+ * Age a leaf: its accessed flag makes it young again, else it gets one scan
+ * older. The processor may set the A/D flags meanwhile, they are not lost.
+ */
+static void wss_age_entry(uint64_t *entry, uint64_t size, uint64_t *hist)
+{
+	uint64_t old, new, age;
+
+	do {
+		old = *entry;
+		age = (old & EPT_WSS_AGE_MASK) >> EPT_WSS_AGE_SHIFT;
+		if ((old & EPT_ACCESSED) != 0UL) {
+			age = 0UL;
+		} else if (age < (ACRN_WSS_AGES - 1U)) {
+			age++;
+		} else {
+			/* as old as it gets */
+		}
+		new = (old & ~(EPT_ACCESSED | EPT_WSS_AGE_MASK)) | (age << EPT_WSS_AGE_SHIFT);
+	} while ((new != old) && (atomic_cmpxchg64(entry, old, new) != old));
+
+	if (hist != NULL) {
+		hist[age] += size;
+	}
+}
+
+static void wss_clear_entry(uint64_t *entry)
+{
+	uint64_t old;
+
+	do {
+		old = *entry;
+	} while (((old & (EPT_ACCESSED | EPT_WSS_AGE_MASK)) != 0UL) &&
+			(atomic_cmpxchg64(entry, old, old & ~(EPT_ACCESSED | EPT_WSS_AGE_MASK)) != old));
+}
+
+static void wss_visit(uint64_t *entry, uint64_t size, uint64_t *hist)
+{
+	/* the RAM, not the MMIO of the pass-through devices */
+	if ((*entry & EPT_MT_MASK) == EPT_WB) {
+		if (hist != NULL) {
+			wss_age_entry(entry, size, hist);
+		} else {
+			wss_clear_entry(entry);
+		}
+	}
+}
+
+/*
+ * Age the leaves of the EPT of vm into hist, or clear their ages if hist is
+ * NULL. The page tables may be split or coalesced meanwhile, so the walk
+ * holds vm->ept_lock for one PDPTE at a time and gives the pCPU away between
+ * two of them if asked to.
+ */
+static void wss_walk(struct acrn_vm *vm, uint64_t *hist)
+{
+	const struct pgtable *table = &vm->arch_vm.ept_pgtable;
+	uint64_t *pml4e, *pdpte, *pde, *pte;
+	uint64_t i, j, k, m;
+	bool present;
+
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		pml4e = pml4e_offset((uint64_t *)vm->arch_vm.nworld_eptp, i << PML4E_SHIFT);
+		spinlock_obtain(&vm->ept_lock);
+		present = pgentry_present(table, (*pml4e));
+		spinlock_release(&vm->ept_lock);
+		if (!present) {
+			continue;
+		}
+
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			spinlock_obtain(&vm->ept_lock);
+			pdpte = pdpte_offset(pml4e, j << PDPTE_SHIFT);
+			if (!pgentry_present(table, (*pdpte))) {
+				/* nothing mapped */
+			} else if (pdpte_large(*pdpte) != 0UL) {
+				wss_visit(pdpte, PDPTE_SIZE, hist);
+			} else {
+				for (k = 0UL; k < PTRS_PER_PDE; k++) {
+					pde = pde_offset(pdpte, k << PDE_SHIFT);
+					if (!pgentry_present(table, (*pde))) {
+						continue;
+					}
+					if (pde_large(*pde) != 0UL) {
+						wss_visit(pde, PDE_SIZE, hist);
+						continue;
+					}
+					for (m = 0UL; m < PTRS_PER_PTE; m++) {
+						pte = pte_offset(pde, m << PTE_SHIFT);
+						if (pgentry_present(table, (*pte))) {
+							wss_visit(pte, PTE_SIZE, hist);
+						}
+					}
+				}
+			}
+			spinlock_release(&vm->ept_lock);
+
+			if (need_reschedule(get_pcpu_id())) {
+				schedule();
+			}
+		}
+	}
+}
+
+void init_wss(struct acrn_vm *vm)
+{
+	(void)memset(&vm->arch_vm.wss, 0U, sizeof(vm->arch_vm.wss));
+}
+
+static void wss_sync(struct acrn_vm *vm)
+{
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	/* a cached translation doesn't set the accessed flag again */
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+}
+
+int32_t wss_start(struct acrn_vm *vm, uint32_t min_interval_ms)
+{
+	struct vm_wss *wss = &vm->arch_vm.wss;
+	int32_t ret = -EINVAL;
+
+	if (!pcpu_has_vmx_ept_vpid_cap(VMX_EPT_AD)) {
+		ret = -ENODEV;
+	} else if (is_rt_vm(vm) || is_lapic_pt_configured(vm) || is_nvmx_configured(vm) ||
+			(vm->sworld_control.flag.supported != 0UL)) {
+		/* no TLB flushes on an RTVM, the others run with other EPTPs or can't be kicked */
+		pr_err("%s: vm%hu doesn't support working set estimation", __func__, vm->vm_id);
+	} else if (wss->enabled || (min_interval_ms == 0U)) {
+		pr_err("%s: vm%hu already started or invalid interval", __func__, vm->vm_id);
+	} else {
+		(void)memset(wss->idle_bytes, 0U, sizeof(wss->idle_bytes));
+		wss->min_interval_ms = min_interval_ms;
+		wss->nr_scans = 0UL;
+		wss->last_interval_us = 0UL;
+		wss->last_scan_tsc = cpu_ticks();
+		wss->scanning = 0U;
+		wss->enabled = true;
+		/* the flags set so far tell nothing */
+		wss_walk(vm, NULL);
+		dirty_log_sync(vm, ACRN_REQUEST_DIRTY_LOG);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+void wss_stop(struct acrn_vm *vm)
+{
+	struct vm_wss *wss = &vm->arch_vm.wss;
+
+	if (wss->enabled) {
+		/* wait for the scan running, if any */
+		while (atomic_cmpxchg32(&wss->scanning, 0U, 1U) != 0U) {
+			asm_pause();
+		}
+		wss->enabled = false;
+		dirty_log_sync(vm, ACRN_REQUEST_DIRTY_LOG);
+		/* back to entries the ages don't keep from coalescing */
+		wss_walk(vm, NULL);
+		wss->scanning = 0U;
+	}
+}
+
+int32_t wss_scan(struct acrn_vm *vm, struct acrn_wss *out)
+{
+	struct vm_wss *wss = &vm->arch_vm.wss;
+	uint64_t hist[ACRN_WSS_AGES];
+	uint64_t now = cpu_ticks();
+	uint32_t i, age;
+	int32_t ret = 0;
+
+	if (!wss->enabled) {
+		ret = -EINVAL;
+	} else if (atomic_cmpxchg32(&wss->scanning, 0U, 1U) != 0U) {
+		ret = -EBUSY;
+	} else {
+		if ((now - wss->last_scan_tsc) >= ((uint64_t)wss->min_interval_ms * TICKS_PER_MS)) {
+			(void)memset(hist, 0U, sizeof(hist));
+			wss_walk(vm, hist);
+			wss_sync(vm);
+			(void)memcpy_s(wss->idle_bytes, sizeof(wss->idle_bytes), hist, sizeof(hist));
+			wss->last_interval_us = ticks_to_us(now - wss->last_scan_tsc);
+			wss->last_scan_tsc = now;
+			wss->nr_scans++;
+		}
+
+		out->nr_scans = wss->nr_scans;
+		out->last_interval_us = wss->last_interval_us;
+		(void)memset(out->ws_bytes, 0U, sizeof(out->ws_bytes));
+		for (age = 0U; age < ACRN_WSS_AGES; age++) {
+			out->idle_bytes[age] = wss->idle_bytes[age];
+			for (i = 0U; i < ACRN_WSS_WINDOWS; i++) {
+				if (age < (1U << i)) {
+					out->ws_bytes[i] += wss->idle_bytes[age];
+				}
+			}
+		}
+		wss->scanning = 0U;
+	}
+
+	return ret;
+}
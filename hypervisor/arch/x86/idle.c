@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <rtl.h>
+#include <sprintf.h>
+#include <asm/cpu.h>
+#include <asm/cpuid.h>
+#include <asm/cpufeatures.h>
+#include <asm/cpu_caps.h>
+#include <asm/host_pm.h>
+#include <asm/per_cpu.h>
+#include <asm/idle.h>
+#include <schedule.h>
+#include <timer.h>
+#include <ticks.h>
+
+/*
+ * The idle thread enters the deepest state whose exit latency the pCPU allows
+ * and whose target residency fits before the next hv_timer deadline. The
+ * states are HLT and the MWAIT (FFixedHW) entries of the ACPI _CST the board
+ * inspector extracted; I/O port C-state entries are left to the Service VM.
+ */
+
+#define CPUID_MWAIT_LEAF	5U
+/* MWAIT hint: EAX[7:4] is the target C-state minus 1, EAX[3:0] the sub-state */
+#define MWAIT_CSTATE(hint)	((((hint) >> 4U) & 0xFU) + 1U)
+#define MWAIT_SUBSTATE(hint)	((hint) & 0xFU)
+/* as the ACPI idle driver of Linux, a state pays off from twice its exit latency */
+#define IDLE_RESIDENCY_FACTOR	2U
+
+static struct idle_state idle_states[MAX_IDLE_STATES] = {
+	{ .name = "HLT", .mwait = false, .hint = 0U, .latency_us = 0U, .residency_us = 0U },
+};
+static uint32_t nr_idle_states = 1U;
+
+static bool mwait_hint_supported(uint32_t hint, uint32_t edx)
+{
+	uint32_t cstate = MWAIT_CSTATE(hint);
+
+	/* CPUID.05H:EDX[4n+3:4n] enumerates the sub-states of C<n> */
+	return (cstate < 8U) && (MWAIT_SUBSTATE(hint) < ((edx >> (cstate * 4U)) & 0xFU));
+}
+
+void init_idle_states(void)
+{
+	const struct cpu_state_info *pm_info = get_cpu_pm_state_info();
+	const struct acrn_cstate_data *cx;
+	struct idle_state *state;
+	uint32_t eax, ebx, ecx, edx, hint;
+	uint16_t pcpu_id;
+	uint8_t i;
+
+	for (pcpu_id = 0U; pcpu_id < MAX_PCPU_NUM; pcpu_id++) {
+		per_cpu(idle_ctl, pcpu_id).max_latency_us = IDLE_LATENCY_ANY;
+	}
+
+	if (pcpu_has_cap(X86_FEATURE_MONITOR) && (pm_info->cx_data != NULL)) {
+		cpuid_subleaf(CPUID_MWAIT_LEAF, 0U, &eax, &ebx, &ecx, &edx);
+
+		for (i = 0U; (i < pm_info->cx_cnt) && (nr_idle_states < MAX_IDLE_STATES); i++) {
+			cx = &pm_info->cx_data[i];
+			hint = (uint32_t)cx->cx_reg.address;
+			if ((cx->cx_reg.space_id != SPACE_FFixedHW) || !mwait_hint_supported(hint, edx)) {
+				continue;
+			}
+			/* _CST is ordered from the shallowest state */
+			state = &idle_states[nr_idle_states];
+			(void)snprintf(state->name, sizeof(state->name), "C%u", cx->type);
+			state->mwait = true;
+			state->hint = hint;
+			state->latency_us = cx->latency;
+			state->residency_us = cx->latency * IDLE_RESIDENCY_FACTOR;
+			nr_idle_states++;
+		}
+	}
+}
+
+uint32_t get_idle_states(const struct idle_state **states)
+{
+	*states = idle_states;
+	return nr_idle_states;
+}
+
+/*
+ * @brief Bound the exit latency of the idle states the pCPU may enter.
+ *
+ * The shallowest state is always allowed, whatever max_latency_us.
+ */
+void set_idle_latency_limit(uint16_t pcpu_id, uint32_t max_latency_us)
+{
+	per_cpu(idle_ctl, pcpu_id).max_latency_us = max_latency_us;
+}
+
+static uint32_t select_idle_state(uint16_t pcpu_id, uint64_t now, uint64_t deadline)
+{
+	uint32_t max_latency_us = per_cpu(idle_ctl, pcpu_id).max_latency_us;
+	uint64_t predicted_us = ~0UL;
+	uint32_t i, idx = 0U;
+
+	/* no deadline while the tick is stopped with no other timer */
+	if (deadline != 0UL) {
+		predicted_us = (deadline > now) ? ticks_to_us(deadline - now) : 0UL;
+	}
+
+	for (i = 1U; i < nr_idle_states; i++) {
+		if ((idle_states[i].latency_us > max_latency_us) ||
+				((uint64_t)idle_states[i].residency_us > predicted_us)) {
+			break;
+		}
+		idx = i;
+	}
+
+	return idx;
+}
+
+/*
+ * @brief Idle the current pCPU until an interrupt comes.
+ *
+ * Called with interrupts disabled, as asm_safe_hlt() they are enabled for the
+ * time of the halt and the pending ones handled before it returns.
+ */
+void enter_idle_state(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	struct idle_stat *stat;
+	const struct idle_state *state;
+	uint64_t deadline = get_next_timer_deadline(pcpu_id);
+	uint64_t start = cpu_ticks(), end;
+	uint32_t idx = select_idle_state(pcpu_id, start, deadline);
+
+	state = &idle_states[idx];
+	if (state->mwait) {
+		/* a reschedule request from another pCPU also ends the MWAIT */
+		asm_monitor(&ctl->flags, 0UL, 0UL);
+		if (!need_reschedule(pcpu_id)) {
+			asm_safe_mwait(state->hint, 0U);
+		}
+	} else {
+		asm_safe_hlt();
+	}
+	end = cpu_ticks();
+
+	stat = &per_cpu(idle_ctl, pcpu_id).stat[idx];
+	stat->usage++;
+	stat->residency += end - start;
+	if ((end - start) < us_to_ticks(state->residency_us)) {
+		stat->below_target++;
+	}
+	if ((deadline != 0UL) && (end >= deadline)) {
+		stat->timer_wakes++;
+		stat->wake_latency += end - deadline;
+		if ((end - deadline) > stat->max_wake_latency) {
+			stat->max_wake_latency = end - deadline;
+		}
+	}
+}
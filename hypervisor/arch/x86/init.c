@@ -15,6 +15,7 @@
 #include <asm/seed.h>
 #include <asm/boot/ld_sym.h>
 #include <boot.h>
+#include <boot_time.h>
 
 /* boot_regs store the multiboot info magic and address, defined in
    arch/x86/boot/cpu_primary.S.
@@ -93,6 +94,7 @@ void init_primary_pcpu(void)
 
 	/* Clear BSS */
 	(void)memset(&ld_bss_start, 0U, (size_t)(&ld_bss_end - &ld_bss_start));
+	boot_time_mark(ACRN_BOOT_HV_START);
 
 	init_acrn_boot_info(boot_regs);
 
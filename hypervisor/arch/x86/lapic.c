@@ -253,6 +253,32 @@ void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector)
 	}
 }
 
+void send_dest_ipi_mask_logical(uint64_t dest_mask, uint32_t vector)
+{
+	union apic_icr icr;
+	uint64_t mask = dest_mask;
+	uint32_t cluster_id;
+	uint16_t pcpu_id, i;
+
+	pcpu_id = ffs64(mask);
+	while (pcpu_id < MAX_PCPU_NUM) {
+		cluster_id = per_cpu(lapic_ldr, pcpu_id) & X2APIC_LDR_CLUSTER_ID_MASK;
+		icr.value_32.hi_32 = cluster_id;
+		/* the pCPUs of the cluster all go in the logical IDs of one write */
+		for (i = pcpu_id; i < MAX_PCPU_NUM; i++) {
+			if (bitmap_test(i, &mask) &&
+					((per_cpu(lapic_ldr, i) & X2APIC_LDR_CLUSTER_ID_MASK) == cluster_id)) {
+				icr.value_32.hi_32 |= per_cpu(lapic_ldr, i) & X2APIC_LDR_LOGICAL_ID_MASK;
+				bitmap_clear_nolock(i, &mask);
+			}
+		}
+		icr.value_32.lo_32 = vector | (INTR_LAPIC_ICR_LOGICAL << 11U);
+
+		msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
+		pcpu_id = ffs64(mask);
+	}
+}
+
 void send_single_ipi(uint16_t pcpu_id, uint32_t vector)
 {
 	union apic_icr icr;
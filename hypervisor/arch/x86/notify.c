@@ -17,7 +17,39 @@
 
 static uint32_t notification_irq = IRQ_INVALID;
 
-static uint64_t smp_call_mask = 0UL;
+/* run the calls posted to pcpu_id, pcpu_id being the current pCPU */
+static void run_smp_calls(uint16_t pcpu_id)
+{
+	struct smp_call_queue *queue = &per_cpu(smp_call_queue, pcpu_id);
+	struct smp_call *call;
+	smp_call_func_t done;
+	void *data;
+	uint64_t rflags, pending;
+
+	do {
+		spinlock_irqsave_obtain(&queue->lock, &rflags);
+		call = NULL;
+		if (queue->head != queue->tail) {
+			call = queue->calls[queue->head % SMP_CALL_QUEUE_SIZE];
+			queue->head++;
+		}
+		spinlock_irqrestore_release(&queue->lock, rflags);
+
+		if (call != NULL) {
+			/* the caller may reuse a synchronous call once its pending is 0, read it before */
+			done = call->done;
+			data = call->data;
+			call->func(data);
+			do {
+				pending = call->pending;
+			} while (atomic_cmpxchg64(&call->pending, pending, pending & ~(1UL << pcpu_id)) != pending);
+
+			if ((pending == (1UL << pcpu_id)) && (done != NULL)) {
+				done(data);
+			}
+		}
+	} while (call != NULL);
+}
 
 /* run in interrupt context */
 static void kick_notification(__unused uint32_t irq, __unused void *data)
@@ -25,17 +57,7 @@ static void kick_notification(__unused uint32_t irq, __unused void *data)
 	/* Notification vector is used to kick target cpu out of non-root mode.
 	 * And it also serves for smp call.
 	 */
-	uint16_t pcpu_id = get_pcpu_id();
-
-	if (bitmap_test(pcpu_id, &smp_call_mask)) {
-		struct smp_call_info_data *smp_call =
-			&per_cpu(smp_call_info, pcpu_id);
-
-		if (smp_call->func != NULL) {
-			smp_call->func(smp_call->data);
-		}
-		bitmap_clear_lock(pcpu_id, &smp_call_mask);
-	}
+	run_smp_calls(get_pcpu_id());
 }
 
 void handle_smp_call(void)
@@ -43,40 +65,121 @@ void handle_smp_call(void)
 	kick_notification(0, NULL);
 }
 
-void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+/*
+ * Queue call to pcpu_id. Returns whether the queue was empty: otherwise,
+ * the pCPU is already notified and runs call after the ones before.
+ */
+static bool queue_smp_call(uint16_t pcpu_id, struct smp_call *call)
 {
-	uint16_t pcpu_id;
-	struct smp_call_info_data *smp_call;
+	struct smp_call_queue *queue = &per_cpu(smp_call_queue, pcpu_id);
+	bool queued = false, was_empty = false;
+	uint64_t rflags;
+
+	while (!queued) {
+		spinlock_irqsave_obtain(&queue->lock, &rflags);
+		if ((queue->tail - queue->head) < SMP_CALL_QUEUE_SIZE) {
+			was_empty = (queue->tail == queue->head);
+			queue->calls[queue->tail % SMP_CALL_QUEUE_SIZE] = call;
+			queue->tail++;
+			queued = true;
+		}
+		spinlock_irqrestore_release(&queue->lock, rflags);
 
-	/* wait for previous smp call complete, which may run on other cpus */
-	while (atomic_cmpxchg64(&smp_call_mask, 0UL, mask) != 0UL);
-	pcpu_id = ffs64(mask);
+		if (!queued) {
+			/* pcpu_id may itself wait for a slot in the queue of this pCPU */
+			run_smp_calls(get_pcpu_id());
+			asm_pause();
+		}
+	}
+
+	return was_empty;
+}
+
+/*
+ * Post call to the active pCPUs of mask, the calls of several pCPUs are in
+ * flight at once. The pCPUs whose queue was empty are notified with one IPI
+ * per x2APIC cluster, or with a request if they run a vCPU with LAPIC
+ * passthrough. If the current pCPU is in mask, call is run on it before the
+ * return.
+ */
+static void post_smp_call(uint64_t mask, struct smp_call *call)
+{
+	uint16_t pcpu_id, self = get_pcpu_id();
+	uint64_t rest = mask, targets = 0UL, ipi_mask = 0UL;
+	struct acrn_vcpu *vcpu;
+
+	pcpu_id = ffs64(rest);
 	while (pcpu_id < MAX_PCPU_NUM) {
-		bitmap_clear_nolock(pcpu_id, &mask);
-		if (pcpu_id == get_pcpu_id()) {
-			func(data);
-			bitmap_clear_nolock(pcpu_id, &smp_call_mask);
-		} else if (is_pcpu_active(pcpu_id)) {
-			smp_call = &per_cpu(smp_call_info, pcpu_id);
-			smp_call->func = func;
-			smp_call->data = data;
+		bitmap_clear_nolock(pcpu_id, &rest);
+		if ((pcpu_id == self) || is_pcpu_active(pcpu_id)) {
+			bitmap_set_nolock(pcpu_id, &targets);
+		} else {
+			/* pcpu is not in active, print error */
+			pr_err("pcpu_id %d not in active!", pcpu_id);
+		}
+		pcpu_id = ffs64(rest);
+	}
 
-			struct acrn_vcpu *vcpu = get_ever_run_vcpu(pcpu_id);
+	call->pending = targets;
+	if ((targets == 0UL) && (call->done != NULL)) {
+		call->done(call->data);
+	}
 
+	pcpu_id = ffs64(targets);
+	while (pcpu_id < MAX_PCPU_NUM) {
+		bitmap_clear_nolock(pcpu_id, &targets);
+		if ((pcpu_id != self) && queue_smp_call(pcpu_id, call)) {
+			vcpu = get_ever_run_vcpu(pcpu_id);
 			if ((vcpu != NULL) && (is_lapic_pt_enabled(vcpu))) {
 				vcpu_make_request(vcpu, ACRN_REQUEST_SMP_CALL);
 			} else {
-				send_single_ipi(pcpu_id, NOTIFY_VCPU_VECTOR);
+				bitmap_set_nolock(pcpu_id, &ipi_mask);
 			}
-		} else {
-			/* pcpu is not in active, print error */
-			pr_err("pcpu_id %d not in active!", pcpu_id);
-			bitmap_clear_nolock(pcpu_id, &smp_call_mask);
 		}
-		pcpu_id = ffs64(mask);
+		pcpu_id = ffs64(targets);
 	}
-	/* wait for current smp call complete */
-	wait_sync_change(&smp_call_mask, 0UL);
+
+	if (ipi_mask != 0UL) {
+		send_dest_ipi_mask_logical(ipi_mask, NOTIFY_VCPU_VECTOR);
+	}
+
+	/* the local run goes through the queue as well, so that it comes after the calls posted to this pCPU before */
+	if (bitmap_test(self, &mask)) {
+		(void)queue_smp_call(self, call);
+		run_smp_calls(self);
+	}
+}
+
+void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+{
+	struct smp_call call;
+
+	call.func = func;
+	call.data = data;
+	call.done = NULL;
+	post_smp_call(mask, &call);
+
+	/*
+	 * wait for current smp call complete, running the calls posted to
+	 * this pCPU meanwhile: two pCPUs calling each other don't wait on
+	 * one another.
+	 */
+	while (call.pending != 0UL) {
+		run_smp_calls(get_pcpu_id());
+		asm_pause();
+	}
+}
+
+/*
+ * Run call->func(call->data) on the pCPUs of mask without waiting for them,
+ * then call->done(call->data) on the last of them.
+ *
+ * @pre call->done != NULL
+ * @pre call isn't in flight: it is free again once its done() is entered
+ */
+void smp_call_function_async(uint64_t mask, struct smp_call *call)
+{
+	post_smp_call(mask, call);
 }
 
 static int32_t request_notification_irq(irq_action_t func, void *data)
@@ -6,6 +6,7 @@
 #include <types.h>
 #include <asm/lib/bits.h>
 #include <asm/page.h>
+#include <asm/cpu.h>
 #include <logmsg.h>
 
 /**
@@ -22,38 +23,153 @@
  * support to manage memory resources.
  */
 
-struct page *alloc_page(struct page_pool *pool)
+/* the per-VM EPT pools and the shadow EPT pool */
+#define MAX_CACHED_POOLS	(CONFIG_MAX_VM_NUM + 1U)
+
+static struct page_pool *cached_pools[MAX_CACHED_POOLS];
+static uint32_t nr_cached_pools;
+static spinlock_t cached_pools_lock;
+
+/* Allocate up to n pages from the bitmap of pool, the generation they are of is put in gen */
+static uint32_t take_pool_pages(struct page_pool *pool, struct page **pages, uint32_t n, uint64_t *gen)
 {
-	struct page *page = NULL;
-	uint64_t loop_idx, idx, bit;
+	uint64_t loop_idx, idx, bit, hint;
+	uint32_t nr = 0U;
 
 	spinlock_obtain(&pool->lock);
-	for (loop_idx = pool->last_hint_id;
-		loop_idx < (pool->last_hint_id + pool->bitmap_size); loop_idx++) {
+	hint = pool->last_hint_id;
+	for (loop_idx = hint; (loop_idx < (hint + pool->bitmap_size)) && (nr < n); loop_idx++) {
 		idx = loop_idx % pool->bitmap_size;
-		if (*(pool->bitmap + idx) != ~0UL) {
+		while ((*(pool->bitmap + idx) != ~0UL) && (nr < n)) {
 			bit = ffz64(*(pool->bitmap + idx));
 			bitmap_set_nolock(bit, pool->bitmap + idx);
-			page = pool->start_page + ((idx << 6U) + bit);
-
+			pages[nr] = pool->start_page + ((idx << 6U) + bit);
+			nr++;
 			pool->last_hint_id = idx;
-			break;
 		}
 	}
+	*gen = pool->generation;
+	spinlock_release(&pool->lock);
+
+	return nr;
+}
+
+/* Free a page of generation gen to the bitmap of pool, its bit was cleared already if the pool was reset since */
+static void put_pool_page(struct page_pool *pool, struct page *page, uint64_t gen)
+{
+	uint64_t idx, bit;
+
+	spinlock_obtain(&pool->lock);
+	if (gen == pool->generation) {
+		idx = (page - pool->start_page) >> 6U;
+		bit = (page - pool->start_page) & 0x3fUL;
+		bitmap_clear_nolock(bit, pool->bitmap + idx);
+	}
 	spinlock_release(&pool->lock);
+}
+
+/* Put pages of generation gen into the dirty pages of cache, those which don't fit back into the pool */
+static void put_dirty_pages(struct page_pool *pool, struct page_cache *cache, struct page **pages, uint32_t n,
+		uint64_t gen)
+{
+	uint32_t i = 0U;
+
+	spinlock_obtain(&cache->lock);
+	if (gen == pool->generation) {
+		while ((i < n) && (cache->nr_dirty < PAGE_CACHE_SIZE)) {
+			cache->dirty[cache->nr_dirty] = pages[i];
+			cache->nr_dirty++;
+			i++;
+		}
+	}
+	spinlock_release(&cache->lock);
+
+	for (; i < n; i++) {
+		put_pool_page(pool, pages[i], gen);
+	}
+}
+
+/* Take a page out of cache, *zeroed tells whether it is clean */
+static struct page *take_cached_page(struct page_cache *cache, bool *zeroed)
+{
+	struct page *page = NULL;
+
+	spinlock_obtain(&cache->lock);
+	if (cache->nr_clean > 0U) {
+		cache->nr_clean--;
+		page = cache->clean[cache->nr_clean];
+		*zeroed = true;
+	} else if (cache->nr_dirty > 0U) {
+		cache->nr_dirty--;
+		page = cache->dirty[cache->nr_dirty];
+		*zeroed = false;
+	} else {
+		/* empty */
+	}
+	spinlock_release(&cache->lock);
+
+	return page;
+}
+
+static struct page *alloc_cached_page(struct page_pool *pool)
+{
+	struct page_cache *cache = &pool->caches[get_pcpu_id()];
+	struct page *pages[PAGE_CACHE_BATCH];
+	struct page *page;
+	bool zeroed = false;
+	uint64_t gen;
+	uint32_t nr;
+	uint16_t i;
+
+	cache->active = true;
+	page = take_cached_page(cache, &zeroed);
+	if (page == NULL) {
+		nr = take_pool_pages(pool, pages, PAGE_CACHE_BATCH, &gen);
+		if (nr > 0U) {
+			page = pages[0];
+			put_dirty_pages(pool, cache, &pages[1], nr - 1U, gen);
+		} else {
+			/* the pool is empty, but other pCPUs may keep pages of it */
+			for (i = 0U; (i < MAX_PCPU_NUM) && (page == NULL); i++) {
+				page = take_cached_page(&pool->caches[i], &zeroed);
+			}
+		}
+	}
+
+	if ((page != NULL) && !zeroed) {
+		(void)memset(page, 0U, PAGE_SIZE);
+	}
+
+	return page;
+}
+
+struct page *alloc_page(struct page_pool *pool)
+{
+	struct page *page = NULL;
+	uint64_t gen;
+
+	if (pool->caches != NULL) {
+		page = alloc_cached_page(pool);
+	} else if (take_pool_pages(pool, &page, 1U, &gen) == 1U) {
+		(void)memset(page, 0U, PAGE_SIZE);
+	} else {
+		page = NULL;
+	}
 
 	ASSERT(page != NULL, "no page aviable!");
-	page = (page != NULL) ? page : pool->dummy_page;
 	if (page == NULL) {
-		/* For HV MMU page-table mapping, we didn't use dummy page when there's no page
-		 * available in the page pool. This because we only do MMU page-table mapping on
-		 * the early boot time and we reserve enough pages for it. After that, we would
-		 * not do any MMU page-table mapping. We would let the system boot fail when page
-		 * allocation failed.
-		 */
-		panic("no dummy aviable!");
+		page = pool->dummy_page;
+		if (page == NULL) {
+			/* For HV MMU page-table mapping, we didn't use dummy page when there's no page
+			 * available in the page pool. This because we only do MMU page-table mapping on
+			 * the early boot time and we reserve enough pages for it. After that, we would
+			 * not do any MMU page-table mapping. We would let the system boot fail when page
+			 * allocation failed.
+			 */
+			panic("no dummy aviable!");
+		}
+		(void)memset(page, 0U, PAGE_SIZE);
 	}
-	(void)memset(page, 0U, PAGE_SIZE);
 	return page;
 }
 
@@ -62,13 +178,108 @@ struct page *alloc_page(struct page_pool *pool)
  */
 void free_page(struct page_pool *pool, struct page *page)
 {
-	uint64_t idx, bit;
+	if (pool->caches != NULL) {
+		put_dirty_pages(pool, &pool->caches[get_pcpu_id()], &page, 1U, pool->generation);
+	} else {
+		put_pool_page(pool, page, pool->generation);
+	}
+}
+
+void reset_page_pool(struct page_pool *pool, struct page_cache *caches)
+{
+	struct page_cache *cache;
+	uint32_t i;
+	bool found = false;
 
+	/* the lock of the pool is kept, an idle thread may hold it; the initialization depends on the clear BSS */
 	spinlock_obtain(&pool->lock);
-	idx = (page - pool->start_page) >> 6U;
-	bit = (page - pool->start_page) & 0x3fUL;
-	bitmap_clear_nolock(bit, pool->bitmap + idx);
+	pool->generation++;
+	(void)memset((void *)pool->bitmap, 0U, pool->bitmap_size * sizeof(uint64_t));
+	pool->last_hint_id = 0UL;
+	pool->caches = caches;
 	spinlock_release(&pool->lock);
+
+	if (caches != NULL) {
+		for (i = 0U; i < MAX_PCPU_NUM; i++) {
+			cache = &caches[i];
+			spinlock_obtain(&cache->lock);
+			cache->active = false;
+			cache->nr_clean = 0U;
+			cache->nr_dirty = 0U;
+			spinlock_release(&cache->lock);
+		}
+
+		spinlock_obtain(&cached_pools_lock);
+		for (i = 0U; i < nr_cached_pools; i++) {
+			if (cached_pools[i] == pool) {
+				found = true;
+			}
+		}
+		if (!found && (nr_cached_pools < MAX_CACHED_POOLS)) {
+			cached_pools[nr_cached_pools] = pool;
+			/* the idle threads read the pools without the lock */
+			cpu_write_memory_barrier();
+			nr_cached_pools++;
+		}
+		spinlock_release(&cached_pools_lock);
+	}
+}
+
+/* Zero one dirty page of cache, or top it up from pool if it runs low, false if it needs neither */
+static bool refill_page_cache(struct page_pool *pool, struct page_cache *cache)
+{
+	struct page *pages[PAGE_CACHE_BATCH];
+	struct page *page = NULL;
+	uint64_t gen;
+	uint32_t nr;
+	bool low = false;
+
+	spinlock_obtain(&cache->lock);
+	gen = pool->generation;
+	if (cache->active) {
+		if ((cache->nr_dirty > 0U) && (cache->nr_clean < PAGE_CACHE_SIZE)) {
+			cache->nr_dirty--;
+			page = cache->dirty[cache->nr_dirty];
+		} else if ((cache->nr_clean + cache->nr_dirty) < PAGE_CACHE_BATCH) {
+			low = true;
+		} else {
+			/* full enough */
+		}
+	}
+	spinlock_release(&cache->lock);
+
+	if (page != NULL) {
+		(void)memset(page, 0U, PAGE_SIZE);
+
+		spinlock_obtain(&cache->lock);
+		/* only this idle thread adds clean pages, there is still room */
+		if (gen == pool->generation) {
+			cache->clean[cache->nr_clean] = page;
+			cache->nr_clean++;
+		}
+		spinlock_release(&cache->lock);
+	} else if (low) {
+		/* zeroed one by one by the next calls */
+		nr = take_pool_pages(pool, pages, PAGE_CACHE_BATCH, &gen);
+		put_dirty_pages(pool, cache, pages, nr, gen);
+		low = (nr > 0U);
+	} else {
+		/* nothing to do */
+	}
+
+	return (page != NULL) || low;
+}
+
+bool refill_page_caches(uint16_t pcpu_id)
+{
+	uint32_t i, nr = nr_cached_pools;
+	bool ret = false;
+
+	for (i = 0U; (i < nr) && !ret; i++) {
+		ret = refill_page_cache(cached_pools[i], &cached_pools[i]->caches[pcpu_id]);
+	}
+
+	return ret;
 }
 
 /**
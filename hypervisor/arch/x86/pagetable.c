@@ -377,6 +377,194 @@ void pgtable_modify_or_del_map(uint64_t *pml4_page, uint64_t vaddr_base, uint64_
 	}
 }
 
+/*
+ * Replace the page table referenced by pde with a 2MB leaf if its 512 entries
+ * map contiguous physical pages with identical properties, then retire it.
+ *
+ * Entries which tweak_exe_right() would alter are kept in 4KB pages, as they
+ * have been split on purpose (e.g. to map code pages with execute right).
+ */
+static bool try_to_promote_pt_page(uint64_t *pde, const struct pgtable *table, struct pgtable_retired *retired)
+{
+	uint64_t *pt_page = pde_page_vaddr(*pde);
+	uint64_t paddr = (*pt_page) & PTE_PFN_MASK;
+	uint64_t prot = (*pt_page) & ~PTE_PFN_MASK;
+	uint64_t large_prot = prot;
+	uint64_t index;
+	bool promoted = false;
+
+	table->tweak_exe_right(&large_prot);
+	if ((retired->nr < PGTABLE_RETIRED_MAX) && pgentry_present(table, (*pt_page)) && mem_aligned_check(paddr, PDE_SIZE) &&
+			(large_prot == prot) && table->large_page_support(IA32E_PD, prot)) {
+		for (index = 1UL; index < PTRS_PER_PTE; index++) {
+			if (*(pt_page + index) != ((paddr + (index * PTE_SIZE)) | prot)) {
+				break;
+			}
+		}
+
+		if (index == PTRS_PER_PTE) {
+			set_pgentry(pde, paddr | (prot | PAGE_PSE), table);
+			retired->pages[retired->nr] = pt_page;
+			retired->nr++;
+			promoted = true;
+		}
+	}
+
+	return promoted;
+}
+
+/*
+ * Replace the page directory referenced by pdpte with a 1GB leaf if its 512
+ * entries are 2MB leaves mapping contiguous physical memory with identical
+ * properties, then retire it.
+ */
+static bool try_to_promote_pd_page(uint64_t *pdpte, const struct pgtable *table, struct pgtable_retired *retired)
+{
+	uint64_t *pd_page = pdpte_page_vaddr(*pdpte);
+	uint64_t paddr = (*pd_page) & PDE_PFN_MASK;
+	uint64_t prot = (*pd_page) & ~PDE_PFN_MASK;
+	uint64_t index;
+	bool promoted = false;
+
+	if ((retired->nr < PGTABLE_RETIRED_MAX) && pgentry_present(table, (*pd_page)) && (pde_large(*pd_page) != 0UL) &&
+			mem_aligned_check(paddr, PDPTE_SIZE) && table->large_page_support(IA32E_PDPT, prot)) {
+		for (index = 1UL; index < PTRS_PER_PDE; index++) {
+			if (*(pd_page + index) != ((paddr + (index * PDE_SIZE)) | prot)) {
+				break;
+			}
+		}
+
+		if (index == PTRS_PER_PDE) {
+			set_pgentry(pdpte, paddr | prot, table);
+			retired->pages[retired->nr] = pd_page;
+			retired->nr++;
+			promoted = true;
+		}
+	}
+
+	return promoted;
+}
+
+static bool coalesce_pde(uint64_t *pdpte, uint64_t vaddr_start, uint64_t vaddr_end, const struct pgtable *table,
+		struct pgtable_retired *retired)
+{
+	uint64_t *pd_page = pdpte_page_vaddr(*pdpte);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pde_index(vaddr);
+	bool promoted = false;
+
+	for (; index < PTRS_PER_PDE; index++) {
+		uint64_t *pde = pd_page + index;
+
+		if (pgentry_present(table, (*pde)) && (pde_large(*pde) == 0UL)) {
+			if (try_to_promote_pt_page(pde, table, retired)) {
+				promoted = true;
+			}
+		}
+
+		vaddr = (vaddr & PDE_MASK) + PDE_SIZE;
+		if (vaddr >= vaddr_end) {
+			break;	/* done */
+		}
+	}
+
+	return promoted;
+}
+
+/**
+ * @brief Merge split mappings in the specified address range back into large pages.
+ *
+ * Splitting a large page (see pgtable_modify_or_del_map()) is never undone by itself, so a range which has been
+ * modified and restored stays on 4KB pages. This function checks each 4KB page table and 2MB page directory that
+ * overlaps [vaddr_base, vaddr_base + size) and, if all of its 512 entries map contiguous physical memory with identical
+ * properties, replaces it with one large leaf and adds the table page to retired. Nothing is promoted any more once
+ * retired is full.
+ *
+ * The caller is responsible for the TLB flush, once, if the function returns true, and for freeing the retired pages
+ * to table->pool once no processor can walk them from its paging-structure caches any more.
+ *
+ * @param[inout] pml4_page A pointer to the specified PML4 table.
+ * @param[in] vaddr_base The start of the input address range to check.
+ * @param[in] size The size of the input address range to check.
+ * @param[in] table A pointer to the struct pgtable containing the information of the specified memory operations.
+ * @param[inout] retired The table pages unlinked and not freed yet, the ones of this call are appended.
+ *
+ * @return Whether any mapping has been promoted.
+ *
+ * @pre pml4_page != NULL
+ * @pre table != NULL && retired != NULL
+ * @pre Leaf entries of table only differ between levels in PAGE_PSE, which holds for EPT.
+ */
+bool pgtable_coalesce_map(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size, const struct pgtable *table,
+		struct pgtable_retired *retired)
+{
+	uint64_t vaddr = vaddr_base & PDE_MASK;
+	uint64_t vaddr_end = (vaddr_base + size + PDE_SIZE - 1UL) & PDE_MASK;
+	uint64_t vaddr_next, pdpte_end;
+	uint64_t *pml4e, *pdpte;
+	bool promoted = false;
+
+	dev_dbg(DBG_LEVEL_MMU, "%s, vaddr: [0x%lx - 0x%lx]\n", __func__, vaddr, vaddr_end);
+	while (vaddr < vaddr_end) {
+		vaddr_next = (vaddr & PDPTE_MASK) + PDPTE_SIZE;
+		pml4e = pml4e_offset(pml4_page, vaddr);
+		if (pgentry_present(table, (*pml4e))) {
+			pdpte = pdpte_offset(pml4e, vaddr);
+			if (pgentry_present(table, (*pdpte)) && (pdpte_large(*pdpte) == 0UL)) {
+				pdpte_end = min(vaddr_next, vaddr_end);
+				if (coalesce_pde(pdpte, vaddr, pdpte_end, table, retired)) {
+					promoted = true;
+				}
+				if (try_to_promote_pd_page(pdpte, table, retired)) {
+					promoted = true;
+				}
+			}
+		}
+		vaddr = vaddr_next;
+	}
+
+	return promoted;
+}
+
+/**
+ * @brief Map every page of a range with a 4K page
+ *
+ * The large pages overlapping [vaddr_base, vaddr_base + size) are split down to
+ * 4K pages, for the flags set per page by the processor, such as the EPT dirty
+ * flag, to tell the pages apart. Nothing is mapped where nothing was.
+ *
+ * @pre pml4_page != NULL
+ * @pre table != NULL
+ */
+void pgtable_split_map(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size, const struct pgtable *table)
+{
+	uint64_t vaddr = vaddr_base & PDE_MASK;
+	uint64_t vaddr_end = vaddr_base + size;
+	uint64_t *pml4e, *pdpte, *pde;
+
+	dev_dbg(DBG_LEVEL_MMU, "%s, vaddr: [0x%lx - 0x%lx]\n", __func__, vaddr, vaddr_end);
+	while (vaddr < vaddr_end) {
+		pml4e = pml4e_offset(pml4_page, vaddr);
+		if (!pgentry_present(table, (*pml4e))) {
+			vaddr = (vaddr & PML4E_MASK) + PML4E_SIZE;
+			continue;
+		}
+		pdpte = pdpte_offset(pml4e, vaddr);
+		if (!pgentry_present(table, (*pdpte))) {
+			vaddr = (vaddr & PDPTE_MASK) + PDPTE_SIZE;
+			continue;
+		}
+		if (pdpte_large(*pdpte) != 0UL) {
+			split_large_page(pdpte, IA32E_PDPT, vaddr, table);
+		}
+		pde = pde_offset(pdpte, vaddr);
+		if (pgentry_present(table, (*pde)) && (pde_large(*pde) != 0UL)) {
+			split_large_page(pde, IA32E_PD, vaddr, table);
+		}
+		vaddr += PDE_SIZE;
+	}
+}
+
 /*
  * In PT level,
  * add [vaddr_start, vaddr_end) to [paddr_base, ...) MT PT mapping
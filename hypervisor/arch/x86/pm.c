@@ -11,6 +11,7 @@
 #include <asm/msr.h>
 #include <asm/pgtable.h>
 #include <asm/host_pm.h>
+#include <asm/vm_config.h>
 #include <asm/trampoline.h>
 #include <asm/vmx.h>
 #include <console.h>
@@ -215,6 +216,9 @@ void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_
 
 	asm_enter_s3(sstate_data, pm1a_cnt_val, pm1b_cnt_val);
 
+	/* the XSAVE state of the vCPUs was lost with the registers */
+	get_cpu_var(whose_xsave) = NULL;
+
 	resume_lapic();
 	resume_iommu();
 	resume_ioapic();
@@ -276,6 +280,10 @@ void reset_host(bool warm)
 }
 
 static enum acrn_cpufreq_policy_type cpufreq_policy = CPUFREQ_POLICY_PERFORMANCE;
+static bool hwp_enabled;
+/* IA32_HWP_REQUEST set by apply_frequency_policy(), and the one last written, per pCPU */
+static uint64_t host_hwp_request[MAX_PCPU_NUM];
+static uint64_t cur_hwp_request[MAX_PCPU_NUM];
 
 void init_frequency_policy(void)
 {
@@ -296,6 +304,7 @@ void init_frequency_policy(void)
 	if ((cpuid_06_eax & CPUID_EAX_HWP) != 0U) {
 		/* If HWP is available, enable HWP early. This will unlock other HWP MSRs. */
 		msr_write(MSR_IA32_PM_ENABLE, 1U);
+		hwp_enabled = true;
 	}
 }
 
@@ -331,6 +340,8 @@ void apply_frequency_policy(void)
 		/* EPP(0x80: default) | Desired_Performance(0: HWP auto) | Maximum_Performance | Minimum_Performance */
 		reg = (0x80UL << 24U) | (0x00UL << 16U) | (highest_lvl_req << 8U) | lowest_lvl_req;
 	    msr_write(MSR_IA32_HWP_REQUEST, reg);
+		host_hwp_request[get_pcpu_id()] = reg;
+		cur_hwp_request[get_pcpu_id()] = reg;
 	} else if ((cpuid_01_ecx & CPUID_ECX_EST) != 0U) {
 		struct cpu_state_info *pm_s_state_data = get_cpu_pm_state_info();
 
@@ -355,3 +366,70 @@ void apply_frequency_policy(void)
 		/* If no frequency interface is presented, just let CPU run by itself. Do nothing here.*/
 	}
 }
+
+/*
+ * IA32_HWP_REQUEST of a VM perf_policy on a pCPU:
+ *   - VM_PERF_POLICY_HOST: the request of the cpu_perf_policy of the hypervisor.
+ *   - VM_PERF_POLICY_PERFORMANCE: pinned to the highest HWP level, EPP 0 (performance).
+ *   - VM_PERF_POLICY_EFFICIENCY: between the lowest and the guaranteed HWP levels, EPP 0xC0
+ *     (balance power), so turbo is never requested.
+ *
+ * @pre pcpu_id < MAX_PCPU_NUM
+ */
+uint64_t get_vm_hwp_request(uint16_t pcpu_id, uint8_t perf_policy)
+{
+	const struct acrn_cpufreq_limits *limits = &cpufreq_limits[pcpu_id];
+	uint64_t highest = limits->highest_hwp_lvl, lowest = limits->lowest_hwp_lvl;
+	uint64_t guaranteed = limits->guaranteed_hwp_lvl, reg;
+
+	switch (perf_policy) {
+	case VM_PERF_POLICY_PERFORMANCE:
+		reg = (0x00UL << 24U) | (highest << 8U) | highest;
+		break;
+	case VM_PERF_POLICY_EFFICIENCY:
+		reg = (0xC0UL << 24U) | (guaranteed << 8U) | lowest;
+		break;
+	default:
+		reg = host_hwp_request[pcpu_id];
+		break;
+	}
+
+	return reg;
+}
+
+/*
+ * Clamp the minimum, maximum and desired performance of a guest IA32_HWP_REQUEST to the HWP
+ * levels of the pCPU, with the minimum kept below the maximum. The EPP and the activity window
+ * are the guest's. Reserved and package control bits are to be rejected by the caller.
+ *
+ * @pre pcpu_id < MAX_PCPU_NUM
+ */
+uint64_t sanitize_hwp_request(uint16_t pcpu_id, uint64_t req)
+{
+	const struct acrn_cpufreq_limits *limits = &cpufreq_limits[pcpu_id];
+	uint64_t highest = limits->highest_hwp_lvl, lowest = limits->lowest_hwp_lvl;
+	uint64_t min = req & 0xFFUL, max = (req >> 8U) & 0xFFUL, desired = (req >> 16U) & 0xFFUL;
+
+	max = (max > highest) ? highest : ((max < lowest) ? lowest : max);
+	min = (min > max) ? max : ((min < lowest) ? lowest : min);
+	/* 0 lets the hardware select autonomously */
+	if (desired != 0UL) {
+		desired = (desired > max) ? max : ((desired < min) ? min : desired);
+	}
+
+	return (req & ~0xFFFFFFUL) | (desired << 16U) | (max << 8U) | min;
+}
+
+/*
+ * Write IA32_HWP_REQUEST of the current pCPU, unless it holds req already: vCPUs of VMs with
+ * different perf_policy sharing a pCPU each get theirs when switched in.
+ */
+void load_hwp_request(uint64_t req)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+
+	if (hwp_enabled && (cur_hwp_request[pcpu_id] != req)) {
+		msr_write(MSR_IA32_HWP_REQUEST, req);
+		cur_hwp_request[pcpu_id] = req;
+	}
+}
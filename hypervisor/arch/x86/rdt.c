@@ -16,6 +16,9 @@
 #include <asm/board.h>
 #include <asm/vm_config.h>
 #include <asm/msr.h>
+#include <asm/notify.h>
+#include <asm/guest/vcpu.h>
+#include <ticks.h>
 
 const uint16_t hv_clos = 0U;
 /* RDT features can support different numbers of CLOS. Set the lowest numerical
@@ -74,12 +77,276 @@ static void setup_res_clos_msr(uint16_t pcpu_id, struct rdt_type *info, struct r
 	}
 }
 
+#define RDT_RMID_MASK		0x3FFUL
+#define QM_CTR_ERROR		(1UL << 63U)
+#define QM_CTR_UNAVAILABLE	(1UL << 62U)
+#define QM_CTR_DATA_MASK	(QM_CTR_UNAVAILABLE - 1UL)
+/* the L3 monitoring events, the bits of ACRN_RDT_MON_* are at i for the event i + 1 */
+#define NUM_RDT_MON_EVENTS	3U
+
+/* L3 cache monitoring, CPUID.(EAX=0FH, ECX=1) */
+static struct {
+	uint32_t max_rmid;
+	uint32_t events;	/* ACRN_RDT_MON_* */
+	uint32_t width;		/* of the bandwidth counters */
+	uint64_t upscale;
+} rdt_mon;
+
+/* Serializes the changes of the clos_config_array of the instances, the initialization depends on the clear BSS */
+static spinlock_t rdt_clos_lock;
+
+static void init_rdt_mon(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid_subleaf(CPUID_EXTEND_FEATURE, 0U, &eax, &ebx, &ecx, &edx);
+	if ((ebx & CPUID_EBX_PQM) != 0U) {
+		cpuid_subleaf(CPUID_RDT_MONITOR, 0U, &eax, &ebx, &ecx, &edx);
+		/* L3 monitoring */
+		if ((edx & (1U << 1U)) != 0U) {
+			cpuid_subleaf(CPUID_RDT_MONITOR, 1U, &eax, &ebx, &ecx, &edx);
+			rdt_mon.upscale = (uint64_t)ebx;
+			rdt_mon.max_rmid = ecx;
+			rdt_mon.events = edx & (ACRN_RDT_MON_OCCUPANCY | ACRN_RDT_MON_TOTAL_BW | ACRN_RDT_MON_LOCAL_BW);
+			rdt_mon.width = 24U + (eax & 0xFFU);
+		}
+	}
+}
+
+/* RMID 0 is left to the hypervisor, VM n gets n + 1 if the platform has as many */
+static uint32_t rdt_vm_rmid(uint16_t vm_id)
+{
+	uint32_t rmid = (uint32_t)vm_id + 1U;
+
+	return ((rdt_mon.events != 0U) && (rmid <= rdt_mon.max_rmid)) ? rmid : 0U;
+}
+
+uint64_t vm_clos2pqr_msr(uint16_t vm_id, uint16_t clos)
+{
+	return (clos2pqr_msr(clos) & ~RDT_RMID_MASK) | (uint64_t)rdt_vm_rmid(vm_id);
+}
+
+/*
+ * A pCPU of cpu_mask to access the MSRs of its domain on, the current one
+ * if it is in. The smp calls to the pCPUs of lapic-pt vCPUs would wait for a
+ * VM exit, they are skipped. Returns INVALID_BIT_INDEX if there is none.
+ */
+static uint16_t get_rdt_domain_pcpu(uint64_t cpu_mask)
+{
+	uint64_t mask = cpu_mask;
+	uint16_t pcpu_id = get_pcpu_id();
+	struct acrn_vcpu *vcpu;
+
+	if (!bitmap_test(pcpu_id, &mask)) {
+		pcpu_id = ffs64(mask);
+		while (pcpu_id < MAX_PCPU_NUM) {
+			vcpu = get_ever_run_vcpu(pcpu_id);
+			if (is_pcpu_active(pcpu_id) && ((vcpu == NULL) || !is_lapic_pt_enabled(vcpu))) {
+				break;
+			}
+			bitmap_clear_nolock(pcpu_id, &mask);
+			pcpu_id = ffs64(mask);
+		}
+	}
+
+	return pcpu_id;
+}
+
+struct rdt_mon_sample {
+	uint32_t rmid;
+	uint32_t valid;	/* ACRN_RDT_MON_* */
+	uint64_t ctr[NUM_RDT_MON_EVENTS];
+};
+
+static void rdt_mon_sample_func(void *data)
+{
+	struct rdt_mon_sample *sample = (struct rdt_mon_sample *)data;
+	uint64_t val;
+	uint32_t i;
+
+	for (i = 0U; i < NUM_RDT_MON_EVENTS; i++) {
+		if ((rdt_mon.events & (1U << i)) != 0U) {
+			msr_write(MSR_IA32_QM_EVTSEL, ((uint64_t)sample->rmid << 32U) | (uint64_t)(i + 1U));
+			val = msr_read(MSR_IA32_QM_CTR);
+			if ((val & (QM_CTR_ERROR | QM_CTR_UNAVAILABLE)) == 0UL) {
+				sample->ctr[i] = val & QM_CTR_DATA_MASK;
+				sample->valid |= (1U << i);
+			}
+		}
+	}
+}
+
+int32_t rdt_get_mon(struct acrn_rdt_mon *mon)
+{
+	struct rdt_mon_sample sample = { 0U };
+	const struct rdt_ins *ins;
+	uint64_t mask = 0UL;
+	uint16_t pcpu_id;
+	int32_t ret = -EINVAL;
+
+	if ((mon->vm_id < CONFIG_MAX_VM_NUM) && (mon->pcpu_id < get_pcpu_nums())) {
+		sample.rmid = rdt_vm_rmid(mon->vm_id);
+		if (!is_platform_rdt_capable() || (sample.rmid == 0U)) {
+			ret = -ENODEV;
+		} else {
+			ins = get_rdt_res_ins(RDT_RESOURCE_L3, mon->pcpu_id);
+			if (ins != NULL) {
+				mask = ins->cpu_mask;
+			} else {
+				bitmap_set_nolock(mon->pcpu_id, &mask);
+			}
+
+			pcpu_id = get_rdt_domain_pcpu(mask);
+			if (pcpu_id >= MAX_PCPU_NUM) {
+				ret = -EBUSY;
+			} else {
+				mask = 0UL;
+				bitmap_set_nolock(pcpu_id, &mask);
+				smp_call_function(mask, rdt_mon_sample_func, &sample);
+
+				mon->flags = sample.valid;
+				mon->rmid = sample.rmid;
+				mon->width = rdt_mon.width;
+				mon->upscale = rdt_mon.upscale;
+				mon->llc_occupancy = sample.ctr[0];
+				mon->mbm_total = sample.ctr[1];
+				mon->mbm_local = sample.ctr[2];
+				mon->tsc = cpu_ticks();
+				mon->tsc_khz = cpu_tickrate();
+				ret = 0;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Whether entry clos of ins is one of a CLOS of an RT VM or of a VM with
+ * vCAT, the cache masks of the RT VMs are or'ed into rt_mask.
+ */
+static bool is_reserved_clos(const struct rdt_ins *ins, uint32_t res_id, uint16_t clos, uint32_t *rt_mask)
+{
+	const struct acrn_vm_config *vm_config;
+	bool cdp = (res_id != RDT_RESID_MBA) && ins->res.cache.is_cdp_enabled;
+	bool reserved = false;
+	uint16_t vm_id, i, entry, j;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_config = get_vm_config(vm_id);
+		if (((vm_config->guest_flags & (GUEST_FLAG_RT | GUEST_FLAG_VCAT_ENABLED)) == 0UL) ||
+				(vm_config->pclosids == NULL)) {
+			continue;
+		}
+
+		for (i = 0U; i < vm_config->num_pclosids; i++) {
+			/* with CDP, the data then the code mask of each CLOS */
+			entry = cdp ? (vm_config->pclosids[i] << 1U) : vm_config->pclosids[i];
+			for (j = 0U; j < (cdp ? 2U : 1U); j++) {
+				if ((entry + j) == clos) {
+					reserved = true;
+				}
+				if (((vm_config->guest_flags & GUEST_FLAG_RT) != 0UL) && (res_id != RDT_RESID_MBA) &&
+						((entry + j) < ins->num_clos_config)) {
+					*rt_mask |= ins->clos_config_array[entry + j].clos_mask;
+				}
+			}
+		}
+	}
+
+	return reserved;
+}
+
+static bool is_valid_rdt_value(const struct rdt_ins *ins, uint32_t res_id, uint32_t value)
+{
+	uint32_t cbm;
+	bool ret;
+
+	if (res_id == RDT_RESID_MBA) {
+		ret = (value <= ins->res.membw.mba_max);
+	} else {
+		/* a contiguous mask of at least one way */
+		cbm = (value != 0U) ? (value >> ffs64((uint64_t)value)) : 0U;
+		ret = (value != 0U) && ((cbm & (cbm + 1U)) == 0U) && ((uint64_t)value < (1UL << ins->res.cache.cbm_len));
+	}
+
+	return ret;
+}
+
+struct rdt_clos_write {
+	uint32_t msr_index;
+	uint64_t value;
+};
+
+static void rdt_clos_write_func(void *data)
+{
+	struct rdt_clos_write *w = (struct rdt_clos_write *)data;
+
+	msr_write(w->msr_index, w->value);
+}
+
+int32_t rdt_set_clos(struct acrn_rdt_clos *clos)
+{
+	struct rdt_type *info;
+	struct rdt_ins *ins = NULL;
+	union clos_config *cfg;
+	struct rdt_clos_write w;
+	uint32_t rt_mask = 0U;
+	uint64_t mask = 0UL;
+	uint16_t pcpu_id;
+	int32_t ret = -EINVAL;
+
+	if ((clos->res >= ACRN_RDT_RES_L3) && (clos->res <= ACRN_RDT_RES_MBA) && (clos->pcpu_id < get_pcpu_nums())) {
+		info = &res_cap_info[clos->res - 1U];
+		ins = (struct rdt_ins *)get_rdt_res_ins((int)(clos->res - 1U), clos->pcpu_id);
+		if ((ins == NULL) || (ins->num_closids == 0U)) {
+			ret = -ENODEV;
+		} else if ((clos->clos < ins->num_clos_config) && is_valid_rdt_value(ins, info->res_id, clos->value)) {
+			spinlock_obtain(&rdt_clos_lock);
+			if (is_reserved_clos(ins, info->res_id, clos->clos, &rt_mask) ||
+					((info->res_id != RDT_RESID_MBA) && ((clos->value & rt_mask) != 0U))) {
+				ret = -EPERM;
+			} else {
+				pcpu_id = get_rdt_domain_pcpu(ins->cpu_mask);
+				if (pcpu_id >= MAX_PCPU_NUM) {
+					ret = -EBUSY;
+				} else {
+					cfg = &ins->clos_config_array[clos->clos];
+					if (info->res_id == RDT_RESID_MBA) {
+						clos->old_value = cfg->mba_delay;
+						cfg->mba_delay = (uint16_t)clos->value;
+					} else {
+						clos->old_value = cfg->clos_mask;
+						cfg->clos_mask = clos->value;
+					}
+
+					/* the masks are shared by the domain, the pCPUs brought up later take them from cfg */
+					w.msr_index = info->msr_base + clos->clos;
+					w.value = (uint64_t)clos->value;
+					bitmap_set_nolock(pcpu_id, &mask);
+					smp_call_function(mask, rdt_clos_write_func, &w);
+					ret = 0;
+				}
+			}
+			spinlock_release(&rdt_clos_lock);
+		} else {
+			/* invalid CLOS or value */
+		}
+	}
+
+	return ret;
+}
+
 void setup_clos(uint16_t pcpu_id)
 {
 	uint16_t i, j;
 	struct rdt_type *info;
 	struct rdt_ins *ins;
 
+	if (pcpu_id == BSP_CPU_ID) {
+		init_rdt_mon();
+	}
+
 	for (i = 0U; i < RDT_NUM_RESOURCES; i++) {
 		info = &res_cap_info[i];
 		for (j = 0U; j < info->num_ins; j++) {
@@ -141,6 +408,21 @@ uint64_t clos2pqr_msr(__unused uint16_t clos)
 	return 0UL;
 }
 
+uint64_t vm_clos2pqr_msr(__unused uint16_t vm_id, __unused uint16_t clos)
+{
+	return 0UL;
+}
+
+int32_t rdt_get_mon(__unused struct acrn_rdt_mon *mon)
+{
+	return -ENODEV;
+}
+
+int32_t rdt_set_clos(__unused struct acrn_rdt_clos *clos)
+{
+	return -ENODEV;
+}
+
 bool is_platform_rdt_capable(void)
 {
 	return false;
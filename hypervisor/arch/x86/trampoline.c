@@ -14,6 +14,13 @@
 
 static uint64_t trampoline_start16_paddr;
 
+/* the stack of each pCPU, looked up by the trampoline by the x2APIC ID */
+struct trampoline_stack {
+	uint64_t lapic_id;
+	uint64_t stack;
+};
+static struct trampoline_stack trampoline_stacks[MAX_PCPU_NUM];
+
 /*
  * Because trampoline code is relocated in different way, if HV code
  * accesses trampoline using relative addressing, it needs to take
@@ -42,16 +49,21 @@ void write_trampoline_sym(const void *sym, uint64_t val)
 	clflush(hva);
 }
 
-void write_trampoline_stack_sym(uint16_t pcpu_id)
+void write_trampoline_stack_syms(void)
 {
-	uint64_t *hva, stack_sym_addr;
-	hva = (uint64_t *)(hpa2hva(trampoline_start16_paddr) + trampoline_relo_addr(secondary_cpu_stack));
-
-	stack_sym_addr = (uint64_t)&per_cpu(stack, pcpu_id)[CONFIG_STACK_SIZE - 1];
-	stack_sym_addr &= ~(CPU_STACK_ALIGN - 1UL);
-	*hva = stack_sym_addr;
+	uint64_t stack_sym_addr;
+	uint16_t pcpu_id;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		stack_sym_addr = (uint64_t)&per_cpu(stack, pcpu_id)[CONFIG_STACK_SIZE - 1];
+		stack_sym_addr &= ~(CPU_STACK_ALIGN - 1UL);
+		trampoline_stacks[pcpu_id].lapic_id = per_cpu(lapic_id, pcpu_id);
+		trampoline_stacks[pcpu_id].stack = stack_sym_addr;
+	}
+	flush_cache_range(trampoline_stacks, sizeof(trampoline_stacks));
 
-	clflush(hva);
+	write_trampoline_sym(secondary_cpu_stacks, hva2hpa(trampoline_stacks));
+	write_trampoline_sym(secondary_cpu_num, get_pcpu_nums());
 }
 
 uint64_t get_trampoline_start16_paddr(void)
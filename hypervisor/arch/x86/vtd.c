@@ -88,6 +88,8 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 
 #define DMAR_INVALIDATION_QUEUE_SIZE	4096U
 #define DMAR_QI_INV_ENTRY_SIZE		16U
+/* descriptors gathered before a single wait descriptor is issued, must leave room in the ring */
+#define DMAR_QI_BATCH_MAX		16U
 #define DMAR_NUM_IR_ENTRIES_PER_PAGE	256U
 
 #define DMAR_INV_STATUS_WRITE_SHIFT	5U
@@ -148,6 +150,16 @@ struct dmar_drhd_rt {
 	uint32_t fault_state[IOMMU_FAULT_REGISTER_STATE_NUM]; /* 32bit registers */
 };
 
+/*
+ * Caller owned batch of invalidation descriptors for one DMAR unit.
+ * The descriptors are submitted together and completed by one wait descriptor.
+ */
+struct dmar_qi_batch {
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t nr_desc;
+	struct dmar_entry desc[DMAR_QI_BATCH_MAX];
+};
+
 struct context_table {
 	struct page buses[ACFG_MAX_PCI_BUS_NUM];
 };
@@ -541,22 +553,30 @@ static struct dmar_drhd_rt *device_to_dmaru(uint8_t bus, uint8_t devfun)
 	return dmaru;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/*
+ * Queue @nr_desc invalidation descriptors followed by one wait descriptor,
+ * then spin until hardware reports the whole group completed.
+ *
+ * @pre nr_desc <= DMAR_QI_BATCH_MAX
+ */
+static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, const struct dmar_entry *invalidate_desc,
+		uint32_t nr_desc)
 {
 	struct dmar_entry *invalidate_desc_ptr;
 	uint32_t qi_status = 0U;
+	uint32_t i;
 	uint64_t start;
 
 	spinlock_obtain(&(dmar_unit->lock));
 
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
-
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
-
-	invalidate_desc_ptr++;
+	for (i = 0U; i < nr_desc; i++) {
+		invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = invalidate_desc[i].hi_64;
+		invalidate_desc_ptr->lo_64 = invalidate_desc[i].lo_64;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	}
 
+	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
 	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
 	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
 	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
@@ -576,13 +596,49 @@ static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_en
 	spinlock_release(&(dmar_unit->lock));
 }
 
+static void dmar_qi_batch_init(struct dmar_qi_batch *batch)
+{
+	batch->dmar_unit = NULL;
+	batch->nr_desc = 0U;
+}
+
+static void dmar_qi_batch_flush(struct dmar_qi_batch *batch)
+{
+	if (batch->nr_desc != 0U) {
+		dmar_issue_qi_request(batch->dmar_unit, batch->desc, batch->nr_desc);
+	}
+	dmar_qi_batch_init(batch);
+}
+
+/*
+ * Submit one invalidation descriptor. With a NULL @batch it is issued and
+ * waited for immediately, otherwise it is deferred to dmar_qi_batch_flush().
+ * A batch holds descriptors of a single DMAR unit, it is flushed implicitly
+ * when it is full or when a descriptor for another unit is added.
+ */
+static void dmar_submit_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch,
+		struct dmar_entry invalidate_desc)
+{
+	if (batch == NULL) {
+		dmar_issue_qi_request(dmar_unit, &invalidate_desc, 1U);
+	} else {
+		if ((batch->nr_desc == DMAR_QI_BATCH_MAX) ||
+				((batch->nr_desc != 0U) && (batch->dmar_unit != dmar_unit))) {
+			dmar_qi_batch_flush(batch);
+		}
+		batch->dmar_unit = dmar_unit;
+		batch->desc[batch->nr_desc] = invalidate_desc;
+		batch->nr_desc++;
+	}
+}
+
 /*
  * did: domain id
  * sid: source id
  * fm: function mask
  * cirg: cache-invalidation request granularity
  */
-static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
+static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch,
 	uint16_t did, uint16_t sid, uint8_t fm, enum dmar_cirg_type cirg)
 {
 	struct dmar_entry invalidate_desc;
@@ -606,16 +662,16 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
+		dmar_submit_qi_request(dmar_unit, batch, invalidate_desc);
 	}
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
+static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch)
 {
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
+	dmar_invalid_context_cache(dmar_unit, batch, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
 }
 
-static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
+static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch, uint16_t did, uint64_t address, uint8_t am,
 			       bool hint, enum dmar_iirg_type iirg)
 {
 	/* set Drain Reads & Drain Writes,
@@ -649,7 +705,7 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
+		dmar_submit_qi_request(dmar_unit, batch, invalidate_desc);
 	}
 }
 
@@ -658,9 +714,9 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
  * all PASID-cache entries are invalidated,
  * all paging-structure-cache entries are invalidated.
  */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
+static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch)
 {
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	dmar_invalid_iotlb(dmar_unit, batch, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
 }
 
 /* @pre dmar_unit->ir_table_addr != NULL */
@@ -685,7 +741,7 @@ static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
-static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
+static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch, uint16_t intr_index,
 				uint8_t index_mask, bool is_global)
 {
 	struct dmar_entry invalidate_desc;
@@ -700,13 +756,13 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
+		dmar_submit_qi_request(dmar_unit, batch, invalidate_desc);
 	}
 }
 
-static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
+static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit, struct dmar_qi_batch *batch)
 {
-	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	dmar_invalid_iec(dmar_unit, batch, 0U, 0U, true);
 }
 
 /* @pre dmar_unit->root_table_addr != NULL */
@@ -931,10 +987,14 @@ static void prepare_dmar(struct dmar_drhd_rt *dmar_unit)
 
 static void enable_dmar(struct dmar_drhd_rt *dmar_unit)
 {
+	struct dmar_qi_batch batch;
+
 	dev_dbg(DBG_LEVEL_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_qi_batch_init(&batch);
+	dmar_invalid_context_cache_global(dmar_unit, &batch);
+	dmar_invalid_iotlb_global(dmar_unit, &batch);
+	dmar_invalid_iec_global(dmar_unit, &batch);
+	dmar_qi_batch_flush(&batch);
 	dmar_enable_translation(dmar_unit);
 }
 
@@ -948,11 +1008,14 @@ static void disable_dmar(struct dmar_drhd_rt *dmar_unit)
 
 static void suspend_dmar(struct dmar_drhd_rt *dmar_unit)
 {
+	struct dmar_qi_batch batch;
 	uint32_t i;
 
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_qi_batch_init(&batch);
+	dmar_invalid_context_cache_global(dmar_unit, &batch);
+	dmar_invalid_iotlb_global(dmar_unit, &batch);
+	dmar_invalid_iec_global(dmar_unit, &batch);
+	dmar_qi_batch_flush(&batch);
 
 	disable_dmar(dmar_unit);
 
@@ -1002,7 +1065,8 @@ static bool is_dmar_unit_valid(const struct dmar_drhd_rt *dmar_unit, union pci_b
 }
 
 /* @pre bus < ACFG_MAX_PCI_BUS_NUM */
-static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bus, uint8_t devfun)
+static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bus, uint8_t devfun,
+		struct dmar_qi_batch *batch)
 {
 	struct dmar_drhd_rt *dmar_unit;
 	struct dmar_entry *root_table;
@@ -1071,6 +1135,15 @@ static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bu
 			context_entry->hi_64 = hi_64;
 			context_entry->lo_64 = lo_64;
 			iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
+
+			/*
+			 * In caching mode, not-present entries may be cached under domain id 0,
+			 * so the not-present to present transition has to be invalidated.
+			 */
+			if (iommu_cap_caching_mode(dmar_unit->cap) != 0U) {
+				dmar_invalid_context_cache(dmar_unit, batch, 0U, sid.value, 0U, DMAR_CIRG_DEVICE);
+				dmar_invalid_iotlb(dmar_unit, batch, 0U, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+			}
 			ret = 0;
 		}
 	} else {
@@ -1083,7 +1156,8 @@ static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bu
 }
 
 /* @pre bus < ACFG_MAX_PCI_BUS_NUM */
-static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bus, uint8_t devfun)
+static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bus, uint8_t devfun,
+		struct dmar_qi_batch *batch)
 {
 	struct dmar_drhd_rt *dmar_unit;
 	struct dmar_entry *root_table;
@@ -1125,9 +1199,9 @@ static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bu
 			context_entry->hi_64 = 0UL;
 			iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
 
-			dmar_invalid_context_cache(dmar_unit, vmid_to_domainid(domain->vm_id), sid.value, 0U,
+			dmar_invalid_context_cache(dmar_unit, batch, vmid_to_domainid(domain->vm_id), sid.value, 0U,
 							DMAR_CIRG_DEVICE);
-			dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+			dmar_invalid_iotlb(dmar_unit, batch, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
 							DMAR_IIRG_DOMAIN);
 		}
 	} else {
@@ -1202,19 +1276,23 @@ void destroy_iommu_domain(struct iommu_domain *domain)
 
 int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun)
 {
+	struct dmar_qi_batch batch;
 	int32_t status = 0;
 	uint16_t bus_local = bus;
 
 	/* TODO: check if the device assigned */
 
 	if (bus_local < ACFG_MAX_PCI_BUS_NUM) {
+		/* detach and attach invalidations complete with a single wait */
+		dmar_qi_batch_init(&batch);
 		if (from_domain != NULL) {
-			status = iommu_detach_device(from_domain, bus, devfun);
+			status = iommu_detach_device(from_domain, bus, devfun, &batch);
 		}
 
 		if ((status == 0) && (to_domain != NULL)) {
-			status = iommu_attach_device(to_domain, bus, devfun);
+			status = iommu_attach_device(to_domain, bus, devfun, &batch);
 		}
+		dmar_qi_batch_flush(&batch);
 	} else {
 		status = -EINVAL;
 	}
@@ -1222,6 +1300,40 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
 	return status;
 }
 
+/*
+ * @pre (from_domain != NULL) || (to_domain != NULL)
+ * @pre bdfs != NULL
+ */
+int32_t move_pt_devices(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain,
+		const union pci_bdf *bdfs, uint16_t nr)
+{
+	struct dmar_qi_batch batch;
+	int32_t status = 0;
+	uint16_t i, bus_local;
+	uint8_t devfun;
+
+	dmar_qi_batch_init(&batch);
+	for (i = 0U; (i < nr) && (status == 0); i++) {
+		bus_local = bdfs[i].bits.b;
+		devfun = bdfs[i].fields.devfun;
+		if (bus_local < ACFG_MAX_PCI_BUS_NUM) {
+			if (from_domain != NULL) {
+				status = iommu_detach_device(from_domain, (uint8_t)bus_local, devfun, &batch);
+			}
+
+			if ((status == 0) && (to_domain != NULL)) {
+				status = iommu_attach_device(to_domain, (uint8_t)bus_local, devfun, &batch);
+			}
+		} else {
+			status = -EINVAL;
+		}
+	}
+	/* one wait for the devices under the same DMAR unit, the batch is flushed on a change of unit */
+	dmar_qi_batch_flush(&batch);
+
+	return status;
+}
+
 void enable_iommu(void)
 {
 	do_action_for_iommus(enable_dmar);
@@ -1382,7 +1494,7 @@ int32_t dmar_assign_irte(const struct intr_source *intr_src, union dmar_ir_entry
 				*ir_entry = *irte;
 			}
 			iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-			dmar_invalid_iec(dmar_unit, *idx_out, 0U, false);
+			dmar_invalid_iec(dmar_unit, NULL, *idx_out, 0U, false);
 		}
 		ret = 0;
 	}
@@ -1409,7 +1521,7 @@ void dmar_free_irte(const struct intr_source *intr_src, uint16_t index)
 		ir_entry->bits.remap.present = 0x0UL;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		dmar_invalid_iec(dmar_unit, NULL, index, 0U, false);
 
 		if (!is_irte_reserved(dmar_unit, index)) {
 			spinlock_obtain(&dmar_unit->lock);
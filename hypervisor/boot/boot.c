@@ -10,6 +10,10 @@
 #include <boot.h>
 #include <rtl.h>
 #include <logmsg.h>
+#include <common/boot_time.h>
+
+/* the TSC of the ACRN_BOOT_EFI_* phases, in hex: efi_boot_tsc=<entry>,<images>,<handoff> */
+#define EFI_BOOT_TSC_ARG	"efi_boot_tsc="
 
 static struct acrn_boot_info acrn_bi = { 0 };
 
@@ -34,10 +38,34 @@ void get_boot_mods_range(uint64_t *p_start, uint64_t *p_end)
 	*p_end = end;
 }
 
+/*
+ * The boot time of the phases of the EFI stub, passed in the command line as the multiboot info has no room for
+ * them. The TSC keeps counting across the jump to the hypervisor, so they compare with its own phases.
+ */
+static void parse_efi_boot_time(const struct acrn_boot_info *abi)
+{
+	uint32_t phase, len = strnlen_s(EFI_BOOT_TSC_ARG, MAX_BOOTARGS_SIZE);
+	char *arg = strstr_s(abi->cmdline, MAX_BOOTARGS_SIZE, EFI_BOOT_TSC_ARG, len);
+
+	if (arg != NULL) {
+		arg += len;
+		for (phase = ACRN_BOOT_EFI_ENTRY; phase <= ACRN_BOOT_EFI_HANDOFF; phase++) {
+			boot_time_set(phase, strtoul_hex(arg));
+			arg = strchr(arg, ',');
+			if (arg == NULL) {
+				break;
+			}
+			arg++;
+		}
+	}
+}
+
 void init_acrn_boot_info(uint32_t *registers)
 {
 	(void)init_multiboot_info(registers);
 	/* TODO: add more boot protocol support here */
+
+	parse_efi_boot_time(&acrn_bi);
 }
 
 int32_t sanitize_acrn_boot_info(struct acrn_boot_info *abi)
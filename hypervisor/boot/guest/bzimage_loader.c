@@ -355,7 +355,7 @@ static void load_bzimage(struct acrn_vm *vm, struct acrn_vcpu *vcpu,
 				(sw_kernel->kernel_size - prot_code_offset) : 0U;
 
 	/* Copy the protected mode part kernel code to its run-time location */
-	(void)copy_to_gpa(vm, (sw_kernel->kernel_src_addr + prot_code_offset), kernel_load_gpa, prot_code_size);
+	(void)copy_image_to_gpa(vm, (sw_kernel->kernel_src_addr + prot_code_offset), kernel_load_gpa, prot_code_size);
 
 	if (vm->sw.ramdisk_info.size > 0U) {
 		/* Use customer specified ramdisk load addr if it is configured in VM configuration,
@@ -370,10 +370,8 @@ static void load_bzimage(struct acrn_vm *vm, struct acrn_vcpu *vcpu,
 			}
 		}
 
-		/* Don't need to load ramdisk if src_addr and load_addr are pointed to same place. */
-		if (gpa2hva(vm, (uint64_t)ramdisk_info->load_addr) != ramdisk_info->src_addr) {
-			load_sw_module(vm, ramdisk_info);
-		}
+		/* The ramdisk isn't copied if src_addr and load_addr are pointed to same place. */
+		load_sw_module(vm, ramdisk_info);
 	}
 
 	bootargs_info->load_addr = (void *)BZIMG_CMDLINE_GPA(load_params_gpa);
@@ -107,9 +107,9 @@ static void *do_load_elf64(struct acrn_vm *vm)
 				 *
 				 * We assume that the guest elf can put segments to valid gpa.
 				 */
-				(void)copy_to_gpa(vm, p_elf_img + p_prg_tbl_head64->p_offset,
-					p_prg_tbl_head64->p_paddr, (uint32_t)p_prg_tbl_head64->p_filesz);
-				/* copy_to_gpa has its own stac/clac inside. Call stac again here to keep
+				(void)copy_image_to_gpa(vm, p_elf_img + p_prg_tbl_head64->p_offset,
+					p_prg_tbl_head64->p_paddr, p_prg_tbl_head64->p_filesz);
+				/* copy_image_to_gpa has its own stac/clac inside. Call stac again here to keep
 				 * the context. */
 				stac();
 			}
@@ -173,9 +173,9 @@ static void *do_load_elf32(struct acrn_vm *vm)
 				 *
 				 * We assume that the guest elf can put segments to valid gpa.
 				 */
-				(void)copy_to_gpa(vm, p_elf_img + p_prg_tbl_head32->p_offset,
+				(void)copy_image_to_gpa(vm, p_elf_img + p_prg_tbl_head32->p_offset,
 					p_prg_tbl_head32->p_paddr, p_prg_tbl_head32->p_filesz);
-				/* copy_to_gpa has its own stac/clac inside. Call stac again here to keep
+				/* copy_image_to_gpa has its own stac/clac inside. Call stac again here to keep
 				 * the context. */
 				stac();
 			}
@@ -10,6 +10,7 @@
 
 int32_t init_vm_boot_info(struct acrn_vm *vm);
 void load_sw_module(struct acrn_vm *vm, struct sw_module_info *sw_module);
+int32_t copy_image_to_gpa(struct acrn_vm *vm, const void *src, uint64_t gpa, uint64_t size);
 
 #ifdef CONFIG_GUEST_KERNEL_BZIMAGE
 int32_t bzimage_loader(struct acrn_vm *vm);
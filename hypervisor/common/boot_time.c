@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <util.h>
+#include <rtl.h>
+#include <common/ticks.h>
+#include <common/boot_time.h>
+
+/* in the BSS cleared on entry, the phases not reached stay 0 */
+static uint64_t hv_boot_time[ACRN_BOOT_PHASE_MAX];
+static struct acrn_vm_boot_time vm_boot_time[CONFIG_MAX_VM_NUM];
+
+void boot_time_mark(uint32_t phase)
+{
+	hv_boot_time[phase] = cpu_ticks();
+}
+
+void boot_time_set(uint32_t phase, uint64_t ticks)
+{
+	hv_boot_time[phase] = ticks;
+}
+
+void vm_boot_time_mark(uint16_t vm_id, uint32_t phase)
+{
+	if (phase == ACRN_VM_BOOT_CREATE) {
+		(void)memset(&vm_boot_time[vm_id], 0U, sizeof(vm_boot_time[vm_id]));
+	}
+	vm_boot_time[vm_id].phase[phase] = cpu_ticks();
+}
+
+void vm_boot_time_load(uint16_t vm_id, uint64_t size, bool in_place, uint32_t nr_pcpus)
+{
+	struct acrn_vm_boot_time *bt = &vm_boot_time[vm_id];
+
+	if (in_place) {
+		bt->in_place += size;
+	} else {
+		bt->copied += size;
+		bt->copy_pcpus = max(bt->copy_pcpus, nr_pcpus);
+	}
+}
+
+const uint64_t *get_boot_time(void)
+{
+	return hv_boot_time;
+}
+
+const struct acrn_vm_boot_time *get_vm_boot_time(uint16_t vm_id)
+{
+	return &vm_boot_time[vm_id];
+}
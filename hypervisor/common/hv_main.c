@@ -9,11 +9,13 @@
 #include <asm/guest/vmcs.h>
 #include <asm/guest/vmexit.h>
 #include <asm/guest/virq.h>
+#include <asm/page.h>
 #include <schedule.h>
 #include <profiling.h>
 #include <sprintf.h>
 #include <trace.h>
 #include <logmsg.h>
+#include <msi_ring.h>
 
 void vcpu_thread(struct thread_object *obj)
 {
@@ -23,6 +25,10 @@ void vcpu_thread(struct thread_object *obj)
 	do {
 		if (!is_lapic_pt_enabled(vcpu)) {
 			CPU_IRQ_DISABLE_ON_CONFIG();
+			/* the softirqs left pending past the budget of the last pass */
+			if (has_pending_softirq(pcpuid_from_vcpu(vcpu))) {
+				do_softirq();
+			}
 		}
 
 		/* Don't open interrupt window between here and vmentry */
@@ -71,6 +77,9 @@ void vcpu_thread(struct thread_object *obj)
 		}
 
 		profiling_post_vmexit_handler(vcpu);
+
+		/* with the interrupts on, before the checks above for the next entry */
+		lock_instr_throttle(vcpu);
 	} while (1);
 }
 
@@ -80,13 +89,22 @@ void default_idle(__unused struct thread_object *obj)
 
 	while (1) {
 		if (need_reschedule(pcpu_id)) {
+			stop_polling_msi_rings(pcpu_id);
 			schedule();
 		} else if (need_offline(pcpu_id)) {
+			stop_polling_msi_rings(pcpu_id);
 			cpu_dead();
 		} else if (need_shutdown_vm(pcpu_id)) {
 			shutdown_vm_from_idle(pcpu_id);
+		} else if (has_pending_softirq(pcpu_id)) {
+			/* deferred ones, no budget in the idle thread */
+			do_softirq();
 		} else {
-			cpu_do_idle();
+			balance_vcpus(pcpu_id);
+			/* zero page cache pages one at a time, checking again for work in between */
+			if (!refill_page_caches(pcpu_id) && !poll_msi_rings(pcpu_id)) {
+				cpu_do_idle();
+			}
 		}
 	}
 }
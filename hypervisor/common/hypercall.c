@@ -14,6 +14,7 @@
 #include <asm/lapic.h>
 #include <asm/guest/assign.h>
 #include <asm/guest/ept.h>
+#include <asm/guest/vlapic.h>
 #include <asm/guest/vm.h>
 #include <asm/mmu.h>
 #include <hypercall.h>
@@ -28,6 +29,10 @@
 #include <ticks.h>
 #include <asm/cpuid.h>
 #include <vroot_port.h>
+#include <asm/rdt.h>
+#include <boot_time.h>
+#include <msi_ring.h>
+#include <asm/guest/vcpu_state.h>
 
 #define DBG_LEVEL_HYCALL	6U
 
@@ -100,6 +105,39 @@ int32_t hcall_service_vm_offline_cpu(struct acrn_vcpu *vcpu, __unused struct acr
 			}
 			zombie_vcpu(target_vcpu, VCPU_ZOMBIE);
 			offline_vcpu(target_vcpu);
+			bitmap_clear_lock(pcpuid_from_vcpu(target_vcpu), &vcpu->vm->hw.cpu_affinity);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Give a pCPU the Service VM offlined back to it
+ *
+ * A Service VM vCPU is created again on the pCPU, the Service VM brings it
+ * up with an INIT-SIPI sequence.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param param1 lapic id of the pCPU
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_service_vm_online_cpu(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	struct acrn_vcpu *new_vcpu;
+	uint16_t pcpu_id;
+	uint32_t lapicid = (uint32_t)param1;
+	int32_t ret = -1;
+
+	pr_info("Service VM online cpu with lapicid %u", lapicid);
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		if (per_cpu(lapic_id, pcpu_id) == lapicid) {
+			ret = vm_add_vcpu(vcpu->vm, pcpu_id, &new_vcpu);
+			break;
 		}
 	}
 
@@ -226,6 +264,9 @@ int32_t hcall_create_vm(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint6
 				if (((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0UL)
 						&& ((vm_config->guest_flags & GUEST_FLAG_RT) == 0UL)) {
 					pr_err("Wrong guest flags 0x%lx\n", vm_config->guest_flags);
+				} else if (sched_admit(pcpu_bitmap, &vm_config->sched_params) != 0) {
+					pr_err("VM%u: the CPU reservation of its vCPUs doesn't fit on pCPUs 0x%llx",
+							vmid, pcpu_bitmap);
 				} else {
 					if (create_vm(vmid, pcpu_bitmap, vm_config, &tgt_vm) == 0) {
 						/* return a relative vm_id from Service VM view */
@@ -391,6 +432,274 @@ int32_t hcall_set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 	return ret;
 }
 
+/**
+ * @brief Save the state of a vCPU of a paused VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_state, its vcpu_id set
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_save_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint16_t vcpu_id;
+	int32_t ret = -1;
+
+	if ((target_vm->state == VM_PAUSED) && (copy_from_gpa(vm, &vcpu_id,
+			param2 + offsetof(struct acrn_vcpu_state, vcpu_id), sizeof(vcpu_id)) == 0)) {
+		if (vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id for save_vcpu_state\n", __func__);
+		} else {
+			ret = save_vcpu_state(vcpu_from_vid(target_vm, vcpu_id), vm, param2);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Restore the state of a vCPU of a VM not started yet
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_state
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_restore_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint16_t vcpu_id;
+	int32_t ret = -1;
+
+	if ((target_vm->state == VM_CREATED) && (copy_from_gpa(vm, &vcpu_id,
+			param2 + offsetof(struct acrn_vcpu_state, vcpu_id), sizeof(vcpu_id)) == 0)) {
+		if (vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id for restore_vcpu_state\n", __func__);
+		} else {
+			ret = restore_vcpu_state(vcpu_from_vid(target_vm, vcpu_id), vm, param2);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Add or remove a vCPU of a User VM
+ *
+ * The vCPU is added on, or removed from, a pCPU in the cpu_affinity of the
+ * VM that the Service VM gave up. An added vCPU waits for the INIT-SIPI
+ * sequence of the guest, a removed one must have been offlined by the guest.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_hotplug
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_hotplug_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu_hotplug hotplug;
+	struct acrn_vcpu *new_vcpu;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm)
+			&& (copy_from_gpa(vm, &hotplug, param2, sizeof(hotplug)) == 0)) {
+		if (hotplug.op == ACRN_VCPU_HOTPLUG_ADD) {
+			ret = vm_add_vcpu(target_vm, hotplug.pcpu_id, &new_vcpu);
+			if (ret == 0) {
+				hotplug.vcpu_id = new_vcpu->vcpu_id;
+				hotplug.lapic_id = vlapic_get_apicid(vcpu_vlapic(new_vcpu));
+				ret = copy_to_gpa(vm, &hotplug, param2, sizeof(hotplug));
+			}
+		} else if (hotplug.op == ACRN_VCPU_HOTPLUG_REMOVE) {
+			ret = vm_remove_vcpu(target_vm, hotplug.pcpu_id);
+		} else {
+			pr_err("%s: invalid op %u\n", __func__, hotplug.op);
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_get_vmexit_stat(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vmexit_stats stats;
+	struct acrn_vcpu *target_vcpu;
+	int32_t ret = -1;
+
+	if ((!is_poweroff_vm(target_vm)) && (param2 != 0U)) {
+		if (copy_from_gpa(vm, &stats, param2, sizeof(stats)) != 0) {
+		} else if (stats.vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id for get_vmexit_stat\n", __func__);
+		} else {
+			target_vcpu = vcpu_from_vid(target_vm, stats.vcpu_id);
+			stats.nr_reasons = min(stats.nr_reasons, ACRN_VMEXIT_REASON_MAX);
+			/* the counters are updated locklessly by the pCPU of target_vcpu,
+			 * a concurrent exit may be partially accounted in the copy.
+			 */
+			if (copy_to_gpa(vm, target_vcpu->exit_stat, stats.stat_gpa,
+					stats.nr_reasons * sizeof(struct acrn_vmexit_stat)) == 0) {
+				if ((stats.flags & ACRN_VMEXIT_STAT_RESET) != 0U) {
+					(void)memset(target_vcpu->exit_stat, 0U, sizeof(target_vcpu->exit_stat));
+				}
+				ret = copy_to_gpa(vm, &stats, param2, sizeof(stats));
+			}
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_get_sched_stat(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_sched_stats stats;
+	struct acrn_vcpu *target_vcpu;
+	int32_t ret = -1;
+
+	if ((!is_poweroff_vm(target_vm)) && (param2 != 0U)) {
+		if (copy_from_gpa(vm, &stats, param2, sizeof(stats)) != 0) {
+		} else if (stats.vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id for get_sched_stat\n", __func__);
+		} else {
+			target_vcpu = vcpu_from_vid(target_vm, stats.vcpu_id);
+			stats.tsc_khz = cpu_tickrate();
+			/* the counters are updated under the scheduler lock of another pCPU,
+			 * a concurrent switch may be partially accounted in the copy.
+			 */
+			stats.stat = target_vcpu->thread_obj.stat;
+			if ((stats.flags & ACRN_SCHED_STAT_RESET) != 0U) {
+				(void)memset((void *)&target_vcpu->thread_obj.stat, 0U,
+						sizeof(target_vcpu->thread_obj.stat));
+			}
+			ret = copy_to_gpa(vm, &stats, param2, sizeof(stats));
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_get_steal_time(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_steal_time_stats stats;
+	struct acrn_vcpu_steal_time st;
+	struct acrn_vcpu *target_vcpu;
+	uint16_t i, nr_vcpus;
+	int32_t ret = -1;
+
+	if ((!is_poweroff_vm(target_vm)) && (param2 != 0U)) {
+		if (copy_from_gpa(vm, &stats, param2, sizeof(stats)) == 0) {
+			nr_vcpus = min(stats.nr_vcpus, target_vm->hw.created_vcpus);
+			ret = 0;
+			/* the counters are updated by the pCPU of each vCPU, a concurrent
+			 * switch may be partially accounted in the copy.
+			 */
+			for (i = 0U; (i < nr_vcpus) && (ret == 0); i++) {
+				target_vcpu = vcpu_from_vid(target_vm, i);
+				st.run = target_vcpu->steal_time.run;
+				st.steal = target_vcpu->steal_time.steal;
+				st.preempted = (target_vcpu->thread_obj.status == THREAD_STS_RUNNABLE) ? 1U : 0U;
+				st.reserved = 0U;
+				ret = copy_to_gpa(vm, &st, stats.stat_gpa + (i * sizeof(st)), sizeof(st));
+			}
+
+			if (ret == 0) {
+				stats.nr_vcpus = nr_vcpus;
+				stats.tsc_khz = cpu_tickrate();
+				ret = copy_to_gpa(vm, &stats, param2, sizeof(stats));
+			}
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_get_boot_time(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_boot_time bt;
+	struct acrn_vm_boot_time vm_bt;
+	uint32_t nr_vms;
+	uint16_t vm_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &bt, param2, sizeof(bt)) == 0) {
+		nr_vms = min(bt.nr_vms, (uint32_t)CONFIG_MAX_VM_NUM);
+		ret = 0;
+		for (vm_id = 0U; (vm_id < nr_vms) && (ret == 0); vm_id++) {
+			(void)memcpy_s(&vm_bt, sizeof(vm_bt), get_vm_boot_time(vm_id), sizeof(vm_bt));
+			ret = copy_to_gpa(vm, &vm_bt, bt.vm_gpa + (vm_id * sizeof(vm_bt)), sizeof(vm_bt));
+		}
+
+		if (ret == 0) {
+			bt.nr_vms = nr_vms;
+			bt.tsc_khz = cpu_tickrate();
+			(void)memcpy_s(bt.hv, sizeof(bt.hv), get_boot_time(), sizeof(bt.hv));
+			ret = copy_to_gpa(vm, &bt, param2, sizeof(bt));
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_get_rdt_mon(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_rdt_mon mon;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &mon, param2, sizeof(mon)) == 0) {
+		ret = rdt_get_mon(&mon);
+		if (ret == 0) {
+			ret = copy_to_gpa(vm, &mon, param2, sizeof(mon));
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_set_rdt_clos(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_rdt_clos clos;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &clos, param2, sizeof(clos)) == 0) {
+		ret = rdt_set_clos(&clos);
+		if (ret == 0) {
+			pr_info("%s: clos %hu of resource %hu set to 0x%x", __func__, clos.clos, clos.res, clos.value);
+			ret = copy_to_gpa(vm, &clos, param2, sizeof(clos));
+		} else {
+			pr_err("%s: failed to set clos %hu of resource %hu to 0x%x: %d", __func__,
+					clos.clos, clos.res, clos.value, ret);
+		}
+	}
+
+	return ret;
+}
+
 int32_t hcall_create_vcpu(__unused struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
 		__unused uint64_t param1, __unused uint64_t param2)
 {
@@ -468,6 +777,34 @@ int32_t hcall_inject_msi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __un
 	return ret;
 }
 
+/**
+ * @brief notify the MSI ring
+ *
+ * Inject the MSIs the DM published in the MSI ring of a VM, while no pCPU
+ * polls the ring.
+ * The function will return -1 if the target VM does not exist or has no ring.
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 not used
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_msi_ring(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	int32_t ret = -1;
+
+	if (target_vm->sw.msi_ring != NULL) {
+		(void)drain_msi_ring(target_vm);
+		ret = 0;
+	}
+
+	return ret;
+}
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -486,7 +823,6 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
 {
 	struct acrn_vm *vm = vcpu->vm;
 	uint64_t hpa;
-	uint16_t i;
 	int32_t ret = -1;
 
 	if (is_created_vm(target_vm)) {
@@ -503,9 +839,7 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
 				target_vm->sw.io_shared_page = NULL;
 			} else {
 				target_vm->sw.io_shared_page = hpa2hva(hpa);
-				for (i = 0U; i < ACRN_IO_REQUEST_MAX; i++) {
-					set_io_req_state(target_vm, i, ACRN_IOREQ_STATE_FREE);
-				}
+				reset_vm_ioreqs(target_vm);
 				ret = 0;
 			}
 		}
@@ -569,6 +903,32 @@ int32_t hcall_asyncio_deassign(__unused struct acrn_vcpu *vcpu, struct acrn_vm *
 	return ret;
 }
 
+int32_t hcall_posted_io_assign(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		 __unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_posted_io_range range;
+	struct acrn_vm *vm = vcpu->vm;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &range, param2, sizeof(range)) == 0) {
+		ret = add_posted_io_range(target_vm, &range);
+	}
+	return ret;
+}
+
+int32_t hcall_posted_io_deassign(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		 __unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_posted_io_range range;
+	struct acrn_vm *vm = vcpu->vm;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &range, param2, sizeof(range)) == 0) {
+		ret = remove_posted_io_range(target_vm, &range);
+	}
+	return ret;
+}
+
 /**
  * @brief notify request done
  *
@@ -608,12 +968,50 @@ int32_t hcall_notify_ioreq_finish(__unused struct acrn_vcpu *vcpu, struct acrn_v
 	return ret;
 }
 
+/**
+ * @pre is_service_vm(vcpu->vm)
+ */
+int32_t hcall_notify_ioreq_finish_batch(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vcpu *target_vcpu;
+	uint64_t vcpu_mask = param2;
+	uint16_t vcpu_id;
+	int32_t ret = -1;
+
+	/* make sure we have set req_buf */
+	if (is_severity_pass(target_vm->vm_id) &&
+	    (!is_poweroff_vm(target_vm)) && (target_vm->sw.io_shared_page != NULL)) {
+		dev_dbg(DBG_LEVEL_HYCALL, "[%d] NOTIFY_FINISH_BATCH for vcpus 0x%lx",
+			target_vm->vm_id, vcpu_mask);
+
+		if ((vcpu_mask == 0UL) || ((target_vm->hw.created_vcpus < 64U) &&
+		    ((vcpu_mask >> target_vm->hw.created_vcpus) != 0UL))) {
+			pr_err("%s, invalid VCPU mask 0x%lx for VM %d\n",
+				__func__, vcpu_mask, target_vm->vm_id);
+		} else {
+			/* one exit for all the requestors whose ioreq is complete */
+			if (!target_vm->sw.is_polling_ioreq) {
+				while (vcpu_mask != 0UL) {
+					vcpu_id = ffs64(vcpu_mask);
+					bitmap_clear_nolock(vcpu_id, &vcpu_mask);
+					target_vcpu = vcpu_from_vid(target_vm, vcpu_id);
+					signal_event(&target_vcpu->events[VCPU_EVENT_IOREQ]);
+				}
+			}
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 /**
  *@pre is_service_vm(vm)
  *@pre gpa2hpa(vm, region->service_vm_gpa) != INVALID_HPA
  */
 static void add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_vm,
-				const struct vm_memory_region *region,uint64_t *pml4_page)
+				const struct vm_memory_region *region,uint64_t *pml4_page, struct ept_batch *batch)
 {
 	uint64_t prot = 0UL, base_paddr;
 	uint64_t hpa = gpa2hpa(vm, region->service_vm_gpa);
@@ -656,14 +1054,14 @@ static void add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_vm,
 	}
 
 	/* create gpa to hpa EPT mapping */
-	ept_add_mr(target_vm, pml4_page, hpa, region->gpa, region->size, prot);
+	ept_add_mr_batch(target_vm, pml4_page, hpa, region->gpa, region->size, prot, batch);
 }
 
 /**
  *@pre is_service_vm(vm)
  */
 static int32_t set_vm_memory_region(struct acrn_vm *vm,
-	struct acrn_vm *target_vm, const struct vm_memory_region *region)
+	struct acrn_vm *target_vm, const struct vm_memory_region *region, struct ept_batch *batch)
 {
 	uint64_t *pml4_page;
 	int32_t ret = -EINVAL;
@@ -674,12 +1072,12 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 			/* if the GPA range is Service VM valid GPA or not */
 			if (ept_is_valid_mr(vm, region->service_vm_gpa, region->size)) {
 				/* FIXME: how to filter the alias mapping ? */
-				add_vm_memory_region(vm, target_vm, region, pml4_page);
+				add_vm_memory_region(vm, target_vm, region, pml4_page, batch);
 				ret = 0;
 			}
 		} else {
 			if (ept_is_valid_mr(target_vm, region->gpa, region->size)) {
-				ept_del_mr(target_vm, pml4_page, region->gpa, region->size);
+				ept_del_mr_batch(target_vm, pml4_page, region->gpa, region->size, batch);
 				ret = 0;
 			}
 		}
@@ -709,6 +1107,7 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 	struct acrn_vm *vm = vcpu->vm;
 	struct set_regions regions;
 	struct vm_memory_region mr;
+	struct ept_batch batch;
 	uint32_t idx;
 	int32_t ret = -1;
 
@@ -716,6 +1115,8 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 
 		if (!is_poweroff_vm(target_vm) &&
 		    (is_severity_pass(target_vm->vm_id) || (target_vm->state != VM_RUNNING))) {
+			/* one EPT flush for all the regions instead of one per region */
+			ept_batch_init(&batch, target_vm);
 			idx = 0U;
 			while (idx < regions.mr_num) {
 				if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
@@ -723,12 +1124,13 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 					break;
 				}
 
-				ret = set_vm_memory_region(vm, target_vm, &mr);
+				ret = set_vm_memory_region(vm, target_vm, &mr, &batch);
 				if (ret < 0) {
 					break;
 				}
 				idx++;
 			}
+			ept_batch_flush(&batch);
 		} else {
 			pr_err("%p %s:target_vm is invalid or Targeting to service vm", target_vm, __func__);
 		}
@@ -812,6 +1214,79 @@ int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_
 	return ret;
 }
 
+int32_t hcall_vm_dirty_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_dirty_log log;
+	uint64_t bitmap_size;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm) &&
+			(copy_from_gpa(vm, &log, param2, sizeof(log)) == 0)) {
+		switch (log.cmd) {
+		case ACRN_DIRTY_LOG_START:
+			bitmap_size = (((log.size >> PAGE_SHIFT) + 63UL) >> 6U) << 3U;
+			/* the Service VM is identity mapped, so its contiguous GPAs are contiguous HPAs */
+			if ((log.bitmap_gpa != 0UL) && mem_aligned_check(log.bitmap_gpa, 8UL) &&
+					ept_is_valid_mr(vm, log.bitmap_gpa, bitmap_size)) {
+				ret = dirty_log_start(target_vm, log.gpa, log.size,
+						(uint64_t *)gpa2hva(vm, log.bitmap_gpa));
+			} else {
+				pr_err("%s: invalid bitmap 0x%lx", __func__, log.bitmap_gpa);
+			}
+			break;
+		case ACRN_DIRTY_LOG_STOP:
+			dirty_log_stop(target_vm);
+			ret = 0;
+			break;
+		case ACRN_DIRTY_LOG_GET:
+			ret = dirty_log_get(target_vm, log.gpa, log.size, vm, log.bitmap_gpa, &log.nr_dirty);
+			if (ret == 0) {
+				ret = copy_to_gpa(vm, &log, param2, sizeof(log));
+			}
+			break;
+		default:
+			pr_err("%s: invalid cmd %u", __func__, log.cmd);
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int32_t hcall_vm_wss(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_wss wss;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm) &&
+			(copy_from_gpa(vm, &wss, param2, sizeof(wss)) == 0)) {
+		switch (wss.cmd) {
+		case ACRN_WSS_START:
+			ret = wss_start(target_vm, wss.min_interval_ms);
+			break;
+		case ACRN_WSS_STOP:
+			wss_stop(target_vm);
+			ret = 0;
+			break;
+		case ACRN_WSS_SCAN:
+			ret = wss_scan(target_vm, &wss);
+			if (ret == 0) {
+				ret = copy_to_gpa(vm, &wss, param2, sizeof(wss));
+			}
+			break;
+		default:
+			pr_err("%s: invalid cmd %u", __func__, wss.cmd);
+			break;
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -848,6 +1323,66 @@ int32_t hcall_gpa_to_hpa(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __un
 	return ret;
 }
 
+int32_t hcall_gpa_to_hpa_extents(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_gpa2hpa_extents req;
+	struct acrn_hpa_extent ext;
+	uint64_t gpa, end, hpa, len;
+	uint32_t pg_size = 0U;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &req, param2, sizeof(req)) == 0)) {
+		gpa = req.gpa;
+		end = req.gpa + min(req.size, ACRN_GPA2HPA_MAX_SIZE);
+		if ((req.max_extents != 0U) && (end > gpa)) {
+			ret = 0;
+			req.nr_extents = 0U;
+			ext.size = 0UL;
+			while (gpa < end) {
+				hpa = local_gpa2hpa(target_vm, gpa, &pg_size);
+				if (hpa == INVALID_HPA) {
+					break;
+				}
+				/* to the end of the leaf, the whole of it is contiguous */
+				len = min((uint64_t)pg_size - (gpa & ((uint64_t)pg_size - 1UL)), end - gpa);
+				if ((ext.size != 0UL) && (hpa == (ext.hpa + ext.size))) {
+					ext.size += len;
+				} else {
+					if (ext.size != 0UL) {
+						ret = copy_to_gpa(vm, &ext, req.extents_gpa +
+							(req.nr_extents * sizeof(ext)), sizeof(ext));
+						req.nr_extents++;
+						ext.size = 0UL;
+						if ((ret != 0) || (req.nr_extents == req.max_extents)) {
+							break;
+						}
+					}
+					ext.gpa = gpa;
+					ext.hpa = hpa;
+					ext.size = len;
+				}
+				gpa += len;
+			}
+
+			if ((ret == 0) && (ext.size != 0UL)) {
+				ret = copy_to_gpa(vm, &ext, req.extents_gpa +
+					(req.nr_extents * sizeof(ext)), sizeof(ext));
+				req.nr_extents++;
+			}
+			if (ret == 0) {
+				req.size = gpa - req.gpa;
+				ret = copy_to_gpa(vm, &req, param2, sizeof(req));
+			}
+		}
+	} else {
+		pr_err("target_vm is invalid or HCALL gpa2hpa extents: Unable copy param from vm\n");
+	}
+
+	return ret;
+}
+
 /**
  * @brief Assign one PCI dev to a VM.
  *
@@ -1214,8 +1749,19 @@ int32_t hcall_vm_intr_monitor(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 
 				case INTR_CMD_DELAY_INT:
 					/* buffer[0] is the delay time (in MS), if 0 to cancel delay */
-					target_vm->intr_inject_delay_delta =
-						intr_hdr->buffer[0] * TICKS_PER_MS;
+					ptirq_set_rate_limit(target_vm, intr_hdr->buffer[0] * TICKS_PER_MS, 1U);
+					break;
+
+				case INTR_CMD_RATE_LIMIT:
+					/* buffer[0] is the max number of interrupts per second, if 0 to cancel limit */
+					if (intr_hdr->buffer[0] == 0UL) {
+						ptirq_set_rate_limit(target_vm, 0UL, 0U);
+					} else if ((intr_hdr->buffer[1] != 0UL) && (intr_hdr->buffer[1] <= UINT32_MAX)) {
+						ptirq_set_rate_limit(target_vm, (TICKS_PER_MS * 1000UL) / intr_hdr->buffer[0],
+							(uint32_t)intr_hdr->buffer[1]);
+					} else {
+						status = -EINVAL;
+					}
 					break;
 
 				default:
@@ -1354,3 +1900,73 @@ int32_t hcall_remove_vdev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __u
 	}
 	return ret;
 }
+
+/**
+ * @brief Set the config space shadow of a device model emulated device.
+ *
+ * The hypervisor answers the guest reads of the shadowed config dwords of
+ * the device itself, the other accesses still go to the device model.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to data structure of
+ *              acrn_vdev_cfg_shadow
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_vdev_cfg_shadow(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vdev_cfg_shadow shadow;
+	int32_t ret = -EINVAL;
+
+	if (is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &shadow, param2, sizeof(shadow)) == 0) {
+			ret = vpci_set_cfg_shadow(target_vm, &shadow);
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Send an IPI to several vCPUs of the calling VM
+ *
+ * One hypercall replaces the ICR writes of an IPI to each destination.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param param1 bitmap of the destination APIC IDs, bit n for APIC ID (min + n)
+ * @param param2 the min APIC ID in bits 63:32, the low ICR word of the IPI in bits 31:0
+ *
+ * @return the number of vCPUs the IPI was sent to, negative on error.
+ */
+int32_t hcall_pv_send_ipi(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2)
+{
+	int32_t ret = -ENOTTY;
+
+	if (is_pv_ipi_configured(vcpu->vm)) {
+		ret = vlapic_pv_send_ipi(vcpu, param1, (uint32_t)(param2 >> 32U), (uint32_t)param2);
+	}
+	return ret;
+}
+
+/**
+ * @brief Register the state of the calling vCPU shared with the guest
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param param1 guest physical address of a struct acrn_pv_vcpu_state, 0 to unregister it
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_pv_set_vcpu_state(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	int32_t ret = -ENOTTY;
+
+	if (is_pv_ipi_configured(vcpu->vm)) {
+		ret = vcpu_set_pv_state(vcpu, param1);
+	}
+	return ret;
+}
@@ -10,6 +10,7 @@
 #include <common/softirq.h>
 #include <asm/irq.h>
 #include <asm/per_cpu.h>
+#include <trace.h>
 
 static spinlock_t irq_alloc_spinlock = { .head = 0U, .tail = 0U, };
 
@@ -194,6 +195,7 @@ void do_irq(const uint32_t irq)
 	if (irq < NR_IRQS) {
 		desc = &irq_desc_array[irq];
 		per_cpu(irq_count, get_pcpu_id())[irq]++;
+		TRACE_2L(TRACE_IRQ, (uint64_t)irq, 0UL);
 
 		/* XXX irq_alloc_bitmap is used lockless here */
 		if (bitmap_test((uint16_t)(irq & 0x3FU), irq_alloc_bitmap + (irq >> 6U))) {
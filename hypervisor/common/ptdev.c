@@ -14,7 +14,12 @@
 #include <asm/vtd.h>
 #include <ticks.h>
 
-#define PTIRQ_ENTRY_HASHBITS	9U
+/* about a bucket per entry, CONFIG_MAX_PT_IRQ_ENTRIES being the passthrough vectors the scenario needs */
+#define PTIRQ_ENTRY_HASHBITS	((CONFIG_MAX_PT_IRQ_ENTRIES > 1024U) ? 11U :	\
+				(CONFIG_MAX_PT_IRQ_ENTRIES > 512U) ? 10U :	\
+				(CONFIG_MAX_PT_IRQ_ENTRIES > 256U) ? 9U :	\
+				(CONFIG_MAX_PT_IRQ_ENTRIES > 128U) ? 8U :	\
+				(CONFIG_MAX_PT_IRQ_ENTRIES > 64U) ? 7U : 6U)
 #define PTIRQ_ENTRY_HASHSIZE	(1U << PTIRQ_ENTRY_HASHBITS)
 
 #define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
@@ -27,6 +32,49 @@ static struct hlist_head phys_sid_htable[PTIRQ_ENTRY_HASHSIZE];
 /* lookup mapping info from virtual sid within a vm, hashing from sid + acrn_vm structure address */
 static struct hlist_head virt_sid_htable[PTIRQ_ENTRY_HASHSIZE];
 
+/*
+ * The hash tables are looked up without ptdev_lock. The writers, holding it,
+ * make ptirq_table_gen odd while they link, unlink or reinitialize entries,
+ * and even again after: a lookup that ran while it was odd or that sees it
+ * changed is walked again. No grace period is needed before an entry is
+ * reused: the entries are in a static array, so a walk racing with an update
+ * only follows links to entries or NULL, and a walk longer than the number
+ * of entries is given up.
+ */
+static volatile uint32_t ptirq_table_gen;
+
+static inline void ptirq_table_write_begin(void)
+{
+	ptirq_table_gen++;
+	cpu_write_memory_barrier();
+}
+
+static inline void ptirq_table_write_end(void)
+{
+	cpu_write_memory_barrier();
+	ptirq_table_gen++;
+}
+
+static inline uint32_t ptirq_table_read_begin(void)
+{
+	uint32_t gen = ptirq_table_gen;
+
+	while ((gen & 1U) != 0U) {
+		asm_pause();
+		gen = ptirq_table_gen;
+	}
+	/* loads aren't reordered with other loads, only the compiler could */
+	cpu_compiler_barrier();
+
+	return gen;
+}
+
+static inline bool ptirq_table_read_retry(uint32_t gen)
+{
+	cpu_compiler_barrier();
+	return (ptirq_table_gen != gen);
+}
+
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
 	uint16_t id = (uint16_t)ffz64_ex(ptirq_entry_bitmaps, CONFIG_MAX_PT_IRQ_ENTRIES);
@@ -54,39 +102,37 @@ static inline uint64_t ptirq_hash_key(const struct acrn_vm *vm,
 	return hash64(sid->value + (uint64_t)vm, PTIRQ_ENTRY_HASHBITS);
 }
 
-/*
- * to find ptirq_remapping_info from phyical source id (vm == NULL) or
- * virtual source id in a vm.
- */
-struct ptirq_remapping_info *find_ptirq_entry(uint32_t intr_type,
+static struct ptirq_remapping_info *ptirq_walk_bucket(uint32_t intr_type,
 		const union source_id *sid, const struct acrn_vm *vm)
 {
 	struct hlist_node *p;
-	struct hlist_head *b;
 	struct ptirq_remapping_info *n, *entry = NULL;
 	uint64_t key = ptirq_hash_key(vm, sid);
+	uint32_t steps = 0U;
 
 	if (vm == NULL) {
-		b = &(phys_sid_htable[key]);
-
-		hlist_for_each(p, b) {
+		hlist_for_each(p, &(phys_sid_htable[key])) {
 			n = hlist_entry(p, struct ptirq_remapping_info, phys_link);
-			if (is_entry_active(n)) {
-				if ((intr_type == n->intr_type) && (sid->value == n->phys_sid.value)) {
-					entry = n;
-					break;
-				}
+			if (is_entry_active(n) && (intr_type == n->intr_type) && (sid->value == n->phys_sid.value)) {
+				entry = n;
+				break;
+			}
+			steps++;
+			if (steps > CONFIG_MAX_PT_IRQ_ENTRIES) {
+				break;
 			}
 		}
 	} else {
-		b = &(virt_sid_htable[key]);
-		hlist_for_each(p, b) {
+		hlist_for_each(p, &(virt_sid_htable[key])) {
 			n = hlist_entry(p, struct ptirq_remapping_info, virt_link);
-			if (is_entry_active(n)) {
-				if ((intr_type == n->intr_type) && (sid->value == n->virt_sid.value) && (vm == n->vm)) {
-					entry = n;
-					break;
-				}
+			if (is_entry_active(n) && (intr_type == n->intr_type) && (sid->value == n->virt_sid.value) &&
+					(vm == n->vm)) {
+				entry = n;
+				break;
+			}
+			steps++;
+			if (steps > CONFIG_MAX_PT_IRQ_ENTRIES) {
+				break;
 			}
 		}
 	}
@@ -94,6 +140,24 @@ struct ptirq_remapping_info *find_ptirq_entry(uint32_t intr_type,
 	return entry;
 }
 
+/*
+ * to find ptirq_remapping_info from phyical source id (vm == NULL) or
+ * virtual source id in a vm, with or without ptdev_lock.
+ */
+struct ptirq_remapping_info *find_ptirq_entry(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm)
+{
+	struct ptirq_remapping_info *entry;
+	uint32_t gen;
+
+	do {
+		gen = ptirq_table_read_begin();
+		entry = ptirq_walk_bucket(intr_type, sid, vm);
+	} while (ptirq_table_read_retry(gen));
+
+	return entry;
+}
+
 static void ptirq_enqueue_softirq(struct ptirq_remapping_info *entry)
 {
 	uint64_t rflags;
@@ -116,30 +180,61 @@ static void ptirq_intr_delay_callback(void *data)
 	ptirq_enqueue_softirq(entry);
 }
 
-struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
+uint32_t ptirq_dequeue_softirq_batch(uint16_t pcpu_id, struct ptirq_remapping_info *batch[], uint32_t max)
 {
 	uint64_t rflags;
-	struct ptirq_remapping_info *entry = NULL;
+	struct list_head *queue = &per_cpu(softirq_dev_entry_list, pcpu_id);
+	struct ptirq_remapping_info *entry;
+	uint32_t nr = 0U;
 
 	CPU_INT_ALL_DISABLE(&rflags);
 
-	while (!list_empty(&get_cpu_var(softirq_dev_entry_list))) {
-		entry = get_first_item(&per_cpu(softirq_dev_entry_list, pcpu_id), struct ptirq_remapping_info, softirq_node);
-
+	while ((nr < max) && !list_empty(queue)) {
+		entry = get_first_item(queue, struct ptirq_remapping_info, softirq_node);
 		list_del_init(&entry->softirq_node);
+		batch[nr] = entry;
+		nr++;
+	}
 
-		/* if Service VM, just dequeue, if User VM, check delay timer */
-		if (is_service_vm(entry->vm) || timer_expired(&entry->intr_delay_timer, cpu_ticks(), NULL)) {
-			break;
-		} else {
-			/* add it into timer list; dequeue next one */
-			(void)add_timer(&entry->intr_delay_timer);
-			entry = NULL;
+	CPU_INT_ALL_RESTORE(rflags);
+	return nr;
+}
+
+void ptirq_set_rate_limit(struct acrn_vm *vm, uint64_t interval, uint32_t burst)
+{
+	struct ptirq_rate_limit *rl = &vm->ptirq_rate_limit;
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&rl->lock, &rflags);
+	rl->interval = interval;
+	rl->tolerance = (burst > 1U) ? (interval * (burst - 1U)) : 0UL;
+	rl->tat = 0UL;
+	spinlock_irqrestore_release(&rl->lock, rflags);
+}
+
+/*
+ * Take a token for one interrupt of the VM at time now. The token is
+ * reserved even if the bucket is empty, the return value tells how many
+ * ticks the injection has to wait for it, 0 means inject right away.
+ */
+static uint64_t ptirq_take_token(struct acrn_vm *vm, uint64_t now)
+{
+	struct ptirq_rate_limit *rl = &vm->ptirq_rate_limit;
+	uint64_t rflags, delay = 0UL;
+
+	spinlock_irqsave_obtain(&rl->lock, &rflags);
+	if (rl->interval != 0UL) {
+		if (rl->tat < now) {
+			rl->tat = now;
 		}
+		if ((rl->tat - now) > rl->tolerance) {
+			delay = rl->tat - now - rl->tolerance;
+		}
+		rl->tat += rl->interval;
 	}
+	spinlock_irqrestore_release(&rl->lock, rflags);
 
-	CPU_INT_ALL_RESTORE(rflags);
-	return entry;
+	return delay;
 }
 
 struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type)
@@ -149,12 +244,17 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 
 	if (ptirq_id < CONFIG_MAX_PT_IRQ_ENTRIES) {
 		entry = &ptirq_entries[ptirq_id];
+		ptirq_table_write_begin();
 		(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
+		ptirq_table_write_end();
 		entry->ptdev_entry_id = ptirq_id;
 		entry->intr_type = intr_type;
 		entry->vm = vm;
 		entry->intr_count = 0UL;
 		entry->irte_idx = INVALID_IRTE_ID;
+		entry->remote_pcpu_id = INVALID_CPU_ID;
+		entry->steer_pcpu_id = INVALID_CPU_ID;
+		spinlock_init(&entry->remap_lock);
 
 		INIT_LIST_HEAD(&entry->softirq_node);
 
@@ -179,7 +279,9 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry)
 
 	bitmap_clear_lock((entry->ptdev_entry_id) & 0x3FU, &ptirq_entry_bitmaps[entry->ptdev_entry_id >> 6U]);
 
+	ptirq_table_write_begin();
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
+	ptirq_table_write_end();
 }
 
 /* interrupt context */
@@ -187,26 +289,27 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 {
 	struct ptirq_remapping_info *entry = (struct ptirq_remapping_info *) data;
 	bool to_enqueue = true;
+	uint64_t now, delay;
 
 	/*
-	 * "interrupt storm" detection & delay intr injection just for User VM
+	 * "interrupt storm" detection & rate limited intr injection just for User VM
 	 * pass-thru devices, collect its data and delay injection if needed
 	 */
 	if (!is_service_vm(entry->vm)) {
 		entry->intr_count++;
 
-		/* if delta > 0, set the delay TSC, dequeue to handle */
-		if (entry->vm->intr_inject_delay_delta > 0UL) {
-
-			/* if the timer started (entry is in timer-list), not need enqueue again */
-			if (timer_is_started(&entry->intr_delay_timer)) {
+		/* if the timer started, a delayed injection is pending and covers this one */
+		if (timer_is_started(&entry->intr_delay_timer)) {
+			to_enqueue = false;
+		} else {
+			now = cpu_ticks();
+			delay = ptirq_take_token(entry->vm, now);
+			if (delay != 0UL) {
+				/* the timer callback enqueues the entry once its token is refilled */
+				update_timer(&entry->intr_delay_timer, now + delay, 0UL);
+				(void)add_timer(&entry->intr_delay_timer);
 				to_enqueue = false;
-			} else {
-				update_timer(&entry->intr_delay_timer,
-					     cpu_ticks() + entry->vm->intr_inject_delay_delta, 0UL);
 			}
-		} else {
-			update_timer(&entry->intr_delay_timer, 0UL, 0UL);
 		}
 	}
 
@@ -234,12 +337,14 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 
 	if (ret >=0) {
 		entry->allocated_pirq = irq;
-		entry->active = true;
 
+		ptirq_table_write_begin();
+		entry->active = true;
 		key = ptirq_hash_key(NULL, &(entry->phys_sid));
 		hlist_add_head(&entry->phys_link, &(phys_sid_htable[key]));
 		key = ptirq_hash_key(entry->vm, &(entry->virt_sid));
 		hlist_add_head(&entry->virt_link, &(virt_sid_htable[key]));
+		ptirq_table_write_end();
 	}
 
 	return ret;
@@ -247,9 +352,11 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry)
 {
+	ptirq_table_write_begin();
 	hlist_del(&entry->phys_link);
 	hlist_del(&entry->virt_link);
 	entry->active = false;
+	ptirq_table_write_end();
 	if (entry->allocated_pirq != IRQ_INVALID) {
 		free_irq(entry->allocated_pirq);
 	}
@@ -15,6 +15,7 @@
 #include <asm/cpu.h>
 #include <asm/per_cpu.h>
 #include <vm_event.h>
+#include <msi_ring.h>
 
 uint32_t sbuf_next_ptr(uint32_t pos_arg,
 		uint32_t span, uint32_t scope)
@@ -25,6 +26,28 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
 	return pos;
 }
 
+static inline uint32_t sbuf_used(uint32_t head, uint32_t tail, uint32_t size)
+{
+	return (tail >= head) ? (tail - head) : ((size - head) + tail);
+}
+
+/*
+ * With SBUF_NOTIFY_EN set, the consumer is notified once each time the fill
+ * level crosses the watermark, so it can sleep until there is work instead of
+ * polling. Called after tail has moved from old_tail.
+ */
+static bool sbuf_crossed_watermark(const struct shared_buf *sbuf, uint32_t old_tail)
+{
+	uint32_t head = sbuf->head, size = sbuf->size, wm = sbuf->watermark;
+	bool crossed = false;
+
+	if (((sbuf->flags & SBUF_NOTIFY_EN) != 0U) && (wm != 0U) && (head < size) && (old_tail < size)) {
+		crossed = (sbuf_used(head, old_tail, size) < wm) && (sbuf_used(head, sbuf->tail, size) >= wm);
+	}
+
+	return crossed;
+}
+
 /**
  * The high caller should guarantee each time there must have
  * sbuf->ele_size data can be write form data.
@@ -52,11 +75,12 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len)
 {
 	void *to;
 	uint32_t next_tail;
-	uint32_t ele_size, ret;
-	bool trigger_overwrite = false;
+	uint32_t ele_size, ret, old_tail;
+	bool trigger_overwrite = false, notify = false;
 
 	stac();
 	ele_size = sbuf->ele_size;
+	old_tail = sbuf->tail;
 	next_tail = sbuf_next_ptr(sbuf->tail, ele_size, sbuf->size);
 
 	if ((next_tail == sbuf->head) && ((sbuf->flags & OVERWRITE_EN) == 0U)) {
@@ -79,6 +103,7 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len)
 					ele_size, sbuf->size);
 		}
 		sbuf->tail = next_tail;
+		notify = sbuf_crossed_watermark(sbuf, old_tail);
 		ret = ele_size;
 	} else {
 		/* there must be something wrong */
@@ -86,6 +111,103 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len)
 	}
 	clac();
 
+	if (notify) {
+		arch_fire_hsm_interrupt();
+	}
+
+	return ret;
+}
+
+/*
+ * Find room for a len bytes record in a SBUF_VAR_LEN sbuf. The record goes
+ * at tail, or at offset 0 when it does not fit before the end of the buffer.
+ * The new tail must not catch up with head, or the buffer would look empty.
+ */
+static bool sbuf_var_room(uint32_t head, uint32_t tail, uint32_t size, uint32_t len, uint32_t *pos)
+{
+	bool fits;
+
+	if (head > tail) {
+		*pos = tail;
+		fits = ((tail + len) < head);
+	} else if (((tail + len) < size) || (((tail + len) == size) && (head != 0U))) {
+		*pos = tail;
+		fits = true;
+	} else {
+		*pos = 0U;
+		fits = (len < head);
+	}
+
+	return fits;
+}
+
+/**
+ * Put one record of len bytes into a sbuf with SBUF_VAR_LEN set, the first
+ * byte of data must be len. See sbuf_put() for the meaning of the flags, with
+ * OVERWRITE_EN set whole records are dropped from head until the new one fits.
+ *
+ * return:
+ * len:		write succeeded.
+ * 0:		no write, buf is full
+ * UINT32_MAX:	failed, sbuf corrupted.
+ */
+uint32_t sbuf_put_var(struct shared_buf *sbuf, const uint8_t *data, uint32_t len)
+{
+	uint8_t *base = (uint8_t *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t size, head, tail, pos, ret;
+	bool overwrite, fits, notify = false;
+
+	stac();
+	size = sbuf->size;
+	head = sbuf->head;
+	tail = sbuf->tail;
+	overwrite = ((sbuf->flags & OVERWRITE_EN) != 0U);
+
+	if ((len == 0U) || (len > 0xFFU) || (len >= size) || (head >= size) || (tail >= size)) {
+		/* there must be something wrong */
+		ret = UINT32_MAX;
+	} else {
+		fits = sbuf_var_room(head, tail, size, len, &pos);
+		while (!fits && overwrite && (head != tail)) {
+			if (base[head] == 0U) {
+				head = 0U;
+			} else {
+				head = sbuf_next_ptr(head, base[head], size);
+				sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
+			}
+			fits = sbuf_var_room(head, tail, size, len, &pos);
+		}
+		if (!fits && overwrite) {
+			/* everything was dropped, start over from the beginning */
+			head = 0U;
+			tail = 0U;
+			fits = sbuf_var_room(head, tail, size, len, &pos);
+		}
+
+		if (fits) {
+			if (pos != tail) {
+				base[tail] = 0U;
+			}
+			(void)memcpy_s(base + pos, len, data, len);
+			/* make sure write data before update head */
+			cpu_write_memory_barrier();
+
+			if (overwrite) {
+				sbuf->head = head;
+			}
+			sbuf->tail = sbuf_next_ptr(pos, len, size);
+			notify = sbuf_crossed_watermark(sbuf, tail);
+			ret = len;
+		} else {
+			ret = 0U;
+		}
+	}
+	clac();
+
+	if (notify) {
+		arch_fire_hsm_interrupt();
+	}
+
 	return ret;
 }
 
@@ -106,6 +228,12 @@ int32_t sbuf_setup_common(struct acrn_vm *vm, uint16_t cpu_id, uint32_t sbuf_id,
 		case ACRN_VM_EVENT:
 			ret = init_vm_event(vm, hva);
 			break;
+		case ACRN_POSTED_IO:
+			ret = init_posted_io(vm, hva);
+			break;
+		case ACRN_MSI_RING:
+			ret = init_msi_ring(vm, hva);
+			break;
 		default:
 			pr_err("%s not support sbuf_id %d", __func__, sbuf_id);
 			ret = -1;
@@ -114,6 +242,97 @@ int32_t sbuf_setup_common(struct acrn_vm *vm, uint16_t cpu_id, uint32_t sbuf_id,
 	return ret;
 }
 
+/**
+ * Reserve up to elem_num elements of elem_size bytes at tail. The reservation
+ * is split in two when it wraps around the end of the buffer. The producer
+ * fills the slots in place and publishes all of them with sbuf_commit().
+ *
+ * SMAP stays open from a successful reserve until the commit, so the producer
+ * may write the slots directly but must not schedule or clac in between. As
+ * with sbuf_put(), the caller serializes the producers of one sbuf.
+ *
+ * flag:
+ * If OVERWRITE_EN set, up to (ele_num - 1) elements can be reserved and the
+ * oldest ones are dropped by the commit.
+ * if OVERWRITE_EN not set, only the free elements can be reserved.
+ *
+ * return:
+ * n:		number of elements reserved, span is valid.
+ * 0:		nothing reserved, buf is full.
+ * UINT32_MAX:	failed, sbuf corrupted.
+ * Only a non-zero n other than UINT32_MAX is to be committed.
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t elem_size, uint32_t elem_num, struct sbuf_span *span)
+{
+	uint8_t *base = (uint8_t *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t size, head, tail, used, avail, n, ret;
+
+	stac();
+	size = sbuf->size;
+	head = sbuf->head;
+	tail = sbuf->tail;
+
+	if ((elem_size == 0U) || (sbuf->ele_size != elem_size) || (size < (2U * elem_size)) ||
+			((size % elem_size) != 0U) || (head >= size) || (tail >= size) ||
+			((head % elem_size) != 0U) || ((tail % elem_size) != 0U)) {
+		/* there must be something wrong */
+		ret = UINT32_MAX;
+	} else {
+		used = sbuf_used(head, tail, size);
+		avail = ((size - used) / elem_size) - 1U;
+		if ((sbuf->flags & OVERWRITE_EN) != 0U) {
+			n = min(elem_num, (size / elem_size) - 1U);
+		} else {
+			n = min(elem_num, avail);
+		}
+
+		if (n != 0U) {
+			span->ele_size = elem_size;
+			span->start[0] = base + tail;
+			span->num[0] = min(n, (size - tail) / elem_size);
+			span->start[1] = base;
+			span->num[1] = n - span->num[0];
+			span->tail = sbuf_next_ptr(tail, n * elem_size, size);
+			span->dropped = (n > avail) ? (n - avail) : 0U;
+		}
+		ret = n;
+	}
+
+	if ((ret == 0U) || (ret == UINT32_MAX)) {
+		clac();
+	}
+
+	return ret;
+}
+
+/**
+ * Publish the elements reserved by sbuf_reserve() with one barrier and one
+ * tail update.
+ *
+ * @pre span is the result of a successful sbuf_reserve() on sbuf
+ */
+void sbuf_commit(struct shared_buf *sbuf, const struct sbuf_span *span)
+{
+	uint32_t old_tail = sbuf->tail;
+	bool notify;
+
+	/* make sure write data before update head */
+	cpu_write_memory_barrier();
+
+	if (span->dropped != 0U) {
+		/* accumulate overrun count if necessary */
+		sbuf->overrun_cnt += (sbuf->flags & OVERRUN_CNT_EN) * span->dropped;
+		sbuf->head = sbuf_next_ptr(sbuf->head, span->dropped * span->ele_size, sbuf->size);
+	}
+	sbuf->tail = span->tail;
+	notify = sbuf_crossed_watermark(sbuf, old_tail);
+	clac();
+
+	if (notify) {
+		arch_fire_hsm_interrupt();
+	}
+}
+
 /* try put a batch of elememts from data to sbuf
  * data_size should be equel to n*elem_size, data not enough to fill the elem_size will be ignored.
  *
@@ -123,19 +342,22 @@ int32_t sbuf_setup_common(struct acrn_vm *vm, uint16_t cpu_id, uint32_t sbuf_id,
  */
 uint32_t sbuf_put_many(struct shared_buf *sbuf, uint32_t elem_size, uint8_t *data, uint32_t data_size)
 {
-	uint32_t ret, sent = 0U;
-	uint32_t i;
+	struct sbuf_span span;
+	uint32_t n, len0, len1, sent;
 
-	for (i = 0U; i < (data_size / elem_size); i++) {
-		ret = sbuf_put(sbuf, data + i * elem_size, elem_size);
-		if (ret == elem_size) {
-			sent += ret;
-		} else {
-			if (ret == UINT32_MAX) {
-				sent = UINT32_MAX;
-			}
-			break;
+	n = sbuf_reserve(sbuf, elem_size, data_size / elem_size, &span);
+	if ((n == 0U) || (n == UINT32_MAX)) {
+		sent = n;
+	} else {
+		len0 = span.num[0] * elem_size;
+		len1 = span.num[1] * elem_size;
+		(void)memcpy_s(span.start[0], len0, data, len0);
+		if (len1 != 0U) {
+			(void)memcpy_s(span.start[1], len1, data + len0, len1);
 		}
+		sbuf_commit(sbuf, &span);
+		sent = len0 + len1;
 	}
+
 	return sent;
 }
@@ -5,6 +5,7 @@
  */
 
 #include <list.h>
+#include <asm/lib/bits.h>
 #include <asm/per_cpu.h>
 #include <schedule.h>
 #include <ticks.h>
@@ -39,9 +40,13 @@
 #define BVT_VT_RATIO_MIN	8U
 #define BVT_VT_RATIO_MAX	(BVT_WEIGHT_MAX * BVT_VT_RATIO_MIN / BVT_WEIGHT_MIN)
 
+#define BVT_INVALID_RQ_INDEX	0xFFFFFFFFU
+
 struct sched_bvt_data {
-	/* keep list as the first item */
-	struct list_head list;
+	/* index in the runqueue heap, BVT_INVALID_RQ_INDEX if not runnable */
+	uint32_t rq_index;
+	/* runqueue sequence number, the secondary key after evt */
+	uint64_t rq_seq;
 	/* minimum charging unit in cycles */
 	uint64_t mcu;
 	/* a thread receives a share of cpu in proportion to its weight */
@@ -59,6 +64,8 @@ struct sched_bvt_data {
 	uint64_t residual;
 
 	uint64_t start_tsc;
+	/* slice_start of the last gang slice this thread was moved ahead for */
+	uint64_t cosched_slice;
 };
 
 /*
@@ -68,7 +75,68 @@ struct sched_bvt_data {
 static bool is_inqueue(struct thread_object *obj)
 {
 	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
-	return !list_empty(&data->list);
+	return (data->rq_index != BVT_INVALID_RQ_INDEX);
+}
+
+static inline struct sched_bvt_data *rq_data(const struct sched_bvt_control *bvt_ctl, uint32_t idx)
+{
+	return (struct sched_bvt_data *)bvt_ctl->runqueue[idx]->data;
+}
+
+/*
+ * the earliest evt has highest priority, threads with the same evt are
+ * ordered by the time they entered the runqueue.
+ */
+static inline bool bvt_before(const struct sched_bvt_data *a, const struct sched_bvt_data *b)
+{
+	return (a->evt < b->evt) || ((a->evt == b->evt) && (a->rq_seq < b->rq_seq));
+}
+
+static inline void rq_set(struct sched_bvt_control *bvt_ctl, uint32_t idx, struct thread_object *obj)
+{
+	bvt_ctl->runqueue[idx] = obj;
+	((struct sched_bvt_data *)obj->data)->rq_index = idx;
+}
+
+static void rq_sift_up(struct sched_bvt_control *bvt_ctl, uint32_t index)
+{
+	struct thread_object *obj = bvt_ctl->runqueue[index];
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+	uint32_t idx = index, parent;
+
+	while (idx > 0U) {
+		parent = (idx - 1U) >> 1U;
+		if (!bvt_before(data, rq_data(bvt_ctl, parent))) {
+			break;
+		}
+		rq_set(bvt_ctl, idx, bvt_ctl->runqueue[parent]);
+		idx = parent;
+	}
+	rq_set(bvt_ctl, idx, obj);
+}
+
+static void rq_sift_down(struct sched_bvt_control *bvt_ctl, uint32_t index)
+{
+	struct thread_object *obj = bvt_ctl->runqueue[index];
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+	uint32_t idx = index, child;
+
+	while (true) {
+		child = (idx << 1U) + 1U;
+		if (child >= bvt_ctl->nr_runnable) {
+			break;
+		}
+		if (((child + 1U) < bvt_ctl->nr_runnable) &&
+				bvt_before(rq_data(bvt_ctl, child + 1U), rq_data(bvt_ctl, child))) {
+			child++;
+		}
+		if (!bvt_before(rq_data(bvt_ctl, child), data)) {
+			break;
+		}
+		rq_set(bvt_ctl, idx, bvt_ctl->runqueue[child]);
+		idx = child;
+	}
+	rq_set(bvt_ctl, idx, obj);
 }
 
 /*
@@ -76,13 +144,8 @@ static bool is_inqueue(struct thread_object *obj)
  */
 static void update_svt(struct sched_bvt_control *bvt_ctl)
 {
-	struct sched_bvt_data *obj_data;
-	struct thread_object *tmp_obj;
-
-	if (!list_empty(&bvt_ctl->runqueue)) {
-		tmp_obj = get_first_item(&bvt_ctl->runqueue, struct thread_object, data);
-		obj_data = (struct sched_bvt_data *)tmp_obj->data;
-		bvt_ctl->svt = obj_data->avt;
+	if (bvt_ctl->nr_runnable != 0U) {
+		bvt_ctl->svt = rq_data(bvt_ctl, 0U)->avt;
 	}
 }
 
@@ -97,41 +160,61 @@ static void runqueue_add(struct thread_object *obj)
 	struct sched_bvt_control *bvt_ctl =
 		(struct sched_bvt_control *)obj->sched_ctl->priv;
 	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
-	struct list_head *pos;
-	struct thread_object *iter_obj;
-	struct sched_bvt_data *iter_data;
 
-	/*
-	 * the earliest evt has highest priority,
-	 * the runqueue is ordered by priority.
-	 */
+	if (!is_inqueue(obj)) {
+		ASSERT(bvt_ctl->nr_runnable < BVT_RUNQUEUE_MAX, "bvt runqueue overflow!");
+		data->rq_seq = bvt_ctl->seq++;
+		bvt_ctl->runqueue[bvt_ctl->nr_runnable] = obj;
+		bvt_ctl->nr_runnable++;
+		rq_sift_up(bvt_ctl, bvt_ctl->nr_runnable - 1U);
+	}
+}
 
-	if (list_empty(&bvt_ctl->runqueue)) {
-		list_add(&data->list, &bvt_ctl->runqueue);
-	} else {
-		list_for_each(pos, &bvt_ctl->runqueue) {
-			iter_obj = container_of(pos, struct thread_object, data);
-			iter_data = (struct sched_bvt_data *)iter_obj->data;
-			if (iter_data->evt > data->evt) {
-				list_add_node(&data->list, pos->prev, pos);
-				break;
+/*
+ * @pre obj != NULL
+ * @pre obj->data != NULL
+ */
+static void runqueue_remove(struct thread_object *obj)
+{
+	struct sched_bvt_control *bvt_ctl =
+		(struct sched_bvt_control *)obj->sched_ctl->priv;
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+	struct thread_object *last;
+	uint32_t idx = data->rq_index;
+
+	if (is_inqueue(obj)) {
+		bvt_ctl->nr_runnable--;
+		data->rq_index = BVT_INVALID_RQ_INDEX;
+		if (idx != bvt_ctl->nr_runnable) {
+			last = bvt_ctl->runqueue[bvt_ctl->nr_runnable];
+			rq_set(bvt_ctl, idx, last);
+			if ((idx > 0U) && bvt_before((struct sched_bvt_data *)last->data,
+						rq_data(bvt_ctl, (idx - 1U) >> 1U))) {
+				rq_sift_up(bvt_ctl, idx);
+			} else {
+				rq_sift_down(bvt_ctl, idx);
 			}
 		}
-		if (!is_inqueue(obj)) {
-			list_add_tail(&data->list, &bvt_ctl->runqueue);
-		}
+		bvt_ctl->runqueue[bvt_ctl->nr_runnable] = NULL;
 	}
 }
 
 /*
+ * @brief Re-key a runnable thread after its evt grew, it can only move down.
  * @pre obj != NULL
  * @pre obj->data != NULL
  */
-static void runqueue_remove(struct thread_object *obj)
+static void runqueue_update(struct thread_object *obj)
 {
+	struct sched_bvt_control *bvt_ctl =
+		(struct sched_bvt_control *)obj->sched_ctl->priv;
 	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
 
-	list_del_init(&data->list);
+	if (is_inqueue(obj)) {
+		/* a re-keyed thread goes behind the others with the same evt */
+		data->rq_seq = bvt_ctl->seq++;
+		rq_sift_down(bvt_ctl, data->rq_index);
+	}
 }
 
 /*
@@ -166,7 +249,7 @@ static void sched_tick_handler(void *param)
 		if (!is_idle_thread(current)) {
 			make_reschedule_request(pcpu_id);
 		} else {
-			if (!list_empty(&bvt_ctl->runqueue)) {
+			if (bvt_ctl->nr_runnable != 0U) {
 				make_reschedule_request(pcpu_id);
 			}
 		}
@@ -185,7 +268,8 @@ static int sched_bvt_init(struct sched_control *ctl)
 	ASSERT(ctl->pcpu_id == get_pcpu_id(), "Init scheduler on wrong CPU!");
 
 	ctl->priv = bvt_ctl;
-	INIT_LIST_HEAD(&bvt_ctl->runqueue);
+	bvt_ctl->nr_runnable = 0U;
+	bvt_ctl->seq = 0UL;
 
 	/* The tick_timer is periodically */
 	initialize_timer(&bvt_ctl->tick_timer, sched_tick_handler, ctl, 0, 0);
@@ -204,7 +288,8 @@ static void sched_bvt_init_data(struct thread_object *obj, struct sched_params *
 	struct sched_bvt_data *data;
 
 	data = (struct sched_bvt_data *)obj->data;
-	INIT_LIST_HEAD(&data->list);
+	data->rq_index = BVT_INVALID_RQ_INDEX;
+	data->rq_seq = 0UL;
 	data->mcu = BVT_MCU_MS * TICKS_PER_MS;
 	data->weight = clamp(params->bvt_weight, BVT_WEIGHT_MIN, BVT_WEIGHT_MAX);
 	data->warp_value = params->bvt_warp_value;
@@ -213,6 +298,7 @@ static void sched_bvt_init_data(struct thread_object *obj, struct sched_params *
 	data->warp_on = false;	/* warp disabled by default */
 	data->vt_ratio = BVT_VT_RATIO_MAX / data->weight;
 	data->residual = 0U;
+	data->cosched_slice = 0UL;
 }
 
 static void sched_bvt_suspend(struct sched_control *ctl)
@@ -248,24 +334,135 @@ static void update_vt(struct thread_object *obj)
 	/* TODO: evt = avt - (warp ? warpback : 0U) */
 	data->evt = data->avt;
 
-	if (is_inqueue(obj)) {
-		runqueue_remove(obj);
-		runqueue_add(obj);
+	runqueue_update(obj);
+}
+
+/*
+ * @brief Put a runnable thread at the head of the runqueue for one pick.
+ *
+ * Only evt is lowered, avt is not charged, so the boost is undone by the
+ * next update_vt() of this thread.
+ */
+static void sched_bvt_prioritize(struct thread_object *obj)
+{
+	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)obj->sched_ctl->priv;
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+
+	if (is_inqueue(obj) && (data->rq_index != 0U)) {
+		data->evt = rq_data(bvt_ctl, 0U)->evt - 1;
+		rq_sift_up(bvt_ctl, data->rq_index);
+	}
+}
+
+/*
+ * @brief Move queued gang members ahead once their gang has been running
+ * without them for longer than the tolerated skew.
+ *
+ * A member is moved ahead at most once per gang slice, so a gang can't take
+ * more than one context switch allowance from the other threads of a pCPU
+ * before it is charged as usual.
+ *
+ * @return TSC at which the next queued member is due, UINT64_MAX if none.
+ */
+static uint64_t bvt_cosched_catch_up(struct sched_bvt_control *bvt_ctl, uint64_t now_tsc)
+{
+	struct thread_object *obj;
+	struct sched_bvt_data *data;
+	struct sched_gang *gang;
+	uint64_t slice_start, due, next_due = UINT64_MAX;
+	uint32_t i;
+
+	for (i = 0U; i < bvt_ctl->nr_runnable; i++) {
+		obj = bvt_ctl->runqueue[i];
+		data = (struct sched_bvt_data *)obj->data;
+		gang = obj->gang;
+		if ((gang != NULL) && (gang->running_mask != 0UL) &&
+				!bitmap_test(obj->gang_member, &gang->running_mask)) {
+			slice_start = gang->slice_start;
+			due = slice_start + gang->skew_limit;
+			if (data->cosched_slice == slice_start) {
+				/* already moved ahead in this gang slice */
+			} else if (now_tsc >= due) {
+				data->cosched_slice = slice_start;
+				if (i != 0U) {
+					sched_bvt_prioritize(obj);
+					gang->stat[obj->gang_member].boosts++;
+				}
+			} else if (due < next_due) {
+				next_due = due;
+			}
+		}
+	}
+
+	return next_due;
+}
+
+/*
+ * @brief Track the gang slices across a switch from current to next.
+ *
+ * The first member to run opens a gang slice and kicks the pCPUs of its
+ * runnable siblings, which then catch up in bvt_cosched_catch_up(). The tick
+ * of a sibling of a strict gang is aligned to the tick of the first member so
+ * that the whole gang is preempted at once.
+ *
+ * @return TSC of the next tick of this pCPU, UINT64_MAX if none.
+ */
+static uint64_t bvt_cosched_switch(const struct thread_object *current, struct thread_object *next,
+		uint64_t now_tsc, uint64_t tick_tsc)
+{
+	struct sched_gang *gang;
+	struct sched_gang_stat *stat;
+	struct thread_object *member;
+	uint64_t skew, next_tick = tick_tsc;
+	uint16_t i;
+
+	if (current->gang != NULL) {
+		bitmap_clear_lock(current->gang_member, &current->gang->running_mask);
+	}
+
+	gang = next->gang;
+	if (gang != NULL) {
+		if (gang->running_mask == 0UL) {
+			gang->slice_start = now_tsc;
+			gang->slice_end = tick_tsc;
+			bitmap_set_lock(next->gang_member, &gang->running_mask);
+			for (i = 0U; i < gang->nr_members; i++) {
+				member = gang->members[i];
+				if ((member != next) && (member->status == THREAD_STS_RUNNABLE)) {
+					make_reschedule_request(member->pcpu_id);
+				}
+			}
+		} else {
+			bitmap_set_lock(next->gang_member, &gang->running_mask);
+			skew = now_tsc - gang->slice_start;
+			stat = &gang->stat[next->gang_member];
+			stat->joins++;
+			stat->skew_total += skew;
+			if (skew > stat->skew_max) {
+				stat->skew_max = skew;
+			}
+			if ((gang->mode == COSCHED_STRICT) && (gang->slice_end > now_tsc) &&
+					(gang->slice_end < next_tick)) {
+				next_tick = gang->slice_end;
+			}
+		}
 	}
+
+	return next_tick;
 }
 
 static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 {
 	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
-	struct thread_object *first_obj = NULL, *second_obj = NULL;
+	struct thread_object *first_obj = NULL;
 	struct sched_bvt_data *first_data = NULL, *second_data = NULL;
-	struct list_head *first, *sec;
 	struct thread_object *next = NULL;
 	struct thread_object *current = ctl->curr_obj;
 	uint64_t now_tsc = cpu_ticks();
 	uint64_t delta_mcu = 0U;
 	uint64_t tick_period = BVT_MCU_MS * TICKS_PER_MS;
 	uint64_t run_countdown;
+	uint64_t tick_tsc = UINT64_MAX, catch_up_tsc;
 
 	if (!is_idle_thread(current)) {
 		update_vt(current);
@@ -275,22 +472,27 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 
 	del_timer(&bvt_ctl->tick_timer);
 
-	if (!list_empty(&bvt_ctl->runqueue)) {
-		first = bvt_ctl->runqueue.next;
-		sec = (first->next == &bvt_ctl->runqueue) ? NULL : first->next;
+	catch_up_tsc = bvt_cosched_catch_up(bvt_ctl, now_tsc);
 
-		first_obj = container_of(first, struct thread_object, data);
+	if (bvt_ctl->nr_runnable != 0U) {
+		first_obj = bvt_ctl->runqueue[0];
 		first_data = (struct sched_bvt_data *)first_obj->data;
 
+		/* the second earliest evt is one of the children of the heap root */
+		if (bvt_ctl->nr_runnable > 1U) {
+			second_data = rq_data(bvt_ctl, 1U);
+			if ((bvt_ctl->nr_runnable > 2U) && bvt_before(rq_data(bvt_ctl, 2U), second_data)) {
+				second_data = rq_data(bvt_ctl, 2U);
+			}
+		}
+
 		/* The run_countdown is used to describe how may mcu the next thread
 		 * can run for. A one-shot timer is set to expire at
 		 * current time + run_countdown. The next thread can run until the
 		 * timer interrupts. But when there is only one object
 		 * in runqueue, it can run forever. so, no timer is set.
 		 */
-		if (sec != NULL) {
-			second_obj = container_of(sec, struct thread_object, data);
-			second_data = (struct sched_bvt_data *)second_obj->data;
+		if (second_data != NULL) {
 			delta_mcu = second_data->evt - first_data->evt;
 			run_countdown = v2p(delta_mcu, first_data->vt_ratio) + BVT_CSA_MCU;
 		} else {
@@ -299,13 +501,31 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		first_data->start_tsc = now_tsc;
 		next = first_obj;
 		if (run_countdown != UINT64_MAX) {
-			update_timer(&bvt_ctl->tick_timer, cpu_ticks() + run_countdown * tick_period, 0);
-			(void)add_timer(&bvt_ctl->tick_timer);
+			tick_tsc = cpu_ticks() + run_countdown * tick_period;
 		}
 	} else {
 		next = &get_cpu_var(idle);
 	}
 
+	if (next != current) {
+		tick_tsc = bvt_cosched_switch(current, next, now_tsc, tick_tsc);
+	}
+	/* wake up when a queued gang member is due to catch up with its gang */
+	tick_tsc = min(tick_tsc, catch_up_tsc);
+	if (tick_tsc != UINT64_MAX) {
+		update_timer(&bvt_ctl->tick_timer, tick_tsc, 0);
+		(void)add_timer(&bvt_ctl->tick_timer);
+		sched_tick_start(ctl, tick_period);
+	} else {
+		/* a single runnable thread or the idle thread runs tickless until the next wake */
+		sched_tick_stop(ctl);
+	}
+
+#ifdef HV_DEBUG
+	bvt_ctl->pick_stat[bvt_ctl->nr_runnable].count++;
+	bvt_ctl->pick_stat[bvt_ctl->nr_runnable].cycles += cpu_ticks() - now_tsc;
+#endif
+
 	return next;
 }
 
@@ -338,6 +558,7 @@ struct acrn_scheduler sched_bvt = {
 	.pick_next	= sched_bvt_pick_next,
 	.sleep		= sched_bvt_sleep,
 	.wake		= sched_bvt_wake,
+	.prioritize	= sched_bvt_prioritize,
 	.deinit		= sched_bvt_deinit,
 	/* Now suspend is just to do del_timer and add_timer will be delayed to
 	 * shedule after resume.
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <rtl.h>
+#include <list.h>
+#include <asm/per_cpu.h>
+#include <schedule.h>
+#include <ticks.h>
+#include <logmsg.h>
+
+/*
+ * Earliest Deadline First over Constant Bandwidth Servers.
+ *
+ * A thread with a reservation (budget, period) is a server: it may run for
+ * budget in each period, ahead of the threads without one, the runnable
+ * servers in the order of their deadlines. A server which used up its budget
+ * is throttled until its deadline, where it gets its budget back for the next
+ * period. A server woken up with more budget left than its bandwidth allows
+ * until its deadline starts a new period, so that a thread can't save budget
+ * by sleeping and take more than its bandwidth later (the CBS wake-up rule).
+ *
+ * The time the servers leave, because they block early or have no work, goes
+ * to the best-effort threads, round robin; on a pCPU that is otherwise idle,
+ * a throttled server runs past its budget until its replenishment.
+ *
+ * The bandwidth reserved on a pCPU is admitted up to EDF_BW_MAX, the rest is
+ * left to the best-effort threads.
+ */
+
+/* bandwidth in parts per million of a pCPU */
+#define EDF_BW_UNIT		1000000UL
+#define EDF_BW_MAX		(EDF_BW_UNIT * 95UL / 100UL)
+/* the time slice of the best-effort threads */
+#define EDF_BE_SLICE_MS		10UL
+
+struct sched_edf_data {
+	/* keep list as the first item */
+	struct list_head list;
+
+	/* the reservation in TSC ticks, budget 0 for a best-effort thread */
+	uint64_t budget;
+	uint64_t period;
+	uint64_t bw;
+	/* absolute deadline of the current period and the budget left in it */
+	uint64_t deadline;
+	int64_t runtime;
+	bool throttled;
+	/* picked past its budget, on a pCPU with nothing else to run */
+	bool background;
+
+	uint64_t start_tsc;
+	struct sched_edf_stat stat;
+};
+
+static inline struct sched_edf_data *edf_data(const struct thread_object *obj)
+{
+	return (struct sched_edf_data *)obj->data;
+}
+
+static inline bool is_server(const struct sched_edf_data *data)
+{
+	return (data->budget != 0UL);
+}
+
+/*
+ * @pre params != NULL
+ * @return bandwidth of the reservation of params, 0 if it has none or an invalid one
+ */
+static uint64_t edf_params_bw(const struct sched_params *params)
+{
+	uint64_t bw = 0UL;
+
+	if ((params->edf_budget_us != 0U) && (params->edf_budget_us <= params->edf_period_us)) {
+		bw = ((uint64_t)params->edf_budget_us * EDF_BW_UNIT) / params->edf_period_us;
+	}
+
+	return bw;
+}
+
+/* insert in deadline order, behind the threads with the same deadline */
+static void edf_queue_add(struct list_head *queue, struct thread_object *obj)
+{
+	struct sched_edf_data *data = edf_data(obj);
+	struct sched_edf_data *iter_data;
+	struct list_head *pos;
+
+	list_for_each(pos, queue) {
+		iter_data = container_of(pos, struct sched_edf_data, list);
+		if (iter_data->deadline > data->deadline) {
+			list_add_node(&data->list, pos->prev, pos);
+			break;
+		}
+	}
+	if (list_empty(&data->list)) {
+		list_add_tail(&data->list, queue);
+	}
+}
+
+/*
+ * @pre obj != NULL
+ * @pre obj->sched_ctl->priv != NULL
+ */
+static void runqueue_add(struct thread_object *obj)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)obj->sched_ctl->priv;
+	struct sched_edf_data *data = edf_data(obj);
+
+	if (list_empty(&data->list)) {
+		if (!is_server(data)) {
+			list_add_tail(&data->list, &edf_ctl->be_queue);
+		} else if (data->throttled) {
+			edf_queue_add(&edf_ctl->throttled_queue, obj);
+		} else {
+			edf_queue_add(&edf_ctl->edf_queue, obj);
+		}
+	}
+}
+
+static void runqueue_remove(struct thread_object *obj)
+{
+	list_del_init(&edf_data(obj)->list);
+}
+
+/* a new period: the deadline is moved on and the budget is given back */
+static void edf_replenish(struct sched_edf_data *data, uint64_t now)
+{
+	data->deadline += data->period;
+	if (data->deadline <= now) {
+		data->deadline = now + data->period;
+	}
+	data->runtime = (int64_t)data->budget;
+	data->throttled = false;
+	data->stat.replenishes++;
+}
+
+/*
+ * @brief Charge the current thread, throttle it once its budget is used up.
+ */
+static void edf_charge(struct sched_edf_control *edf_ctl, struct thread_object *obj, uint64_t now)
+{
+	struct sched_edf_data *data = edf_data(obj);
+
+	if (is_server(data) && !data->background && (now > data->start_tsc)) {
+		data->runtime -= (int64_t)(now - data->start_tsc);
+		if ((data->runtime <= 0) && !list_empty(&data->list)) {
+			list_del_init(&data->list);
+			data->throttled = true;
+			data->stat.throttles++;
+			edf_queue_add(&edf_ctl->throttled_queue, obj);
+		}
+	}
+}
+
+/*
+ * @brief Give the throttled servers whose deadline passed their next period,
+ * and account the servers that reached their deadline with budget left.
+ *
+ * @return TSC of the next replenishment, UINT64_MAX if none.
+ */
+static uint64_t edf_update_queues(struct sched_edf_control *edf_ctl, uint64_t now)
+{
+	struct list_head *pos, *n;
+	struct sched_edf_data *data;
+	struct thread_object *obj;
+
+	list_for_each_safe(pos, n, &edf_ctl->throttled_queue) {
+		data = container_of(pos, struct sched_edf_data, list);
+		if (data->deadline > now) {
+			break;
+		}
+		list_del_init(&data->list);
+		edf_replenish(data, now);
+		obj = container_of((void *)data, struct thread_object, data);
+		edf_queue_add(&edf_ctl->edf_queue, obj);
+	}
+
+	/* runnable all along, the budget wasn't delivered by the deadline */
+	list_for_each_safe(pos, n, &edf_ctl->edf_queue) {
+		data = container_of(pos, struct sched_edf_data, list);
+		if (data->deadline > now) {
+			break;
+		}
+		list_del_init(&data->list);
+		data->stat.deadline_misses++;
+		edf_replenish(data, now);
+		obj = container_of((void *)data, struct thread_object, data);
+		edf_queue_add(&edf_ctl->edf_queue, obj);
+	}
+
+	if (list_empty(&edf_ctl->throttled_queue)) {
+		return UINT64_MAX;
+	}
+	data = container_of(edf_ctl->throttled_queue.next, struct sched_edf_data, list);
+	return data->deadline;
+}
+
+static void sched_tick_handler(void *param)
+{
+	struct sched_control *ctl = (struct sched_control *)param;
+	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t rflags;
+
+	obtain_schedule_lock(pcpu_id, &rflags);
+	if (ctl->curr_obj != NULL) {
+		make_reschedule_request(pcpu_id);
+	}
+	release_schedule_lock(pcpu_id, rflags);
+}
+
+/*
+ * @pre ctl->pcpu_id == get_pcpu_id()
+ */
+static int sched_edf_init(struct sched_control *ctl)
+{
+	struct sched_edf_control *edf_ctl = &per_cpu(sched_edf_ctl, ctl->pcpu_id);
+
+	ASSERT(ctl->pcpu_id == get_pcpu_id(), "Init scheduler on wrong CPU!");
+
+	ctl->priv = edf_ctl;
+	INIT_LIST_HEAD(&edf_ctl->edf_queue);
+	INIT_LIST_HEAD(&edf_ctl->throttled_queue);
+	INIT_LIST_HEAD(&edf_ctl->be_queue);
+	edf_ctl->reserved_bw = 0UL;
+	initialize_timer(&edf_ctl->tick_timer, sched_tick_handler, ctl, 0, 0);
+
+	return 0;
+}
+
+static void sched_edf_deinit(struct sched_control *ctl)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)ctl->priv;
+
+	del_timer(&edf_ctl->tick_timer);
+}
+
+static bool sched_edf_admit(struct sched_control *ctl, const struct sched_params *params)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)ctl->priv;
+	bool admitted = true;
+
+	if ((params->edf_budget_us != 0U) && (params->edf_budget_us > params->edf_period_us)) {
+		admitted = false;
+	} else if ((edf_ctl->reserved_bw + edf_params_bw(params)) > EDF_BW_MAX) {
+		admitted = false;
+	}
+
+	return admitted;
+}
+
+/*
+ * The reservation is taken here, admitted again in case another VM took the
+ * bandwidth since sched_edf_admit(); a thread it doesn't fit runs best-effort.
+ */
+static void sched_edf_init_data(struct thread_object *obj, struct sched_params *params)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)obj->sched_ctl->priv;
+	struct sched_edf_data *data = edf_data(obj);
+	uint64_t bw = edf_params_bw(params);
+
+	(void)memset((void *)data, 0U, sizeof(*data));
+	INIT_LIST_HEAD(&data->list);
+	if (bw != 0UL) {
+		if ((edf_ctl->reserved_bw + bw) <= EDF_BW_MAX) {
+			data->budget = us_to_ticks(params->edf_budget_us);
+			data->period = us_to_ticks(params->edf_period_us);
+			data->bw = bw;
+			edf_ctl->reserved_bw += bw;
+		} else {
+			pr_err("%s: %s: no bandwidth left on pCPU%hu, runs best-effort",
+					__func__, obj->name, obj->pcpu_id);
+		}
+	}
+}
+
+static void sched_edf_deinit_data(struct thread_object *obj)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)obj->sched_ctl->priv;
+	struct sched_edf_data *data = edf_data(obj);
+
+	runqueue_remove(obj);
+	edf_ctl->reserved_bw -= data->bw;
+	data->budget = 0UL;
+	data->bw = 0UL;
+}
+
+static struct thread_object *sched_edf_pick_next(struct sched_control *ctl)
+{
+	struct sched_edf_control *edf_ctl = (struct sched_edf_control *)ctl->priv;
+	struct thread_object *current = ctl->curr_obj;
+	struct thread_object *next;
+	struct sched_edf_data *data;
+	uint64_t now = cpu_ticks();
+	uint64_t tick_tsc, be_slice = EDF_BE_SLICE_MS * TICKS_PER_MS;
+
+	if ((current != NULL) && !is_idle_thread(current)) {
+		edf_charge(edf_ctl, current, now);
+		data = edf_data(current);
+		/* a preempted best-effort thread goes behind the others */
+		if (!is_server(data) && !list_empty(&data->list)) {
+			list_del_init(&data->list);
+			list_add_tail(&data->list, &edf_ctl->be_queue);
+		}
+	}
+
+	del_timer(&edf_ctl->tick_timer);
+	tick_tsc = edf_update_queues(edf_ctl, now);
+
+	if (!list_empty(&edf_ctl->edf_queue)) {
+		next = get_first_item(&edf_ctl->edf_queue, struct thread_object, data);
+		data = edf_data(next);
+		data->background = false;
+		/* preempted when its budget is used up, or by an earlier replenishment */
+		tick_tsc = min(tick_tsc, now + (uint64_t)data->runtime);
+	} else if (!list_empty(&edf_ctl->be_queue)) {
+		next = get_first_item(&edf_ctl->be_queue, struct thread_object, data);
+		if (edf_ctl->be_queue.next->next != &edf_ctl->be_queue) {
+			tick_tsc = min(tick_tsc, now + be_slice);
+		}
+	} else if (!list_empty(&edf_ctl->throttled_queue)) {
+		/* runs in the background until its replenishment, uncharged */
+		next = get_first_item(&edf_ctl->throttled_queue, struct thread_object, data);
+		edf_data(next)->background = true;
+	} else {
+		next = &get_cpu_var(idle);
+	}
+
+	if (!is_idle_thread(next)) {
+		edf_data(next)->start_tsc = now;
+	}
+
+	if (tick_tsc != UINT64_MAX) {
+		update_timer(&edf_ctl->tick_timer, tick_tsc, 0);
+		(void)add_timer(&edf_ctl->tick_timer);
+		sched_tick_start(ctl, be_slice);
+	} else {
+		/* a single runnable thread or the idle thread runs tickless until the next wake */
+		sched_tick_stop(ctl);
+	}
+
+	return next;
+}
+
+static void sched_edf_sleep(struct thread_object *obj)
+{
+	runqueue_remove(obj);
+}
+
+/*
+ * The CBS wake-up rule: the budget left is kept only if it doesn't exceed
+ * the bandwidth of the server until its deadline, otherwise a new period
+ * starts now.
+ */
+static void sched_edf_wake(struct thread_object *obj)
+{
+	struct sched_edf_data *data = edf_data(obj);
+	uint64_t now = cpu_ticks();
+
+	if (is_server(data) && !data->throttled) {
+		if ((data->deadline <= now) || ((data->runtime > 0) &&
+				(((uint64_t)data->runtime * data->period) >
+				 ((data->deadline - now) * data->budget)))) {
+			data->deadline = now + data->period;
+			data->runtime = (int64_t)data->budget;
+		} else if (data->runtime <= 0) {
+			/* used up before it slept, waits for the deadline */
+			data->throttled = true;
+		}
+	}
+	runqueue_add(obj);
+}
+
+/*
+ * @return false if obj has no reservation, its counters in stat otherwise
+ */
+bool sched_edf_get_stat(const struct thread_object *obj, uint32_t *budget_us, uint32_t *period_us,
+		struct sched_edf_stat *stat)
+{
+	const struct sched_edf_data *data = edf_data(obj);
+
+	if (is_server(data)) {
+		*budget_us = (uint32_t)ticks_to_us(data->budget);
+		*period_us = (uint32_t)ticks_to_us(data->period);
+		*stat = data->stat;
+	}
+
+	return is_server(data);
+}
+
+struct acrn_scheduler sched_edf = {
+	.name		= "sched_edf",
+	.init		= sched_edf_init,
+	.admit		= sched_edf_admit,
+	.init_data	= sched_edf_init_data,
+	.pick_next	= sched_edf_pick_next,
+	.sleep		= sched_edf_sleep,
+	.wake		= sched_edf_wake,
+	.deinit_data	= sched_edf_deinit_data,
+	.deinit		= sched_edf_deinit,
+	/* as sched_bvt, the timer is added back by the next pick_next */
+	.suspend	= sched_edf_deinit,
+};
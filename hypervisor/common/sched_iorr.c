@@ -10,6 +10,18 @@
 #include <ticks.h>
 
 #define CONFIG_SLICE_MS 10UL
+/*
+ * A thread is classified by how long it runs on average before it blocks:
+ * the I/O-bound ones are queued at the head when they wake up, with a short
+ * slice, the CPU-bound ones at the tail, with a long slice to switch less.
+ */
+#define IORR_IO_SLICE_MS	5UL
+#define IORR_CPU_SLICE_MS	20UL
+#define IORR_IO_BOUND_US	500UL
+#define IORR_CPU_BOUND_US	(CONFIG_SLICE_MS * 1000UL / 2UL)
+/* the last run weighs 1/8 in the average run length */
+#define IORR_RUN_AVG_SHIFT	3U
+
 struct sched_iorr_data {
 	/* keep list as the first item */
 	struct list_head list;
@@ -17,8 +29,46 @@ struct sched_iorr_data {
 	uint64_t slice_cycles;
 	uint64_t last_cycles;
 	int64_t  left_cycles;
+
+	uint64_t run_cycles;		/* run since the last wake or used up slice */
+	uint64_t avg_run_cycles;
+	enum sched_iorr_class class;
+	uint64_t blocks;
+	uint64_t expiries;
 };
 
+static void iorr_charge(struct sched_iorr_data *data, uint64_t now)
+{
+	data->left_cycles -= (int64_t)(now - data->last_cycles);
+	data->run_cycles += now - data->last_cycles;
+	data->last_cycles = now;
+}
+
+/* end of a run, on block or on a used up slice: reclassify the thread */
+static void iorr_end_run(struct sched_iorr_data *data)
+{
+	uint64_t avg_us;
+
+	data->avg_run_cycles = data->avg_run_cycles - (data->avg_run_cycles >> IORR_RUN_AVG_SHIFT) +
+			(data->run_cycles >> IORR_RUN_AVG_SHIFT);
+	data->run_cycles = 0UL;
+
+	avg_us = ticks_to_us(data->avg_run_cycles);
+	if (avg_us < IORR_IO_BOUND_US) {
+		data->class = IORR_CLASS_IO;
+		data->slice_cycles = IORR_IO_SLICE_MS * TICKS_PER_MS;
+	} else if (avg_us >= IORR_CPU_BOUND_US) {
+		data->class = IORR_CLASS_CPU;
+		data->slice_cycles = IORR_CPU_SLICE_MS * TICKS_PER_MS;
+	} else {
+		data->class = IORR_CLASS_NORMAL;
+		data->slice_cycles = CONFIG_SLICE_MS * TICKS_PER_MS;
+	}
+	if (data->left_cycles > (int64_t)data->slice_cycles) {
+		data->left_cycles = (int64_t)data->slice_cycles;
+	}
+}
+
 /*
  * @pre obj != NULL
  * @pre obj->data != NULL
@@ -89,8 +139,7 @@ static void sched_tick_handler(void *param)
 			data = (struct sched_iorr_data *)current->data;
 			/* consume the left_cycles of current thread_object if it is not idle */
 			if (!is_idle_thread(current)) {
-				data->left_cycles -= now - data->last_cycles;
-				data->last_cycles = now;
+				iorr_charge(data, now);
 			}
 			/* make reschedule request if current ran out of its cycles */
 			if (is_idle_thread(current) || data->left_cycles <= 0) {
@@ -110,6 +159,8 @@ int sched_iorr_add_timer(struct sched_control *ctl)
 	/* The tick_timer is periodically */
 	initialize_timer(&iorr_ctl->tick_timer, sched_tick_handler, ctl,
 			cpu_ticks() + tick_period, tick_period);
+	iorr_ctl->tick_stopped = false;
+	sched_tick_start(ctl, tick_period);
 
 	if (add_timer(&iorr_ctl->tick_timer) < 0) {
 		pr_err("Failed to add schedule tick timer!");
@@ -160,6 +211,12 @@ void sched_iorr_init_data(struct thread_object *obj, __unused struct sched_param
 	data = (struct sched_iorr_data *)obj->data;
 	INIT_LIST_HEAD(&data->list);
 	data->left_cycles = data->slice_cycles = CONFIG_SLICE_MS * TICKS_PER_MS;
+	data->run_cycles = 0UL;
+	/* a new thread starts in the middle of the normal class */
+	data->avg_run_cycles = us_to_ticks((uint32_t)((IORR_IO_BOUND_US + IORR_CPU_BOUND_US) / 2UL));
+	data->class = IORR_CLASS_NORMAL;
+	data->blocks = 0UL;
+	data->expiries = 0UL;
 }
 
 static struct thread_object *sched_iorr_pick_next(struct sched_control *ctl)
@@ -174,8 +231,11 @@ static struct thread_object *sched_iorr_pick_next(struct sched_control *ctl)
 	data = (struct sched_iorr_data *)current->data;
 	/* Ignore the idle object, inactive objects */
 	if (!is_idle_thread(current) && is_inqueue(current)) {
-		data->left_cycles -= now - data->last_cycles;
+		iorr_charge(data, now);
 		if (data->left_cycles <= 0) {
+			/* a used up slice ends a run as a block does */
+			data->expiries++;
+			iorr_end_run(data);
 			/*  replenish thread_object with slice_cycles */
 			data->left_cycles += data->slice_cycles;
 		}
@@ -201,17 +261,76 @@ static struct thread_object *sched_iorr_pick_next(struct sched_control *ctl)
 		next = &get_cpu_var(idle);
 	}
 
+	/*
+	 * The tick only preempts threads that have someone to share the pCPU
+	 * with. Stop it while there is at most one runnable thread, the next
+	 * wake_thread() reschedules this pCPU and restarts it.
+	 */
+	if (list_empty(&iorr_ctl->runqueue) || (iorr_ctl->runqueue.next == iorr_ctl->runqueue.prev)) {
+		if (!iorr_ctl->tick_stopped) {
+			del_timer(&iorr_ctl->tick_timer);
+			iorr_ctl->tick_stopped = true;
+			sched_tick_stop(ctl);
+		}
+	} else if (iorr_ctl->tick_stopped) {
+		update_timer(&iorr_ctl->tick_timer, now + TICKS_PER_MS, TICKS_PER_MS);
+		(void)add_timer(&iorr_ctl->tick_timer);
+		iorr_ctl->tick_stopped = false;
+		sched_tick_start(ctl, TICKS_PER_MS);
+	} else {
+		/* the tick is running */
+	}
+
 	return next;
 }
 
 static void sched_iorr_sleep(struct thread_object *obj)
 {
+	struct sched_iorr_data *data = (struct sched_iorr_data *)obj->data;
+
+	if (is_inqueue(obj)) {
+		if (obj == obj->sched_ctl->curr_obj) {
+			iorr_charge(data, cpu_ticks());
+		}
+		data->blocks++;
+		iorr_end_run(data);
+	}
 	runqueue_remove(obj);
 }
 
 static void sched_iorr_wake(struct thread_object *obj)
 {
-	runqueue_add_head(obj);
+	struct sched_iorr_data *data = (struct sched_iorr_data *)obj->data;
+
+	if (data->class == IORR_CLASS_CPU) {
+		runqueue_add_tail(obj);
+	} else {
+		runqueue_add_head(obj);
+	}
+}
+
+static void sched_iorr_prioritize(struct thread_object *obj)
+{
+	if (is_inqueue(obj)) {
+		runqueue_remove(obj);
+		runqueue_add_head(obj);
+	}
+}
+
+bool sched_iorr_get_stat(const struct thread_object *obj, struct sched_iorr_stat *stat)
+{
+	const struct sched_iorr_data *data = (const struct sched_iorr_data *)obj->data;
+	bool ret = (obj->sched_ctl != NULL) && (obj->sched_ctl->scheduler == &sched_iorr);
+
+	if (ret) {
+		stat->class = data->class;
+		stat->slice_us = ticks_to_us(data->slice_cycles);
+		stat->avg_run_us = ticks_to_us(data->avg_run_cycles);
+		stat->blocks = data->blocks;
+		stat->expiries = data->expiries;
+	}
+
+	return ret;
 }
 
 struct acrn_scheduler sched_iorr = {
@@ -221,6 +340,7 @@ struct acrn_scheduler sched_iorr = {
 	.pick_next	= sched_iorr_pick_next,
 	.sleep		= sched_iorr_sleep,
 	.wake		= sched_iorr_wake,
+	.prioritize	= sched_iorr_prioritize,
 	.deinit		= sched_iorr_deinit,
 	.suspend	= sched_iorr_suspend,
 	.resume		= sched_iorr_resume,
@@ -14,6 +14,9 @@
 #include <sprintf.h>
 #include <asm/irq.h>
 #include <trace.h>
+#include <ticks.h>
+#include <errno.h>
+#include <logmsg.h>
 
 bool is_idle_thread(const struct thread_object *obj)
 {
@@ -48,6 +51,26 @@ void release_schedule_lock(uint16_t pcpu_id, uint64_t rflag)
 	spinlock_irqrestore_release(&ctl->scheduler_lock, rflag);
 }
 
+/*
+ * Lock the scheduler of the pCPU obj is on. The pCPU of a migratable thread
+ * only stays stable while the scheduler lock of that pCPU is held.
+ *
+ * @return the pCPU ID whose scheduler lock is held
+ */
+static uint16_t obtain_thread_lock(const struct thread_object *obj, uint64_t *rflag)
+{
+	uint16_t pcpu_id = obj->pcpu_id;
+
+	obtain_schedule_lock(pcpu_id, rflag);
+	while (obj->pcpu_id != pcpu_id) {
+		release_schedule_lock(pcpu_id, *rflag);
+		pcpu_id = obj->pcpu_id;
+		obtain_schedule_lock(pcpu_id, rflag);
+	}
+
+	return pcpu_id;
+}
+
 static struct acrn_scheduler *get_scheduler(uint16_t pcpu_id)
 {
 	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
@@ -73,6 +96,7 @@ void init_sched(uint16_t pcpu_id)
 	ctl->flags = 0UL;
 	ctl->curr_obj = NULL;
 	ctl->pcpu_id = pcpu_id;
+	ctl->migrate_obj = NULL;
 #ifdef CONFIG_SCHED_NOOP
 	ctl->scheduler = &sched_noop;
 #endif
@@ -84,6 +108,9 @@ void init_sched(uint16_t pcpu_id)
 #endif
 #ifdef CONFIG_SCHED_PRIO
 	ctl->scheduler = &sched_prio;
+#endif
+#ifdef CONFIG_SCHED_EDF
+	ctl->scheduler = &sched_edf;
 #endif
 	if (ctl->scheduler->init != NULL) {
 		ctl->scheduler->init(ctl);
@@ -117,6 +144,38 @@ void resume_sched(void)
 	}
 }
 
+/*
+ * @brief Admission control of the threads of a VM, one on each pCPU of
+ * pcpu_bitmap, before they are created.
+ *
+ * @return 0 if the scheduler of each pCPU admits a thread of params,
+ * -EBUSY otherwise
+ */
+int32_t sched_admit(uint64_t pcpu_bitmap, const struct sched_params *params)
+{
+	struct sched_control *ctl;
+	uint64_t mask = pcpu_bitmap, rflag;
+	uint16_t pcpu_id;
+	int32_t ret = 0;
+
+	pcpu_id = ffs64(mask);
+	while ((pcpu_id < MAX_PCPU_NUM) && (ret == 0)) {
+		bitmap_clear_nolock(pcpu_id, &mask);
+		ctl = &per_cpu(sched_ctl, pcpu_id);
+		if (ctl->scheduler->admit != NULL) {
+			obtain_schedule_lock(pcpu_id, &rflag);
+			if (!ctl->scheduler->admit(ctl, params)) {
+				pr_err("%s: the scheduler of pCPU%hu can't admit the thread", __func__, pcpu_id);
+				ret = -EBUSY;
+			}
+			release_schedule_lock(pcpu_id, rflag);
+		}
+		pcpu_id = ffs64(mask);
+	}
+
+	return ret;
+}
+
 void init_thread_data(struct thread_object *obj, struct sched_params *params)
 {
 	struct acrn_scheduler *scheduler = get_scheduler(obj->pcpu_id);
@@ -126,17 +185,50 @@ void init_thread_data(struct thread_object *obj, struct sched_params *params)
 	if (scheduler->init_data != NULL) {
 		scheduler->init_data(obj, params);
 	}
+	obj->runnable_tsc = 0UL;
+	obj->run_tsc = 0UL;
+	(void)memset((void *)&obj->stat, 0U, sizeof(obj->stat));
 	/* initial as BLOCKED status, so we can wake it up to run */
 	set_thread_status(obj, THREAD_STS_BLOCKED);
 	release_schedule_lock(obj->pcpu_id, rflag);
 }
 
+/*
+ * @pre gang != NULL && params != NULL
+ */
+void init_sched_gang(struct sched_gang *gang, const struct sched_params *params)
+{
+	(void)memset((void *)gang, 0U, sizeof(struct sched_gang));
+	gang->mode = params->bvt_cosched;
+	gang->skew_limit = (gang->mode == COSCHED_RELAXED) ? us_to_ticks(params->bvt_cosched_skew_us) : 0UL;
+}
+
+/*
+ * @brief Add a thread to a gang, it is a no-op if the gang is not co-scheduled.
+ *
+ * @pre gang != NULL && obj != NULL
+ * @pre obj is not running yet
+ */
+void join_sched_gang(struct sched_gang *gang, struct thread_object *obj)
+{
+	obj->gang = NULL;
+	if ((gang->mode != COSCHED_NONE) && (gang->nr_members < MAX_PCPU_NUM)) {
+		obj->gang_member = gang->nr_members;
+		gang->members[gang->nr_members] = obj;
+		gang->nr_members++;
+		obj->gang = gang;
+	}
+}
+
 void deinit_thread_data(struct thread_object *obj)
 {
 	struct acrn_scheduler *scheduler = get_scheduler(obj->pcpu_id);
+	uint64_t rflag;
 
 	if (scheduler->deinit_data != NULL) {
+		obtain_schedule_lock(obj->pcpu_id, &rflag);
 		scheduler->deinit_data(obj);
+		release_schedule_lock(obj->pcpu_id, rflag);
 	}
 }
 
@@ -146,6 +238,37 @@ struct thread_object *sched_get_current(uint16_t pcpu_id)
 	return ctl->curr_obj;
 }
 
+/*
+ * @brief Account that the scheduler stopped the tick of ctl's pCPU.
+ *
+ * @pre ctl->pcpu_id == get_pcpu_id()
+ */
+void sched_tick_stop(struct sched_control *ctl)
+{
+	struct sched_tick_stat *stat = &ctl->tick_stat;
+
+	if (stat->stop_tsc == 0UL) {
+		stat->stop_tsc = cpu_ticks();
+		stat->stops++;
+	}
+}
+
+/*
+ * @brief Account the tick periods suppressed since sched_tick_stop().
+ *
+ * @pre ctl->pcpu_id == get_pcpu_id()
+ * @pre tick_period != 0
+ */
+void sched_tick_start(struct sched_control *ctl, uint64_t tick_period)
+{
+	struct sched_tick_stat *stat = &ctl->tick_stat;
+
+	if (stat->stop_tsc != 0UL) {
+		stat->suppressed += (cpu_ticks() - stat->stop_tsc) / tick_period;
+		stat->stop_tsc = 0UL;
+	}
+}
+
 /**
  * @pre delmode == DEL_MODE_IPI || delmode == DEL_MODE_INIT
  */
@@ -166,6 +289,88 @@ bool need_reschedule(uint16_t pcpu_id)
 	return bitmap_test(NEED_RESCHEDULE, &ctl->flags);
 }
 
+/*
+ * Hand the thread requested by request_thread_migration() over to its
+ * destination pCPU. Runs on the source pCPU, so that the migrate_out
+ * callback can release the pCPU specific state of the thread here.
+ */
+static void migrate_thread(struct sched_control *ctl)
+{
+	uint16_t pcpu_id = ctl->pcpu_id, dst_pcpu_id;
+	struct sched_control *dst_ctl;
+	struct thread_object *obj;
+	uint64_t rflag;
+
+	obtain_schedule_lock(pcpu_id, &rflag);
+	obj = ctl->migrate_obj;
+	dst_pcpu_id = ctl->migrate_dst;
+	ctl->migrate_obj = NULL;
+	release_schedule_lock(pcpu_id, rflag);
+
+	if (obj != NULL) {
+		dst_ctl = &per_cpu(sched_ctl, dst_pcpu_id);
+
+		/* both scheduler locks are taken in pCPU ID order */
+		obtain_schedule_lock(min(pcpu_id, dst_pcpu_id), &rflag);
+		spinlock_obtain(&per_cpu(sched_ctl, max(pcpu_id, dst_pcpu_id)).scheduler_lock);
+		if ((obj->status == THREAD_STS_RUNNABLE) && (obj->pcpu_id == pcpu_id)) {
+			if (ctl->scheduler->sleep != NULL) {
+				ctl->scheduler->sleep(obj);
+			}
+			obj->pcpu_id = dst_pcpu_id;
+			obj->sched_ctl = dst_ctl;
+			if (obj->migrate_out != NULL) {
+				obj->migrate_out(obj);
+			}
+			if (dst_ctl->scheduler->wake != NULL) {
+				dst_ctl->scheduler->wake(obj);
+			}
+			make_reschedule_request(dst_pcpu_id);
+			TRACE_2L(TRACE_SCHED_MIGRATE, (uint64_t)pcpu_id, (uint64_t)dst_pcpu_id);
+		}
+		bitmap_clear_lock(INCOMING_MIGRATION, &dst_ctl->flags);
+		spinlock_release(&per_cpu(sched_ctl, max(pcpu_id, dst_pcpu_id)).scheduler_lock);
+		release_schedule_lock(min(pcpu_id, dst_pcpu_id), rflag);
+	}
+}
+
+static inline uint32_t sched_hist_bucket(uint64_t cycles)
+{
+	uint32_t bucket = 0U;
+
+	if (cycles >= (1UL << ACRN_SCHED_HIST_SHIFT)) {
+		bucket = min(fls64(cycles) - (ACRN_SCHED_HIST_SHIFT - 1U), ACRN_SCHED_HIST_BUCKETS - 1U);
+	}
+
+	return bucket;
+}
+
+/*
+ * @pre prev != next
+ * @pre the scheduler lock of the current pCPU is held
+ */
+static void account_thread_switch(struct thread_object *prev, struct thread_object *next, uint64_t now)
+{
+	uint64_t cycles;
+
+	if (prev != NULL) {
+		cycles = now - prev->run_tsc;
+		prev->stat.slice_total += cycles;
+		prev->stat.slice_hist[sched_hist_bucket(cycles)]++;
+		if (!prev->be_blocking) {
+			prev->stat.preemptions++;
+			prev->runnable_tsc = now;
+		}
+	}
+
+	cycles = now - next->runnable_tsc;
+	next->stat.switches++;
+	next->stat.run_delay_total += cycles;
+	next->stat.run_delay_max = max(next->stat.run_delay_max, cycles);
+	next->stat.run_delay_hist[sched_hist_bucket(cycles)]++;
+	next->run_tsc = now;
+}
+
 void schedule(void)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -175,6 +380,10 @@ void schedule(void)
 	uint64_t rflag;
 	char name[16];
 
+	if (ctl->migrate_obj != NULL) {
+		migrate_thread(ctl);
+	}
+
 	obtain_schedule_lock(pcpu_id, &rflag);
 	if (ctl->scheduler->pick_next != NULL) {
 		next = ctl->scheduler->pick_next(ctl);
@@ -183,6 +392,7 @@ void schedule(void)
 
 	/* If we picked different sched object, switch context */
 	if (prev != next) {
+		account_thread_switch(prev, next, cpu_ticks());
 		if (prev != NULL) {
 			memcpy_erms(name, prev->name, 4);
 			memcpy_erms(name + 4, next->name, 4);
@@ -210,11 +420,12 @@ void schedule(void)
 
 void sleep_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
-	struct acrn_scheduler *scheduler = get_scheduler(pcpu_id);
+	uint16_t pcpu_id;
+	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
 	if (scheduler->sleep != NULL) {
 		scheduler->sleep(obj);
 	}
@@ -235,13 +446,38 @@ void sleep_thread_sync(struct thread_object *obj)
 	}
 }
 
+/*
+ * A migratable thread woken up behind another thread kicks the idle pCPUs
+ * it may run on, so that they get a chance to pull it.
+ */
+static void kick_idle_pcpus(const struct thread_object *obj)
+{
+	uint64_t mask = obj->migrate_mask;
+	struct thread_object *curr = sched_get_current(obj->pcpu_id);
+	uint16_t pcpu_id;
+
+	if ((mask != 0UL) && (curr != NULL) && !is_idle_thread(curr)) {
+		bitmap_clear_nolock(obj->pcpu_id, &mask);
+		pcpu_id = ffs64(mask);
+		while (pcpu_id < MAX_PCPU_NUM) {
+			bitmap_clear_nolock(pcpu_id, &mask);
+			curr = sched_get_current(pcpu_id);
+			if ((curr != NULL) && is_idle_thread(curr)
+					&& (per_cpu(mode_to_kick_pcpu, pcpu_id) == DEL_MODE_IPI)) {
+				kick_pcpu(pcpu_id);
+			}
+			pcpu_id = ffs64(mask);
+		}
+	}
+}
+
 void wake_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
+	uint16_t pcpu_id;
 	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
 	if (is_blocked(obj) || obj->be_blocking) {
 		scheduler = get_scheduler(pcpu_id);
 		if (scheduler->wake != NULL) {
@@ -249,13 +485,80 @@ void wake_thread(struct thread_object *obj)
 		}
 		if (is_blocked(obj)) {
 			set_thread_status(obj, THREAD_STS_RUNNABLE);
+			obj->runnable_tsc = cpu_ticks();
+			obj->stat.wakeups++;
 			make_reschedule_request(pcpu_id);
+			kick_idle_pcpus(obj);
 		}
 		obj->be_blocking = false;
 	}
 	release_schedule_lock(pcpu_id, rflag);
 }
 
+/*
+ * @brief Ask the scheduler of obj's pCPU to run obj next.
+ *
+ * Only a preempted (runnable) thread can be prioritized, a running or
+ * blocked thread is left alone.
+ *
+ * @return true if obj was prioritized
+ */
+bool prioritize_thread(struct thread_object *obj)
+{
+	uint16_t pcpu_id;
+	struct acrn_scheduler *scheduler;
+	uint64_t rflag;
+	bool prioritized = false;
+
+	pcpu_id = obtain_thread_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
+	if ((obj->status == THREAD_STS_RUNNABLE) && (scheduler->prioritize != NULL)) {
+		scheduler->prioritize(obj);
+		make_reschedule_request(pcpu_id);
+		prioritized = true;
+	}
+	release_schedule_lock(pcpu_id, rflag);
+
+	return prioritized;
+}
+
+/*
+ * @brief Ask the pCPU of obj to migrate obj to dst_pcpu_id.
+ *
+ * Only a runnable thread that allows dst_pcpu_id in its migrate_mask is
+ * migrated, and a pCPU takes one incoming migration at a time. The source
+ * pCPU does the migration on its next schedule().
+ *
+ * @return true if the migration was requested
+ */
+bool request_thread_migration(struct thread_object *obj, uint16_t dst_pcpu_id)
+{
+	struct sched_control *dst_ctl = &per_cpu(sched_ctl, dst_pcpu_id);
+	struct sched_control *ctl;
+	uint16_t pcpu_id;
+	uint64_t rflag;
+	bool requested = false;
+
+	if (!bitmap_test_and_set_lock(INCOMING_MIGRATION, &dst_ctl->flags)) {
+		pcpu_id = obtain_thread_lock(obj, &rflag);
+		ctl = &per_cpu(sched_ctl, pcpu_id);
+		if ((pcpu_id != dst_pcpu_id) && (obj->status == THREAD_STS_RUNNABLE)
+				&& (ctl->migrate_obj == NULL) && bitmap_test(dst_pcpu_id, &obj->migrate_mask)) {
+			ctl->migrate_obj = obj;
+			ctl->migrate_dst = dst_pcpu_id;
+			make_reschedule_request(pcpu_id);
+			requested = true;
+		}
+		release_schedule_lock(pcpu_id, rflag);
+
+		if (!requested) {
+			bitmap_clear_lock(INCOMING_MIGRATION, &dst_ctl->flags);
+		}
+	}
+
+	return requested;
+}
+
 void yield_current(void)
 {
 	make_reschedule_request(get_pcpu_id());
@@ -268,6 +571,7 @@ void run_thread(struct thread_object *obj)
 	obtain_schedule_lock(obj->pcpu_id, &rflag);
 	get_cpu_var(sched_ctl).curr_obj = obj;
 	set_thread_status(obj, THREAD_STS_RUNNING);
+	obj->run_tsc = cpu_ticks();
 	release_schedule_lock(obj->pcpu_id, rflag);
 
 	if (obj->thread_entry != NULL) {
@@ -9,11 +9,26 @@
 #include <asm/cpu.h>
 #include <asm/per_cpu.h>
 #include <softirq.h>
+#include <schedule.h>
+#include <ticks.h>
 
 static softirq_handler softirq_handlers[NR_SOFTIRQS];
 
+static const uint64_t softirq_class_mask[NR_SOFTIRQ_CLASSES] = {
+	[SOFTIRQ_CLASS_RT] = (1UL << SOFTIRQ_TIMER) | (1UL << SOFTIRQ_PTDEV),
+	[SOFTIRQ_CLASS_VDEV] = (1UL << SOFTIRQ_VHPET) | (1UL << SOFTIRQ_VPIT),
+	[SOFTIRQ_CLASS_HOUSEKEEP] = (1UL << SOFTIRQ_THERMAL),
+};
+
+/* SOFTIRQ_BUDGET_US in TSC cycles */
+static uint64_t softirq_budget;
+
+/*
+ * @pre called by the BSP, after the TSC calibration
+ */
 void init_softirq(void)
 {
+	softirq_budget = us_to_ticks(SOFTIRQ_BUDGET_US);
 }
 
 /*
@@ -32,16 +47,75 @@ void fire_softirq(uint16_t nr)
 	bitmap_set_lock(nr, &per_cpu(softirq_pending, get_pcpu_id()));
 }
 
-static void do_softirq_internal(uint16_t cpu_id)
+/*
+ * Run by pcpu_id at its next interrupt, the caller kicks it if it's another pCPU.
+ *
+ * @pre: nr will not equal or large than NR_SOFTIRQS
+ */
+void fire_softirq_on_pcpu(uint16_t pcpu_id, uint16_t nr)
+{
+	bitmap_set_lock(nr, &per_cpu(softirq_pending, pcpu_id));
+}
+
+bool has_pending_softirq(uint16_t pcpu_id)
+{
+	return (per_cpu(softirq_pending, pcpu_id) != 0UL);
+}
+
+/* The first pending softirq of the highest class, INVALID_BIT_INDEX if none */
+static uint16_t next_softirq(uint64_t pending)
+{
+	uint16_t nr = INVALID_BIT_INDEX;
+	uint32_t class;
+
+	for (class = 0U; class < NR_SOFTIRQ_CLASSES; class++) {
+		if ((pending & softirq_class_mask[class]) != 0UL) {
+			nr = ffs64(pending & softirq_class_mask[class]);
+			break;
+		}
+	}
+
+	return nr;
+}
+
+/*
+ * Run the pending softirqs by class. Once past deadline, if not 0, the ones
+ * out of SOFTIRQ_CLASS_RT are left pending.
+ */
+static void do_softirq_internal(uint16_t cpu_id, uint64_t deadline)
 {
 	volatile uint64_t *softirq_pending_bitmap =
 			&per_cpu(softirq_pending, cpu_id);
-	uint16_t nr = ffs64(*softirq_pending_bitmap);
+	struct softirq_stat *stat;
+	uint64_t start, cycles, rest;
+	uint16_t nr = next_softirq(*softirq_pending_bitmap);
 
 	while (nr < NR_SOFTIRQS) {
+		start = cpu_ticks();
+		if ((deadline != 0UL) && (start >= deadline) &&
+				((softirq_class_mask[SOFTIRQ_CLASS_RT] & (1UL << nr)) == 0UL)) {
+			/* the RT ones are all done, the rest waits for the next pass */
+			rest = *softirq_pending_bitmap;
+			nr = ffs64(rest);
+			while (nr < NR_SOFTIRQS) {
+				bitmap_clear_nolock(nr, &rest);
+				per_cpu(softirq_stat, cpu_id)[nr].deferred++;
+				nr = ffs64(rest);
+			}
+			break;
+		}
+
 		bitmap_clear_lock(nr, softirq_pending_bitmap);
 		(*softirq_handlers[nr])(cpu_id);
-		nr = ffs64(*softirq_pending_bitmap);
+
+		cycles = cpu_ticks() - start;
+		stat = &per_cpu(softirq_stat, cpu_id)[nr];
+		stat->count++;
+		stat->cycles += cycles;
+		if (cycles > stat->max_cycles) {
+			stat->max_cycles = cycles;
+		}
+		nr = next_softirq(*softirq_pending_bitmap);
 	}
 }
 
@@ -51,15 +125,22 @@ static void do_softirq_internal(uint16_t cpu_id)
 void do_softirq(void)
 {
 	uint16_t cpu_id = get_pcpu_id();
+	struct thread_object *curr = sched_get_current(cpu_id);
+	uint64_t deadline = 0UL;
 
 	if (per_cpu(softirq_servicing, cpu_id) == 0U) {
 		per_cpu(softirq_servicing, cpu_id) = 1U;
 
+		/* no VM entry waits for the softirqs of the idle thread */
+		if ((curr != NULL) && !is_idle_thread(curr)) {
+			deadline = cpu_ticks() + softirq_budget;
+		}
+
 		CPU_IRQ_ENABLE_ON_CONFIG();
-		do_softirq_internal(cpu_id);
+		do_softirq_internal(cpu_id, deadline);
 		CPU_IRQ_DISABLE_ON_CONFIG();
 
-		do_softirq_internal(cpu_id);
+		do_softirq_internal(cpu_id, deadline);
 		per_cpu(softirq_servicing, cpu_id) = 0U;
 	}
 }
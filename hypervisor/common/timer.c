@@ -16,6 +16,8 @@
 #include <asm/irq.h>
 #include <ticks.h>
 #include <hw/hw_timer.h>
+#include <logmsg.h>
+#include <asm/tsc.h>
 
 #define MAX_TIMER_ACTIONS	32U
 #define MIN_TIMER_PERIOD_US	500U
@@ -39,7 +41,7 @@ bool timer_expired(const struct hv_timer *timer, uint64_t now, uint64_t *delta)
 
 bool timer_is_started(const struct hv_timer *timer)
 {
-	return (!list_empty(&timer->node));
+	return (timer->heap_index != INVALID_TIMER_INDEX);
 }
 
 static void run_timer(const struct hv_timer *timer)
@@ -54,41 +56,99 @@ static void run_timer(const struct hv_timer *timer)
 
 static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
-	struct hv_timer *timer = NULL;
+	/* the next event timer is the heap root */
+	if (cpu_timer->nr_timers != 0U) {
+		/* it is okay to program a expired time */
+		msr_write(MSR_IA32_TSC_DEADLINE, cpu_timer->heap[0]->timeout);
+	}
+}
 
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = container_of((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
+static inline void heap_set(struct per_cpu_timers *cpu_timer, uint32_t idx, struct hv_timer *timer)
+{
+	cpu_timer->heap[idx] = timer;
+	timer->heap_index = idx;
+}
 
-		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->timeout);
+static void heap_sift_up(struct per_cpu_timers *cpu_timer, uint32_t index)
+{
+	struct hv_timer *timer = cpu_timer->heap[index];
+	uint32_t idx = index, parent;
+
+	while (idx > 0U) {
+		parent = (idx - 1U) >> 1U;
+		if (cpu_timer->heap[parent]->timeout <= timer->timeout) {
+			break;
+		}
+		heap_set(cpu_timer, idx, cpu_timer->heap[parent]);
+		idx = parent;
+	}
+	heap_set(cpu_timer, idx, timer);
+}
+
+static void heap_sift_down(struct per_cpu_timers *cpu_timer, uint32_t index)
+{
+	struct hv_timer *timer = cpu_timer->heap[index];
+	uint32_t idx = index, child;
+
+	while (true) {
+		child = (idx << 1U) + 1U;
+		if (child >= cpu_timer->nr_timers) {
+			break;
+		}
+		if (((child + 1U) < cpu_timer->nr_timers) &&
+				(cpu_timer->heap[child + 1U]->timeout < cpu_timer->heap[child]->timeout)) {
+			child++;
+		}
+		if (timer->timeout <= cpu_timer->heap[child]->timeout) {
+			break;
+		}
+		heap_set(cpu_timer, idx, cpu_timer->heap[child]);
+		idx = child;
 	}
+	heap_set(cpu_timer, idx, timer);
 }
 
 /*
- * return true if we add the timer on the timer_list head
+ * return true if the timer becomes the heap root
  */
 static bool local_add_timer(struct per_cpu_timers *cpu_timer,
 			struct hv_timer *timer)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->timeout;
+	bool ret = false;
+
+	if (cpu_timer->nr_timers < MAX_TIMERS_PER_PCPU) {
+		cpu_timer->heap[cpu_timer->nr_timers] = timer;
+		cpu_timer->nr_timers++;
+		heap_sift_up(cpu_timer, cpu_timer->nr_timers - 1U);
+		ret = (timer->heap_index == 0U);
+	}
+
+	return ret;
+}
 
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = container_of(pos, struct hv_timer, node);
-		if (tmp->timeout < tsc) {
-			prev = &tmp->node;
+/*
+ * return true if the removed timer was the heap root
+ */
+static bool local_del_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	uint32_t idx = timer->heap_index;
+	struct hv_timer *last;
+
+	cpu_timer->nr_timers--;
+	timer->heap_index = INVALID_TIMER_INDEX;
+	if (idx != cpu_timer->nr_timers) {
+		last = cpu_timer->heap[cpu_timer->nr_timers];
+		heap_set(cpu_timer, idx, last);
+		if ((idx > 0U) && (cpu_timer->heap[(idx - 1U) >> 1U]->timeout > last->timeout)) {
+			heap_sift_up(cpu_timer, idx);
 		} else {
-			break;
+			heap_sift_down(cpu_timer, idx);
 		}
 	}
+	cpu_timer->heap[cpu_timer->nr_timers] = NULL;
 
-	list_add(&timer->node, prev);
-
-	return (prev == &cpu_timer->timer_list);
+	return (idx == 0U);
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -101,7 +161,7 @@ int32_t add_timer(struct hv_timer *timer)
 	if ((timer == NULL) || (timer->func == NULL) || (timer->timeout == 0UL)) {
 		ret = -EINVAL;
 	} else {
-		ASSERT(list_empty(&timer->node), "add timer again!\n");
+		ASSERT(!timer_is_started(timer), "add timer again!\n");
 
 		/* limit minimal periodic timer cycle period */
 		if (timer->mode == TICK_MODE_PERIODIC) {
@@ -112,13 +172,22 @@ int32_t add_timer(struct hv_timer *timer)
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
 		CPU_INT_ALL_DISABLE(&rflags);
-		/* update the physical timer if we're on the timer_list head */
-		if (local_add_timer(cpu_timer, timer)) {
-			update_physical_timer(cpu_timer);
+		if (cpu_timer->nr_timers < MAX_TIMERS_PER_PCPU) {
+			timer->pcpu_id = pcpu_id;
+			/* update the physical timer if we're on the heap root */
+			if (local_add_timer(cpu_timer, timer)) {
+				update_physical_timer(cpu_timer);
+			}
+		} else {
+			ret = -ENOMEM;
 		}
 		CPU_INT_ALL_RESTORE(rflags);
 
-		TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->timeout, 0UL);
+		if (ret == 0) {
+			TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->timeout, 0UL);
+		} else {
+			pr_err("%s: timer heap of pcpu %hu is full", __func__, pcpu_id);
+		}
 	}
 
 	return ret;
@@ -140,7 +209,8 @@ void initialize_timer(struct hv_timer *timer,
 			timer->mode = TICK_MODE_ONESHOT;
 			timer->period_in_cycle = 0UL;
 		}
-		INIT_LIST_HEAD(&timer->node);
+		timer->heap_index = INVALID_TIMER_INDEX;
+		timer->pcpu_id = INVALID_CPU_ID;
 	}
 }
 
@@ -163,25 +233,31 @@ void del_timer(struct hv_timer *timer)
 	uint64_t rflags;
 
 	CPU_INT_ALL_DISABLE(&rflags);
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	if ((timer != NULL) && timer_is_started(timer)) {
+		(void)local_del_timer(&per_cpu(cpu_timers, timer->pcpu_id), timer);
 	}
 	CPU_INT_ALL_RESTORE(rflags);
 }
 
+uint64_t get_next_timer_deadline(uint16_t pcpu_id)
+{
+	const struct per_cpu_timers *cpu_timer = &per_cpu(cpu_timers, pcpu_id);
+
+	return (cpu_timer->nr_timers != 0U) ? cpu_timer->heap[0]->timeout : 0UL;
+}
+
 static void init_percpu_timer(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	cpu_timer->nr_timers = 0U;
 }
 
 static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	const struct list_head *pos, *n;
 	uint32_t tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = cpu_ticks();
 
@@ -194,8 +270,8 @@ static void timer_softirq(uint16_t pcpu_id)
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = container_of(pos, struct hv_timer, node);
+	while (cpu_timer->nr_timers != 0U) {
+		timer = cpu_timer->heap[0];
 		/* timer expried */
 		tries--;
 		if ((timer->timeout <= current_tsc) && (tries != 0U)) {
@@ -219,6 +295,59 @@ static void timer_softirq(uint16_t pcpu_id)
 	update_physical_timer(cpu_timer);
 }
 
+#ifdef HV_DEBUG
+#define TIMER_BENCH_NUM		128U
+
+static struct per_cpu_timers bench_timers;
+static struct hv_timer bench_timer_array[TIMER_BENCH_NUM];
+
+/*
+ * Boot-time self-benchmark of the timer heap: insert TIMER_BENCH_NUM timers with
+ * scattered deadlines, then expire them in deadline order, and report the
+ * average cycles spent per queue operation.
+ */
+static void timer_queue_self_bench(void)
+{
+	struct hv_timer *timer;
+	uint64_t start, add_cycles, expire_cycles, seed = 0x2545F4914F6CDD1DUL;
+	uint64_t rflags, last = 0UL;
+	uint32_t i;
+	bool sorted = true;
+
+	for (i = 0U; i < TIMER_BENCH_NUM; i++) {
+		/* xorshift to generate scattered deadlines */
+		seed ^= seed << 13U;
+		seed ^= seed >> 7U;
+		seed ^= seed << 17U;
+		initialize_timer(&bench_timer_array[i], NULL, NULL, (seed >> 16U) + 1UL, 0UL);
+	}
+	bench_timers.nr_timers = 0U;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	start = rdtsc();
+	for (i = 0U; i < TIMER_BENCH_NUM; i++) {
+		(void)local_add_timer(&bench_timers, &bench_timer_array[i]);
+	}
+	add_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	while (bench_timers.nr_timers != 0U) {
+		timer = bench_timers.heap[0];
+		(void)local_del_timer(&bench_timers, timer);
+		if (timer->timeout < last) {
+			sorted = false;
+		}
+		last = timer->timeout;
+	}
+	expire_cycles = rdtsc() - start;
+	CPU_INT_ALL_RESTORE(rflags);
+
+	pr_acrnlog("timer heap self-bench: %u timers, add %lu cycles/op, expire %lu cycles/op%s",
+		TIMER_BENCH_NUM, add_cycles / TIMER_BENCH_NUM, expire_cycles / TIMER_BENCH_NUM,
+		sorted ? "" : ", ORDER BROKEN");
+}
+#endif
+
 void timer_init(void)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -227,6 +356,9 @@ void timer_init(void)
 
 	if (pcpu_id == BSP_CPU_ID) {
 		register_softirq(SOFTIRQ_TIMER, timer_softirq);
+#ifdef HV_DEBUG
+		timer_queue_self_bench();
+#endif
 	}
 
 	init_hw_timer();
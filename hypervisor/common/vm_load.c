@@ -5,9 +5,144 @@
  */
 
 #include <asm/guest/vm.h>
+#include <asm/guest/ept.h>
+#include <asm/mmu.h>
+#include <asm/lib/atomic.h>
 #include <vboot.h>
 #include <errno.h>
 #include <logmsg.h>
+#include <boot_time.h>
+
+/* the images that big are copied by all the pCPUs of their VM, by chunks */
+#define IMAGE_COPY_CHUNK	MEM_2M
+#define IMAGE_COPY_PARALLEL_MIN	(4UL * MEM_2M)
+
+/*
+ * The copy of an image in progress for a VM, by its BSP and by the other
+ * pCPUs of the VM waiting in help_load_vm() until the VM is prepared.
+ */
+struct image_copy_job {
+	struct acrn_vm *vm;
+	const uint8_t *src;
+	uint64_t gpa;
+	int64_t size;
+	int64_t next;		/* offset of the next chunk to take */
+	int64_t done;		/* bytes copied */
+	int32_t busy;		/* helpers looking at the job */
+	int32_t nr_pcpus;	/* pCPUs having copied a chunk */
+	volatile bool active;
+	volatile bool finished;	/* the VM is prepared, the helpers leave */
+};
+
+static struct image_copy_job image_copy_jobs[CONFIG_MAX_VM_NUM];
+
+static void copy_image_chunks(struct image_copy_job *job)
+{
+	int64_t off, len;
+	bool counted = false;
+
+	off = atomic_xadd64(&job->next, (int64_t)IMAGE_COPY_CHUNK);
+	while (off < job->size) {
+		if (!counted) {
+			(void)atomic_inc_return(&job->nr_pcpus);
+			counted = true;
+		}
+		len = min(job->size - off, (int64_t)IMAGE_COPY_CHUNK);
+		(void)copy_to_gpa(job->vm, (void *)(job->src + off), job->gpa + (uint64_t)off, (uint32_t)len);
+		(void)atomic_add64_return(&job->done, len);
+		off = atomic_xadd64(&job->next, (int64_t)IMAGE_COPY_CHUNK);
+	}
+}
+
+/* Whether the image at src is mapped at gpa in vm already, all of it */
+static bool is_image_in_place(struct acrn_vm *vm, const void *src, uint64_t gpa, uint64_t size)
+{
+	uint64_t hpa = hva2hpa(src), off = 0UL, pg_hpa, pg_off;
+	uint32_t pg_size = 0U;
+	bool in_place = true;
+
+	while (in_place && (off < size)) {
+		pg_hpa = local_gpa2hpa(vm, gpa + off, &pg_size);
+		if ((pg_hpa == INVALID_HPA) || (pg_hpa != (hpa + off))) {
+			in_place = false;
+		} else {
+			/* the rest of the page gpa + off is in */
+			pg_off = (gpa + off) & ((uint64_t)pg_size - 1UL);
+			off += (uint64_t)pg_size - pg_off;
+		}
+	}
+
+	return in_place;
+}
+
+/**
+ * @brief Copy a guest image to its guest physical address
+ *
+ * Nothing is copied if the image is there already. The images of at least
+ * IMAGE_COPY_PARALLEL_MIN bytes of a VM prepared by launch_vms() are copied
+ * by all the pCPUs of the VM.
+ *
+ * @pre vm != NULL && src != NULL
+ */
+int32_t copy_image_to_gpa(struct acrn_vm *vm, const void *src, uint64_t gpa, uint64_t size)
+{
+	struct image_copy_job *job = &image_copy_jobs[vm->vm_id];
+	int32_t ret = 0;
+
+	if (is_image_in_place(vm, src, gpa, size)) {
+		vm_boot_time_load(vm->vm_id, size, true, 0U);
+	} else if ((size < IMAGE_COPY_PARALLEL_MIN) || job->finished || (vm->hw.created_vcpus <= 1U)) {
+		ret = copy_to_gpa(vm, (void *)src, gpa, (uint32_t)size);
+		vm_boot_time_load(vm->vm_id, size, false, 1U);
+	} else if (!ept_is_valid_mr(vm, gpa, size)) {
+		pr_err("%s: vm%hu image at 0x%lx, size 0x%lx isn't in its memory", __func__, vm->vm_id, gpa, size);
+		ret = -EINVAL;
+	} else {
+		job->vm = vm;
+		job->src = (const uint8_t *)src;
+		job->gpa = gpa;
+		job->size = (int64_t)size;
+		job->next = 0;
+		job->done = 0;
+		job->nr_pcpus = 0;
+		/* the job is set up before the helpers see it active */
+		cpu_write_memory_barrier();
+		job->active = true;
+
+		copy_image_chunks(job);
+		while (job->done < job->size) {
+			asm_pause();
+		}
+
+		/* the job is only changed again once no helper looks at it */
+		job->active = false;
+		while (job->busy != 0) {
+			asm_pause();
+		}
+		vm_boot_time_load(vm->vm_id, size, false, (uint32_t)job->nr_pcpus);
+	}
+
+	return ret;
+}
+
+void help_load_vm(uint16_t vm_id)
+{
+	struct image_copy_job *job = &image_copy_jobs[vm_id];
+
+	while (!job->finished) {
+		(void)atomic_inc_return(&job->busy);
+		if (job->active) {
+			copy_image_chunks(job);
+		}
+		(void)atomic_dec_return(&job->busy);
+		asm_pause();
+	}
+}
+
+void finish_load_vm(uint16_t vm_id)
+{
+	image_copy_jobs[vm_id].finished = true;
+}
 
 /**
  * @pre sw_module != NULL
@@ -15,7 +150,7 @@
 void load_sw_module(struct acrn_vm *vm, struct sw_module_info *sw_module)
 {
 	if ((sw_module->size != 0) && (sw_module->load_addr != NULL)) {
-		(void)copy_to_gpa(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
+		(void)copy_image_to_gpa(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
 	}
 }
 
@@ -192,6 +192,9 @@ static void console_timer_callback(__unused void *data)
 	} else {
 		shell_kick();
 	}
+
+	/* log messages are written to the UART here, not by their callers */
+	console_flush_logmsg();
 }
 
 void console_setup_timer(void)
@@ -207,6 +210,8 @@ void console_setup_timer(void)
 	/* Start an periodic timer */
 	if (add_timer(&console_timer) != 0) {
 		pr_err("Failed to add console kick timer");
+	} else {
+		console_defer_logmsg(true);
 	}
 }
 
@@ -235,6 +240,7 @@ void suspend_console(void)
 {
 	if (VUART_TIMER_CPU == BSP_CPU_ID) {
 		del_timer(&console_timer);
+		console_defer_logmsg(false);
 	}
 }
 
@@ -12,6 +12,7 @@
 #include <npk_log.h>
 #include <asm/guest/vm.h>
 #include <logmsg.h>
+#include <trace.h>
 
 #ifdef PROFILING_ON
 /**
@@ -116,3 +117,28 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, __unused struct acrn_vm *targe
 	hw_info.cpu_num = get_pcpu_nums();
 	return copy_to_gpa(vcpu->vm, &hw_info, param1, sizeof(hw_info));
 }
+
+/**
+ * @brief Set the event classes, VMs and VM exit reasons traced by acrntrace
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param param1 Guest physical address pointing to struct acrn_trace_filter
+ *
+ * @pre is_service_vm(vcpu->vm)
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+int32_t hcall_set_trace_filter(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	struct acrn_trace_filter filter;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vcpu->vm, &filter, param1, sizeof(filter)) == 0) {
+		set_trace_filter(&filter);
+		ret = 0;
+	}
+
+	return ret;
+}
@@ -12,26 +12,303 @@
 #include <npk_log.h>
 #include <logmsg.h>
 #include <ticks.h>
+#include <console.h>
+#include <sbuf.h>
+#include <asm/boot/ld_sym.h>
 
 /* buf size should be identical to the size in hvlog option, which is
  * transfered to Service VM:
  * bsp/uefi/clearlinux/acrn.conf: hvlog=2M@0x1FE00000
  */
 
+/*
+ * Console messages are queued on a per pCPU ring by their own pCPU, with no
+ * lock, and written to the UART by console_flush_logmsg() from the console
+ * timer. Only LOG_FATAL messages and those logged before the console timer
+ * runs go to the UART right away.
+ */
+#define LOG_RING_SIZE		(16U * LOG_MESSAGE_MAX_SIZE)
+
+struct log_ring {
+	char buf[LOG_RING_SIZE];
+	volatile uint32_t head;		/* read by the console timer */
+	volatile uint32_t tail;		/* written by the owner pCPU */
+	uint32_t dropped;
+};
+
+/*
+ * Binary memory log: the format string ID, i.e. its offset in the .hvlog_fmt
+ * section, plus the raw arguments. acrnlog resolves the strings from the
+ * acrn.logfmt table extracted from the same build. A record takes nr_entries
+ * LOG_ENTRY_SIZE entries of the sbuf and starts with HVLOG_BIN_MAGIC, where a
+ * text message starts with '['. Numeric arguments take 8 bytes, with 32-bit
+ * signed ones sign extended, and a string takes a length byte followed by
+ * its characters.
+ */
+#define HVLOG_BIN_MAGIC		0x01U
+#define HVLOG_STR_MAX		255U
+
+struct hvlog_bin_hdr {
+	uint8_t magic;
+	uint8_t severity;
+	uint8_t nr_entries;
+	uint8_t nr_args;
+	uint16_t pcpu_id;
+	uint16_t len;		/* of the header plus the arguments */
+	uint32_t fmt_id;
+	uint32_t seq;
+	uint64_t timestamp;	/* in us */
+	char thread[16];
+} __packed;
+
 struct acrn_logmsg_ctl {
 	int32_t seq;
-	spinlock_t lock;
+	spinlock_t lock;	/* serializes the UART writers */
+	bool deferred;
 };
 
 static struct acrn_logmsg_ctl logmsg_ctl;
+static struct log_ring log_rings[MAX_PCPU_NUM];
 
 void init_logmsg()
 {
 	logmsg_ctl.seq = 0;
+	logmsg_ctl.deferred = false;
 
 	spinlock_init(&(logmsg_ctl.lock));
 }
 
+static uint32_t log_ring_copy(struct log_ring *ring, uint32_t pos, const char *src, uint32_t len)
+{
+	uint32_t first = min(len, LOG_RING_SIZE - pos);
+
+	(void)memcpy_s(&ring->buf[pos], first, src, first);
+	if (first < len) {
+		(void)memcpy_s(&ring->buf[0], len - first, src + first, len - first);
+	}
+
+	return (pos + len) % LOG_RING_SIZE;
+}
+
+/*
+ * @pre the caller runs on the pCPU owning ring, with interrupts disabled
+ */
+static void log_ring_put(struct log_ring *ring, const char *msg, uint32_t len)
+{
+	uint32_t head = ring->head, tail = ring->tail;
+	uint32_t used = (tail >= head) ? (tail - head) : ((LOG_RING_SIZE - head) + tail);
+
+	if ((used + len + 2U) >= LOG_RING_SIZE) {
+		ring->dropped++;
+	} else {
+		tail = log_ring_copy(ring, tail, msg, len);
+		tail = log_ring_copy(ring, tail, "\n\r", 2U);
+		/* make sure the message is in place before publishing it */
+		cpu_write_memory_barrier();
+		ring->tail = tail;
+	}
+}
+
+/*
+ * Write the queued console messages of all pCPUs to the UART, called from the
+ * console timer only.
+ */
+void console_flush_logmsg(void)
+{
+	struct log_ring *ring;
+	uint32_t head, tail, len, dropped;
+	uint64_t rflags;
+	uint16_t pcpu_id;
+
+	spinlock_irqsave_obtain(&(logmsg_ctl.lock), &rflags);
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		ring = &log_rings[pcpu_id];
+		head = ring->head;
+		tail = ring->tail;
+		while (head != tail) {
+			len = (tail > head) ? (tail - head) : (LOG_RING_SIZE - head);
+			(void)console_write(&ring->buf[head], len);
+			head = (head + len) % LOG_RING_SIZE;
+			ring->head = head;
+		}
+
+		dropped = ring->dropped;
+		if (dropped != 0U) {
+			ring->dropped = 0U;
+			printf("[cpu=%hu] %u console messages dropped\n\r", pcpu_id, dropped);
+		}
+	}
+	spinlock_irqrestore_release(&(logmsg_ctl.lock), rflags);
+}
+
+/*
+ * Queue the console messages from now on, or flush them and go back to
+ * writing them synchronously, e.g. while the console timer is stopped.
+ */
+void console_defer_logmsg(bool deferred)
+{
+	if (!deferred) {
+		console_flush_logmsg();
+	}
+	logmsg_ctl.deferred = deferred;
+}
+
+/*
+ * Allow LOG_RATELIMIT_BURST messages per LOG_RATELIMIT_MS from one call site,
+ * the number of suppressed ones is logged when the next period starts.
+ */
+bool logmsg_ratelimit(struct log_ratelimit *rl)
+{
+	uint64_t now = cpu_ticks();
+	uint32_t missed;
+	bool pass = true;
+
+	if ((rl->begin == 0UL) || ((now - rl->begin) >= (LOG_RATELIMIT_MS * TICKS_PER_MS))) {
+		missed = rl->missed;
+		rl->begin = now;
+		rl->printed = 0U;
+		rl->missed = 0U;
+		if (missed != 0U) {
+			pr_warn("%u messages suppressed", missed);
+		}
+	}
+
+	if (rl->printed < LOG_RATELIMIT_BURST) {
+		rl->printed++;
+	} else {
+		rl->missed++;
+		pass = false;
+	}
+
+	return pass;
+}
+
+static uint32_t log_put_arg(char *buf, uint32_t pos, uint64_t val)
+{
+	uint32_t ret = 0U;
+
+	if ((pos + sizeof(val)) <= LOG_MESSAGE_MAX_SIZE) {
+		(void)memcpy_s(buf + pos, sizeof(val), &val, sizeof(val));
+		ret = pos + sizeof(val);
+	}
+
+	return ret;
+}
+
+static uint32_t log_put_str(char *buf, uint32_t pos, const char *str)
+{
+	uint32_t len = strnlen_s(str, HVLOG_STR_MAX);
+	uint32_t ret = 0U;
+
+	if ((pos + 1U + len) <= LOG_MESSAGE_MAX_SIZE) {
+		buf[pos] = (char)len;
+		(void)memcpy_s(buf + pos + 1U, len, str, len);
+		ret = pos + 1U + len;
+	}
+
+	return ret;
+}
+
+/*
+ * Append the arguments of fmt to buf at pos, taking them the way do_print()
+ * does. Return the end of the arguments, or 0 if they don't fit in buf.
+ */
+static uint32_t log_encode_args(char *buf, uint32_t pos_arg, const char *fmt_arg, va_list args, uint8_t *nr_args)
+{
+	const char *fmt = fmt_arg;
+	const char *str;
+	uint32_t pos = pos_arg;
+	bool is_long;
+	char ch;
+
+	while ((*fmt != '\0') && (pos != 0U)) {
+		ch = *fmt;
+		fmt++;
+		if (ch == '%') {
+			/* flags, width and precision */
+			while ((*fmt == '#') || (*fmt == '-') || (*fmt == ' ') || (*fmt == '+') ||
+					(*fmt == '.') || ((*fmt >= '0') && (*fmt <= '9'))) {
+				fmt++;
+			}
+			is_long = false;
+			while ((*fmt == 'h') || (*fmt == 'l')) {
+				is_long = is_long || (*fmt == 'l');
+				fmt++;
+			}
+
+			ch = *fmt;
+			if (ch != '\0') {
+				fmt++;
+			}
+
+			if ((ch == 'd') || (ch == 'i')) {
+				if (is_long) {
+					pos = log_put_arg(buf, pos, (uint64_t)__builtin_va_arg(args, int64_t));
+				} else {
+					pos = log_put_arg(buf, pos, (uint64_t)(int64_t)__builtin_va_arg(args, int32_t));
+				}
+				(*nr_args)++;
+			} else if ((ch == 'u') || (ch == 'x') || (ch == 'X')) {
+				if (is_long) {
+					pos = log_put_arg(buf, pos, __builtin_va_arg(args, uint64_t));
+				} else {
+					pos = log_put_arg(buf, pos, (uint64_t)__builtin_va_arg(args, uint32_t));
+				}
+				(*nr_args)++;
+			} else if (ch == 'c') {
+				pos = log_put_arg(buf, pos, (uint64_t)(int64_t)__builtin_va_arg(args, int32_t));
+				(*nr_args)++;
+			} else if (ch == 's') {
+				str = __builtin_va_arg(args, char *);
+				pos = log_put_str(buf, pos, (str != NULL) ? str : "(null)");
+				(*nr_args)++;
+			} else {
+				/* '%' or printed as it is, no argument */
+			}
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Log the message to sbuf as a binary record, all of it or nothing.
+ * Return false if its arguments don't fit in a record, to log it as text.
+ */
+static bool log_put_binary(struct shared_buf *sbuf, char *buffer, struct hvlog_bin_hdr *hdr,
+		const char *fmt, va_list args)
+{
+	struct sbuf_span span;
+	uint32_t len, n, i;
+	bool ret = false;
+
+	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
+	hdr->nr_args = 0U;
+	len = log_encode_args(buffer, sizeof(*hdr), fmt, args, &hdr->nr_args);
+	if (len != 0U) {
+		hdr->len = (uint16_t)len;
+		hdr->nr_entries = (uint8_t)(((len - 1U) / LOG_ENTRY_SIZE) + 1U);
+		(void)memcpy_s(buffer, sizeof(*hdr), hdr, sizeof(*hdr));
+
+		n = sbuf_reserve(sbuf, LOG_ENTRY_SIZE, hdr->nr_entries, &span);
+		if (n == hdr->nr_entries) {
+			for (i = 0U; i < n; i++) {
+				(void)memcpy_s(sbuf_span_elem(&span, i), LOG_ENTRY_SIZE,
+					buffer + (i * LOG_ENTRY_SIZE), LOG_ENTRY_SIZE);
+			}
+			sbuf_commit(sbuf, &span);
+		} else if ((n != 0U) && (n != UINT32_MAX)) {
+			/* drop it, a partial record can't be decoded */
+			clac();
+		} else {
+			/* buf is full */
+		}
+		ret = true;
+	}
+
+	return ret;
+}
+
 void do_logmsg(uint32_t severity, const char *fmt, ...)
 {
 	va_list args;
@@ -40,8 +317,11 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	bool do_console_log;
 	bool do_mem_log;
 	bool do_npk_log;
+	uint32_t msg_len, seq;
 	char *buffer;
 	struct thread_object *current;
+	struct shared_buf *sbuf;
+	struct hvlog_bin_hdr hdr;
 
 	do_console_log = (severity <= console_loglevel);
 	do_mem_log = (severity <= mem_loglevel);
@@ -61,11 +341,36 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	pcpu_id = get_pcpu_id();
 	buffer = per_cpu(logbuf, pcpu_id);
 	current = sched_get_current(pcpu_id);
+	sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+	seq = (uint32_t)atomic_inc_return(&logmsg_ctl.seq);
+
+	/* Check whether output to memory as a binary record, only a pr_*() format has an ID */
+	if (do_mem_log && mem_log_binary && (sbuf != NULL) &&
+			((const uint8_t *)fmt >= &ld_hvlog_fmt_start) && ((const uint8_t *)fmt < &ld_hvlog_fmt_end)) {
+		(void)memset(&hdr, 0U, sizeof(hdr));
+		hdr.magic = HVLOG_BIN_MAGIC;
+		hdr.severity = (uint8_t)severity;
+		hdr.pcpu_id = pcpu_id;
+		hdr.fmt_id = (uint32_t)((const uint8_t *)fmt - &ld_hvlog_fmt_start);
+		hdr.seq = seq;
+		hdr.timestamp = timestamp;
+		(void)strncpy_s(hdr.thread, sizeof(hdr.thread), current->name, sizeof(current->name));
+
+		va_start(args, fmt);
+		if (log_put_binary(sbuf, buffer, &hdr, fmt, args)) {
+			do_mem_log = false;
+		}
+		va_end(args);
+	}
+
+	if (!do_console_log && !do_mem_log && !do_npk_log) {
+		return;
+	}
 
 	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
 	/* Put time-stamp, CPU ID and severity into buffer */
 	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%luus][cpu=%hu][%s][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, current->name, severity, atomic_inc_return(&logmsg_ctl.seq));
+			timestamp, pcpu_id, current->name, severity, seq);
 
 	/* Put message into remaining portion of local buffer */
 	va_start(args, fmt);
@@ -73,7 +378,6 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 		LOG_MESSAGE_MAX_SIZE
 		- strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), fmt, args);
 	va_end(args);
-
 	/* Check whether output to NPK */
 	if (do_npk_log) {
 		npk_log_write(buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE));
@@ -81,19 +385,27 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 
 	/* Check whether output to stdout */
 	if (do_console_log) {
-		spinlock_irqsave_obtain(&(logmsg_ctl.lock), &rflags);
+		if (logmsg_ctl.deferred && (severity != LOG_FATAL)) {
+			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
+			CPU_INT_ALL_DISABLE(&rflags);
+			log_ring_put(&log_rings[pcpu_id], buffer, msg_len);
+			CPU_INT_ALL_RESTORE(rflags);
+		} else {
+			/* older messages first, a fatal one may be the last */
+			if (logmsg_ctl.deferred) {
+				console_flush_logmsg();
+			}
+			spinlock_irqsave_obtain(&(logmsg_ctl.lock), &rflags);
 
-		/* Send buffer to stdout */
-		printf("%s\n\r", buffer);
+			/* Send buffer to stdout */
+			printf("%s\n\r", buffer);
 
-		spinlock_irqrestore_release(&(logmsg_ctl.lock), rflags);
+			spinlock_irqrestore_release(&(logmsg_ctl.lock), rflags);
+		}
 	}
 
 	/* Check whether output to memory */
 	if (do_mem_log) {
-		uint32_t msg_len;
-		struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
-
 		/* If sbuf is not ready, we just drop the massage */
 		if (sbuf != NULL) {
 			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
@@ -15,6 +15,9 @@
 static int32_t npk_log_setup_ref;
 static bool npk_log_enabled;
 static uint64_t base;
+static bool npk_trace_on;
+/* the trace channels, one per pCPU, follow the log ones */
+static uint64_t trace_base;
 
 #define HV_NPK_LOG_REF_SHIFT  2U
 #define HV_NPK_LOG_REF_MASK   ((1U << HV_NPK_LOG_REF_SHIFT) - 1U)
@@ -28,6 +31,8 @@ enum {
 	HV_NPK_LOG_CMD_ENABLE,
 	HV_NPK_LOG_CMD_DISABLE,
 	HV_NPK_LOG_CMD_QUERY,
+	HV_NPK_LOG_CMD_TRACE_ENABLE,
+	HV_NPK_LOG_CMD_TRACE_DISABLE,
 };
 
 #define	HV_NPK_LOG_RES_INVALID	0x0U
@@ -116,6 +121,25 @@ void npk_log_setup(struct hv_npk_log_param *param)
 		npk_log_enabled = 0;
 		param->res = HV_NPK_LOG_RES_OK;
 		break;
+	case HV_NPK_LOG_CMD_TRACE_ENABLE:
+		if (param->mmio_addr != 0UL) {
+			base = param->mmio_addr;
+		}
+		if (base != 0UL) {
+			if (!npk_trace_on) {
+				pcpu_nums = get_pcpu_nums();
+				trace_base = base + (pcpu_nums * (HV_NPK_LOG_REF_MASK + 1U)
+					* sizeof(struct npk_chan));
+				set_paging_supervisor(trace_base, pcpu_nums * sizeof(struct npk_chan));
+			}
+			param->res = HV_NPK_LOG_RES_OK;
+			npk_trace_on = true;
+		}
+		break;
+	case HV_NPK_LOG_CMD_TRACE_DISABLE:
+		npk_trace_on = false;
+		param->res = HV_NPK_LOG_RES_OK;
+		break;
 	case HV_NPK_LOG_CMD_QUERY:
 		param->res = npk_log_enabled ? HV_NPK_LOG_RES_ENABLED :
 			HV_NPK_LOG_RES_DISABLED;
@@ -160,3 +184,24 @@ void npk_log_write(const char *buf, size_t buf_len)
 
 	atomic_dec32(&per_cpu(npk_log_ref, cpu_id));
 }
+
+bool npk_trace_enabled(void)
+{
+	return npk_trace_on;
+}
+
+/*
+ * A trace record carries its length in its first byte, so no flag is needed
+ * to delimit it; the trace hub timestamps the first store.
+ */
+void npk_trace_write(uint16_t pcpu_id, const uint8_t *rec, uint32_t len)
+{
+	struct npk_chan *channel = (struct npk_chan *)trace_base + pcpu_id;
+	const char *p = (const char *)rec;
+	const char *end = p + len;
+	int32_t sz;
+
+	sz = npk_write(p, &(channel->DnTS), len);
+	for (p += sz; sz >= 0; p += sz)
+		sz = npk_write(p, &(channel->Dn), (size_t)(end - p));
+}
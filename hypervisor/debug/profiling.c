@@ -16,6 +16,7 @@
 #include <sprintf.h>
 #include <logmsg.h>
 #include <ticks.h>
+#include <sbuf.h>
 
 #define DBG_LEVEL_PROFILING		5U
 #define DBG_LEVEL_ERR_PROFILING		3U
@@ -28,6 +29,13 @@
 #define LVT_PERFCTR_BIT_UNMASK		0xFFFEFFFFU
 #define LVT_PERFCTR_BIT_MASK		0x10000U
 #define VALID_DEBUGCTL_BIT_MASK		0x1801U
+#define PERF_OVF_CTR_MASK		0x70000000FUL
+#define PERF_CAP_PEBS_FMT_SHIFT		8U
+#define PERF_CAP_PEBS_FMT_MASK		0xFUL
+#define PEBS_FMT_ADAPTIVE		4U
+#define PEBS_BUFFER_SIZE		(2U * PAGE_SIZE)
+/* room left at the interrupt threshold, for the largest adaptive record */
+#define PEBS_MAX_RECORD_SIZE		0x600U
 
 static uint64_t sep_collection_switch;
 static uint64_t socwatch_collection_switch;
@@ -35,6 +43,8 @@ static bool in_pmu_profiling;
 
 static uint32_t profiling_pmi_irq = IRQ_INVALID;
 
+static uint8_t pebs_buffer[MAX_PCPU_NUM][PEBS_BUFFER_SIZE] __aligned(PAGE_SIZE);
+
 extern struct irq_desc irq_desc_array[NR_IRQS];
 
 static void profiling_initialize_vmsw(void)
@@ -92,6 +102,69 @@ static void profiling_initialize_pmi(void)
 		__func__,  get_pcpu_id());
 }
 
+/*
+ * Point the Debug Store area at the PEBS buffer of this pCPU. The records are
+ * drained on the PMI raised when the buffer reaches its interrupt threshold.
+ * The counter reset values are the reload values of the PMI exit list.
+ */
+static void profiling_setup_pebs(void)
+{
+	uint32_t i, group_id;
+	uint64_t base, last;
+	struct profiling_msr_op *msrop = NULL;
+	struct sep_state *ss = &get_cpu_var(profiling_info.s_state);
+	struct profiling_ds_area *ds = &get_cpu_var(profiling_info.ds_area);
+	/* size of the PEBS record formats 0 to 3 */
+	static const uint32_t pebs_record_size[PEBS_FMT_ADAPTIVE] = { 144U, 176U, 192U, 200U };
+
+	if ((msr_read(MSR_IA32_MISC_ENABLE) & MSR_IA32_MISC_ENABLE_PEBS_UNAVAIL) != 0UL) {
+		pr_err("%s: PEBS unavailable on cpu%d", __func__, get_pcpu_id());
+		return;
+	}
+
+	ss->pebs_format = (uint32_t)((msr_read(MSR_IA32_PERF_CAPABILITIES) >> PERF_CAP_PEBS_FMT_SHIFT)
+				& PERF_CAP_PEBS_FMT_MASK);
+	ss->pebs_record_size = (ss->pebs_format < PEBS_FMT_ADAPTIVE) ? pebs_record_size[ss->pebs_format] : 0U;
+
+	base = (uint64_t)pebs_buffer[get_pcpu_id()];
+	if (ss->pebs_record_size != 0U) {
+		last = base + (((uint64_t)PEBS_BUFFER_SIZE / ss->pebs_record_size) * ss->pebs_record_size);
+		ds->pebs_interrupt_threshold = last - ss->pebs_record_size;
+	} else {
+		last = base + PEBS_BUFFER_SIZE;
+		ds->pebs_interrupt_threshold = last - PEBS_MAX_RECORD_SIZE;
+	}
+	ds->pebs_buffer_base = base;
+	ds->pebs_index = base;
+	ds->pebs_absolute_maximum = last;
+
+	group_id = ss->current_pmi_group_id;
+	for (i = 0U; i < MAX_MSR_LIST_NUM; i++) {
+		msrop = &(ss->pmi_exit_msr_list[group_id][i]);
+		if (msrop->msr_id == (uint32_t)-1) {
+			break;
+		}
+		if ((msrop->reg_type == (uint8_t)PMU_MSR_DATA) && (msrop->param < MAX_PEBS_COUNTERS)) {
+			ds->pebs_counter_reset[msrop->param] = msrop->value;
+		}
+	}
+
+	msr_write(MSR_IA32_DS_AREA, (uint64_t)ds);
+	ss->pebs_enable = msr_read(MSR_IA32_PEBS_ENABLE);
+	ss->pebs_active = true;
+}
+
+static void profiling_teardown_pebs(void)
+{
+	struct sep_state *ss = &get_cpu_var(profiling_info.s_state);
+
+	if (ss->pebs_active) {
+		ss->pebs_active = false;
+		msr_write(MSR_IA32_PEBS_ENABLE, 0UL);
+		msr_write(MSR_IA32_DS_AREA, 0UL);
+	}
+}
+
 /*
  * Enable all the Performance Monitoring Control registers.
  */
@@ -162,6 +235,10 @@ static void profiling_enable_pmu(void)
 		}
 	}
 
+	if ((sep_collection_switch & (1UL << (uint64_t)PEBS_PMU_SAMPLING)) != 0UL) {
+		profiling_setup_pebs();
+	}
+
 	ss->pmu_state = PMU_RUNNING;
 
 	dev_dbg(DBG_LEVEL_PROFILING, "%s: exiting cpu%d",
@@ -209,6 +286,8 @@ static void profiling_disable_pmu(void)
 			}
 		}
 
+		profiling_teardown_pebs();
+
 		/* Mask LAPIC LVT entry for PMC register */
 		lvt_perf_ctr = (uint32_t) msr_read(MSR_IA32_EXT_APIC_LVT_PMI);
 
@@ -462,6 +541,190 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 	return 0;
 }
 
+/*
+ * Copy len bytes to offset of a reserved span, which may wrap around
+ */
+static void profiling_span_write(const struct sbuf_span *span, uint32_t offset,
+		const void *data, uint32_t len)
+{
+	uint32_t size0 = span->num[0] * span->ele_size;
+	uint32_t first;
+
+	if (offset < size0) {
+		first = min(len, size0 - offset);
+		(void)memcpy_s(span->start[0] + offset, first, data, first);
+		if (first < len) {
+			(void)memcpy_s(span->start[1], len - first, (const uint8_t *)data + first, len - first);
+		}
+	} else {
+		(void)memcpy_s(span->start[1] + (offset - size0), len, data, len);
+	}
+}
+
+static uint64_t pebs_field(const uint8_t *rec, uint32_t offset)
+{
+	return *(const uint64_t *)(rec + offset);
+}
+
+/*
+ * Size of the PEBS record at rec, 0 if there is no complete one before end
+ */
+static uint32_t pebs_record_size(const struct sep_state *ss, const uint8_t *rec, const uint8_t *end)
+{
+	uint32_t size = ss->pebs_record_size;
+
+	if ((size == 0U) && ((rec + sizeof(uint64_t)) <= end)) {
+		/* adaptive record: the size is in the basic info group */
+		size = (uint32_t)(pebs_field(rec, 0U) >> 48U);
+	}
+	if ((size < (4U * sizeof(uint64_t))) || ((rec + size) > end)) {
+		size = 0U;
+	}
+
+	return size;
+}
+
+static void pebs_to_sample(const struct sep_state *ss, const uint8_t *rec, struct acrn_profiling_sample *sample)
+{
+	(void)memset(sample, 0U, sizeof(*sample));
+	sample->source = ACRN_PROFILING_SRC_PEBS;
+	/* PEBS is off while the guests run, see profiling_vmenter_handler() */
+	sample->vm_id = ACRN_PROFILING_HV_ID;
+	sample->pcpu_id = get_pcpu_id();
+
+	if (ss->pebs_format >= PEBS_FMT_ADAPTIVE) {
+		sample->rip = pebs_field(rec, 8U);
+		sample->overflow_status = pebs_field(rec, 16U);
+		sample->tsc = pebs_field(rec, 24U);
+	} else {
+		sample->rflags = pebs_field(rec, 0U);
+		/* the eventing IP from format 2, not the IP after it */
+		sample->rip = (ss->pebs_format >= 2U) ? pebs_field(rec, 176U) : pebs_field(rec, 8U);
+		sample->overflow_status = (ss->pebs_format >= 1U) ? pebs_field(rec, 144U) : 0UL;
+		sample->tsc = (ss->pebs_format >= 3U) ? pebs_field(rec, 192U) : cpu_ticks();
+	}
+}
+
+/*
+ * Write the samples of this PMI to the ACRN_SEP sbuf as one batch: the
+ * counter overflow sample tagged with the VM, vCPU, RIP and CR3 it hit, with
+ * the LBR call stack if LBR_PMU_SAMPLING is on, and the drained PEBS records.
+ * See struct acrn_profiling_sample for the layout.
+ */
+static void profiling_put_tagged_samples(uint32_t irq, uint64_t perf_ovf_status)
+{
+	static const uint8_t zeros[SEP_BUF_ENTRY_SIZE];
+	struct sep_state *ss = &(get_cpu_var(profiling_info.s_state));
+	struct profiling_ds_area *ds = &(get_cpu_var(profiling_info.ds_area));
+	struct guest_vm_info *vm_info = &(get_cpu_var(profiling_info.vm_info));
+	struct lbr_pmu_sample *lsample = &(get_cpu_var(profiling_info.p_sample).lsample);
+	struct shared_buf *sbuf = per_cpu(sbuf, get_pcpu_id())[ACRN_SEP];
+	struct acrn_profiling_sample sample;
+	struct acrn_profiling_branch branch;
+	struct data_header pkt_header;
+	struct sbuf_span span;
+	const uint8_t *rec = NULL, *end = NULL;
+	uint32_t i, size, n_pebs = 0U, n_branches = 0U, entries, offset, n;
+	bool pmi_sample;
+
+	pmi_sample = ((perf_ovf_status & PERF_OVF_CTR_MASK & ~ss->pebs_enable) != 0UL);
+
+	if (pmi_sample && ((sep_collection_switch & (1UL << (uint64_t)LBR_PMU_SAMPLING)) != 0UL)) {
+		lsample->lbr_tos = msr_read(MSR_CORE_LASTBRANCH_TOS);
+		for (i = 0U; i < LBR_NUM_REGISTERS; i++) {
+			lsample->lbr_from_ip[i] = msr_read(MSR_CORE_LASTBRANCH_0_FROM_IP + i);
+			lsample->lbr_to_ip[i] = msr_read(MSR_CORE_LASTBRANCH_0_TO_IP + i);
+		}
+		n_branches = LBR_NUM_REGISTERS;
+	}
+
+	if (ss->pebs_active) {
+		rec = (const uint8_t *)ds->pebs_buffer_base;
+		end = (const uint8_t *)min(ds->pebs_index, ds->pebs_absolute_maximum);
+		for (size = pebs_record_size(ss, rec, end); size != 0U; size = pebs_record_size(ss, rec, end)) {
+			rec += size;
+			n_pebs++;
+		}
+		rec = (const uint8_t *)ds->pebs_buffer_base;
+		ds->pebs_index = ds->pebs_buffer_base;
+	}
+
+	if (pmi_sample || (n_pebs != 0U)) {
+		size = (uint32_t)sizeof(sample) * (n_pebs + (pmi_sample ? 1U : 0U)) +
+			((uint32_t)sizeof(branch) * n_branches);
+		entries = (((uint32_t)DATA_HEADER_SIZE + size) + SEP_BUF_ENTRY_SIZE - 1U) / SEP_BUF_ENTRY_SIZE;
+
+		n = (sbuf != NULL) ? sbuf_reserve(sbuf, SEP_BUF_ENTRY_SIZE, entries, &span) : 0U;
+		if (n != entries) {
+			if ((n != 0U) && (n != UINT32_MAX)) {
+				clac();
+			}
+			ss->samples_dropped += n_pebs + (pmi_sample ? 1U : 0U);
+		} else {
+			(void)memset(&pkt_header, 0U, sizeof(pkt_header));
+			pkt_header.tsc = cpu_ticks();
+			pkt_header.collector_id = COLLECT_PROFILE_DATA;
+			pkt_header.cpu_id = get_pcpu_id();
+			pkt_header.data_type = (uint16_t)(1U << VM_TAGGED_SAMPLING);
+			pkt_header.reserved = MAGIC_NUMBER;
+			pkt_header.payload_size = size;
+			profiling_span_write(&span, 0U, &pkt_header, (uint32_t)DATA_HEADER_SIZE);
+			offset = (uint32_t)DATA_HEADER_SIZE;
+
+			if (pmi_sample) {
+				(void)memset(&sample, 0U, sizeof(sample));
+				sample.tsc = pkt_header.tsc;
+				sample.overflow_status = perf_ovf_status;
+				sample.pcpu_id = get_pcpu_id();
+				sample.source = ACRN_PROFILING_SRC_PMI;
+				sample.nr_branches = (uint8_t)n_branches;
+				if ((vm_info->vmexit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) &&
+						(vm_info->external_vector == (int32_t)PMI_VECTOR)) {
+					/* Attribute PMI to guest context */
+					sample.vm_id = vm_info->guest_vm_id;
+					sample.vcpu_id = vm_info->guest_vcpu_id;
+					sample.rip = vm_info->guest_rip;
+					sample.rflags = vm_info->guest_rflags;
+					sample.cr3 = vm_info->guest_cr3;
+					vm_info->vmexit_reason = 0U;
+					vm_info->external_vector = -1;
+				} else {
+					/* Attribute PMI to hypervisor context */
+					const struct x86_irq_data *irqd = irq_desc_array[irq].arch_data;
+
+					sample.vm_id = ACRN_PROFILING_HV_ID;
+					sample.rip = irqd->ctx_rip;
+					sample.rflags = irqd->ctx_rflags;
+				}
+				profiling_span_write(&span, offset, &sample, sizeof(sample));
+				offset += sizeof(sample);
+
+				/* most recent branch first */
+				for (i = 0U; i < n_branches; i++) {
+					n = (uint32_t)((lsample->lbr_tos + LBR_NUM_REGISTERS - i) % LBR_NUM_REGISTERS);
+					branch.from_ip = lsample->lbr_from_ip[n];
+					branch.to_ip = lsample->lbr_to_ip[n];
+					profiling_span_write(&span, offset, &branch, sizeof(branch));
+					offset += sizeof(branch);
+				}
+			}
+
+			for (i = 0U; i < n_pebs; i++) {
+				pebs_to_sample(ss, rec, &sample);
+				profiling_span_write(&span, offset, &sample, sizeof(sample));
+				offset += sizeof(sample);
+				rec += pebs_record_size(ss, rec, end);
+			}
+
+			if ((offset % SEP_BUF_ENTRY_SIZE) != 0U) {
+				profiling_span_write(&span, offset, zeros, SEP_BUF_ENTRY_SIZE - (offset % SEP_BUF_ENTRY_SIZE));
+			}
+			sbuf_commit(sbuf, &span);
+			ss->samples_logged += n_pebs + (pmi_sample ? 1U : 0U);
+		}
+	}
+}
+
 /*
  * Performs MSR operations - read, write and clear
  */
@@ -609,6 +872,11 @@ static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 		ss->nofrozen_pmi++;
 	}
 
+	if (((sep_collection_switch & (1UL << (uint64_t)VM_TAGGED_SAMPLING)) != 0UL) || ss->pebs_active) {
+		profiling_put_tagged_samples(irq, perf_ovf_status);
+		goto clear_ovf;
+	}
+
 	(void)memset(psample, 0U, sizeof(struct pmu_sample));
 
 	/* Attribute PMI to guest context */
@@ -660,6 +928,7 @@ static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 		(void)profiling_generate_data(COLLECT_PROFILE_DATA, CORE_PMU_SAMPLING);
 	}
 
+clear_ovf:
 	/* Clear PERF_GLOBAL_OVF_STATUS bits */
 	msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL,
 			perf_ovf_status & PERF_OVF_BIT_MASK);
@@ -909,8 +1178,10 @@ int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr)
 	ver_info.supported_features = (int64_t)
 					((1U << (uint64_t)CORE_PMU_SAMPLING) |
 					(1U << (uint64_t)CORE_PMU_COUNTING) |
+					(1U << (uint64_t)PEBS_PMU_SAMPLING) |
 					(1U << (uint64_t)LBR_PMU_SAMPLING) |
-					(1U << (uint64_t)VM_SWITCH_TRACING));
+					(1U << (uint64_t)VM_SWITCH_TRACING) |
+					(1U << (uint64_t)VM_TAGGED_SAMPLING));
 
 	if (copy_to_gpa(vm, &ver_info, addr, sizeof(ver_info)) != 0) {
 		return -EINVAL;
@@ -993,7 +1264,10 @@ int32_t profiling_set_control(struct acrn_vm *vm, uint64_t addr)
 						profiling_stop_pmu();
 					}
 					break;
+				case PEBS_PMU_SAMPLING:
 				case LBR_PMU_SAMPLING:
+				case VM_TAGGED_SAMPLING:
+					/* taken into account by the next start */
 					break;
 				case VM_SWITCH_TRACING:
 					break;
@@ -1293,6 +1567,14 @@ void profiling_ipi_handler(__unused void *data)
  */
 void profiling_vmenter_handler(__unused struct acrn_vcpu *vcpu)
 {
+	/*
+	 * The Debug Store area is the hypervisor's, so no PEBS in VMX non-root,
+	 * it is enabled again by profiling_pre_vmexit_handler().
+	 */
+	if (get_cpu_var(profiling_info.s_state).pebs_active) {
+		msr_write(MSR_IA32_PEBS_ENABLE, 0UL);
+	}
+
 	if (((get_cpu_var(profiling_info.s_state).pmu_state == PMU_RUNNING) &&
 			((sep_collection_switch &
 				(1UL << (uint64_t)VM_SWITCH_TRACING)) > 0UL)) ||
@@ -1313,6 +1595,10 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	exit_reason = vcpu->arch.exit_reason & 0xFFFFUL;
 
+	if (get_cpu_var(profiling_info.s_state).pebs_active) {
+		msr_write(MSR_IA32_PEBS_ENABLE, get_cpu_var(profiling_info.s_state).pebs_enable);
+	}
+
 	if ((get_cpu_var(profiling_info.s_state).pmu_state == PMU_RUNNING) ||
 		(get_cpu_var(profiling_info.soc_state) == SW_RUNNING)) {
 
@@ -1334,7 +1620,11 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 		get_cpu_var(profiling_info.vm_info).guest_cs
 			= exec_vmread64(VMX_GUEST_CS_SEL);
 
+		get_cpu_var(profiling_info.vm_info).guest_cr3
+			= exec_vmread(VMX_GUEST_CR3);
+
 		get_cpu_var(profiling_info.vm_info).guest_vm_id = (int16_t)vcpu->vm->vm_id;
+		get_cpu_var(profiling_info.vm_info).guest_vcpu_id = vcpu->vcpu_id;
 	}
 }
 
@@ -16,12 +16,14 @@
 #include <asm/ioapic.h>
 #include <ptdev.h>
 #include <asm/guest/vm.h>
+#include <asm/guest/ept.h>
 #include <sprintf.h>
 #include <logmsg.h>
 #include <version.h>
 #include <shell.h>
 #include <asm/guest/vmcs.h>
 #include <asm/host_pm.h>
+#include <boot_time.h>
 
 #define TEMP_STR_SIZE		60U
 #define MAX_STR_SIZE		256U
@@ -47,10 +49,27 @@ static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
+static int32_t shell_logfmt(int32_t argc, char **argv);
 static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_reboot(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+static int32_t shell_show_sched_stat(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_softirq_stat(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_idle_stat(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_mmio_stat(int32_t argc, char **argv);
+static int32_t shell_show_ept_stat(int32_t argc, char **argv);
+static int32_t shell_show_vmexit_stat(int32_t argc, char **argv);
+static int32_t shell_show_ioreq_stat(int32_t argc, char **argv);
+static int32_t shell_show_ipi_stat(int32_t argc, char **argv);
+static int32_t shell_show_msr_stat(int32_t argc, char **argv);
+static int32_t shell_show_cr_stat(int32_t argc, char **argv);
+static int32_t shell_show_tee_stat(int32_t argc, char **argv);
+static int32_t shell_show_lock_stat(int32_t argc, char **argv);
+static int32_t shell_show_boot_time(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_vcpu_sched(int32_t argc, char **argv);
+static int32_t shell_perf(int32_t argc, char **argv);
+static bool perf_top_kick(void);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -131,6 +150,12 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_LOG_LVL_HELP,
 		.fcn		= shell_loglevel,
 	},
+	{
+		.str		= SHELL_CMD_LOG_FMT,
+		.cmd_param	= SHELL_CMD_LOG_FMT_PARAM,
+		.help_str	= SHELL_CMD_LOG_FMT_HELP,
+		.fcn		= shell_logfmt,
+	},
 	{
 		.str		= SHELL_CMD_CPUID,
 		.cmd_param	= SHELL_CMD_CPUID_PARAM,
@@ -155,6 +180,96 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+	{
+		.str		= SHELL_CMD_MMIO_STAT,
+		.cmd_param	= SHELL_CMD_MMIO_STAT_PARAM,
+		.help_str	= SHELL_CMD_MMIO_STAT_HELP,
+		.fcn		= shell_show_mmio_stat,
+	},
+	{
+		.str		= SHELL_CMD_EPT_STAT,
+		.cmd_param	= SHELL_CMD_EPT_STAT_PARAM,
+		.help_str	= SHELL_CMD_EPT_STAT_HELP,
+		.fcn		= shell_show_ept_stat,
+	},
+	{
+		.str		= SHELL_CMD_VMEXIT_STAT,
+		.cmd_param	= SHELL_CMD_VMEXIT_STAT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_STAT_HELP,
+		.fcn		= shell_show_vmexit_stat,
+	},
+	{
+		.str		= SHELL_CMD_IOREQ_STAT,
+		.cmd_param	= SHELL_CMD_IOREQ_STAT_PARAM,
+		.help_str	= SHELL_CMD_IOREQ_STAT_HELP,
+		.fcn		= shell_show_ioreq_stat,
+	},
+	{
+		.str		= SHELL_CMD_IPI_STAT,
+		.cmd_param	= SHELL_CMD_IPI_STAT_PARAM,
+		.help_str	= SHELL_CMD_IPI_STAT_HELP,
+		.fcn		= shell_show_ipi_stat,
+	},
+	{
+		.str		= SHELL_CMD_MSR_STAT,
+		.cmd_param	= SHELL_CMD_MSR_STAT_PARAM,
+		.help_str	= SHELL_CMD_MSR_STAT_HELP,
+		.fcn		= shell_show_msr_stat,
+	},
+	{
+		.str		= SHELL_CMD_CR_STAT,
+		.cmd_param	= SHELL_CMD_CR_STAT_PARAM,
+		.help_str	= SHELL_CMD_CR_STAT_HELP,
+		.fcn		= shell_show_cr_stat,
+	},
+	{
+		.str		= SHELL_CMD_TEE_STAT,
+		.cmd_param	= SHELL_CMD_TEE_STAT_PARAM,
+		.help_str	= SHELL_CMD_TEE_STAT_HELP,
+		.fcn		= shell_show_tee_stat,
+	},
+	{
+		.str		= SHELL_CMD_LOCK_STAT,
+		.cmd_param	= SHELL_CMD_LOCK_STAT_PARAM,
+		.help_str	= SHELL_CMD_LOCK_STAT_HELP,
+		.fcn		= shell_show_lock_stat,
+	},
+	{
+		.str		= SHELL_CMD_BOOT_TIME,
+		.cmd_param	= SHELL_CMD_BOOT_TIME_PARAM,
+		.help_str	= SHELL_CMD_BOOT_TIME_HELP,
+		.fcn		= shell_show_boot_time,
+	},
+	{
+		.str		= SHELL_CMD_SCHED_STAT,
+		.cmd_param	= SHELL_CMD_SCHED_STAT_PARAM,
+		.help_str	= SHELL_CMD_SCHED_STAT_HELP,
+		.fcn		= shell_show_sched_stat,
+	},
+	{
+		.str		= SHELL_CMD_SOFTIRQ_STAT,
+		.cmd_param	= SHELL_CMD_SOFTIRQ_STAT_PARAM,
+		.help_str	= SHELL_CMD_SOFTIRQ_STAT_HELP,
+		.fcn		= shell_show_softirq_stat,
+	},
+	{
+		.str		= SHELL_CMD_IDLE_STAT,
+		.cmd_param	= SHELL_CMD_IDLE_STAT_PARAM,
+		.help_str	= SHELL_CMD_IDLE_STAT_HELP,
+		.fcn		= shell_show_idle_stat,
+	},
+	{
+		.str		= SHELL_CMD_VCPU_SCHED,
+		.cmd_param	= SHELL_CMD_VCPU_SCHED_PARAM,
+		.help_str	= SHELL_CMD_VCPU_SCHED_HELP,
+		.fcn		= shell_show_vcpu_sched,
+	},
+	{
+		.str		= SHELL_CMD_PERF,
+		.cmd_param	= SHELL_CMD_PERF_PARAM,
+		.help_str	= SHELL_CMD_PERF_HELP,
+		.fcn		= shell_perf,
+	},
 };
 
 /* for function key: up/down/right/left/home/end and delete key */
@@ -174,6 +289,7 @@ enum function_key {
 uint16_t console_loglevel = CONFIG_CONSOLE_LOGLEVEL_DEFAULT;
 uint16_t mem_loglevel = CONFIG_MEM_LOGLEVEL_DEFAULT;
 uint16_t npk_loglevel = CONFIG_NPK_LOGLEVEL_DEFAULT;
+bool mem_log_binary = false;
 
 static struct shell hv_shell;
 static struct shell *p_shell = &hv_shell;
@@ -630,6 +746,10 @@ void shell_kick(void)
 	 * Show HV shell prompt ONLY when HV owns the
 	 * serial port.
 	 */
+	if (perf_top_kick()) {
+		return;
+	}
+
 	/* Prompt the user for a selection. */
 	if (is_cmd_cmplt) {
 		shell_puts(SHELL_PROMPT_STR);
@@ -1265,7 +1385,8 @@ static void get_ptdev_info(char *str_arg, size_t str_max)
 {
 	char *str = str_arg;
 	struct ptirq_remapping_info *entry;
-	uint16_t idx;
+	struct acrn_vm *vm;
+	uint16_t idx, vm_id;
 	size_t len, size = str_max;
 	uint32_t irq, vector;
 	char type[16];
@@ -1306,6 +1427,61 @@ static void get_ptdev_info(char *str_arg, size_t str_max)
 		}
 	}
 
+	len = snprintf(str, size, "\r\n\r\nVM\tMSI_REMAPS\tINTX_REMAPS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			len = snprintf(str, size, "\r\n%hu\t%lu\t\t%lu", vm_id, vm->ptirq_msi_remaps,
+					vm->ptirq_intx_remaps);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	/* MSIs injected to a vCPU running on another pCPU, and the pCPU a lowest priority one is steered to */
+	len = snprintf(str, size, "\r\n\r\nVM\tVBDF\tENTRY\tVVEC\tINTRS\tREMOTE\tSTEER");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		entry = &ptirq_entries[idx];
+		if (is_entry_active(entry) && (entry->intr_type == PTDEV_INTR_MSI)) {
+			vbdf.value = entry->virt_sid.msi_id.bdf;
+			len = snprintf(str, size, "\r\n%hu\t%x:%x.%x\t%hu\t0x%X\t%lu\t%lu",
+					entry->vm->vm_id, vbdf.bits.b, vbdf.bits.d, vbdf.bits.f,
+					entry->virt_sid.msi_id.entry_nr, entry->vmsi.data.bits.vector,
+					entry->intr_count, entry->remote_count);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+
+			if (entry->steer_pcpu_id != INVALID_CPU_ID) {
+				len = snprintf(str, size, "\t%hu", entry->steer_pcpu_id);
+			} else {
+				len = snprintf(str, size, "\t-");
+			}
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
 	snprintf(str, size, "\r\n");
 	return;
 
@@ -1502,6 +1678,23 @@ static int32_t shell_loglevel(int32_t argc, char **argv)
 	return 0;
 }
 
+static int32_t shell_logfmt(int32_t argc, char **argv)
+{
+	int32_t ret = 0;
+
+	if (argc == 1) {
+		shell_puts(mem_log_binary ? "mem_log: binary\r\n" : "mem_log: text\r\n");
+	} else if ((argc == 2) && (strcmp(argv[1], "binary") == 0)) {
+		mem_log_binary = true;
+	} else if ((argc == 2) && (strcmp(argv[1], "text") == 0)) {
+		mem_log_binary = false;
+	} else {
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
 static int32_t shell_cpuid(int32_t argc, char **argv)
 {
 	char str[MAX_STR_SIZE] = {0};
@@ -1615,3 +1808,1509 @@ static int32_t shell_wrmsr(int32_t argc, char **argv)
 
 	return ret;
 }
+
+static void get_sched_stat(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	uint16_t pcpu_id;
+	size_t len, size = str_max;
+	const struct sched_tick_stat *tick_stat;
+#ifdef CONFIG_SCHED_BVT
+	uint16_t vm_id, i;
+	uint32_t nr;
+	struct sched_bvt_pick_stat *stat;
+	struct acrn_vm *vm;
+	const struct sched_gang *gang;
+	const struct sched_gang_stat *gstat;
+#endif
+#ifdef CONFIG_SCHED_EDF
+	uint16_t vm_id, i;
+	uint32_t budget_us, period_us;
+	struct sched_edf_stat stat;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+#endif
+#ifdef CONFIG_SCHED_IORR
+	static const char *const iorr_class_names[] = { "normal", "io", "cpu" };
+	uint16_t vm_id, i;
+	struct sched_iorr_stat stat;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+#endif
+
+	len = snprintf(str, size, "\r\nPCPU\tTICK_STOPS\tTICKS_SUPPRESSED\tTICKLESS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		tick_stat = &per_cpu(sched_ctl, pcpu_id).tick_stat;
+		len = snprintf(str, size, "\r\n%hu\t%lu\t\t%lu\t\t\t%s", pcpu_id, tick_stat->stops,
+				tick_stat->suppressed, (tick_stat->stop_tsc != 0UL) ? "yes" : "no");
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+#ifdef CONFIG_SCHED_BVT
+	len = snprintf(str, size, "\r\n\r\nPCPU\tRUNNABLE\tPICKS\t\tAVG_CYCLES");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		for (nr = 0U; nr <= BVT_RUNQUEUE_MAX; nr++) {
+			stat = &per_cpu(sched_bvt_ctl, pcpu_id).pick_stat[nr];
+			if (stat->count != 0UL) {
+				len = snprintf(str, size, "\r\n%hu\t%u\t\t%lu\t\t%lu",
+						pcpu_id, nr, stat->count, stat->cycles / stat->count);
+				if (len >= size) {
+					goto overflow;
+				}
+				size -= len;
+				str += len;
+			}
+		}
+	}
+
+	/* start skew of co-scheduled vCPUs relative to the first vCPU of their gang slice */
+	len = snprintf(str, size, "\r\n\r\nVM\tVCPU\tMODE\tJOINS\t\tAVG_SKEW_US\tMAX_SKEW_US\tCATCH_UPS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		gang = &vm->sched_gang;
+		if (is_poweroff_vm(vm) || (gang->mode == COSCHED_NONE)) {
+			continue;
+		}
+		for (i = 0U; i < gang->nr_members; i++) {
+			gstat = &gang->stat[i];
+			len = snprintf(str, size, "\r\n%hu\t%hu\t%s\t%lu\t\t%lu\t\t%lu\t\t%lu", vm_id, i,
+					(gang->mode == COSCHED_STRICT) ? "strict" : "relaxed", gstat->joins,
+					(gstat->joins != 0UL) ? ticks_to_us(gstat->skew_total / gstat->joins) : 0UL,
+					ticks_to_us(gstat->skew_max), gstat->boosts);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+#endif
+
+#ifdef CONFIG_SCHED_EDF
+	/* bandwidth reserved on each pCPU, in parts per million */
+	len = snprintf(str, size, "\r\n\r\nPCPU\tRESERVED_PPM");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		len = snprintf(str, size, "\r\n%hu\t%lu", pcpu_id, per_cpu(sched_edf_ctl, pcpu_id).reserved_bw);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	len = snprintf(str, size, "\r\n\r\nVM\tVCPU\tBUDGET_US\tPERIOD_US\tPERIODS\t\tTHROTTLES\tMISSES");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			if (!sched_edf_get_stat(&vcpu->thread_obj, &budget_us, &period_us, &stat)) {
+				continue;
+			}
+			len = snprintf(str, size, "\r\n%hu\t%hu\t%u\t\t%u\t\t%lu\t\t%lu\t\t%lu", vm_id, i,
+					budget_us, period_us, stat.replenishes, stat.throttles, stat.deadline_misses);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+#endif
+
+#ifdef CONFIG_SCHED_IORR
+	/* classification of each vCPU by its average run before blocking */
+	len = snprintf(str, size, "\r\n\r\nVM\tVCPU\tCLASS\tSLICE_US\tAVG_RUN_US\tBLOCKS\t\tEXPIRIES");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			if (!sched_iorr_get_stat(&vcpu->thread_obj, &stat)) {
+				continue;
+			}
+			len = snprintf(str, size, "\r\n%hu\t%hu\t%s\t%lu\t\t%lu\t\t%lu\t\t%lu", vm_id, i,
+					iorr_class_names[stat.class], stat.slice_us, stat.avg_run_us,
+					stat.blocks, stat.expiries);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+#endif
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_sched_stat(__unused int32_t argc, __unused char **argv)
+{
+	get_sched_stat(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_softirq_stat(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	static const char *const softirq_names[NR_SOFTIRQS] = {
+		[SOFTIRQ_TIMER] = "timer",
+		[SOFTIRQ_PTDEV] = "ptdev",
+		[SOFTIRQ_THERMAL] = "thermal",
+		[SOFTIRQ_VHPET] = "vhpet",
+		[SOFTIRQ_VPIT] = "vpit",
+	};
+	uint16_t pcpu_id, nr;
+	size_t len, size = str_max;
+	const struct softirq_stat *stat;
+
+	len = snprintf(str, size, "\r\nPCPU\tSOFTIRQ\tCOUNT\t\tAVG_CYCLES\tMAX_CYCLES\tDEFERRED");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		for (nr = 0U; nr < NR_SOFTIRQS; nr++) {
+			stat = &per_cpu(softirq_stat, pcpu_id)[nr];
+			if ((stat->count == 0UL) && (stat->deferred == 0UL)) {
+				continue;
+			}
+			len = snprintf(str, size, "\r\n%hu\t%s\t%lu\t\t%lu\t\t%lu\t\t%lu", pcpu_id,
+					softirq_names[nr], stat->count,
+					(stat->count != 0UL) ? (stat->cycles / stat->count) : 0UL,
+					stat->max_cycles, stat->deferred);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_softirq_stat(__unused int32_t argc, __unused char **argv)
+{
+	get_softirq_stat(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_idle_stat(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	const struct idle_state *states;
+	const struct pcpu_idle *idle;
+	const struct idle_stat *stat;
+	uint32_t nr_states, i;
+	uint16_t pcpu_id;
+	size_t len, size = str_max;
+
+	nr_states = get_idle_states(&states);
+	len = snprintf(str, size, "\r\nSTATE\tHINT\tLATENCY_US\tRESIDENCY_US");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < nr_states; i++) {
+		len = snprintf(str, size, "\r\n%s\t0x%x\t%u\t\t%u", states[i].name, states[i].hint,
+				states[i].latency_us, states[i].residency_us);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	len = snprintf(str, size, "\r\n\r\nPCPU\tMAX_LAT\tSTATE\tUSAGE\t\tRESIDENCY_US\tBELOW_TARGET\t"
+			"TIMER_WAKES\tAVG_WAKE_US\tMAX_WAKE_US");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		idle = &per_cpu(idle_ctl, pcpu_id);
+		for (i = 0U; i < nr_states; i++) {
+			stat = &idle->stat[i];
+			if (stat->usage == 0UL) {
+				continue;
+			}
+			len = snprintf(str, size, "\r\n%hu\t%d\t%s\t%lu\t\t%lu\t\t%lu\t\t%lu\t\t%lu\t\t%lu",
+					pcpu_id, (idle->max_latency_us == IDLE_LATENCY_ANY) ? -1 : (int32_t)idle->max_latency_us,
+					states[i].name, stat->usage, ticks_to_us(stat->residency), stat->below_target,
+					stat->timer_wakes,
+					(stat->timer_wakes != 0UL) ? ticks_to_us(stat->wake_latency / stat->timer_wakes) : 0UL,
+					ticks_to_us(stat->max_wake_latency));
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_idle_stat(__unused int32_t argc, __unused char **argv)
+{
+	get_idle_stat(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_mmio_stat(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	const struct mem_io_node *mmio_node;
+	uint16_t i;
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nVCPU\tHINT_HIT\tHINT_MISS\tDECODE_CACHE_HIT\tDECODE_CACHE_MISS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		len = snprintf(str, size, "\r\n%hu\t%lu\t\t%lu\t\t%lu\t\t\t%lu", vcpu->vcpu_id,
+				vcpu->mmio_hint_hits, vcpu->mmio_hint_misses,
+				vcpu->inst_cache.hits, vcpu->inst_cache.misses);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	len = snprintf(str, size, "\r\n\r\nREGION_START\t\tREGION_END");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < vm->nr_emul_mmio_index; i++) {
+		mmio_node = &vm->emul_mmio[vm->emul_mmio_index[i]];
+		len = snprintf(str, size, "\r\n0x%016lx\t0x%016lx", mmio_node->range_start, mmio_node->range_end);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_mmio_stat(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret >= 0) {
+		vmid = sanitize_vmid((uint16_t) ret);
+		get_mmio_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void get_ept_stat(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	uint64_t nr_leaves[EPT_LEAF_SIZES];
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	get_ept_leaf_stat(vm, nr_leaves);
+	len = snprintf(str, size, "\r\nLEAF\tCOUNT\t\tMAPPED(MB)"
+			"\r\n4K\t%lu\t\t%lu\r\n2M\t%lu\t\t%lu\r\n1G\t%lu\t\t%lu",
+			nr_leaves[EPT_LEAF_4K], (nr_leaves[EPT_LEAF_4K] * PTE_SIZE) >> 20U,
+			nr_leaves[EPT_LEAF_2M], (nr_leaves[EPT_LEAF_2M] * PDE_SIZE) >> 20U,
+			nr_leaves[EPT_LEAF_1G], (nr_leaves[EPT_LEAF_1G] * PDPTE_SIZE) >> 20U);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_ept_stat(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret >= 0) {
+		vmid = sanitize_vmid((uint16_t) ret);
+		get_ept_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void get_vmexit_stat(char *str_arg, size_t str_max, const struct acrn_vcpu *vcpu)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	const struct acrn_vmexit_stat *stat;
+	uint32_t reason, i;
+
+	len = snprintf(str, size, "\r\nHALT_POLL: WINDOW %luus MAX %luus SUCCESS %lu FAIL %lu\r\n",
+		ticks_to_us(vcpu->halt_poll.window), ticks_to_us(vcpu->halt_poll.max_window),
+		vcpu->halt_poll.success, vcpu->halt_poll.fail);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	len = snprintf(str, size, "PLE: DIRECTED_YIELD HIT %lu MISS %lu\r\n",
+		vcpu->directed_yield_hits, vcpu->directed_yield_misses);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	len = snprintf(str, size, "GVA_CACHE: HIT %lu MISS %lu\r\n",
+		vcpu->gva_cache.hits, vcpu->gva_cache.misses);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	len = snprintf(str, size, "\r\nREASON\tCOUNT\t\tAVG_CYCLES\tHISTOGRAM (log2 cycles, from 2^8)");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (reason = 0U; reason < ACRN_VMEXIT_REASON_MAX; reason++) {
+		stat = &vcpu->exit_stat[reason];
+		if (stat->count == 0UL) {
+			continue;
+		}
+
+		len = snprintf(str, size, "\r\n%u\t%-16lu%-16lu", reason, stat->count, stat->cycles / stat->count);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+
+		for (i = 0U; i < ACRN_VMEXIT_HIST_BUCKETS; i++) {
+			len = snprintf(str, size, " %u", stat->hist[i]);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_vmexit_stat(int32_t argc, char **argv)
+{
+	uint16_t vm_id, vcpu_id;
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 3) {
+		shell_puts("Please enter cmd with <vm_id, vcpu_id>\r\n");
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+	vm_id = sanitize_vmid((uint16_t)status);
+	vcpu_id = (uint16_t)strtol_deci(argv[2]);
+
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id, vcpu_id>\r\n");
+		return -EINVAL;
+	}
+
+	if (vcpu_id >= vm->hw.created_vcpus) {
+		shell_puts("vcpu id is out of range\r\n");
+		return -EINVAL;
+	}
+
+	get_vmexit_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vcpu_from_vid(vm, vcpu_id));
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void list_vcpu_sched(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct acrn_sched_stat *stat;
+	uint16_t idx, i;
+
+	len = snprintf(str, size, "\r\nVM ID    VCPU ID    PCPU ID    WAKEUPS       PREEMPTS      "
+			"AVG DELAY(us)  MAX DELAY(us)  AVG SLICE(us)"
+			"\r\n=====    =======    =======    =======       ========      "
+			"=============  =============  =============");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			stat = &vcpu->thread_obj.stat;
+			len = snprintf(str, size, "\r\n  %-9hu%-11hu%-9hu%-14lu%-14lu%-15lu%-15lu%-15lu",
+					vm->vm_id, vcpu->vcpu_id, pcpuid_from_vcpu(vcpu),
+					stat->wakeups, stat->preemptions,
+					(stat->switches != 0UL) ? ticks_to_us(stat->run_delay_total / stat->switches) : 0UL,
+					ticks_to_us(stat->run_delay_max),
+					(stat->switches != 0UL) ? ticks_to_us(stat->slice_total / stat->switches) : 0UL);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static void get_vcpu_sched_hist(char *str_arg, size_t str_max, const struct acrn_vcpu *vcpu)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	const struct acrn_sched_stat *stat = &vcpu->thread_obj.stat;
+	uint32_t i;
+
+	len = snprintf(str, size, "\r\nBUCKET (log2 cycles, from 2^10)\tRUN_DELAY\tSLICE");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < ACRN_SCHED_HIST_BUCKETS; i++) {
+		len = snprintf(str, size, "\r\n%u\t\t\t\t%u\t\t%u", i + ACRN_SCHED_HIST_SHIFT - 1U,
+				stat->run_delay_hist[i], stat->slice_hist[i]);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_vcpu_sched(int32_t argc, char **argv)
+{
+	uint16_t vm_id, vcpu_id;
+	struct acrn_vm *vm;
+	int32_t status;
+
+	if (argc == 1) {
+		list_vcpu_sched(shell_log_buf, SHELL_LOG_BUF_SIZE);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	/* User input invalidation */
+	if (argc != 3) {
+		shell_puts("Please enter cmd with <vm_id, vcpu_id>\r\n");
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+	vm_id = sanitize_vmid((uint16_t)status);
+	vcpu_id = (uint16_t)strtol_deci(argv[2]);
+
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id, vcpu_id>\r\n");
+		return -EINVAL;
+	}
+
+	if (vcpu_id >= vm->hw.created_vcpus) {
+		shell_puts("vcpu id is out of range\r\n");
+		return -EINVAL;
+	}
+
+	get_vcpu_sched_hist(shell_log_buf, SHELL_LOG_BUF_SIZE, vcpu_from_vid(vm, vcpu_id));
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_ioreq_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vcpu *vcpu;
+	uint64_t hist[IOREQ_LAT_HIST_BUCKETS] = { 0UL };
+	uint16_t i;
+	uint32_t j;
+
+	len = snprintf(str, size, "\r\nVCPU\tAVG_US\t\tSPIN_HIT\tSPIN_MISS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		len = snprintf(str, size, "\r\n%hu\t%-16lu%-16lu%lu", vcpu->vcpu_id,
+				ticks_to_us(vcpu->ioreq_stat.lat_avg), vcpu->ioreq_stat.spin_hits,
+				vcpu->ioreq_stat.spin_misses);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+
+		for (j = 0U; j < IOREQ_LAT_HIST_BUCKETS; j++) {
+			hist[j] += vcpu->ioreq_stat.hist[j];
+		}
+	}
+
+	len = snprintf(str, size, "\r\n\r\nLATENCY_US\tCOUNT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (j = 0U; j < IOREQ_LAT_HIST_BUCKETS; j++) {
+		if (j == 0U) {
+			len = snprintf(str, size, "\r\n<1\t\t%lu", hist[j]);
+		} else if (j == (IOREQ_LAT_HIST_BUCKETS - 1U)) {
+			len = snprintf(str, size, "\r\n>=%lu\t\t%lu", 1UL << (j - 1U), hist[j]);
+		} else {
+			len = snprintf(str, size, "\r\n%lu-%lu\t\t%lu", 1UL << (j - 1U), (1UL << j) - 1UL, hist[j]);
+		}
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_ioreq_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_ioreq_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_ipi_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vcpu *vcpu;
+	struct vcpu_ipi_stat total = { 0UL };
+	const struct vcpu_ipi_stat *stat;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nVCPU\tCOUNT\t\tAVG_CYCLES\tTARGETS\t\tNOTIFIED\tNOT_RUNNING");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		stat = &vcpu->ipi_stat;
+		len = snprintf(str, size, "\r\n%hu\t%-16lu%-16lu%-16lu%-16lu%lu", vcpu->vcpu_id, stat->count,
+				(stat->count != 0UL) ? (stat->cycles / stat->count) : 0UL, stat->targets,
+				stat->notified, stat->not_running);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+
+		total.count += stat->count;
+		total.cycles += stat->cycles;
+		total.targets += stat->targets;
+		total.notified += stat->notified;
+		total.not_running += stat->not_running;
+	}
+
+	snprintf(str, size, "\r\nVM\t%-16lu%-16lu%-16lu%-16lu%lu\r\n", total.count,
+			(total.count != 0UL) ? (total.cycles / total.count) : 0UL, total.targets,
+			total.notified, total.not_running);
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_ipi_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_ipi_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_msr_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vcpu *vcpu;
+	const struct msr_exit_count *slot;
+	uint32_t j;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nVCPU\tMSR\t\tREADS\t\tWRITES");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		for (j = 0U; j < MSR_EXIT_STAT_SLOTS; j++) {
+			slot = &vcpu->msr_stat.slot[j];
+			if ((slot->reads == 0U) && (slot->writes == 0U)) {
+				continue;
+			}
+
+			len = snprintf(str, size, "\r\n%hu\t0x%-14x%-16u%u", vcpu->vcpu_id, slot->msr,
+					slot->reads, slot->writes);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+
+		if (vcpu->msr_stat.dropped != 0UL) {
+			len = snprintf(str, size, "\r\n%hu\tother MSRs, table full: %lu exits", vcpu->vcpu_id,
+					vcpu->msr_stat.dropped);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_msr_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_msr_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_cr_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vcpu *vcpu;
+	const struct vcpu_cr_stat *stat;
+	uint32_t bit;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nVCPU\tCR0_NOP\t\tCR4_NOP\t\tCLTS\t\tLMSW\t\tMOV_TO_CR BIT:EXITS");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		stat = &vcpu->cr_stat;
+		len = snprintf(str, size, "\r\n%hu\t%-16u%-16u%-16u%-16u", vcpu->vcpu_id, stat->cr0_unchanged,
+				stat->cr4_unchanged, stat->clts, stat->lmsw);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+
+		for (bit = 0U; bit < 32U; bit++) {
+			if (stat->cr0_bits[bit] != 0U) {
+				len = snprintf(str, size, " CR0.%u:%u", bit, stat->cr0_bits[bit]);
+				if (len >= size) {
+					goto overflow;
+				}
+				size -= len;
+				str += len;
+			}
+		}
+		for (bit = 0U; bit < 32U; bit++) {
+			if (stat->cr4_bits[bit] != 0U) {
+				len = snprintf(str, size, " CR4.%u:%u", bit, stat->cr4_bits[bit]);
+				if (len >= size) {
+					goto overflow;
+				}
+				size -= len;
+				str += len;
+			}
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_cr_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_cr_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_tee_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vcpu *vcpu;
+	const struct vcpu_tee_stat *stat;
+	uint16_t i;
+
+	len = snprintf(str, size, "\r\nVCPU\tSWITCHES\tAVG_CYCLES\tSKIPPED\t\tCALLS\t\tAVG_US\t\tMAX_US\t\tFIQ_POSTED");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(i, vm, vcpu) {
+		stat = &vcpu->tee_stat;
+		len = snprintf(str, size, "\r\n%hu\t%-16lu%-16lu%-16lu%-16lu%-16lu%-16lu%lu", vcpu->vcpu_id, stat->switches,
+				(stat->switches != 0UL) ? (stat->switch_ticks / stat->switches) : 0UL,
+				(stat->switches != 0UL) ? (stat->fields_skipped / stat->switches) : 0UL, stat->calls,
+				(stat->calls != 0UL) ? ticks_to_us(stat->call_ticks / stat->calls) : 0UL,
+				ticks_to_us(stat->call_max_ticks), stat->fiq_posted);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_tee_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_tee_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static void get_lock_stat(char *str_arg, size_t str_max, struct acrn_vm *vm)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct lock_instr_stat *stat = &vm->lock_instr_stat;
+	struct lock_instr_rip rips[LOCK_INSTR_NR_RIPS];
+	uint64_t rflags, emulated, bus_locks, throttled, throttled_ticks;
+	uint16_t i;
+
+	spinlock_irqsave_obtain(&stat->lock, &rflags);
+	emulated = stat->emulated;
+	bus_locks = stat->bus_locks;
+	throttled = stat->throttled;
+	throttled_ticks = stat->throttled_ticks;
+	(void)memcpy_s((void *)rips, sizeof(rips), (void *)stat->rips, sizeof(stat->rips));
+	spinlock_irqrestore_release(&stat->lock, rflags);
+
+	len = snprintf(str, size, "\r\nEMULATED\tBUS_LOCKS\tTHROTTLED\tTHROTTLED_US\r\n%-16lu%-16lu%-16lu%lu",
+			emulated, bus_locks, throttled, ticks_to_us(throttled_ticks));
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	len = snprintf(str, size, "\r\n\r\nRIP\t\t\tCOUNT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < LOCK_INSTR_NR_RIPS; i++) {
+		if (rips[i].count != 0UL) {
+			len = snprintf(str, size, "\r\n0x%016lx\t%lu", rips[i].rip, rips[i].count);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static const char *const boot_phase_names[ACRN_BOOT_PHASE_MAX] = {
+	[ACRN_BOOT_HV_START] = "HV_START",
+	[ACRN_BOOT_PAGING] = "PAGING",
+	[ACRN_BOOT_ACPI] = "ACPI",
+	[ACRN_BOOT_TSC_CALIBRATED] = "TSC_CALIBRATED",
+	[ACRN_BOOT_IOMMU] = "IOMMU",
+	[ACRN_BOOT_PCI] = "PCI",
+	[ACRN_BOOT_EPT_POOL] = "EPT_POOL",
+	[ACRN_BOOT_APS_UP] = "APS_UP",
+	[ACRN_BOOT_PCPUS_READY] = "PCPUS_READY",
+	[ACRN_BOOT_EFI_ENTRY] = "EFI_ENTRY",
+	[ACRN_BOOT_EFI_IMAGES] = "EFI_IMAGES",
+	[ACRN_BOOT_EFI_HANDOFF] = "EFI_HANDOFF",
+};
+
+/* the phases of the EFI stub come before the hypervisor */
+static const uint32_t boot_phase_order[] = {
+	ACRN_BOOT_EFI_ENTRY, ACRN_BOOT_EFI_IMAGES, ACRN_BOOT_EFI_HANDOFF,
+	ACRN_BOOT_HV_START, ACRN_BOOT_PAGING, ACRN_BOOT_ACPI, ACRN_BOOT_TSC_CALIBRATED,
+	ACRN_BOOT_IOMMU, ACRN_BOOT_PCI, ACRN_BOOT_EPT_POOL, ACRN_BOOT_APS_UP, ACRN_BOOT_PCPUS_READY,
+};
+
+static const char *const vm_boot_phase_names[ACRN_VM_BOOT_PHASE_MAX] = {
+	[ACRN_VM_BOOT_CREATE] = "CREATE",
+	[ACRN_VM_BOOT_MEMMAP] = "MEMMAP",
+	[ACRN_VM_BOOT_VCPUS] = "VCPUS",
+	[ACRN_VM_BOOT_LOADING] = "LOADING",
+	[ACRN_VM_BOOT_LOADED] = "LOADED",
+	[ACRN_VM_BOOT_START] = "START",
+};
+
+static void get_boot_time_stat(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	const uint64_t *hv = get_boot_time();
+	const struct acrn_vm_boot_time *vm_bt;
+	uint64_t start = (hv[ACRN_BOOT_EFI_ENTRY] != 0UL) ? hv[ACRN_BOOT_EFI_ENTRY] : hv[ACRN_BOOT_HV_START];
+	uint64_t last = start;
+	uint32_t i, phase;
+	uint16_t vm_id;
+
+	len = snprintf(str, size, "\r\nPHASE\t\t\tUS\t\tDELTA_US");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < ARRAY_SIZE(boot_phase_order); i++) {
+		phase = boot_phase_order[i];
+		if (hv[phase] != 0UL) {
+			len = snprintf(str, size, "\r\n%-24s%-16lu%lu", boot_phase_names[phase],
+					ticks_to_us(hv[phase] - start), ticks_to_us(hv[phase] - last));
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+			last = hv[phase];
+		}
+	}
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_bt = get_vm_boot_time(vm_id);
+		if (vm_bt->phase[ACRN_VM_BOOT_CREATE] == 0UL) {
+			continue;
+		}
+
+		len = snprintf(str, size, "\r\n\r\nVM%hu: %lu KB copied by up to %u pCPUs, %lu KB in place",
+				vm_id, vm_bt->copied >> 10U, vm_bt->copy_pcpus, vm_bt->in_place >> 10U);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+
+		last = vm_bt->phase[ACRN_VM_BOOT_CREATE];
+		for (i = 0U; i < ACRN_VM_BOOT_PHASE_MAX; i++) {
+			if ((vm_boot_phase_names[i] != NULL) && (vm_bt->phase[i] != 0UL)) {
+				len = snprintf(str, size, "\r\n%-24s%-16lu%lu", vm_boot_phase_names[i],
+						ticks_to_us(vm_bt->phase[i] - start), ticks_to_us(vm_bt->phase[i] - last));
+				if (len >= size) {
+					goto overflow;
+				}
+				size -= len;
+				str += len;
+				last = vm_bt->phase[i];
+			}
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_boot_time(__unused int32_t argc, __unused char **argv)
+{
+	get_boot_time_stat(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+static int32_t shell_show_lock_stat(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	int32_t status;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)status));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_lock_stat(shell_log_buf, SHELL_LOG_BUF_SIZE, vm);
+	shell_puts(shell_log_buf);
+
+	return 0;
+}
+
+#define PERF_TOP_MAX_VCPUS	(CONFIG_MAX_VM_NUM * MAX_VCPUS_PER_VM)
+#define PERF_TOP_ROWS		24U
+#define PERF_TOP_MAX_INTERVAL	60
+
+enum perf_top_sort {
+	PERF_SORT_EXITS = 0U,
+	PERF_SORT_IOREQ,
+	PERF_SORT_IRQ,
+	PERF_SORT_RUN,
+	PERF_SORT_DELAY,
+	PERF_SORT_NUM,
+};
+
+static const char *const perf_sort_names[PERF_SORT_NUM] = {
+	[PERF_SORT_EXITS] = "exits",
+	[PERF_SORT_IOREQ] = "ioreq",
+	[PERF_SORT_IRQ] = "irq",
+	[PERF_SORT_RUN] = "run",
+	[PERF_SORT_DELAY] = "delay",
+};
+
+/* counters of a vCPU at the previous frame */
+struct perf_vcpu_sample {
+	uint64_t vm_created;	/* TSC the VM was created at, the sample is stale for another one */
+	uint32_t exits[ACRN_VMEXIT_REASON_MAX];	/* low 32 bits, the increments of an interval fit */
+	uint64_t ioreqs;
+	uint64_t intrs;
+	uint64_t run;
+	uint64_t delay;
+};
+
+/* rates of a vCPU over the interval: per second, or in % of the interval for run and delay */
+struct perf_top_row {
+	uint16_t vm_id;
+	uint16_t vcpu_id;
+	uint16_t pcpu_id;
+	uint32_t top_reason;
+	uint64_t top_exits;
+	uint64_t ioreq_us;
+	uint64_t val[PERF_SORT_NUM];
+};
+
+/*
+ * The shell runs in the console timer callback, which can't wait for the next frame: while perf_top is active,
+ * shell_kick() draws a frame once the interval has elapsed instead of reading a command, until a key is hit.
+ */
+static struct {
+	bool active;
+	uint32_t sort;
+	uint64_t interval;	/* in TSC ticks */
+	uint64_t last_tsc;
+	struct perf_vcpu_sample samples[PERF_TOP_MAX_VCPUS];
+	struct perf_top_row rows[PERF_TOP_MAX_VCPUS];
+} perf_top;
+
+static uint64_t perf_rate(uint64_t delta, uint64_t us)
+{
+	return (us != 0UL) ? ((delta * 1000000UL) / us) : 0UL;
+}
+
+/*
+ * Take the counters of a vCPU as the sample for the next frame, and fill its row from the previous sample
+ *
+ * @return false if the previous sample was of another VM, and so no rate is known yet
+ */
+static bool perf_top_sample(struct acrn_vcpu *vcpu, uint64_t now, uint64_t us, struct perf_top_row *row)
+{
+	struct perf_vcpu_sample *sample = &perf_top.samples[(vcpu->vm->vm_id * MAX_VCPUS_PER_VM) + vcpu->vcpu_id];
+	const struct acrn_sched_stat *stat = &vcpu->thread_obj.stat;
+	uint64_t vm_created = get_vm_boot_time(vcpu->vm->vm_id)->phase[ACRN_VM_BOOT_CREATE];
+	uint64_t ioreqs = 0UL, run = stat->slice_total, exits = 0UL, delta;
+	bool valid = (sample->vm_created == vm_created);
+	uint32_t reason, j;
+
+	/* the slice of a vCPU running now is added to slice_total only once it is switched out */
+	if (sched_get_current(pcpuid_from_vcpu(vcpu)) == &vcpu->thread_obj) {
+		run += now - vcpu->thread_obj.run_tsc;
+	}
+
+	for (j = 0U; j < IOREQ_LAT_HIST_BUCKETS; j++) {
+		ioreqs += vcpu->ioreq_stat.hist[j];
+	}
+
+	row->vm_id = vcpu->vm->vm_id;
+	row->vcpu_id = vcpu->vcpu_id;
+	row->pcpu_id = pcpuid_from_vcpu(vcpu);
+	row->top_reason = 0U;
+	row->top_exits = 0UL;
+	for (reason = 0U; reason < ACRN_VMEXIT_REASON_MAX; reason++) {
+		delta = (uint64_t)((uint32_t)vcpu->exit_stat[reason].count - sample->exits[reason]);
+		if (delta > row->top_exits) {
+			row->top_reason = reason;
+			row->top_exits = delta;
+		}
+		exits += delta;
+		sample->exits[reason] = (uint32_t)vcpu->exit_stat[reason].count;
+	}
+
+	row->top_exits = perf_rate(row->top_exits, us);
+	row->ioreq_us = ticks_to_us(vcpu->ioreq_stat.lat_avg);
+	row->val[PERF_SORT_EXITS] = perf_rate(exits, us);
+	row->val[PERF_SORT_IOREQ] = perf_rate(ioreqs - sample->ioreqs, us);
+	row->val[PERF_SORT_IRQ] = perf_rate(vcpu->intr_accepted - sample->intrs, us);
+	row->val[PERF_SORT_RUN] = (us != 0UL) ? ((ticks_to_us(run - sample->run) * 100UL) / us) : 0UL;
+	row->val[PERF_SORT_DELAY] = (us != 0UL) ? ((ticks_to_us(stat->run_delay_total - sample->delay) * 100UL) / us) : 0UL;
+
+	sample->vm_created = vm_created;
+	sample->ioreqs = ioreqs;
+	sample->intrs = vcpu->intr_accepted;
+	sample->run = run;
+	sample->delay = stat->run_delay_total;
+
+	return valid;
+}
+
+/*
+ * Sample all the vCPUs and sort their rows over the time since the previous call
+ *
+ * @return the number of rows
+ */
+static uint32_t perf_top_collect(uint64_t us)
+{
+	uint64_t now = cpu_ticks();
+	struct perf_top_row *rows = perf_top.rows, tmp;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint32_t nr_rows = 0U, i, j, sort = perf_top.sort;
+	uint16_t idx, vcpu_idx;
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(vcpu_idx, vm, vcpu) {
+			if (perf_top_sample(vcpu, now, us, &rows[nr_rows])) {
+				nr_rows++;
+			}
+		}
+	}
+	perf_top.last_tsc = now;
+
+	/* insertion sort, the rates are taken once per interval */
+	for (i = 1U; i < nr_rows; i++) {
+		tmp = rows[i];
+		for (j = i; (j > 0U) && (rows[j - 1U].val[sort] < tmp.val[sort]); j--) {
+			rows[j] = rows[j - 1U];
+		}
+		rows[j] = tmp;
+	}
+
+	return nr_rows;
+}
+
+static void get_perf_top(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	uint64_t us = ticks_to_us(cpu_ticks() - perf_top.last_tsc);
+	const struct perf_top_row *rows = perf_top.rows;
+	uint32_t nr_rows = perf_top_collect(us), i, sort = perf_top.sort;
+	uint16_t pcpu_id;
+
+	len = snprintf(str, size, "\033[H\033[2J%lu ms, sorted by %s, hit any key to stop\r\n"
+			"\r\nVM\tVCPU\tPCPU\tEXITS/s\t\tTOP_EXIT\tTOP/s\t\tIOREQ/s\t\tIOREQ_US\tIRQ/s\t\tRUN%%\tDELAY%%",
+			us / 1000UL, perf_sort_names[sort]);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; (i < nr_rows) && (i < PERF_TOP_ROWS); i++) {
+		len = snprintf(str, size, "\r\n%hu\t%hu\t%hu\t%-16lu%-16u%-16lu%-16lu%-16lu%-16lu%-8lu%lu",
+				rows[i].vm_id, rows[i].vcpu_id, rows[i].pcpu_id, rows[i].val[PERF_SORT_EXITS],
+				rows[i].top_reason, rows[i].top_exits, rows[i].val[PERF_SORT_IOREQ], rows[i].ioreq_us,
+				rows[i].val[PERF_SORT_IRQ], rows[i].val[PERF_SORT_RUN], rows[i].val[PERF_SORT_DELAY]);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	len = snprintf(str, size, "\r\n\r\nTIMERS (PCPU:ACTIVE)");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		len = snprintf(str, size, " %hu:%u", pcpu_id, per_cpu(cpu_timers, pcpu_id).nr_timers);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+/*
+ * @return true while the perf command refreshes, the shell reads no command in the meantime
+ */
+static bool perf_top_kick(void)
+{
+	if (perf_top.active) {
+		if (shell_getc() != -1) {
+			perf_top.active = false;
+		} else if ((cpu_ticks() - perf_top.last_tsc) >= perf_top.interval) {
+			get_perf_top(shell_log_buf, SHELL_LOG_BUF_SIZE);
+			shell_puts(shell_log_buf);
+		} else {
+			/* wait for the next frame */
+		}
+	}
+
+	return perf_top.active;
+}
+
+static int32_t shell_perf(int32_t argc, char **argv)
+{
+	int32_t interval = 1;
+	uint32_t sort = PERF_SORT_EXITS;
+
+	if (argc > 3) {
+		return -EINVAL;
+	}
+
+	if (argc > 1) {
+		interval = strtol_deci(argv[1]);
+		if ((interval <= 0) || (interval > PERF_TOP_MAX_INTERVAL)) {
+			shell_puts("interval out of range\r\n");
+			return -EINVAL;
+		}
+	}
+
+	if (argc > 2) {
+		for (sort = 0U; sort < PERF_SORT_NUM; sort++) {
+			if (strcmp(argv[2], perf_sort_names[sort]) == 0) {
+				break;
+			}
+		}
+		if (sort == PERF_SORT_NUM) {
+			shell_puts("sort by exits, ioreq, irq, run or delay\r\n");
+			return -EINVAL;
+		}
+	}
+
+	/* the first pass only takes the samples, the rates are drawn from the next one */
+	perf_top.sort = sort;
+	(void)perf_top_collect(0UL);
+
+	perf_top.interval = us_to_ticks((uint32_t)interval * 1000000U);
+	perf_top.active = true;
+	shell_puts("collecting...\r\n");
+
+	return 0;
+}
@@ -101,6 +101,11 @@ struct shell {
 #define SHELL_CMD_LOG_LVL_HELP		"No argument: get the level of logging for the console, memory and npk. Set "\
 					"the level by giving (up to) 3 parameters between 0 and 6 (verbose)"
 
+#define SHELL_CMD_LOG_FMT		"logfmt"
+#define SHELL_CMD_LOG_FMT_PARAM		"[text|binary]"
+#define SHELL_CMD_LOG_FMT_HELP		"No argument: get the format of the memory log. Set it to text, or to binary "\
+					"records decoded by acrnlog -f <acrn.logfmt>"
+
 #define SHELL_CMD_CPUID			"cpuid"
 #define SHELL_CMD_CPUID_PARAM		"<leaf> [subleaf]"
 #define SHELL_CMD_CPUID_HELP		"Display the CPUID leaf [subleaf], in hexadecimal"
@@ -113,4 +118,82 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_MMIO_STAT		"mmio_stat"
+#define SHELL_CMD_MMIO_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_MMIO_STAT_HELP	"Show the emulated MMIO regions of a VM, the per-vCPU handler lookup "\
+					"hint hit/miss counters and the decoded-instruction cache hit/miss counters"
+
+#define SHELL_CMD_EPT_STAT		"ept_stat"
+#define SHELL_CMD_EPT_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_EPT_STAT_HELP		"Show the number of 4K, 2M and 1G leaves in the EPT of a VM and the memory "\
+					"they map"
+
+#define SHELL_CMD_VMEXIT_STAT		"vmexit_stat"
+#define SHELL_CMD_VMEXIT_STAT_PARAM	"<vm id, vcpu id>"
+#define SHELL_CMD_VMEXIT_STAT_HELP	"Show the VM exit count, average cost and log2 cost histogram per exit "\
+					"reason of a vCPU"
+
+#define SHELL_CMD_IOREQ_STAT		"ioreq_stat"
+#define SHELL_CMD_IOREQ_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_IOREQ_STAT_HELP	"Show the I/O request completion latency histogram of a VM and the "\
+					"per-vCPU average latency and hybrid spin hit/miss counters"
+
+#define SHELL_CMD_IPI_STAT		"ipi_stat"
+#define SHELL_CMD_IPI_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_IPI_STAT_HELP		"Show the x2APIC IPIs posted by the multicast fast path or sent by "\
+					"hypercall per vCPU and for the VM: count, average cycles, targets "\
+					"notified or not running"
+
+#define SHELL_CMD_MSR_STAT		"msr_stat"
+#define SHELL_CMD_MSR_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_MSR_STAT_HELP		"Show the RDMSR and WRMSR exits of each vCPU of a VM per MSR"
+
+#define SHELL_CMD_CR_STAT		"cr_stat"
+#define SHELL_CMD_CR_STAT_PARAM		"<vm id>"
+#define SHELL_CMD_CR_STAT_HELP		"Show the CR0/CR4 write exits of each vCPU of a VM per changed bit, "\
+					"and the CLTS and LMSW exits"
+
+#define SHELL_CMD_TEE_STAT		"tee_stat"
+#define SHELL_CMD_TEE_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_TEE_STAT_HELP		"Show the Trusty world switches and the TEE round trips of each vCPU "\
+					"of a normal world, REE or TEE VM"
+
+#define SHELL_CMD_LOCK_STAT		"lock_stat"
+#define SHELL_CMD_LOCK_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_LOCK_STAT_HELP	"Show the split-lock/UC-lock emulations and bus locks of a VM, how often "\
+					"and how long its vCPUs were throttled, and the guest RIPs hit the most"
+
+#define SHELL_CMD_BOOT_TIME		"boot_time"
+#define SHELL_CMD_BOOT_TIME_PARAM	NULL
+#define SHELL_CMD_BOOT_TIME_HELP	"Show the time of each boot phase of the hypervisor and of the VMs, in us "\
+					"from the entry of the hypervisor"
+
+#define SHELL_CMD_SCHED_STAT		"sched_stat"
+#define SHELL_CMD_SCHED_STAT_PARAM	NULL
+#define SHELL_CMD_SCHED_STAT_HELP	"Show the scheduler ticks suppressed per pCPU, for BVT the pick_next "\
+					"latency against the number of runnable threads and the start skew of "\
+					"co-scheduled vCPUs, and for IORR the I/O- or CPU-bound class of each vCPU"
+
+#define SHELL_CMD_SOFTIRQ_STAT		"softirq_stat"
+#define SHELL_CMD_SOFTIRQ_STAT_PARAM	NULL
+#define SHELL_CMD_SOFTIRQ_STAT_HELP	"Show the runs and cycles of each softirq per pCPU, and the passes it was "\
+					"left pending in past the softirq budget"
+
+#define SHELL_CMD_IDLE_STAT		"idle_stat"
+#define SHELL_CMD_IDLE_STAT_PARAM	NULL
+#define SHELL_CMD_IDLE_STAT_HELP	"Show the idle states of the pCPUs, and per pCPU the exit latency limit (-1: "\
+					"none) and for each state its use, residency, the exits before its target "\
+					"residency, and the wakeup latency past the next timer deadline"
+
+#define SHELL_CMD_VCPU_SCHED		"vcpu_sched"
+#define SHELL_CMD_VCPU_SCHED_PARAM	"[<vm id, vcpu id>]"
+#define SHELL_CMD_VCPU_SCHED_HELP	"List the wakeups, preemptions, run delay and slice length of all vCPUs, "\
+					"or show the log2 run delay and slice histograms of one vCPU"
+
+#define SHELL_CMD_PERF			"perf"
+#define SHELL_CMD_PERF_PARAM		"[<interval s> [exits|ioreq|irq|run|delay]]"
+#define SHELL_CMD_PERF_HELP		"Refresh the busiest vCPUs top-style until a key is hit: VM exit, I/O "\
+					"request and interrupt rates, run and run delay in % of the interval, "\
+					"and the active timers per pCPU"
 #endif /* SHELL_PRIV_H */
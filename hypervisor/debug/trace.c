@@ -5,15 +5,24 @@
  */
 
 #include <types.h>
+#include <asm/lib/bits.h>
+#include <asm/cpu.h>
 #include <asm/per_cpu.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/vm.h>
 #include <ticks.h>
 #include <trace.h>
+#include <npk_log.h>
 
 #define TRACE_CUSTOM			0xFCU
 #define TRACE_FUNC_ENTER		0xFDU
 #define TRACE_FUNC_EXIT			0xFEU
 #define TRACE_STR			0xFFU
 
+#define TRACE_REC_SYNC			0x80U
+#define TRACE_REC_MAX			64U
+#define TRACE_SYNC_PERIOD		256U
+
 /* sizeof(trace_entry) == 4 x 64bit */
 struct trace_entry {
 	uint64_t tsc; /* TSC */
@@ -39,24 +48,241 @@ struct trace_entry {
 	} payload;
 } __aligned(8);
 
-static inline bool trace_check(uint16_t cpu_id)
+/* everything is traced until the Service VM sets a filter */
+static struct acrn_trace_filter trace_filter = {
+	.class_mask = ACRN_TRACE_CLASS_ALL,
+	.vm_mask = ~0UL,
+	.vmexit_mask = { ~0UL, ~0UL },
+};
+
+static uint32_t trace_event_class(uint32_t evid)
 {
-	if (per_cpu(sbuf, cpu_id)[ACRN_TRACE] == NULL) {
-		return false;
+	uint32_t class;
+
+	if (evid >= TRACE_VMEXIT_ENTRY) {
+		class = ACRN_TRACE_CLASS_VMEXIT;
+	} else {
+		switch (evid) {
+		case TRACE_TIMER_ACTION_ADDED:
+		case TRACE_TIMER_ACTION_PCKUP:
+		case TRACE_TIMER_ACTION_UPDAT:
+			class = ACRN_TRACE_CLASS_TIMER;
+			break;
+		case TRACE_TIMER_IRQ:
+		case TRACE_IRQ:
+			class = ACRN_TRACE_CLASS_IRQ;
+			break;
+		case TRACE_VM_EXIT:
+		case TRACE_VM_ENTER:
+			class = ACRN_TRACE_CLASS_VMEXIT;
+			break;
+		case TRACE_SCHED_NEXT:
+		case TRACE_SCHED_MIGRATE:
+		case TRACE_TEE_SWITCH:
+			class = ACRN_TRACE_CLASS_SCHED;
+			break;
+		case TRACE_IOREQ:
+			class = ACRN_TRACE_CLASS_IOREQ;
+			break;
+		case TRACE_PTIRQ_BATCH:
+			class = ACRN_TRACE_CLASS_PTIRQ;
+			break;
+		default:
+			class = ACRN_TRACE_CLASS_OTHER;
+			break;
+		}
 	}
 
-	return true;
+	return class;
+}
+
+static bool trace_filter_pass(uint16_t cpu_id, uint32_t evid)
+{
+	const struct acrn_trace_filter *filter = &trace_filter;
+	struct acrn_vcpu *vcpu = NULL;
+	uint32_t class = trace_event_class(evid);
+	uint16_t reason;
+	bool pass = ((filter->class_mask & class) != 0U);
+
+	if (pass && (filter->vm_mask != ~0UL)) {
+		vcpu = get_running_vcpu(cpu_id);
+		if ((vcpu != NULL) && (vcpu->vm->vm_id < 64U)) {
+			pass = bitmap_test(vcpu->vm->vm_id, &filter->vm_mask);
+		}
+	}
+
+	if (pass && (class == ACRN_TRACE_CLASS_VMEXIT) &&
+			((filter->vmexit_mask[0] & filter->vmexit_mask[1]) != ~0UL)) {
+		/* all VM exit events are raised while the exiting vCPU runs */
+		if (vcpu == NULL) {
+			vcpu = get_running_vcpu(cpu_id);
+		}
+		if (vcpu != NULL) {
+			reason = (uint16_t)(vcpu->arch.exit_reason & 0x7FU);
+			pass = bitmap_test(reason & 0x3FU, &filter->vmexit_mask[reason >> 6U]);
+		}
+	}
+
+	return pass;
+}
+
+/*
+ * The first two tests are the only ones taken while neither acrntrace runs
+ * nor the trace hub sink is enabled.
+ */
+static inline bool trace_check(uint16_t cpu_id, uint32_t evid)
+{
+	return ((per_cpu(sbuf, cpu_id)[ACRN_TRACE] != NULL) || npk_trace_enabled()) &&
+		trace_filter_pass(cpu_id, evid);
+}
+
+/*
+ * @pre filter != NULL
+ */
+void set_trace_filter(const struct acrn_trace_filter *filter)
+{
+	/* tracing CPUs may see a mix of the old and the new filter for a moment */
+	trace_filter.class_mask = filter->class_mask;
+	trace_filter.vm_mask = filter->vm_mask;
+	trace_filter.vmexit_mask[0] = filter->vmexit_mask[0];
+	trace_filter.vmexit_mask[1] = filter->vmexit_mask[1];
+}
+
+/* per pCPU state of the compact (SBUF_VAR_LEN) record stream */
+struct trace_compact_state {
+	uint64_t last_tsc;
+	uint32_t count;
+	bool compact;
+};
+
+static struct trace_compact_state trace_state[MAX_PCPU_NUM];
+/* the records sent to the trace hub are always compact, with their own TSC delta chain */
+static struct trace_compact_state npk_trace_state[MAX_PCPU_NUM];
+
+static uint32_t put_varint(uint8_t *p, uint64_t val)
+{
+	uint64_t v = val;
+	uint32_t n = 0U;
+
+	while (v >= 0x80UL) {
+		p[n] = (uint8_t)(v | 0x80UL);
+		v >>= 7U;
+		n++;
+	}
+	p[n] = (uint8_t)v;
+
+	return n + 1U;
+}
+
+/*
+ * Compact record: u8 length, u8 n_data (| TRACE_REC_SYNC), varint event id,
+ * then either u8 pCPU id and the full TSC (sync record) or a varint TSC delta
+ * from the previous record of this pCPU, then the payload. 2L and 4I payloads
+ * are varints, 6C is 6 raw bytes and 16STR is the string without trailing 0.
+ * A sync record is put every TRACE_SYNC_PERIOD records so that a reader can
+ * pick up the stream after overwritten or dropped records.
+ */
+static uint32_t trace_encode(const struct trace_compact_state *state, const struct trace_entry *entry, uint8_t *rec)
+{
+	uint32_t len = 2U, i;
+	bool sync = (!state->compact || (state->count == 0U));
+
+	rec[1] = sync ? (uint8_t)(entry->n_data | TRACE_REC_SYNC) : entry->n_data;
+	len += put_varint(&rec[len], entry->id);
+	if (sync) {
+		rec[len] = entry->cpu;
+		len++;
+		for (i = 0U; i < 8U; i++) {
+			rec[len] = (uint8_t)(entry->tsc >> (i * 8U));
+			len++;
+		}
+	} else {
+		len += put_varint(&rec[len], entry->tsc - state->last_tsc);
+	}
+
+	switch (entry->n_data) {
+	case 2U:
+		len += put_varint(&rec[len], entry->payload.fields_64.e);
+		len += put_varint(&rec[len], entry->payload.fields_64.f);
+		break;
+	case 4U:
+		len += put_varint(&rec[len], entry->payload.fields_32.a);
+		len += put_varint(&rec[len], entry->payload.fields_32.b);
+		len += put_varint(&rec[len], entry->payload.fields_32.c);
+		len += put_varint(&rec[len], entry->payload.fields_32.d);
+		break;
+	case 8U:
+		rec[len] = entry->payload.fields_8.a1;
+		rec[len + 1U] = entry->payload.fields_8.a2;
+		rec[len + 2U] = entry->payload.fields_8.a3;
+		rec[len + 3U] = entry->payload.fields_8.a4;
+		rec[len + 4U] = entry->payload.fields_8.b1;
+		rec[len + 5U] = entry->payload.fields_8.b2;
+		len += 6U;
+		break;
+	default:
+		for (i = 0U; (i < 15U) && (entry->payload.str[i] != '\0'); i++) {
+			rec[len] = (uint8_t)entry->payload.str[i];
+			len++;
+		}
+		break;
+	}
+	rec[0] = (uint8_t)len;
+
+	return len;
+}
+
+/*
+ * The trace hub sink takes the events instead of the shared buffer while it
+ * is enabled: each one is a few MMIO stores, captured outside the platform.
+ */
+static void trace_put_npk(uint16_t cpu_id, const struct trace_entry *entry)
+{
+	struct trace_compact_state *state = &npk_trace_state[cpu_id];
+	uint8_t rec[TRACE_REC_MAX];
+	uint32_t len;
+
+	len = trace_encode(state, entry, rec);
+	npk_trace_write(cpu_id, rec, len);
+	state->last_tsc = entry->tsc;
+	state->count = (state->count + 1U) % TRACE_SYNC_PERIOD;
+	state->compact = true;
 }
 
 static inline void trace_put(uint16_t cpu_id, uint32_t evid, uint32_t n_data, struct trace_entry *entry)
 {
 	struct shared_buf *sbuf = per_cpu(sbuf, cpu_id)[ACRN_TRACE];
+	struct trace_compact_state *state = &trace_state[cpu_id];
+	uint8_t rec[TRACE_REC_MAX];
+	uint32_t len;
+	bool compact;
 
 	entry->tsc = cpu_ticks();
 	entry->id = evid;
 	entry->n_data = (uint8_t)n_data;
 	entry->cpu = (uint8_t)cpu_id;
-	(void)sbuf_put(sbuf, (uint8_t *)entry, sizeof(*entry));
+
+	if (npk_trace_enabled()) {
+		trace_put_npk(cpu_id, entry);
+		return;
+	}
+
+	stac();
+	compact = ((sbuf->flags & SBUF_VAR_LEN) != 0U);
+	clac();
+
+	if (compact) {
+		len = trace_encode(state, entry, rec);
+		if (sbuf_put_var(sbuf, rec, len) == len) {
+			/* a dropped record does not break the TSC delta chain */
+			state->last_tsc = entry->tsc;
+			state->count = (state->count + 1U) % TRACE_SYNC_PERIOD;
+			state->compact = true;
+		}
+	} else {
+		state->compact = false;
+		(void)sbuf_put(sbuf, (uint8_t *)entry, sizeof(*entry));
+	}
 }
 
 void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
@@ -64,7 +290,7 @@ void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
 	struct trace_entry entry;
 	uint16_t cpu_id = get_pcpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -78,7 +304,7 @@ void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
 	struct trace_entry entry;
 	uint16_t cpu_id = get_pcpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -94,7 +320,7 @@ void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uin
 	struct trace_entry entry;
 	uint16_t cpu_id = get_pcpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -117,7 +343,7 @@ void TRACE_16STR(uint32_t evid, const char name[])
 	uint16_t cpu_id = get_pcpu_id();
 	size_t len, i;
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
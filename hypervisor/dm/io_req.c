@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <logmsg.h>
 #include <sbuf.h>
+#include <trace.h>
 
 #define DBG_LEVEL_IOREQ	6U
 
@@ -56,11 +57,21 @@ __unused static void acrn_print_request(uint16_t vcpu_id, const struct acrn_io_r
  */
 void reset_vm_ioreqs(struct acrn_vm *vm)
 {
+	struct acrn_io_request_buffer *req_buf;
 	uint16_t i;
 
 	for (i = 0U; i < ACRN_IO_REQUEST_MAX; i++) {
 		set_io_req_state(vm, i, ACRN_IOREQ_STATE_FREE);
 	}
+
+	req_buf = (struct acrn_io_request_buffer *)vm->sw.io_shared_page;
+	if (req_buf != NULL) {
+		/* the device model scans only the slots in pending_mask once it sees the feature */
+		stac();
+		req_buf->req_slot[0].pending_mask = 0UL;
+		req_buf->req_slot[0].buf_features = ACRN_IOREQ_BUF_PENDING_MASK;
+		clac();
+	}
 }
 
 /**
@@ -164,11 +175,13 @@ static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 	return (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_COMPLETE);
 }
 
-static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struct io_request *io_req,
+	struct acrn_asyncio_entry *entry)
 {
 	uint64_t addr = 0UL;
 	uint32_t type;
 	uint64_t value;
+	uint64_t size;
 	struct list_head *pos;
 	struct asyncio_desc *iter_desc;
 	struct acrn_asyncio_info *iter_info;
@@ -182,12 +195,14 @@ static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struc
 		case ACRN_IOREQ_TYPE_PORTIO:
 			addr = io_req->reqs.pio_request.address;
 			value = io_req->reqs.pio_request.value;
+			size = io_req->reqs.pio_request.size;
 			type = ACRN_ASYNCIO_PIO;
 			break;
 
 		case ACRN_IOREQ_TYPE_MMIO:
 			addr = io_req->reqs.mmio_request.address;
 			value = io_req->reqs.mmio_request.value;
+			size = io_req->reqs.mmio_request.size;
 			type = ACRN_ASYNCIO_MMIO;
 			break;
 		default:
@@ -201,6 +216,11 @@ static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struc
 					iter_info = &(iter_desc->asyncio_info);
 					if ((iter_info->addr == addr) && (iter_info->type == type) &&
 						((iter_info->match_data == 0U) || (iter_info->data == value))) {
+						entry->fd = iter_info->fd;
+						entry->addr = addr;
+						entry->data = value;
+						entry->type = type;
+						entry->size = (uint32_t)size;
 						ret = iter_desc;
 						break;
 					}
@@ -212,16 +232,18 @@ static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struc
 	return ret;
 
 }
-static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, const uint64_t asyncio_fd)
+static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, struct acrn_asyncio_entry *entry)
 {
 	struct acrn_vm *vm = vcpu->vm;
 	struct shared_buf *sbuf =
 		(struct shared_buf *)vm->sw.asyncio_sbuf;
+	/* legacy asyncio sbuf only takes the fd cookie, which is the first field */
+	uint32_t len = vm->sw.asyncio_payload ? sizeof(*entry) : sizeof(entry->fd);
 	int ret = -ENODEV;
 
 	if (sbuf != NULL) {
 		spinlock_obtain(&vm->asyncio_lock);
-		while (sbuf_put(sbuf, (uint8_t *)&asyncio_fd, sizeof(asyncio_fd)) == 0U) {
+		while (sbuf_put(sbuf, (uint8_t *)entry, len) == 0U) {
 			/* sbuf is full, try later.. */
 			spinlock_release(&vm->asyncio_lock);
 			asm_pause();
@@ -237,6 +259,57 @@ static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, const uint64_t asyncio_fd
 	}
 	return ret;
 }
+/* hybrid completion never spins longer than this, slower requests are slept on */
+#define IOREQ_SPIN_MAX_US	50U
+
+static void account_ioreq_latency(struct acrn_vcpu *vcpu, uint64_t ticks)
+{
+	struct vcpu_ioreq_stat *stat = &vcpu->ioreq_stat;
+	uint64_t us = ticks_to_us(ticks);
+	uint32_t bucket = 0U;
+
+	if (us != 0UL) {
+		bucket = min((uint32_t)fls64(us) + 1U, IOREQ_LAT_HIST_BUCKETS - 1U);
+	}
+	stat->hist[bucket]++;
+
+	/* moving average with a weight of 1/8 for the new sample */
+	stat->lat_avg = stat->lat_avg - (stat->lat_avg >> 3U) + (ticks >> 3U);
+}
+
+/*
+ * Spin for twice the recent average completion latency, unless the
+ * device model has been slower than IOREQ_SPIN_MAX_US on average.
+ */
+static void wait_ioreq_hybrid(struct acrn_vcpu *vcpu, uint64_t start)
+{
+	struct vcpu_ioreq_stat *stat = &vcpu->ioreq_stat;
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+	uint64_t budget = 0UL;
+
+	if (stat->lat_avg < us_to_ticks(IOREQ_SPIN_MAX_US)) {
+		budget = stat->lat_avg << 1U;
+	}
+
+	while (!has_complete_ioreq(vcpu) && ((cpu_ticks() - start) < budget) && !need_reschedule(pcpu_id)) {
+		asm_pause();
+	}
+
+	if (has_complete_ioreq(vcpu)) {
+		stat->spin_hits++;
+	} else {
+		stat->spin_misses++;
+		/*
+		 * HSM sets the request COMPLETE before it notifies us, so a request
+		 * that completed while spinning leaves a late signal behind. Only
+		 * the request state tells whether this request is done.
+		 */
+		while (!has_complete_ioreq(vcpu)) {
+			wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+		}
+	}
+}
+
 /**
  * @brief Deliver \p io_req to Service VM and suspend \p vcpu till its completion
  *
@@ -252,6 +325,7 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 	bool is_polling = false;
 	int32_t ret = 0;
 	uint16_t cur;
+	uint64_t start, latency;
 
 	if ((vcpu->vm->sw.io_shared_page != NULL)
 		 && (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_FREE)) {
@@ -269,6 +343,12 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 			acrn_io_req->completion_polling = 1U;
 			is_polling = true;
 		}
+		/* the device model stamps the following stages, if it traces them */
+		acrn_io_req->tsc_insert = cpu_ticks();
+		acrn_io_req->tsc_pickup = 0UL;
+		acrn_io_req->tsc_handled = 0UL;
+		/* the bit of the slot is set before it turns PENDING, the locked op orders the fill as well */
+		bitmap_set_lock(cur, &req_buf->req_slot[0].pending_mask);
 		clac();
 
 		/* Before updating the acrn_io_req state, enforce all fill acrn_io_req operations done */
@@ -280,6 +360,7 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 		 * because HSM can work in pulling mode without wait for upcall
 		 */
 		set_io_req_state(vcpu->vm, vcpu->vcpu_id, ACRN_IOREQ_STATE_PENDING);
+		start = cpu_ticks();
 
 		/* signal HSM */
 		arch_fire_hsm_interrupt();
@@ -296,9 +377,14 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 					schedule();
 				}
 			}
+		} else if (vcpu->vm->sw.is_hybrid_ioreq) {
+			wait_ioreq_hybrid(vcpu, start);
 		} else {
 			wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
 		}
+		latency = cpu_ticks() - start;
+		account_ioreq_latency(vcpu, latency);
+		TRACE_2L(TRACE_IOREQ, (uint64_t)io_req->io_type, latency);
 	} else {
 		ret = -EINVAL;
 	}
@@ -352,7 +438,9 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva)
 
 	stac();
 	if (sbuf != NULL) {
-		if (sbuf->magic == SBUF_MAGIC) {
+		if ((sbuf->magic == SBUF_MAGIC) && ((sbuf->ele_size == sizeof(uint64_t)) ||
+			(sbuf->ele_size == sizeof(struct acrn_asyncio_entry)))) {
+			vm->sw.asyncio_payload = (sbuf->ele_size == sizeof(struct acrn_asyncio_entry));
 			vm->sw.asyncio_sbuf = sbuf;
 			INIT_LIST_HEAD(&vm->aiodesc_queue);
 			spinlock_init(&vm->asyncio_lock);
@@ -364,6 +452,179 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva)
 	return ret;
 }
 
+int init_posted_io(struct acrn_vm *vm, uint64_t *hva)
+{
+	struct shared_buf *sbuf = (struct shared_buf *)hva;
+	int ret = -1;
+
+	stac();
+	if (sbuf != NULL) {
+		if ((sbuf->magic == SBUF_MAGIC) && (sbuf->ele_size == sizeof(struct acrn_posted_io))) {
+			spinlock_obtain(&vm->posted_io_lock);
+			vm->sw.posted_io_sbuf = sbuf;
+			spinlock_release(&vm->posted_io_lock);
+			ret = 0;
+		}
+	}
+	clac();
+
+	return ret;
+}
+
+/**
+ * @pre vm->posted_io_lock is held
+ */
+static bool posted_io_range_overlapped(const struct acrn_vm *vm, const struct acrn_posted_io_range *range)
+{
+	uint32_t i;
+	const struct acrn_posted_io_range *p;
+	bool ret = false;
+
+	for (i = 0U; i < ACRN_POSTED_IO_RANGE_MAX; i++) {
+		p = &vm->posted_io_range[i];
+		if ((p->len != 0UL) && (p->type == range->type) &&
+			(range->addr < (p->addr + p->len)) && (p->addr < (range->addr + range->len))) {
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int32_t add_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range)
+{
+	uint32_t i;
+	struct acrn_posted_io_range *p;
+	int32_t ret = -EINVAL;
+
+	if (((range->type == ACRN_IOREQ_TYPE_PORTIO) || (range->type == ACRN_IOREQ_TYPE_MMIO)) &&
+		(range->len != 0UL) && ((range->addr + range->len) > range->addr)) {
+		spinlock_obtain(&vm->posted_io_lock);
+		if (posted_io_range_overlapped(vm, range)) {
+			ret = -EBUSY;
+		} else {
+			ret = -ENOMEM;
+			for (i = 0U; i < ACRN_POSTED_IO_RANGE_MAX; i++) {
+				p = &vm->posted_io_range[i];
+				if (p->len == 0UL) {
+					*p = *range;
+					ret = 0;
+					break;
+				}
+			}
+		}
+		spinlock_release(&vm->posted_io_lock);
+	}
+
+	if (ret != 0) {
+		pr_err("%s: failed to add posted range [0x%lx, 0x%lx) type %u: %d", __func__,
+			range->addr, range->addr + range->len, range->type, ret);
+	}
+
+	return ret;
+}
+
+int32_t remove_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range)
+{
+	uint32_t i;
+	struct acrn_posted_io_range *p;
+	int32_t ret = -EINVAL;
+
+	spinlock_obtain(&vm->posted_io_lock);
+	for (i = 0U; i < ACRN_POSTED_IO_RANGE_MAX; i++) {
+		p = &vm->posted_io_range[i];
+		if ((p->len != 0UL) && (p->type == range->type) &&
+			(p->addr == range->addr) && (p->len == range->len)) {
+			(void)memset(p, 0U, sizeof(*p));
+			ret = 0;
+			break;
+		}
+	}
+	spinlock_release(&vm->posted_io_lock);
+
+	return ret;
+}
+
+/**
+ * @pre vm->posted_io_lock is held
+ */
+static bool is_posted_io(const struct acrn_vm *vm, uint32_t type, uint64_t addr, uint64_t size)
+{
+	uint32_t i;
+	const struct acrn_posted_io_range *p;
+	bool ret = false;
+
+	for (i = 0U; i < ACRN_POSTED_IO_RANGE_MAX; i++) {
+		p = &vm->posted_io_range[i];
+		if ((p->len != 0UL) && (p->type == type) &&
+			(addr >= p->addr) && ((addr + size) <= (p->addr + p->len))) {
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Queue a guest write to a posted range without suspending \p vcpu
+ *
+ * The write is appended to the posted I/O sbuf of the VM. Only writes hitting
+ * a range registered by HC_POSTED_IO_ASSIGN are posted. The sbuf is per VM
+ * rather than per vCPU so that the DM observes posted writes of all vCPUs in
+ * the order they were issued.
+ *
+ * @retval 0 The write has been posted.
+ * @retval -ENODEV The request is not a posted write or the sbuf is full, the
+ *         caller shall fall back to a synchronous I/O request.
+ */
+static int32_t acrn_insert_posted_io(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct shared_buf *sbuf;
+	struct acrn_posted_io entry;
+	uint32_t direction = ACRN_IOREQ_DIR_READ;
+	int32_t ret = -ENODEV;
+
+	(void)memset(&entry, 0U, sizeof(entry));
+	entry.type = io_req->io_type;
+	entry.vcpu_id = vcpu->vcpu_id;
+	if (io_req->io_type == ACRN_IOREQ_TYPE_PORTIO) {
+		direction = io_req->reqs.pio_request.direction;
+		entry.addr = io_req->reqs.pio_request.address;
+		entry.size = (uint16_t)io_req->reqs.pio_request.size;
+		entry.value = io_req->reqs.pio_request.value;
+	} else if (io_req->io_type == ACRN_IOREQ_TYPE_MMIO) {
+		direction = io_req->reqs.mmio_request.direction;
+		entry.addr = io_req->reqs.mmio_request.address;
+		entry.size = (uint16_t)io_req->reqs.mmio_request.size;
+		entry.value = io_req->reqs.mmio_request.value;
+	} else {
+		/* Only port I/O and MMIO writes can be posted */
+	}
+
+	if ((direction == ACRN_IOREQ_DIR_WRITE) && (vm->sw.posted_io_sbuf != NULL)) {
+		spinlock_obtain(&vm->posted_io_lock);
+		sbuf = (struct shared_buf *)vm->sw.posted_io_sbuf;
+		if ((sbuf != NULL) && is_posted_io(vm, entry.type, entry.addr, entry.size)) {
+			if (sbuf_put(sbuf, (uint8_t *)&entry, sizeof(entry)) == sizeof(entry)) {
+				ret = 0;
+			}
+		}
+		spinlock_release(&vm->posted_io_lock);
+
+		if (ret == 0) {
+			/* HSM folds consecutive upcalls into one eventfd signal, and the
+			 * DM drains the whole sbuf per wakeup.
+			 */
+			arch_fire_hsm_interrupt();
+		}
+	}
+
+	return ret;
+}
+
 void set_hsm_notification_vector(uint32_t vector)
 {
 	acrn_hsm_notification_vector = vector;
@@ -472,7 +733,17 @@ static void dm_emulate_mmio_complete(struct acrn_vcpu *vcpu)
  */
 static void dm_emulate_io_complete(struct acrn_vcpu *vcpu)
 {
+	struct acrn_io_request_buffer *req_buf;
+
 	if (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_COMPLETE) {
+		req_buf = (struct acrn_io_request_buffer *)vcpu->vm->sw.io_shared_page;
+		stac();
+		/* only the requests the device model traced, see acrn_io_request */
+		if (req_buf->req_slot[vcpu->vcpu_id].tsc_handled != 0UL) {
+			req_buf->req_slot[vcpu->vcpu_id].tsc_complete = cpu_ticks();
+		}
+		clac();
+
 		/*
 		 * If vcpu is in Zombie state and will be destroyed soon. Just
 		 * mark ioreq done and don't resume vcpu.
@@ -579,12 +850,41 @@ static int32_t mmio_default_access_handler(struct io_request *io_req,
  * @retval -ENODEV No proper handler found.
  * @retval -EIO The request spans multiple devices and cannot be emulated.
  */
+/**
+ * @brief Find the port I/O handler of a port
+ *
+ * The ports below EMUL_PIO_MAP_PORTS are looked up in the direct map, the others in the handlers by index. The
+ * handler of the lowest index covering the port is the one used either way.
+ *
+ * @return The handler covering \p port, or NULL.
+ */
+static struct vm_io_handler_desc *find_pio_handler(struct acrn_vm *vm, uint16_t port)
+{
+	struct vm_io_handler_desc *handler = NULL;
+	uint32_t idx;
+
+	if (port < EMUL_PIO_MAP_PORTS) {
+		idx = vm->emul_pio_map[port];
+		if (idx != 0U) {
+			handler = &(vm->emul_pio[idx - 1U]);
+		}
+	} else {
+		for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+			if ((port >= vm->emul_pio[idx].port_start) && (port < vm->emul_pio[idx].port_end)) {
+				handler = &(vm->emul_pio[idx]);
+				break;
+			}
+		}
+	}
+
+	return handler;
+}
+
 static int32_t
 hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
 	uint16_t port, size;
-	uint32_t idx;
 	struct acrn_vm *vm = vcpu->vm;
 	struct acrn_pio_request *pio_req = &io_req->reqs.pio_request;
 	struct vm_io_handler_desc *handler;
@@ -599,20 +899,14 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	port = (uint16_t)pio_req->address;
 	size = (uint16_t)pio_req->size;
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
-		handler = &(vm->emul_pio[idx]);
-
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
-		}
-
+	handler = find_pio_handler(vm, port);
+	if (handler != NULL) {
 		if (handler->io_read != NULL) {
 			io_read = handler->io_read;
 		}
 		if (handler->io_write != NULL) {
 			io_write = handler->io_write;
 		}
-		break;
 	}
 
 	if ((pio_req->direction == ACRN_IOREQ_DIR_WRITE) && (io_write != NULL)) {
@@ -633,6 +927,76 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+static inline bool mmio_node_contains(const struct mem_io_node *mmio_node, uint64_t address, uint64_t size)
+{
+	return (mmio_node->read_write != NULL) &&
+		(address >= mmio_node->range_start) && ((address + size) <= mmio_node->range_end);
+}
+
+/**
+ * @brief Find the registered MMIO node that covers an access
+ *
+ * The per-vCPU hint of the last matched node is checked first, then the range
+ * sorted index is binary searched. Registered ranges never overlap.
+ *
+ * @pre vcpu->vm->emul_mmio_lock is held
+ *
+ * @param status Set to -EIO if the access spans multiple ranges, untouched otherwise.
+ *
+ * @return The node covering [address, address + size), or NULL.
+ */
+static struct mem_io_node *find_mmio_node_by_addr(struct acrn_vcpu *vcpu,
+		uint64_t address, uint64_t size, int32_t *status)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct mem_io_node *mmio_node = NULL, *next;
+	uint16_t lo = 0U, hi = vm->nr_emul_mmio_index, mid;
+
+	if (vcpu->mmio_hint < CONFIG_MAX_EMULATED_MMIO_REGIONS) {
+		mmio_node = &vm->emul_mmio[vcpu->mmio_hint];
+		if (mmio_node_contains(mmio_node, address, size)) {
+			vcpu->mmio_hint_hits++;
+		} else {
+			mmio_node = NULL;
+		}
+	}
+
+	if (mmio_node == NULL) {
+		vcpu->mmio_hint_misses++;
+
+		/* find the first range whose start is above address */
+		while (lo < hi) {
+			mid = lo + ((hi - lo) >> 1U);
+			if (vm->emul_mmio[vm->emul_mmio_index[mid]].range_start <= address) {
+				lo = mid + 1U;
+			} else {
+				hi = mid;
+			}
+		}
+
+		/* the range right below (or at) address may cover the access */
+		if ((lo > 0U) && (address < vm->emul_mmio[vm->emul_mmio_index[lo - 1U]].range_end)) {
+			mmio_node = &vm->emul_mmio[vm->emul_mmio_index[lo - 1U]];
+			if (mmio_node_contains(mmio_node, address, size)) {
+				vcpu->mmio_hint = vm->emul_mmio_index[lo - 1U];
+			} else {
+				mmio_node = NULL;
+				*status = -EIO;
+			}
+		} else if (lo < vm->nr_emul_mmio_index) {
+			/* the access must not run into the next range */
+			next = &vm->emul_mmio[vm->emul_mmio_index[lo]];
+			if ((address + size) > next->range_start) {
+				*status = -EIO;
+			}
+		} else {
+			/* no range above address */
+		}
+	}
+
+	return mmio_node;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
@@ -648,8 +1012,7 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
 	bool hold_lock = true;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	uint64_t address, size;
 	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
 	struct mem_io_node *mmio_handler = NULL;
 	hv_mem_io_handler_t read_write = NULL;
@@ -663,26 +1026,15 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	size = mmio_req->size;
 
 	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->nr_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
-
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
-			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					hold_lock = mmio_handler->hold_lock;
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
-				}
-				break;
-			}
-		}
+	mmio_handler = find_mmio_node_by_addr(vcpu, address, size, &status);
+	if (mmio_handler != NULL) {
+		hold_lock = mmio_handler->hold_lock;
+		read_write = mmio_handler->read_write;
+		handler_private_data = mmio_handler->handler_private_data;
+	} else if (status == -EIO) {
+		pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+	} else {
+		/* No registered handler covers the access */
 	}
 
 	if ((status == -ENODEV) && (read_write != NULL)) {
@@ -727,8 +1079,10 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	int32_t status;
 	struct acrn_vm_config *vm_config;
 	struct asyncio_desc *aio_desc;
+	struct acrn_asyncio_entry aio_entry;
 
 	vm_config = get_vm_config(vcpu->vm->vm_id);
+	io_req->dm_emulated = false;
 
 	switch (io_req->io_type) {
 	case ACRN_IOREQ_TYPE_PORTIO:
@@ -756,9 +1110,13 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		 *
 		 * ACRN insert request to HSM and inject upcall.
 		 */
-		aio_desc = get_asyncio_desc(vcpu, io_req);
+		io_req->dm_emulated = true;
+		aio_desc = get_asyncio_desc(vcpu, io_req, &aio_entry);
 		if (aio_desc) {
-			status = acrn_insert_asyncio(vcpu, aio_desc->asyncio_info.fd);
+			status = acrn_insert_asyncio(vcpu, &aio_entry);
+		} else if (acrn_insert_posted_io(vcpu, io_req) == 0) {
+			/* Posted write, the vCPU doesn't wait for its completion */
+			status = 0;
 		} else {
 			status = acrn_insert_request(vcpu, io_req);
 			if (status == 0) {
@@ -794,6 +1152,8 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 		const struct vm_io_range *range, io_read_fn_t io_read_fn_ptr, io_write_fn_t io_write_fn_ptr)
 {
+	uint32_t idx, port, end;
+
 	if (is_service_vm(vm)) {
 		deny_guest_pio_access(vm, range->base, range->len);
 	}
@@ -801,6 +1161,17 @@ void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 	vm->emul_pio[pio_idx].port_end = range->base + range->len;
 	vm->emul_pio[pio_idx].io_read = io_read_fn_ptr;
 	vm->emul_pio[pio_idx].io_write = io_write_fn_ptr;
+
+	/* rebuild the direct map, the lowest index wins the ports handled twice */
+	(void)memset(vm->emul_pio_map, 0U, sizeof(vm->emul_pio_map));
+	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+		end = min((uint32_t)vm->emul_pio[idx].port_end, EMUL_PIO_MAP_PORTS);
+		for (port = vm->emul_pio[idx].port_start; port < end; port++) {
+			if (vm->emul_pio_map[port] == 0U) {
+				vm->emul_pio_map[port] = (uint8_t)(idx + 1U);
+			}
+		}
+	}
 }
 
 /**
@@ -861,19 +1232,33 @@ static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
 }
 
 /**
- * @brief Register a MMIO handler
- *
- * This API registers a MMIO handler to \p vm
+ * @brief Rebuild the sorted MMIO range index of \p vm
  *
- * @param vm The VM to which the MMIO handler is registered
- * @param read_write The handler for emulating accesses to the given range
- * @param start The base address of the range \p read_write can emulate
- * @param end The end of the range (exclusive) \p read_write can emulate
- * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
+ * @pre vm->emul_mmio_lock is held
  */
-void register_mmio_emulation_handler(struct acrn_vm *vm,
+static void rebuild_mmio_index(struct acrn_vm *vm)
+{
+	uint16_t idx, pos, nr = 0U;
+
+	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
+		if (vm->emul_mmio[idx].read_write != NULL) {
+			/* insertion sort, the number of regions is small */
+			pos = nr;
+			while ((pos > 0U) && (vm->emul_mmio[vm->emul_mmio_index[pos - 1U]].range_start >
+					vm->emul_mmio[idx].range_start)) {
+				vm->emul_mmio_index[pos] = vm->emul_mmio_index[pos - 1U];
+				pos--;
+			}
+			vm->emul_mmio_index[pos] = idx;
+			nr++;
+		}
+	}
+	vm->nr_emul_mmio_index = nr;
+}
+
+static void register_mmio_node(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
-	uint64_t end, void *handler_private_data, bool hold_lock)
+	uint64_t end, void *handler_private_data, bool hold_lock, bool doorbell)
 {
 	struct mem_io_node *mmio_node;
 
@@ -884,16 +1269,76 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 		if (mmio_node != NULL) {
 			/* Fill in information for this node */
 			mmio_node->hold_lock = hold_lock;
+			mmio_node->doorbell = doorbell;
 			mmio_node->read_write = read_write;
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
+			rebuild_mmio_index(vm);
 		}
 		spinlock_release(&vm->emul_mmio_lock);
 	}
 
 }
 
+/**
+ * @brief Register a MMIO handler
+ *
+ * This API registers a MMIO handler to \p vm
+ *
+ * @param vm The VM to which the MMIO handler is registered
+ * @param read_write The handler for emulating accesses to the given range
+ * @param start The base address of the range \p read_write can emulate
+ * @param end The end of the range (exclusive) \p read_write can emulate
+ * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
+ */
+void register_mmio_emulation_handler(struct acrn_vm *vm,
+	hv_mem_io_handler_t read_write, uint64_t start,
+	uint64_t end, void *handler_private_data, bool hold_lock)
+{
+	register_mmio_node(vm, read_write, start, end, handler_private_data, hold_lock, false);
+}
+
+void register_mmio_doorbell_handler(struct acrn_vm *vm,
+	hv_mem_io_handler_t read_write, uint64_t start,
+	uint64_t end, void *handler_private_data)
+{
+	register_mmio_node(vm, read_write, start, end, handler_private_data, false, true);
+}
+
+int32_t emulate_mmio_doorbell(struct acrn_vcpu *vcpu, uint64_t gpa)
+{
+	int32_t status = -ENODEV;
+	struct io_request *io_req = &vcpu->req;
+	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
+	struct mem_io_node *mmio_node;
+	hv_mem_io_handler_t read_write = NULL;
+	void *handler_private_data = NULL;
+
+	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
+	mmio_node = find_mmio_node_by_addr(vcpu, gpa, 1UL, &status);
+	if ((mmio_node != NULL) && mmio_node->doorbell) {
+		read_write = mmio_node->read_write;
+		handler_private_data = mmio_node->handler_private_data;
+	}
+	spinlock_release(&vcpu->vm->emul_mmio_lock);
+
+	if (read_write != NULL) {
+		io_req->io_type = ACRN_IOREQ_TYPE_MMIO;
+		mmio_req->direction = ACRN_IOREQ_DIR_WRITE;
+		mmio_req->address = gpa;
+		mmio_req->size = 0UL;
+		mmio_req->value = 0UL;
+		/* a doorbell node is never modified once registered, as for !hold_lock */
+		(void)read_write(io_req, handler_private_data);
+		status = 0;
+	} else {
+		status = -ENODEV;
+	}
+
+	return status;
+}
+
 /**
  * @brief Unregister a MMIO handler
  *
@@ -912,6 +1357,7 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 	mmio_node = find_match_mmio_node(vm, start, end);
 	if (mmio_node != NULL) {
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
+		rebuild_mmio_index(vm);
 	}
 	spinlock_release(&vm->emul_mmio_lock);
 }
@@ -919,5 +1365,7 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 void deinit_emul_io(struct acrn_vm *vm)
 {
 	(void)memset(vm->emul_mmio, 0U, sizeof(vm->emul_mmio));
+	vm->nr_emul_mmio_index = 0U;
 	(void)memset(vm->emul_pio, 0U, sizeof(vm->emul_pio));
+	(void)memset(vm->emul_pio_map, 0U, sizeof(vm->emul_pio_map));
 }
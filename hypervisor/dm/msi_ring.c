@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <asm/lib/atomic.h>
+#include <asm/cpu.h>
+#include <asm/per_cpu.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vlapic.h>
+#include <msi_ring.h>
+#include <ticks.h>
+#include <logmsg.h>
+
+/* an idle pCPU polls the rings this long after the last MSI it took */
+#define MSI_RING_POLL_US	200U
+
+static uint32_t nr_msi_rings;
+static uint32_t msi_ring_poller = (uint32_t)INVALID_CPU_ID;
+static uint64_t msi_ring_poll_end;
+
+int32_t init_msi_ring(struct acrn_vm *vm, uint64_t *hva)
+{
+	struct acrn_msi_ring *ring = (struct acrn_msi_ring *)hva;
+	uint32_t nr_entries;
+	int32_t ret = -1;
+
+	if ((ring != NULL) && is_severity_pass(vm->vm_id)) {
+		stac();
+		nr_entries = ring->nr_entries;
+		if ((ring->magic == ACRN_MSI_RING_MAGIC) && (nr_entries != 0U) &&
+				((nr_entries & (nr_entries - 1U)) == 0U) && (nr_entries <= ACRN_MSI_RING_MAX)) {
+			/* no pCPU polls the new ring until the next one starts polling */
+			ring->doorbell = 1U;
+			spinlock_obtain(&vm->msi_ring_lock);
+			if (vm->sw.msi_ring == NULL) {
+				atomic_inc32(&nr_msi_rings);
+			}
+			vm->sw.msi_ring_entries = nr_entries;
+			vm->sw.msi_ring_cons = ring->cons;
+			vm->sw.msi_ring = ring;
+			spinlock_release(&vm->msi_ring_lock);
+			ret = 0;
+		}
+		clac();
+	}
+
+	return ret;
+}
+
+void deinit_msi_ring(struct acrn_vm *vm)
+{
+	spinlock_obtain(&vm->msi_ring_lock);
+	if (vm->sw.msi_ring != NULL) {
+		vm->sw.msi_ring = NULL;
+		atomic_dec32(&nr_msi_rings);
+	}
+	spinlock_release(&vm->msi_ring_lock);
+}
+
+uint32_t drain_msi_ring(struct acrn_vm *vm)
+{
+	struct acrn_msi_ring *ring;
+	struct acrn_msi_entry msi;
+	uint32_t cons, prod, n = 0U;
+
+	spinlock_obtain(&vm->msi_ring_lock);
+	ring = (struct acrn_msi_ring *)vm->sw.msi_ring;
+	if (ring != NULL) {
+		/* cons is the copy of the hypervisor, the DM can't move it */
+		cons = vm->sw.msi_ring_cons;
+		stac();
+		prod = ring->prod;
+		/* the entries are read after prod, loads aren't reordered with other loads */
+		cpu_compiler_barrier();
+		if ((prod - cons) > vm->sw.msi_ring_entries) {
+			pr_err("%s: vm%hu MSI ring corrupted, prod %u cons %u", __func__, vm->vm_id, prod, cons);
+			cons = prod;
+		}
+
+		while (cons != prod) {
+			msi = ring->entries[cons & (vm->sw.msi_ring_entries - 1U)];
+			clac();
+			(void)vlapic_inject_msi(vm, msi.msi_addr, msi.msi_data);
+			stac();
+			cons++;
+			n++;
+		}
+		ring->cons = cons;
+		clac();
+		vm->sw.msi_ring_cons = cons;
+	}
+	spinlock_release(&vm->msi_ring_lock);
+
+	return n;
+}
+
+/* whether the ring of vm has MSIs to inject, checked without the lock */
+static bool is_msi_ring_pending(const struct acrn_vm *vm)
+{
+	const struct acrn_msi_ring *ring = (const struct acrn_msi_ring *)vm->sw.msi_ring;
+	bool pending = false;
+
+	if (ring != NULL) {
+		stac();
+		pending = (ring->prod != vm->sw.msi_ring_cons);
+		clac();
+	}
+
+	return pending;
+}
+
+uint32_t drain_msi_rings(void)
+{
+	uint32_t n = 0U;
+	uint16_t vm_id;
+	struct acrn_vm *vm;
+
+	if (nr_msi_rings != 0U) {
+		for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+			vm = get_vm_from_vmid(vm_id);
+			if (is_msi_ring_pending(vm)) {
+				n += drain_msi_ring(vm);
+			}
+		}
+	}
+
+	return n;
+}
+
+static void set_msi_ring_doorbells(uint32_t doorbell)
+{
+	struct acrn_msi_ring *ring;
+	struct acrn_vm *vm;
+	uint16_t vm_id;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		spinlock_obtain(&vm->msi_ring_lock);
+		ring = (struct acrn_msi_ring *)vm->sw.msi_ring;
+		if (ring != NULL) {
+			stac();
+			ring->doorbell = doorbell;
+			clac();
+		}
+		spinlock_release(&vm->msi_ring_lock);
+	}
+}
+
+bool poll_msi_rings(uint16_t pcpu_id)
+{
+	bool polling = false;
+	uint64_t now;
+
+	if (nr_msi_rings != 0U) {
+		if (msi_ring_poller == (uint32_t)pcpu_id) {
+			polling = true;
+		} else if (atomic_cmpxchg32(&msi_ring_poller, (uint32_t)INVALID_CPU_ID, (uint32_t)pcpu_id) ==
+				(uint32_t)INVALID_CPU_ID) {
+			set_msi_ring_doorbells(0U);
+			msi_ring_poll_end = cpu_ticks() + us_to_ticks(MSI_RING_POLL_US);
+			polling = true;
+		} else {
+			/* another idle pCPU polls */
+		}
+	}
+
+	if (polling) {
+		now = cpu_ticks();
+		if (drain_msi_rings() != 0U) {
+			msi_ring_poll_end = now + us_to_ticks(MSI_RING_POLL_US);
+		} else if (now >= msi_ring_poll_end) {
+			stop_polling_msi_rings(pcpu_id);
+			polling = false;
+		} else {
+			/* keep polling */
+		}
+
+		if (polling) {
+			asm_pause();
+		}
+	}
+
+	return polling;
+}
+
+void stop_polling_msi_rings(uint16_t pcpu_id)
+{
+	if (msi_ring_poller == (uint32_t)pcpu_id) {
+		set_msi_ring_doorbells(1U);
+		/*
+		 * Pairs with the fence of the DM between publishing and checking
+		 * the doorbell: either it finds the doorbell set, or the MSIs
+		 * it published are found here.
+		 */
+		cpu_memory_barrier();
+		msi_ring_poller = (uint32_t)INVALID_CPU_ID;
+		(void)drain_msi_rings();
+	}
+}
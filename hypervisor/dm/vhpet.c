@@ -0,0 +1,817 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2024 Intel Corporation.
+ * Copyright (c) 2013 Tycho Nightingale <tycho.nightingale@pluribusnetworks.com>
+ * Copyright (c) 2013 Neel Natu <neel@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NETAPP, INC ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL NETAPP, INC OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <asm/cpu.h>
+#include <asm/lapic.h>
+#include <asm/tsc.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vlapic.h>
+#include <io_req.h>
+#include <vioapic.h>
+#include <vhpet.h>
+#include <softirq.h>
+#include <logmsg.h>
+
+/**
+ * @addtogroup vp-dm_vperipheral
+ *
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Implementation of virtual HPET device.
+ *
+ * This file provides the implementation of the virtual HPET device of the post-launched VMs with GUEST_FLAG_VHPET,
+ * the same device as the one of the device model, without the round trip to the Service VM of each access. The main
+ * counter is computed from the TSC and the comparators are backed by timers of the hypervisor.
+ */
+
+#define HPET_FREQ		(1UL << 24U)	/* 16.7 (2^24) Mhz */
+#define FS_PER_S		1000000000000000UL
+
+/* General registers */
+#define HPET_CAPABILITIES	0x0U
+#define HPET_CONFIG		0x10U
+#define HPET_CNF_ENABLE		0x1UL
+#define HPET_ISR		0x20U
+#define HPET_MAIN_COUNTER	0xf0U
+
+/* Timer N registers */
+#define HPET_TIMER_CAP_CNF(x)	(((x) * 0x20U) + 0x100U)
+#define HPET_TIMER_COMPARATOR(x)	(((x) * 0x20U) + 0x108U)
+#define HPET_TIMER_FSB_VAL(x)	(((x) * 0x20U) + 0x110U)
+#define HPET_TIMER_FSB_ADDR(x)	(((x) * 0x20U) + 0x114U)
+
+#define HPET_TCAP_INT_ROUTE	0xffffffff00000000UL
+#define HPET_TCAP_FSB_INT_DEL	0x00008000UL
+#define HPET_TCNF_FSB_EN	0x00004000UL
+#define HPET_TCNF_INT_ROUTE	0x00003e00UL
+#define HPET_TCNF_32MODE	0x00000100UL
+#define HPET_TCNF_VAL_SET	0x00000040UL
+#define HPET_TCAP_SIZE		0x00000020UL	/* 1 = 64-bit, 0 = 32-bit */
+#define HPET_TCAP_PER_INT	0x00000010UL	/* Supports periodic interrupts */
+#define HPET_TCNF_TYPE		0x00000008UL	/* 1 = periodic, 0 = one-shot */
+#define HPET_TCNF_INT_ENB	0x00000004UL
+#define HPET_TCNF_INT_TYPE	0x00000002UL	/* 1 = level triggered, 0 = edge */
+
+#define HPET_TCAP_RO_MASK	(HPET_TCAP_INT_ROUTE | HPET_TCAP_FSB_INT_DEL | HPET_TCAP_SIZE | HPET_TCAP_PER_INT)
+
+/* #define DEBUG_HPET */
+#ifdef DEBUG_HPET
+# define HPET_DEBUG  pr_info
+#else
+# define HPET_DEBUG(format, ...)      do { } while (false)
+#endif
+
+/* The same capabilities as vhpet_capabilities() of the device model, which builds the ACPI HPET table */
+static uint64_t vhpet_capabilities(void)
+{
+	uint64_t cap;
+
+	cap = 0x8086UL << 16U;					/* vendor id */
+	cap |= ((uint64_t)VHPET_NUM_TIMERS - 1UL) << 8U;	/* number of timers */
+	cap |= 1UL;						/* revision, 32-bit counter */
+	cap |= (FS_PER_S / HPET_FREQ) << 32U;			/* tick period in fs */
+
+	return cap;
+}
+
+static inline uint64_t get_tsc_hz(void)
+{
+	return (uint64_t)get_tsc_khz() * 1000UL;
+}
+
+/* HPET ticks in tsc TSC cycles, without the overflow of (tsc << 24) */
+static uint64_t tsc_to_hpet_ticks(uint64_t tsc)
+{
+	uint64_t hz = get_tsc_hz();
+
+	return ((tsc / hz) << 24U) + (((tsc % hz) << 24U) / hz);
+}
+
+/* TSC cycles in ticks HPET ticks, rounded up so that the main counter has reached them by then */
+static uint64_t hpet_ticks_to_tsc(uint64_t ticks)
+{
+	uint64_t hz = get_tsc_hz();
+
+	return ((ticks >> 24U) * hz) + ((((ticks & (HPET_FREQ - 1UL)) * hz) + (HPET_FREQ - 1UL)) >> 24U);
+}
+
+static inline bool vhpet_counter_enabled(const struct acrn_vhpet *vhpet)
+{
+	return ((vhpet->config & HPET_CNF_ENABLE) != 0UL);
+}
+
+static inline bool vhpet_timer_msi_enabled(const struct vhpet_timer *t)
+{
+	const uint64_t msi_enable = HPET_TCAP_FSB_INT_DEL | HPET_TCNF_FSB_EN;
+
+	return ((t->cap_config & msi_enable) == msi_enable);
+}
+
+static inline uint32_t vhpet_timer_ioapic_pin(const struct vhpet_timer *t)
+{
+	uint32_t pin = 0U;
+
+	/* A timer using MSI isn't connected to the vIOAPIC */
+	if (!vhpet_timer_msi_enabled(t)) {
+		pin = (uint32_t)((t->cap_config & HPET_TCNF_INT_ROUTE) >> 9U);
+	}
+
+	return pin;
+}
+
+static inline bool vhpet_periodic_timer(const struct vhpet_timer *t)
+{
+	return ((t->cap_config & HPET_TCNF_TYPE) != 0UL);
+}
+
+static inline bool vhpet_timer_interrupt_enabled(const struct vhpet_timer *t)
+{
+	return ((t->cap_config & HPET_TCNF_INT_ENB) != 0UL);
+}
+
+static inline bool vhpet_timer_enabled(const struct vhpet_timer *t)
+{
+	/* The timer is enabled when at least one of the two bits is set */
+	return (vhpet_timer_interrupt_enabled(t) || vhpet_periodic_timer(t));
+}
+
+static inline bool vhpet_timer_edge_trig(const struct vhpet_timer *t)
+{
+	return (!vhpet_timer_msi_enabled(t) && ((t->cap_config & HPET_TCNF_INT_TYPE) == 0UL));
+}
+
+static uint32_t vhpet_counter(const struct acrn_vhpet *vhpet, uint64_t *now)
+{
+	uint64_t tsc = cpu_ticks();
+	uint32_t val = vhpet->countbase;
+
+	/* countbase_tsc may be from another pCPU, whose TSC is a bit ahead */
+	if (vhpet_counter_enabled(vhpet) && (tsc > vhpet->countbase_tsc)) {
+		val += (uint32_t)tsc_to_hpet_ticks(tsc - vhpet->countbase_tsc);
+	}
+
+	if (now != NULL) {
+		*now = tsc;
+	}
+
+	return val;
+}
+
+static void vhpet_set_irqline(const struct acrn_vhpet *vhpet, uint32_t pin, uint32_t operation)
+{
+	if (pin < get_vm_gsicount(vhpet->vm)) {
+		vioapic_set_irqline_lock(vhpet->vm, pin, operation);
+	}
+}
+
+static void vhpet_timer_clear_isr(struct acrn_vhpet *vhpet, struct vhpet_timer *t)
+{
+	uint32_t pin;
+
+	if ((vhpet->isr & (1UL << t->num)) != 0UL) {
+		pin = vhpet_timer_ioapic_pin(t);
+		if (pin != 0U) {
+			vhpet_set_irqline(vhpet, pin, GSI_SET_LOW);
+		}
+		vhpet->isr &= ~(1UL << t->num);
+	}
+}
+
+static void vhpet_timer_interrupt(struct acrn_vhpet *vhpet, struct vhpet_timer *t)
+{
+	uint32_t pin;
+	bool level_asserted = false;
+
+	/* If interrupts are not enabled for this timer then just return. */
+	if (vhpet_timer_interrupt_enabled(t)) {
+		if ((vhpet->isr & (1UL << t->num)) != 0UL) {
+			if (vhpet_timer_edge_trig(t) || vhpet_timer_msi_enabled(t)) {
+				vhpet->isr &= ~(1UL << t->num);
+			} else {
+				/* A level triggered interrupt is already asserted */
+				level_asserted = true;
+			}
+		}
+
+		if (level_asserted) {
+			HPET_DEBUG("vhpet t%u intr is already asserted", t->num);
+		} else if (vhpet_timer_msi_enabled(t)) {
+			(void)vlapic_inject_msi(vhpet->vm, t->msireg >> 32U, t->msireg & 0xffffffffUL);
+		} else {
+			pin = vhpet_timer_ioapic_pin(t);
+			if (pin == 0U) {
+				HPET_DEBUG("vhpet t%u intr is not routed to ioapic", t->num);
+			} else if (vhpet_timer_edge_trig(t)) {
+				vhpet_set_irqline(vhpet, pin, GSI_RAISING_PULSE);
+			} else {
+				vhpet->isr |= 1UL << t->num;
+				vhpet_set_irqline(vhpet, pin, GSI_SET_HIGH);
+			}
+		}
+	}
+}
+
+/*
+ * Run in the timer softirq of vhpet->pcpu_id. An expires changed since the timer of the hypervisor was last moved
+ * to it isn't fired here: a resync of the timers is pending on this pCPU, and whoever changed it took care of an
+ * expiry passed already.
+ */
+static void vhpet_timer_expired(void *data)
+{
+	struct vhpet_timer *t = (struct vhpet_timer *)data;
+	struct acrn_vhpet *vhpet = t->vhpet;
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+	if ((t->expires != 0UL) && (t->expires == t->timer.timeout)) {
+		vhpet_timer_interrupt(vhpet, t);
+
+		/* The timer of the hypervisor is periodic, a periodic comparator moves on with it */
+		t->expires += t->timer.period_in_cycle;
+		t->compval += t->comprate;
+	}
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+}
+
+/* Move the timers of the hypervisor to the expires of the timers, @pre get_pcpu_id() == vhpet->pcpu_id */
+static void vhpet_resync_timers(struct acrn_vhpet *vhpet)
+{
+	struct vhpet_timer *t;
+	uint64_t rflags;
+	uint32_t i;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+	if (vhpet->resync) {
+		vhpet->resync = false;
+		for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+			t = &vhpet->timer[i];
+			del_timer(&t->timer);
+			if (t->expires != 0UL) {
+				update_timer(&t->timer, t->expires, t->period);
+				(void)add_timer(&t->timer);
+			}
+		}
+	}
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+}
+
+static void vhpet_softirq(uint16_t pcpu_id)
+{
+	struct acrn_vhpet *vhpet;
+	uint16_t vm_id;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vhpet = &get_vm_from_vmid(vm_id)->vhpet;
+		if ((vhpet->pcpu_id == pcpu_id) && vhpet->resync) {
+			vhpet_resync_timers(vhpet);
+		}
+	}
+}
+
+/*
+ * The timers of the hypervisor can only be added to and deleted from the pCPU they are on, so they are moved to
+ * the new expires right away on that pCPU, else by a softirq there.
+ */
+static void vhpet_kick_resync(struct acrn_vhpet *vhpet)
+{
+	if (get_pcpu_id() == vhpet->pcpu_id) {
+		vhpet_resync_timers(vhpet);
+	} else {
+		fire_softirq_on_pcpu(vhpet->pcpu_id, SOFTIRQ_VHPET);
+		kick_pcpu(vhpet->pcpu_id);
+	}
+}
+
+static void vhpet_adjust_compval(struct vhpet_timer *t, uint64_t now)
+{
+	uint64_t delta_ticks;
+
+	if ((t->comprate != 0U) && (t->expires < now)) {
+		/*
+		 * The main counter is ahead of compval by at least comprate, round compval up to the next periodic
+		 * interrupt after it.
+		 */
+		delta_ticks = tsc_to_hpet_ticks(now - t->expires);
+		t->compval += (uint32_t)(((delta_ticks / t->comprate) + 1UL) * t->comprate);
+	}
+}
+
+/* A now of 0 stops the timer without the interrupt of an expiry passed already */
+static void vhpet_stop_timer(struct acrn_vhpet *vhpet, struct vhpet_timer *t, uint64_t now, bool adj_compval)
+{
+	if (t->expires != 0UL) {
+		HPET_DEBUG("vhpet t%u stopped", t->num);
+
+		/*
+		 * If the timer was scheduled to expire in the past but hasn't had a chance to fire yet then trigger
+		 * the timer interrupt here. Failing to do so will result in a missed timer interrupt in the guest,
+		 * which waits for the counter to wrap around in one-shot mode.
+		 */
+		if (t->expires < now) {
+			if (adj_compval) {
+				vhpet_adjust_compval(t, now);
+			}
+			vhpet_timer_interrupt(vhpet, t);
+		}
+
+		t->expires = 0UL;
+		vhpet->resync = true;
+	}
+}
+
+static void vhpet_start_timer(struct acrn_vhpet *vhpet, struct vhpet_timer *t, uint32_t counter, uint64_t now,
+		bool adj_compval)
+{
+	uint32_t delta;
+
+	vhpet_stop_timer(vhpet, t, now, adj_compval);
+
+	HPET_DEBUG("vhpet t%u started", t->num);
+
+	/*
+	 * It is the guest's responsibility to make sure that the comparator value is not in the "past". The
+	 * hardware doesn't have any belt-and-suspenders to deal with this so we don't either.
+	 */
+	delta = t->compval - counter;
+	t->expires = now + hpet_ticks_to_tsc((uint64_t)delta);
+	/* It takes 2^32 ticks to wrap around in one-shot mode */
+	t->period = hpet_ticks_to_tsc((t->comprate != 0U) ? (uint64_t)t->comprate : (1UL << 32U));
+	vhpet->resync = true;
+}
+
+static void vhpet_restart_timer(struct acrn_vhpet *vhpet, struct vhpet_timer *t, bool adj_compval)
+{
+	uint32_t counter;
+	uint64_t now;
+
+	/* Restart the timer based on the current value of the main counter */
+	counter = vhpet_counter(vhpet, &now);
+	vhpet_start_timer(vhpet, t, counter, now, adj_compval);
+}
+
+static void vhpet_start_counting(struct acrn_vhpet *vhpet)
+{
+	struct vhpet_timer *t;
+	uint32_t i;
+
+	vhpet->countbase_tsc = cpu_ticks();
+
+	/* Restart the timers based on the main counter base value */
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		if (vhpet_timer_enabled(t)) {
+			vhpet_start_timer(vhpet, t, vhpet->countbase, vhpet->countbase_tsc, true);
+		} else {
+			vhpet_stop_timer(vhpet, t, 0UL, false);
+		}
+	}
+}
+
+static void vhpet_stop_counting(struct acrn_vhpet *vhpet, uint32_t counter, uint64_t now)
+{
+	struct vhpet_timer *t;
+	uint32_t i;
+
+	/* Update the main counter base value */
+	vhpet->countbase = counter;
+
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		vhpet_stop_timer(vhpet, t, vhpet_timer_enabled(t) ? now : 0UL, true);
+	}
+}
+
+static inline void update_register(uint64_t *regptr, uint64_t data, uint64_t mask)
+{
+	*regptr &= ~mask;
+	*regptr |= (data & mask);
+}
+
+static void vhpet_timer_update_config(struct acrn_vhpet *vhpet, struct vhpet_timer *t, uint64_t data, uint64_t mask)
+{
+	uint32_t old_pin, new_pin, allowed_irqs;
+	uint64_t oldval, newval;
+
+	if (vhpet_timer_msi_enabled(t) || vhpet_timer_edge_trig(t)) {
+		vhpet->isr &= ~(1UL << t->num);
+	}
+
+	old_pin = vhpet_timer_ioapic_pin(t);
+	oldval = t->cap_config;
+
+	newval = oldval;
+	update_register(&newval, data, mask);
+	newval &= ~(HPET_TCAP_RO_MASK | HPET_TCNF_32MODE);
+	newval |= oldval & HPET_TCAP_RO_MASK;
+
+	if (newval != oldval) {
+		t->cap_config = newval;
+		HPET_DEBUG("vhpet t%u cap_config set to 0x%016lx", t->num, newval);
+
+		if (((oldval ^ newval) & (HPET_TCNF_TYPE | HPET_TCNF_INT_ENB)) != 0UL) {
+			if (!vhpet_periodic_timer(t)) {
+				t->comprate = 0U;
+			}
+
+			/*
+			 * Stop the timer if both bits are now cleared. Else, restart the timer if it was stopped, or
+			 * HPET_TCNF_TYPE is being toggled. Else, the timer remains in periodic mode.
+			 */
+			if (vhpet_counter_enabled(vhpet)) {
+				if (!vhpet_timer_enabled(t)) {
+					vhpet_stop_timer(vhpet, t, cpu_ticks(), true);
+				} else if (((oldval & (HPET_TCNF_TYPE | HPET_TCNF_INT_ENB)) == 0UL) ||
+						(((oldval ^ newval) & HPET_TCNF_TYPE) != 0UL)) {
+					vhpet_restart_timer(vhpet, t, true);
+				} else {
+					/* no-op */
+				}
+			}
+		}
+
+		/*
+		 * Validate the interrupt routing in the HPET_TCNF_INT_ROUTE field. If it does not match the bits set
+		 * in HPET_TCAP_INT_ROUTE then set it to the default value of 0.
+		 */
+		allowed_irqs = (uint32_t)(t->cap_config >> 32U);
+		new_pin = vhpet_timer_ioapic_pin(t);
+		if ((new_pin != 0U) && ((allowed_irqs & (1U << new_pin)) == 0U)) {
+			pr_dbg("vhpet t%u configured invalid irq %u, allowed_irqs 0x%08x", t->num, new_pin,
+					allowed_irqs);
+			new_pin = 0U;
+			t->cap_config &= ~HPET_TCNF_INT_ROUTE;
+		}
+
+		/*
+		 * If the timer's ISR bit is set then clear it when the interrupt is disabled, changed from level to
+		 * edge or fsb, or routed elsewhere, so that a level triggered interrupt does not remain asserted
+		 * forever.
+		 */
+		if ((vhpet->isr & (1UL << t->num)) != 0UL) {
+			if (old_pin == 0U) {
+				vhpet->isr &= ~(1UL << t->num);
+			} else if (!vhpet_timer_interrupt_enabled(t) || vhpet_timer_msi_enabled(t) ||
+					vhpet_timer_edge_trig(t) || (new_pin != old_pin)) {
+				vhpet_set_irqline(vhpet, old_pin, GSI_SET_LOW);
+				vhpet->isr &= ~(1UL << t->num);
+			} else {
+				/* still asserted */
+			}
+		}
+	}
+}
+
+static void vhpet_comparator_write(struct acrn_vhpet *vhpet, struct vhpet_timer *t, uint64_t data, uint64_t mask)
+{
+	uint32_t old_compval = t->compval, old_comprate = t->comprate;
+	uint64_t val64;
+
+	if (vhpet_periodic_timer(t)) {
+		/*
+		 * In periodic mode, writes to the comparator change the compval register only if the
+		 * HPET_TCNF_VAL_SET bit is set in the config register.
+		 */
+		val64 = t->comprate;
+		update_register(&val64, data, mask);
+		t->comprate = (uint32_t)val64;
+		if ((t->cap_config & HPET_TCNF_VAL_SET) != 0UL) {
+			t->compval = (uint32_t)val64;
+		}
+	} else {
+		t->comprate = 0U;
+		val64 = t->compval;
+		update_register(&val64, data, mask);
+		t->compval = (uint32_t)val64;
+	}
+
+	t->cap_config &= ~HPET_TCNF_VAL_SET;
+
+	if ((t->compval != old_compval) || (t->comprate != old_comprate)) {
+		if (vhpet_counter_enabled(vhpet) && vhpet_timer_enabled(t)) {
+			vhpet_restart_timer(vhpet, t, false);
+		}
+	}
+}
+
+static void vhpet_mmio_write(struct acrn_vhpet *vhpet, uint32_t offset, uint64_t size, uint64_t value)
+{
+	uint64_t data, mask, oldval, val64, now;
+	uint32_t counter, i;
+	struct vhpet_timer *t;
+
+	/* Accesses to the HPET should be 4 or 8 bytes wide, naturally aligned to their width */
+	if (((size != 4UL) && (size != 8UL)) || ((offset & (size - 1UL)) != 0U)) {
+		pr_dbg("vhpet invalid mmio write: offset 0x%08x, size %lu", offset, size);
+	} else {
+		mask = (size == 8UL) ? ~0UL : 0xffffffffUL;
+		data = value & mask;
+		if ((size == 4UL) && ((offset & 0x4U) != 0U)) {
+			mask <<= 32U;
+			data <<= 32U;
+		}
+
+		switch (offset & ~0x4U) {
+		case HPET_CONFIG:
+			/*
+			 * Get the most recent value of the counter before updating the 'config' register. If the HPET
+			 * is going to be disabled then we need to update 'countbase' with the value right before it is
+			 * disabled.
+			 */
+			counter = vhpet_counter(vhpet, &now);
+			oldval = vhpet->config;
+			update_register(&vhpet->config, data, mask);
+
+			/* LegacyReplacement Routing is not supported so clear the bit along with the reserved bits */
+			vhpet->config &= HPET_CNF_ENABLE;
+
+			if (((oldval ^ vhpet->config) & HPET_CNF_ENABLE) != 0UL) {
+				if (vhpet_counter_enabled(vhpet)) {
+					vhpet_start_counting(vhpet);
+				} else {
+					vhpet_stop_counting(vhpet, counter, now);
+				}
+			}
+			break;
+		case HPET_ISR:
+			/* Top 32 bits are reserved */
+			for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+				if (((vhpet->isr & data) & (1UL << i)) != 0UL) {
+					vhpet_timer_clear_isr(vhpet, &vhpet->timer[i]);
+				}
+			}
+			break;
+		case HPET_MAIN_COUNTER:
+			/* Zero-extend the counter to 64-bits before updating it */
+			val64 = vhpet_counter(vhpet, NULL);
+			update_register(&val64, data, mask);
+			vhpet->countbase = (uint32_t)val64;
+			if (vhpet_counter_enabled(vhpet)) {
+				vhpet_start_counting(vhpet);
+			}
+			break;
+		default:
+			i = (offset - HPET_TIMER_CAP_CNF(0U)) / 0x20U;
+			if ((offset >= HPET_TIMER_CAP_CNF(0U)) && (i < VHPET_NUM_TIMERS)) {
+				t = &vhpet->timer[i];
+				if ((offset & ~0x4U) == HPET_TIMER_CAP_CNF(i)) {
+					vhpet_timer_update_config(vhpet, t, data, mask);
+				} else if ((offset & ~0x4U) == HPET_TIMER_COMPARATOR(i)) {
+					vhpet_comparator_write(vhpet, t, data, mask);
+				} else if ((offset & ~0x4U) == HPET_TIMER_FSB_VAL(i)) {
+					update_register(&t->msireg, data, mask);
+				} else {
+					pr_dbg("vhpet invalid mmio write: offset 0x%08x, size %lu", offset, size);
+				}
+			} else {
+				pr_dbg("vhpet invalid mmio write: offset 0x%08x, size %lu", offset, size);
+			}
+			break;
+		}
+	}
+}
+
+static uint64_t vhpet_mmio_read(const struct acrn_vhpet *vhpet, uint32_t offset, uint64_t size)
+{
+	uint64_t data = 0UL;
+	uint32_t i;
+	const struct vhpet_timer *t;
+
+	/* Accesses to the HPET should be 4 or 8 bytes wide, naturally aligned to their width */
+	if (((size != 4UL) && (size != 8UL)) || ((offset & (size - 1UL)) != 0U)) {
+		pr_dbg("vhpet invalid mmio read: offset 0x%08x, size %lu", offset, size);
+	} else {
+		switch (offset & ~0x4U) {
+		case HPET_CAPABILITIES:
+			data = vhpet_capabilities();
+			break;
+		case HPET_CONFIG:
+			data = vhpet->config;
+			break;
+		case HPET_ISR:
+			data = vhpet->isr;
+			break;
+		case HPET_MAIN_COUNTER:
+			data = vhpet_counter(vhpet, NULL);
+			break;
+		default:
+			i = (offset - HPET_TIMER_CAP_CNF(0U)) / 0x20U;
+			if ((offset >= HPET_TIMER_CAP_CNF(0U)) && (i < VHPET_NUM_TIMERS)) {
+				t = &vhpet->timer[i];
+				if ((offset & ~0x4U) == HPET_TIMER_CAP_CNF(i)) {
+					data = t->cap_config;
+				} else if ((offset & ~0x4U) == HPET_TIMER_COMPARATOR(i)) {
+					data = t->compval;
+				} else if ((offset & ~0x4U) == HPET_TIMER_FSB_VAL(i)) {
+					data = t->msireg;
+				} else {
+					pr_dbg("vhpet invalid mmio read: offset 0x%08x, size %lu", offset, size);
+				}
+			} else {
+				pr_dbg("vhpet invalid mmio read: offset 0x%08x, size %lu", offset, size);
+			}
+			break;
+		}
+
+		if ((size == 4UL) && ((offset & 0x4U) != 0U)) {
+			data >>= 32U;
+		}
+	}
+
+	return (size == 4UL) ? (data & 0xffffffffUL) : data;
+}
+
+/*
+ * @pre handler_private_data != NULL
+ */
+static int32_t vhpet_mmio_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct acrn_vhpet *vhpet = (struct acrn_vhpet *)handler_private_data;
+	struct acrn_mmio_request *mmio = &io_req->reqs.mmio_request;
+	uint32_t offset = (uint32_t)(mmio->address - VHPET_BASE);
+	uint64_t rflags;
+	bool resync;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+	if (vhpet->active) {
+		if (mmio->direction == ACRN_IOREQ_DIR_READ) {
+			mmio->value = vhpet_mmio_read(vhpet, offset, mmio->size);
+		} else {
+			vhpet_mmio_write(vhpet, offset, mmio->size, mmio->value);
+		}
+	} else if (mmio->direction == ACRN_IOREQ_DIR_READ) {
+		mmio->value = 0UL;
+	} else {
+		/* ignored */
+	}
+	resync = vhpet->resync;
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+
+	if (resync) {
+		vhpet_kick_resync(vhpet);
+	}
+
+	return 0;
+}
+
+/* Registers at reset, with the timers stopped, @pre the lock is held or the device not active */
+static void vhpet_reset_regs(struct acrn_vhpet *vhpet)
+{
+	struct vhpet_timer *t;
+	uint32_t pincount, i;
+	uint64_t allowed_irqs;
+
+	pincount = get_vm_gsicount(vhpet->vm);
+	if (pincount >= 32U) {
+		allowed_irqs = 0xff000000UL;	/* irqs 24-31 */
+	} else if (pincount >= 20U) {
+		allowed_irqs = 0xfUL << (pincount - 4U);	/* 4 upper irqs */
+	} else {
+		allowed_irqs = 0UL;
+	}
+
+	vhpet->config = 0UL;
+	vhpet->isr = 0UL;
+	vhpet->countbase = 0U;
+	vhpet->countbase_tsc = 0UL;
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		t->cap_config = (allowed_irqs << 32U) | HPET_TCAP_PER_INT | HPET_TCAP_FSB_INT_DEL;
+		t->msireg = 0UL;
+		t->compval = 0xffffffffU;
+		t->comprate = 0U;
+		if (t->expires != 0UL) {
+			t->expires = 0UL;
+			vhpet->resync = true;
+		}
+	}
+}
+
+/**
+ * @brief Initialize the virtual HPET device of a VM.
+ *
+ * The timers of the device are on the pCPU \p pcpu_id, which is to stay in the VM until vhpet_deinit().
+ *
+ * @param[inout] vm Pointer to the VM whose virtual HPET device is to be initialized.
+ * @param[in] pcpu_id The pCPU the timers of the device are on, the one of its BSP.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre is_vhpet_configured(vm)
+ * @pre vioapic_init(vm) was called
+ */
+void vhpet_init(struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	struct acrn_vhpet *vhpet = &vm->vhpet;
+	struct vhpet_timer *t;
+	uint32_t i;
+
+	register_softirq(SOFTIRQ_VHPET, vhpet_softirq);
+
+	spinlock_init(&vhpet->lock);
+	vhpet->vm = vm;
+	vhpet->pcpu_id = pcpu_id;
+	vhpet->resync = false;
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		t->vhpet = vhpet;
+		t->num = i;
+		t->expires = 0UL;
+		t->period = 0UL;
+		initialize_timer(&t->timer, vhpet_timer_expired, t, 0UL, 0UL);
+	}
+	vhpet_reset_regs(vhpet);
+	vhpet->active = true;
+
+	register_mmio_emulation_handler(vm, vhpet_mmio_access_handler, VHPET_BASE, VHPET_BASE + VHPET_SIZE,
+			(void *)vhpet, false);
+}
+
+/**
+ * @brief Reset the virtual HPET device of a VM to its power-on state.
+ *
+ * @param[inout] vm Pointer to the VM whose virtual HPET device is to be reset.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre vm->state == VM_PAUSED
+ */
+void vhpet_reset(struct acrn_vm *vm)
+{
+	struct acrn_vhpet *vhpet = &vm->vhpet;
+	uint64_t rflags;
+
+	if (vhpet->active) {
+		spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+		vhpet_reset_regs(vhpet);
+		spinlock_irqrestore_release(&vhpet->lock, rflags);
+
+		vhpet_kick_resync(vhpet);
+	}
+}
+
+/**
+ * @brief Stop the virtual HPET device of a VM.
+ *
+ * Return once the timers of the device are deleted from its pCPU.
+ *
+ * @param[inout] vm Pointer to the VM whose virtual HPET device is to be stopped.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre vm->state == VM_POWERED_OFF
+ */
+void vhpet_deinit(struct acrn_vm *vm)
+{
+	struct acrn_vhpet *vhpet = &vm->vhpet;
+	uint64_t rflags;
+
+	if (vhpet->active) {
+		spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+		vhpet->active = false;
+		vhpet_reset_regs(vhpet);
+		spinlock_irqrestore_release(&vhpet->lock, rflags);
+
+		vhpet_kick_resync(vhpet);
+		while (vhpet->resync) {
+			asm_pause();
+		}
+	}
+}
+
+/**
+ * @}
+ */
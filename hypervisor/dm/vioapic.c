@@ -49,6 +49,20 @@ static inline struct acrn_vioapics *vm_ioapics(const struct acrn_vm *vm)
 	return (struct acrn_vioapics *)&(vm->arch_vm.vioapics);
 }
 
+/**
+ * Track the Remote IRR of the pin in rtbl into remote_irr_pins.
+ *
+ * @pre pin < vioapic->chipinfo.nr_pins
+ */
+static inline void vioapic_sync_remote_irr(struct acrn_single_vioapic *vioapic, uint32_t pin)
+{
+	if (vioapic->rtbl[pin].bits.remote_irr != 0UL) {
+		bitmap_set_nolock((uint16_t)(pin & 0x3FU), &vioapic->remote_irr_pins[pin >> 6U]);
+	} else {
+		bitmap_clear_nolock((uint16_t)(pin & 0x3FU), &vioapic->remote_irr_pins[pin >> 6U]);
+	}
+}
+
 /**
  * @pre pin < vioapic->chipinfo.nr_pins
  */
@@ -74,6 +88,7 @@ vioapic_generate_intr(struct acrn_single_vioapic *vioapic, uint32_t pin)
 		if (!level || (vioapic->rtbl[pin].bits.remote_irr == 0UL)) {
 			if (level) {
 				vioapic->rtbl[pin].bits.remote_irr = IOAPIC_RTE_REM_IRR;
+				vioapic_sync_remote_irr(vioapic, pin);
 			}
 			vector = rte.bits.vector;
 			dest = rte.bits.dest_field;
@@ -256,6 +271,7 @@ vioapic_indirect_read(struct acrn_single_vioapic *vioapic, uint32_t addr)
 				if (entry != NULL) {
 					ioapic_get_rte(entry->allocated_pirq, &phys_rte);
 					vioapic->rtbl[pin].bits.remote_irr = phys_rte.bits.remote_irr;
+					vioapic_sync_remote_irr(vioapic, pin);
 				}
 			}
 			ret = vioapic->rtbl[pin].u.lo_32;
@@ -361,6 +377,7 @@ static void vioapic_indirect_write(struct acrn_single_vioapic *vioapic, uint32_t
 
 		if (wire_mode_valid) {
 			vioapic->rtbl[pin] = new;
+			vioapic_sync_remote_irr(vioapic, pin);
 			dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic pin%hhu: redir table entry %#lx",
 				pin, vioapic->rtbl[pin].full);
 
@@ -435,9 +452,11 @@ vioapic_mmio_rw(struct acrn_single_vioapic *vioapic, uint64_t gpa,
 static void
 vioapic_process_eoi(struct acrn_single_vioapic *vioapic, uint32_t vector)
 {
-	uint32_t pin, pincount = vioapic->chipinfo.nr_pins;
+	uint64_t eoi_pins[STATE_BITMAP_SIZE] = { 0UL };
+	uint64_t bits, rflags;
+	uint32_t idx, pin;
 	union ioapic_rte rte;
-	uint64_t rflags;
+	bool found = false;
 
 	if ((vector < VECTOR_DYNAMIC_START) || (vector > NR_MAX_VECTOR)) {
 		pr_err("vioapic_process_eoi: invalid vector %u", vector);
@@ -445,37 +464,61 @@ vioapic_process_eoi(struct acrn_single_vioapic *vioapic, uint32_t vector)
 
 	dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic processing eoi for vector %u", vector);
 
-	/* notify device to ack if assigned pin */
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
-		}
-
-		ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC);
-	}
-
 	/*
-	 * XXX keep track of the pins associated with this vector instead
-	 * of iterating on every single pin each time.
+	 * Only the pins with Remote IRR set are waiting for an EOI: walk those of this vector, usually one or
+	 * none, instead of every single pin of the IOAPIC.
 	 */
 	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
+	for (idx = 0U; idx < STATE_BITMAP_SIZE; idx++) {
+		bits = vioapic->remote_irr_pins[idx];
+		while (bits != 0UL) {
+			pin = (idx << 6U) + (uint32_t)ffs64(bits);
+			bits &= bits - 1UL;
+			if (vioapic->rtbl[pin].bits.vector == vector) {
+				bitmap_set_nolock((uint16_t)(pin & 0x3FU), &eoi_pins[idx]);
+				found = true;
+			}
+		}
+	}
+	spinlock_irqrestore_release(&(vioapic->lock), rflags);
+
+	if (found) {
+		/* notify device to ack if assigned pin, this may de-assert the pin */
+		for (idx = 0U; idx < STATE_BITMAP_SIZE; idx++) {
+			bits = eoi_pins[idx];
+			while (bits != 0UL) {
+				pin = (idx << 6U) + (uint32_t)ffs64(bits);
+				bits &= bits - 1UL;
+				ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC);
+			}
 		}
 
-		vioapic->rtbl[pin].bits.remote_irr = 0U;
-		if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
-			dev_dbg(DBG_LEVEL_VIOAPIC,
-				"ioapic pin%hhu: asserted at eoi", pin);
-			vioapic_generate_intr(vioapic, pin);
+		/*
+		 * A pin still (or again) asserted at its EOI generates its next interrupt right here, the
+		 * de-assert/re-assert in between costing no interrupt of its own.
+		 */
+		spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+		for (idx = 0U; idx < STATE_BITMAP_SIZE; idx++) {
+			bits = eoi_pins[idx];
+			while (bits != 0UL) {
+				pin = (idx << 6U) + (uint32_t)ffs64(bits);
+				bits &= bits - 1UL;
+				rte = vioapic->rtbl[pin];
+				if ((rte.bits.vector != vector) || (rte.bits.remote_irr == 0U)) {
+					continue;
+				}
+
+				vioapic->rtbl[pin].bits.remote_irr = 0U;
+				vioapic_sync_remote_irr(vioapic, pin);
+				if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
+					dev_dbg(DBG_LEVEL_VIOAPIC,
+						"ioapic pin%hhu: asserted at eoi", pin);
+					vioapic_generate_intr(vioapic, pin);
+				}
+			}
 		}
+		spinlock_irqrestore_release(&(vioapic->lock), rflags);
 	}
-	spinlock_irqrestore_release(&(vioapic->lock), rflags);
 }
 
 void vioapic_broadcast_eoi(const struct acrn_vm *vm, uint32_t vector)
@@ -503,6 +546,7 @@ static void reset_one_vioapic(struct acrn_single_vioapic *vioapic)
 	for (pin = 0U; pin < pincount; pin++) {
 		vioapic->rtbl[pin].full = MASK_ALL_INTERRUPTS;
 	}
+	(void)memset(vioapic->remote_irr_pins, 0U, sizeof(vioapic->remote_irr_pins));
 	vioapic->chipinfo.id = 0U;
 	vioapic->ioregsel = 0U;
 }
@@ -607,3 +651,23 @@ void vioapic_get_rte(const struct acrn_vm *vm, uint32_t vgsi, union ioapic_rte *
 
 	*rte = vioapic->rtbl[pin];
 }
+
+/**
+ * Set the RTE of a pin as the guest would, the high half first.
+ *
+ * @pre vm->arch_vm.vioapics != NULL
+ * @pre vgsi < get_vm_gsicount(vm)
+ */
+void vioapic_set_rte(const struct acrn_vm *vm, uint32_t vgsi, union ioapic_rte rte)
+{
+	struct acrn_single_vioapic *vioapic;
+	uint32_t pin;
+	uint64_t rflags;
+
+	vioapic = vgsi_to_vioapic_and_vpin(vm, vgsi, &pin);
+
+	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+	vioapic_indirect_write(vioapic, IOAPIC_REDTBL + (pin * 2U) + 1U, rte.u.hi_32);
+	vioapic_indirect_write(vioapic, IOAPIC_REDTBL + (pin * 2U), rte.u.lo_32);
+	spinlock_irqrestore_release(&(vioapic->lock), rflags);
+}
@@ -40,7 +40,15 @@
 #define IVSHMEM_MSIX_BAR	1U
 #define IVSHMEM_SHM_BAR	2U
 
-#define IVSHMEM_MMIO_BAR_SIZE 256UL
+/*
+ * The registers take the first 256 bytes of BAR0, its second half holds
+ * the fast doorbells: a write of any value to the doorbell of peer P and
+ * MSI-X vector V, at IVSHMEM_FAST_DOORBELL_OFFSET + ((P * 8) + V) * 4,
+ * interrupts the peer as a write of (P << 16) | V to the Doorbell register
+ * would, without the instruction being decoded.
+ */
+#define IVSHMEM_MMIO_BAR_SIZE		0x1000UL
+#define IVSHMEM_FAST_DOORBELL_OFFSET	0x800UL
 
 /* The device-specific registers of ivshmem device */
 #define	IVSHMEM_IRQ_MASK_REG	0x0U
@@ -60,6 +68,14 @@ union ivshmem_doorbell {
 	} reg;
 };
 
+/* The vCPU the MSI-X entry of a vector was delivered to, at its addr and data */
+struct ivshmem_msi_target {
+	uint64_t addr;
+	uint32_t data;
+	uint32_t vector;
+	struct acrn_vcpu *vcpu;
+};
+
 struct ivshmem_device {
 	struct pci_vdev* pcidev;
 	union {
@@ -78,6 +94,8 @@ struct ivshmem_device {
 		} regs;
 	} mmio;
 	struct ivshmem_shm_region *region;
+	spinlock_t target_lock;
+	struct ivshmem_msi_target msi_targets[MAX_IVSHMEM_MSIX_TBL_ENTRY_NUM];
 };
 
 static struct ivshmem_device ivshmem_dev[IVSHMEM_DEV_NUM];
@@ -171,6 +189,9 @@ static void ivshmem_server_notify_peer(struct ivshmem_device *src_ivs_dev, uint1
 	struct acrn_vm *dest_vm;
 	struct ivshmem_device *dest_ivs_dev;
 	struct msix_table_entry *entry;
+	struct ivshmem_msi_target *target;
+	struct acrn_vcpu *vcpu;
+	uint32_t vector;
 	struct ivshmem_shm_region *region = src_ivs_dev->region;
 
 	if (dest_peer_id < MAX_IVSHMEM_PEER_NUM) {
@@ -183,7 +204,25 @@ static void ivshmem_server_notify_peer(struct ivshmem_device *src_ivs_dev, uint1
 			if ((entry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) {
 
 				dest_vm = vpci2vm(dest_ivs_dev->pcidev->vpci);
-				vlapic_inject_msi(dest_vm, entry->addr, entry->data);
+				target = &dest_ivs_dev->msi_targets[vector_index];
+
+				/* decode the MSI again only once the guest has changed the entry */
+				spinlock_obtain(&dest_ivs_dev->target_lock);
+				if ((target->addr != entry->addr) || (target->data != entry->data)) {
+					target->addr = entry->addr;
+					target->data = entry->data;
+					target->vcpu = vlapic_msi_dest_vcpu(dest_vm, entry->addr, entry->data,
+						&target->vector);
+				}
+				vcpu = target->vcpu;
+				vector = target->vector;
+				spinlock_release(&dest_ivs_dev->target_lock);
+
+				if (vcpu != NULL) {
+					vlapic_post_msi(vcpu, vector);
+				} else {
+					vlapic_inject_msi(dest_vm, entry->addr, entry->data);
+				}
 			} else {
 				pr_err("%s,target msix entry [%d] is masked.\n",
 					__func__, vector_index);
@@ -217,6 +256,8 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
 	 * states after VM reboot.
 	 */
 	memset(&ivshmem_dev[i].mmio, 0U, sizeof(uint32_t) * 4);
+	spinlock_init(&ivshmem_dev[i].target_lock);
+	memset(ivshmem_dev[i].msi_targets, 0U, sizeof(ivshmem_dev[i].msi_targets));
 }
 
 /**
@@ -288,6 +329,39 @@ static int32_t ivshmem_mmio_handler(struct io_request *io_req, void *data)
 	return 0;
 }
 
+/**
+ * @brief Handle the accesses to the fast doorbells of the ivshmem device.
+ *
+ * A write is handled from its address alone, its value and size being unknown: it rings the doorbell of the peer and
+ * vector the address stands for, see IVSHMEM_FAST_DOORBELL_OFFSET. A read returns 0.
+ *
+ * @param[inout] io_req Pointer to the I/O request structure that contains the MMIO request information.
+ * @param[inout] data Pointer to the pci_vdev structure that is treated as an ivshmem device.
+ *
+ * @return Always return 0.
+ *
+ * @pre io_req != NULL
+ * @pre data != NULL
+ * @pre data->priv_data != NULL
+ *
+ * @post retval == 0
+ */
+static int32_t ivshmem_fast_doorbell_handler(struct io_request *io_req, void *data)
+{
+	struct acrn_mmio_request *mmio = &io_req->reqs.mmio_request;
+	struct pci_vdev *vdev = (struct pci_vdev *) data;
+	struct ivshmem_device *ivs_dev = (struct ivshmem_device *) vdev->priv_data;
+	uint64_t index = (mmio->address - vdev->vbars[IVSHMEM_MMIO_BAR].base_gpa - IVSHMEM_FAST_DOORBELL_OFFSET) >> 2U;
+
+	if (mmio->direction == ACRN_IOREQ_DIR_READ) {
+		mmio->value = 0UL;
+	} else {
+		ivshmem_server_notify_peer(ivs_dev, (uint16_t)(index / MAX_IVSHMEM_MSIX_TBL_ENTRY_NUM),
+			(uint16_t)(index % MAX_IVSHMEM_MSIX_TBL_ENTRY_NUM));
+	}
+	return 0;
+}
+
 /**
  * @brief Read the PCI configuration space of the ivshmem device.
  *
@@ -323,8 +397,8 @@ static int32_t read_ivshmem_vdev_cfg(struct pci_vdev *vdev, uint32_t offset, uin
  * ivshmem device or when guest updates the BAR register.
  *
  * - BAR0 and BAR1 are used for device registers and MSI-X table and PBA, respectively. If the specified idx is 0 or 1
- *   and the field base_gpa in the specified vBAR is not 0, it unregisters the mmio range handler for the BAR by calling
- *   unregister_mmio_emulation_handler().
+ *   and the field base_gpa in the specified vBAR is not 0, it unregisters the mmio range handlers for the BAR (the
+ *   registers and the fast doorbells for BAR0) by calling unregister_mmio_emulation_handler().
  * - BAR2 maps the shared memory object. If the specified idx is 2 and the field base_gpa in vBAR2 is not 0, it releases
  *   the ept memory mapping for the shared memory region by calling ept_del_mr().
  * - Otherwise, it does nothing.
@@ -347,7 +421,11 @@ static void ivshmem_vbar_unmap(struct pci_vdev *vdev, uint32_t idx)
 
 	if ((idx == IVSHMEM_SHM_BAR) && (vbar->base_gpa != 0UL)) {
 		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_gpa, vbar->size);
-	} else if (((idx == IVSHMEM_MMIO_BAR) || (idx == IVSHMEM_MSIX_BAR)) && (vbar->base_gpa != 0UL)) {
+	} else if ((idx == IVSHMEM_MMIO_BAR) && (vbar->base_gpa != 0UL)) {
+		unregister_mmio_emulation_handler(vm, vbar->base_gpa, (vbar->base_gpa + IVSHMEM_FAST_DOORBELL_OFFSET));
+		unregister_mmio_emulation_handler(vm, (vbar->base_gpa + IVSHMEM_FAST_DOORBELL_OFFSET),
+				(vbar->base_gpa + vbar->size));
+	} else if ((idx == IVSHMEM_MSIX_BAR) && (vbar->base_gpa != 0UL)) {
 		unregister_mmio_emulation_handler(vm, vbar->base_gpa, (vbar->base_gpa + vbar->size));
 	}
 }
@@ -359,8 +437,9 @@ static void ivshmem_vbar_unmap(struct pci_vdev *vdev, uint32_t idx)
  * BAR register.
  *
  * - BAR0 is used for device registers. If the specified idx is 0 and the field base_gpa in the specified vBAR is not 0,
- *   it registers the mmio range handler (via the callback ivshmem_mmio_handler) for the BAR and deletes the 4KB ept
- *   memory mapping for the BAR by calling ept_del_mr().
+ *   it registers the mmio range handler (via the callback ivshmem_mmio_handler) for its first half, the doorbell handler
+ *   (via the callback ivshmem_fast_doorbell_handler) for its second half, and deletes the 4KB ept memory mapping for
+ *   the BAR by calling ept_del_mr().
  * - BAR1 is used for MSI-X table and PBA. If the specified idx is 1 and the field base_gpa in the specified vBAR is not
  *   0, it registers the mmio range handler (via the callback vmsix_handle_table_mmio_access) for the BAR and deletes
  *   the ept memory mapping for the BAR by calling ept_del_mr(). It also sets the mmio_gpa field in the vdev->msix to
@@ -392,7 +471,9 @@ static void ivshmem_vbar_map(struct pci_vdev *vdev, uint32_t idx)
 				vbar->base_gpa, vbar->size, EPT_RD | EPT_WR | EPT_WB | EPT_IGNORE_PAT);
 	} else if ((idx == IVSHMEM_MMIO_BAR) && (vbar->base_gpa != 0UL)) {
 		register_mmio_emulation_handler(vm, ivshmem_mmio_handler, vbar->base_gpa,
-				(vbar->base_gpa + vbar->size), vdev, false);
+				(vbar->base_gpa + IVSHMEM_FAST_DOORBELL_OFFSET), vdev, false);
+		register_mmio_doorbell_handler(vm, ivshmem_fast_doorbell_handler,
+				(vbar->base_gpa + IVSHMEM_FAST_DOORBELL_OFFSET), (vbar->base_gpa + vbar->size), vdev);
 		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_gpa, round_page_up(vbar->size));
 	} else if ((idx == IVSHMEM_MSIX_BAR) && (vbar->base_gpa != 0UL)) {
 		register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access, vbar->base_gpa,
@@ -523,7 +604,7 @@ static void init_ivshmem_bar(struct pci_vdev *vdev, uint32_t bar_idx)
  *   - It sets subsystem vendor ID to 0x8086 (Intel) and subsystem ID to the region ID of the shared memory region.
  *   - It sets up the MSI-X capability with 8 MSI-X table entries and maps the table and PBA into BAR1. For detailed
  *     operations, refer to add_vmsix_capability().
- *   - It initializes BAR0 for the device to hold device registers (256 Byte MMIO).
+ *   - It initializes BAR0 for the device to hold device registers (256 Byte MMIO) and the fast doorbells (4KB MMIO).
  *   - It initializes BAR1 for the device to hold MSI-X table and PBA.
  *   - It initializes BAR2 for the device to map the shared memory object. Because BAR2 is a 64-bit memory BAR, it also
  *     sets up the next Base Address Register as the high 32 bits and the total number of bars is set to 4.
@@ -37,12 +37,20 @@
 #include <config.h>
 #include "vpci_priv.h"
 
+/* The vMSI-X tables shadowed at once, the reads of the others trap */
+#define VMSIX_SHADOW_NUM	32U
+
+static struct page vmsix_shadows[VMSIX_SHADOW_NUM];
+static uint64_t vmsix_shadow_bitmap;
+static spinlock_t vmsix_shadow_lock = { .head = 0U, .tail = 0U, };
+
 /**
  * @pre vdev != NULL
  */
 static inline struct msix_table_entry *get_msix_table_entry(const struct pci_vdev *vdev, uint32_t index)
 {
-	void *hva = hpa2hva(vdev->msix.mmio_hpa + vdev->msix.table_offset);
+	/* the physical table, where the vMSI-X table is relocated from or not */
+	void *hva = hpa2hva(vdev->msix.mmio_hpa + vdev->pdev->msix.table_offset);
 
 	return ((struct msix_table_entry *)hva + index);
 }
@@ -102,7 +110,7 @@ static void mask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
  * @pre vdev->vpci != NULL
  * @pre vdev->pdev != NULL
  */
-static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
+static void remap_one_vmsix_entry(struct pci_vdev *vdev, uint32_t index)
 {
 	const struct msix_table_entry *ventry;
 	struct msix_table_entry *pentry;
@@ -110,6 +118,7 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 	int32_t ret;
 
 	mask_one_msix_vector(vdev, index);
+	bitmap_clear_nolock((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U]);
 	ventry = &vdev->msix.table_entries[index];
 	if ((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) {
 		info.addr.full = vdev->msix.table_entries[index].addr;
@@ -133,9 +142,136 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 			mmio_write32(info.data.full, (void *)&(pentry->data));
 			mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
 			clac();
+			bitmap_set_nolock((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U]);
+		}
+	}
+
+}
+
+/**
+ * @brief Update the physical entry after a write of the vMSI-X table
+ *
+ * With the address and the data unchanged since a remap, the vector control is
+ * written alone, a guest masking and unmasking its vector doesn't rebuild its IRTE.
+ *
+ * @pre vdev != NULL
+ * @pre old != NULL
+ * @pre index < vdev->msix.table_count
+ */
+static void update_one_vmsix_entry(struct pci_vdev *vdev, uint32_t index, const struct msix_table_entry *old)
+{
+	const struct msix_table_entry *ventry = &vdev->msix.table_entries[index];
+	struct msix_table_entry *pentry;
+
+	if ((ventry->addr == old->addr) && (ventry->data == old->data) &&
+			bitmap_test((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U])) {
+		if (ventry->vector_control != old->vector_control) {
+			pentry = get_msix_table_entry(vdev, index);
+			stac();
+			mmio_write32(ventry->vector_control, (void *)&(pentry->vector_control));
+			clac();
 		}
+	} else {
+		remap_one_vmsix_entry(vdev, index);
 	}
+}
 
+/**
+ * @pre vdev != NULL
+ */
+static void sync_vmsix_shadow(const struct pci_vdev *vdev)
+{
+	const struct pci_msix *msix = &vdev->msix;
+	uint64_t offset;
+
+	if (msix->table_shadow != NULL) {
+		offset = (msix->mmio_gpa + msix->table_offset) - msix->table_shadow_gpa;
+		(void)memcpy_s((void *)&msix->table_shadow->contents[offset], PAGE_SIZE - offset,
+			(const void *)&msix->table_entries[0], msix->table_count * MSIX_TABLE_ENTRY_SIZE);
+	}
+}
+
+/**
+ * @brief Whether the page [addr_lo, addr_hi) of the vMSI-X table can be read from a shadow
+ *
+ * The page must hold nothing the VM reads live: no PBA, and as PCIe requires no
+ * other registers than the table and the PBA. A relocated table has its own pages.
+ *
+ * @pre vdev != NULL
+ */
+static bool vmsix_table_can_shadow(const struct pci_vdev *vdev, uint64_t addr_lo, uint64_t addr_hi)
+{
+	const struct pci_msix *msix = &vdev->msix;
+	uint64_t pba_lo, pba_hi, table_lo;
+	uint32_t pba;
+	bool ret = false;
+
+	if (!msix->is_vmsix_on_msi && (vdev->vbars[msix->table_bar].size >= PAGE_SIZE) &&
+			((addr_hi - addr_lo) == PAGE_SIZE)) {
+		if (msix->is_relocated) {
+			ret = true;
+		} else {
+			pba = pci_vdev_read_vcfg(vdev, msix->capoff + PCIR_MSIX_PBA, 4U);
+			table_lo = round_page_down(msix->table_offset);
+			pba_lo = (uint64_t)(pba & ~PCIM_MSIX_BIR_MASK);
+			pba_hi = pba_lo + (((msix->table_count + 63U) >> 6U) << 3U);
+			ret = ((pba & PCIM_MSIX_BIR_MASK) != msix->table_bar) ||
+				(pba_hi <= table_lo) || (pba_lo >= (table_lo + PAGE_SIZE));
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Map a read-only shadow of the vMSI-X table page at addr_lo, if one is free
+ *
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ */
+static void map_vmsix_shadow(struct pci_vdev *vdev, uint64_t addr_lo, struct ept_batch *batch)
+{
+	struct acrn_vm *vm = vpci2vm(vdev->vpci);
+	struct pci_msix *msix = &vdev->msix;
+	uint16_t idx;
+
+	spinlock_obtain(&vmsix_shadow_lock);
+	idx = ffz64(vmsix_shadow_bitmap);
+	if (idx < VMSIX_SHADOW_NUM) {
+		bitmap_set_nolock(idx, &vmsix_shadow_bitmap);
+	}
+	spinlock_release(&vmsix_shadow_lock);
+
+	if (idx < VMSIX_SHADOW_NUM) {
+		msix->table_shadow = &vmsix_shadows[idx];
+		msix->table_shadow_gpa = addr_lo;
+		(void)memset((void *)msix->table_shadow, 0U, PAGE_SIZE);
+		sync_vmsix_shadow(vdev);
+		ept_add_mr_batch(vm, (uint64_t *)vm->arch_vm.nworld_eptp, hva2hpa(msix->table_shadow),
+			addr_lo, PAGE_SIZE, EPT_RD | EPT_WB, batch);
+	}
+}
+
+/**
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ */
+static void unmap_vmsix_shadow(struct pci_vdev *vdev, struct ept_batch *batch)
+{
+	struct acrn_vm *vm = vpci2vm(vdev->vpci);
+	struct pci_msix *msix = &vdev->msix;
+	uint16_t idx;
+
+	if (msix->table_shadow != NULL) {
+		ept_del_mr_batch(vm, (uint64_t *)vm->arch_vm.nworld_eptp, msix->table_shadow_gpa, PAGE_SIZE, batch);
+		idx = (uint16_t)(msix->table_shadow - &vmsix_shadows[0]);
+		msix->table_shadow = NULL;
+		msix->table_shadow_gpa = 0UL;
+
+		spinlock_obtain(&vmsix_shadow_lock);
+		bitmap_clear_nolock(idx, &vmsix_shadow_bitmap);
+		spinlock_release(&vmsix_shadow_lock);
+	}
 }
 
 /**
@@ -145,20 +281,28 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 static int32_t pt_vmsix_handle_table_mmio_access(struct io_request *io_req, void *priv_data)
 {
 	struct acrn_mmio_request *mmio = &io_req->reqs.mmio_request;
+	struct msix_table_entry old = {};
 	struct pci_vdev *vdev;
-	uint32_t index;
+	uint32_t index, offset;
 	int32_t ret = 0;
 
 	vdev = (struct pci_vdev *)priv_data;
 	if (vdev->user == vdev) {
+		/* the entry before the write, to tell what it changes */
+		offset = (uint32_t)(mmio->address - vdev->msix.mmio_gpa);
+		if (msixtable_access(vdev, offset)) {
+			old = vdev->msix.table_entries[(offset - vdev->msix.table_offset) / MSIX_TABLE_ENTRY_SIZE];
+		}
+
 		index = rw_vmsix_table(vdev, io_req);
 
 		if ((mmio->direction == ACRN_IOREQ_DIR_WRITE) && (index < vdev->msix.table_count)) {
 			if (vdev->msix.is_vmsix_on_msi) {
 				remap_one_vmsix_entry_on_msi(vdev, index);
 			} else {
-				remap_one_vmsix_entry(vdev, index);
+				update_one_vmsix_entry(vdev, index, &old);
 			}
+			sync_vmsix_shadow(vdev);
 		}
 	} else {
 		ret = -EFAULT;
@@ -171,7 +315,7 @@ static int32_t pt_vmsix_handle_table_mmio_access(struct io_request *io_req, void
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  */
-static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
+static void vdev_pt_unmap_msix(struct pci_vdev *vdev, struct ept_batch *batch)
 {
 	uint32_t i;
 	uint64_t addr_hi, addr_lo;
@@ -183,13 +327,20 @@ static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
 		msix->table_entries[i].addr = 0U;
 		msix->table_entries[i].data = 0U;
 	}
+	(void)memset((void *)&msix->remapped, 0U, sizeof(msix->remapped));
 
 	if (msix->mmio_gpa != 0UL) {
-		addr_lo = msix->mmio_gpa + msix->table_offset;
-		addr_hi = addr_lo + (msix->table_count * MSIX_TABLE_ENTRY_SIZE);
-		addr_lo = round_page_down(addr_lo);
-		addr_hi = round_page_up(addr_hi);
+		if (msix->is_relocated) {
+			addr_lo = msix->mmio_gpa;
+			addr_hi = addr_lo + vdev->vbars[msix->table_bar].size;
+		} else {
+			addr_lo = msix->mmio_gpa + msix->table_offset;
+			addr_hi = addr_lo + (msix->table_count * MSIX_TABLE_ENTRY_SIZE);
+			addr_lo = round_page_down(addr_lo);
+			addr_hi = round_page_up(addr_hi);
+		}
 		unregister_mmio_emulation_handler(vpci2vm(vdev->vpci), addr_lo, addr_hi);
+		unmap_vmsix_shadow(vdev, batch);
 		msix->mmio_gpa = 0UL;
 	}
 }
@@ -198,7 +349,7 @@ static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  */
-void vdev_pt_map_msix(struct pci_vdev *vdev, bool hold_lock)
+static void vdev_pt_map_msix_batch(struct pci_vdev *vdev, bool hold_lock, struct ept_batch *batch)
 {
 	struct pci_vbar *vbar;
 	uint64_t addr_hi, addr_lo;
@@ -208,35 +359,54 @@ void vdev_pt_map_msix(struct pci_vdev *vdev, bool hold_lock)
 	if (vbar->base_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
-		addr_lo = vbar->base_gpa + msix->table_offset;
-		addr_hi = addr_lo + (msix->table_count * MSIX_TABLE_ENTRY_SIZE);
-		addr_lo = round_page_down(addr_lo);
-		addr_hi = round_page_up(addr_hi);
+		if (msix->is_relocated) {
+			/* nothing else is in the BAR of a relocated table */
+			addr_lo = vbar->base_gpa;
+			addr_hi = addr_lo + vbar->size;
+		} else {
+			addr_lo = vbar->base_gpa + msix->table_offset;
+			addr_hi = addr_lo + (msix->table_count * MSIX_TABLE_ENTRY_SIZE);
+			addr_lo = round_page_down(addr_lo);
+			addr_hi = round_page_up(addr_hi);
+		}
 		register_mmio_emulation_handler(vm, pt_vmsix_handle_table_mmio_access,
 				addr_lo, addr_hi, vdev, hold_lock);
-		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr_lo, addr_hi - addr_lo);
+		ept_del_mr_batch(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr_lo, addr_hi - addr_lo, batch);
 		msix->mmio_gpa = vbar->base_gpa;
+		if (vmsix_table_can_shadow(vdev, addr_lo, msix->is_relocated ? (addr_lo + msix->pba_offset) : addr_hi)) {
+			map_vmsix_shadow(vdev, addr_lo, batch);
+		}
 	}
 }
 
+/*
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ */
+void vdev_pt_map_msix(struct pci_vdev *vdev, bool hold_lock)
+{
+	vdev_pt_map_msix_batch(vdev, hold_lock, NULL);
+}
+
 /**
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  */
-static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
+static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx, struct ept_batch *batch)
 {
 	struct pci_vbar *vbar = &vdev->vbars[idx];
 
-	if (vbar->base_gpa != 0UL) {
+	if (vbar->mapped_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
-		ept_del_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
-			vbar->base_gpa, /* GPA (old vbar) */
-			vbar->size);
+		ept_del_mr_batch(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
+			vbar->mapped_gpa, /* GPA (old vbar) */
+			vbar->size, batch);
+		vbar->mapped_gpa = 0UL;
 	}
 
 	if ((has_msix_cap(vdev) && (idx == vdev->msix.table_bar))) {
-		vdev_pt_unmap_msix(vdev);
+		vdev_pt_unmap_msix(vdev, batch);
 	}
 }
 
@@ -244,25 +414,80 @@ static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  */
-static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
+static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx, struct ept_batch *batch)
 {
 	struct pci_vbar *vbar = &vdev->vbars[idx];
 
 	if (vbar->base_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
-		ept_add_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
+		ept_add_mr_batch(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
 			vbar->base_hpa, /* HPA (pbar) */
 			vbar->base_gpa, /* GPA (new vbar) */
 			vbar->size,
-			EPT_WR | EPT_RD | EPT_UNCACHED);
+			EPT_WR | EPT_RD | EPT_UNCACHED, batch);
+		vbar->mapped_gpa = vbar->base_gpa;
 	}
 
 	if (has_msix_cap(vdev) && (idx == vdev->msix.table_bar)) {
-		vdev_pt_map_msix(vdev, true);
+		vdev_pt_map_msix_batch(vdev, true, batch);
+	}
+}
+
+/**
+ * @brief Move the EPT mapping of a memory BAR to its current base_gpa
+ *
+ * The unmapping and the mapping, with the ones of the MSI-X table in the BAR,
+ * flush the EPT of the VM once. Nothing is done if the BAR didn't move.
+ *
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ * @pre !vdev->vbars[idx].is_mem64hi
+ */
+static void vdev_pt_commit_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
+{
+	struct acrn_vm *vm = vpci2vm(vdev->vpci);
+	struct pci_vbar *vbar = &vdev->vbars[idx];
+	struct ept_batch batch;
+
+	if (vbar->mapped_gpa != vbar->base_gpa) {
+		ept_batch_init(&batch, vm);
+		vdev_pt_unmap_mem_vbar(vdev, idx, &batch);
+		if (vbar->base_gpa != 0UL) {
+			vdev_pt_map_mem_vbar(vdev, idx, &batch);
+		}
+		ept_batch_flush(&batch);
+	}
+}
+
+/**
+ * @brief Commit the memory BARs written while the memory decoding of the device was off
+ *
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ */
+void vdev_pt_commit_mem_vbars(struct pci_vdev *vdev)
+{
+	uint32_t idx;
+
+	for (idx = 0U; idx < vdev->nr_bars; idx++) {
+		if (!is_pci_io_bar(&vdev->vbars[idx]) && !vdev->vbars[idx].is_mem64hi) {
+			vdev_pt_commit_mem_vbar(vdev, idx);
+		}
 	}
 }
 
+/**
+ * @pre vdev != NULL
+ * @pre vdev->pdev != NULL
+ */
+static bool vdev_pt_mem_decoding(const struct pci_vdev *vdev)
+{
+	/* MSE(Memory Space Enable) bit always be set for an assigned VF */
+	return ((vdev->phyfun != NULL) ||
+		((pci_pdev_read_cfg(vdev->pdev->bdf, PCIR_COMMAND, 2U) & PCIM_CMD_MEMEN) != 0U));
+}
+
 /**
  * @brief Allow IO bar access
  * @pre vdev != NULL
@@ -310,8 +535,14 @@ void vdev_pt_write_vbar(struct pci_vdev *vdev, uint32_t idx, uint32_t val)
 	if (is_pci_io_bar(vbar)) {
 		vpci_update_one_vbar(vdev, idx, val, vdev_pt_allow_io_vbar, vdev_pt_deny_io_vbar);
 	} else {
-		/* pci mem bar */
-		vpci_update_one_vbar(vdev, idx, val, vdev_pt_map_mem_vbar, vdev_pt_unmap_mem_vbar);
+		/*
+		 * pci mem bar, the EPT follows once the new base is whole: at the write of the
+		 * high half of a 64-bit BAR, or with the memory decoding off when it's turned on.
+		 */
+		pci_vdev_write_vbar(vdev, idx, val);
+		if (!is_pci_mem64lo_bar(vbar) && vdev_pt_mem_decoding(vdev)) {
+			vdev_pt_commit_mem_vbar(vdev, vbar->is_mem64hi ? (idx - 1U) : idx);
+		}
 	}
 }
 
@@ -508,6 +739,13 @@ static void init_bars(struct pci_vdev *vdev, bool is_sriov_bar)
 		}
 	}
 
+	/* the initial bases are where the VM has the BARs mapped, if it does */
+	if (!is_sriov_bar) {
+		for (idx = 0U; idx < bar_cnt; idx++) {
+			vdev->vbars[idx].mapped_gpa = vdev->vbars[idx].base_gpa;
+		}
+	}
+
 	/* Initialize MSIx mmio hpa and size after BARs initialization */
 	if (has_msix_cap(vdev) && (!is_sriov_bar)) {
 		vdev->msix.mmio_hpa = vdev->vbars[vdev->msix.table_bar].base_hpa;
@@ -528,6 +766,7 @@ void init_vmsix_pt(struct pci_vdev *vdev)
 	vdev->msix.table_bar = pdev->msix.table_bar;
 	vdev->msix.table_offset = pdev->msix.table_offset;
 	vdev->msix.table_count = pdev->msix.table_count;
+	vdev->msix.is_relocated = false;
 
 	if (has_msix_cap(vdev)) {
 		(void)memcpy_s((void *)&vdev->cfgdata.data_8[pdev->msix.capoff], pdev->msix.caplen,
@@ -535,6 +774,70 @@ void init_vmsix_pt(struct pci_vdev *vdev)
 	}
 }
 
+/**
+ * @brief Relocate the vMSI-X table and PBA of a passthrough device to its first unused BAR
+ *
+ * The table is at offset 0 of the BAR and the PBA at the next page after it, the
+ * BAR is trapped whole. Then the BAR holding the physical table is mapped whole
+ * to the VM, the registers in the pages of the table included.
+ *
+ * The size of the BAR must be the one the device model allocated it with.
+ *
+ * @return 0 on success, -ENODEV if all the BARs are used.
+ *
+ * @pre vdev != NULL
+ * @pre vdev->pdev != NULL
+ * @pre has_msix_cap(vdev) && !vdev->msix.is_vmsix_on_msi
+ */
+int32_t vdev_pt_relocate_msix(struct pci_vdev *vdev)
+{
+	struct pci_msix *msix = &vdev->msix;
+	struct pci_vbar *vbar;
+	uint32_t i, pba, pba_bar, size;
+	int32_t ret = -ENODEV;
+
+	for (i = 0U; i < vdev->nr_bars; i++) {
+		if (vdev->vbars[i].base_hpa == 0UL) {
+			break;
+		}
+		if (is_pci_mem64lo_bar(&vdev->vbars[i])) {
+			i++;
+		}
+	}
+
+	if (i < vdev->nr_bars) {
+		/* the physical PBA, the entries of the physical table can be pending on it */
+		pba = vdev->pdev->msix.cap[PCIR_MSIX_PBA] | ((uint32_t)vdev->pdev->msix.cap[PCIR_MSIX_PBA + 1U] << 8U) |
+			((uint32_t)vdev->pdev->msix.cap[PCIR_MSIX_PBA + 2U] << 16U) |
+			((uint32_t)vdev->pdev->msix.cap[PCIR_MSIX_PBA + 3U] << 24U);
+		pba_bar = pba & PCIM_MSIX_BIR_MASK;
+		msix->pba_hpa = vdev->vbars[pba_bar].base_hpa + (pba & ~PCIM_MSIX_BIR_MASK);
+
+		msix->pba_offset = (uint32_t)round_page_up(msix->table_count * MSIX_TABLE_ENTRY_SIZE);
+		size = msix->pba_offset + PAGE_SIZE;
+		/* round up to a power of 2 */
+		if ((size & (size - 1U)) != 0U) {
+			size = 1U << (fls32(size) + 1U);
+		}
+
+		msix->table_bar = i;
+		msix->table_offset = 0U;
+		msix->is_relocated = true;
+		pci_vdev_write_vcfg(vdev, msix->capoff + PCIR_MSIX_TABLE, 4U, i);
+		pci_vdev_write_vcfg(vdev, msix->capoff + PCIR_MSIX_PBA, 4U, msix->pba_offset | i);
+
+		vbar = &vdev->vbars[i];
+		vbar->size = size;
+		vbar->base_hpa = 0UL;
+		vbar->mask = ~(size - 1U) & PCI_BASE_ADDRESS_MEM_MASK;
+		/* fixed for memory, 32bit, non-prefetchable */
+		vbar->bar_type.bits = PCIM_BAR_MEM_32;
+		ret = 0;
+	}
+
+	return ret;
+}
+
 /**
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
@@ -545,7 +848,9 @@ void deinit_vmsix_pt(struct pci_vdev *vdev)
 		if (vdev->msix.table_count != 0U) {
 			ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->pdev->bdf.value, vdev->msix.table_count);
 			(void)memset((void *)&vdev->msix.table_entries, 0U, sizeof(vdev->msix.table_entries));
+			(void)memset((void *)&vdev->msix.remapped, 0U, sizeof(vdev->msix.remapped));
 			vdev->msix.is_vmsix_on_msi_programmed = false;
+			unmap_vmsix_shadow(vdev, NULL);
 		}
 	}
 }
@@ -646,7 +951,7 @@ void init_vdev_pt(struct pci_vdev *vdev, bool is_pf_vdev)
 			uint32_t bar_idx;
 
 			for (bar_idx = 0U; bar_idx < vdev->nr_bars; bar_idx++) {
-				vdev_pt_map_mem_vbar(vdev, bar_idx);
+				vdev_pt_map_mem_vbar(vdev, bar_idx, NULL);
 			}
 		}
 	}
@@ -674,7 +979,7 @@ void deinit_vdev_pt(struct pci_vdev *vdev) {
 
 		/* Delete VF MMIO from EPT table since the VF physical device has gone */
 		for (bar_idx = 0U; bar_idx < vdev->nr_bars; bar_idx++) {
-			vdev_pt_unmap_mem_vbar(vdev, bar_idx);
+			vdev_pt_unmap_mem_vbar(vdev, bar_idx, NULL);
 		}
 	}
 }
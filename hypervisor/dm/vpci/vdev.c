@@ -73,10 +73,7 @@ void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes,
 	}
 }
 
-/**
- * @pre vpci != NULL
- */
-struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
+static struct pci_vdev *find_hashed_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
 {
 	struct pci_vdev *vdev = NULL, *tmp;
 	struct hlist_node *n;
@@ -92,6 +89,53 @@ struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
 	return vdev;
 }
 
+/**
+ * @pre vpci != NULL
+ */
+struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
+{
+	struct pci_vdev *vdev;
+
+	if (vbdf.bits.b == 0U) {
+		vdev = vpci->bus0_vdevs[vbdf.fields.devfun];
+	} else {
+		vdev = find_hashed_vdev(vpci, vbdf);
+	}
+
+	return vdev;
+}
+
+/**
+ * @brief Make a vdev found by pci_find_vdev() at its vdev->bdf
+ *
+ * @pre vdev->vpci != NULL
+ */
+void vpci_link_vdev(struct pci_vdev *vdev)
+{
+	struct acrn_vpci *vpci = vdev->vpci;
+
+	hlist_add_head(&vdev->link, &vpci->vdevs_hlist_heads[hash64(vdev->bdf.value, VDEV_LIST_HASHBITS)]);
+	if (vdev->bdf.bits.b == 0U) {
+		vpci->bus0_vdevs[vdev->bdf.fields.devfun] = vdev;
+	}
+}
+
+/**
+ * @brief Stop pci_find_vdev() from finding a vdev, before its vdev->bdf changes or it's deinitialized
+ *
+ * @pre vdev->vpci != NULL
+ */
+void vpci_unlink_vdev(struct pci_vdev *vdev)
+{
+	struct acrn_vpci *vpci = vdev->vpci;
+
+	hlist_del(&vdev->link);
+	if ((vdev->bdf.bits.b == 0U) && (vpci->bus0_vdevs[vdev->bdf.fields.devfun] == vdev)) {
+		/* another vdev may have been shadowed at the same BDF */
+		vpci->bus0_vdevs[vdev->bdf.fields.devfun] = find_hashed_vdev(vpci, vdev->bdf);
+	}
+}
+
 static bool is_pci_mem_bar_base_valid(struct acrn_vm *vm, uint64_t base)
 {
 	struct acrn_vpci *vpci = &vm->vpci;
@@ -123,6 +123,19 @@ uint32_t rw_vmsix_table(struct pci_vdev *vdev, struct io_request *io_req)
 			} else {
 				pr_err("%s, Only DWORD and QWORD are permitted", __func__);
 			}
+		} else if (vdev->msix.is_relocated) {
+			/* the rest of the BAR of a relocated table is the PBA, then reserved */
+			if (mmio->direction == ACRN_IOREQ_DIR_READ) {
+				if ((offset >= vdev->msix.pba_offset) &&
+						((offset - vdev->msix.pba_offset) < (((vdev->msix.table_count + 63U) >> 6U) << 3U))) {
+					hva = hpa2hva(vdev->msix.pba_hpa + (offset - vdev->msix.pba_offset));
+					stac();
+					mmio->value = mmio_read(hva, mmio->size);
+					clac();
+				} else {
+					mmio->value = 0UL;
+				}
+			}
 		} else {
 			if (vdev->pdev != NULL) {
 				hva = hpa2hva(vdev->msix.mmio_hpa + (mmio->address - vdev->msix.mmio_gpa));
@@ -392,7 +392,10 @@ static void vpci_init_pt_dev(struct pci_vdev *vdev)
 	init_vsriov(vdev);
 	init_vdev_pt(vdev, false);
 
-	assign_vdev_pt_iommu_domain(vdev);
+	/* the VFs being enabled are assigned together by enable_vfs() */
+	if ((vdev->phyfun == NULL) || !vdev->phyfun->sriov.enabling_vfs) {
+		assign_vdev_pt_iommu_domain(vdev);
+	}
 }
 
 static void vpci_deinit_pt_dev(struct pci_vdev *vdev)
@@ -566,6 +569,10 @@ static int32_t write_cfg_header(struct pci_vdev *vdev,
 			pci_vdev_write_vcfg(vdev, offset, bytes, (val & 0xfU));
 		}
 
+		/* the BARs written with the memory decoding off are mapped now it's on */
+		if ((offset == PCIR_COMMAND) && ((val & PCIM_CMD_MEMEN) != 0U)) {
+			vdev_pt_commit_mem_vbars(vdev);
+		}
 	}
 	return ret;
 }
@@ -640,6 +647,115 @@ static const struct pci_vdev_ops pci_pt_dev_ops = {
 	.read_vdev_cfg	= read_pt_dev_cfg,
 };
 
+/**
+ * @pre vpci != NULL
+ */
+static struct vpci_cfg_shadow *find_cfg_shadow(struct acrn_vpci *vpci, union pci_bdf bdf)
+{
+	struct vpci_cfg_shadow *shadow = NULL;
+	uint32_t i;
+
+	for (i = 0U; i < VPCI_CFG_SHADOW_NUM; i++) {
+		if (vpci->cfg_shadows[i].valid && (vpci->cfg_shadows[i].bdf.value == bdf.value)) {
+			shadow = &vpci->cfg_shadows[i];
+			break;
+		}
+	}
+
+	return shadow;
+}
+
+/**
+ * @brief Answer a config read of a device model vdev from its shadow
+ *
+ * @pre vpci != NULL
+ * @pre pci_is_valid_access(offset, bytes)
+ *
+ * @return 0 if the read is answered, -ENODEV if the device model has to.
+ */
+static int32_t read_cfg_shadow(struct acrn_vpci *vpci, union pci_bdf bdf,
+	uint32_t offset, uint32_t bytes, uint32_t *val)
+{
+	struct vpci_cfg_shadow *shadow = find_cfg_shadow(vpci, bdf);
+	uint32_t idx = offset >> 2U;
+	int32_t ret = -ENODEV;
+
+	if ((shadow != NULL) && (idx < ACRN_PCI_CFG_SHADOW_DWORDS) && ((shadow->dm_dwords & (1UL << idx)) == 0UL)) {
+		*val = shadow->cfg[idx] >> ((offset & 3U) * 8U);
+		if (bytes < 4U) {
+			*val &= (1U << (bytes * 8U)) - 1U;
+		}
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Stop shadowing a config dword the guest writes
+ *
+ * The device model only shadows the dwords it doesn't expect to change,
+ * anything the guest writes it handles from then on.
+ *
+ * @pre vpci != NULL
+ */
+static void write_cfg_shadow(struct acrn_vpci *vpci, union pci_bdf bdf, uint32_t offset)
+{
+	struct vpci_cfg_shadow *shadow = find_cfg_shadow(vpci, bdf);
+	uint32_t idx = offset >> 2U;
+
+	if ((shadow != NULL) && (idx < ACRN_PCI_CFG_SHADOW_DWORDS)) {
+		shadow->dm_dwords |= (1UL << idx);
+	}
+}
+
+/**
+ * @brief Set or drop the config space shadow of a device model vdev
+ *
+ * @pre vm != NULL
+ * @pre shadow != NULL
+ *
+ * @return 0 on success, -EINVAL if the hypervisor emulates the device,
+ *         -ENOMEM if there is no free shadow.
+ */
+int32_t vpci_set_cfg_shadow(struct acrn_vm *vm, const struct acrn_vdev_cfg_shadow *shadow)
+{
+	struct acrn_vpci *vpci = &vm->vpci;
+	struct vpci_cfg_shadow *entry;
+	union pci_bdf bdf;
+	uint32_t i;
+	int32_t ret = 0;
+
+	bdf.value = shadow->bdf;
+	spinlock_obtain(&vpci->lock);
+	entry = find_cfg_shadow(vpci, bdf);
+	if ((shadow->flags & ACRN_PCI_CFG_SHADOW_CLEAR) != 0U) {
+		if (entry != NULL) {
+			entry->valid = false;
+		}
+	} else if (find_available_vdev(vpci, bdf) != NULL) {
+		ret = -EINVAL;
+	} else {
+		for (i = 0U; (entry == NULL) && (i < VPCI_CFG_SHADOW_NUM); i++) {
+			if (!vpci->cfg_shadows[i].valid) {
+				entry = &vpci->cfg_shadows[i];
+			}
+		}
+
+		if (entry != NULL) {
+			entry->bdf = bdf;
+			entry->dm_dwords = shadow->dm_dwords;
+			(void)memcpy_s(entry->cfg, sizeof(entry->cfg), shadow->cfg, sizeof(shadow->cfg));
+			entry->valid = true;
+		} else {
+			ret = -ENOMEM;
+		}
+	}
+	spinlock_release(&vpci->lock);
+
+	return ret;
+}
+
 /**
  * @pre vpci != NULL
  */
@@ -655,7 +771,7 @@ static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 		ret = vdev->vdev_ops->read_vdev_cfg(vdev, offset, bytes, val);
 	} else {
 		if (is_postlaunched_vm(vpci2vm(vpci))) {
-			ret = -ENODEV;
+			ret = read_cfg_shadow(vpci, bdf, offset, bytes, val);
 		} else if (is_plat_hidden_pdev(bdf)) {
 			/* expose and pass through platform hidden devices */
 			*val = pci_pdev_read_cfg(bdf, offset, bytes);
@@ -682,6 +798,7 @@ static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 		ret = vdev->vdev_ops->write_vdev_cfg(vdev, offset, bytes, val);
 	} else {
 		if (is_postlaunched_vm(vpci2vm(vpci))) {
+			write_cfg_shadow(vpci, bdf, offset);
 			ret = -ENODEV;
 		} else if (is_plat_hidden_pdev(bdf)) {
 			/* expose and pass through platform hidden devices */
@@ -728,7 +845,7 @@ struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_c
 		vdev->pci_dev_config = dev_config;
 		vdev->phyfun = parent_pf_vdev;
 
-		hlist_add_head(&vdev->link, &vpci->vdevs_hlist_heads[hash64(dev_config->vbdf.value, VDEV_LIST_HASHBITS)]);
+		vpci_link_vdev(vdev);
 		if (dev_config->vdev_ops != NULL) {
 			vdev->vdev_ops = dev_config->vdev_ops;
 		} else {
@@ -742,6 +859,20 @@ struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_c
 	return vdev;
 }
 
+/**
+ * @pre vpci != NULL
+ */
+uint32_t vpci_free_vdev_slots(const struct acrn_vpci *vpci)
+{
+	uint32_t i, used = 0U;
+
+	for (i = 0U; i < INT_DIV_ROUNDUP(CONFIG_MAX_PCI_DEV_NUM, 64U); i++) {
+		used += bitmap_weight(vpci->vdev_bitmaps[i]);
+	}
+
+	return CONFIG_MAX_PCI_DEV_NUM - used;
+}
+
 /**
  * @brief Deinitialize a vdev structure.
  * 
@@ -756,7 +887,7 @@ void vpci_deinit_vdev(struct pci_vdev *vdev)
 {
 	vdev->vdev_ops->deinit_vdev(vdev);
 
-	hlist_del(&vdev->link);
+	vpci_unlink_vdev(vdev);
 	bitmap_clear_nolock((vdev->id & 0x3FU), &vdev->vpci->vdev_bitmaps[vdev->id >> 6U]);
 	memset(vdev, 0U, sizeof(struct pci_vdev));
 }
@@ -832,6 +963,13 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 		if (vdev != NULL) {
 			pci_vdev_write_vcfg(vdev, PCIR_INTERRUPT_LINE, 1U, pcidev->intr_line);
 			pci_vdev_write_vcfg(vdev, PCIR_INTERRUPT_PIN, 1U, pcidev->intr_pin);
+			if (((pcidev->type & ACRN_PTDEV_MSIX_RELOC) != 0U) && has_msix_cap(vdev) &&
+					!vdev->msix.is_vmsix_on_msi && (vdev->phyfun == NULL)) {
+				if (vdev_pt_relocate_msix(vdev) != 0) {
+					pr_err("%s: no unused BAR to relocate the MSI-X table of %x:%x.%x", __func__,
+						bdf.bits.b, bdf.bits.d, bdf.bits.f);
+				}
+			}
 			for (idx = 0U; idx < vdev->nr_bars; idx++) {
 				/* VF is assigned to a User VM */
 				if (vdev->phyfun != NULL) {
@@ -843,15 +981,18 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 				}
 				pci_vdev_write_vbar(vdev, idx, pcidev->bar[idx]);
 			}
+			for (idx = 0U; idx < vdev->nr_bars; idx++) {
+				vdev->vbars[idx].mapped_gpa = vdev->vbars[idx].base_gpa;
+			}
 
 			ret = check_pt_dev_pio_bars(vdev);
 
 			if (ret == 0) {
 				vdev->flags |= pcidev->type;
+				/* We should re-add the vdev to the lookups since its vbdf changes */
+				vpci_unlink_vdev(vdev);
 				vdev->bdf.value = pcidev->virt_bdf;
-				/*We should re-add the vdev to hashlist since its vbdf has changed */
-				hlist_del(&vdev->link);
-				hlist_add_head(&vdev->link, &vpci->vdevs_hlist_heads[hash64(vdev->bdf.value, VDEV_LIST_HASHBITS)]);
+				vpci_link_vdev(vdev);
 				vdev->parent_user = vdev_in_service_vm;
 				vdev_in_service_vm->user = vdev;
 			} else {
@@ -145,6 +145,7 @@ static inline bool is_zombie_vf(const struct pci_vdev *vdev)
 void init_vdev_pt(struct pci_vdev *vdev, bool is_pf_vdev);
 void deinit_vdev_pt(struct pci_vdev *vdev);
 void vdev_pt_write_vbar(struct pci_vdev *vdev, uint32_t idx, uint32_t val);
+void vdev_pt_commit_mem_vbars(struct pci_vdev *vdev);
 void vdev_pt_map_msix(struct pci_vdev *vdev, bool hold_lock);
 
 void init_vmsi(struct pci_vdev *vdev);
@@ -161,6 +162,7 @@ uint32_t rw_vmsix_table(struct pci_vdev *vdev, struct io_request *io_req);
 int32_t vmsix_handle_table_mmio_access(struct io_request *io_req, void *priv_data);
 bool vpci_vmsix_enabled(const struct pci_vdev *vdev);
 void deinit_vmsix_pt(struct pci_vdev *vdev);
+int32_t vdev_pt_relocate_msix(struct pci_vdev *vdev);
 
 void init_vmsix_on_msi(struct pci_vdev *vdev);
 void write_vmsix_cap_reg_on_msi(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
@@ -173,6 +175,8 @@ uint32_t sriov_bar_offset(const struct pci_vdev *vdev, uint32_t bar_idx);
 
 uint32_t pci_vdev_read_vcfg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes);
 void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
+void vpci_link_vdev(struct pci_vdev *vdev);
+void vpci_unlink_vdev(struct pci_vdev *vdev);
 uint32_t vpci_add_capability(struct pci_vdev *vdev, uint8_t *capdata, uint8_t caplen);
 
 void pci_vdev_write_vbar(struct pci_vdev *vdev, uint32_t idx, uint32_t val);
@@ -33,6 +33,7 @@
 #include <asm/pci_dev.h>
 #include <logmsg.h>
 #include <delay.h>
+#include <asm/vtd.h>
 
 #include "vpci_priv.h"
 
@@ -82,7 +83,19 @@ static void init_sriov_vf_bar(struct pci_vdev *pf_vdev)
 /**
  * @pre pf_vdev != NULL
  */
-static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t vf_id)
+static void clear_vf_enable(const struct pci_vdev *pf_vdev)
+{
+	uint16_t control;
+
+	control = read_sriov_reg(pf_vdev, PCIR_SRIOV_CONTROL);
+	control &= (~PCIM_SRIOV_VF_ENABLE);
+	pci_pdev_write_cfg(pf_vdev->bdf, pf_vdev->sriov.capoff + PCIR_SRIOV_CONTROL, 2U, control);
+}
+
+/**
+ * @pre pf_vdev != NULL
+ */
+static struct pci_vdev *create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t vf_id)
 {
 	struct pci_pdev *vf_pdev;
 	struct pci_vdev *vf_vdev = NULL;
@@ -106,11 +119,7 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
 	 * and the requested VF physical devices are ready at this time, clear VF_ENABLE.
 	 */
 	if (vf_vdev == NULL) {
-		uint16_t control;
-
-		control = read_sriov_reg(pf_vdev, PCIR_SRIOV_CONTROL);
-		control &= (~PCIM_SRIOV_VF_ENABLE);
-		pci_pdev_write_cfg(pf_vdev->bdf, pf_vdev->sriov.capoff + PCIR_SRIOV_CONTROL, 2U, control);
+		clear_vf_enable(pf_vdev);
 		pr_err("PF %x:%x.%x can't creat VF, unset VF_ENABLE",
 			pf_vdev->bdf.bits.b, pf_vdev->bdf.bits.d, pf_vdev->bdf.bits.f);
 	} else {
@@ -124,6 +133,7 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
 			*vf_vbar = vf_vdev->phyfun->sriov.vbars[bar_idx];
 			vf_vbar->base_hpa += (vf_vbar->size * vf_id);
 			vf_vbar->base_gpa = vf_vbar->base_hpa;
+			vf_vbar->mapped_gpa = vf_vbar->base_gpa;
 
 			/* Map VF's BARs when it's first created. */
 			if (vf_vbar->base_gpa != 0UL) {
@@ -145,6 +155,8 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
 			pci_vdev_write_vcfg(vf_vdev, pci_bar_offset(bar_idx), 4U, 0U);
 		}
 	}
+
+	return vf_vdev;
 }
 
 /**
@@ -196,9 +208,36 @@ static void enable_vfs(struct pci_vdev *pf_vdev)
 	vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, fst_off, stride, 0U);
 	sub_vid = (uint16_t) pci_pdev_read_cfg(vf_bdf, PCIV_SUB_VENDOR_ID, 2U);
 	if ((sub_vid != 0xFFFFU) && (sub_vid != 0U)) {
+		struct acrn_vpci *vpci = &vpci2vm(pf_vdev->vpci)->vpci;
+		struct acrn_vm_config *vm_config = get_vm_config(vpci2vm(pf_vdev->vpci)->vm_id);
+		union pci_bdf vf_pbdfs[CONFIG_MAX_PCI_DEV_NUM];
 		struct pci_vdev *vf_vdev;
+		uint16_t nr_new = 0U, nr_vfs = 0U;
 
 		num_vfs = read_sriov_reg(pf_vdev, PCIR_SRIOV_NUMVFS);
+
+		/*
+		 * The vdev and device config slots of the VFs never created are checked up front,
+		 * a PF short of slots gets none of its VFs rather than the first ones.
+		 */
+		for (idx = 0U; idx < num_vfs; idx++) {
+			vf_bdf.fields.bus = get_vf_bus(pf_vdev, fst_off, stride, idx);
+			vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, fst_off, stride, idx);
+			if (pci_find_vdev(vpci, vf_bdf) == NULL) {
+				nr_new++;
+			}
+		}
+
+		if ((nr_new > vpci_free_vdev_slots(vpci)) ||
+				(((uint32_t)vm_config->pci_dev_num + nr_new) > CONFIG_MAX_PCI_DEV_NUM)) {
+			clear_vf_enable(pf_vdev);
+			pr_err("PF %x:%x.%x can't create %hu VFs, no slot left, unset VF_ENABLE",
+				pf_vdev->bdf.bits.b, pf_vdev->bdf.bits.d, pf_vdev->bdf.bits.f, nr_new);
+			num_vfs = 0U;
+		}
+
+		/* the IOMMU attaches of all the VFs complete with one invalidation wait, after the loop */
+		pf_vdev->sriov.enabling_vfs = true;
 		for (idx = 0U; idx < num_vfs; idx++) {
 			vf_bdf.fields.bus = get_vf_bus(pf_vdev, fst_off, stride, idx);
 			vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, fst_off, stride, idx);
@@ -209,15 +248,27 @@ static void enable_vfs(struct pci_vdev *pf_vdev)
 			 * The VF maybe have already existed but it is a zombie instance that vf_vdev->vpci
 			 * is NULL, in this case, we need to make the vf_vdev available again in here.
 			 */
-			vf_vdev = pci_find_vdev(&vpci2vm(pf_vdev->vpci)->vpci, vf_bdf);
+			vf_vdev = pci_find_vdev(vpci, vf_bdf);
 			if (vf_vdev == NULL) {
-				create_vf(pf_vdev, vf_bdf, idx);
+				vf_vdev = create_vf(pf_vdev, vf_bdf, idx);
+				if (vf_vdev == NULL) {
+					break;
+				}
 			} else {
 				/* Re-activate a zombie VF */
 				if (is_zombie_vf(vf_vdev)) {
 					vf_vdev->vdev_ops->init_vdev(vf_vdev);
+				} else {
+					continue;
 				}
 			}
+			vf_pbdfs[nr_vfs] = vf_vdev->pdev->bdf;
+			nr_vfs++;
+		}
+		pf_vdev->sriov.enabling_vfs = false;
+
+		if ((nr_vfs != 0U) && (move_pt_devices(NULL, vpci2vm(pf_vdev->vpci)->iommu, vf_pbdfs, nr_vfs) != 0)) {
+			panic("failed to assign iommu device!");
 		}
 	} else {
 		/*
@@ -0,0 +1,673 @@
+/*-
+ * Copyright (c) 2024 Intel Corporation.
+ * Copyright (c) 2014 Tycho Nightingale <tycho.nightingale@pluribusnetworks.com>
+ * Copyright (c) 2011 NetApp, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NETAPP, INC ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL NETAPP, INC OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <asm/cpu.h>
+#include <asm/lapic.h>
+#include <asm/tsc.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vmx_io.h>
+#include <io_req.h>
+#include <vpic.h>
+#include <vioapic.h>
+#include <vpit.h>
+#include <softirq.h>
+#include <logmsg.h>
+
+/**
+ * @addtogroup vp-dm_vperipheral
+ *
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Implementation of virtual PIT device.
+ *
+ * This file provides the implementation of the virtual i8254 PIT device of the post-launched VMs with
+ * GUEST_FLAG_VPIT, the same device as the one of the device model, without the round trip to the Service VM of
+ * each access: the firmware and the guests calibrating their delays poll the counters by the thousands. The
+ * counters are computed from the TSC and the interrupts of channel 0 are driven by a timer of the hypervisor.
+ */
+
+#define IO_TIMER1_PORT		0x40U	/* 8253 Timer #1 */
+#define TIMER_CNTR0		(IO_TIMER1_PORT + 0U)
+#define TIMER_CNTR2		(IO_TIMER1_PORT + 2U)
+#define TIMER_MODE		(IO_TIMER1_PORT + 3U)
+#define NMISC_PORT		0x61U
+
+#define PIT_ATPIC_IRQ		0U
+#define PIT_IOAPIC_IRQ		2U
+
+#define TIMER_INTTC		0x00U	/* mode 0, intr on terminal cnt */
+#define TIMER_RATEGEN		0x04U	/* mode 2, rate generator */
+#define TIMER_SQWAVE		0x06U	/* mode 3, square wave */
+#define TIMER_SWSTROBE		0x08U	/* mode 4, s/w triggered strobe */
+#define TIMER_LATCH		0x00U	/* latch counter for reading */
+#define TIMER_16BIT		0x30U	/* r/w counter 16 bits, LSB first */
+
+#define TIMER_SEL_MASK		0xc0U
+#define TIMER_RW_MASK		0x30U
+#define TIMER_MODE_MASK		0x0fU
+#define TIMER_MODE_DONT_CARE_MASK	0x08U
+#define TIMER_SEL_READBACK	0xc0U
+
+#define TIMER_STS_OUT		0x80U
+#define TIMER_STS_NULLCNT	0x40U
+
+#define TIMER_RB_LCTR		0x20U
+#define TIMER_RB_LSTATUS	0x10U
+#define TIMER_RB_CTR_2		0x08U
+#define TIMER_RB_CTR_1		0x04U
+#define TIMER_RB_CTR_0		0x02U
+
+#define TMR2_OUT_STS		0x20U
+
+#define PIT_8254_FREQ		1193182UL
+#define PIT_HZ_TO_TICKS(hz)	((PIT_8254_FREQ + ((hz) / 2UL)) / (hz))
+
+#define PERIODIC_MODE(mode)	(((mode) == TIMER_RATEGEN) || ((mode) == TIMER_SQWAVE))
+
+static inline uint64_t get_tsc_hz(void)
+{
+	return (uint64_t)get_tsc_khz() * 1000UL;
+}
+
+/* PIT ticks in tsc TSC cycles, without the overflow of (tsc * PIT_8254_FREQ) */
+static uint64_t tsc_to_pit_ticks(uint64_t tsc)
+{
+	uint64_t hz = get_tsc_hz();
+
+	return ((tsc / hz) * PIT_8254_FREQ) + (((tsc % hz) * PIT_8254_FREQ) / hz);
+}
+
+/* TSC cycles in ticks PIT ticks, ticks <= 0x10001 */
+static uint64_t pit_ticks_to_tsc(uint64_t ticks)
+{
+	return ((ticks * get_tsc_hz()) + (PIT_8254_FREQ - 1UL)) / PIT_8254_FREQ;
+}
+
+static uint64_t ticks_elapsed_since(uint64_t since)
+{
+	uint64_t now = cpu_ticks();
+
+	return (now > since) ? tsc_to_pit_ticks(now - since) : 0UL;
+}
+
+static inline bool pit_cntr0_timer_running(const struct acrn_vpit *vpit)
+{
+	return (vpit->expires != 0UL);
+}
+
+static bool vpit_get_out(const struct acrn_vpit *vpit, uint32_t channel, uint64_t delta_ticks)
+{
+	const struct vpit_channel *c = &vpit->channel[channel];
+	bool initval = c->nullcnt;
+	bool out = true;
+
+	/* only channel 0 emulates delayed CE loading */
+	if ((channel == 0U) && PERIODIC_MODE(c->mode)) {
+		initval = initval && !pit_cntr0_timer_running(vpit);
+	}
+
+	switch (c->mode) {
+	case TIMER_INTTC:
+		/*
+		 * For mode 0, see if the elapsed time is greater than the initial value - this results in the
+		 * output pin being set to 1 in the status byte.
+		 */
+		out = !initval && (delta_ticks >= c->initial);
+		break;
+	case TIMER_RATEGEN:
+		out = initval || ((delta_ticks % c->initial) != (c->initial - 1U));
+		break;
+	case TIMER_SQWAVE:
+		out = initval || ((delta_ticks % c->initial) < ((c->initial + 1U) / 2U));
+		break;
+	case TIMER_SWSTROBE:
+		out = initval || (delta_ticks != c->initial);
+		break;
+	default:
+		pr_dbg("vpit invalid timer mode: %u", c->mode);
+		break;
+	}
+
+	return out;
+}
+
+static uint32_t pit_cr_val(const uint8_t cr[2])
+{
+	uint32_t val;
+
+	val = (uint32_t)cr[0] | ((uint32_t)cr[1] << 8U);
+
+	/* CR == 0 means 2^16 for binary counting */
+	if (val == 0U) {
+		val = 0x10000U;
+	}
+
+	return val;
+}
+
+static void pit_load_ce(struct vpit_channel *c, uint64_t now)
+{
+	/* no CR update in progress */
+	if (c->nullcnt && (c->crbyte == 2U)) {
+		c->initial = pit_cr_val(c->cr);
+		c->nullcnt = false;
+		c->crbyte = 0U;
+		c->start_tsc = now;
+	}
+}
+
+/*
+ * Run in the timer softirq of vpit->pcpu_id. An expires changed since the timer of the hypervisor was last moved
+ * to it isn't fired here: a resync of the timer is pending on this pCPU.
+ */
+static void vpit_timer_expired(void *data)
+{
+	struct acrn_vpit *vpit = (struct acrn_vpit *)data;
+	struct acrn_vm *vm = vpit->vm;
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vpit->lock, &rflags);
+	if ((vpit->expires != 0UL) && (vpit->expires == vpit->timer.timeout)) {
+		/* generate a rising edge on OUT, PIC pin 0 is IOAPIC pin 2 */
+		vpic_set_irqline(vm_pic(vm), PIT_ATPIC_IRQ, GSI_RAISING_PULSE);
+		vioapic_set_irqline_lock(vm, PIT_IOAPIC_IRQ, GSI_RAISING_PULSE);
+
+		/* CR -> CE if necessary */
+		pit_load_ce(&vpit->channel[0], vpit->expires);
+
+		if (vpit->timer.mode == TICK_MODE_PERIODIC) {
+			vpit->expires += vpit->timer.period_in_cycle;
+		} else {
+			vpit->expires = 0UL;
+		}
+	}
+	spinlock_irqrestore_release(&vpit->lock, rflags);
+}
+
+/* Move the timer of the hypervisor to the expires of channel 0, @pre get_pcpu_id() == vpit->pcpu_id */
+static void vpit_resync_timer(struct acrn_vpit *vpit)
+{
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vpit->lock, &rflags);
+	if (vpit->resync) {
+		vpit->resync = false;
+		del_timer(&vpit->timer);
+		if (vpit->expires != 0UL) {
+			update_timer(&vpit->timer, vpit->expires, vpit->period);
+			(void)add_timer(&vpit->timer);
+		}
+	}
+	spinlock_irqrestore_release(&vpit->lock, rflags);
+}
+
+static void vpit_softirq(uint16_t pcpu_id)
+{
+	struct acrn_vpit *vpit;
+	uint16_t vm_id;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vpit = &get_vm_from_vmid(vm_id)->vpit;
+		if ((vpit->pcpu_id == pcpu_id) && vpit->resync) {
+			vpit_resync_timer(vpit);
+		}
+	}
+}
+
+/* The timer of the hypervisor can only be added and deleted on its own pCPU, the same as the vHPET ones */
+static void vpit_kick_resync(struct acrn_vpit *vpit)
+{
+	if (get_pcpu_id() == vpit->pcpu_id) {
+		vpit_resync_timer(vpit);
+	} else {
+		fire_softirq_on_pcpu(vpit->pcpu_id, SOFTIRQ_VPIT);
+		kick_pcpu(vpit->pcpu_id);
+	}
+}
+
+/* Return whether channel 0 was counting, and the TSC cycles left to its next interrupt in rem */
+static bool pit_timer_stop_cntr0(struct acrn_vpit *vpit, uint64_t now, uint64_t *rem)
+{
+	bool active = pit_cntr0_timer_running(vpit);
+
+	if (active) {
+		if (rem != NULL) {
+			*rem = (vpit->expires > now) ? (vpit->expires - now) : 0UL;
+		}
+		vpit->expires = 0UL;
+		vpit->resync = true;
+	}
+
+	return active;
+}
+
+static void pit_timer_start_cntr0(struct acrn_vpit *vpit)
+{
+	struct vpit_channel *c = &vpit->channel[0];
+	uint64_t now = cpu_ticks();
+	uint64_t rem = 0UL, timer_ticks;
+
+	if (pit_timer_stop_cntr0(vpit, now, &rem) && PERIODIC_MODE(c->mode)) {
+		/*
+		 * Counter is being updated while counting in periodic mode. Update CE at the end of the current
+		 * counting cycle: on real hardware, mode 3 requires CE to be updated at the end of its current
+		 * half-cycle. We operate as if CR is always updated in the second half-cycle (before a rising edge on
+		 * OUT).
+		 */
+		vpit->expires = now + rem;
+		vpit->period = pit_ticks_to_tsc((uint64_t)pit_cr_val(c->cr));
+	} else {
+		/* Aperiodic mode or no running periodic counter. Update CE immediately. */
+		pit_load_ce(c, now);
+
+		timer_ticks = (c->mode == TIMER_SWSTROBE) ? ((uint64_t)c->initial + 1UL) : (uint64_t)c->initial;
+		vpit->expires = now + pit_ticks_to_tsc(timer_ticks);
+
+		/* make it periodic if required */
+		vpit->period = PERIODIC_MODE(c->mode) ? pit_ticks_to_tsc(timer_ticks) : 0UL;
+	}
+
+	/* expires of 0 is not counting */
+	if (vpit->expires == 0UL) {
+		vpit->expires = 1UL;
+	}
+	vpit->resync = true;
+}
+
+static uint16_t pit_update_counter(struct vpit_channel *c, bool latch, uint64_t *ticks_elapsed)
+{
+	uint16_t lval = 0U;
+	uint64_t delta_ticks, t;
+
+	if (c->initial == 0U) {
+		/*
+		 * This is possibly an o/s bug - reading the value of the timer without having set up the initial
+		 * value. The original Bhyve user-space version of this code set the timer to 100hz in this
+		 * condition; do the same here.
+		 */
+		c->initial = (uint32_t)PIT_HZ_TO_TICKS(100UL);
+		delta_ticks = 0UL;
+		c->start_tsc = cpu_ticks();
+	} else {
+		delta_ticks = ticks_elapsed_since(c->start_tsc);
+	}
+
+	switch (c->mode) {
+	case TIMER_INTTC:
+	case TIMER_SWSTROBE:
+		lval = (uint16_t)(c->initial - delta_ticks);
+		break;
+	case TIMER_RATEGEN:
+		lval = (uint16_t)(c->initial - (delta_ticks % c->initial));
+		break;
+	case TIMER_SQWAVE:
+		t = delta_ticks % c->initial;
+		if (t >= ((c->initial + 1U) / 2U)) {
+			t -= (c->initial + 1U) / 2U;
+		}
+		lval = (uint16_t)((c->initial & ~0x1U) - (t * 2UL));
+		break;
+	default:
+		pr_dbg("vpit invalid timer mode: %u", c->mode);
+		break;
+	}
+
+	/* cannot latch a new value until the old one has been consumed */
+	if (latch && (c->olbyte == 0U)) {
+		c->olbyte = 2U;
+		c->ol[1] = (uint8_t)lval;		/* LSB */
+		c->ol[0] = (uint8_t)(lval >> 8U);	/* MSB */
+	}
+
+	*ticks_elapsed = delta_ticks;
+	return lval;
+}
+
+static void pit_readback1(struct acrn_vpit *vpit, uint32_t channel, uint8_t cmd)
+{
+	struct vpit_channel *c = &vpit->channel[channel];
+	uint64_t delta_ticks;
+
+	/*
+	 * Latch the count/status of the timer if not already latched. N.B. that the count/status latch-select
+	 * bits are active-low.
+	 */
+	(void)pit_update_counter(c, ((cmd & TIMER_RB_LCTR) == 0U), &delta_ticks);
+
+	if (((cmd & TIMER_RB_LSTATUS) == 0U) && !c->slatched) {
+		c->slatched = true;
+
+		/* status byte is only updated upon latching */
+		c->status = TIMER_16BIT | c->mode;
+		if (c->nullcnt) {
+			c->status |= TIMER_STS_NULLCNT;
+		}
+
+		/* use the same delta_ticks for both latches */
+		if (vpit_get_out(vpit, channel, delta_ticks)) {
+			c->status |= TIMER_STS_OUT;
+		}
+	}
+}
+
+static void pit_readback(struct acrn_vpit *vpit, uint8_t cmd)
+{
+	/* The readback command can apply to all timers. */
+	if ((cmd & TIMER_RB_CTR_0) != 0U) {
+		pit_readback1(vpit, 0U, cmd);
+	}
+	if ((cmd & TIMER_RB_CTR_1) != 0U) {
+		pit_readback1(vpit, 1U, cmd);
+	}
+	if ((cmd & TIMER_RB_CTR_2) != 0U) {
+		pit_readback1(vpit, 2U, cmd);
+	}
+}
+
+static void vpit_update_mode(struct acrn_vpit *vpit, uint8_t val)
+{
+	struct vpit_channel *c;
+	uint8_t sel, rw, mode;
+	uint64_t delta_ticks;
+
+	sel = val & TIMER_SEL_MASK;
+	rw = val & TIMER_RW_MASK;
+	mode = val & TIMER_MODE_MASK;
+
+	if (sel == TIMER_SEL_READBACK) {
+		pit_readback(vpit, val);
+	} else if ((rw != TIMER_LATCH) && (rw != TIMER_16BIT)) {
+		pr_dbg("vpit unsupported rw: 0x%x", rw);
+	} else if ((rw != TIMER_LATCH) && (mode != TIMER_INTTC) &&
+			!PERIODIC_MODE(mode & ~TIMER_MODE_DONT_CARE_MASK) && (mode != TIMER_SWSTROBE)) {
+		/* Counter mode is not affected when issuing a latch command. */
+		pr_dbg("vpit unsupported mode: 0x%x", mode);
+	} else {
+		c = &vpit->channel[sel >> 6U];
+		if (rw == TIMER_LATCH) {
+			(void)pit_update_counter(c, true, &delta_ticks);
+		} else {
+			if ((mode == (TIMER_MODE_DONT_CARE_MASK | TIMER_RATEGEN)) ||
+					(mode == (TIMER_MODE_DONT_CARE_MASK | TIMER_SQWAVE))) {
+				mode &= ~TIMER_MODE_DONT_CARE_MASK;
+			}
+
+			c->mode = mode;
+			c->nullcnt = true;
+			c->crbyte = 0U;	/* control word must be written first */
+			c->olbyte = 0U;	/* reset latch after reprogramming */
+
+			if ((sel >> 6U) == 0U) {
+				(void)pit_timer_stop_cntr0(vpit, 0UL, NULL);
+			}
+		}
+	}
+}
+
+static uint8_t vpit_counter_read(struct vpit_channel *c)
+{
+	uint64_t delta_ticks;
+	uint16_t tmp;
+	uint8_t val;
+
+	if (c->slatched) {
+		/* Return the status byte if latched */
+		val = c->status;
+		c->slatched = false;
+	} else if (c->olbyte == 0U) {
+		/*
+		 * The spec says that once the output latch is completely read it should revert to "following" the
+		 * counter. Use the free running counter for this case (i.e. Linux TSC calibration). Assuming the
+		 * access mode is 16-bit, toggle the MSB/LSB bit on each read.
+		 */
+		tmp = pit_update_counter(c, false, &delta_ticks);
+		if (c->frbyte != 0U) {
+			tmp >>= 8U;
+		}
+		val = (uint8_t)tmp;
+		c->frbyte ^= 1U;
+	} else {
+		c->olbyte--;
+		val = c->ol[c->olbyte];
+	}
+
+	return val;
+}
+
+static void vpit_counter_write(struct acrn_vpit *vpit, uint32_t channel, uint8_t val)
+{
+	struct vpit_channel *c = &vpit->channel[channel];
+
+	if (c->crbyte == 2U) {
+		/* keep nullcnt */
+		c->crbyte = 0U;
+	}
+
+	c->cr[c->crbyte] = val;
+	c->crbyte++;
+
+	if (c->crbyte == 2U) {
+		if (PERIODIC_MODE(c->mode) && (pit_cr_val(c->cr) == 1U)) {
+			/* illegal value */
+			c->cr[0] = 0U;
+			c->crbyte = 0U;
+		} else {
+			c->frbyte = 0U;
+			c->nullcnt = true;
+
+			if (channel == 0U) {
+				/* Start an interval timer for channel 0 */
+				pit_timer_start_cntr0(vpit);
+			} else {
+				/*
+				 * For channel 1 & 2, load the value into CE immediately. On real hardware, in periodic
+				 * mode, CE doesn't get updated until the end of the current cycle or half-cycle.
+				 */
+				pit_load_ce(c, cpu_ticks());
+			}
+		}
+	}
+}
+
+static bool vpit_read(struct acrn_vcpu *vcpu, uint16_t addr, size_t width)
+{
+	struct acrn_vpit *vpit = &vcpu->vm->vpit;
+	struct acrn_pio_request *pio_req = &vcpu->req.reqs.pio_request;
+	uint64_t rflags;
+
+	pio_req->value = 0xffU;
+	if ((width == 1U) && (addr != TIMER_MODE)) {
+		spinlock_irqsave_obtain(&vpit->lock, &rflags);
+		if (vpit->active) {
+			pio_req->value = vpit_counter_read(&vpit->channel[addr - TIMER_CNTR0]);
+		}
+		spinlock_irqrestore_release(&vpit->lock, rflags);
+	} else {
+		pr_dbg("vpit invalid in op @ io port 0x%x, %lu bytes", addr, width);
+	}
+
+	return true;
+}
+
+static bool vpit_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t width, uint32_t value)
+{
+	struct acrn_vpit *vpit = &vcpu->vm->vpit;
+	uint64_t rflags;
+	bool resync;
+
+	if (width == 1U) {
+		spinlock_irqsave_obtain(&vpit->lock, &rflags);
+		if (vpit->active) {
+			if (addr == TIMER_MODE) {
+				vpit_update_mode(vpit, (uint8_t)value);
+			} else {
+				vpit_counter_write(vpit, (uint32_t)addr - TIMER_CNTR0, (uint8_t)value);
+			}
+		}
+		resync = vpit->resync;
+		spinlock_irqrestore_release(&vpit->lock, rflags);
+
+		if (resync) {
+			vpit_kick_resync(vpit);
+		}
+	} else {
+		pr_dbg("vpit invalid out op @ io port 0x%x, %lu bytes", addr, width);
+	}
+
+	return true;
+}
+
+static bool vpit_nmisc_read(struct acrn_vcpu *vcpu, __unused uint16_t addr, __unused size_t width)
+{
+	struct acrn_vpit *vpit = &vcpu->vm->vpit;
+	struct acrn_pio_request *pio_req = &vcpu->req.reqs.pio_request;
+	uint64_t rflags;
+
+	/* GATE2 control is not emulated */
+	pio_req->value = 0U;
+	spinlock_irqsave_obtain(&vpit->lock, &rflags);
+	if (vpit->active && vpit_get_out(vpit, 2U, ticks_elapsed_since(vpit->channel[2].start_tsc))) {
+		pio_req->value = TMR2_OUT_STS;
+	}
+	spinlock_irqrestore_release(&vpit->lock, rflags);
+
+	return true;
+}
+
+static bool vpit_nmisc_write(__unused struct acrn_vcpu *vcpu, __unused uint16_t addr, __unused size_t width,
+		__unused uint32_t value)
+{
+	return true;
+}
+
+/* Channels at reset, with channel 0 stopped, @pre the lock is held or the device not active */
+static void vpit_reset_channels(struct acrn_vpit *vpit)
+{
+	(void)pit_timer_stop_cntr0(vpit, 0UL, NULL);
+	(void)memset(vpit->channel, 0U, sizeof(vpit->channel));
+}
+
+/**
+ * @brief Initialize the virtual PIT device of a VM.
+ *
+ * The timer of channel 0 is on the pCPU \p pcpu_id, which is to stay in the VM until vpit_deinit().
+ *
+ * @param[inout] vm Pointer to the VM whose virtual PIT device is to be initialized.
+ * @param[in] pcpu_id The pCPU the timer of channel 0 is on, the one of its BSP.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre is_vpit_configured(vm)
+ */
+void vpit_init(struct acrn_vm *vm, uint16_t pcpu_id)
+{
+	struct acrn_vpit *vpit = &vm->vpit;
+	struct vm_io_range range = {
+		.base = TIMER_CNTR0, .len = 4U};
+	struct vm_io_range nmisc_range = {
+		.base = NMISC_PORT, .len = 1U};
+
+	register_softirq(SOFTIRQ_VPIT, vpit_softirq);
+
+	spinlock_init(&vpit->lock);
+	vpit->vm = vm;
+	vpit->pcpu_id = pcpu_id;
+	vpit->resync = false;
+	vpit->expires = 0UL;
+	vpit->period = 0UL;
+	initialize_timer(&vpit->timer, vpit_timer_expired, vpit, 0UL, 0UL);
+	vpit_reset_channels(vpit);
+	vpit->resync = false;
+	vpit->active = true;
+
+	register_pio_emulation_handler(vm, PIT_PIO_IDX, &range, vpit_read, vpit_write);
+	register_pio_emulation_handler(vm, NMISC_PIO_IDX, &nmisc_range, vpit_nmisc_read, vpit_nmisc_write);
+}
+
+/**
+ * @brief Reset the virtual PIT device of a VM to its power-on state.
+ *
+ * @param[inout] vm Pointer to the VM whose virtual PIT device is to be reset.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre vm->state == VM_PAUSED
+ */
+void vpit_reset(struct acrn_vm *vm)
+{
+	struct acrn_vpit *vpit = &vm->vpit;
+	uint64_t rflags;
+
+	if (vpit->active) {
+		spinlock_irqsave_obtain(&vpit->lock, &rflags);
+		vpit_reset_channels(vpit);
+		spinlock_irqrestore_release(&vpit->lock, rflags);
+
+		vpit_kick_resync(vpit);
+	}
+}
+
+/**
+ * @brief Stop the virtual PIT device of a VM.
+ *
+ * Return once the timer of channel 0 is deleted from its pCPU.
+ *
+ * @param[inout] vm Pointer to the VM whose virtual PIT device is to be stopped.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre vm->state == VM_POWERED_OFF
+ */
+void vpit_deinit(struct acrn_vm *vm)
+{
+	struct acrn_vpit *vpit = &vm->vpit;
+	uint64_t rflags;
+
+	if (vpit->active) {
+		spinlock_irqsave_obtain(&vpit->lock, &rflags);
+		vpit->active = false;
+		vpit_reset_channels(vpit);
+		spinlock_irqrestore_release(&vpit->lock, rflags);
+
+		vpit_kick_resync(vpit);
+		while (vpit->resync) {
+			asm_pause();
+		}
+	}
+}
+
+/**
+ * @}
+ */
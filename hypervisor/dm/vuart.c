@@ -34,6 +34,7 @@
 #include <vuart.h>
 #include <vmcs9900.h>
 #include <asm/guest/vm.h>
+#include <asm/guest/guest_memory.h>
 #include <logmsg.h>
 
 /**
@@ -151,7 +152,7 @@ static uint8_t vuart_intr_reason(const struct acrn_vuart *vu)
 
 	if (((vu->lsr & (LSR_OE | LSR_BI)) != 0U) && ((vu->ier & IER_ELSI) != 0U)) {
 		ret = IIR_RLS;
-	} else if ((fifo_numchars(&vu->rxfifo) > 0U) && ((vu->ier & IER_ERBFI) != 0U)) {
+	} else if (((fifo_numchars(&vu->rxfifo) > 0U) || vu->pv_rx_pending) && ((vu->ier & IER_ERBFI) != 0U)) {
 		ret = IIR_RXRDY;
 	} else if (vu->thre_int_pending && ((vu->ier & IER_ETBEI) != 0U)) {
 		ret = IIR_TXRDY;
@@ -224,14 +225,81 @@ void vuart_toggle_intr(const struct acrn_vuart *vu)
 	}
 }
 
-static bool send_to_target(struct acrn_vuart *vu, uint8_t value_u8)
+/*
+ * Move the RX FIFO to the RX ring, as much as the guest has room for.
+ *
+ * @pre: the vuart lock is held
+ */
+static void vuart_pv_rx_fill(struct acrn_vuart *vu)
+{
+	volatile struct vuart_pv_ring *ring = vu->pv_ring;
+	uint32_t prod, room;
+
+	if (ring != NULL) {
+		prod = ring->rx_prod;
+		room = VUART_PV_RING_SIZE - (prod - ring->rx_cons);
+		/* indexes corrupted by the guest */
+		if (room > VUART_PV_RING_SIZE) {
+			room = 0U;
+		}
+
+		if ((room > 0U) && (fifo_numchars(&vu->rxfifo) > 0U)) {
+			while ((room > 0U) && (fifo_numchars(&vu->rxfifo) > 0U)) {
+				ring->rx[prod & (VUART_PV_RING_SIZE - 1U)] = fifo_getchar(&vu->rxfifo);
+				prod++;
+				room--;
+			}
+			/* the data before the index */
+			cpu_write_memory_barrier();
+			ring->rx_prod = prod;
+			vu->pv_rx_pending = true;
+		}
+	}
+}
+
+/*
+ * Take up to len bytes from the TX ring, return the number taken.
+ *
+ * @pre: the vuart lock is held
+ */
+static uint32_t vuart_pv_tx_get(struct acrn_vuart *vu, char *buf, uint32_t len)
+{
+	volatile struct vuart_pv_ring *ring = vu->pv_ring;
+	uint32_t cons, i, n = 0U;
+
+	if (ring != NULL) {
+		cons = ring->tx_cons;
+		n = ring->tx_prod - cons;
+		/* indexes corrupted by the guest */
+		if (n > VUART_PV_RING_SIZE) {
+			n = 0U;
+		}
+		if (n > len) {
+			n = len;
+		}
+		/* the index before the data */
+		cpu_compiler_barrier();
+		for (i = 0U; i < n; i++) {
+			buf[i] = ring->tx[(cons + i) & (VUART_PV_RING_SIZE - 1U)];
+		}
+		ring->tx_cons = cons + n;
+	}
+
+	return n;
+}
+
+static bool send_to_target(struct acrn_vuart *vu, const char *buf, uint32_t len)
 {
 	uint64_t rflags;
+	uint32_t i;
 	bool ret = false;
 
 	obtain_vuart_lock(vu, rflags);
 	if (vu->active) {
-		fifo_putchar(&vu->rxfifo, (char)value_u8);
+		for (i = 0U; i < len; i++) {
+			fifo_putchar(&vu->rxfifo, buf[i]);
+		}
+		vuart_pv_rx_fill(vu);
 		if (fifo_isfull(&vu->rxfifo)) {
 			ret = true;
 		}
@@ -299,6 +367,59 @@ static uint8_t update_modem_status(uint8_t new_msr, uint8_t old_msr)
 	return update_msr;
 }
 
+/*
+ * @pre: the vuart lock is held
+ */
+static void write_pv_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
+{
+	uint32_t shift;
+	void *hva;
+
+	if (reg == VUART_PV_CTRL) {
+		if ((value_u8 & VUART_PV_CTRL_RING_EN) == 0U) {
+			vu->pv_ring = NULL;
+			vu->pv_rx_pending = false;
+		} else if (vu->pv_ring == NULL) {
+			/* the ring is in one page, mapped contiguously */
+			hva = gpa2hva(vu->vm, (uint64_t)vu->pv_ring_gfn << PAGE_SHIFT);
+			if (hva != NULL) {
+				vu->pv_ring = (volatile struct vuart_pv_ring *)hva;
+			} else {
+				pr_err("vuart: invalid ring gfn 0x%x of vm%d", vu->pv_ring_gfn, vu->vm->vm_id);
+			}
+		} else {
+			/* already enabled */
+		}
+	} else if ((reg >= VUART_PV_RING_GFN) && (vu->pv_ring == NULL)) {
+		shift = ((uint32_t)reg - VUART_PV_RING_GFN) * 8U;
+		vu->pv_ring_gfn = (vu->pv_ring_gfn & ~(0xffU << shift)) | ((uint32_t)value_u8 << shift);
+	} else {
+		/* read-only, or the ring moved while enabled */
+	}
+}
+
+/*
+ * @pre: the vuart lock is held
+ */
+static uint8_t read_pv_reg(const struct acrn_vuart *vu, uint16_t reg)
+{
+	uint8_t reg_val;
+
+	if (reg == VUART_PV_ID) {
+		reg_val = VUART_PV_SIGNATURE;
+	} else if (reg == VUART_PV_BURST) {
+		reg_val = VUART_PV_TX_BURST;
+	} else if (reg == VUART_PV_CTRL) {
+		reg_val = (vu->pv_ring != NULL) ? VUART_PV_CTRL_RING_EN : 0U;
+	} else if (reg >= VUART_PV_RING_GFN) {
+		reg_val = (uint8_t)(vu->pv_ring_gfn >> (((uint32_t)reg - VUART_PV_RING_GFN) * 8U));
+	} else {
+		reg_val = 0xFFU;
+	}
+
+	return reg_val;
+}
+
 /*
  * @pre: vu != NULL
  */
@@ -309,9 +430,11 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
 
 	obtain_vuart_lock(vu, rflags);
 	/*
-	 * Take care of the special case DLAB accesses first
+	 * Take care of the paravirtual bank and the special case DLAB accesses first
 	 */
-	if (((vu->lcr & LCR_DLAB) != 0U) && (reg == UART16550_DLL)) {
+	if ((vu->lcr == VUART_LCR_PV_BANK) && (reg != UART16550_LCR)) {
+		write_pv_reg(vu, reg, value_u8);
+	} else if (((vu->lcr & LCR_DLAB) != 0U) && (reg == UART16550_DLL)) {
 		vu->dll = value_u8;
 	} else if (((vu->lcr & LCR_DLAB) != 0U) && (reg == UART16550_DLM)) {
 		vu->dlh = value_u8;
@@ -390,6 +513,77 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
 	release_vuart_lock(vu, rflags);
 }
 
+static void notify_target(const struct acrn_vuart *vu)
+{
+	struct acrn_vuart *t_vu;
+	uint64_t rflags;
+
+	if (vu != NULL) {
+		t_vu = vu->target_vu;
+		if ((t_vu != NULL) && !fifo_isfull(&vu->rxfifo)) {
+			obtain_vuart_lock(t_vu, rflags);
+			t_vu->thre_int_pending = true;
+			vuart_toggle_intr(t_vu);
+			release_vuart_lock(t_vu, rflags);
+		}
+	}
+}
+
+/*
+ * Doorbell of the paravirtual mode: the guest has filled the TX ring and/or consumed the RX ring.
+ *
+ * - The RX ring is refilled from the RX FIFO, and the target told it may send more if that has room again.
+ * - The TX ring goes to the RX FIFO of the target in bursts the size of the room fifo_isfull() keeps there, until
+ *   the ring is empty or that FIFO is full. Like for THR writes, THRE is raised unless the target is full: its
+ *   reads raise it later, and the guest then rings the doorbell again for the rest of the ring.
+ * - Without a target, the TX ring goes to the TX FIFO the console reads.
+ */
+static void vuart_pv_doorbell(struct acrn_vuart *vu)
+{
+	struct acrn_vuart *t_vu = vu->target_vu;
+	char buf[VUART_PV_TX_BURST];
+	uint32_t i, n;
+	uint64_t rflags;
+	bool full = false;
+
+	obtain_vuart_lock(vu, rflags);
+	vuart_pv_rx_fill(vu);
+	if (t_vu == NULL) {
+		do {
+			n = vuart_pv_tx_get(vu, buf, VUART_PV_TX_BURST);
+			for (i = 0U; i < n; i++) {
+				fifo_putchar(&vu->txfifo, buf[i]);
+			}
+		} while (n > 0U);
+	}
+	vuart_toggle_intr(vu);
+	release_vuart_lock(vu, rflags);
+	notify_target(vu);
+
+	if (t_vu != NULL) {
+		obtain_vuart_lock(t_vu, rflags);
+		full = fifo_isfull(&t_vu->rxfifo);
+		release_vuart_lock(t_vu, rflags);
+
+		while (!full) {
+			obtain_vuart_lock(vu, rflags);
+			n = vuart_pv_tx_get(vu, buf, VUART_PV_TX_BURST);
+			release_vuart_lock(vu, rflags);
+			if (n == 0U) {
+				break;
+			}
+			full = send_to_target(t_vu, buf, n);
+		}
+	}
+
+	if (!full) {
+		obtain_vuart_lock(vu, rflags);
+		vu->thre_int_pending = true;
+		vuart_toggle_intr(vu);
+		release_vuart_lock(vu, rflags);
+	}
+}
+
 /**
  * @brief Write a value to a register in the virtual UART.
  *
@@ -404,7 +598,8 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
  *   - Additionally, to ensure reliable communication, it raises the THRE interrupt (indicating that more data can be
  *     processed) only if the target vUART's RXFIFO is not full.
  * - If these conditions are not met, the virtual registers specified by the offset are updated according to the 16550
- *   UART specification.
+ *   UART specification, or the paravirtual bank if the LCR selects it. A write to the SCR of a vUART with the ring of
+ *   the paravirtual mode enabled also rings its doorbell, see vuart_pv_doorbell().
  *
  * @param[inout] vu The virtual UART structure to which the register value is to be written.
  * @param[in] offset The offset of the register within the vUART.
@@ -420,12 +615,13 @@ void vuart_write_reg(struct acrn_vuart *vu, uint16_t offset, uint8_t value_u8)
 {
 	struct acrn_vuart *target_vu = NULL;
 	uint64_t rflags;
+	char ch = (char)value_u8;
 
 	target_vu = vu->target_vu;
 
 	if (((vu->mcr & MCR_LOOPBACK) == 0U) && ((vu->lcr & LCR_DLAB) == 0U)
 		&& (offset == UART16550_THR) && (target_vu != NULL)) {
-		if (!send_to_target(target_vu, value_u8)) {
+		if (!send_to_target(target_vu, &ch, 1U)) {
 			/* FIFO is not full, raise THRE interrupt */
 			obtain_vuart_lock(vu, rflags);
 			vu->thre_int_pending = true;
@@ -434,6 +630,9 @@ void vuart_write_reg(struct acrn_vuart *vu, uint16_t offset, uint8_t value_u8)
 		}
 	} else {
 		write_reg(vu, offset, value_u8);
+		if ((offset == UART16550_SCR) && ((vu->lcr & LCR_DLAB) == 0U) && (vu->pv_ring != NULL)) {
+			vuart_pv_doorbell(vu);
+		}
 	}
 }
 
@@ -475,22 +674,6 @@ static bool vuart_write(struct acrn_vcpu *vcpu, uint16_t offset_arg,
 	return true;
 }
 
-static void notify_target(const struct acrn_vuart *vu)
-{
-	struct acrn_vuart *t_vu;
-	uint64_t rflags;
-
-	if (vu != NULL) {
-		t_vu = vu->target_vu;
-		if ((t_vu != NULL) && !fifo_isfull(&vu->rxfifo)) {
-			obtain_vuart_lock(t_vu, rflags);
-			t_vu->thre_int_pending = true;
-			vuart_toggle_intr(t_vu);
-			release_vuart_lock(t_vu, rflags);
-		}
-	}
-}
-
 /**
  * @brief Read a register from the virtual UART.
  *
@@ -524,9 +707,11 @@ uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset)
 	t_vu = vu->target_vu;
 	obtain_vuart_lock(vu, rflags);
 	/*
-	 * Take care of the special case DLAB accesses first
+	 * Take care of the paravirtual bank and the special case DLAB accesses first
 	 */
-	if ((vu->lcr & LCR_DLAB) != 0U) {
+	if ((vu->lcr == VUART_LCR_PV_BANK) && (offset != UART16550_LCR)) {
+		reg = read_pv_reg(vu, offset);
+	} else if ((vu->lcr & LCR_DLAB) != 0U) {
 		if (offset == UART16550_DLL) {
 			reg = vu->dll;
 		} else if (offset == UART16550_DLM) {
@@ -551,6 +736,10 @@ uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset)
 			 */
 			if (intr_reason == IIR_TXRDY) {
 				vu->thre_int_pending = false;
+			} else if (intr_reason == IIR_RXRDY) {
+				vu->pv_rx_pending = false;
+			} else {
+				/* no side effect */
 			}
 			iir |= intr_reason;
 			reg = iir;
@@ -679,6 +868,9 @@ static void setup_vuart(struct acrn_vm *vm, uint16_t vuart_idx)
 	vu->ier = 0U;
 	vuart_toggle_intr(vu);
 	vu->target_vu = NULL;
+	vu->pv_ring_gfn = 0U;
+	vu->pv_ring = NULL;
+	vu->pv_rx_pending = false;
 }
 
 static struct acrn_vuart *find_active_target_vuart(const struct vuart_config *vu_config)
@@ -834,6 +1026,7 @@ void deinit_legacy_vuarts(struct acrn_vm *vm)
 		if (vm->vuart[i].port_base != INVALID_COM_BASE) {
 			vm->vuart[i].active = false;
 			vm->vuart[i].escaping = false;
+			vm->vuart[i].pv_ring = NULL;
 			if (vm->vuart[i].target_vu != NULL) {
 				vuart_deinit_connection(&vm->vuart[i]);
 			}
@@ -907,6 +1100,7 @@ void deinit_pci_vuart(struct pci_vdev *vdev)
 
 	vu->active = false;
 	vu->escaping = false;
+	vu->pv_ring = NULL;
 	if (vu->target_vu != NULL) {
 		vuart_deinit_connection(vu);
 	}
@@ -16,5 +16,7 @@ extern uint8_t		ld_trampoline_start;
 extern uint8_t		ld_trampoline_end;
 extern uint8_t		ld_ram_start;
 extern uint8_t		ld_ram_end;
+extern const uint8_t	ld_hvlog_fmt_start;
+extern const uint8_t	ld_hvlog_fmt_end;
 
 #endif /* LD_SYM_H */
@@ -139,6 +139,7 @@
 #define RFLAGS_A (1U<<4U)
 #define RFLAGS_Z (1U<<6U)
 #define RFLAGS_S (1U<<7U)
+#define RFLAGS_D (1U<<10U)
 #define RFLAGS_O (1U<<11U)
 #define RFLAGS_VM (1U<<17U)
 #define RFLAGS_AC (1U<<18U)
@@ -201,6 +202,9 @@
 
 #ifndef ASSEMBLER
 
+/* the LLC page colors a VM can be given, one bit per color in its cache_colors */
+#define MAX_LLC_COLORS		64U
+
 #define ALL_CPUS_MASK		((1UL << get_pcpu_nums()) - 1UL)
 #define AP_MASK			(ALL_CPUS_MASK & ~(1UL << BSP_CPU_ID))
 
@@ -269,7 +273,8 @@ enum cpu_reg_name {
 
 /* In trampoline range, hold the jump target which trampline will jump to */
 extern uint64_t               main_entry[1];
-extern uint64_t               secondary_cpu_stack[1];
+extern uint64_t               secondary_cpu_stacks[1];
+extern uint64_t               secondary_cpu_num[1];
 
 /*
  * To support per_cpu access, we use a special struct "per_cpu_region" to hold
@@ -416,6 +421,8 @@ struct ext_context {
 
 	struct xsave_area xs_area;
 	uint64_t xcr0;
+	/* the pCPU xs_area was last restored on, INVALID_CPU_ID once xs_area is reinitialized */
+	uint16_t xs_pcpu;
 };
 
 struct cpu_context {
@@ -543,6 +550,17 @@ static inline void asm_safe_hlt(void)
 	asm volatile ("sti; hlt; cli" : : : "cc");
 }
 
+static inline void asm_monitor(volatile const void *addr, uint64_t ecx, uint64_t edx)
+{
+	asm volatile ("monitor" : : "a" (addr), "c" (ecx), "d" (edx));
+}
+
+/* the STI shadow covers MWAIT, so an interrupt can't slip in before it */
+static inline void asm_safe_mwait(uint32_t eax, uint32_t ecx)
+{
+	asm volatile ("sti; mwait; cli" : : "a" (eax), "c" (ecx) : "cc", "memory");
+}
+
 /* Disables interrupts on the current CPU */
 #ifdef CONFIG_KEEP_IRQ_DISABLED
 #define CPU_IRQ_DISABLE_ON_CONFIG()		do { } while (0)
@@ -812,6 +830,10 @@ static inline void clac(void)
  * @post return <= MAX_PCPU_NUM
  */
 uint16_t get_pcpu_nums(void);
+/*
+ * @post return >= 1 && return <= MAX_LLC_COLORS
+ */
+uint32_t get_llc_colors(void);
 bool is_pcpu_active(uint16_t pcpu_id);
 uint64_t get_active_pcpu_bitmap(void);
 #else /* ASSEMBLER defined */
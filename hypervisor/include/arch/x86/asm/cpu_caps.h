@@ -52,6 +52,11 @@ bool is_apl_platform(void);
 bool is_apicv_advanced_feature_supported(void);
 bool pcpu_has_cap(uint32_t bit);
 bool pcpu_has_vmx_ept_vpid_cap(uint64_t bit_mask);
+bool is_pml_supported(void);
+bool is_vmx_preemption_timer_supported(void);
+bool is_vmx_tsc_scaling_supported(void);
+bool is_vmx_ins_outs_info_supported(void);
+uint32_t vmx_preemption_timer_shift(void);
 bool is_apl_platform(void);
 bool has_core_cap(uint32_t bit_mask);
 bool is_ac_enabled(void);
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef DIRTY_LOG_H
+#define DIRTY_LOG_H
+
+#include <types.h>
+#include <asm/lib/spinlock.h>
+
+/*
+ * Dirty logging of a range of guest memory by Page Modification Logging
+ *
+ * While the log is on, the range is mapped with 4K pages, EPT A/D flags are
+ * enabled, and each vCPU logs the GPAs of the pages whose EPT dirty flag it
+ * sets into its PML buffer. The buffer is drained into the bitmap of the log
+ * on every VM exit, the PML-full exits included. Getting the log clears the
+ * bits got and the dirty flags of their pages, so that they are logged again
+ * on their next write.
+ */
+struct dirty_log {
+	/* enabled, gpa, size and bitmap change under both vm->ept_lock and lock */
+	spinlock_t lock;
+	bool enabled;
+	uint64_t gpa;
+	uint64_t size;
+	/* one bit per page of the range, in the memory of the Service VM */
+	uint64_t *bitmap;
+};
+
+struct acrn_vm;
+struct acrn_vcpu;
+
+void init_dirty_log(struct acrn_vm *vm);
+
+/**
+ * @brief Start the dirty logging of [gpa, gpa + size)
+ *
+ * @param bitmap The bitmap of the log, one bit per page of the range, cleared here
+ *
+ * @return 0 on success, -ENODEV if PML isn't supported, -EINVAL otherwise.
+ */
+int32_t dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t *bitmap);
+
+/**
+ * @brief Stop the dirty logging of vm, if started
+ *
+ * No vCPU of vm writes the bitmap of the log any more on return.
+ */
+void dirty_log_stop(struct acrn_vm *vm);
+
+/**
+ * @brief Get and clear the dirty log of [gpa, gpa + size)
+ *
+ * The pages written before the call are either in the bitmap copied or, if
+ * they were written while the call ran, still dirty in the log.
+ *
+ * @param service_vm The VM whose memory bitmap_gpa is in
+ * @param bitmap_gpa Where the bits of the range are copied to
+ * @param nr_dirty The number of dirty pages copied
+ *
+ * @pre gpa is a multiple of 64 pages from the start of the log
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t dirty_log_get(struct acrn_vm *vm, uint64_t gpa, uint64_t size,
+		struct acrn_vm *service_vm, uint64_t bitmap_gpa, uint64_t *nr_dirty);
+
+/*
+ * Make each vCPU of vm handle request before it runs guest code again, a
+ * vCPU in non-root mode is made to exit
+ */
+void dirty_log_sync(struct acrn_vm *vm, uint16_t request);
+
+/*
+ * Bring the PML of vcpu in line with the dirty log of its VM, and its EPT A/D
+ * flags with the dirty log and the working set estimation, on its own pCPU
+ */
+void dirty_log_apply(struct acrn_vcpu *vcpu);
+
+/* Mark the pages logged by vcpu in the dirty log and empty its PML buffer */
+void dirty_log_drain(struct acrn_vcpu *vcpu);
+
+int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu);
+
+#endif /* DIRTY_LOG_H */
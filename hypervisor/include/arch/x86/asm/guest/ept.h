@@ -20,6 +20,15 @@ typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size);
 
 struct acrn_vm;
 
+/*
+ * Caller owned batch of EPT updates of one VM. The EPT flush of the updates
+ * made through it is requested once, by ept_batch_flush().
+ */
+struct ept_batch {
+	struct acrn_vm *vm;
+	bool flush_pending;
+};
+
 /* External Interfaces */
 /**
  * @brief Check if the GPA range is guest valid GPA or not
@@ -113,6 +122,59 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
+/**
+ * @brief Start a batch of EPT updates on a VM
+ *
+ * @param[out] batch the batch owned by the caller
+ * @param[in] vm the pointer that points to VM data structure
+ */
+void ept_batch_init(struct ept_batch *batch, struct acrn_vm *vm);
+/**
+ * @brief Request the EPT flush of the updates made through the batch, if any
+ *
+ * The batch is empty again afterwards.
+ *
+ * @param[inout] batch the batch owned by the caller
+ */
+void ept_batch_flush(struct ept_batch *batch);
+/**
+ * @brief ept_add_mr() deferring the EPT flush to ept_batch_flush()
+ *
+ * With a NULL batch, the EPT flush is requested right away as ept_add_mr() does.
+ *
+ * @pre batch == NULL || batch->vm == vm
+ */
+void ept_add_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
+		uint64_t gpa, uint64_t size, uint64_t prot_orig, struct ept_batch *batch);
+/**
+ * @brief ept_modify_mr() deferring the EPT flush to ept_batch_flush()
+ *
+ * With a NULL batch, the EPT flush is requested right away as ept_modify_mr() does.
+ *
+ * @pre batch == NULL || batch->vm == vm
+ */
+void ept_modify_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+		uint64_t size, uint64_t prot_set, uint64_t prot_clr, struct ept_batch *batch);
+/**
+ * @brief ept_del_mr() deferring the EPT flush to ept_batch_flush()
+ *
+ * With a NULL batch, the EPT flush is requested right away as ept_del_mr() does.
+ *
+ * @pre batch == NULL || batch->vm == vm
+ * @pre [gpa,gpa+size) has been mapped into host physical memory region
+ */
+void ept_del_mr_batch(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+		uint64_t size, struct ept_batch *batch);
+
+/**
+ * @brief Invalidate the EPT caches of the current pCPU for the vCPU, on its EPT flush request
+ *
+ * The EPT table pages retired by the coalescing are freed once all the vCPUs did it.
+ *
+ * @param[in] vcpu the vCPU running on the current pCPU
+ */
+void ept_flush_vcpu(struct acrn_vcpu *vcpu);
+
 /**
  * @brief Flush address space from the page entry
  *
@@ -142,6 +204,23 @@ void *get_eptp(struct acrn_vm *vm);
  */
 void walk_ept_table(struct acrn_vm *vm, pge_handler cb);
 
+/* EPT leaf sizes counted by get_ept_leaf_stat(): 4K, 2M and 1G */
+#define EPT_LEAF_4K		0U
+#define EPT_LEAF_2M		1U
+#define EPT_LEAF_1G		2U
+#define EPT_LEAF_SIZES		3U
+
+/**
+ * @brief Count the leaves of each size in the normal world EPT of a VM
+ *
+ * Unlike walk_ept_table(), it never reschedules, so it may be called from
+ * the debug shell.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[out] nr_leaves the number of leaves, indexed by EPT_LEAF_4K/2M/1G
+ */
+void get_ept_leaf_stat(struct acrn_vm *vm, uint64_t nr_leaves[EPT_LEAF_SIZES]);
+
 /**
  * @brief EPT misconfiguration handling
  *
@@ -30,6 +30,7 @@ enum vm_paging_mode {
  * VM related APIs
  */
 int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa, uint32_t *err_code);
+void invalidate_gva_cache(struct acrn_vm *vm);
 
 enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu);
 
@@ -8,6 +8,7 @@
 #define HYPERV_H
 
 #include <asm/guest/vcpuid.h>
+#include <timer.h>
 
 /* Hyper-V MSR numbers */
 #define HV_X64_MSR_GUEST_OS_ID		0x40000000U
@@ -19,6 +20,33 @@
 #define HV_X64_MSR_TSC_FREQUENCY	0x40000022U
 #define HV_X64_MSR_APIC_FREQUENCY	0x40000023U
 
+/* Synthetic interrupt controller */
+#define HV_X64_MSR_SCONTROL		0x40000080U
+#define HV_X64_MSR_SVERSION		0x40000081U
+#define HV_X64_MSR_SIEFP		0x40000082U
+#define HV_X64_MSR_SIMP			0x40000083U
+#define HV_X64_MSR_EOM			0x40000084U
+#define HV_X64_MSR_SINT0		0x40000090U
+#define HV_X64_MSR_SINT15		0x4000009FU
+
+/* Synthetic timers, a CONFIG and a COUNT MSR each */
+#define HV_X64_MSR_STIMER0_CONFIG	0x400000B0U
+#define HV_X64_MSR_STIMER3_COUNT	0x400000B7U
+
+#define HV_SYNIC_SINT_COUNT		16U
+#define HV_SYNIC_STIMER_COUNT		4U
+
+static inline bool is_hyperv_synic_msr(uint32_t msr)
+{
+	return ((msr >= HV_X64_MSR_SCONTROL) && (msr <= HV_X64_MSR_EOM)) ||
+		((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15));
+}
+
+static inline bool is_hyperv_stimer_msr(uint32_t msr)
+{
+	return (msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT);
+}
+
 union hyperv_ref_tsc_page_msr {
 	uint64_t val64;
 	struct {
@@ -51,6 +79,42 @@ union hyperv_guest_os_id_msr {
 	};
 };
 
+union hyperv_stimer_config {
+	uint64_t val64;
+	struct {
+		uint64_t enabled:1;
+		uint64_t periodic:1;
+		uint64_t lazy:1;
+		uint64_t auto_enable:1;
+		uint64_t apic_vector:8;
+		uint64_t direct_mode:1;
+		uint64_t rsvdz1:3;
+		uint64_t sintx:4;
+		uint64_t rsvdz2:44;
+	};
+};
+
+struct hyperv_stimer {
+	struct hv_timer timer;
+	struct acrn_vcpu *vcpu;
+	uint32_t index;
+	union hyperv_stimer_config config;
+	uint64_t count;		/* the expiration time or the period, in 100ns units */
+	uint64_t exp_time;	/* reference time of the next expiration */
+	bool msg_pending;	/* the expiration message waits for a free SIMP slot */
+	bool restart;		/* the timer was stopped by a migration of the vCPU */
+};
+
+/* Per vCPU SynIC and synthetic timers */
+struct acrn_hyperv_vcpu {
+	uint64_t scontrol;
+	uint64_t siefp;
+	uint64_t simp;
+	void *simp_page;	/* HVA of the SIMP, NULL if disabled */
+	uint64_t sint[HV_SYNIC_SINT_COUNT];
+	struct hyperv_stimer stimer[HV_SYNIC_STIMER_COUNT];
+};
+
 struct acrn_hyperv {
 	union hyperv_hypercall_msr	hypercall_page;
 	union hyperv_guest_os_id_msr	guest_os_id;
@@ -65,4 +129,11 @@ void hyperv_init_time(struct acrn_vm *vm);
 void hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 	struct vcpuid_entry *entry);
 void hyperv_page_destory(struct acrn_vm *vm);
+void hyperv_init_vcpu(struct acrn_vcpu *vcpu);
+void hyperv_reset_vcpu(struct acrn_vcpu *vcpu);
+/* stop the synthetic timers of a vcpu leaving its pCPU, restarted on the next one */
+void hyperv_stimer_migrate_out(struct acrn_vcpu *vcpu);
+void hyperv_stimer_migrate_in(struct acrn_vcpu *vcpu);
+bool is_hyperv_hypercall(const struct acrn_vcpu *vcpu);
+void hyperv_hypercall(struct acrn_vcpu *vcpu);
 #endif
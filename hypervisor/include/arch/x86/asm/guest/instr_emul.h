@@ -90,8 +90,31 @@ struct instr_emul_ctxt {
 	struct instr_emul_vie vie;
 };
 
+/* Must be a power of 2 */
+#define VIE_CACHE_ENTRIES	16U
+
+/*
+ * A decoded instruction of a vCPU, only used by the pCPU running the vCPU.
+ * The decode only depends on the instruction bytes, the CPU mode and the CS
+ * attributes: a hit needs the bytes fetched at RIP to match the cached ones.
+ */
+struct instr_emul_cache_entry {
+	uint64_t rip_gla;
+	uint32_t csar;
+	uint8_t cpu_mode;
+	bool valid;
+	struct instr_emul_vie vie;	/* state right after local decode, with the instruction bytes */
+};
+
+struct instr_emul_cache {
+	struct instr_emul_cache_entry entries[VIE_CACHE_ENTRIES];
+	uint64_t hits;
+	uint64_t misses;
+};
+
 int32_t emulate_instruction(struct acrn_vcpu *vcpu);
 int32_t decode_instruction(struct acrn_vcpu *vcpu, bool full_decode);
+bool vie_rep_next(struct acrn_vcpu *vcpu, uint64_t *gpa);
 bool is_current_opcode_xchg(struct acrn_vcpu *vcpu);
 
 #endif
@@ -7,8 +7,55 @@
 #ifndef SPLITLOCK_H_
 #define SPLITLOCK_H_
 
+#include <types.h>
+#include <asm/lib/spinlock.h>
+
+/* The locked instructions a VM may have emulated or bus-locked per second, and in a burst */
+#define LOCK_INSTR_RATE		1000U
+#define LOCK_INSTR_BURST	100U
+#define LOCK_INSTR_NR_RIPS	8U
+
+struct lock_instr_rip {
+	uint64_t rip;
+	uint64_t count;
+};
+
+/*
+ * Split-lock/UC-lock accounting and rate limiting of a VM
+ *
+ * Each emulation of a locked instruction and each bus lock VM exit takes a
+ * token of a bucket kept like ptirq_rate_limit: tat is when the bucket would be
+ * full again. A vCPU finding it empty is held out of non-root mode until its
+ * token is due, leaving its pCPU to the other threads, instead of stopping
+ * all of its siblings once more right away.
+ */
+struct lock_instr_stat {
+	spinlock_t lock;
+	uint64_t interval;	/* TSC ticks to refill one token, 0 disables the limiter */
+	uint64_t tolerance;	/* (burst - 1) * interval */
+	uint64_t tat;		/* theoretical arrival time of the next locked instruction */
+	uint64_t emulated;	/* locked instructions emulated on #AC/#GP */
+	uint64_t bus_locks;	/* bus locks reported by VM exits */
+	uint64_t throttled;	/* locked instructions the vCPU was held back for */
+	uint64_t throttled_ticks;
+	/* the guest RIPs taking the most tokens, the least hit one is replaced by a new one */
+	struct lock_instr_rip rips[LOCK_INSTR_NR_RIPS];
+};
+
+struct acrn_vm;
+struct acrn_vcpu;
+
+void init_lock_instr_stat(struct acrn_vm *vm);
 void vcpu_kick_lock_instr_emulation(struct acrn_vcpu *cur_vcpu);
 void vcpu_complete_lock_instr_emulation(struct acrn_vcpu *cur_vcpu);
 int32_t emulate_lock_instr(struct acrn_vcpu *vcpu, uint32_t exception_vector, bool *queue_exception);
 
+/* Account a bus lock of vcpu reported by a VM exit, the instruction has completed */
+void lock_instr_bus_lock(struct acrn_vcpu *vcpu);
+
+/* Hold vcpu on its pCPU, yielding it, until the token of its last locked instruction is due */
+void lock_instr_throttle(struct acrn_vcpu *vcpu);
+
+int32_t bus_lock_vmexit_handler(struct acrn_vcpu *vcpu);
+
 #endif /* SPLITLOCK_H_ */
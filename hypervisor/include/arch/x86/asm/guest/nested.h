@@ -335,7 +335,7 @@ struct acrn_vvmcs {
 	uint64_t vmcs12_gpa;            /* The corresponding L1 GPA for this VMCS12 */
 	uint32_t ref_cnt;		/* Count of being VMPTRLDed without VMCLEARed */
 	bool host_state_dirty;		/* To indicate need to merge VMCS12 host-state fields to VMCS01 */
-	bool control_fields_dirty;	/* For all other non-host-state fields that need to be merged */
+	uint32_t control_fields_dirty;	/* The other fields to merge to VMCS02, a VMCS12_*_DIRTY mask */
 } __aligned(PAGE_SIZE);
 
 #define MAX_ACTIVE_VVMCS_NUM	4
@@ -23,5 +23,7 @@ int is_tee_vm(struct acrn_vm *vm);
 int is_ree_vm(struct acrn_vm *vm);
 void prepare_tee_vm_memmap(struct acrn_vm *vm, const struct acrn_vm_config *vm_config);
 void handle_x86_tee_int(struct ptirq_remapping_info *entry, uint16_t pcpu_id);
+void handle_x86_tee_posted_int(struct acrn_vcpu *tee_vcpu, uint16_t pcpu_id);
+void tee_vcpu_switch_in(struct acrn_vcpu *tee_vcpu);
 
 #endif /* TEE_H_ */
@@ -30,6 +30,9 @@
 #include <asm/guest/nested.h>
 #include <asm/vmx.h>
 #include <asm/vm_config.h>
+#ifdef CONFIG_HYPERV_ENABLED
+#include <asm/guest/hyperv.h>
+#endif
 
 /**
  * @brief vcpu
@@ -107,6 +110,12 @@
 
 #define ACRN_REQUEST_SMP_CALL			11U
 
+/**
+ * @brief Request for the PML and the EPT A/D flags of the vCPU to follow the
+ * dirty log and the working set estimation of its VM
+ */
+#define ACRN_REQUEST_DIRTY_LOG			12U
+
 /**
  * @}
  */
@@ -240,6 +249,9 @@ struct acrn_vcpu_arch {
 	/* MSR bitmap region for this vcpu, MUST be 4-Kbyte aligned */
 	uint8_t msr_bitmap[PAGE_SIZE];
 
+	/* page-modification log of this vcpu, MUST be 4-Kbyte aligned */
+	uint64_t pml_buf[VMX_PML_ENTRY_NUM];
+
 	/* per vcpu lapic */
 	struct acrn_vlapic vlapic;
 
@@ -269,7 +281,9 @@ struct acrn_vcpu_arch {
 	bool lapic_pt_enabled;
 	bool irq_window_enabled;
 	bool emulating_lock;
+	bool lock_instr_token;	/* a token is taken for the locked instruction retried */
 	bool xsave_enabled;
+	bool pml_enabled;	/* PML and EPT A/D flags are on in the VMCS */
 
 	/* VCPU context state information */
 	uint32_t exit_reason;
@@ -277,6 +291,7 @@ struct acrn_vcpu_arch {
 	uint64_t exit_qualification;
 	uint32_t proc_vm_exec_ctrls;
 	uint32_t inst_len;
+	uint64_t lock_instr_deadline;	/* the vCPU isn't entered before, 0 if it isn't throttled */
 
 	/* Information related to secondary / AP VCPU start-up */
 	enum vm_cpu_mode cpu_mode;
@@ -294,6 +309,15 @@ struct acrn_vcpu_arch {
 	/* Keylocker */
 	struct iwkey IWKey;
 	bool cr4_kl_enabled;
+
+	/* CR4 bits the guest owns, the complement of the VMCS CR4 guest/host mask */
+	uint64_t cr4_passthru_mask;
+
+	/* sanitized IA32_HWP_REQUEST written by a vHWP guest, 0 for the perf_policy of the VM */
+	uint64_t hwp_request;
+
+	/* VMX TSC multiplier, 48-bit fixed point, 0 when the guest TSC runs at the host rate */
+	uint64_t tsc_multiplier;
 	/*
 	 * Keylocker spec 4.4:
 	 * Bit 0 - Status of most recent copy to or from IWKeyBackup.
@@ -302,6 +326,150 @@ struct acrn_vcpu_arch {
 	uint64_t iwkey_copy_status;
 } __aligned(PAGE_SIZE);
 
+#define IOREQ_LAT_HIST_BUCKETS	16U
+
+/* I/O request completion latency, only updated by the pCPU running the vCPU */
+struct vcpu_ioreq_stat {
+	uint64_t lat_avg;	/* running average of completion latency in TSC ticks */
+	uint64_t spin_hits;	/* hybrid mode requests completed while spinning */
+	uint64_t spin_misses;	/* hybrid mode requests that had to sleep */
+	/* bucket 0 counts latencies below 1us, bucket n counts [2^(n-1), 2^n) us */
+	uint64_t hist[IOREQ_LAT_HIST_BUCKETS];
+};
+
+/* IPIs sent by the vCPU through the x2APIC ICR, only updated by the pCPU running the vCPU */
+struct vcpu_ipi_stat {
+	uint64_t count;		/* ICR writes of fixed IPIs posted by the fast path */
+	uint64_t cycles;	/* TSC cycles spent in the fast path */
+	uint64_t targets;	/* vCPUs the IPIs were posted to */
+	uint64_t notified;	/* of which notified on the pCPU running them */
+	uint64_t not_running;	/* of which not running, left to their next VM entry */
+};
+
+/*
+ * GVA to GPA translations of 4-level paging, only used by the pCPU running the
+ * vCPU. A hit reads the paging structure entries of the walk again through
+ * their cached host pointers, which stay valid until the EPT of the VM changes.
+ */
+#define GVA_CACHE_ENTRIES	16U
+#define GVA_WALK_LEVELS		4U
+
+struct gva_cache_entry {
+	uint64_t cr3;		/* guest CR3 with its PCID */
+	uint64_t gva_page;
+	uint64_t gpa_page;
+	uint64_t *entry[GVA_WALK_LEVELS];	/* paging structure entries of the walk */
+	uint64_t value[GVA_WALK_LEVELS];	/* and their values */
+	uint32_t levels;
+	uint32_t walk_key;	/* access type and paging controls the walk checked */
+	uint32_t gen;		/* gva_cache_gen of the VM when cached */
+	bool valid;
+};
+
+struct vcpu_gva_cache {
+	struct gva_cache_entry entries[GVA_CACHE_ENTRIES];
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/* MOV to CR0/CR4 exits per changed bit, only updated by the pCPU running the vCPU */
+struct vcpu_cr_stat {
+	uint32_t cr0_bits[32];
+	uint32_t cr4_bits[32];
+	uint32_t cr0_unchanged;	/* writes which changed no bit */
+	uint32_t cr4_unchanged;
+	uint32_t clts;
+	uint32_t lmsw;
+};
+
+/*
+ * Trusty world switches and TEE round trips of a vCPU of the normal world or of a REE VM, only
+ * updated by the pCPU running the vCPU: a call starts at the switch to the TEE and ends when it
+ * switches back to the REE.
+ */
+struct vcpu_tee_stat {
+	uint64_t switches;		/* Trusty world switches, both directions */
+	uint64_t switch_ticks;		/* spent in switch_world() */
+	uint64_t fields_skipped;	/* VMCS fields and MSRs already holding the value of the next world */
+	uint64_t calls;
+	uint64_t call_ticks;
+	uint64_t call_max_ticks;
+	uint64_t call_start;		/* 0 when no call is outstanding */
+	uint64_t switch_armed;		/* TEE vCPU: woken to enter the TEE at this TSC, 0 once running */
+	uint64_t switch_reason;		/* TEE_SWITCH_CALL or TEE_SWITCH_FIQ */
+	uint64_t fiq_posted;		/* TEE vCPU: secure interrupts posted while its REE vCPU ran */
+};
+
+/* RDMSR/WRMSR exits per MSR, only updated by the pCPU running the vCPU */
+#define MSR_EXIT_STAT_ORDER	6U
+#define MSR_EXIT_STAT_SLOTS	(1U << MSR_EXIT_STAT_ORDER)
+
+struct msr_exit_count {
+	uint32_t msr;
+	uint32_t reads;
+	uint32_t writes;
+};
+
+struct vcpu_msr_stat {
+	struct msr_exit_count slot[MSR_EXIT_STAT_SLOTS];	/* open-addressed by MSR */
+	uint64_t dropped;	/* exits of the MSRs which found the table full */
+};
+
+/*
+ * VMCS fields read several times while handling a VM exit. They are read
+ * once and cached until the next VM entry, and the values written with
+ * vcpu_vmcs_write() are only written back to the VMCS before that entry.
+ */
+enum vmcs_cache_field {
+	VMCS_CACHE_GUEST_CS_ATTR = 0U,
+	VMCS_CACHE_GUEST_CR3,
+	VMCS_CACHE_GUEST_INTR_STATE,
+	VMCS_CACHE_GUEST_PHYS_ADDR,
+	VMCS_CACHE_GUEST_LINEAR_ADDR,
+	VMCS_CACHE_EXIT_INT_INFO,
+	VMCS_CACHE_FIELD_NUM
+};
+
+struct vmcs_cache {
+	uint64_t valid;		/* bit n: value[n] holds field n */
+	uint64_t dirty;		/* bit n: value[n] is to be written back */
+	uint64_t value[VMCS_CACHE_FIELD_NUM];
+};
+
+/* Steal time of the vCPU, only updated on its switches in and out */
+struct vcpu_steal_time {
+	uint64_t run;		/* TSC cycles the vCPU ran */
+	uint64_t steal;		/* TSC cycles the vCPU was runnable but not running */
+	uint64_t msr;		/* MSR_ACRN_STEAL_TIME of the guest */
+	uint32_t version;	/* the last even version written to page */
+	struct acrn_steal_time *page;	/* in the memory of the guest, NULL if not registered */
+};
+
+/* pCPU migration state, set by the source pCPU and consumed on the destination pCPU */
+struct vcpu_migration {
+	bool rebind;		/* pCPU specific state is set up when switched in */
+	bool relaunch;		/* VMCS was cleared on the source pCPU, enter it with VMLAUNCH */
+	bool restart_vtimer;	/* vLAPIC timer was stopped on the source pCPU */
+	uint64_t count;		/* number of migrations */
+};
+
+/* The state set by HC_RESTORE_VCPU_STATE out of the contexts and the vLAPIC, see load_vcpu_state() */
+struct vcpu_restore {
+	bool pending;		/* loaded into the VMCS by init_vmcs() */
+	uint32_t interruptibility;
+	uint64_t tsc;		/* the guest TSC when the VM was paused */
+	uint64_t apicbase;
+	uint64_t tsc_deadline;
+};
+
+/* Adaptive halt polling state, only accessed by the pCPU running the vCPU */
+struct vcpu_halt_poll {
+	uint64_t window;	/* current poll window in TSC ticks */
+	uint64_t max_window;	/* upper bound of the window, from halt_poll_us of the VM config */
+	uint64_t success;	/* HLT exits resolved by polling */
+	uint64_t fail;		/* polls that timed out and had to wait for the event */
+};
+
 struct acrn_vm;
 struct acrn_vcpu {
 	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
@@ -317,10 +485,37 @@ struct acrn_vcpu {
 	bool launched; /* Whether the vcpu is launched on target pcpu */
 
 	struct instr_emul_ctxt inst_ctxt;
+	struct instr_emul_cache inst_cache;
 	struct io_request req; /* used by io/ept emulation */
+	uint16_t mmio_hint;	/* emul_mmio index of the last matched MMIO handler */
+	uint64_t mmio_hint_hits;
+	uint64_t mmio_hint_misses;
+
+	/* VM exit cost per basic exit reason, only updated by the pCPU running this vCPU */
+	struct acrn_vmexit_stat exit_stat[ACRN_VMEXIT_REASON_MAX];
+
+	struct vcpu_halt_poll halt_poll;
+	struct vcpu_ioreq_stat ioreq_stat;
+	struct vcpu_ipi_stat ipi_stat;
+	struct vcpu_msr_stat msr_stat;
+	struct vcpu_cr_stat cr_stat;
+	struct vcpu_tee_stat tee_stat;
+	struct vcpu_gva_cache gva_cache;
+	uint64_t intr_accepted;	/* interrupts accepted by the vLAPIC, atomically as any pCPU may raise them */
+	uint64_t directed_yield_hits;	/* PAUSE-loop exits that prioritized a preempted sibling vCPU */
+	uint64_t directed_yield_misses;	/* PAUSE-loop exits that found no candidate */
+	struct vcpu_migration migration;
+	struct vcpu_restore restore;
+	/* registered by HC_PV_SET_VCPU_STATE, in the memory of the guest */
+	struct acrn_pv_vcpu_state *pv_state;
+	struct vcpu_steal_time steal_time;
+#ifdef CONFIG_HYPERV_ENABLED
+	struct acrn_hyperv_vcpu hyperv;
+#endif
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
+	struct vmcs_cache vmcs_cache;
 
 	struct sched_event events[VCPU_EVENT_NUM];
 } __aligned(PAGE_SIZE);
@@ -353,6 +548,27 @@ static inline void vcpu_retain_rip(struct acrn_vcpu *vcpu)
 	(vcpu)->arch.inst_len = 0U;
 }
 
+static inline void tee_call_start(struct acrn_vcpu *vcpu, uint64_t now)
+{
+	vcpu->tee_stat.call_start = now;
+}
+
+static inline void tee_call_done(struct acrn_vcpu *vcpu, uint64_t now)
+{
+	struct vcpu_tee_stat *stat = &vcpu->tee_stat;
+	uint64_t delta;
+
+	if (stat->call_start != 0UL) {
+		delta = now - stat->call_start;
+		stat->calls++;
+		stat->call_ticks += delta;
+		if (delta > stat->call_max_ticks) {
+			stat->call_max_ticks = delta;
+		}
+		stat->call_start = 0UL;
+	}
+}
+
 static inline struct acrn_vlapic *vcpu_vlapic(struct acrn_vcpu *vcpu)
 {
 	return &(vcpu->arch.vlapic);
@@ -403,6 +619,31 @@ uint64_t vcpu_get_gpreg(const struct acrn_vcpu *vcpu, uint32_t reg);
  */
 void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val);
 
+/**
+ * @brief read a VMCS field through the VMCS cache of the vCPU
+ *
+ * The field is read from the current VMCS on its first read after a VM
+ * exit, and from the cache after.
+ *
+ * @pre vcpu is the vCPU running on the current pCPU and its VMCS is current
+ */
+uint64_t vcpu_vmcs_read(struct acrn_vcpu *vcpu, enum vmcs_cache_field field);
+
+/**
+ * @brief write a VMCS field through the VMCS cache of the vCPU
+ *
+ * The value is written to the VMCS before the next VM entry.
+ */
+void vcpu_vmcs_write(struct acrn_vcpu *vcpu, enum vmcs_cache_field field, uint64_t val);
+
+/**
+ * @brief write back and empty the VMCS cache of the vCPU
+ *
+ * To be called before the current VMCS changes, or before the cached fields
+ * are written with exec_vmwrite().
+ */
+void vcpu_vmcs_cache_flush(struct acrn_vcpu *vcpu);
+
 /**
  * @brief get vcpu RIP value
  *
@@ -553,6 +794,11 @@ void vcpu_clear_eoi_exit_bitmap(struct acrn_vcpu *vcpu, uint32_t vector);
  */
 void set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_regs *vcpu_regs);
 
+/**
+ * @brief set the CPU mode of a vCPU from the registers it is set to
+ */
+void set_vcpu_mode(struct acrn_vcpu *vcpu, uint32_t cs_attr, uint64_t ia32_efer, uint64_t cr0);
+
 /**
  * @brief reset all the vcpu registers
  *
@@ -604,8 +850,13 @@ struct acrn_vcpu *get_running_vcpu(uint16_t pcpu_id);
 struct acrn_vcpu *get_ever_run_vcpu(uint16_t pcpu_id);
 
 void save_xsave_area(struct acrn_vcpu *vcpu, struct ext_context *ectx);
-void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *ectx);
+void rstore_xsave_area(const struct acrn_vcpu *vcpu, struct ext_context *ectx);
 void load_iwkey(struct acrn_vcpu *vcpu);
+uint64_t vcpu_hwp_request(const struct acrn_vcpu *vcpu);
+uint64_t vcpu_tsc_multiplier(const struct acrn_vcpu *vcpu);
+uint64_t vcpu_guest_tsc(const struct acrn_vcpu *vcpu, uint64_t host_tsc);
+uint64_t vcpu_host_tsc(const struct acrn_vcpu *vcpu, uint64_t guest_tsc);
+bool vcpu_tsc_is_host_tsc(const struct acrn_vcpu *vcpu);
 
 /**
  * @brief create a vcpu for the target vm
@@ -687,6 +938,39 @@ void launch_vcpu(struct acrn_vcpu *vcpu);
  */
 void kick_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief register the state of a vcpu shared with its guest
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @param[in] gpa the 64-byte aligned GPA of a struct acrn_pv_vcpu_state, 0 to unregister it
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if gpa isn't aligned or isn't mapped
+ */
+int32_t vcpu_set_pv_state(struct acrn_vcpu *vcpu, uint64_t gpa);
+
+/**
+ * @brief write MSR_ACRN_STEAL_TIME of a vcpu
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @param[in] val the 64-byte aligned GPA of a struct acrn_steal_time with
+ *		  ACRN_STEAL_TIME_ENABLE set, 0 to disable the updates
+ *
+ * @retval 0 on success
+ * @retval -EACCES if reserved bits are set or the GPA isn't mapped
+ */
+int32_t vcpu_set_steal_time_msr(struct acrn_vcpu *vcpu, uint64_t val);
+
+/**
+ * @brief pull a preempted vcpu to an idle pcpu
+ *
+ * Ask the pcpu with the most runnable vcpus to hand one of its preempted,
+ * migratable vcpus over to pcpu_id. Called by the idle thread of pcpu_id.
+ *
+ * @param[in] pcpu_id the idle pcpu
+ */
+void balance_vcpus(uint16_t pcpu_id);
+
 /**
  * @brief create a vcpu for the vm and mapped to the pcpu.
  *
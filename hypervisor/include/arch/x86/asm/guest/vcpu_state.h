@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef VCPU_STATE_H
+#define VCPU_STATE_H
+
+#include <types.h>
+
+/*
+ * Saving and restoring the state of the vCPUs of a post-launched VM
+ *
+ * The state of a vCPU of a paused VM is read out of its VMCS on its own
+ * pCPU, the only one its VMCS is active on, and out of the contexts and the
+ * vLAPIC saved when it was switched out. A vCPU of a VM not started yet is
+ * set to such a state through its contexts and vLAPIC, and the VMCS fields
+ * init_vmcs() doesn't take from the contexts get it on its first entry.
+ */
+
+struct acrn_vm;
+struct acrn_vcpu;
+
+/**
+ * @brief Copy the state of vcpu to the struct acrn_vcpu_state at gpa
+ *
+ * @param service_vm The VM whose memory gpa is in
+ *
+ * @pre vcpu->vm->state == VM_PAUSED
+ *
+ * @return 0 on success, -ENODEV if the VM doesn't support it, non-zero on other errors.
+ */
+int32_t save_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *service_vm, uint64_t gpa);
+
+/**
+ * @brief Set vcpu to the state of the struct acrn_vcpu_state at gpa
+ *
+ * A vCPU state without ACRN_VCPU_STATE_LAUNCHED leaves vcpu at its reset state.
+ *
+ * @param service_vm The VM whose memory gpa is in
+ *
+ * @pre vcpu->vm->state == VM_CREATED
+ *
+ * @return 0 on success, -ENODEV if the VM doesn't support it, non-zero on other errors.
+ */
+int32_t restore_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *service_vm, uint64_t gpa);
+
+/* Load the restored state of vcpu into its VMCS, on its own pCPU by init_vmcs() */
+void load_vcpu_state(struct acrn_vcpu *vcpu);
+
+#endif /* VCPU_STATE_H */
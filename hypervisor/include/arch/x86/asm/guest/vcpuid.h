@@ -10,8 +10,24 @@
 #define CPUID_CHECK_SUBLEAF	(1U << 0U)
 #define MAX_VM_VCPUID_ENTRIES	64U
 
+/*
+ * Direct index from leaf to the first vcpuid_entries[] slot of that leaf,
+ * kept per leaf range: basic (0x0), hypervisor (0x40000000) and extended
+ * (0x80000000). Leaves beyond VCPUID_LEAF_INDEX_NUM in a range are looked
+ * up by scanning vcpuid_entries[].
+ */
+#define VCPUID_LEAF_RANGE_NUM	3U
+#define VCPUID_LEAF_INDEX_NUM	0x40U
+#define VCPUID_INDEX_INVALID	0xFFU
+
 /* Guest capability flags reported by CPUID */
 #define GUEST_CAPS_PRIVILEGE_VM	(1U << 0U)
+/* HC_PV_SEND_IPI is available */
+#define GUEST_CAPS_PV_IPI	(1U << 1U)
+/* HC_PV_SET_VCPU_STATE is available, with ACRN_PV_VCPU_FLUSH_TLB */
+#define GUEST_CAPS_PV_TLB_FLUSH	(1U << 2U)
+/* MSR_ACRN_STEAL_TIME is available */
+#define GUEST_CAPS_STEAL_TIME	(1U << 3U)
 
 struct vcpuid_entry {
 	uint32_t eax;
@@ -13,7 +13,7 @@
  * @brief public APIs for vCR operations
  */
 uint64_t get_cr4_reserved_bits(void);
-void init_cr0_cr4_host_guest_mask(void);
+void init_cr0_cr4_host_guest_mask(struct acrn_vcpu *vcpu);
 
 /**
  * @brief vCR from vcpu
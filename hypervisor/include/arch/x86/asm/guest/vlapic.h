@@ -47,6 +47,11 @@ struct vlapic_timer {
 	uint32_t mode;
 	uint32_t tmicr;
 	uint32_t divisor_shift;
+	/*
+	 * The TSC deadline is backed by the VMX preemption timer while the vCPU
+	 * runs, timer only being added while the vCPU is switched out.
+	 */
+	bool vmx_ptimer;
 };
 
 struct acrn_vlapic {
@@ -132,6 +137,35 @@ int32_t vlapic_set_apicbase(struct acrn_vlapic *vlapic, uint64_t new);
 int32_t vlapic_x2apic_read(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val);
 int32_t vlapic_x2apic_write(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
 
+/**
+ * @brief Send a fixed IPI to the vCPUs of dmask, a bitmap of vCPU IDs
+ *
+ * The interrupt is posted to all the destinations first, with a single
+ * notification IPI, when APICv advanced features are supported.
+ *
+ * @pre vec >= 16U
+ */
+void vlapic_send_fixed_ipi_mask(struct acrn_vcpu *vcpu, uint64_t dmask, uint32_t vec);
+
+/* Fire the TSC deadline of vcpu backed by the VMX preemption timer, if passed */
+void vlapic_expire_ptimer(struct acrn_vcpu *vcpu);
+/* Program the VMX preemption timer with the TSC deadline of vcpu, right before VM entry */
+void vlapic_arm_ptimer(struct acrn_vcpu *vcpu);
+/* Move the TSC deadline to a timer while vcpu doesn't run, and back */
+void vlapic_ptimer_switch_out(struct acrn_vcpu *vcpu);
+void vlapic_ptimer_switch_in(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Send an IPI to the vCPUs of a bitmap of APIC IDs, for HC_PV_SEND_IPI
+ *
+ * @param[in] bitmap Bit n is set for APIC ID (min_apic_id + n)
+ * @param[in] icr_low The low ICR word of the IPI, a fixed IPI or a NMI
+ *
+ * @return the number of vCPUs the IPI was sent to, -EINVAL for another
+ *	   delivery mode or a vector below 16.
+ */
+int32_t vlapic_pv_send_ipi(struct acrn_vcpu *vcpu, uint64_t bitmap, uint32_t min_apic_id, uint32_t icr_low);
+
 /*
  * Signals to the LAPIC that an interrupt at 'vector' needs to be generated
  * to the 'cpu', the state is recorded in IRR.
@@ -177,6 +211,17 @@ int32_t vlapic_set_local_intr(struct acrn_vm *vm, uint16_t vcpu_id_arg, uint32_t
  */
 int32_t vlapic_inject_msi(struct acrn_vm *vm, uint64_t addr, uint64_t data);
 
+/**
+ * @brief The single vCPU a MSI is delivered to, NULL if it may have several.
+ *
+ * Set for a fixed MSI to a physical APIC ID only, for the caller to cache it
+ * with the MSI and post the next ones to it by vlapic_post_msi().
+ *
+ * @pre vm != NULL
+ */
+struct acrn_vcpu *vlapic_msi_dest_vcpu(struct acrn_vm *vm, uint64_t addr, uint64_t msg, uint32_t *vector);
+void vlapic_post_msi(struct acrn_vcpu *vcpu, uint32_t vector);
+
 
 void vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest,
 		bool phys, uint32_t delmode, uint32_t vec, bool rh);
@@ -197,6 +242,7 @@ void vlapic_free(struct acrn_vcpu *vcpu);
 
 void vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum reset_mode mode);
 void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs);
+void vlapic_load_state(struct acrn_vlapic *vlapic, uint64_t apicbase, uint64_t tsc_deadline);
 uint64_t vlapic_apicv_get_apic_access_addr(void);
 uint64_t vlapic_apicv_get_apic_page_addr(struct acrn_vlapic *vlapic);
 int32_t apic_access_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -204,6 +250,7 @@ int32_t apic_write_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t veoi_vmexit_handler(struct acrn_vcpu *vcpu);
 void vlapic_update_tpr_threshold(const struct acrn_vlapic *vlapic);
 int32_t tpr_below_threshold_vmexit_handler(struct acrn_vcpu *vcpu);
+int32_t vmx_preemption_timer_vmexit_handler(struct acrn_vcpu *vcpu);
 uint64_t vlapic_calc_dest_noshort(struct acrn_vm *vm, bool is_broadcast,
 		uint32_t dest, bool phys, bool lowprio);
 bool is_x2apic_enabled(const struct acrn_vlapic *vlapic);
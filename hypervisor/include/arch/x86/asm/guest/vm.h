@@ -22,8 +22,13 @@
 #include <asm/guest/vmx_io.h>
 #include <vuart.h>
 #include <vrtc.h>
+#include <vhpet.h>
+#include <vpit.h>
 #include <asm/guest/trusty.h>
 #include <asm/guest/vcpuid.h>
+#include <asm/guest/dirty_log.h>
+#include <asm/guest/wss.h>
+#include <asm/guest/lock_instr_emul.h>
 #include <vpci.h>
 #include <asm/cpu_caps.h>
 #include <asm/e820.h>
@@ -72,9 +77,17 @@ struct vm_sw_info {
 	/* HVA to IO shared page */
 	void *io_shared_page;
 	void *asyncio_sbuf;
+	/* asyncio sbuf elements are struct acrn_asyncio_entry instead of bare fds */
+	bool asyncio_payload;
 	void *vm_event_sbuf;
+	void *posted_io_sbuf;
+	/* the struct acrn_msi_ring of the VM, msi_ring_entries and msi_ring_cons kept out of the DM's reach */
+	void *msi_ring;
+	uint32_t msi_ring_entries;
+	uint32_t msi_ring_cons;
 	/* If enable IO completion polling mode */
 	bool is_polling_ioreq;
+	bool is_hybrid_ioreq;	/* spin for an adaptive budget, then sleep on IO completion */
 };
 
 struct vm_pm_info {
@@ -113,6 +126,20 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct pgtable ept_pgtable;
+	/*
+	 * EPT table pages unlinked by the coalescing, protected by vm->ept_lock: the first
+	 * ept_retired_flushing ones are freed once the vCPUs in ept_flush_vcpus invalidated their EPT caches.
+	 */
+	struct pgtable_retired ept_retired;
+	uint32_t ept_retired_flushing;
+	uint64_t ept_flush_vcpus;
+	struct dirty_log dirty_log;
+	struct vm_wss wss;
+	struct vm_mtrr_ept mtrr_ept;
+	/* the host TSC the guest TSCs of the vCPU states are taken at, on pause and on start */
+	uint64_t state_tsc;
+	/* the rate of the guest TSCs in kHz when restored from another TSC rate, 0 at the host rate */
+	uint32_t tsc_khz;
 
 	struct acrn_vioapics vioapics;	/* Virtual IOAPIC/s */
 	struct acrn_vpic vpic;      /* Virtual PIC */
@@ -135,6 +162,18 @@ struct vm_arch {
 
 } __aligned(PAGE_SIZE);
 
+/*
+ * Token bucket limiting the passthrough interrupt injection rate of a User VM,
+ * kept in its virtual scheduling form: tat is when the bucket would be full
+ * again, an interrupt conforms if it arrives no earlier than tat - tolerance.
+ */
+struct ptirq_rate_limit {
+	spinlock_t lock;
+	uint64_t interval;	/* TSC ticks to refill one token, 0 disables the limiter */
+	uint64_t tolerance;	/* (burst - 1) * interval */
+	uint64_t tat;		/* theoretical arrival time of the next interrupt */
+};
+
 struct acrn_vm {
 	struct vm_arch arch_vm; /* Reference to this VM's arch information */
 	struct vm_hw_info hw;	/* Reference to this VM's HW information */
@@ -149,6 +188,9 @@ struct acrn_vm {
 	struct list_head aiodesc_queue;
 	spinlock_t asyncio_lock; /* Spin-lock used to protect asyncio add/remove for a VM */
 	spinlock_t vm_event_lock;
+	struct acrn_posted_io_range posted_io_range[ACRN_POSTED_IO_RANGE_MAX];
+	spinlock_t posted_io_lock; /* Spin-lock used to protect posted ranges and the posted I/O sbuf */
+	spinlock_t msi_ring_lock; /* Spin-lock used to protect the MSI ring and its consumer index */
 
 	enum vpic_wire_mode wire_mode;
 	struct iommu_domain *iommu;	/* iommu domain of this VM */
@@ -162,8 +204,16 @@ struct acrn_vm {
 	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
 	uint16_t nr_emul_mmio_regions;	/* the emulated mmio_region number */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* indexes of the registered emul_mmio nodes, sorted by range_start and rebuilt on (un)register */
+	uint16_t emul_mmio_index[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	uint16_t nr_emul_mmio_index;
+	uint32_t gva_cache_gen;		/* bumped on EPT changes, invalidates the vCPU GVA caches */
+	uint16_t last_boosted_vcpu;	/* directed yield candidates are scanned from the next vCPU */
+	struct sched_gang sched_gang;	/* co-scheduling state of the vCPUs */
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	/* emul_pio index + 1 of the handler of each port below EMUL_PIO_MAP_PORTS, 0 if none, rebuilt on register */
+	uint8_t emul_pio_map[EMUL_PIO_MAP_PORTS];
 
 	char name[MAX_VM_NAME_LEN];
 	struct secure_world_control sworld_control;
@@ -177,10 +227,16 @@ struct acrn_vm {
 
 	uint32_t vcpuid_entry_nr, vcpuid_level, vcpuid_xlevel;
 	struct vcpuid_entry vcpuid_entries[MAX_VM_VCPUID_ENTRIES];
+	uint8_t vcpuid_index[VCPUID_LEAF_RANGE_NUM][VCPUID_LEAF_INDEX_NUM];
 	struct acrn_vpci vpci;
 	struct acrn_vrtc vrtc;
+	struct acrn_vhpet vhpet;
+	struct acrn_vpit vpit;
 
-	uint64_t intr_inject_delay_delta; /* delay of intr injection */
+	struct ptirq_rate_limit ptirq_rate_limit;	/* passthrough interrupt injection limiter */
+	uint64_t ptirq_msi_remaps;	/* MSI/MSI-X vectors of passthrough devices remapped */
+	uint64_t ptirq_intx_remaps;	/* INTx pins of passthrough devices remapped */
+	struct lock_instr_stat lock_instr_stat;	/* split-lock/UC-lock limiter and counters */
 	uint32_t reset_control;
 } __aligned(PAGE_SIZE);
 
@@ -249,6 +305,8 @@ void start_vm(struct acrn_vm *vm);
 int32_t reset_vm(struct acrn_vm *vm, enum reset_mode mode);
 int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *vm_config, struct acrn_vm **rtn_vm);
 int32_t prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config);
+int32_t vm_add_vcpu(struct acrn_vm *vm, uint16_t pcpu_id, struct acrn_vcpu **rtn_vcpu);
+int32_t vm_remove_vcpu(struct acrn_vm *vm, uint16_t pcpu_id);
 void launch_vms(uint16_t pcpu_id);
 bool is_poweroff_vm(const struct acrn_vm *vm);
 bool is_created_vm(const struct acrn_vm *vm);
@@ -266,15 +324,31 @@ void prepare_vm_identical_memmap(struct acrn_vm *vm, uint16_t e820_entry_type, u
 uint64_t find_space_from_ve820(struct acrn_vm *vm, uint32_t size, uint64_t min_addr, uint64_t max_addr);
 
 int32_t prepare_os_image(struct acrn_vm *vm);
+/* On a pCPU of vm_id but its BSP, copy chunks of its guest images until finish_load_vm() */
+void help_load_vm(uint16_t vm_id);
+void finish_load_vm(uint16_t vm_id);
 
 void suspend_vrtc(void);
 void resume_vrtc(void);
 void vrtc_init(struct acrn_vm *vm);
+void vhpet_init(struct acrn_vm *vm, uint16_t pcpu_id);
+void vhpet_reset(struct acrn_vm *vm);
+void vhpet_deinit(struct acrn_vm *vm);
+void vpit_init(struct acrn_vm *vm, uint16_t pcpu_id);
+void vpit_reset(struct acrn_vm *vm);
+void vpit_deinit(struct acrn_vm *vm);
 
 bool is_lapic_pt_configured(const struct acrn_vm *vm);
 bool is_pmu_pt_configured(const struct acrn_vm *vm);
 bool is_rt_vm(const struct acrn_vm *vm);
 bool is_stateful_vm(const struct acrn_vm *vm);
+bool is_vcpu_migration_configured(const struct acrn_vm *vm);
+bool is_pv_ipi_configured(const struct acrn_vm *vm);
+bool is_vmx_preempt_timer_configured(const struct acrn_vm *vm);
+bool is_mwait_pt_configured(const struct acrn_vm *vm);
+uint32_t vm_tsc_khz(const struct acrn_vm *vm);
+bool is_vhpet_configured(const struct acrn_vm *vm);
+bool is_vpit_configured(const struct acrn_vm *vm);
 bool is_nvmx_configured(const struct acrn_vm *vm);
 bool is_vcat_configured(const struct acrn_vm *vm);
 bool is_static_configured_vm(const struct acrn_vm *vm);
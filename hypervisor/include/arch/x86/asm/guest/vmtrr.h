@@ -9,6 +9,9 @@
  */
 #ifndef VMTRR_H
 #define VMTRR_H
+
+#include <asm/lib/spinlock.h>
+
 /**
  * @brief MTRR Virtualization
  *
@@ -17,6 +20,9 @@
  */
 #define FIXED_RANGE_MTRR_NUM	11U
 #define MTRR_SUB_RANGE_NUM	8U
+#define FIXED_SUB_RANGE_NUM	(FIXED_RANGE_MTRR_NUM * MTRR_SUB_RANGE_NUM)
+/* memory type of a sub-range not applied to the EPT yet */
+#define MTRR_EPT_TYPE_UNKNOWN	0xFFU
 
 union mtrr_cap_reg {
 	uint64_t value;
@@ -51,6 +57,13 @@ struct acrn_vmtrr {
 	union mtrr_cap_reg		cap;
 	union mtrr_def_type_reg		def_type;
 	union mtrr_fixed_range_reg	fixed_range[FIXED_RANGE_MTRR_NUM];
+	bool				ept_stale;	/* written since last applied to the EPT */
+};
+
+/* memory types the EPT of a VM holds for the fixed-range sub-ranges */
+struct vm_mtrr_ept {
+	spinlock_t	lock;
+	uint8_t		type[FIXED_SUB_RANGE_NUM];
 };
 
 struct acrn_vcpu;
@@ -71,6 +84,15 @@ void write_vmtrr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t value);
  * @return The specified virtual MTRR MSR value
  */
 uint64_t read_vmtrr(const struct acrn_vcpu *vcpu, uint32_t msr);
+/**
+ * @brief Apply the virtual MTRRs written since last time to the EPT
+ *
+ * Only the sub-ranges whose memory type differs from what the EPT holds are
+ * updated, so the same MTRR values written by the other vCPUs cost nothing.
+ *
+ * @param[in] vcpu The pointer that points VCPU data structure
+ */
+void apply_vmtrr(struct acrn_vcpu *vcpu);
 /**
  * @brief Virtual MTRR initialization
  *
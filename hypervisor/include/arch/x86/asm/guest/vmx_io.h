@@ -27,7 +27,14 @@
 #define CF9_PIO_IDX			(KB_PIO_IDX + 1U)
 #define PIO_RESET_REG_IDX		(CF9_PIO_IDX + 1U)
 #define SLEEP_CTL_PIO_IDX		(PIO_RESET_REG_IDX + 1U)
-#define EMUL_PIO_IDX_MAX		(SLEEP_CTL_PIO_IDX + 1U)
+#define PIT_PIO_IDX			(SLEEP_CTL_PIO_IDX + 1U)
+#define NMISC_PIO_IDX			(PIT_PIO_IDX + 1U)
+#define EMUL_PIO_IDX_MAX		(NMISC_PIO_IDX + 1U)
+
+/* Ports up to 0xfff, which the legacy devices, the UARTs and the PCI configuration ports sit in, map directly to
+ * their handlers; the handlers of the ports above are scanned.
+ */
+#define EMUL_PIO_MAP_PORTS		0x1000U
 /**
  * @brief The handler of VM exits on I/O instructions
  *
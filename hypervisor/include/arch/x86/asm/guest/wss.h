@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef WSS_H
+#define WSS_H
+
+#include <types.h>
+#include <acrn_hv_defs.h>
+
+/*
+ * Working set estimation of a VM from the EPT accessed flags
+ *
+ * While it is on, EPT A/D flags are enabled and each scan walks the EPT of
+ * the VM: a leaf whose accessed flag is set was accessed since the previous
+ * scan, the flag is cleared and the age of the leaf, the number of scans it
+ * has not been accessed for, kept in ignored bits of the entry, is reset.
+ * The histogram of the ages gives the memory accessed over several windows.
+ *
+ * The scans run in the context of the Service VM hypercall asking for them,
+ * never on the pCPUs of the VM, and not more often than the interval given
+ * at the start.
+ */
+struct vm_wss {
+	bool enabled;
+	/* 1 while a scan runs, the others are refused */
+	uint32_t scanning;
+	uint32_t min_interval_ms;
+	uint64_t last_scan_tsc;
+	uint64_t last_interval_us;
+	uint64_t nr_scans;
+	/* bytes of memory by age, as of the last scan */
+	uint64_t idle_bytes[ACRN_WSS_AGES];
+};
+
+struct acrn_vm;
+
+void init_wss(struct acrn_vm *vm);
+
+/**
+ * @brief Start the working set estimation of vm
+ *
+ * @param min_interval_ms The shortest time between two scans
+ *
+ * @return 0 on success, -ENODEV without EPT A/D flags, -EINVAL otherwise.
+ */
+int32_t wss_start(struct acrn_vm *vm, uint32_t min_interval_ms);
+
+/**
+ * @brief Stop the working set estimation of vm, if started
+ *
+ * The accessed flags and the ages of the EPT entries are cleared.
+ */
+void wss_stop(struct acrn_vm *vm);
+
+/**
+ * @brief Scan the EPT of vm if the interval is over, and get the estimation
+ *
+ * @return 0 on success, -EBUSY if another scan runs, -EINVAL if not started.
+ */
+int32_t wss_scan(struct acrn_vm *vm, struct acrn_wss *wss);
+
+#endif /* WSS_H */
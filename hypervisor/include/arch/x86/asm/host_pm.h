@@ -44,5 +44,8 @@ struct acpi_reset_reg *get_host_reset_reg_data(void);
 void reset_host(bool warm);
 void init_frequency_policy(void);
 void apply_frequency_policy(void);
+uint64_t get_vm_hwp_request(uint16_t pcpu_id, uint8_t perf_policy);
+uint64_t sanitize_hwp_request(uint16_t pcpu_id, uint64_t req);
+void load_hwp_request(uint64_t req);
 
 #endif	/* HOST_PM_H */
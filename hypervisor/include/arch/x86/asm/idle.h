@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <asm/cpu_caps.h>
+
+/* HLT, then the MWAIT C-states of _CST from the shallowest to the deepest */
+#define MAX_IDLE_STATES		(MAX_CX_ENTRY + 1U)
+
+/* no wakeup latency constraint on the pCPU */
+#define IDLE_LATENCY_ANY	0xFFFFFFFFU
+
+struct idle_state {
+	char name[8];
+	bool mwait;
+	uint32_t hint;			/* MWAIT EAX */
+	uint32_t latency_us;		/* worst case exit latency, from _CST */
+	uint32_t residency_us;		/* shortest idle time the state pays off for */
+};
+
+struct idle_stat {
+	uint64_t usage;
+	uint64_t residency;		/* TSC cycles spent in the state */
+	uint64_t below_target;		/* woke up before residency_us */
+	uint64_t timer_wakes;		/* woke up at or after the next timer deadline */
+	uint64_t wake_latency;		/* TSC cycles from the timer deadline to the exit, summed */
+	uint64_t max_wake_latency;
+};
+
+struct pcpu_idle {
+	uint32_t max_latency_us;	/* deepest exit latency allowed on the pCPU */
+	struct idle_stat stat[MAX_IDLE_STATES];
+};
+
+void init_idle_states(void);
+uint32_t get_idle_states(const struct idle_state **states);
+void set_idle_latency_limit(uint16_t pcpu_id, uint32_t max_latency_us);
+void enter_idle_state(uint16_t pcpu_id);
+
+#endif /* IDLE_H */
@@ -104,6 +104,17 @@ void send_startup_ipi(uint16_t dest_pcpu_id, uint64_t cpu_startup_start_address)
  */
 void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector);
 
+/**
+ * @brief Send an IPI to multiple pCPUs, with one ICR write per x2APIC cluster
+ *
+ * The pCPUs of a cluster are all addressed by their logical IDs in a single
+ * write, instead of one write per pCPU.
+ *
+ * @param[in]	dest_mask The mask of destination physical cpus, all active
+ * @param[in]	vector The vector of interrupt
+ */
+void send_dest_ipi_mask_logical(uint64_t dest_mask, uint32_t vector);
+
 /**
  * @brief Send an IPI to a single pCPU
  *
@@ -594,10 +594,13 @@
 #define MSR_IA32_XSS_HDC			(1UL << 13U)
 
 /* Miscellaneous data */
+#define MSR_IA32_MISC_PREEMPT_TIMER_RATE	0x1FU
 #define MSR_IA32_MISC_UNRESTRICTED_GUEST	(1U<<5U)
 
 /* Width of physical address used by VMX related region */
 #define MSR_IA32_VMX_BASIC_ADDR_WIDTH		(1UL << 48U)
+/* VM-exit instruction information valid for INS/OUTS */
+#define MSR_IA32_VMX_BASIC_INS_OUTS_INFO	(1UL << 54U)
 
 /* 5 high-order bits in every field are reserved */
 #define PAT_FIELD_RSV_BITS			(0xF8UL)
@@ -624,6 +627,7 @@ struct acrn_vcpu;
 
 void init_msr_emulation(struct acrn_vcpu *vcpu);
 void init_intercepted_cat_msr_list(void);
+void init_emulated_msr_index(void);
 uint32_t vmsr_get_guest_msr_index(uint32_t msr);
 void update_msr_bitmap_x2apic_apicv(struct acrn_vcpu *vcpu);
 void update_msr_bitmap_x2apic_passthru(struct acrn_vcpu *vcpu);
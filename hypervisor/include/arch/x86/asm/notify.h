@@ -7,14 +7,35 @@
 #ifndef NOTIFY_H
 #define NOTIFY_H
 
+#include <asm/lib/spinlock.h>
+
 typedef void (*smp_call_func_t)(void *data);
-struct smp_call_info_data {
+
+/*
+ * A call of func(data) on the pCPUs of a mask. Each pCPU clears its bit of
+ * pending once func returned on it.
+ */
+struct smp_call {
 	smp_call_func_t func;
 	void *data;
+	/* asynchronous calls only: run with data on the last pCPU done with func */
+	smp_call_func_t done;
+	volatile uint64_t pending;
+};
+
+#define SMP_CALL_QUEUE_SIZE	16U
+
+/* The calls posted to a pCPU, run in order by its notification handler */
+struct smp_call_queue {
+	spinlock_t lock;
+	uint32_t head;
+	uint32_t tail;
+	struct smp_call *calls[SMP_CALL_QUEUE_SIZE];
 };
 
 struct acrn_vm;
 void smp_call_function(uint64_t mask, smp_call_func_t func, void *data);
+void smp_call_function_async(uint64_t mask, struct smp_call *call);
 
 void setup_notification(void);
 void handle_smp_call(void);
@@ -14,9 +14,11 @@
 #include <profiling.h>
 #include <logmsg.h>
 #include <schedule.h>
+#include <softirq.h>
 #include <asm/notify.h>
 #include <asm/page.h>
 #include <asm/gdt.h>
+#include <asm/idle.h>
 #include <asm/security.h>
 #include <asm/vm_config.h>
 
@@ -42,6 +44,7 @@ struct per_cpu_region {
 	struct sched_iorr_control sched_iorr_ctl;
 	struct sched_bvt_control sched_bvt_ctl;
 	struct sched_prio_control sched_prio_ctl;
+	struct sched_edf_control sched_edf_ctl;
 	struct thread_object idle;
 	struct host_gdt gdt;
 	struct tss_64 tss;
@@ -53,10 +56,14 @@ struct per_cpu_region {
 	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
 	uint32_t lapic_id;
 	uint32_t lapic_ldr;
+	uint32_t l2_id;		/* pCPUs with the same l2_id share the L2 cache */
+	uint32_t llc_id;	/* pCPUs with the same llc_id share the last level cache */
 	uint32_t softirq_servicing;
+	struct softirq_stat softirq_stat[NR_SOFTIRQS];
 	uint32_t mode_to_kick_pcpu;
 	uint32_t mode_to_idle;
-	struct smp_call_info_data smp_call_info;
+	struct pcpu_idle idle_ctl;
+	struct smp_call_queue smp_call_queue;
 	struct list_head softirq_dev_entry_list;
 #ifdef PROFILING_ON
 	struct profiling_info_wrapper profiling_info;
@@ -64,6 +71,8 @@ struct per_cpu_region {
 	uint64_t shutdown_vm_bitmap;
 	uint64_t tsc_suspend;
 	struct acrn_vcpu *whose_iwkey;
+	/* the extended context whose XSAVE state the registers of this pCPU hold */
+	const struct ext_context *whose_xsave;
 	/*
 	 * We maintain a per-pCPU array of vCPUs. vCPUs of a VM won't
 	 * share same pCPU. So the maximum possible # of vCPUs that can
@@ -124,6 +124,9 @@
 /* End of ept_mem_type */
 
 #define EPT_MT_MASK		(7UL << EPT_MT_SHIFT)
+/* set by the processor when accessing/writing the page, with EPT A/D flags enabled in the EPTP */
+#define EPT_ACCESSED		(1UL << 8U)
+#define EPT_DIRTY		(1UL << 9U)
 #define EPT_VE			(1UL << 63U)
 /* EPT leaf entry bits (bit 52 - bit 63) should be maksed  when calculate PFN */
 #define EPT_PFN_HIGH_MASK	0xFFF0000000000000UL
@@ -152,6 +155,7 @@
 #define PML4E_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDPTE_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDE_PFN_MASK		0x0000FFFFFFFFF000UL
+#define PTE_PFN_MASK		0x0000FFFFFFFFF000UL
 
 #define EPT_ENTRY_PFN_MASK	((~EPT_PFN_HIGH_MASK) & PAGE_MASK)
 
@@ -236,6 +240,19 @@ static inline bool pgentry_present(const struct pgtable *table, uint64_t pte)
 	return ((table->pgentry_present_mask & (pte)) != 0UL);
 }
 
+#define PGTABLE_RETIRED_MAX	64U
+
+/**
+ * @brief Paging-structure pages unlinked by pgtable_coalesce_map() and not freed yet.
+ *
+ * A processor may keep walking an unlinked page from its paging-structure caches until it invalidates them, so the
+ * owner of the page table frees these pages to table->pool only once every processor using it did.
+ */
+struct pgtable_retired {
+	uint64_t *pages[PGTABLE_RETIRED_MAX];
+	uint32_t nr;
+};
+
 /**
  * @brief Translate a host physical address to a host virtual address before paging mode enabled.
  *
@@ -553,6 +570,10 @@ void pgtable_add_map(uint64_t *pml4_page, uint64_t paddr_base,
 void pgtable_modify_or_del_map(uint64_t *pml4_page, uint64_t vaddr_base,
 		uint64_t size, uint64_t prot_set, uint64_t prot_clr,
 		const struct pgtable *table, uint32_t type);
+bool pgtable_coalesce_map(uint64_t *pml4_page, uint64_t vaddr_base,
+		uint64_t size, const struct pgtable *table, struct pgtable_retired *retired);
+void pgtable_split_map(uint64_t *pml4_page, uint64_t vaddr_base,
+		uint64_t size, const struct pgtable *table);
 #endif /* PGTABLE_H */
 
 /**
@@ -53,9 +53,33 @@ struct rdt_type {
 	struct rdt_ins *ins_array;
 };
 
+struct acrn_rdt_mon;
+struct acrn_rdt_clos;
+
 void setup_clos(uint16_t pcpu_id);
 uint64_t clos2pqr_msr(uint16_t clos);
 bool is_platform_rdt_capable(void);
 const struct rdt_ins *get_rdt_res_ins(int res, uint16_t pcpu_id);
 
+/* The IA32_PQR_ASSOC of the vCPUs of VM vm_id in clos, with the RMID of the VM if it is monitored */
+uint64_t vm_clos2pqr_msr(uint16_t vm_id, uint16_t clos);
+
+/**
+ * @brief Sample the L3 occupancy and memory bandwidth counters of the RMID of a VM
+ *
+ * @return 0 on success, -ENODEV if the platform or the VM isn't monitored,
+ *         -EBUSY if all the pCPUs of the domain run RT vCPUs, -EINVAL otherwise.
+ */
+int32_t rdt_get_mon(struct acrn_rdt_mon *mon);
+
+/**
+ * @brief Change the cache mask or MBA delay of a CLOS on its domain
+ *
+ * @return 0 on success, -EPERM if the CLOS is of an RT VM or a VM with vCAT,
+ *         or the mask would overlap the mask of an RT VM, -ENODEV if the
+ *         resource isn't enabled, -EBUSY if all the pCPUs of the domain run
+ *         RT vCPUs, -EINVAL otherwise.
+ */
+int32_t rdt_set_clos(struct acrn_rdt_clos *clos);
+
 #endif	/* RDT_H */
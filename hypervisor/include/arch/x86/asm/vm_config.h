@@ -61,10 +61,12 @@
 #define DM_OWNED_GUEST_FLAG_MASK	0UL
 #elif defined(CONFIG_RELEASE)
 #define DM_OWNED_GUEST_FLAG_MASK	(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH \
-					| GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)
+					| GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_VHPET \
+					| GUEST_FLAG_VPIT)
 #else
 #define DM_OWNED_GUEST_FLAG_MASK	(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH \
-					| GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_PMU_PASSTHROUGH)
+					| GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_PMU_PASSTHROUGH \
+					| GUEST_FLAG_VHPET | GUEST_FLAG_VPIT)
 #endif
 
 /* ACRN guest severity */
@@ -157,6 +159,11 @@ struct pt_intx_config {
 	uint32_t virt_gsi;	/* virtual IOAPIC gsi triggered on the vIOAPIC */
 } __aligned(8);
 
+/* IA32_HWP_REQUEST of the vCPUs of a VM, see get_vm_hwp_request() */
+#define VM_PERF_POLICY_HOST		0U	/* cpu_perf_policy of the hypervisor */
+#define VM_PERF_POLICY_PERFORMANCE	1U	/* highest HWP level */
+#define VM_PERF_POLICY_EFFICIENCY	2U	/* up to the guaranteed HWP level, EPP towards power */
+
 struct acrn_vm_config {
 	enum acrn_vm_load_order load_order;		/* specify the load order of VM */
 	char name[MAX_VM_NAME_LEN];				/* VM name identifier */
@@ -172,6 +179,15 @@ struct acrn_vm_config {
 							 * We could add more guest flags in future;
 							 */
 	struct sched_params sched_params;		/* Scheduler params for vCPUs of this VM */
+	uint32_t halt_poll_us;				/* Max time a vCPU polls for a wakeup on HLT
+							 * before it is scheduled out, 0 disables polling
+							 */
+	uint32_t ple_gap;				/* PAUSE-loop exiting gap in TSC cycles, 0 for default */
+	uint32_t ple_window;				/* PAUSE-loop exiting window in TSC cycles, 0 for default */
+	uint32_t rep_io_batch;				/* Max iterations of a REP string I/O on the device model
+							 * per VM exit, 0 for default
+							 */
+	uint8_t perf_policy;				/* VM_PERF_POLICY_* */
 	uint16_t companion_vm_id;			/* The companion VM id for this VM */
 	struct acrn_vm_mem_config memory;		/* memory configuration of VM */
 	struct epc_section epc;				/* EPC memory configuration of VM */
@@ -204,6 +220,12 @@ struct acrn_vm_config {
 	uint32_t max_l2_pcbm;
 	uint32_t max_l3_pcbm;
 
+	/* cache_colors: the LLC page colors the memory of a pre-launched VM is taken from, one bit per
+	 * color of get_llc_colors(), the pages of its host regions of other colors are left out.
+	 * 0 is for all the colors.
+	 */
+	uint64_t cache_colors;
+
 	struct vuart_config vuart[MAX_VUART_NUM_PER_VM];/* vuart configuration for VM */
 
 	bool pt_tpm2;
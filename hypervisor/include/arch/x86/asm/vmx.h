@@ -283,6 +283,9 @@
 #define VMX_EXIT_REASON_XSAVES                                       0x0000003FU
 #define VMX_EXIT_REASON_XRSTORS                                      0x00000040U
 #define VMX_EXIT_REASON_LOADIWKEY                                    0x00000045U
+#define VMX_EXIT_REASON_BUS_LOCK                                     0x0000004AU
+/* a bus lock was detected while running the guest up to another VM exit */
+#define VMX_EXIT_REASON_BUS_LOCK_DETECTED                            (1U << 26U)
 
 /* VMX execution control bits (pin based) */
 #define VMX_PINBASED_CTLS_IRQ_EXIT     (1U<<0U)
@@ -338,6 +341,7 @@
 #define VMX_PROCBASED_CTLS2_TSC_SCALING (1U<<25U)
 #define VMX_PROCBASED_CTLS2_UWAIT_PAUSE (1U<<26U)
 #define VMX_PROCBASED_CTLS2_ENCLV_EXIT (1U<<28U)
+#define VMX_PROCBASED_CTLS2_BUS_LOCK   (1U<<30U)
 #define VMX_PROCBASED_CTLS3_LOADIWKEY  (1U<<0U)
 
 /* MSR_IA32_VMX_EPT_VPID_CAP: EPT and VPID capability bits */
@@ -373,6 +377,9 @@
 #define VMX_EPTP_MT_WB  		0x6UL
 #define VMX_EPTP_MT_UC  		0x0UL
 
+/* number of the GPA entries in the page-modification log, SDM 29.3.6 */
+#define VMX_PML_ENTRY_NUM		512U
+
 /* VMX exit control bits */
 #define VMX_EXIT_CTLS_SAVE_DBG         (1U<<2U)
 #define VMX_EXIT_CTLS_HOST_ADDR64      (1U<<9U)
@@ -465,4 +472,5 @@ void init_cr0_cr4_flexible_bits(void);
 bool is_valid_cr0_cr4(uint64_t cr0, uint64_t cr4);
 
 #define POSTED_INTR_ON  0U
+#define POSTED_INTR_SN  1U
 #endif /* VMX_H_ */
@@ -602,6 +602,26 @@ struct iommu_domain;
  */
 int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
 
+/**
+ * @brief Assign several devices to a iommu domain at once.
+ *
+ * As move_pt_device() for each device of bdfs, the invalidations of all the
+ * devices are issued together and waited for once per DMAR unit.
+ *
+ * @param[in]    from_domain iommu domain from which the devices are removed from
+ * @param[in]    to_domain iommu domain to which the devices are assgined to
+ * @param[in]    bdfs the physical BDFs of the devices
+ * @param[in]    nr the number of devices in bdfs
+ *
+ * @retval 0 on success.
+ * @retval <0 fail to move one of the devices, the devices before it are moved
+ *
+ * @pre (from_domain != NULL) || (to_domain != NULL)
+ * @pre bdfs != NULL
+ */
+int32_t move_pt_devices(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain,
+		const union pci_bdf *bdfs, uint16_t nr);
+
 /**
  * @brief Create a iommu domain for a VM specified by vm_id.
  *
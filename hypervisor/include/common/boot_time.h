@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef BOOT_TIME_H
+#define BOOT_TIME_H
+
+#include <types.h>
+#include <acrn_common.h>
+
+/**
+ * @brief Record the TSC of the ACRN_BOOT_* phase reached
+ *
+ * @pre phase < ACRN_BOOT_PHASE_MAX
+ */
+void boot_time_mark(uint32_t phase);
+
+/**
+ * @brief Record the TSC of an ACRN_BOOT_* phase reached before the hypervisor, by its boot loader
+ *
+ * @pre phase < ACRN_BOOT_PHASE_MAX
+ */
+void boot_time_set(uint32_t phase, uint64_t ticks);
+
+/**
+ * @brief Record the TSC of the ACRN_VM_BOOT_* phase reached by a VM
+ *
+ * ACRN_VM_BOOT_CREATE clears the other phases of the VM, recorded by its
+ * previous boot.
+ *
+ * @pre vm_id < CONFIG_MAX_VM_NUM && phase < ACRN_VM_BOOT_PHASE_MAX
+ */
+void vm_boot_time_mark(uint16_t vm_id, uint32_t phase);
+
+/**
+ * @brief Account the bytes of a guest image loaded for a VM
+ *
+ * @param in_place The image was at its guest address already, not copied
+ * @param nr_pcpus The pCPUs the image was copied by
+ *
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+void vm_boot_time_load(uint16_t vm_id, uint64_t size, bool in_place, uint32_t nr_pcpus);
+
+/* The TSC of the ACRN_BOOT_* phases, 0 for those not reached */
+const uint64_t *get_boot_time(void);
+
+/*
+ * The TSC of the ACRN_VM_BOOT_* phases of a VM, 0 for those not reached, and
+ * its load stats
+ *
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ */
+const struct acrn_vm_boot_time *get_vm_boot_time(uint16_t vm_id);
+
+#endif /* BOOT_TIME_H */
@@ -37,6 +37,19 @@ bool is_hypercall_from_ring0(void);
  */
 int32_t hcall_service_vm_offline_cpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Give an offlined pCPU back to the Service VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 lapic id of the pCPU
+ * @param param2 not used
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_service_vm_online_cpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Get hypervisor api version
  *
@@ -153,6 +166,57 @@ int32_t hcall_pause_vm(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64
  */
 int32_t hcall_set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Save the state of a vCPU of a paused VM
+ *
+ * Copy the registers, the LAPIC and the XSAVE area of a vCPU of a paused
+ * User VM to the Service VM, for the VM to be restored from a snapshot.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_state, its vcpu_id set
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_save_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Restore the state of a vCPU of a VM not started yet
+ *
+ * Set a vCPU of a created User VM to a state got by hcall_save_vcpu_state(),
+ * the vCPU starts from it on the next HC_START_VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_state
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_restore_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Add or remove a vCPU of a User VM
+ *
+ * Grow or shrink a created User VM by one vCPU on a pCPU of its cpu_affinity,
+ * to move pCPUs between the Service VM and User VMs without a reboot.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vcpu_hotplug
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_hotplug_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief set or clear IRQ line
  *
@@ -186,6 +250,24 @@ int32_t hcall_set_irqline(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uin
  */
 int32_t hcall_inject_msi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief notify the MSI ring
+ *
+ * Inject the MSIs the DM published in the ACRN_MSI_RING shared buffer of a
+ * VM. The DM only calls it while the doorbell of the ring is set, i.e. while
+ * no pCPU polls the ring.
+ * The function will return -1 if the target VM does not exist or has no ring.
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 not used
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_msi_ring(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -217,6 +299,22 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_notify_ioreq_finish(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief notify requests done
+ *
+ * Notify several requestor VCPUs for the completion of their ioreqs at once.
+ * The function will return -1 if the target VM does not exist, or if the
+ * bitmap is empty or has a VCPU the VM does not have.
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 bitmap of the vcpu IDs of the requestors
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -246,6 +344,42 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
  */
 int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief start, stop or get the dirty logging of guest memory
+ *
+ * The dirty log uses Page Modification Logging. Only post-launched VMs without
+ * LAPIC passthrough, nested virtualization or secure world can be logged.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief start, stop or scan the working set estimation of a VM
+ *
+ * The scans clear the EPT accessed flags of the VM, on the pCPU of the
+ * calling vCPU, not more often than the interval given at the start. Only
+ * post-launched VMs without real-time, LAPIC passthrough, nested
+ * virtualization or secure world can be estimated.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_wss
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_wss(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -262,6 +396,23 @@ int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_
  */
 int32_t hcall_gpa_to_hpa(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief translate a guest physical range to host physical extents
+ *
+ * Translate a range of guest physical memory of a VM into the runs of it
+ * that are contiguous in host physical memory, so that a buffer needs one
+ * hypercall rather than one per page.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct acrn_gpa2hpa_extents
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_gpa_to_hpa_extents(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Assign one PCI dev to VM.
  *
@@ -346,6 +497,20 @@ int32_t hcall_add_vdev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64
  */
 int32_t hcall_remove_vdev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Set the config space shadow of a device model emulated device.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to data structure of
+ *              acrn_vdev_cfg_shadow
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_vdev_cfg_shadow(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Set interrupt mapping info of ptdev.
  *
@@ -551,6 +716,34 @@ int32_t hcall_asyncio_assign(__unused struct acrn_vcpu *vcpu, struct acrn_vm *ta
 int32_t hcall_asyncio_deassign(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 		 __unused uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Assign a write-posted I/O range to a VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm which VM the posted range belongs.
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_posted_io_range
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_posted_io_assign(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		 __unused uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Deassign a write-posted I/O range from a VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm which VM the posted range belongs.
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_posted_io_range
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_posted_io_deassign(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		 __unused uint64_t param1, uint64_t param2);
+
 /**
  * @brief Setup the hypervisor NPK log.
  *
@@ -581,6 +774,104 @@ int32_t hcall_setup_hv_npk_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Get the VM exit statistics of a vCPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_stat(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Set the filter of the hypervisor trace events
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address. This gpa points to
+ *              struct acrn_trace_filter
+ * @param param2 not used
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_trace_filter(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Get the scheduling latency statistics of a vCPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_sched_stats
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_sched_stat(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Get the steal time of the vCPUs of a VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to vm_id of Service VM
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_steal_time_stats
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_steal_time(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Get the TSC of the boot phases of the hypervisor and of the VMs
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_boot_time
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_boot_time(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Sample the L3 occupancy and memory bandwidth of a VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_rdt_mon
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_rdt_mon(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Change the cache mask or MBA delay of a CLOS
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_rdt_clos
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, -EPERM if the CLOS is reserved for an RT VM, non-zero on other errors.
+ */
+int32_t hcall_set_rdt_clos(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Execute profiling operation
  *
@@ -596,6 +887,33 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uin
 int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
 int32_t hcall_create_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Send an IPI to several vCPUs of the calling VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 bitmap of the destination APIC IDs, bit n for APIC ID (min + n)
+ * @param param2 the min APIC ID in bits 63:32, the low ICR word of the IPI in bits 31:0
+ *
+ * @pre is_pv_ipi_configured(vcpu->vm)
+ * @return the number of vCPUs the IPI was sent to, negative on error.
+ */
+int32_t hcall_pv_send_ipi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Register the state of the calling vCPU shared with the guest
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address of a struct acrn_pv_vcpu_state, 0 to unregister it
+ * @param param2 not used
+ *
+ * @pre is_pv_ipi_configured(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_pv_set_vcpu_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2);
 /**
  * @}
  */
@@ -142,6 +142,11 @@ struct ptirq_remapping_info {
 	uint16_t irte_idx;
 
 	uint64_t intr_count;
+	uint64_t remote_count;	/* MSIs injected to a vCPU of another pCPU */
+	uint16_t remote_pcpu_id;	/* pCPU of the last remote injections, remote_streak in a row */
+	uint16_t remote_streak;
+	uint16_t steer_pcpu_id;	/* the only pCPU in the IRTE destination, INVALID_CPU_ID if not steered */
+	spinlock_t remap_lock;	/* serializes the builds of the physical MSI */
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
 	ptirq_arch_release_fn_t release_cb;
 };
@@ -222,17 +227,33 @@ void ptdev_init(void);
 void ptdev_release_all_entries(const struct acrn_vm *vm);
 
 /**
- * @brief Dequeue an entry from per cpu ptdev softirq queue.
+ * @brief Dequeue a batch of entries from per cpu ptdev softirq queue.
  *
- * Dequeue an entry from the ptdev softirq queue on the specific physical cpu.
+ * Dequeue up to \p max entries from the ptdev softirq queue on the specific
+ * physical cpu, with interrupts disabled only once for the whole batch.
+ * Every queued entry is ready for injection.
  *
  * @param[in]    pcpu_id physical cpu id
+ * @param[out]   batch array receiving the dequeued entries
+ * @param[in]    max capacity of \p batch
  *
- * @retval NULL when the queue is empty
- * @retval !NULL when there is available ptirq_remapping_info entry in the queue
+ * @return number of entries dequeued, 0 when the queue is empty
  *
  */
-struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id);
+uint32_t ptirq_dequeue_softirq_batch(uint16_t pcpu_id, struct ptirq_remapping_info *batch[], uint32_t max);
+
+/**
+ * @brief Configure the passthrough interrupt rate limiter of a VM.
+ *
+ * Interrupts beyond \p burst back-to-back ones are spaced \p interval apart,
+ * later ones are coalesced per entry until injected.
+ *
+ * @param[in]    vm acrn_vm to configure
+ * @param[in]    interval TSC ticks between refills of one token, 0 disables the limiter
+ * @param[in]    burst number of interrupts that may be injected back to back
+ *
+ */
+void ptirq_set_rate_limit(struct acrn_vm *vm, uint64_t interval, uint32_t burst);
 /**
  * @brief Allocate a ptirq_remapping_info entry.
  *
@@ -13,11 +13,33 @@
 #define SHARED_BUFFER_H
 #include <acrn_common.h>
 #include <asm/guest/vm.h>
+
+/*
+ * Elements reserved by sbuf_reserve(): num[0] at start[0], then num[1] at
+ * start[1] (the base of the buffer) when the reservation wraps around.
+ */
+struct sbuf_span {
+	uint8_t *start[2];
+	uint32_t num[2];
+	uint32_t ele_size;
+	uint32_t tail;		/* tail once the span is committed */
+	uint32_t dropped;	/* oldest elements overwritten by the commit */
+};
+
+static inline uint8_t *sbuf_span_elem(const struct sbuf_span *span, uint32_t i)
+{
+	return (i < span->num[0]) ? (span->start[0] + (i * span->ele_size)) :
+		(span->start[1] + ((i - span->num[0]) * span->ele_size));
+}
+
 /**
  *@pre sbuf != NULL
  *@pre data != NULL
  */
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len);
+uint32_t sbuf_put_var(struct shared_buf *sbuf, const uint8_t *data, uint32_t len);
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t elem_size, uint32_t elem_num, struct sbuf_span *span);
+void sbuf_commit(struct shared_buf *sbuf, const struct sbuf_span *span);
 uint32_t sbuf_put_many(struct shared_buf *sbuf, uint32_t elem_size, uint8_t *data, uint32_t data_size);
 int32_t sbuf_share_setup(uint16_t cpu_id, uint32_t sbuf_id, uint64_t *hva);
 void sbuf_reset(void);
@@ -9,8 +9,11 @@
 #include <asm/lib/spinlock.h>
 #include <lib/list.h>
 #include <timer.h>
+#include <board_info.h>
+#include <acrn_common.h>
 
 #define	NEED_RESCHEDULE		(1U)
+#define	INCOMING_MIGRATION	(2U)
 
 #define DEL_MODE_INIT		(1U)
 #define DEL_MODE_IPI		(2U)
@@ -34,6 +37,13 @@ enum thread_priority {
 	PRIO_MAX
 };
 
+/* Tools can configure the vCPUs of a VM to be co-scheduled by the BVT scheduler */
+enum thread_cosched_mode {
+	COSCHED_NONE = 0,
+	COSCHED_STRICT,		/* siblings are started with the gang and preempted at its slice end */
+	COSCHED_RELAXED,	/* siblings may start late by up to bvt_cosched_skew_us */
+};
+
 /* 
  * For now, we just have several parameters for all the schedulers. So we
  * put them together here for simplicity. TODO When this structure grows big
@@ -48,6 +58,38 @@ struct sched_params {
 	int32_t bvt_warp_value; /* the warp reduce effective VT to boost priority */
 	uint32_t bvt_warp_limit;	/* max time in one warp */
 	uint32_t bvt_unwarp_period;	/* min unwarp time after a warp */
+	uint8_t bvt_cosched;		/* enum thread_cosched_mode of the threads of a VM */
+	uint32_t bvt_cosched_skew_us;	/* start skew tolerated in COSCHED_RELAXED mode */
+
+	/* per thread reservation for the EDF scheduler, no reservation if budget is 0 */
+	uint32_t edf_budget_us;		/* time the thread may run in each period */
+	uint32_t edf_period_us;
+};
+
+struct sched_gang_stat {
+	uint64_t joins;		/* times the member started while a sibling was running */
+	uint64_t skew_total;	/* sum of the start skew of those joins, in TSC ticks */
+	uint64_t skew_max;	/* largest start skew, in TSC ticks */
+	uint64_t boosts;	/* times the member was moved ahead to catch up with the gang */
+};
+
+/*
+ * Threads co-scheduled as one gang, e.g. the vCPUs of a VM.
+ *
+ * A gang slice opens when the first member starts running and closes when
+ * the last running member is switched out. running_mask, slice_start and
+ * slice_end are shared by the pCPUs of all members, stat[i] is only written
+ * by the pCPU member i runs on.
+ */
+struct sched_gang {
+	uint8_t mode;
+	uint64_t skew_limit;		/* tolerated start skew in TSC ticks */
+	uint16_t nr_members;
+	struct thread_object *members[MAX_PCPU_NUM];
+	volatile uint64_t running_mask;	/* bit i is set while members[i] runs */
+	volatile uint64_t slice_start;
+	volatile uint64_t slice_end;	/* preemption tick of the first member, UINT64_MAX if none */
+	struct sched_gang_stat stat[MAX_PCPU_NUM];
 };
 
 struct thread_object;
@@ -65,9 +107,30 @@ struct thread_object {
 	switch_t switch_out;
 	switch_t switch_in;
 
+	/* pCPUs the thread may be migrated to, 0 if it is pinned */
+	uint64_t migrate_mask;
+	/* called on the source pCPU once pcpu_id has been set to the destination */
+	switch_t migrate_out;
+
+	/* gang the thread is co-scheduled with, NULL if it is scheduled alone */
+	struct sched_gang *gang;
+	uint16_t gang_member;
+
+	/* scheduling latency, only updated under the scheduler lock of pcpu_id */
+	uint64_t runnable_tsc;	/* TSC the thread was woken or preempted at */
+	uint64_t run_tsc;	/* TSC the thread was switched in at */
+	struct acrn_sched_stat stat;
+
 	uint8_t data[THREAD_DATA_SIZE];
 };
 
+/* how long the scheduler tick of a pCPU was left stopped */
+struct sched_tick_stat {
+	uint64_t stops;		/* times the tick was stopped */
+	uint64_t suppressed;	/* tick periods that elapsed while the tick was stopped */
+	uint64_t stop_tsc;	/* TSC the tick was stopped at, 0 while it runs */
+};
+
 struct sched_control {
 	uint16_t pcpu_id;
 	uint64_t flags;
@@ -75,14 +138,22 @@ struct sched_control {
 	spinlock_t scheduler_lock;	/* to protect sched_control and thread_object */
 	struct acrn_scheduler *scheduler;
 	void *priv;
+
+	/* runnable thread to be handed over to migrate_dst on the next schedule() */
+	struct thread_object *migrate_obj;
+	uint16_t migrate_dst;
+
+	struct sched_tick_stat tick_stat;
 };
 
-#define SCHEDULER_MAX_NUMBER 4U
+#define SCHEDULER_MAX_NUMBER 5U
 struct acrn_scheduler {
 	char name[16];
 
 	/* init scheduler */
 	int32_t	(*init)(struct sched_control *ctl);
+	/* whether a thread of these params fits on the pCPU, NULL if any does */
+	bool	(*admit)(struct sched_control *ctl, const struct sched_params *params);
 	/* init private data of scheduler */
 	void	(*init_data)(struct thread_object *obj, struct sched_params *params);
 	/* pick the next thread object */
@@ -114,14 +185,47 @@ struct sched_noop_control {
 struct sched_iorr_control {
 	struct list_head runqueue;
 	struct hv_timer tick_timer;
+	bool tick_stopped;	/* the tick is stopped while at most one thread is runnable */
 };
 
+enum sched_iorr_class {
+	IORR_CLASS_NORMAL,
+	IORR_CLASS_IO,		/* short runs before blocking: head on wake, short slice */
+	IORR_CLASS_CPU,		/* long runs: tail on wake, long slice */
+};
+
+struct sched_iorr_stat {
+	enum sched_iorr_class class;
+	uint64_t slice_us;
+	uint64_t avg_run_us;	/* average run before blocking or using up the slice */
+	uint64_t blocks;
+	uint64_t expiries;	/* slices used up */
+};
+
+bool sched_iorr_get_stat(const struct thread_object *obj, struct sched_iorr_stat *stat);
+
 extern struct acrn_scheduler sched_bvt;
+/* vCPUs of a VM don't share a pCPU, so at most CONFIG_MAX_VM_NUM threads are runnable on one pCPU */
+#define BVT_RUNQUEUE_MAX	CONFIG_MAX_VM_NUM
+
+struct sched_bvt_pick_stat {
+	uint64_t count;		/* number of pick_next calls */
+	uint64_t cycles;	/* total cycles spent in pick_next */
+};
+
 struct sched_bvt_control {
-	struct list_head runqueue;
+	/* indexed min-heap of runnable threads, ordered by effective virtual time */
+	struct thread_object *runqueue[BVT_RUNQUEUE_MAX];
+	uint32_t nr_runnable;
+	/* insertion sequence, keeps FIFO order among threads with the same evt */
+	uint64_t seq;
 	struct hv_timer tick_timer;
 	/* The minimum AVT of any runnable threads */
 	int64_t svt;
+#ifdef HV_DEBUG
+	/* pick_next latency, indexed by the number of runnable threads */
+	struct sched_bvt_pick_stat pick_stat[BVT_RUNQUEUE_MAX + 1U];
+#endif
 };
 
 extern struct acrn_scheduler sched_prio;
@@ -129,6 +233,24 @@ struct sched_prio_control {
 	struct list_head prio_queue;
 };
 
+extern struct acrn_scheduler sched_edf;
+struct sched_edf_control {
+	struct list_head edf_queue;		/* runnable servers with budget left, by deadline */
+	struct list_head throttled_queue;	/* runnable servers waiting for their deadline */
+	struct list_head be_queue;		/* runnable threads without reservation, round robin */
+	struct hv_timer tick_timer;
+	uint64_t reserved_bw;			/* bandwidth of the servers, in parts per million */
+};
+
+struct sched_edf_stat {
+	uint64_t replenishes;		/* periods started at a deadline */
+	uint64_t throttles;		/* budget used up before the deadline */
+	uint64_t deadline_misses;	/* deadline reached, runnable, with budget left */
+};
+
+bool sched_edf_get_stat(const struct thread_object *obj, uint32_t *budget_us, uint32_t *period_us,
+		struct sched_edf_stat *stat);
+
 bool is_idle_thread(const struct thread_object *obj);
 uint16_t sched_get_pcpuid(const struct thread_object *obj);
 struct thread_object *sched_get_current(uint16_t pcpu_id);
@@ -140,9 +262,15 @@ void resume_sched(void);
 void obtain_schedule_lock(uint16_t pcpu_id, uint64_t *rflag);
 void release_schedule_lock(uint16_t pcpu_id, uint64_t rflag);
 
+int32_t sched_admit(uint64_t pcpu_bitmap, const struct sched_params *params);
 void init_thread_data(struct thread_object *obj, struct sched_params *params);
+void init_sched_gang(struct sched_gang *gang, const struct sched_params *params);
+void join_sched_gang(struct sched_gang *gang, struct thread_object *obj);
 void deinit_thread_data(struct thread_object *obj);
 
+void sched_tick_stop(struct sched_control *ctl);
+void sched_tick_start(struct sched_control *ctl, uint64_t tick_period);
+
 void make_reschedule_request(uint16_t pcpu_id);
 bool need_reschedule(uint16_t pcpu_id);
 
@@ -150,6 +278,8 @@ void run_thread(struct thread_object *obj);
 void sleep_thread(struct thread_object *obj);
 void sleep_thread_sync(struct thread_object *obj);
 void wake_thread(struct thread_object *obj);
+bool prioritize_thread(struct thread_object *obj);
+bool request_thread_migration(struct thread_object *obj, uint16_t dst_pcpu_id);
 void yield_current(void);
 void schedule(void);
 
@@ -10,12 +10,36 @@
 #define SOFTIRQ_TIMER		0U
 #define SOFTIRQ_PTDEV		1U
 #define SOFTIRQ_THERMAL		2U
-#define NR_SOFTIRQS             3U
+#define SOFTIRQ_VHPET		3U
+#define SOFTIRQ_VPIT		4U
+#define NR_SOFTIRQS             5U
+
+/* Priority classes: the pending softirqs of a class run before those of the next classes */
+#define SOFTIRQ_CLASS_RT	0U	/* timers and passthrough interrupts, never deferred */
+#define SOFTIRQ_CLASS_VDEV	1U	/* emulated devices */
+#define SOFTIRQ_CLASS_HOUSEKEEP	2U
+#define NR_SOFTIRQ_CLASSES	3U
+
+/*
+ * Time the softirqs out of SOFTIRQ_CLASS_RT may take in a pass on the way to
+ * VM entry. Those still pending past it run in the next pass, at the next
+ * VM exit or in the idle thread, which has no budget.
+ */
+#define SOFTIRQ_BUDGET_US	50U
+
+struct softirq_stat {
+	uint64_t count;
+	uint64_t cycles;
+	uint64_t max_cycles;
+	uint64_t deferred;	/* passes it was left pending in, past the budget */
+};
 
 typedef void (*softirq_handler)(uint16_t cpu_id);
 
 void init_softirq(void);
 void register_softirq(uint16_t nr, softirq_handler handler);
 void fire_softirq(uint16_t nr);
+void fire_softirq_on_pcpu(uint16_t pcpu_id, uint16_t nr);
+bool has_pending_softirq(uint16_t pcpu_id);
 void do_softirq(void);
 #endif /* SOFTIRQ_H */
@@ -27,18 +27,44 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+/* HPET requires at least 3 timers and up to 32 timers per block, the same number as the device model */
+#define VHPET_NUM_TIMERS	8U
+
+/*
+ * The active timers of one pCPU are the sched tick timer, the vLAPIC timers of
+ * the vCPUs running on it (at most one per VM), the Hyper-V synthetic timers of
+ * those vCPUs (four each), the ptirq interrupt delay timers, the vHPET and vPIT
+ * timers of the VMs whose BSP runs on it (VHPET_NUM_TIMERS and one each) and a
+ * few device/console timers.
+ */
+#ifdef CONFIG_HYPERV_ENABLED
+#define MAX_VCPU_TIMERS_PER_PCPU	(CONFIG_MAX_VM_NUM * 5U)
+#else
+#define MAX_VCPU_TIMERS_PER_PCPU	CONFIG_MAX_VM_NUM
+#endif
+#define MAX_VHPET_TIMERS_PER_PCPU	(CONFIG_MAX_VM_NUM * VHPET_NUM_TIMERS)
+#define MAX_VPIT_TIMERS_PER_PCPU	CONFIG_MAX_VM_NUM
+#define MAX_VDEV_TIMERS_PER_PCPU	(MAX_VHPET_TIMERS_PER_PCPU + MAX_VPIT_TIMERS_PER_PCPU)
+#define MAX_TIMERS_PER_PCPU	(CONFIG_MAX_PT_IRQ_ENTRIES + MAX_VCPU_TIMERS_PER_PCPU + MAX_VDEV_TIMERS_PER_PCPU + 8U)
+#define INVALID_TIMER_INDEX	0xFFFFFFFFU
+
 /**
  * @brief Definition of timers for per-cpu
+ *
+ * The active timers are kept in a binary min-heap keyed on timeout, so the
+ * nearest timer is always heap[0] and add/delete cost O(log n).
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	struct hv_timer *heap[MAX_TIMERS_PER_PCPU];	/**< min-heap of runtime active timers */
+	uint32_t nr_timers;				/**< number of timers in the heap */
 };
 
 /**
  * @brief Definition of timer
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	uint32_t heap_index;		/**< index in the per-cpu timer heap, INVALID_TIMER_INDEX if not active */
+	uint16_t pcpu_id;		/**< pcpu whose timer heap holds this timer */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t timeout;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in CPU ticks */
@@ -100,6 +126,7 @@ void update_timer(struct hv_timer *timer, uint64_t timeout, uint64_t period);
  *
  * @retval 0 on success
  * @retval -EINVAL timer has an invalid value
+ * @retval -ENOMEM the per-cpu timer heap is full
  *
  * @remark Don't call it in the timer callback function or interrupt content.
  */
@@ -114,6 +141,15 @@ int32_t add_timer(struct hv_timer *timer);
  */
 void del_timer(struct hv_timer *timer);
 
+/**
+ * @brief Get the deadline of the nearest timer of a pCPU.
+ *
+ * @param[in] pcpu_id pCPU whose timers to look at, the current one.
+ *
+ * @return TSC deadline of the nearest timer, 0 if none is active.
+ */
+uint64_t get_next_timer_deadline(uint16_t pcpu_id);
+
 /**
  * @brief Initialize timer.
  */
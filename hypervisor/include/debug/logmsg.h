@@ -29,6 +29,7 @@
 extern uint16_t console_loglevel;
 extern uint16_t mem_loglevel;
 extern uint16_t npk_loglevel;
+extern bool mem_log_binary;
 
 void asm_assert(int32_t line, const char *file, const char *txt);
 
@@ -46,6 +47,19 @@ void asm_assert(int32_t line, const char *file, const char *txt);
 #endif /* HV_DEBUG */
 
 void init_logmsg();
+void console_flush_logmsg(void);
+void console_defer_logmsg(bool deferred);
+
+#define LOG_RATELIMIT_BURST	10U
+#define LOG_RATELIMIT_MS	1000UL
+
+struct log_ratelimit {
+	uint64_t begin;
+	uint32_t printed;
+	uint32_t missed;
+};
+
+bool logmsg_ratelimit(struct log_ratelimit *rl);
 
 /*
  * @pre the severity > 0
@@ -80,40 +94,64 @@ void vprintf(const char *fmt, va_list args);
 #define pr_prefix
 #endif
 
-#define pr_fatal(...)						\
-	do {							\
-		do_logmsg(LOG_FATAL, pr_prefix __VA_ARGS__);	\
+/*
+ * The format strings live in .hvlog_fmt, their offset in it is the ID used by
+ * the binary memory log.
+ */
+#define __hvlog(severity, fmt, ...)					\
+	do {								\
+		static const char hvlog_fmt_[]				\
+			__attribute__((section(".hvlog_fmt"))) = fmt;	\
+		do_logmsg((severity), hvlog_fmt_, ##__VA_ARGS__);	\
 	} while (0)
 
-#define pr_acrnlog(...)						\
-	do {							\
-		do_logmsg(LOG_ACRN, pr_prefix __VA_ARGS__);	\
-	} while (0)
+#define pr_fatal(fmt, ...)	\
+	__hvlog(LOG_FATAL, pr_prefix fmt, ##__VA_ARGS__)
 
-#define pr_err(...)						\
-	do {							\
-		do_logmsg(LOG_ERROR, pr_prefix __VA_ARGS__);	\
-	} while (0)
+#define pr_acrnlog(fmt, ...)	\
+	__hvlog(LOG_ACRN, pr_prefix fmt, ##__VA_ARGS__)
+
+#define pr_err(fmt, ...)	\
+	__hvlog(LOG_ERROR, pr_prefix fmt, ##__VA_ARGS__)
+
+#define pr_warn(fmt, ...)	\
+	__hvlog(LOG_WARNING, pr_prefix fmt, ##__VA_ARGS__)
+
+#define pr_info(fmt, ...)	\
+	__hvlog(LOG_INFO, pr_prefix fmt, ##__VA_ARGS__)
+
+#define pr_dbg(fmt, ...)	\
+	__hvlog(LOG_DEBUG, pr_prefix fmt, ##__VA_ARGS__)
 
-#define pr_warn(...)						\
+/* for the messages a guest can trigger at will, e.g. on every VM exit */
+#define pr_err_ratelimited(...)					\
 	do {							\
-		do_logmsg(LOG_WARNING, pr_prefix __VA_ARGS__);	\
+		static struct log_ratelimit rl_;		\
+		if (logmsg_ratelimit(&rl_)) {			\
+			pr_err(__VA_ARGS__);			\
+		}						\
 	} while (0)
 
-#define pr_info(...)						\
+#define pr_warn_ratelimited(...)				\
 	do {							\
-		do_logmsg(LOG_INFO, pr_prefix __VA_ARGS__);	\
+		static struct log_ratelimit rl_;		\
+		if (logmsg_ratelimit(&rl_)) {			\
+			pr_warn(__VA_ARGS__);			\
+		}						\
 	} while (0)
 
-#define pr_dbg(...)						\
+#define pr_info_ratelimited(...)				\
 	do {							\
-		do_logmsg(LOG_DEBUG, pr_prefix __VA_ARGS__);	\
+		static struct log_ratelimit rl_;		\
+		if (logmsg_ratelimit(&rl_)) {			\
+			pr_info(__VA_ARGS__);			\
+		}						\
 	} while (0)
 
-#define dev_dbg(lvl, ...)					\
+#define dev_dbg(lvl, fmt, ...)					\
 	do {							\
 		if ((lvl) > 0) {                                \
-			do_logmsg((lvl), pr_prefix __VA_ARGS__);\
+			__hvlog((lvl), pr_prefix fmt, ##__VA_ARGS__);\
 		}                                               \
 	} while (0)
 
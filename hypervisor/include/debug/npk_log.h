@@ -10,5 +10,7 @@ struct hv_npk_log_param;
 
 void npk_log_setup(struct hv_npk_log_param *param);
 void npk_log_write(const char *buf, size_t len);
+bool npk_trace_enabled(void);
+void npk_trace_write(uint16_t pcpu_id, const uint8_t *rec, uint32_t len);
 
 #endif /* NPK_LOG_H */
@@ -66,6 +66,7 @@ typedef enum PROFILING_SEP_FEATURE {
 	LBR_PMU_SAMPLING,
 	UNCORE_PMU_SAMPLING,
 	VM_SWITCH_TRACING,
+	VM_TAGGED_SAMPLING,	/* struct acrn_profiling_sample records */
 	MAX_SEP_FEATURE_ID
 } profiling_sep_feature;
 
@@ -169,7 +170,9 @@ struct guest_vm_info {
 	uint64_t guest_rip;
 	uint64_t guest_rflags;
 	uint64_t guest_cs;
+	uint64_t guest_cr3;
 	uint16_t guest_vm_id;
+	uint16_t guest_vcpu_id;
 	int32_t external_vector;
 };
 
@@ -218,8 +221,29 @@ struct sep_state {
 	uint32_t vmexit_msr_cnt;
 	uint64_t guest_debugctl_value;
 	uint64_t saved_debugctl_value;
+
+	/* PEBS_PMU_SAMPLING, the PEBS buffer is drained on the PMI */
+	bool pebs_active;
+	uint32_t pebs_format;
+	uint32_t pebs_record_size;	/* 0 for the adaptive records */
+	uint64_t pebs_enable;
 } __aligned(8);
 
+#define MAX_PEBS_COUNTERS	8U
+
+/* Debug Store save area */
+struct profiling_ds_area {
+	uint64_t bts_buffer_base;
+	uint64_t bts_index;
+	uint64_t bts_absolute_maximum;
+	uint64_t bts_interrupt_threshold;
+	uint64_t pebs_buffer_base;
+	uint64_t pebs_index;
+	uint64_t pebs_absolute_maximum;
+	uint64_t pebs_interrupt_threshold;
+	uint64_t pebs_counter_reset[MAX_PEBS_COUNTERS];
+} __aligned(64);
+
 struct data_header {
 	int32_t collector_id;
 	uint16_t cpu_id;
@@ -294,6 +318,7 @@ struct profiling_info_wrapper {
 	ipi_commands ipi_cmd;
 	struct pmu_sample p_sample;
 	struct vm_switch_trace vm_trace;
+	struct profiling_ds_area ds_area;
 	socwatch_state soc_state;
 	struct sw_msr_op_info sw_msr_info;
 	spinlock_t sw_lock;
@@ -24,6 +24,24 @@
 /* event to calculate cpu usage with shared pcpu */
 #define TRACE_SCHED_NEXT		0x20U
 
+/* number of passthrough interrupts dequeued in one ptdev softirq batch */
+#define TRACE_PTIRQ_BATCH		0x21U
+
+/* thread migrated from the source pCPU to the destination pCPU */
+#define TRACE_SCHED_MIGRATE		0x22U
+
+/* external interrupt dispatched by the hypervisor */
+#define TRACE_IRQ			0x23U
+
+/* I/O request completed by the Service VM */
+#define TRACE_IOREQ			0x24U
+
+/* world switch: TEE_SWITCH_* of the switch and its latency in TSC ticks */
+#define TRACE_TEE_SWITCH		0x25U
+#define TEE_SWITCH_TRUSTY		0UL	/* switch_world(), its own duration */
+#define TEE_SWITCH_CALL			1UL	/* REE call, from the switch hypercall to the TEE vCPU running */
+#define TEE_SWITCH_FIQ			2UL	/* secure interrupt, from its arrival to the TEE vCPU running */
+
 #define TRACE_VMEXIT_ENTRY		0x10000U
 
 #define TRACE_VMEXIT_EXCEPTION_OR_NMI	    (TRACE_VMEXIT_ENTRY + 0x00000000U)
@@ -50,4 +68,7 @@ void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2);
 void TRACE_16STR(uint32_t evid, const char name[]);
 
+struct acrn_trace_filter;
+void set_trace_filter(const struct acrn_trace_filter *filter);
+
 #endif /* TRACE_H */
@@ -38,6 +38,18 @@ struct io_request {
 		struct acrn_mmio_request        mmio_request;
 		uint64_t			data[8];
 	} reqs;
+
+	/**
+	 * @brief Set by emulate_io() when the request was delivered to the device model.
+	 */
+	bool dm_emulated;
+
+	/**
+	 * @brief The request is one element of an INS or OUTS.
+	 *
+	 * The value read by an INS goes to the guest memory, not to RAX.
+	 */
+	bool string_io;
 };
 
 struct asyncio_desc {
@@ -127,6 +139,14 @@ struct mem_io_node {
 	 */
 	bool hold_lock;
 
+	/**
+	 * @brief Whether the writes to the range are doorbells
+	 *
+	 * A doorbell write is handled from its address alone, before the
+	 * instruction is decoded: the handler gets a write of size 0 and value 0.
+	 * The reads are emulated as usual.
+	 */
+	bool doorbell;
 
 	/**
 	 * @brief A pointer to the handler
@@ -287,6 +307,26 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
  */
 void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 					uint64_t start, uint64_t end);
+
+/**
+ * @brief Register a MMIO handler of doorbells
+ *
+ * The same as register_mmio_emulation_handler(), without the lock held, for a
+ * range the writes to are doorbells: they are handled with no instruction
+ * decode, so their value and size are unknown to \p read_write.
+ */
+void register_mmio_doorbell_handler(struct acrn_vm *vm,
+	hv_mem_io_handler_t read_write, uint64_t start,
+	uint64_t end, void *handler_private_data);
+
+/**
+ * @brief Handle a write to \p gpa by \p vcpu if it is a doorbell
+ *
+ * @retval 0 The write was a doorbell, handled.
+ * @retval -ENODEV No doorbell range covers \p gpa.
+ */
+int32_t emulate_mmio_doorbell(struct acrn_vcpu *vcpu, uint64_t gpa);
+
 void deinit_emul_io(struct acrn_vm *vm);
 
 int init_asyncio(struct acrn_vm *vm, uint64_t *hva);
@@ -294,6 +334,12 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva);
 int add_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_info);
 
 int remove_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_info);
+
+int init_posted_io(struct acrn_vm *vm, uint64_t *hva);
+
+int32_t add_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range);
+
+int32_t remove_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range);
 /**
  * @}
  */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef MSI_RING_H
+#define MSI_RING_H
+
+#include <types.h>
+
+/*
+ * Rings of the MSIs the DM raises for its VMs, struct acrn_msi_ring in the
+ * memory of the Service VM. The MSIs are injected on the exits of the Service
+ * VM, by an idle pCPU polling the rings for a while after the last MSI it
+ * took, and by HC_NOTIFY_MSI_RING, that the DM only calls while no pCPU
+ * polls.
+ */
+
+struct acrn_vm;
+
+/**
+ * @brief Take the ring the DM set up at hva for vm, the ACRN_MSI_RING sbuf
+ *
+ * @return 0 on success, -1 if the ring isn't valid.
+ */
+int32_t init_msi_ring(struct acrn_vm *vm, uint64_t *hva);
+
+/* Forget the ring of vm, no pCPU reads or writes it on return */
+void deinit_msi_ring(struct acrn_vm *vm);
+
+/* Inject the MSIs published in the ring of vm, returns their number */
+uint32_t drain_msi_ring(struct acrn_vm *vm);
+
+/* The same for all the VMs with a ring */
+uint32_t drain_msi_rings(void);
+
+/**
+ * @brief Poll the rings from the idle thread of pcpu_id
+ *
+ * One idle pCPU polls at a time, until no MSI was published for a while.
+ *
+ * @return true if the pCPU polls and calls again instead of idling.
+ */
+bool poll_msi_rings(uint16_t pcpu_id);
+
+/* Stop polling from pcpu_id, if it polls, before it leaves its idle thread */
+void stop_polling_msi_rings(uint16_t pcpu_id);
+
+#endif /* MSI_RING_H */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VHPET_H
+#define VHPET_H
+
+#include <asm/lib/spinlock.h>
+#include <timer.h>
+
+/**
+ * @addtogroup vp-dm_vperipheral
+ *
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Definitions for the virtual HPET device.
+ *
+ * This file defines types and data structure for the virtual HPET device, emulated in the hypervisor for the
+ * post-launched VMs with GUEST_FLAG_VHPET instead of in the device model.
+ */
+
+#define VHPET_BASE		0xfed00000UL
+#define VHPET_SIZE		0x400UL
+
+/* VHPET_NUM_TIMERS lives in timer.h, the per-pCPU timer heap is sized from it */
+
+struct acrn_vhpet;
+
+/**
+ * @brief Data structure to illustrate a timer of the virtual HPET device.
+ */
+struct vhpet_timer {
+	struct acrn_vhpet *vhpet;	/**< Pointer to the virtual HPET device of the timer. */
+	uint32_t	num;		/**< Number of the timer. */
+	uint32_t	compval;	/**< Comparator. */
+	uint32_t	comprate;	/**< Period of the comparator in periodic mode, in HPET ticks. */
+	uint64_t	cap_config;	/**< Configuration and capabilities register. */
+	uint64_t	msireg;		/**< FSB interrupt route register. */
+	uint64_t	expires;	/**< TSC when the main counter reaches compval, 0 if not running. */
+	uint64_t	period;		/**< TSC cycles to the next time the main counter reaches compval. */
+	struct hv_timer	timer;		/**< Timer of the hypervisor, on the pCPU of the device. */
+};
+
+/**
+ * @brief Data structure to illustrate a virtual HPET device.
+ *
+ * The main counter is computed from the TSC, the timers are backed by timers of the hypervisor. Those are all on
+ * the pCPU of the BSP: a register written on another pCPU only updates the expires of the timers, and the timers
+ * of the hypervisor are moved to them by a softirq there.
+ *
+ * @consistency self.vm->vhpet == self
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct acrn_vhpet {
+	struct acrn_vm	*vm;		/**< Pointer to the VM that owns the virtual HPET device. */
+	spinlock_t	lock;		/**< Lock of the registers. */
+	bool		active;		/**< Whether the guest accesses are emulated. */
+	volatile bool	resync;		/**< Whether the timers of the hypervisor are to be moved to the expires. */
+	uint16_t	pcpu_id;	/**< pCPU the timers of the hypervisor are on. */
+	uint64_t	config;		/**< General configuration register. */
+	uint64_t	isr;		/**< General interrupt status register. */
+	uint32_t	countbase;	/**< Main counter at countbase_tsc. */
+	uint64_t	countbase_tsc;	/**< TSC the main counter started counting from countbase at. */
+	struct vhpet_timer timer[VHPET_NUM_TIMERS];	/**< Timers of the device. */
+};
+
+/**
+ * @}
+ */
+
+#endif /* VHPET_H */
@@ -33,9 +33,12 @@
 #include <lib/util.h>
 #include <pci.h>
 #include <list.h>
+#include <acrn_common.h>
 
 #define VDEV_LIST_HASHBITS 4U
 #define VDEV_LIST_HASHSIZE (1U << VDEV_LIST_HASHBITS)
+/* the vdevs on bus 0, where the most of them sit, are looked up by devfn */
+#define VDEV_BUS0_DEVFNS   256U
 
 struct pci_vbar {
 	bool is_mem64hi;	/* this is to indicate the high part of 64 bits MMIO bar */
@@ -43,6 +46,7 @@ struct pci_vbar {
 	uint64_t size;		/* BAR size */
 	uint64_t base_gpa;	/* BAR guest physical address */
 	uint64_t base_hpa;	/* BAR host physical address */
+	uint64_t mapped_gpa;	/* where the EPT maps the passthrough BAR, base_gpa once an update is committed */
 	union pci_bar_type bar_type; /* the low 2(PIO)/4(MMIO) bits of BAR */
 	uint32_t mask;		/* BAR size mask */
 };
@@ -81,6 +85,15 @@ struct pci_msix {
 	uint32_t  table_count;
 	bool      is_vmsix_on_msi;
 	bool	  is_vmsix_on_msi_programmed;
+	/* with the table, the PBA of a relocated vMSI-X is at pba_offset, read from pba_hpa */
+	bool      is_relocated;
+	uint32_t  pba_offset;
+	uint64_t  pba_hpa;
+	/* a read-only copy of the table page mapped to the VM at table_shadow_gpa, only the writes trap */
+	struct page *table_shadow;
+	uint64_t  table_shadow_gpa;
+	/* the entries whose address and data are programmed, from the last remap */
+	uint64_t  remapped[INT_DIV_ROUNDUP(CONFIG_MAX_MSIX_TABLE_NUM, 64U)];
 };
 
 /* SRIOV capability structure */
@@ -93,6 +106,9 @@ struct pci_cap_sriov {
 	 * the bar information that is using to initialize SRIOV VF vdev bar.
 	 */
 	struct pci_vbar vbars[PCI_BAR_COUNT];
+
+	/* set while its VFs are enabled, they are then attached to the IOMMU domain at once */
+	bool enabling_vfs;
 };
 
 union pci_cfgdata {
@@ -171,6 +187,16 @@ struct pci_mmio_res {
 	uint64_t end;
 };
 
+/* the device model vdevs of a VM the config space can be shadowed of */
+#define VPCI_CFG_SHADOW_NUM	32U
+
+struct vpci_cfg_shadow {
+	bool valid;
+	union pci_bdf bdf;
+	uint64_t dm_dwords;
+	uint32_t cfg[ACRN_PCI_CFG_SHADOW_DWORDS];
+};
+
 struct acrn_vpci {
 	spinlock_t lock;
 	union pci_cfg_addr_reg addr;
@@ -180,6 +206,8 @@ struct acrn_vpci {
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
 	uint64_t vdev_bitmaps[INT_DIV_ROUNDUP(CONFIG_MAX_PCI_DEV_NUM, 64U)];
 	struct hlist_head vdevs_hlist_heads [VDEV_LIST_HASHSIZE];
+	struct pci_vdev *bus0_vdevs[VDEV_BUS0_DEVFNS];	/* vdevs of bus 0 found first in the hash list, by devfn */
+	struct vpci_cfg_shadow cfg_shadows[VPCI_CFG_SHADOW_NUM];
 };
 
 struct acrn_vm;
@@ -192,9 +220,11 @@ void deinit_vpci(struct acrn_vm *vm);
 struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf);
 struct acrn_pcidev;
 int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev);
+int32_t vpci_set_cfg_shadow(struct acrn_vm *vm, const struct acrn_vdev_cfg_shadow *shadow);
 int32_t vpci_deassign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev);
 struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_config *dev_config, struct pci_vdev *parent_pf_vdev);
 void vpci_deinit_vdev(struct pci_vdev *vdev);
+uint32_t vpci_free_vdev_slots(const struct acrn_vpci *vpci);
 
 static inline bool is_pci_io_bar(struct pci_vbar *vbar)
 {
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VPIT_H
+#define VPIT_H
+
+#include <asm/lib/spinlock.h>
+#include <timer.h>
+
+/**
+ * @addtogroup vp-dm_vperipheral
+ *
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Definitions for the virtual PIT device.
+ *
+ * This file defines types and data structure for the virtual i8254 PIT device, emulated in the hypervisor for the
+ * post-launched VMs with GUEST_FLAG_VPIT instead of in the device model.
+ */
+
+#define VPIT_NUM_CHANNELS	3U
+
+/**
+ * @brief Data structure to illustrate a channel of the virtual PIT device.
+ */
+struct vpit_channel {
+	uint8_t		mode;		/**< Counter mode. */
+	uint32_t	initial;	/**< Initial counter value. */
+	uint64_t	start_tsc;	/**< TSC when the counter was loaded. */
+	uint8_t		cr[2];		/**< Count register, LSB and MSB. */
+	uint8_t		ol[2];		/**< Output latch, MSB and LSB. */
+	bool		nullcnt;	/**< Whether the count register is yet to be loaded into the counter. */
+	bool		slatched;	/**< Whether the status is latched. */
+	uint8_t		status;		/**< Status latched. */
+	uint32_t	crbyte;		/**< Bytes of the count register written. */
+	uint32_t	olbyte;		/**< Bytes of the output latch left to read. */
+	uint32_t	frbyte;		/**< Byte of the free running counter read next, 0 for the LSB. */
+};
+
+/**
+ * @brief Data structure to illustrate a virtual PIT device.
+ *
+ * The counters are computed from the TSC, the interrupts of channel 0 are driven by a timer of the hypervisor on
+ * the pCPU of the BSP: a channel 0 programmed on another pCPU only updates its expires, that a softirq there moves
+ * the timer of the hypervisor to.
+ *
+ * @consistency self.vm->vpit == self
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct acrn_vpit {
+	struct acrn_vm	*vm;		/**< Pointer to the VM that owns the virtual PIT device. */
+	spinlock_t	lock;		/**< Lock of the channels. */
+	bool		active;		/**< Whether the guest accesses are emulated. */
+	volatile bool	resync;		/**< Whether the timer of the hypervisor is to be moved to the expires. */
+	uint16_t	pcpu_id;	/**< pCPU the timer of the hypervisor is on. */
+	uint64_t	expires;	/**< TSC of the next interrupt of channel 0, 0 if not counting. */
+	uint64_t	period;		/**< TSC cycles between the interrupts of channel 0, 0 if aperiodic. */
+	struct hv_timer	timer;		/**< Timer of the hypervisor of channel 0. */
+	struct vpit_channel channel[VPIT_NUM_CHANNELS];	/**< Channels of the device. */
+};
+
+/**
+ * @}
+ */
+
+#endif /* VPIT_H */
@@ -61,6 +61,38 @@
 #define COM3_IRQ		6U
 #define COM4_IRQ		7U
 
+/*
+ * Paravirtual bank of the vuart, selected by writing VUART_LCR_PV_BANK to the LCR: DLAB with a break condition,
+ * which no 16550 driver programs. A driver aware of it reads the signature and the THR burst size there, and may
+ * register a page of its memory as a TX/RX ring. With the ring enabled and DLAB clear, a write to the SCR is the
+ * doorbell: the hypervisor moves the whole TX ring to the target (or the console) and refills the RX ring, instead
+ * of one port I/O exit per byte. The other registers keep the 16550 semantics.
+ */
+#define VUART_LCR_PV_BANK	0xC3U
+#define VUART_PV_ID		0x00U	/* (R) VUART_PV_SIGNATURE */
+#define VUART_PV_BURST		0x01U	/* (R) bytes the THR takes per THRE interrupt, 16 on a 16550 */
+#define VUART_PV_CTRL		0x02U	/* (R/W) VUART_PV_CTRL_RING_EN */
+#define VUART_PV_RING_GFN	0x04U	/* (R/W) 0x04-0x07, guest page frame number of the ring, LSB first */
+
+#define VUART_PV_SIGNATURE	0xACU
+#define VUART_PV_TX_BURST	64U	/* the room fifo_isfull() keeps in the RX FIFO of the target */
+#define VUART_PV_CTRL_RING_EN	(1U << 0U)
+
+#define VUART_PV_RING_SIZE	1024U
+
+/*
+ * The ring, in a page of the guest memory. The indexes are free running, the guest produces TX and consumes RX,
+ * the hypervisor the other way round; the data of each direction is in [cons, prod) modulo VUART_PV_RING_SIZE.
+ */
+struct vuart_pv_ring {
+	uint32_t tx_prod;
+	uint32_t tx_cons;
+	uint32_t rx_prod;
+	uint32_t rx_cons;
+	char tx[VUART_PV_RING_SIZE];
+	char rx[VUART_PV_RING_SIZE];
+};
+
 struct vuart_fifo {
 	char *buf;
 	uint32_t rindex;	/* index to read from */
@@ -100,6 +132,9 @@ struct acrn_vuart {
 	bool thre_int_pending; /**< Whether Transmitter Holding Register Empty(THRE) interrupt is pending. */
 	bool active; /**< Whether the vuart is active. */
 	bool escaping; /**< Whether in escaping sequence, only for console vuarts. */
+	uint32_t pv_ring_gfn; /**< Guest page frame number of the ring, written to the paravirtual bank. */
+	volatile struct vuart_pv_ring *pv_ring; /**< Ring of the paravirtual mode, NULL if not enabled. */
+	bool pv_rx_pending; /**< Whether the RX ring was filled since the IIR was last read. */
 	struct acrn_vuart *target_vu; /**< Pointer to target vuart */
 	struct acrn_vm *vm; /**< Pointer to the VM that owns the virtual UART device. */
 	struct pci_vdev *vdev; /**< Pointer to the PCI device, only for a PCI vuart. */
@@ -27,12 +27,16 @@
 
 #define ACRN_IO_REQUEST_MAX		16U
 #define ACRN_ASYNCIO_MAX		64U
+#define ACRN_POSTED_IO_RANGE_MAX	16U
 
 #define ACRN_IOREQ_STATE_PENDING	0U
 #define ACRN_IOREQ_STATE_COMPLETE	1U
 #define ACRN_IOREQ_STATE_PROCESSING	2U
 #define ACRN_IOREQ_STATE_FREE		3U
 
+/* Features of the I/O request buffer, in req_slot[0].buf_features */
+#define ACRN_IOREQ_BUF_PENDING_MASK	(1U << 0U)
+
 #define ACRN_IOREQ_TYPE_PORTIO		0U
 #define ACRN_IOREQ_TYPE_MMIO		1U
 #define ACRN_IOREQ_TYPE_PCICFG		2U
@@ -66,6 +70,13 @@
 #define GUEST_FLAG_VHWP				(1UL << 12U)    /* Whether the VM supports vHWP */
 #define GUEST_FLAG_VTM				(1UL << 13U)    /* Whether the VM supports virtual thermal monitor */
 #define GUEST_FLAG_STATELESS			(1UL << 14U)	/* Whether the VM is stateless (can be forcefully shutdown with no data loss) */
+#define GUEST_FLAG_IO_COMPLETION_HYBRID		(1UL << 15U)	/* Whether hypervisor spins on IO completion before sleeping */
+#define GUEST_FLAG_VCPU_MIGRATION		(1UL << 16U)	/* Whether vCPUs may migrate among the pCPUs of cpu_affinity */
+#define GUEST_FLAG_PV_IPI			(1UL << 17U)	/* Whether the VM may use the paravirtual IPI and TLB flush */
+#define GUEST_FLAG_VMX_PREEMPT_TIMER		(1UL << 18U)	/* Whether the TSC deadline timer is backed by the VMX preemption timer */
+#define GUEST_FLAG_VHPET			(1UL << 19U)	/* Whether the HPET is emulated by hypervisor instead of device model */
+#define GUEST_FLAG_VPIT			(1UL << 20U)	/* Whether the PIT is emulated by hypervisor instead of device model */
+#define GUEST_FLAG_MWAIT_PASSTHROUGH		(1UL << 21U)	/* Whether MONITOR/MWAIT run natively in the VM */
 
 /* TODO: We may need to get this addr from guest ACPI instead of hardcode here */
 #define VIRTUAL_SLEEP_CTL_ADDR		0x400U /* Pre-launched VM uses ACPI reduced HW mode and sleep control register */
@@ -300,7 +311,48 @@ struct acrn_io_request {
 	 *
 	 * Byte offset: 8.
 	 */
-	uint32_t reserved0[14];
+	uint32_t reserved0[2];
+
+	/**
+	 * @brief TSC when the hypervisor made the request pending.
+	 *
+	 * Byte offset: 16.
+	 */
+	uint64_t tsc_insert;
+
+	/**
+	 * @brief TSC when the device model picked up the request.
+	 *
+	 * Stamped by the device model, 0 if it doesn't trace the requests.
+	 *
+	 * Byte offset: 24.
+	 */
+	uint64_t tsc_pickup;
+
+	/**
+	 * @brief TSC when the device model handler was done with the request.
+	 *
+	 * Byte offset: 32.
+	 */
+	uint64_t tsc_handled;
+
+	/**
+	 * @brief TSC when the hypervisor completed the request.
+	 *
+	 * Only stamped for the requests with tsc_handled set. It is kept when
+	 * the next request of the vCPU is made pending, which is where the
+	 * device model reads it.
+	 *
+	 * Byte offset: 40.
+	 */
+	uint64_t tsc_complete;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 48.
+	 */
+	uint32_t reserved2[4];
 
 	/**
 	 * @brief Details about this request.
@@ -336,6 +388,35 @@ struct acrn_io_request {
 	 * Byte offset: 136.
 	 */
 	uint32_t processed;
+
+	/**
+	 * @brief Features of the request buffer, ACRN_IOREQ_BUF_xxx.
+	 *
+	 * Only used in req_slot[0], set by the hypervisor when the buffer is
+	 * registered. It stays 0 with a hypervisor that does not know it.
+	 *
+	 * Byte offset: 192.
+	 */
+	uint32_t buf_features __aligned(64);
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 196.
+	 */
+	uint32_t reserved3;
+
+	/**
+	 * @brief Slots the hypervisor made PENDING, bit n for req_slot[n].
+	 *
+	 * Only used in req_slot[0], with ACRN_IOREQ_BUF_PENDING_MASK set. The
+	 * hypervisor sets the bit before the state of the slot turns PENDING;
+	 * the device model clears it when it takes the request, so a set bit
+	 * may be stale but a PENDING slot always has its bit set.
+	 *
+	 * Byte offset: 200.
+	 */
+	uint64_t pending_mask;
 } __aligned(256);
 
 struct acrn_io_request_buffer {
@@ -353,6 +434,356 @@ struct acrn_asyncio_info {
 	uint64_t data;
 };
 
+/**
+ * @brief Element of the ACRN_ASYNCIO shared buffer carrying the write payload
+ *
+ * The fd cookie stays the first field, so an asyncio sbuf set up with
+ * ele_size == sizeof(uint64_t) keeps receiving the bare fd as before. When
+ * the sbuf is set up with ele_size == sizeof(struct acrn_asyncio_entry), the
+ * address, width and value of the guest write come along with the kick.
+ */
+struct acrn_asyncio_entry {
+	/** fd cookie of the matched asyncio descriptor */
+	uint64_t fd;
+	/** written address, port number for ACRN_ASYNCIO_PIO */
+	uint64_t addr;
+	/** written value */
+	uint64_t data;
+	/** ACRN_ASYNCIO_PIO or ACRN_ASYNCIO_MMIO */
+	uint32_t type;
+	/** access width in bytes */
+	uint32_t size;
+};
+
+/**
+ * @brief Info of a write-posted I/O range, the parameter for
+ * HC_POSTED_IO_ASSIGN/HC_POSTED_IO_DEASSIGN hypercalls
+ *
+ * Guest writes that hit a posted range are queued in the ACRN_POSTED_IO
+ * shared buffer and the vCPU resumes without waiting for the DM. Reads
+ * from a posted range are still delivered as synchronous I/O requests.
+ */
+struct acrn_posted_io_range {
+	/** ACRN_IOREQ_TYPE_PORTIO or ACRN_IOREQ_TYPE_MMIO */
+	uint32_t type;
+	uint32_t reserved;
+	/** start address of the range */
+	uint64_t addr;
+	/** length of the range in bytes */
+	uint64_t len;
+};
+
+/**
+ * @brief Element of the ACRN_POSTED_IO shared buffer, one posted write
+ */
+struct acrn_posted_io {
+	/** ACRN_IOREQ_TYPE_PORTIO or ACRN_IOREQ_TYPE_MMIO */
+	uint32_t type;
+	/** vCPU that issued the write */
+	uint16_t vcpu_id;
+	/** access width in bytes */
+	uint16_t size;
+	uint64_t addr;
+	uint64_t value;
+	uint64_t reserved;
+};
+
+#define ACRN_VMEXIT_REASON_MAX		75U
+#define ACRN_VMEXIT_HIST_BUCKETS	16U
+/* Fold exits faster than 2^ACRN_VMEXIT_HIST_SHIFT cycles into bucket 0 */
+#define ACRN_VMEXIT_HIST_SHIFT		9U
+
+/**
+ * @brief Accumulated cost of one VM exit reason on one vCPU
+ *
+ * Bucket i of hist counts the exits which took [2^(i+8), 2^(i+9)) TSC
+ * cycles to handle. Bucket 0 also counts shorter exits and the last bucket
+ * also counts longer ones.
+ */
+struct acrn_vmexit_stat {
+	uint64_t count;
+	uint64_t cycles;
+	uint32_t hist[ACRN_VMEXIT_HIST_BUCKETS];
+};
+
+#define ACRN_VMEXIT_STAT_RESET		(1U << 0U)
+
+/**
+ * @brief Query of the VM exit statistics of a vCPU, the parameter for
+ * HC_GET_VMEXIT_STAT hypercall
+ */
+struct acrn_vmexit_stats {
+	/** [in] vCPU to query */
+	uint16_t vcpu_id;
+	/** [in] ACRN_VMEXIT_STAT_RESET clears the counters after the read */
+	uint16_t flags;
+	/** [in] capacity of the stat array, [out] number of entries filled */
+	uint32_t nr_reasons;
+	/** [in] GPA of a struct acrn_vmexit_stat array indexed by basic exit reason */
+	uint64_t stat_gpa;
+} __aligned(8);
+
+/* acrn_pv_vcpu_state.preempted: the vCPU is switched out */
+#define ACRN_PV_VCPU_PREEMPTED		(1U << 0U)
+/* acrn_pv_vcpu_state.preempted: flush the TLB of the vCPU before it runs again */
+#define ACRN_PV_VCPU_FLUSH_TLB		(1U << 1U)
+
+/**
+ * @brief State of a vCPU shared with the guest, registered by the
+ * HC_PV_SET_VCPU_STATE hypercall
+ *
+ * ACRN_PV_VCPU_PREEMPTED is set when the vCPU is switched out, and cleared
+ * when it is switched in again. Instead of sending a TLB shootdown IPI to a
+ * vCPU seen preempted, the guest sets ACRN_PV_VCPU_FLUSH_TLB by a
+ * compare-and-exchange from ACRN_PV_VCPU_PREEMPTED: the TLB of the vCPU is
+ * flushed before its next VM entry.
+ */
+struct acrn_pv_vcpu_state {
+	uint32_t preempted;
+	uint32_t reserved[15];
+} __aligned(64);
+
+/*
+ * MSR a guest writes the GPA of its struct acrn_steal_time to, 64-byte
+ * aligned, with ACRN_STEAL_TIME_ENABLE set. Writing 0 stops the updates.
+ */
+#define MSR_ACRN_STEAL_TIME		0x41435200U
+#define ACRN_STEAL_TIME_ENABLE		(1UL << 0U)
+
+/**
+ * @brief Steal time of a vCPU shared with the guest, registered by
+ * MSR_ACRN_STEAL_TIME
+ *
+ * Updated on each switch in and out of the vCPU. version is odd while the
+ * hypervisor updates the other fields: the guest reads them between two
+ * reads of the same, even version. The times are in TSC cycles, the TSC
+ * frequency is in EAX of CPUID leaf 0x40000010, in kHz.
+ */
+struct acrn_steal_time {
+	uint32_t version;
+	/** 1 if the vCPU was switched out while runnable, 0 if it runs or blocks */
+	uint32_t preempted;
+	/** time the vCPU ran */
+	uint64_t run;
+	/** time the vCPU was runnable but waited for its pCPU */
+	uint64_t steal;
+	uint64_t reserved[5];
+} __aligned(64);
+
+/**
+ * @brief Steal time of a vCPU, in the array of HC_GET_STEAL_TIME
+ */
+struct acrn_vcpu_steal_time {
+	uint64_t run;
+	uint64_t steal;
+	uint32_t preempted;
+	uint32_t reserved;
+};
+
+/**
+ * @brief Query of the steal time of the vCPUs of a VM, the parameter for
+ * HC_GET_STEAL_TIME hypercall
+ */
+struct acrn_steal_time_stats {
+	/** [in] capacity of the stat array, [out] number of vCPUs filled */
+	uint16_t nr_vcpus;
+	uint16_t reserved[3];
+	/** [out] TSC frequency in kHz to convert the cycles */
+	uint64_t tsc_khz;
+	/** [in] GPA of a struct acrn_vcpu_steal_time array indexed by vCPU ID */
+	uint64_t stat_gpa;
+} __aligned(8);
+
+/* counters of struct acrn_rdt_mon */
+#define ACRN_RDT_MON_OCCUPANCY		(1U << 0U)
+#define ACRN_RDT_MON_TOTAL_BW		(1U << 1U)
+#define ACRN_RDT_MON_LOCAL_BW		(1U << 2U)
+
+/**
+ * @brief LLC occupancy and memory bandwidth of a VM in one L3 domain, the
+ * parameter for HC_GET_RDT_MON hypercall
+ *
+ * The counters are in units of upscale bytes. The bandwidth counters count
+ * the traffic of the VM since its RMID was assigned and wrap at 2^width, the
+ * bandwidth is the difference of two samples over the difference of their tsc.
+ */
+struct acrn_rdt_mon {
+	/** [in] VM to sample, its ID in the scenario, pre-launched VMs included */
+	uint16_t vm_id;
+	/** [in] a pCPU of the L3 domain to sample */
+	uint16_t pcpu_id;
+	/** [out] ACRN_RDT_MON_* bits of the counters sampled */
+	uint32_t flags;
+	/** [out] RMID of the VM */
+	uint32_t rmid;
+	/** [out] width of the bandwidth counters in bits */
+	uint32_t width;
+	/** [out] bytes per unit of the counters */
+	uint64_t upscale;
+	uint64_t llc_occupancy;
+	uint64_t mbm_total;
+	uint64_t mbm_local;
+	/** [out] TSC of the sample */
+	uint64_t tsc;
+	/** [out] TSC frequency in kHz */
+	uint64_t tsc_khz;
+} __aligned(8);
+
+/* resources of struct acrn_rdt_clos */
+#define ACRN_RDT_RES_L3			1U
+#define ACRN_RDT_RES_L2			2U
+#define ACRN_RDT_RES_MBA		3U
+
+/**
+ * @brief Cache mask or MBA delay of a CLOS, the parameter for HC_SET_RDT_CLOS hypercall
+ *
+ * The CLOSes of the RT VMs and of the VMs with vCAT are not changed, and the
+ * cache masks of the other CLOSes may not overlap those of the RT VMs.
+ */
+struct acrn_rdt_clos {
+	/** [in] ACRN_RDT_RES_* */
+	uint16_t res;
+	/** [in] a pCPU of the cache, or of the MBA domain */
+	uint16_t pcpu_id;
+	/** [in] index of the MSR from IA32_L3_MASK_0, IA32_L2_MASK_0 or
+	 *  IA32_MBA_0, two per CLOS with CDP (data then code) */
+	uint16_t clos;
+	uint16_t reserved;
+	/** [in] contiguous cache bit mask, or MBA delay */
+	uint32_t value;
+	/** [out] the previous one */
+	uint32_t old_value;
+} __aligned(8);
+
+/* phases of the hypervisor boot, indexes of acrn_boot_time.hv */
+#define ACRN_BOOT_HV_START		0U	/* entry of the BSP in C */
+#define ACRN_BOOT_PAGING		1U	/* hypervisor page tables on */
+#define ACRN_BOOT_ACPI			2U	/* ACPI tables parsed */
+#define ACRN_BOOT_TSC_CALIBRATED	3U
+#define ACRN_BOOT_IOMMU			4U	/* IOMMU initialized */
+#define ACRN_BOOT_PCI			5U	/* PCI devices enumerated */
+#define ACRN_BOOT_EPT_POOL		6U	/* EPT pages reserved */
+#define ACRN_BOOT_APS_UP		7U	/* all the APs started */
+#define ACRN_BOOT_PCPUS_READY		8U	/* all the pCPUs initialized */
+#define ACRN_BOOT_EFI_ENTRY		9U	/* entry of the EFI stub, before ACRN_BOOT_HV_START */
+#define ACRN_BOOT_EFI_IMAGES		10U	/* hypervisor and modules placed by the EFI stub */
+#define ACRN_BOOT_EFI_HANDOFF		11U	/* EFI stub building the multiboot info to jump to the hypervisor */
+#define ACRN_BOOT_PHASE_MAX		16U
+
+/* phases of the boot of a VM, indexes of acrn_vm_boot_time.phase */
+#define ACRN_VM_BOOT_CREATE		0U	/* creation started */
+#define ACRN_VM_BOOT_MEMMAP		1U	/* EPT built */
+#define ACRN_VM_BOOT_VCPUS		2U	/* vCPUs created */
+#define ACRN_VM_BOOT_LOADING		3U	/* loading of the guest images started, by the hypervisor */
+#define ACRN_VM_BOOT_LOADED		4U	/* guest images loaded, by the hypervisor */
+#define ACRN_VM_BOOT_START		5U	/* started */
+#define ACRN_VM_BOOT_PHASE_MAX		8U
+
+/**
+ * @brief TSC of the boot phases of a VM, in the array of HC_GET_BOOT_TIME
+ *
+ * The phases are recorded each time the VM is created, 0 for the phases not
+ * reached.
+ */
+struct acrn_vm_boot_time {
+	uint64_t phase[ACRN_VM_BOOT_PHASE_MAX];
+	/** bytes of the guest images copied by the hypervisor */
+	uint64_t copied;
+	/** bytes of the guest images found at their guest address already */
+	uint64_t in_place;
+	/** most pCPUs an image was copied by at once */
+	uint32_t copy_pcpus;
+	uint32_t reserved;
+};
+
+/**
+ * @brief TSC of the boot phases of the hypervisor and its VMs, the parameter
+ * for HC_GET_BOOT_TIME hypercall
+ */
+struct acrn_boot_time {
+	/** [in] capacity of the VM array, [out] number of entries filled */
+	uint32_t nr_vms;
+	uint32_t reserved;
+	/** [in] GPA of a struct acrn_vm_boot_time array indexed by VM id */
+	uint64_t vm_gpa;
+	/** [out] TSC frequency in kHz */
+	uint64_t tsc_khz;
+	/** [out] TSC of each ACRN_BOOT_* phase, 0 for the phases not reached */
+	uint64_t hv[ACRN_BOOT_PHASE_MAX];
+} __aligned(8);
+
+/* event classes of the hypervisor trace */
+#define ACRN_TRACE_CLASS_TIMER		(1U << 0U)
+#define ACRN_TRACE_CLASS_IRQ		(1U << 1U)
+#define ACRN_TRACE_CLASS_VMEXIT		(1U << 2U)
+#define ACRN_TRACE_CLASS_SCHED		(1U << 3U)
+#define ACRN_TRACE_CLASS_IOREQ		(1U << 4U)
+#define ACRN_TRACE_CLASS_PTIRQ		(1U << 5U)
+#define ACRN_TRACE_CLASS_OTHER		(1U << 6U)
+#define ACRN_TRACE_CLASS_ALL		0x7FU
+
+/**
+ * @brief Filter of the hypervisor trace events
+ *
+ * the parameter for HC_SET_TRACE_FILTER hypercall
+ */
+struct acrn_trace_filter {
+	/** ACRN_TRACE_CLASS_* bits of the event classes to trace */
+	uint32_t class_mask;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** bit n traces the events raised while a vCPU of VM n runs, events
+	 *  raised outside of a vCPU context are not filtered by VM */
+	uint64_t vm_mask;
+
+	/** bit n traces the ACRN_TRACE_CLASS_VMEXIT events of basic exit reason n */
+	uint64_t vmexit_mask[2];
+} __aligned(8);
+
+#define ACRN_SCHED_HIST_BUCKETS		20U
+/* Fold intervals shorter than 2^ACRN_SCHED_HIST_SHIFT cycles into bucket 0 */
+#define ACRN_SCHED_HIST_SHIFT		11U
+
+/**
+ * @brief Scheduling latency of one vCPU thread
+ *
+ * run_delay is the time the thread waited as runnable, after a wakeup or a
+ * preemption, until it was switched in. slice is the time it ran before it
+ * was switched out. Bucket i of a histogram counts the intervals of
+ * [2^(i+10), 2^(i+11)) TSC cycles, bucket 0 also counts shorter ones and the
+ * last bucket also counts longer ones.
+ */
+struct acrn_sched_stat {
+	uint64_t wakeups;
+	uint64_t preemptions;
+	uint64_t switches;
+	uint64_t run_delay_total;
+	uint64_t run_delay_max;
+	uint64_t slice_total;
+	uint32_t run_delay_hist[ACRN_SCHED_HIST_BUCKETS];
+	uint32_t slice_hist[ACRN_SCHED_HIST_BUCKETS];
+};
+
+#define ACRN_SCHED_STAT_RESET		(1U << 0U)
+
+/**
+ * @brief Query of the scheduling latency of a vCPU, the parameter for
+ * HC_GET_SCHED_STAT hypercall
+ */
+struct acrn_sched_stats {
+	/** [in] vCPU to query */
+	uint16_t vcpu_id;
+	/** [in] ACRN_SCHED_STAT_RESET clears the counters after the read */
+	uint16_t flags;
+	uint32_t reserved;
+	/** [out] TSC frequency in kHz to convert the cycles */
+	uint64_t tsc_khz;
+	/** [out] scheduling latency of the vCPU */
+	struct acrn_sched_stat stat;
+} __aligned(8);
+
 /**
  * @brief Info to create a VM, the parameter for HC_CREATE_VM hypercall
  */
@@ -467,6 +898,124 @@ struct acrn_vcpu_regs {
 	struct acrn_regs vcpu_regs;
 };
 
+/**
+ * @brief A segment register of a vCPU state
+ */
+struct acrn_segment_state {
+	uint64_t base;
+	uint32_t limit;
+	uint32_t attr;
+	uint16_t selector;
+	uint16_t reserved[3];
+};
+
+/**
+ * @brief The registers of a vCPU state, out of its LAPIC and XSAVE area
+ */
+struct acrn_cpu_state {
+	struct acrn_gp_regs gprs;
+	struct acrn_descriptor_ptr gdt;
+	struct acrn_descriptor_ptr idt;
+	struct acrn_segment_state cs;
+	struct acrn_segment_state ss;
+	struct acrn_segment_state ds;
+	struct acrn_segment_state es;
+	struct acrn_segment_state fs;
+	struct acrn_segment_state gs;
+	struct acrn_segment_state ldtr;
+	struct acrn_segment_state tr;
+
+	uint64_t rip;
+	uint64_t rflags;
+	uint64_t cr0;
+	uint64_t cr2;
+	uint64_t cr3;
+	uint64_t cr4;
+	uint64_t dr7;
+	uint64_t xcr0;
+	uint64_t ia32_efer;
+	uint64_t ia32_pat;
+	uint64_t ia32_debugctl;
+	uint64_t ia32_sysenter_esp;
+	uint64_t ia32_sysenter_eip;
+	uint64_t ia32_star;
+	uint64_t ia32_cstar;
+	uint64_t ia32_lstar;
+	uint64_t ia32_fmask;
+	uint64_t ia32_kernel_gs_base;
+	uint64_t ia32_xss;
+	uint64_t tsc_aux;
+	/** the guest TSC when the VM was paused */
+	uint64_t tsc;
+	uint64_t apicbase;
+	uint64_t tsc_deadline;
+	uint64_t reserved_64[4];
+
+	uint32_t ia32_sysenter_cs;
+	/** the guest interruptibility state of the VMCS */
+	uint32_t interruptibility;
+	/** the rate of the guest TSC in kHz, kept by a restore on a platform of another TSC rate */
+	uint32_t tsc_khz;
+	uint32_t reserved_32[1];
+};
+
+/** The vCPU ran: it is launched on restore, not left waiting for INIT/SIPI */
+#define ACRN_VCPU_STATE_LAUNCHED	(1UL << 0U)
+
+#define ACRN_VCPU_STATE_PAGE_SIZE	4096U
+
+/**
+ * @brief The state of a vCPU of a paused VM
+ *
+ * the parameter for HC_SAVE_VCPU_STATE and HC_RESTORE_VCPU_STATE
+ */
+struct acrn_vcpu_state {
+	/** the virtual CPU ID of the vCPU */
+	uint16_t vcpu_id;
+
+	uint16_t reserved[3];
+
+	/** ACRN_VCPU_STATE_* */
+	uint64_t flags;
+
+	struct acrn_cpu_state cpu;
+
+	/** the LAPIC registers, struct lapic_regs */
+	uint8_t lapic[ACRN_VCPU_STATE_PAGE_SIZE];
+
+	/** the XSAVES area, in the compacted format of the platform */
+	uint8_t xsave[ACRN_VCPU_STATE_PAGE_SIZE];
+
+	/** the vIOAPIC redirection table of the VM, saved and restored with vCPU 0 only */
+	uint64_t ioapic_rte[VIOAPIC_RTE_NUM];
+};
+
+/** Add a vCPU on a pCPU to a VM, for HC_HOTPLUG_VCPU */
+#define ACRN_VCPU_HOTPLUG_ADD		1U
+/** Remove the vCPU on a pCPU from a VM, for HC_HOTPLUG_VCPU */
+#define ACRN_VCPU_HOTPLUG_REMOVE	2U
+
+/**
+ * @brief Add or remove a vCPU of a running User VM
+ *
+ * the parameter for HC_HOTPLUG_VCPU hypercall
+ */
+struct acrn_vcpu_hotplug {
+	/** ACRN_VCPU_HOTPLUG_ADD or ACRN_VCPU_HOTPLUG_REMOVE */
+	uint32_t op;
+
+	/** the physical CPU the vCPU runs on, in the cpu_affinity of the VM */
+	uint16_t pcpu_id;
+
+	/** output: the virtual CPU ID of the added vCPU */
+	uint16_t vcpu_id;
+
+	/** output: the LAPIC ID of the added vCPU */
+	uint32_t lapic_id;
+
+	uint32_t reserved;
+};
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
@@ -497,6 +1046,38 @@ struct acrn_msi_entry {
 	uint64_t msi_data;
 };
 
+#define ACRN_MSI_RING_MAGIC	0x474e495249534d41UL	/* "AMSIRING" */
+#define ACRN_MSI_RING_MAX	128U
+
+/**
+ * @brief Ring of the MSIs the DM raises for a VM, in a page shared with the hypervisor
+ *
+ * the ACRN_MSI_RING shared buffer, set up by HC_SETUP_SBUF. The DM writes
+ * the MSIs into the entries and publishes them by moving prod, the
+ * hypervisor injects them and moves cons. It takes them on the exits of the
+ * Service VM and from an idle pCPU polling the rings. No pCPU polls the ring
+ * while doorbell is set: the DM then calls HC_NOTIFY_MSI_RING after
+ * publishing, the hypervisor checks the ring again after setting it.
+ */
+struct acrn_msi_ring {
+	uint64_t magic;
+	/** a power of 2, ACRN_MSI_RING_MAX at most */
+	uint32_t nr_entries;
+	uint32_t reserved0[13];
+
+	/** written by the DM, the entries before it are published */
+	uint32_t prod;
+	uint32_t reserved1[15];
+
+	/** written by the hypervisor, the entries before it are injected */
+	uint32_t cons;
+	/** written by the hypervisor, the DM calls HC_NOTIFY_MSI_RING if set */
+	uint32_t doorbell;
+	uint32_t reserved2[14];
+
+	struct acrn_msi_entry entries[ACRN_MSI_RING_MAX];
+};
+
 /**
  * @brief Info The power state data of a VCPU.
  *
@@ -602,13 +1183,19 @@ struct acrn_intr_monitor {
 	/** the count of this buffer to save */
 	uint32_t buf_cnt;
 
-	/** the buffer which save each interrupt count */
+	/**
+	 * the buffer which save each interrupt count for INTR_CMD_GET_DATA,
+	 * buffer[0] is the delay in ms for INTR_CMD_DELAY_INT,
+	 * buffer[0] is the max interrupts per second (0 to cancel) and
+	 * buffer[1] the burst size for INTR_CMD_RATE_LIMIT
+	 */
 	uint64_t buffer[MAX_PTDEV_NUM * 2];
 } __aligned(8);
 
 /** cmd for intr monitor **/
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
+#define INTR_CMD_RATE_LIMIT 2U
 
 /*
  * PRE_LAUNCHED_VM is launched by ACRN hypervisor, with LAPIC_PT;
@@ -657,6 +1244,11 @@ struct vrp_config
 
 /* Type of PCI device assignment */
 #define ACRN_PTDEV_QUIRK_ASSIGN	(1U << 0)
+/*
+ * The vMSI-X table and PBA are moved to the first unused BAR, whose base is
+ * in bar[], so that the BAR holding the physical ones is mapped whole.
+ */
+#define ACRN_PTDEV_MSIX_RELOC	(1U << 1)
 
 #define ACRN_PCI_NUM_BARS	6U
 /**
@@ -744,6 +1336,38 @@ struct acrn_vdev {
 	uint8_t	args[128];
 };
 
+/** Dwords of the PCI config space a device model vdev can shadow */
+#define ACRN_PCI_CFG_SHADOW_DWORDS	64U
+
+/** Drop the shadow of the device instead of setting it */
+#define ACRN_PCI_CFG_SHADOW_CLEAR	(1U << 0U)
+
+/**
+ * @brief Read-only shadow of the config header of a device model vdev
+ *
+ * the parameter for HC_SET_VDEV_CFG_SHADOW hypercall. The hypervisor
+ * answers the guest reads of the config dwords whose bit is clear in
+ * dm_dwords from cfg, without an I/O request to the device model. Writes
+ * still go to the device model, and a written dword is not shadowed
+ * anymore.
+ */
+struct acrn_vdev_cfg_shadow {
+	/** the virtual BDF of the device */
+	uint16_t bdf;
+
+	/** ACRN_PCI_CFG_SHADOW_CLEAR, or 0 to set the shadow */
+	uint16_t flags;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** bit n set: the device model handles the dword at offset 4 * n */
+	uint64_t dm_dwords;
+
+	/** the config space of the device, standard header and capabilities */
+	uint32_t cfg[ACRN_PCI_CFG_SHADOW_DWORDS];
+};
+
 #define ACRN_ASYNCIO_PIO	(0x01U)
 #define ACRN_ASYNCIO_MMIO	(0x02U)
 
@@ -754,6 +1378,8 @@ struct acrn_vdev {
 /* sbuf flags */
 #define OVERRUN_CNT_EN	(1U << 0U) /* whether overrun counting is enabled */
 #define OVERWRITE_EN	(1U << 1U) /* whether overwrite is enabled */
+#define SBUF_VAR_LEN	(1U << 2U) /* records of variable length, see below */
+#define SBUF_NOTIFY_EN	(1U << 3U) /* raise the HSM upcall when filled up to watermark */
 
 /**
  * (sbuf) head + buf (store (ele_num - 1) elements at most)
@@ -769,6 +1395,11 @@ struct acrn_vdev {
  * |
  * |
  * struct shared_buf *buf
+ *
+ * With SBUF_VAR_LEN set, ele_size is ignored and every record starts with
+ * its own length in bytes (1 - 255). A record never wraps around the end of
+ * the buffer: a length byte of 0 means the rest of the buffer is padding and
+ * the next record is at offset 0.
  */
 
 enum {
@@ -780,6 +1411,8 @@ enum {
 	ACRN_SBUF_PER_PCPU_ID_MAX,
 	ACRN_ASYNCIO = 64,
 	ACRN_VM_EVENT,
+	ACRN_POSTED_IO,
+	ACRN_MSI_RING,
 };
 
 /* Make sure sizeof(struct shared_buf) == SBUF_HEAD_SIZE */
@@ -793,7 +1426,43 @@ struct shared_buf {
 	uint32_t reserved;
 	uint32_t overrun_cnt;	/* count of overrun */
 	uint32_t size;		/* ele_num * ele_size */
-	uint32_t padding[6];
+	uint32_t watermark;	/* fill level in bytes for SBUF_NOTIFY_EN */
+	uint32_t padding[5];
+};
+
+/*
+ * Profiling samples in the ACRN_SEP sbuf, with VM_TAGGED_SAMPLING or
+ * PEBS_PMU_SAMPLING set in the profiling control switches.
+ *
+ * A PMI writes one batch: the 32-byte profiling data header, with data_type
+ * (1 << VM_TAGGED_SAMPLING) and payload_size the exact size of the batch,
+ * then its samples back to back. Each struct acrn_profiling_sample is
+ * followed by nr_branches struct acrn_profiling_branch, the LBR call stack
+ * with the most recent branch first. The batch is zero padded to whole 32-byte
+ * sbuf elements.
+ */
+#define ACRN_PROFILING_HV_ID		0xFFFFU	/* vm_id of the samples in the hypervisor */
+
+#define ACRN_PROFILING_SRC_PMI		0U	/* counter overflow */
+#define ACRN_PROFILING_SRC_PEBS		1U	/* PEBS record */
+
+struct acrn_profiling_branch {
+	uint64_t from_ip;
+	uint64_t to_ip;
+};
+
+struct acrn_profiling_sample {
+	uint64_t tsc;
+	uint64_t rip;		/* guest RIP, or hypervisor RIP */
+	uint64_t cr3;		/* guest CR3, 0 in the hypervisor */
+	uint64_t overflow_status;	/* IA32_PERF_GLOBAL_STATUS, or the PEBS applicable counters */
+	uint64_t rflags;
+	uint16_t vm_id;
+	uint16_t vcpu_id;
+	uint16_t pcpu_id;
+	uint8_t source;
+	uint8_t nr_branches;
+	uint64_t reserved[2];
 };
 
 /**
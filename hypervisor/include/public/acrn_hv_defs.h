@@ -29,6 +29,8 @@
 #define HC_GET_API_VERSION          BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x00UL)
 #define HC_SERVICE_VM_OFFLINE_CPU   BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x01UL)
 #define HC_SET_CALLBACK_VECTOR      BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x02UL)
+#define HC_MULTICALL                BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x03UL)
+#define HC_SERVICE_VM_ONLINE_CPU    BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x04UL)
 
 /* VM management */
 #define HC_ID_VM_BASE               0x10UL
@@ -39,12 +41,16 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_SAVE_VCPU_STATE          BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
+#define HC_RESTORE_VCPU_STATE       BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x08UL)
+#define HC_HOTPLUG_VCPU             BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x09UL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
 #define HC_INJECT_MSI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x03UL)
 #define HC_VM_INTR_MONITOR          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x04UL)
 #define HC_SET_IRQLINE              BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x05UL)
+#define HC_NOTIFY_MSI_RING          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x06UL)
 
 /* DM ioreq management */
 #define HC_ID_IOREQ_BASE            0x30UL
@@ -52,6 +58,9 @@
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
 #define HC_ASYNCIO_ASSIGN           BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
 #define HC_ASYNCIO_DEASSIGN         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_POSTED_IO_ASSIGN         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
+#define HC_POSTED_IO_DEASSIGN       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x05UL)
+#define HC_NOTIFY_REQUEST_FINISH_BATCH BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x06UL)
 
 
 /* Guest memory management */
@@ -60,6 +69,9 @@
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
 #define HC_SETUP_SBUF               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_DIRTY_LOG             BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
+#define HC_VM_WSS                   BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x06UL)
+#define HC_VM_GPA2HPA_EXTENTS       BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x07UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -74,12 +86,18 @@
 #define HC_DEASSIGN_MMIODEV         BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x08UL)
 #define HC_ADD_VDEV                 BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x09UL)
 #define HC_REMOVE_VDEV              BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x0AUL)
+#define HC_SET_VDEV_CFG_SHADOW      BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x0BUL)
 
 /* DEBUG */
 #define HC_ID_DBG_BASE              0x60UL
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
 #define HC_GET_HW_INFO              BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_GET_VMEXIT_STAT          BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
+#define HC_GET_SCHED_STAT           BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x05UL)
+#define HC_SET_TRACE_FILTER         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x06UL)
+#define HC_GET_STEAL_TIME           BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x07UL)
+#define HC_GET_BOOT_TIME            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x08UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
@@ -96,6 +114,16 @@
 #define HC_TEE_VCPU_BOOT_DONE	    BASE_HC_ID(HC_ID, HC_ID_TEE_BASE + 0x00UL)
 #define HC_SWITCH_EE		    BASE_HC_ID(HC_ID, HC_ID_TEE_BASE + 0x01UL)
 
+/* Paravirtual interfaces of the guests with GUEST_FLAG_PV_IPI */
+#define HC_ID_PV_BASE               0xA0UL
+#define HC_PV_SEND_IPI              BASE_HC_ID(HC_ID, HC_ID_PV_BASE + 0x00UL)
+#define HC_PV_SET_VCPU_STATE        BASE_HC_ID(HC_ID, HC_ID_PV_BASE + 0x01UL)
+
+/* Resource Director Technology */
+#define HC_ID_RDT_BASE              0xB0UL
+#define HC_GET_RDT_MON              BASE_HC_ID(HC_ID, HC_ID_RDT_BASE + 0x00UL)
+#define HC_SET_RDT_CLOS             BASE_HC_ID(HC_ID, HC_ID_RDT_BASE + 0x01UL)
+
 #define ACRN_INVALID_VMID (0xffffU)
 #define ACRN_INVALID_HPA (~0UL)
 
@@ -168,6 +196,30 @@ struct set_regions {
 	uint64_t regions_gpa;
 } __aligned(8);
 
+/** the most entries of an HC_MULTICALL */
+#define ACRN_MULTICALL_MAX_ENTRIES	64UL
+
+/**
+ * @brief An entry of HC_MULTICALL
+ *
+ * the parameter for HC_MULTICALL hypercall is the gpa of an array of them,
+ * and their number. Each hypercall is done with its param1 and param2 as if
+ * it was issued on its own, its return value is written back to result.
+ */
+struct acrn_multicall_entry {
+	/** the hypercall to do, one of the Service VM managing the other VMs */
+	uint64_t hcall_id;
+
+	/** its first parameter */
+	uint64_t param1;
+
+	/** its second parameter */
+	uint64_t param2;
+
+	/** its return value, set by the hypervisor */
+	int64_t result;
+} __aligned(8);
+
 /**
  * @brief Info to change guest one page write protect permission
  *
@@ -186,6 +238,76 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+#define ACRN_DIRTY_LOG_START	0U
+#define ACRN_DIRTY_LOG_STOP	1U
+#define ACRN_DIRTY_LOG_GET	2U
+
+/**
+ * @brief Info to control the dirty logging of guest memory
+ *
+ * the parameter for HC_VM_DIRTY_LOG hypercall
+ */
+struct acrn_dirty_log {
+	/** ACRN_DIRTY_LOG_START, ACRN_DIRTY_LOG_STOP or ACRN_DIRTY_LOG_GET */
+	uint32_t cmd;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/**
+	 * the guest physical address of the range, page aligned.
+	 * For ACRN_DIRTY_LOG_GET, a multiple of 64 pages from the start of the log
+	 */
+	uint64_t gpa;
+
+	/** size of the range, a multiple of the page size */
+	uint64_t size;
+
+	/**
+	 * Service VM's guest physical address of a bitmap, one bit per page of the range.
+	 * ACRN_DIRTY_LOG_START: the log itself, contiguous, used by the hypervisor till
+	 * ACRN_DIRTY_LOG_STOP. ACRN_DIRTY_LOG_GET: where the dirty bits are copied to.
+	 */
+	uint64_t bitmap_gpa;
+
+	/** the number of dirty pages got by ACRN_DIRTY_LOG_GET */
+	uint64_t nr_dirty;
+} __aligned(8);
+
+#define ACRN_WSS_START		0U
+#define ACRN_WSS_STOP		1U
+#define ACRN_WSS_SCAN		2U
+
+/* the ages of the memory, in scans, the last one for this age and more */
+#define ACRN_WSS_AGES		16U
+/* the working set over the last 1, 2, 4 and 8 scans */
+#define ACRN_WSS_WINDOWS	4U
+
+/**
+ * @brief Info to control the working set estimation of a VM
+ *
+ * the parameter for HC_VM_WSS hypercall
+ */
+struct acrn_wss {
+	/** ACRN_WSS_START, ACRN_WSS_STOP or ACRN_WSS_SCAN */
+	uint32_t cmd;
+
+	/** ACRN_WSS_START: the shortest time between two scans, in ms */
+	uint32_t min_interval_ms;
+
+	/** the number of scans since ACRN_WSS_START */
+	uint64_t nr_scans;
+
+	/** the time between the last two scans, in us */
+	uint64_t last_interval_us;
+
+	/** bytes of memory not accessed for i scans, as of the last scan */
+	uint64_t idle_bytes[ACRN_WSS_AGES];
+
+	/** bytes of memory accessed within the last 2^i scans */
+	uint64_t ws_bytes[ACRN_WSS_WINDOWS];
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
@@ -244,6 +366,47 @@ struct vm_gpa2hpa {
 	uint64_t hpa;
 } __aligned(8);
 
+/* the most guest memory HC_VM_GPA2HPA_EXTENTS translates at once, 64K 4K pages */
+#define ACRN_GPA2HPA_MAX_SIZE	(256UL << 20U)
+
+/**
+ * A guest physical range backed by contiguous host physical memory
+ */
+struct acrn_hpa_extent {
+	/** start of the range in the guest physical address space */
+	uint64_t gpa;
+
+	/** start of the range in the host physical address space */
+	uint64_t hpa;
+
+	/** size of the range, in bytes */
+	uint64_t size;
+} __aligned(8);
+
+/**
+ * @brief Info to translate a guest physical range to host physical extents
+ *
+ * the parameter for HC_VM_GPA2HPA_EXTENTS hypercall. The translation stops
+ * at the first unmapped page, once max_extents are filled or after
+ * ACRN_GPA2HPA_MAX_SIZE bytes; size then tells where to resume from.
+ */
+struct acrn_gpa2hpa_extents {
+	/** start of the guest physical range to translate */
+	uint64_t gpa;
+
+	/** in: size of the range, out: bytes translated into the extents */
+	uint64_t size;
+
+	/** Service VM GPA of an array of max_extents struct acrn_hpa_extent */
+	uint64_t extents_gpa;
+
+	/** the number of entries of the extents array */
+	uint32_t max_extents;
+
+	/** the number of extents filled */
+	uint32_t nr_extents;
+} __aligned(8);
+
 /**
  * Intr mapping info per ptdev, the parameter for HC_SET_PTDEV_INTR_INFO
  * hypercall
@@ -25,3 +25,9 @@ int32_t hcall_profiling_ops(__unused struct acrn_vcpu *vcpu, __unused struct acr
 {
 	return -EPERM;
 }
+
+int32_t hcall_set_trace_filter(__unused struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return -EPERM;
+}
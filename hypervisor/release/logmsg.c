@@ -5,8 +5,10 @@
  */
 
 #include <types.h>
+#include <logmsg.h>
 
 void init_logmsg() {}
 void do_logmsg(__unused uint32_t severity, __unused const char *fmt, ...) {}
 void printf(__unused const char *fmt, ...) {}
 void vprintf(__unused const char *fmt, __unused va_list args) {}
+bool logmsg_ratelimit(__unused struct log_ratelimit *rl) { return false; }
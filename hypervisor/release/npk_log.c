@@ -9,3 +9,5 @@
 
 void npk_log_setup(__unused struct hv_npk_log_param *param) {}
 void npk_log_write(__unused const char *buf, __unused size_t len) {}
+bool npk_trace_enabled(void) { return false; }
+void npk_trace_write(__unused uint16_t pcpu_id, __unused const uint8_t *rec, __unused uint32_t len) {}
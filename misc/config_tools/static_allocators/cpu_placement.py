@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024 Intel Corporation.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+import sys, os, logging
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
+from acrn_config_utilities import get_node
+
+def smt_siblings(board_etree, pcpu_id):
+    """Return the other hyper-threads of the core of a pCPU."""
+    siblings = board_etree.xpath(f"//processors//thread[cpu_id = '{pcpu_id}']/../thread/cpu_id/text()")
+    return set(int(x) for x in siblings) - {pcpu_id}
+
+def rt_pcpus(scenario_etree):
+    """
+    Return the pCPUs running real-time vCPUs: those marked real-time of the RTVMs, or all the pCPUs of an RTVM
+    which marks none.
+    """
+    pcpus = set()
+    for vm_node in scenario_etree.xpath("//vm[vm_type = 'RTVM']"):
+        rt = vm_node.xpath("./cpu_affinity/pcpu[real_time_vcpu = 'y']/pcpu_id/text()")
+        if not rt:
+            rt = vm_node.xpath("./cpu_affinity//pcpu_id/text()")
+        pcpus.update(int(x) for x in rt if x != '')
+    return pcpus
+
+def trim_service_vm_affinity(board_etree, scenario_etree, allocation_etree, rt_cpus):
+    """
+    Keep the Service VM, and so the device model and its I/O, off the hyper-threads of the cores running real-time
+    vCPUs. Only done when the Service VM CPU affinity is allocated rather than given by the scenario, and the Service
+    VM is left at least one pCPU.
+    """
+    vm_id = get_node("//vm[load_order = 'SERVICE_VM']/@id", scenario_etree)
+    if vm_id is None:
+        return
+
+    pcpu_nodes = allocation_etree.xpath(f"/acrn-config/vm[@id = '{vm_id}']/cpu_affinity/pcpu_id")
+    if not pcpu_nodes:
+        return
+
+    noisy = set()
+    for pcpu_id in rt_cpus:
+        noisy |= smt_siblings(board_etree, pcpu_id)
+    noisy -= rt_cpus
+
+    trimmed = [node for node in pcpu_nodes if int(node.text) in noisy]
+    if not trimmed or len(trimmed) == len(pcpu_nodes):
+        return
+
+    for node in trimmed:
+        node.getparent().remove(node)
+    logging.info(f"Service VM is kept off pCPU(s) {sorted(int(node.text) for node in trimmed)}, hyper-threads of real-time vCPUs.")
+
+def fn(board_etree, scenario_etree, allocation_etree):
+    rt_cpus = rt_pcpus(scenario_etree)
+    if not rt_cpus:
+        return
+
+    trim_service_vm_affinity(board_etree, scenario_etree, allocation_etree, rt_cpus)
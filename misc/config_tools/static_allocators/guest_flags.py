@@ -17,6 +17,11 @@ class GuestFlagPolicy(namedtuple("GuestFlagPolycy", ["condition", "guest_flag"])
 policies = [
     GuestFlagPolicy(".//lapic_passthrough = 'y'", "GUEST_FLAG_LAPIC_PASSTHROUGH"),
     GuestFlagPolicy(".//io_completion_polling = 'y'", "GUEST_FLAG_IO_COMPLETION_POLLING"),
+    GuestFlagPolicy(".//io_completion_hybrid = 'y'", "GUEST_FLAG_IO_COMPLETION_HYBRID"),
+    GuestFlagPolicy(".//vcpu_migration = 'y'", "GUEST_FLAG_VCPU_MIGRATION"),
+    GuestFlagPolicy(".//pv_ipi = 'y'", "GUEST_FLAG_PV_IPI"),
+    GuestFlagPolicy(".//vmx_preemption_timer = 'y'", "GUEST_FLAG_VMX_PREEMPT_TIMER"),
+    GuestFlagPolicy(".//mwait_passthrough = 'y' and .//own_pcpu = 'y'", "GUEST_FLAG_MWAIT_PASSTHROUGH"),
     GuestFlagPolicy(".//virtual_cat_support = 'y'", "GUEST_FLAG_VCAT_ENABLED"),
     GuestFlagPolicy(".//secure_world_support = 'y'", "GUEST_FLAG_SECURE_WORLD_ENABLED"),
     GuestFlagPolicy(".//hide_mtrr_support = 'y'", "GUEST_FLAG_HIDE_MTRR"),
@@ -64,7 +64,29 @@ class RamRange():
 
         return hpa_info
 
-def alloc_memory(scenario_etree, ram_range_info):
+def get_llc_colors(board_etree):
+    # the pages of a color share the same sets of the last level cache, the colors repeat every way
+    max_level = max((int(level) for level in board_etree.xpath("//caches/cache/@level")), default=0)
+    llc_node = get_node(f"//caches/cache[@level = '{max_level}']", board_etree)
+    if llc_node is None:
+        return 1
+    way_size = int(get_node("./line_size/text()", llc_node)) * int(get_node("./partitions/text()", llc_node)) * \
+               int(get_node("./sets/text()", llc_node))
+    return min(max(way_size // 0x1000, 1), 64)
+
+def scale_colored_size(board_etree, vm_node, mem_info):
+    colors_node = get_node("./memory/cache_colors/text()", vm_node)
+    if colors_node is None or 0 not in mem_info.keys() or mem_info[0] == 0:
+        return
+    nr_colors = get_llc_colors(board_etree)
+    nr_allowed = bin(int(colors_node, 16) & ((1 << nr_colors) - 1)).count("1")
+    if nr_allowed == 0 or nr_allowed == nr_colors:
+        return
+    # the hypervisor maps only the pages of the colors, one more period covers a region not starting at a color
+    periods = math.ceil(mem_info[0] // 0x1000 / nr_allowed) + 1
+    mem_info[0] = math.ceil(periods * nr_colors * 0x1000 / 0x100000) * 0x100000
+
+def alloc_memory(scenario_etree, ram_range_info, board_etree=None):
     vm_node_list = scenario_etree.xpath("/acrn-config/vm[load_order = 'PRE_LAUNCHED_VM']")
     mem_info_list = []
     vm_node_index_list = []
@@ -75,6 +97,8 @@ def alloc_memory(scenario_etree, ram_range_info):
 
     for vm_node in vm_node_list:
         mem_info = RamRange().get_memory_info(vm_node)
+        if board_etree is not None:
+            scale_colored_size(board_etree, vm_node, mem_info)
         mem_info_list.append(mem_info)
         vm_node_index_list.append(vm_node.attrib["id"])
 
@@ -162,7 +186,7 @@ def write_hpa_info(allocation_etree, mem_info_list, vm_node_index_list):
 
 def alloc_vm_memory(board_etree, scenario_etree, allocation_etree):
     ram_range_info = RamRange().import_memory_info(board_etree, allocation_etree)
-    ram_range_info, mem_info_list, vm_node_index_list = alloc_memory(scenario_etree, ram_range_info)
+    ram_range_info, mem_info_list, vm_node_index_list = alloc_memory(scenario_etree, ram_range_info, board_etree)
     write_hpa_info(allocation_etree, mem_info_list, vm_node_index_list)
 
 def allocate_hugepages(board_etree, scenario_etree, allocation_etree):
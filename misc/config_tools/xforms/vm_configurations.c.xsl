@@ -116,8 +116,35 @@
     <xsl:value-of select="acrn:initializer('bvt_warp_value', bvt_warp_value)" />
     <xsl:value-of select="acrn:initializer('bvt_warp_limit', bvt_warp_limit)" />
     <xsl:value-of select="acrn:initializer('bvt_unwarp_period', bvt_unwarp_period)" />
+    <xsl:if test="bvt_cosched">
+      <xsl:value-of select="acrn:initializer('bvt_cosched', bvt_cosched)" />
+    </xsl:if>
+    <xsl:if test="bvt_cosched_skew_us">
+      <xsl:value-of select="acrn:initializer('bvt_cosched_skew_us', concat(bvt_cosched_skew_us, 'U'))" />
+    </xsl:if>
+    <xsl:if test="edf_budget_us">
+      <xsl:value-of select="acrn:initializer('edf_budget_us', concat(edf_budget_us, 'U'))" />
+    </xsl:if>
+    <xsl:if test="edf_period_us">
+      <xsl:value-of select="acrn:initializer('edf_period_us', concat(edf_period_us, 'U'))" />
+    </xsl:if>
     <xsl:text>},</xsl:text>
     <xsl:value-of select="$newline" />
+    <xsl:if test="halt_poll_us">
+      <xsl:value-of select="acrn:initializer('halt_poll_us', concat(halt_poll_us, 'U'))" />
+    </xsl:if>
+    <xsl:if test="ple_gap">
+      <xsl:value-of select="acrn:initializer('ple_gap', concat(ple_gap, 'U'))" />
+    </xsl:if>
+    <xsl:if test="ple_window">
+      <xsl:value-of select="acrn:initializer('ple_window', concat(ple_window, 'U'))" />
+    </xsl:if>
+    <xsl:if test="rep_io_batch">
+      <xsl:value-of select="acrn:initializer('rep_io_batch', concat(rep_io_batch, 'U'))" />
+    </xsl:if>
+    <xsl:if test="perf_policy and perf_policy != 'HOST'">
+      <xsl:value-of select="acrn:initializer('perf_policy', concat('VM_PERF_POLICY_', perf_policy))" />
+    </xsl:if>
     <xsl:value-of select="acrn:initializer('companion_vm_id', concat(companion_vmid, 'U'))" />
     <xsl:call-template name="guest_flags" />
 
@@ -226,6 +253,9 @@
     <xsl:value-of select="acrn:initializer('host_regions', concat('vm', ../@id, '_hpa'))" />
     <xsl:text>},</xsl:text>
     <xsl:value-of select="$newline" />
+    <xsl:if test="cache_colors/text()">
+      <xsl:value-of select="acrn:initializer('cache_colors', concat(cache_colors, 'UL'))" />
+    </xsl:if>
   </xsl:template>
 
   <xsl:template match="epc_section">
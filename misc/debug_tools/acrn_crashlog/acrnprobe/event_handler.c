@@ -9,6 +9,9 @@
 #include <sys/time.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include "event_queue.h"
 #include "load_conf.h"
 #include "channels.h"
@@ -22,9 +25,37 @@
 /* Watchdog timeout in second*/
 #define WDT_TIMEOUT 300
 
+/* ioprio_set(2), not wrapped by the C library */
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_PRIO_VALUE(class, data)	(((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+/* Nice value of the event handler */
+#define EVENT_HANDLER_NICE 19
+
 static struct event_t *last_e;
 static int event_processing;
 
+/**
+ * Lower the priorities of the event handler thread, and so of the commands
+ * it runs: the logs are collected with the disks and the CPUs the running
+ * VMs leave idle, at the rate the copies are capped to.
+ */
+static void lower_event_handler_priority(void)
+{
+	const pid_t tid = (pid_t)syscall(SYS_gettid);
+
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+		    IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) < 0)
+		LOGW("failed to set idle I/O priority, error (%s)\n",
+		     strerror(errno));
+
+	if (setpriority(PRIO_PROCESS, tid, EVENT_HANDLER_NICE) < 0)
+		LOGW("failed to set nice value, error (%s)\n",
+		     strerror(errno));
+}
+
 /**
  * Handle watchdog expire.
  *
@@ -138,6 +169,8 @@ static void *event_handle(void *unused __attribute__((unused)))
 	struct event_t *e;
 	struct vm_event_t *vme;
 
+	lower_event_handler_priority();
+
 	while ((e = event_dequeue())) {
 		/* here we only handle internal event */
 		if (e->event_type == HEART_BEAT) {
@@ -4,6 +4,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/queue.h>
 #include <pthread.h>
 #include "event_queue.h"
@@ -13,17 +15,61 @@ const char *etype_str[] = {"CRASH", "INFO", "UPTIME", "HEART_BEAT",
 					"REBOOT", "VM", "UNKNOWN"};
 
 static pthread_mutex_t eq_mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t pcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pcond;
 TAILQ_HEAD(, event_t) event_q;
 
+/**
+ * Check if an event is one of a storm that can be handled only once: the
+ * crashes and infos of the same configuration, from the same channel.
+ */
+static int event_coalescible(const struct event_t *e)
+{
+	return e->event_type == CRASH || e->event_type == INFO;
+}
+
+static int event_same(const struct event_t *a, const struct event_t *b)
+{
+	return a->event_type == b->event_type && a->private == b->private &&
+	       a->channel && b->channel && !strcmp(a->channel, b->channel);
+}
+
+static int event_ready(const struct event_t *e, const struct timespec *now)
+{
+	return now->tv_sec > e->ready.tv_sec ||
+	       (now->tv_sec == e->ready.tv_sec &&
+		now->tv_nsec >= e->ready.tv_nsec);
+}
+
 /**
  * Enqueue an event to event_queue.
+ * A CRASH or INFO event is held for EVENT_COALESCE_WINDOW, and the same
+ * events enqueued meanwhile only count in it: a crash loop collects the
+ * logs once per window instead of once per crash.
  *
- * @param event Event to process.
+ * @param event Event to process, freed if coalesced.
  */
 void event_enqueue(struct event_t *event)
 {
+	struct event_t *e;
+
+	event->count = 1;
+	clock_gettime(CLOCK_MONOTONIC, &event->ready);
+
 	pthread_mutex_lock(&eq_mtx);
+	if (event_coalescible(event)) {
+		TAILQ_FOREACH(e, &event_q, entries) {
+			if (event_same(e, event)) {
+				e->count++;
+				LOGD("coalesce %d, (%d)%s into %d events\n",
+				     event->event_type, event->len,
+				     event->path, e->count);
+				pthread_mutex_unlock(&eq_mtx);
+				free(event);
+				return;
+			}
+		}
+		event->ready.tv_sec += EVENT_COALESCE_WINDOW;
+	}
 	TAILQ_INSERT_TAIL(&event_q, event, entries);
 	pthread_cond_signal(&pcond);
 	LOGD("enqueue %d, (%d)%s\n", event->event_type, event->len,
@@ -50,18 +96,38 @@ int events_count(void)
 }
 
 /**
- * Dequeue an event from event_queue.
+ * Dequeue an event from event_queue, in order, once it's no longer held
+ * for coalescing. The HEART_BEAT events aren't held behind the others.
  *
  * @return the dequeued event.
  */
 struct event_t *event_dequeue(void)
 {
 	struct event_t *e;
+	struct event_t *head;
+	struct timespec now;
 
 	pthread_mutex_lock(&eq_mtx);
-	while (TAILQ_EMPTY(&event_q))
-		pthread_cond_wait(&pcond, &eq_mtx);
-	e = TAILQ_FIRST(&event_q);
+	while (1) {
+		head = TAILQ_FIRST(&event_q);
+		if (!head) {
+			pthread_cond_wait(&pcond, &eq_mtx);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (event_ready(head, &now)) {
+			e = head;
+			break;
+		}
+		TAILQ_FOREACH(e, &event_q, entries)
+			if (e->event_type == HEART_BEAT)
+				break;
+		if (e)
+			break;
+
+		pthread_cond_timedwait(&pcond, &eq_mtx, &head->ready);
+	}
 	TAILQ_REMOVE(&event_q, e, entries);
 	LOGD("dequeue %d, (%d)%s\n", e->event_type, e->len, e->path);
 	pthread_mutex_unlock(&eq_mtx);
@@ -74,5 +140,12 @@ struct event_t *event_dequeue(void)
  */
 void init_event_queue(void)
 {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pcond, &attr);
+	pthread_condattr_destroy(&attr);
+
 	TAILQ_INIT(&event_q);
 }
@@ -46,6 +46,7 @@ struct history_entry {
 	const char *lastuptime; /* for uptime */
 	const char *key;
 	const char *eventtime;
+	int count; /* events this entry stands for */
 };
 
 char *history_file;
@@ -94,8 +95,12 @@ static void update_event_count_file(struct history_entry *entry)
 
 	update_line = strstr(all_events_cnt, line);
 	if (!update_line) {
-		*(char *)(mempcpy(line + len, "1\n", 2)) = '\0';
-		len += 2;
+		const int nlen = snprintf(line + len, sizeof(line) - len,
+					  "%d\n", entry->count);
+
+		if (s_not_expect(nlen, sizeof(line) - len))
+			return;
+		len += nlen;
 		all_events_new = realloc(all_events_cnt, all_events_size +
 					 len + 1);
 		if (!all_events_new)
@@ -113,6 +118,7 @@ static void update_event_count_file(struct history_entry *entry)
 		int num;
 		char *ne;
 		char *replace;
+		size_t grow;
 
 		if (!s || !e)
 			return;
@@ -125,27 +131,30 @@ static void update_event_count_file(struct history_entry *entry)
 			     &num) == -1)
 			return;
 
-		if (strspn(num_str, "9") == strnlen(num_str, sizeof(num_str))) {
+		grow = strnlen(num_str, sizeof(num_str));
+		len = snprintf(num_str, sizeof(num_str), "%u",
+			       num + entry->count);
+		if (s_not_expect(len, sizeof(num_str)))
+			return;
+
+		if ((size_t)len > grow) {
+			grow = len - grow;
 			all_events_new = realloc(all_events_cnt,
-						 all_events_size + 1 + 1);
+						 all_events_size + grow + 1);
 			if (!all_events_new)
 				return;
 
 			ne = all_events_new + (e - all_events_cnt);
-			memmove(ne + 1, ne,
+			memmove(ne + grow, ne,
 				all_events_cnt + all_events_size - e + 1);
 			replace = all_events_new + (s - all_events_cnt) + 2;
 
 			all_events_cnt = all_events_new;
-			all_events_size++;
+			all_events_size += grow;
 		} else {
 			replace = s + 2;
 		}
 
-		len = snprintf(num_str, sizeof(num_str), "%u", num + 1);
-		if (s_not_expect(len, sizeof(num_str)))
-			return;
-
 		memcpy(replace, num_str, len);
 	}
 
@@ -251,19 +260,28 @@ free:
 	free(des);
 }
 
-void hist_raise_event(const char *event, const char *type, const char *log,
-			const char *lastuptime, const char *key)
+/**
+ * Record a batch of the same events in history, once: all_events counts
+ * all of them, the line of history_event notes how many there were.
+ *
+ * @param count Number of events of the batch.
+ */
+void hist_raise_events(const char *event, const char *type, const char *log,
+			const char *lastuptime, const char *key, int count)
 {
 	char line[MAXLINESIZE];
 	char eventtime[LONG_TIME_SIZE];
+	char batchlog[MAXLINESIZE];
 	struct sender_t *crashlog;
 	int maxlines;
+	int len;
 	struct history_entry entry = {
 		.event = event,
 		.type = type,
 		.log = log,
 		.lastuptime = lastuptime,
-		.key = key
+		.key = key,
+		.count = count
 	};
 
 	/* here means user have configured the crashlog sender */
@@ -286,6 +304,14 @@ void hist_raise_event(const char *event, const char *type, const char *log,
 	if (get_current_time_long(eventtime) <= 0)
 		return;
 
+	if (count > 1) {
+		len = snprintf(batchlog, sizeof(batchlog), "%s%s(%d events)",
+			       log ? log : "", log ? " " : "", count);
+		if (s_not_expect(len, sizeof(batchlog)))
+			return;
+		entry.log = batchlog;
+	}
+
 	entry.eventtime = eventtime;
 	if (entry_to_history_line(&entry, line, sizeof(line)) == -1) {
 		LOGE("failed to generate new line\n");
@@ -297,6 +323,12 @@ void hist_raise_event(const char *event, const char *type, const char *log,
 	}
 }
 
+void hist_raise_event(const char *event, const char *type, const char *log,
+			const char *lastuptime, const char *key)
+{
+	hist_raise_events(event, type, log, lastuptime, key, 1);
+}
+
 void hist_raise_uptime(char *lastuptime)
 {
 	char boot_time[UPTIME_SIZE];
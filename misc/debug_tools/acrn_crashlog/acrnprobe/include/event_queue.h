@@ -7,6 +7,10 @@
 #define __EVENT_QUEUE_H__
 
 #include <sys/queue.h>
+#include <time.h>
+
+/* Seconds a CRASH or INFO event waits in event_queue for the same ones */
+#define EVENT_COALESCE_WINDOW 5
 
 enum event_type_t {
 	CRASH,
@@ -29,6 +33,11 @@ struct event_t {
 
 	TAILQ_ENTRY(event_t) entries;
 
+	/* number of the same events coalesced into this one */
+	int count;
+	/* CLOCK_MONOTONIC time this event can be handled from */
+	struct timespec ready;
+
 	/* dir to storage logs */
 	char *dir;
 	size_t dlen;
@@ -31,5 +31,7 @@ void hist_raise_infoerror(const char *type, size_t tlen);
 void hist_raise_uptime(char *lastuptime);
 void hist_raise_event(const char *event, const char *type, const char *log,
 			const char *lastuptime, const char *key);
+void hist_raise_events(const char *event, const char *type, const char *log,
+			const char *lastuptime, const char *key, int count);
 
 #endif
@@ -135,6 +135,8 @@ struct sender_t {
 	size_t		spacequota_len;
 	const char	*foldersize;
 	size_t		foldersize_len;
+	const char	*copyrate;
+	size_t		copyrate_len;
 	struct uptime_t *uptime;
 
 	void (*send)(struct event_t *);
@@ -37,6 +37,7 @@ static void print(void)
 		print_id_item(maxlines, sender, id);
 		print_id_item(spacequota, sender, id);
 		print_id_item(foldersize, sender, id);
+		print_id_item(copyrate, sender, id);
 
 		if (sender->uptime) {
 			print_id_item(uptime->name, sender, id);
@@ -674,6 +675,8 @@ static int parse_sender(xmlNodePtr cur, struct sender_t *sender)
 			res = load_cur_content(cur, sender, spacequota);
 		else if (name_is(cur, "foldersize"))
 			res = load_cur_content(cur, sender, foldersize);
+		else if (name_is(cur, "copyrate"))
+			res = load_cur_content(cur, sender, copyrate);
 		else if (name_is(cur, "uptime"))
 			res = parse_uptime(cur, sender);
 
@@ -12,6 +12,7 @@
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include "fsutils.h"
 #include "strutils.h"
 #include "cmdutils.h"
@@ -25,6 +26,16 @@
 #include "log_sys.h"
 #include "loop.h"
 
+/* Threads collecting the logs of an event, at most */
+#define COLLECT_WORKERS 4
+
+struct collect_job {
+	struct log_t **logs;
+	char *desdir;
+	int nlogs;
+	int next;
+};
+
 static int crashlog_check_space(void)
 {
 	struct sender_t *crashlog = get_sender_by_name("crashlog");
@@ -104,7 +115,7 @@ static int cal_log_filepath(char **out, const struct log_t *log,
 	return asprintf(out, "%s/%s", desdir, filename);
 }
 
-/* get_log_file_* only used to copy regular file which can be mmaped */
+/* get_log_file_* only used to copy regular file */
 static void get_log_file_complete(const char *despath, const char *srcpath)
 {
 	const int ret = do_copy_tail(srcpath, despath, 0);
@@ -118,34 +129,12 @@ static void get_log_file_complete(const char *despath, const char *srcpath)
 static void get_log_file_tail(const char *despath, const char *srcpath,
 				const int lines)
 {
-	char *start;
-	int start_line;
-	int file_lines;
-	struct mm_file_t *mfile;
-	int ret;
-
-	mfile = mmap_file(srcpath);
-	if (!mfile) {
-		LOGE("mmap (%s) failed, error (%s)\n", srcpath,
-		     strerror(errno));
-		return;
-	}
-	file_lines = mm_count_lines(mfile);
-	if (file_lines <= 0) {
-		LOGW("get lines (%s, %d) failed\n", mfile->path, file_lines);
-		goto unmap;
-	}
-	start_line = MAX(file_lines - lines, 0) + 1;
-	start = mm_get_line(mfile, start_line);
-	ret = overwrite_file(despath, start);
+	const int ret = do_copy_tail_lines(srcpath, despath, lines);
+
 	if (ret < 0) {
-		LOGE("create file with (%s, %p) failed, error (%s)\n",
-		     despath, start, strerror(errno));
-		goto unmap;
+		LOGE("copy last %d lines of (%s) failed, error (%s)\n",
+		     lines, srcpath, strerror(-ret));
 	}
-
-unmap:
-	unmap_file(mfile);
 }
 
 static void get_log_file(const char *despath, const char *srcpath,
@@ -274,6 +263,51 @@ static void crashlog_get_log(struct log_t *log, void *data)
 		LOGW("get (%s) spend %ds\n", log->name, spent);
 }
 
+static void *collect_worker(void *data)
+{
+	struct collect_job *job = (struct collect_job *)data;
+	int id;
+
+	while ((id = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->nlogs)
+		job->logs[id]->get(job->logs[id], (void *)job->desdir);
+
+	return NULL;
+}
+
+/**
+ * Collect the logs of an event with up to COLLECT_WORKERS threads, running
+ * at the priorities of the event handler. The copies all share the rate
+ * they're capped to.
+ */
+static void collect_logs(struct log_t **logs, char *desdir)
+{
+	pthread_t workers[COLLECT_WORKERS - 1];
+	struct collect_job job = {
+		.logs = logs,
+		.desdir = desdir,
+		.nlogs = 0,
+		.next = 0
+	};
+	int n;
+	int i;
+
+	while (job.nlogs < LOG_MAX && logs[job.nlogs])
+		job.nlogs++;
+
+	for (n = 0; n < MIN(job.nlogs, COLLECT_WORKERS) - 1; n++) {
+		if (pthread_create(&workers[n], NULL, collect_worker, &job)) {
+			LOGW("failed to create collector, error (%s)\n",
+			     strerror(errno));
+			break;
+		}
+	}
+
+	collect_worker(&job);
+	for (i = 0; i < n; i++)
+		pthread_join(workers[i], NULL);
+}
+
 static void crashlog_send_crash(struct event_t *e, char *eid,
 				char *data, size_t dlen)
 {
@@ -284,11 +318,9 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 	size_t d1len;
 	size_t d2len;
 	struct crash_t *crash = (struct crash_t *)e->private;
-	int id;
-	struct log_t *log;
 
-	hist_raise_event(etype_str[e->event_type], crash->name, e->dir, "",
-			 eid);
+	hist_raise_events(etype_str[e->event_type], crash->name, e->dir, "",
+			  eid, e->count);
 	if (!e->dir)
 		return;
 
@@ -303,11 +335,7 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 			   SHORT_KEY_LENGTH, crash->name, crash->name_len,
 			   data0, d0len, data1, d1len, data2, d2len);
 
-	for_each_log_collect(id, log, crash) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
-	}
+	collect_logs(crash->log, e->dir);
 	if (!strcmp(e->channel, "inotify")) {
 		/* get the trigger file */
 		char *src;
@@ -335,18 +363,13 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 
 static void crashlog_send_info(struct event_t *e, char *eid)
 {
-	int id;
 	struct info_t *info = (struct info_t *)e->private;
-	struct log_t *log;
 
-	hist_raise_event(etype_str[e->event_type], info->name, e->dir, "", eid);
+	hist_raise_events(etype_str[e->event_type], info->name, e->dir, "",
+			  eid, e->count);
 	if (!e->dir)
 		return;
-	for_each_log_collect(id, log, info) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
-	}
+	collect_logs(info->log, e->dir);
 }
 
 static void crashlog_send_uptime(void)
@@ -568,7 +591,8 @@ static int crashlog_new_event(struct event_t *e, char *result, size_t rsize,
 	}
 
 	if (crashlog_check_space() == -1) {
-		hist_raise_event(estr, e_subtype, "SPACE_FULL", "", key);
+		hist_raise_events(estr, e_subtype, "SPACE_FULL", "", key,
+				  e->count);
 		free(key);
 		goto fail;
 	}
@@ -696,6 +720,17 @@ int init_sender(void)
 				LOGE("failed to init outdir size\n");
 				return -1;
 			}
+			if (sender->copyrate) {
+				int rate;
+
+				if (cfg_atoi(sender->copyrate,
+					     sender->copyrate_len, &rate) == -1 ||
+				    rate < 0) {
+					LOGE("invalid copyrate\n");
+					return -1;
+				}
+				set_copy_rate_limit((size_t)rate * KB);
+			}
 		}
 	}
 
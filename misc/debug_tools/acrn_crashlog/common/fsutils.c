@@ -33,6 +33,7 @@
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <ftw.h>
+#include <time.h>
 #include "fsutils.h"
 #include "cmdutils.h"
 #include "strutils.h"
@@ -221,6 +222,143 @@ void unmap_file(struct mm_file_t *mfile)
 	free(mfile);
 }
 
+/* Bytes per second the log copies may read, 0 if not capped */
+static size_t copy_rate_limit;
+/* CLOCK_MONOTONIC time, in ns, the copies have been paced up to */
+static long long copy_paced_ns;
+
+/**
+ * Cap the rate of the log copies, so that a collection doesn't compete for
+ * the disks with the running VMs. The cap is shared by all the copies in
+ * flight, whichever thread is running them.
+ *
+ * @param bytes_per_sec Bytes per second the copies may read, 0 to not cap
+ *			them.
+ */
+void set_copy_rate_limit(size_t bytes_per_sec)
+{
+	copy_rate_limit = bytes_per_sec;
+}
+
+enum copy_mode {
+	COPY_RANGE,	/* copy_file_range(2), in the file systems */
+	COPY_SENDFILE,	/* sendfile(2), in the kernel */
+	COPY_RW,	/* read(2)/write(2) through a buffer */
+};
+
+static void copy_throttle(size_t bytes)
+{
+	struct timespec now, ts;
+	long long now_ns, paced, next, ahead_ns;
+
+	if (!copy_rate_limit)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+	/* reserve the time these bytes take, after the ones in flight */
+	paced = __atomic_load_n(&copy_paced_ns, __ATOMIC_RELAXED);
+	do {
+		next = MAX(paced, now_ns) +
+		       (long long)((double)bytes * 1e9 / copy_rate_limit);
+	} while (!__atomic_compare_exchange_n(&copy_paced_ns, &paced, next, 0,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	ahead_ns = next - now_ns;
+	if (ahead_ns <= 0)
+		return;
+
+	ts.tv_sec = ahead_ns / 1000000000LL;
+	ts.tv_nsec = ahead_ns % 1000000000LL;
+	nanosleep(&ts, NULL);
+}
+
+static ssize_t copy_rw(int fdin, off_t *off, int fdout, size_t len)
+{
+	char buffer[CPBUFFERSIZE];
+	ssize_t r_count;
+	ssize_t w_count;
+	ssize_t done = 0;
+
+	r_count = off ? pread(fdin, buffer, MIN(len, CPBUFFERSIZE), *off) :
+			read(fdin, buffer, MIN(len, CPBUFFERSIZE));
+	if (r_count <= 0)
+		return r_count;
+
+	while (done < r_count) {
+		w_count = write(fdout, buffer + done, r_count - done);
+		if (w_count < 0)
+			return -1;
+		done += w_count;
+	}
+	if (off)
+		*off += r_count;
+
+	return r_count;
+}
+
+/**
+ * Copy data between two opened files at copy_rate_limit, in the kernel when
+ * they allow it, through a buffer otherwise.
+ *
+ * @param fdin File to copy from, a non-blocking one is copied until it
+ *	       has no more data.
+ * @param off Offset to copy from, updated, NULL to copy from the file offset.
+ * @param fdout File to copy to, at its file offset.
+ * @param len Bytes to copy at most, 0 to copy until end of file.
+ * @param mode The first way to try, COPY_RANGE only for regular files:
+ *	       the special files of proc or sys may copy nothing that way.
+ *
+ * @return the number of bytes copied if successful, or -1 if not.
+ */
+static ssize_t copy_fd(int fdin, off_t *off, int fdout, size_t len,
+		       enum copy_mode mode)
+{
+	size_t done = 0;
+	size_t chunk;
+	ssize_t n;
+
+	while (!len || done < len) {
+		/* throttle in steps, without bursts of a whole file */
+		chunk = COPY_CHUNK_SIZE;
+		if (len)
+			chunk = MIN(chunk, len - done);
+
+		if (mode == COPY_RANGE) {
+			n = copy_file_range(fdin, off, fdout, NULL, chunk, 0);
+			if (n < 0 && (errno == EXDEV || errno == EINVAL ||
+			    errno == ENOSYS || errno == EOPNOTSUPP)) {
+				mode = COPY_SENDFILE;
+				continue;
+			}
+		} else if (mode == COPY_SENDFILE) {
+			n = sendfile(fdout, fdin, off, chunk);
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				mode = COPY_RW;
+				continue;
+			}
+		} else {
+			n = copy_rw(fdin, off, fdout, chunk);
+		}
+
+		if (n < 0) {
+			if (errno == EAGAIN)
+				break;
+			LOGE("copy failed, err:%s\n", strerror(errno));
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		done += n;
+		copy_throttle(n);
+	}
+
+	return done;
+}
+
 /**
  * Copy the tail data from a file which supports mmap(2)-like operations
  * to new file.
@@ -263,12 +401,86 @@ int do_copy_tail(const char *src, const char *dest, int limit)
 	if (info.st_size > limit)
 		offset = info.st_size - limit;
 
-	rc = sendfile(fdest, fsrc, &offset, limit);
+	rc = copy_fd(fsrc, &offset, fdest, limit,
+		     S_ISREG(info.st_mode) ? COPY_RANGE : COPY_SENDFILE);
+	if (rc == -1)
+		rc = -errno;
+
+	close(fsrc);
+	close(fdest);
+
+	return rc;
+}
+
+/**
+ * Copy the last lines of a file to new file, reading the file backwards
+ * from its end instead of mapping it whole.
+ * This function defaults to all text files ending with \n.
+ *
+ * @param src File path to copy, a regular file.
+ * @param dest New file path to generate.
+ * @param lines Number of lines to copy.
+ *
+ * @return The number of bytes written to new file if successful,
+ *         or a negative errno-style value if not.
+ */
+int do_copy_tail_lines(const char *src, const char *dest, int lines)
+{
+	char buffer[CPBUFFERSIZE];
+	int fsrc, fdest;
+	struct stat info;
+	off_t pos, start = 0;
+	ssize_t blk, i;
+	int found = 0;
+	int rc;
+
+	if (src == NULL || dest == NULL || lines <= 0)
+		return -EINVAL;
+
+	fsrc = open(src, O_RDONLY);
+	if (fsrc < 0)
+		return -errno;
+
+	if (fstat(fsrc, &info) < 0) {
+		rc = -errno;
+		close(fsrc);
+		return rc;
+	}
+
+	/* the last lines begin after the (lines + 1)th \n from the end */
+	pos = info.st_size;
+	while (pos > 0 && !start) {
+		blk = MIN(pos, (off_t)sizeof(buffer));
+		pos -= blk;
+		blk = pread(fsrc, buffer, blk, pos);
+		if (blk <= 0) {
+			rc = blk ? -errno : -EIO;
+			close(fsrc);
+			return rc;
+		}
+		for (i = blk - 1; i >= 0; i--) {
+			if (buffer[i] == '\n' && ++found == lines + 1) {
+				start = pos + i + 1;
+				break;
+			}
+		}
+	}
+
+	fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fdest < 0) {
+		rc = -errno;
+		close(fsrc);
+		return rc;
+	}
+
+	rc = copy_fd(fsrc, &start, fdest, info.st_size - start, COPY_RANGE);
+	if (rc == -1)
+		rc = -errno;
 
 	close(fsrc);
 	close(fdest);
 
-	return rc == -1 ? -errno : rc;
+	return rc;
 }
 
 /**
@@ -534,14 +746,9 @@ int file_update_int(const char *filename, unsigned int current,
  */
 int do_copy_limit(const char *src, const char *des, size_t limitsize)
 {
-	char buffer[CPBUFFERSIZE];
 	int rc = 0;
 	int fd1;
 	int fd2;
-	size_t dsize = 0;
-	size_t rbsize = CPBUFFERSIZE;
-	ssize_t r_count;
-	ssize_t w_count;
 
 	if (src == NULL || des == NULL)
 		return -1;
@@ -561,45 +768,9 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 		return -1;
 	}
 
-	/* Start copy loop */
-	while (1) {
-		if (limitsize > 0) {
-		       if (dsize >= limitsize)
-				break;
-			rbsize = MIN(limitsize - dsize, CPBUFFERSIZE);
-		}
-
-		/* Read data from src */
-		r_count = read(fd1, buffer, rbsize);
-		if (r_count < 0) {
-			if (errno == EAGAIN) {
-				break;
-			} else {
-				LOGE("read failed, err:%s\n", strerror(errno));
-				rc = -1;
-				break;
-			}
-		}
-
-		if (r_count == 0)
-			break;
-
-		/* Copy data to des */
-		w_count = write(fd2, buffer, r_count);
-		if (w_count < 0) {
-			LOGE("write failed, err:%s\n", strerror(errno));
-			rc = -1;
-			break;
-		}
-		if (r_count != w_count) {
-			LOGE("write failed, r_count:%zd w_count:%zd\n",
-			     r_count, w_count);
-			rc = -1;
-			break;
-		}
-
-		dsize += w_count;
-	}
+	/* a node may be a special file, never copy_file_range(2) it */
+	if (copy_fd(fd1, NULL, fd2, limitsize, COPY_SENDFILE) < 0)
+		rc = -1;
 
 	if (fd1 >= 0)
 		close(fd1);
@@ -660,16 +831,24 @@ int space_available(const char *path, int quota)
  */
 int count_lines_in_file(const char *filename)
 {
-	struct mm_file_t *f;
-	int ret;
+	char buffer[CPBUFFERSIZE];
+	char *p;
+	ssize_t n;
+	int fd;
+	int ret = 0;
 
-	f = mmap_file(filename);
-	if (!f)
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
 		return -errno;
 
-	ret = mm_count_lines(f);
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (p = buffer; (p = memchr(p, '\n', buffer + n - p)); p++)
+			ret++;
+	}
+	if (n < 0)
+		ret = -errno;
 
-	unmap_file(f);
+	close(fd);
 
 	return ret;
 }
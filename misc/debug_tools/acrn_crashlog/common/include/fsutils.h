@@ -34,6 +34,7 @@
 #define MB                      (KB * KB)
 #define MAXLINESIZE             (PATH_MAX + 128)
 #define CPBUFFERSIZE            (4 * KB)
+#define COPY_CHUNK_SIZE         (256 * KB)
 #define PAGE_SIZE               (4 * KB)
 
 struct mm_file_t {
@@ -95,6 +96,8 @@ int mm_count_lines(struct mm_file_t *mfile);
 struct mm_file_t *mmap_file(const char *path);
 void unmap_file(struct mm_file_t *mfile);
 int do_copy_tail(const char *src, const char *dest, int limit);
+int do_copy_tail_lines(const char *src, const char *dest, int lines);
+void set_copy_rate_limit(size_t bytes_per_sec);
 int do_mv(char *src, char *dest);
 ssize_t append_file(const char *filename, const char *text, size_t tlen);
 int replace_file_head(char *filename, char *text);
@@ -5,10 +5,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <elf.h>
+#include <sys/syscall.h>
 #include "log_sys.h"
 #include "crash_dump.h"
 #include "cmdutils.h"
@@ -79,41 +85,309 @@ static const char *get_signame(int sig)
 	}
 }
 
+/* the core is written at the lowest best-effort I/O priority */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_BE_LOWEST ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+/* bandwidth cap of the core writer, and the amount written back at a time */
+#define CORE_WRITE_BW (32UL << 20)
+#define CORE_SYNC_SIZE (8UL << 20)
+/* the shared mappings from this size are taken as guest memory */
+#define CORE_SHARED_MAX (64UL << 20)
+#define SMAPS_LINE_LEN 512
+
+struct vma_range {
+	unsigned long start;
+	unsigned long end;
+};
+
+struct core_writer {
+	int fd;
+	unsigned long written;
+	unsigned long synced;
+	struct timespec start;
+	char buf[BUFFER_SIZE];
+};
+
+static int add_vma_range(struct vma_range **ranges, int *n, int *max,
+			unsigned long start, unsigned long end)
+{
+	struct vma_range *r;
+
+	/* a big shared mapping may also be hugetlbfs, only add it once */
+	if (*n > 0 && (*ranges)[*n - 1].start == start)
+		return 0;
+	if (*n == *max) {
+		*max = *max ? *max * 2 : 16;
+		r = realloc(*ranges, *max * sizeof(*r));
+		if (r == NULL)
+			return -1;
+		*ranges = r;
+	}
+	(*ranges)[*n].start = start;
+	(*ranges)[*n].end = end;
+	(*n)++;
+	return 0;
+}
+
 /**
- * Save core dump to file.
- * @filename: core dump file name
- * return 0 on success, or -1 on error
+ * Get the mappings of the process not worth dumping: the hugetlbfs ones
+ * and the big shared ones, which hold the guest memory of the DM rather
+ * than data the backtrace needs.
+ * @pid: process pid
+ * @ranges: the mappings, to be freed by the caller
+ * return the number of mappings, or -1 on error
  */
-static int save_coredump(const char *filename)
+static int get_skipped_vmas(int pid, struct vma_range **ranges)
 {
-	size_t read_len;
-	size_t write_len;
-	char input_buffer[BUFFER_SIZE];
-	FILE *dump_file;
-
-	/* open dump file in write and binary mode */
-	dump_file = fopen(filename, "wb");
-	if (dump_file == NULL) {
-		LOGE("fopen core file failed\n");
+	char path[64];
+	char line[SMAPS_LINE_LEN];
+	char perms[8];
+	unsigned long start = 0, end = 0, pagesize;
+	int n = 0, max = 0;
+	int ret = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
 		return -1;
+
+	*ranges = NULL;
+	while (!ret && fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%lx-%lx %7s", &start, &end, perms) == 3) {
+			if (perms[3] == 's' && (end - start) >= CORE_SHARED_MAX)
+				ret = add_vma_range(ranges, &n, &max, start, end);
+		} else if (sscanf(line, "KernelPageSize: %lu kB", &pagesize) == 1 &&
+				pagesize > 4) {
+			ret = add_vma_range(ranges, &n, &max, start, end);
+		}
+	}
+	fclose(fp);
+
+	if (ret) {
+		free(*ranges);
+		*ranges = NULL;
+		return -1;
+	}
+	return n;
+}
+
+static bool vma_skipped(const struct vma_range *ranges, int n,
+			unsigned long start, unsigned long end)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (start >= ranges[i].start && end <= ranges[i].end)
+			return true;
 	}
-	/* Read from STDIN and write to dump file */
-	while (1) {
-		read_len = fread(input_buffer, 1, BUFFER_SIZE, stdin);
-		if (read_len == 0)
-			break;
-		write_len = fwrite(input_buffer, 1, read_len, dump_file);
-		if (write_len == 0) {
-			LOGE("fwrite error\n");
-			fclose(dump_file);
+	return false;
+}
+
+/* write the data out within the bandwidth cap, with bounded dirty pages */
+static int core_write(struct core_writer *w, const void *buf, size_t len)
+{
+	struct timespec now, delay;
+	unsigned long elapsed_ns, expected_ns;
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = write(w->fd, (const char *)buf + done, len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("write core failed, error (%s)\n", strerror(errno));
 			return -1;
 		}
+		done += ret;
+	}
+	w->written += len;
+
+	if (w->written - w->synced >= CORE_SYNC_SIZE) {
+		sync_file_range(w->fd, w->synced, w->written - w->synced,
+				SYNC_FILE_RANGE_WAIT_BEFORE |
+				SYNC_FILE_RANGE_WRITE |
+				SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(w->fd, w->synced, w->written - w->synced,
+				POSIX_FADV_DONTNEED);
+		w->synced = w->written;
 	}
 
-	fclose(dump_file);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ns = (now.tv_sec - w->start.tv_sec) * 1000000000UL +
+			now.tv_nsec - w->start.tv_nsec;
+	expected_ns = w->written / (CORE_WRITE_BW >> 10) * (1000000000UL >> 10);
+	if (expected_ns > elapsed_ns) {
+		delay.tv_sec = (expected_ns - elapsed_ns) / 1000000000UL;
+		delay.tv_nsec = (expected_ns - elapsed_ns) % 1000000000UL;
+		nanosleep(&delay, NULL);
+	}
 	return 0;
 }
 
+/* copy len bytes of the core from STDIN, or only drop them if !keep */
+static int core_copy(struct core_writer *w, unsigned long len, bool keep)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = fread(w->buf, 1, MIN(len, sizeof(w->buf)), stdin);
+		if (n == 0) {
+			LOGE("core truncated\n");
+			return -1;
+		}
+		if (keep && core_write(w, w->buf, n) == -1)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+static int core_copy_all(struct core_writer *w)
+{
+	size_t n;
+
+	while ((n = fread(w->buf, 1, sizeof(w->buf), stdin)) > 0) {
+		if (core_write(w, w->buf, n) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stream the ELF core from STDIN, without the contents of the PT_LOAD
+ * segments of the skipped mappings: they are kept with a p_filesz of 0
+ * and the segments after them moved down. This relies on the kernel
+ * writing the program headers right after the ELF header and the
+ * segments in file order, other cores are copied unchanged.
+ * @w: core writer
+ * @pid: process pid
+ * return 0 on success, or -1 on error
+ */
+static int stream_coredump(struct core_writer *w, int pid)
+{
+	Elf64_Ehdr ehdr;
+	Elf64_Phdr *phdr = NULL, out;
+	struct vma_range *ranges = NULL;
+	bool *skip = NULL;
+	unsigned long in_off, removed = 0, dropped = 0;
+	size_t n, hdr_len;
+	int nr_ranges = 0;
+	int i, ret = -1;
+
+	n = fread(&ehdr, 1, sizeof(ehdr), stdin);
+	if (n == sizeof(ehdr) && !memcmp(ehdr.e_ident, ELFMAG, SELFMAG) &&
+		ehdr.e_ident[EI_CLASS] == ELFCLASS64 &&
+		ehdr.e_phoff == sizeof(ehdr) &&
+		ehdr.e_phentsize == sizeof(Elf64_Phdr) &&
+		ehdr.e_phnum > 0 && ehdr.e_phnum < PN_XNUM)
+		nr_ranges = get_skipped_vmas(pid, &ranges);
+	if (nr_ranges <= 0) {
+		if (core_write(w, &ehdr, n) == -1)
+			return -1;
+		return core_copy_all(w);
+	}
+
+	hdr_len = ehdr.e_phnum * sizeof(*phdr);
+	phdr = malloc(hdr_len);
+	skip = calloc(ehdr.e_phnum, sizeof(*skip));
+	if (phdr == NULL || skip == NULL)
+		goto out;
+	if (fread(phdr, 1, hdr_len, stdin) != hdr_len) {
+		LOGE("core truncated\n");
+		goto out;
+	}
+	in_off = sizeof(ehdr) + hdr_len;
+
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		if (phdr[i].p_filesz == 0)
+			continue;
+		if (phdr[i].p_offset < in_off) {
+			LOGE("unexpected core layout\n");
+			goto out;
+		}
+		in_off = phdr[i].p_offset + phdr[i].p_filesz;
+		skip[i] = phdr[i].p_type == PT_LOAD &&
+			vma_skipped(ranges, nr_ranges, phdr[i].p_vaddr,
+				phdr[i].p_vaddr + phdr[i].p_memsz);
+	}
+
+	if (core_write(w, &ehdr, sizeof(ehdr)) == -1)
+		goto out;
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		out = phdr[i];
+		out.p_offset -= removed;
+		if (skip[i]) {
+			removed += out.p_filesz;
+			out.p_filesz = 0;
+		}
+		if (core_write(w, &out, sizeof(out)) == -1)
+			goto out;
+	}
+
+	in_off = sizeof(ehdr) + hdr_len;
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		if (phdr[i].p_filesz == 0)
+			continue;
+		if (core_copy(w, phdr[i].p_offset - in_off, true) == -1 ||
+			core_copy(w, phdr[i].p_filesz, !skip[i]) == -1)
+			goto out;
+		in_off = phdr[i].p_offset + phdr[i].p_filesz;
+		dropped += skip[i];
+	}
+	ret = core_copy_all(w);
+	if (dropped)
+		LOGI("%lu segments, 0x%lx bytes left out of the core\n",
+			dropped, removed);
+
+out:
+	free(skip);
+	free(phdr);
+	free(ranges);
+	return ret;
+}
+
+/**
+ * Save core dump to file.
+ * The core is streamed through a fixed buffer, without the guest memory
+ * of the DM, and written at a capped rate and the lowest I/O priority so
+ * that the running VMs do not stall on the storage.
+ * @filename: core dump file name
+ * @pid: process pid
+ * return 0 on success, or -1 on error
+ */
+static int save_coredump(const char *filename, int pid)
+{
+	struct core_writer *w;
+	int ret;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		LOGE("alloc core writer failed\n");
+		return -1;
+	}
+
+	w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (w->fd < 0) {
+		LOGE("open core file failed\n");
+		free(w);
+		return -1;
+	}
+
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_BE_LOWEST) < 0)
+		LOGW("set I/O priority failed, error (%s)\n", strerror(errno));
+	clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+	ret = stream_coredump(w, pid);
+
+	close(w->fd);
+	free(w);
+	return ret;
+}
+
 static int get_backtrace(int pid, int fd, int sig, const char *comm)
 {
 	char *membkt;
@@ -128,7 +402,7 @@ static int get_backtrace(int pid, int fd, int sig, const char *comm)
 	} else {
 		flen = snprintf(format, sizeof(format), "%s %s", comm,
 				DUMP_FILE);
-		if (save_coredump(DUMP_FILE) == -1) {
+		if (save_coredump(DUMP_FILE, pid) == -1) {
 			LOGE("save core file failed\n");
 			return -1;
 		}
@@ -58,6 +58,31 @@ static struct hvlog_file last_log = {
 	.num = LOG_FILE_NUM
 };
 
+/*
+ * Binary record of the hypervisor memory log, see do_logmsg() in
+ * hypervisor/debug/logmsg.c. The format string is at fmt_id in the
+ * acrn.logfmt table of the hypervisor build.
+ */
+#define HVLOG_BIN_MAGIC		0x01
+#define HVLOG_BIN_MAX_ENTRIES	4
+
+struct hvlog_bin_hdr {
+	__u8 magic;
+	__u8 severity;
+	__u8 nr_entries;
+	__u8 nr_args;
+	__u16 pcpu_id;
+	__u16 len;
+	__u32 fmt_id;
+	__u32 seq;
+	__u64 usec;
+	char thread[16];
+} __attribute__((packed));
+
+/* acrn.logfmt table loaded with -f */
+static char *logfmt_table;
+static size_t logfmt_size;
+
 struct hvlog_msg {
 	__u64 usec;		/* timestamp, from tsc reset in usec */
 	int cpu;		/* which physical cpu output the log */
@@ -77,6 +102,7 @@ struct hvlog_dev {
 	struct hvlog_msg *msg;	/* pointer to msg */
 
 	int latched;		/* 1 if an sbuf element latched */
+	int latched_bin;	/* 1 if the latched element is a binary record */
 	char entry_latch[LOG_ELEMENT_SIZE];	/* latch for an sbuf element */
 	struct hvlog_msg latched_msg;	/* latch for parsed msg */
 };
@@ -107,6 +133,150 @@ static int get_dev_cnt(char *prefix)
 	return cnt;
 }
 
+static int hvlog_is_bin(const char *entry)
+{
+	struct hvlog_bin_hdr hdr;
+
+	memcpy(&hdr, entry, sizeof(hdr));
+	return hdr.magic == HVLOG_BIN_MAGIC && hdr.severity >= 1 && hdr.severity <= 6 &&
+		hdr.len >= sizeof(hdr) && hdr.len <= LOG_ELEMENT_SIZE * HVLOG_BIN_MAX_ENTRIES &&
+		hdr.nr_entries == (hdr.len - 1) / LOG_ELEMENT_SIZE + 1;
+}
+
+/*
+ * Render the message of a binary record into out, following the format
+ * grammar of the hypervisor printf: flags, width, precision, h/hh/l/ll and
+ * d, i, u, x, X, c, s or '%'. Anything else is copied as it is.
+ */
+static size_t hvlog_format_bin(char *out, size_t size, const struct hvlog_bin_hdr *hdr,
+		const char *rec)
+{
+	const char *arg = rec + sizeof(*hdr), *end = rec + hdr->len;
+	const char *fmt, *start;
+	char spec[32], str[256];
+	size_t n = 0, spec_len;
+	int is_long, ret = 0;
+	__u64 val;
+	__u8 len;
+	char ch;
+
+	if (!logfmt_table || hdr->fmt_id >= logfmt_size) {
+		ret = snprintf(out, size, "fmt#%u, %u args", hdr->fmt_id, hdr->nr_args);
+		return (ret < 0) ? 0 : ((size_t)ret >= size ? size - 1 : (size_t)ret);
+	}
+
+	fmt = &logfmt_table[hdr->fmt_id];
+	while (*fmt && n < size - 1) {
+		if (*fmt != '%') {
+			out[n++] = *fmt++;
+			continue;
+		}
+
+		start = fmt++;
+		while (*fmt == '#' || *fmt == '-' || *fmt == ' ' || *fmt == '+' ||
+				*fmt == '.' || (*fmt >= '0' && *fmt <= '9'))
+			fmt++;
+		for (is_long = 0; *fmt == 'h' || *fmt == 'l'; fmt++)
+			is_long |= (*fmt == 'l');
+		ch = *fmt;
+		if (ch)
+			fmt++;
+
+		spec_len = fmt - start;
+		if (spec_len >= sizeof(spec))
+			spec_len = sizeof(spec) - 1;
+		memcpy(spec, start, spec_len);
+		spec[spec_len] = 0;
+
+		switch (ch) {
+		case '%':
+			out[n++] = '%';
+			continue;
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'c':
+			if (arg + sizeof(val) > end)
+				goto truncated;
+			memcpy(&val, arg, sizeof(val));
+			arg += sizeof(val);
+			if (ch == 'c')
+				ret = snprintf(&out[n], size - n, spec, (int)val);
+			else if (ch == 'd' || ch == 'i')
+				ret = is_long ? snprintf(&out[n], size - n, spec, (long)val) :
+					snprintf(&out[n], size - n, spec, (int)val);
+			else
+				ret = is_long ? snprintf(&out[n], size - n, spec, (unsigned long)val) :
+					snprintf(&out[n], size - n, spec, (unsigned int)val);
+			break;
+		case 's':
+			if (arg + 1 > end || arg + 1 + (__u8)*arg > end)
+				goto truncated;
+			len = (__u8)*arg;
+			memcpy(str, arg + 1, len);
+			str[len] = 0;
+			arg += 1 + len;
+			ret = snprintf(&out[n], size - n, spec, str);
+			break;
+		default:
+			ret = snprintf(&out[n], size - n, "%s", spec);
+			break;
+		}
+
+		if (ret > 0)
+			n += ((size_t)ret >= size - n) ? size - n - 1 : (size_t)ret;
+	}
+	out[n] = 0;
+	return n;
+
+truncated:
+	ret = snprintf(&out[n], size - n, "<truncated record>");
+	if (ret > 0)
+		n += ((size_t)ret >= size - n) ? size - n - 1 : (size_t)ret;
+	return n;
+}
+
+/*
+ * Read the rest of the binary record starting with entry and decode it into
+ * dev->msg, in the same text layout as the hypervisor's own messages.
+ */
+static struct hvlog_msg *hvlog_read_bin(struct hvlog_dev *dev, const char *entry)
+{
+	char rec[LOG_ELEMENT_SIZE * HVLOG_BIN_MAX_ENTRIES];
+	struct hvlog_msg *msg = dev->msg;
+	struct hvlog_bin_hdr hdr;
+	int i, ret;
+
+	memcpy(rec, entry, LOG_ELEMENT_SIZE);
+	memcpy(&hdr, rec, sizeof(hdr));
+	/* the records are committed whole, the other entries follow */
+	for (i = 1; i < hdr.nr_entries; i++) {
+		if (read(dev->fd, &rec[i * LOG_ELEMENT_SIZE], LOG_ELEMENT_SIZE) != LOG_ELEMENT_SIZE)
+			return NULL;
+	}
+
+	memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+	msg->usec = hdr.usec;
+	msg->cpu = hdr.pcpu_id;
+	msg->sev = hdr.severity;
+	msg->seq = hdr.seq;
+
+	ret = snprintf(msg->raw, LOG_MSG_SIZE, "[%lluus][cpu=%hu][%.16s][sev=%u][seq=%u]:",
+			hdr.usec, hdr.pcpu_id, hdr.thread, hdr.severity, hdr.seq);
+	if (ret < 0 || ret >= LOG_MSG_SIZE - 1)
+		ret = 0;
+	msg->len = ret;
+	msg->len += hvlog_format_bin(&msg->raw[msg->len], LOG_MSG_SIZE - 1 - msg->len, &hdr, rec);
+
+	msg->raw[msg->len] = '\n';
+	msg->raw[msg->len + 1] = 0;
+	msg->len++;
+
+	return msg;
+}
+
 /*
  * The function read a complete msg from acrnlog dev.
  * read one more sbuf entry if read an entry doesn't end with '\0'
@@ -122,6 +292,11 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	int msg_num;
 	char warn_msg[LOG_MSG_SIZE] = {0};
 
+	if (dev->latched_bin) {
+		dev->latched_bin = 0;
+		return hvlog_read_bin(dev, dev->entry_latch);
+	}
+
 	msg[0] = dev->msg;
 	msg[1] = &dev->latched_msg;
 
@@ -142,6 +317,16 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 				 LOG_ELEMENT_SIZE);
 			if (!ret)
 				break;
+			/* a binary record, either our message or the next one */
+			if (hvlog_is_bin(&msg[0]->raw[msg[0]->len])) {
+				memcpy(dev->entry_latch, &msg[0]->raw[msg[0]->len],
+				       LOG_ELEMENT_SIZE);
+				memset(&msg[0]->raw[msg[0]->len], 0, LOG_ELEMENT_SIZE);
+				if (msg_num == 0)
+					return hvlog_read_bin(dev, dev->entry_latch);
+				dev->latched_bin = 1;
+				break;
+			}
 			/* do we read a new meaasge?
 			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
 			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
@@ -420,19 +605,49 @@ static int mk_dir(const char *path)
 	return 0;
 }
 
+/* load the format string table extracted from the hypervisor ELF */
+static int load_logfmt(const char *path)
+{
+	struct stat st;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp || fstat(fileno(fp), &st)) {
+		printf("Failed to open %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+
+	logfmt_table = calloc(1, st.st_size + 1);
+	if (!logfmt_table) {
+		printf("Failed to allocate buf for %s\n", path);
+		goto err;
+	}
+
+	logfmt_size = fread(logfmt_table, 1, st.st_size, fp);
+	fclose(fp);
+	return 0;
+
+err:
+	if (fp)
+		fclose(fp);
+	return -1;
+}
+
 /* for user optinal args */
-static const char optString[] = "s:n:t:h";
+static const char optString[] = "s:n:t:f:h";
 
 static void display_usage(void)
 {
 	printf("acrnlog - tool to collect ACRN hypervisor log\n"
-	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-h]\n\n"
+	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-f logfmt] [-h]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-t: polling interval to collect logs, in ms\n"
 	       "\t-s: size limitation for each log file, in MB.\n"
 	       "\t    0 means no limitation.\n"
 	       "\t-n: how many files you would like to keep on disk\n"
+	       "\t-f: acrn.logfmt of the running hypervisor, to decode\n"
+	       "\t    its binary log records\n"
 	       "[Output] capatured log files under /var/log/acrnlog/\n");
 }
 
@@ -471,6 +686,10 @@ static int parse_opt(int argc, char *argv[])
 			interval = ret * 1000;
 			printf("Polling interval is %u ms\n", ret);
 			break;
+		case 'f':
+			if (load_logfmt(optarg))
+				return -EINVAL;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
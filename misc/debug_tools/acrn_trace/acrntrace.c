@@ -12,6 +12,9 @@
 #include <sys/statvfs.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <time.h>
 #include <dirent.h>
 #include <signal.h>
@@ -20,8 +23,11 @@
 #include <string.h>
 #include <signal.h>
 #include <numa.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
 
 #include "acrntrace.h"
+#include "analyze.h"
 
 #define TIMER_ID	(128)
 static uint32_t timeout = 0;
@@ -30,7 +36,7 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hcrt:a:";
+static const char optString[] = "i:hcrzpt:a:e:v:x:w:R:s:o:";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags = FLAG_CLEAR_BUF;
@@ -41,17 +47,47 @@ static int dev_cnt = 0; /* Count of /dev/acrn_trace_xxx devices */
 
 static struct bitmask *cpu_bitmask = NULL;
 
+static const char *trace_class_names[] = {
+	"timer", "irq", "vmexit", "sched", "ioreq", "ptirq", "other",
+};
+
+static trace_filter_t filter = {
+	.class_mask = TRACE_CLASS_ALL,
+	.vm_mask = ~0UL,
+	.vmexit_mask = { ~0UL, ~0UL },
+};
+static int filter_set = 0;
+
+static uint32_t watermark = 0; /* in percent of the buffer, 0 to poll */
+static int hsm_fd = -1;
+
+static uint64_t ring_size = 0; /* max bytes per trace file, 0 for no limit */
+
+static uint32_t stream_interval = 0; /* report period of the analyzer, 0 to record */
+static const char *textfile = NULL;
+
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-e classes] [-v vms] [-x reasons] [-w percent] [-R size] [-s interval [-o file]] [-chprz]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
 	       "\t-c: clear the buffered old data (deprecated)\n"
 	       "\t-r: capture the buffered old data instead of clearing it\n"
-	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n");
+	       "\t-z: record in the compact variable-length format (acrntrace_format.py -z)\n"
+	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n"
+	       "\t-e: class-list: only trace these comma separated event classes\n"
+	       "\t    (timer, irq, vmexit, sched, ioreq, ptirq, other)\n"
+	       "\t-v: vm-list: only trace the events raised by the vCPUs of these comma separated VM ids\n"
+	       "\t-x: reason-list: only trace the vmexit events of these comma separated basic exit reasons\n"
+	       "\t-w: percent: wake up when a buffer is this full [1-99], polling interval becomes the max latency\n"
+	       "\t-R: size_in_MB: flight recorder, only keep the last size_in_MB of each cpu's trace data\n"
+	       "\t-p: pin each reader thread to a cpu\n"
+	       "\t-s: interval: analyze the events as they arrive instead of recording them and\n"
+	       "\t    report vmexit, irq and cpu usage statistics every interval seconds\n"
+	       "\t-o: file: write the -s reports to this Prometheus textfile instead of stdout\n");
 }
 
 static void timer_handler(union sigval sv)
@@ -94,6 +130,96 @@ static int init_timer(int timeout)
 	return 0;
 }
 
+static int parse_class_list(char *list, uint32_t *mask)
+{
+	char *tok, *save = NULL;
+	size_t i, nr = sizeof(trace_class_names) / sizeof(trace_class_names[0]);
+
+	*mask = 0U;
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < nr; i++) {
+			if (!strcmp(tok, trace_class_names[i]))
+				break;
+		}
+		if (i == nr) {
+			pr_err("unknown event class '%s'\n", tok);
+			return -EINVAL;
+		}
+		*mask |= 1U << i;
+	}
+	return 0;
+}
+
+/* set bit n of the mask array for each number n of the comma separated list */
+static int parse_id_list(char *list, uint64_t *mask, int nr_masks)
+{
+	char *tok, *end, *save = NULL;
+	long id;
+
+	memset(mask, 0, sizeof(uint64_t) * nr_masks);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		id = strtol(tok, &end, 10);
+		if (*end != '\0' || id < 0 || id >= 64 * nr_masks) {
+			pr_err("invalid id '%s'\n", tok);
+			return -EINVAL;
+		}
+		mask[id / 64] |= 1UL << (id % 64);
+	}
+	return 0;
+}
+
+static int set_trace_filter(int verbose)
+{
+	int fd, ret;
+
+	fd = open(HSM_DEV_PATH, O_RDWR);
+	if (fd < 0) {
+		if (verbose)
+			pr_err("Failed to open %s: %s\n", HSM_DEV_PATH, strerror(errno));
+		return -1;
+	}
+
+	ret = ioctl(fd, ACRN_IOCTL_SET_TRACE_FILTER, &filter);
+	if (ret < 0 && verbose)
+		pr_err("Failed to set the trace filter: %s\n", strerror(errno));
+
+	close(fd);
+	return ret;
+}
+
+/*
+ * HSM signals every registered eventfd on the upcalls raised by the
+ * hypervisor, including the sbuf watermark ones. Without HSM support the
+ * reader falls back to polling.
+ */
+static int setup_sbuf_eventfd(void)
+{
+	int efd;
+
+	if (hsm_fd < 0) {
+		hsm_fd = open(HSM_DEV_PATH, O_RDWR);
+		if (hsm_fd < 0) {
+			pr_err("Failed to open %s: %s\n", HSM_DEV_PATH, strerror(errno));
+			return -1;
+		}
+	}
+
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		pr_err("Failed to create eventfd: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(hsm_fd, ACRN_IOCTL_SETUP_SBUF_EVENT_FD, &efd) < 0) {
+		pr_err("Failed to set up the sbuf eventfd, polling instead: %s\n",
+			strerror(errno));
+		close(efd);
+		return -1;
+	}
+
+	return efd;
+}
+
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret;
@@ -127,9 +253,57 @@ static int parse_opt(int argc, char *argv[])
 		case 'r':
 			flags &= ~FLAG_CLEAR_BUF;
 			break;
+		case 'z':
+			flags |= FLAG_COMPACT;
+			break;
 		case 'a':
 			cpu_bitmask = numa_parse_cpustring_all(optarg);
 			break;
+		case 'e':
+			if (parse_class_list(optarg, &filter.class_mask))
+				return -EINVAL;
+			filter_set = 1;
+			break;
+		case 'v':
+			if (parse_id_list(optarg, &filter.vm_mask, 1))
+				return -EINVAL;
+			filter_set = 1;
+			break;
+		case 'x':
+			if (parse_id_list(optarg, filter.vmexit_mask, TRACE_VMEXIT_REASON_MAX / 64))
+				return -EINVAL;
+			filter_set = 1;
+			break;
+		case 'p':
+			flags |= FLAG_PIN;
+			break;
+		case 'R':
+			ret = strtol(optarg, NULL, 10);
+			if (ret <= 0) {
+				pr_err("'-R' require integer greater than 0\n");
+				return -EINVAL;
+			}
+			ring_size = (uint64_t)ret << 20;
+			break;
+		case 's':
+			ret = strtol(optarg, NULL, 10);
+			if (ret <= 0) {
+				pr_err("'-s' require integer greater than 0\n");
+				return -EINVAL;
+			}
+			stream_interval = ret;
+			break;
+		case 'o':
+			textfile = optarg;
+			break;
+		case 'w':
+			ret = strtol(optarg, NULL, 10);
+			if (ret <= 0 || ret >= 100) {
+				pr_err("'-w' require integer between [1-99]\n");
+				return -EINVAL;
+			}
+			watermark = ret;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -139,6 +313,24 @@ static int parse_opt(int argc, char *argv[])
 			return -EINVAL;
 		}
 	};
+
+	/* the trace file may only wrap at a record boundary */
+	if (ring_size && (flags & FLAG_COMPACT)) {
+		pr_err("'-R' can't be used with '-z'\n");
+		return -EINVAL;
+	}
+
+	/* the analyzer only decodes the fixed-size records */
+	if (stream_interval && (ring_size || (flags & FLAG_COMPACT))) {
+		pr_err("'-s' can't be used with '-R' or '-z'\n");
+		return -EINVAL;
+	}
+
+	if (textfile && !stream_interval) {
+		pr_err("'-o' requires '-s'\n");
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
@@ -217,11 +409,121 @@ static int create_trace_file_dir(char *dir)
 	return err;
 }
 
+static void reader_wait(param_t *param)
+{
+	struct pollfd pfd = { .fd = param->event_fd, .events = POLLIN };
+	uint64_t cnt;
+
+	if (param->event_fd < 0) {
+		usleep(period);
+		return;
+	}
+
+	if (poll(&pfd, 1, period / 1000) > 0 && read(param->event_fd, &cnt, sizeof(cnt)) < 0)
+		pr_dbg("Failed to read eventfd: %s\n", strerror(errno));
+}
+
+/*
+ * In ring mode, the trace file wraps around at ring_size and the oldest data
+ * is overwritten; trace_file_unroll() puts it back in order on exit.
+ */
+static int trace_write(param_t *param, const uint8_t *buf, uint32_t len)
+{
+	uint64_t chunk;
+	ssize_t ret;
+
+	while (len) {
+		chunk = len;
+		if (ring_size) {
+			if (param->ring_pos >= ring_size) {
+				param->ring_pos = 0;
+				param->ring_wrapped = 1;
+			}
+			if (chunk > ring_size - param->ring_pos)
+				chunk = ring_size - param->ring_pos;
+			ret = pwrite(param->trace_fd, buf, chunk, param->ring_pos);
+		} else {
+			ret = write(param->trace_fd, buf, chunk);
+		}
+
+		if (ret <= 0) {
+			pr_err("Failed to write: ret %ld, errno %d\n", ret, (ret < 0) ? errno : 0);
+			return -1;
+		}
+
+		buf += ret;
+		len -= ret;
+		param->ring_pos += ret;
+	}
+
+	return 0;
+}
+
+static void trace_file_unroll(param_t *param)
+{
+	uint64_t pos = param->ring_pos;
+	uint8_t *buf;
+
+	if (!param->ring_wrapped || pos >= ring_size)
+		return;
+
+	buf = malloc(ring_size);
+	if (!buf) {
+		pr_err("Failed to allocate memory, trace file %u is left unordered at %lu\n",
+			param->devid, pos);
+		return;
+	}
+
+	if (pread(param->trace_fd, buf, ring_size, 0) != (ssize_t)ring_size ||
+			pwrite(param->trace_fd, buf + pos, ring_size - pos, 0) != (ssize_t)(ring_size - pos) ||
+			pwrite(param->trace_fd, buf, pos, ring_size - pos) != (ssize_t)pos)
+		pr_err("Failed to reorder trace file %u, errno %d\n", param->devid, errno);
+
+	free(buf);
+}
+
+/* write the whole buffered data out in at most two chunks, without copying */
+static int reader_drain(param_t *param)
+{
+	shared_buf_t *sbuf = param->sbuf;
+	const void *data;
+	uint32_t len;
+	int ret;
+
+	if (flags & FLAG_COMPACT) {
+		do {
+			ret = sbuf_write_var(param->trace_fd, sbuf);
+		} while (ret > 0);
+		return ret;
+	}
+
+	do {
+		len = sbuf_peek(sbuf, &data);
+		if (len == 0)
+			return 0;
+		if (stream_interval)
+			analyzer_consume(param->devid, data, len / sizeof(trace_ev_t));
+		else if (trace_write(param, data, len) < 0)
+			return -1;
+		sbuf_consume(sbuf, len);
+	} while (1);
+}
+
+static void reader_pin(param_t *param)
+{
+	cpu_set_t set;
+	int nr_cpus = get_nprocs();
+
+	/* the Service VM may have fewer CPUs than the hypervisor */
+	CPU_ZERO(&set);
+	CPU_SET(param->devid % nr_cpus, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		pr_err("Failed to pin reader %u to cpu %d\n", param->devid, param->devid % nr_cpus);
+}
+
 /* function executed in each consumer thread */
 static void reader_fn(param_t * param)
 {
-	int ret;
-	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
@@ -230,16 +532,25 @@ static void reader_fn(param_t * param)
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
-	/* Clear the old data in sbuf */
-	if (flags & FLAG_CLEAR_BUF)
+	if (flags & FLAG_PIN)
+		reader_pin(param);
+
+	if (flags & FLAG_COMPACT) {
+		/*
+		 * Old data is in the fixed-size format and has to go. Give the
+		 * records being put right now a moment to land before clearing.
+		 */
+		sbuf_add_flags(sbuf, SBUF_VAR_LEN);
+		usleep(1000);
+		sbuf_clear_buffered(sbuf);
+	} else if (flags & FLAG_CLEAR_BUF) {
+		/* Clear the old data in sbuf */
 		sbuf_clear_buffered(sbuf);
+	}
 
 	while (1) {
-		do {
-			ret = sbuf_write(fd, sbuf);
-		} while (ret > 0);
-
-		usleep(period);
+		reader_drain(param);
+		reader_wait(param);
 	}
 }
 
@@ -252,6 +563,7 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 		printf("WARN: device name is truncated\n");
 
 	reader->param.devid = dev_id;
+	reader->param.event_fd = -1;
 
 	reader->dev_fd = open(reader->dev_name, O_RDWR);
 	if (reader->dev_fd < 0) {
@@ -273,11 +585,26 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 	       dev_id, reader->param.sbuf->magic, reader->param.sbuf->ele_num,
 	       reader->param.sbuf->ele_size);
 
+	if (watermark) {
+		reader->param.event_fd = setup_sbuf_eventfd();
+		if (reader->param.event_fd >= 0) {
+			reader->param.sbuf->watermark = reader->param.sbuf->size / 100 * watermark;
+			sbuf_add_flags(reader->param.sbuf, SBUF_NOTIFY_EN);
+		} else {
+			/* no need to retry for the other readers */
+			watermark = 0;
+		}
+	}
+
+	if (stream_interval)
+		goto start;
+
 	if(snprintf(trace_file_name, TRACE_FILE_NAME_LEN, "%s/%d", trace_file_dir,
 		 dev_id) >= TRACE_FILE_NAME_LEN)
 		printf("WARN: trace file name is truncated\n");
+	/* ring mode reads the file back in trace_file_unroll() */
 	reader->param.trace_fd = open(trace_file_name,
-					O_WRONLY | O_CREAT | O_TRUNC, 0644);
+					(ring_size ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
 	if (!reader->param.trace_fd) {
 		pr_err("Failed to open %s, err %d\n", trace_file_name, errno);
 		return -3;
@@ -286,6 +613,7 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 	pr_info("trace data file %s created for %s\n",
 		trace_file_name, reader->dev_name);
 
+ start:
 	if (pthread_create(&reader->thrd, NULL,
 			   (void *)&reader_fn, &reader->param)) {
 		pr_err("failed to create reader thread, %d\n", dev_id);
@@ -306,6 +634,10 @@ static void destory_reader(reader_struct * reader)
 	}
 
 	if (reader->param.sbuf) {
+		/* back to the fixed-size records for the next reader */
+		if (flags & FLAG_COMPACT)
+			sbuf_clear_flags(reader->param.sbuf, SBUF_VAR_LEN);
+		sbuf_clear_flags(reader->param.sbuf, SBUF_NOTIFY_EN);
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
 	}
@@ -316,8 +648,14 @@ static void destory_reader(reader_struct * reader)
 	}
 
 	if (reader->param.trace_fd) {
+		trace_file_unroll(&reader->param);
 		close(reader->param.trace_fd);
 	}
+
+	if (reader->param.event_fd > 0) {
+		close(reader->param.event_fd);
+		reader->param.event_fd = -1;
+	}
 }
 
 static void handle_on_exit(void)
@@ -365,14 +703,24 @@ int main(int argc, char *argv[])
 			numa_bitmask_setbit(cpu_bitmask, dev_id);
 	}
 
+	/* the filter outlives this run, so an unfiltered run resets it */
+	if (set_trace_filter(filter_set) < 0 && filter_set)
+		exit(EXIT_FAILURE);
+
 	reader = calloc(1, sizeof(reader_struct) * dev_cnt);
 	if (!reader) {
 		pr_err("Failed to allocate reader memory\n");
 		exit(EXIT_FAILURE);
 	}
 
+	/* the analyzer keeps statistics only, no trace file */
+	if (stream_interval && analyzer_init(dev_cnt, stream_interval, textfile)) {
+		pr_err("Failed to allocate analyzer memory\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* create dir for trace file */
-	if (create_trace_file_dir(trace_file_dir)) {
+	if (!stream_interval && create_trace_file_dir(trace_file_dir)) {
 		pr_err("Failed to create dir for trace files\n");
 		exit(EXIT_FAILURE);
 	}
@@ -396,6 +744,9 @@ int main(int argc, char *argv[])
 				goto out_free;
 	}
 
+	if (stream_interval && analyzer_start())
+		goto out_free;
+
 	/* for kill exit handling */
 	signal(SIGTERM, signal_exit_handler);
 	signal(SIGINT, signal_exit_handler);
@@ -4,6 +4,8 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#ifndef ACRNTRACE_H
+#define ACRNTRACE_H
 
 #include "sbuf.h"
 
@@ -38,9 +40,13 @@
  * flags:
  * FLAG_TO_REL   - resources need to be release
  * FLAG_CLEAR_BUF - to clear buffered old data
+ * FLAG_COMPACT  - ask the hypervisor for variable-length records
+ * FLAG_PIN      - pin each reader thread to a CPU
  */
 #define FLAG_TO_REL		(1UL << 0)
 #define FLAG_CLEAR_BUF		(1UL << 1)
+#define FLAG_COMPACT		(1UL << 2)
+#define FLAG_PIN		(1UL << 3)
 
 #define foreach_dev(dev_id)                                       \
         for ((dev_id) = 0; (dev_id) < (dev_cnt); (dev_id)++)
@@ -70,10 +76,29 @@ typedef struct {
 	};
 } trace_ev_t;
 
+/* same layout as struct acrn_trace_filter of the hypervisor */
+typedef struct {
+	uint32_t class_mask;
+	uint32_t reserved;
+	uint64_t vm_mask;
+	uint64_t vmexit_mask[2];
+} trace_filter_t;
+
+#define TRACE_CLASS_ALL		0x7FU
+#define TRACE_VMEXIT_REASON_MAX	128
+
+#define HSM_DEV_PATH		"/dev/acrn_hsm"
+#define ACRN_IOCTL_TYPE		0xA2
+#define ACRN_IOCTL_SET_TRACE_FILTER	_IOW(ACRN_IOCTL_TYPE, 0xb0, trace_filter_t)
+#define ACRN_IOCTL_SETUP_SBUF_EVENT_FD	_IOW(ACRN_IOCTL_TYPE, 0xb1, int)
+
 typedef struct {
 	uint32_t devid;
 	int exit_flag;
 	int trace_fd;
+	int event_fd;	/* signaled on a watermark upcall, -1 to poll */
+	uint64_t ring_pos;	/* write offset in the trace file in ring mode */
+	int ring_wrapped;
 	shared_buf_t *sbuf;
 	pthread_mutex_t *sbuf_lock;
 } param_t;
@@ -84,3 +109,5 @@ typedef struct {
 	pthread_t thrd;
 	param_t param;
 } reader_struct;
+
+#endif /* ACRNTRACE_H */
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2018-2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <x86intrin.h>
+#include "analyze.h"
+
+/* event ids, see hypervisor/include/debug/trace.h */
+#define TRACE_VM_EXIT		0x10
+#define TRACE_VM_ENTER		0x11
+#define TRACE_SCHED_NEXT	0x20
+#define TRACE_IRQ		0x23
+
+#define NR_EXIT_REASONS		TRACE_VMEXIT_REASON_MAX
+#define NR_IRQS			256
+#define NR_OWNERS		66	/* VM 0-63, idle, unknown */
+#define OWNER_IDLE		64
+#define OWNER_UNKNOWN		65
+
+/*
+ * Log-linear latency histogram: 4 buckets per power of two, so a percentile
+ * is within 25% of the real value, up to 2^32 cycles.
+ */
+#define HIST_SUB_BITS		2
+#define HIST_BUCKETS		128
+
+struct cpu_stat {
+	pthread_mutex_t lock;
+
+	/* pending VM exit */
+	int in_exit;
+	uint32_t exit_reason;
+	uint64_t exit_tsc;
+
+	/* owner of the pCPU since the last TRACE_SCHED_NEXT */
+	int owner;
+	uint64_t owner_tsc;
+
+	uint64_t exits[NR_EXIT_REASONS];
+	uint64_t exit_cycles[NR_EXIT_REASONS];
+	uint32_t exit_hist[NR_EXIT_REASONS][HIST_BUCKETS];
+	uint64_t irqs[NR_IRQS];
+	uint64_t owner_cycles[NR_OWNERS];
+	uint64_t lost;	/* enter without exit or missing sched events */
+};
+
+static struct cpu_stat *stats;
+static struct cpu_stat *snap;
+static uint32_t stat_cpus;
+static uint32_t report_interval;
+static const char *report_file;
+static pthread_t report_thrd;
+
+static uint32_t hist_bucket(uint64_t v)
+{
+	uint32_t msb, b;
+
+	if (v < (1 << HIST_SUB_BITS))
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	b = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+		((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+
+	return (b < HIST_BUCKETS) ? b : (HIST_BUCKETS - 1);
+}
+
+static uint64_t hist_value(uint32_t b)
+{
+	uint32_t msb;
+
+	if (b < (1 << HIST_SUB_BITS))
+		return b;
+
+	msb = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+	return (uint64_t)((1 << HIST_SUB_BITS) + (b & ((1 << HIST_SUB_BITS) - 1)))
+		<< (msb - HIST_SUB_BITS);
+}
+
+static uint64_t hist_percentile(const uint32_t *hist, uint64_t total, uint32_t pct)
+{
+	uint64_t sum = 0, target = (total * pct + 99) / 100;
+	uint32_t b;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		sum += hist[b];
+		if (sum >= target)
+			return hist_value(b);
+	}
+
+	return hist_value(HIST_BUCKETS - 1);
+}
+
+/* "vm1:idle" style, the first 4 chars of the previous and the next thread */
+static int parse_owner(const char *name)
+{
+	int id;
+
+	if (name[0] == 'v' && name[1] == 'm' && name[2] >= '0' && name[2] <= '9') {
+		id = name[2] - '0';
+		if (name[3] >= '0' && name[3] <= '9')
+			id = id * 10 + name[3] - '0';
+		return (id < OWNER_IDLE) ? id : OWNER_UNKNOWN;
+	}
+
+	if (strncmp(name, "idle", 4) == 0)
+		return OWNER_IDLE;
+
+	return OWNER_UNKNOWN;
+}
+
+static void consume_one(struct cpu_stat *st, const trace_ev_t *ev)
+{
+	uint64_t id = ev->id & 0xffffffffffffUL;
+	uint64_t lat;
+	int owner;
+
+	switch (id) {
+	case TRACE_VM_EXIT:
+		st->in_exit = 1;
+		st->exit_reason = ev->e & (NR_EXIT_REASONS - 1);
+		st->exit_tsc = ev->tsc;
+		break;
+	case TRACE_VM_ENTER:
+		if (!st->in_exit) {
+			st->lost++;
+			break;
+		}
+		lat = ev->tsc - st->exit_tsc;
+		st->exits[st->exit_reason]++;
+		st->exit_cycles[st->exit_reason] += lat;
+		st->exit_hist[st->exit_reason][hist_bucket(lat)]++;
+		st->in_exit = 0;
+		break;
+	case TRACE_SCHED_NEXT:
+		owner = parse_owner(ev->str);
+		if (st->owner >= 0) {
+			if (owner != st->owner)
+				st->lost++;
+			st->owner_cycles[st->owner] += ev->tsc - st->owner_tsc;
+		}
+		st->owner = parse_owner(ev->str + 4);
+		st->owner_tsc = ev->tsc;
+		break;
+	case TRACE_IRQ:
+		st->irqs[(ev->e < NR_IRQS) ? ev->e : (NR_IRQS - 1)]++;
+		break;
+	default:
+		break;
+	}
+}
+
+void analyzer_consume(uint32_t cpu, const trace_ev_t *ev, uint32_t nr_ev)
+{
+	struct cpu_stat *st = &stats[cpu];
+	uint32_t i;
+
+	pthread_mutex_lock(&st->lock);
+	for (i = 0; i < nr_ev; i++)
+		consume_one(st, &ev[i]);
+	pthread_mutex_unlock(&st->lock);
+}
+
+/*
+ * Move the counters of the interval to snap and restart them. The pending
+ * exit and the pCPU owner carry over; the owner is charged up to now, which
+ * relies on the Service VM reading the same TSC as the hypervisor.
+ */
+static void take_snapshot(uint64_t now)
+{
+	struct cpu_stat *st, *sn;
+	uint32_t cpu;
+
+	for (cpu = 0; cpu < stat_cpus; cpu++) {
+		st = &stats[cpu];
+		sn = &snap[cpu];
+
+		pthread_mutex_lock(&st->lock);
+		if (st->owner >= 0 && now > st->owner_tsc) {
+			st->owner_cycles[st->owner] += now - st->owner_tsc;
+			st->owner_tsc = now;
+		}
+		memcpy(sn->exits, st->exits, sizeof(st->exits));
+		memcpy(sn->exit_cycles, st->exit_cycles, sizeof(st->exit_cycles));
+		memcpy(sn->exit_hist, st->exit_hist, sizeof(st->exit_hist));
+		memcpy(sn->irqs, st->irqs, sizeof(st->irqs));
+		memcpy(sn->owner_cycles, st->owner_cycles, sizeof(st->owner_cycles));
+		sn->lost = st->lost;
+		memset(st->exits, 0, sizeof(st->exits));
+		memset(st->exit_cycles, 0, sizeof(st->exit_cycles));
+		memset(st->exit_hist, 0, sizeof(st->exit_hist));
+		memset(st->irqs, 0, sizeof(st->irqs));
+		memset(st->owner_cycles, 0, sizeof(st->owner_cycles));
+		st->lost = 0;
+		pthread_mutex_unlock(&st->lock);
+	}
+}
+
+static void owner_label(int owner, char *buf, size_t len)
+{
+	if (owner == OWNER_IDLE)
+		snprintf(buf, len, "idle");
+	else if (owner == OWNER_UNKNOWN)
+		snprintf(buf, len, "unknown");
+	else
+		snprintf(buf, len, "vm%d", owner);
+}
+
+/* Prometheus text exposition format, all gauges over the last interval */
+static void write_report(FILE *fp, double secs, uint64_t cycles)
+{
+	static uint32_t hist[HIST_BUCKETS];
+	uint64_t n, total, lost = 0;
+	uint32_t cpu, r, b;
+	char label[16];
+	int o;
+
+	fprintf(fp, "# HELP acrn_vmexit_rate VM exits per second\n"
+		    "# TYPE acrn_vmexit_rate gauge\n");
+	for (r = 0; r < NR_EXIT_REASONS; r++) {
+		for (n = 0, cpu = 0; cpu < stat_cpus; cpu++)
+			n += snap[cpu].exits[r];
+		if (n)
+			fprintf(fp, "acrn_vmexit_rate{reason=\"%u\"} %.2f\n", r, n / secs);
+	}
+
+	fprintf(fp, "# HELP acrn_vmexit_latency_cycles TSC cycles from VM exit to VM entry\n"
+		    "# TYPE acrn_vmexit_latency_cycles summary\n");
+	for (r = 0; r < NR_EXIT_REASONS; r++) {
+		memset(hist, 0, sizeof(hist));
+		for (n = 0, total = 0, cpu = 0; cpu < stat_cpus; cpu++) {
+			n += snap[cpu].exits[r];
+			total += snap[cpu].exit_cycles[r];
+			for (b = 0; b < HIST_BUCKETS; b++)
+				hist[b] += snap[cpu].exit_hist[r][b];
+		}
+		if (!n)
+			continue;
+		fprintf(fp, "acrn_vmexit_latency_cycles{reason=\"%u\",quantile=\"0.5\"} %lu\n"
+			    "acrn_vmexit_latency_cycles{reason=\"%u\",quantile=\"0.9\"} %lu\n"
+			    "acrn_vmexit_latency_cycles{reason=\"%u\",quantile=\"0.99\"} %lu\n"
+			    "acrn_vmexit_latency_cycles_sum{reason=\"%u\"} %lu\n"
+			    "acrn_vmexit_latency_cycles_count{reason=\"%u\"} %lu\n",
+			r, hist_percentile(hist, n, 50), r, hist_percentile(hist, n, 90),
+			r, hist_percentile(hist, n, 99), r, total, r, n);
+	}
+
+	fprintf(fp, "# HELP acrn_irq_rate hypervisor IRQs per second\n"
+		    "# TYPE acrn_irq_rate gauge\n");
+	for (r = 0; r < NR_IRQS; r++) {
+		for (n = 0, cpu = 0; cpu < stat_cpus; cpu++)
+			n += snap[cpu].irqs[r];
+		if (n)
+			fprintf(fp, "acrn_irq_rate{irq=\"%u\"} %.2f\n", r, n / secs);
+	}
+
+	fprintf(fp, "# HELP acrn_cpu_usage_ratio share of the pCPU time per VM\n"
+		    "# TYPE acrn_cpu_usage_ratio gauge\n");
+	for (cpu = 0; cpu < stat_cpus; cpu++) {
+		lost += snap[cpu].lost;
+		for (o = 0; o < NR_OWNERS; o++) {
+			if (!snap[cpu].owner_cycles[o])
+				continue;
+			owner_label(o, label, sizeof(label));
+			fprintf(fp, "acrn_cpu_usage_ratio{cpu=\"%u\",vm=\"%s\"} %.4f\n",
+				cpu, label, (double)snap[cpu].owner_cycles[o] / cycles);
+		}
+	}
+
+	fprintf(fp, "# HELP acrn_trace_lost_pairs unmatched exit/entry or sched events\n"
+		    "# TYPE acrn_trace_lost_pairs gauge\n"
+		    "acrn_trace_lost_pairs %lu\n", lost);
+}
+
+static void publish_report(double secs, uint64_t cycles)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	if (!report_file) {
+		write_report(stdout, secs, cycles);
+		fflush(stdout);
+		return;
+	}
+
+	/* the textfile collector must never see a partial file */
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", report_file) >= sizeof(tmp)) {
+		pr_err("report file name is too long\n");
+		return;
+	}
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		pr_err("Failed to open %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	write_report(fp, secs, cycles);
+	if (fclose(fp) || rename(tmp, report_file))
+		pr_err("Failed to write %s: %s\n", report_file, strerror(errno));
+}
+
+static void *report_fn(void *arg)
+{
+	struct timespec last, now;
+	uint64_t last_tsc, now_tsc;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	last_tsc = __rdtsc();
+
+	while (1) {
+		sleep(report_interval);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_tsc = __rdtsc();
+		take_snapshot(now_tsc);
+
+		secs = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+		publish_report(secs, now_tsc - last_tsc);
+
+		last = now;
+		last_tsc = now_tsc;
+	}
+
+	return NULL;
+}
+
+int analyzer_init(uint32_t nr_cpus, uint32_t interval, const char *textfile)
+{
+	uint32_t cpu;
+
+	stats = calloc(nr_cpus, sizeof(*stats));
+	snap = calloc(nr_cpus, sizeof(*snap));
+	if (!stats || !snap) {
+		free(stats);
+		free(snap);
+		return -ENOMEM;
+	}
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		pthread_mutex_init(&stats[cpu].lock, NULL);
+		stats[cpu].owner = -1;
+	}
+
+	stat_cpus = nr_cpus;
+	report_interval = interval;
+	report_file = textfile;
+
+	return 0;
+}
+
+int analyzer_start(void)
+{
+	if (pthread_create(&report_thrd, NULL, report_fn, NULL)) {
+		pr_err("Failed to create the report thread\n");
+		return -1;
+	}
+
+	return 0;
+}
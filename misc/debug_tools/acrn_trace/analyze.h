@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2018-2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef ACRNTRACE_ANALYZE_H
+#define ACRNTRACE_ANALYZE_H
+
+#include "acrntrace.h"
+
+/*
+ * Streaming analyzer: the readers feed the trace records of their pCPU as
+ * they arrive and a report is printed, or written as a Prometheus textfile,
+ * every interval. No raw event is stored.
+ */
+int analyzer_init(uint32_t nr_cpus, uint32_t interval, const char *textfile);
+void analyzer_consume(uint32_t cpu, const trace_ev_t *ev, uint32_t nr_ev);
+int analyzer_start(void);
+
+#endif /* ACRNTRACE_ANALYZE_H */
@@ -71,6 +71,58 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 	return sbuf->ele_size;
 }
 
+/*
+ * Return the number of bytes readable in place at head, up to the end of the
+ * buffer, and point data at them. Release them with sbuf_consume().
+ */
+uint32_t sbuf_peek(shared_buf_t *sbuf, const void **data)
+{
+	uint32_t head = sbuf->head;
+	uint32_t tail = sbuf->tail;
+
+	*data = (void *)sbuf + SBUF_HEAD_SIZE + head;
+
+	return (tail >= head) ? (tail - head) : (sbuf->size - head);
+}
+
+void sbuf_consume(shared_buf_t *sbuf, uint32_t len)
+{
+	sbuf->head = sbuf_next_ptr(sbuf->head, len, sbuf->size);
+}
+
+int sbuf_write_var(int fd, shared_buf_t *sbuf)
+{
+	const uint8_t *start;
+	uint32_t len;
+	int written;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	if (sbuf_is_empty(sbuf)) {
+		return 0;
+	}
+
+	start = (uint8_t *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
+	len = *start;
+	if (len == 0) {
+		/* padding up to the end of the buffer */
+		sbuf->head = 0;
+		return 1;
+	}
+
+	written = write(fd, start, len);
+	if (written != (int)len) {
+		printf("Failed to write: ret %d (len %u), errno %d\n",
+			written, len, (written == -1) ? errno : 0);
+		return -1;
+	}
+
+	sbuf->head = sbuf_next_ptr(sbuf->head, len, sbuf->size);
+
+	return len;
+}
+
 int sbuf_clear_buffered(shared_buf_t *sbuf)
 {
 	if (sbuf == NULL)
@@ -16,6 +16,8 @@
 /* sbuf flags */
 #define OVERRUN_CNT_EN  (1ULL << 0) /* whether overrun counting is enabled */
 #define OVERWRITE_EN    (1ULL << 1) /* whether overwrite is enabled */
+#define SBUF_VAR_LEN    (1ULL << 2) /* records of variable length */
+#define SBUF_NOTIFY_EN  (1ULL << 3) /* raise the HSM upcall when filled up to watermark */
 
 typedef unsigned char uint8_t;
 typedef unsigned int uint32_t;
@@ -35,6 +37,9 @@ typedef unsigned long uint64_t;
  * |
  * |
  * shared_buf_t *buf
+ *
+ * With SBUF_VAR_LEN set, each record starts with its length in bytes and a
+ * length of 0 means the next record is at offset 0.
  */
 
 /* Make sure sizeof(shared_buf_t) == SBUF_HEAD_SIZE */
@@ -47,7 +52,8 @@ typedef struct shared_buf {
         uint64_t flags;
         uint32_t overrun_cnt;   /* count of overrun */
         uint32_t size;          /* ele_num * ele_size */
-        uint32_t padding[6];
+        uint32_t watermark;     /* fill level in bytes for SBUF_NOTIFY_EN */
+        uint32_t padding[5];
 } shared_buf_t;
 
 static inline void sbuf_clear_flags(shared_buf_t *sbuf, uint64_t flags)
@@ -67,5 +73,8 @@ static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
 
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data);
 int sbuf_write(int fd, shared_buf_t *sbuf);
+uint32_t sbuf_peek(shared_buf_t *sbuf, const void **data);
+void sbuf_consume(shared_buf_t *sbuf, uint32_t len);
+int sbuf_write_var(int fd, shared_buf_t *sbuf);
 int sbuf_clear_buffered(shared_buf_t *sbuf);
 #endif /* SHARED_BUF_H */
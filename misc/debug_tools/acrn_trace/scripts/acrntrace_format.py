@@ -17,6 +17,7 @@ def usage():
 
           [options]
           -h: print this message
+          -z: trace_data was recorded with acrntrace -z (compact records)
 
           Parses trace_data in binary format generated by acrntrace and
           reformats it according to the rules in the [formats] file.
@@ -172,14 +173,89 @@ def main_loop(formats, fd):
         except struct.error:
             sys.exit()
 
+# structure of compact trace data (acrntrace -z)
+# LEN(B) TYPE(B) EVENT(varint) TIME D...
+# TYPE is n_data of the event, with 0x80 set for a sync record
+# TIME is CPU(B) TSC(Q) in a sync record, else a varint TSC delta from the
+# previous record of the same cpu (the file of one cpu only has its records)
+# D is varints for 2 and 4 data, 6 bytes for 8 data and a string for 16 data
+REC_SYNC = 0x80
+
+def read_varint(rec, pos):
+    val = 0
+    shift = 0
+    while True:
+        b = rec[pos]
+        pos = pos + 1
+        val = val | ((b & 0x7f) << shift)
+        shift = shift + 7
+        if b < 0x80:
+            return (val, pos)
+
+def compact_loop(formats, fd):
+    global exit
+    cpu = None
+    tsc = 0
+
+    while not exit:
+        line = fd.read(1)
+        if not line:
+            break
+        rec = bytearray(line) + bytearray(fd.read(line[0] - 1))
+        if len(rec) != line[0]:
+            break
+
+        try:
+            n_data = rec[1] & ~REC_SYNC
+            (event, pos) = read_varint(rec, 2)
+            if rec[1] & REC_SYNC:
+                cpu = rec[pos]
+                tsc = struct.unpack_from("Q", rec, pos + 1)[0]
+                pos = pos + 9
+            elif cpu is None:
+                # deltas are meaningless until the first sync record
+                continue
+            else:
+                (delta, pos) = read_varint(rec, pos)
+                tsc = tsc + delta
+
+            d = [0] * 16
+            if n_data == 2 or n_data == 4:
+                for j in range(n_data):
+                    (d[j], pos) = read_varint(rec, pos)
+            elif n_data == 8:
+                d[0:6] = rec[pos:pos + 6]
+            elif n_data == 16:
+                d[0:len(rec) - pos] = struct.unpack_from("%db" % (len(rec) - pos), rec, pos)
+        except (IndexError, struct.error):
+            sys.exit()
+
+        args = {'cpu'   : cpu,
+                'tsc'   : tsc,
+                'event' : event }
+        for j in range(16):
+            args[str(j + 1)] = d[j]
+
+        try:
+            if str(event) in formats.keys():
+                print (formats[str(event)] % args)
+        except TypeError:
+            if str(event) in formats.keys():
+                print (formats[str(event)])
+                print (args)
+
 def main(argv):
+    compact = False
+
     try:
-        opts, arg = getopt.getopt(sys.argv[1:], "h")
+        opts, arg = getopt.getopt(sys.argv[1:], "hz")
 
         for opt in opts:
             if opt[0] == '-h':
                 usage()
                 sys.exit()
+            if opt[0] == '-z':
+                compact = True
 
     except getopt.GetoptError:
         usage()
@@ -191,7 +267,10 @@ def main(argv):
     except IOError:
         sys.exit(1)
 
-    main_loop(formats, fd)
+    if compact:
+        compact_loop(formats, fd)
+    else:
+        main_loop(formats, fd)
 
 if __name__ == "__main__":
     main(sys.argv[1:])
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * vsock_perf measures the round trip time and the bandwidth of AF_VSOCK
+ * stream sockets between the Service VM and a User VM: one side serves,
+ * the other one connects to it by CID and drives the tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/vm_sockets.h>
+
+#define DEFAULT_PORT		1234
+#define DEFAULT_RTT_SIZE	64
+#define DEFAULT_RTT_COUNT	10000
+#define DEFAULT_BW_SIZE		(64 * 1024)
+#define DEFAULT_BW_SECONDS	10
+#define MAX_MSG_SIZE		(4 * 1024 * 1024)
+
+/* the first message of a connection tells the server what to do */
+enum perf_test {
+	PERF_TEST_RTT = 1,
+	PERF_TEST_BW,
+};
+
+struct perf_hdr {
+	uint32_t test;
+	uint32_t size;		/* of the messages */
+	uint64_t count;		/* RTT: messages to echo */
+};
+
+static unsigned int port = DEFAULT_PORT;
+static unsigned long sock_buf_size;
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s -s [-p port] [-b bytes]\n"
+	       "       %s -c cid [-p port] [-b bytes] [-r] [-w] [-l size]"
+	       " [-n count] [-t seconds]\n"
+	       "  -s  serve the tests\n"
+	       "  -c  connect to the server of this CID (2 is the Service VM)\n"
+	       "  -p  port, %d by default\n"
+	       "  -b  vsock buffer size of the sockets\n"
+	       "  -r  round trip test only\n"
+	       "  -w  bandwidth test only\n"
+	       "  -l  message size, %d for the round trips and %d for the"
+	       " bandwidth by default\n"
+	       "  -n  round trips, %d by default\n"
+	       "  -t  seconds of the bandwidth test, %d by default\n",
+	       prog, prog, DEFAULT_PORT, DEFAULT_RTT_SIZE, DEFAULT_BW_SIZE,
+	       DEFAULT_RTT_COUNT, DEFAULT_BW_SECONDS);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(fd, (char *)buf + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = write(fd, (const char *)buf + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static void set_buf_size(int fd)
+{
+	unsigned long long size = sock_buf_size;
+
+	if (size == 0)
+		return;
+
+	/* the max has to be raised first for a size above it */
+	if (setsockopt(fd, AF_VSOCK, SO_VM_SOCKETS_BUFFER_MAX_SIZE,
+		       &size, sizeof(size)) < 0 ||
+	    setsockopt(fd, AF_VSOCK, SO_VM_SOCKETS_BUFFER_SIZE,
+		       &size, sizeof(size)) < 0)
+		fprintf(stderr, "failed to set the buffer size: %s\n",
+			strerror(errno));
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void serve_rtt(int fd, struct perf_hdr *hdr, char *buf)
+{
+	uint64_t i;
+
+	for (i = 0; i < hdr->count; i++) {
+		if (read_full(fd, buf, hdr->size) < 0 ||
+		    write_full(fd, buf, hdr->size) < 0) {
+			fprintf(stderr, "rtt: connection lost\n");
+			return;
+		}
+	}
+}
+
+static void serve_bw(int fd, struct perf_hdr *hdr, char *buf)
+{
+	uint64_t total = 0;
+	ssize_t n;
+
+	/* the client closes its side at the end, the total is the ack */
+	while ((n = read(fd, buf, hdr->size)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "bw: read failed: %s\n",
+				strerror(errno));
+			return;
+		}
+		total += n;
+	}
+	(void)write_full(fd, &total, sizeof(total));
+}
+
+static int run_server(void)
+{
+	struct sockaddr_vm addr;
+	struct perf_hdr hdr;
+	int lfd, fd;
+	char *buf;
+
+	lfd = socket(AF_VSOCK, SOCK_STREAM, 0);
+	if (lfd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.svm_family = AF_VSOCK;
+	addr.svm_cid = VMADDR_CID_ANY;
+	addr.svm_port = port;
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 1) < 0) {
+		perror("bind/listen");
+		close(lfd);
+		return -1;
+	}
+
+	buf = malloc(MAX_MSG_SIZE);
+	if (!buf) {
+		close(lfd);
+		return -1;
+	}
+
+	printf("serving on port %u\n", port);
+	while (1) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		set_buf_size(fd);
+
+		if (read_full(fd, &hdr, sizeof(hdr)) < 0 ||
+		    hdr.size == 0 || hdr.size > MAX_MSG_SIZE) {
+			fprintf(stderr, "bad test request\n");
+		} else if (hdr.test == PERF_TEST_RTT) {
+			serve_rtt(fd, &hdr, buf);
+		} else if (hdr.test == PERF_TEST_BW) {
+			serve_bw(fd, &hdr, buf);
+		}
+		close(fd);
+	}
+
+	free(buf);
+	close(lfd);
+	return -1;
+}
+
+static int connect_to(unsigned int cid)
+{
+	struct sockaddr_vm addr;
+	int fd;
+
+	fd = socket(AF_VSOCK, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	set_buf_size(fd);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.svm_family = AF_VSOCK;
+	addr.svm_cid = cid;
+	addr.svm_port = port;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int test_rtt(unsigned int cid, uint32_t size, uint64_t count)
+{
+	struct perf_hdr hdr = { PERF_TEST_RTT, size, count };
+	uint64_t *samples, start, sum = 0;
+	uint64_t i;
+	char *buf;
+	int fd, ret = -1;
+
+	samples = calloc(count, sizeof(*samples));
+	buf = calloc(1, size);
+	fd = connect_to(cid);
+	if (!samples || !buf || fd < 0)
+		goto out;
+
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		start = now_ns();
+		if (write_full(fd, buf, size) < 0 ||
+		    read_full(fd, buf, size) < 0) {
+			fprintf(stderr, "rtt: connection lost\n");
+			goto out;
+		}
+		samples[i] = now_ns() - start;
+		sum += samples[i];
+	}
+
+	qsort(samples, count, sizeof(*samples), cmp_u64);
+	printf("rtt of %u bytes, %lu round trips: min %.1f avg %.1f "
+	       "p50 %.1f p99 %.1f max %.1f us\n", size, count,
+	       samples[0] / 1000.0, sum / count / 1000.0,
+	       samples[count / 2] / 1000.0,
+	       samples[count * 99 / 100] / 1000.0,
+	       samples[count - 1] / 1000.0);
+	ret = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	free(samples);
+	return ret;
+}
+
+static int test_bw(unsigned int cid, uint32_t size, unsigned int seconds)
+{
+	struct perf_hdr hdr = { PERF_TEST_BW, size, 0 };
+	uint64_t start, end, sent = 0, received;
+	double secs;
+	char *buf;
+	int fd, ret = -1;
+
+	buf = calloc(1, size);
+	fd = connect_to(cid);
+	if (!buf || fd < 0)
+		goto out;
+
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0)
+		goto out;
+
+	start = now_ns();
+	end = start + (uint64_t)seconds * 1000000000UL;
+	while (now_ns() < end) {
+		if (write_full(fd, buf, size) < 0) {
+			fprintf(stderr, "bw: connection lost\n");
+			goto out;
+		}
+		sent += size;
+	}
+
+	/* the bandwidth counts until the server got all of it */
+	shutdown(fd, SHUT_WR);
+	if (read_full(fd, &received, sizeof(received)) < 0) {
+		fprintf(stderr, "bw: no ack from the server\n");
+		goto out;
+	}
+	secs = (now_ns() - start) / 1e9;
+	if (received != sent)
+		fprintf(stderr, "bw: sent %lu bytes, received %lu\n",
+			sent, received);
+
+	printf("bandwidth with %u byte writes: %lu bytes in %.2f s, "
+	       "%.1f MB/s, %.2f Gbit/s\n", size, received, secs,
+	       received / secs / 1e6, received * 8 / secs / 1e9);
+	ret = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	bool server = false, rtt = true, bw = true;
+	unsigned int cid = 0, seconds = DEFAULT_BW_SECONDS;
+	unsigned long count = DEFAULT_RTT_COUNT, size = 0;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "sc:p:b:rwl:n:t:h")) != -1) {
+		switch (opt) {
+		case 's':
+			server = true;
+			break;
+		case 'c':
+			cid = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			port = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			sock_buf_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			bw = false;
+			break;
+		case 'w':
+			rtt = false;
+			break;
+		case 'l':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (server)
+		return run_server() < 0 ? 1 : 0;
+
+	if (cid == 0 || count == 0 || seconds == 0 || size > MAX_MSG_SIZE ||
+	    (!rtt && !bw)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (rtt && test_rtt(cid, size ? size : DEFAULT_RTT_SIZE, count) < 0)
+		ret = 1;
+	if (bw && test_bw(cid, size ? size : DEFAULT_BW_SIZE, seconds) < 0)
+		ret = 1;
+	return ret;
+}
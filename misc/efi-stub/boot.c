@@ -42,6 +42,17 @@ EFI_BOOT_SERVICES *boot;
 EFI_RUNTIME_SERVICES *runtime;
 HV_LOADER hvld;
 
+/*
+ * TSC of the stages of the stub, in the boot command of the hypervisor as
+ * efi_boot_tsc=<entry>,<images>,<handoff> for its boot_time phases
+ */
+#define EFI_BOOT_TSC_ARG	"efi_boot_tsc="
+#define EFI_STAGE_ENTRY		0
+#define EFI_STAGE_IMAGES	1
+#define EFI_STAGE_HANDOFF	2
+#define EFI_STAGE_NUM		3
+static UINT64 efi_boot_tsc[EFI_STAGE_NUM];
+
 EFI_STATUS
 get_efi_memmap(struct efi_memmap_info *mi, int size_only)
 {
@@ -586,6 +597,41 @@ out:
 	return err;
 }
 
+static char *
+hex_to_str(char *p, UINT64 val)
+{
+	static const char digits[] = "0123456789abcdef";
+	int shift = 60;
+
+	while (shift > 0 && (val >> shift) == 0)
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		*p++ = digits[(val >> shift) & 0xf];
+
+	return p;
+}
+
+static void
+append_boot_time(HV_LOADER hvld)
+{
+	char arg[sizeof(EFI_BOOT_TSC_ARG) + EFI_STAGE_NUM * 17];
+	char *p = arg;
+	int i;
+
+	memcpy(p, EFI_BOOT_TSC_ARG, sizeof(EFI_BOOT_TSC_ARG) - 1);
+	p += sizeof(EFI_BOOT_TSC_ARG) - 1;
+	for (i = 0; i < EFI_STAGE_NUM; i++) {
+		if (i > 0)
+			*p++ = ',';
+		p = hex_to_str(p, efi_boot_tsc[i]);
+	}
+	*p = '\0';
+
+	/* boot time is informational only, boot on without it */
+	if (hvld->append_boot_cmd(hvld, arg) != EFI_SUCCESS)
+		Print(L"No room for the boot time in the boot command\n");
+}
+
 static EFI_STATUS
 run_acrn(EFI_HANDLE image, HV_LOADER hvld)
 {
@@ -599,6 +645,10 @@ run_acrn(EFI_HANDLE image, HV_LOADER hvld)
 	if (err != EFI_SUCCESS && err != EFI_NOT_FOUND)
 		goto out;
 
+	/* the boot services exit right after the multiboot info built */
+	efi_boot_tsc[EFI_STAGE_HANDOFF] = rdtsc();
+	append_boot_time(hvld);
+
 	if (mb_version == 2) {
 		err = construct_mbi2(hvld, &mbi, &memmapinfo);
 	}
@@ -636,6 +686,8 @@ efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *_table)
 
 	INTN index;
 
+	efi_boot_tsc[EFI_STAGE_ENTRY] = rdtsc();
+
 	InitializeLib(image, _table);
 	sys_table = _table;
 	boot = sys_table->BootServices;
@@ -673,6 +725,7 @@ efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *_table)
 		Print(L"Unable to load VM modules %r ", err);
 		goto failed;
 	}
+	efi_boot_tsc[EFI_STAGE_IMAGES] = rdtsc();
 
 	err = run_acrn(image, hvld);
 	if (err != EFI_SUCCESS)
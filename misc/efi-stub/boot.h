@@ -77,6 +77,14 @@
 	*msr_val_ptr = ((uint64_t)msrh << 32U) | msrl;           \
 }
 
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32U) | lo;
+}
+
 EFI_STATUS get_pe_section(CHAR8 *base, char *section_name, UINTN section_name_len, UINTN *vaddr, UINTN *size);
 typedef void(*hv_func)(int32_t, struct multiboot_info*);
 
@@ -186,6 +194,8 @@ struct hv_loader {
 	const char *(*get_boot_cmd)(IN HV_LOADER hvld);
 	/* Get hypervisor boot command length */
 	UINTN (*get_boot_cmdsize)(IN HV_LOADER hvld);
+	/* Append an argument to hypervisor boot command */
+	EFI_STATUS (*append_boot_cmd)(IN HV_LOADER hvld, IN const char *arg);
 
 	MB_MODULE_INFO *(*get_mods_info)(IN HV_LOADER hvld, UINTN index);
 	/* Get the number of multiboot2 modules */
@@ -361,7 +361,7 @@ out:
 	} else {
 		/* We put modules after hv */
 		UINTN hv_ram_size = ctr->laddr->load_end_addr - ctr->laddr->load_addr;
-		err = emalloc_fixed_addr(&(ctr->mod_hpa), hv_ram_size, ctr->hv_hpa + ALIGN_UP(hv_ram_size, EFI_PAGE_SIZE));
+		err = emalloc_fixed_addr(&(ctr->mod_hpa), ctr->total_modsize, ctr->hv_hpa + ALIGN_UP(hv_ram_size, EFI_PAGE_SIZE));
 	}
 	if (err != EFI_SUCCESS) {
 		Print(L"Failed to allocate memory for modules %r\n", err);
@@ -410,6 +410,32 @@ static UINTN container_get_boot_cmdsize(HV_LOADER hvld)
 	return ((struct container *)hvld)->boot_cmdsize;
 }
 
+/**
+ * @brief Append an argument to hypervisor boot command
+ *
+ * @param[in] hvld Loader handle
+ * @param[in] arg  Argument to append, separated by a space
+ *
+ * @return EFI_SUCCESS(0) on success, EFI_BUFFER_TOO_SMALL if the command would exceed MAX_BOOTCMD_SIZE
+ */
+static EFI_STATUS container_append_boot_cmd(HV_LOADER hvld, const char *arg)
+{
+	struct container *ctr = (struct container *)hvld;
+	UINTN len = strlen(ctr->boot_cmd);
+	UINTN arg_len = strlen(arg);
+
+	if ((len + 1 + arg_len + 1) > MAX_BOOTCMD_SIZE) {
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	ctr->boot_cmd[len] = ' ';
+	memcpy(&ctr->boot_cmd[len + 1], arg, arg_len);
+	ctr->boot_cmd[len + 1 + arg_len] = '\0';
+	ctr->boot_cmdsize = len + 1 + arg_len + 1;
+
+	return EFI_SUCCESS;
+}
+
 /**
  * @brief Get boot module info
  *
@@ -549,6 +575,7 @@ static struct hv_loader container_ops = {
 	.load_modules = container_load_modules,
 	.get_boot_cmd = container_get_boot_cmd,
 	.get_boot_cmdsize = container_get_boot_cmdsize,
+	.append_boot_cmd = container_append_boot_cmd,
 	.get_mods_info = container_get_mods_info,
 	.get_total_modsize = container_get_total_modsize,
 	.get_total_modcmdsize = container_get_total_modcmdsize,
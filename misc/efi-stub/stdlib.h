@@ -46,21 +46,24 @@
 #include <efi.h>
 #include <efilib.h>
 
+/*
+ * The string instructions move whole cache lines at a time on the CPUs with
+ * fast strings, the modules of several MB are copied with them.
+ */
 static inline void memset(void *dstv, char ch, UINTN size)
 {
-	char *dst = dstv;
-	int32_t i;
-
-	for (i = 0; i < size; i++)
-		dst[i] = ch;
+	asm volatile ("cld; rep stosb"
+		: "+D"(dstv), "+c"(size)
+		: "a"(ch)
+		: "memory");
 }
 
 static inline void memcpy(char *dst, const char *src, UINTN size)
 {
-	int32_t i;
-
-	for (i = 0; i < size; i++)
-		*dst++ = *src++;
+	asm volatile ("cld; rep movsb"
+		: "+D"(dst), "+S"(src), "+c"(size)
+		:
+		: "memory");
 }
 
 static inline int32_t strlen(const char *str)
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <util.h>
+#include <asm/page.h>
+#include <asm/tsc.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+#define BENCH_POOL_PAGES	4096U
+/* pages each pCPU holds at once, as a page table walk allocating its levels */
+#define BENCH_PAGES_HELD	4U
+
+static struct page pool_pages[BENCH_POOL_PAGES] __aligned(PAGE_SIZE);
+static uint64_t pool_bitmap[BENCH_POOL_PAGES / 64U];
+static struct page_cache pool_caches[MAX_PCPU_NUM];
+static struct page_pool pool = {
+	.start_page = pool_pages,
+	.bitmap = pool_bitmap,
+	.bitmap_size = BENCH_POOL_PAGES / 64U,
+};
+
+static uint64_t page_cycles[MAX_PCPU_NUM];
+
+/* allocate BENCH_PAGES_HELD pages and free them, until BENCH_ITERATIONS pages went through */
+static void page_alloc_free(uint16_t pcpu_id, __unused void *arg)
+{
+	struct page *pages[BENCH_PAGES_HELD];
+	uint64_t start;
+	uint32_t i, j;
+
+	start = rdtsc();
+	for (i = 0U; i < BENCH_ITERATIONS; i += BENCH_PAGES_HELD) {
+		for (j = 0U; j < BENCH_PAGES_HELD; j++) {
+			pages[j] = alloc_page(&pool);
+		}
+		for (j = 0U; j < BENCH_PAGES_HELD; j++) {
+			free_page(&pool, pages[j]);
+		}
+	}
+	page_cycles[pcpu_id] = rdtsc() - start;
+}
+
+/* one op is an alloc_page() and its free_page(), zeroing the page included */
+static void bench_page_contention(const char *name, struct page_cache *caches)
+{
+	uint16_t max_nr = min(MAX_PCPU_NUM, bench_nr_cpus());
+	uint64_t cycles;
+	uint16_t nr, i;
+
+	for (nr = 1U; nr <= max_nr; nr *= 2U) {
+		reset_page_pool(&pool, caches);
+		bench_run_threads(nr, page_alloc_free, NULL);
+		cycles = 0UL;
+		for (i = 0U; i < nr; i++) {
+			cycles += page_cycles[i];
+		}
+		bench_report(name, BENCH_POOL_PAGES, nr, (uint64_t)BENCH_ITERATIONS * nr, cycles);
+	}
+}
+
+void bench_page(void)
+{
+	bench_page_contention("page_alloc_free", NULL);
+	bench_page_contention("page_alloc_free_cached", pool_caches);
+}
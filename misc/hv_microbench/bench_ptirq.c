@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/guest/vm.h>
+#include <asm/tsc.h>
+#include <ptdev.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+#define BENCH_PTIRQ_VMS		4U
+
+static const uint32_t entry_counts[] = { 16U, 64U, 256U, 1024U };
+
+/* only the addresses of the VMs are looked at, as the owner of the entries */
+static struct acrn_vm vms[BENCH_PTIRQ_VMS];
+static struct ptirq_remapping_info *entries[CONFIG_MAX_PT_IRQ_ENTRIES];
+
+struct ptirq_lookup {
+	uint32_t n;
+	bool virt;
+	uint64_t cycles[MAX_PCPU_NUM];
+};
+
+/* MSI entries of devices 00:01.0 on, 8 vectors a device, spread over the VMs */
+static uint32_t add_ptirq_entries(uint32_t n)
+{
+	struct ptirq_remapping_info *entry;
+	uint32_t i;
+
+	for (i = 0U; i < n; i++) {
+		entry = ptirq_alloc_entry(&vms[(i / 8U) % BENCH_PTIRQ_VMS], PTDEV_INTR_MSI);
+		if (entry == NULL) {
+			break;
+		}
+		entry->phys_sid.msi_id.bdf = (uint16_t)(((i / 8U) + 1U) << 3U);
+		entry->phys_sid.msi_id.entry_nr = (uint16_t)(i % 8U);
+		entry->virt_sid.msi_id.bdf = (uint16_t)((((i / 8U) / BENCH_PTIRQ_VMS) + 1U) << 3U);
+		entry->virt_sid.msi_id.entry_nr = (uint16_t)(i % 8U);
+		(void)ptirq_activate_entry(entry, i);
+		entries[i] = entry;
+	}
+
+	return i;
+}
+
+static void remove_ptirq_entries(uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0U; i < n; i++) {
+		ptirq_deactivate_entry(entries[i]);
+		ptirq_release_entry(entries[i]);
+	}
+}
+
+/* look the entries up at random, by the source id the interrupt remapping or the guest sees */
+static void ptirq_lookup(uint16_t pcpu_id, void *arg)
+{
+	struct ptirq_lookup *lookup = (struct ptirq_lookup *)arg;
+	const struct ptirq_remapping_info *entry;
+	uint64_t seed = 0xBF58476D1CE4E5B9UL + pcpu_id, start;
+	uint32_t i;
+
+	start = rdtsc();
+	for (i = 0U; i < BENCH_ITERATIONS; i++) {
+		entry = entries[bench_rand(&seed) % lookup->n];
+		if (lookup->virt) {
+			entry = find_ptirq_entry(PTDEV_INTR_MSI, &entry->virt_sid, entry->vm);
+		} else {
+			entry = find_ptirq_entry(PTDEV_INTR_MSI, &entry->phys_sid, NULL);
+		}
+		if (entry == NULL) {
+			break;
+		}
+	}
+	lookup->cycles[pcpu_id] = rdtsc() - start;
+}
+
+static void bench_ptirq_lookup(const char *name, uint32_t n, bool virt, uint16_t nr_threads)
+{
+	struct ptirq_lookup lookup = { .n = n, .virt = virt };
+	uint64_t cycles = 0UL;
+	uint16_t i;
+
+	bench_run_threads(nr_threads, ptirq_lookup, &lookup);
+	for (i = 0U; i < nr_threads; i++) {
+		cycles += lookup.cycles[i];
+	}
+	bench_report(name, n, nr_threads, (uint64_t)BENCH_ITERATIONS * nr_threads, cycles);
+}
+
+void bench_ptirq(void)
+{
+	uint16_t nr_threads = min(MAX_PCPU_NUM, bench_nr_cpus());
+	uint32_t i, n;
+
+	for (i = 0U; (i < ARRAY_SIZE(entry_counts)) && (entry_counts[i] <= CONFIG_MAX_PT_IRQ_ENTRIES); i++) {
+		n = add_ptirq_entries(entry_counts[i]);
+		if (n != 0U) {
+			bench_ptirq_lookup("ptirq_lookup_phys", n, false, 1U);
+			bench_ptirq_lookup("ptirq_lookup_virt", n, true, 1U);
+			if (nr_threads > 1U) {
+				/* the lookups don't take ptdev_lock, they should scale */
+				bench_ptirq_lookup("ptirq_lookup_phys", n, false, nr_threads);
+			}
+		}
+		remove_ptirq_entries(n);
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <rtl.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <sbuf.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+#define SBUF_ELE_SIZE		64U
+#define SBUF_ELE_NUM		1024U
+#define SBUF_BATCH		16U
+
+static uint8_t sbuf_mem[SBUF_HEAD_SIZE + (SBUF_ELE_SIZE * SBUF_ELE_NUM)] __aligned(PAGE_SIZE);
+static struct shared_buf *sbuf = (struct shared_buf *)sbuf_mem;
+static uint8_t data[SBUF_ELE_SIZE * SBUF_BATCH];
+
+static void init_sbuf(void)
+{
+	(void)memset(sbuf, 0U, SBUF_HEAD_SIZE);
+	sbuf->magic = SBUF_MAGIC;
+	sbuf->ele_num = SBUF_ELE_NUM;
+	sbuf->ele_size = SBUF_ELE_SIZE;
+	sbuf->size = SBUF_ELE_NUM * SBUF_ELE_SIZE;
+}
+
+/* fill the sbuf up with batch elements a call, it is emptied at once between the fills */
+static void bench_sbuf_fill(const char *name, uint32_t batch)
+{
+	uint64_t start, cycles = 0UL, ops = 0UL;
+	uint32_t ret;
+
+	init_sbuf();
+	while (ops < BENCH_ITERATIONS) {
+		start = rdtsc();
+		do {
+			if (batch == 1U) {
+				ret = sbuf_put(sbuf, data, SBUF_ELE_SIZE);
+			} else {
+				ret = sbuf_put_many(sbuf, SBUF_ELE_SIZE, data, SBUF_ELE_SIZE * batch);
+			}
+			ops += ret / SBUF_ELE_SIZE;
+		} while (ret != 0U);
+		cycles += rdtsc() - start;
+		sbuf->head = sbuf->tail;
+	}
+	bench_report(name, SBUF_ELE_NUM, 1U, ops, cycles);
+}
+
+static uint64_t producer_cycles;
+
+/* pCPU 0 puts BENCH_ITERATIONS elements one by one, pCPU 1 takes them as the Service VM would */
+static void sbuf_producer_consumer(uint16_t pcpu_id, __unused void *arg)
+{
+	volatile struct shared_buf *vsbuf = sbuf;
+	uint8_t out[SBUF_ELE_SIZE];
+	uint64_t start;
+	uint32_t i, head;
+
+	if (pcpu_id == 0U) {
+		start = rdtsc();
+		for (i = 0U; i < BENCH_ITERATIONS; i++) {
+			while (sbuf_put(sbuf, data, SBUF_ELE_SIZE) == 0U) {
+				asm_pause();
+			}
+		}
+		producer_cycles = rdtsc() - start;
+	} else {
+		for (i = 0U; i < BENCH_ITERATIONS; i++) {
+			head = vsbuf->head;
+			while (head == vsbuf->tail) {
+				asm_pause();
+			}
+			(void)memcpy_s(out, SBUF_ELE_SIZE, sbuf_mem + SBUF_HEAD_SIZE + head, SBUF_ELE_SIZE);
+			cpu_memory_barrier();
+			vsbuf->head = sbuf_next_ptr(head, SBUF_ELE_SIZE, SBUF_ELE_NUM * SBUF_ELE_SIZE);
+		}
+	}
+}
+
+void bench_sbuf(void)
+{
+	bench_sbuf_fill("sbuf_put", 1U);
+	bench_sbuf_fill("sbuf_put_many16", SBUF_BATCH);
+
+	if (bench_nr_cpus() >= 2U) {
+		init_sbuf();
+		bench_run_threads(2U, sbuf_producer_consumer, NULL);
+		bench_report("sbuf_put_consumer", SBUF_ELE_NUM, 2U, BENCH_ITERATIONS, producer_cycles);
+	}
+}
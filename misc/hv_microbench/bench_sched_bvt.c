@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/per_cpu.h>
+#include <asm/tsc.h>
+#include <schedule.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+static const uint32_t thread_counts[] = { 2U, 4U, 8U, 16U };
+
+static struct thread_object threads[BVT_RUNQUEUE_MAX];
+
+/* the threads of pCPU 0 with weights 1 to 8, none of them in a gang */
+static void init_bvt_threads(struct sched_control *ctl)
+{
+	struct thread_object *idle = &per_cpu(idle, 0U);
+	struct sched_params params = { 0 };
+	uint32_t i;
+
+	idle->pcpu_id = 0U;
+	idle->sched_ctl = ctl;
+	ctl->pcpu_id = 0U;
+	ctl->scheduler = &sched_bvt;
+	ctl->curr_obj = idle;
+	(void)sched_bvt.init(ctl);
+
+	for (i = 0U; i < BVT_RUNQUEUE_MAX; i++) {
+		threads[i].pcpu_id = 0U;
+		threads[i].sched_ctl = ctl;
+		threads[i].status = THREAD_STS_BLOCKED;
+		params.bvt_weight = (uint8_t)((i % 8U) + 1U);
+		sched_bvt.init_data(&threads[i], &params);
+	}
+}
+
+/* put a random runnable thread to sleep and wake it up again */
+static void bench_bvt_sleep_wake(uint32_t n, uint64_t *seed)
+{
+	struct thread_object *obj;
+	uint64_t start, cycles;
+	uint32_t i;
+
+	start = rdtsc();
+	for (i = 0U; i < BENCH_ITERATIONS; i++) {
+		obj = &threads[bench_rand(seed) % n];
+		sched_bvt.sleep(obj);
+		sched_bvt.wake(obj);
+	}
+	cycles = rdtsc() - start;
+	bench_report("bvt_sleep_wake", n, 1U, BENCH_ITERATIONS, cycles);
+}
+
+/* pick the next thread as schedule() does, the current one is charged the time since its pick */
+static void bench_bvt_pick_next(struct sched_control *ctl, uint32_t n)
+{
+	uint64_t start, cycles;
+	uint32_t i;
+
+	start = rdtsc();
+	for (i = 0U; i < BENCH_ITERATIONS; i++) {
+		ctl->curr_obj = sched_bvt.pick_next(ctl);
+	}
+	cycles = rdtsc() - start;
+	bench_report("bvt_pick_next", n, 1U, BENCH_ITERATIONS, cycles);
+}
+
+void bench_sched_bvt(void)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, 0U);
+	uint64_t seed = 0x9E3779B97F4A7C15UL;
+	uint32_t i, j, n;
+
+	timer_init();
+	init_bvt_threads(ctl);
+	for (i = 0U; (i < ARRAY_SIZE(thread_counts)) && (thread_counts[i] <= BVT_RUNQUEUE_MAX); i++) {
+		n = thread_counts[i];
+		for (j = 0U; j < n; j++) {
+			sched_bvt.wake(&threads[j]);
+		}
+		bench_bvt_sleep_wake(n, &seed);
+		bench_bvt_pick_next(ctl, n);
+
+		for (j = 0U; j < n; j++) {
+			sched_bvt.sleep(&threads[j]);
+		}
+		ctl->curr_obj = sched_bvt.pick_next(ctl);
+	}
+	sched_bvt.deinit(ctl);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/per_cpu.h>
+#include <asm/tsc.h>
+#include <softirq.h>
+#include <timer.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+static const uint32_t timer_counts[] = { 16U, 64U, 256U, 1024U };
+
+static struct hv_timer timers[MAX_TIMERS_PER_PCPU];
+static struct hv_timer probe;
+
+static void timer_nop(__unused void *data)
+{
+}
+
+/* add and delete one timer while n - 1 others are queued, at scattered deadlines */
+static void bench_timer_add_del(uint32_t n, uint64_t *seed)
+{
+	uint64_t now = cpu_ticks(), start, cycles;
+	uint32_t i;
+
+	for (i = 0U; i < (n - 1U); i++) {
+		initialize_timer(&timers[i], timer_nop, NULL, now + (bench_rand(seed) >> 24U), 0UL);
+		(void)add_timer(&timers[i]);
+	}
+	initialize_timer(&probe, timer_nop, NULL, now, 0UL);
+
+	start = rdtsc();
+	for (i = 0U; i < BENCH_ITERATIONS; i++) {
+		update_timer(&probe, now + (bench_rand(seed) >> 24U), 0UL);
+		(void)add_timer(&probe);
+		del_timer(&probe);
+	}
+	cycles = rdtsc() - start;
+	bench_report("timer_add_del", n, 1U, BENCH_ITERATIONS, cycles);
+
+	for (i = 0U; i < (n - 1U); i++) {
+		del_timer(&timers[i]);
+	}
+}
+
+/* expire n one-shot timers from the timer softirq, as many passes as it takes */
+static void bench_timer_expire(uint32_t n, uint64_t *seed)
+{
+	const struct per_cpu_timers *cpu_timers = &per_cpu(cpu_timers, 0U);
+	uint64_t now, start, cycles = 0UL, ops = 0UL;
+	uint32_t i, round, rounds = (BENCH_ITERATIONS / n) + 1U;
+
+	for (round = 0U; round < rounds; round++) {
+		now = cpu_ticks();
+		for (i = 0U; i < n; i++) {
+			initialize_timer(&timers[i], timer_nop, NULL, now - (bench_rand(seed) >> 48U), 0UL);
+			(void)add_timer(&timers[i]);
+		}
+
+		start = rdtsc();
+		while (cpu_timers->nr_timers != 0U) {
+			run_softirq(SOFTIRQ_TIMER, 0U);
+		}
+		cycles += rdtsc() - start;
+		ops += n;
+	}
+	bench_report("timer_expire", n, 1U, ops, cycles);
+}
+
+void bench_timer(void)
+{
+	uint64_t seed = 0x2545F4914F6CDD1DUL;
+	uint32_t i;
+
+	timer_init();
+	for (i = 0U; (i < ARRAY_SIZE(timer_counts)) && (timer_counts[i] <= MAX_TIMERS_PER_PCPU); i++) {
+		bench_timer_add_del(timer_counts[i], &seed);
+		bench_timer_expire(timer_counts[i], &seed);
+	}
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HV_MICROBENCH_H
+#define HV_MICROBENCH_H
+
+/* shared by main.c, built with the C library, and the benchmarks, built with the hypervisor headers */
+
+#define BENCH_ITERATIONS	200000U
+
+struct bench {
+	const char *name;
+	const char *desc;
+	void (*run)(void);
+};
+
+typedef void (*bench_thread_fn)(uint16_t pcpu_id, void *arg);
+
+/*
+ * Run fn on nr_threads threads at once, the thread of pCPU i pinned to host
+ * CPU i, so nr_threads is at most bench_nr_cpus().
+ */
+void bench_run_threads(uint16_t nr_threads, bench_thread_fn fn, void *arg);
+uint16_t bench_nr_cpus(void);
+uint32_t bench_tsc_khz(void);
+void bench_report(const char *bench, uint32_t n, uint16_t threads, uint64_t ops, uint64_t cycles);
+
+void bench_timer(void);
+void bench_sched_bvt(void);
+void bench_sbuf(void);
+void bench_page(void);
+void bench_ptirq(void);
+
+#endif /* HV_MICROBENCH_H */
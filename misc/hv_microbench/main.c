@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * The host side of the harness: the threads playing the pCPUs, the TSC
+ * frequency, the report and the list of the benchmarks. It is built with the
+ * C library headers, the bench_*.c files with the hypervisor ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "hv_microbench.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+__thread uint16_t bench_pcpu_id;
+
+static uint32_t tsc_khz;
+static uint16_t nr_cpus;
+
+struct bench_thread {
+	pthread_t tid;
+	uint16_t pcpu_id;
+	bench_thread_fn fn;
+	void *arg;
+	pthread_barrier_t *barrier;
+};
+
+static inline uint64_t host_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* the TSC frequency stands in for cpu_tickrate(), measured over 100ms */
+static void calibrate_tsc_khz(void)
+{
+	uint64_t ns = now_ns(), tsc = host_rdtsc();
+
+	usleep(100000);
+	ns = now_ns() - ns;
+	tsc = host_rdtsc() - tsc;
+	tsc_khz = (uint32_t)((tsc * 1000000UL) / ns);
+}
+
+uint32_t bench_tsc_khz(void)
+{
+	return tsc_khz;
+}
+
+uint16_t bench_nr_cpus(void)
+{
+	return nr_cpus;
+}
+
+static void *bench_thread_main(void *data)
+{
+	struct bench_thread *t = data;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->pcpu_id, &set);
+	(void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	bench_pcpu_id = t->pcpu_id;
+	pthread_barrier_wait(t->barrier);
+	t->fn(t->pcpu_id, t->arg);
+
+	return NULL;
+}
+
+void bench_run_threads(uint16_t nr_threads, bench_thread_fn fn, void *arg)
+{
+	struct bench_thread *threads = calloc(nr_threads, sizeof(*threads));
+	pthread_barrier_t barrier;
+	uint16_t i;
+
+	if (threads == NULL) {
+		fprintf(stderr, "no memory for %u threads\n", nr_threads);
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, nr_threads);
+	for (i = 0U; i < nr_threads; i++) {
+		threads[i].pcpu_id = i;
+		threads[i].fn = fn;
+		threads[i].arg = arg;
+		threads[i].barrier = &barrier;
+		if (pthread_create(&threads[i].tid, NULL, bench_thread_main, &threads[i]) != 0) {
+			fprintf(stderr, "failed to create the thread of pCPU %u\n", i);
+			exit(1);
+		}
+	}
+	for (i = 0U; i < nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+}
+
+void bench_report(const char *bench, uint32_t n, uint16_t threads, uint64_t ops, uint64_t cycles)
+{
+	printf("{\"bench\": \"%s\", \"n\": %u, \"threads\": %u, \"ops\": %lu, \"cycles_per_op\": %.1f}\n",
+		bench, n, threads, ops, (ops != 0UL) ? ((double)cycles / (double)ops) : 0.0);
+	fflush(stdout);
+}
+
+static const struct bench benches[] = {
+	{ "timer", "hv_timer heap: add/del with N timers queued, expiry of N timers", bench_timer },
+	{ "bvt", "BVT runqueue: wake/sleep and pick_next with N runnable threads", bench_sched_bvt },
+	{ "sbuf", "shared buffer: put, put_many and put with a consumer on another pCPU", bench_sbuf },
+	{ "page", "page pool: alloc/free on N pCPUs, with and without the per-pCPU caches", bench_page },
+	{ "ptirq", "ptirq entries: lookup by physical and virtual source id among N entries", bench_ptirq },
+};
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-l] [benchmark...]\n"
+		"  Run the microbenchmarks of the hypervisor modules, all of them by default.\n"
+		"  Each result is a JSON object on one line, in TSC cycles per operation.\n"
+		"  -l  list the benchmarks\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t i;
+	int opt, j;
+	bool run;
+
+	while ((opt = getopt(argc, argv, "lh")) != -1) {
+		switch (opt) {
+		case 'l':
+			for (i = 0U; i < ARRAY_SIZE(benches); i++) {
+				printf("%-8s %s\n", benches[i].name, benches[i].desc);
+			}
+			return 0;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	for (j = optind; j < argc; j++) {
+		for (i = 0U; (i < ARRAY_SIZE(benches)) && (strcmp(argv[j], benches[i].name) != 0); i++) {
+		}
+		if (i == ARRAY_SIZE(benches)) {
+			fprintf(stderr, "unknown benchmark %s\n", argv[j]);
+			return 1;
+		}
+	}
+
+	/* a pCPU spinning on a lock must not wait for the holder to be scheduled back */
+	nr_cpus = (uint16_t)sysconf(_SC_NPROCESSORS_ONLN);
+	calibrate_tsc_khz();
+	bench_pcpu_id = 0U;
+	for (i = 0U; i < ARRAY_SIZE(benches); i++) {
+		run = (optind == argc);
+		for (j = optind; (j < argc) && !run; j++) {
+			run = (strcmp(argv[j], benches[i].name) == 0);
+		}
+		if (run) {
+			benches[i].run();
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * What the modules under test need from the rest of the hypervisor: the
+ * per-CPU regions, the TSC and the entry points of the modules which are not
+ * built. Those only record what a benchmark looks at, or do nothing.
+ */
+
+#include <types.h>
+#include <asm/per_cpu.h>
+#include <asm/tsc.h>
+#include <asm/guest/vm.h>
+#include <softirq.h>
+#include <schedule.h>
+#include <irq.h>
+#include <hv_microbench.h>
+#include "shim.h"
+
+struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
+
+static softirq_handler softirq_handlers[NR_SOFTIRQS];
+
+uint64_t cpu_ticks(void)
+{
+	return rdtsc();
+}
+
+uint32_t cpu_tickrate(void)
+{
+	return bench_tsc_khz();
+}
+
+uint32_t get_tsc_khz(void)
+{
+	return bench_tsc_khz();
+}
+
+void register_softirq(uint16_t nr, softirq_handler handler)
+{
+	softirq_handlers[nr] = handler;
+}
+
+/* the softirqs are not raised, a benchmark runs the handler it measures */
+void fire_softirq(__unused uint16_t nr)
+{
+}
+
+void run_softirq(uint16_t nr, uint16_t pcpu_id)
+{
+	if (softirq_handlers[nr] != NULL) {
+		softirq_handlers[nr](pcpu_id);
+	}
+}
+
+void init_hw_timer(void)
+{
+}
+
+void do_logmsg(__unused uint32_t severity, __unused const char *fmt, ...)
+{
+}
+
+void TRACE_2L(__unused uint32_t evid, __unused uint64_t e, __unused uint64_t f)
+{
+}
+
+void obtain_schedule_lock(uint16_t pcpu_id, uint64_t *rflag)
+{
+	spinlock_irqsave_obtain(&per_cpu(sched_ctl, pcpu_id).scheduler_lock, rflag);
+}
+
+void release_schedule_lock(uint16_t pcpu_id, uint64_t rflag)
+{
+	spinlock_irqrestore_release(&per_cpu(sched_ctl, pcpu_id).scheduler_lock, rflag);
+}
+
+void make_reschedule_request(uint16_t pcpu_id)
+{
+	bitmap_set_lock(NEED_RESCHEDULE, &per_cpu(sched_ctl, pcpu_id).flags);
+}
+
+bool is_idle_thread(const struct thread_object *obj)
+{
+	return (obj == &per_cpu(idle, obj->pcpu_id));
+}
+
+void sched_tick_start(__unused struct sched_control *ctl, __unused uint64_t tick_period)
+{
+}
+
+void sched_tick_stop(__unused struct sched_control *ctl)
+{
+}
+
+void arch_fire_hsm_interrupt(void)
+{
+}
+
+int32_t sbuf_share_setup(__unused uint16_t cpu_id, __unused uint32_t sbuf_id, __unused uint64_t *hva)
+{
+	return -1;
+}
+
+int32_t init_asyncio(__unused struct acrn_vm *vm, __unused uint64_t *hva)
+{
+	return -1;
+}
+
+int32_t init_vm_event(__unused struct acrn_vm *vm, __unused uint64_t *hva)
+{
+	return -1;
+}
+
+int32_t init_posted_io(__unused struct acrn_vm *vm, __unused uint64_t *hva)
+{
+	return -1;
+}
+
+int32_t init_msi_ring(__unused struct acrn_vm *vm, __unused uint64_t *hva)
+{
+	return -1;
+}
+
+/* the ptirq entries take no host vector, the phys_irq is handed back */
+int32_t request_irq(uint32_t req_irq, __unused irq_action_t action_fn, __unused void *priv_data,
+		__unused uint32_t flags)
+{
+	return (int32_t)req_irq;
+}
+
+void free_irq(__unused uint32_t irq)
+{
+}
+
+bool is_service_vm(__unused const struct acrn_vm *vm)
+{
+	return false;
+}
+
+bool is_pi_capable(__unused const struct acrn_vm *vm)
+{
+	return false;
+}
+
+void ptirq_softirq(__unused uint16_t pcpu_id)
+{
+}
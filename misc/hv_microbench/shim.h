@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HV_MICROBENCH_SHIM_H
+#define HV_MICROBENCH_SHIM_H
+
+/* run the handler a module registered with register_softirq() */
+void run_softirq(uint16_t nr, uint16_t pcpu_id);
+
+/* xorshift, the same sequence on every run */
+static inline uint64_t bench_rand(uint64_t *seed)
+{
+	*seed ^= *seed << 13U;
+	*seed ^= *seed >> 7U;
+	*seed ^= *seed << 17U;
+	return *seed;
+}
+
+#endif /* HV_MICROBENCH_SHIM_H */
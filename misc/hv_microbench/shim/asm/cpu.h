@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HV_MICROBENCH_ASM_CPU_H
+#define HV_MICROBENCH_ASM_CPU_H
+
+/*
+ * The hypervisor header is used as is, but for the accessors which would
+ * fault in user space: they are renamed away while it is included and
+ * replaced below. Each benchmark thread plays the pCPU bench_pcpu_id.
+ */
+#define stac			native_stac
+#define clac			native_clac
+#define get_pcpu_id		native_get_pcpu_id
+#define msr_read		native_msr_read
+#define msr_write		native_msr_write
+
+#include_next <asm/cpu.h>
+
+#undef stac
+#undef clac
+#undef get_pcpu_id
+#undef msr_read
+#undef msr_write
+
+/* the benchmark threads are not interrupted, rflags is still saved and restored */
+#undef CPU_IRQ_DISABLE_ON_CONFIG
+#define CPU_IRQ_DISABLE_ON_CONFIG()	do { } while (0)
+#undef CPU_IRQ_ENABLE_ON_CONFIG
+#define CPU_IRQ_ENABLE_ON_CONFIG()	do { } while (0)
+
+extern __thread uint16_t bench_pcpu_id;
+
+static inline void stac(void)
+{
+}
+
+static inline void clac(void)
+{
+}
+
+static inline uint16_t get_pcpu_id(void)
+{
+	return bench_pcpu_id;
+}
+
+/* the TSC deadline of the timers is all the benchmarks write, it is dropped */
+static inline uint64_t msr_read(__unused uint32_t reg_num)
+{
+	return 0UL;
+}
+
+static inline void msr_write(__unused uint32_t reg_num, __unused uint64_t value64)
+{
+}
+
+#endif /* HV_MICROBENCH_ASM_CPU_H */
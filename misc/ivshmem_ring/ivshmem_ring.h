@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Rings of fixed-size slots in an ivshmem region, between VMs
+ *
+ * A ring has one consumer and one or more producers, in the same VM or not.
+ * The producer and consumer indexes are in cache lines of their own, and are
+ * moved once per batch of slots: a producer reserves slots, fills them and
+ * publishes them all with one store, the consumer releases all the slots it
+ * took with one store.
+ *
+ * A side only sleeps on an empty (or full) ring after setting its waiting
+ * flag, and the other side rings the ivshmem doorbell only when it finds the
+ * flag set, clearing it: a consumer keeping up with the producers takes the
+ * slots without any interrupt, a sleeping one gets a single one.
+ *
+ * Only stdint.h and the GCC __atomic built-ins are needed, so that the rings
+ * build alike for Linux user space and for RTOS guests. The layout is shared
+ * by the VMs, IVSHMEM_RING_MAGIC changes with it.
+ */
+
+#ifndef IVSHMEM_RING_H
+#define IVSHMEM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define IVSHMEM_RING_MAGIC	0x31524849U	/* "IHR1" */
+#define IVSHMEM_RING_CACHELINE	64U
+
+struct ivshmem_ring {
+	/* set by ivshmem_ring_init(), read-only after */
+	uint32_t magic;
+	uint32_t nr_slots;	/* a power of 2 */
+	uint32_t slot_size;	/* a multiple of IVSHMEM_RING_CACHELINE */
+	uint8_t pad0[IVSHMEM_RING_CACHELINE - 12U];
+
+	/* written by the producers */
+	uint32_t prod_head;	/* the next slot to reserve */
+	uint32_t prod_tail;	/* the slots before it are published */
+	uint32_t prod_waiting;	/* a producer sleeps until slots are released */
+	uint8_t pad1[IVSHMEM_RING_CACHELINE - 12U];
+
+	/* written by the consumer */
+	uint32_t cons_tail;	/* the slots before it are released */
+	uint32_t cons_waiting;	/* the consumer sleeps until slots are published */
+	uint8_t pad2[IVSHMEM_RING_CACHELINE - 8U];
+
+	/* the slots follow */
+} __attribute__((aligned(IVSHMEM_RING_CACHELINE)));
+
+static inline void ivshmem_ring_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* The bytes a ring of nr_slots of slot_size takes in the region */
+static inline size_t ivshmem_ring_mem_size(uint32_t nr_slots, uint32_t slot_size)
+{
+	return sizeof(struct ivshmem_ring) + (size_t)nr_slots * slot_size;
+}
+
+/*
+ * Set up a ring at r, cache line aligned, by the side owning the region.
+ * The other side waits for ivshmem_ring_ready() before using it.
+ *
+ * Returns 0 on success, -1 if nr_slots isn't a power of 2 or slot_size
+ * isn't a multiple of the cache line size.
+ */
+static inline int ivshmem_ring_init(struct ivshmem_ring *r, uint32_t nr_slots, uint32_t slot_size)
+{
+	if ((nr_slots == 0U) || ((nr_slots & (nr_slots - 1U)) != 0U) ||
+			(slot_size == 0U) || ((slot_size % IVSHMEM_RING_CACHELINE) != 0U))
+		return -1;
+
+	__atomic_store_n(&r->magic, 0U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	r->nr_slots = nr_slots;
+	r->slot_size = slot_size;
+	r->prod_head = 0U;
+	r->prod_tail = 0U;
+	r->prod_waiting = 0U;
+	r->cons_tail = 0U;
+	r->cons_waiting = 0U;
+	__atomic_store_n(&r->magic, IVSHMEM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static inline bool ivshmem_ring_ready(const struct ivshmem_ring *r)
+{
+	return __atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) == IVSHMEM_RING_MAGIC;
+}
+
+/* The slot of index idx, the indexes run free and wrap at 2^32 */
+static inline void *ivshmem_ring_slot(struct ivshmem_ring *r, uint32_t idx)
+{
+	return (uint8_t *)(r + 1) + (size_t)(idx & (r->nr_slots - 1U)) * r->slot_size;
+}
+
+/*
+ * Producers
+ */
+
+/*
+ * Reserve up to n slots from *idx for a single producer.
+ *
+ * Returns the number of slots reserved, 0 if the ring is full.
+ */
+static inline uint32_t ivshmem_ring_sp_reserve(struct ivshmem_ring *r, uint32_t n, uint32_t *idx)
+{
+	uint32_t head = r->prod_head;
+	uint32_t avail = r->nr_slots - (head - __atomic_load_n(&r->cons_tail, __ATOMIC_ACQUIRE));
+
+	if (n > avail)
+		n = avail;
+	if (n != 0U) {
+		r->prod_head = head + n;
+		*idx = head;
+	}
+	return n;
+}
+
+/* The same for one of several producers, the slots are published in reservation order */
+static inline uint32_t ivshmem_ring_mp_reserve(struct ivshmem_ring *r, uint32_t n, uint32_t *idx)
+{
+	uint32_t head = __atomic_load_n(&r->prod_head, __ATOMIC_RELAXED);
+	uint32_t avail, got;
+
+	do {
+		avail = r->nr_slots - (head - __atomic_load_n(&r->cons_tail, __ATOMIC_ACQUIRE));
+		got = (n > avail) ? avail : n;
+		if (got == 0U)
+			return 0U;
+	} while (!__atomic_compare_exchange_n(&r->prod_head, &head, head + got, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	*idx = head;
+	return got;
+}
+
+/*
+ * Publish the n slots from idx got from a reserve, all at once.
+ *
+ * Returns true if the consumer sleeps: the caller rings the doorbell of its peer.
+ */
+static inline bool ivshmem_ring_commit(struct ivshmem_ring *r, uint32_t idx, uint32_t n)
+{
+	/* the slots reserved before have to be published first */
+	while (__atomic_load_n(&r->prod_tail, __ATOMIC_RELAXED) != idx)
+		ivshmem_ring_cpu_relax();
+	__atomic_store_n(&r->prod_tail, idx + n, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in ivshmem_ring_cons_prepare_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return (__atomic_load_n(&r->cons_waiting, __ATOMIC_RELAXED) != 0U) &&
+		(__atomic_exchange_n(&r->cons_waiting, 0U, __ATOMIC_RELAXED) != 0U);
+}
+
+/*
+ * Call before sleeping on a full ring, until n slots are free.
+ *
+ * Returns false if they are free already, true if the caller can sleep on
+ * the doorbell: the consumer rings it after releasing slots.
+ */
+static inline bool ivshmem_ring_prod_prepare_wait(struct ivshmem_ring *r, uint32_t n)
+{
+	uint32_t used;
+
+	__atomic_store_n(&r->prod_waiting, 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	used = __atomic_load_n(&r->prod_head, __ATOMIC_RELAXED) -
+		__atomic_load_n(&r->cons_tail, __ATOMIC_RELAXED);
+	if ((r->nr_slots - used) >= n) {
+		__atomic_store_n(&r->prod_waiting, 0U, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * The consumer
+ */
+
+/*
+ * The number of published slots from *idx, the slots to take.
+ */
+static inline uint32_t ivshmem_ring_peek(struct ivshmem_ring *r, uint32_t *idx)
+{
+	uint32_t tail = r->cons_tail;
+
+	*idx = tail;
+	return __atomic_load_n(&r->prod_tail, __ATOMIC_ACQUIRE) - tail;
+}
+
+/*
+ * Give the n first slots taken back to the producers, all at once.
+ *
+ * Returns true if a producer sleeps: the caller rings the doorbell of its peer.
+ */
+static inline bool ivshmem_ring_release(struct ivshmem_ring *r, uint32_t n)
+{
+	__atomic_store_n(&r->cons_tail, r->cons_tail + n, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in ivshmem_ring_prod_prepare_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return (__atomic_load_n(&r->prod_waiting, __ATOMIC_RELAXED) != 0U) &&
+		(__atomic_exchange_n(&r->prod_waiting, 0U, __ATOMIC_RELAXED) != 0U);
+}
+
+/*
+ * Call before sleeping on an empty ring.
+ *
+ * Returns false if slots are published already, true if the caller can sleep
+ * on the doorbell: the producer rings it after publishing slots.
+ */
+static inline bool ivshmem_ring_cons_prepare_wait(struct ivshmem_ring *r)
+{
+	uint32_t idx;
+
+	__atomic_store_n(&r->cons_waiting, 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (ivshmem_ring_peek(r, &idx) != 0U) {
+		__atomic_store_n(&r->cons_waiting, 0U, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+#endif /* IVSHMEM_RING_H */
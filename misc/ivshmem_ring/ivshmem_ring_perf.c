@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * ivshmem_ring_perf measures the latency and the throughput of the ivshmem
+ * rings between two VMs sharing an ivshmem region: one side serves, the
+ * other one drives the tests. The region holds two rings, the requests to
+ * the server in its first half and the replies in its second half.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+
+/* the ACRN kernel lets a UIO device signal its MSI-X vectors on eventfds */
+#if defined(__has_include)
+#if __has_include(<linux/uio/uio.h>)
+#include <linux/uio/uio.h>
+#endif
+#endif
+
+#include "ivshmem_ring.h"
+
+#define DEFAULT_SLOTS		256
+#define DEFAULT_SLOT_SIZE	256
+#define DEFAULT_RTT_COUNT	100000
+#define DEFAULT_BW_SECONDS	10
+#define DEFAULT_BATCH		32
+
+/* the ivshmem registers, in BAR0 */
+#define IVSHMEM_REGS_SIZE	256
+#define IVSHMEM_IV_POS_REG	0x8
+#define IVSHMEM_DOORBELL_REG	0xc
+
+enum perf_op {
+	PERF_OP_ECHO = 1,	/* sent back as is */
+	PERF_OP_DATA,		/* counted */
+	PERF_OP_SYNC,		/* answered with the DATA slots counted since the last one */
+};
+
+/* at the start of each slot */
+struct perf_msg {
+	uint32_t op;
+	uint32_t len;		/* of the payload after the header */
+	uint64_t seq;
+};
+
+struct perf_ctx {
+	void *shm;
+	size_t shm_size;
+	volatile uint32_t *regs;
+	int evt_fd;		/* doorbell mode */
+	uint32_t peer;
+	uint32_t vector;
+	struct ivshmem_ring *req;
+	struct ivshmem_ring *rsp;
+};
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s -s (-u uio | -f file) [-q slots] [-l slot_size] [-d -p peer]\n"
+	       "       %s -c (-u uio | -f file) [-d -p peer] [-r] [-w] [-n count]"
+	       " [-t seconds] [-b batch]\n"
+	       "  -s  serve the tests, setting the rings up\n"
+	       "  -c  run the tests\n"
+	       "  -u  number of the UIO device of the ivshmem device\n"
+	       "  -f  file shared instead of an ivshmem region, polling only\n"
+	       "  -q  slots per ring, %d by default\n"
+	       "  -l  bytes per slot, %d by default\n"
+	       "  -d  sleep on the doorbell instead of polling an empty ring\n"
+	       "  -p  IVPosition of the peer, rung by the doorbell\n"
+	       "  -v  MSI-X vector rung and waited for, 0 by default\n"
+	       "  -r  round trip test only\n"
+	       "  -w  throughput test only\n"
+	       "  -n  round trips, %d by default\n"
+	       "  -t  seconds of the throughput test, %d by default\n"
+	       "  -b  slots published at once in the throughput test, %d by default\n",
+	       prog, prog, DEFAULT_SLOTS, DEFAULT_SLOT_SIZE, DEFAULT_RTT_COUNT,
+	       DEFAULT_BW_SECONDS, DEFAULT_BATCH);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void *map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (*size == 0) {
+		if (fstat(fd, &st) < 0 || st.st_size == 0) {
+			fprintf(stderr, "failed to get the size of %s\n", path);
+			close(fd);
+			return NULL;
+		}
+		*size = st.st_size;
+	}
+
+	p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "failed to map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	return p;
+}
+
+static int setup_doorbell(struct perf_ctx *ctx, int uio)
+{
+#ifdef UIO_IRQ_DATA
+	struct uio_irq_data irq_data;
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/uio%d", uio);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	ctx->evt_fd = eventfd(0, 0);
+	irq_data.fd = ctx->evt_fd;
+	irq_data.vector = ctx->vector;
+	if (ctx->evt_fd < 0 || ioctl(fd, UIO_IRQ_DATA, &irq_data) < 0) {
+		fprintf(stderr, "failed to get the doorbell of vector %u: %s\n",
+			ctx->vector, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	/* the eventfd is left to the driver until the exit */
+	return 0;
+#else
+	(void)ctx;
+	(void)uio;
+	fprintf(stderr, "built without UIO_IRQ_DATA, the doorbell can't be waited for\n");
+	return -1;
+#endif
+}
+
+static int setup(struct perf_ctx *ctx, int uio, const char *file, bool doorbell)
+{
+	char path[64];
+	size_t size = 0, regs_size = IVSHMEM_REGS_SIZE;
+
+	ctx->evt_fd = -1;
+	if (file != NULL) {
+		if (doorbell) {
+			fprintf(stderr, "no doorbell with a file\n");
+			return -1;
+		}
+		ctx->shm = map_file(file, &size);
+	} else {
+		snprintf(path, sizeof(path), "/sys/class/uio/uio%d/device/resource2_wc", uio);
+		ctx->shm = map_file(path, &size);
+		snprintf(path, sizeof(path), "/sys/class/uio/uio%d/device/resource0", uio);
+		ctx->regs = map_file(path, &regs_size);
+		if (ctx->regs == NULL)
+			return -1;
+		printf("IVPosition %u\n", ctx->regs[IVSHMEM_IV_POS_REG / 4]);
+		if (doorbell && setup_doorbell(ctx, uio) < 0)
+			return -1;
+	}
+	if (ctx->shm == NULL)
+		return -1;
+
+	ctx->shm_size = size;
+	ctx->req = ctx->shm;
+	ctx->rsp = (struct ivshmem_ring *)((char *)ctx->shm + size / 2);
+	return 0;
+}
+
+static void ring_doorbell(struct perf_ctx *ctx)
+{
+	if (ctx->regs != NULL)
+		ctx->regs[IVSHMEM_DOORBELL_REG / 4] = (ctx->peer << 16) | ctx->vector;
+}
+
+/* sleep on the doorbell if prepared, or spin once */
+static void wait_peer(struct perf_ctx *ctx, bool prepared)
+{
+	eventfd_t val;
+
+	if (ctx->evt_fd >= 0 && prepared)
+		(void)eventfd_read(ctx->evt_fd, &val);
+	else
+		ivshmem_ring_cpu_relax();
+}
+
+/* take the published slot of r at *idx, waiting for it */
+static struct perf_msg *take(struct perf_ctx *ctx, struct ivshmem_ring *r, uint32_t *idx)
+{
+	while (ivshmem_ring_peek(r, idx) == 0)
+		wait_peer(ctx, ctx->evt_fd >= 0 && ivshmem_ring_cons_prepare_wait(r));
+	return ivshmem_ring_slot(r, *idx);
+}
+
+static void give_back(struct perf_ctx *ctx, struct ivshmem_ring *r, uint32_t n)
+{
+	if (ivshmem_ring_release(r, n))
+		ring_doorbell(ctx);
+}
+
+/* reserve up to n slots of r from *idx, waiting for one at least */
+static uint32_t reserve(struct perf_ctx *ctx, struct ivshmem_ring *r, uint32_t n, uint32_t *idx)
+{
+	uint32_t got;
+
+	while ((got = ivshmem_ring_sp_reserve(r, n, idx)) == 0)
+		wait_peer(ctx, ctx->evt_fd >= 0 && ivshmem_ring_prod_prepare_wait(r, 1));
+	return got;
+}
+
+static void publish(struct perf_ctx *ctx, struct ivshmem_ring *r, uint32_t idx, uint32_t n)
+{
+	if (ivshmem_ring_commit(r, idx, n))
+		ring_doorbell(ctx);
+}
+
+static int run_server(struct perf_ctx *ctx, uint32_t nr_slots, uint32_t slot_size)
+{
+	struct perf_msg *msg, *reply;
+	uint64_t counted = 0;
+	uint32_t idx, ridx, n, i;
+
+	if (ivshmem_ring_mem_size(nr_slots, slot_size) > ctx->shm_size / 2 ||
+	    slot_size < sizeof(*msg) ||
+	    ivshmem_ring_init(ctx->req, nr_slots, slot_size) < 0 ||
+	    ivshmem_ring_init(ctx->rsp, nr_slots, slot_size) < 0) {
+		fprintf(stderr, "%u slots of %u bytes don't fit in half of the %zu bytes\n",
+			nr_slots, slot_size, ctx->shm_size);
+		return -1;
+	}
+
+	printf("serving %u slots of %u bytes\n", nr_slots, slot_size);
+	while (1) {
+		(void)take(ctx, ctx->req, &idx);
+		n = ivshmem_ring_peek(ctx->req, &idx);
+		for (i = 0; i < n; i++) {
+			msg = ivshmem_ring_slot(ctx->req, idx + i);
+			if (msg->op == PERF_OP_DATA) {
+				counted++;
+				continue;
+			}
+
+			(void)reserve(ctx, ctx->rsp, 1, &ridx);
+			reply = ivshmem_ring_slot(ctx->rsp, ridx);
+			if (msg->op == PERF_OP_SYNC) {
+				reply->op = PERF_OP_SYNC;
+				reply->len = 0;
+				reply->seq = counted;
+				counted = 0;
+			} else {
+				memcpy(reply, msg, sizeof(*msg) + msg->len);
+			}
+			publish(ctx, ctx->rsp, ridx, 1);
+		}
+		/* the whole batch is given back at once */
+		give_back(ctx, ctx->req, n);
+	}
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int test_rtt(struct perf_ctx *ctx, uint64_t count)
+{
+	struct perf_msg *msg;
+	uint64_t *samples, start, sum = 0, i;
+	uint32_t idx;
+	size_t len = ctx->req->slot_size - sizeof(*msg);
+
+	samples = calloc(count, sizeof(*samples));
+	if (samples == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		start = now_ns();
+		(void)reserve(ctx, ctx->req, 1, &idx);
+		msg = ivshmem_ring_slot(ctx->req, idx);
+		msg->op = PERF_OP_ECHO;
+		msg->len = len;
+		msg->seq = i;
+		publish(ctx, ctx->req, idx, 1);
+
+		msg = take(ctx, ctx->rsp, &idx);
+		if (msg->op != PERF_OP_ECHO || msg->seq != i) {
+			fprintf(stderr, "rtt: got op %u seq %lu for %lu\n", msg->op, msg->seq, i);
+			free(samples);
+			return -1;
+		}
+		give_back(ctx, ctx->rsp, 1);
+		samples[i] = now_ns() - start;
+		sum += samples[i];
+	}
+
+	qsort(samples, count, sizeof(*samples), cmp_u64);
+	printf("rtt of %u byte slots, %lu round trips: min %.2f avg %.2f "
+	       "p50 %.2f p99 %.2f p99.9 %.2f max %.2f us\n", ctx->req->slot_size, count,
+	       samples[0] / 1000.0, sum / count / 1000.0,
+	       samples[count / 2] / 1000.0,
+	       samples[count * 99 / 100] / 1000.0,
+	       samples[count * 999 / 1000] / 1000.0,
+	       samples[count - 1] / 1000.0);
+	free(samples);
+	return 0;
+}
+
+static int test_bw(struct perf_ctx *ctx, unsigned int seconds, uint32_t batch)
+{
+	struct perf_msg *msg;
+	uint64_t start, end, sent = 0, batches = 0;
+	uint32_t idx, n, i;
+	uint32_t len = ctx->req->slot_size - sizeof(*msg);
+	double secs;
+
+	start = now_ns();
+	end = start + (uint64_t)seconds * 1000000000UL;
+	while (now_ns() < end) {
+		n = reserve(ctx, ctx->req, batch, &idx);
+		for (i = 0; i < n; i++) {
+			msg = ivshmem_ring_slot(ctx->req, idx + i);
+			msg->op = PERF_OP_DATA;
+			msg->len = len;
+			msg->seq = sent + i;
+			memset(msg + 1, (int)(sent + i), len);
+		}
+		publish(ctx, ctx->req, idx, n);
+		sent += n;
+		batches++;
+	}
+
+	/* the throughput counts until the server took all of it */
+	(void)reserve(ctx, ctx->req, 1, &idx);
+	msg = ivshmem_ring_slot(ctx->req, idx);
+	msg->op = PERF_OP_SYNC;
+	msg->len = 0;
+	publish(ctx, ctx->req, idx, 1);
+	msg = take(ctx, ctx->rsp, &idx);
+	secs = (now_ns() - start) / 1e9;
+	if (msg->op != PERF_OP_SYNC || msg->seq != sent)
+		fprintf(stderr, "bw: sent %lu slots, the server got %lu\n", sent, msg->seq);
+	give_back(ctx, ctx->rsp, 1);
+
+	printf("throughput of %u byte slots, %.1f per batch: %.2f Mslots/s, %.1f MB/s\n",
+	       ctx->req->slot_size, (double)sent / batches, sent / secs / 1e6,
+	       sent * (double)ctx->req->slot_size / secs / 1e6);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct perf_ctx ctx = {};
+	bool server = false, client = false, doorbell = false, rtt = true, bw = true;
+	unsigned long count = DEFAULT_RTT_COUNT, seconds = DEFAULT_BW_SECONDS;
+	unsigned long nr_slots = DEFAULT_SLOTS, slot_size = DEFAULT_SLOT_SIZE, batch = DEFAULT_BATCH;
+	const char *file = NULL;
+	int opt, uio = -1, ret = 0;
+
+	while ((opt = getopt(argc, argv, "scu:f:q:l:dp:v:rwn:t:b:h")) != -1) {
+		switch (opt) {
+		case 's':
+			server = true;
+			break;
+		case 'c':
+			client = true;
+			break;
+		case 'u':
+			uio = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'q':
+			nr_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			slot_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			doorbell = true;
+			break;
+		case 'p':
+			ctx.peer = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			ctx.vector = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			bw = false;
+			break;
+		case 'w':
+			rtt = false;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (server == client || (uio < 0 && file == NULL) || count == 0 || seconds == 0 ||
+	    batch == 0 || (!rtt && !bw)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (setup(&ctx, uio, file, doorbell) < 0)
+		return 1;
+
+	if (server)
+		return run_server(&ctx, nr_slots, slot_size) < 0 ? 1 : 0;
+
+	printf("waiting for the server to set the rings up\n");
+	while (!ivshmem_ring_ready(ctx.req) || !ivshmem_ring_ready(ctx.rsp))
+		usleep(1000);
+
+	if (rtt && test_rtt(&ctx, count) < 0)
+		ret = 1;
+	if (bw && test_bw(&ctx, seconds, batch) < 0)
+		ret = 1;
+	return ret;
+}
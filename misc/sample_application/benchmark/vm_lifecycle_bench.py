@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024 Intel Corporation.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""
+Time the start and the stop of User VMs launched at once from the Service VM,
+through acrnctl, and write their latencies into one JSON report.
+
+Each round starts all the VMs concurrently and waits until acrnctl lists them
+all started, then stops them all concurrently and waits until they are all
+stopped. The VMs must be stopped to begin with.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import threading
+import time
+
+def vm_states(acrnctl):
+    states = {}
+    out = subprocess.run([acrnctl, "list"], capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2:
+            states[fields[0]] = fields[1]
+    return states
+
+def wait_state(acrnctl, vm, state, timeout, poll):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if vm_states(acrnctl).get(vm) == state:
+            return True
+        time.sleep(poll)
+    return False
+
+def run_phase(acrnctl, vms, command, state, timeout, poll):
+    """Run the command of each VM in its own thread, the latency of each VM is until it reaches state."""
+    results = {}
+    barrier = threading.Barrier(len(vms))
+
+    def one(vm):
+        barrier.wait()
+        start = time.monotonic()
+        proc = subprocess.run([acrnctl] + command + [vm], capture_output=True, text=True)
+        if proc.returncode != 0:
+            results[vm] = {"error": f"acrnctl {' '.join(command)} exit status {proc.returncode}",
+                           "output": (proc.stdout + proc.stderr)[-512:]}
+        elif not wait_state(acrnctl, vm, state, timeout, poll):
+            results[vm] = {"error": f"not {state} after {timeout} s"}
+        else:
+            results[vm] = {"ms": (time.monotonic() - start) * 1000}
+
+    start = time.monotonic()
+    threads = [threading.Thread(target=one, args=(vm,)) for vm in vms]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return results, (time.monotonic() - start) * 1000
+
+def summary(samples):
+    if not samples:
+        return {}
+    samples = sorted(samples)
+    return {"count": len(samples), "min_ms": samples[0], "avg_ms": statistics.mean(samples),
+            "p50_ms": statistics.median(samples), "max_ms": samples[-1]}
+
+def main():
+    parser = argparse.ArgumentParser(description="Time the concurrent start and stop of ACRN User VMs")
+    parser.add_argument("vms", nargs="+", help="names of the VMs, as acrnctl lists them")
+    parser.add_argument("-n", "--rounds", type=int, default=10, help="start/stop rounds, 10 by default")
+    parser.add_argument("-t", "--timeout", type=float, default=120, help="seconds to reach a state, 120 by default")
+    parser.add_argument("-p", "--poll", type=float, default=0.05, help="seconds between two acrnctl list")
+    parser.add_argument("--settle", type=float, default=2, help="seconds between two phases")
+    parser.add_argument("--acrnctl", default="acrnctl", help="path of acrnctl")
+    parser.add_argument("-o", "--output", help="report file, stdout by default")
+    args = parser.parse_args()
+
+    states = vm_states(args.acrnctl)
+    running = [vm for vm in args.vms if states.get(vm) != "stopped"]
+    if running:
+        print(f"not stopped, or unknown to acrnctl: {', '.join(running)}", file=sys.stderr)
+        sys.exit(1)
+
+    phases = {"start": (["start"], "started"), "stop": (["stop", "-f"], "stopped")}
+    samples = {phase: {vm: [] for vm in args.vms} for phase in phases}
+    makespans = {phase: [] for phase in phases}
+    errors = []
+
+    for r in range(args.rounds):
+        for phase, (command, state) in phases.items():
+            results, makespan = run_phase(args.acrnctl, args.vms, command, state, args.timeout, args.poll)
+            makespans[phase].append(makespan)
+            for vm, result in results.items():
+                if "error" in result:
+                    errors.append(dict(result, round=r, phase=phase, vm=vm))
+                else:
+                    samples[phase][vm].append(result["ms"])
+            print(f"round {r} {phase}: {makespan:.0f} ms", file=sys.stderr, flush=True)
+            if errors:
+                break
+            time.sleep(args.settle)
+        if errors:
+            break
+
+    report = {
+        "vms": args.vms,
+        "rounds": args.rounds,
+        "phases": {
+            phase: {
+                "all": summary(makespans[phase]),
+                "vms": {vm: summary(samples[phase][vm]) for vm in args.vms},
+            } for phase in phases
+        },
+        "errors": errors,
+    }
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write(os.linesep)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    sys.exit(1 if errors else 0)
+
+if __name__ == "__main__":
+    main()
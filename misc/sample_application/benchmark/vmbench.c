@@ -0,0 +1,701 @@
+/*
+ * Copyright (C) 2024 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * vmbench runs in a VM of ACRN the round trips to the hypervisor and to the
+ * device model of a guest (CPUID, PIO, MMIO, hypercall, IPI, timer interrupt
+ * and HLT wakeup), the guest TSC reads that must not exit, or a noisy neighbor load (memory bandwidth, LLC thrash,
+ * block I/O) next to them. Each run writes one JSON object on stdout, that
+ * the orchestrator of the Service VM collects into its report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/io.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_ITERATIONS	100000UL
+#define DEFAULT_SLEEP_ITERATIONS	10000UL	/* of the tests sleeping between the samples */
+#define DEFAULT_SLEEP_US	100UL
+#define DEFAULT_PIO_PORT	0xcf8	/* PCI config address, emulated by the hypervisor */
+#define DEFAULT_MMIO_ADDR	0xfec00000UL	/* IOAPIC, emulated by the hypervisor */
+#define DEFAULT_MEMBW_MB	256UL
+#define DEFAULT_LLC_MB		64UL
+#define DEFAULT_BLK_MB		1024UL
+#define BLK_BLOCK_SIZE		(1024UL * 1024UL)
+#define CACHE_LINE		64UL
+
+/* ACRN_IOCTL_PM_GET_CPU_STATE of the HSM driver, the Px count query is a harmless hypercall */
+#define ACRN_IOCTL_TYPE			0xA2
+#define ACRN_IOCTL_PM_GET_CPU_STATE	_IOWR(ACRN_IOCTL_TYPE, 0x60, uint64_t)
+#define ACRN_PMCMD_GET_PX_CNT		0UL
+
+struct bench_opts {
+	const char *label;
+	unsigned long iterations;
+	unsigned long sleep_us;
+	unsigned long size_mb;
+	unsigned long seconds;
+	unsigned int port;
+	unsigned int width;
+	unsigned long addr;
+	const char *path;
+	int cpus[2];
+};
+
+static double tsc_per_ns;
+static volatile sig_atomic_t stop;
+
+static inline uint64_t rdtsc_ordered(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* the TSC doesn't exit, it times the round trips of a few hundred ns without the cost of clock_gettime() */
+static void calibrate_tsc(void)
+{
+	uint64_t ns = now_ns(), tsc = rdtsc_ordered();
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000L };
+
+	nanosleep(&ts, NULL);
+	tsc_per_ns = (double)(rdtsc_ordered() - tsc) / (double)(now_ns() - ns);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* samples are in TSC cycles, or in ns if already converted */
+static void report(const char *test, const struct bench_opts *opts, uint64_t *samples, unsigned long count,
+		bool in_ns)
+{
+	double scale = in_ns ? 1.0 : (1.0 / tsc_per_ns);
+	double sum = 0.0;
+	unsigned long i;
+
+	if (count == 0UL) {
+		printf("{\"test\": \"%s\", \"error\": \"no samples\"}\n", test);
+		return;
+	}
+
+	for (i = 0UL; i < count; i++) {
+		sum += (double)samples[i];
+	}
+	qsort(samples, count, sizeof(*samples), cmp_u64);
+
+	printf("{\"test\": \"%s\", \"label\": \"%s\", \"iterations\": %lu, \"min_ns\": %.1f, \"avg_ns\": %.1f, "
+	       "\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p99_9_ns\": %.1f, \"max_ns\": %.1f}\n",
+	       test, (opts->label != NULL) ? opts->label : test, count,
+	       samples[0] * scale, sum / count * scale, samples[count / 2] * scale,
+	       samples[count * 99 / 100] * scale, samples[count * 999 / 1000] * scale,
+	       samples[count - 1] * scale);
+	fflush(stdout);
+}
+
+static uint64_t *alloc_samples(unsigned long count)
+{
+	uint64_t *samples = calloc(count, sizeof(*samples));
+
+	if (samples == NULL) {
+		fprintf(stderr, "no memory for %lu samples\n", count);
+	}
+	return samples;
+}
+
+static int pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0) {
+		return 0;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		fprintf(stderr, "failed to pin to CPU %d\n", cpu);
+		return -1;
+	}
+	return 0;
+}
+
+/* CPUID exits unconditionally */
+static int bench_cpuid(const struct bench_opts *opts)
+{
+	uint64_t *samples = alloc_samples(opts->iterations), t;
+	uint32_t eax, ebx, ecx, edx;
+	unsigned long i;
+
+	if (samples == NULL) {
+		return -1;
+	}
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		t = rdtsc_ordered();
+		asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0U), "c"(0U));
+		samples[i] = rdtsc_ordered() - t;
+	}
+
+	report("cpuid", opts, samples, opts->iterations, false);
+	free(samples);
+	return 0;
+}
+
+/* RDTSCP doesn't exit, even once the guest wrote its TSC: its round trip is the one of the instruction */
+static int bench_tsc(const struct bench_opts *opts)
+{
+	uint64_t *samples = alloc_samples(opts->iterations), t;
+	uint32_t lo, hi, aux;
+	unsigned long i;
+
+	if (samples == NULL) {
+		return -1;
+	}
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		t = rdtsc_ordered();
+		asm volatile ("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+		samples[i] = rdtsc_ordered() - t;
+	}
+
+	report("tsc", opts, samples, opts->iterations, false);
+	free(samples);
+	return 0;
+}
+
+/* the port decides who emulates it: the hypervisor (0xcf8 by default) or the device model of a User VM */
+static int bench_pio(const struct bench_opts *opts)
+{
+	uint64_t *samples, t;
+	unsigned long i;
+
+	if (iopl(3) != 0) {
+		fprintf(stderr, "iopl: %s\n", strerror(errno));
+		return -1;
+	}
+
+	samples = alloc_samples(opts->iterations);
+	if (samples == NULL) {
+		return -1;
+	}
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		t = rdtsc_ordered();
+		switch (opts->width) {
+		case 1U:
+			(void)inb(opts->port);
+			break;
+		case 2U:
+			(void)inw(opts->port);
+			break;
+		default:
+			(void)inl(opts->port);
+			break;
+		}
+		samples[i] = rdtsc_ordered() - t;
+	}
+
+	report("pio", opts, samples, opts->iterations, false);
+	free(samples);
+	return 0;
+}
+
+/* a BAR through its sysfs resource file (a device of the device model), or a physical address through /dev/mem */
+static int bench_mmio(const struct bench_opts *opts)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t base = (opts->path != NULL) ? 0 : (off_t)(opts->addr & ~((unsigned long)page - 1UL));
+	size_t offset = (opts->path != NULL) ? opts->addr : (opts->addr & ((unsigned long)page - 1UL));
+	const char *path = (opts->path != NULL) ? opts->path : "/dev/mem";
+	volatile uint8_t *mmio;
+	uint64_t *samples, t;
+	unsigned long i;
+	int fd;
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	mmio = mmap(NULL, offset + (size_t)page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+	close(fd);
+	if (mmio == MAP_FAILED) {
+		fprintf(stderr, "failed to map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	samples = alloc_samples(opts->iterations);
+	if (samples == NULL) {
+		munmap((void *)mmio, offset + (size_t)page);
+		return -1;
+	}
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		t = rdtsc_ordered();
+		switch (opts->width) {
+		case 1U:
+			(void)*(volatile uint8_t *)(mmio + offset);
+			break;
+		case 2U:
+			(void)*(volatile uint16_t *)(mmio + offset);
+			break;
+		default:
+			(void)*(volatile uint32_t *)(mmio + offset);
+			break;
+		}
+		samples[i] = rdtsc_ordered() - t;
+	}
+
+	report("mmio", opts, samples, opts->iterations, false);
+	free(samples);
+	munmap((void *)mmio, offset + (size_t)page);
+	return 0;
+}
+
+/* only the Service VM may call the hypervisor, through the HSM driver: the round trip includes the ioctl */
+static int bench_hypercall(const struct bench_opts *opts)
+{
+	uint64_t *samples, t, cmd;
+	unsigned long i;
+	int fd;
+
+	fd = open((opts->path != NULL) ? opts->path : "/dev/acrn_hsm", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open the HSM device: %s\n", strerror(errno));
+		return -1;
+	}
+
+	samples = alloc_samples(opts->iterations);
+	if (samples == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		cmd = ACRN_PMCMD_GET_PX_CNT;
+		t = rdtsc_ordered();
+		(void)ioctl(fd, ACRN_IOCTL_PM_GET_CPU_STATE, &cmd);
+		samples[i] = rdtsc_ordered() - t;
+	}
+
+	report("hypercall", opts, samples, opts->iterations, false);
+	free(samples);
+	close(fd);
+	return 0;
+}
+
+struct ipi_ctx {
+	const struct bench_opts *opts;
+	volatile uint32_t ping;
+	volatile uint32_t pong;
+};
+
+static void futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+	while (*addr == val) {
+		(void)syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+	}
+}
+
+static void futex_wake(volatile uint32_t *addr)
+{
+	(void)syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void *ipi_peer(void *arg)
+{
+	struct ipi_ctx *ctx = arg;
+	unsigned long i;
+
+	(void)pin_cpu(ctx->opts->cpus[1]);
+	for (i = 1UL; i <= ctx->opts->iterations; i++) {
+		futex_wait(&ctx->ping, (uint32_t)(i - 1UL));
+		ctx->pong = (uint32_t)i;
+		futex_wake(&ctx->pong);
+	}
+	return NULL;
+}
+
+/*
+ * The peer sleeps on another vCPU, so its vCPU halts: each wakeup is a reschedule IPI from a vCPU to a halted
+ * one, both ways. The round trip is two IPIs and two HLT wakeups.
+ */
+static int bench_ipi(const struct bench_opts *opts)
+{
+	struct ipi_ctx ctx = { .opts = opts, .ping = 0U, .pong = 0U };
+	uint64_t *samples = alloc_samples(opts->iterations), t;
+	struct timespec idle = { .tv_sec = 0, .tv_nsec = 1000000L };
+	pthread_t peer;
+	unsigned long i;
+
+	if (samples == NULL) {
+		return -1;
+	}
+
+	if (pthread_create(&peer, NULL, ipi_peer, &ctx) != 0) {
+		free(samples);
+		return -1;
+	}
+
+	for (i = 1UL; i <= opts->iterations; i++) {
+		/* let the vCPU of the peer halt */
+		nanosleep(&idle, NULL);
+		t = rdtsc_ordered();
+		ctx.ping = (uint32_t)i;
+		futex_wake(&ctx.ping);
+		futex_wait(&ctx.pong, (uint32_t)(i - 1UL));
+		samples[i - 1UL] = rdtsc_ordered() - t;
+	}
+
+	pthread_join(peer, NULL);
+	report("ipi", opts, samples, opts->iterations, false);
+	free(samples);
+	return 0;
+}
+
+/*
+ * The vCPU halts while the thread sleeps, and is woken by the timer interrupt of the expiry: what it sleeps
+ * longer than asked for is the latency of the virtual timer interrupt and of the HLT wakeup.
+ */
+static int bench_timer(const struct bench_opts *opts)
+{
+	uint64_t *samples = alloc_samples(opts->iterations), t, slept;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = (long)(opts->sleep_us * 1000UL) };
+	unsigned long i;
+
+	if (samples == NULL) {
+		return -1;
+	}
+
+	/* no slack, the thread is to be woken at the expiry */
+	(void)prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+	for (i = 0UL; i < opts->iterations; i++) {
+		t = now_ns();
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+		slept = now_ns() - t;
+		samples[i] = (slept > (opts->sleep_us * 1000UL)) ? (slept - (opts->sleep_us * 1000UL)) : 0UL;
+	}
+
+	report("timer", opts, samples, opts->iterations, true);
+	free(samples);
+	return 0;
+}
+
+/* the orchestrator stops a load by closing its stdin, which ssh forwards */
+static void *stdin_watch(__attribute__((unused)) void *arg)
+{
+	char buf[64];
+
+	while (read(STDIN_FILENO, buf, sizeof(buf)) > 0) {
+	}
+	stop = 1;
+	return NULL;
+}
+
+static void sig_stop(__attribute__((unused)) int sig)
+{
+	stop = 1;
+}
+
+static bool load_done(uint64_t start, const struct bench_opts *opts)
+{
+	return (stop != 0) || ((opts->seconds != 0UL) && ((now_ns() - start) >= (opts->seconds * 1000000000UL)));
+}
+
+static void report_load(const char *load, const struct bench_opts *opts, uint64_t start, uint64_t bytes)
+{
+	double seconds = (double)(now_ns() - start) / 1e9;
+
+	printf("{\"load\": \"%s\", \"label\": \"%s\", \"seconds\": %.1f, \"mb_per_s\": %.1f}\n",
+	       load, (opts->label != NULL) ? opts->label : load, seconds,
+	       (seconds > 0.0) ? ((double)bytes / seconds / (1024.0 * 1024.0)) : 0.0);
+	fflush(stdout);
+}
+
+/* streaming copies between two buffers much larger than the LLC */
+static int load_membw(const struct bench_opts *opts)
+{
+	size_t size = opts->size_mb * 1024UL * 1024UL / 2UL;
+	char *src = malloc(size), *dst = malloc(size);
+	uint64_t start = now_ns(), bytes = 0UL;
+
+	if ((src == NULL) || (dst == NULL)) {
+		fprintf(stderr, "no memory for %lu MB\n", opts->size_mb);
+		free(src);
+		free(dst);
+		return -1;
+	}
+
+	memset(src, 0x5a, size);
+	while (!load_done(start, opts)) {
+		memcpy(dst, src, size);
+		/* dst is never read, keep the copy */
+		asm volatile ("" :: "r"(dst) : "memory");
+		bytes += size;
+	}
+
+	report_load("membw", opts, start, bytes);
+	free(src);
+	free(dst);
+	return 0;
+}
+
+/* dependent writes to random cache lines of a buffer larger than the LLC, evicting what the others cache */
+static int load_llc(const struct bench_opts *opts)
+{
+	size_t size = opts->size_mb * 1024UL * 1024UL, lines = size / CACHE_LINE, line = 0UL;
+	volatile uint64_t *buf = malloc(size);
+	uint64_t start = now_ns(), bytes = 0UL, x = 88172645463325252UL;
+	unsigned long i;
+
+	if (buf == NULL) {
+		fprintf(stderr, "no memory for %lu MB\n", opts->size_mb);
+		return -1;
+	}
+
+	memset((void *)buf, 0, size);
+	while (!load_done(start, opts)) {
+		for (i = 0UL; i < 65536UL; i++) {
+			/* xorshift, and the line of the next write depends on the previous one */
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			line = (x + buf[line * (CACHE_LINE / sizeof(uint64_t))]) % lines;
+			buf[line * (CACHE_LINE / sizeof(uint64_t))] += 1UL;
+		}
+		bytes += 65536UL * CACHE_LINE;
+	}
+
+	report_load("llc", opts, start, bytes);
+	free((void *)buf);
+	return 0;
+}
+
+/* direct reads and writes of 1 MB at random offsets of a file or a virtio-blk disk, half each */
+static int load_blk(const struct bench_opts *opts)
+{
+	unsigned long blocks = opts->size_mb * 1024UL * 1024UL / BLK_BLOCK_SIZE, n = 0UL;
+	uint64_t start = now_ns(), bytes = 0UL;
+	ssize_t len;
+	void *buf;
+	off_t off;
+	int fd;
+
+	if ((opts->path == NULL) || (blocks == 0UL)) {
+		fprintf(stderr, "blk needs -f <file or disk> and -s <MB>\n");
+		return -1;
+	}
+
+	fd = open(opts->path, O_RDWR | O_CREAT | O_DIRECT, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", opts->path, strerror(errno));
+		return -1;
+	}
+
+	if (posix_memalign(&buf, 4096UL, BLK_BLOCK_SIZE) != 0) {
+		close(fd);
+		return -1;
+	}
+	memset(buf, 0xa5, BLK_BLOCK_SIZE);
+
+	while (!load_done(start, opts)) {
+		off = (off_t)((unsigned long)random() % blocks * BLK_BLOCK_SIZE);
+		if ((n++ & 1UL) == 0UL) {
+			len = pwrite(fd, buf, BLK_BLOCK_SIZE, off);
+		} else {
+			len = pread(fd, buf, BLK_BLOCK_SIZE, off);
+		}
+		if (len < 0) {
+			fprintf(stderr, "I/O on %s: %s\n", opts->path, strerror(errno));
+			break;
+		}
+		bytes += (uint64_t)len;
+	}
+
+	report_load("blk", opts, start, bytes);
+	free(buf);
+	close(fd);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s <test> [options]\n"
+	       "       %s load <membw|llc|blk> [options]\n"
+	       "tests:\n"
+	       "  cpuid      CPUID round trip\n"
+	       "  tsc        RDTSCP round trip, which doesn't exit\n"
+	       "  pio        IN of a port: -p port, -w width\n"
+	       "  mmio       read of an MMIO register: -a address [-f sysfs resource file, -a is then its offset], -w width\n"
+	       "  hypercall  hypercall of the Service VM through the HSM driver [-f device]\n"
+	       "  ipi        wakeup of a thread sleeping on another vCPU and back: -c cpu,peer_cpu\n"
+	       "  timer      timer interrupt and HLT wakeup after a sleep: -t us, -c cpu\n"
+	       "options:\n"
+	       "  -n  iterations, %lu by default, %lu for ipi and timer\n"
+	       "  -p  port, 0x%x by default\n"
+	       "  -w  access width in bytes, 1, 2 or 4 (default)\n"
+	       "  -a  physical address, 0x%lx by default\n"
+	       "  -t  sleep of the timer test in us, %lu by default\n"
+	       "  -c  CPUs to pin to\n"
+	       "  -s  MB used by a load, membw %lu, llc %lu, blk %lu by default\n"
+	       "  -f  file or device of blk, mmio or hypercall\n"
+	       "  -d  seconds of a load, until stdin is closed or SIGTERM by default\n"
+	       "  -l  label of the JSON result\n",
+	       prog, prog, DEFAULT_ITERATIONS, DEFAULT_SLEEP_ITERATIONS, DEFAULT_PIO_PORT, DEFAULT_MMIO_ADDR, DEFAULT_SLEEP_US,
+	       DEFAULT_MEMBW_MB, DEFAULT_LLC_MB, DEFAULT_BLK_MB);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_opts opts = {
+		.sleep_us = DEFAULT_SLEEP_US,
+		.port = DEFAULT_PIO_PORT,
+		.width = 4U,
+		.addr = DEFAULT_MMIO_ADDR,
+		.cpus = { -1, -1 },
+	};
+	const char *test, *load = NULL;
+	pthread_t watch;
+	int opt;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	test = argv[1];
+	if (strcmp(test, "load") == 0) {
+		if (argc < 3) {
+			usage(argv[0]);
+			return 1;
+		}
+		load = argv[2];
+		optind = 3;
+	} else {
+		optind = 2;
+	}
+
+	while ((opt = getopt(argc, argv, "n:p:w:a:t:c:s:f:d:l:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			opts.iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opts.port = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			opts.width = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			opts.addr = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.sleep_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (sscanf(optarg, "%d,%d", &opts.cpus[0], &opts.cpus[1]) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			opts.size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opts.path = optarg;
+			break;
+		case 'd':
+			opts.seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			opts.label = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (load != NULL) {
+		signal(SIGTERM, sig_stop);
+		signal(SIGINT, sig_stop);
+		if (opts.seconds == 0UL) {
+			(void)pthread_create(&watch, NULL, stdin_watch, NULL);
+		}
+
+		if (strcmp(load, "membw") == 0) {
+			opts.size_mb = (opts.size_mb != 0UL) ? opts.size_mb : DEFAULT_MEMBW_MB;
+			return (load_membw(&opts) == 0) ? 0 : 1;
+		} else if (strcmp(load, "llc") == 0) {
+			opts.size_mb = (opts.size_mb != 0UL) ? opts.size_mb : DEFAULT_LLC_MB;
+			return (load_llc(&opts) == 0) ? 0 : 1;
+		} else if (strcmp(load, "blk") == 0) {
+			opts.size_mb = (opts.size_mb != 0UL) ? opts.size_mb : DEFAULT_BLK_MB;
+			return (load_blk(&opts) == 0) ? 0 : 1;
+		}
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (opts.iterations == 0UL) {
+		opts.iterations = ((strcmp(test, "ipi") == 0) || (strcmp(test, "timer") == 0)) ?
+			DEFAULT_SLEEP_ITERATIONS : DEFAULT_ITERATIONS;
+	}
+
+	calibrate_tsc();
+	if (pin_cpu(opts.cpus[0]) != 0) {
+		return 1;
+	}
+
+	if (strcmp(test, "cpuid") == 0) {
+		return (bench_cpuid(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "tsc") == 0) {
+		return (bench_tsc(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "pio") == 0) {
+		return (bench_pio(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "mmio") == 0) {
+		return (bench_mmio(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "hypercall") == 0) {
+		return (bench_hypercall(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "ipi") == 0) {
+		return (bench_ipi(&opts) == 0) ? 0 : 1;
+	} else if (strcmp(test, "timer") == 0) {
+		return (bench_timer(&opts) == 0) ? 0 : 1;
+	}
+
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024 Intel Corporation.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""
+Run the vmbench microbenchmarks of a suite in the VMs of an ACRN scenario from
+the Service VM, each scenario of the suite next to its noisy neighbor loads,
+and write their results into one JSON report.
+
+The VMs are reached over ssh, or run locally for the Service VM. A load runs
+until its stdin is closed, which ends it and prints its own result.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+import time
+
+IVSHMEM_RTT = re.compile(r"rtt of (\d+) byte slots, (\d+) round trips: min ([\d.]+) avg ([\d.]+) "
+                         r"p50 ([\d.]+) p99 ([\d.]+) p99.9 ([\d.]+) max ([\d.]+) us")
+
+def command(suite, vm, args):
+    target = suite["vms"][vm]
+    if target == "local":
+        return args
+    return suite.get("ssh", ["ssh", "-o", "BatchMode=yes"]) + [target, " ".join(args)]
+
+def tool(suite, vm, name):
+    tools = suite.get("tools", {})
+    return tools.get(vm, {}).get(name, tools.get(name, name))
+
+def parse_output(name, output):
+    """The last JSON line of vmbench, or the round trip line of ivshmem_ring_perf."""
+    for line in reversed(output.splitlines()):
+        line = line.strip()
+        if line.startswith("{"):
+            return json.loads(line)
+        m = IVSHMEM_RTT.search(line)
+        if m is not None:
+            us = [float(x) for x in m.groups()[2:]]
+            return {"test": "ivshmem", "label": name, "slot_size": int(m.group(1)), "iterations": int(m.group(2)),
+                    "min_ns": us[0] * 1000, "avg_ns": us[1] * 1000, "p50_ns": us[2] * 1000,
+                    "p99_ns": us[3] * 1000, "p99_9_ns": us[4] * 1000, "max_ns": us[5] * 1000}
+    return {"label": name, "error": "no result", "output": output[-512:]}
+
+def start_load(suite, name):
+    load = suite["loads"][name]
+    args = [tool(suite, load["vm"], "vmbench"), "load"] + load["args"] + ["-l", name]
+    return subprocess.Popen(command(suite, load["vm"], args), stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE, text=True)
+
+def stop_load(name, proc, timeout):
+    try:
+        # closes stdin, which ends the load
+        out, err = proc.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        proc.terminate()
+        out, err = proc.communicate()
+    result = parse_output(name, out)
+    if "error" in result:
+        result["stderr"] = err[-512:]
+    return result
+
+def run_benchmark(suite, bench, timeout):
+    name = bench["name"]
+    peer = None
+    if "peer" in bench:
+        # the server side of a two-VM test, e.g. ivshmem_ring_perf -s, set up before the client
+        peer_args = [tool(suite, bench["peer"]["vm"], bench["peer"].get("tool", "vmbench"))] + bench["peer"]["args"]
+        peer = subprocess.Popen(command(suite, bench["peer"]["vm"], peer_args), stdin=subprocess.PIPE,
+                                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, text=True)
+        time.sleep(bench["peer"].get("setup", 2))
+
+    args = [tool(suite, bench["vm"], bench.get("tool", "vmbench"))] + bench["args"]
+    if bench.get("tool", "vmbench") == "vmbench":
+        args += ["-l", name]
+    try:
+        proc = subprocess.run(command(suite, bench["vm"], args), stdin=subprocess.DEVNULL, capture_output=True,
+                              text=True, timeout=timeout)
+        result = parse_output(name, proc.stdout)
+        if proc.returncode != 0:
+            result.setdefault("error", f"exit status {proc.returncode}")
+            result["stderr"] = proc.stderr[-512:]
+    except subprocess.TimeoutExpired:
+        result = {"label": name, "error": f"timed out after {timeout} s"}
+
+    if peer is not None:
+        peer.stdin.close()
+        peer.terminate()
+        peer.wait()
+
+    result["vm"] = bench["vm"]
+    if "max" in bench:
+        result["checks"] = check_result(result, bench["max"])
+    return result
+
+def check_result(result, limits):
+    """Compare the statistics of a result to their upper bounds, e.g. of a round trip that must not exit."""
+    checks = {}
+    for stat, limit in limits.items():
+        value = result.get(stat)
+        checks[stat] = {"max": limit, "value": value, "passed": value is not None and value <= limit}
+    return checks
+
+def failed_checks(report):
+    return [f"{scenario['name']}/{result['label']} {stat}"
+            for scenario in report["scenarios"] for result in scenario["results"]
+            for stat, check in result.get("checks", {}).items() if not check["passed"]]
+
+def run_suite(suite, selected, log):
+    timeout = suite.get("timeout", 300)
+    report = {
+        "suite": suite.get("name", ""),
+        "started": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "service_vm": platform.uname()._asdict(),
+        "release": suite.get("release", ""),
+        "scenarios": [],
+    }
+
+    for scenario in suite["scenarios"]:
+        if selected and scenario["name"] not in selected:
+            continue
+        log(f"scenario {scenario['name']}: loads {', '.join(scenario.get('loads', [])) or 'none'}")
+
+        loads = [(name, start_load(suite, name)) for name in scenario.get("loads", [])]
+        time.sleep(suite.get("warmup", 5) if loads else 0)
+
+        results = []
+        for bench in suite["benchmarks"]:
+            if "benchmarks" in scenario and bench["name"] not in scenario["benchmarks"]:
+                continue
+            log(f"  {bench['name']} on {bench['vm']}")
+            results.append(run_benchmark(suite, bench, timeout))
+
+        report["scenarios"].append({
+            "name": scenario["name"],
+            "results": results,
+            "loads": [stop_load(name, proc, timeout) for name, proc in loads],
+        })
+
+    report["finished"] = datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds")
+    return report
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the vmbench suite of an ACRN scenario from the Service VM")
+    parser.add_argument("suite", help="suite description in JSON, see vmbench_suite.json")
+    parser.add_argument("-o", "--output", help="report file, stdout by default")
+    parser.add_argument("-s", "--scenario", action="append", default=[], help="run this scenario only, repeatable")
+    parser.add_argument("-q", "--quiet", action="store_true", help="no progress on stderr")
+    args = parser.parse_args()
+
+    with open(args.suite) as f:
+        suite = json.load(f)
+
+    log = (lambda msg: None) if args.quiet else (lambda msg: print(msg, file=sys.stderr, flush=True))
+    report = run_suite(suite, args.scenario, log)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write(os.linesep)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    failed = failed_checks(report)
+    for check in failed:
+        print(f"check failed: {check}", file=sys.stderr)
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
@@ -17,6 +17,10 @@
 #include "mevent.h"
 #include "acrn_mngr.h"
 
+/* the peers built against an older header still size messages by PARAM_LEN */
+_Static_assert(sizeof(((struct mngr_msg *)0)->data) == PARAM_LEN,
+	       "struct mngr_msg data must stay PARAM_LEN bytes");
+
 /* helpers */
 /* Check if @path exists and if is a directory, if not existence, create or warn according to the flag */
 int check_dir(const char *path, int flags)
@@ -46,7 +50,7 @@ int check_dir(const char *path, int flags)
 
 #define MNGR_SOCK_FMT		"/run/acrn/mngr/%s.%d.socket"
 #define MNGR_MAX_HANDLER	8
-#define MNGR_MAX_CLIENT		4
+#define MNGR_MAX_CLIENT		8	/* subscribers keep theirs open */
 
 #define CLIENT_BUF_LEN  4096
 
@@ -57,6 +61,8 @@ struct mngr_client {
 	socklen_t addr_len;
 	void *buf;
 	int len;		/* buf len */
+	int subscribed;		/* events are pushed to it */
+	unsigned interval;	/* seconds between periodic events it asked */
 	LIST_ENTRY(mngr_client) list;
 };
 
@@ -180,6 +186,25 @@ static void *server_listen_func(void *arg)
 	return NULL;
 }
 
+/* (un)subscribe the client, ack it, then let the server push the first events */
+static void server_subscribe(struct mngr_fd *mfd, struct mngr_client *client,
+			     struct mngr_msg *msg)
+{
+	struct mngr_msg ack;
+
+	pthread_mutex_lock(&mfd->client_mtx);
+	client->subscribed = (msg->msgid == MNGR_SUBSCRIBE);
+	client->interval = client->subscribed ? msg->data.subscribe.interval : 0;
+	pthread_mutex_unlock(&mfd->client_mtx);
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	ack.data.err = 0;
+	mngr_send_msg(client->fd, &ack, NULL, 1);
+}
+
 static int server_parse_buf(struct mngr_fd *mfd, struct mngr_client *client)
 {
 	struct mngr_msg *msg;
@@ -199,6 +224,12 @@ static int server_parse_buf(struct mngr_fd *mfd, struct mngr_client *client)
 			break;
 		}
 
+		if (msg->magic == MNGR_MSG_MAGIC &&
+		    (msg->msgid == MNGR_SUBSCRIBE || msg->msgid == MNGR_UNSUBSCRIBE)) {
+			server_subscribe(mfd, client, msg);
+			handled = 1;
+		}
+
 		LIST_FOREACH(handler, &mfd->handler_head, list) {
 			if (msg->magic != MNGR_MSG_MAGIC)
 				return -1;
@@ -573,6 +604,128 @@ int mngr_add_handler(int server_fd, unsigned id,
 	return 0;
 }
 
+int mngr_publish_msg(int server_fd, struct mngr_msg *msg)
+{
+	struct mngr_fd *mfd;
+	struct mngr_client *client;
+	ssize_t ret;
+	int count = 0;
+
+	mfd = desc_to_mfd(server_fd);
+	if (!mfd || mfd->type != MNGR_SERVER || !msg)
+		return -1;
+
+	pthread_mutex_lock(&mfd->client_mtx);
+	LIST_FOREACH(client, &mfd->client_head, list) {
+		if (!client->subscribed)
+			continue;
+
+		/* never block the server on a slow subscriber */
+		ret = send(client->fd, msg, sizeof(*msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret == sizeof(*msg)) {
+			count++;
+		} else if (ret > 0) {
+			/* the stream is out of sync, the poll thread frees it */
+			client->subscribed = 0;
+			shutdown(client->fd, SHUT_RDWR);
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			client->subscribed = 0;
+		}
+	}
+	pthread_mutex_unlock(&mfd->client_mtx);
+
+	return count;
+}
+
+int mngr_subscribers(int server_fd, unsigned *interval)
+{
+	struct mngr_fd *mfd;
+	struct mngr_client *client;
+	unsigned min = 0;
+	int count = 0;
+
+	mfd = desc_to_mfd(server_fd);
+	if (!mfd || mfd->type != MNGR_SERVER)
+		return -1;
+
+	pthread_mutex_lock(&mfd->client_mtx);
+	LIST_FOREACH(client, &mfd->client_head, list) {
+		if (!client->subscribed)
+			continue;
+		count++;
+		if (client->interval && (!min || client->interval < min))
+			min = client->interval;
+	}
+	pthread_mutex_unlock(&mfd->client_mtx);
+
+	if (interval)
+		*interval = min;
+
+	return count;
+}
+
+int mngr_subscribe(const char *name, unsigned interval)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	int fd;
+
+	fd = mngr_open_un(name, MNGR_CLIENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = MNGR_SUBSCRIBE;
+	req.timestamp = time(NULL);
+	req.data.subscribe.interval = interval;
+
+	if (mngr_send_msg(fd, &req, NULL, 1) < 0 ||
+	    mngr_recv_msg(fd, &ack, 1) <= 0 ||
+	    ack.msgid != MNGR_SUBSCRIBE || ack.data.err) {
+		printf("%s: %s refused the subscription\n", __func__, name);
+		mngr_close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int mngr_recv_msg(int fd, struct mngr_msg *msg, unsigned timeout)
+{
+	fd_set rfd;
+	struct timeval t;
+	size_t len = 0;
+	ssize_t ret;
+
+	if (!msg)
+		return -1;
+
+	t.tv_sec = timeout;
+	t.tv_usec = 0;
+
+	FD_ZERO(&rfd);
+	FD_SET(fd, &rfd);
+	ret = select(fd + 1, &rfd, NULL, NULL, timeout ? &t : NULL);
+	if (ret == 0)
+		return 0;
+	if (ret < 0)
+		return -1;
+
+	/* the server writes a message at once, so the rest follows shortly */
+	while (len < sizeof(*msg)) {
+		ret = read(fd, (char *)msg + len, sizeof(*msg) - len);
+		if (ret <= 0)
+			return -1;
+		len += ret;
+	}
+
+	if (msg->magic != MNGR_MSG_MAGIC)
+		return -1;
+
+	return len;
+}
+
 int mngr_send_msg(int fd, struct mngr_msg *req, struct mngr_msg *ack,
 		  unsigned timeout)
 {
@@ -30,6 +30,9 @@ header file.
 /* TODO: Revisit PARAM_LEN and see if size can be reduced */
 #define PARAM_LEN	256
 
+/* virtio queues a DM_METRICS_EVENT reports, to fit in PARAM_LEN */
+#define DM_METRICS_MAX_VQ	24
+
 struct mngr_msg {
 	unsigned long long magic;	/* Make sure you get a mngr_msg */
 	unsigned int msgid;
@@ -79,6 +82,35 @@ struct mngr_msg {
 			time_t t;
 		} rtc_timer;
 
+		/* req of DM_NOTIFY */
+		struct req_dm_notify {
+			char name[MAX_VM_NAME_LEN];
+			int state;	/* enum dm_notify_state */
+		} dm_notify;
+
+		/* req of MNGR_SUBSCRIBE */
+		struct req_mngr_subscribe {
+			unsigned interval;	/* seconds between DM_METRICS_EVENT, 0 for none */
+		} subscribe;
+
+		/* DM_METRICS_EVENT, the counters run from the DM start */
+		struct dm_metrics {
+			char name[MAX_VM_NAME_LEN];
+			unsigned nr_vq;		/* entries of vq[] filled */
+			unsigned lat_max_ns;	/* longest ioreq since the last event */
+			unsigned long long pio;		/* port I/O ioreqs */
+			unsigned long long mmio;	/* MMIO ioreqs */
+			unsigned long long pci_cfg;	/* PCI config ioreqs */
+			unsigned long long lat_total_ns;	/* time spent in all of them */
+			struct dm_metrics_vq {
+				unsigned char slot;	/* PCI slot of the virtio device */
+				unsigned char queue;	/* index of the queue in the device */
+				unsigned short qsize;
+				unsigned short pending;	/* made available, not taken yet */
+				unsigned short inflight;	/* taken, not used yet */
+			} vq[DM_METRICS_MAX_VQ];
+		} dm_metrics;
+
 	} data;
 };
 
@@ -118,6 +150,13 @@ enum acrnd_msgid {
 
 /* Acrnd handled message req/ack pairs */
 
+/* VM states a DM_NOTIFY reports */
+enum dm_notify_state {
+	DM_NOTIFY_RUNNING = 1,	/* the vCPUs of the User VM run */
+	DM_NOTIFY_STOPPED,	/* the DM of the User VM exits */
+	DM_NOTIFY_SUSPENDED,	/* the User VM waits in S3 to be resumed */
+};
+
 /* SOS-LCS handled message event types */
 enum sos_lcs_msgid {
 	WAKEUP_REASON = ACRND_MAX + 1,	/* Acrnd/Acrnctl request wakeup reason */
@@ -127,6 +166,20 @@ enum sos_lcs_msgid {
 	REBOOT,
 };
 
+/*
+ * Subscription message event types, handled by the library for any server:
+ * a client subscribed gets events pushed on the same connection until it
+ * unsubscribes or disconnects, instead of polling the server.
+ */
+enum mngr_sub_msgid {
+	MNGR_SUBSCRIBE = REBOOT + 1,	/* Push events on this connection */
+	MNGR_UNSUBSCRIBE,	/* Stop pushing events on this connection */
+
+	/* DM -> subscribers */
+	DM_STATE_EVENT,		/* State of this UOS changed, in data.dm_notify */
+	DM_METRICS_EVENT,	/* Periodic counters of this UOS, in data.dm_metrics */
+};
+
 /* helper functions */
 #define MNGR_SERVER	1	/* create a server fd, which you can add handlers onto it */
 #define MNGR_CLIENT	0	/* create a client, just send req and read ack */
@@ -176,6 +229,46 @@ int mngr_add_handler(int desc, unsigned id,
 int mngr_send_msg(int desc, struct mngr_msg *req, struct mngr_msg *ack,
 		  unsigned timeout);
 
+/**
+ * @brief push a message to all the subscribed clients of a server
+ *
+ * The message is dropped for a client whose socket is full, a client that
+ * got a partial message is disconnected.
+ *
+ * @param desc server descripter created using mngr_open_un
+ * @param msg pointer to message to push
+ * @return number of clients the message is pushed to, -1 on error
+ */
+int mngr_publish_msg(int desc, struct mngr_msg *msg);
+
+/**
+ * @brief count the subscribed clients of a server
+ *
+ * @param desc server descripter created using mngr_open_un
+ * @param interval if not NULL, the shortest non-zero interval asked, 0 if none
+ * @return number of subscribed clients, -1 on error
+ */
+int mngr_subscribers(int desc, unsigned *interval);
+
+/**
+ * @brief connect to a server and subscribe to its events
+ *
+ * @param name name of the server, as for mngr_open_un
+ * @param interval seconds between periodic events, 0 for state changes only
+ * @return client descripter to read events with mngr_recv_msg, -1 on error
+ */
+int mngr_subscribe(const char *name, unsigned interval);
+
+/**
+ * @brief wait for a message pushed by the server
+ *
+ * @param desc client descripter returned by mngr_subscribe
+ * @param msg pointer to where to read the message
+ * @param timeout time to wait, zero to blocking waiting
+ * @return len of the message on success, 0 on timeout, -1 if disconnected
+ */
+int mngr_recv_msg(int desc, struct mngr_msg *msg, unsigned timeout);
+
 /**
  * @brief check @path existence and create or report error accoding to the flag
  *
@@ -428,3 +428,58 @@ int blkrescan_vm(const char *vmname, char *devargs)
 
 	return ack.data.err;
 }
+
+static void print_metrics(struct dm_metrics *m)
+{
+	unsigned long long n = m->pio + m->mmio + m->pci_cfg;
+	unsigned i;
+
+	printf("%s\tioreq pio %llu mmio %llu pcicfg %llu, latency avg %llu max %u ns\n",
+		m->name, m->pio, m->mmio, m->pci_cfg,
+		n ? m->lat_total_ns / n : 0, m->lat_max_ns);
+	for (i = 0; i < m->nr_vq && i < DM_METRICS_MAX_VQ; i++)
+		printf("\t\tslot %u queue %u: pending %u inflight %u of %u\n",
+			m->vq[i].slot, m->vq[i].queue, m->vq[i].pending,
+			m->vq[i].inflight, m->vq[i].qsize);
+}
+
+int watch_vm(const char *vmname, unsigned interval)
+{
+	static const char *notify_str[] = {
+		[DM_NOTIFY_RUNNING] = "running",
+		[DM_NOTIFY_STOPPED] = "stopped",
+		[DM_NOTIFY_SUSPENDED] = "suspended",
+	};
+	struct mngr_msg msg;
+	int fd, state;
+
+	fd = mngr_subscribe(vmname, interval);
+	if (fd < 0) {
+		printf("Unable to subscribe to vm %s. It may have been shutdown\n", vmname);
+		return -1;
+	}
+
+	/* events are pushed until the DM closes the connection */
+	while (mngr_recv_msg(fd, &msg, 0) > 0) {
+		switch (msg.msgid) {
+		case DM_STATE_EVENT:
+			state = msg.data.dm_notify.state;
+			msg.data.dm_notify.name[MAX_VM_NAME_LEN - 1] = '\0';
+			printf("%s\tstate %s\n", msg.data.dm_notify.name,
+				(state > 0 && state <= DM_NOTIFY_SUSPENDED) ?
+				notify_str[state] : "unknown");
+			break;
+		case DM_METRICS_EVENT:
+			msg.data.dm_metrics.name[MAX_VM_NAME_LEN - 1] = '\0';
+			print_metrics(&msg.data.dm_metrics);
+			break;
+		default:
+			break;
+		}
+		fflush(stdout);
+	}
+
+	mngr_close(fd);
+
+	return 0;
+}
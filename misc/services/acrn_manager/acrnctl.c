@@ -34,6 +34,7 @@
 #define ADD_DESC       "Add one virtual machine with SCRIPTS and OPTIONS"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define WATCH_DESC     "Print state changes and, every INTERVAL seconds, metrics of VM_NAME"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -427,6 +428,23 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_watch(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	unsigned interval = 0;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s || (s->state != VM_STARTED && s->state != VM_SUSPENDED)) {
+		printf("%s is not running\n", argv[VM_NAME]);
+		return -1;
+	}
+
+	if (argc == 3)
+		interval = strtoul(argv[CMD_ARGS], NULL, 10);
+
+	return watch_vm(argv[VM_NAME], interval);
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -641,6 +659,18 @@ static int valid_blkrescan_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_watch_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME [INTERVAL]";
+
+	if (argc < 2 || argc > 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "launch_scripts options";
@@ -683,6 +713,7 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("add", acrnctl_do_add, ADD_DESC, valid_add_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("watch", acrnctl_do_watch, WATCH_DESC, valid_watch_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
@@ -58,5 +58,6 @@ int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
 int blkrescan_vm(const char *vmname, char *devargs);
+int watch_vm(const char *vmname, unsigned interval);
 
 #endif				/* _ACRNCTL_H_ */
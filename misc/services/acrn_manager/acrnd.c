@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -25,6 +26,7 @@
 #define SERVICE_VM_LCS_SOCK	"service-vm-lcs"
 #define HW_IOC_PATH		"/dev/cbc-early-signals"
 #define VMS_STOP_TIMEOUT	20U /* Time to wait VMs to stop */
+#define VM_READY_TIMEOUT	60U /* Time to wait a VM to notify it runs */
 #define SOCK_TIMEOUT		2U
 
 /* acrnd worker timer */
@@ -52,6 +54,7 @@ static unsigned char platform_has_hw_ioc;
 static int sigterm = 0; /* Exit acrnd when recevied SIGTERM and stop all vms */
 
 static int logfile = 1;
+static unsigned int launch_jobs; /* VMs launched at a time, 0 for no limit */
 #ifdef MNGR_DEBUG
 static int autostart_delay = 0;
 #endif
@@ -233,6 +236,261 @@ static int load_timer_list(void)
 	return ret;
 }
 
+/* acrnd launch graph
+ *
+ * ACRN_CONF_PATH_ADD/[vmname].conf, optional, has one "key=value" a line:
+ * priority=<n>		the VMs ready to launch start by higher priority
+ * after=<vm>[,<vm>...]	launch once those VMs run
+ * ready_timeout=<sec>	assume it runs if the DM has not notified by then
+ * stop_timeout=<sec>	force it to stop if it has not stopped by then
+ *
+ * A VM runs once its DM notifies DM_NOTIFY_RUNNING, it fails if its DM
+ * exits before, so do the VMs launched after it.
+ */
+#define MAX_LAUNCH_VMS		16
+#define MAX_LAUNCH_DEPS		8
+
+enum launch_state {
+	LAUNCH_PENDING = 0,
+	LAUNCH_STARTED,		/* forked, waiting for DM_NOTIFY_RUNNING */
+	LAUNCH_RUNNING,
+	LAUNCH_FAILED,
+};
+
+struct launch_vm {
+	char name[MAX_VM_NAME_LEN];
+	int priority;
+	char after[MAX_LAUNCH_DEPS][MAX_VM_NAME_LEN];
+	int nafter;
+	unsigned int ready_timeout;
+	unsigned int stop_timeout;
+	enum launch_state state;
+	pid_t pid;
+	time_t started;
+	int stopped;		/* DM_NOTIFY_STOPPED received */
+};
+
+static struct launch_vm launch_vms[MAX_LAUNCH_VMS];
+static int nlaunch_vms;
+static pthread_mutex_t launch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t launch_cond = PTHREAD_COND_INITIALIZER;
+
+/* Called with launch_mutex hold */
+static struct launch_vm *launch_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nlaunch_vms; i++)
+		if (!strncmp(launch_vms[i].name, name, MAX_VM_NAME_LEN))
+			return &launch_vms[i];
+	return NULL;
+}
+
+static void launch_load_conf(struct launch_vm *l)
+{
+	FILE *fp;
+	char path[PATH_LEN + MAX_VM_NAME_LEN];
+	char line[256], *key, *val, *dep, *p;
+	long v;
+
+	l->ready_timeout = VM_READY_TIMEOUT;
+	l->stop_timeout = VMS_STOP_TIMEOUT;
+
+	snprintf(path, sizeof(path), "%s/%s.conf", ACRN_CONF_PATH_ADD, l->name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+
+		val = line;
+		key = strsep(&val, "=");
+		if (!val) {
+			fprintf(stderr, "%s: ignore \"%s\"\n", path, key);
+			continue;
+		}
+
+		if (!strcmp(key, "after")) {
+			while ((dep = strsep(&val, ",")) != NULL) {
+				if (dep[0] == '\0')
+					continue;
+				if (l->nafter >= MAX_LAUNCH_DEPS) {
+					fprintf(stderr, "%s: more than %d VMs after\n",
+						path, MAX_LAUNCH_DEPS);
+					break;
+				}
+				strncpy(l->after[l->nafter++], dep, MAX_VM_NAME_LEN - 1);
+			}
+			continue;
+		}
+
+		errno = 0;
+		v = strtol(val, &p, 10);
+		if (errno || *p != '\0' || v < 0 || v > INT_MAX) {
+			fprintf(stderr, "%s: invalid %s=%s\n", path, key, val);
+			continue;
+		}
+
+		if (!strcmp(key, "priority"))
+			l->priority = v;
+		else if (!strcmp(key, "ready_timeout"))
+			l->ready_timeout = v;
+		else if (!strcmp(key, "stop_timeout"))
+			l->stop_timeout = v;
+		else
+			fprintf(stderr, "%s: unknown key %s\n", path, key);
+	}
+
+	fclose(fp);
+}
+
+/* Called with launch_mutex hold, 1 if l can be forked, -1 if it can never */
+static int launch_deps_ready(struct launch_vm *l)
+{
+	struct launch_vm *d;
+	int i, ret = 1;
+
+	for (i = 0; i < l->nafter; i++) {
+		d = launch_find(l->after[i]);
+
+		/* a VM not launched by acrnd, it runs already or never will */
+		if (!d)
+			continue;
+
+		if (d->state == LAUNCH_FAILED)
+			return -1;
+		if (d->state != LAUNCH_RUNNING)
+			ret = 0;
+	}
+	return ret;
+}
+
+/* Called with launch_mutex hold, the live launches */
+static int launch_update(time_t now)
+{
+	struct launch_vm *l;
+	int i, status, nlive = 0;
+
+	for (i = 0; i < nlaunch_vms; i++) {
+		l = &launch_vms[i];
+		if (l->state != LAUNCH_STARTED)
+			continue;
+
+		if (l->stopped || waitpid(l->pid, &status, WNOHANG) == l->pid) {
+			fprintf(stderr, "%s exited before it runs\n", l->name);
+			l->state = LAUNCH_FAILED;
+		} else if (now - l->started >= l->ready_timeout) {
+			printf("%s not notified to run in %u sec, assume it runs\n",
+				l->name, l->ready_timeout);
+			l->state = LAUNCH_RUNNING;
+		} else
+			nlive++;
+	}
+	return nlive;
+}
+
+static void *launch_thread(void *arg)
+{
+	struct launch_vm *l, *next;
+	struct timespec ts;
+	time_t now;
+	int i, ready, nlive, npending;
+	pid_t pid;
+
+	pthread_mutex_lock(&launch_mutex);
+	for (;;) {
+		now = time(NULL);
+		nlive = launch_update(now);
+
+		next = NULL;
+		npending = 0;
+		for (i = 0; i < nlaunch_vms; i++) {
+			l = &launch_vms[i];
+			if (l->state != LAUNCH_PENDING)
+				continue;
+
+			ready = launch_deps_ready(l);
+			if (ready < 0) {
+				fprintf(stderr, "%s not launched, a VM it is after failed\n",
+					l->name);
+				l->state = LAUNCH_FAILED;
+				continue;
+			}
+
+			npending++;
+			if (ready && (!next || l->priority > next->priority))
+				next = l;
+		}
+
+		if (next && (!launch_jobs || nlive < launch_jobs)) {
+			pid = fork();
+			if (!pid)
+				acrnd_run_vm(next->name);
+			if (pid < 0) {
+				perror("Fork to launch VM");
+				next->state = LAUNCH_FAILED;
+				continue;
+			}
+
+			printf("Launched %s, %d VMs launching\n", next->name, nlive + 1);
+			next->pid = pid;
+			next->started = now;
+			next->state = LAUNCH_STARTED;
+			continue;
+		}
+
+		if (!npending && !nlive)
+			break;
+
+		/* the VMs left are after each other */
+		if (npending && !next && !nlive) {
+			for (i = 0; i < nlaunch_vms; i++) {
+				l = &launch_vms[i];
+				if (l->state != LAUNCH_PENDING)
+					continue;
+				fprintf(stderr, "%s not launched, its after VMs form a cycle\n",
+					l->name);
+				l->state = LAUNCH_FAILED;
+			}
+			break;
+		}
+
+		/* woken up by DM_NOTIFY, the timeouts are checked each second */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&launch_cond, &launch_mutex, &ts);
+	}
+	pthread_mutex_unlock(&launch_mutex);
+
+	printf("All the launches of VMs are done\n");
+	return NULL;
+}
+
+static void handle_dm_notify(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct launch_vm *l;
+
+	msg->data.dm_notify.name[MAX_VM_NAME_LEN - 1] = '\0';
+	printf("%s notified state %d\n", msg->data.dm_notify.name,
+		msg->data.dm_notify.state);
+
+	pthread_mutex_lock(&launch_mutex);
+	l = launch_find(msg->data.dm_notify.name);
+	if (l) {
+		l->stopped = 0;
+		if (msg->data.dm_notify.state == DM_NOTIFY_STOPPED)
+			l->stopped = 1;
+		else if (msg->data.dm_notify.state == DM_NOTIFY_RUNNING &&
+				l->state == LAUNCH_STARTED)
+			l->state = LAUNCH_RUNNING;
+	}
+	pthread_cond_broadcast(&launch_cond);
+	pthread_mutex_unlock(&launch_mutex);
+}
+
 static void acrnd_run_vm(char *name)
 {
 	/*If do not use logfile, then output to stdout,
@@ -248,24 +506,36 @@ static void acrnd_run_vm(char *name)
 
 	start_vm(name);
 	printf("%s exited!\n", name);
-	exit(0);
+
+	/* not the atexit() handlers of acrnd, that store its timer list */
+	fflush(stdout);
+	_exit(0);
 }
 
 static int active_all_vms(void)
 {
 	struct vmmngr_struct *vm;
+	struct launch_vm *l;
 	int ret = 0;
-	pid_t pid;
 	unsigned reason = 0;
+	pthread_t tid;
+	pthread_attr_t attr;
 
 	vmmngr_update();
 
+	pthread_mutex_lock(&launch_mutex);
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		switch (vm->state) {
 		case VM_CREATED:
-			pid = fork();
-			if (!pid)
-				acrnd_run_vm(vm->name);
+			if (nlaunch_vms >= MAX_LAUNCH_VMS) {
+				fprintf(stderr, "%s: more than %d VMs to launch, %s ignored\n",
+					__func__, MAX_LAUNCH_VMS, vm->name);
+				break;
+			}
+			l = &launch_vms[nlaunch_vms++];
+			memset(l, 0, sizeof(*l));
+			strncpy(l->name, vm->name, sizeof(l->name) - 1);
+			launch_load_conf(l);
 			break;
 		case VM_SUSPENDED:
 			if (platform_has_hw_ioc) {
@@ -277,25 +547,123 @@ static int active_all_vms(void)
 			printf("%s: Unkown vm state %ld\n", __func__, vm->state);
 		}
 	}
+	pthread_mutex_unlock(&launch_mutex);
+
+	/*
+	 * The launches wait for DM_NOTIFY, a detached thread runs them so
+	 * that the main thread serves the timers meanwhile.
+	 */
+	if (pthread_attr_init(&attr) ||
+	    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) ||
+	    pthread_create(&tid, &attr, launch_thread, NULL)) {
+		fprintf(stderr, "%s: Failed to create launch thread\n", __func__);
+		ret = -1;
+	}
+	pthread_attr_destroy(&attr);
 
 	return ret ? -1 : 0;
 }
 
+/* if the DM of vmname has its monitor socket */
+static int vm_is_alive(const char *vmname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	size_t len = strnlen(vmname, MAX_VM_NAME_LEN);
+	int alive = 0;
+
+	dir = opendir(ACRN_DM_SOCK_PATH);
+	if (!dir)
+		return 0;
+
+	while ((entry = readdir(dir))) {
+		if (!strncmp(entry->d_name, vmname, len) &&
+		    !strncmp(entry->d_name + len, ".monitor.", strlen(".monitor."))) {
+			alive = 1;
+			break;
+		}
+	}
+	closedir(dir);
+	return alive;
+}
+
+struct stop_arg {
+	char name[MAX_VM_NAME_LEN];
+	unsigned int timeout;
+};
+
+/* stop one VM, force it to stop after its timeout */
+static void *stop_vm_thread(void *arg)
+{
+	struct stop_arg *s = arg;
+	struct timespec ts;
+	time_t deadline;
+
+	if (stop_vm(s->name, 0) != 0) {
+		fprintf(stderr, "Fail to send stop cmd to vm %s\n", s->name);
+	} else {
+		printf("Send stop cmd to vm %s successfully\n", s->name);
+	}
+
+	deadline = time(NULL) + s->timeout;
+	pthread_mutex_lock(&launch_mutex);
+	while (vm_is_alive(s->name) && time(NULL) < deadline) {
+		/* woken up by DM_NOTIFY, checked each second else */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&launch_cond, &launch_mutex, &ts);
+	}
+	pthread_mutex_unlock(&launch_mutex);
+
+	if (vm_is_alive(s->name)) {
+		fprintf(stderr, "vm %s not stopped in %u sec, force it\n",
+			s->name, s->timeout);
+		stop_vm(s->name, 1);
+	} else
+		printf("vm %s stopped\n", s->name);
+
+	return NULL;
+}
+
+/* stop all the VMs at once, each within its stop_timeout */
 static void stop_all_vms(void)
 {
 	struct vmmngr_struct *vm;
-	int err;
+	struct launch_vm *l;
+	struct stop_arg args[MAX_LAUNCH_VMS];
+	pthread_t tids[MAX_LAUNCH_VMS];
+	int i, n = 0;
 
 	vmmngr_update();
 
 	LIST_FOREACH(vm, &vmmngr_head, list) {
-		err = stop_vm(vm->name, 0);
-		if (err != 0) {
-			fprintf(stderr, "Fail to send stop cmd to vm %s\n", vm->name);
-		} else {
-			printf("Send stop cmd to vm %s successfully\n", vm->name);
+		if (vm->state == VM_CREATED)
+			continue;
+		if (n >= MAX_LAUNCH_VMS) {
+			fprintf(stderr, "%s: more than %d VMs to stop, %s ignored\n",
+				__func__, MAX_LAUNCH_VMS, vm->name);
+			break;
+		}
+
+		memset(&args[n], 0, sizeof(args[n]));
+		strncpy(args[n].name, vm->name, sizeof(args[n].name) - 1);
+		args[n].timeout = VMS_STOP_TIMEOUT;
+		pthread_mutex_lock(&launch_mutex);
+		l = launch_find(vm->name);
+		if (l)
+			args[n].timeout = l->stop_timeout;
+		pthread_mutex_unlock(&launch_mutex);
+
+		if (pthread_create(&tids[n], NULL, stop_vm_thread, &args[n])) {
+			fprintf(stderr, "%s: Failed to create stop thread of %s\n",
+				__func__, vm->name);
+			continue;
 		}
+		n++;
 	}
+
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
 }
 
 static int wakeup_suspended_vms(unsigned wakeup_reason)
@@ -675,18 +1043,19 @@ static void sigterm_handler(int signo)
 	sigterm = 1;
 }
 
-static const char optString[] = "td:h";
+static const char optString[] = "tj:d:h";
 
 static void display_usage(void)
 {
 	printf("acrnd - Daemon for ACRN VM Management\n"
 #ifdef MNGR_DEBUG
-	       "[Usage] acrnd [-t] [-d delay] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-j jobs] [-d delay] [-h]\n\n"
 #else
-	       "[Usage] acrnd [-t] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-j jobs] [-h]\n\n"
 #endif
 	       "[Options]\n"
 	       "\t-t: print messages to stdout\n"
+	       "\t-j: launch at most <jobs> VMs at a time, 0 (default) for no limit\n"
 #ifdef MNGR_DEBUG
 	       "\t-d: delay the autostarting of VMs, <0-60> in second\n"
 #endif
@@ -697,6 +1066,7 @@ static void display_usage(void)
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret = 0;
+	long jobs;
 #ifdef MNGR_DEBUG
 	long delay = 0;
 #endif
@@ -706,6 +1076,16 @@ static int parse_opt(int argc, char *argv[])
 		case 't':
 			logfile = 0;
 			break;
+		case 'j':
+			errno = 0;
+			jobs = strtol(optarg, NULL, 10);
+			if (errno != 0 || jobs < 0 || jobs > MAX_LAUNCH_VMS) {
+				printf("'-j' invalid parameter: %s\n", optarg);
+				return -EINVAL;
+			}
+
+			launch_jobs = (unsigned int)jobs;
+			break;
 #ifdef MNGR_DEBUG
 		case 'd':
 			delay = strtol(optarg, NULL, 10);
@@ -771,6 +1151,9 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* the launches of init_vm() wait for the DMs to notify */
+	mngr_add_handler(acrnd_fd, DM_NOTIFY, handle_dm_notify, NULL);
+
 	if (init_vm()) {
 		printf("%s: Failed to init_vm\n", __func__);
 		return -1;
@@ -795,12 +1178,11 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * Try to stop all the vms when receiving SIGTERM within VMS_STOP_TIMEOUT sec
-	 * gracefully. acrnd will exit after waiting maximal VMS_STOP_TIMEOUT sec.
-	 * System will kill all other vms which can not be stopped within VMS_STOP_TIMEOUT sec.
+	 * Try to stop all the vms when receiving SIGTERM gracefully, each within
+	 * its stop_timeout, VMS_STOP_TIMEOUT sec by default, and at the same time.
+	 * The vms which can not be stopped within it are stopped by force.
 	 */
 	stop_all_vms();
-	wait_for_stop(VMS_STOP_TIMEOUT);
 
 	return 0;
 }
@@ -45,7 +45,7 @@ static bool wait_post_vms_shutdown(void)
 	char command[64], buf[8];
 	char *endptr, *ret_str;
 	long val;
-	int check_time = SHUTDOWN_TIMEOUT/5;
+	int check_time = SHUTDOWN_TIMEOUT;
 	bool all_done = false;
 
 	snprintf(command, sizeof(command), "pgrep -u root -f acrn-dm | wc -l");
@@ -61,10 +61,12 @@ static bool wait_post_vms_shutdown(void)
 			break;
 		}
 		check_time--;
-		LOG_PRINTF("Wait post launched VMs shutdown check_time:%d, Running VM num:%ld\n",
-				check_time, val);
+		if ((check_time % 5) == 0)
+			LOG_PRINTF("Wait post launched VMs shutdown check_time:%d, Running VM num:%ld\n",
+					check_time, val);
 		pclose(fp);
-		sleep(5);
+		/* check often, the last user VM usually exits soon after its ACK */
+		sleep(1);
 	} while (check_time > 0);
 	return all_done;
 }
@@ -319,14 +321,18 @@ int ack_poweroff_handler(void *arg, int fd)
 {
 	struct channel_dev *c_dev = NULL;
 	struct uart_channel *c = (struct uart_channel *)arg;
+	bool stopped;
 
 	c_dev = find_uart_channel_dev(c, fd);
 	if (c_dev == NULL)
 		return 0;
 	LOG_PRINTF("Receive poweroff ACK from user VM (%s)\n", c_dev->name);
+	/* no need to give a user VM time to power off once its acrn-dm exited */
+	stopped = is_uart_channel_dev_vm_stopped(c_dev);
 	stop_uart_channel_dev_resend(c_dev);
 	disconnect_uart_channel_dev(c_dev, c);
-	usleep(WAIT_USER_VM_POWEROFF);
+	if (!stopped)
+		usleep(WAIT_USER_VM_POWEROFF);
 	if (system_reboot_request_flag) {
 		start_system_reboot();
 	} else {
@@ -20,11 +20,12 @@
 #include "config.h"
 
 /* it read from uart, and if end is '\0' or '\n' or len = buff-len it will return */
-static ssize_t try_receive_message_by_uart(int fd, void *buffer, size_t buf_len)
+static ssize_t try_receive_message_by_uart(int fd, void *buffer, size_t buf_len,
+					   unsigned int retry_times)
 {
 	ssize_t rc = 0U, count = 0U;
 	char *tmp;
-	unsigned int retry_times = RETRY_RECV_TIMES;
+	bool partial = false;
 
 	do {
 		/* NOTE: Now we can't handle multi command message at one time. */
@@ -42,6 +43,12 @@ static ssize_t try_receive_message_by_uart(int fd, void *buffer, size_t buf_len)
 			if (errno == EAGAIN) {
 				usleep(WAIT_RECV);
 				retry_times--;
+				/* the rest of a message begun is waited for as long as usual */
+				if ((count > 0) && !partial) {
+					partial = true;
+					if (retry_times < RETRY_RECV_TIMES)
+						retry_times = RETRY_RECV_TIMES;
+				}
 			} else {
 				break;
 			}
@@ -59,7 +66,18 @@ ssize_t receive_message_by_uart(struct uart_dev *dev, void *buf, size_t len)
 	if ((dev == NULL) || (buf == NULL) || (len == 0))
 		return -EINVAL;
 
-	return try_receive_message_by_uart(dev->tty_fd, buf, len);
+	return try_receive_message_by_uart(dev->tty_fd, buf, len, RETRY_RECV_TIMES);
+}
+/**
+ * @brief Receive message, waiting retry_times times WAIT_RECV for it to begin.
+ */
+ssize_t receive_message_by_uart_timeout(struct uart_dev *dev, void *buf, size_t len,
+					unsigned int retry_times)
+{
+	if ((dev == NULL) || (buf == NULL) || (len == 0) || (retry_times == 0))
+		return -EINVAL;
+
+	return try_receive_message_by_uart(dev->tty_fd, buf, len, retry_times);
 }
 ssize_t send_message_by_uart(struct uart_dev *dev, const void *buf, size_t len)
 {
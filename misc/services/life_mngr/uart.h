@@ -44,6 +44,12 @@ ssize_t send_message_by_uart(struct uart_dev *dev, const void *buf, size_t len);
  * avoid miss message in some cases.
  */
 ssize_t receive_message_by_uart(struct uart_dev *dev, void *buf, size_t len);
+/**
+ * @brief Receive message, waiting retry_times times WAIT_RECV for it to begin,
+ * and as long as receive_message_by_uart for the rest of it.
+ */
+ssize_t receive_message_by_uart_timeout(struct uart_dev *dev, void *buf, size_t len,
+					unsigned int retry_times);
 /**
  * @brief Get the file descriptor of a UART device
  */
@@ -16,6 +16,8 @@
 #include <pthread.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
+#include <dirent.h>
 #include "uart_channel.h"
 #include "log.h"
 #include "list.h"
@@ -35,6 +37,41 @@ static void parse_channel_dev_id(struct channel_dev *c_dev)
 					get_uart_dev_fd(c_dev->uart_device), c_dev->name);
 	}
 }
+static uint64_t get_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+/**
+ * @brief Check whether the acrn-dm of the user VM named name runs
+ *
+ * acrn-dm serves its monitor on DM_MONITOR_SOCK_PATH/<name>.monitor.<pid>.socket
+ * as long as it runs, which tells that a user VM powered off sooner than its ACK.
+ */
+static bool is_user_vm_dm_running(const char *name)
+{
+	DIR *dir;
+	struct dirent *entry;
+	size_t len = strnlen(name, CHANNEL_DEV_NAME_MAX);
+	bool running = false;
+
+	if (len == 0)
+		return false;
+	dir = opendir(DM_MONITOR_SOCK_PATH);
+	if (dir == NULL)
+		return false;
+	while ((entry = readdir(dir)) != NULL) {
+		if ((strncmp(entry->d_name, name, len) == 0) &&
+				(strncmp(entry->d_name + len, ".monitor.", strlen(".monitor.")) == 0)) {
+			running = true;
+			break;
+		}
+	}
+	closedir(dir);
+	return running;
+}
 static void add_uart_channel_dev_connection_list(struct channel_dev *c_dev)
 {
 	struct uart_channel *c = c_dev->channel;
@@ -132,29 +169,46 @@ void *poll_and_dispatch_uart_channel_events(void *arg)
 	struct uart_channel *c;
 
 	c = c_dev->channel;
+	uint64_t now;
+
 	sem_wait(&c_dev->dev_sem);
 	LOG_PRINTF("UART polling fd=%d...\n", get_uart_dev_fd(c_dev->uart_device));
 	while (c_dev->polling) {
 		memset(c_dev->buf, 0, sizeof(c_dev->buf));
-		num = receive_message_by_uart(c_dev->uart_device, (void *)c_dev->buf,
+		/**
+		 * Wait for an ACK in short windows, so that it is handled as soon as
+		 * it arrives, and the message is resent and given up on time.
+		 */
+		if (c_dev->resend_time > 0)
+			num = receive_message_by_uart_timeout(c_dev->uart_device, (void *)c_dev->buf,
+								sizeof(c_dev->buf), RESEND_RECV_TIMES);
+		else
+			num = receive_message_by_uart(c_dev->uart_device, (void *)c_dev->buf,
 								sizeof(c_dev->buf));
 		/**
 		 * Resend message if resend_time is set.
 		 */
-		if (num == 0) {
-			if (c_dev->resend_time > 1) {
-				usleep(LISTEN_INTERVAL + SECOND_TO_US);
+		if ((num == 0) && (c_dev->resend_time > 0)) {
+			now = get_now_ms();
+			if (now >= c_dev->resend_deadline) {
+				c_dev->resend_time = 1U;
+				memcpy(c_dev->buf, ACK_TIMEOUT, strlen(ACK_TIMEOUT));
+				num = strlen(ACK_TIMEOUT);
+			} else if (is_uart_channel_dev_vm_stopped(c_dev)) {
+				/* powered off without its ACK reaching us, no need to wait for it */
+				LOG_PRINTF("The acrn-dm of user VM (%s) exited\n", c_dev->name);
+				memcpy(c_dev->buf, ACK_POWEROFF, strlen(ACK_POWEROFF));
+				num = strlen(ACK_POWEROFF);
+			} else if ((now >= c_dev->resend_at) && (c_dev->resend_time > 1)) {
 				LOG_PRINTF("Resend (%s) to (%s)\n", c_dev->resend_buf, c_dev->name);
 				ret = send_message_by_uart(c_dev->uart_device, (void *)c_dev->resend_buf,
 								strlen(c_dev->resend_buf));
 				if (ret < 0)
 					LOG_WRITE("Send poweroff message to user VM fail\n");
 				c_dev->resend_time--;
-			} else if (c_dev->resend_time == 1) {
-				memcpy(c_dev->buf, ACK_TIMEOUT, strlen(ACK_TIMEOUT));
-				num = strlen(ACK_TIMEOUT);
+				c_dev->resend_at = now + RESEND_INTERVAL_MS;
 			} else {
-				/* No action if resend_time is 0 */
+				/* Wait for the ACK until the deadline */
 			}
 		}
 		if (num > 0) {
@@ -222,21 +276,41 @@ void stop_listen_uart_channel_dev(struct uart_channel *c)
 		}
 	}
 }
+static void set_uart_channel_dev_resend(struct channel_dev *c_dev, char *resend_buf,
+					unsigned int resend_time, uint64_t now, uint64_t deadline)
+{
+	strncpy(c_dev->resend_buf, resend_buf, CHANNEL_DEV_BUF_LEN - 1);
+	c_dev->resend_at = now + RESEND_INTERVAL_MS;
+	c_dev->resend_deadline = deadline;
+	/* only a poweroff can be acked by acrn-dm exiting, a reboot may reset it */
+	c_dev->dm_running = (strncmp(resend_buf, POWEROFF_CMD, sizeof(POWEROFF_CMD)) == 0) &&
+				is_user_vm_dm_running(c_dev->name);
+	c_dev->resend_time = resend_time + 1;
+}
 void start_uart_channel_dev_resend(struct channel_dev *c_dev, char *resend_buf, unsigned int resend_time)
 {
+	uint64_t now = get_now_ms();
+
 	if (resend_time < MIN_RESEND_TIME)
 		resend_time = MIN_RESEND_TIME;
-	strncpy(c_dev->resend_buf, resend_buf, CHANNEL_DEV_BUF_LEN - 1);
-	c_dev->resend_time = resend_time + 1;
+	set_uart_channel_dev_resend(c_dev, resend_buf, resend_time, now,
+				now + (resend_time + 1) * RESEND_TIMEOUT_MS);
 }
 void start_all_uart_channel_dev_resend(struct uart_channel *c, char *msg, unsigned int resend_time)
 {
 	struct channel_dev *c_dev;
+	uint64_t now = get_now_ms();
+	uint64_t deadline;
+
+	if (resend_time < MIN_RESEND_TIME)
+		resend_time = MIN_RESEND_TIME;
+	/* One deadline for all, whatever the number of user VMs */
+	deadline = now + (resend_time + 1) * RESEND_TIMEOUT_MS;
 
 	/* Enable resend for all connected uart channel devices */
 	pthread_mutex_lock(&c->tty_conn_list_lock);
 	LIST_FOREACH(c_dev, &c->tty_conn_head, list) {
-		start_uart_channel_dev_resend(c_dev, msg, resend_time);
+		set_uart_channel_dev_resend(c_dev, msg, resend_time, now, deadline);
 	}
 	pthread_mutex_unlock(&c->tty_conn_list_lock);
 }
@@ -245,6 +319,7 @@ void stop_uart_channel_dev_resend(struct channel_dev *c_dev)
 	if (c_dev->resend_time == 1U)
 		LOG_PRINTF("Timeout of receiving ACK message from (%s)\n", c_dev->name);
 	c_dev->resend_time = 0U;
+	c_dev->dm_running = false;
 	memset(c_dev->resend_buf, 0x0, CHANNEL_DEV_BUF_LEN);
 }
 /**
@@ -265,6 +340,10 @@ void notify_all_connected_uart_channel_dev(struct uart_channel *c, char *msg)
 	}
 	pthread_mutex_unlock(&c->tty_conn_list_lock);
 }
+bool is_uart_channel_dev_vm_stopped(struct channel_dev *c_dev)
+{
+	return c_dev->dm_running && !is_user_vm_dm_running(c_dev->name);
+}
 bool is_uart_channel_connection_list_empty(struct uart_channel *c)
 {
 	bool ret = false;
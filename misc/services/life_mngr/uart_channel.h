@@ -18,6 +18,16 @@
 #define MIN_RESEND_TIME 3U
 #define LISTEN_INTERVAL (5 * SECOND_TO_US)
 
+/* a message is resent this often until it is acked */
+#define RESEND_INTERVAL_MS ((LISTEN_INTERVAL + SECOND_TO_US) / 1000)
+/* and given up after this long per resend, as long as a full receive window */
+#define RESEND_TIMEOUT_MS (RESEND_INTERVAL_MS + RETRY_RECV_TIMES * WAIT_RECV / 1000)
+/* receive window while waiting for an ACK, to act on it and resend on time */
+#define RESEND_RECV_TIMES 4U
+
+/* the monitor sockets of acrn-dm, one per running post-launched user VM */
+#define DM_MONITOR_SOCK_PATH "/run/acrn/mngr"
+
 typedef void data_handler_f(const char *cmd_name, int fd);
 
 struct channel_dev {
@@ -37,6 +47,9 @@ struct channel_dev {
 	sem_t dev_sem; /**< semaphore used to start polling message */
 	char resend_buf[CHANNEL_DEV_BUF_LEN]; /**< store the message that will be sent */
 	unsigned int resend_time; /**< the time which the message will be resent */
+	uint64_t resend_at; /**< when to resend the message next, in ms of CLOCK_MONOTONIC */
+	uint64_t resend_deadline; /**< when to stop waiting for the ACK, in ms of CLOCK_MONOTONIC */
+	bool dm_running; /**< whether the acrn-dm of the user VM ran when the message was sent */
 };
 struct channel_config {
 	char identifier[CHANNEL_DEV_NAME_MAX]; /**< the user VM name which is configured by user */
@@ -128,6 +141,9 @@ void stop_listen_uart_channel_dev(struct uart_channel *c);
 void start_uart_channel_dev_resend(struct channel_dev *c_dev, char *resend_buf, unsigned int resend_time);
 /**
  * @brief Start to resend for all connected uart channel devices
+ *
+ * All the devices share one deadline for the ACK, they are sent and
+ * resent the message concurrently by their polling threads.
  */
 void start_all_uart_channel_dev_resend(struct uart_channel *c, char *msg, unsigned int resend_time);
 /**
@@ -138,6 +154,11 @@ void stop_uart_channel_dev_resend(struct channel_dev *c_dev);
  * @brief Broadcast message to each connected uart channel device
  */
 void notify_all_connected_uart_channel_dev(struct uart_channel *c, char *msg);
+/**
+ * @brief Check whether the acrn-dm of the user VM behind uart channel device exited
+ * since the message being resent was sent
+ */
+bool is_uart_channel_dev_vm_stopped(struct channel_dev *c_dev);
 /**
  * @brief Check whether uart channel connection list is empty or not
  */